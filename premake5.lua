@@ -263,6 +263,10 @@ solution("xenia")
   include("src/xenia/ui/vulkan")
   include("src/xenia/vfs")
 
+  if os.istarget("linux") then
+    include("src/xenia/apu/alsa")
+  end
+
   if os.istarget("windows") then
     include("src/xenia/apu/xaudio2")
     include("src/xenia/hid/winkey")
@@ -0,0 +1,255 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/app/benchmark.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/memory_usage.h"
+#include "xenia/base/string.h"
+#include "xenia/base/string_buffer.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/gpu/command_processor.h"
+#include "xenia/gpu/gpu_flags.h"
+#include "xenia/gpu/graphics_system.h"
+#include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/xthread.h"
+
+DEFINE_int32(benchmark_frames, 0,
+             "Run the title uncapped for this many guest swaps, then report "
+             "the frame times and exit. 0 runs normally.");
+DEFINE_int32(benchmark_warmup_frames, 60,
+             "Swaps to let pass before --benchmark_frames are measured.");
+DEFINE_string(benchmark_state, "",
+              "Save state to restore once the title is launched, before the "
+              "benchmark starts.");
+DEFINE_string(benchmark_report, "",
+              "Path to write the benchmark report to as JSON. Logged if "
+              "empty.");
+DEFINE_int32(benchmark_timeout_s, 600,
+             "Seconds to wait for the benchmark frames before giving up.");
+
+namespace xe {
+namespace app {
+
+namespace {
+
+void AppendJsonString(StringBuffer* sb, const std::string& value) {
+  sb->Append('"');
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      sb->Append('\\');
+      sb->Append(c);
+    } else if (uint8_t(c) < 0x20) {
+      sb->AppendFormat("\\u%04X", uint8_t(c));
+    } else {
+      sb->Append(c);
+    }
+  }
+  sb->Append('"');
+}
+
+// Nearest-rank percentile of the sorted values.
+uint64_t Percentile(const std::vector<uint64_t>& sorted, double percentile) {
+  size_t rank = size_t(std::ceil(percentile / 100.0 * sorted.size()));
+  return sorted[std::min(std::max(rank, size_t(1)), sorted.size()) - 1];
+}
+
+}  // namespace
+
+bool Benchmark::is_enabled() { return FLAGS_benchmark_frames > 0; }
+
+void Benchmark::ConfigureFlags() {
+  FLAGS_vsync = false;
+  FLAGS_frame_limit = 0;
+}
+
+Benchmark::Benchmark(Emulator* emulator)
+    : emulator_(emulator),
+      done_event_(xe::threading::Event::CreateManualResetEvent(false)) {
+  frame_ticks_.reserve(size_t(FLAGS_benchmark_frames));
+}
+
+bool Benchmark::Run() {
+  if (!FLAGS_benchmark_state.empty()) {
+    XELOGI("Benchmark: restoring %s", FLAGS_benchmark_state.c_str());
+    if (!emulator_->RestoreFromFile(xe::to_wstring(FLAGS_benchmark_state))) {
+      XELOGE("Benchmark: failed to restore the save state");
+      WriteReport(false);
+      return false;
+    }
+  }
+
+  emulator_->graphics_system()->command_processor()->on_swap.AddListener(
+      [this]() { OnSwap(); });
+  auto result = xe::threading::Wait(
+      done_event_.get(), false,
+      std::chrono::seconds(std::max(FLAGS_benchmark_timeout_s, 1)));
+  bool completed = result == xe::threading::WaitResult::kSuccess;
+  if (!completed) {
+    XELOGE("Benchmark: timed out waiting for %d frames",
+           FLAGS_benchmark_frames);
+  }
+  return WriteReport(completed) && completed;
+}
+
+void Benchmark::OnSwap() {
+  if (done_) {
+    return;
+  }
+  uint64_t tick = Clock::QueryHostTickCount();
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (done_) {
+    return;
+  }
+  ++swap_count_;
+  uint32_t warmup_count = uint32_t(std::max(FLAGS_benchmark_warmup_frames, 0));
+  if (swap_count_ == warmup_count + 1) {
+    begin_threads_ = SampleThreads();
+  } else if (swap_count_ > warmup_count + 1) {
+    frame_ticks_.push_back(tick - last_swap_tick_);
+    if (frame_ticks_.size() >= size_t(FLAGS_benchmark_frames)) {
+      end_threads_ = SampleThreads();
+      done_ = true;
+      done_event_->Set();
+    }
+  }
+  last_swap_tick_ = tick;
+}
+
+std::unordered_map<uint32_t, Benchmark::ThreadSample>
+Benchmark::SampleThreads() {
+  std::unordered_map<uint32_t, ThreadSample> samples;
+  auto threads = emulator_->kernel_state()
+                     ->object_table()
+                     ->GetObjectsByType<kernel::XThread>();
+  for (auto& thread : threads) {
+    if (!thread->is_running() || !thread->thread()) {
+      continue;
+    }
+    ThreadSample sample;
+    sample.name = thread->name();
+    sample.is_guest = thread->is_guest_thread();
+    sample.cpu_microseconds = thread->thread()->QueryCpuTimeMicroseconds();
+    samples[thread->thread_id()] = std::move(sample);
+  }
+  return samples;
+}
+
+bool Benchmark::WriteReport(bool completed) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // Nothing is recorded past this.
+  done_ = true;
+
+  double tick_ms = 1000.0 / double(Clock::host_tick_frequency());
+  StringBuffer sb;
+  sb.Append("{\n");
+  sb.AppendFormat("  \"title_id\": \"%.8X\",\n", emulator_->title_id());
+  sb.Append("  \"title\": ");
+  AppendJsonString(&sb, xe::to_string(emulator_->game_title()));
+  sb.Append(",\n  \"state\": ");
+  AppendJsonString(&sb, FLAGS_benchmark_state);
+  sb.AppendFormat(",\n  \"completed\": %s,\n", completed ? "true" : "false");
+  sb.AppendFormat("  \"frames\": %u,\n", uint32_t(frame_ticks_.size()));
+
+  if (!frame_ticks_.empty()) {
+    std::vector<uint64_t> sorted(frame_ticks_);
+    std::sort(sorted.begin(), sorted.end());
+    uint64_t total_ticks = 0;
+    for (uint64_t ticks : sorted) {
+      total_ticks += ticks;
+    }
+    sb.AppendFormat("  \"elapsed_seconds\": %.3f,\n",
+                    total_ticks * tick_ms / 1000.0);
+    sb.Append("  \"frame_time_ms\": {\n");
+    sb.AppendFormat("    \"average\": %.3f,\n",
+                    total_ticks * tick_ms / sorted.size());
+    sb.AppendFormat("    \"p50\": %.3f,\n", Percentile(sorted, 50) * tick_ms);
+    sb.AppendFormat("    \"p99\": %.3f,\n", Percentile(sorted, 99) * tick_ms);
+    sb.AppendFormat("    \"p99_9\": %.3f,\n",
+                    Percentile(sorted, 99.9) * tick_ms);
+    sb.AppendFormat("    \"max\": %.3f\n", sorted.back() * tick_ms);
+    sb.Append("  },\n");
+  }
+
+  // Only the threads that ran through the whole measurement.
+  sb.Append("  \"threads\": [");
+  bool first = true;
+  for (auto& it : end_threads_) {
+    auto begin_it = begin_threads_.find(it.first);
+    if (begin_it == begin_threads_.end()) {
+      continue;
+    }
+    auto& sample = it.second;
+    sb.Append(first ? "\n" : ",\n");
+    sb.AppendFormat("    {\"id\": %u, \"name\": ", it.first);
+    AppendJsonString(&sb, sample.name);
+    sb.AppendFormat(", \"guest\": %s, \"cpu_seconds\": %.3f}",
+                    sample.is_guest ? "true" : "false",
+                    (sample.cpu_microseconds -
+                     std::min(sample.cpu_microseconds,
+                              begin_it->second.cpu_microseconds)) /
+                        1000000.0);
+    first = false;
+  }
+  sb.Append("\n  ],\n");
+
+  auto jit_stats =
+      emulator_->processor()->translation_worker_pool()->QueryStats();
+  sb.Append("  \"jit\": {\n");
+  sb.AppendFormat("    \"queued\": %" PRIu64 ",\n", jit_stats.queued_count);
+  sb.AppendFormat("    \"translated\": %" PRIu64 ",\n",
+                  jit_stats.translated_count);
+  sb.AppendFormat("    \"tier_up\": %" PRIu64 ",\n", jit_stats.tier_up_count);
+  sb.AppendFormat("    \"stalls\": %" PRIu64 ",\n", jit_stats.stall_count);
+  sb.AppendFormat("    \"stall_seconds\": %.3f\n",
+                  jit_stats.stall_microseconds / 1000000.0);
+  sb.Append("  },\n");
+
+  // The code, texture and buffer caches.
+  sb.Append("  \"memory_usage\": [");
+  first = true;
+  for (auto& sample : MemoryUsageCounter::SampleAll()) {
+    sb.Append(first ? "\n" : ",\n");
+    sb.Append("    {\"counter\": ");
+    AppendJsonString(&sb, sample.name);
+    sb.AppendFormat(", \"bytes\": %" PRIu64 ", \"peak_bytes\": %" PRIu64 "}",
+                    sample.bytes, sample.peak_bytes);
+    first = false;
+  }
+  sb.Append("\n  ]\n}\n");
+
+  if (FLAGS_benchmark_report.empty()) {
+    XELOGI("Benchmark report:\n%s", sb.GetString());
+    return true;
+  }
+  FILE* file =
+      xe::filesystem::OpenFile(xe::to_wstring(FLAGS_benchmark_report), "w");
+  if (!file) {
+    XELOGE("Benchmark: unable to write %s", FLAGS_benchmark_report.c_str());
+    return false;
+  }
+  std::fwrite(sb.GetString(), 1, std::strlen(sb.GetString()), file);
+  std::fclose(file);
+  XELOGI("Benchmark: wrote %s", FLAGS_benchmark_report.c_str());
+  return true;
+}
+
+}  // namespace app
+}  // namespace xe
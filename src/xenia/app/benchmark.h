@@ -0,0 +1,73 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APP_BENCHMARK_H_
+#define XENIA_APP_BENCHMARK_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+#include "xenia/emulator.h"
+
+namespace xe {
+namespace app {
+
+// Runs the launched title for --benchmark_frames guest swaps as fast as the
+// host allows, optionally from a save state, then reports the frame times,
+// the host CPU time of every emulator thread and the JIT and cache
+// statistics as JSON, so builds can be compared on the same titles.
+class Benchmark {
+ public:
+  static bool is_enabled();
+  // Uncaps the frame rate. Done before the emulator is set up.
+  static void ConfigureFlags();
+
+  explicit Benchmark(Emulator* emulator);
+
+  // Restores the save state, if any, and measures the frames. Returns false
+  // if the state couldn't be restored or the frames weren't swapped in time,
+  // in which case the report says so.
+  bool Run();
+
+ private:
+  struct ThreadSample {
+    std::string name;
+    bool is_guest;
+    uint64_t cpu_microseconds;
+  };
+
+  void OnSwap();
+  std::unordered_map<uint32_t, ThreadSample> SampleThreads();
+  bool WriteReport(bool completed);
+
+  Emulator* emulator_;
+  std::unique_ptr<xe::threading::Event> done_event_;
+
+  // Written by OnSwap on the command processor thread until done.
+  std::mutex mutex_;
+  uint32_t swap_count_ = 0;
+  uint64_t last_swap_tick_ = 0;
+  // Host ticks of each measured frame.
+  std::vector<uint64_t> frame_ticks_;
+  std::atomic<bool> done_ = {false};
+
+  std::unordered_map<uint32_t, ThreadSample> begin_threads_;
+  std::unordered_map<uint32_t, ThreadSample> end_threads_;
+};
+
+}  // namespace app
+}  // namespace xe
+
+#endif  // XENIA_APP_BENCHMARK_H_
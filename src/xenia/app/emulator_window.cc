@@ -306,8 +306,9 @@ void EmulatorWindow::FileOpen() {
   file_picker->set_multi_selection(false);
   file_picker->set_title(L"Select Content Package");
   file_picker->set_extensions({
-      {L"Supported Files", L"*.iso;*.xex;*.xcp;*.*"},
+      {L"Supported Files", L"*.iso;*.xcdi;*.xex;*.xcp;*.*"},
       {L"Disc Image (*.iso)", L"*.iso"},
+      {L"Compressed Disc Image (*.xcdi)", L"*.xcdi"},
       {L"Xbox Executable (*.xex)", L"*.xex"},
       //{ L"Content Package (*.xcp)", L"*.xcp" },
       {L"All Files (*.*)", L"*.*"},
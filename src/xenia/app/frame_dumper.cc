@@ -0,0 +1,76 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/app/frame_dumper.h"
+
+#include <gflags/gflags.h>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+#include "xenia/gpu/command_processor.h"
+#include "xenia/gpu/graphics_system.h"
+#include "xenia/ui/graphics_context.h"
+
+// The implementation is in xenia-gpu, with the trace dumper.
+#undef _CRT_SECURE_NO_WARNINGS
+#undef _CRT_NONSTDC_NO_DEPRECATE
+#include "third_party/stb/stb_image_write.h"
+
+DEFINE_int32(frame_dump_interval, 0,
+             "Write every Nth guest frame to --frame_dump_path as a PNG. 0 "
+             "doesn't write any.");
+DEFINE_string(frame_dump_path, "frames",
+              "Folder to write the frames from --frame_dump_interval to.");
+
+namespace xe {
+namespace app {
+
+bool FrameDumper::is_enabled() { return FLAGS_frame_dump_interval > 0; }
+
+FrameDumper::FrameDumper(Emulator* emulator)
+    : emulator_(emulator),
+      path_(xe::to_absolute_path(xe::to_wstring(FLAGS_frame_dump_path))) {
+  if (!xe::filesystem::CreateFolder(path_)) {
+    XELOGE("Unable to create the frame dump folder %S", path_.c_str());
+    return;
+  }
+  XELOGI("Writing every %d frames to %S", FLAGS_frame_dump_interval,
+         path_.c_str());
+  emulator_->graphics_system()->command_processor()->on_swap.AddListener(
+      [this]() { OnSwap(); });
+}
+
+void FrameDumper::OnSwap() {
+  if (swap_count_++ % uint32_t(FLAGS_frame_dump_interval)) {
+    return;
+  }
+  // Nothing was drawn for it with --frame_skip.
+  if (emulator_->graphics_system()->command_processor()->last_frame_skipped()) {
+    return;
+  }
+
+  // The frontbuffer was just submitted, and captures go through the same
+  // queue, so this waits for the frame to finish rendering.
+  auto raw_image = emulator_->graphics_system()->Capture();
+  if (!raw_image) {
+    return;
+  }
+  auto png_path = xe::to_string(xe::join_paths(
+      path_, xe::format_string(L"%.8X_%.6u.png", emulator_->title_id(),
+                               swap_count_ - 1)));
+  if (!stbi_write_png(png_path.c_str(), int(raw_image->width),
+                      int(raw_image->height), 4, raw_image->data.data(),
+                      int(raw_image->stride))) {
+    XELOGE("Unable to write frame %s", png_path.c_str());
+  }
+}
+
+}  // namespace app
+}  // namespace xe
@@ -0,0 +1,42 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APP_FRAME_DUMPER_H_
+#define XENIA_APP_FRAME_DUMPER_H_
+
+#include <cstdint>
+#include <string>
+
+#include "xenia/emulator.h"
+
+namespace xe {
+namespace app {
+
+// Writes every --frame_dump_interval'th guest swap to --frame_dump_path as a
+// PNG, which is mostly how the output of a --headless run is looked at.
+// Must outlive the emulator's graphics system or be destroyed after it.
+class FrameDumper {
+ public:
+  static bool is_enabled();
+
+  explicit FrameDumper(Emulator* emulator);
+
+ private:
+  // Called on the command processor thread, right after the swap is issued.
+  void OnSwap();
+
+  Emulator* emulator_;
+  std::wstring path_;
+  uint32_t swap_count_ = 0;
+};
+
+}  // namespace app
+}  // namespace xe
+
+#endif  // XENIA_APP_FRAME_DUMPER_H_
@@ -67,6 +67,8 @@ project("xenia-app")
 
   filter("platforms:Linux")
     links({
+      "xenia-apu-alsa",
+      "asound",
       "X11",
       "xcb",
       "X11-xcb",
@@ -9,7 +9,9 @@
 
 #include <gflags/gflags.h>
 
+#include "xenia/app/benchmark.h"
 #include "xenia/app/emulator_window.h"
+#include "xenia/app/frame_dumper.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/main.h"
@@ -17,11 +19,15 @@
 #include "xenia/base/threading.h"
 #include "xenia/debug/ui/debug_window.h"
 #include "xenia/emulator.h"
+#include "xenia/kernel/kernel_state.h"
 #include "xenia/ui/file_picker.h"
 #include "xenia/vfs/devices/host_path_device.h"
 
 // Available audio systems:
 #include "xenia/apu/nop/nop_audio_system.h"
+#if XE_PLATFORM_LINUX
+#include "xenia/apu/alsa/alsa_audio_system.h"
+#endif  // XE_PLATFORM_LINUX
 #if XE_PLATFORM_WIN32
 #include "xenia/apu/xaudio2/xaudio2_audio_system.h"
 #endif  // XE_PLATFORM_WIN32
@@ -37,7 +43,7 @@
 #include "xenia/hid/xinput/xinput_hid.h"
 #endif  // XE_PLATFORM_WIN32
 
-DEFINE_string(apu, "any", "Audio system. Use: [any, nop, xaudio2]");
+DEFINE_string(apu, "any", "Audio system. Use: [any, nop, alsa, xaudio2]");
 DEFINE_string(gpu, "any", "Graphics system. Use: [any, vulkan, null]");
 DEFINE_string(hid, "any", "Input system. Use: [any, nop, winkey, xinput]");
 
@@ -55,6 +61,10 @@ namespace app {
 std::unique_ptr<apu::AudioSystem> CreateAudioSystem(cpu::Processor* processor) {
   if (FLAGS_apu.compare("nop") == 0) {
     return apu::nop::NopAudioSystem::Create(processor);
+#if XE_PLATFORM_LINUX
+  } else if (FLAGS_apu.compare("alsa") == 0) {
+    return apu::alsa::AlsaAudioSystem::Create(processor);
+#endif  // XE_PLATFORM_LINUX
 #if XE_PLATFORM_WIN32
   } else if (FLAGS_apu.compare("xaudio2") == 0) {
     return apu::xaudio2::XAudio2AudioSystem::Create(processor);
@@ -63,6 +73,13 @@ std::unique_ptr<apu::AudioSystem> CreateAudioSystem(cpu::Processor* processor) {
     // Create best available.
     std::unique_ptr<apu::AudioSystem> best;
 
+#if XE_PLATFORM_LINUX
+    best = apu::alsa::AlsaAudioSystem::Create(processor);
+    if (best) {
+      return best;
+    }
+#endif  // XE_PLATFORM_LINUX
+
 #if XE_PLATFORM_WIN32
     best = apu::xaudio2::XAudio2AudioSystem::Create(processor);
     if (best) {
@@ -100,7 +117,8 @@ std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() {
 std::vector<std::unique_ptr<hid::InputDriver>> CreateInputDrivers(
     ui::Window* window) {
   std::vector<std::unique_ptr<hid::InputDriver>> drivers;
-  if (FLAGS_hid.compare("nop") == 0) {
+  // Without a window there's nobody to take input from.
+  if (FLAGS_hid.compare("nop") == 0 || !window) {
     drivers.emplace_back(xe::hid::nop::Create(window));
 #if XE_PLATFORM_WIN32
   } else if (FLAGS_hid.compare("winkey") == 0) {
@@ -168,19 +186,33 @@ int xenia_main(const std::vector<std::wstring>& args) {
   // Create the emulator but don't initialize so we can setup the window.
   auto emulator = std::make_unique<Emulator>(L"", content_root);
 
-  // Main emulator display window.
-  auto emulator_window = EmulatorWindow::Create(emulator.get());
+  // Main emulator display window. Headless, the guest renders offscreen and
+  // nothing is presented.
+  std::unique_ptr<EmulatorWindow> emulator_window;
+  if (!FLAGS_headless) {
+    emulator_window = EmulatorWindow::Create(emulator.get());
+  }
+
+  if (Benchmark::is_enabled()) {
+    Benchmark::ConfigureFlags();
+  }
 
   // Setup and initialize all subsystems. If we can't do something
   // (unsupported system, memory issues, etc) this will fail early.
   X_STATUS result =
-      emulator->Setup(emulator_window->window(), CreateAudioSystem,
-                      CreateGraphicsSystem, CreateInputDrivers);
+      emulator->Setup(emulator_window ? emulator_window->window() : nullptr,
+                      CreateAudioSystem, CreateGraphicsSystem,
+                      CreateInputDrivers);
   if (XFAILED(result)) {
     XELOGE("Failed to setup emulator: %.8X", result);
     return 1;
   }
 
+  std::unique_ptr<FrameDumper> frame_dumper;
+  if (FrameDumper::is_enabled()) {
+    frame_dumper = std::make_unique<FrameDumper>(emulator.get());
+  }
+
   if (FLAGS_mount_scratch) {
     auto scratch_device = std::make_unique<xe::vfs::HostPathDevice>(
         "\\SCRATCH", L"scratch", false);
@@ -224,7 +256,9 @@ int xenia_main(const std::vector<std::wstring>& args) {
   // Set a debug handler.
   // This will respond to debugging requests so we can open the debug UI.
   std::unique_ptr<xe::debug::ui::DebugWindow> debug_window;
-  if (FLAGS_debug) {
+  if (FLAGS_debug && !emulator_window) {
+    XELOGW("The debugger UI isn't available headless");
+  } else if (FLAGS_debug) {
     emulator->processor()->set_debug_listener_request_handler(
         [&](xe::cpu::Processor* processor) {
           if (debug_window) {
@@ -246,27 +280,31 @@ int xenia_main(const std::vector<std::wstring>& args) {
 
   auto evt = xe::threading::Event::CreateAutoResetEvent(false);
   emulator->on_launch.AddListener([&]() {
-    emulator_window->UpdateTitle();
+    if (emulator_window) {
+      emulator_window->UpdateTitle();
+    }
     evt->Set();
   });
 
-  emulator_window->window()->on_closing.AddListener([&](ui::UIEvent* e) {
-    // This needs to shut down before the graphics context.
-    Profiler::Shutdown();
-  });
-
   bool exiting = false;
-  emulator_window->loop()->on_quit.AddListener([&](ui::UIEvent* e) {
-    exiting = true;
-    evt->Set();
-
-    // TODO(DrChat): Remove this code and do a proper exit.
-    XELOGI("Cheap-skate exit!");
-    exit(0);
-  });
-
-  // Enable the main menu now that the emulator is properly loaded
-  emulator_window->window()->EnableMainMenu();
+  if (emulator_window) {
+    emulator_window->window()->on_closing.AddListener([&](ui::UIEvent* e) {
+      // This needs to shut down before the graphics context.
+      Profiler::Shutdown();
+    });
+
+    emulator_window->loop()->on_quit.AddListener([&](ui::UIEvent* e) {
+      exiting = true;
+      evt->Set();
+
+      // TODO(DrChat): Remove this code and do a proper exit.
+      XELOGI("Cheap-skate exit!");
+      exit(0);
+    });
+
+    // Enable the main menu now that the emulator is properly loaded
+    emulator_window->window()->EnableMainMenu();
+  }
 
   // Grab path from the flag or unnamed argument.
   std::wstring path;
@@ -283,7 +321,13 @@ int xenia_main(const std::vector<std::wstring>& args) {
   }
 
   // Toggles fullscreen
-  if (FLAGS_fullscreen) emulator_window->ToggleFullscreen();
+  if (FLAGS_fullscreen && emulator_window) emulator_window->ToggleFullscreen();
+
+  if (!emulator_window && path.empty()) {
+    // There's no window to pick a title from.
+    XELOGE("Running headless needs a target to launch");
+    return 1;
+  }
 
   if (!path.empty()) {
     // Normalize the path and make absolute.
@@ -292,9 +336,18 @@ int xenia_main(const std::vector<std::wstring>& args) {
     if (XFAILED(result)) {
       xe::FatalError("Failed to launch target: %.8X", result);
       emulator.reset();
+      frame_dumper.reset();
       emulator_window.reset();
       return 1;
     }
+
+    if (Benchmark::is_enabled()) {
+      Benchmark benchmark(emulator.get());
+      bool succeeded = benchmark.Run();
+      // Same as closing the window, the title is left running.
+      XELOGI("Benchmark finished, exiting");
+      exit(succeeded ? 0 : 1);
+    }
   }
 
   // Now, we're going to use the main thread to drive events related to
@@ -310,10 +363,16 @@ int xenia_main(const std::vector<std::wstring>& args) {
         break;
       }
     }
+
+    // Headless, the run is over once the title exits.
+    if (!emulator_window) {
+      break;
+    }
   }
 
   debug_window.reset();
   emulator.reset();
+  frame_dumper.reset();
 
   Profiler::Dump();
   Profiler::Shutdown();
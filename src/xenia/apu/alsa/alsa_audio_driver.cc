@@ -0,0 +1,220 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/alsa/alsa_audio_driver.h"
+
+#include <alsa/asoundlib.h>
+#include <gflags/gflags.h>
+
+#include <algorithm>
+
+#include "xenia/apu/apu_flags.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+
+DEFINE_string(alsa_device, "default", "ALSA PCM device to play audio on.");
+DEFINE_int32(alsa_latency_ms, 40,
+             "Audio buffered by the ALSA device, in milliseconds, on top of "
+             "the frames queued by --apu_max_queued_frames.");
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+AlsaAudioDriver::AlsaAudioDriver(Memory* memory,
+                                 xe::threading::Semaphore* semaphore,
+                                 uint32_t queued_frame_count)
+    : AudioDriver(memory),
+      semaphore_(semaphore),
+      ring_slot_count_(queued_frame_count + 1) {}
+
+AlsaAudioDriver::~AlsaAudioDriver() { assert_null(pcm_); }
+
+bool AlsaAudioDriver::Initialize() {
+  int err = snd_pcm_open(&pcm_, FLAGS_alsa_device.c_str(),
+                         SND_PCM_STREAM_PLAYBACK, 0);
+  if (err < 0) {
+    XELOGE("snd_pcm_open(%s) failed: %s", FLAGS_alsa_device.c_str(),
+           snd_strerror(err));
+    pcm_ = nullptr;
+    return false;
+  }
+
+  unsigned int latency_us =
+      unsigned(std::max(FLAGS_alsa_latency_ms, 1)) * 1000;
+  // Let alsa-lib convert the format and rate where the device needs it.
+  for (uint32_t channels : {kFrameChannels, 2u}) {
+    err = snd_pcm_set_params(pcm_, SND_PCM_FORMAT_FLOAT_LE,
+                             SND_PCM_ACCESS_RW_INTERLEAVED, channels,
+                             kSampleRate, 1, latency_us);
+    if (err >= 0) {
+      output_channels_ = channels;
+      break;
+    }
+  }
+  if (err < 0) {
+    XELOGE("snd_pcm_set_params failed: %s", snd_strerror(err));
+    return false;
+  }
+  XELOGI("ALSA: playing on %s, %u channels, %d ms device buffer, %u frames "
+         "queued",
+         FLAGS_alsa_device.c_str(), output_channels_, FLAGS_alsa_latency_ms,
+         ring_slot_count_ - 1);
+
+  ring_.resize(ring_slot_count_ * output_channels_ * kChannelSamples);
+  silence_.resize(output_channels_ * kChannelSamples);
+
+  running_ = true;
+  playback_thread_ =
+      xe::threading::Thread::Create({}, [this]() { PlaybackThreadMain(); });
+  playback_thread_->set_name("ALSA Playback");
+  playback_thread_->set_priority(xe::threading::ThreadPriority::kHighest);
+  return true;
+}
+
+void AlsaAudioDriver::SubmitFrame(uint32_t frame_ptr) {
+  // Process samples! They are big-endian floats, one channel after another.
+  uint32_t write_index = ring_write_index_.load(std::memory_order_relaxed);
+  uint32_t next_index = (write_index + 1) % ring_slot_count_;
+  if (next_index == ring_read_index_.load(std::memory_order_acquire)) {
+    // Shouldn't happen as the client semaphore limits what's queued, but the
+    // client must not stall on a frame that's never played.
+    ++dropped_frames_;
+    semaphore_->Release(1, nullptr);
+    return;
+  }
+
+  auto input_frame = memory_->TranslateVirtual<float*>(frame_ptr);
+  float* output_frame = ring_slot(write_index);
+  if (output_channels_ == kFrameChannels) {
+    for (uint32_t index = 0, o = 0; index < kChannelSamples; ++index) {
+      for (uint32_t channel = 0, table = 0; channel < kFrameChannels;
+           ++channel, table += kChannelSamples) {
+        output_frame[o++] = xe::byte_swap(input_frame[table + index]);
+      }
+    }
+  } else {
+    // Front left, front right, center, LFE, back left, back right, with the
+    // center and back channels folded into the front ones at -3dB.
+    const float kFold = 0.7071f;
+    for (uint32_t index = 0; index < kChannelSamples; ++index) {
+      float channels[kFrameChannels];
+      for (uint32_t channel = 0; channel < kFrameChannels; ++channel) {
+        channels[channel] =
+            xe::byte_swap(input_frame[channel * kChannelSamples + index]);
+      }
+      float center = channels[2] * kFold;
+      output_frame[index * 2] =
+          xe::saturate(channels[0] + center + channels[4] * kFold);
+      output_frame[index * 2 + 1] =
+          xe::saturate(channels[1] + center + channels[5] * kFold);
+    }
+  }
+  ring_write_index_.store(next_index, std::memory_order_release);
+}
+
+void AlsaAudioDriver::PlaybackThreadMain() {
+#if XE_OPTION_PROFILING
+  static const MicroProfileToken underrun_token =
+      MicroProfileGetCounterToken("apu/alsa_underruns");
+  static const MicroProfileToken latency_token =
+      MicroProfileGetCounterToken("apu/alsa_latency_us");
+#endif  // XE_OPTION_PROFILING
+  while (running_) {
+    uint32_t read_index = ring_read_index_.load(std::memory_order_relaxed);
+    uint32_t write_index = ring_write_index_.load(std::memory_order_acquire);
+    bool have_frame = read_index != write_index;
+    const float* frame = silence_.data();
+    if (have_frame) {
+      if (!FLAGS_mute) {
+        frame = ring_slot(read_index);
+      }
+      started_ = true;
+    } else if (started_) {
+      ++underruns_;
+#if XE_OPTION_PROFILING
+      MicroProfileCounterAdd(underrun_token, 1);
+#endif  // XE_OPTION_PROFILING
+    }
+
+    snd_pcm_uframes_t remaining = kChannelSamples;
+    while (remaining && running_) {
+      snd_pcm_sframes_t written = snd_pcm_writei(
+          pcm_, frame + (kChannelSamples - remaining) * output_channels_,
+          remaining);
+      if (written < 0) {
+        ++xruns_;
+        written = snd_pcm_recover(pcm_, int(written), 1);
+        if (written < 0) {
+          XELOGE("snd_pcm_writei failed: %s", snd_strerror(int(written)));
+          running_ = false;
+          break;
+        }
+        continue;
+      }
+      remaining -= snd_pcm_uframes_t(written);
+    }
+
+    if (have_frame) {
+      ring_read_index_.store((read_index + 1) % ring_slot_count_,
+                             std::memory_order_release);
+      auto ret = semaphore_->Release(1, nullptr);
+      assert_true(ret);
+
+      // What's buffered by the device and still queued behind this frame.
+      snd_pcm_sframes_t delay = 0;
+      if (snd_pcm_delay(pcm_, &delay) < 0) {
+        delay = 0;
+      }
+      uint32_t queued = (ring_write_index_.load(std::memory_order_relaxed) +
+                         ring_slot_count_ - read_index - 1) %
+                        ring_slot_count_;
+      uint64_t latency_us =
+          (uint64_t(std::max(delay, snd_pcm_sframes_t(0))) +
+           uint64_t(queued) * kChannelSamples) *
+          1000000 / kSampleRate;
+      ++played_frames_;
+      total_latency_us_ += latency_us;
+      max_latency_us_ = std::max(max_latency_us_, latency_us);
+#if XE_OPTION_PROFILING
+      MicroProfileCounterSet(latency_token, int64_t(latency_us));
+#endif  // XE_OPTION_PROFILING
+    }
+  }
+}
+
+void AlsaAudioDriver::Shutdown() {
+  if (playback_thread_) {
+    running_ = false;
+    // At most a write's worth of the device buffer away.
+    xe::threading::Wait(playback_thread_.get(), false);
+    playback_thread_.reset();
+    XELOGI(
+        "ALSA: %llu frames played, %llu underruns, %llu xruns, %llu dropped, "
+        "latency avg %llu us, max %llu us",
+        static_cast<unsigned long long>(played_frames_),
+        static_cast<unsigned long long>(underruns_),
+        static_cast<unsigned long long>(xruns_),
+        static_cast<unsigned long long>(dropped_frames_.load()),
+        static_cast<unsigned long long>(
+            played_frames_ ? total_latency_us_ / played_frames_ : 0),
+        static_cast<unsigned long long>(max_latency_us_));
+  }
+  if (pcm_) {
+    snd_pcm_drop(pcm_);
+    snd_pcm_close(pcm_);
+    pcm_ = nullptr;
+  }
+}
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,83 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
+#define XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include "xenia/apu/audio_driver.h"
+#include "xenia/base/threading.h"
+
+typedef struct _snd_pcm snd_pcm_t;
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+// Plays a client's frames on an ALSA device from a thread of its own, which
+// alsa-lib paces by blocking on writes once the device buffer, sized by
+// --alsa_latency_ms, is full. Frames go from SubmitFrame to that thread
+// through a lock-free single producer, single consumer ring as deep as the
+// AudioSystem lets clients queue, and the client's semaphore is released as
+// each one is handed to the device. When the ring runs dry, silence is
+// written instead and counted as an underrun.
+class AlsaAudioDriver : public AudioDriver {
+ public:
+  AlsaAudioDriver(Memory* memory, xe::threading::Semaphore* semaphore,
+                  uint32_t queued_frame_count);
+  ~AlsaAudioDriver() override;
+
+  bool Initialize();
+  void SubmitFrame(uint32_t frame_ptr) override;
+  void Shutdown();
+
+ private:
+  void PlaybackThreadMain();
+  float* ring_slot(uint32_t index) {
+    return ring_.data() + index * output_channels_ * kChannelSamples;
+  }
+
+  static const uint32_t kFrameChannels = 6;
+  static const uint32_t kChannelSamples = 256;
+  static const uint32_t kSampleRate = 48000;
+
+  xe::threading::Semaphore* semaphore_ = nullptr;
+  snd_pcm_t* pcm_ = nullptr;
+  // 6, or 2 with the frames downmixed if the device can't take 5.1.
+  uint32_t output_channels_ = kFrameChannels;
+
+  // One slot more than the queue depth, so that full and empty differ.
+  uint32_t ring_slot_count_ = 0;
+  std::vector<float> ring_;
+  std::atomic<uint32_t> ring_read_index_ = {0};
+  std::atomic<uint32_t> ring_write_index_ = {0};
+  std::vector<float> silence_;
+
+  std::atomic<bool> running_ = {false};
+  std::unique_ptr<xe::threading::Thread> playback_thread_;
+
+  // Kept by the playback thread, and read once it has stopped.
+  bool started_ = false;
+  uint64_t played_frames_ = 0;
+  uint64_t underruns_ = 0;
+  uint64_t xruns_ = 0;
+  uint64_t total_latency_us_ = 0;
+  uint64_t max_latency_us_ = 0;
+  // Frames SubmitFrame found no room for.
+  std::atomic<uint64_t> dropped_frames_ = {0};
+};
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_ALSA_ALSA_AUDIO_DRIVER_H_
@@ -0,0 +1,56 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/alsa/alsa_audio_system.h"
+
+#include "xenia/apu/alsa/alsa_audio_driver.h"
+#include "xenia/apu/apu_flags.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+std::unique_ptr<AudioSystem> AlsaAudioSystem::Create(
+    cpu::Processor* processor) {
+  return std::make_unique<AlsaAudioSystem>(processor);
+}
+
+AlsaAudioSystem::AlsaAudioSystem(cpu::Processor* processor)
+    : AudioSystem(processor) {}
+
+AlsaAudioSystem::~AlsaAudioSystem() {}
+
+void AlsaAudioSystem::Initialize() { AudioSystem::Initialize(); }
+
+X_STATUS AlsaAudioSystem::CreateDriver(size_t index,
+                                       xe::threading::Semaphore* semaphore,
+                                       AudioDriver** out_driver) {
+  assert_not_null(out_driver);
+  auto driver =
+      new AlsaAudioDriver(memory_, semaphore, uint32_t(queued_frame_count()));
+  if (!driver->Initialize()) {
+    driver->Shutdown();
+    delete driver;
+    return X_STATUS_UNSUCCESSFUL;
+  }
+
+  *out_driver = driver;
+  return X_STATUS_SUCCESS;
+}
+
+void AlsaAudioSystem::DestroyDriver(AudioDriver* driver) {
+  assert_not_null(driver);
+  auto adriver = static_cast<AlsaAudioDriver*>(driver);
+  adriver->Shutdown();
+  delete adriver;
+}
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
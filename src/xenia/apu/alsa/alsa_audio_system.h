@@ -0,0 +1,38 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_ALSA_ALSA_AUDIO_SYSTEM_H_
+#define XENIA_APU_ALSA_ALSA_AUDIO_SYSTEM_H_
+
+#include "xenia/apu/audio_system.h"
+
+namespace xe {
+namespace apu {
+namespace alsa {
+
+class AlsaAudioSystem : public AudioSystem {
+ public:
+  explicit AlsaAudioSystem(cpu::Processor* processor);
+  ~AlsaAudioSystem() override;
+
+  static std::unique_ptr<AudioSystem> Create(cpu::Processor* processor);
+
+  X_RESULT CreateDriver(size_t index, xe::threading::Semaphore* semaphore,
+                        AudioDriver** out_driver) override;
+  void DestroyDriver(AudioDriver* driver) override;
+
+ protected:
+  void Initialize() override;
+};
+
+}  // namespace alsa
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_ALSA_ALSA_AUDIO_SYSTEM_H_
@@ -0,0 +1,19 @@
+project_root = "../../../.."
+include(project_root.."/tools/build")
+
+group("src")
+project("xenia-apu-alsa")
+  uuid("3c9a6a4e-8d1b-4f3a-9b5e-2f6c0d7e1a54")
+  kind("StaticLib")
+  language("C++")
+  links({
+    "asound",
+    "xenia-base",
+    "xenia-apu",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  local_platform_files()
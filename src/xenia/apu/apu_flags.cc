@@ -10,3 +10,10 @@
 #include "xenia/apu/apu_flags.h"
 
 DEFINE_bool(mute, false, "Mutes all audio output.");
+DEFINE_int32(apu_max_queued_frames, 64,
+             "Audio frames, of 256 samples each, a client may have queued for "
+             "playback, between 2 and 64. Lower is less latency but more "
+             "prone to underruns.");
+DEFINE_bool(apu_mix_clients, false,
+            "Mix the frames of all audio clients into one host stream, "
+            "instead of giving each its own voice.");
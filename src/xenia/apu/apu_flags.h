@@ -13,5 +13,7 @@
 #include <gflags/gflags.h>
 
 DECLARE_bool(mute);
+DECLARE_int32(apu_max_queued_frames);
+DECLARE_bool(apu_mix_clients);
 
 #endif  // XENIA_APU_APU_FLAGS_H_
@@ -0,0 +1,119 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/audio_mixer.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/platform.h"
+
+#if XE_ARCH_AMD64
+#include <immintrin.h>
+#endif  // XE_ARCH_AMD64
+
+namespace xe {
+namespace apu {
+
+namespace {
+
+// Adds big-endian samples to mix, swapping them on the way.
+void AddSwapped(float* mix, const float* samples, size_t count) {
+  size_t i = 0;
+#if XE_ARCH_AMD64
+  const __m128i shufmask =
+      _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
+                   0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
+  for (; i + 4 <= count; i += 4) {
+    __m128i input =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(&samples[i]));
+    __m128 value = _mm_castsi128_ps(_mm_shuffle_epi8(input, shufmask));
+    _mm_storeu_ps(&mix[i], _mm_add_ps(_mm_loadu_ps(&mix[i]), value));
+  }
+#endif  // XE_ARCH_AMD64
+  for (; i < count; ++i) {
+    mix[i] += xe::byte_swap(samples[i]);
+  }
+}
+
+}  // namespace
+
+AudioMixer::AudioMixer(size_t client_count, size_t max_queued_frames)
+    : max_queued_frames_(max_queued_frames),
+      clients_(client_count),
+      mix_(kFrameSamples) {}
+
+AudioMixer::~AudioMixer() = default;
+
+void AudioMixer::AddClient(size_t index) {
+  auto& client = clients_[index];
+  client.active = true;
+  client.frames.resize(max_queued_frames_ * kFrameSamples);
+  client.head = 0;
+  client.count = 0;
+}
+
+void AudioMixer::RemoveClient(size_t index) {
+  auto& client = clients_[index];
+  client.active = false;
+  client.frames.clear();
+  client.frames.shrink_to_fit();
+  client.count = 0;
+}
+
+bool AudioMixer::has_clients() const {
+  return std::any_of(clients_.begin(), clients_.end(),
+                     [](const Client& client) { return client.active; });
+}
+
+bool AudioMixer::SubmitFrame(size_t index, const float* frame,
+                             float* out_frame) {
+  auto& submitter = clients_[index];
+  assert_true(submitter.active);
+  if (submitter.count == max_queued_frames_) {
+    // The semaphores keep this from happening, but drop the oldest if so.
+    submitter.head = (submitter.head + 1) % max_queued_frames_;
+    --submitter.count;
+  }
+  size_t tail = (submitter.head + submitter.count) % max_queued_frames_;
+  std::memcpy(&submitter.frames[tail * kFrameSamples], frame,
+              kFrameSamples * sizeof(float));
+  ++submitter.count;
+
+  bool all_queued = true;
+  bool any_full = false;
+  for (auto& client : clients_) {
+    if (client.active) {
+      all_queued = all_queued && client.count;
+      any_full = any_full || client.count == max_queued_frames_;
+    }
+  }
+  if (!all_queued && !any_full) {
+    return false;
+  }
+
+  std::fill(mix_.begin(), mix_.end(), 0.0f);
+  for (auto& client : clients_) {
+    if (!client.active || !client.count) {
+      continue;
+    }
+    AddSwapped(mix_.data(), &client.frames[client.head * kFrameSamples],
+               kFrameSamples);
+    client.head = (client.head + 1) % max_queued_frames_;
+    --client.count;
+  }
+  xe::copy_and_swap_32_unaligned(out_frame, mix_.data(), kFrameSamples);
+  return true;
+}
+
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,59 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_AUDIO_MIXER_H_
+#define XENIA_APU_AUDIO_MIXER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+namespace apu {
+
+// Sums the frames of all clients into one, so that a single driver plays
+// them all with --apu_mix_clients. Frames are as clients submit them and
+// drivers take them: 6 channels of 256 big-endian float samples, one channel
+// after another. Each client's frames are queued until every client has one,
+// or until one of them has max_queued_frames, so that a client that stopped
+// submitting only holds the others back that long and is mixed as silence.
+// Not thread safe, AudioSystem calls it under its lock.
+class AudioMixer {
+ public:
+  static const size_t kFrameSamples = 6 * 256;
+
+  AudioMixer(size_t client_count, size_t max_queued_frames);
+  ~AudioMixer();
+
+  void AddClient(size_t index);
+  void RemoveClient(size_t index);
+  bool has_clients() const;
+
+  // Queues a frame of the client, and returns true with the next mixed frame
+  // in out_frame if one is ready.
+  bool SubmitFrame(size_t index, const float* frame, float* out_frame);
+
+ private:
+  struct Client {
+    bool active = false;
+    // A ring of max_queued_frames_ frames, still big-endian.
+    std::vector<float> frames;
+    size_t head = 0;
+    size_t count = 0;
+  };
+
+  size_t max_queued_frames_;
+  std::vector<Client> clients_;
+  std::vector<float> mix_;
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_AUDIO_MIXER_H_
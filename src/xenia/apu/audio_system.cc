@@ -11,6 +11,7 @@
 
 #include "xenia/apu/apu_flags.h"
 #include "xenia/apu/audio_driver.h"
+#include "xenia/apu/audio_mixer.h"
 #include "xenia/apu/xma_decoder.h"
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
@@ -36,20 +37,44 @@
 namespace xe {
 namespace apu {
 
+namespace {
+
+// Takes back the count of a client semaphore.
+void DrainSemaphore(xe::threading::Semaphore* semaphore) {
+  xe::threading::WaitResult wait_result;
+  do {
+    wait_result =
+        xe::threading::Wait(semaphore, false, std::chrono::milliseconds(0));
+  } while (wait_result == xe::threading::WaitResult::kSuccess);
+  assert_true(wait_result == xe::threading::WaitResult::kTimeout);
+}
+
+}  // namespace
+
 AudioSystem::AudioSystem(cpu::Processor* processor)
     : memory_(processor->memory()),
       processor_(processor),
       worker_running_(false) {
   std::memset(clients_, 0, sizeof(clients_));
 
+  queued_frame_count_ =
+      size_t(xe::clamp(FLAGS_apu_max_queued_frames, 2,
+                       int32_t(kMaximumQueuedFrames)));
   for (size_t i = 0; i < kMaximumClientCount; ++i) {
-    client_semaphores_[i] =
-        xe::threading::Semaphore::Create(0, kMaximumQueuedFrames);
+    client_semaphores_[i] = xe::threading::Semaphore::Create(
+        0, int(queued_frame_count_));
     wait_handles_[i] = client_semaphores_[i].get();
   }
   shutdown_event_ = xe::threading::Event::CreateAutoResetEvent(false);
   wait_handles_[kMaximumClientCount] = shutdown_event_.get();
 
+  if (FLAGS_apu_mix_clients) {
+    mixer_ =
+        std::make_unique<AudioMixer>(kMaximumClientCount, queued_frame_count_);
+    mix_semaphore_ =
+        xe::threading::Semaphore::Create(0, int(queued_frame_count_));
+  }
+
   xma_decoder_ = std::make_unique<xe::apu::XmaDecoder>(processor_);
 
   resume_event_ = xe::threading::Event::CreateAutoResetEvent(false);
@@ -90,15 +115,26 @@ void AudioSystem::WorkerThreadMain() {
     // These handles signify the number of submitted samples. Once we reach
     // 64 samples, we wait until our audio backend releases a semaphore
     // (signaling a sample has finished playing)
-    auto result =
-        xe::threading::WaitAny(wait_handles_, xe::countof(wait_handles_), true);
+    std::pair<xe::threading::WaitResult, size_t> result;
+    size_t shutdown_index;
+    if (mixer_) {
+      xe::threading::WaitHandle* mix_wait_handles[] = {mix_semaphore_.get(),
+                                                       shutdown_event_.get()};
+      result = xe::threading::WaitAny(mix_wait_handles,
+                                      xe::countof(mix_wait_handles), true);
+      shutdown_index = 1;
+    } else {
+      result = xe::threading::WaitAny(wait_handles_,
+                                      xe::countof(wait_handles_), true);
+      shutdown_index = kMaximumClientCount;
+    }
     if (result.first == xe::threading::WaitResult::kFailed) {
       // TODO: Assert?
       continue;
     }
 
     if (result.first == threading::WaitResult::kSuccess &&
-        result.second == kMaximumClientCount) {
+        result.second == shutdown_index) {
       // Shutdown event signaled.
       if (paused_) {
         pause_fence_.Signal();
@@ -110,7 +146,10 @@ void AudioSystem::WorkerThreadMain() {
 
     // Number of clients pumped
     bool pumped = false;
-    if (result.first == xe::threading::WaitResult::kSuccess) {
+    if (result.first == xe::threading::WaitResult::kSuccess && mixer_) {
+      PumpMixedClients();
+      pumped = true;
+    } else if (result.first == xe::threading::WaitResult::kSuccess) {
       auto index = result.second;
 
       auto global_lock = global_critical_region_.Acquire();
@@ -142,6 +181,28 @@ void AudioSystem::WorkerThreadMain() {
   // TODO(benvanik): call module API to kill?
 }
 
+void AudioSystem::PumpMixedClients() {
+  // One mixed frame was played, so every client renders another.
+  uint32_t callbacks[kMaximumClientCount][2];
+  size_t callback_count = 0;
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto& client : clients_) {
+    if (client.in_use && client.callback) {
+      callbacks[callback_count][0] = client.callback;
+      callbacks[callback_count][1] = client.wrapped_callback_arg;
+      ++callback_count;
+    }
+  }
+  global_lock.unlock();
+
+  for (size_t i = 0; i < callback_count; ++i) {
+    SCOPE_profile_cpu_i("apu", "xe::apu::AudioSystem->client_callback");
+    uint64_t args[] = {callbacks[i][1]};
+    processor_->Execute(worker_thread_->thread_state(), callbacks[i][0], args,
+                        xe::countof(args));
+  }
+}
+
 int AudioSystem::FindFreeClient() {
   for (int i = 0; i < kMaximumClientCount; i++) {
     auto& client = clients_[i];
@@ -169,16 +230,11 @@ X_STATUS AudioSystem::RegisterClient(uint32_t callback, uint32_t callback_arg,
   auto index = FindFreeClient();
   assert_true(index >= 0);
 
-  auto client_semaphore = client_semaphores_[index].get();
-  auto ret = client_semaphore->Release(kMaximumQueuedFrames, nullptr);
-  assert_true(ret);
-
-  AudioDriver* driver;
-  auto result = CreateDriver(index, client_semaphore, &driver);
+  AudioDriver* driver = nullptr;
+  auto result = CreateClientDriver(index, &driver);
   if (XFAILED(result)) {
     return result;
   }
-  assert_not_null(driver);
 
   uint32_t ptr = memory()->SystemHeapAlloc(0x4);
   xe::store_and_swap<uint32_t>(memory()->TranslateVirtual(ptr), callback_arg);
@@ -192,11 +248,52 @@ X_STATUS AudioSystem::RegisterClient(uint32_t callback, uint32_t callback_arg,
   return X_STATUS_SUCCESS;
 }
 
+X_STATUS AudioSystem::CreateClientDriver(size_t index,
+                                         AudioDriver** out_driver) {
+  if (!mixer_) {
+    auto client_semaphore = client_semaphores_[index].get();
+    auto ret = client_semaphore->Release(int(queued_frame_count_), nullptr);
+    assert_true(ret);
+
+    auto result = CreateDriver(index, client_semaphore, out_driver);
+    if (XFAILED(result)) {
+      return result;
+    }
+    assert_not_null(*out_driver);
+    return X_STATUS_SUCCESS;
+  }
+
+  if (!mix_driver_) {
+    auto result = CreateDriver(index, mix_semaphore_.get(), &mix_driver_);
+    if (XFAILED(result)) {
+      mix_driver_ = nullptr;
+      return result;
+    }
+    assert_not_null(mix_driver_);
+    mix_frame_ptr_ =
+        memory()->SystemHeapAlloc(AudioMixer::kFrameSamples * sizeof(float));
+    auto ret = mix_semaphore_->Release(int(queued_frame_count_), nullptr);
+    assert_true(ret);
+  }
+  mixer_->AddClient(index);
+  *out_driver = nullptr;
+  return X_STATUS_SUCCESS;
+}
+
 void AudioSystem::SubmitFrame(size_t index, uint32_t samples_ptr) {
   SCOPE_profile_cpu_f("apu");
 
   auto global_lock = global_critical_region_.Acquire();
   assert_true(index < kMaximumClientCount);
+  if (mixer_) {
+    assert_true(clients_[index].in_use);
+    auto frame = memory()->TranslateVirtual<const float*>(samples_ptr);
+    auto mix_frame = memory()->TranslateVirtual<float*>(mix_frame_ptr_);
+    if (mixer_->SubmitFrame(index, frame, mix_frame)) {
+      mix_driver_->SubmitFrame(mix_frame_ptr_);
+    }
+    return;
+  }
   assert_true(clients_[index].driver != NULL);
   (clients_[index].driver)->SubmitFrame(samples_ptr);
 }
@@ -206,18 +303,24 @@ void AudioSystem::UnregisterClient(size_t index) {
 
   auto global_lock = global_critical_region_.Acquire();
   assert_true(index < kMaximumClientCount);
-  DestroyDriver(clients_[index].driver);
+  if (mixer_) {
+    mixer_->RemoveClient(index);
+  } else {
+    DestroyDriver(clients_[index].driver);
+  }
   memory()->SystemHeapFree(clients_[index].wrapped_callback_arg);
   clients_[index] = {0};
 
+  if (mixer_ && mix_driver_ && !mixer_->has_clients()) {
+    DestroyDriver(mix_driver_);
+    mix_driver_ = nullptr;
+    memory()->SystemHeapFree(mix_frame_ptr_);
+    mix_frame_ptr_ = 0;
+    DrainSemaphore(mix_semaphore_.get());
+  }
+
   // Drain the semaphore of its count.
-  auto client_semaphore = client_semaphores_[index].get();
-  xe::threading::WaitResult wait_result;
-  do {
-    wait_result = xe::threading::Wait(client_semaphore, false,
-                                      std::chrono::milliseconds(0));
-  } while (wait_result == xe::threading::WaitResult::kSuccess);
-  assert_true(wait_result == xe::threading::WaitResult::kTimeout);
+  DrainSemaphore(client_semaphores_[index].get());
 }
 
 bool AudioSystem::Save(ByteStream* stream) {
@@ -262,7 +365,7 @@ bool AudioSystem::Restore(ByteStream* stream) {
     auto& client = clients_[id];
 
     // Reset the semaphore and recreate the driver ourselves.
-    if (client.driver) {
+    if (client.in_use) {
       UnregisterClient(id);
     }
 
@@ -272,12 +375,8 @@ bool AudioSystem::Restore(ByteStream* stream) {
 
     client.in_use = true;
 
-    auto client_semaphore = client_semaphores_[id].get();
-    auto ret = client_semaphore->Release(kMaximumQueuedFrames, nullptr);
-    assert_true(ret);
-
     AudioDriver* driver = nullptr;
-    auto status = CreateDriver(id, client_semaphore, &driver);
+    auto status = CreateClientDriver(id, &driver);
     if (XFAILED(status)) {
       XELOGE(
           "AudioSystem::Restore - Call to CreateDriver failed with status %.8X",
@@ -285,7 +384,6 @@ bool AudioSystem::Restore(ByteStream* stream) {
       return false;
     }
 
-    assert_not_null(driver);
     client.driver = driver;
   }
 
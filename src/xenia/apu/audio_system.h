@@ -24,6 +24,7 @@ namespace xe {
 namespace apu {
 
 class AudioDriver;
+class AudioMixer;
 class XmaDecoder;
 
 class AudioSystem {
@@ -65,9 +66,14 @@ class AudioSystem {
   // XAUDIO2_MAX_QUEUED_BUFFERS))
   static const size_t kMaximumQueuedFrames = 64;
 
+  // How many frames drivers may be given ahead of playback, from
+  // --apu_max_queued_frames.
+  size_t queued_frame_count() const { return queued_frame_count_; }
+
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
   std::unique_ptr<XmaDecoder> xma_decoder_;
+  size_t queued_frame_count_ = kMaximumQueuedFrames;
 
   std::atomic<bool> worker_running_ = {false};
   kernel::object_ref<kernel::XHostThread> worker_thread_;
@@ -83,6 +89,11 @@ class AudioSystem {
   } clients_[kMaximumClientCount];
 
   int FindFreeClient();
+  // Gives the client a driver of its own, or adds it to the mixer, in which
+  // case out_driver is null.
+  X_STATUS CreateClientDriver(size_t index, AudioDriver** out_driver);
+  // Runs the callbacks of all clients, for another frame to mix.
+  void PumpMixedClients();
 
   std::unique_ptr<xe::threading::Semaphore>
       client_semaphores_[kMaximumClientCount];
@@ -90,6 +101,15 @@ class AudioSystem {
   std::unique_ptr<xe::threading::Event> shutdown_event_;
   xe::threading::WaitHandle* wait_handles_[kMaximumClientCount + 1];
 
+  // With --apu_mix_clients, the clients share mix_driver_, created for the
+  // first one. It releases mix_semaphore_ as it plays each mixed frame, which
+  // has the worker call all clients back for the next one.
+  std::unique_ptr<AudioMixer> mixer_;
+  AudioDriver* mix_driver_ = nullptr;
+  std::unique_ptr<xe::threading::Semaphore> mix_semaphore_;
+  // Guest memory the mixed frames are handed to the driver in.
+  uint32_t mix_frame_ptr_ = 0;
+
   bool paused_ = false;
   threading::Fence pause_fence_;
   std::unique_ptr<threading::Event> resume_event_;
@@ -12,13 +12,17 @@
 #include <algorithm>
 #include <cstring>
 
+#include "xenia/apu/xma_decode_cache.h"
 #include "xenia/apu/xma_decoder.h"
 #include "xenia/apu/xma_helpers.h"
 #include "xenia/base/bit_stream.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
 
+#include "third_party/xxhash/xxhash.h"
+
 extern "C" {
 #include "third_party/libav/libavcodec/avcodec.h"
 #include "third_party/libav/libavcodec/xma2dec.h"
@@ -33,11 +37,20 @@ extern AVCodec ff_xma2_decoder;
 namespace xe {
 namespace apu {
 
+namespace {
+
+// libav doesn't allow codecs to be opened or closed on several threads at
+// once, and contexts are decoded on several XmaDecoder workers.
+std::mutex codec_open_mutex;
+
+}  // namespace
+
 XmaContext::XmaContext() = default;
 
 XmaContext::~XmaContext() {
   if (context_) {
     if (avcodec_is_open(context_)) {
+      std::lock_guard<std::mutex> codec_lock(codec_open_mutex);
       avcodec_close(context_);
     }
     av_free(context_);
@@ -50,10 +63,12 @@ XmaContext::~XmaContext() {
   }
 }
 
-int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr) {
+int XmaContext::Setup(uint32_t id, Memory* memory, uint32_t guest_ptr,
+                      XmaDecodeCache* decode_cache) {
   id_ = id;
   memory_ = memory;
   guest_ptr_ = guest_ptr;
+  decode_cache_ = decode_cache;
 
   // Allocate important stuff.
   codec_ = &ff_xma2_decoder;
@@ -106,8 +121,47 @@ bool XmaContext::Work() {
 
   set_is_enabled(false);
 
+#if XE_OPTION_PROFILING
+  if (profile_token_ == MICROPROFILE_INVALID_TOKEN) {
+    auto name = xe::format_string("XMA context %u", id_);
+    profile_token_ =
+        MicroProfileGetToken("apu", name.c_str(),
+                             xe::Profiler::GetColor(name.c_str()),
+                             MicroProfileTokenTypeCpu);
+  }
+  MicroProfileScopeHandler profile_scope(profile_token_);
+#endif  // XE_OPTION_PROFILING
+
+  auto context_ptr = memory()->TranslateVirtual(guest_ptr());
+  XMA_CONTEXT_DATA data(context_ptr);
+  DecodePackets(&data);
+  data.Store(context_ptr);
+  return true;
+}
+
+bool XmaContext::WorkAhead() {
+  std::unique_lock<std::mutex> lock(lock_, std::try_to_lock);
+  if (!lock.owns_lock() || !is_allocated() || !is_running_) {
+    return false;
+  }
+
   auto context_ptr = memory()->TranslateVirtual(guest_ptr());
   XMA_CONTEXT_DATA data(context_ptr);
+  if (!data.output_buffer_valid ||
+      (!data.input_buffer_0_valid && !data.input_buffer_1_valid)) {
+    return false;
+  }
+  // As in DecodePackets, only whole frames are written.
+  RingBuffer output_rb(nullptr,
+                       data.output_buffer_block_count * kBytesPerSubframe);
+  output_rb.set_read_offset(data.output_buffer_read_offset *
+                            kBytesPerSubframe);
+  output_rb.set_write_offset(data.output_buffer_write_offset *
+                             kBytesPerSubframe);
+  if (output_rb.write_count() < kBytesPerFrame * (data.is_stereo ? 2 : 1)) {
+    return false;
+  }
+
   DecodePackets(&data);
   data.Store(context_ptr);
   return true;
@@ -128,6 +182,7 @@ void XmaContext::Enable() {
   data.Store(context_ptr);
 
   set_is_enabled(true);
+  is_running_ = true;
 }
 
 bool XmaContext::Block(bool poll) {
@@ -144,6 +199,7 @@ bool XmaContext::Block(bool poll) {
 void XmaContext::Clear() {
   std::lock_guard<std::mutex> lock(lock_);
   XELOGAPU("XmaContext: reset context %d", id());
+  is_running_ = false;
 
   auto context_ptr = memory()->TranslateVirtual(guest_ptr());
   XMA_CONTEXT_DATA data(context_ptr);
@@ -162,6 +218,7 @@ void XmaContext::Disable() {
   std::lock_guard<std::mutex> lock(lock_);
   XELOGAPU("XmaContext: disabling context %d", id());
   set_is_enabled(false);
+  is_running_ = false;
 }
 
 void XmaContext::Release() {
@@ -170,6 +227,7 @@ void XmaContext::Release() {
   assert_true(is_allocated_ == true);
 
   set_is_allocated(false);
+  is_running_ = false;
   auto context_ptr = memory()->TranslateVirtual(guest_ptr());
   std::memset(context_ptr, 0, sizeof(XMA_CONTEXT_DATA));  // Zero it.
 }
@@ -208,11 +266,11 @@ size_t XmaContext::SavePartial(uint8_t* packet, uint32_t frame_offset_bits,
 
     return copy_bits;
   } else {
+    // Right after the bits saved so far, whether or not they end on the same
+    // bit within a byte as the rest starts at.
     size_t copy_bits = frame_size_bits - partial_frame_offset_bits_;
-    size_t copy_offset = stream.Copy(
-        buff +
-            ((partial_frame_offset_bits_ + partial_frame_start_offset_bits_) /
-             8),
+    stream.CopyBits(
+        buff, partial_frame_start_offset_bits_ + partial_frame_offset_bits_,
         copy_bits);
 
     partial_frame_offset_bits_ += copy_bits;
@@ -483,8 +541,40 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
                    num_channels);
 
     bool partial = false;
+    bool cached = false;
+    uint64_t frame_id = 0;
+    uint64_t frame_key = 0;
+    int invalid_frame = 0;  // invalid frame?
+    int got_frame = 0;      // successfully decoded a frame?
+    int frame_size = 0;
+    int len = 0;
+    if (decode_cache_) {
+      // Partial frames are only given an id, to key the frame after them.
+      if (partial_frame_saved_) {
+        frame_id = GetFrameId(partial_frame_buffer_.data(),
+                              partial_frame_buffer_.size(),
+                              partial_frame_start_offset_bits_);
+      } else {
+        frame_id = GetFrameId(current_input_buffer, current_input_size,
+                              data->input_buffer_read_offset);
+        uint64_t key_ids[2] = {output_frame_id_, frame_id};
+        frame_key = XXH64(key_ids, sizeof(key_ids), 0);
+        cached = decode_cache_->Lookup(frame_key, &len, &frame_size,
+                                       current_frame_);
+      }
+      if (!cached && decoded_frame_id_ != output_frame_id_) {
+        // Earlier frames came from the cache, so libav would overlap this one
+        // with the wrong frame. Start it over, as if after a seek.
+        ReopenDecoder();
+        uint64_t fresh_key_ids[2] = {0, frame_id};
+        frame_key = XXH64(fresh_key_ids, sizeof(fresh_key_ids), 0);
+      }
+    }
+
     size_t bit_offset = data->input_buffer_read_offset;
-    if (partial_frame_saved_) {
+    if (cached) {
+      got_frame = 1;
+    } else if (partial_frame_saved_) {
       XELOGAPU("XmaContext %d: processing saved partial frame", id());
       packet_->data = partial_frame_buffer_.data();
       packet_->size = (int)partial_frame_buffer_.size();
@@ -497,12 +587,13 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
       packet_->size = (int)current_input_size;
     }
 
-    int invalid_frame = 0;  // invalid frame?
-    int got_frame = 0;      // successfully decoded a frame?
-    int frame_size = 0;
-    int len =
-        xma2_decode_frame(context_, packet_, decoded_frame_, &got_frame,
-                          &invalid_frame, &frame_size, !partial, bit_offset);
+    if (!cached) {
+      len = xma2_decode_frame(context_, packet_, decoded_frame_, &got_frame,
+                              &invalid_frame, &frame_size, !partial,
+                              bit_offset);
+      decoded_frame_id_ = frame_id;
+    }
+    output_frame_id_ = frame_id;
     if (!partial && len == 0) {
       // Got the last frame of a packet. Advance the read offset to the next
       // packet.
@@ -573,19 +664,28 @@ void XmaContext::DecodePackets(XMA_CONTEXT_DATA* data) {
       // Copy to the output buffer.
       size_t written_bytes = 0;
 
-      // Validity checks.
-      assert(decoded_frame_->nb_samples <= kSamplesPerFrame);
-      assert(context_->sample_fmt == AV_SAMPLE_FMT_FLTP);
-
-      // Check the returned buffer size.
-      assert(av_samples_get_buffer_size(NULL, context_->channels,
-                                        decoded_frame_->nb_samples,
-                                        context_->sample_fmt, 1) ==
-             context_->channels * decoded_frame_->nb_samples * sizeof(float));
-
-      // Convert the frame.
-      ConvertFrame((const uint8_t**)decoded_frame_->data, context_->channels,
-                   decoded_frame_->nb_samples, current_frame_);
+      if (!cached) {
+        // Validity checks.
+        assert(decoded_frame_->nb_samples <= kSamplesPerFrame);
+        assert(context_->sample_fmt == AV_SAMPLE_FMT_FLTP);
+
+        // Check the returned buffer size.
+        assert(av_samples_get_buffer_size(NULL, context_->channels,
+                                          decoded_frame_->nb_samples,
+                                          context_->sample_fmt, 1) ==
+               context_->channels * decoded_frame_->nb_samples *
+                   sizeof(float));
+
+        // Convert the frame.
+        ConvertFrame((const uint8_t**)decoded_frame_->data,
+                     context_->channels, decoded_frame_->nb_samples,
+                     current_frame_);
+
+        if (decode_cache_ && !partial && len >= 0) {
+          decode_cache_->Insert(frame_key, len, frame_size, current_frame_,
+                                kBytesPerFrame * num_channels);
+        }
+      }
 
       assert_true(output_remaining_bytes >= kBytesPerFrame * num_channels);
       output_rb.Write(current_frame_, kBytesPerFrame * num_channels);
@@ -629,6 +729,7 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
   if (context_->sample_rate != sample_rate || context_->channels != channels) {
     // We have to reopen the codec so it'll realloc whatever data it needs.
     // TODO(DrChat): Find a better way.
+    std::lock_guard<std::mutex> codec_lock(codec_open_mutex);
     avcodec_close(context_);
 
     context_->sample_rate = sample_rate;
@@ -640,6 +741,8 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
       XELOGE("XmaContext: Failed to reopen libav context");
       return 1;
     }
+    decoded_frame_id_ = 0;
+    output_frame_id_ = 0;
   }
 
   av_frame_unref(decoded_frame_);
@@ -647,12 +750,53 @@ int XmaContext::PrepareDecoder(uint8_t* block, size_t size, int sample_rate,
   return 0;
 }
 
+int XmaContext::ReopenDecoder() {
+  std::lock_guard<std::mutex> codec_lock(codec_open_mutex);
+  avcodec_close(context_);
+  decoded_frame_id_ = 0;
+  output_frame_id_ = 0;
+  if (avcodec_open2(context_, codec_, NULL) < 0) {
+    XELOGE("XmaContext: Failed to reopen libav context");
+    return 1;
+  }
+  return 0;
+}
+
+uint64_t XmaContext::GetFrameId(uint8_t* block, size_t size,
+                                size_t bit_offset) {
+  // Frames are at most 0x7FFF bits, so they span up to 3 packets.
+  size_t packet_count = size / kBytesPerPacket;
+  size_t first_packet = bit_offset / (kBytesPerPacket * 8);
+  size_t end_packet = std::min(first_packet + 3, packet_count);
+  uint32_t params[3] = {uint32_t(bit_offset % (kBytesPerPacket * 8)),
+                        uint32_t(context_->sample_rate),
+                        uint32_t(context_->channels)};
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, params, sizeof(params));
+  XXH64_update(&hash_state, block + first_packet * kBytesPerPacket,
+               (end_packet - first_packet) * kBytesPerPacket);
+  return XXH64_digest(&hash_state);
+}
+
 bool XmaContext::ConvertFrame(const uint8_t** samples, int num_channels,
                               int num_samples, uint8_t* output_buffer) {
+  // Mono and stereo, which is all XMA has, take the vectorized kernels.
+  if (num_channels == 1) {
+    xe::convert_f32_to_s16_be(output_buffer,
+                              reinterpret_cast<const float*>(samples[0]),
+                              num_samples);
+    return true;
+  } else if (num_channels == 2) {
+    xe::convert_f32_to_s16_be_interleaved(
+        output_buffer, reinterpret_cast<const float*>(samples[0]),
+        reinterpret_cast<const float*>(samples[1]), num_samples);
+    return true;
+  }
+
   // Loop through every sample, convert and drop it into the output array.
   // If more than one channel, we need to interleave the samples from each
   // channel next to each other.
-  // TODO: This can definitely be optimized with AVX/SSE intrinsics!
   uint32_t o = 0;
   for (int i = 0; i < num_samples; i++) {
     for (int j = 0; j < num_channels; j++) {
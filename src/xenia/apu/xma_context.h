@@ -15,6 +15,7 @@
 #include <queue>
 #include <vector>
 
+#include "xenia/base/profiling.h"
 #include "xenia/memory.h"
 #include "xenia/xbox.h"
 
@@ -37,6 +38,8 @@ struct AVPacket;
 namespace xe {
 namespace apu {
 
+class XmaDecodeCache;
+
 // This is stored in guest space in big-endian order.
 // We load and swap the whole thing to splat here so that we can
 // use bitfields.
@@ -148,8 +151,21 @@ class XmaContext {
   explicit XmaContext();
   ~XmaContext();
 
-  int Setup(uint32_t id, Memory* memory, uint32_t guest_ptr);
+  // Host memory of the buffers allocated by Setup, not counting the state of
+  // the codec itself.
+  size_t host_buffer_size() const {
+    return partial_frame_buffer_.capacity() +
+           (current_frame_ ? kSamplesPerFrame * kBytesPerSample * 2 : 0);
+  }
+
+  // decode_cache may be null.
+  int Setup(uint32_t id, Memory* memory, uint32_t guest_ptr,
+            XmaDecodeCache* decode_cache);
   bool Work();
+  // Decodes ahead into the output buffer of a context kicked and not locked
+  // since, if its input is valid and its output has room for a frame, so that
+  // the guest rarely has to block on it. Skipped if the context is busy.
+  bool WorkAhead();
 
   void Enable();
   bool Block(bool poll);
@@ -191,6 +207,12 @@ class XmaContext {
   int DecodePacket(uint8_t* output, size_t offset, size_t size,
                    size_t* read_bytes);
 
+  // Identifies the frame at bit_offset in block by the packets it can span
+  // and the decode parameters, for the decode cache.
+  uint64_t GetFrameId(uint8_t* block, size_t size, size_t bit_offset);
+  // Drops what libav carries over from the frames decoded before.
+  int ReopenDecoder();
+
   Memory* memory_ = nullptr;
 
   uint32_t id_ = 0;
@@ -198,6 +220,13 @@ class XmaContext {
   std::mutex lock_;
   bool is_allocated_ = false;
   bool is_enabled_ = false;
+  // Kicked and not locked, cleared or released since.
+  bool is_running_ = false;
+
+#if XE_OPTION_PROFILING
+  // Created on the first decode, so that only contexts that are used show up.
+  MicroProfileToken profile_token_ = MICROPROFILE_INVALID_TOKEN;
+#endif  // XE_OPTION_PROFILING
 
   // libav structures
   AVCodec* codec_ = nullptr;
@@ -214,6 +243,12 @@ class XmaContext {
   std::vector<uint8_t> partial_frame_buffer_;
 
   uint8_t* current_frame_ = nullptr;
+
+  XmaDecodeCache* decode_cache_ = nullptr;
+  // The frames last given to libav and last output, which differ after cache
+  // hits, 0 for none since libav was opened.
+  uint64_t decoded_frame_id_ = 0;
+  uint64_t output_frame_id_ = 0;
 };
 
 }  // namespace apu
@@ -0,0 +1,102 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/apu/xma_decode_cache.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+
+DEFINE_int32(xma_decode_cache_mb, 0,
+             "Keep up to this many MB of decoded XMA frames to replay instead "
+             "of decoding them again, 0 to disable.");
+
+namespace xe {
+namespace apu {
+
+namespace {
+
+// The map node and the LRU node of an entry, roughly.
+const size_t kEntryOverhead = 64;
+
+}  // namespace
+
+std::unique_ptr<XmaDecodeCache> XmaDecodeCache::Create() {
+  if (FLAGS_xma_decode_cache_mb <= 0) {
+    return nullptr;
+  }
+  XELOGI("XMA decode cache: %d MB", FLAGS_xma_decode_cache_mb);
+  return std::make_unique<XmaDecodeCache>(
+      size_t(FLAGS_xma_decode_cache_mb) << 20);
+}
+
+XmaDecodeCache::XmaDecodeCache(size_t max_size) : max_size_(max_size) {}
+
+XmaDecodeCache::~XmaDecodeCache() = default;
+
+bool XmaDecodeCache::Lookup(uint64_t key, int* out_length,
+                            int* out_frame_size, uint8_t* out_samples) {
+#if XE_OPTION_PROFILING
+  static const MicroProfileToken hit_token =
+      MicroProfileGetCounterToken("apu/xma_decode_cache_hits");
+  static const MicroProfileToken miss_token =
+      MicroProfileGetCounterToken("apu/xma_decode_cache_misses");
+#endif  // XE_OPTION_PROFILING
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+#if XE_OPTION_PROFILING
+    MicroProfileCounterAdd(miss_token, 1);
+#endif  // XE_OPTION_PROFILING
+    return false;
+  }
+#if XE_OPTION_PROFILING
+  MicroProfileCounterAdd(hit_token, 1);
+#endif  // XE_OPTION_PROFILING
+  auto& entry = it->second;
+  lru_.splice(lru_.begin(), lru_, entry.lru_it);
+  *out_length = entry.length;
+  *out_frame_size = entry.frame_size;
+  std::memcpy(out_samples, entry.samples.data(),
+              entry.samples.size());
+  return true;
+}
+
+void XmaDecodeCache::Insert(uint64_t key, int length, int frame_size,
+                            const uint8_t* samples, size_t sample_bytes) {
+  size_t entry_size = sample_bytes + kEntryOverhead;
+  if (entry_size > max_size_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (entries_.count(key)) {
+    // Another context decoded the same frame meanwhile.
+    return;
+  }
+  while (size_ + entry_size > max_size_ && !lru_.empty()) {
+    auto evicted = entries_.find(lru_.back());
+    size_ -= evicted->second.samples.size() + kEntryOverhead;
+    entries_.erase(evicted);
+    lru_.pop_back();
+  }
+  lru_.push_front(key);
+  auto& entry = entries_[key];
+  entry.length = length;
+  entry.frame_size = frame_size;
+  entry.samples.assign(samples, samples + sample_bytes);
+  entry.lru_it = lru_.begin();
+  size_ += entry_size;
+}
+
+}  // namespace apu
+}  // namespace xe
@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_APU_XMA_DECODE_CACHE_H_
+#define XENIA_APU_XMA_DECODE_CACHE_H_
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace xe {
+namespace apu {
+
+// Decoded and converted XMA frames, shared by all contexts, so that looping
+// ambient tracks and sound effects played over and over skip libav after
+// their first time. XmaContext keys frames by the contents of the packets
+// they're in, their offset, the decode parameters and the frame decoded
+// before them, as the decoder overlaps each frame with the previous one.
+// Least recently used frames are dropped past --xma_decode_cache_mb.
+class XmaDecodeCache {
+ public:
+  // Null if --xma_decode_cache_mb is 0, the default.
+  static std::unique_ptr<XmaDecodeCache> Create();
+
+  explicit XmaDecodeCache(size_t max_size);
+  ~XmaDecodeCache();
+
+  // Copies the samples of the frame into out_samples, which must be as big as
+  // those inserted for it, along with the length and frame size that
+  // xma2_decode_frame returned for it, so that the context advances its read
+  // offset the same way. False on a miss.
+  bool Lookup(uint64_t key, int* out_length, int* out_frame_size,
+              uint8_t* out_samples);
+  void Insert(uint64_t key, int length, int frame_size, const uint8_t* samples,
+              size_t sample_bytes);
+
+ private:
+  struct Entry {
+    int length;
+    int frame_size;
+    std::vector<uint8_t> samples;
+    std::list<uint64_t>::iterator lru_it;
+  };
+
+  size_t max_size_;
+  std::mutex mutex_;
+  // Most recently used first.
+  std::list<uint64_t> lru_;
+  std::unordered_map<uint64_t, Entry> entries_;
+  size_t size_ = 0;
+};
+
+}  // namespace apu
+}  // namespace xe
+
+#endif  // XENIA_APU_XMA_DECODE_CACHE_H_
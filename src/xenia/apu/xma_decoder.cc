@@ -11,6 +11,9 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <chrono>
+
 #include "xenia/apu/xma_context.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -50,6 +53,13 @@ extern "C" {
 // using the XMA* functions.
 
 DEFINE_bool(libav_verbose, false, "Verbose libav output (debug and above)");
+DEFINE_int32(xma_decoder_threads, 0,
+             "Number of XMA decoder worker threads, 0 to pick one from the "
+             "number of logical processors.");
+DEFINE_int32(xma_lookahead_interval_ms, 2,
+             "Milliseconds between the checks of the running XMA contexts for "
+             "output room to decode ahead into, so that the guest rarely "
+             "blocks on them. 0 to only decode when contexts are kicked.");
 
 namespace xe {
 namespace apu {
@@ -113,77 +123,123 @@ X_STATUS XmaDecoder::Setup(kernel::KernelState* kernel_state) {
       context_data_first_ptr_;
 
   // Setup XMA contexts.
+  decode_cache_ = XmaDecodeCache::Create();
   for (int i = 0; i < kContextCount; ++i) {
     uint32_t guest_ptr = context_data_first_ptr_ + i * sizeof(XMA_CONTEXT_DATA);
     XmaContext& context = contexts_[i];
-    if (context.Setup(i, memory(), guest_ptr)) {
+    if (context.Setup(i, memory(), guest_ptr, decode_cache_.get())) {
       assert_always();
     }
+    memory_usage_.Add(context.host_buffer_size());
   }
   register_file_[XE_XMA_REG_NEXT_CONTEXT_INDEX].u32 = 1;
   context_bitmap_.Resize(kContextCount);
 
+  uint32_t worker_count = uint32_t(std::max(FLAGS_xma_decoder_threads, 0));
+  if (!worker_count) {
+    // Most titles only have a handful of contexts playing at once, so a few
+    // threads are plenty and leave the rest to the CPU and GPU.
+    uint32_t processor_count = xe::threading::logical_processor_count();
+    worker_count = std::min(4u, std::max(1u, processor_count / 4));
+  }
+  worker_count = std::min(worker_count, kContextCount);
+
   worker_running_ = true;
-  work_event_ = xe::threading::Event::CreateAutoResetEvent(false);
-  worker_thread_ = kernel::object_ref<kernel::XHostThread>(
-      new kernel::XHostThread(kernel_state, 128 * 1024, 0, [this]() {
-        WorkerThreadMain();
-        return 0;
-      }));
-  worker_thread_->set_name("XMA Decoder Worker");
-  worker_thread_->set_can_debugger_suspend(true);
-  worker_thread_->Create();
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    auto worker = std::make_unique<Worker>();
+    worker->index = i;
+    for (uint32_t n = i; n < kContextCount; n += worker_count) {
+      worker->context_masks[n / 32] |= 1u << (n % 32);
+    }
+    worker->work_event = xe::threading::Event::CreateAutoResetEvent(false);
+    auto worker_ptr = worker.get();
+    worker->thread = kernel::object_ref<kernel::XHostThread>(
+        new kernel::XHostThread(kernel_state, 128 * 1024, 0, [=]() {
+          WorkerThreadMain(worker_ptr);
+          return 0;
+        }));
+    worker->thread->set_name(xe::format_string("XMA Decoder Worker %u", i));
+    worker->thread->set_can_debugger_suspend(true);
+    workers_.push_back(std::move(worker));
+  }
+  for (auto& worker : workers_) {
+    worker->thread->Create();
+  }
 
   return X_STATUS_SUCCESS;
 }
 
-void XmaDecoder::WorkerThreadMain() {
-  uint32_t idle_loop_count = 0;
+void XmaDecoder::WorkerThreadMain(Worker* worker) {
   while (worker_running_) {
-    // Okay, let's loop through XMA contexts to find ones we need to decode!
-    bool did_work = false;
-    for (uint32_t n = 0; n < kContextCount; n++) {
-      XmaContext& context = contexts_[n];
-      did_work = context.Work() || did_work;
-
-      // TODO: Need thread safety to do this.
-      // Probably not too important though.
-      // registers_.current_context = n;
-      // registers_.next_context = (n + 1) % kContextCount;
-    }
-
     if (paused_) {
-      pause_fence_.Signal();
-      resume_fence_.Wait();
+      worker->pause_fence.Signal();
+      worker->resume_fence.Wait();
+      continue;
     }
 
-    if (!did_work) {
-      idle_loop_count++;
-    } else {
-      idle_loop_count = 0;
+    // Take the contexts of ours that were kicked and decode them. A kick
+    // landing after this sets its bit again and the event, so it's either
+    // picked up here or wakes the wait below.
+    bool had_pending = false;
+    for (uint32_t word = 0; word < kContextWordCount; ++word) {
+      uint32_t mask = worker->context_masks[word];
+      uint32_t bits = pending_contexts_[word].fetch_and(~mask) & mask;
+      had_pending = had_pending || bits;
+      uint32_t bit;
+      while (xe::bit_scan_forward(bits, &bit)) {
+        bits &= ~(1u << bit);
+        XmaContext& context = contexts_[word * 32 + bit];
+        context.Work();
+
+        // TODO: Need thread safety to do this.
+        // Probably not too important though.
+        // registers_.current_context = n;
+        // registers_.next_context = (n + 1) % kContextCount;
+      }
     }
 
-    if (idle_loop_count > 500) {
-      // Idle for an extended period. Introduce a 20ms wait.
-      xe::threading::Wait(work_event_.get(), false,
-                          std::chrono::milliseconds(20));
+    if (!had_pending) {
+      if (FLAGS_xma_lookahead_interval_ms > 0 && WorkAhead(worker)) {
+        // The guest frees output room without kicking.
+        xe::threading::Wait(
+            worker->work_event.get(), false,
+            std::chrono::milliseconds(FLAGS_xma_lookahead_interval_ms));
+      } else {
+        xe::threading::Wait(worker->work_event.get(), false);
+      }
     }
+  }
+}
 
-    xe::threading::MaybeYield();
+bool XmaDecoder::WorkAhead(Worker* worker) {
+  bool any_running = false;
+  for (uint32_t word = 0; word < kContextWordCount; ++word) {
+    uint32_t bits = running_contexts_[word] & worker->context_masks[word];
+    any_running = any_running || bits;
+    uint32_t bit;
+    while (xe::bit_scan_forward(bits, &bit)) {
+      bits &= ~(1u << bit);
+      contexts_[word * 32 + bit].WorkAhead();
+    }
   }
+  return any_running;
 }
 
 void XmaDecoder::Shutdown() {
   worker_running_ = false;
-  work_event_->Set();
+  for (auto& worker : workers_) {
+    worker->work_event->Set();
+  }
 
   if (paused_) {
     Resume();
   }
 
-  // Wait for work thread.
-  xe::threading::Wait(worker_thread_->thread(), false);
-  worker_thread_.reset();
+  // Wait for work threads.
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker->thread->thread(), false);
+  }
+  workers_.clear();
 
   if (context_data_first_ptr_) {
     memory()->SystemHeapFree(context_data_first_ptr_);
@@ -222,6 +278,7 @@ void XmaDecoder::ReleaseContext(uint32_t guest_ptr) {
 
   XmaContext& context = contexts_[context_id];
   assert_true(context.is_allocated());
+  running_contexts_[context_id / 32].fetch_and(~(1u << (context_id % 32)));
   context.Release();
   context_bitmap_.Release(context_id);
 }
@@ -298,6 +355,7 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
 
     // The context ID is a bit in the range of the entire context array.
     uint32_t base_context_id = (r - XE_XMA_REG_CONTEXT_KICK_0) * 32;
+    uint32_t context_mask = value;
     for (int i = 0; value && i < 32; ++i, value >>= 1) {
       if (value & 1) {
         uint32_t context_id = base_context_id + i;
@@ -306,13 +364,16 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
       }
     }
 
-    // Signal the decoder thread to start processing.
-    work_event_->Set();
+    // Mark them pending and signal the decoder threads to start processing.
+    running_contexts_[r - XE_XMA_REG_CONTEXT_KICK_0].fetch_or(context_mask);
+    pending_contexts_[r - XE_XMA_REG_CONTEXT_KICK_0].fetch_or(context_mask);
+    SignalWorkers(base_context_id, context_mask);
   } else if (r >= XE_XMA_REG_CONTEXT_LOCK_0 && r <= XE_XMA_REG_CONTEXT_LOCK_9) {
     // Context lock command.
     // This requests a lock by flagging the context.
     // XMADisableContext
     uint32_t base_context_id = (r - XE_XMA_REG_CONTEXT_LOCK_0) * 32;
+    running_contexts_[r - XE_XMA_REG_CONTEXT_LOCK_0].fetch_and(~value);
     for (int i = 0; value && i < 32; ++i, value >>= 1) {
       if (value & 1) {
         uint32_t context_id = base_context_id + i;
@@ -320,14 +381,12 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
         context.Disable();
       }
     }
-
-    // Signal the decoder thread to start processing.
-    work_event_->Set();
   } else if (r >= XE_XMA_REG_CONTEXT_CLEAR_0 &&
              r <= XE_XMA_REG_CONTEXT_CLEAR_9) {
     // Context clear command.
     // This will reset the given hardware contexts.
     uint32_t base_context_id = (r - XE_XMA_REG_CONTEXT_CLEAR_0) * 32;
+    running_contexts_[r - XE_XMA_REG_CONTEXT_CLEAR_0].fetch_and(~value);
     for (int i = 0; value && i < 32; ++i, value >>= 1) {
       if (value & 1) {
         uint32_t context_id = base_context_id + i;
@@ -338,13 +397,39 @@ void XmaDecoder::WriteRegister(uint32_t addr, uint32_t value) {
   }
 }
 
+void XmaDecoder::SignalWorkers(uint32_t base_context_id,
+                               uint32_t context_mask) {
+  uint32_t worker_count = uint32_t(workers_.size());
+  if (worker_count > 32) {
+    for (auto& worker : workers_) {
+      worker->work_event->Set();
+    }
+    return;
+  }
+  uint32_t worker_mask = 0;
+  for (int i = 0; context_mask && i < 32; ++i, context_mask >>= 1) {
+    if (context_mask & 1) {
+      worker_mask |= 1u << ((base_context_id + i) % worker_count);
+    }
+  }
+  for (uint32_t i = 0; worker_mask; ++i, worker_mask >>= 1) {
+    if (worker_mask & 1) {
+      workers_[i]->work_event->Set();
+    }
+  }
+}
+
 void XmaDecoder::Pause() {
   if (paused_) {
     return;
   }
   paused_ = true;
 
-  pause_fence_.Wait();
+  for (auto& worker : workers_) {
+    // Idle workers wait for a kick.
+    worker->work_event->Set();
+    worker->pause_fence.Wait();
+  }
 }
 
 void XmaDecoder::Resume() {
@@ -353,7 +438,9 @@ void XmaDecoder::Resume() {
   }
   paused_ = false;
 
-  resume_fence_.Signal();
+  for (auto& worker : workers_) {
+    worker->resume_fence.Signal();
+  }
 }
 
 }  // namespace apu
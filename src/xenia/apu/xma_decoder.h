@@ -13,10 +13,13 @@
 #include <atomic>
 #include <mutex>
 #include <queue>
+#include <vector>
 
 #include "xenia/apu/xma_context.h"
+#include "xenia/apu/xma_decode_cache.h"
 #include "xenia/apu/xma_register_file.h"
 #include "xenia/base/bit_map.h"
+#include "xenia/base/memory_usage.h"
 #include "xenia/kernel/xthread.h"
 #include "xenia/xbox.h"
 
@@ -55,7 +58,28 @@ class XmaDecoder {
   int GetContextId(uint32_t guest_ptr);
 
  private:
-  void WorkerThreadMain();
+  static const uint32_t kContextCount = 320;
+  // Words of pending_contexts_, one per KICK register.
+  static const uint32_t kContextWordCount = kContextCount / 32;
+
+  // Contexts are statically owned by worker id % workers_.size(), so a
+  // context is only ever decoded on one thread and in the order it is kicked.
+  struct Worker {
+    uint32_t index = 0;
+    // The bits of owned contexts in each word of pending_contexts_.
+    uint32_t context_masks[kContextWordCount] = {};
+    kernel::object_ref<kernel::XHostThread> thread;
+    std::unique_ptr<xe::threading::Event> work_event;
+    xe::threading::Fence pause_fence;   // Signaled when worker paused.
+    xe::threading::Fence resume_fence;  // Signaled when resume requested.
+  };
+
+  void WorkerThreadMain(Worker* worker);
+  // Decodes ahead in the running contexts of the worker. Returns whether any
+  // is running.
+  bool WorkAhead(Worker* worker);
+  // Wakes the workers owning the contexts of a KICK register.
+  void SignalWorkers(uint32_t base_context_id, uint32_t context_mask);
 
   static uint32_t MMIOReadRegisterThunk(void* ppc_context, XmaDecoder* as,
                                         uint32_t addr) {
@@ -71,18 +95,22 @@ class XmaDecoder {
   cpu::Processor* processor_ = nullptr;
 
   std::atomic<bool> worker_running_ = {false};
-  kernel::object_ref<kernel::XHostThread> worker_thread_;
-  std::unique_ptr<xe::threading::Event> work_event_ = nullptr;
+  std::vector<std::unique_ptr<Worker>> workers_;
 
-  bool paused_ = false;
-  xe::threading::Fence pause_fence_;   // Signaled when worker paused.
-  xe::threading::Fence resume_fence_;  // Signaled when resume requested.
+  std::atomic<bool> paused_ = {false};
 
   XmaRegisterFile register_file_;
 
-  static const uint32_t kContextCount = 320;
+  std::unique_ptr<XmaDecodeCache> decode_cache_;
   XmaContext contexts_[kContextCount];
+  // Contexts kicked since their worker last looked, as the KICK registers lay
+  // them out. Workers only visit the contexts set in it.
+  std::atomic<uint32_t> pending_contexts_[kContextWordCount] = {};
+  // Contexts kicked and not locked, cleared or released since, laid out the
+  // same, which workers decode ahead in (--xma_lookahead_interval_ms).
+  std::atomic<uint32_t> running_contexts_[kContextWordCount] = {};
   BitMap context_bitmap_;
+  MemoryUsageCounter memory_usage_{"apu/xma_contexts"};
 
   uint32_t context_data_first_ptr_ = 0;
   uint32_t context_data_last_ptr_ = 0;
@@ -0,0 +1,395 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/aes_cbc.h"
+
+#include <cstring>
+
+#include "xenia/base/platform.h"
+
+#if XE_ARCH_AMD64
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#define XE_AES_NI_TARGET
+#else
+#include <cpuid.h>
+#define XE_AES_NI_TARGET __attribute__((target("aes,sse2")))
+#endif  // XE_COMPILER_MSVC
+#endif  // XE_ARCH_AMD64
+
+#include "third_party/crypto/rijndael-alg-fst.c"
+#include "third_party/crypto/rijndael-alg-fst.h"
+
+namespace xe {
+
+#if XE_ARCH_AMD64
+
+XE_AES_NI_TARGET static __m128i ExpandKeyStep(__m128i key, __m128i assist) {
+  assist = _mm_shuffle_epi32(assist, _MM_SHUFFLE(3, 3, 3, 3));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  key = _mm_xor_si128(key, _mm_slli_si128(key, 4));
+  return _mm_xor_si128(key, assist);
+}
+
+XE_AES_NI_TARGET static void ExpandDecryptionKeys(const uint8_t key[16],
+                                                  uint8_t out_keys[11][16]) {
+  __m128i enc[11];
+  enc[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(key));
+  // The round constant has to be an immediate.
+#define EXPAND(n, rcon)       \
+  enc[n] = ExpandKeyStep( \
+      enc[n - 1], _mm_aeskeygenassist_si128(enc[n - 1], rcon))
+  EXPAND(1, 0x01);
+  EXPAND(2, 0x02);
+  EXPAND(3, 0x04);
+  EXPAND(4, 0x08);
+  EXPAND(5, 0x10);
+  EXPAND(6, 0x20);
+  EXPAND(7, 0x40);
+  EXPAND(8, 0x80);
+  EXPAND(9, 0x1B);
+  EXPAND(10, 0x36);
+#undef EXPAND
+  auto out = reinterpret_cast<__m128i*>(out_keys);
+  _mm_store_si128(out + 0, enc[10]);
+  for (int i = 1; i < 10; ++i) {
+    _mm_store_si128(out + i, _mm_aesimc_si128(enc[10 - i]));
+  }
+  _mm_store_si128(out + 10, enc[0]);
+}
+
+#endif  // XE_ARCH_AMD64
+
+bool AesCbcDecryptor::host_has_aes_ni() {
+#if XE_ARCH_AMD64
+#if XE_COMPILER_MSVC
+  int regs[4];
+  __cpuid(regs, 1);
+  uint32_t ecx = uint32_t(regs[2]);
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+#endif  // XE_COMPILER_MSVC
+  // AES is bit 25 and SSE2 (edx bit 26) comes with every x64 CPU.
+  return (ecx & (1u << 25)) != 0;
+#else
+  return false;
+#endif  // XE_ARCH_AMD64
+}
+
+AesCbcDecryptor::AesCbcDecryptor(const uint8_t key[16], bool allow_aes_ni) {
+  rounds_ = rijndaelKeySetupDec(rk_, key, 128);
+#if XE_ARCH_AMD64
+  uses_aes_ni_ = allow_aes_ni && host_has_aes_ni();
+  if (uses_aes_ni_) {
+    ExpandDecryptionKeys(key, dec_keys_);
+  }
+#endif  // XE_ARCH_AMD64
+}
+
+void AesCbcDecryptor::Decrypt(const uint8_t* iv, const uint8_t* input,
+                              size_t size, uint8_t* output) const {
+  size_t block_count = size / 16;
+  size_t tail = size % 16;
+  size_t offset = block_count * 16;
+  // The tail is chained to the last full block, which an in-place decrypt
+  // is about to overwrite.
+  uint8_t tail_iv[16] = {0};
+  if (tail && (offset || iv)) {
+    std::memcpy(tail_iv, offset ? input + offset - 16 : iv, 16);
+  }
+  if (block_count) {
+    if (uses_aes_ni_) {
+      DecryptAesNi(iv, input, block_count, output);
+    } else {
+      DecryptSoftware(iv, input, block_count, output);
+    }
+  }
+  if (tail) {
+    uint8_t block[16] = {0};
+    std::memcpy(block, input + offset, tail);
+    DecryptSoftware(tail_iv, block, 1, block);
+    std::memcpy(output + offset, block, tail);
+  }
+}
+
+void AesCbcDecryptor::DecryptSoftware(const uint8_t* iv, const uint8_t* input,
+                                      size_t block_count,
+                                      uint8_t* output) const {
+  uint8_t prev[16] = {0};
+  if (iv) {
+    std::memcpy(prev, iv, 16);
+  }
+  for (size_t n = 0; n < block_count; ++n) {
+    uint8_t ct[16];
+    std::memcpy(ct, input + n * 16, 16);
+    uint8_t* pt = output + n * 16;
+    rijndaelDecrypt(rk_, rounds_, ct, pt);
+    for (size_t i = 0; i < 16; ++i) {
+      pt[i] ^= prev[i];
+    }
+    std::memcpy(prev, ct, 16);
+  }
+}
+
+#if XE_ARCH_AMD64
+
+XE_AES_NI_TARGET static inline __m128i DecryptBlock(const __m128i* keys,
+                                                    __m128i x) {
+  x = _mm_xor_si128(x, keys[0]);
+  for (int i = 1; i < 10; ++i) {
+    x = _mm_aesdec_si128(x, keys[i]);
+  }
+  return _mm_aesdeclast_si128(x, keys[10]);
+}
+
+XE_AES_NI_TARGET void AesCbcDecryptor::DecryptAesNi(const uint8_t* iv,
+                                                    const uint8_t* input,
+                                                    size_t block_count,
+                                                    uint8_t* output) const {
+  const __m128i* keys = reinterpret_cast<const __m128i*>(dec_keys_);
+  auto src = reinterpret_cast<const __m128i*>(input);
+  auto dst = reinterpret_cast<__m128i*>(output);
+  __m128i prev = iv ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv))
+                    : _mm_setzero_si128();
+  size_t n = 0;
+  // CBC decryption has no chain between blocks, so keep four in flight to
+  // cover the latency of aesdec.
+  for (; n + 4 <= block_count; n += 4) {
+    __m128i c0 = _mm_loadu_si128(src + n + 0);
+    __m128i c1 = _mm_loadu_si128(src + n + 1);
+    __m128i c2 = _mm_loadu_si128(src + n + 2);
+    __m128i c3 = _mm_loadu_si128(src + n + 3);
+    __m128i x0 = _mm_xor_si128(c0, keys[0]);
+    __m128i x1 = _mm_xor_si128(c1, keys[0]);
+    __m128i x2 = _mm_xor_si128(c2, keys[0]);
+    __m128i x3 = _mm_xor_si128(c3, keys[0]);
+    for (int i = 1; i < 10; ++i) {
+      x0 = _mm_aesdec_si128(x0, keys[i]);
+      x1 = _mm_aesdec_si128(x1, keys[i]);
+      x2 = _mm_aesdec_si128(x2, keys[i]);
+      x3 = _mm_aesdec_si128(x3, keys[i]);
+    }
+    x0 = _mm_aesdeclast_si128(x0, keys[10]);
+    x1 = _mm_aesdeclast_si128(x1, keys[10]);
+    x2 = _mm_aesdeclast_si128(x2, keys[10]);
+    x3 = _mm_aesdeclast_si128(x3, keys[10]);
+    _mm_storeu_si128(dst + n + 0, _mm_xor_si128(x0, prev));
+    _mm_storeu_si128(dst + n + 1, _mm_xor_si128(x1, c0));
+    _mm_storeu_si128(dst + n + 2, _mm_xor_si128(x2, c1));
+    _mm_storeu_si128(dst + n + 3, _mm_xor_si128(x3, c2));
+    prev = c3;
+  }
+  for (; n < block_count; ++n) {
+    __m128i c = _mm_loadu_si128(src + n);
+    _mm_storeu_si128(dst + n, _mm_xor_si128(DecryptBlock(keys, c), prev));
+    prev = c;
+  }
+}
+
+XE_AES_NI_TARGET static inline __m128i EncryptBlock(const __m128i* keys,
+                                                    __m128i x) {
+  x = _mm_xor_si128(x, keys[0]);
+  for (int i = 1; i < 10; ++i) {
+    x = _mm_aesenc_si128(x, keys[i]);
+  }
+  return _mm_aesenclast_si128(x, keys[10]);
+}
+
+XE_AES_NI_TARGET static void Aes128EncryptAesNi(
+    const uint8_t round_keys[11][16], uint8_t* iv, const uint8_t* input,
+    size_t block_count, uint8_t* output) {
+  __m128i keys[11];
+  for (int i = 0; i < 11; ++i) {
+    keys[i] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys[i]));
+  }
+  auto src = reinterpret_cast<const __m128i*>(input);
+  auto dst = reinterpret_cast<__m128i*>(output);
+  size_t n = 0;
+  if (iv) {
+    // Every block is chained to the one before it.
+    __m128i feed = _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv));
+    for (; n < block_count; ++n) {
+      feed = EncryptBlock(keys, _mm_xor_si128(_mm_loadu_si128(src + n), feed));
+      _mm_storeu_si128(dst + n, feed);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(iv), feed);
+    return;
+  }
+  for (; n + 4 <= block_count; n += 4) {
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128(src + n + 0), keys[0]);
+    __m128i x1 = _mm_xor_si128(_mm_loadu_si128(src + n + 1), keys[0]);
+    __m128i x2 = _mm_xor_si128(_mm_loadu_si128(src + n + 2), keys[0]);
+    __m128i x3 = _mm_xor_si128(_mm_loadu_si128(src + n + 3), keys[0]);
+    for (int i = 1; i < 10; ++i) {
+      x0 = _mm_aesenc_si128(x0, keys[i]);
+      x1 = _mm_aesenc_si128(x1, keys[i]);
+      x2 = _mm_aesenc_si128(x2, keys[i]);
+      x3 = _mm_aesenc_si128(x3, keys[i]);
+    }
+    _mm_storeu_si128(dst + n + 0, _mm_aesenclast_si128(x0, keys[10]));
+    _mm_storeu_si128(dst + n + 1, _mm_aesenclast_si128(x1, keys[10]));
+    _mm_storeu_si128(dst + n + 2, _mm_aesenclast_si128(x2, keys[10]));
+    _mm_storeu_si128(dst + n + 3, _mm_aesenclast_si128(x3, keys[10]));
+  }
+  for (; n < block_count; ++n) {
+    _mm_storeu_si128(dst + n, EncryptBlock(keys, _mm_loadu_si128(src + n)));
+  }
+}
+
+XE_AES_NI_TARGET static void Aes128DecryptAesNi(
+    const uint8_t round_keys[11][16], uint8_t* iv, const uint8_t* input,
+    size_t block_count, uint8_t* output) {
+  // The equivalent inverse cipher schedule, as in ExpandDecryptionKeys.
+  __m128i keys[11];
+  keys[0] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys[10]));
+  for (int i = 1; i < 10; ++i) {
+    keys[i] = _mm_aesimc_si128(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys[10 - i])));
+  }
+  keys[10] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(round_keys[0]));
+  auto src = reinterpret_cast<const __m128i*>(input);
+  auto dst = reinterpret_cast<__m128i*>(output);
+  __m128i prev = iv ? _mm_loadu_si128(reinterpret_cast<const __m128i*>(iv))
+                    : _mm_setzero_si128();
+  size_t n = 0;
+  for (; n + 4 <= block_count; n += 4) {
+    __m128i c0 = _mm_loadu_si128(src + n + 0);
+    __m128i c1 = _mm_loadu_si128(src + n + 1);
+    __m128i c2 = _mm_loadu_si128(src + n + 2);
+    __m128i c3 = _mm_loadu_si128(src + n + 3);
+    __m128i x0 = _mm_xor_si128(c0, keys[0]);
+    __m128i x1 = _mm_xor_si128(c1, keys[0]);
+    __m128i x2 = _mm_xor_si128(c2, keys[0]);
+    __m128i x3 = _mm_xor_si128(c3, keys[0]);
+    for (int i = 1; i < 10; ++i) {
+      x0 = _mm_aesdec_si128(x0, keys[i]);
+      x1 = _mm_aesdec_si128(x1, keys[i]);
+      x2 = _mm_aesdec_si128(x2, keys[i]);
+      x3 = _mm_aesdec_si128(x3, keys[i]);
+    }
+    x0 = _mm_aesdeclast_si128(x0, keys[10]);
+    x1 = _mm_aesdeclast_si128(x1, keys[10]);
+    x2 = _mm_aesdeclast_si128(x2, keys[10]);
+    x3 = _mm_aesdeclast_si128(x3, keys[10]);
+    if (iv) {
+      x0 = _mm_xor_si128(x0, prev);
+      x1 = _mm_xor_si128(x1, c0);
+      x2 = _mm_xor_si128(x2, c1);
+      x3 = _mm_xor_si128(x3, c2);
+      prev = c3;
+    }
+    _mm_storeu_si128(dst + n + 0, x0);
+    _mm_storeu_si128(dst + n + 1, x1);
+    _mm_storeu_si128(dst + n + 2, x2);
+    _mm_storeu_si128(dst + n + 3, x3);
+  }
+  for (; n < block_count; ++n) {
+    __m128i c = _mm_loadu_si128(src + n);
+    __m128i x = DecryptBlock(keys, c);
+    if (iv) {
+      x = _mm_xor_si128(x, prev);
+      prev = c;
+    }
+    _mm_storeu_si128(dst + n, x);
+  }
+  if (iv) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(iv), prev);
+  }
+}
+
+#else
+
+void AesCbcDecryptor::DecryptAesNi(const uint8_t* iv, const uint8_t* input,
+                                   size_t block_count, uint8_t* output) const {
+  DecryptSoftware(iv, input, block_count, output);
+}
+
+#endif  // XE_ARCH_AMD64
+
+void Aes128ExpandKey(const uint8_t key[16], uint8_t round_keys[11][16]) {
+  uint32_t rk[44];
+  rijndaelKeySetupEnc(rk, key, 128);
+  for (int i = 0; i < 44; ++i) {
+    PUTU32(&round_keys[i / 4][(i % 4) * 4], rk[i]);
+  }
+}
+
+void Aes128Encrypt(const uint8_t round_keys[11][16], uint8_t* iv,
+                   const uint8_t* input, size_t block_count, uint8_t* output,
+                   bool allow_aes_ni) {
+#if XE_ARCH_AMD64
+  static const bool host_has_aes_ni = AesCbcDecryptor::host_has_aes_ni();
+  if (allow_aes_ni && host_has_aes_ni) {
+    Aes128EncryptAesNi(round_keys, iv, input, block_count, output);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  uint32_t rk[44];
+  for (int i = 0; i < 44; ++i) {
+    rk[i] = GETU32(&round_keys[i / 4][(i % 4) * 4]);
+  }
+  for (size_t n = 0; n < block_count; ++n) {
+    uint8_t block[16];
+    std::memcpy(block, input + n * 16, 16);
+    if (iv) {
+      for (size_t i = 0; i < 16; ++i) {
+        block[i] ^= iv[i];
+      }
+    }
+    rijndaelEncrypt(rk, 10, block, output + n * 16);
+    if (iv) {
+      std::memcpy(iv, output + n * 16, 16);
+    }
+  }
+}
+
+void Aes128Decrypt(const uint8_t round_keys[11][16], uint8_t* iv,
+                   const uint8_t* input, size_t block_count, uint8_t* output,
+                   bool allow_aes_ni) {
+#if XE_ARCH_AMD64
+  static const bool host_has_aes_ni = AesCbcDecryptor::host_has_aes_ni();
+  if (allow_aes_ni && host_has_aes_ni) {
+    Aes128DecryptAesNi(round_keys, iv, input, block_count, output);
+    return;
+  }
+#endif  // XE_ARCH_AMD64
+  // What rijndaelKeySetupDec makes of the encryption schedule: the rounds
+  // reversed, and all but the outer two through inverse MixColumns.
+  uint32_t rk[44];
+  for (int i = 0; i < 44; ++i) {
+    uint32_t word = GETU32(&round_keys[10 - i / 4][(i % 4) * 4]);
+    if (i >= 4 && i < 40) {
+      word = Td0[Te4[word >> 24] & 0xFF] ^
+             Td1[Te4[(word >> 16) & 0xFF] & 0xFF] ^
+             Td2[Te4[(word >> 8) & 0xFF] & 0xFF] ^
+             Td3[Te4[word & 0xFF] & 0xFF];
+    }
+    rk[i] = word;
+  }
+  for (size_t n = 0; n < block_count; ++n) {
+    uint8_t ciphertext[16];
+    std::memcpy(ciphertext, input + n * 16, 16);
+    uint8_t* plaintext = output + n * 16;
+    rijndaelDecrypt(rk, 10, ciphertext, plaintext);
+    if (iv) {
+      for (size_t i = 0; i < 16; ++i) {
+        plaintext[i] ^= iv[i];
+      }
+      std::memcpy(iv, ciphertext, 16);
+    }
+  }
+}
+
+}  // namespace xe
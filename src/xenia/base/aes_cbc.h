@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_AES_CBC_H_
+#define XENIA_BASE_AES_CBC_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xe {
+
+// AES-128 CBC decryption. Uses AES-NI when the host has it and falls back to
+// the reference implementation otherwise. A decryptor holds only the expanded
+// key, so one instance can be shared by threads decrypting different ranges.
+class AesCbcDecryptor {
+ public:
+  explicit AesCbcDecryptor(const uint8_t key[16], bool allow_aes_ni = true);
+
+  // Whether the host supports the AES-NI instructions.
+  static bool host_has_aes_ni();
+  bool uses_aes_ni() const { return uses_aes_ni_; }
+
+  // Decrypts size bytes from input to output. iv is the ciphertext block
+  // preceding input, or nullptr for a zero IV, which lets a long stream be
+  // split into independently decrypted ranges. input and output may be the
+  // same. A trailing partial block is decrypted as if zero padded.
+  void Decrypt(const uint8_t* iv, const uint8_t* input, size_t size,
+               uint8_t* output) const;
+
+ private:
+  void DecryptSoftware(const uint8_t* iv, const uint8_t* input,
+                       size_t block_count, uint8_t* output) const;
+  void DecryptAesNi(const uint8_t* iv, const uint8_t* input,
+                    size_t block_count, uint8_t* output) const;
+
+  bool uses_aes_ni_ = false;
+  // Reference decryption schedule (4 * (MAXNR + 1) words).
+  uint32_t rk_[60];
+  int rounds_ = 0;
+  // Equivalent inverse cipher schedule for aesdec, last round key first.
+  alignas(16) uint8_t dec_keys_[11][16];
+};
+
+// AES-128 with an expanded encryption key schedule: the 11 round keys in the
+// byte order of FIPS-197, which is how the guest kernel keeps them. These use
+// AES-NI when the host has it. With an iv they are CBC, and the iv is updated
+// to the last ciphertext block so that calls can be chained; without one they
+// are ECB. input and output may be the same.
+void Aes128ExpandKey(const uint8_t key[16], uint8_t round_keys[11][16]);
+void Aes128Encrypt(const uint8_t round_keys[11][16], uint8_t* iv,
+                   const uint8_t* input, size_t block_count, uint8_t* output,
+                   bool allow_aes_ni = true);
+void Aes128Decrypt(const uint8_t round_keys[11][16], uint8_t* iv,
+                   const uint8_t* input, size_t block_count, uint8_t* output,
+                   bool allow_aes_ni = true);
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_AES_CBC_H_
@@ -9,13 +9,126 @@
 
 #include "xenia/base/arena.h"
 
+#include <atomic>
 #include <cstring>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <vector>
 
 #include "xenia/base/assert.h"
 
 namespace xe {
 
+namespace {
+
+const size_t kThreadCachedChunkCount = 4;
+const size_t kSharedCachedChunkCount = 16;
+
+std::atomic<size_t> chunks_allocated_ = {0};
+std::atomic<size_t> chunks_reused_ = {0};
+
+// Set once the chunks of the thread are handed over, for arenas destroyed
+// later on while it exits.
+thread_local bool thread_chunks_released_ = false;
+
+}  // namespace
+
+class Arena::ChunkCache {
+ public:
+  static Chunk* Acquire(size_t chunk_size) {
+    Chunk* chunk = nullptr;
+    if (!thread_chunks_released_) {
+      chunk = Take(&thread_chunks().chunks, chunk_size);
+    }
+    if (!chunk) {
+      auto& shared = shared_chunks();
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      chunk = Take(&shared.chunks, chunk_size);
+    }
+    if (chunk) {
+      chunks_reused_.fetch_add(1, std::memory_order_relaxed);
+      chunk->next = nullptr;
+      chunk->offset = 0;
+      return chunk;
+    }
+    chunks_allocated_.fetch_add(1, std::memory_order_relaxed);
+    return new Chunk(chunk_size);
+  }
+
+  static void Release(Chunk* chunk) {
+    if (!thread_chunks_released_) {
+      auto& local = thread_chunks().chunks;
+      if (local.size() < kThreadCachedChunkCount) {
+        local.push_back(chunk);
+        return;
+      }
+    }
+    ReleaseShared(chunk);
+  }
+
+ private:
+  struct ThreadChunks {
+    std::vector<Chunk*> chunks;
+    // Handed over to the other threads when this one exits.
+    ~ThreadChunks() {
+      thread_chunks_released_ = true;
+      for (auto chunk : chunks) {
+        ReleaseShared(chunk);
+      }
+    }
+  };
+  struct SharedChunks {
+    std::mutex mutex;
+    std::vector<Chunk*> chunks;
+    ~SharedChunks() {
+      for (auto chunk : chunks) {
+        delete chunk;
+      }
+    }
+  };
+
+  static ThreadChunks& thread_chunks() {
+    static thread_local ThreadChunks chunks;
+    return chunks;
+  }
+  static SharedChunks& shared_chunks() {
+    static SharedChunks chunks;
+    return chunks;
+  }
+
+  static Chunk* Take(std::vector<Chunk*>* chunks, size_t chunk_size) {
+    for (auto it = chunks->rbegin(); it != chunks->rend(); ++it) {
+      Chunk* chunk = *it;
+      if (chunk->capacity == chunk_size) {
+        chunks->erase(std::next(it).base());
+        return chunk;
+      }
+    }
+    return nullptr;
+  }
+
+  static void ReleaseShared(Chunk* chunk) {
+    auto& shared = shared_chunks();
+    {
+      std::lock_guard<std::mutex> lock(shared.mutex);
+      if (shared.chunks.size() < kSharedCachedChunkCount) {
+        shared.chunks.push_back(chunk);
+        return;
+      }
+    }
+    delete chunk;
+  }
+};
+
+size_t Arena::chunks_allocated() {
+  return chunks_allocated_.load(std::memory_order_relaxed);
+}
+
+size_t Arena::chunks_reused() {
+  return chunks_reused_.load(std::memory_order_relaxed);
+}
+
 Arena::Arena(size_t chunk_size)
     : chunk_size_(chunk_size), head_chunk_(nullptr), active_chunk_(nullptr) {}
 
@@ -24,7 +137,7 @@ Arena::~Arena() {
   Chunk* chunk = head_chunk_;
   while (chunk) {
     Chunk* next = chunk->next;
-    delete chunk;
+    ChunkCache::Release(chunk);
     chunk = next;
   }
   head_chunk_ = nullptr;
@@ -51,14 +164,14 @@ void* Arena::Alloc(size_t size) {
       Chunk* next = active_chunk_->next;
       if (!next) {
         assert_true(size < chunk_size_, "need to support larger chunks");
-        next = new Chunk(chunk_size_);
+        next = ChunkCache::Acquire(chunk_size_);
         active_chunk_->next = next;
       }
       next->offset = 0;
       active_chunk_ = next;
     }
   } else {
-    head_chunk_ = active_chunk_ = new Chunk(chunk_size_);
+    head_chunk_ = active_chunk_ = ChunkCache::Acquire(chunk_size_);
   }
 
   uint8_t* p = active_chunk_->buffer + active_chunk_->offset;
@@ -14,6 +14,7 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/memory.h"
 
 namespace xe {
 
@@ -36,26 +37,16 @@ uint64_t BitStream::Peek(size_t num_bits) {
   assert_false(num_bits > 57);
   assert_false(offset_bits_ + num_bits > size_bits_);
 
-  size_t offset_bytes = offset_bits_ >> 3;
-  size_t rel_offset_bits = offset_bits_ - (offset_bytes << 3);
-
   // offset -->
   // ..[junk]..| target bits |....[junk].............
-  uint64_t bits = *(uint64_t*)(buffer_ + offset_bytes);
-
-  // We need the data in little endian.
-  // TODO: Have a flag specifying endianness of data?
-  bits = xe::byte_swap(bits);
-
-  // Shift right
-  // .....[junk]........| target bits |
-  bits >>= 64 - (rel_offset_bits + num_bits);
-
-  // AND with mask
-  // ...................| target bits |
-  bits &= (1ULL << num_bits) - 1;
-
-  return bits;
+  uint64_t bits = LoadWord(offset_bits_ >> 3);
+
+  // Shift the junk before the target bits out to the left, and the junk after
+  // them out to the right. The right shift is split so that neither shift is
+  // by 64 (undefined) when num_bits is 0.
+  // | target bits |....[junk]......................
+  // ...................................| target bits |
+  return (bits << (offset_bits_ & 7)) >> 1 >> (63 - num_bits);
 }
 
 uint64_t BitStream::Read(size_t num_bits) {
@@ -103,43 +94,76 @@ bool BitStream::Write(uint64_t val, size_t num_bits) {
 }
 
 size_t BitStream::Copy(uint8_t* dest_buffer, size_t num_bits) {
-  size_t offset_bytes = offset_bits_ >> 3;
-  size_t rel_offset_bits = offset_bits_ - (offset_bytes << 3);
-  size_t bits_left = num_bits;
-  size_t out_offset_bytes = 0;
+  size_t rel_offset_bits = offset_bits_ & 7;
+  CopyBits(dest_buffer, rel_offset_bits, num_bits);
+
+  // Return the bit offset to the copied bits.
+  return rel_offset_bits;
+}
 
-  // First: Copy the first few bits up to a byte boundary.
-  if (rel_offset_bits) {
-    uint64_t bits = Peek(8 - rel_offset_bits);
-    dest_buffer[out_offset_bytes] |= (uint8_t)bits;
+void BitStream::CopyBits(uint8_t* dest_buffer, size_t dest_offset_bits,
+                         size_t num_bits) {
+  assert_false(offset_bits_ + num_bits > size_bits_);
 
-    bits_left -= 8 - rel_offset_bits;
-    Advance(8 - rel_offset_bits);
-    out_offset_bytes++;
+  uint8_t* dest = dest_buffer + (dest_offset_bits >> 3);
+  size_t dest_rel_bits = dest_offset_bits & 7;
+
+  // First: Copy the bits up to a byte boundary of the destination.
+  if (dest_rel_bits && num_bits) {
+    size_t head_bits = std::min(8 - dest_rel_bits, num_bits);
+    size_t shift = 8 - dest_rel_bits - head_bits;
+    uint8_t mask = uint8_t(((1u << head_bits) - 1) << shift);
+    *dest = uint8_t((*dest & ~mask) | (Read(head_bits) << shift));
+    dest++;
+    num_bits -= head_bits;
   }
 
-  // Second: Use memcpy for the bytes left.
-  if (bits_left >= 8) {
-    std::memcpy(dest_buffer + out_offset_bytes,
-                buffer_ + offset_bytes + out_offset_bytes, bits_left / 8);
-    out_offset_bytes += (bits_left / 8);
-    Advance((bits_left / 8) * 8);
-    bits_left -= (bits_left / 8) * 8;
+  // Second: Copy whole bytes.
+  if (!(offset_bits_ & 7)) {
+    // The source is byte aligned too.
+    size_t length = num_bits >> 3;
+    std::memcpy(dest, buffer_ + (offset_bits_ >> 3), length);
+    dest += length;
+    Advance(length << 3);
+    num_bits &= 7;
+  } else {
+    // 7 bytes per load, stored as 8 bytes while at least 8 are left, as the
+    // next store overwrites the extra one.
+    while (num_bits >= 64) {
+      xe::store_and_swap<uint64_t>(dest, Read(56) << 8);
+      dest += 7;
+      num_bits -= 56;
+    }
+    while (num_bits >= 8) {
+      *dest++ = uint8_t(Read(8));
+      num_bits -= 8;
+    }
   }
 
   // Third: Copy the last few bits.
-  if (bits_left) {
-    uint64_t bits = Peek(bits_left);
-    bits <<= 8 - bits_left;
-
-    dest_buffer[out_offset_bytes] |= (uint8_t)bits;
-    Advance(bits_left);
+  if (num_bits) {
+    size_t shift = 8 - num_bits;
+    uint8_t mask = uint8_t(((1u << num_bits) - 1) << shift);
+    *dest = uint8_t((*dest & ~mask) | (Read(num_bits) << shift));
   }
-
-  // Return the bit offset to the copied bits.
-  return rel_offset_bits;
 }
 
 void BitStream::Advance(size_t num_bits) { SetOffset(offset_bits_ + num_bits); }
 
+uint64_t BitStream::LoadWord(size_t offset_bytes) const {
+  size_t size_bytes = (size_bits_ + 7) >> 3;
+  if (offset_bytes + 8 <= size_bytes) {
+    return xe::load_and_swap<uint64_t>(buffer_ + offset_bytes);
+  }
+  // The last few bytes, zero padded.
+  uint64_t bits = 0;
+  for (size_t i = 0; i < 8; i++) {
+    bits <<= 8;
+    if (offset_bytes + i < size_bytes) {
+      bits |= buffer_[offset_bytes + i];
+    }
+  }
+  return bits;
+}
+
 }  // namespace xe
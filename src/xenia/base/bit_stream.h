@@ -29,14 +29,26 @@ class BitStream {
   void SetOffset(size_t offset_bits);
   size_t BitsRemaining();
 
+  // Bits are in big endian order, from the most significant bit of the first
+  // byte. Peeking loads the word of the stream at the offset in one go, or
+  // byte by byte at the very end so as not to read past it.
   // Note: num_bits MUST be in the range 0-57 (inclusive)
   uint64_t Peek(size_t num_bits);
   uint64_t Read(size_t num_bits);
   bool Write(uint64_t val, size_t num_bits);  // TODO(DrChat): Not tested!
 
+  // Copies num_bits bits to dest_buffer starting at the same bit within its
+  // first byte as the stream offset is, and returns that bit.
   size_t Copy(uint8_t* dest_buffer, size_t num_bits);
+  // Copies num_bits bits to dest_buffer starting at dest_offset_bits, keeping
+  // the bits around them. Whole bytes are copied with memcpy when the source
+  // and destination bits line up, and a word at a time when they don't.
+  void CopyBits(uint8_t* dest_buffer, size_t dest_offset_bits,
+                size_t num_bits);
 
  private:
+  uint64_t LoadWord(size_t offset_bytes) const;
+
   uint8_t* buffer_ = nullptr;
   size_t offset_bits_ = 0;
   size_t size_bits_ = 0;
@@ -51,6 +51,16 @@ class ByteStream {
     Write(reinterpret_cast<uint8_t*>(&data), sizeof(T));
   }
 
+  // Whole arrays in one copy, in host byte order like the single values.
+  template <typename T>
+  void ReadArray(T* values, size_t count) {
+    Read(reinterpret_cast<uint8_t*>(values), count * sizeof(T));
+  }
+  template <typename T>
+  void WriteArray(const T* values, size_t count) {
+    Write(reinterpret_cast<const uint8_t*>(values), count * sizeof(T));
+  }
+
   void Write(const std::string& str) {
     Write(uint32_t(str.length()));
     Write(str.c_str(), str.length());
@@ -9,10 +9,30 @@
 
 #include "xenia/base/clock.h"
 
+#include <gflags/gflags.h>
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <climits>
+#include <mutex>
+#include <thread>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/platform.h"
+
+#if XE_ARCH_AMD64
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif  // XE_COMPILER_MSVC
+#endif  // XE_ARCH_AMD64
+
+DEFINE_bool(tsc_guest_clock, true,
+            "Compute guest time from the host TSC when it's invariant, "
+            "instead of querying the host performance counter every time.");
 
 namespace xe {
 
@@ -22,43 +42,152 @@ double guest_time_scalar_ = 1.0;
 uint64_t guest_tick_frequency_ = Clock::host_tick_frequency();
 // Base FILETIME of the guest system from app start.
 uint64_t guest_system_time_base_ = Clock::QueryHostSystemTime();
-// Combined time and frequency scalar (computed by RecomputeGuestTickScalar).
-double guest_tick_scalar_ = 1.0;
-// Native guest ticks.
-thread_local uint64_t guest_tick_count_ = 0;
-// 100ns ticks, relative to guest_system_time_base_.
-thread_local uint64_t guest_time_filetime_ = 0;
-// Last sampled host tick count.
-thread_local uint64_t last_host_tick_count_ = Clock::QueryHostTickCount();
-
-void RecomputeGuestTickScalar() {
-  guest_tick_scalar_ = (guest_tick_frequency_ * guest_time_scalar_) /
-                       static_cast<double>(Clock::host_tick_frequency());
-}
-
-void UpdateGuestClock() {
-  uint64_t host_tick_count = Clock::QueryHostTickCount();
-  uint64_t host_tick_delta = host_tick_count > last_host_tick_count_
-                                 ? host_tick_count - last_host_tick_count_
-                                 : 0;
-  last_host_tick_count_ = host_tick_count;
-  uint64_t guest_tick_delta = uint64_t(host_tick_delta * guest_tick_scalar_);
-  guest_tick_count_ += guest_tick_delta;
-  guest_time_filetime_ += (guest_tick_delta * 10000000) / guest_tick_frequency_;
+// 100ns ticks added to the guest system time by SetGuestSystemTime.
+std::atomic<int64_t> guest_system_time_offset_ = {0};
+
+// Source of the host ticks the guest clock is computed from, picked when the
+// clock is first started.
+bool guest_clock_uses_tsc_ = false;
+uint64_t guest_clock_host_frequency_ = 0;
+// Replaced, never modified, whenever the guest clock is restarted. The old
+// ones are kept, as JIT code may be reading them concurrently.
+std::atomic<const Clock::GuestTickBase*> guest_tick_base_ = {nullptr};
+std::mutex guest_tick_base_mutex_;
+
+namespace {
+
+bool HasInvariantTsc() {
+#if XE_ARCH_AMD64
+  uint32_t regs[4];
+#if XE_COMPILER_MSVC
+  __cpuid(reinterpret_cast<int*>(regs), 0x80000000);
+  if (regs[0] < 0x80000007) {
+    return false;
+  }
+  __cpuid(reinterpret_cast<int*>(regs), 0x80000007);
+#else
+  if (__get_cpuid_max(0x80000000, nullptr) < 0x80000007) {
+    return false;
+  }
+  __get_cpuid(0x80000007, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif  // XE_COMPILER_MSVC
+  // EDX bit 8: the TSC runs at a constant rate in all power states.
+  return (regs[3] & (1 << 8)) != 0;
+#else
+  return false;
+#endif  // XE_ARCH_AMD64
+}
+
+uint64_t ReadTsc() {
+#if XE_ARCH_AMD64
+  return __rdtsc();
+#else
+  return 0;
+#endif  // XE_ARCH_AMD64
+}
+
+// Measures the TSC rate against the host performance counter.
+uint64_t CalibrateTscFrequency() {
+  uint64_t host_start = Clock::QueryHostTickCount();
+  uint64_t tsc_start = ReadTsc();
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  uint64_t host_delta = Clock::QueryHostTickCount() - host_start;
+  uint64_t tsc_delta = ReadTsc() - tsc_start;
+  return uint64_t(double(tsc_delta) * double(Clock::host_tick_frequency()) /
+                  double(host_delta));
+}
+
+uint64_t QueryGuestClockHostTicks() {
+  return guest_clock_uses_tsc_ ? ReadTsc() : Clock::QueryHostTickCount();
+}
+
+uint64_t ComputeGuestTickCount(const Clock::GuestTickBase* base,
+                               uint64_t host_ticks) {
+  if (host_ticks <= base->host_tick_base) {
+    return base->guest_tick_base;
+  }
+  uint64_t delta = host_ticks - base->host_tick_base;
+#if XE_COMPILER_MSVC
+  uint64_t product_high;
+  uint64_t product_low = _umul128(delta, base->multiplier, &product_high);
+  uint64_t scaled = (product_low >> 32) | (product_high << 32);
+#else
+  uint64_t scaled = uint64_t(
+      (static_cast<unsigned __int128>(delta) * base->multiplier) >> 32);
+#endif  // XE_COMPILER_MSVC
+  return base->guest_tick_base + scaled;
+}
+
+// Restarts the guest clock at the given tick count, running at the current
+// frequency and scalar. Called with guest_tick_base_mutex_ held.
+void RestartGuestClock(uint64_t guest_tick_count) {
+  if (!guest_clock_host_frequency_) {
+    guest_clock_uses_tsc_ = FLAGS_tsc_guest_clock && HasInvariantTsc();
+    guest_clock_host_frequency_ = guest_clock_uses_tsc_
+                                      ? CalibrateTscFrequency()
+                                      : Clock::host_tick_frequency();
+  }
+  auto base = new Clock::GuestTickBase();
+  base->host_tick_base = QueryGuestClockHostTicks();
+  base->guest_tick_base = guest_tick_count;
+  base->multiplier =
+      uint64_t(double(guest_tick_frequency_) * guest_time_scalar_ *
+               4294967296.0 / double(guest_clock_host_frequency_));
+  guest_tick_base_.store(base, std::memory_order_release);
+}
+
+// The current guest tick count, before the clock is started the first time.
+uint64_t QueryCurrentGuestTickCount() {
+  auto base = guest_tick_base_.load(std::memory_order_acquire);
+  return base ? ComputeGuestTickCount(base, QueryGuestClockHostTicks()) : 0;
+}
+
+uint64_t GuestTicksToFileTime(uint64_t guest_ticks) {
+  uint64_t seconds = guest_ticks / guest_tick_frequency_;
+  uint64_t remainder = guest_ticks % guest_tick_frequency_;
+  return seconds * 10000000 + remainder * 10000000 / guest_tick_frequency_;
+}
+
+}  // namespace
+
+const Clock::GuestTickBase* Clock::guest_tick_base() {
+  auto base = guest_tick_base_.load(std::memory_order_acquire);
+  if (!base) {
+    std::lock_guard<std::mutex> lock(guest_tick_base_mutex_);
+    if (!guest_tick_base_.load(std::memory_order_relaxed)) {
+      RestartGuestClock(0);
+    }
+    base = guest_tick_base_.load(std::memory_order_relaxed);
+  }
+  return base;
+}
+
+const void* Clock::guest_tick_base_address() {
+  guest_tick_base();
+  return &guest_tick_base_;
+}
+
+bool Clock::is_guest_clock_tsc() {
+  guest_tick_base();
+  return guest_clock_uses_tsc_;
 }
 
 double Clock::guest_time_scalar() { return guest_time_scalar_; }
 
 void Clock::set_guest_time_scalar(double scalar) {
+  std::lock_guard<std::mutex> lock(guest_tick_base_mutex_);
+  uint64_t guest_tick_count = QueryCurrentGuestTickCount();
   guest_time_scalar_ = scalar;
-  RecomputeGuestTickScalar();
+  RestartGuestClock(guest_tick_count);
 }
 
 uint64_t Clock::guest_tick_frequency() { return guest_tick_frequency_; }
 
 void Clock::set_guest_tick_frequency(uint64_t frequency) {
+  std::lock_guard<std::mutex> lock(guest_tick_base_mutex_);
+  uint64_t guest_tick_count = QueryCurrentGuestTickCount();
   guest_tick_frequency_ = frequency;
-  RecomputeGuestTickScalar();
+  RestartGuestClock(guest_tick_count);
 }
 
 uint64_t Clock::guest_system_time_base() { return guest_system_time_base_; }
@@ -68,30 +197,30 @@ void Clock::set_guest_system_time_base(uint64_t time_base) {
 }
 
 uint64_t Clock::QueryGuestTickCount() {
-  UpdateGuestClock();
-  return guest_tick_count_;
+  return ComputeGuestTickCount(guest_tick_base(), QueryGuestClockHostTicks());
 }
 
 uint64_t Clock::QueryGuestSystemTime() {
-  UpdateGuestClock();
-  return guest_system_time_base_ + guest_time_filetime_;
+  return guest_system_time_base_ + guest_system_time_offset_ +
+         GuestTicksToFileTime(QueryGuestTickCount());
 }
 
 uint32_t Clock::QueryGuestUptimeMillis() {
-  UpdateGuestClock();
-  uint64_t uptime_millis = guest_tick_count_ / (guest_tick_frequency_ / 1000);
+  uint64_t uptime_millis =
+      QueryGuestTickCount() / (guest_tick_frequency_ / 1000);
   uint32_t result = uint32_t(std::min(uptime_millis, uint64_t(UINT_MAX)));
   return result;
 }
 
 void Clock::SetGuestTickCount(uint64_t tick_count) {
-  last_host_tick_count_ = Clock::QueryHostTickCount();
-  guest_tick_count_ = tick_count;
+  std::lock_guard<std::mutex> lock(guest_tick_base_mutex_);
+  RestartGuestClock(tick_count);
 }
 
 void Clock::SetGuestSystemTime(uint64_t system_time) {
-  last_host_tick_count_ = Clock::QueryHostTickCount();
-  guest_time_filetime_ = system_time - guest_system_time_base_;
+  guest_system_time_offset_ =
+      int64_t(system_time - guest_system_time_base_ -
+              GuestTicksToFileTime(QueryGuestTickCount()));
 }
 
 uint32_t Clock::ScaleGuestDurationMillis(uint32_t guest_ms) {
@@ -124,7 +253,7 @@ int64_t Clock::ScaleGuestDurationFileTime(int64_t guest_file_time) {
 }
 
 void Clock::ScaleGuestDurationTimeval(int32_t* tv_sec, int32_t* tv_usec) {
-  uint64_t scaled_sec = uint64_t(uint64_t(*tv_sec) * guest_tick_scalar_);
+  uint64_t scaled_sec = uint64_t(uint64_t(*tv_sec) * guest_time_scalar_);
   uint64_t scaled_usec = uint64_t(uint64_t(*tv_usec) * guest_time_scalar_);
   if (scaled_usec > UINT_MAX) {
     uint64_t overflow_sec = scaled_usec / 1000000;
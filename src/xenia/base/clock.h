@@ -16,6 +16,15 @@ namespace xe {
 
 class Clock {
  public:
+  // The guest tick count is guest_tick_base plus the host ticks since
+  // host_tick_base times multiplier / 2^32, with the host ticks read from the
+  // TSC when is_guest_clock_tsc or QueryHostTickCount otherwise.
+  struct GuestTickBase {
+    uint64_t host_tick_base;
+    uint64_t guest_tick_base;
+    uint64_t multiplier;
+  };
+
   // Host ticks-per-second.
   static uint64_t host_tick_frequency();
   // Queries the current host tick count.
@@ -39,6 +48,14 @@ class Clock {
   // Sets the guest time base, used for computing the system time.
   // By default this is the current system time.
   static void set_guest_system_time_base(uint64_t time_base);
+  // Current guest clock parameters, only valid until the clock is changed.
+  static const GuestTickBase* guest_tick_base();
+  // Address of the pointer to the current guest clock parameters, for JIT
+  // code to compute the tick count inline.
+  static const void* guest_tick_base_address();
+  // Whether the guest clock counts invariant TSC ticks, so rdtsc can be used
+  // directly.
+  static bool is_guest_clock_tsc();
   // Queries the current guest tick count, accounting for frequency adjustment
   // and scaling.
   static uint64_t QueryGuestTickCount();
@@ -47,9 +64,9 @@ class Clock {
   // Queries the milliseconds since the guest began, accounting for scaling.
   static uint32_t QueryGuestUptimeMillis();
 
-  // Sets the guest tick count for the current thread.
+  // Sets the guest tick count, which keeps counting from there.
   static void SetGuestTickCount(uint64_t tick_count);
-  // Sets the system time for the current thread.
+  // Sets the guest system time, which keeps counting from there.
   static void SetGuestSystemTime(uint64_t system_time);
 
   // Scales a time duration in milliseconds, from guest time.
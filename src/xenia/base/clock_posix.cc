@@ -14,18 +14,14 @@
 
 namespace xe {
 
-uint64_t Clock::host_tick_frequency() {
-  timespec res;
-  clock_getres(CLOCK_MONOTONIC_RAW, &res);
-
-  return uint64_t(res.tv_sec) + uint64_t(res.tv_nsec) * 1000000000ull;
-}
+// Ticks are nanoseconds, whatever the resolution of the clock.
+uint64_t Clock::host_tick_frequency() { return 1000000000ull; }
 
 uint64_t Clock::QueryHostTickCount() {
   timespec res;
   clock_gettime(CLOCK_MONOTONIC_RAW, &res);
 
-  return uint64_t(res.tv_sec) + uint64_t(res.tv_nsec) * 1000000000ull;
+  return uint64_t(res.tv_sec) * 1000000000ull + uint64_t(res.tv_nsec);
 }
 
 uint64_t Clock::QueryHostSystemTime() {
@@ -0,0 +1,157 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_CONCURRENT_HASH_MAP_H_
+#define XENIA_BASE_CONCURRENT_HASH_MAP_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/assert.h"
+
+namespace xe {
+
+// Open-addressing map from 32-bit keys to pointers with lock-free lookups.
+// Inserts must be serialized by the caller (they usually already hold a lock
+// to coordinate whatever the value is for). Entries can't be removed.
+//
+// Entries are published value first, key second, so a reader that finds the
+// key always sees the value. When the table fills up it is copied into one
+// twice the size and swapped in; the old table stays valid for any readers
+// still probing it and is only freed with the map. Those add up to less than
+// the size of the live table.
+template <typename T>
+class ConcurrentHashMap {
+ public:
+  explicit ConcurrentHashMap(size_t initial_capacity = 1024) {
+    size_t capacity = 16;
+    while (capacity < initial_capacity) {
+      capacity <<= 1;
+    }
+    tables_.emplace_back(new Table(capacity));
+    table_ = tables_.back().get();
+  }
+
+  ConcurrentHashMap(const ConcurrentHashMap&) = delete;
+  ConcurrentHashMap& operator=(const ConcurrentHashMap&) = delete;
+
+  // Number of entries. Must not race with writers.
+  size_t size() const { return table_.load(std::memory_order_acquire)->size; }
+
+  // Returns the value for key or nullptr. Safe to call concurrently with
+  // anything.
+  T* Find(uint32_t key) const {
+    const Table* table = table_.load(std::memory_order_acquire);
+    size_t mask = table->capacity - 1;
+    for (size_t index = Hash(key) & mask;; index = (index + 1) & mask) {
+      auto& slot = table->slots[index];
+      uint64_t slot_key = slot.key.load(std::memory_order_acquire);
+      if (slot_key == key) {
+        return slot.value.load(std::memory_order_acquire);
+      } else if (slot_key == kEmptyKey) {
+        return nullptr;
+      }
+    }
+  }
+
+  // Adds or replaces the value for key. Writers must be serialized.
+  void Insert(uint32_t key, T* value) {
+    Table* table = table_.load(std::memory_order_relaxed);
+    if ((table->size + 1) * 2 > table->capacity) {
+      table = Grow(table);
+    }
+    if (InsertInto(table, key, value)) {
+      ++table->size;
+    }
+  }
+
+  // Calls fn(key, value) for every entry. Must not race with writers.
+  template <typename Fn>
+  void ForEach(Fn fn) const {
+    const Table* table = table_.load(std::memory_order_acquire);
+    for (size_t i = 0; i < table->capacity; ++i) {
+      auto& slot = table->slots[i];
+      uint64_t key = slot.key.load(std::memory_order_relaxed);
+      if (key != kEmptyKey) {
+        fn(uint32_t(key), slot.value.load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+ private:
+  // Keys are stored widened so that every 32-bit key is usable.
+  static const uint64_t kEmptyKey = ~0ull;
+
+  struct Slot {
+    std::atomic<uint64_t> key;
+    std::atomic<T*> value;
+  };
+  struct Table {
+    explicit Table(size_t capacity)
+        : capacity(capacity), slots(new Slot[capacity]) {
+      for (size_t i = 0; i < capacity; ++i) {
+        slots[i].key.store(kEmptyKey, std::memory_order_relaxed);
+        slots[i].value.store(nullptr, std::memory_order_relaxed);
+      }
+    }
+    size_t capacity;
+    size_t size = 0;
+    std::unique_ptr<Slot[]> slots;
+  };
+
+  static size_t Hash(uint32_t key) {
+    // Keys are mostly 4-byte aligned guest addresses; mix the low bits up so
+    // neighbouring functions don't cluster.
+    return size_t((uint64_t(key) * 0x9E3779B97F4A7C15ull) >> 32);
+  }
+
+  // Returns true if a new slot was used.
+  static bool InsertInto(Table* table, uint32_t key, T* value) {
+    size_t mask = table->capacity - 1;
+    for (size_t index = Hash(key) & mask;; index = (index + 1) & mask) {
+      auto& slot = table->slots[index];
+      uint64_t slot_key = slot.key.load(std::memory_order_relaxed);
+      if (slot_key == key) {
+        slot.value.store(value, std::memory_order_release);
+        return false;
+      } else if (slot_key == kEmptyKey) {
+        slot.value.store(value, std::memory_order_release);
+        slot.key.store(key, std::memory_order_release);
+        return true;
+      }
+    }
+  }
+
+  Table* Grow(Table* table) {
+    auto new_table = new Table(table->capacity * 2);
+    for (size_t i = 0; i < table->capacity; ++i) {
+      auto& slot = table->slots[i];
+      uint64_t key = slot.key.load(std::memory_order_relaxed);
+      if (key != kEmptyKey) {
+        InsertInto(new_table, uint32_t(key),
+                   slot.value.load(std::memory_order_relaxed));
+      }
+    }
+    new_table->size = table->size;
+    tables_.emplace_back(new_table);
+    table_.store(new_table, std::memory_order_release);
+    return new_table;
+  }
+
+  std::atomic<Table*> table_;
+  // All tables ever used, current last. Only touched by writers.
+  std::vector<std::unique_ptr<Table>> tables_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_CONCURRENT_HASH_MAP_H_
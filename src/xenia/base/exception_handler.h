@@ -75,8 +75,15 @@ class ExceptionHandler {
   // Installs an exception handler.
   // Handlers are called in the order they are installed.
   static void Install(Handler fn, void* data);
-
-  // Uninstalls a previously-installed exception handler.
+  // Installs a handler for access violations at host addresses in
+  // [address_begin, address_end), such as a guest memory mapping. It's found
+  // by the fault address and called before any other handler, with only rip,
+  // eflags and the integer registers in the thread context, as what a mov can
+  // touch. If it doesn't handle the exception, the others are called as usual.
+  static void InstallForRange(Handler fn, void* data, uint64_t address_begin,
+                              uint64_t address_end);
+
+  // Uninstalls a previously-installed exception handler, of either kind.
   static void Uninstall(Handler fn, void* data);
 };
 
@@ -9,9 +9,13 @@
 
 #include "xenia/base/exception_handler.h"
 
+#include <signal.h>
+#include <ucontext.h>
+
+#include <cstring>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/math.h"
-#include "xenia/base/platform_linux.h"
 
 namespace xe {
 
@@ -24,12 +28,184 @@ constexpr size_t kMaxHandlerCount = 8;
 // Executed in order.
 std::pair<ExceptionHandler::Handler, void*> handlers_[kMaxHandlerCount];
 
+struct RangeHandler {
+  uint64_t address_begin;
+  uint64_t address_end;
+  ExceptionHandler::Handler fn;
+  void* data;
+};
+// Handlers of access violations by fault address, left-aligned and null
+// terminated too.
+RangeHandler range_handlers_[kMaxHandlerCount];
+
+bool signals_installed_ = false;
+struct sigaction previous_sigsegv_action_;
+struct sigaction previous_sigill_action_;
+
+// X64Context::int_registers order.
+const int kIntRegisterMap[16] = {
+    REG_RAX, REG_RCX, REG_RDX, REG_RBX, REG_RSP, REG_RBP, REG_RSI, REG_RDI,
+    REG_R8,  REG_R9,  REG_R10, REG_R11, REG_R12, REG_R13, REG_R14, REG_R15,
+};
+
+void LoadIntContext(const mcontext_t& mcontext, X64Context* thread_context) {
+  thread_context->rip = uint64_t(mcontext.gregs[REG_RIP]);
+  thread_context->eflags = uint32_t(mcontext.gregs[REG_EFL]);
+  for (size_t i = 0; i < xe::countof(kIntRegisterMap); ++i) {
+    thread_context->int_registers[i] =
+        uint64_t(mcontext.gregs[kIntRegisterMap[i]]);
+  }
+}
+
+void StoreIntContext(const X64Context& thread_context, mcontext_t* mcontext) {
+  mcontext->gregs[REG_RIP] = greg_t(thread_context.rip);
+  mcontext->gregs[REG_EFL] = greg_t(thread_context.eflags);
+  for (size_t i = 0; i < xe::countof(kIntRegisterMap); ++i) {
+    mcontext->gregs[kIntRegisterMap[i]] =
+        greg_t(thread_context.int_registers[i]);
+  }
+}
+
+void LoadVectorContext(const mcontext_t& mcontext,
+                       X64Context* thread_context) {
+  if (mcontext.fpregs) {
+    std::memcpy(thread_context->xmm_registers, mcontext.fpregs->_xmm,
+                sizeof(thread_context->xmm_registers));
+  } else {
+    std::memset(thread_context->xmm_registers, 0,
+                sizeof(thread_context->xmm_registers));
+  }
+}
+
+void StoreVectorContext(const X64Context& thread_context,
+                        mcontext_t* mcontext) {
+  if (mcontext->fpregs) {
+    std::memcpy(mcontext->fpregs->_xmm, thread_context.xmm_registers,
+                sizeof(thread_context.xmm_registers));
+  }
+}
+
+void SignalHandler(int signal, siginfo_t* info, void* context_ptr) {
+  auto& mcontext = reinterpret_cast<ucontext_t*>(context_ptr)->uc_mcontext;
+
+  X64Context thread_context;
+  Exception ex;
+  if (signal == SIGSEGV) {
+    uint64_t fault_address = reinterpret_cast<uint64_t>(info->si_addr);
+    // MMIO and access watch faults go straight to their handler, with just
+    // the registers it may read or write.
+    for (size_t i = 0;
+         i < xe::countof(range_handlers_) && range_handlers_[i].fn; ++i) {
+      auto& range = range_handlers_[i];
+      if (fault_address < range.address_begin ||
+          fault_address >= range.address_end) {
+        continue;
+      }
+      LoadIntContext(mcontext, &thread_context);
+      ex.InitializeAccessViolation(&thread_context, fault_address);
+      if (range.fn(&ex, range.data)) {
+        StoreIntContext(thread_context, &mcontext);
+        return;
+      }
+      break;
+    }
+    LoadIntContext(mcontext, &thread_context);
+    LoadVectorContext(mcontext, &thread_context);
+    ex.InitializeAccessViolation(&thread_context, fault_address);
+  } else {
+    LoadIntContext(mcontext, &thread_context);
+    LoadVectorContext(mcontext, &thread_context);
+    ex.InitializeIllegalInstruction(&thread_context);
+  }
+
+  for (size_t i = 0; i < xe::countof(handlers_) && handlers_[i].first; ++i) {
+    if (handlers_[i].first(&ex, handlers_[i].second)) {
+      // Exception handled.
+      StoreIntContext(thread_context, &mcontext);
+      StoreVectorContext(thread_context, &mcontext);
+      return;
+    }
+  }
+
+  // Nobody wanted it. Put back what was there before, which is called (or
+  // crashes) when the instruction faults again as this returns.
+  sigaction(signal,
+            signal == SIGSEGV ? &previous_sigsegv_action_
+                              : &previous_sigill_action_,
+            nullptr);
+}
+
+void InstallSignalHandlers() {
+  if (signals_installed_) {
+    return;
+  }
+  struct sigaction action;
+  std::memset(&action, 0, sizeof(action));
+  action.sa_sigaction = SignalHandler;
+  action.sa_flags = SA_SIGINFO;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGSEGV, &action, &previous_sigsegv_action_);
+  sigaction(SIGILL, &action, &previous_sigill_action_);
+  signals_installed_ = true;
+}
+
+void UninstallSignalHandlersIfUnused() {
+  if (!signals_installed_ || handlers_[0].first || range_handlers_[0].fn) {
+    return;
+  }
+  sigaction(SIGSEGV, &previous_sigsegv_action_, nullptr);
+  sigaction(SIGILL, &previous_sigill_action_, nullptr);
+  signals_installed_ = false;
+}
+
 void ExceptionHandler::Install(Handler fn, void* data) {
-  // TODO(dougvj) stub
+  InstallSignalHandlers();
+
+  for (size_t i = 0; i < xe::countof(handlers_); ++i) {
+    if (!handlers_[i].first) {
+      handlers_[i].first = fn;
+      handlers_[i].second = data;
+      return;
+    }
+  }
+  assert_always("Too many exception handlers installed");
+}
+
+void ExceptionHandler::InstallForRange(Handler fn, void* data,
+                                       uint64_t address_begin,
+                                       uint64_t address_end) {
+  InstallSignalHandlers();
+
+  for (size_t i = 0; i < xe::countof(range_handlers_); ++i) {
+    if (!range_handlers_[i].fn) {
+      range_handlers_[i] = {address_begin, address_end, fn, data};
+      return;
+    }
+  }
+  assert_always("Too many exception handlers installed");
 }
 
 void ExceptionHandler::Uninstall(Handler fn, void* data) {
-  // TODO(dougvj) stub
+  for (size_t i = 0; i < xe::countof(handlers_); ++i) {
+    if (handlers_[i].first == fn && handlers_[i].second == data) {
+      for (; i < xe::countof(handlers_) - 1; ++i) {
+        handlers_[i] = handlers_[i + 1];
+      }
+      handlers_[i].first = nullptr;
+      handlers_[i].second = nullptr;
+      break;
+    }
+  }
+  for (size_t i = 0; i < xe::countof(range_handlers_); ++i) {
+    if (range_handlers_[i].fn == fn && range_handlers_[i].data == data) {
+      for (; i < xe::countof(range_handlers_) - 1; ++i) {
+        range_handlers_[i] = range_handlers_[i + 1];
+      }
+      range_handlers_[i] = {0, 0, nullptr, nullptr};
+      break;
+    }
+  }
+  UninstallSignalHandlersIfUnused();
 }
 
 }  // namespace xe
@@ -29,12 +29,55 @@ constexpr size_t kMaxHandlerCount = 8;
 // Executed in order.
 std::pair<ExceptionHandler::Handler, void*> handlers_[kMaxHandlerCount];
 
+struct RangeHandler {
+  uint64_t address_begin;
+  uint64_t address_end;
+  ExceptionHandler::Handler fn;
+  void* data;
+};
+// Handlers of access violations by fault address, left-aligned and null
+// terminated too.
+RangeHandler range_handlers_[kMaxHandlerCount];
+
+bool HandleRangeException(PEXCEPTION_POINTERS ex_info) {
+  uint64_t fault_address = ex_info->ExceptionRecord->ExceptionInformation[1];
+  for (size_t i = 0;
+       i < xe::countof(range_handlers_) && range_handlers_[i].fn; ++i) {
+    auto& range = range_handlers_[i];
+    if (fault_address < range.address_begin ||
+        fault_address >= range.address_end) {
+      continue;
+    }
+    // Only what a mov can read or write.
+    X64Context thread_context;
+    thread_context.rip = ex_info->ContextRecord->Rip;
+    thread_context.eflags = ex_info->ContextRecord->EFlags;
+    std::memcpy(thread_context.int_registers, &ex_info->ContextRecord->Rax,
+                sizeof(thread_context.int_registers));
+    Exception ex;
+    ex.InitializeAccessViolation(&thread_context, fault_address);
+    if (!range.fn(&ex, range.data)) {
+      return false;
+    }
+    ex_info->ContextRecord->Rip = thread_context.rip;
+    std::memcpy(&ex_info->ContextRecord->Rax, thread_context.int_registers,
+                sizeof(thread_context.int_registers));
+    return true;
+  }
+  return false;
+}
+
 LONG CALLBACK ExceptionHandlerCallback(PEXCEPTION_POINTERS ex_info) {
   // Visual Studio SetThreadName.
   if (ex_info->ExceptionRecord->ExceptionCode == 0x406D1388) {
     return EXCEPTION_CONTINUE_SEARCH;
   }
 
+  if (ex_info->ExceptionRecord->ExceptionCode == STATUS_ACCESS_VIOLATION &&
+      HandleRangeException(ex_info)) {
+    return EXCEPTION_CONTINUE_EXECUTION;
+  }
+
   // TODO(benvanik): avoid this by mapping X64Context virtual?
   X64Context thread_context;
   thread_context.rip = ex_info->ContextRecord->Rip;
@@ -71,7 +114,7 @@ LONG CALLBACK ExceptionHandlerCallback(PEXCEPTION_POINTERS ex_info) {
   return EXCEPTION_CONTINUE_SEARCH;
 }
 
-void ExceptionHandler::Install(Handler fn, void* data) {
+void InstallVectoredHandler() {
   if (!veh_handle_) {
     veh_handle_ = AddVectoredExceptionHandler(1, ExceptionHandlerCallback);
 
@@ -81,6 +124,10 @@ void ExceptionHandler::Install(Handler fn, void* data) {
       // vch_handle_ = AddVectoredContinueHandler(1, ExceptionHandlerCallback);
     }
   }
+}
+
+void ExceptionHandler::Install(Handler fn, void* data) {
+  InstallVectoredHandler();
 
   for (size_t i = 0; i < xe::countof(handlers_); ++i) {
     if (!handlers_[i].first) {
@@ -92,6 +139,20 @@ void ExceptionHandler::Install(Handler fn, void* data) {
   assert_always("Too many exception handlers installed");
 }
 
+void ExceptionHandler::InstallForRange(Handler fn, void* data,
+                                       uint64_t address_begin,
+                                       uint64_t address_end) {
+  InstallVectoredHandler();
+
+  for (size_t i = 0; i < xe::countof(range_handlers_); ++i) {
+    if (!range_handlers_[i].fn) {
+      range_handlers_[i] = {address_begin, address_end, fn, data};
+      return;
+    }
+  }
+  assert_always("Too many exception handlers installed");
+}
+
 void ExceptionHandler::Uninstall(Handler fn, void* data) {
   for (size_t i = 0; i < xe::countof(handlers_); ++i) {
     if (handlers_[i].first == fn && handlers_[i].second == data) {
@@ -103,8 +164,17 @@ void ExceptionHandler::Uninstall(Handler fn, void* data) {
       break;
     }
   }
+  for (size_t i = 0; i < xe::countof(range_handlers_); ++i) {
+    if (range_handlers_[i].fn == fn && range_handlers_[i].data == data) {
+      for (; i < xe::countof(range_handlers_) - 1; ++i) {
+        range_handlers_[i] = range_handlers_[i + 1];
+      }
+      range_handlers_[i] = {0, 0, nullptr, nullptr};
+      break;
+    }
+  }
 
-  bool has_any = false;
+  bool has_any = range_handlers_[0].fn != nullptr;
   for (size_t i = 0; i < xe::countof(handlers_); ++i) {
     if (handlers_[i].first) {
       has_any = true;
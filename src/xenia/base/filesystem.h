@@ -10,6 +10,7 @@
 #ifndef XENIA_BASE_FILESYSTEM_H_
 #define XENIA_BASE_FILESYSTEM_H_
 
+#include <functional>
 #include <iterator>
 #include <memory>
 #include <string>
@@ -62,6 +63,20 @@ FILE* OpenFile(const std::wstring& path, const char* mode);
 // Returns true if the file was found and removed.
 bool DeleteFile(const std::wstring& path);
 
+// Renames the file, replacing any file already at the new path. Processes
+// that still have the old one open or mapped keep seeing its contents, though
+// Windows refuses to replace a file that's mapped.
+bool RenameFile(const std::wstring& from_path, const std::wstring& to_path);
+
+// Truncates or extends the open file to the given length.
+bool SetFileLength(FILE* file, size_t length);
+
+// Takes an exclusive lock on the open file, which other processes share, so
+// only one of them writes a file they all read. Released when the file is
+// closed, including when the process dies. Returns false right away if another
+// process holds it. The lock is advisory and doesn't stop reads.
+bool TryLockFile(FILE* file);
+
 struct FileAccess {
   // Implies kFileReadData.
   static const uint32_t kGenericRead = 0x80000000;
@@ -103,6 +118,10 @@ class FileHandle {
   // Flushes any pending write buffers to the underlying filesystem.
   virtual void Flush() = 0;
 
+  // Hints that the given range will be read soon, so the OS can start reading
+  // it into its cache in the background.
+  virtual void Prefetch(size_t file_offset, size_t length) {}
+
  protected:
   explicit FileHandle(std::wstring path) : path_(std::move(path)) {}
 
@@ -125,6 +144,32 @@ struct FileInfo {
 bool GetInfo(const std::wstring& path, FileInfo* out_info);
 std::vector<FileInfo> ListFiles(const std::wstring& path);
 
+// Watches directories under a root for entries being added, removed,
+// renamed or written to. The callback runs on a thread of the watcher with
+// the path of the directory whose listing changed, or an empty path when
+// events were lost and anything under the root may have changed.
+class DirectoryWatcher {
+ public:
+  typedef std::function<void(const std::wstring& path)> Callback;
+
+  // nullptr if the platform can't watch the root.
+  static std::unique_ptr<DirectoryWatcher> Create(const std::wstring& root,
+                                                  Callback callback);
+  virtual ~DirectoryWatcher() = default;
+
+  // Starts reporting changes to a directory under the root, by the path
+  // given here. Platforms that watch whole trees at once report every
+  // directory under the root from the start, by path joined to the root.
+  virtual bool Watch(const std::wstring& path) = 0;
+
+ protected:
+  DirectoryWatcher(std::wstring root, Callback callback)
+      : root_(std::move(root)), callback_(std::move(callback)) {}
+
+  std::wstring root_;
+  Callback callback_;
+};
+
 }  // namespace filesystem
 }  // namespace xe
 
@@ -10,20 +10,32 @@
 #include "xenia/base/assert.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
 #include "xenia/base/string.h"
+#include "xenia/base/threading.h"
 
 #include <assert.h>
 #include <dirent.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <ftw.h>
 #include <libgen.h>
 #include <pwd.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 #include <iostream>
+#include <mutex>
+#include <unordered_map>
+
+#if XE_PLATFORM_LINUX
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#endif  // XE_PLATFORM_LINUX
 
 namespace xe {
 namespace filesystem {
@@ -124,6 +136,20 @@ bool DeleteFile(const std::wstring& path) {
   return (xe::to_string(path).c_str()) == 0 ? true : false;
 }
 
+bool RenameFile(const std::wstring& from_path, const std::wstring& to_path) {
+  return rename(xe::to_string(from_path).c_str(),
+                xe::to_string(to_path).c_str()) == 0;
+}
+
+bool SetFileLength(FILE* file, size_t length) {
+  fflush(file);
+  return ftruncate(fileno(file), off_t(length)) == 0;
+}
+
+bool TryLockFile(FILE* file) {
+  return flock(fileno(file), LOCK_EX | LOCK_NB) == 0;
+}
+
 class PosixFileHandle : public FileHandle {
  public:
   PosixFileHandle(std::wstring path, int handle)
@@ -148,6 +174,11 @@ class PosixFileHandle : public FileHandle {
     return ftruncate(handle_, length) >= 0 ? true : false;
   }
   void Flush() override { fsync(handle_); }
+  void Prefetch(size_t file_offset, size_t length) override {
+#if XE_PLATFORM_LINUX
+    posix_fadvise(handle_, file_offset, length, POSIX_FADV_WILLNEED);
+#endif  // XE_PLATFORM_LINUX
+  }
 
  private:
   int handle_ = -1;
@@ -190,9 +221,13 @@ bool GetInfo(const std::wstring& path, FileInfo* out_info) {
   if (stat(xe::to_string(path).c_str(), &st) == 0) {
     if (S_ISDIR(st.st_mode)) {
       out_info->type = FileInfo::Type::kDirectory;
+      out_info->total_size = 0;
     } else {
       out_info->type = FileInfo::Type::kFile;
+      out_info->total_size = st.st_size;
     }
+    out_info->path = xe::find_base_path(path);
+    out_info->name = xe::find_name_from_path(path);
     out_info->create_timestamp = convertUnixtimeToWinFiletime(st.st_ctime);
     out_info->access_timestamp = convertUnixtimeToWinFiletime(st.st_atime);
     out_info->write_timestamp = convertUnixtimeToWinFiletime(st.st_mtime);
@@ -210,11 +245,15 @@ std::vector<FileInfo> ListFiles(const std::wstring& path) {
   }
 
   while (auto ent = readdir(dir)) {
+    if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, "..")) {
+      continue;
+    }
     FileInfo info;
 
+    info.path = path;
     info.name = xe::to_wstring(ent->d_name);
-    struct stat st;
-    stat((xe::to_string(path) + xe::to_string(info.name)).c_str(), &st);
+    struct stat st = {};
+    stat(xe::join_paths(xe::to_string(path), ent->d_name, '/').c_str(), &st);
     info.create_timestamp = convertUnixtimeToWinFiletime(st.st_ctime);
     info.access_timestamp = convertUnixtimeToWinFiletime(st.st_atime);
     info.write_timestamp = convertUnixtimeToWinFiletime(st.st_mtime);
@@ -227,9 +266,114 @@ std::vector<FileInfo> ListFiles(const std::wstring& path) {
     }
     result.push_back(info);
   }
+  closedir(dir);
 
   return result;
 }
 
+#if XE_PLATFORM_LINUX
+class InotifyDirectoryWatcher : public DirectoryWatcher {
+ public:
+  InotifyDirectoryWatcher(std::wstring root, Callback callback, int fd,
+                          int wake_fd)
+      : DirectoryWatcher(std::move(root), std::move(callback)),
+        fd_(fd),
+        wake_fd_(wake_fd) {
+    thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+    thread_->set_name("Directory Watcher");
+  }
+
+  ~InotifyDirectoryWatcher() override {
+    eventfd_write(wake_fd_, 1);
+    xe::threading::Wait(thread_.get(), false);
+    close(wake_fd_);
+    close(fd_);
+  }
+
+  bool Watch(const std::wstring& path) override {
+    int wd = inotify_add_watch(fd_, xe::to_string(path).c_str(),
+                               IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+                                   IN_MOVED_TO | IN_CLOSE_WRITE | IN_ONLYDIR);
+    if (wd < 0) {
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    paths_[wd] = path;
+    return true;
+  }
+
+ private:
+  void ThreadMain() {
+    alignas(struct inotify_event) char buffer[16 * 1024];
+    pollfd fds[] = {{fd_, POLLIN, 0}, {wake_fd_, POLLIN, 0}};
+    while (true) {
+      if (poll(fds, 2, -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return;
+      }
+      if (fds[1].revents) {
+        return;
+      }
+      ssize_t length = read(fd_, buffer, sizeof(buffer));
+      if (length <= 0) {
+        continue;
+      }
+      for (char* p = buffer; p < buffer + length;) {
+        auto event = reinterpret_cast<struct inotify_event*>(p);
+        p += sizeof(struct inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+          callback_(std::wstring());
+          continue;
+        }
+        std::wstring path;
+        {
+          std::lock_guard<std::mutex> lock(mutex_);
+          auto it = paths_.find(event->wd);
+          if (it == paths_.end()) {
+            continue;
+          }
+          if (event->mask & IN_IGNORED) {
+            // The directory itself is gone, which its parent reports.
+            paths_.erase(it);
+            continue;
+          }
+          path = it->second;
+        }
+        callback_(path);
+      }
+    }
+  }
+
+  int fd_;
+  // Written to stop the thread.
+  int wake_fd_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::mutex mutex_;
+  // Watched paths by watch descriptor.
+  std::unordered_map<int, std::wstring> paths_;
+};
+#endif  // XE_PLATFORM_LINUX
+
+std::unique_ptr<DirectoryWatcher> DirectoryWatcher::Create(
+    const std::wstring& root, Callback callback) {
+#if XE_PLATFORM_LINUX
+  int fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  int wake_fd = eventfd(0, EFD_CLOEXEC);
+  if (wake_fd < 0) {
+    close(fd);
+    return nullptr;
+  }
+  return std::make_unique<InotifyDirectoryWatcher>(root, std::move(callback),
+                                                   fd, wake_fd);
+#else
+  return nullptr;
+#endif  // XE_PLATFORM_LINUX
+}
+
 }  // namespace filesystem
 }  // namespace xe
@@ -10,11 +10,13 @@
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 
+#include <io.h>
 #include <string>
 
 #include <shlobj.h>
 
 #include "xenia/base/platform_win.h"
+#include "xenia/base/threading.h"
 
 namespace xe {
 namespace filesystem {
@@ -91,6 +93,32 @@ bool DeleteFile(const std::wstring& path) {
   return DeleteFileW(path.c_str()) ? true : false;
 }
 
+bool RenameFile(const std::wstring& from_path, const std::wstring& to_path) {
+  return MoveFileExW(from_path.c_str(), to_path.c_str(),
+                     MOVEFILE_REPLACE_EXISTING)
+             ? true
+             : false;
+}
+
+bool SetFileLength(FILE* file, size_t length) {
+  fflush(file);
+  return _chsize_s(_fileno(file), int64_t(length)) == 0;
+}
+
+bool TryLockFile(FILE* file) {
+  // Locks on Windows are mandatory, so the byte locked is far past the end of
+  // anything written, where it doesn't get in the way of reading.
+  auto handle = reinterpret_cast<HANDLE>(_get_osfhandle(_fileno(file)));
+  OVERLAPPED overlapped = {0};
+  overlapped.Offset = 0xFFFFFFFE;
+  overlapped.OffsetHigh = 0x7FFFFFFF;
+  return LockFileEx(handle,
+                    LOCKFILE_EXCLUSIVE_LOCK | LOCKFILE_FAIL_IMMEDIATELY, 0, 1,
+                    0, &overlapped)
+             ? true
+             : false;
+}
+
 class Win32FileHandle : public FileHandle {
  public:
   Win32FileHandle(std::wstring path, HANDLE handle)
@@ -249,5 +277,97 @@ std::vector<FileInfo> ListFiles(const std::wstring& path) {
   return result;
 }
 
+// Watches the whole tree under the root with one ReadDirectoryChangesW.
+class Win32DirectoryWatcher : public DirectoryWatcher {
+ public:
+  Win32DirectoryWatcher(std::wstring root, Callback callback, HANDLE handle)
+      : DirectoryWatcher(std::move(root), std::move(callback)),
+        handle_(handle) {
+    io_event_ = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    stop_event_ = CreateEvent(nullptr, TRUE, FALSE, nullptr);
+    thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+    thread_->set_name("Directory Watcher");
+  }
+
+  ~Win32DirectoryWatcher() override {
+    SetEvent(stop_event_);
+    xe::threading::Wait(thread_.get(), false);
+    CloseHandle(stop_event_);
+    CloseHandle(io_event_);
+    CloseHandle(handle_);
+  }
+
+  bool Watch(const std::wstring& path) override { return true; }
+
+ private:
+  void ThreadMain() {
+    // FILE_NOTIFY_INFORMATION must be DWORD aligned.
+    DWORD buffer[16 * 1024];
+    while (true) {
+      OVERLAPPED overlapped = {0};
+      overlapped.hEvent = io_event_;
+      ResetEvent(io_event_);
+      if (!ReadDirectoryChangesW(
+              handle_, buffer, sizeof(buffer), TRUE,
+              FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_DIR_NAME |
+                  FILE_NOTIFY_CHANGE_SIZE | FILE_NOTIFY_CHANGE_LAST_WRITE,
+              nullptr, &overlapped, nullptr)) {
+        return;
+      }
+      HANDLE handles[] = {io_event_, stop_event_};
+      DWORD bytes = 0;
+      if (WaitForMultipleObjects(2, handles, FALSE, INFINITE) !=
+          WAIT_OBJECT_0) {
+        CancelIoEx(handle_, &overlapped);
+        GetOverlappedResult(handle_, &overlapped, &bytes, TRUE);
+        return;
+      }
+      if (!GetOverlappedResult(handle_, &overlapped, &bytes, FALSE)) {
+        return;
+      }
+      if (!bytes) {
+        // The buffer overflowed and the changes were dropped.
+        callback_(std::wstring());
+        continue;
+      }
+      auto info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(buffer);
+      while (true) {
+        // Names are relative to the root, the directory is everything before
+        // the last separator.
+        std::wstring name(info->FileName,
+                          info->FileNameLength / sizeof(wchar_t));
+        auto separator = name.find_last_of(L'\\');
+        callback_(separator == std::wstring::npos
+                      ? root_
+                      : xe::join_paths(root_, name.substr(0, separator)));
+        if (!info->NextEntryOffset) {
+          break;
+        }
+        info = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(
+            reinterpret_cast<uint8_t*>(info) + info->NextEntryOffset);
+      }
+    }
+  }
+
+  HANDLE handle_;
+  HANDLE io_event_;
+  HANDLE stop_event_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+};
+
+std::unique_ptr<DirectoryWatcher> DirectoryWatcher::Create(
+    const std::wstring& root, Callback callback) {
+  HANDLE handle = CreateFileW(
+      root.c_str(), FILE_LIST_DIRECTORY,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED,
+      nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    return nullptr;
+  }
+  return std::make_unique<Win32DirectoryWatcher>(root, std::move(callback),
+                                                 handle);
+}
+
 }  // namespace filesystem
 }  // namespace xe
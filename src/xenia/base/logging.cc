@@ -11,19 +11,19 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <atomic>
 #include <cinttypes>
 #include <cstdarg>
 #include <cstdlib>
+#include <memory>
 #include <mutex>
 #include <vector>
 
-#include "xenia/base/atomic.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/main.h"
 #include "xenia/base/math.h"
-#include "xenia/base/memory.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/base/threading.h"
 
@@ -41,6 +41,9 @@ DEFINE_bool(flush_log, true, "Flush log file after each log line batch.");
 DEFINE_int32(
     log_level, 2,
     "Maximum level to be logged. (0=error, 1=warning, 2=info, 3=debug)");
+DEFINE_int32(log_thread_buffer_kb, 256,
+             "Size of the log buffer of each thread, in KB. A thread waits "
+             "for the writer when its buffer is full.");
 
 namespace xe {
 
@@ -49,9 +52,53 @@ class Logger;
 Logger* logger_ = nullptr;
 thread_local std::vector<char> log_format_buffer_(64 * 1024);
 
+namespace {
+
+struct LineHeader {
+  // Global order of the line, for interleaving the threads.
+  uint64_t sequence;
+  uint32_t buffer_length;
+  uint32_t thread_id;
+  uint16_t _pad_0;  // (2b) padding
+  uint8_t _pad_1;   // (1b) padding
+  char prefix_char;
+};
+
+// Lines of one thread, written only by it and read only by whoever holds
+// the drain lock, so neither side needs a lock or a CAS loop.
+struct ThreadBuffer {
+  explicit ThreadBuffer(size_t capacity) : data(capacity) {}
+
+  std::vector<uint8_t> data;
+  std::atomic<size_t> write_offset = {0};
+  std::atomic<size_t> read_offset = {0};
+  // Set when the thread exits, so that a new thread can take the buffer over
+  // once it has been drained.
+  std::atomic<bool> retired = {false};
+};
+
+struct ThreadBufferHolder {
+  ~ThreadBufferHolder();
+
+  Logger* logger = nullptr;
+  ThreadBuffer* buffer = nullptr;
+};
+
+thread_local ThreadBufferHolder thread_buffer_holder_;
+
+ThreadBufferHolder::~ThreadBufferHolder() {
+  if (buffer && logger == logger_) {
+    buffer->retired = true;
+  }
+}
+
+}  // namespace
+
 class Logger {
  public:
-  explicit Logger(const std::wstring& app_name) : running_(true) {
+  explicit Logger(const std::wstring& app_name)
+      : running_(true),
+        buffer_capacity_(std::max(FLAGS_log_thread_buffer_kb, 4) * 1024) {
     if (FLAGS_log_file.empty()) {
       // Default to app name.
       auto file_path = app_name + L".log";
@@ -67,6 +114,7 @@ class Logger {
       }
     }
 
+    wake_event_ = xe::threading::Event::CreateAutoResetEvent(false);
     write_thread_ =
         xe::threading::Thread::Create({}, [this]() { WriteThread(); });
     write_thread_->set_name("xe::FileLogSink Writer");
@@ -74,7 +122,9 @@ class Logger {
 
   ~Logger() {
     running_ = false;
+    wake_event_->Set();
     xe::threading::Wait(write_thread_.get(), true);
+    Drain();
     fflush(file_);
     fclose(file_);
   }
@@ -86,63 +136,94 @@ class Logger {
       return;
     }
 
-    LogLine line;
-    line.buffer_length = buffer_length;
-    line.thread_id = thread_id;
-    line.prefix_char = prefix_char;
+    // A line that can't ever fit is cut, leaving a byte free as a full ring
+    // would look empty.
+    buffer_length =
+        std::min(buffer_length, buffer_capacity_ - sizeof(LineHeader) - 1);
+    size_t size = sizeof(LineHeader) + buffer_length;
 
-    // First, run a check and see if we can increment write
-    // head without any problems. If so, cmpxchg it to reserve some space in the
-    // ring. If someone beats us, loop around.
-    //
-    // Once we have a reservation, write our data and then increment the write
-    // tail.
-    size_t size = sizeof(LogLine) + buffer_length;
+    ThreadBuffer* thread_buffer = GetThreadBuffer();
+    RingBuffer rb(thread_buffer->data.data(), buffer_capacity_);
+    rb.set_write_offset(
+        thread_buffer->write_offset.load(std::memory_order_relaxed));
     while (true) {
-      // Attempt to make a reservation.
-      size_t write_head = write_head_;
-      size_t read_head = read_head_;
-
-      RingBuffer rb(buffer_, kBufferSize);
-      rb.set_write_offset(write_head);
-      rb.set_read_offset(read_head);
-      if (rb.write_count() < size) {
-        xe::threading::MaybeYield();
-        continue;
+      rb.set_read_offset(
+          thread_buffer->read_offset.load(std::memory_order_acquire));
+      if (rb.write_count() > size) {
+        break;
       }
+      // Full, wait for the writer to make room.
+      wake_event_->Set();
+      xe::threading::MaybeYield();
+    }
 
-      // We have enough size to make a reservation!
-      rb.AdvanceWrite(size);
-      if (xe::atomic_cas(write_head, rb.write_offset(), &write_head_)) {
-        // Reservation made. Write out logline.
-        rb.set_write_offset(write_head);
-        rb.Write(&line, sizeof(LogLine));
-        rb.Write(buffer, buffer_length);
-
-        while (!xe::atomic_cas(write_head, rb.write_offset(), &write_tail_)) {
-          // Done writing. End the reservation.
-          xe::threading::MaybeYield();
-        }
+    LineHeader line;
+    line.sequence = sequence_.fetch_add(1, std::memory_order_relaxed);
+    line.buffer_length = uint32_t(buffer_length);
+    line.thread_id = thread_id;
+    line.prefix_char = prefix_char;
+    rb.Write(&line, sizeof(LineHeader));
+    rb.Write(buffer, buffer_length);
+    thread_buffer->write_offset.store(rb.write_offset(),
+                                      std::memory_order_release);
+
+    // Otherwise the writer picks the line up on its next round, so that
+    // chatty threads don't pay for a wake up per line.
+    if (level == LogLevel::Error || rb.read_count() > buffer_capacity_ / 2) {
+      wake_event_->Set();
+    }
+  }
 
-        break;
-      } else {
-        // Someone beat us to the chase. Loop around.
-        continue;
-      }
+  void Flush() {
+    // The writer may have been stopped mid-drain by a crash, so don't wait on
+    // it forever.
+    std::unique_lock<std::mutex> lock(drain_mutex_, std::defer_lock);
+    for (int i = 0; i < kFlushAttemptCount && !lock.try_lock(); ++i) {
+      xe::threading::Sleep(std::chrono::milliseconds(1));
+    }
+    if (!lock.owns_lock()) {
+      return;
     }
+    Drain();
+    fflush(file_);
   }
 
  private:
-  static const size_t kBufferSize = 8 * 1024 * 1024;
-
-  struct LogLine {
-    size_t buffer_length;
-    uint32_t thread_id;
-    uint16_t _pad_0;  // (2b) padding
-    uint8_t _pad_1;   // (1b) padding
-    char prefix_char;
+  // How often the writer looks for lines when nobody wakes it.
+  static const uint32_t kWriteIntervalMs = 10;
+  static const int kFlushAttemptCount = 100;
+
+  struct DrainHead {
+    ThreadBuffer* buffer;
+    bool has_line;
+    LineHeader line;
   };
 
+  ThreadBuffer* GetThreadBuffer() {
+    auto& holder = thread_buffer_holder_;
+    if (holder.logger == this) {
+      return holder.buffer;
+    }
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    ThreadBuffer* buffer = nullptr;
+    for (auto& it : buffers_) {
+      if (it->retired &&
+          it->read_offset.load(std::memory_order_acquire) ==
+              it->write_offset.load(std::memory_order_relaxed)) {
+        buffer = it.get();
+        buffer->retired = false;
+        break;
+      }
+    }
+    if (!buffer) {
+      buffers_.emplace_back(new ThreadBuffer(buffer_capacity_));
+      buffer = buffers_.back().get();
+    }
+    holder.logger = this;
+    holder.buffer = buffer;
+    return buffer;
+  }
+
   void Write(const char* buf, size_t size) {
     if (file_) {
       fwrite(buf, 1, size, file_);
@@ -153,109 +234,166 @@ class Logger {
     }
   }
 
-  void WriteThread() {
-    RingBuffer rb(buffer_, kBufferSize);
-    uint32_t idle_loops = 0;
-    while (true) {
-      bool did_write = false;
-      rb.set_write_offset(write_tail_);
-      if (!running_ && rb.empty()) {
-        break;
-      }
-      while (!rb.empty()) {
-        did_write = true;
-
-        // Read line header and write out the line prefix.
-        LogLine line;
-        rb.Read(&line, sizeof(line));
-        char prefix[] = {
-            line.prefix_char,
-            '>',
-            ' ',
-            '0',  // Thread ID gets placed here (8 chars).
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            '0',
-            ' ',
-            0,
-        };
-        std::snprintf(prefix + 3, sizeof(prefix) - 3, "%08" PRIX32 " ",
-                      line.thread_id);
-        Write(prefix, sizeof(prefix) - 1);
-        if (line.buffer_length) {
-          // Get access to the line data - which may be split in the ring buffer
-          // - and write it out in parts.
-          auto line_range = rb.BeginRead(line.buffer_length);
-          Write(reinterpret_cast<const char*>(line_range.first),
-                line_range.first_length);
-          if (line_range.second_length) {
-            Write(reinterpret_cast<const char*>(line_range.second),
-                  line_range.second_length);
-          }
-          // Always ensure there is a newline.
-          char last_char = line_range.second
-                               ? line_range.second[line_range.second_length - 1]
-                               : line_range.first[line_range.first_length - 1];
-          if (last_char != '\n') {
-            const char suffix[1] = {'\n'};
-            Write(suffix, 1);
-          }
-          rb.EndRead(std::move(line_range));
-        } else {
-          const char suffix[1] = {'\n'};
-          Write(suffix, 1);
-        }
+  bool PeekLine(DrainHead* head) {
+    auto buffer = head->buffer;
+    size_t read_offset = buffer->read_offset.load(std::memory_order_relaxed);
+    size_t write_offset = buffer->write_offset.load(std::memory_order_acquire);
+    if (read_offset == write_offset) {
+      return false;
+    }
+    RingBuffer rb(buffer->data.data(), buffer_capacity_);
+    rb.set_read_offset(read_offset);
+    rb.set_write_offset(write_offset);
+    rb.Read(&head->line, sizeof(LineHeader));
+    head->has_line = true;
+    return true;
+  }
 
-        rb.set_write_offset(write_tail_);
-        read_head_ = rb.read_offset();
+  void WriteLine(DrainHead* head) {
+    auto buffer = head->buffer;
+    auto& line = head->line;
+    RingBuffer rb(buffer->data.data(), buffer_capacity_);
+    rb.set_read_offset(buffer->read_offset.load(std::memory_order_relaxed));
+    rb.set_write_offset(buffer->write_offset.load(std::memory_order_acquire));
+    rb.AdvanceRead(sizeof(LineHeader));
+
+    // Write out the line prefix.
+    char prefix[] = {
+        line.prefix_char,
+        '>',
+        ' ',
+        '0',  // Thread ID gets placed here (8 chars).
+        '0',
+        '0',
+        '0',
+        '0',
+        '0',
+        '0',
+        '0',
+        ' ',
+        0,
+    };
+    std::snprintf(prefix + 3, sizeof(prefix) - 3, "%08" PRIX32 " ",
+                  line.thread_id);
+    Write(prefix, sizeof(prefix) - 1);
+    if (line.buffer_length) {
+      // Get access to the line data - which may be split in the ring buffer
+      // - and write it out in parts.
+      auto line_range = rb.BeginRead(line.buffer_length);
+      Write(reinterpret_cast<const char*>(line_range.first),
+            line_range.first_length);
+      if (line_range.second_length) {
+        Write(reinterpret_cast<const char*>(line_range.second),
+              line_range.second_length);
       }
-      if (did_write) {
-        if (FLAGS_flush_log) {
-          fflush(file_);
+      // Always ensure there is a newline.
+      char last_char = line_range.second
+                           ? line_range.second[line_range.second_length - 1]
+                           : line_range.first[line_range.first_length - 1];
+      if (last_char != '\n') {
+        const char suffix[1] = {'\n'};
+        Write(suffix, 1);
+      }
+      rb.EndRead(std::move(line_range));
+    } else {
+      const char suffix[1] = {'\n'};
+      Write(suffix, 1);
+    }
+
+    buffer->read_offset.store(rb.read_offset(), std::memory_order_release);
+    head->has_line = false;
+  }
+
+  // Writes out the lines of all threads, merged back in sequence order.
+  // Lines of a thread always come out in the order it logged them; across
+  // threads a line may come out after a later one that was published first.
+  // drain_mutex_ must be held.
+  bool Drain() {
+    {
+      // The list only grows. If a crashed thread holds the lock, go with the
+      // threads known already.
+      std::unique_lock<std::mutex> lock(buffers_mutex_, std::try_to_lock);
+      if (lock.owns_lock()) {
+        for (size_t i = drain_heads_.size(); i < buffers_.size(); ++i) {
+          drain_heads_.push_back({buffers_[i].get(), false, {}});
         }
+      }
+    }
 
-        idle_loops = 0;
-      } else {
-        if (idle_loops > 1000) {
-          // Introduce a waiting period.
-          xe::threading::Sleep(std::chrono::milliseconds(50));
+    bool did_write = false;
+    while (true) {
+      DrainHead* oldest = nullptr;
+      for (auto& head : drain_heads_) {
+        if (!head.has_line && !PeekLine(&head)) {
+          continue;
+        }
+        if (!oldest || head.line.sequence < oldest->line.sequence) {
+          oldest = &head;
         }
+      }
+      if (!oldest) {
+        break;
+      }
+      WriteLine(oldest);
+      did_write = true;
+    }
+    return did_write;
+  }
 
-        idle_loops++;
+  void WriteThread() {
+    while (running_) {
+      xe::threading::Wait(wake_event_.get(), false,
+                          std::chrono::milliseconds(kWriteIntervalMs));
+      std::lock_guard<std::mutex> lock(drain_mutex_);
+      if (Drain() && FLAGS_flush_log) {
+        fflush(file_);
       }
     }
   }
 
-  volatile size_t write_tail_ = 0;
-  size_t write_head_ = 0;
-  size_t read_head_ = 0;
-  uint8_t buffer_[kBufferSize];
   FILE* file_ = nullptr;
 
   std::atomic<bool> running_;
+  size_t buffer_capacity_;
+  std::atomic<uint64_t> sequence_ = {0};
+
+  std::mutex buffers_mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+
+  std::mutex drain_mutex_;
+  std::vector<DrainHead> drain_heads_;
+
+  std::unique_ptr<xe::threading::Event> wake_event_;
   std::unique_ptr<xe::threading::Thread> write_thread_;
 };
 
+const uint32_t Logger::kWriteIntervalMs;
+
 void InitializeLogging(const std::wstring& app_name) {
-  auto mem = memory::AlignedAlloc<Logger>(0x10);
-  logger_ = new (mem) Logger(app_name);
+  logger_ = new Logger(app_name);
 }
 
 void ShutdownLogging() {
   Logger* logger = logger_;
   logger_ = nullptr;
 
-  logger->~Logger();
-  memory::AlignedFree(logger);
+  delete logger;
+}
+
+void FlushLog() {
+  if (logger_) {
+    logger_->Flush();
+  }
+}
+
+bool IsLogLevelEnabled(LogLevel log_level) {
+  return logger_ && static_cast<int32_t>(log_level) <= FLAGS_log_level;
 }
 
 void LogLineFormat(LogLevel log_level, const char prefix_char, const char* fmt,
                    ...) {
-  if (!logger_) {
+  // Skip formatting lines that would be discarded anyway.
+  if (!IsLogLevelEnabled(log_level)) {
     return;
   }
 
@@ -275,7 +413,7 @@ void LogLineFormat(LogLevel log_level, const char prefix_char, const char* fmt,
 
 void LogLineVarargs(LogLevel log_level, const char prefix_char, const char* fmt,
                     va_list args) {
-  if (!logger_) {
+  if (!IsLogLevelEnabled(log_level)) {
     return;
   }
 
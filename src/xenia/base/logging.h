@@ -19,6 +19,12 @@ namespace xe {
 
 #define XE_OPTION_ENABLE_LOGGING 1
 
+// Lines above this level are compiled out, arguments included, whatever
+// --log_level says.
+#ifndef XE_OPTION_MAX_LOG_LEVEL
+#define XE_OPTION_MAX_LOG_LEVEL 3
+#endif  // XE_OPTION_MAX_LOG_LEVEL
+
 // Log level is a general indication of the importance of a given log line.
 //
 // While log levels are named, they are a rough correlation of what the log line
@@ -34,9 +40,20 @@ enum class LogLevel {
 
 // Initializes the logging system and any outputs requested.
 // Must be called on startup.
+// Each thread formats its lines into a buffer of its own, which a writer
+// thread drains in the background. Shutting down writes out what's left.
 void InitializeLogging(const std::wstring& app_name);
 void ShutdownLogging();
 
+// Writes out the lines buffered so far and flushes the log file, for an
+// exception handler to call before the process goes down. Gives up if the
+// writer doesn't let go of the buffers within a short while.
+void FlushLog();
+
+// Returns true if lines at the given level will be written anywhere.
+// Callers building expensive log lines should check this first.
+bool IsLogLevelEnabled(LogLevel log_level);
+
 // Appends a line to the log with printf-style formatting.
 void LogLineFormat(LogLevel log_level, const char prefix_char, const char* fmt,
                    ...);
@@ -54,11 +71,15 @@ void FatalError(const char* fmt, ...);
 void FatalError(const std::string& str);
 
 #if XE_OPTION_ENABLE_LOGGING
-#define XELOGCORE(level, prefix, fmt, ...) \
-  xe::LogLineFormat(level, prefix, fmt, ##__VA_ARGS__)
+#define XELOGCORE(level, prefix, fmt, ...)                    \
+  do {                                                        \
+    if (static_cast<int>(level) <= XE_OPTION_MAX_LOG_LEVEL) { \
+      xe::LogLineFormat(level, prefix, fmt, ##__VA_ARGS__);   \
+    }                                                         \
+  } while (false)
 #else
-#define XELOGCORE(level, fmt, ...) \
-  do {                             \
+#define XELOGCORE(level, prefix, fmt, ...) \
+  do {                                     \
   } while (false)
 #endif  // ENABLE_LOGGING
 
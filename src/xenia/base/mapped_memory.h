@@ -44,6 +44,10 @@ class MappedMemory {
   virtual void Close(uint64_t truncate_size = 0) {}
   virtual void Flush() {}
 
+  // Hints that the given range will be read soon, so the OS can start paging
+  // it in from the file in the background.
+  virtual void Prefetch(size_t offset, size_t length) {}
+
   // Changes the offset inside the file. This will update data() and size()!
   virtual bool Remap(size_t offset, size_t length) { return false; }
 
@@ -10,6 +10,8 @@
 #include "xenia/base/mapped_memory.h"
 
 #include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
 #include <cstdio>
 #include <memory>
 
@@ -31,6 +33,18 @@ class PosixMappedMemory : public MappedMemory {
     }
   }
 
+  void Prefetch(size_t offset, size_t length) override {
+    if (!data_ || offset >= size_) {
+      return;
+    }
+    length = std::min(length, size_ - offset);
+    // madvise needs a page-aligned start.
+    size_t page_size = size_t(sysconf(_SC_PAGESIZE));
+    size_t aligned_offset = offset & ~(page_size - 1);
+    madvise(data() + aligned_offset, length + (offset - aligned_offset),
+            MADV_WILLNEED);
+  }
+
   FILE* file_handle;
 };
 
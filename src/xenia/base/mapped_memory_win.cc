@@ -9,6 +9,7 @@
 
 #include "xenia/base/mapped_memory.h"
 
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <vector>
@@ -60,6 +61,28 @@ class Win32MappedMemory : public MappedMemory {
   }
 
   void Flush() override { FlushViewOfFile(data(), size()); }
+  void Prefetch(size_t offset, size_t length) override {
+    if (!data_ || offset >= size_) {
+      return;
+    }
+    // Windows 8+, so looked up at runtime. Without it the view is paged in
+    // on demand as before.
+    struct MemoryRangeEntry {
+      PVOID VirtualAddress;
+      SIZE_T NumberOfBytes;
+    };
+    typedef BOOL(WINAPI * PrefetchVirtualMemoryFn)(HANDLE, ULONG_PTR,
+                                                    MemoryRangeEntry*, ULONG);
+    static auto prefetch_virtual_memory =
+        reinterpret_cast<PrefetchVirtualMemoryFn>(GetProcAddress(
+            GetModuleHandleW(L"kernel32.dll"), "PrefetchVirtualMemory"));
+    if (!prefetch_virtual_memory) {
+      return;
+    }
+    MemoryRangeEntry range = {data() + offset,
+                              std::min(length, size_ - offset)};
+    prefetch_virtual_memory(GetCurrentProcess(), 1, &range, 0);
+  }
   bool Remap(size_t offset, size_t length) override {
     size_t aligned_offset = offset & ~(memory::allocation_granularity() - 1);
     size_t aligned_length = length + (offset - aligned_offset);
@@ -12,9 +12,21 @@
 
 #include <algorithm>
 
+#include "xenia/base/math.h"
+
+#if XE_ARCH_AMD64
+#include <immintrin.h>
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#define XE_AVX2_TARGET
+#else
+#include <cpuid.h>
+#define XE_AVX2_TARGET __attribute__((target("avx2")))
+#endif  // XE_COMPILER_MSVC
+#endif  // XE_ARCH_AMD64
+
 namespace xe {
 
-// TODO(benvanik): fancy AVX versions.
 // https://github.com/gnuradio/volk/blob/master/kernels/volk/volk_16u_byteswap.h
 // https://github.com/gnuradio/volk/blob/master/kernels/volk/volk_32u_byteswap.h
 // https://github.com/gnuradio/volk/blob/master/kernels/volk/volk_64u_byteswap.h
@@ -28,6 +40,175 @@ void copy_128_aligned(void* dest, const void* src, size_t count) {
 }
 
 #if XE_ARCH_AMD64
+namespace {
+
+// pshufb masks, applied to both 128-bit lanes by the AVX2 paths.
+alignas(16) const uint8_t kSwap16Mask[16] = {1, 0, 3,  2,  5,  4,  7,  6,
+                                             9, 8, 11, 10, 13, 12, 15, 14};
+alignas(16) const uint8_t kSwap32Mask[16] = {3,  2,  1, 0, 7,  6,  5,  4,
+                                             11, 10, 9, 8, 15, 14, 13, 12};
+alignas(16) const uint8_t kSwap64Mask[16] = {7,  6,  5,  4,  3,  2,  1, 0,
+                                             15, 14, 13, 12, 11, 10, 9, 8};
+alignas(16) const uint8_t kSwap16In32Mask[16] = {2,  3,  0, 1, 6,  7,  4,  5,
+                                                 10, 11, 8, 9, 14, 15, 12, 13};
+
+bool HostHasAvx2() {
+  // The OS must save the YMM registers: OSXSAVE, then XCR0 bits 1 and 2.
+#if XE_COMPILER_MSVC
+  int regs[4];
+  __cpuid(regs, 1);
+  if (!(regs[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6) {
+    return false;
+  }
+  __cpuidex(regs, 7, 0);
+  uint32_t ebx = uint32_t(regs[1]);
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 27))) {
+    return false;
+  }
+  uint32_t xcr0_low, xcr0_high;
+  __asm__("xgetbv" : "=a"(xcr0_low), "=d"(xcr0_high) : "c"(0));
+  if ((xcr0_low & 0x6) != 0x6 ||
+      !__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+#endif  // XE_COMPILER_MSVC
+  // AVX2 is leaf 7 ebx bit 5.
+  return (ebx & (1u << 5)) != 0;
+}
+
+// Checked once, as the kernels are called for every texture row or block.
+const bool kHostHasAvx2 = HostHasAvx2();
+
+// Copies at least this long bypass the caches when stored. They would evict
+// everything else from them otherwise, and what they go to, such as GPU
+// buffers and save states, isn't read back by the CPU right away.
+const size_t kNonTemporalLength = 2 * 1024 * 1024;
+
+// Shuffles 32 bytes at a time with mask and returns how many bytes were done,
+// leaving the rest to the SSE loops.
+XE_AVX2_TARGET size_t shuffle_avx2(void* dest_ptr, const void* src_ptr,
+                                   size_t length, const uint8_t* mask) {
+  auto dest = reinterpret_cast<uint8_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint8_t*>(src_ptr);
+  __m256i shufmask = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(mask)));
+  size_t i;
+  // Streaming stores need an aligned destination, and the mask applies from
+  // the start, so the destination can't be aligned with a shorter first copy.
+  if (length >= kNonTemporalLength &&
+      !(reinterpret_cast<uintptr_t>(dest) & 31)) {
+    for (i = 0; i + 32 <= length; i += 32) {
+      __m256i input =
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+      __m256i output = _mm256_shuffle_epi8(input, shufmask);
+      _mm256_stream_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+    }
+    // Ordered before the stores of the rest, and of whatever comes next.
+    _mm_sfence();
+    return i;
+  }
+  for (i = 0; i + 32 <= length; i += 32) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    __m256i output = _mm256_shuffle_epi8(input, shufmask);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+  }
+  return i;
+}
+
+XE_AVX2_TARGET size_t cmp_swap_16_avx2(uint16_t* dest, const uint16_t* src,
+                                       uint16_t cmp_value, size_t count) {
+  __m256i shufmask = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(kSwap16Mask)));
+  __m256i cmpval = _mm256_set1_epi16(cmp_value);
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    __m256i output = _mm256_shuffle_epi8(input, shufmask);
+    __m256i mask = _mm256_cmpeq_epi16(output, cmpval);
+    output = _mm256_or_si256(output, mask);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+  }
+  return i;
+}
+
+XE_AVX2_TARGET size_t cmp_swap_32_avx2(uint32_t* dest, const uint32_t* src,
+                                       uint32_t cmp_value, size_t count) {
+  __m256i shufmask = _mm256_broadcastsi128_si256(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(kSwap32Mask)));
+  __m256i cmpval = _mm256_set1_epi32(cmp_value);
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    __m256i input =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(&src[i]));
+    __m256i output = _mm256_shuffle_epi8(input, shufmask);
+    __m256i mask = _mm256_cmpeq_epi32(output, cmpval);
+    output = _mm256_or_si256(output, mask);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]), output);
+  }
+  return i;
+}
+
+// Clamps, scales and truncates 4 samples, NaN becoming 1 as with
+// xe::saturate.
+inline __m128i convert_f32_to_s32_sse2(const float* src) {
+  __m128 value = _mm_loadu_ps(src);
+  value = _mm_max_ps(_mm_min_ps(value, _mm_set1_ps(1.0f)), _mm_set1_ps(-1.0f));
+  return _mm_cvttps_epi32(_mm_mul_ps(value, _mm_set1_ps(32767.0f)));
+}
+
+inline __m128i swap_16_sse2(__m128i value) {
+  return _mm_or_si128(_mm_slli_epi16(value, 8), _mm_srli_epi16(value, 8));
+}
+
+XE_AVX2_TARGET inline __m256i convert_f32_to_s32_avx2(const float* src) {
+  __m256 value = _mm256_loadu_ps(src);
+  value = _mm256_max_ps(_mm256_min_ps(value, _mm256_set1_ps(1.0f)),
+                        _mm256_set1_ps(-1.0f));
+  return _mm256_cvttps_epi32(_mm256_mul_ps(value, _mm256_set1_ps(32767.0f)));
+}
+
+XE_AVX2_TARGET inline __m256i swap_16_avx2(__m256i value) {
+  return _mm256_or_si256(_mm256_slli_epi16(value, 8),
+                         _mm256_srli_epi16(value, 8));
+}
+
+XE_AVX2_TARGET size_t convert_f32_to_s16_be_avx2(uint16_t* dest,
+                                                 const float* src,
+                                                 size_t count) {
+  size_t i;
+  for (i = 0; i + 16 <= count; i += 16) {
+    // Packing works within 128-bit lanes, so put the quadwords back in order.
+    __m256i output = _mm256_packs_epi32(convert_f32_to_s32_avx2(&src[i]),
+                                        convert_f32_to_s32_avx2(&src[i + 8]));
+    output = _mm256_permute4x64_epi64(output, 0xD8);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i]),
+                        swap_16_avx2(output));
+  }
+  return i;
+}
+
+XE_AVX2_TARGET size_t convert_f32_to_s16_be_interleaved_avx2(
+    uint16_t* dest, const float* left, const float* right, size_t count) {
+  size_t i;
+  for (i = 0; i + 8 <= count; i += 8) {
+    // Each lane gets 4 left and 4 right samples, which unpack to 4 pairs.
+    __m256i left_value = convert_f32_to_s32_avx2(&left[i]);
+    __m256i right_value = convert_f32_to_s32_avx2(&right[i]);
+    __m256i output =
+        _mm256_unpacklo_epi16(_mm256_packs_epi32(left_value, left_value),
+                              _mm256_packs_epi32(right_value, right_value));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(&dest[i * 2]),
+                        swap_16_avx2(output));
+  }
+  return i;
+}
+
+}  // namespace
+
 void copy_and_swap_16_aligned(void* dest_ptr, const void* src_ptr,
                               size_t count) {
   assert_zero(reinterpret_cast<uintptr_t>(dest_ptr) & 0xF);
@@ -40,7 +221,10 @@ void copy_and_swap_16_aligned(void* dest_ptr, const void* src_ptr,
                    0x04, 0x05, 0x02, 0x03, 0x00, 0x01);
 
   size_t i = 0;
-  for (i = 0; i + 8 <= count; i += 8) {
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 2, kSwap16Mask) / 2;
+  }
+  for (; i + 8 <= count; i += 8) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_store_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -58,8 +242,11 @@ void copy_and_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x0E, 0x0F, 0x0C, 0x0D, 0x0A, 0x0B, 0x08, 0x09, 0x06, 0x07,
                    0x04, 0x05, 0x02, 0x03, 0x00, 0x01);
 
-  size_t i;
-  for (i = 0; i + 8 <= count; i += 8) {
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 2, kSwap16Mask) / 2;
+  }
+  for (; i + 8 <= count; i += 8) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -80,8 +267,11 @@ void copy_and_swap_32_aligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
                    0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
 
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 4, kSwap32Mask) / 4;
+  }
+  for (; i + 4 <= count; i += 4) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_store_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -99,8 +289,11 @@ void copy_and_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
                    0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
 
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 4, kSwap32Mask) / 4;
+  }
+  for (; i + 4 <= count; i += 4) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -121,8 +314,11 @@ void copy_and_swap_64_aligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x00, 0x01,
                    0x02, 0x03, 0x04, 0x05, 0x06, 0x07);
 
-  size_t i;
-  for (i = 0; i + 2 <= count; i += 2) {
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 8, kSwap64Mask) / 8;
+  }
+  for (; i + 2 <= count; i += 2) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_store_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -140,8 +336,11 @@ void copy_and_swap_64_unaligned(void* dest_ptr, const void* src_ptr,
       _mm_set_epi8(0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F, 0x00, 0x01,
                    0x02, 0x03, 0x04, 0x05, 0x06, 0x07);
 
-  size_t i;
-  for (i = 0; i + 2 <= count; i += 2) {
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 8, kSwap64Mask) / 8;
+  }
+  for (; i + 2 <= count; i += 2) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output = _mm_shuffle_epi8(input, shufmask);
     _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
@@ -153,10 +352,13 @@ void copy_and_swap_64_unaligned(void* dest_ptr, const void* src_ptr,
 
 void copy_and_swap_16_in_32_aligned(void* dest_ptr, const void* src_ptr,
                                     size_t count) {
-  auto dest = reinterpret_cast<uint64_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint64_t*>(src_ptr);
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 4, kSwap16In32Mask) / 4;
+  }
+  for (; i + 4 <= count; i += 4) {
     __m128i input = _mm_load_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output =
         _mm_or_si128(_mm_slli_epi32(input, 16), _mm_srli_epi32(input, 16));
@@ -169,10 +371,13 @@ void copy_and_swap_16_in_32_aligned(void* dest_ptr, const void* src_ptr,
 
 void copy_and_swap_16_in_32_unaligned(void* dest_ptr, const void* src_ptr,
                                       size_t count) {
-  auto dest = reinterpret_cast<uint64_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint64_t*>(src_ptr);
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = shuffle_avx2(dest, src, count * 4, kSwap16In32Mask) / 4;
+  }
+  for (; i + 4 <= count; i += 4) {
     __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
     __m128i output =
         _mm_or_si128(_mm_slli_epi32(input, 16), _mm_srli_epi32(input, 16));
@@ -182,6 +387,104 @@ void copy_and_swap_16_in_32_unaligned(void* dest_ptr, const void* src_ptr,
     dest[i] = (src[i] >> 16) | (src[i] << 16);
   }
 }
+
+void copy_cmp_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
+                                uint16_t cmp_value, size_t count) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint16_t*>(src_ptr);
+  __m128i shufmask =
+      _mm_set_epi8(0x0E, 0x0F, 0x0C, 0x0D, 0x0A, 0x0B, 0x08, 0x09, 0x06, 0x07,
+                   0x04, 0x05, 0x02, 0x03, 0x00, 0x01);
+  __m128i cmpval = _mm_set1_epi16(cmp_value);
+
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = cmp_swap_16_avx2(dest, src, cmp_value, count);
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+    __m128i output = _mm_shuffle_epi8(input, shufmask);
+
+    __m128i mask = _mm_cmpeq_epi16(output, cmpval);
+    output = _mm_or_si128(output, mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    uint16_t value = byte_swap(src[i]);
+    dest[i] = value == cmp_value ? 0xFFFF : value;
+  }
+}
+
+void copy_cmp_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
+                                uint32_t cmp_value, size_t count) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  __m128i shufmask =
+      _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
+                   0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
+  __m128i cmpval = _mm_set1_epi32(cmp_value);
+
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = cmp_swap_32_avx2(dest, src, cmp_value, count);
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
+    __m128i output = _mm_shuffle_epi8(input, shufmask);
+
+    __m128i mask = _mm_cmpeq_epi32(output, cmpval);
+    output = _mm_or_si128(output, mask);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    uint32_t value = byte_swap(src[i]);
+    dest[i] = value == cmp_value ? 0xFFFFFFFF : value;
+  }
+}
+
+void convert_f32_to_s16_be(void* dest_ptr, const float* src, size_t count) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = convert_f32_to_s16_be_avx2(dest, src, count);
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m128i output = _mm_packs_epi32(convert_f32_to_s32_sse2(&src[i]),
+                                     convert_f32_to_s32_sse2(&src[i + 4]));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]),
+                     swap_16_sse2(output));
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    dest[i] = byte_swap(uint16_t(int(xe::saturate(src[i]) * 32767.0f)));
+  }
+}
+
+void convert_f32_to_s16_be_interleaved(void* dest_ptr, const float* left,
+                                       const float* right, size_t count) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  size_t i = 0;
+  if (kHostHasAvx2) {
+    i = convert_f32_to_s16_be_interleaved_avx2(dest, left, right, count);
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m128i left_value = _mm_packs_epi32(convert_f32_to_s32_sse2(&left[i]),
+                                         convert_f32_to_s32_sse2(&left[i + 4]));
+    __m128i right_value =
+        _mm_packs_epi32(convert_f32_to_s32_sse2(&right[i]),
+                        convert_f32_to_s32_sse2(&right[i + 4]));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(&dest[i * 2]),
+        swap_16_sse2(_mm_unpacklo_epi16(left_value, right_value)));
+    _mm_storeu_si128(
+        reinterpret_cast<__m128i*>(&dest[i * 2 + 8]),
+        swap_16_sse2(_mm_unpackhi_epi16(left_value, right_value)));
+  }
+  for (; i < count; ++i) {  // handle residual elements
+    dest[i * 2] = byte_swap(uint16_t(int(xe::saturate(left[i]) * 32767.0f)));
+    dest[i * 2 + 1] =
+        byte_swap(uint16_t(int(xe::saturate(right[i]) * 32767.0f)));
+  }
+}
 #else
 // Generic routines.
 void copy_and_swap_16_aligned(void* dest, const void* src, size_t count) {
@@ -229,12 +532,49 @@ void copy_and_swap_16_in_32_aligned(void* dest, const void* src, size_t count) {
 
 void copy_and_swap_16_in_32_unaligned(void* dest_ptr, const void* src_ptr,
                                       size_t count) {
-  auto dest = reinterpret_cast<uint64_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint64_t*>(src_ptr);
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
   for (size_t i = 0; i < count; ++i) {
     dest[i] = (src[i] >> 16) | (src[i] << 16);
   }
 }
+
+void copy_cmp_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
+                                uint16_t cmp_value, size_t count) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint16_t*>(src_ptr);
+  for (size_t i = 0; i < count; ++i) {
+    uint16_t value = byte_swap(src[i]);
+    dest[i] = value == cmp_value ? 0xFFFF : value;
+  }
+}
+
+void copy_cmp_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
+                                uint32_t cmp_value, size_t count) {
+  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
+  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
+  for (size_t i = 0; i < count; ++i) {
+    uint32_t value = byte_swap(src[i]);
+    dest[i] = value == cmp_value ? 0xFFFFFFFF : value;
+  }
+}
+
+void convert_f32_to_s16_be(void* dest_ptr, const float* src, size_t count) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  for (size_t i = 0; i < count; ++i) {
+    dest[i] = byte_swap(uint16_t(int(xe::saturate(src[i]) * 32767.0f)));
+  }
+}
+
+void convert_f32_to_s16_be_interleaved(void* dest_ptr, const float* left,
+                                       const float* right, size_t count) {
+  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
+  for (size_t i = 0; i < count; ++i) {
+    dest[i * 2] = byte_swap(uint16_t(int(xe::saturate(left[i]) * 32767.0f)));
+    dest[i * 2 + 1] =
+        byte_swap(uint16_t(int(xe::saturate(right[i]) * 32767.0f)));
+  }
+}
 #endif
 
 }  // namespace xe
@@ -29,6 +29,11 @@ size_t page_size();
 // This is likely 64KiB.
 size_t allocation_granularity();
 
+// Returns the size of the large pages file mappings can be backed with, in
+// bytes, or 0 if the system doesn't support them.
+// This is likely 2MiB.
+size_t large_page_size();
+
 enum class PageAccess {
   kNoAccess = 0,
   kReadOnly = 1 << 0,
@@ -70,6 +75,20 @@ bool Protect(void* base_address, size_t length, PageAccess access,
 // the region.
 bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out);
 
+// Asks the system to back the given block of memory with large pages where it
+// can. Unlike large page file mappings, this keeps the protection of each page
+// independent. Returns false if the system can't do this transparently.
+bool AdviseLargePages(void* base_address, size_t length);
+
+// Returns the host pages backing the given block of memory to the system,
+// leaving it mapped with the same access rights. Unlike decommitting, this
+// also works on views of file mappings. The contents of the block are
+// undefined afterwards (zero on Linux).
+bool DiscardMemory(void* base_address, size_t length);
+
+// Gets how many bytes of the given block of memory are in host RAM.
+size_t QueryResidentSize(void* base_address, size_t length);
+
 // Allocates a block of memory for a type with the given alignment.
 // The memory must be freed with AlignedFree.
 template <typename T>
@@ -104,6 +123,22 @@ void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
                   PageAccess access, size_t file_offset);
 bool UnmapFileView(FileMappingHandle handle, void* base_address, size_t length);
 
+// Creates a mapping backed by large pages. These are committed up front and
+// can only be mapped and protected in whole large_page_size() units, so the
+// length is rounded up to it. Returns nullptr if the pages can't be obtained,
+// such as when none are reserved or the process may not lock them, in which
+// case CreateFileMappingHandle should be used instead.
+FileMappingHandle CreateLargePageFileMappingHandle(std::wstring path,
+                                                   size_t length,
+                                                   PageAccess access);
+// Maps a view of a mapping created with CreateLargePageFileMappingHandle. The
+// base address and file offset must be large page aligned. This is where the
+// pages are actually obtained on some systems, so this may fail when they run
+// out. Views are unmapped with UnmapFileView.
+void* MapLargePageFileView(FileMappingHandle handle, void* base_address,
+                           size_t length, PageAccess access,
+                           size_t file_offset);
+
 inline size_t hash_combine(size_t seed) { return seed; }
 
 template <typename T, typename... Ts>
@@ -132,6 +167,18 @@ void copy_and_swap_64_unaligned(void* dest, const void* src, size_t count);
 void copy_and_swap_16_in_32_aligned(void* dest, const void* src, size_t count);
 void copy_and_swap_16_in_32_unaligned(void* dest, const void* src,
                                       size_t count);
+// Same as copy_and_swap_16/32_unaligned, but values that equal cmp_value once
+// swapped are written as all ones, e.g. for primitive reset indices.
+void copy_cmp_swap_16_unaligned(void* dest, const void* src,
+                                uint16_t cmp_value, size_t count);
+void copy_cmp_swap_32_unaligned(void* dest, const void* src,
+                                uint32_t cmp_value, size_t count);
+// Converts float samples, clamped to [-1, 1], to big endian signed 16-bit ones,
+// scaled by 32767 and truncated, e.g. for decoded audio. The interleaved
+// variant writes count pairs of left and right samples.
+void convert_f32_to_s16_be(void* dest, const float* src, size_t count);
+void convert_f32_to_s16_be_interleaved(void* dest, const float* left,
+                                       const float* right, size_t count);
 
 template <typename T>
 void copy_and_swap(T* dest, const T* src, size_t count) {
@@ -8,18 +8,51 @@
  */
 
 #include "xenia/base/memory.h"
+#include "xenia/base/math.h"
 #include "xenia/base/string.h"
 
 #include <fcntl.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <cstdio>
+
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 0x0001U
+#endif
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
 namespace xe {
 namespace memory {
 
 size_t page_size() { return getpagesize(); }
 size_t allocation_granularity() { return page_size(); }
 
+size_t large_page_size() {
+  static size_t value = 0;
+  static bool queried = false;
+  if (!queried) {
+    queried = true;
+    FILE* file = std::fopen("/proc/meminfo", "r");
+    if (file) {
+      char line[128];
+      unsigned long size_kb;
+      while (std::fgets(line, sizeof(line), file)) {
+        if (std::sscanf(line, "Hugepagesize: %lu kB", &size_kb) == 1) {
+          value = size_t(size_kb) * 1024;
+          break;
+        }
+      }
+      std::fclose(file);
+    }
+  }
+  return value;
+}
+
 uint32_t ToPosixProtectFlags(PageAccess access) {
   switch (access) {
     case PageAccess::kNoAccess:
@@ -38,13 +71,30 @@ uint32_t ToPosixProtectFlags(PageAccess access) {
 
 void* AllocFixed(void* base_address, size_t length,
                  AllocationType allocation_type, PageAccess access) {
-  // mmap does not support reserve / commit, so ignore allocation_type.
   uint32_t prot = ToPosixProtectFlags(access);
-  return mmap(base_address, length, prot, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (allocation_type == AllocationType::kCommit) {
+    // The range is already mapped, by a reservation or a file view, and pages
+    // are only allocated when first touched.
+    if (mprotect(base_address, length, prot)) {
+      return nullptr;
+    }
+    return base_address;
+  }
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+  if (allocation_type == AllocationType::kReserve) {
+    prot = PROT_NONE;
+    flags |= MAP_NORESERVE;
+  }
+  void* result = mmap(base_address, length, prot, flags, -1, 0);
+  return result == MAP_FAILED ? nullptr : result;
 }
 
 bool DeallocFixed(void* base_address, size_t length,
                   DeallocationType deallocation_type) {
+  if (deallocation_type == DeallocationType::kDecommit) {
+    return DiscardMemory(base_address, length) &&
+           mprotect(base_address, length, PROT_NONE) == 0;
+  }
   return munmap(base_address, length) == 0;
 }
 
@@ -61,6 +111,47 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return false;
 }
 
+bool AdviseLargePages(void* base_address, size_t length) {
+#ifdef MADV_HUGEPAGE
+  // Transparent huge pages are split by the kernel when parts of them are
+  // protected differently.
+  return madvise(base_address, length, MADV_HUGEPAGE) == 0;
+#else
+  return false;
+#endif  // MADV_HUGEPAGE
+}
+
+bool DiscardMemory(void* base_address, size_t length) {
+#ifdef MADV_REMOVE
+  // Shared mappings keep the pages in their file unless they're removed from
+  // it. Fails on private mappings.
+  if (madvise(base_address, length, MADV_REMOVE) == 0) {
+    return true;
+  }
+#endif  // MADV_REMOVE
+  return madvise(base_address, length, MADV_DONTNEED) == 0;
+}
+
+size_t QueryResidentSize(void* base_address, size_t length) {
+  size_t page = page_size();
+  uintptr_t address = reinterpret_cast<uintptr_t>(base_address) & ~(page - 1);
+  uintptr_t end =
+      xe::round_up(reinterpret_cast<uintptr_t>(base_address) + length, page);
+  unsigned char residency[4096];
+  size_t resident_page_count = 0;
+  while (address < end) {
+    size_t count = std::min((end - address) / page, sizeof(residency));
+    if (mincore(reinterpret_cast<void*>(address), count * page, residency)) {
+      break;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      resident_page_count += residency[i] & 1;
+    }
+    address += count * page;
+  }
+  return resident_page_count * page;
+}
+
 FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
                                           PageAccess access, bool commit) {
   int oflag;
@@ -105,5 +196,48 @@ bool UnmapFileView(FileMappingHandle handle, void* base_address,
   return munmap(base_address, length) == 0;
 }
 
+FileMappingHandle CreateLargePageFileMappingHandle(std::wstring path,
+                                                   size_t length,
+                                                   PageAccess access) {
+#ifdef SYS_memfd_create
+  size_t large_page = large_page_size();
+  if (!large_page) {
+    return nullptr;
+  }
+  // The access is decided per view, a memfd is always readable and writable.
+  int ret = int(syscall(SYS_memfd_create, xe::to_string(path).c_str(),
+                        MFD_CLOEXEC | MFD_HUGETLB));
+  if (ret <= 0) {
+    return nullptr;
+  }
+  if (ftruncate64(ret, xe::round_up(length, large_page))) {
+    close(ret);
+    return nullptr;
+  }
+  return reinterpret_cast<FileMappingHandle>(ret);
+#else
+  return nullptr;
+#endif  // SYS_memfd_create
+}
+
+void* MapLargePageFileView(FileMappingHandle handle, void* base_address,
+                           size_t length, PageAccess access,
+                           size_t file_offset) {
+  // Huge pages are reserved when a shared mapping is created, so running out
+  // of them fails here rather than on first access.
+  length = xe::round_up(length, large_page_size());
+  uint32_t prot = ToPosixProtectFlags(access);
+  void* result = mmap64(base_address, length, prot, MAP_SHARED,
+                        reinterpret_cast<intptr_t>(handle), file_offset);
+  if (result == MAP_FAILED) {
+    return nullptr;
+  }
+  if (base_address && result != base_address) {
+    munmap(result, length);
+    return nullptr;
+  }
+  return result;
+}
+
 }  // namespace memory
 }  // namespace xe
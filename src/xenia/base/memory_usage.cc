@@ -0,0 +1,62 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/memory_usage.h"
+
+#include <algorithm>
+#include <mutex>
+
+namespace xe {
+
+namespace {
+
+// Constructed on first use, so counters with static storage duration can be
+// created and destroyed in any order relative to it.
+std::mutex& counters_mutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+std::vector<MemoryUsageCounter*>& counters() {
+  static std::vector<MemoryUsageCounter*> counters;
+  return counters;
+}
+
+}  // namespace
+
+MemoryUsageCounter::MemoryUsageCounter(const char* name)
+    : name_(name), bytes_(0), peak_bytes_(0) {
+  std::lock_guard<std::mutex> lock(counters_mutex());
+  counters().push_back(this);
+}
+
+MemoryUsageCounter::~MemoryUsageCounter() {
+  std::lock_guard<std::mutex> lock(counters_mutex());
+  auto& list = counters();
+  list.erase(std::find(list.begin(), list.end(), this));
+}
+
+void MemoryUsageCounter::UpdatePeak(uint64_t bytes) {
+  uint64_t peak = peak_bytes_.load(std::memory_order_relaxed);
+  while (bytes > peak && !peak_bytes_.compare_exchange_weak(
+                             peak, bytes, std::memory_order_relaxed)) {
+  }
+}
+
+std::vector<MemoryUsageCounter::Sample> MemoryUsageCounter::SampleAll() {
+  std::lock_guard<std::mutex> lock(counters_mutex());
+  std::vector<Sample> samples;
+  samples.reserve(counters().size());
+  for (auto counter : counters()) {
+    samples.push_back({counter->name(), counter->bytes(),
+                       counter->peak_bytes()});
+  }
+  return samples;
+}
+
+}  // namespace xe
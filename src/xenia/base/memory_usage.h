@@ -0,0 +1,67 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_MEMORY_USAGE_H_
+#define XENIA_BASE_MEMORY_USAGE_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// A named amount of memory held by a subsystem outside of guest memory (code
+// caches, texture caches, decoder buffers), kept up to date by its owner and
+// readable from any thread. Counters are registered for their lifetime so all
+// of them can be sampled at once for logging or monitoring.
+class MemoryUsageCounter {
+ public:
+  // The name must outlive the counter, usually a literal like
+  // "gpu/texture_cache".
+  explicit MemoryUsageCounter(const char* name);
+  ~MemoryUsageCounter();
+  MemoryUsageCounter(const MemoryUsageCounter&) = delete;
+  MemoryUsageCounter& operator=(const MemoryUsageCounter&) = delete;
+
+  const char* name() const { return name_; }
+  uint64_t bytes() const { return bytes_.load(std::memory_order_relaxed); }
+  uint64_t peak_bytes() const {
+    return peak_bytes_.load(std::memory_order_relaxed);
+  }
+
+  void Add(uint64_t bytes) {
+    UpdatePeak(bytes_.fetch_add(bytes, std::memory_order_relaxed) + bytes);
+  }
+  void Subtract(uint64_t bytes) {
+    bytes_.fetch_sub(bytes, std::memory_order_relaxed);
+  }
+  void Set(uint64_t bytes) {
+    bytes_.store(bytes, std::memory_order_relaxed);
+    UpdatePeak(bytes);
+  }
+
+  struct Sample {
+    const char* name;
+    uint64_t bytes;
+    uint64_t peak_bytes;
+  };
+  // Samples every live counter, in the order they were created.
+  static std::vector<Sample> SampleAll();
+
+ private:
+  void UpdatePeak(uint64_t bytes);
+
+  const char* name_;
+  std::atomic<uint64_t> bytes_;
+  std::atomic<uint64_t> peak_bytes_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_MEMORY_USAGE_H_
@@ -9,8 +9,17 @@
 
 #include "xenia/base/memory.h"
 
+#include "xenia/base/math.h"
 #include "xenia/base/platform_win.h"
 
+#include <psapi.h>
+
+#include <algorithm>
+
+#ifndef FILE_MAP_LARGE_PAGES
+#define FILE_MAP_LARGE_PAGES 0x20000000
+#endif
+
 namespace xe {
 namespace memory {
 
@@ -34,6 +43,14 @@ size_t allocation_granularity() {
   return value;
 }
 
+size_t large_page_size() {
+  static size_t value = 0;
+  if (!value) {
+    value = GetLargePageMinimum();
+  }
+  return value;
+}
+
 DWORD ToWin32ProtectFlags(PageAccess access) {
   switch (access) {
     case PageAccess::kNoAccess:
@@ -142,6 +159,48 @@ bool QueryProtect(void* base_address, size_t& length, PageAccess& access_out) {
   return true;
 }
 
+bool AdviseLargePages(void* base_address, size_t length) {
+  // Large pages are only available through explicit allocations, which can't
+  // be protected in smaller units.
+  return false;
+}
+
+bool DiscardMemory(void* base_address, size_t length) {
+  // Views of file mappings can't be decommitted, but the pages of ones backed
+  // by the paging file can be reset. That only lets the system drop them when
+  // it needs to, so also take them out of the working set, which unlocking
+  // pages that aren't locked does (while failing).
+  if (!VirtualAlloc(base_address, length, MEM_RESET, PAGE_NOACCESS)) {
+    return false;
+  }
+  VirtualUnlock(base_address, length);
+  return true;
+}
+
+size_t QueryResidentSize(void* base_address, size_t length) {
+  size_t page = page_size();
+  uintptr_t address = reinterpret_cast<uintptr_t>(base_address) & ~(page - 1);
+  uintptr_t end =
+      xe::round_up(reinterpret_cast<uintptr_t>(base_address) + length, page);
+  PSAPI_WORKING_SET_EX_INFORMATION info[512];
+  size_t resident_page_count = 0;
+  while (address < end) {
+    size_t count = std::min((end - address) / page, xe::countof(info));
+    for (size_t i = 0; i < count; ++i) {
+      info[i].VirtualAddress = reinterpret_cast<void*>(address + i * page);
+    }
+    if (!QueryWorkingSetEx(GetCurrentProcess(), info,
+                           DWORD(count * sizeof(info[0])))) {
+      break;
+    }
+    for (size_t i = 0; i < count; ++i) {
+      resident_page_count += info[i].VirtualAttributes.Valid;
+    }
+    address += count * page;
+  }
+  return resident_page_count * page;
+}
+
 FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
                                           PageAccess access, bool commit) {
   DWORD protect =
@@ -153,20 +212,20 @@ FileMappingHandle CreateFileMappingHandle(std::wstring path, size_t length,
 
 void CloseFileMappingHandle(FileMappingHandle handle) { CloseHandle(handle); }
 
-void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
-                  PageAccess access, size_t file_offset) {
+void* MapFileViewWithFlags(FileMappingHandle handle, void* base_address,
+                           size_t length, PageAccess access,
+                           size_t file_offset, DWORD file_access) {
   DWORD target_address_low = static_cast<DWORD>(file_offset);
   DWORD target_address_high = static_cast<DWORD>(file_offset >> 32);
-  DWORD file_access = 0;
   switch (access) {
     case PageAccess::kReadOnly:
-      file_access = FILE_MAP_READ;
+      file_access |= FILE_MAP_READ;
       break;
     case PageAccess::kReadWrite:
-      file_access = FILE_MAP_ALL_ACCESS;
+      file_access |= FILE_MAP_ALL_ACCESS;
       break;
     case PageAccess::kExecuteReadWrite:
-      file_access = FILE_MAP_ALL_ACCESS | FILE_MAP_EXECUTE;
+      file_access |= FILE_MAP_ALL_ACCESS | FILE_MAP_EXECUTE;
       break;
     case PageAccess::kNoAccess:
     default:
@@ -177,10 +236,65 @@ void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
                          target_address_low, length, base_address);
 }
 
+void* MapFileView(FileMappingHandle handle, void* base_address, size_t length,
+                  PageAccess access, size_t file_offset) {
+  return MapFileViewWithFlags(handle, base_address, length, access,
+                              file_offset, 0);
+}
+
 bool UnmapFileView(FileMappingHandle handle, void* base_address,
                    size_t length) {
   return UnmapViewOfFile(base_address) ? true : false;
 }
 
+bool EnableLockMemoryPrivilege() {
+  HANDLE token;
+  if (!OpenProcessToken(GetCurrentProcess(),
+                        TOKEN_ADJUST_PRIVILEGES | TOKEN_QUERY, &token)) {
+    return false;
+  }
+  TOKEN_PRIVILEGES privileges;
+  privileges.PrivilegeCount = 1;
+  privileges.Privileges[0].Attributes = SE_PRIVILEGE_ENABLED;
+  // AdjustTokenPrivileges succeeds even if the account doesn't hold the
+  // privilege, but reports ERROR_NOT_ALL_ASSIGNED then.
+  bool result = LookupPrivilegeValueW(nullptr, SE_LOCK_MEMORY_NAME,
+                                      &privileges.Privileges[0].Luid) &&
+                AdjustTokenPrivileges(token, FALSE, &privileges, 0, nullptr,
+                                      nullptr) &&
+                GetLastError() == ERROR_SUCCESS;
+  CloseHandle(token);
+  return result;
+}
+
+FileMappingHandle CreateLargePageFileMappingHandle(std::wstring path,
+                                                   size_t length,
+                                                   PageAccess access) {
+  size_t large_page = large_page_size();
+  if (!large_page || !EnableLockMemoryPrivilege()) {
+    return nullptr;
+  }
+  length = xe::round_up(length, large_page);
+  DWORD protect = ToWin32ProtectFlags(access) | SEC_COMMIT | SEC_LARGE_PAGES;
+  return CreateFileMappingW(INVALID_HANDLE_VALUE, NULL, protect,
+                            static_cast<DWORD>(length >> 32),
+                            static_cast<DWORD>(length), path.c_str());
+}
+
+void* MapLargePageFileView(FileMappingHandle handle, void* base_address,
+                           size_t length, PageAccess access,
+                           size_t file_offset) {
+  length = xe::round_up(length, large_page_size());
+  void* result = MapFileViewWithFlags(handle, base_address, length, access,
+                                      file_offset, FILE_MAP_LARGE_PAGES);
+  if (!result) {
+    // Windows before 10 1703 doesn't know the flag, but maps views of large
+    // page sections with large pages anyway.
+    result = MapFileViewWithFlags(handle, base_address, length, access,
+                                  file_offset, 0);
+  }
+  return result;
+}
+
 }  // namespace memory
 }  // namespace xe
@@ -0,0 +1,218 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/metrics.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/logging.h"
+#include "xenia/base/memory_usage.h"
+#include "xenia/base/platform.h"
+#include "xenia/base/socket.h"
+#include "xenia/base/threading.h"
+
+namespace xe {
+
+namespace {
+
+// Held while collecting, so a collector is never running once removed.
+std::mutex collectors_mutex_;
+std::vector<std::pair<Metrics::Collector, void*>> collectors_;
+
+std::mutex exporter_mutex_;
+std::unique_ptr<SocketServer> exporter_;
+
+#if XE_PLATFORM_WIN32
+void ServeScrape(std::unique_ptr<Socket> client) {
+  // Whatever was asked for, the answer is the metrics, but the request is
+  // read first so the client doesn't see a reset.
+  char request[1024];
+  xe::threading::Wait(client->wait_handle(), false,
+                      std::chrono::milliseconds(1000));
+  client->Receive(request, sizeof(request));
+
+  std::string body = Metrics::Collect();
+  char header[160];
+  int header_length = std::snprintf(
+      header, sizeof(header),
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Content-Length: %zu\r\n"
+      "Connection: close\r\n\r\n",
+      body.size());
+  std::pair<const void*, size_t> buffers[] = {
+      {header, size_t(header_length)},
+      {body.data(), body.size()},
+  };
+  client->Send(buffers, 2);
+  client->Close();
+}
+#endif  // XE_PLATFORM_WIN32
+
+}  // namespace
+
+void MetricsWriter::Counter(const char* name, const char* help, double value,
+                            const char* labels) {
+  Header(name, help, "counter");
+  Sample(name, "", labels, value);
+}
+
+void MetricsWriter::Gauge(const char* name, const char* help, double value,
+                          const char* labels) {
+  Header(name, help, "gauge");
+  Sample(name, "", labels, value);
+}
+
+void MetricsWriter::Summary(const char* name, const char* help,
+                            const double* quantiles,
+                            const double* quantile_values,
+                            size_t quantile_count, uint64_t count,
+                            double sum) {
+  Header(name, help, "summary");
+  for (size_t i = 0; i < quantile_count; ++i) {
+    char labels[32];
+    std::snprintf(labels, sizeof(labels), "quantile=\"%g\"", quantiles[i]);
+    Sample(name, "", labels, quantile_values[i]);
+  }
+  Sample(name, "_sum", nullptr, sum);
+  Sample(name, "_count", nullptr, double(count));
+}
+
+void MetricsWriter::Header(const char* name, const char* help,
+                           const char* type) {
+  if (last_name_ == name) {
+    return;
+  }
+  last_name_ = name;
+  text_ += "# HELP ";
+  text_ += name;
+  text_ += ' ';
+  text_ += help;
+  text_ += "\n# TYPE ";
+  text_ += name;
+  text_ += ' ';
+  text_ += type;
+  text_ += '\n';
+}
+
+void MetricsWriter::Sample(const char* name, const char* suffix,
+                           const char* labels, double value) {
+  text_ += name;
+  text_ += suffix;
+  if (labels) {
+    text_ += '{';
+    text_ += labels;
+    text_ += '}';
+  }
+  char value_str[32];
+  std::snprintf(value_str, sizeof(value_str), " %.15g\n", value);
+  text_ += value_str;
+}
+
+void MetricsSummary::Record(double value) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  samples_[count_ % kSampleCount] = value;
+  ++count_;
+  sum_ += value;
+}
+
+void MetricsSummary::Write(MetricsWriter* writer, const char* name,
+                           const char* help) {
+  static const double kQuantiles[] = {0.5, 0.9, 0.99};
+  double values[3] = {0.0, 0.0, 0.0};
+  std::array<double, kSampleCount> samples;
+  size_t sample_count;
+  uint64_t count;
+  double sum;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sample_count = size_t(std::min(count_, uint64_t(kSampleCount)));
+    std::copy(samples_.begin(), samples_.begin() + sample_count,
+              samples.begin());
+    count = count_;
+    sum = sum_;
+  }
+  if (sample_count) {
+    for (size_t i = 0; i < 3; ++i) {
+      auto nth = samples.begin() + size_t(kQuantiles[i] * (sample_count - 1));
+      std::nth_element(samples.begin(), nth, samples.begin() + sample_count);
+      values[i] = *nth;
+    }
+  }
+  writer->Summary(name, help, kQuantiles, values, 3, count, sum);
+}
+
+void Metrics::AddCollector(Collector fn, void* data) {
+  std::lock_guard<std::mutex> lock(collectors_mutex_);
+  collectors_.emplace_back(fn, data);
+}
+
+void Metrics::RemoveCollector(Collector fn, void* data) {
+  std::lock_guard<std::mutex> lock(collectors_mutex_);
+  auto it = std::find(collectors_.begin(), collectors_.end(),
+                      std::make_pair(fn, data));
+  if (it != collectors_.end()) {
+    collectors_.erase(it);
+  }
+}
+
+std::string Metrics::Collect() {
+  MetricsWriter writer;
+  // The host memory held by the caches and decoders is already tracked
+  // everywhere it matters.
+  auto usage_samples = MemoryUsageCounter::SampleAll();
+  char labels[96];
+  for (auto& sample : usage_samples) {
+    std::snprintf(labels, sizeof(labels), "counter=\"%s\"", sample.name);
+    writer.Gauge("xenia_memory_usage_bytes",
+                 "Host memory held by each subsystem.", double(sample.bytes),
+                 labels);
+  }
+  for (auto& sample : usage_samples) {
+    std::snprintf(labels, sizeof(labels), "counter=\"%s\"", sample.name);
+    writer.Gauge("xenia_memory_usage_peak_bytes",
+                 "Most host memory ever held by each subsystem.",
+                 double(sample.peak_bytes), labels);
+  }
+
+  std::lock_guard<std::mutex> lock(collectors_mutex_);
+  for (auto& collector : collectors_) {
+    collector.first(&writer, collector.second);
+  }
+  return writer.text();
+}
+
+bool Metrics::StartExporter(uint16_t port) {
+  std::lock_guard<std::mutex> lock(exporter_mutex_);
+#if XE_PLATFORM_WIN32
+  exporter_ = SocketServer::Create(port, ServeScrape);
+  if (!exporter_) {
+    XELOGE("Unable to serve the metrics on port %u", port);
+    return false;
+  }
+  XELOGI("Serving the metrics on http://localhost:%u/metrics", port);
+  return true;
+#else
+  // There is no SocketServer on this platform yet.
+  XELOGW("The metrics exporter isn't available on this platform");
+  return false;
+#endif  // XE_PLATFORM_WIN32
+}
+
+void Metrics::StopExporter() {
+  std::lock_guard<std::mutex> lock(exporter_mutex_);
+  exporter_.reset();
+}
+
+}  // namespace xe
@@ -0,0 +1,85 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_METRICS_H_
+#define XENIA_BASE_METRICS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+
+namespace xe {
+
+// Builds the Prometheus text exposition of the metrics for one scrape.
+class MetricsWriter {
+ public:
+  // The labels, if any, are written as they are, such as `heap="v00000000"`.
+  void Counter(const char* name, const char* help, double value,
+               const char* labels = nullptr);
+  void Gauge(const char* name, const char* help, double value,
+             const char* labels = nullptr);
+  void Summary(const char* name, const char* help, const double* quantiles,
+               const double* quantile_values, size_t quantile_count,
+               uint64_t count, double sum);
+
+  const std::string& text() const { return text_; }
+
+ private:
+  // Samples with the same name must be written one after the other, and the
+  // header only goes before the first.
+  void Header(const char* name, const char* help, const char* type);
+  void Sample(const char* name, const char* suffix, const char* labels,
+              double value);
+
+  std::string text_;
+  std::string last_name_;
+};
+
+// Keeps the most recent samples of a value, such as the frame time, to export
+// its quantiles. Cheap enough to record into once per frame.
+class MetricsSummary {
+ public:
+  static const size_t kSampleCount = 512;
+
+  void Record(double value);
+  void Write(MetricsWriter* writer, const char* name, const char* help);
+
+ private:
+  std::mutex mutex_;
+  std::array<double, kSampleCount> samples_;
+  uint64_t count_ = 0;
+  double sum_ = 0.0;
+};
+
+// Process-wide set of the runtime metrics, served in the Prometheus text
+// format over HTTP from --metrics_port. Subsystems mostly already keep their
+// own statistics, so they add a collector that reads them at each scrape and
+// nothing is done on their hot paths in between.
+class Metrics {
+ public:
+  typedef void (*Collector)(MetricsWriter* writer, void* data);
+
+  static void AddCollector(Collector fn, void* data);
+  // Does nothing if the collector wasn't added.
+  static void RemoveCollector(Collector fn, void* data);
+
+  // Runs every collector.
+  static std::string Collect();
+
+  // Serves Collect() to any HTTP request on the loopback port. Scrapes are
+  // answered on the accept thread, one at a time.
+  static bool StartExporter(uint16_t port);
+  static void StopExporter();
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_METRICS_H_
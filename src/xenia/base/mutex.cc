@@ -9,6 +9,11 @@
 
 #include "xenia/base/mutex.h"
 
+#include <string>
+#include <thread>
+
+#include "xenia/base/profiling.h"
+
 namespace xe {
 
 std::recursive_mutex& global_critical_region::mutex() {
@@ -16,4 +21,96 @@ std::recursive_mutex& global_critical_region::mutex() {
   return global_mutex;
 }
 
+namespace {
+
+// Threads not started through threading::Thread keep their own state.
+thread_local thread_lock_state default_thread_lock_state_;
+thread_local thread_lock_state* current_thread_lock_state_ = nullptr;
+
+}  // namespace
+
+void thread_lock_state::BeginSuspend() {
+  suspend_pending.fetch_add(1);
+  while (held_count.load()) {
+    std::this_thread::yield();
+  }
+}
+
+void thread_lock_state::EndSuspend() { suspend_pending.fetch_sub(1); }
+
+bool thread_lock_state::TryEnter() {
+  // Pairs with BeginSuspend: either the suspending thread sees the count, or
+  // this sees the pending suspension. Once in a region the suspension waits
+  // for it anyway, so only the first one backs off.
+  if (held_count.fetch_add(1) || !suspend_pending.load()) {
+    return true;
+  }
+  held_count.fetch_sub(1);
+  return false;
+}
+
+void thread_lock_state::Enter() {
+  while (!TryEnter()) {
+    while (suspend_pending.load()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+thread_lock_state* thread_lock_state::current() {
+  if (!current_thread_lock_state_) {
+    current_thread_lock_state_ = &default_thread_lock_state_;
+  }
+  return current_thread_lock_state_;
+}
+
+void thread_lock_state::set_current(thread_lock_state* state) {
+  current_thread_lock_state_ = state;
+}
+
+subsystem_mutex::subsystem_mutex(const char* name) : name_(name) {
+#if XE_OPTION_PROFILING
+  std::string counter_name = std::string(name) + "/lock_contention";
+  profile_counter_ = MicroProfileGetCounterToken(counter_name.c_str());
+#endif  // XE_OPTION_PROFILING
+}
+
+void subsystem_mutex::lock() {
+  auto state = thread_lock_state::current();
+  while (true) {
+    // The thread must not be counted as holding a lock while it waits, or a
+    // suspension from the owner of the lock would never complete.
+    if (!mutex_.try_lock()) {
+      ++contention_count_;
+#if XE_OPTION_PROFILING
+      MicroProfileCounterAdd(profile_counter_, 1);
+#endif  // XE_OPTION_PROFILING
+      mutex_.lock();
+    }
+    if (state->TryEnter()) {
+      return;
+    }
+    mutex_.unlock();
+    while (state->suspend_pending.load()) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+bool subsystem_mutex::try_lock() {
+  if (!mutex_.try_lock()) {
+    return false;
+  }
+  if (!thread_lock_state::current()->TryEnter()) {
+    mutex_.unlock();
+    return false;
+  }
+  return true;
+}
+
+void subsystem_mutex::unlock() {
+  mutex_.unlock();
+  thread_lock_state::current()->Leave();
+}
+
 }  // namespace xe
@@ -10,6 +10,8 @@
 #ifndef XENIA_BASE_MUTEX_H_
 #define XENIA_BASE_MUTEX_H_
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 
 namespace xe {
@@ -76,6 +78,81 @@ class global_critical_region {
   }
 };
 
+// Bookkeeping shared between a thread and the threads suspending it, so that
+// the thread is never suspended while holding a subsystem_mutex.
+// threading::Thread::Suspend calls BeginSuspend/EndSuspend around suspending
+// any thread but the caller.
+struct thread_lock_state {
+  // Number of subsystem mutex acquisitions held by the thread.
+  std::atomic<uint32_t> held_count = {0};
+  // Number of threads waiting to suspend the thread.
+  std::atomic<uint32_t> suspend_pending = {0};
+
+  // Waits until the thread holds no subsystem mutex. Until EndSuspend the
+  // thread won't acquire its first one.
+  void BeginSuspend();
+  void EndSuspend();
+
+  // Counts a region the thread must not be suspended in, as subsystem mutexes
+  // do. TryEnter fails if this would be the first one while a suspension is
+  // pending, Enter waits until the suspension is over instead. Called from
+  // the thread itself.
+  bool TryEnter();
+  void Enter();
+  void Leave() { held_count.fetch_sub(1); }
+
+  // Returns the state of the calling thread.
+  static thread_lock_state* current();
+  // Binds the state of the calling thread, before it acquires any lock.
+  static void set_current(thread_lock_state* state);
+};
+
+// A recursive lock guarding the data of a single subsystem, used in place of
+// the global critical region where nothing but that data needs guarding.
+// Threads holding one are never suspended (see thread_lock_state), so they
+// can't stall everyone else waiting on it.
+//
+// Lock ordering - a lock may only be acquired while holding those above it:
+//   1. xe::global_critical_region.
+//   2. The Processor debugger lock. This is the only subsystem mutex that may
+//      be held while suspending other threads, as the suspension waits for
+//      them to release the ones they hold.
+//   3. Leaf locks: the ObjectTable, the KernelState thread and module lists,
+//      the XThread APC queues, the NotifyListener queues, the
+//      VirtualFileSystem resolved path cache and the HostPathDevice changed
+//      directories. Nothing else may be acquired, and no guest code run,
+//      while holding one. Objects are released after the ObjectTable lock is
+//      dropped, as their destructors take other locks.
+// Access watches (MMIOHandler) stay in the global critical region, as their
+// callbacks run inside it.
+//
+// Contended acquisitions are counted in the "<name>/lock_contention" profiler
+// counter.
+class subsystem_mutex {
+ public:
+  explicit subsystem_mutex(const char* name);
+  subsystem_mutex(const subsystem_mutex&) = delete;
+  subsystem_mutex& operator=(const subsystem_mutex&) = delete;
+
+  void lock();
+  bool try_lock();
+  void unlock();
+
+  std::unique_lock<subsystem_mutex> Acquire() {
+    return std::unique_lock<subsystem_mutex>(*this);
+  }
+
+  const char* name() const { return name_; }
+  // Number of acquisitions that had to wait for another thread.
+  uint64_t contention_count() const { return contention_count_; }
+
+ private:
+  std::recursive_mutex mutex_;
+  const char* name_;
+  std::atomic<uint64_t> contention_count_ = {0};
+  uint64_t profile_counter_ = 0;
+};
+
 }  // namespace xe
 
 #endif  // XENIA_BASE_MUTEX_H_
@@ -9,7 +9,12 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
 #include <string>
+#include <utility>
+#include <vector>
 
 // NOTE: this must be included before microprofile as macro expansion needs
 // XELOGI.
@@ -30,6 +35,7 @@
 #include "third_party/microprofile/microprofile.h"
 
 #include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/profiling.h"
 #include "xenia/ui/window.h"
 
@@ -43,6 +49,10 @@
 #endif  // XE_OPTION_PROFILING_UI
 
 DEFINE_bool(show_profiler, false, "Show profiling UI by default.");
+DEFINE_string(profile_trace_file, "",
+              "Stream the scopes of all profiled threads and of the GPU to "
+              "this file as Chrome trace events, for chrome://tracing or "
+              "ui.perfetto.dev.");
 
 namespace xe {
 
@@ -53,6 +63,163 @@ std::unique_ptr<ui::MicroprofileDrawer> Profiler::drawer_ = nullptr;
 
 #if XE_OPTION_PROFILING
 
+static_assert(Profiler::kGpuFrameDelay == MICROPROFILE_GPU_FRAME_DELAY,
+              "GPU timestamp providers must match the microprofile delay");
+
+namespace {
+
+GpuTimestampProvider* gpu_timestamp_provider_ = nullptr;
+thread_local void* gpu_context_ = nullptr;
+
+void GpuShutdown() { gpu_timestamp_provider_ = nullptr; }
+uint32_t GpuFlip() { return gpu_timestamp_provider_->Flip(); }
+uint32_t GpuInsertTimer(void* context) {
+  return gpu_timestamp_provider_->InsertTimestamp(context);
+}
+uint64_t GpuGetTimeStamp(uint32_t index) {
+  return gpu_timestamp_provider_->GetTimestamp(index);
+}
+uint64_t GpuGetTicksPerSecond() {
+  return gpu_timestamp_provider_->ticks_per_second();
+}
+// The GPU timeline is aligned with the CPU one by the frame starts instead.
+bool GpuGetTickReference(int64_t* cpu_tick, int64_t* gpu_tick) {
+  return false;
+}
+
+// Appends the scopes of each frame microprofile is done with, once the GPU
+// timestamps of it have been resolved, to a Chrome trace event JSON file.
+// Scopes are written as complete events when they are left, so the file
+// stays usable if the process dies, and scopes still open at exit are lost.
+class TraceWriter {
+ public:
+  explicit TraceWriter(FILE* file) : file_(file) {
+    start_tick_cpu_ = MP_TICK();
+    fputs("[\n", file_);
+    AppendEvent("{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":1,"
+                "\"args\":{\"name\":\"xenia\"}}");
+  }
+  ~TraceWriter() {
+    fputs("\n]\n", file_);
+    fclose(file_);
+  }
+
+  void WriteFrame() {
+    auto& s = g_MicroProfile;
+    std::lock_guard<std::recursive_mutex> lock(MicroProfileGetMutex());
+    if (!s.nRunning || s.nFrameCurrentIndex == last_frame_index_) {
+      return;
+    }
+    last_frame_index_ = s.nFrameCurrentIndex;
+
+    auto& frame = s.Frames[s.nFrameCurrent];
+    auto& next_frame =
+        s.Frames[(s.nFrameCurrent + 1) % MICROPROFILE_MAX_FRAME_HISTORY];
+    double cpu_us_per_tick = 1000000.0 / MicroProfileTicksPerSecondCpu();
+    double gpu_us_per_tick = 1000000.0 / MicroProfileTicksPerSecondGpu();
+    double frame_start_us =
+        (frame.nFrameStartCpu - start_tick_cpu_) * cpu_us_per_tick;
+    for (uint32_t i = 0; i < s.nNumLogs; ++i) {
+      auto log = s.Pool[i];
+      uint32_t log_start = frame.nLogStart[i];
+      uint32_t log_end = next_frame.nLogStart[i];
+      if (!log || log_start == log_end) {
+        continue;
+      }
+      if (thread_names_[i] != log->ThreadName) {
+        // A new thread, or one taking over the log of an exited one.
+        thread_names_[i] = log->ThreadName;
+        stacks_[i].clear();
+        AppendEvent("{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,"
+                    "\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                    i, Escape(log->ThreadName).c_str());
+      }
+      // GPU ticks are placed on the CPU timeline by the frame starts.
+      bool is_gpu = log->nGpu != 0;
+      if (is_gpu && !frame.nFrameStartGpu) {
+        continue;
+      }
+      auto& stack = stacks_[i];
+      for (uint32_t j = log_start; j != log_end;
+           j = (j + 1) % MICROPROFILE_BUFFER_SIZE) {
+        MicroProfileLogEntry entry = log->Log[j];
+        uint64_t type = MicroProfileLogType(entry);
+        if (type != MP_LOG_ENTER && type != MP_LOG_LEAVE) {
+          continue;
+        }
+        auto timer_index = uint32_t(MicroProfileLogTimerIndex(entry));
+        double time_us =
+            is_gpu ? frame_start_us +
+                         TickDifference(frame.nFrameStartGpu, entry) *
+                             gpu_us_per_tick
+                   : TickDifference(start_tick_cpu_, entry) * cpu_us_per_tick;
+        if (type == MP_LOG_ENTER) {
+          if (stack.size() < MICROPROFILE_STACK_MAX) {
+            stack.emplace_back(timer_index, time_us);
+          }
+          continue;
+        }
+        // Leaves of scopes entered before the trace started are dropped.
+        if (stack.empty() || stack.back().first != timer_index) {
+          continue;
+        }
+        double begin_us = stack.back().second;
+        stack.pop_back();
+        auto& timer = s.TimerInfo[timer_index];
+        AppendEvent("{\"ph\":\"X\",\"name\":\"%s\",\"cat\":\"%s\","
+                    "\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                    Escape(timer.pName).c_str(),
+                    Escape(s.GroupInfo[timer.nGroupIndex].pName).c_str(), i,
+                    begin_us, std::max(time_us - begin_us, 0.0));
+      }
+    }
+    fflush(file_);
+  }
+
+ private:
+  // Of the 48 bit tick of the entry from a full one, less than 2^47 away.
+  static int64_t TickDifference(int64_t from_tick, MicroProfileLogEntry entry) {
+    uint64_t difference = uint64_t(MicroProfileLogGetTick(entry)) -
+                          uint64_t(from_tick & MP_LOG_TICK_MASK);
+    return int64_t(difference << 16) >> 16;
+  }
+
+  static std::string Escape(const char* str) {
+    std::string escaped;
+    for (; *str; ++str) {
+      if (*str == '"' || *str == '\\') {
+        escaped += '\\';
+      } else if (uint8_t(*str) < 0x20) {
+        continue;
+      }
+      escaped += *str;
+    }
+    return escaped;
+  }
+
+  void AppendEvent(const char* format, ...) {
+    if (event_count_++) {
+      fputs(",\n", file_);
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(file_, format, args);
+    va_end(args);
+  }
+
+  FILE* file_;
+  int64_t start_tick_cpu_;
+  uint32_t last_frame_index_ = UINT32_MAX;
+  uint64_t event_count_ = 0;
+  std::string thread_names_[MICROPROFILE_MAX_THREADS];
+  // Timer index and time of the scopes entered but not yet left.
+  std::vector<std::pair<uint32_t, double>> stacks_[MICROPROFILE_MAX_THREADS];
+};
+
+std::unique_ptr<TraceWriter> trace_writer_;
+
+}  // namespace
+
 bool Profiler::is_enabled() { return true; }
 
 bool Profiler::is_visible() { return is_enabled() && MicroProfileIsDrawing(); }
@@ -64,6 +231,7 @@ void Profiler::Initialize() {
   MicroProfileForceEnableGroup("cpu", MicroProfileTokenTypeCpu);
   MicroProfileForceEnableGroup("gpu", MicroProfileTokenTypeCpu);
   MicroProfileForceEnableGroup("internal", MicroProfileTokenTypeCpu);
+  MicroProfileForceEnableGroup("host_gpu", MicroProfileTokenTypeGpu);
   g_MicroProfile.nGroupMask = g_MicroProfile.nForceGroup;
   g_MicroProfile.nActiveGroup = g_MicroProfile.nActiveGroupWanted =
       g_MicroProfile.nGroupMask;
@@ -85,6 +253,17 @@ void Profiler::Initialize() {
   MicroProfileSetEnableAllGroups(true);
   MicroProfileSetForceMetaCounters(false);
 #endif  // XE_OPTION_PROFILING_UI
+
+  if (!FLAGS_profile_trace_file.empty()) {
+    auto file = xe::filesystem::OpenFile(
+        xe::to_wstring(FLAGS_profile_trace_file), "w");
+    if (file) {
+      trace_writer_ = std::make_unique<TraceWriter>(file);
+    } else {
+      XELOGE("Unable to open the profile trace file %s",
+             FLAGS_profile_trace_file.c_str());
+    }
+  }
 }
 
 void Profiler::Dump() {
@@ -96,6 +275,7 @@ void Profiler::Dump() {
 }
 
 void Profiler::Shutdown() {
+  trace_writer_.reset();
   drawer_.reset();
   window_ = nullptr;
   MicroProfileShutdown();
@@ -113,6 +293,35 @@ void Profiler::ThreadEnter(const char* name) {
 
 void Profiler::ThreadExit() { MicroProfileOnThreadExit(); }
 
+Profiler::GpuContextScope::GpuContextScope(void* context)
+    : previous_context_(gpu_context_) {
+  SetGpuContext(context);
+}
+
+Profiler::GpuContextScope::~GpuContextScope() {
+  SetGpuContext(previous_context_);
+}
+
+void Profiler::SetGpuTimestampProvider(GpuTimestampProvider* provider) {
+  MicroProfileGpuShutdown();
+  if (!provider) {
+    return;
+  }
+  gpu_timestamp_provider_ = provider;
+  auto& gpu = MicroProfileGet()->GPU;
+  gpu.Shutdown = GpuShutdown;
+  gpu.Flip = GpuFlip;
+  gpu.InsertTimer = GpuInsertTimer;
+  gpu.GetTimeStamp = GpuGetTimeStamp;
+  gpu.GetTicksPerSecond = GpuGetTicksPerSecond;
+  gpu.GetTickReference = GpuGetTickReference;
+}
+
+void Profiler::SetGpuContext(void* context) {
+  gpu_context_ = context;
+  MicroProfileGpuSetContext(context);
+}
+
 bool Profiler::OnKeyDown(int key_code) {
   // https://msdn.microsoft.com/en-us/library/windows/desktop/dd375731(v=vs.85).aspx
   switch (key_code) {
@@ -246,7 +455,12 @@ void Profiler::Present() {
 #endif  // XE_OPTION_PROFILING_UI
 }
 
-void Profiler::Flip() { MicroProfileFlip(); }
+void Profiler::Flip() {
+  MicroProfileFlip();
+  if (trace_writer_) {
+    trace_writer_->WriteFrame();
+  }
+}
 
 #else
 
@@ -258,6 +472,11 @@ void Profiler::Shutdown() {}
 uint32_t Profiler::GetColor(const char* str) { return 0; }
 void Profiler::ThreadEnter(const char* name) {}
 void Profiler::ThreadExit() {}
+Profiler::GpuContextScope::GpuContextScope(void* context)
+    : previous_context_(nullptr) {}
+Profiler::GpuContextScope::~GpuContextScope() = default;
+void Profiler::SetGpuTimestampProvider(GpuTimestampProvider* provider) {}
+void Profiler::SetGpuContext(void* context) {}
 bool Profiler::OnKeyDown(int key_code) { return false; }
 bool Profiler::OnKeyUp(int key_code) { return false; }
 void Profiler::OnMouseDown(bool left_button, bool right_button) {}
@@ -47,11 +47,13 @@ namespace xe {
 // Declares a previously defined profile scope. Use in a translation unit.
 #define DECLARE_profile_cpu(name) MICROPROFILE_DECLARE(name)
 
-// Defines a profiling scope for GPU tasks.
-// Use `COUNT_profile_gpu(name)` to activate the scope.
-#define DEFINE_profile_gpu(name, group_name, scope_name) \
-  MICROPROFILE_DEFINE_GPU(name, group_name, scope_name,  \
-                          xe::Profiler::GetColor(scope_name))
+// Defines a profiling scope for GPU tasks, timed with the timestamps of the
+// GpuTimestampProvider. GPU groups must not share names with CPU groups.
+// Use `SCOPE_profile_gpu(name)` to activate the scope.
+#define DEFINE_profile_gpu(name, group_name, scope_name)          \
+  MicroProfileToken g_mp_##name = MicroProfileGetToken(           \
+      group_name, scope_name, xe::Profiler::GetColor(scope_name), \
+      MicroProfileTokenTypeGpu)
 
 // Declares a previously defined profile scope. Use in a translation unit.
 #define DECLARE_profile_gpu(name) MICROPROFILE_DECLARE_GPU(name)
@@ -78,15 +80,33 @@ namespace xe {
 
 // Enters a GPU profiling scope, active for the duration of the containing
 // block. No previous definition required.
-#define SCOPE_profile_gpu_i(group_name, scope_name) \
-  MICROPROFILE_SCOPEGPUI(group_name, scope_name,    \
-                         xe::Profiler::GetColor(scope_name))
+#define SCOPE_profile_gpu_i(group_name, scope_name)                   \
+  static MicroProfileToken MICROPROFILE_TOKEN_PASTE(g_mp, __LINE__) = \
+      MicroProfileGetToken(group_name, scope_name,                    \
+                           xe::Profiler::GetColor(scope_name),        \
+                           MicroProfileTokenTypeGpu);                 \
+  MicroProfileScopeHandler MICROPROFILE_TOKEN_PASTE(foo, __LINE__)(   \
+      MICROPROFILE_TOKEN_PASTE(g_mp, __LINE__))
 
 // Enters a GPU profiling scope by function name, active for the duration of
 // the containing block. No previous definition required.
-#define SCOPE_profile_gpu_f(group_name)            \
-  MICROPROFILE_SCOPEGPUI(group_name, __FUNCTION__, \
-                         xe::Profiler::GetColor(__FUNCTION__))
+#define SCOPE_profile_gpu_f(group_name) \
+  SCOPE_profile_gpu_i(group_name, __FUNCTION__)
+
+// Enters a previously defined GPU profiling scope timed in the given GPU
+// context (such as a command buffer) rather than the one of the thread,
+// active for the duration of the containing block.
+#define SCOPE_profile_gpu_context(name, context)         \
+  xe::Profiler::GpuContextScope MICROPROFILE_TOKEN_PASTE( \
+      xe_gpu_context_, __LINE__)(context);                \
+  MICROPROFILE_SCOPEGPU(name)
+
+// Enters a previously defined GPU profiling scope not bound to a block,
+// returning the value to leave it with.
+#define ENTER_profile_gpu(name) MicroProfileEnter(g_mp_##name)
+
+// Leaves a GPU profiling scope entered with ENTER_profile_gpu.
+#define LEAVE_profile_gpu(name, tick) MicroProfileLeave(g_mp_##name, tick)
 
 // Adds a number to a counter
 #define COUNT_profile_add(name, count) MICROPROFILE_COUNTER_ADD(name, count)
@@ -127,6 +147,13 @@ namespace xe {
 #define SCOPE_profile_gpu_i(group_name, scope_name) \
   do {                                              \
   } while (false)
+#define SCOPE_profile_gpu_context(name, context) \
+  do {                                           \
+  } while (false)
+#define ENTER_profile_gpu(name) uint64_t(0)
+#define LEAVE_profile_gpu(name, tick) \
+  do {                                \
+  } while (false)
 #define COUNT_profile_add(name, count) \
   do {                                 \
   } while (false)
@@ -150,8 +177,41 @@ namespace xe {
 
 #endif  // XE_OPTION_PROFILING
 
+// Source of the timestamps of GPU profiling scopes, implemented by a graphics
+// backend. All methods are called on the thread that enters the GPU scopes and
+// flips the profiler.
+class GpuTimestampProvider {
+ public:
+  virtual ~GpuTimestampProvider() = default;
+
+  // Writes a timestamp in the context (such as a command buffer), returning
+  // its index, or UINT32_MAX if it can't be written.
+  virtual uint32_t InsertTimestamp(void* context) = 0;
+  // Starts a new profiler frame, returning the index of the timestamp of its
+  // start, or UINT32_MAX. Timestamps are read kGpuFrameDelay flips after the
+  // frame they were inserted in ends, and must be resolved by then.
+  virtual uint32_t Flip() = 0;
+  // Returns the ticks of a timestamp, or UINT64_MAX if it isn't available.
+  virtual uint64_t GetTimestamp(uint32_t index) = 0;
+  virtual uint64_t ticks_per_second() = 0;
+};
+
 class Profiler {
  public:
+  // Number of flips after a frame ends that its GPU timestamps are read.
+  static const uint32_t kGpuFrameDelay = 3;
+
+  // Sets the context GPU scopes are timed in on the calling thread for the
+  // lifetime of the scope.
+  class GpuContextScope {
+   public:
+    explicit GpuContextScope(void* context);
+    ~GpuContextScope();
+
+   private:
+    void* previous_context_;
+  };
+
   static bool is_enabled();
   static bool is_visible();
 
@@ -171,6 +231,11 @@ class Profiler {
   // Deactivates the calling thread for profiling.
   static void ThreadExit();
 
+  // Times GPU scopes with the provider, or disables them if null.
+  static void SetGpuTimestampProvider(GpuTimestampProvider* provider);
+  // Sets the context GPU scopes entered on the calling thread are timed in.
+  static void SetGpuContext(void* context);
+
   static bool OnKeyDown(int key_code);
   static bool OnKeyUp(int key_code);
   static void OnMouseDown(bool left_button, bool right_button);
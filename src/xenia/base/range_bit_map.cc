@@ -0,0 +1,190 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/range_bit_map.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+namespace {
+
+// The word must not be zero.
+size_t LowestSetBit(uint64_t word) {
+  return 63 - xe::lzcnt(word & (~word + 1));
+}
+size_t HighestSetBit(uint64_t word) { return 63 - xe::lzcnt(word); }
+
+}  // namespace
+
+RangeBitMap::RangeBitMap() = default;
+
+void RangeBitMap::Resize(size_t size_bits) {
+  size_bits_ = size_bits;
+  for (auto& levels : levels_) {
+    levels.clear();
+    size_t word_count = (size_bits + 63) >> 6;
+    levels.emplace_back(word_count);
+    while (word_count > 1) {
+      word_count = (word_count + 63) >> 6;
+      levels.emplace_back(word_count);
+    }
+  }
+  Reset();
+}
+
+void RangeBitMap::Reset() {
+  if (levels_[kSet].empty()) {
+    return;
+  }
+  for (auto& level : levels_[kSet]) {
+    std::fill(level.begin(), level.end(), 0);
+  }
+  Levels& clear_levels = levels_[kClear];
+  for (size_t i = 0; i < clear_levels[0].size(); ++i) {
+    clear_levels[0][i] = ValidMask(i);
+  }
+  for (size_t level = 1; level < clear_levels.size(); ++level) {
+    auto& words = clear_levels[level];
+    std::fill(words.begin(), words.end(), 0);
+    const auto& lower_words = clear_levels[level - 1];
+    for (size_t i = 0; i < lower_words.size(); ++i) {
+      if (lower_words[i]) {
+        words[i >> 6] |= uint64_t(1) << (i & 63);
+      }
+    }
+  }
+}
+
+uint64_t RangeBitMap::ValidMask(size_t word_index) const {
+  size_t valid_bits = size_bits_ - (word_index << 6);
+  return valid_bits >= 64 ? ~uint64_t(0) : (uint64_t(1) << valid_bits) - 1;
+}
+
+void RangeBitMap::Update(size_t first, size_t count, bool set) {
+  if (!count) {
+    return;
+  }
+  size_t last = first + count - 1;
+  assert_true(last < size_bits_);
+  size_t first_word = first >> 6, last_word = last >> 6;
+  for (size_t word_index = first_word; word_index <= last_word;
+       ++word_index) {
+    uint64_t mask = ~uint64_t(0);
+    if (word_index == first_word) {
+      mask &= ~uint64_t(0) << (first & 63);
+    }
+    if (word_index == last_word) {
+      mask &= ~uint64_t(0) >> (63 - (last & 63));
+    }
+    uint64_t& word = levels_[kSet][0][word_index];
+    uint64_t new_word = set ? word | mask : word & ~mask;
+    if (new_word == word) {
+      continue;
+    }
+    word = new_word;
+    levels_[kClear][0][word_index] = ~new_word & ValidMask(word_index);
+    UpdateSummary(levels_[kSet], word_index);
+    UpdateSummary(levels_[kClear], word_index);
+  }
+}
+
+void RangeBitMap::UpdateSummary(Levels& levels, size_t word_index) {
+  for (size_t level = 1; level < levels.size(); ++level) {
+    bool any = levels[level - 1][word_index] != 0;
+    uint64_t bit = uint64_t(1) << (word_index & 63);
+    uint64_t& word = levels[level][word_index >> 6];
+    uint64_t new_word = any ? word | bit : word & ~bit;
+    if (new_word == word) {
+      // Nothing further up changes either.
+      break;
+    }
+    word = new_word;
+    word_index >>= 6;
+  }
+}
+
+size_t RangeBitMap::FindFirst(Polarity polarity, size_t first,
+                              size_t end) const {
+  end = std::min(end, size_bits_);
+  if (first >= end) {
+    return end;
+  }
+  size_t index = FindNext(levels_[polarity], 0, first);
+  return index < end ? index : end;
+}
+
+size_t RangeBitMap::FindLast(Polarity polarity, size_t first,
+                             size_t end) const {
+  end = std::min(end, size_bits_);
+  if (first >= end) {
+    return end;
+  }
+  size_t index = FindPrevious(levels_[polarity], 0, end - 1);
+  return index != kNotFound && index >= first ? index : end;
+}
+
+size_t RangeBitMap::FindNext(const Levels& levels, size_t level,
+                             size_t index) {
+  const auto& words = levels[level];
+  size_t word_index = index >> 6;
+  if (word_index >= words.size()) {
+    return kNotFound;
+  }
+  uint64_t word = words[word_index] & (~uint64_t(0) << (index & 63));
+  if (!word) {
+    // Find the next word with any bits set through the summary.
+    if (level + 1 < levels.size()) {
+      word_index = FindNext(levels, level + 1, word_index + 1);
+      if (word_index == kNotFound) {
+        return kNotFound;
+      }
+    } else {
+      do {
+        if (++word_index >= words.size()) {
+          return kNotFound;
+        }
+      } while (!words[word_index]);
+    }
+    word = words[word_index];
+  }
+  return (word_index << 6) + LowestSetBit(word);
+}
+
+size_t RangeBitMap::FindPrevious(const Levels& levels, size_t level,
+                                 size_t index) {
+  const auto& words = levels[level];
+  size_t word_index = index >> 6;
+  uint64_t word = words[word_index] & (~uint64_t(0) >> (63 - (index & 63)));
+  if (!word) {
+    if (!word_index) {
+      return kNotFound;
+    }
+    if (level + 1 < levels.size()) {
+      word_index = FindPrevious(levels, level + 1, word_index - 1);
+      if (word_index == kNotFound) {
+        return kNotFound;
+      }
+    } else {
+      do {
+        if (!word_index) {
+          return kNotFound;
+        }
+        --word_index;
+      } while (!words[word_index]);
+    }
+    word = words[word_index];
+  }
+  return (word_index << 6) + HighestSetBit(word);
+}
+
+}  // namespace xe
@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_RANGE_BIT_MAP_H_
+#define XENIA_BASE_RANGE_BIT_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+
+// Range Bit Map: a bit per entry with summary words above it, one bit per word
+// of the level below, so the next or previous set or clear entry is found in
+// logarithmic time. Used for searching free ranges, not threadsafe.
+class RangeBitMap {
+ public:
+  RangeBitMap();
+
+  // Resizes the bitmap to the given number of entries, all clear.
+  void Resize(size_t size_bits);
+
+  // Clears all entries.
+  void Reset();
+
+  size_t size() const { return size_bits_; }
+
+  bool Test(size_t index) const {
+    return (levels_[kSet][0][index >> 6] >> (index & 63)) & 1;
+  }
+
+  // Sets or clears count entries starting at first.
+  void Set(size_t first, size_t count) { Update(first, count, true); }
+  void Clear(size_t first, size_t count) { Update(first, count, false); }
+
+  // Returns the lowest set or clear entry within [first, end), or end if there
+  // is none.
+  size_t FindFirstSet(size_t first, size_t end) const {
+    return FindFirst(kSet, first, end);
+  }
+  size_t FindFirstClear(size_t first, size_t end) const {
+    return FindFirst(kClear, first, end);
+  }
+
+  // Returns the highest set or clear entry within [first, end), or end if
+  // there is none.
+  size_t FindLastSet(size_t first, size_t end) const {
+    return FindLast(kSet, first, end);
+  }
+  size_t FindLastClear(size_t first, size_t end) const {
+    return FindLast(kClear, first, end);
+  }
+
+ private:
+  // Both polarities are kept so searches for either only look at set bits.
+  enum Polarity {
+    kSet,
+    kClear,
+  };
+  typedef std::vector<std::vector<uint64_t>> Levels;
+
+  static const size_t kNotFound = SIZE_MAX;
+
+  void Update(size_t first, size_t count, bool set);
+  // Updates the summary bits above the given level 0 word.
+  void UpdateSummary(Levels& levels, size_t word_index);
+  // Mask of the entries that exist within a level 0 word.
+  uint64_t ValidMask(size_t word_index) const;
+
+  size_t FindFirst(Polarity polarity, size_t first, size_t end) const;
+  size_t FindLast(Polarity polarity, size_t first, size_t end) const;
+  static size_t FindNext(const Levels& levels, size_t level, size_t index);
+  static size_t FindPrevious(const Levels& levels, size_t level, size_t index);
+
+  size_t size_bits_ = 0;
+  Levels levels_[2];
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_RANGE_BIT_MAP_H_
@@ -17,6 +17,7 @@
 
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/memory.h"
 
 namespace xe {
 
@@ -95,6 +96,33 @@ class RingBuffer {
     return imm;
   }
 
+  // Reads count values and swaps them, both halves of a wrapped range in one
+  // go rather than value by value. Returns the number of values read.
+  template <typename T>
+  size_t ReadAndSwapArray(T* values, size_t count) {
+    static_assert(std::is_fundamental<T>::value,
+                  "Array read only supports basic types!");
+
+    auto range = BeginRead(count * sizeof(T));
+    if (range.first_length % sizeof(T)) {
+      // A value is split by the end of the buffer.
+      size_t read = Read(values, count * sizeof(T)) / sizeof(T);
+      xe::copy_and_swap(values, values, read);
+      return read;
+    }
+    size_t first_count = range.first_length / sizeof(T);
+    size_t second_count = range.second_length / sizeof(T);
+    xe::copy_and_swap(values, reinterpret_cast<const T*>(range.first),
+                      first_count);
+    if (second_count) {
+      xe::copy_and_swap(values + first_count,
+                        reinterpret_cast<const T*>(range.second),
+                        second_count);
+    }
+    EndRead(range);
+    return first_count + second_count;
+  }
+
   size_t Write(const uint8_t* buffer, size_t count);
   template <typename T>
   size_t Write(const T* buffer, size_t count) {
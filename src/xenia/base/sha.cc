@@ -0,0 +1,385 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/sha.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/platform.h"
+
+#if XE_ARCH_AMD64
+#include <immintrin.h>
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#define XE_SHA_NI_TARGET
+#else
+#include <cpuid.h>
+#define XE_SHA_NI_TARGET __attribute__((target("sha,ssse3,sse4.1")))
+#endif  // XE_COMPILER_MSVC
+#endif  // XE_ARCH_AMD64
+
+namespace xe {
+
+namespace {
+
+const uint32_t kSha1InitialState[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE,
+                                       0x10325476, 0xC3D2E1F0};
+
+const uint32_t kSha256InitialState[8] = {0x6A09E667, 0xBB67AE85, 0x3C6EF372,
+                                         0xA54FF53A, 0x510E527F, 0x9B05688C,
+                                         0x1F83D9AB, 0x5BE0CD19};
+
+alignas(16) const uint32_t kSha256K[64] = {
+    0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1,
+    0x923F82A4, 0xAB1C5ED5, 0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3,
+    0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174, 0xE49B69C1, 0xEFBE4786,
+    0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+    0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147,
+    0x06CA6351, 0x14292967, 0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13,
+    0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85, 0xA2BFE8A1, 0xA81A664B,
+    0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+    0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A,
+    0x5B9CCA4F, 0x682E6FF3, 0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208,
+    0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2};
+
+void Sha1BlocksSoftware(uint32_t* state, const uint8_t* blocks,
+                        size_t block_count) {
+  for (; block_count; --block_count, blocks += 64) {
+    uint32_t w[80];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = xe::load_and_swap<uint32_t>(blocks + i * 4);
+    }
+    for (int i = 16; i < 80; ++i) {
+      w[i] = xe::rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+             e = state[4];
+    for (int i = 0; i < 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t t = xe::rotate_left(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = xe::rotate_left(b, 30);
+      b = a;
+      a = t;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+  }
+}
+
+inline uint32_t rotate_right(uint32_t v, uint8_t sh) {
+  return xe::rotate_left(v, uint8_t(32 - sh));
+}
+
+void Sha256BlocksSoftware(uint32_t* state, const uint8_t* blocks,
+                          size_t block_count) {
+  for (; block_count; --block_count, blocks += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = xe::load_and_swap<uint32_t>(blocks + i * 4);
+    }
+    for (int i = 16; i < 64; ++i) {
+      uint32_t s0 = rotate_right(w[i - 15], 7) ^ rotate_right(w[i - 15], 18) ^
+                    (w[i - 15] >> 3);
+      uint32_t s1 = rotate_right(w[i - 2], 17) ^ rotate_right(w[i - 2], 19) ^
+                    (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = state[0], b = state[1], c = state[2], d = state[3],
+             e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      uint32_t s1 =
+          rotate_right(e, 6) ^ rotate_right(e, 11) ^ rotate_right(e, 25);
+      uint32_t ch = (e & f) ^ (~e & g);
+      uint32_t t1 = h + s1 + ch + kSha256K[i] + w[i];
+      uint32_t s0 =
+          rotate_right(a, 2) ^ rotate_right(a, 13) ^ rotate_right(a, 22);
+      uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + s0 + maj;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+}
+
+#if XE_ARCH_AMD64
+
+// In both, every group of four rounds also advances the message schedule of
+// the groups ahead of it, so the loops are unrolled with the group number as
+// a constant that the conditions fold on.
+
+XE_SHA_NI_TARGET void Sha1BlocksShaNi(uint32_t* state, const uint8_t* blocks,
+                                      size_t block_count) {
+  // The first word goes to the high lane.
+  const __m128i swap_mask =
+      _mm_set_epi64x(0x0001020304050607ll, 0x08090A0B0C0D0E0Fll);
+  __m128i abcd = _mm_shuffle_epi32(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0x1B);
+  __m128i e_initial = _mm_set_epi32(int(state[4]), 0, 0, 0);
+  for (; block_count; --block_count, blocks += 64) {
+    auto src = reinterpret_cast<const __m128i*>(blocks);
+    __m128i abcd_saved = abcd;
+    __m128i msg[4];
+    __m128i e[2];
+    e[0] = e_initial;
+#define ROUNDS(g)                                                       \
+  if (g < 4) {                                                          \
+    msg[g & 3] = _mm_shuffle_epi8(_mm_loadu_si128(src + (g & 3)),       \
+                                  swap_mask);                           \
+  }                                                                     \
+  e[g & 1] = g ? _mm_sha1nexte_epu32(e[g & 1], msg[g & 3])              \
+               : _mm_add_epi32(e[0], msg[0]);                           \
+  e[~g & 1] = abcd;                                                     \
+  if (g >= 3 && g <= 18) {                                              \
+    msg[(g + 1) & 3] = _mm_sha1msg2_epu32(msg[(g + 1) & 3], msg[g & 3]); \
+  }                                                                     \
+  abcd = _mm_sha1rnds4_epu32(abcd, e[g & 1], g / 5);                    \
+  if (g >= 1 && g <= 16) {                                              \
+    msg[(g + 3) & 3] = _mm_sha1msg1_epu32(msg[(g + 3) & 3], msg[g & 3]); \
+  }                                                                     \
+  if (g >= 2 && g <= 17) {                                              \
+    msg[(g + 2) & 3] = _mm_xor_si128(msg[(g + 2) & 3], msg[g & 3]);     \
+  }
+    ROUNDS(0);
+    ROUNDS(1);
+    ROUNDS(2);
+    ROUNDS(3);
+    ROUNDS(4);
+    ROUNDS(5);
+    ROUNDS(6);
+    ROUNDS(7);
+    ROUNDS(8);
+    ROUNDS(9);
+    ROUNDS(10);
+    ROUNDS(11);
+    ROUNDS(12);
+    ROUNDS(13);
+    ROUNDS(14);
+    ROUNDS(15);
+    ROUNDS(16);
+    ROUNDS(17);
+    ROUNDS(18);
+    ROUNDS(19);
+#undef ROUNDS
+    // e[0] holds a from before the last group, which rotated is the new e.
+    e_initial = _mm_sha1nexte_epu32(e[0], e_initial);
+    abcd = _mm_add_epi32(abcd, abcd_saved);
+  }
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+                   _mm_shuffle_epi32(abcd, 0x1B));
+  state[4] = uint32_t(_mm_extract_epi32(e_initial, 3));
+}
+
+XE_SHA_NI_TARGET void Sha256BlocksShaNi(uint32_t* state,
+                                        const uint8_t* blocks,
+                                        size_t block_count) {
+  const __m128i swap_mask =
+      _mm_set_epi64x(0x0C0D0E0F08090A0Bll, 0x0405060700010203ll);
+  auto k = reinterpret_cast<const __m128i*>(kSha256K);
+  // sha256rnds2 wants the state as ABEF and CDGH.
+  __m128i dcba = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state));
+  __m128i hgfe = _mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4));
+  __m128i cdab = _mm_shuffle_epi32(dcba, 0xB1);
+  __m128i efgh = _mm_shuffle_epi32(hgfe, 0x1B);
+  __m128i abef = _mm_alignr_epi8(cdab, efgh, 8);
+  __m128i cdgh = _mm_blend_epi16(efgh, cdab, 0xF0);
+  for (; block_count; --block_count, blocks += 64) {
+    auto src = reinterpret_cast<const __m128i*>(blocks);
+    __m128i abef_saved = abef;
+    __m128i cdgh_saved = cdgh;
+    __m128i msg[4];
+    __m128i msg_k;
+#define ROUNDS(g)                                                          \
+  if (g < 4) {                                                             \
+    msg[g & 3] = _mm_shuffle_epi8(_mm_loadu_si128(src + (g & 3)),          \
+                                  swap_mask);                              \
+  }                                                                        \
+  msg_k = _mm_add_epi32(msg[g & 3], _mm_load_si128(k + g));                \
+  cdgh = _mm_sha256rnds2_epu32(cdgh, abef, msg_k);                         \
+  if (g >= 3 && g <= 14) {                                                 \
+    msg[(g + 1) & 3] = _mm_add_epi32(                                      \
+        msg[(g + 1) & 3], _mm_alignr_epi8(msg[g & 3], msg[(g + 3) & 3], 4)); \
+    msg[(g + 1) & 3] = _mm_sha256msg2_epu32(msg[(g + 1) & 3], msg[g & 3]); \
+  }                                                                        \
+  abef = _mm_sha256rnds2_epu32(abef, cdgh, _mm_shuffle_epi32(msg_k, 0x0E)); \
+  if (g >= 1 && g <= 12) {                                                 \
+    msg[(g + 3) & 3] = _mm_sha256msg1_epu32(msg[(g + 3) & 3], msg[g & 3]); \
+  }
+    ROUNDS(0);
+    ROUNDS(1);
+    ROUNDS(2);
+    ROUNDS(3);
+    ROUNDS(4);
+    ROUNDS(5);
+    ROUNDS(6);
+    ROUNDS(7);
+    ROUNDS(8);
+    ROUNDS(9);
+    ROUNDS(10);
+    ROUNDS(11);
+    ROUNDS(12);
+    ROUNDS(13);
+    ROUNDS(14);
+    ROUNDS(15);
+#undef ROUNDS
+    abef = _mm_add_epi32(abef, abef_saved);
+    cdgh = _mm_add_epi32(cdgh, cdgh_saved);
+  }
+  __m128i feba = _mm_shuffle_epi32(abef, 0x1B);
+  __m128i dchg = _mm_shuffle_epi32(cdgh, 0xB1);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state),
+                   _mm_blend_epi16(feba, dchg, 0xF0));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4),
+                   _mm_alignr_epi8(dchg, feba, 8));
+}
+
+#else
+
+void (*const Sha1BlocksShaNi)(uint32_t*, const uint8_t*, size_t) = nullptr;
+void (*const Sha256BlocksShaNi)(uint32_t*, const uint8_t*, size_t) = nullptr;
+
+#endif  // XE_ARCH_AMD64
+
+}  // namespace
+
+bool ShaHasher::host_has_sha_ni() {
+#if XE_ARCH_AMD64
+#if XE_COMPILER_MSVC
+  int regs[4];
+  __cpuid(regs, 1);
+  uint32_t ecx = uint32_t(regs[2]);
+  __cpuidex(regs, 7, 0);
+  uint32_t ebx = uint32_t(regs[1]);
+#else
+  unsigned int eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  unsigned int ecx_1 = ecx;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+  ecx = ecx_1;
+#endif  // XE_COMPILER_MSVC
+  // SHA is leaf 7 ebx bit 29; the shuffles need SSSE3 and SSE4.1 (leaf 1 ecx
+  // bits 9 and 19).
+  return (ebx & (1u << 29)) && (ecx & (1u << 9)) && (ecx & (1u << 19));
+#else
+  return false;
+#endif  // XE_ARCH_AMD64
+}
+
+ShaHasher::ShaHasher(const uint32_t* state, size_t state_words,
+                     uint64_t byte_count, const uint8_t* partial_block,
+                     BlockFunction software_function,
+                     BlockFunction sha_ni_function, bool allow_sha_ni)
+    : state_words_(state_words), byte_count_(byte_count) {
+  assert_true(state_words <= xe::countof(state_));
+  // Checked once, as titles hash a lot of small buffers too.
+  static const bool host_has_sha_ni_ = host_has_sha_ni();
+  uses_sha_ni_ = allow_sha_ni && sha_ni_function && host_has_sha_ni_;
+  block_function_ = uses_sha_ni_ ? sha_ni_function : software_function;
+  std::memcpy(state_, state, state_words * 4);
+  size_t partial_size = size_t(byte_count % kBlockSize);
+  if (partial_size) {
+    std::memcpy(block_, partial_block, partial_size);
+  }
+}
+
+void ShaHasher::Update(const void* data, size_t size) {
+  auto input = static_cast<const uint8_t*>(data);
+  size_t partial_size = size_t(byte_count_ % kBlockSize);
+  byte_count_ += size;
+  if (partial_size) {
+    size_t fill_size = std::min(kBlockSize - partial_size, size);
+    std::memcpy(block_ + partial_size, input, fill_size);
+    input += fill_size;
+    size -= fill_size;
+    if (partial_size + fill_size < kBlockSize) {
+      return;
+    }
+    block_function_(state_, block_, 1);
+  }
+  size_t block_count = size / kBlockSize;
+  if (block_count) {
+    block_function_(state_, input, block_count);
+    input += block_count * kBlockSize;
+    size -= block_count * kBlockSize;
+  }
+  if (size) {
+    std::memcpy(block_, input, size);
+  }
+}
+
+void ShaHasher::Final(uint8_t* digest) {
+  uint64_t bit_count = byte_count_ * 8;
+  // 0x80, then zeros up to 8 bytes before the end of a block.
+  uint8_t padding[kBlockSize + 8] = {0x80};
+  size_t partial_size = size_t(byte_count_ % kBlockSize);
+  size_t padding_size =
+      (partial_size < kBlockSize - 8 ? kBlockSize : kBlockSize * 2) - 8 -
+      partial_size;
+  xe::store_and_swap<uint64_t>(padding + padding_size, bit_count);
+  Update(padding, padding_size + 8);
+  for (size_t i = 0; i < state_words_; ++i) {
+    xe::store_and_swap<uint32_t>(digest + i * 4, state_[i]);
+  }
+}
+
+Sha1::Sha1(bool allow_sha_ni)
+    : Sha1(kSha1InitialState, 0, nullptr, allow_sha_ni) {}
+
+Sha1::Sha1(const uint32_t state[5], uint64_t byte_count,
+           const uint8_t* partial_block, bool allow_sha_ni)
+    : ShaHasher(state, 5, byte_count, partial_block, Sha1BlocksSoftware,
+                Sha1BlocksShaNi, allow_sha_ni) {}
+
+Sha256::Sha256(bool allow_sha_ni)
+    : Sha256(kSha256InitialState, 0, nullptr, allow_sha_ni) {}
+
+Sha256::Sha256(const uint32_t state[8], uint64_t byte_count,
+               const uint8_t* partial_block, bool allow_sha_ni)
+    : ShaHasher(state, 8, byte_count, partial_block, Sha256BlocksSoftware,
+                Sha256BlocksShaNi, allow_sha_ni) {}
+
+}  // namespace xe
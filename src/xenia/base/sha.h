@@ -0,0 +1,80 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_SHA_H_
+#define XENIA_BASE_SHA_H_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xe {
+
+// Incremental SHA-1 and SHA-256. These use the SHA extensions (SHA-NI) when
+// the host has them and a portable implementation otherwise. Whole blocks are
+// hashed straight from the input, so large buffers are never copied.
+class ShaHasher {
+ public:
+  static const size_t kBlockSize = 64;
+
+  // Whether the host supports the SHA extensions.
+  static bool host_has_sha_ni();
+  bool uses_sha_ni() const { return uses_sha_ni_; }
+
+  size_t digest_size() const { return state_words_ * 4; }
+
+  void Update(const void* data, size_t size);
+  // Pads the message and writes the big-endian digest (digest_size() bytes).
+  // The hasher must not be updated afterwards.
+  void Final(uint8_t* digest);
+
+  // Everything needed to continue the hash later: the chaining state, the
+  // number of bytes hashed and the partial block, its byte_count() % 64 bytes.
+  const uint32_t* state() const { return state_; }
+  uint64_t byte_count() const { return byte_count_; }
+  const uint8_t* partial_block() const { return block_; }
+
+ protected:
+  typedef void (*BlockFunction)(uint32_t* state, const uint8_t* blocks,
+                                size_t block_count);
+
+  ShaHasher(const uint32_t* state, size_t state_words, uint64_t byte_count,
+            const uint8_t* partial_block, BlockFunction software_function,
+            BlockFunction sha_ni_function, bool allow_sha_ni);
+
+ private:
+  size_t state_words_;
+  BlockFunction block_function_;
+  bool uses_sha_ni_ = false;
+  uint64_t byte_count_;
+  uint32_t state_[8];
+  uint8_t block_[kBlockSize];
+};
+
+class Sha1 : public ShaHasher {
+ public:
+  static const size_t kDigestSize = 20;
+
+  explicit Sha1(bool allow_sha_ni = true);
+  // Continues a hash from what ShaHasher exposes of it.
+  Sha1(const uint32_t state[5], uint64_t byte_count,
+       const uint8_t* partial_block, bool allow_sha_ni = true);
+};
+
+class Sha256 : public ShaHasher {
+ public:
+  static const size_t kDigestSize = 32;
+
+  explicit Sha256(bool allow_sha_ni = true);
+  Sha256(const uint32_t state[8], uint64_t byte_count,
+         const uint8_t* partial_block, bool allow_sha_ni = true);
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_SHA_H_
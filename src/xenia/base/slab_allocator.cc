@@ -0,0 +1,267 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/slab_allocator.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/byte_stream.h"
+#include "xenia/base/math.h"
+
+namespace xe {
+
+namespace {
+
+// A slot of each class is aligned to the lowest set bit of its size, so the
+// classes in between the powers of two still serve 16 or 32 byte alignment.
+const uint32_t kSizeClasses[] = {16,  32,  48,  64,   96,   128,  192,
+                                 256, 384, 512, 768, 1024, 1536, 2048};
+
+}  // namespace
+
+SlabAllocator::SlabAllocator(ChunkAllocFunction alloc_chunk,
+                             ChunkFreeFunction free_chunk)
+    : alloc_chunk_(std::move(alloc_chunk)),
+      free_chunk_(std::move(free_chunk)),
+      size_classes_(xe::countof(kSizeClasses)) {}
+
+uint32_t SlabAllocator::slot_count(uint32_t size_class) {
+  return kChunkSize / kSizeClasses[size_class];
+}
+
+uint32_t SlabAllocator::Alloc(uint32_t size, uint32_t alignment,
+                              uint32_t tag) {
+  if (size > kMaxSize || (alignment & (alignment - 1))) {
+    return 0;
+  }
+  alignment = std::max(alignment, 1u);
+  uint32_t size_class = 0;
+  while (size_class < xe::countof(kSizeClasses) &&
+         (kSizeClasses[size_class] < size ||
+          (kSizeClasses[size_class] & (alignment - 1)))) {
+    ++size_class;
+  }
+  if (size_class >= xe::countof(kSizeClasses)) {
+    return 0;
+  }
+  uint32_t class_size = kSizeClasses[size_class];
+
+  auto global_lock = global_critical_region_.Acquire();
+  auto& partial_chunks = size_classes_[size_class].partial_chunks;
+  uint32_t base;
+  Chunk* chunk;
+  if (partial_chunks.empty()) {
+    base = alloc_chunk_();
+    if (!base) {
+      return 0;
+    }
+    assert_zero(base & (kChunkSize - 1));
+    chunk = &chunks_[base];
+    InitChunk(chunk, size_class);
+    AddPartial(base, chunk);
+  } else {
+    // The newest chunk, whose slots were touched most recently.
+    base = partial_chunks.back();
+    chunk = &chunks_[base];
+    if (chunk->free_count == slot_count(size_class)) {
+      --size_classes_[size_class].empty_chunk_count;
+    }
+  }
+
+  uint32_t slot = 0;
+  for (size_t i = 0; i < chunk->used_slots.size(); ++i) {
+    uint64_t free_slots = ~chunk->used_slots[i];
+    if (free_slots) {
+      uint32_t bit = xe::tzcnt(free_slots);
+      chunk->used_slots[i] |= uint64_t(1) << bit;
+      slot = uint32_t(i * 64 + bit);
+      break;
+    }
+  }
+  if (!--chunk->free_count) {
+    RemovePartial(chunk);
+  }
+  chunk->slot_tags[slot] = tag;
+  chunk->slot_sizes[slot] = uint16_t(size);
+
+  auto& stats = tag_stats(tag);
+  ++stats.alloc_count;
+  ++stats.live_count;
+  stats.live_bytes += size;
+  stats.live_slot_bytes += class_size;
+  return base + slot * class_size;
+}
+
+bool SlabAllocator::Free(uint32_t address) {
+  auto global_lock = global_critical_region_.Acquire();
+  uint32_t base = address & ~(kChunkSize - 1);
+  auto it = chunks_.find(base);
+  if (it == chunks_.end()) {
+    return false;
+  }
+  Chunk& chunk = it->second;
+  uint32_t class_size = kSizeClasses[chunk.size_class];
+  uint32_t slot = (address - base) / class_size;
+  uint64_t slot_bit = uint64_t(1) << (slot & 63);
+  if ((address - base) % class_size || slot >= slot_count(chunk.size_class) ||
+      !(chunk.used_slots[slot / 64] & slot_bit)) {
+    assert_always("Freeing an address that isn't an allocated slot");
+    return true;
+  }
+  chunk.used_slots[slot / 64] &= ~slot_bit;
+  if (!chunk.free_count++) {
+    AddPartial(base, &chunk);
+  }
+
+  auto& stats = tag_stats(chunk.slot_tags[slot]);
+  ++stats.free_count;
+  --stats.live_count;
+  stats.live_bytes -= chunk.slot_sizes[slot];
+  stats.live_slot_bytes -= class_size;
+
+  if (chunk.free_count == slot_count(chunk.size_class)) {
+    // One empty chunk per class is kept, so an allocation and free going
+    // back and forth over a chunk boundary don't hit the backing allocator.
+    auto& size_class = size_classes_[chunk.size_class];
+    if (size_class.empty_chunk_count) {
+      RemovePartial(&chunk);
+      chunks_.erase(it);
+      free_chunk_(base);
+    } else {
+      ++size_class.empty_chunk_count;
+    }
+  }
+  return true;
+}
+
+void SlabAllocator::Reset() {
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto& it : chunks_) {
+    free_chunk_(it.first);
+  }
+  Clear();
+}
+
+void SlabAllocator::Clear() {
+  auto global_lock = global_critical_region_.Acquire();
+  chunks_.clear();
+  size_classes_.assign(xe::countof(kSizeClasses), SizeClass());
+  tag_stats_.clear();
+}
+
+void SlabAllocator::GetStatistics(Statistics* out_stats) {
+  auto global_lock = global_critical_region_.Acquire();
+  out_stats->chunk_count = uint32_t(chunks_.size());
+  out_stats->tags.clear();
+  for (auto& it : tag_stats_) {
+    out_stats->tags.push_back(it.second);
+  }
+  std::sort(out_stats->tags.begin(), out_stats->tags.end(),
+            [](const TagStatistics& a, const TagStatistics& b) {
+              return a.live_slot_bytes > b.live_slot_bytes;
+            });
+}
+
+void SlabAllocator::Save(ByteStream* stream) {
+  auto global_lock = global_critical_region_.Acquire();
+  stream->Write(uint32_t(chunks_.size()));
+  for (auto& it : chunks_) {
+    const Chunk& chunk = it.second;
+    stream->Write(it.first);
+    stream->Write(chunk.size_class);
+    stream->WriteArray(chunk.used_slots.data(), chunk.used_slots.size());
+    stream->WriteArray(chunk.slot_tags.data(), chunk.slot_tags.size());
+    stream->WriteArray(chunk.slot_sizes.data(), chunk.slot_sizes.size());
+  }
+}
+
+bool SlabAllocator::Restore(ByteStream* stream) {
+  auto global_lock = global_critical_region_.Acquire();
+  // The chunks were restored with the backing memory.
+  Clear();
+  uint32_t chunk_count = stream->Read<uint32_t>();
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    uint32_t base = stream->Read<uint32_t>();
+    uint32_t size_class = stream->Read<uint32_t>();
+    if (size_class >= xe::countof(kSizeClasses)) {
+      return false;
+    }
+    Chunk* chunk = &chunks_[base];
+    InitChunk(chunk, size_class);
+    stream->ReadArray(chunk->used_slots.data(), chunk->used_slots.size());
+    stream->ReadArray(chunk->slot_tags.data(), chunk->slot_tags.size());
+    stream->ReadArray(chunk->slot_sizes.data(), chunk->slot_sizes.size());
+
+    // Only the live allocations can be recounted.
+    uint32_t count = slot_count(size_class);
+    for (uint32_t slot = 0; slot < count; ++slot) {
+      if (chunk->used_slots[slot / 64] & (uint64_t(1) << (slot & 63))) {
+        --chunk->free_count;
+        auto& stats = tag_stats(chunk->slot_tags[slot]);
+        ++stats.alloc_count;
+        ++stats.live_count;
+        stats.live_bytes += chunk->slot_sizes[slot];
+        stats.live_slot_bytes += kSizeClasses[size_class];
+      }
+    }
+    if (chunk->free_count) {
+      AddPartial(base, chunk);
+    }
+    if (chunk->free_count == count) {
+      ++size_classes_[size_class].empty_chunk_count;
+    }
+  }
+  return true;
+}
+
+void SlabAllocator::InitChunk(Chunk* chunk, uint32_t size_class) {
+  uint32_t count = slot_count(size_class);
+  chunk->size_class = size_class;
+  chunk->free_count = count;
+  chunk->partial_index = uint32_t(-1);
+  chunk->used_slots.assign(xe::round_up(count, 64u) / 64, 0);
+  if (count % 64) {
+    // Past the end of the chunk, never handed out.
+    chunk->used_slots.back() = ~((uint64_t(1) << (count % 64)) - 1);
+  }
+  chunk->slot_tags.assign(count, 0);
+  chunk->slot_sizes.assign(count, 0);
+}
+
+void SlabAllocator::AddPartial(uint32_t base, Chunk* chunk) {
+  auto& partial_chunks = size_classes_[chunk->size_class].partial_chunks;
+  chunk->partial_index = uint32_t(partial_chunks.size());
+  partial_chunks.push_back(base);
+}
+
+void SlabAllocator::RemovePartial(Chunk* chunk) {
+  auto& partial_chunks = size_classes_[chunk->size_class].partial_chunks;
+  uint32_t index = chunk->partial_index;
+  assert_true(index < partial_chunks.size());
+  if (index != partial_chunks.size() - 1) {
+    uint32_t moved_base = partial_chunks.back();
+    partial_chunks[index] = moved_base;
+    chunks_[moved_base].partial_index = index;
+  }
+  partial_chunks.pop_back();
+  chunk->partial_index = uint32_t(-1);
+}
+
+SlabAllocator::TagStatistics& SlabAllocator::tag_stats(uint32_t tag) {
+  auto it = tag_stats_.find(tag);
+  if (it == tag_stats_.end()) {
+    TagStatistics stats = {};
+    stats.tag = tag;
+    it = tag_stats_.emplace(tag, stats).first;
+  }
+  return it->second;
+}
+
+}  // namespace xe
@@ -0,0 +1,107 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_SLAB_ALLOCATOR_H_
+#define XENIA_BASE_SLAB_ALLOCATOR_H_
+
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+
+namespace xe {
+
+class ByteStream;
+
+// Hands out small allocations as fixed-size slots carved from larger chunks,
+// with one set of chunks per size class. The chunks come from a backing
+// allocator, so allocating and freeing only touches the bookkeeping here,
+// which is all kept on the host: the allocator deals in 32-bit addresses and
+// never reads or writes the memory itself.
+class SlabAllocator {
+ public:
+  // Chunks must be aligned to their size.
+  static const uint32_t kChunkSize = 64 * 1024;
+  // Larger allocations are left to the backing allocator.
+  static const uint32_t kMaxSize = 2048;
+
+  // Returns kChunkSize bytes aligned to kChunkSize, or 0 when out of memory.
+  typedef std::function<uint32_t()> ChunkAllocFunction;
+  typedef std::function<void(uint32_t address)> ChunkFreeFunction;
+
+  struct TagStatistics {
+    uint32_t tag;
+    uint64_t alloc_count;
+    uint64_t free_count;
+    uint32_t live_count;
+    // Requested by the live allocations. The rest of the slots holding them,
+    // live_slot_bytes - live_bytes, is lost to rounding up to a size class.
+    uint64_t live_bytes;
+    uint64_t live_slot_bytes;
+  };
+  struct Statistics {
+    uint32_t chunk_count;
+    std::vector<TagStatistics> tags;
+  };
+
+  SlabAllocator(ChunkAllocFunction alloc_chunk, ChunkFreeFunction free_chunk);
+
+  // Returns 0 if the size or alignment don't fit a slot or no chunk could be
+  // allocated, in which case the caller should use the backing allocator.
+  // The tag only groups the statistics.
+  uint32_t Alloc(uint32_t size, uint32_t alignment, uint32_t tag);
+  // Returns false if the address isn't from this allocator.
+  bool Free(uint32_t address);
+
+  // Frees every chunk.
+  void Reset();
+  // Forgets every chunk without freeing it, once the backing memory itself
+  // has been reset.
+  void Clear();
+
+  void GetStatistics(Statistics* out_stats);
+
+  void Save(ByteStream* stream);
+  bool Restore(ByteStream* stream);
+
+ private:
+  struct Chunk {
+    uint32_t size_class;
+    uint32_t free_count;
+    // Index in the partial_chunks of its size class, or -1 when full.
+    uint32_t partial_index;
+    std::vector<uint64_t> used_slots;
+    std::vector<uint32_t> slot_tags;
+    std::vector<uint16_t> slot_sizes;
+  };
+  struct SizeClass {
+    // Bases of the chunks with free slots.
+    std::vector<uint32_t> partial_chunks;
+    uint32_t empty_chunk_count = 0;
+  };
+
+  static uint32_t slot_count(uint32_t size_class);
+  void InitChunk(Chunk* chunk, uint32_t size_class);
+  void AddPartial(uint32_t base, Chunk* chunk);
+  void RemovePartial(Chunk* chunk);
+  TagStatistics& tag_stats(uint32_t tag);
+
+  xe::global_critical_region global_critical_region_;
+  ChunkAllocFunction alloc_chunk_;
+  ChunkFreeFunction free_chunk_;
+  std::unordered_map<uint32_t, Chunk> chunks_;
+  std::vector<SizeClass> size_classes_;
+  std::unordered_map<uint32_t, TagStatistics> tag_stats_;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_SLAB_ALLOCATOR_H_
@@ -0,0 +1,155 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/startup_phases.h"
+
+#include <gflags/gflags.h>
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+
+DEFINE_string(startup_report, "",
+              "Write the times of the startup phases, up to the first frame, "
+              "to this file as JSON.");
+
+namespace xe {
+
+namespace {
+
+typedef std::chrono::steady_clock::time_point TimePoint;
+
+struct State {
+  // Static initialization is as close to process start as we get portably.
+  TimePoint process_start = std::chrono::steady_clock::now();
+  std::mutex mutex;
+  double times_ms[size_t(StartupPhases::Phase::kCount)] = {};
+  std::string title;
+  bool reported = false;
+};
+
+State& state() {
+  static State state;
+  return state;
+}
+
+// Taken during static initialization.
+State& initial_state_ = state();
+
+const char* const kPhaseNames[] = {
+    "setup_begin",
+    "setup_end",
+    "launch_begin",
+    "title_mounted",
+    "title_loaded",
+    "title_launched",
+    "first_guest_code",
+    "first_packet",
+    "first_swap",
+};
+static_assert(sizeof(kPhaseNames) / sizeof(kPhaseNames[0]) ==
+                  size_t(StartupPhases::Phase::kCount),
+              "Every phase needs a name");
+
+}  // namespace
+
+std::atomic<bool> StartupPhases::reached_[size_t(Phase::kCount)];
+
+void StartupPhases::set_title(const std::string& title) {
+  auto& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  s.title = title;
+}
+
+const char* StartupPhases::name(Phase phase) {
+  return kPhaseNames[size_t(phase)];
+}
+
+double StartupPhases::time_ms(Phase phase) {
+  auto& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  return reached_[size_t(phase)] ? s.times_ms[size_t(phase)] : -1.0;
+}
+
+void StartupPhases::MarkFirst(Phase phase) {
+  auto now = std::chrono::steady_clock::now();
+  auto& s = state();
+  {
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (reached_[size_t(phase)]) {
+      return;
+    }
+    s.times_ms[size_t(phase)] =
+        std::chrono::duration<double, std::milli>(now - s.process_start)
+            .count();
+    reached_[size_t(phase)] = true;
+  }
+  if (phase == Phase::kFirstSwap) {
+    Report();
+  }
+}
+
+void StartupPhases::Report() {
+  auto& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (s.reported) {
+    return;
+  }
+  s.reported = true;
+
+  XELOGI("Startup phases%s%s:", s.title.empty() ? "" : " of ",
+         s.title.c_str());
+  for (size_t i = 0; i < size_t(Phase::kCount); ++i) {
+    if (reached_[i]) {
+      XELOGI("  %-16s %10.1f ms", kPhaseNames[i], s.times_ms[i]);
+    }
+  }
+
+  if (FLAGS_startup_report.empty()) {
+    return;
+  }
+  auto file =
+      xe::filesystem::OpenFile(xe::to_wstring(FLAGS_startup_report), "w");
+  if (!file) {
+    XELOGE("Unable to open the startup report %s",
+           FLAGS_startup_report.c_str());
+    return;
+  }
+  std::string title;
+  for (char c : s.title) {
+    if (c == '"' || c == '\\') {
+      title += '\\';
+    }
+    if (uint8_t(c) >= 0x20) {
+      title += c;
+    }
+  }
+  fprintf(file, "{\n  \"title\": \"%s\",\n  \"phases_ms\": {", title.c_str());
+  bool first = true;
+  for (size_t i = 0; i < size_t(Phase::kCount); ++i) {
+    if (reached_[i]) {
+      fprintf(file, "%s\n    \"%s\": %.3f", first ? "" : ",", kPhaseNames[i],
+              s.times_ms[i]);
+      first = false;
+    }
+  }
+  fprintf(file, "\n  }");
+  if (reached_[size_t(Phase::kFirstSwap)]) {
+    fprintf(file, ",\n  \"time_to_first_frame_ms\": %.3f",
+            s.times_ms[size_t(Phase::kFirstSwap)]);
+  }
+  fprintf(file, "\n}\n");
+  fclose(file);
+}
+
+}  // namespace xe
@@ -0,0 +1,68 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_STARTUP_PHASES_H_
+#define XENIA_BASE_STARTUP_PHASES_H_
+
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+namespace xe {
+
+// Records when the emulator first reaches each phase of booting a title,
+// relative to process start, up to the first frame it swaps. The phases are
+// logged then, and written as JSON to --startup_report if set, so that the
+// time to the first frame can be tracked across builds and titles.
+class StartupPhases {
+ public:
+  enum class Phase {
+    kSetupBegin,
+    kSetupEnd,
+    kLaunchBegin,
+    // The title's filesystem is mounted and its module is about to load.
+    kTitleMounted,
+    // The XEX and its imports are loaded.
+    kTitleLoaded,
+    kTitleLaunched,
+    kFirstGuestCode,
+    kFirstPacket,
+    kFirstSwap,
+    kCount,
+  };
+
+  // Records the first time the phase is reached. Once it has been, this is
+  // a single relaxed load, so it can sit on hot paths.
+  static void Mark(Phase phase) {
+    if (!reached_[size_t(phase)].load(std::memory_order_relaxed)) {
+      MarkFirst(phase);
+    }
+  }
+
+  // Names the title in the report.
+  static void set_title(const std::string& title);
+
+  static const char* name(Phase phase);
+  // Milliseconds from process start to the phase, or a negative value if it
+  // hasn't been reached.
+  static double time_ms(Phase phase);
+
+  // Logs the phases reached so far, and writes the report if requested.
+  // Done when the first frame is swapped.
+  static void Report();
+
+ private:
+  static void MarkFirst(Phase phase);
+
+  static std::atomic<bool> reached_[size_t(Phase::kCount)];
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_STARTUP_PHASES_H_
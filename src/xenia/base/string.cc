@@ -119,6 +119,16 @@ std::string::size_type find_first_of_case(const std::string& target,
   }
 }
 
+std::string to_lower_ascii(const std::string& source) {
+  std::string result(source);
+  for (auto& c : result) {
+    if (c >= 'A' && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+  }
+  return result;
+}
+
 std::wstring to_absolute_path(const std::wstring& path) {
 #if XE_PLATFORM_WIN32
   wchar_t buffer[kMaxPath];
@@ -296,12 +306,15 @@ int fuzzy_match(const std::string& pattern, const char* value) {
   // TODO(benvanik): look at https://github.com/atom/fuzzaldrin/tree/master/src
   // This does not weight complete substrings or prefixes right, which
   // kind of sucks.
+  // Every character of the pattern has to appear, in order.
+  if (pattern.empty()) {
+    return 0;
+  }
   size_t pattern_index = 0;
-  size_t value_length = std::strlen(value);
   int total_score = 0;
   int local_score = 0;
-  for (size_t i = 0; i < value_length; ++i) {
-    if (std::tolower(value[i]) == std::tolower(pattern[pattern_index])) {
+  for (const char* c = value; *c && pattern_index < pattern.size(); ++c) {
+    if (std::tolower(*c) == std::tolower(pattern[pattern_index])) {
       ++pattern_index;
       local_score += 1 + local_score;
     } else {
@@ -309,7 +322,7 @@ int fuzzy_match(const std::string& pattern, const char* value) {
     }
     total_score += local_score;
   }
-  return total_score;
+  return pattern_index == pattern.size() ? total_score : 0;
 }
 
 std::vector<std::pair<size_t, int>> fuzzy_filter(const std::string& pattern,
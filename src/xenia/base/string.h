@@ -44,6 +44,9 @@ inline std::wstring format_string(const wchar_t* format, ...) {
 std::string::size_type find_first_of_case(const std::string& target,
                                           const std::string& search);
 
+// Returns the string with ASCII letters lowercased, for case-insensitive keys.
+std::string to_lower_ascii(const std::string& source);
+
 // Converts the given path to an absolute path based on cwd.
 std::wstring to_absolute_path(const std::wstring& path);
 
@@ -75,7 +78,8 @@ std::string find_base_path(const std::string& path,
 std::wstring find_base_path(const std::wstring& path,
                             wchar_t sep = xe::kPathSeparator);
 
-// Tests a match against a case-insensitive fuzzy filter.
+// Tests a match against a case-insensitive fuzzy filter, which matches values
+// containing all of the pattern characters in order.
 // Returns the score of the match or 0 if none.
 int fuzzy_match(const std::string& pattern, const char* value);
 
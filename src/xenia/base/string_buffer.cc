@@ -64,9 +64,14 @@ void StringBuffer::AppendFormat(const char* format, ...) {
 }
 
 void StringBuffer::AppendVarargs(const char* format, va_list args) {
-  int length = vsnprintf(nullptr, 0, format, args);
+  // Measuring consumes the arguments, so it goes through a copy of them.
+  va_list size_args;
+  va_copy(size_args, args);
+  int length = vsnprintf(nullptr, 0, format, size_args);
+  va_end(size_args);
   Grow(length + 1);
-  vsnprintf(buffer_ + buffer_offset_, buffer_capacity_, format, args);
+  vsnprintf(buffer_ + buffer_offset_, buffer_capacity_ - buffer_offset_,
+            format, args);
   buffer_offset_ += length;
   buffer_[buffer_offset_] = 0;
 }
@@ -10,7 +10,10 @@
 #ifndef XENIA_BASE_STRING_BUFFER_H_
 #define XENIA_BASE_STRING_BUFFER_H_
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -45,6 +48,56 @@ class StringBuffer {
   size_t buffer_capacity_ = 0;
 };
 
+// Builds a string in N characters stored inline, so on the stack for a local,
+// and only moves it to the heap if it grows past them. Always terminated.
+template <typename T, size_t N>
+class StackStringBuffer {
+ public:
+  StackStringBuffer() { inline_buffer_[0] = 0; }
+  StackStringBuffer(const StackStringBuffer&) = delete;
+  StackStringBuffer& operator=(const StackStringBuffer&) = delete;
+
+  size_t length() const { return length_; }
+  const T* data() const { return buffer_; }
+
+  void Reset() {
+    length_ = 0;
+    buffer_[0] = 0;
+  }
+
+  void Append(T c) {
+    Reserve(length_ + 1);
+    buffer_[length_++] = c;
+    buffer_[length_] = 0;
+  }
+  void Append(const T* values, size_t count) {
+    Reserve(length_ + count);
+    std::memcpy(buffer_ + length_, values, count * sizeof(T));
+    length_ += count;
+    buffer_[length_] = 0;
+  }
+
+ private:
+  void Reserve(size_t length) {
+    // One more for the terminator.
+    if (length < capacity_) {
+      return;
+    }
+    size_t new_capacity = std::max(capacity_ * 2, length + 1);
+    std::unique_ptr<T[]> heap_buffer(new T[new_capacity]);
+    std::memcpy(heap_buffer.get(), buffer_, (length_ + 1) * sizeof(T));
+    heap_buffer_ = std::move(heap_buffer);
+    buffer_ = heap_buffer_.get();
+    capacity_ = new_capacity;
+  }
+
+  T inline_buffer_[N];
+  std::unique_ptr<T[]> heap_buffer_;
+  T* buffer_ = inline_buffer_;
+  size_t length_ = 0;
+  size_t capacity_ = N;
+};
+
 }  // namespace xe
 
 #endif  // XENIA_BASE_STRING_BUFFER_H_
@@ -0,0 +1,232 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/task_scheduler.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
+
+DEFINE_int32(task_scheduler_threads, 0,
+             "Worker threads of the shared task scheduler. 0 for the host "
+             "logical processor count minus --task_scheduler_reserved_cores.");
+DEFINE_int32(task_scheduler_reserved_cores, 4,
+             "Host logical processors left to guest threads when sizing the "
+             "shared task scheduler.");
+
+namespace xe {
+
+namespace {
+
+struct CurrentWorker {
+  const TaskScheduler* scheduler;
+  uint32_t index;
+};
+
+thread_local CurrentWorker current_worker_ = {nullptr,
+                                              TaskScheduler::kAnyWorker};
+
+}  // namespace
+
+const uint32_t TaskScheduler::kAnyWorker;
+
+TaskScheduler* TaskScheduler::shared() {
+  static TaskScheduler scheduler([]() {
+    int32_t count = FLAGS_task_scheduler_threads;
+    if (count <= 0) {
+      count = int32_t(xe::threading::logical_processor_count()) -
+              std::max(FLAGS_task_scheduler_reserved_cores, 0);
+    }
+    return uint32_t(std::max(count, 1));
+  }());
+  return &scheduler;
+}
+
+TaskScheduler::TaskScheduler(uint32_t worker_count) {
+  assert_true(worker_count > 0);
+  // All of them exist before any can start stealing from the others.
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+    auto thread =
+        xe::threading::Thread::Create(params, [this, i]() { WorkerMain(i); });
+    assert_not_null(thread);
+    thread->set_name(xe::format_string("Task Worker %u", i));
+    workers_[i]->thread = std::move(thread);
+  }
+  XELOGI("Started %u task scheduler workers", worker_count);
+}
+
+TaskScheduler::~TaskScheduler() {
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    shutting_down_ = true;
+  }
+  sleep_cond_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker->thread.get(), false);
+  }
+  // Release the waiters of what never ran.
+  for (auto& worker : workers_) {
+    for (auto& queue : worker->queues) {
+      for (auto& task : queue) {
+        if (task.group) {
+          task.group->RemovePending();
+        }
+      }
+    }
+  }
+}
+
+uint32_t TaskScheduler::current_worker() const {
+  return current_worker_.scheduler == this ? current_worker_.index
+                                           : kAnyWorker;
+}
+
+void TaskScheduler::Submit(std::function<void()> task, TaskPriority priority,
+                           uint32_t worker_hint) {
+  Submit(nullptr, std::move(task), priority, worker_hint);
+}
+
+void TaskScheduler::Submit(TaskGroup* group, std::function<void()> task,
+                           TaskPriority priority, uint32_t worker_hint) {
+  if (group) {
+    group->AddPending();
+  }
+  uint32_t worker_index;
+  if (worker_hint != kAnyWorker) {
+    worker_index = worker_hint % worker_count();
+  } else {
+    worker_index = current_worker();
+    if (worker_index == kAnyWorker) {
+      worker_index = next_worker_++ % worker_count();
+    }
+  }
+  auto& worker = *workers_[worker_index];
+  {
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    worker.queues[size_t(priority)].push_back({std::move(task), group});
+  }
+  {
+    std::lock_guard<std::mutex> lock(sleep_mutex_);
+    ++queued_count_;
+  }
+  sleep_cond_.notify_one();
+}
+
+bool TaskScheduler::RunOne() {
+  Task task;
+  if (!TakeTask(current_worker(), &task)) {
+    return false;
+  }
+  RunTask(task);
+  return true;
+}
+
+bool TaskScheduler::TakeTask(uint32_t worker_index, Task* out_task) {
+  uint32_t count = worker_count();
+  uint32_t first = worker_index != kAnyWorker ? worker_index : 0;
+  for (size_t priority = 0; priority < kPriorityCount; ++priority) {
+    for (uint32_t i = 0; i < count; ++i) {
+      uint32_t victim = (first + i) % count;
+      auto& worker = *workers_[victim];
+      std::lock_guard<std::mutex> lock(worker.mutex);
+      auto& queue = worker.queues[priority];
+      if (queue.empty()) {
+        continue;
+      }
+      if (victim == worker_index) {
+        *out_task = std::move(queue.back());
+        queue.pop_back();
+      } else {
+        *out_task = std::move(queue.front());
+        queue.pop_front();
+      }
+      std::lock_guard<std::mutex> sleep_lock(sleep_mutex_);
+      --queued_count_;
+      return true;
+    }
+  }
+  return false;
+}
+
+void TaskScheduler::RunTask(Task& task) {
+  if (!task.group || !task.group->is_cancelled()) {
+    SCOPE_profile_cpu_i("internal", "TaskScheduler::RunTask");
+    task.function();
+  }
+  if (task.group) {
+    task.group->RemovePending();
+  }
+}
+
+void TaskScheduler::WorkerMain(uint32_t worker_index) {
+  Profiler::ThreadEnter(
+      xe::format_string("Task Worker %u", worker_index).c_str());
+  current_worker_ = {this, worker_index};
+  while (true) {
+    Task task;
+    if (TakeTask(worker_index, &task)) {
+      RunTask(task);
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(sleep_mutex_);
+    sleep_cond_.wait(lock,
+                     [this]() { return shutting_down_ || queued_count_; });
+    if (shutting_down_) {
+      break;
+    }
+  }
+  current_worker_ = {nullptr, kAnyWorker};
+  Profiler::ThreadExit();
+}
+
+TaskGroup::TaskGroup(TaskScheduler* scheduler) : scheduler_(scheduler) {}
+
+TaskGroup::~TaskGroup() { Wait(); }
+
+void TaskGroup::Wait() {
+  while (true) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (!pending_count_) {
+        return;
+      }
+    }
+    if (!scheduler_->RunOne()) {
+      break;
+    }
+  }
+  // What's left is running on other threads, or queued after the check.
+  std::unique_lock<std::mutex> lock(mutex_);
+  cond_.wait(lock, [this]() { return !pending_count_; });
+}
+
+void TaskGroup::AddPending() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++pending_count_;
+}
+
+void TaskGroup::RemovePending() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  assert_true(pending_count_ > 0);
+  if (!--pending_count_) {
+    cond_.notify_all();
+  }
+}
+
+}  // namespace xe
@@ -0,0 +1,141 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_TASK_SCHEDULER_H_
+#define XENIA_BASE_TASK_SCHEDULER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+
+class TaskGroup;
+
+// Order of tasks waiting to run, between all the workers.
+enum class TaskPriority {
+  kHigh,
+  kNormal,
+  kLow,
+};
+
+// Runs short background tasks on a fixed set of host threads shared by all
+// subsystems, rather than each of them keeping threads of its own.
+//
+// Every worker has a queue per priority. Tasks submitted from a worker go to
+// its own queues, where it takes the newest first to stay warm in cache, and
+// others to the queues of the worker hinted at, or of each worker in turn.
+// Idle workers steal the oldest tasks of the others, higher priorities
+// first. Workers run below normal priority so that they never get in the
+// way of guest threads, and the shared scheduler leaves some host cores to
+// them too.
+class TaskScheduler {
+ public:
+  // Worker hint for tasks that can run anywhere.
+  static const uint32_t kAnyWorker = UINT32_MAX;
+
+  // Started on first use with --task_scheduler_threads workers.
+  static TaskScheduler* shared();
+
+  explicit TaskScheduler(uint32_t worker_count);
+  // Drops the tasks that haven't started, and waits for the running ones.
+  ~TaskScheduler();
+
+  uint32_t worker_count() const { return uint32_t(workers_.size()); }
+  // The index of the worker calling, or kAnyWorker if it isn't one.
+  uint32_t current_worker() const;
+
+  // Queues the task to run on a worker. The hint is a worker index (modulo
+  // the count) that should run it, such as one that recently worked on the
+  // same data; other workers may still steal it.
+  void Submit(std::function<void()> task,
+              TaskPriority priority = TaskPriority::kNormal,
+              uint32_t worker_hint = kAnyWorker);
+  void Submit(TaskGroup* group, std::function<void()> task,
+              TaskPriority priority = TaskPriority::kNormal,
+              uint32_t worker_hint = kAnyWorker);
+
+  // Takes a queued task, in the same order as a worker would, and runs it on
+  // the calling thread. False if there were none.
+  bool RunOne();
+
+ private:
+  static const size_t kPriorityCount = size_t(TaskPriority::kLow) + 1;
+
+  struct Task {
+    std::function<void()> function;
+    TaskGroup* group;
+  };
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Task> queues[kPriorityCount];
+    std::unique_ptr<xe::threading::Thread> thread;
+  };
+
+  bool TakeTask(uint32_t worker_index, Task* out_task);
+  void RunTask(Task& task);
+  void WorkerMain(uint32_t worker_index);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<uint32_t> next_worker_ = {0};
+
+  // Tasks queued and not taken yet, under sleep_mutex_ for waking workers.
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cond_;
+  size_t queued_count_ = 0;
+  bool shutting_down_ = false;
+};
+
+// Tracks a set of tasks submitted to a scheduler, to wait for or cancel
+// them together.
+class TaskGroup {
+ public:
+  explicit TaskGroup(TaskScheduler* scheduler = TaskScheduler::shared());
+  // Waits for the tasks of the group.
+  ~TaskGroup();
+
+  TaskScheduler* scheduler() const { return scheduler_; }
+  bool is_cancelled() const { return cancelled_; }
+
+  void Run(std::function<void()> task,
+           TaskPriority priority = TaskPriority::kNormal,
+           uint32_t worker_hint = TaskScheduler::kAnyWorker) {
+    scheduler_->Submit(this, std::move(task), priority, worker_hint);
+  }
+
+  // Returns once every task of the group has finished or been dropped,
+  // running queued tasks (of any group) on the calling thread meanwhile.
+  void Wait();
+  // Drops the tasks of the group that haven't started, including those run
+  // later. Running tasks can poll is_cancelled to stop early.
+  void Cancel() { cancelled_ = true; }
+
+ private:
+  friend class TaskScheduler;
+
+  void AddPending();
+  void RemovePending();
+
+  TaskScheduler* scheduler_;
+  std::atomic<bool> cancelled_ = {false};
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  uint32_t pending_count_ = 0;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_TASK_SCHEDULER_H_
@@ -0,0 +1,120 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/aes_cbc.h"
+
+#include <cstring>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+// NIST SP 800-38A F.2.2, CBC-AES128.Decrypt.
+static const uint8_t kKey[16] = {0x2B, 0x7E, 0x15, 0x16, 0x28, 0xAE,
+                                 0xD2, 0xA6, 0xAB, 0xF7, 0x15, 0x88,
+                                 0x09, 0xCF, 0x4F, 0x3C};
+static const uint8_t kIv[16] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05,
+                                0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B,
+                                0x0C, 0x0D, 0x0E, 0x0F};
+static const uint8_t kCiphertext[64] = {
+    0x76, 0x49, 0xAB, 0xAC, 0x81, 0x19, 0xB2, 0x46, 0xCE, 0xE9, 0x8E,
+    0x9B, 0x12, 0xE9, 0x19, 0x7D, 0x50, 0x86, 0xCB, 0x9B, 0x50, 0x72,
+    0x19, 0xEE, 0x95, 0xDB, 0x11, 0x3A, 0x91, 0x76, 0x78, 0xB2, 0x73,
+    0xBE, 0xD6, 0xB8, 0xE3, 0xC1, 0x74, 0x3B, 0x71, 0x16, 0xE6, 0x9E,
+    0x22, 0x22, 0x95, 0x16, 0x3F, 0xF1, 0xCA, 0xA1, 0x68, 0x1F, 0xAC,
+    0x09, 0x12, 0x0E, 0xCA, 0x30, 0x75, 0x86, 0xE1, 0xA7};
+static const uint8_t kPlaintext[64] = {
+    0x6B, 0xC1, 0xBE, 0xE2, 0x2E, 0x40, 0x9F, 0x96, 0xE9, 0x3D, 0x7E,
+    0x11, 0x73, 0x93, 0x17, 0x2A, 0xAE, 0x2D, 0x8A, 0x57, 0x1E, 0x03,
+    0xAC, 0x9C, 0x9E, 0xB7, 0x6F, 0xAC, 0x45, 0xAF, 0x8E, 0x51, 0x30,
+    0xC8, 0x1C, 0x46, 0xA3, 0x5C, 0xE4, 0x11, 0xE5, 0xFB, 0xC1, 0x19,
+    0x1A, 0x0A, 0x52, 0xEF, 0xF6, 0x9F, 0x24, 0x45, 0xDF, 0x4F, 0x9B,
+    0x17, 0xAD, 0x2B, 0x41, 0x7B, 0xE6, 0x6C, 0x37, 0x10};
+
+static void TestKnownAnswer(bool allow_aes_ni) {
+  AesCbcDecryptor aes(kKey, allow_aes_ni);
+  uint8_t output[64];
+  aes.Decrypt(kIv, kCiphertext, sizeof(kCiphertext), output);
+  REQUIRE(std::memcmp(output, kPlaintext, sizeof(output)) == 0);
+
+  // In place.
+  std::memcpy(output, kCiphertext, sizeof(output));
+  aes.Decrypt(kIv, output, sizeof(output), output);
+  REQUIRE(std::memcmp(output, kPlaintext, sizeof(output)) == 0);
+
+  // Starting mid-stream from the preceding ciphertext block.
+  aes.Decrypt(kCiphertext + 16, kCiphertext + 32, 32, output);
+  REQUIRE(std::memcmp(output, kPlaintext + 32, 32) == 0);
+}
+
+TEST_CASE("aes_cbc_software", "AesCbc") { TestKnownAnswer(false); }
+
+TEST_CASE("aes_cbc_aes_ni", "AesCbc") {
+  if (!AesCbcDecryptor::host_has_aes_ni()) {
+    return;
+  }
+  TestKnownAnswer(true);
+
+  // Odd lengths exercise the interleaved loop, its remainder and the
+  // partial tail block against the reference implementation.
+  std::vector<uint8_t> input(4099);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = uint8_t(i * 131 + 7);
+  }
+  AesCbcDecryptor software(kKey, false);
+  AesCbcDecryptor aes_ni(kKey, true);
+  REQUIRE(aes_ni.uses_aes_ni());
+  std::vector<uint8_t> expected(input.size());
+  std::vector<uint8_t> actual(input.size());
+  software.Decrypt(nullptr, input.data(), input.size(), expected.data());
+  aes_ni.Decrypt(nullptr, input.data(), input.size(), actual.data());
+  REQUIRE(expected == actual);
+}
+
+// NIST SP 800-38A F.1.1 and F.2.1, ECB and CBC-AES128.Encrypt, on the key
+// schedule the way the guest kernel keeps it.
+static void TestKeySchedule(bool allow_aes_ni) {
+  static const uint8_t kEcbCiphertext[16] = {0x3A, 0xD7, 0x7B, 0xB4, 0x0D, 0x7A,
+                                             0x36, 0x60, 0xA8, 0x9E, 0xCA, 0xF3,
+                                             0x24, 0x66, 0xEF, 0x97};
+  uint8_t round_keys[11][16];
+  Aes128ExpandKey(kKey, round_keys);
+  uint8_t output[64];
+  Aes128Encrypt(round_keys, nullptr, kPlaintext, 1, output, allow_aes_ni);
+  REQUIRE(std::memcmp(output, kEcbCiphertext, 16) == 0);
+  Aes128Decrypt(round_keys, nullptr, kEcbCiphertext, 1, output, allow_aes_ni);
+  REQUIRE(std::memcmp(output, kPlaintext, 16) == 0);
+
+  // Chained through the iv, in two calls.
+  uint8_t iv[16];
+  std::memcpy(iv, kIv, 16);
+  Aes128Encrypt(round_keys, iv, kPlaintext, 1, output, allow_aes_ni);
+  Aes128Encrypt(round_keys, iv, kPlaintext + 16, 3, output + 16, allow_aes_ni);
+  REQUIRE(std::memcmp(output, kCiphertext, sizeof(output)) == 0);
+  REQUIRE(std::memcmp(iv, kCiphertext + 48, 16) == 0);
+  std::memcpy(iv, kIv, 16);
+  Aes128Decrypt(round_keys, iv, output, 4, output, allow_aes_ni);
+  REQUIRE(std::memcmp(output, kPlaintext, sizeof(output)) == 0);
+}
+
+TEST_CASE("aes_key_schedule_software", "AesCbc") { TestKeySchedule(false); }
+
+TEST_CASE("aes_key_schedule_aes_ni", "AesCbc") {
+  if (!AesCbcDecryptor::host_has_aes_ni()) {
+    return;
+  }
+  TestKeySchedule(true);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
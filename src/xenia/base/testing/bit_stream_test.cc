@@ -0,0 +1,79 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/bit_stream.h"
+
+#include <cstring>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+namespace {
+
+uint32_t GetBit(const uint8_t* buffer, size_t offset_bits) {
+  return (buffer[offset_bits >> 3] >> (7 - (offset_bits & 7))) & 1;
+}
+
+void FillPattern(uint8_t* buffer, size_t length) {
+  uint32_t value = 0x12345678;
+  for (size_t i = 0; i < length; i++) {
+    value = value * 1103515245 + 12345;
+    buffer[i] = uint8_t(value >> 16);
+  }
+}
+
+}  // namespace
+
+TEST_CASE("bit_stream_read", "BitStream") {
+  uint8_t buffer[] = {0xA5, 0x0F, 0xF0, 0x81};
+  BitStream stream(buffer, sizeof(buffer) * 8);
+  REQUIRE(stream.Peek(0) == 0);
+  REQUIRE(stream.Read(4) == 0xA);
+  REQUIRE(stream.Read(8) == 0x50);
+  REQUIRE(stream.Read(15) == 0x7F84);
+  // The end of the buffer is shorter than a word.
+  REQUIRE(stream.Read(5) == 0x01);
+  REQUIRE(stream.BitsRemaining() == 0);
+}
+
+TEST_CASE("bit_stream_copy_bits", "BitStream") {
+  uint8_t source[64];
+  FillPattern(source, sizeof(source));
+  for (size_t src_offset = 0; src_offset < 16; src_offset++) {
+    for (size_t dest_offset = 0; dest_offset < 16; dest_offset++) {
+      for (size_t num_bits = 0; num_bits <= 300; num_bits += 7) {
+        uint8_t dest[64];
+        std::memset(dest, 0xCC, sizeof(dest));
+        uint8_t expected[64];
+        std::memcpy(expected, dest, sizeof(dest));
+        for (size_t i = 0; i < num_bits; i++) {
+          size_t bit = dest_offset + i;
+          uint8_t mask = uint8_t(0x80 >> (bit & 7));
+          expected[bit >> 3] = uint8_t((expected[bit >> 3] & ~mask) |
+                                       (GetBit(source, src_offset + i)
+                                            ? mask
+                                            : 0));
+        }
+
+        BitStream stream(source, sizeof(source) * 8);
+        stream.SetOffset(src_offset);
+        stream.CopyBits(dest, dest_offset, num_bits);
+        REQUIRE(stream.offset_bits() == src_offset + num_bits);
+        REQUIRE(std::memcmp(dest, expected, sizeof(dest)) == 0);
+      }
+    }
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,89 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/concurrent_hash_map.h"
+
+#include <thread>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("concurrent_hash_map_insert_find", "ConcurrentHashMap") {
+  ConcurrentHashMap<int> map(16);
+  int values[4] = {0, 1, 2, 3};
+  REQUIRE(map.Find(0x82000000) == nullptr);
+  map.Insert(0x82000000, &values[0]);
+  map.Insert(0x82000004, &values[1]);
+  map.Insert(0, &values[2]);
+  map.Insert(0xFFFFFFFF, &values[3]);
+  REQUIRE(map.size() == 4);
+  REQUIRE(map.Find(0x82000000) == &values[0]);
+  REQUIRE(map.Find(0x82000004) == &values[1]);
+  REQUIRE(map.Find(0) == &values[2]);
+  REQUIRE(map.Find(0xFFFFFFFF) == &values[3]);
+  REQUIRE(map.Find(0x82000008) == nullptr);
+
+  // Replacing keeps the count.
+  map.Insert(0x82000000, &values[3]);
+  REQUIRE(map.size() == 4);
+  REQUIRE(map.Find(0x82000000) == &values[3]);
+}
+
+TEST_CASE("concurrent_hash_map_grow", "ConcurrentHashMap") {
+  ConcurrentHashMap<int> map(16);
+  static int value = 0;
+  for (uint32_t i = 0; i < 10000; ++i) {
+    map.Insert(0x82000000 + i * 4, &value);
+  }
+  REQUIRE(map.size() == 10000);
+  size_t count = 0;
+  map.ForEach([&](uint32_t key, int* found_value) {
+    REQUIRE(found_value == &value);
+    ++count;
+  });
+  REQUIRE(count == 10000);
+  for (uint32_t i = 0; i < 10000; ++i) {
+    REQUIRE(map.Find(0x82000000 + i * 4) == &value);
+  }
+}
+
+TEST_CASE("concurrent_hash_map_concurrent_reads", "ConcurrentHashMap") {
+  // One writer growing the table while a reader looks up what has been
+  // published so far; everything it sees must be complete.
+  const uint32_t kCount = 20000;
+  ConcurrentHashMap<uint32_t> map(16);
+  std::unique_ptr<uint32_t[]> values(new uint32_t[kCount]);
+  std::atomic<uint32_t> published = {0};
+  bool reader_ok = true;
+  std::thread reader([&]() {
+    while (published.load() < kCount) {
+      uint32_t limit = published.load();
+      for (uint32_t i = 0; i < limit; i += 97) {
+        auto found_value = map.Find(i * 4);
+        if (!found_value || *found_value != i) {
+          reader_ok = false;
+        }
+      }
+    }
+  });
+  for (uint32_t i = 0; i < kCount; ++i) {
+    values[i] = i;
+    map.Insert(i * 4, &values[i]);
+    published.store(i + 1);
+  }
+  reader.join();
+  REQUIRE(reader_ok);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -9,7 +9,14 @@
 
 #include "xenia/base/memory.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <vector>
+
 #include "third_party/catch/include/catch.hpp"
+#include "xenia/base/math.h"
 
 namespace xe {
 namespace base {
@@ -405,13 +412,282 @@ TEST_CASE("copy_and_swap_64_unaligned", "Copy and Swap") {
 }
 
 TEST_CASE("copy_and_swap_16_in_32_aligned", "Copy and Swap") {
-  // TODO(bwrsandman): test once properly understood.
-  REQUIRE(true == true);
+  alignas(16) uint32_t a = 0x11111111, b = 0x89ABCDEF;
+  copy_and_swap_16_in_32_aligned(&a, &b, 1);
+  REQUIRE(a == 0xCDEF89AB);
+  REQUIRE(b == 0x89ABCDEF);
+
+  alignas(16) uint32_t c[] = {0x00000000, 0x00000000, 0x00000000, 0x00000000,
+                              0x00000000};
+  alignas(16) uint32_t d[] = {0x01234567, 0x89ABCDEF, 0xE887EEED, 0xD8514199,
+                              0x0000FFFF};
+  copy_and_swap_16_in_32_aligned(c, d, 3);
+  REQUIRE(c[0] == 0x45670123);
+  REQUIRE(c[1] == 0xCDEF89AB);
+  REQUIRE(c[2] == 0xEEEDE887);
+  REQUIRE(c[3] == 0x00000000);
+
+  copy_and_swap_16_in_32_aligned(c, d, 5);
+  REQUIRE(c[0] == 0x45670123);
+  REQUIRE(c[1] == 0xCDEF89AB);
+  REQUIRE(c[2] == 0xEEEDE887);
+  REQUIRE(c[3] == 0x4199D851);
+  REQUIRE(c[4] == 0xFFFF0000);
 }
 
 TEST_CASE("copy_and_swap_16_in_32_unaligned", "Copy and Swap") {
-  // TODO(bwrsandman): test once properly understood.
-  REQUIRE(true == true);
+  uint32_t a = 0x11111111, b = 0x89ABCDEF;
+  copy_and_swap_16_in_32_unaligned(&a, &b, 1);
+  REQUIRE(a == 0xCDEF89AB);
+  REQUIRE(b == 0x89ABCDEF);
+
+  char f[85] = {0x00};
+  char g[] =
+      "This is a 85 byte long string... "
+      "It's supposed to be longer than standard alignment.";
+  copy_and_swap_16_in_32_unaligned(f, g, 21);
+  REQUIRE(std::strcmp(f,
+                      "isThs  i85a yt bloe  sngintr..g.t' Isus ospp tedbeo "
+                      "on lr geanthta sarndald nmigt.en") == 0);
+
+  std::memset(f, 0, sizeof(f));
+  copy_and_swap_16_in_32_unaligned(f, g + 1, 20);
+  REQUIRE(std::strcmp(f,
+                      "s hi ais5  8tebyon lstg ngri. ..'sItup ssepotod e  "
+                      "bnglo tern haanstrddali amegn") == 0);
+}
+
+TEST_CASE("copy_cmp_swap_16_unaligned", "Copy and Swap") {
+  // Enough values for the vector loops and a residual.
+  uint16_t src[37];
+  uint16_t dest[37];
+  for (uint16_t i = 0; i < 37; ++i) {
+    src[i] = i % 3 ? uint16_t(0x0100 + i) : 0x3412;
+  }
+  copy_cmp_swap_16_unaligned(dest, src, 0x1234, 37);
+  for (uint16_t i = 0; i < 37; ++i) {
+    REQUIRE(dest[i] == (i % 3 ? uint16_t((i << 8) | 0x01) : 0xFFFF));
+  }
+}
+
+TEST_CASE("copy_cmp_swap_32_unaligned", "Copy and Swap") {
+  uint32_t src[19];
+  uint32_t dest[19];
+  for (uint32_t i = 0; i < 19; ++i) {
+    src[i] = i % 3 ? 0x01000000 + i : 0x78563412;
+  }
+  copy_cmp_swap_32_unaligned(dest, src, 0x12345678, 19);
+  for (uint32_t i = 0; i < 19; ++i) {
+    REQUIRE(dest[i] == (i % 3 ? (i << 24) | 0x01 : 0xFFFFFFFF));
+  }
+}
+
+TEST_CASE("copy_and_swap_lengths", "Copy and Swap") {
+  // Every length up to a few vectors, so the AVX2, SSE and scalar loops all
+  // meet each other at some point.
+  uint8_t src[257];
+  for (size_t i = 0; i < sizeof(src); ++i) {
+    src[i] = uint8_t(i * 7 + 1);
+  }
+  for (size_t length = 0; length < 256; length += 8) {
+    uint8_t dest[264];
+    std::memset(dest, 0, sizeof(dest));
+    copy_and_swap_64_unaligned(dest, src + 1, length / 8);
+    for (size_t i = 0; i < length; ++i) {
+      REQUIRE(dest[i] == src[1 + (i ^ 7)]);
+    }
+    REQUIRE(dest[length] == 0);
+
+    std::memset(dest, 0, sizeof(dest));
+    copy_and_swap_32_unaligned(dest, src + 1, length / 4);
+    for (size_t i = 0; i < length; ++i) {
+      REQUIRE(dest[i] == src[1 + (i ^ 3)]);
+    }
+    REQUIRE(dest[length] == 0);
+
+    std::memset(dest, 0, sizeof(dest));
+    copy_and_swap_16_unaligned(dest, src + 1, length / 2);
+    for (size_t i = 0; i < length; ++i) {
+      REQUIRE(dest[i] == src[1 + (i ^ 1)]);
+    }
+    REQUIRE(dest[length] == 0);
+
+    std::memset(dest, 0, sizeof(dest));
+    copy_and_swap_16_in_32_unaligned(dest, src + 1, length / 4);
+    for (size_t i = 0; i < length; ++i) {
+      REQUIRE(dest[i] == src[1 + (i ^ 2)]);
+    }
+    REQUIRE(dest[length] == 0);
+  }
+}
+
+TEST_CASE("copy_and_swap_non_temporal", "Copy and Swap") {
+  // Long enough to be streamed to an aligned destination, in place too.
+  const size_t count = (4 * 1024 * 1024 + 12) / 4;
+  std::vector<uint32_t> src(count + 8);
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = uint32_t(i * 0x01020305);
+  }
+  std::vector<uint8_t> dest_buffer(src.size() * 4 + 32);
+  auto dest = reinterpret_cast<uint32_t*>(
+      xe::round_up(reinterpret_cast<uintptr_t>(dest_buffer.data()), 32));
+  copy_and_swap_32_unaligned(dest, src.data() + 1, count);
+  for (size_t i = 0; i < count; ++i) {
+    REQUIRE(dest[i] == xe::byte_swap(src[1 + i]));
+  }
+  copy_and_swap_32_unaligned(dest, dest, count);
+  for (size_t i = 0; i < count; ++i) {
+    REQUIRE(dest[i] == src[1 + i]);
+  }
+}
+
+// What XmaContext::ConvertFrame used to do for each sample.
+uint16_t convert_f32_to_s16_be_reference(float value) {
+  int sample = static_cast<int>(xe::saturate(value) * ((1 << 15) - 1));
+  return xe::byte_swap(uint16_t(sample & 0xFFFF));
+}
+
+TEST_CASE("convert_f32_to_s16_be", "Copy and Swap") {
+  // Out of range values and NaN too, and every length up to a few vectors.
+  float src[67];
+  float right[67];
+  for (size_t i = 0; i < xe::countof(src); ++i) {
+    src[i] = (float(i) - 33.0f) / 30.0f;
+    right[i] = -src[i] * 0.75f;
+  }
+  src[5] = std::numeric_limits<float>::quiet_NaN();
+  right[9] = std::numeric_limits<float>::infinity();
+  for (size_t count = 0; count <= xe::countof(src); ++count) {
+    uint16_t dest[xe::countof(src) * 2 + 1];
+    std::memset(dest, 0, sizeof(dest));
+    convert_f32_to_s16_be(dest, src, count);
+    for (size_t i = 0; i < count; ++i) {
+      REQUIRE(dest[i] == convert_f32_to_s16_be_reference(src[i]));
+    }
+    REQUIRE(dest[count] == 0);
+
+    std::memset(dest, 0, sizeof(dest));
+    convert_f32_to_s16_be_interleaved(dest, src, right, count);
+    for (size_t i = 0; i < count; ++i) {
+      REQUIRE(dest[i * 2] == convert_f32_to_s16_be_reference(src[i]));
+      REQUIRE(dest[i * 2 + 1] == convert_f32_to_s16_be_reference(right[i]));
+    }
+    REQUIRE(dest[count * 2] == 0);
+  }
+}
+
+TEST_CASE("discard_memory", "Memory") {
+  const size_t length = 16 * xe::memory::page_size();
+  auto memory = reinterpret_cast<uint8_t*>(xe::memory::AllocFixed(
+      nullptr, length, xe::memory::AllocationType::kReserveCommit,
+      xe::memory::PageAccess::kReadWrite));
+  REQUIRE(memory != nullptr);
+  std::memset(memory, 0xCD, length);
+  REQUIRE(xe::memory::QueryResidentSize(memory, length) == length);
+  REQUIRE(xe::memory::DiscardMemory(memory, length / 2));
+  REQUIRE(xe::memory::QueryResidentSize(memory, length) == length / 2);
+  // Still accessible.
+  memory[0] = 1;
+  REQUIRE(memory[0] == 1);
+  REQUIRE(memory[length - 1] == 0xCD);
+  xe::memory::DeallocFixed(memory, 0, xe::memory::DeallocationType::kRelease);
+}
+
+// Hidden, run with [.benchmark] to compare the kernels on a given host.
+TEST_CASE("copy_and_swap_benchmark", "[.benchmark]") {
+  // From a single guest struct to vertex buffer and index buffer uploads and
+  // save states, past the length streamed around the caches.
+  const size_t lengths[] = {16,     96,      1536,     24576,
+                            393216, 4194304, 16777216, 67108864};
+  std::vector<uint8_t> src(lengths[xe::countof(lengths) - 1] + 1);
+  // Aligned, as streaming stores need it.
+  std::vector<uint8_t> dest_buffer(src.size() + 32);
+  uint8_t* dest_data = reinterpret_cast<uint8_t*>(
+      xe::round_up(reinterpret_cast<uintptr_t>(dest_buffer.data()), 32));
+  for (size_t i = 0; i < src.size(); ++i) {
+    src[i] = uint8_t(i);
+  }
+  for (size_t length : lengths) {
+    // About 256MB per kernel.
+    size_t iterations = std::max(size_t(1), (size_t(256) << 20) / length);
+    auto run = [&](const char* name, auto kernel) {
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        // Odd source address, as guest buffers rarely line up.
+        kernel(dest_data, src.data() + 1, length);
+      }
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::printf("%-24s %8zu bytes: %8.2f GB/s\n", name, length,
+                  double(length) * iterations / elapsed.count() / 1e9);
+    };
+    run("memcpy", [](void* d, const void* s, size_t l) {
+      std::memcpy(d, s, l);
+    });
+    run("copy_and_swap_16", [](void* d, const void* s, size_t l) {
+      copy_and_swap_16_unaligned(d, s, l / 2);
+    });
+    run("copy_and_swap_32", [](void* d, const void* s, size_t l) {
+      copy_and_swap_32_unaligned(d, s, l / 4);
+    });
+    run("copy_and_swap_64", [](void* d, const void* s, size_t l) {
+      copy_and_swap_64_unaligned(d, s, l / 8);
+    });
+    run("copy_and_swap_16_in_32", [](void* d, const void* s, size_t l) {
+      copy_and_swap_16_in_32_unaligned(d, s, l / 4);
+    });
+    run("copy_cmp_swap_16", [](void* d, const void* s, size_t l) {
+      copy_cmp_swap_16_unaligned(d, s, 0xFFFF, l / 2);
+    });
+    run("copy_cmp_swap_32", [](void* d, const void* s, size_t l) {
+      copy_cmp_swap_32_unaligned(d, s, 0xFFFFFFFF, l / 4);
+    });
+  }
+}
+
+TEST_CASE("convert_f32_to_s16_be_benchmark", "[.benchmark]") {
+  // An XMA frame of 512 samples, and a few of them.
+  const size_t counts[] = {512, 4096, 65536};
+  std::vector<float> left(counts[xe::countof(counts) - 1]);
+  std::vector<float> right(left.size());
+  std::vector<uint16_t> dest(left.size() * 2);
+  for (size_t i = 0; i < left.size(); ++i) {
+    left[i] = float(i % 2001) / 1000.0f - 1.0f;
+    right[i] = -left[i];
+  }
+  for (size_t count : counts) {
+    // About 256M samples per kernel.
+    size_t iterations = std::max(size_t(1), (size_t(256) << 20) / count);
+    auto run = [&](const char* name, size_t channels, auto kernel) {
+      auto start = std::chrono::steady_clock::now();
+      for (size_t i = 0; i < iterations; ++i) {
+        kernel(count);
+      }
+      std::chrono::duration<double> elapsed =
+          std::chrono::steady_clock::now() - start;
+      std::printf("%-24s %8zu samples: %8.2f Msamples/s\n", name, count,
+                  double(count * channels) * iterations / elapsed.count() /
+                      1e6);
+    };
+    run("scalar mono", 1, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        dest[i] = convert_f32_to_s16_be_reference(left[i]);
+      }
+    });
+    run("convert mono", 1, [&](size_t n) {
+      convert_f32_to_s16_be(dest.data(), left.data(), n);
+    });
+    run("scalar stereo", 2, [&](size_t n) {
+      for (size_t i = 0; i < n; ++i) {
+        dest[i * 2] = convert_f32_to_s16_be_reference(left[i]);
+        dest[i * 2 + 1] = convert_f32_to_s16_be_reference(right[i]);
+      }
+    });
+    run("convert stereo", 2, [&](size_t n) {
+      convert_f32_to_s16_be_interleaved(dest.data(), left.data(),
+                                        right.data(), n);
+    });
+  }
 }
 
 }  // namespace test
@@ -0,0 +1,71 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/metrics.h"
+
+#include <string>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("metrics_writer", "Metrics") {
+  MetricsWriter writer;
+  writer.Counter("xenia_test_total", "Things done.", 42);
+  writer.Gauge("xenia_test_bytes", "Bytes used.", 1024, "heap=\"a\"");
+  writer.Gauge("xenia_test_bytes", "Bytes used.", 2048, "heap=\"b\"");
+  REQUIRE(writer.text() ==
+          "# HELP xenia_test_total Things done.\n"
+          "# TYPE xenia_test_total counter\n"
+          "xenia_test_total 42\n"
+          "# HELP xenia_test_bytes Bytes used.\n"
+          "# TYPE xenia_test_bytes gauge\n"
+          "xenia_test_bytes{heap=\"a\"} 1024\n"
+          "xenia_test_bytes{heap=\"b\"} 2048\n");
+}
+
+TEST_CASE("metrics_summary", "Metrics") {
+  MetricsSummary summary;
+  // More than fit, so only the last kSampleCount, 1 to kSampleCount, count
+  // towards the quantiles.
+  for (size_t i = 0; i < MetricsSummary::kSampleCount * 2; ++i) {
+    summary.Record(double(i % MetricsSummary::kSampleCount + 1));
+  }
+  MetricsWriter writer;
+  summary.Write(&writer, "xenia_test_seconds", "Time taken.");
+  auto& text = writer.text();
+  REQUIRE(text.find("# TYPE xenia_test_seconds summary\n") !=
+          std::string::npos);
+  REQUIRE(text.find("xenia_test_seconds{quantile=\"0.5\"} 256\n") !=
+          std::string::npos);
+  REQUIRE(text.find("xenia_test_seconds{quantile=\"0.99\"} 506\n") !=
+          std::string::npos);
+  REQUIRE(text.find("xenia_test_seconds_count 1024\n") != std::string::npos);
+}
+
+TEST_CASE("metrics_collectors", "Metrics") {
+  int value = 5;
+  auto collector = [](MetricsWriter* writer, void* data) {
+    writer->Gauge("xenia_test_value", "A value.", *static_cast<int*>(data));
+  };
+  Metrics::AddCollector(collector, &value);
+  REQUIRE(Metrics::Collect().find("xenia_test_value 5\n") !=
+          std::string::npos);
+  value = 6;
+  REQUIRE(Metrics::Collect().find("xenia_test_value 6\n") !=
+          std::string::npos);
+  Metrics::RemoveCollector(collector, &value);
+  REQUIRE(Metrics::Collect().find("xenia_test_value") == std::string::npos);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
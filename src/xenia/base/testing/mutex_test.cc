@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/mutex.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("subsystem_mutex_recursive", "Mutex") {
+  subsystem_mutex mutex("test/recursive");
+  auto state = thread_lock_state::current();
+  REQUIRE(state->held_count == 0);
+  {
+    auto lock = mutex.Acquire();
+    REQUIRE(mutex.try_lock());
+    REQUIRE(state->held_count == 2);
+    mutex.unlock();
+  }
+  REQUIRE(state->held_count == 0);
+  REQUIRE(mutex.contention_count() == 0);
+}
+
+TEST_CASE("subsystem_mutex_suspend_waits", "Mutex") {
+  subsystem_mutex mutex("test/suspend");
+  thread_lock_state holder_state;
+  std::atomic<bool> locked = {false};
+  std::atomic<bool> release = {false};
+  std::thread holder([&]() {
+    thread_lock_state::set_current(&holder_state);
+    auto lock = mutex.Acquire();
+    locked = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (!locked) {
+    std::this_thread::yield();
+  }
+
+  // The suspension completes only once the lock is released.
+  std::atomic<bool> suspended = {false};
+  std::thread suspender([&]() {
+    holder_state.BeginSuspend();
+    suspended = true;
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE_FALSE(suspended);
+  release = true;
+  suspender.join();
+  REQUIRE(suspended);
+  holder_state.EndSuspend();
+  holder.join();
+}
+
+TEST_CASE("subsystem_mutex_backs_off_while_suspending", "Mutex") {
+  subsystem_mutex mutex("test/back_off");
+  auto state = thread_lock_state::current();
+  state->BeginSuspend();
+  REQUIRE_FALSE(mutex.try_lock());
+  REQUIRE(state->held_count == 0);
+  state->EndSuspend();
+  REQUIRE(mutex.try_lock());
+  mutex.unlock();
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
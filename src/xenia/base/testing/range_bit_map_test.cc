@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/range_bit_map.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("range_bit_map_empty", "RangeBitMap") {
+  RangeBitMap map;
+  map.Resize(100000);
+  REQUIRE(map.FindFirstSet(0, 100000) == 100000);
+  REQUIRE(map.FindLastSet(0, 100000) == 100000);
+  REQUIRE(map.FindFirstClear(0, 100000) == 0);
+  REQUIRE(map.FindLastClear(0, 100000) == 99999);
+  // The end is clamped to the size.
+  REQUIRE(map.FindLastClear(0, 200000) == 99999);
+  REQUIRE(map.FindFirstSet(0, 200000) == 100000);
+}
+
+TEST_CASE("range_bit_map_find", "RangeBitMap") {
+  RangeBitMap map;
+  map.Resize(262144);
+  map.Set(10, 5);
+  map.Set(70000, 70000);
+  REQUIRE(map.Test(10));
+  REQUIRE(map.Test(14));
+  REQUIRE_FALSE(map.Test(15));
+  REQUIRE(map.FindFirstSet(0, 262144) == 10);
+  REQUIRE(map.FindFirstSet(15, 262144) == 70000);
+  REQUIRE(map.FindFirstSet(15, 70000) == 70000);
+  REQUIRE(map.FindFirstClear(10, 262144) == 15);
+  REQUIRE(map.FindFirstClear(70000, 262144) == 140000);
+  REQUIRE(map.FindLastSet(0, 262144) == 139999);
+  REQUIRE(map.FindLastSet(0, 70000) == 14);
+  REQUIRE(map.FindLastSet(15, 70000) == 70000);
+  REQUIRE(map.FindLastClear(0, 140000) == 69999);
+  REQUIRE(map.FindLastClear(10, 15) == 15);
+}
+
+TEST_CASE("range_bit_map_clear", "RangeBitMap") {
+  RangeBitMap map;
+  map.Resize(4097);
+  map.Set(0, 4097);
+  REQUIRE(map.FindFirstClear(0, 4097) == 4097);
+  REQUIRE(map.FindLastClear(0, 4097) == 4097);
+  map.Clear(4096, 1);
+  REQUIRE(map.FindFirstClear(0, 4097) == 4096);
+  map.Clear(64, 128);
+  REQUIRE(map.FindFirstClear(0, 4097) == 64);
+  REQUIRE(map.FindLastClear(0, 4096) == 191);
+  REQUIRE(map.FindFirstSet(64, 4097) == 192);
+  map.Reset();
+  REQUIRE(map.FindFirstSet(0, 4097) == 4097);
+  REQUIRE(map.FindLastClear(0, 4097) == 4096);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
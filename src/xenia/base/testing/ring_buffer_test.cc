@@ -0,0 +1,61 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/ring_buffer.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("ring_buffer_read_and_swap_array", "RingBuffer") {
+  uint32_t storage[16];
+  for (uint32_t i = 0; i < 16; i++) {
+    storage[i] = xe::byte_swap(i);
+  }
+  RingBuffer ring(reinterpret_cast<uint8_t*>(storage), sizeof(storage));
+  ring.set_write_offset(15 * sizeof(uint32_t));
+
+  uint32_t values[10];
+  REQUIRE(ring.ReadAndSwapArray(values, 10) == 10);
+  for (uint32_t i = 0; i < 10; i++) {
+    REQUIRE(values[i] == i);
+  }
+  REQUIRE(ring.read_offset() == 10 * sizeof(uint32_t));
+
+  // Wrapping around the end.
+  ring.set_write_offset(4 * sizeof(uint32_t));
+  REQUIRE(ring.ReadAndSwapArray(values, 10) == 10);
+  for (uint32_t i = 0; i < 10; i++) {
+    REQUIRE(values[i] == (10 + i) % 16);
+  }
+  REQUIRE(ring.read_offset() == 4 * sizeof(uint32_t));
+}
+
+TEST_CASE("ring_buffer_read_and_swap_array_split", "RingBuffer") {
+  // A capacity that isn't a multiple of the value size splits one of them.
+  uint8_t storage[10];
+  for (uint8_t i = 0; i < 10; i++) {
+    storage[i] = i;
+  }
+  RingBuffer ring(storage, sizeof(storage));
+  ring.set_read_offset(6);
+  ring.set_write_offset(4);
+
+  uint32_t values[2];
+  REQUIRE(ring.ReadAndSwapArray(values, 2) == 2);
+  REQUIRE(values[0] == 0x06070809);
+  REQUIRE(values[1] == 0x00010203);
+  REQUIRE(ring.read_offset() == 4);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
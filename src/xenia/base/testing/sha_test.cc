@@ -0,0 +1,108 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/sha.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+static const char kTwoBlockMessage[] =
+    "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+template <typename T>
+static std::string Hash(const void* data, size_t size, bool allow_sha_ni) {
+  T sha(allow_sha_ni);
+  sha.Update(data, size);
+  uint8_t digest[T::kDigestSize];
+  sha.Final(digest);
+  std::string hex;
+  for (uint8_t byte : digest) {
+    char byte_hex[3];
+    std::snprintf(byte_hex, sizeof(byte_hex), "%.2x", byte);
+    hex += byte_hex;
+  }
+  return hex;
+}
+
+// FIPS 180-2 appendix A and B.
+static void TestKnownAnswers(bool allow_sha_ni) {
+  std::vector<uint8_t> million_a(1000000, 'a');
+  REQUIRE(Hash<Sha1>("", 0, allow_sha_ni) ==
+          "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+  REQUIRE(Hash<Sha1>("abc", 3, allow_sha_ni) ==
+          "a9993e364706816aba3e25717850c26c9cd0d89d");
+  REQUIRE(Hash<Sha1>(kTwoBlockMessage, std::strlen(kTwoBlockMessage),
+                     allow_sha_ni) ==
+          "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+  REQUIRE(Hash<Sha1>(million_a.data(), million_a.size(), allow_sha_ni) ==
+          "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+  REQUIRE(Hash<Sha256>("abc", 3, allow_sha_ni) ==
+          "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+  REQUIRE(Hash<Sha256>(kTwoBlockMessage, std::strlen(kTwoBlockMessage),
+                       allow_sha_ni) ==
+          "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+  REQUIRE(Hash<Sha256>(million_a.data(), million_a.size(), allow_sha_ni) ==
+          "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
+
+TEST_CASE("sha_software", "Sha") { TestKnownAnswers(false); }
+
+TEST_CASE("sha_sha_ni", "Sha") {
+  if (!ShaHasher::host_has_sha_ni()) {
+    return;
+  }
+  REQUIRE(Sha1(true).uses_sha_ni());
+  TestKnownAnswers(true);
+
+  // Every length around block boundaries against the reference.
+  std::vector<uint8_t> input(300);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = uint8_t(i * 131 + 7);
+  }
+  for (size_t size = 0; size <= input.size(); ++size) {
+    REQUIRE(Hash<Sha1>(input.data(), size, false) ==
+            Hash<Sha1>(input.data(), size, true));
+    REQUIRE(Hash<Sha256>(input.data(), size, false) ==
+            Hash<Sha256>(input.data(), size, true));
+  }
+}
+
+TEST_CASE("sha_resume", "Sha") {
+  // Split at every offset, continuing from the saved state like the kernel
+  // does with the guest one.
+  std::vector<uint8_t> input(200);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = uint8_t(i * 29 + 3);
+  }
+  for (size_t split = 0; split <= input.size(); ++split) {
+    Sha256 first;
+    first.Update(input.data(), split);
+    Sha256 second(first.state(), first.byte_count(), first.partial_block());
+    second.Update(input.data() + split, input.size() - split);
+    uint8_t digest[Sha256::kDigestSize];
+    second.Final(digest);
+    Sha256 whole;
+    whole.Update(input.data(), input.size());
+    uint8_t expected_digest[Sha256::kDigestSize];
+    whole.Final(expected_digest);
+    REQUIRE(std::memcmp(digest, expected_digest, sizeof(digest)) == 0);
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,152 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/slab_allocator.h"
+
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "xenia/base/byte_stream.h"
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+// Chunks from a bump allocator; nothing is backed, only addresses handed out.
+class TestChunks {
+ public:
+  SlabAllocator::ChunkAllocFunction alloc() {
+    return [this]() {
+      uint32_t base = next_;
+      next_ += SlabAllocator::kChunkSize;
+      live_.insert(base);
+      return base;
+    };
+  }
+  SlabAllocator::ChunkFreeFunction free() {
+    return [this](uint32_t base) { REQUIRE(live_.erase(base) == 1); };
+  }
+  size_t live_count() const { return live_.size(); }
+
+ private:
+  uint32_t next_ = 0x10000000;
+  std::set<uint32_t> live_;
+};
+
+TEST_CASE("slab_allocator_size_classes", "SlabAllocator") {
+  TestChunks chunks;
+  SlabAllocator slab(chunks.alloc(), chunks.free());
+  REQUIRE(slab.Alloc(SlabAllocator::kMaxSize + 1, 8, 0) == 0);
+  REQUIRE(slab.Alloc(64, 4096, 0) == 0);
+  REQUIRE(chunks.live_count() == 0);
+
+  // Same class, same chunk, consecutive slots.
+  uint32_t a = slab.Alloc(40, 8, 0);
+  uint32_t b = slab.Alloc(48, 8, 0);
+  REQUIRE(b == a + 48);
+  REQUIRE(chunks.live_count() == 1);
+  // 32 byte alignment skips the 48 byte class.
+  uint32_t c = slab.Alloc(40, 32, 0);
+  REQUIRE((c & 31) == 0);
+  REQUIRE(chunks.live_count() == 2);
+  for (uint32_t size = 1; size <= SlabAllocator::kMaxSize; size += 37) {
+    uint32_t address = slab.Alloc(size, 16, 0);
+    REQUIRE(address != 0);
+    REQUIRE((address & 15) == 0);
+    REQUIRE(slab.Free(address));
+  }
+  REQUIRE(slab.Free(a));
+  REQUIRE(slab.Free(b));
+  REQUIRE(slab.Free(c));
+  REQUIRE_FALSE(slab.Free(0x20000000));
+}
+
+TEST_CASE("slab_allocator_chunks", "SlabAllocator") {
+  TestChunks chunks;
+  SlabAllocator slab(chunks.alloc(), chunks.free());
+  const uint32_t kSlotsPerChunk = SlabAllocator::kChunkSize / 1024;
+  std::vector<uint32_t> addresses;
+  for (uint32_t i = 0; i < kSlotsPerChunk * 3; ++i) {
+    addresses.push_back(slab.Alloc(1000, 8, 0));
+  }
+  std::set<uint32_t> unique(addresses.begin(), addresses.end());
+  REQUIRE(unique.size() == addresses.size());
+  REQUIRE(chunks.live_count() == 3);
+
+  // Emptying chunks gives all but one back.
+  for (uint32_t address : addresses) {
+    REQUIRE(slab.Free(address));
+  }
+  REQUIRE(chunks.live_count() == 1);
+  // And the one left is reused.
+  slab.Alloc(1000, 8, 0);
+  REQUIRE(chunks.live_count() == 1);
+  slab.Reset();
+  REQUIRE(chunks.live_count() == 0);
+}
+
+TEST_CASE("slab_allocator_statistics", "SlabAllocator") {
+  const uint32_t kTagA = 0x41626364;
+  const uint32_t kTagB = 0x57787A79;
+  TestChunks chunks;
+  SlabAllocator slab(chunks.alloc(), chunks.free());
+  uint32_t a = slab.Alloc(100, 8, kTagA);
+  slab.Alloc(100, 8, kTagA);
+  slab.Alloc(10, 8, kTagB);
+  slab.Free(a);
+
+  SlabAllocator::Statistics stats;
+  slab.GetStatistics(&stats);
+  REQUIRE(stats.tags.size() == 2);
+  auto& tag_a = stats.tags[0];
+  REQUIRE(tag_a.tag == kTagA);
+  REQUIRE(tag_a.alloc_count == 2);
+  REQUIRE(tag_a.free_count == 1);
+  REQUIRE(tag_a.live_count == 1);
+  REQUIRE(tag_a.live_bytes == 100);
+  REQUIRE(tag_a.live_slot_bytes == 128);
+  REQUIRE(stats.tags[1].live_slot_bytes == 16);
+}
+
+TEST_CASE("slab_allocator_save_restore", "SlabAllocator") {
+  TestChunks chunks;
+  SlabAllocator slab(chunks.alloc(), chunks.free());
+  std::vector<uint32_t> addresses;
+  for (uint32_t i = 0; i < 100; ++i) {
+    addresses.push_back(slab.Alloc(24 + i, 8, i & 3));
+  }
+
+  std::vector<uint8_t> buffer(1024 * 1024);
+  ByteStream save_stream(buffer.data(), buffer.size());
+  slab.Save(&save_stream);
+
+  SlabAllocator::Statistics saved_stats;
+  slab.GetStatistics(&saved_stats);
+
+  SlabAllocator restored(chunks.alloc(), chunks.free());
+  ByteStream restore_stream(buffer.data(), save_stream.offset());
+  REQUIRE(restored.Restore(&restore_stream));
+  SlabAllocator::Statistics stats;
+  restored.GetStatistics(&stats);
+  REQUIRE(stats.chunk_count == saved_stats.chunk_count);
+  REQUIRE(stats.tags.size() == saved_stats.tags.size());
+  // New allocations don't land on the restored ones.
+  uint32_t address = restored.Alloc(30, 8, 0);
+  REQUIRE(std::find(addresses.begin(), addresses.end(), address) ==
+          addresses.end());
+  for (uint32_t restored_address : addresses) {
+    REQUIRE(restored.Free(restored_address));
+  }
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
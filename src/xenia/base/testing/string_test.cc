@@ -0,0 +1,33 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/string.h"
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+TEST_CASE("fuzzy_match", "string") {
+  REQUIRE(fuzzy_match("", "sub_82001234") == 0);
+  REQUIRE(fuzzy_match("sub", "sub_82001234") > 0);
+  REQUIRE(fuzzy_match("SUB", "sub_82001234") > 0);
+  REQUIRE(fuzzy_match("s8234", "sub_82001234") > 0);
+  // All of the pattern has to be there, in order.
+  REQUIRE(fuzzy_match("subx", "sub_82001234") == 0);
+  REQUIRE(fuzzy_match("bus", "sub_82001234") == 0);
+  // Runs of consecutive characters score higher.
+  REQUIRE(fuzzy_match("1234", "sub_82001234") >
+          fuzzy_match("1234", "sub_1a2b3c4"));
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,106 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/task_scheduler.h"
+
+#include <atomic>
+#include <vector>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+using namespace std::chrono_literals;
+
+TEST_CASE("task_scheduler_group_wait", "TaskScheduler") {
+  TaskScheduler scheduler(4);
+  REQUIRE(scheduler.worker_count() == 4);
+  REQUIRE(scheduler.current_worker() == TaskScheduler::kAnyWorker);
+  std::atomic<uint32_t> count(0);
+  TaskGroup group(&scheduler);
+  for (uint32_t i = 0; i < 1000; ++i) {
+    group.Run([&]() { ++count; },
+              TaskPriority(i % 3), i % 2 ? i : TaskScheduler::kAnyWorker);
+  }
+  group.Wait();
+  REQUIRE(count == 1000);
+}
+
+TEST_CASE("task_scheduler_nested", "TaskScheduler") {
+  // Tasks spawning and waiting on tasks, more than there are workers.
+  TaskScheduler scheduler(2);
+  std::atomic<uint32_t> count(0);
+  std::atomic<bool> on_worker(true);
+  TaskGroup group(&scheduler);
+  for (uint32_t i = 0; i < 8; ++i) {
+    group.Run([&]() {
+      if (scheduler.current_worker() == TaskScheduler::kAnyWorker) {
+        on_worker = false;
+      }
+      TaskGroup inner_group(&scheduler);
+      for (uint32_t j = 0; j < 16; ++j) {
+        inner_group.Run([&]() { ++count; });
+      }
+      inner_group.Wait();
+    });
+  }
+  group.Wait();
+  REQUIRE(count == 8 * 16);
+}
+
+TEST_CASE("task_scheduler_priority", "TaskScheduler") {
+  TaskScheduler scheduler(1);
+  // Keep the only worker busy while queueing, to see the order it takes.
+  std::atomic<bool> release(false);
+  TaskGroup blocker(&scheduler);
+  blocker.Run([&]() {
+    while (!release) {
+      xe::threading::Sleep(1ms);
+    }
+  });
+  xe::threading::Sleep(10ms);
+  std::vector<int> order;
+  TaskGroup group(&scheduler);
+  group.Run([&]() { order.push_back(2); }, TaskPriority::kLow);
+  group.Run([&]() { order.push_back(1); }, TaskPriority::kNormal);
+  group.Run([&]() { order.push_back(0); }, TaskPriority::kHigh);
+  release = true;
+  blocker.Wait();
+  group.Wait();
+  REQUIRE(order == std::vector<int>({0, 1, 2}));
+}
+
+TEST_CASE("task_scheduler_cancel", "TaskScheduler") {
+  TaskScheduler scheduler(1);
+  std::atomic<bool> release(false);
+  std::atomic<uint32_t> count(0);
+  TaskGroup group(&scheduler);
+  group.Run([&]() {
+    while (!release) {
+      xe::threading::Sleep(1ms);
+    }
+    ++count;
+  });
+  xe::threading::Sleep(10ms);
+  for (uint32_t i = 0; i < 10; ++i) {
+    group.Run([&]() { ++count; });
+  }
+  group.Cancel();
+  REQUIRE(group.is_cancelled());
+  release = true;
+  group.Wait();
+  // Only the one already running.
+  REQUIRE(count == 1);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -0,0 +1,163 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/threading.h"
+
+#include <atomic>
+
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+using namespace xe::threading;
+using namespace std::chrono_literals;
+
+TEST_CASE("threading_event", "Threading") {
+  auto auto_event = Event::CreateAutoResetEvent(true);
+  REQUIRE(Wait(auto_event.get(), false, 0ms) == WaitResult::kSuccess);
+  REQUIRE(Wait(auto_event.get(), false, 0ms) == WaitResult::kTimeout);
+  auto_event->Set();
+  REQUIRE(Wait(auto_event.get(), false, 0ms) == WaitResult::kSuccess);
+
+  auto manual_event = Event::CreateManualResetEvent(false);
+  REQUIRE(Wait(manual_event.get(), false, 10ms) == WaitResult::kTimeout);
+  manual_event->Set();
+  REQUIRE(Wait(manual_event.get(), false, 0ms) == WaitResult::kSuccess);
+  REQUIRE(Wait(manual_event.get(), false, 0ms) == WaitResult::kSuccess);
+  manual_event->Reset();
+  REQUIRE(Wait(manual_event.get(), false, 0ms) == WaitResult::kTimeout);
+}
+
+TEST_CASE("threading_semaphore_mutant", "Threading") {
+  auto semaphore = Semaphore::Create(1, 2);
+  int previous_count = -1;
+  REQUIRE(semaphore->Release(1, &previous_count));
+  REQUIRE(previous_count == 1);
+  REQUIRE_FALSE(semaphore->Release(1, nullptr));
+  REQUIRE(Wait(semaphore.get(), false, 0ms) == WaitResult::kSuccess);
+  REQUIRE(Wait(semaphore.get(), false, 0ms) == WaitResult::kSuccess);
+  REQUIRE(Wait(semaphore.get(), false, 0ms) == WaitResult::kTimeout);
+
+  auto mutant = Mutant::Create(true);
+  // Recursive for the owner, unavailable to anyone else.
+  REQUIRE(Wait(mutant.get(), false, 0ms) == WaitResult::kSuccess);
+  WaitResult other_result = WaitResult::kFailed;
+  auto thread = Thread::Create({}, [&]() {
+    other_result = Wait(mutant.get(), false, 0ms);
+  });
+  REQUIRE(Wait(thread.get(), false) == WaitResult::kSuccess);
+  REQUIRE(other_result == WaitResult::kTimeout);
+  REQUIRE(mutant->Release());
+  REQUIRE(mutant->Release());
+  REQUIRE_FALSE(mutant->Release());
+}
+
+TEST_CASE("threading_wait_any_all", "Threading") {
+  auto event_a = Event::CreateManualResetEvent(false);
+  auto event_b = Event::CreateAutoResetEvent(false);
+  WaitHandle* handles[] = {event_a.get(), event_b.get()};
+  REQUIRE(WaitAny(handles, 2, false, 0ms).first == WaitResult::kTimeout);
+  event_b->Set();
+  auto result = WaitAny(handles, 2, false, 0ms);
+  REQUIRE(result.first == WaitResult::kSuccess);
+  REQUIRE(result.second == 1);
+  REQUIRE(WaitAll(handles, 2, false, 0ms) == WaitResult::kTimeout);
+
+  // Signaled from another thread while blocked.
+  auto thread = Thread::Create({}, [&]() {
+    Sleep(10ms);
+    event_a->Set();
+    event_b->Set();
+  });
+  REQUIRE(WaitAll(handles, 2, false) == WaitResult::kSuccess);
+  // The auto-reset event was taken by the wait, the manual one wasn't.
+  REQUIRE(Wait(event_b.get(), false, 0ms) == WaitResult::kTimeout);
+  REQUIRE(Wait(event_a.get(), false, 0ms) == WaitResult::kSuccess);
+  REQUIRE(Wait(thread.get(), false) == WaitResult::kSuccess);
+}
+
+TEST_CASE("threading_handoff", "Threading") {
+  // Every release wakes exactly one waiter.
+  const int kThreadCount = 4;
+  const int kIterations = 1000;
+  auto semaphore = Semaphore::Create(0, kThreadCount * kIterations);
+  std::atomic<int> acquired = {0};
+  std::unique_ptr<Thread> threads[kThreadCount];
+  for (auto& thread : threads) {
+    thread = Thread::Create({}, [&]() {
+      for (int i = 0; i < kIterations; ++i) {
+        if (Wait(semaphore.get(), false) == WaitResult::kSuccess) {
+          ++acquired;
+        }
+      }
+    });
+  }
+  for (int i = 0; i < kThreadCount * kIterations; ++i) {
+    REQUIRE(semaphore->Release(1, nullptr));
+  }
+  for (auto& thread : threads) {
+    REQUIRE(Wait(thread.get(), false) == WaitResult::kSuccess);
+  }
+  REQUIRE(acquired == kThreadCount * kIterations);
+  REQUIRE(Wait(semaphore.get(), false, 0ms) == WaitResult::kTimeout);
+}
+
+TEST_CASE("threading_user_callback", "Threading") {
+  auto started = Event::CreateManualResetEvent(false);
+  auto never = Event::CreateManualResetEvent(false);
+  bool called = false;
+  WaitResult result = WaitResult::kFailed;
+  auto thread = Thread::Create({}, [&]() {
+    started->Set();
+    result = Wait(never.get(), true);
+  });
+  REQUIRE(Wait(started.get(), false) == WaitResult::kSuccess);
+  thread->QueueUserCallback([&]() { called = true; });
+  REQUIRE(Wait(thread.get(), false) == WaitResult::kSuccess);
+  REQUIRE(result == WaitResult::kUserCallback);
+  REQUIRE(called);
+}
+
+TEST_CASE("threading_reuse_host_thread", "Threading") {
+  Thread::CreationParameters params;
+  params.reuse_host_thread = true;
+  std::atomic<int> ran = {0};
+  for (int i = 0; i < 4; ++i) {
+    // Exit returns the host thread for the next one to reuse.
+    auto thread = Thread::Create(params, [&]() {
+      ++ran;
+      Thread::Exit(0);
+      ran += 100;
+    });
+    REQUIRE(Wait(thread.get(), false, 1000ms) == WaitResult::kSuccess);
+  }
+  REQUIRE(ran == 4);
+
+  params.create_suspended = true;
+  auto thread = Thread::Create(params, [&]() { ++ran; });
+  REQUIRE(Wait(thread.get(), false, 10ms) == WaitResult::kTimeout);
+  REQUIRE(ran == 4);
+  REQUIRE(thread->Resume());
+  REQUIRE(Wait(thread.get(), false, 1000ms) == WaitResult::kSuccess);
+  REQUIRE(ran == 5);
+}
+
+TEST_CASE("threading_timer", "Threading") {
+  auto timer = Timer::CreateSynchronizationTimer();
+  REQUIRE(timer->SetOnce(-10ms));
+  REQUIRE(Wait(timer.get(), false, 0ms) == WaitResult::kTimeout);
+  REQUIRE(Wait(timer.get(), false, 1000ms) == WaitResult::kSuccess);
+  REQUIRE(Wait(timer.get(), false, 0ms) == WaitResult::kTimeout);
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
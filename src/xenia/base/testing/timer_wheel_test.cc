@@ -0,0 +1,105 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/timer_wheel.h"
+
+#include <atomic>
+#include <vector>
+
+#include "xenia/base/math.h"
+#include "third_party/catch/include/catch.hpp"
+
+namespace xe {
+namespace base {
+namespace test {
+
+using namespace std::chrono_literals;
+
+TEST_CASE("timer_wheel_once", "TimerWheel") {
+  TimerWheel wheel(1ms);
+  auto start = wheel.start_time();
+  int fired = 0;
+  wheel.Schedule(start + 10ms, 0ms, [&]() { ++fired; });
+  wheel.AdvanceTo(start + 9ms);
+  REQUIRE(fired == 0);
+  wheel.AdvanceTo(start + 10ms);
+  REQUIRE(fired == 1);
+  wheel.AdvanceTo(start + 1000ms);
+  REQUIRE(fired == 1);
+  REQUIRE(wheel.timer_count() == 0);
+}
+
+TEST_CASE("timer_wheel_periodic", "TimerWheel") {
+  TimerWheel wheel(1ms);
+  auto start = wheel.start_time();
+  int fired = 0;
+  auto id = wheel.Schedule(start + 5ms, 10ms, [&]() { ++fired; });
+  wheel.AdvanceTo(start + 5ms);
+  REQUIRE(fired == 1);
+  wheel.AdvanceTo(start + 34ms);
+  REQUIRE(fired == 3);
+  REQUIRE(wheel.Cancel(id));
+  REQUIRE_FALSE(wheel.Cancel(id));
+  wheel.AdvanceTo(start + 100ms);
+  REQUIRE(fired == 3);
+
+  // Expiring together, but canceled by the one called first.
+  TimerWheel::TimerId ids[2];
+  for (auto& other_id : ids) {
+    other_id = wheel.Schedule(start + 200ms, 0ms, [&]() {
+      ++fired;
+      wheel.Cancel(ids[0]);
+      wheel.Cancel(ids[1]);
+    });
+  }
+  wheel.AdvanceTo(start + 200ms);
+  REQUIRE(fired == 4);
+}
+
+TEST_CASE("timer_wheel_cascade", "TimerWheel") {
+  TimerWheel wheel(1ms);
+  auto start = wheel.start_time();
+  // Spread across all the levels, fired in order.
+  const int64_t kDueTicks[] = {3, 255, 256, 257, 70000, 100000, 20000000};
+  std::vector<int64_t> fired;
+  for (int64_t due : kDueTicks) {
+    wheel.Schedule(start + std::chrono::milliseconds(due), 0ms,
+                   [&fired, due]() { fired.push_back(due); });
+  }
+  auto canceled = wheel.Schedule(start + 65536ms, 0ms,
+                                 [&fired]() { fired.push_back(-1); });
+  REQUIRE(wheel.Cancel(canceled));
+  for (size_t i = 0; i < xe::countof(kDueTicks); ++i) {
+    wheel.AdvanceTo(start + std::chrono::milliseconds(kDueTicks[i] - 1));
+    REQUIRE(fired.size() == i);
+    wheel.AdvanceTo(start + std::chrono::milliseconds(kDueTicks[i]));
+    REQUIRE(fired.size() == i + 1);
+    REQUIRE(fired.back() == kDueTicks[i]);
+  }
+  REQUIRE(wheel.timer_count() == 0);
+}
+
+TEST_CASE("timer_wheel_thread", "TimerWheel") {
+  TimerWheel wheel(1ms);
+  wheel.Start();
+  auto event = xe::threading::Event::CreateAutoResetEvent(false);
+  std::atomic<int> fired = {0};
+  wheel.Schedule(TimerWheel::clock::now() + 10ms, 0ms, [&]() {
+    ++fired;
+    event->Set();
+  });
+  REQUIRE(xe::threading::Wait(event.get(), false, 1000ms) ==
+          xe::threading::WaitResult::kSuccess);
+  REQUIRE(fired == 1);
+  wheel.Shutdown();
+}
+
+}  // namespace test
+}  // namespace base
+}  // namespace xe
@@ -24,6 +24,8 @@
 #include <utility>
 #include <vector>
 
+#include "xenia/base/mutex.h"
+
 namespace xe {
 namespace threading {
 
@@ -340,6 +342,11 @@ class Thread : public WaitHandle {
     size_t stack_size = 4 * 1024 * 1024;
     bool create_suspended = false;
     int32_t initial_priority = 0;
+    // Runs the thread on a host thread left by one that exited, and keeps
+    // the host thread for reuse once this one exits, saving the creation
+    // cost. Where supported (POSIX), Exit then returns the host thread to
+    // the pool without unwinding.
+    bool reuse_host_thread = false;
   };
 
   // Creates a thread with the given parameters and calls the start routine from
@@ -357,6 +364,10 @@ class Thread : public WaitHandle {
   // Returns the ID of the thread.
   virtual uint32_t system_id() const = 0;
 
+  // Returns the host CPU time the thread has run for, in user and kernel
+  // mode, or 0 if it can't be queried.
+  virtual uint64_t QueryCpuTimeMicroseconds() = 0;
+
   // Returns the current name of the thread, if previously specified.
   std::string name() const { return name_; }
 
@@ -392,7 +403,8 @@ class Thread : public WaitHandle {
   // to zero, the execution of the thread is resumed.
   virtual bool Resume(uint32_t* out_new_suspend_count = nullptr) = 0;
 
-  // Suspends the specified thread.
+  // Suspends the specified thread. Threads other than the caller are suspended
+  // only once they hold no xe::subsystem_mutex.
   virtual bool Suspend(uint32_t* out_previous_suspend_count = nullptr) = 0;
 
   // Terminates the thread.
@@ -403,6 +415,8 @@ class Thread : public WaitHandle {
 
  protected:
   std::string name_;
+  // Shared by all the objects referring to the thread.
+  std::shared_ptr<thread_lock_state> lock_state_;
 };
 
 }  // namespace threading
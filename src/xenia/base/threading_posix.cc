@@ -12,14 +12,21 @@
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 
+#include <linux/futex.h>
 #include <pthread.h>
-#include <sys/eventfd.h>
+#include <setjmp.h>
 #include <sys/syscall.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <vector>
+
 namespace xe {
 namespace threading {
 
@@ -54,12 +61,6 @@ void Sleep(std::chrono::microseconds duration) {
   // TODO(benvanik): spin while rmtp >0?
 }
 
-// TODO(dougvj) Not sure how to implement the equivalent of this on POSIX.
-SleepResult AlertableSleep(std::chrono::microseconds duration) {
-  sleep(duration.count() / 1000);
-  return SleepResult::kSuccess;
-}
-
 // TODO(dougvj) We can probably wrap this with pthread_key_t but the type of
 // TlsHandle probably needs to be refactored
 TlsHandle AllocateTlsHandle() {
@@ -104,254 +105,839 @@ std::unique_ptr<HighResolutionTimer> HighResolutionTimer::CreateRepeating(
   return std::unique_ptr<HighResolutionTimer>(timer.release());
 }
 
-// TODO(dougvj) There really is no native POSIX handle for a single wait/signal
-// construct pthreads is at a lower level with more handles for such a mechanism
-// This simple wrapper class could function as our handle, but probably needs
-// some more functionality
-class PosixCondition {
+// Dispatcher objects are implemented in user space: the state of each object
+// sits behind a futex lock that takes a single atomic operation when
+// uncontended, and a thread only sleeps (on its own futex word) when a wait
+// can't be satisfied right away. Signaling an object nobody waits on, or
+// waiting on an object that is already signaled, never enters the kernel.
+// The native handle of every wait handle is its PosixDispatcher.
+
+namespace {
+
+int Futex(std::atomic<uint32_t>* address, int op, uint32_t value,
+          const timespec* timeout) {
+  return int(syscall(SYS_futex, reinterpret_cast<uint32_t*>(address),
+                     op | FUTEX_PRIVATE_FLAG, value, timeout, nullptr, 0));
+}
+
+// Sleeps while the value at the address is expected, or until the timeout
+// (relative, null for none) elapses. May return spuriously.
+void FutexWait(std::atomic<uint32_t>* address, uint32_t expected,
+               const timespec* timeout) {
+  Futex(address, FUTEX_WAIT, expected, timeout);
+}
+
+void FutexWake(std::atomic<uint32_t>* address, uint32_t count) {
+  Futex(address, FUTEX_WAKE, count, nullptr);
+}
+
+// A non-recursive lock that only enters the kernel when contended.
+class FutexLock {
  public:
-  PosixCondition() : signal_(false) {
-    pthread_mutex_init(&mutex_, NULL);
-    pthread_cond_init(&cond_, NULL);
+  void lock() {
+    uint32_t state = kUnlocked;
+    if (state_.compare_exchange_strong(state, kLocked,
+                                       std::memory_order_acquire)) {
+      return;
+    }
+    // The critical sections are short, so spin for a bit before sleeping.
+    for (int i = 0; i < 100 && state == kLocked; ++i) {
+      state = kUnlocked;
+      if (state_.compare_exchange_weak(state, kLocked,
+                                       std::memory_order_acquire)) {
+        return;
+      }
+    }
+    if (state != kContended) {
+      state = state_.exchange(kContended, std::memory_order_acquire);
+    }
+    while (state != kUnlocked) {
+      FutexWait(&state_, kContended, nullptr);
+      state = state_.exchange(kContended, std::memory_order_acquire);
+    }
   }
 
-  ~PosixCondition() {
-    pthread_mutex_destroy(&mutex_);
-    pthread_cond_destroy(&cond_);
+  void unlock() {
+    if (state_.exchange(kUnlocked, std::memory_order_release) == kContended) {
+      FutexWake(&state_, 1);
+    }
   }
 
-  void Signal() {
-    pthread_mutex_lock(&mutex_);
-    signal_ = true;
-    pthread_cond_broadcast(&cond_);
-    pthread_mutex_unlock(&mutex_);
+ private:
+  enum : uint32_t {
+    kUnlocked,
+    kLocked,
+    // Locked, and other threads may be sleeping on it.
+    kContended,
+  };
+  std::atomic<uint32_t> state_ = {kUnlocked};
+};
+
+// Windows allows 64 objects per wait (MAXIMUM_WAIT_OBJECTS), and so does the
+// guest.
+const size_t kMaxWaitObjects = 64;
+
+// The wait a thread is blocked in, one per thread and reused by every wait.
+// The state changes from a waiting value exactly once per wait, by whoever
+// ends it: a signaler handing the thread an object, an alert, or the timeout.
+struct PosixWaitBlock {
+  enum : uint32_t {
+    kWaiting,
+    kWaitingAlertable,
+    // A WaitAll object was signaled, the objects need checking again.
+    kRetry,
+    kAlerted,
+    kTimedOut,
+    // Satisfied by the object at (state - kSatisfied).
+    kSatisfied,
+  };
+
+  std::atomic<uint32_t> state = {kTimedOut};
+  bool wait_all = false;
+
+  static bool IsWaiting(uint32_t state) {
+    return state == kWaiting || state == kWaitingAlertable;
   }
 
-  void Reset() {
-    pthread_mutex_lock(&mutex_);
-    signal_ = false;
-    pthread_mutex_unlock(&mutex_);
+  // Ends the wait with the result if it's still waiting. The waiting thread
+  // passes wake = false to skip the futex wake.
+  bool TryEnd(uint32_t result, bool wake = true) {
+    uint32_t current = state.load();
+    while (IsWaiting(current)) {
+      if (state.compare_exchange_weak(current, result)) {
+        if (wake) {
+          FutexWake(&state, 1);
+        }
+        return true;
+      }
+    }
+    return false;
   }
+};
+
+// A wait block registered with a single object.
+struct PosixWaitEntry {
+  PosixWaitBlock* block;
+  uint32_t index;
+  PosixWaitEntry* previous;
+  PosixWaitEntry* next;
+};
+
+}  // namespace
 
-  bool Wait(unsigned int timeout_ms) {
-    // Assume 0 means no timeout, not instant timeout
-    if (timeout_ms == 0) {
-      Wait();
+class PosixDispatcher {
+ public:
+  virtual ~PosixDispatcher() = default;
+
+  // The functions below are called with the lock held.
+  FutexLock& lock() { return lock_; }
+
+  // Whether a wait by the given thread would be satisfied.
+  virtual bool IsSignaled(const PosixWaitBlock* waiter) const = 0;
+  // Takes the signal for a satisfied wait, such as resetting an auto-reset
+  // event.
+  virtual void Satisfy(PosixWaitBlock* waiter) {}
+
+  // Signals the object as SignalObjectAndWait does, called without the lock.
+  // Returns false if the object can't be signaled this way.
+  virtual bool Signal() { return false; }
+
+  void AddWaiter(PosixWaitEntry* entry) {
+    entry->previous = waiters_tail_;
+    entry->next = nullptr;
+    if (waiters_tail_) {
+      waiters_tail_->next = entry;
+    } else {
+      waiters_head_ = entry;
     }
-    struct timespec time_to_wait;
-    struct timeval now;
-    gettimeofday(&now, NULL);
+    waiters_tail_ = entry;
+  }
 
-    // Add the number of seconds we want to wait to the current time
-    time_to_wait.tv_sec = now.tv_sec + (timeout_ms / 1000);
-    // Add the number of nanoseconds we want to wait to the current nanosecond
-    // stride
-    long nsec = (now.tv_usec + (timeout_ms % 1000)) * 1000;
-    // If we overflowed the nanosecond count then we add a second
-    time_to_wait.tv_sec += nsec / 1000000000UL;
-    // We only add nanoseconds within the 1 second stride
-    time_to_wait.tv_nsec = nsec % 1000000000UL;
-    pthread_mutex_lock(&mutex_);
-    while (!signal_) {
-      int status = pthread_cond_timedwait(&cond_, &mutex_, &time_to_wait);
-      if (status == ETIMEDOUT) return false;  // We timed out
+  void RemoveWaiter(PosixWaitEntry* entry) {
+    if (entry->previous) {
+      entry->previous->next = entry->next;
+    } else {
+      waiters_head_ = entry->next;
+    }
+    if (entry->next) {
+      entry->next->previous = entry->previous;
+    } else {
+      waiters_tail_ = entry->previous;
     }
-    pthread_mutex_unlock(&mutex_);
-    return true;  // We didn't time out
   }
 
-  bool Wait() {
-    pthread_mutex_lock(&mutex_);
-    while (!signal_) {
-      pthread_cond_wait(&cond_, &mutex_);
+ protected:
+  // Hands the signal to the waiters in the order they started waiting, after
+  // the object has become signaled. WaitAny waits are satisfied right here,
+  // WaitAll ones are woken to check all of their objects again.
+  void SignalWaiters() {
+    for (auto entry = waiters_head_; entry; entry = entry->next) {
+      auto block = entry->block;
+      if (!IsSignaled(block)) {
+        // Nothing left to hand out, unless it depends on the waiter (as it
+        // does for mutants).
+        continue;
+      }
+      if (block->wait_all) {
+        block->TryEnd(PosixWaitBlock::kRetry);
+      } else if (block->TryEnd(PosixWaitBlock::kSatisfied + entry->index)) {
+        Satisfy(block);
+      }
     }
-    pthread_mutex_unlock(&mutex_);
-    return true;  // Did not time out;
   }
 
  private:
-  bool signal_;
-  pthread_cond_t cond_;
-  pthread_mutex_t mutex_;
+  FutexLock lock_;
+  // Waiters are removed by the waiting thread itself once its wait ends.
+  PosixWaitEntry* waiters_head_ = nullptr;
+  PosixWaitEntry* waiters_tail_ = nullptr;
 };
 
-// Native posix thread handle
-template <typename T>
-class PosixThreadHandle : public T {
+namespace {
+
+PosixDispatcher* GetDispatcher(WaitHandle* wait_handle) {
+  return static_cast<PosixDispatcher*>(wait_handle->native_handle());
+}
+
+}  // namespace
+
+// State shared by all the objects referring to a thread.
+class PosixThreadState {
  public:
-  explicit PosixThreadHandle(pthread_t handle) : handle_(handle) {}
-  ~PosixThreadHandle() override {}
+  PosixWaitBlock* wait_block() { return &wait_block_; }
+  PosixDispatcher* exit_dispatcher() { return &exit_dispatcher_; }
 
- protected:
-  void* native_handle() const override {
-    return reinterpret_cast<void*>(handle_);
+  void QueueUserCallback(std::function<void()> callback) {
+    {
+      std::lock_guard<std::mutex> lock(callback_mutex_);
+      callbacks_.push_back(std::move(callback));
+    }
+    pending_callback_count_.fetch_add(1);
+    uint32_t state = PosixWaitBlock::kWaitingAlertable;
+    if (wait_block_.state.compare_exchange_strong(state,
+                                                  PosixWaitBlock::kAlerted)) {
+      FutexWake(&wait_block_.state, 1);
+    }
   }
 
-  pthread_t handle_;
+  bool has_user_callbacks() const { return pending_callback_count_ != 0; }
+
+  // Runs the queued callbacks in FIFO order, from the thread itself. Returns
+  // whether there were any.
+  bool DeliverUserCallbacks() {
+    if (!has_user_callbacks()) {
+      return false;
+    }
+    std::vector<std::function<void()>> callbacks;
+    {
+      std::lock_guard<std::mutex> lock(callback_mutex_);
+      callbacks.swap(callbacks_);
+    }
+    pending_callback_count_.fetch_sub(uint32_t(callbacks.size()));
+    for (auto& callback : callbacks) {
+      callback();
+    }
+    return !callbacks.empty();
+  }
+
+  // Signals the thread object, from the thread itself as it exits.
+  void SignalExit() {
+    std::lock_guard<FutexLock> lock(exit_dispatcher_.lock());
+    exit_dispatcher_.Exit();
+    has_exited_ = true;
+  }
+  // Once set, the host thread may already be running another thread.
+  bool has_exited() const { return has_exited_; }
+
+  // Holds back the start routine of a thread created suspended until it's
+  // resumed. Suspending running threads isn't supported.
+  void SuspendStart() { start_suspend_count_ = 1; }
+  bool ResumeStart(uint32_t* out_previous_suspend_count) {
+    uint32_t count = start_suspend_count_.load();
+    do {
+      if (!count) {
+        break;
+      }
+    } while (!start_suspend_count_.compare_exchange_weak(count, count - 1));
+    if (out_previous_suspend_count) {
+      *out_previous_suspend_count = count;
+    }
+    if (count == 1) {
+      FutexWake(&start_suspend_count_, INT_MAX);
+    }
+    return true;
+  }
+  void WaitForStart() {
+    uint32_t count;
+    while ((count = start_suspend_count_.load()) != 0) {
+      FutexWait(&start_suspend_count_, count, nullptr);
+    }
+  }
+
+  // Returns the state of the calling thread.
+  static PosixThreadState* current();
+  static const std::shared_ptr<PosixThreadState>& current_shared();
+  // Binds the state of the calling thread, before it waits on anything.
+  static void set_current(std::shared_ptr<PosixThreadState> state);
+
+ private:
+  class ExitDispatcher : public PosixDispatcher {
+   public:
+    bool IsSignaled(const PosixWaitBlock* waiter) const override {
+      return exited_;
+    }
+    void Exit() {
+      exited_ = true;
+      SignalWaiters();
+    }
+
+   private:
+    bool exited_ = false;
+  };
+
+  PosixWaitBlock wait_block_;
+  ExitDispatcher exit_dispatcher_;
+  std::mutex callback_mutex_;
+  std::vector<std::function<void()>> callbacks_;
+  std::atomic<uint32_t> pending_callback_count_ = {0};
+  std::atomic<bool> has_exited_ = {false};
+  std::atomic<uint32_t> start_suspend_count_ = {0};
 };
 
-// This is wraps a condition object as our handle because posix has no single
-// native handle for higher level concurrency constructs such as semaphores
+thread_local std::shared_ptr<PosixThreadState> current_thread_state_;
+
+const std::shared_ptr<PosixThreadState>& PosixThreadState::current_shared() {
+  if (!current_thread_state_) {
+    current_thread_state_ = std::make_shared<PosixThreadState>();
+  }
+  return current_thread_state_;
+}
+
+PosixThreadState* PosixThreadState::current() {
+  return current_shared().get();
+}
+
+void PosixThreadState::set_current(std::shared_ptr<PosixThreadState> state) {
+  current_thread_state_ = std::move(state);
+}
+
+namespace {
+
+// Relative timeout until the deadline for FutexWait, or false if it passed.
+bool GetTimeout(std::chrono::steady_clock::time_point deadline,
+                timespec* out_timeout) {
+  auto remaining = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      deadline - std::chrono::steady_clock::now());
+  if (remaining.count() <= 0) {
+    return false;
+  }
+  out_timeout->tv_sec = time_t(remaining.count() / 1000000000);
+  out_timeout->tv_nsec = long(remaining.count() % 1000000000);
+  return true;
+}
+
+// Sleeps until the wait block stops waiting, ending the wait if the deadline
+// passes or, for alertable waits, user callbacks get queued.
+uint32_t SleepOnWaitBlock(PosixThreadState* thread_state, uint32_t waiting,
+                          bool has_deadline,
+                          std::chrono::steady_clock::time_point deadline) {
+  auto block = thread_state->wait_block();
+  uint32_t state;
+  while ((state = block->state.load()) == waiting) {
+    if (waiting == PosixWaitBlock::kWaitingAlertable &&
+        thread_state->has_user_callbacks()) {
+      block->TryEnd(PosixWaitBlock::kAlerted, false);
+      continue;
+    }
+    timespec timeout;
+    if (!has_deadline) {
+      FutexWait(&block->state, waiting, nullptr);
+    } else if (GetTimeout(deadline, &timeout)) {
+      FutexWait(&block->state, waiting, &timeout);
+    } else {
+      block->TryEnd(PosixWaitBlock::kTimedOut, false);
+    }
+  }
+  return state;
+}
+
+std::pair<WaitResult, size_t> WaitDispatchers(
+    PosixDispatcher* dispatchers[], size_t count, bool wait_all,
+    bool is_alertable, std::chrono::milliseconds timeout) {
+  if (count > kMaxWaitObjects) {
+    return std::make_pair(WaitResult::kFailed, size_t(0));
+  }
+  auto thread_state = PosixThreadState::current();
+  if (is_alertable && thread_state->DeliverUserCallbacks()) {
+    return std::make_pair(WaitResult::kUserCallback, size_t(0));
+  }
+  bool has_deadline = timeout != std::chrono::milliseconds::max();
+  std::chrono::steady_clock::time_point deadline;
+  if (has_deadline) {
+    deadline = std::chrono::steady_clock::now() + timeout;
+  }
+  auto block = thread_state->wait_block();
+  uint32_t waiting = is_alertable ? PosixWaitBlock::kWaitingAlertable
+                                  : PosixWaitBlock::kWaiting;
+  block->wait_all = wait_all;
+  PosixWaitEntry entries[kMaxWaitObjects];
+  uint32_t state;
+
+  if (!wait_all) {
+    // Objects signaled while the rest are checked satisfy the wait through
+    // the wait block, so exactly one of them is taken.
+    block->state = waiting;
+    size_t registered_count = 0;
+    for (size_t i = 0; i < count; ++i) {
+      auto dispatcher = dispatchers[i];
+      std::lock_guard<FutexLock> lock(dispatcher->lock());
+      if (block->state != waiting) {
+        break;
+      }
+      if (dispatcher->IsSignaled(block)) {
+        if (block->TryEnd(PosixWaitBlock::kSatisfied + uint32_t(i), false)) {
+          dispatcher->Satisfy(block);
+        }
+        break;
+      }
+      entries[i].block = block;
+      entries[i].index = uint32_t(i);
+      dispatcher->AddWaiter(&entries[i]);
+      registered_count = i + 1;
+    }
+    state = SleepOnWaitBlock(thread_state, waiting, has_deadline, deadline);
+    for (size_t i = 0; i < registered_count; ++i) {
+      std::lock_guard<FutexLock> lock(dispatchers[i]->lock());
+      dispatchers[i]->RemoveWaiter(&entries[i]);
+    }
+  } else {
+    // All the objects are locked together, in address order, to check and
+    // take them as one.
+    PosixDispatcher* sorted[kMaxWaitObjects];
+    std::copy(dispatchers, dispatchers + count, sorted);
+    std::sort(sorted, sorted + count);
+    if (std::adjacent_find(sorted, sorted + count) != sorted + count) {
+      return std::make_pair(WaitResult::kFailed, size_t(0));
+    }
+    auto lock_all = [&]() {
+      for (size_t i = 0; i < count; ++i) {
+        sorted[i]->lock().lock();
+      }
+    };
+    auto unlock_all = [&]() {
+      for (size_t i = count; i-- > 0;) {
+        sorted[i]->lock().unlock();
+      }
+    };
+    bool registered = false;
+    while (true) {
+      lock_all();
+      bool signaled = true;
+      for (size_t i = 0; i < count && signaled; ++i) {
+        signaled = dispatchers[i]->IsSignaled(block);
+      }
+      if (signaled) {
+        for (size_t i = 0; i < count; ++i) {
+          dispatchers[i]->Satisfy(block);
+        }
+        block->state = PosixWaitBlock::kSatisfied;
+      } else {
+        if (!registered) {
+          for (size_t i = 0; i < count; ++i) {
+            entries[i].block = block;
+            entries[i].index = uint32_t(i);
+            dispatchers[i]->AddWaiter(&entries[i]);
+          }
+          registered = true;
+        }
+        block->state = waiting;
+      }
+      unlock_all();
+      if (!signaled) {
+        state = SleepOnWaitBlock(thread_state, waiting, has_deadline, deadline);
+        if (state == PosixWaitBlock::kRetry) {
+          continue;
+        }
+      } else {
+        state = PosixWaitBlock::kSatisfied;
+      }
+      break;
+    }
+    if (registered) {
+      lock_all();
+      for (size_t i = 0; i < count; ++i) {
+        dispatchers[i]->RemoveWaiter(&entries[i]);
+      }
+      unlock_all();
+    }
+  }
+
+  switch (state) {
+    case PosixWaitBlock::kAlerted:
+      thread_state->DeliverUserCallbacks();
+      return std::make_pair(WaitResult::kUserCallback, size_t(0));
+    case PosixWaitBlock::kTimedOut:
+      return std::make_pair(WaitResult::kTimeout, size_t(0));
+    default:
+      return std::make_pair(WaitResult::kSuccess,
+                            size_t(state - PosixWaitBlock::kSatisfied));
+  }
+}
+
+}  // namespace
+
+// Native posix thread handle
 template <typename T>
-class PosixConditionHandle : public T {
+class PosixThreadHandle : public T {
  public:
-  ~PosixConditionHandle() override {}
+  explicit PosixThreadHandle(pthread_t handle) : handle_(handle) {}
+  ~PosixThreadHandle() override {}
 
  protected:
-  void* native_handle() const override {
-    return reinterpret_cast<void*>(const_cast<PosixCondition*>(&handle_));
-  }
-
-  PosixCondition handle_;
+  pthread_t handle_;
 };
 
 template <typename T>
-class PosixFdHandle : public T {
+class PosixDispatcherHandle : public T, public PosixDispatcher {
  public:
-  explicit PosixFdHandle(intptr_t handle) : handle_(handle) {}
-  ~PosixFdHandle() override {
-    close(handle_);
-    handle_ = 0;
-  }
+  ~PosixDispatcherHandle() override {}
 
  protected:
   void* native_handle() const override {
-    return reinterpret_cast<void*>(handle_);
+    return static_cast<PosixDispatcher*>(
+        const_cast<PosixDispatcherHandle*>(this));
   }
-
-  intptr_t handle_;
 };
 
-// TODO(dougvj)
 WaitResult Wait(WaitHandle* wait_handle, bool is_alertable,
                 std::chrono::milliseconds timeout) {
-  intptr_t handle = reinterpret_cast<intptr_t>(wait_handle->native_handle());
-
-  fd_set set;
-  struct timeval time_val;
-  int ret;
-
-  FD_ZERO(&set);
-  FD_SET(handle, &set);
-
-  time_val.tv_sec = timeout.count() / 1000;
-  time_val.tv_usec = timeout.count() * 1000;
-  ret = select(handle + 1, &set, NULL, NULL, &time_val);
-  if (ret == -1) {
-    return WaitResult::kFailed;
-  } else if (ret == 0) {
-    return WaitResult::kTimeout;
-  } else {
-    uint64_t buf = 0;
-    ret = read(handle, &buf, sizeof(buf));
-    if (ret < 8) {
-      return WaitResult::kTimeout;
-    }
-
-    return WaitResult::kSuccess;
-  }
+  PosixDispatcher* dispatcher = GetDispatcher(wait_handle);
+  return WaitDispatchers(&dispatcher, 1, false, is_alertable, timeout).first;
 }
 
-// TODO(dougvj)
 WaitResult SignalAndWait(WaitHandle* wait_handle_to_signal,
                          WaitHandle* wait_handle_to_wait_on, bool is_alertable,
                          std::chrono::milliseconds timeout) {
-  assert_always();
-  return WaitResult::kFailed;
+  // TODO(benvanik): make the signal atomic with the wait.
+  if (!GetDispatcher(wait_handle_to_signal)->Signal()) {
+    return WaitResult::kFailed;
+  }
+  return Wait(wait_handle_to_wait_on, is_alertable, timeout);
 }
 
-// TODO(dougvj)
 std::pair<WaitResult, size_t> WaitMultiple(WaitHandle* wait_handles[],
                                            size_t wait_handle_count,
                                            bool wait_all, bool is_alertable,
                                            std::chrono::milliseconds timeout) {
-  assert_always();
-  return std::pair<WaitResult, size_t>(WaitResult::kFailed, 0);
+  if (wait_handle_count > kMaxWaitObjects) {
+    return std::make_pair(WaitResult::kFailed, size_t(0));
+  }
+  PosixDispatcher* dispatchers[kMaxWaitObjects];
+  for (size_t i = 0; i < wait_handle_count; ++i) {
+    dispatchers[i] = GetDispatcher(wait_handles[i]);
+  }
+  return WaitDispatchers(dispatchers, wait_handle_count, wait_all,
+                         is_alertable, timeout);
 }
 
-// TODO(dougvj)
-class PosixEvent : public PosixFdHandle<Event> {
+SleepResult AlertableSleep(std::chrono::microseconds duration) {
+  // A wait on nothing, ended by the timeout or user callbacks.
+  auto result = WaitDispatchers(
+      nullptr, 0, false, true,
+      std::chrono::duration_cast<std::chrono::milliseconds>(duration));
+  return result.first == WaitResult::kUserCallback ? SleepResult::kAlerted
+                                                   : SleepResult::kSuccess;
+}
+
+class PosixEvent : public PosixDispatcherHandle<Event> {
  public:
-  PosixEvent(intptr_t fd) : PosixFdHandle(fd) {}
+  PosixEvent(bool manual_reset, bool initial_state)
+      : manual_reset_(manual_reset), signaled_(initial_state) {}
   ~PosixEvent() override = default;
+
   void Set() override {
-    uint64_t buf = 1;
-    write(handle_, &buf, sizeof(buf));
+    std::lock_guard<FutexLock> lock(this->lock());
+    signaled_ = true;
+    SignalWaiters();
+  }
+  void Reset() override {
+    std::lock_guard<FutexLock> lock(this->lock());
+    signaled_ = false;
+  }
+  void Pulse() override {
+    std::lock_guard<FutexLock> lock(this->lock());
+    signaled_ = true;
+    SignalWaiters();
+    signaled_ = false;
+  }
+
+  bool IsSignaled(const PosixWaitBlock* waiter) const override {
+    return signaled_;
+  }
+  void Satisfy(PosixWaitBlock* waiter) override {
+    if (!manual_reset_) {
+      signaled_ = false;
+    }
+  }
+  bool Signal() override {
+    Set();
+    return true;
   }
-  void Reset() override { assert_always(); }
-  void Pulse() override { assert_always(); }
 
  private:
-  PosixCondition condition_;
+  bool manual_reset_;
+  bool signaled_;
 };
 
 std::unique_ptr<Event> Event::CreateManualResetEvent(bool initial_state) {
-  // Linux's eventfd doesn't appear to support manual reset natively.
-  return nullptr;
+  return std::make_unique<PosixEvent>(true, initial_state);
 }
 
 std::unique_ptr<Event> Event::CreateAutoResetEvent(bool initial_state) {
-  int fd = eventfd(initial_state ? 1 : 0, EFD_CLOEXEC);
-  if (fd == -1) {
-    return nullptr;
-  }
-
-  return std::make_unique<PosixEvent>(PosixEvent(fd));
+  return std::make_unique<PosixEvent>(false, initial_state);
 }
 
-// TODO(dougvj)
-class PosixSemaphore : public PosixConditionHandle<Semaphore> {
+class PosixSemaphore : public PosixDispatcherHandle<Semaphore> {
  public:
-  PosixSemaphore(int initial_count, int maximum_count) { assert_always(); }
+  PosixSemaphore(int initial_count, int maximum_count)
+      : count_(initial_count), maximum_count_(maximum_count) {}
   ~PosixSemaphore() override = default;
+
   bool Release(int release_count, int* out_previous_count) override {
-    assert_always();
-    return false;
+    std::lock_guard<FutexLock> lock(this->lock());
+    if (release_count <= 0 || release_count > maximum_count_ - count_) {
+      return false;
+    }
+    if (out_previous_count) {
+      *out_previous_count = count_;
+    }
+    count_ += release_count;
+    SignalWaiters();
+    return true;
+  }
+
+  bool IsSignaled(const PosixWaitBlock* waiter) const override {
+    return count_ > 0;
   }
+  void Satisfy(PosixWaitBlock* waiter) override { --count_; }
+  bool Signal() override { return Release(1, nullptr); }
+
+ private:
+  int count_;
+  int maximum_count_;
 };
 
 std::unique_ptr<Semaphore> Semaphore::Create(int initial_count,
                                              int maximum_count) {
+  if (initial_count < 0 || initial_count > maximum_count ||
+      maximum_count <= 0) {
+    return nullptr;
+  }
   return std::make_unique<PosixSemaphore>(initial_count, maximum_count);
 }
 
-// TODO(dougvj)
-class PosixMutant : public PosixConditionHandle<Mutant> {
+// The owner is identified by the wait block of its thread.
+// TODO(benvanik): abandon mutants still owned by exiting threads.
+class PosixMutant : public PosixDispatcherHandle<Mutant> {
  public:
-  PosixMutant(bool initial_owner) { assert_always(); }
+  explicit PosixMutant(bool initial_owner) {
+    if (initial_owner) {
+      owner_ = PosixThreadState::current()->wait_block();
+      recursion_count_ = 1;
+    }
+  }
   ~PosixMutant() = default;
+
   bool Release() override {
-    assert_always();
-    return false;
+    std::lock_guard<FutexLock> lock(this->lock());
+    if (!recursion_count_ ||
+        owner_ != PosixThreadState::current()->wait_block()) {
+      return false;
+    }
+    if (!--recursion_count_) {
+      owner_ = nullptr;
+      SignalWaiters();
+    }
+    return true;
+  }
+
+  bool IsSignaled(const PosixWaitBlock* waiter) const override {
+    return !recursion_count_ || owner_ == waiter;
   }
+  void Satisfy(PosixWaitBlock* waiter) override {
+    owner_ = waiter;
+    ++recursion_count_;
+  }
+  bool Signal() override { return Release(); }
+
+ private:
+  const PosixWaitBlock* owner_ = nullptr;
+  uint32_t recursion_count_ = 0;
 };
 
 std::unique_ptr<Mutant> Mutant::Create(bool initial_owner) {
   return std::make_unique<PosixMutant>(initial_owner);
 }
 
-// TODO(dougvj)
-class PosixTimer : public PosixConditionHandle<Timer> {
+class PosixTimer;
+
+// Fires all the timers from a single thread, started on first use.
+class PosixTimerQueue {
  public:
-  PosixTimer(bool manual_reset) { assert_always(); }
-  ~PosixTimer() = default;
+  PosixTimerQueue() : thread_([this]() { ThreadMain(); }) {}
+  ~PosixTimerQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      shutdown_ = true;
+    }
+    condition_.notify_one();
+    thread_.join();
+  }
+
+  static PosixTimerQueue& get() {
+    static PosixTimerQueue queue;
+    return queue;
+  }
+
+  std::mutex& mutex() { return mutex_; }
+
+  // Called with the queue mutex held.
+  void Schedule(PosixTimer* timer, std::chrono::steady_clock::time_point due) {
+    timers_.emplace(due, timer);
+    condition_.notify_one();
+  }
+  bool Unschedule(PosixTimer* timer) {
+    for (auto it = timers_.begin(); it != timers_.end(); ++it) {
+      if (it->second == timer) {
+        timers_.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+
+ private:
+  void ThreadMain();
+
+  std::mutex mutex_;
+  std::condition_variable condition_;
+  std::multimap<std::chrono::steady_clock::time_point, PosixTimer*> timers_;
+  bool shutdown_ = false;
+  // Last, so it starts once everything else is constructed.
+  std::thread thread_;
+};
+
+class PosixTimer : public PosixDispatcherHandle<Timer> {
+ public:
+  explicit PosixTimer(bool manual_reset) : manual_reset_(manual_reset) {}
+  ~PosixTimer() override { Cancel(); }
+
   bool SetOnce(std::chrono::nanoseconds due_time,
                std::function<void()> opt_callback) override {
-    assert_always();
-    return false;
+    return Set(due_time, std::chrono::milliseconds(0),
+               std::move(opt_callback));
   }
   bool SetRepeating(std::chrono::nanoseconds due_time,
                     std::chrono::milliseconds period,
                     std::function<void()> opt_callback) override {
-    assert_always();
-    return false;
+    return Set(due_time, period, std::move(opt_callback));
   }
   bool Cancel() override {
-    assert_always();
-    return false;
+    auto& queue = PosixTimerQueue::get();
+    std::lock_guard<std::mutex> queue_lock(queue.mutex());
+    queue.Unschedule(this);
+    callback_ = nullptr;
+    callback_thread_.reset();
+    return true;
+  }
+
+  bool IsSignaled(const PosixWaitBlock* waiter) const override {
+    return signaled_;
+  }
+  void Satisfy(PosixWaitBlock* waiter) override {
+    if (!manual_reset_) {
+      signaled_ = false;
+    }
+  }
+
+  // Called by the queue with its mutex held. Returns the next due time of a
+  // repeating timer.
+  std::chrono::milliseconds Fire() {
+    {
+      std::lock_guard<FutexLock> lock(this->lock());
+      signaled_ = true;
+      SignalWaiters();
+    }
+    if (callback_) {
+      // Like a completion routine, called by the thread that set the timer
+      // once it is alertable.
+      callback_thread_->QueueUserCallback(callback_);
+    }
+    return period_;
+  }
+
+ private:
+  bool Set(std::chrono::nanoseconds due_time, std::chrono::milliseconds period,
+           std::function<void()> opt_callback) {
+    // Negative due times are relative, positive ones absolute in the same
+    // epoch as FILETIME (1601).
+    auto now = std::chrono::steady_clock::now();
+    std::chrono::steady_clock::time_point due;
+    if (due_time.count() <= 0) {
+      due = now - due_time;
+    } else {
+      const std::chrono::seconds kFileTimeToUnixEpoch(11644473600ll);
+      auto until = due_time - kFileTimeToUnixEpoch -
+                   std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch());
+      due = now + std::max(until, std::chrono::nanoseconds(0));
+    }
+    auto& queue = PosixTimerQueue::get();
+    std::lock_guard<std::mutex> queue_lock(queue.mutex());
+    queue.Unschedule(this);
+    {
+      std::lock_guard<FutexLock> lock(this->lock());
+      signaled_ = false;
+    }
+    period_ = period;
+    callback_ = std::move(opt_callback);
+    callback_thread_ =
+        callback_ ? PosixThreadState::current_shared() : nullptr;
+    queue.Schedule(this, due);
+    return true;
   }
+
+  bool manual_reset_;
+  bool signaled_ = false;
+  // Guarded by the queue mutex.
+  std::chrono::milliseconds period_ = std::chrono::milliseconds(0);
+  std::function<void()> callback_;
+  std::shared_ptr<PosixThreadState> callback_thread_;
 };
 
+void PosixTimerQueue::ThreadMain() {
+  set_name("Posix Timer Queue");
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!shutdown_) {
+    if (timers_.empty()) {
+      condition_.wait(lock);
+      continue;
+    }
+    auto it = timers_.begin();
+    auto due = it->first;
+    if (std::chrono::steady_clock::now() < due) {
+      condition_.wait_until(lock, due);
+      continue;
+    }
+    auto timer = it->second;
+    timers_.erase(it);
+    auto period = timer->Fire();
+    if (period.count()) {
+      timers_.emplace(due + period, timer);
+    }
+  }
+}
+
 std::unique_ptr<Timer> Timer::CreateManualResetTimer() {
   return std::make_unique<PosixTimer>(true);
 }
@@ -362,18 +948,67 @@ std::unique_ptr<Timer> Timer::CreateSynchronizationTimer() {
 
 class PosixThread : public PosixThreadHandle<Thread> {
  public:
-  explicit PosixThread(pthread_t handle) : PosixThreadHandle(handle) {}
+  PosixThread(pthread_t handle, std::shared_ptr<thread_lock_state> lock_state,
+              std::shared_ptr<PosixThreadState> thread_state)
+      : PosixThreadHandle(handle), thread_state_(std::move(thread_state)) {
+    lock_state_ = std::move(lock_state);
+  }
   ~PosixThread() = default;
 
+  void* native_handle() const override {
+    return thread_state_->exit_dispatcher();
+  }
+
   void set_name(std::string name) override {
+    if (thread_state_->has_exited()) {
+      return;
+    }
     pthread_setname_np(handle_, name.c_str());
   }
 
   uint32_t system_id() const override { return 0; }
 
-  // TODO(DrChat)
-  uint64_t affinity_mask() override { return 0; }
-  void set_affinity_mask(uint64_t mask) override { assert_always(); }
+  uint64_t QueryCpuTimeMicroseconds() override {
+    // The pthread_t may already be gone once the thread has exited.
+    clockid_t clock_id;
+    if (thread_state_->has_exited() ||
+        pthread_getcpuclockid(handle_, &clock_id)) {
+      return 0;
+    }
+    timespec time;
+    if (clock_gettime(clock_id, &time)) {
+      return 0;
+    }
+    return uint64_t(time.tv_sec) * 1000000 + uint64_t(time.tv_nsec) / 1000;
+  }
+
+  uint64_t affinity_mask() override {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (pthread_getaffinity_np(handle_, sizeof(cpu_set), &cpu_set)) {
+      return 0;
+    }
+    uint64_t mask = 0;
+    for (int i = 0; i < 64; ++i) {
+      if (CPU_ISSET(i, &cpu_set)) {
+        mask |= uint64_t(1) << i;
+      }
+    }
+    return mask;
+  }
+  void set_affinity_mask(uint64_t mask) override {
+    if (thread_state_->has_exited()) {
+      return;
+    }
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    for (int i = 0; i < 64; ++i) {
+      if (mask & (uint64_t(1) << i)) {
+        CPU_SET(i, &cpu_set);
+      }
+    }
+    pthread_setaffinity_np(handle_, sizeof(cpu_set), &cpu_set);
+  }
 
   int priority() override {
     int policy;
@@ -387,19 +1022,20 @@ class PosixThread : public PosixThreadHandle<Thread> {
   }
 
   void set_priority(int new_priority) override {
+    if (thread_state_->has_exited()) {
+      return;
+    }
     struct sched_param param;
     param.sched_priority = new_priority;
     int ret = pthread_setschedparam(handle_, SCHED_FIFO, &param);
   }
 
-  // TODO(DrChat)
   void QueueUserCallback(std::function<void()> callback) override {
-    assert_always();
+    thread_state_->QueueUserCallback(std::move(callback));
   }
 
   bool Resume(uint32_t* out_new_suspend_count = nullptr) override {
-    assert_always();
-    return false;
+    return thread_state_->ResumeStart(out_new_suspend_count);
   }
 
   bool Suspend(uint32_t* out_previous_suspend_count = nullptr) override {
@@ -408,41 +1044,187 @@ class PosixThread : public PosixThreadHandle<Thread> {
   }
 
   void Terminate(int exit_code) override {}
+
+ private:
+  std::shared_ptr<PosixThreadState> thread_state_;
 };
 
 thread_local std::unique_ptr<PosixThread> current_thread_ = nullptr;
 
 struct ThreadStartData {
   std::function<void()> start_routine;
+  std::shared_ptr<thread_lock_state> lock_state;
+  std::shared_ptr<PosixThreadState> thread_state;
 };
-void* ThreadStartRoutine(void* parameter) {
-  current_thread_ =
-      std::unique_ptr<PosixThread>(new PosixThread(::pthread_self()));
 
+// Binds the thread objects of the thread about to run on the calling host
+// thread.
+void BindThread(ThreadStartData* start_data) {
+  thread_lock_state::set_current(start_data->lock_state.get());
+  PosixThreadState::set_current(start_data->thread_state);
+  current_thread_ = std::unique_ptr<PosixThread>(
+      new PosixThread(::pthread_self(), start_data->lock_state,
+                      start_data->thread_state));
+}
+
+void* ThreadStartRoutine(void* parameter) {
   auto start_data = reinterpret_cast<ThreadStartData*>(parameter);
+  BindThread(start_data);
+
+  // Signals the thread object on return and on Thread::Exit, which unwinds.
+  struct ExitSignal {
+    ~ExitSignal() { PosixThreadState::current()->SignalExit(); }
+  } exit_signal;
+  start_data->thread_state->WaitForStart();
   start_data->start_routine();
   delete start_data;
   return 0;
 }
 
+// A host thread running threads created with reuse_host_thread one after
+// another.
+struct PooledHostThread {
+  pthread_t handle;
+  size_t stack_size;
+  ThreadStartData* start_data = nullptr;
+  std::atomic<uint32_t> has_start_data = {0};
+};
+
+// Where Thread::Exit returns to on pooled host threads.
+thread_local sigjmp_buf* pooled_thread_exit_ = nullptr;
+
+// Host threads parked once their thread exited, waiting for Thread::Create to
+// hand them the next one.
+class PosixHostThreadPool {
+ public:
+  static PosixHostThreadPool* get() {
+    // Never destroyed, as parked threads are still using it at exit.
+    static auto pool = new PosixHostThreadPool();
+    return pool;
+  }
+
+  // Hands the thread to an idle host thread with a large enough stack.
+  bool TryLaunch(ThreadStartData* start_data, size_t stack_size,
+                 pthread_t* out_handle) {
+    PooledHostThread* host_thread = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (auto it = idle_threads_.rbegin(); it != idle_threads_.rend();
+           ++it) {
+        if ((*it)->stack_size >= stack_size) {
+          host_thread = *it;
+          idle_threads_.erase(std::next(it).base());
+          break;
+        }
+      }
+    }
+    if (!host_thread) {
+      return false;
+    }
+    host_thread->start_data = start_data;
+    host_thread->has_start_data = 1;
+    FutexWake(&host_thread->has_start_data, 1);
+    *out_handle = host_thread->handle;
+    return true;
+  }
+
+  // Parks the calling host thread until it's handed another thread to run.
+  // Returns null if enough threads are parked already, and it should exit.
+  ThreadStartData* Park(PooledHostThread* host_thread) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (idle_threads_.size() >= kMaxIdleThreadCount) {
+        return nullptr;
+      }
+      host_thread->has_start_data = 0;
+      idle_threads_.push_back(host_thread);
+    }
+    while (!host_thread->has_start_data.load()) {
+      FutexWait(&host_thread->has_start_data, 0, nullptr);
+    }
+    auto start_data = host_thread->start_data;
+    host_thread->start_data = nullptr;
+    return start_data;
+  }
+
+ private:
+  static const size_t kMaxIdleThreadCount = 32;
+
+  std::mutex mutex_;
+  std::vector<PooledHostThread*> idle_threads_;
+};
+
+// Runs the thread until its start routine returns or it calls Thread::Exit,
+// which jumps back here without unwinding, like it ends host threads.
+void RunPooledThread(ThreadStartData* start_data) {
+  BindThread(start_data);
+  sigjmp_buf exit_jmp;
+  if (!sigsetjmp(exit_jmp, 0)) {
+    pooled_thread_exit_ = &exit_jmp;
+    start_data->thread_state->WaitForStart();
+    start_data->start_routine();
+  }
+  pooled_thread_exit_ = nullptr;
+  PosixThreadState::current()->SignalExit();
+  current_thread_.reset();
+  PosixThreadState::set_current(nullptr);
+  thread_lock_state::set_current(nullptr);
+  delete start_data;
+}
+
+void* PooledThreadStartRoutine(void* parameter) {
+  auto host_thread = reinterpret_cast<PooledHostThread*>(parameter);
+  host_thread->handle = ::pthread_self();
+  ThreadStartData* start_data = host_thread->start_data;
+  host_thread->start_data = nullptr;
+  while (start_data) {
+    RunPooledThread(start_data);
+    start_data = PosixHostThreadPool::get()->Park(host_thread);
+  }
+  delete host_thread;
+  return 0;
+}
+
 std::unique_ptr<Thread> Thread::Create(CreationParameters params,
                                        std::function<void()> start_routine) {
-  auto start_data = new ThreadStartData({std::move(start_routine)});
+  auto lock_state = std::make_shared<thread_lock_state>();
+  auto thread_state = std::make_shared<PosixThreadState>();
+  if (params.create_suspended) {
+    thread_state->SuspendStart();
+  }
+  auto start_data = new ThreadStartData(
+      {std::move(start_routine), lock_state, thread_state});
 
-  assert_false(params.create_suspended);
   pthread_t handle;
-  pthread_attr_t attr;
-  pthread_attr_init(&attr);
-  int ret = pthread_create(&handle, &attr, ThreadStartRoutine, start_data);
-  if (ret != 0) {
-    // TODO(benvanik): pass back?
-    auto last_error = errno;
-    XELOGE("Unable to pthread_create: %d", last_error);
-    delete start_data;
-    return nullptr;
+  if (!params.reuse_host_thread ||
+      !PosixHostThreadPool::get()->TryLaunch(start_data, params.stack_size,
+                                            &handle)) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, params.stack_size);
+    PooledHostThread* host_thread = nullptr;
+    int ret;
+    if (params.reuse_host_thread) {
+      host_thread = new PooledHostThread();
+      host_thread->stack_size = params.stack_size;
+      host_thread->start_data = start_data;
+      ret = pthread_create(&handle, &attr, PooledThreadStartRoutine,
+                           host_thread);
+    } else {
+      ret = pthread_create(&handle, &attr, ThreadStartRoutine, start_data);
+    }
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+      // TODO(benvanik): pass back?
+      XELOGE("Unable to pthread_create: %d", ret);
+      delete host_thread;
+      delete start_data;
+      return nullptr;
+    }
   }
 
-  return std::unique_ptr<PosixThread>(new PosixThread(handle));
+  return std::unique_ptr<PosixThread>(new PosixThread(
+      handle, std::move(lock_state), std::move(thread_state)));
 }
 
 Thread* Thread::GetCurrentThread() {
@@ -452,11 +1234,20 @@ Thread* Thread::GetCurrentThread() {
 
   pthread_t handle = pthread_self();
 
-  current_thread_ = std::make_unique<PosixThread>(handle);
+  // The thread wasn't started by Create, so it uses its default lock state,
+  // which lives as long as it does.
+  current_thread_ = std::make_unique<PosixThread>(
+      handle, std::shared_ptr<thread_lock_state>(
+                  std::shared_ptr<thread_lock_state>(),
+                  thread_lock_state::current()),
+      PosixThreadState::current_shared());
   return current_thread_.get();
 }
 
 void Thread::Exit(int exit_code) {
+  if (pooled_thread_exit_) {
+    siglongjmp(*pooled_thread_exit_, 1);
+  }
   pthread_exit(reinterpret_cast<void*>(exit_code));
 }
 
@@ -339,7 +339,10 @@ std::unique_ptr<Timer> Timer::CreateSynchronizationTimer() {
 
 class Win32Thread : public Win32Handle<Thread> {
  public:
-  explicit Win32Thread(HANDLE handle) : Win32Handle(handle) {}
+  Win32Thread(HANDLE handle, std::shared_ptr<thread_lock_state> lock_state)
+      : Win32Handle(handle) {
+    lock_state_ = std::move(lock_state);
+  }
   ~Win32Thread() = default;
 
   void set_name(std::string name) override {
@@ -350,6 +353,20 @@ class Win32Thread : public Win32Handle<Thread> {
   int32_t priority() override { return GetThreadPriority(handle_); }
   uint32_t system_id() const override { return GetThreadId(handle_); }
 
+  uint64_t QueryCpuTimeMicroseconds() override {
+    FILETIME creation_time, exit_time, kernel_time, user_time;
+    if (!GetThreadTimes(handle_, &creation_time, &exit_time, &kernel_time,
+                        &user_time)) {
+      return 0;
+    }
+    // In 100ns units.
+    uint64_t kernel_ticks = (uint64_t(kernel_time.dwHighDateTime) << 32) |
+                            kernel_time.dwLowDateTime;
+    uint64_t user_ticks =
+        (uint64_t(user_time.dwHighDateTime) << 32) | user_time.dwLowDateTime;
+    return (kernel_ticks + user_ticks) / 10;
+  }
+
   void set_priority(int32_t new_priority) override {
     SetThreadPriority(handle_, new_priority);
   }
@@ -396,7 +413,21 @@ class Win32Thread : public Win32Handle<Thread> {
     if (out_previous_suspend_count) {
       *out_previous_suspend_count = 0;
     }
+    bool is_current = GetCurrentThreadId() == GetThreadId(handle_);
+    if (!is_current) {
+      lock_state_->BeginSuspend();
+    }
     DWORD result = SuspendThread(handle_);
+    if (!is_current) {
+      if (result != UINT_MAX) {
+        // SuspendThread is asynchronous - getting the context waits for the
+        // thread to stop, before it's allowed to take a lock again.
+        CONTEXT context;
+        context.ContextFlags = CONTEXT_CONTROL;
+        GetThreadContext(handle_, &context);
+      }
+      lock_state_->EndSuspend();
+    }
     if (result == UINT_MAX) {
       return false;
     }
@@ -420,11 +451,14 @@ thread_local std::unique_ptr<Win32Thread> current_thread_ = nullptr;
 
 struct ThreadStartData {
   std::function<void()> start_routine;
+  std::shared_ptr<thread_lock_state> lock_state;
 };
 DWORD WINAPI ThreadStartRoutine(LPVOID parameter) {
-  current_thread_ = std::make_unique<Win32Thread>(::GetCurrentThread());
-
   auto start_data = reinterpret_cast<ThreadStartData*>(parameter);
+  thread_lock_state::set_current(start_data->lock_state.get());
+  current_thread_ = std::make_unique<Win32Thread>(::GetCurrentThread(),
+                                                  start_data->lock_state);
+
   start_data->start_routine();
   delete start_data;
   return 0;
@@ -432,7 +466,9 @@ DWORD WINAPI ThreadStartRoutine(LPVOID parameter) {
 
 std::unique_ptr<Thread> Thread::Create(CreationParameters params,
                                        std::function<void()> start_routine) {
-  auto start_data = new ThreadStartData({std::move(start_routine)});
+  auto lock_state = std::make_shared<thread_lock_state>();
+  auto start_data =
+      new ThreadStartData({std::move(start_routine), lock_state});
   HANDLE handle =
       CreateThread(NULL, params.stack_size, ThreadStartRoutine, start_data,
                    params.create_suspended ? CREATE_SUSPENDED : 0, NULL);
@@ -444,7 +480,7 @@ std::unique_ptr<Thread> Thread::Create(CreationParameters params,
     return nullptr;
   }
 
-  return std::make_unique<Win32Thread>(handle);
+  return std::make_unique<Win32Thread>(handle, std::move(lock_state));
 }
 
 Thread* Thread::GetCurrentThread() {
@@ -457,7 +493,12 @@ Thread* Thread::GetCurrentThread() {
     return nullptr;
   }
 
-  current_thread_ = std::make_unique<Win32Thread>(handle);
+  // The thread wasn't started by Create, so it uses its default lock state,
+  // which lives as long as it does.
+  current_thread_ = std::make_unique<Win32Thread>(
+      handle, std::shared_ptr<thread_lock_state>(
+                  std::shared_ptr<thread_lock_state>(),
+                  thread_lock_state::current()));
   return current_thread_.get();
 }
 
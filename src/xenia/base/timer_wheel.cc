@@ -0,0 +1,253 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/timer_wheel.h"
+
+#include <algorithm>
+
+namespace xe {
+
+TimerWheel::TimerWheel(std::chrono::microseconds tick_duration)
+    : start_time_(clock::now()),
+      tick_duration_(std::max(tick_duration, std::chrono::microseconds(1))) {}
+
+TimerWheel::~TimerWheel() { Shutdown(); }
+
+void TimerWheel::Start() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (thread_running_) {
+      return;
+    }
+    thread_running_ = true;
+  }
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  thread_->set_name("Timer Wheel");
+}
+
+void TimerWheel::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!thread_running_) {
+      return;
+    }
+    thread_running_ = false;
+  }
+  wake_cond_.notify_all();
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(clock::time_point due_time,
+                                         std::chrono::microseconds period,
+                                         std::function<void()> callback) {
+  auto timer = std::make_unique<Timer>();
+  timer->callback = std::move(callback);
+  timer->period_ticks =
+      period.count() > 0
+          ? std::max(uint64_t((period.count() + tick_duration_.count() - 1) /
+                              tick_duration_.count()),
+                     uint64_t(1))
+          : 0;
+  TimerId id;
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    id = next_id_++;
+    timer->id = id;
+    timer->expiry_tick = std::max(ToTick(due_time, true), current_tick_ + 1);
+    wake = timer->expiry_tick < NextWakeTick();
+    Insert(timer.get());
+    timers_.emplace(id, std::move(timer));
+  }
+  if (wake) {
+    wake_cond_.notify_one();
+  }
+  return id;
+}
+
+bool TimerWheel::Cancel(TimerId id) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  bool found = false;
+  auto it = timers_.find(id);
+  if (it != timers_.end()) {
+    Unlink(it->second.get());
+    timers_.erase(it);
+    found = true;
+  }
+  auto firing_end =
+      std::remove_if(firing_.begin(), firing_.end(),
+                     [id](const std::pair<TimerId, std::function<void()>>&
+                              entry) { return entry.first == id; });
+  if (firing_end != firing_.end()) {
+    firing_.erase(firing_end, firing_.end());
+    found = true;
+  }
+  while (running_timer_ == id &&
+         running_thread_ != std::this_thread::get_id()) {
+    callback_cond_.wait(lock);
+  }
+  return found;
+}
+
+void TimerWheel::AdvanceTo(clock::time_point now) {
+  std::lock_guard<std::mutex> advance_lock(advance_mutex_);
+  std::unique_lock<std::mutex> lock(mutex_);
+  uint64_t target_tick = ToTick(now, false);
+  while (current_tick_ < target_tick) {
+    if (timers_.empty()) {
+      current_tick_ = target_tick;
+      break;
+    }
+    ++current_tick_;
+    uint32_t index = uint32_t(current_tick_ & (kSlotsPerLevel - 1));
+    if (!index) {
+      Cascade(1);
+    }
+    while (Timer* timer = slots_[0][index]) {
+      Unlink(timer);
+      firing_.emplace_back(timer->id, timer->callback);
+      if (timer->period_ticks) {
+        timer->expiry_tick += timer->period_ticks;
+        // Periods missed while nobody advanced the wheel are dropped.
+        timer->expiry_tick =
+            std::max(timer->expiry_tick, current_tick_ + 1);
+        Insert(timer);
+      } else {
+        timers_.erase(timer->id);
+      }
+    }
+  }
+  running_thread_ = std::this_thread::get_id();
+  while (!firing_.empty()) {
+    auto entry = std::move(firing_.front());
+    firing_.pop_front();
+    running_timer_ = entry.first;
+    lock.unlock();
+    entry.second();
+    lock.lock();
+    running_timer_ = 0;
+    callback_cond_.notify_all();
+  }
+  running_thread_ = std::thread::id();
+}
+
+size_t TimerWheel::timer_count() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return timers_.size();
+}
+
+uint64_t TimerWheel::ToTick(clock::time_point time, bool round_up) const {
+  if (time <= start_time_) {
+    return 0;
+  }
+  auto elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(time - start_time_)
+          .count();
+  auto tick =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(tick_duration_)
+          .count();
+  return uint64_t(round_up ? (elapsed + tick - 1) / tick : elapsed / tick);
+}
+
+TimerWheel::clock::time_point TimerWheel::ToTime(uint64_t tick) const {
+  return start_time_ + tick_duration_ * tick;
+}
+
+void TimerWheel::Insert(Timer* timer) {
+  // The level is picked so that its slot is reached no later than the start
+  // of the span the expiry is in, when the timer moves down to a lower level.
+  uint64_t delta = timer->expiry_tick - current_tick_;
+  uint32_t level = 0;
+  while (level + 1 < kLevelCount &&
+         delta >= (uint64_t(1) << ((level + 1) * kLevelBits))) {
+    ++level;
+  }
+  uint64_t slot_tick = timer->expiry_tick;
+  const uint64_t kWheelSpan = uint64_t(1) << (kLevelCount * kLevelBits);
+  if (delta >= kWheelSpan) {
+    // Beyond the wheel, parked in the furthest slot and reinserted from
+    // there.
+    slot_tick = current_tick_ + kWheelSpan - 1;
+  }
+  auto& slot = slots_[level][(slot_tick >> (level * kLevelBits)) &
+                             (kSlotsPerLevel - 1)];
+  timer->previous = nullptr;
+  timer->next = slot;
+  if (slot) {
+    slot->previous = timer;
+  }
+  slot = timer;
+  timer->slot = &slot;
+}
+
+void TimerWheel::Unlink(Timer* timer) {
+  if (timer->previous) {
+    timer->previous->next = timer->next;
+  } else {
+    *timer->slot = timer->next;
+  }
+  if (timer->next) {
+    timer->next->previous = timer->previous;
+  }
+  timer->previous = nullptr;
+  timer->next = nullptr;
+  timer->slot = nullptr;
+}
+
+void TimerWheel::Cascade(uint32_t level) {
+  uint32_t index = uint32_t((current_tick_ >> (level * kLevelBits)) &
+                            (kSlotsPerLevel - 1));
+  Timer* timer = slots_[level][index];
+  slots_[level][index] = nullptr;
+  while (timer) {
+    Timer* next = timer->next;
+    Insert(timer);
+    timer = next;
+  }
+  // The levels above only wrap together with this one, after it's emptied
+  // so that what they move down never lands in the slot just cascaded.
+  if (!index && level + 1 < kLevelCount) {
+    Cascade(level + 1);
+  }
+}
+
+uint64_t TimerWheel::NextWakeTick() const {
+  if (timers_.empty()) {
+    return UINT64_MAX;
+  }
+  uint64_t tick = current_tick_;
+  do {
+    ++tick;
+    if (slots_[0][tick & (kSlotsPerLevel - 1)]) {
+      return tick;
+    }
+  } while (tick & (kSlotsPerLevel - 1));
+  return tick;
+}
+
+void TimerWheel::ThreadMain() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (thread_running_) {
+    uint64_t wake_tick = NextWakeTick();
+    if (wake_tick == UINT64_MAX) {
+      wake_cond_.wait(lock);
+    } else {
+      wake_cond_.wait_until(lock, ToTime(wake_tick));
+    }
+    if (!thread_running_) {
+      break;
+    }
+    lock.unlock();
+    AdvanceTo(clock::now());
+    lock.lock();
+  }
+}
+
+}  // namespace xe
@@ -0,0 +1,126 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_BASE_TIMER_WHEEL_H_
+#define XENIA_BASE_TIMER_WHEEL_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+
+// Hierarchical timer wheel: drives any number of timers from a single thread
+// instead of a host timer object each. Time is counted in ticks, and all the
+// timers expiring within the same tick fire together in one wakeup, so the
+// tick length is also how close expirations must be to be coalesced.
+//
+// Timers are kept in four levels of 256 slots, each slot of a level spanning a
+// whole level below it. Scheduling and canceling take constant time, and
+// timers far in the future are moved down a level every time the one below
+// wraps around. The thread only wakes for due timers and those wraps.
+class TimerWheel {
+ public:
+  typedef std::chrono::steady_clock clock;
+  // Identifies a scheduled timer, never 0.
+  typedef uint64_t TimerId;
+
+  explicit TimerWheel(
+      std::chrono::microseconds tick_duration = std::chrono::milliseconds(1));
+  ~TimerWheel();
+
+  clock::time_point start_time() const { return start_time_; }
+  std::chrono::microseconds tick_duration() const { return tick_duration_; }
+
+  // Starts the thread firing the timers. Without it, AdvanceTo does.
+  void Start();
+  // Stops the thread. Timers still scheduled stay scheduled.
+  void Shutdown();
+
+  // Calls the callback at the due time (rounded up to a tick), then every
+  // period if it's nonzero. Due times that have passed fire on the next tick.
+  TimerId Schedule(clock::time_point due_time,
+                   std::chrono::microseconds period,
+                   std::function<void()> callback);
+  // Stops the timer. Once this returns its callback isn't running (unless
+  // called from it) and won't be called again. Returns false if the timer was
+  // no longer scheduled.
+  bool Cancel(TimerId id);
+
+  // Fires everything due by the given time, from the calling thread. Cancel
+  // only waits for the callback of the timer it stops, so callbacks may take
+  // locks held around Cancel of other timers.
+  void AdvanceTo(clock::time_point now);
+
+  // Number of scheduled timers.
+  size_t timer_count();
+
+ private:
+  static const uint32_t kLevelBits = 8;
+  static const uint32_t kSlotsPerLevel = 1 << kLevelBits;
+  static const uint32_t kLevelCount = 4;
+
+  struct Timer {
+    TimerId id;
+    uint64_t expiry_tick;
+    uint64_t period_ticks;
+    std::function<void()> callback;
+    Timer* previous;
+    Timer* next;
+    Timer** slot;
+  };
+
+  uint64_t ToTick(clock::time_point time, bool round_up) const;
+  clock::time_point ToTime(uint64_t tick) const;
+
+  // Called with the state mutex held.
+  void Insert(Timer* timer);
+  void Unlink(Timer* timer);
+  void Cascade(uint32_t level);
+  // Returns the next tick the thread must wake at: one with timers in the
+  // lowest level, or the next wrap.
+  uint64_t NextWakeTick() const;
+
+  void ThreadMain();
+
+  clock::time_point start_time_;
+  std::chrono::microseconds tick_duration_;
+
+  // Serializes AdvanceTo callers.
+  std::mutex advance_mutex_;
+  // Guards everything below.
+  std::mutex mutex_;
+  std::condition_variable wake_cond_;
+  // Expired timers' callbacks not yet called, and the one being called.
+  std::deque<std::pair<TimerId, std::function<void()>>> firing_;
+  TimerId running_timer_ = 0;
+  std::thread::id running_thread_;
+  std::condition_variable callback_cond_;
+  // All ticks up to this one have been processed.
+  uint64_t current_tick_ = 0;
+  TimerId next_id_ = 1;
+  std::unordered_map<TimerId, std::unique_ptr<Timer>> timers_;
+  Timer* slots_[kLevelCount][kSlotsPerLevel] = {};
+
+  std::unique_ptr<xe::threading::Thread> thread_;
+  bool thread_running_ = false;
+};
+
+}  // namespace xe
+
+#endif  // XENIA_BASE_TIMER_WHEEL_H_
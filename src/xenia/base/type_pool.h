@@ -10,48 +10,75 @@
 #ifndef XENIA_BASE_TYPE_POOL_H_
 #define XENIA_BASE_TYPE_POOL_H_
 
-#include <mutex>
-#include <vector>
+#include <atomic>
+#include <cstddef>
 
 namespace xe {
 
+// Keeps up to kSlotCount released values for reuse, in slots taken and filled
+// with atomic exchanges so that threads allocating and releasing at the same
+// time never wait for each other. Values released when every slot is full are
+// deleted.
 template <class T, typename A>
 class TypePool {
  public:
+  static const size_t kSlotCount = 64;
+
+  TypePool() {
+    for (auto& slot : slots_) {
+      slot.store(nullptr, std::memory_order_relaxed);
+    }
+  }
   ~TypePool() { Reset(); }
 
+  // Values created, and allocations that reused a released one instead.
+  size_t allocated_count() const {
+    return allocated_count_.load(std::memory_order_relaxed);
+  }
+  size_t reused_count() const {
+    return reused_count_.load(std::memory_order_relaxed);
+  }
+
   void Reset() {
-    std::lock_guard<std::mutex> guard(lock_);
-    for (auto it = list_.begin(); it != list_.end(); ++it) {
-      T* value = *it;
-      delete value;
+    for (auto& slot : slots_) {
+      delete slot.exchange(nullptr, std::memory_order_acquire);
     }
-    list_.clear();
   }
 
   T* Allocate(A arg0) {
-    T* result = 0;
-    {
-      std::lock_guard<std::mutex> guard(lock_);
-      if (list_.size()) {
-        result = list_.back();
-        list_.pop_back();
+    for (auto& slot : slots_) {
+      if (!slot.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      T* result = slot.exchange(nullptr, std::memory_order_acquire);
+      if (result) {
+        reused_count_.fetch_add(1, std::memory_order_relaxed);
+        return result;
       }
     }
-    if (!result) {
-      result = new T(arg0);
-    }
-    return result;
+    allocated_count_.fetch_add(1, std::memory_order_relaxed);
+    return new T(arg0);
   }
 
   void Release(T* value) {
-    std::lock_guard<std::mutex> guard(lock_);
-    list_.push_back(value);
+    for (auto& slot : slots_) {
+      if (slot.load(std::memory_order_relaxed)) {
+        continue;
+      }
+      T* expected = nullptr;
+      if (slot.compare_exchange_strong(expected, value,
+                                       std::memory_order_release,
+                                       std::memory_order_relaxed)) {
+        return;
+      }
+    }
+    delete value;
   }
 
  private:
-  std::mutex lock_;
-  std::vector<T*> list_;
+  std::atomic<T*> slots_[kSlotCount];
+  std::atomic<size_t> allocated_count_ = {0};
+  std::atomic<size_t> reused_count_ = {0};
 };
 
 }  // namespace xe
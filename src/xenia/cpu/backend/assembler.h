@@ -13,6 +13,7 @@
 #include <memory>
 
 namespace xe {
+class StringBuffer;
 namespace cpu {
 class FunctionDebugInfo;
 class GuestFunction;
@@ -41,6 +42,10 @@ class Assembler {
                         uint32_t debug_info_flags,
                         std::unique_ptr<FunctionDebugInfo> debug_info) = 0;
 
+  // Disassembles the current machine code of the function, annotated with
+  // the guest addresses of its source map.
+  virtual void DumpMachineCode(GuestFunction* function, StringBuffer* str) = 0;
+
  protected:
   Backend* backend_;
 };
@@ -11,6 +11,7 @@
 #define XENIA_CPU_BACKEND_BACKEND_H_
 
 #include <memory>
+#include <string>
 
 #include "xenia/cpu/backend/machine_info.h"
 #include "xenia/cpu/thread_debug_info.h"
@@ -51,6 +52,23 @@ class Backend {
 
   virtual std::unique_ptr<Assembler> CreateAssembler() = 0;
 
+  // Opens the on-disk cache of generated code for the given module, if the
+  // backend supports it. Restored code replaces translation of functions.
+  virtual bool OpenPersistentCache(const std::wstring& root_path,
+                                   uint64_t module_hash) {
+    return false;
+  }
+  // Sets up the function from the persistent cache, if it has an up-to-date
+  // copy. Returns false if the function must be translated.
+  virtual bool RestorePersistentFunction(GuestFunction* function) {
+    return false;
+  }
+
+  // Stops the current machine code of the function from being entered through
+  // the indirection table or patched call sites. Code that is already running
+  // is unaffected.
+  virtual void InvalidateFunction(GuestFunction* function) {}
+
   virtual std::unique_ptr<GuestFunction> CreateGuestFunction(
       Module* module, uint32_t address) = 0;
 
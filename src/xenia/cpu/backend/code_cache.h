@@ -33,6 +33,13 @@ class CodeCache {
 
   // Finds platform-specific function unwind info for the given host PC.
   virtual void* LookupUnwindInfo(uint64_t host_pc) = 0;
+
+  // Steps out of the guest function frame at the given host PC and stack
+  // pointer to its caller's, from what the backend knows of the frames it
+  // generates, without going through the platform unwinder. Returns false,
+  // leaving them untouched, if the PC isn't in guest code or the caller
+  // can't be told for sure.
+  virtual bool UnwindGuestFrame(uint64_t* host_pc, uint64_t* host_sp) = 0;
 };
 
 }  // namespace backend
@@ -78,14 +78,14 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   void* machine_code = nullptr;
   size_t code_size = 0;
   if (!emitter_->Emit(function, builder, debug_info_flags, debug_info.get(),
-                      &machine_code, &code_size, &function->source_map())) {
+                      &machine_code, &code_size, &source_map_)) {
     return false;
   }
+  function->set_source_map(source_map_);
 
   // Stash generated machine code.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) {
-    DumpMachineCode(machine_code, code_size, function->source_map(),
-                    &string_buffer_);
+    DumpMachineCode(machine_code, code_size, source_map_, &string_buffer_);
     debug_info->set_machine_code_disasm(string_buffer_.ToString());
     string_buffer_.Reset();
   }
@@ -94,6 +94,18 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   static_cast<X64Function*>(function)->Setup(
       reinterpret_cast<uint8_t*>(machine_code), code_size);
 
+  // Probes are only compiled in for the session.
+  auto code_cache = x64_backend_->code_cache();
+  if (code_cache->is_persisting() && emitter_->is_persistable() &&
+      !backend_->processor()->HasProbesInRange(function->address(),
+                                               function->end_address())) {
+    code_cache->RecordPersistentFunction(
+        function,
+        backend_->processor()->memory()->TranslateVirtual(function->address()),
+        machine_code, code_size, emitter_->stack_size(),
+        emitter_->host_relocations());
+  }
+
   // Install into indirection table.
   uint64_t host_address = reinterpret_cast<uint64_t>(machine_code);
   assert_true((host_address >> 32) == 0);
@@ -104,6 +116,12 @@ bool X64Assembler::Assemble(GuestFunction* function, HIRBuilder* builder,
   return true;
 }
 
+void X64Assembler::DumpMachineCode(GuestFunction* function,
+                                   StringBuffer* str) {
+  DumpMachineCode(function->machine_code(), function->machine_code_length(),
+                  function->source_map().ToVector(), str);
+}
+
 void X64Assembler::DumpMachineCode(
     void* machine_code, size_t code_size,
     const std::vector<SourceMapEntry>& source_map, StringBuffer* str) {
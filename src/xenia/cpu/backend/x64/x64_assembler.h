@@ -39,6 +39,8 @@ class X64Assembler : public Assembler {
                 uint32_t debug_info_flags,
                 std::unique_ptr<FunctionDebugInfo> debug_info) override;
 
+  void DumpMachineCode(GuestFunction* function, StringBuffer* str) override;
+
  private:
   void DumpMachineCode(void* machine_code, size_t code_size,
                        const std::vector<SourceMapEntry>& source_map,
@@ -51,6 +53,9 @@ class X64Assembler : public Assembler {
   uintptr_t capstone_handle_;
 
   StringBuffer string_buffer_;
+  // Scratch for the source map of the function being assembled, before it is
+  // compacted into the function.
+  std::vector<SourceMapEntry> source_map_;
 };
 
 }  // namespace x64
@@ -25,10 +25,21 @@
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/stack_walker.h"
+#include "xenia/cpu/thread_state.h"
 
 DEFINE_bool(
     enable_haswell_instructions, true,
     "Uses the AVX2/FMA/etc instructions on Haswell processors, if available.");
+DEFINE_bool(enable_avx512_instructions, true,
+            "Uses AVX-512 (F/BW/VL/VBMI) lowerings for vector ops, if "
+            "available.");
+DEFINE_int32(x64_extension_mask, -1,
+             "Mask of X64EmitterFeatureFlags the emitter may use, on top of "
+             "what the host supports. For testing the fallback lowerings.");
+DEFINE_bool(emit_mmio_range_check, false,
+            "Check 32-bit loads and stores from non-constant addresses against "
+            "the MMIO window inline, calling the MMIO callbacks directly "
+            "instead of going through the access violation handler.");
 
 namespace xe {
 namespace cpu {
@@ -42,6 +53,7 @@ class X64ThunkEmitter : public X64Emitter {
   HostToGuestThunk EmitHostToGuestThunk();
   GuestToHostThunk EmitGuestToHostThunk();
   ResolveFunctionThunk EmitResolveFunctionThunk();
+  IndirectCallThunk EmitIndirectCallThunk();
 
  private:
   // The following four functions provide save/load functionality for registers.
@@ -63,6 +75,16 @@ X64Backend::X64Backend() : Backend(), code_cache_(nullptr) {
 }
 
 X64Backend::~X64Backend() {
+  if (critical_section_slow_path_count_) {
+    XELOGI("Inlined critical sections took the kernel path %llu times",
+           static_cast<unsigned long long>(critical_section_slow_path_count_));
+  }
+  if (elided_rounding_mode_switch_count_) {
+    XELOGI("Elided %llu redundant rounding mode switches",
+           static_cast<unsigned long long>(
+               elided_rounding_mode_switch_count_.load()));
+  }
+
   if (capstone_handle_) {
     cs_close(&capstone_handle_);
   }
@@ -83,7 +105,8 @@ bool X64Backend::Initialize(Processor* processor) {
   }
 
   // Need movbe to do advanced LOAD/STORE tricks.
-  if (FLAGS_enable_haswell_instructions) {
+  if (FLAGS_enable_haswell_instructions &&
+      (FLAGS_x64_extension_mask & kX64EmitMovbe)) {
     machine_info_.supports_extended_load_store =
         cpu.has(Xbyak::util::Cpu::tMOVBE);
   } else {
@@ -115,12 +138,17 @@ bool X64Backend::Initialize(Processor* processor) {
   host_to_guest_thunk_ = thunk_emitter.EmitHostToGuestThunk();
   guest_to_host_thunk_ = thunk_emitter.EmitGuestToHostThunk();
   resolve_function_thunk_ = thunk_emitter.EmitResolveFunctionThunk();
+  indirect_call_thunk_ = thunk_emitter.EmitIndirectCallThunk();
+  emitter_feature_flags_ = thunk_emitter.feature_flags();
 
   // Set the code cache to use the ResolveFunction thunk for default
   // indirections.
   assert_zero(uint64_t(resolve_function_thunk_) & 0xFFFFFFFF00000000ull);
   code_cache_->set_indirection_default(
       uint32_t(uint64_t(resolve_function_thunk_)));
+  assert_zero(uint64_t(indirect_call_thunk_) & 0xFFFFFFFF00000000ull);
+  code_cache_->set_call_site_default(
+      reinterpret_cast<uint8_t*>(indirect_call_thunk_));
 
   // Allocate some special indirections.
   code_cache_->CommitExecutableRange(0x9FFF0000, 0x9FFFFFFF);
@@ -139,6 +167,23 @@ void X64Backend::CommitExecutableRange(uint32_t guest_low,
   code_cache_->CommitExecutableRange(guest_low, guest_high);
 }
 
+bool X64Backend::OpenPersistentCache(const std::wstring& root_path,
+                                     uint64_t module_hash) {
+  return code_cache_->OpenPersistentCache(root_path, module_hash,
+                                          emitter_feature_flags_,
+                                          emitter_data_);
+}
+
+bool X64Backend::RestorePersistentFunction(GuestFunction* function) {
+  return code_cache_->RestorePersistentFunction(function,
+                                                processor_->memory());
+}
+
+void X64Backend::InvalidateFunction(GuestFunction* function) {
+  // Calls resolve the function again, which retranslates it.
+  code_cache_->RemoveIndirection(function->address());
+}
+
 std::unique_ptr<Assembler> X64Backend::CreateAssembler() {
   return std::make_unique<X64Assembler>(this);
 }
@@ -392,8 +437,23 @@ bool X64Backend::ExceptionCallback(Exception* ex) {
     return false;
   }
 
+  // Compiled probe breaks leave the id of the probe in the context.
+  auto marker_ptr = reinterpret_cast<const uint8_t*>(ex->pc() + 2);
+  uint32_t probe_id = 0;
+  if (marker_ptr[0] == 0x0F && marker_ptr[1] == 0x1F && marker_ptr[2] == 0x80 &&
+      xe::load<uint32_t>(marker_ptr + 3) == kProbeBreakMarker) {
+    probe_id = uint32_t(ThreadState::Get()->context()->scratch);
+  }
+
   // Let the processor handle things.
-  return processor()->OnThreadBreakpointHit(ex);
+  uint64_t trap_pc = ex->pc();
+  if (!processor()->OnThreadBreakpointHit(ex, probe_id)) {
+    return false;
+  }
+  if (probe_id && ex->pc() == trap_pc) {
+    ex->set_resume_pc(trap_pc + 2);
+  }
+  return true;
 }
 
 X64ThunkEmitter::X64ThunkEmitter(X64Backend* backend, XbyakAllocator* allocator)
@@ -487,6 +547,18 @@ ResolveFunctionThunk X64ThunkEmitter::EmitResolveFunctionThunk() {
   return (ResolveFunctionThunk)fn;
 }
 
+IndirectCallThunk X64ThunkEmitter::EmitIndirectCallThunk() {
+  // ebx = target PPC address
+  // rcx = return address, passed through untouched
+  // Unpatched direct call sites land here and take the same path as an
+  // indirection table call would have.
+  mov(eax, dword[ebx]);
+  jmp(rax);
+
+  void* fn = Emplace(0);
+  return (IndirectCallThunk)fn;
+}
+
 void X64ThunkEmitter::EmitSaveVolatileRegs() {
   // Save off volatile registers.
   // mov(qword[rsp + offsetof(StackLayout::Thunk, r[0])], rax);
@@ -12,11 +12,15 @@
 
 #include <gflags/gflags.h>
 
+#include <atomic>
 #include <memory>
 
 #include "xenia/cpu/backend/backend.h"
 
 DECLARE_bool(enable_haswell_instructions);
+DECLARE_bool(enable_avx512_instructions);
+DECLARE_int32(x64_extension_mask);
+DECLARE_bool(emit_mmio_range_check);
 
 namespace xe {
 class Exception;
@@ -33,10 +37,14 @@ class X64CodeCache;
 typedef void* (*HostToGuestThunk)(void* target, void* arg0, void* arg1);
 typedef void* (*GuestToHostThunk)(void* target, void* arg0, void* arg1);
 typedef void (*ResolveFunctionThunk)();
+typedef void (*IndirectCallThunk)();
 
 class X64Backend : public Backend {
  public:
   static const uint32_t kForceReturnAddress = 0x9FFF0000u;
+  // Displacement of the nop following the ud2 of compiled probe breaks,
+  // telling them from the ones patched in by breakpoints.
+  static const uint32_t kProbeBreakMarker = 0x42525058u;
 
   explicit X64Backend();
   ~X64Backend() override;
@@ -52,6 +60,9 @@ class X64Backend : public Backend {
   ResolveFunctionThunk resolve_function_thunk() const {
     return resolve_function_thunk_;
   }
+  // Function that jumps through the indirection table entry for the guest
+  // address in ebx. Direct call sites target this until patched.
+  IndirectCallThunk indirect_call_thunk() const { return indirect_call_thunk_; }
 
   bool Initialize(Processor* processor) override;
 
@@ -59,12 +70,35 @@ class X64Backend : public Backend {
 
   std::unique_ptr<Assembler> CreateAssembler() override;
 
+  bool OpenPersistentCache(const std::wstring& root_path,
+                           uint64_t module_hash) override;
+  bool RestorePersistentFunction(GuestFunction* function) override;
+  void InvalidateFunction(GuestFunction* function) override;
+
   std::unique_ptr<GuestFunction> CreateGuestFunction(Module* module,
                                                      uint32_t address) override;
 
   uint64_t CalculateNextHostInstruction(ThreadDebugInfo* thread_info,
                                         uint64_t current_pc) override;
 
+  // Number of times inlined critical section enters/leaves fell back to the
+  // kernel because the lock was contended or held recursively.
+  uint64_t critical_section_slow_path_count() const {
+    return critical_section_slow_path_count_;
+  }
+  uint64_t* critical_section_slow_path_count_ptr() {
+    return &critical_section_slow_path_count_;
+  }
+
+  // Number of guest rounding mode changes dropped at compile time because the
+  // host was already known to be in the requested mode.
+  uint64_t elided_rounding_mode_switch_count() const {
+    return elided_rounding_mode_switch_count_;
+  }
+  void CountElidedRoundingModeSwitch() {
+    ++elided_rounding_mode_switch_count_;
+  }
+
   void InstallBreakpoint(Breakpoint* breakpoint) override;
   void InstallBreakpoint(Breakpoint* breakpoint, Function* fn) override;
   void UninstallBreakpoint(Breakpoint* breakpoint) override;
@@ -77,10 +111,16 @@ class X64Backend : public Backend {
 
   std::unique_ptr<X64CodeCache> code_cache_;
   uintptr_t emitter_data_ = 0;
+  uint32_t emitter_feature_flags_ = 0;
 
   HostToGuestThunk host_to_guest_thunk_;
   GuestToHostThunk guest_to_host_thunk_;
   ResolveFunctionThunk resolve_function_thunk_;
+  IndirectCallThunk indirect_call_thunk_;
+
+  // Incremented by generated code.
+  uint64_t critical_section_slow_path_count_ = 0;
+  std::atomic<uint64_t> elided_rounding_mode_switch_count_ = {0};
 };
 
 }  // namespace x64
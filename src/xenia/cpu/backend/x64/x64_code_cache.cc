@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/backend/x64/x64_code_cache.h"
 
+#include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <cstring>
 
@@ -17,11 +19,18 @@
 #pragma comment(lib, "../third_party/vtune/lib64/jitprofiling.lib")
 #endif
 
+#include "build/version.h"
+#include "third_party/xxhash/xxhash.h"
 #include "xenia/base/assert.h"
 #include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/x64/x64_function.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/module.h"
 
@@ -30,9 +39,72 @@ namespace cpu {
 namespace backend {
 namespace x64 {
 
-X64CodeCache::X64CodeCache() = default;
+// File layout of the persistent cache:
+//   PersistentCacheHeader
+//   PersistentFunctionHeader, machine code, source map, relocations
+//   ... repeated function_count times.
+// Everything that affects the validity of the stored machine code is in the
+// header and must match exactly, otherwise the file is discarded.
+static const uint32_t kPersistentCacheMagic = 'XJCC';
+static const uint32_t kPersistentCacheVersion = 1;
+
+struct PersistentCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  char build_commit_sha[40];
+  uint64_t module_hash;
+  uint32_t feature_flags;
+  uint32_t function_count;
+  // Size of the host thunks placed ahead of all guest code. Code calls these
+  // by absolute address.
+  uint64_t host_code_size;
+  uint64_t emitter_data;
+  // Distance between two host functions in different libraries. Catches
+  // rebuilds that keep the commit but move code around.
+  int64_t host_image_fingerprint;
+};
+
+struct PersistentFunctionHeader {
+  uint32_t guest_address;
+  uint32_t guest_end_address;
+  uint64_t guest_code_hash;
+  uint32_t stack_size;
+  uint32_t code_size;
+  uint32_t source_map_count;
+  uint32_t relocation_count;
+};
+
+// All host relocations are relative to this, which moves with the rest of the
+// host image under ASLR.
+static uintptr_t HostImageAnchor() {
+  return reinterpret_cast<uintptr_t>(&HostImageAnchor);
+}
+
+static int64_t HostImageFingerprint() {
+  return X64CodeCache::HostImageOffset(
+      reinterpret_cast<const void*>(&xe::memory::AllocFixed));
+}
+
+static uint64_t HashGuestCode(const uint8_t* guest_code, uint32_t address,
+                              uint32_t end_address) {
+  // end_address is the address of the last instruction.
+  return XXH64(guest_code, end_address - address + 4, 0);
+}
+
+// The slab each thread is placing code into, tagged with the cache it
+// belongs to.
+struct ThreadCodeSlab {
+  uint64_t cache_id;
+  void* slab;
+};
+static thread_local ThreadCodeSlab thread_code_slab_ = {0, nullptr};
+static std::atomic<uint64_t> next_code_cache_id_ = {1};
+
+X64CodeCache::X64CodeCache() : instance_id_(next_code_cache_id_++) {}
 
 X64CodeCache::~X64CodeCache() {
+  FlushPersistentCache();
+
   if (indirection_table_base_) {
     xe::memory::DeallocFixed(indirection_table_base_, 0,
                              xe::memory::DeallocationType::kRelease);
@@ -40,8 +112,13 @@ X64CodeCache::~X64CodeCache() {
 
   // Unmap all views and close mapping.
   if (mapping_) {
+    // Large page views must be unmapped in whole pages.
+    size_t generated_code_length =
+        large_pages_ ? xe::round_up(size_t(kGeneratedCodeSize),
+                                    xe::memory::large_page_size())
+                     : size_t(kGeneratedCodeSize);
     xe::memory::UnmapFileView(mapping_, generated_code_base_,
-                              kGeneratedCodeSize);
+                              generated_code_length);
     xe::memory::CloseFileMappingHandle(mapping_);
     mapping_ = nullptr;
   }
@@ -63,6 +140,9 @@ bool X64CodeCache::Initialize() {
   // Create mmap file. This allows us to share the code cache with the debugger.
   file_name_ = std::wstring(L"Local\\xenia_code_cache_") +
                std::to_wstring(Clock::QueryHostTickCount());
+  if (FLAGS_code_cache_large_pages && InitializeLargePages()) {
+    return true;
+  }
   mapping_ = xe::memory::CreateFileMappingHandle(
       file_name_, kGeneratedCodeSize, xe::memory::PageAccess::kExecuteReadWrite,
       false);
@@ -84,9 +164,32 @@ bool X64CodeCache::Initialize() {
     return false;
   }
 
-  // Preallocate the function map to a large, reasonable size.
-  generated_code_map_.reserve(kMaximumFunctionCount);
+  return true;
+}
 
+bool X64CodeCache::InitializeLargePages() {
+  mapping_ = xe::memory::CreateLargePageFileMappingHandle(
+      file_name_, kGeneratedCodeSize,
+      xe::memory::PageAccess::kExecuteReadWrite);
+  if (mapping_) {
+    generated_code_base_ = reinterpret_cast<uint8_t*>(
+        xe::memory::MapLargePageFileView(
+            mapping_, reinterpret_cast<void*>(kGeneratedCodeBase),
+            kGeneratedCodeSize, xe::memory::PageAccess::kExecuteReadWrite, 0));
+    if (!generated_code_base_) {
+      xe::memory::CloseFileMappingHandle(mapping_);
+      mapping_ = nullptr;
+    }
+  }
+  if (!mapping_) {
+    XELOGW(
+        "Large pages for the code cache are unavailable, using regular pages");
+    return false;
+  }
+  large_pages_ = true;
+  XELOGI("Mapped %uMB of generated code storage with %uKB large pages",
+         uint32_t((kGeneratedCodeSize + 1) >> 20),
+         uint32_t(xe::memory::large_page_size() >> 10));
   return true;
 }
 
@@ -100,9 +203,89 @@ void X64CodeCache::AddIndirection(uint32_t guest_address,
     return;
   }
 
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
   uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
       indirection_table_base_ + (guest_address - kIndirectionTableBase));
   *indirection_slot = host_address;
+
+  auto it = call_sites_.find(guest_address);
+  if (it != call_sites_.end()) {
+    auto target = reinterpret_cast<uint8_t*>(uint64_t(host_address));
+    for (auto displacement : it->second) {
+      PatchCallSite(displacement, target);
+    }
+  }
+}
+
+void X64CodeCache::RemoveIndirection(uint32_t guest_address) {
+  if (!indirection_table_base_) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
+  uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  *indirection_slot = indirection_default_value_;
+
+  auto it = call_sites_.find(guest_address);
+  if (it != call_sites_.end()) {
+    for (auto displacement : it->second) {
+      PatchCallSite(displacement, call_site_default_target_);
+    }
+  }
+}
+
+void X64CodeCache::AddCallSites(uint32_t guest_address,
+                                uint8_t* const* displacements, size_t count) {
+  if (!count) {
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
+  auto& sites = call_sites_[guest_address];
+  sites.insert(sites.end(), displacements, displacements + count);
+
+  // The target may have been placed (or replaced) between emitting the sites
+  // and getting here, so bring them all up to date.
+  for (size_t i = 0; i < count; ++i) {
+    PatchCallSiteToCurrent(guest_address, displacements[i]);
+  }
+}
+
+void X64CodeCache::FillInlineCache(uint32_t* guest_field,
+                                   uint8_t* displacement,
+                                   uint32_t guest_address) {
+  assert_zero(uintptr_t(guest_field) & 0x3);
+
+  // Threads may race to fill the same site, first one wins.
+  std::lock_guard<std::mutex> lock(call_site_mutex_);
+  if (*guest_field != kInlineCacheEmpty) {
+    return;
+  }
+  call_sites_[guest_address].push_back(displacement);
+  PatchCallSiteToCurrent(guest_address, displacement);
+  // Must be stored after the displacement, as it is what makes the site
+  // reachable.
+  *reinterpret_cast<volatile uint32_t*>(guest_field) = guest_address;
+}
+
+void X64CodeCache::PatchCallSiteToCurrent(uint32_t guest_address,
+                                          uint8_t* displacement) {
+  uint32_t host_address = *reinterpret_cast<uint32_t*>(
+      indirection_table_base_ + (guest_address - kIndirectionTableBase));
+  auto target = host_address == indirection_default_value_
+                    ? call_site_default_target_
+                    : reinterpret_cast<uint8_t*>(uint64_t(host_address));
+  PatchCallSite(displacement, target);
+}
+
+void X64CodeCache::PatchCallSite(uint8_t* displacement, uint8_t* target) {
+  // Displacements are 4b aligned, so this single store is atomic with respect
+  // to other threads executing the instruction.
+  assert_zero(uintptr_t(displacement) & 0x3);
+  int64_t delta = target - (displacement + 4);
+  assert_true(delta >= INT32_MIN && delta <= INT32_MAX);
+  *reinterpret_cast<volatile int32_t*>(displacement) = int32_t(delta);
 }
 
 void X64CodeCache::CommitExecutableRange(uint32_t guest_low,
@@ -132,72 +315,86 @@ void* X64CodeCache::PlaceHostCode(uint32_t guest_address, void* machine_code,
                         nullptr);
 }
 
-void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
-                                   size_t code_size, size_t stack_size,
-                                   GuestFunction* function_info) {
-  // Hold a lock while we bump the pointers up. This is important as the
-  // unwind table requires entries AND code to be sorted in order.
-  size_t low_mark;
-  size_t high_mark;
-  uint8_t* code_address = nullptr;
-  UnwindReservation unwind_reservation;
+X64CodeCache::CodeSlab* X64CodeCache::AcquireSlab(size_t size) {
+  if (thread_code_slab_.cache_id == instance_id_) {
+    auto slab = reinterpret_cast<CodeSlab*>(thread_code_slab_.slab);
+    if (size <= slab->offset_end - slab->offset) {
+      return slab;
+    }
+  }
+
+  // Whatever is left in the old slab is abandoned. Oversized code gets a slab
+  // of its own.
+  size_t slab_size = xe::round_up(std::max(size, kCodeSlabSize), kCodeSlabSize);
+  CodeSlab* slab;
   {
     auto global_lock = global_critical_region_.Acquire();
-
-    low_mark = generated_code_offset_;
-
-    // Reserve code.
-    // Always move the code to land on 16b alignment.
-    code_address = generated_code_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(code_size, 16);
-
-    // Reserve unwind info.
-    // We go on the high size of the unwind info as we don't know how big we
-    // need it, and a few extra bytes of padding isn't the worst thing.
-    unwind_reservation =
-        RequestUnwindReservation(generated_code_base_ + generated_code_offset_);
-    generated_code_offset_ += unwind_reservation.data_size;
-
-    high_mark = generated_code_offset_;
-
-    // Store in map. It is maintained in sorted order of host PC dependent on
-    // us also being append-only.
-    generated_code_map_.emplace_back(
-        (uint64_t(code_address - generated_code_base_) << 32) |
-            generated_code_offset_,
-        function_info);
-
-    // TODO(DrChat): The following code doesn't really need to be under the
-    // global lock except for PlaceCode (but it depends on the previous code
-    // already being ran)
-
-    // If we are going above the high water mark of committed memory, commit
-    // some more. It's ok if multiple threads do this, as redundant commits
-    // aren't harmful.
-    size_t old_commit_mark, new_commit_mark;
-    do {
-      old_commit_mark = generated_code_commit_mark_;
-      if (high_mark <= old_commit_mark) break;
-
-      new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
-      xe::memory::AllocFixed(generated_code_base_, new_commit_mark,
+    size_t offset = xe::round_up(generated_code_offset_, kCodeSlabSize);
+    assert_true(offset + slab_size <= kGeneratedCodeSize);
+    generated_code_offset_ = offset + slab_size;
+    generated_code_usage_.Set(generated_code_offset_);
+
+    // Large pages are all committed up front.
+    if (!large_pages_) {
+      xe::memory::AllocFixed(generated_code_base_ + offset, slab_size,
                              xe::memory::AllocationType::kCommit,
                              xe::memory::PageAccess::kExecuteReadWrite);
-    } while (generated_code_commit_mark_.compare_exchange_weak(
-        old_commit_mark, new_commit_mark));
+    }
+    for (size_t leaf_offset = offset; leaf_offset < offset + slab_size;
+         leaf_offset += kCodeSlabSize) {
+      code_map_[leaf_offset >> kCodeMapLeafShift].reset(
+          new std::atomic<CodeMapEntry*>[kCodeMapLeafPageCount]());
+    }
 
-    // Copy code.
-    std::memcpy(code_address, machine_code, code_size);
+    code_slabs_.emplace_back(new CodeSlab());
+    slab = code_slabs_.back().get();
+    slab->offset_start = offset;
+    slab->offset_end = offset + slab_size;
+    slab->offset = offset;
+    slab->unwind_table = CreateUnwindTable(slab);
+  }
+  thread_code_slab_ = {instance_id_, slab};
+  return slab;
+}
 
-    // Fill unused slots with 0xCC
-    std::memset(
-        code_address + code_size, 0xCC,
-        xe::round_up(code_size + unwind_reservation.data_size, 16) - code_size);
+void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
+                                   size_t code_size, size_t stack_size,
+                                   GuestFunction* function_info) {
+  // Code is bumped into the calling thread's slab. The unwind table requires
+  // entries AND code to be sorted in order, which holds within a slab.
+  size_t code_reserve_size = xe::round_up(code_size, 16);
+  size_t unwind_data_size = this->unwind_data_size();
+  CodeSlab* slab = AcquireSlab(code_reserve_size + unwind_data_size);
+
+  // Reserve code.
+  // Always move the code to land on 16b alignment.
+  uint8_t* code_address = generated_code_base_ + slab->offset;
+  slab->offset += code_reserve_size;
+
+  // Reserve unwind info.
+  // We go on the high size of the unwind info as we don't know how big we
+  // need it, and a few extra bytes of padding isn't the worst thing.
+  UnwindReservation unwind_reservation =
+      RequestUnwindReservation(slab, generated_code_base_ + slab->offset);
+  assert_true(unwind_reservation.data_size <= unwind_data_size);
+  slab->offset += unwind_data_size;
+
+  // Store in map. It is maintained in sorted order of host PC dependent on
+  // us also being append-only.
+  AddCodeMapEntry(slab, uint32_t(code_address - generated_code_base_),
+                  uint32_t(slab->offset), unwind_reservation.table_slot,
+                  function_info, stack_size);
 
-    // Notify subclasses of placed code.
-    PlaceCode(guest_address, machine_code, code_size, stack_size, code_address,
-              unwind_reservation);
-  }
+  // Copy code.
+  std::memcpy(code_address, machine_code, code_size);
+
+  // Fill unused slots with 0xCC
+  std::memset(code_address + code_size, 0xCC,
+              code_reserve_size + unwind_data_size - code_size);
+
+  // Notify subclasses of placed code.
+  PlaceCode(slab, guest_address, machine_code, code_size, stack_size,
+            code_address, unwind_reservation);
 
 #if ENABLE_VTUNE
   if (iJIT_IsProfilingActive() == iJIT_SAMPLING_ON) {
@@ -220,79 +417,455 @@ void* X64CodeCache::PlaceGuestCode(uint32_t guest_address, void* machine_code,
   }
 #endif
 
-  // Now that everything is ready, fix up the indirection table.
+  // Now that everything is ready, publish it through the indirection table.
+  // The release store orders the code copy before it for other threads.
   // Note that we do support code that doesn't have an indirection fixup, so
   // ignore those when we see them.
   if (guest_address && indirection_table_base_) {
-    uint32_t* indirection_slot = reinterpret_cast<uint32_t*>(
+    auto indirection_slot = reinterpret_cast<std::atomic<uint32_t>*>(
         indirection_table_base_ + (guest_address - kIndirectionTableBase));
-    *indirection_slot = uint32_t(reinterpret_cast<uint64_t>(code_address));
+    indirection_slot->store(uint32_t(reinterpret_cast<uint64_t>(code_address)),
+                            std::memory_order_release);
   }
 
   return code_address;
 }
 
 uint32_t X64CodeCache::PlaceData(const void* data, size_t length) {
-  // Hold a lock while we bump the pointers up.
-  size_t high_mark;
-  uint8_t* data_address = nullptr;
+  // Always move the data to land on 16b alignment.
+  size_t reserve_size = xe::round_up(length, 16);
+  CodeSlab* slab = AcquireSlab(reserve_size);
+  uint8_t* data_address = generated_code_base_ + slab->offset;
+  slab->offset += reserve_size;
+
+  // Copy data.
+  std::memcpy(data_address, data, length);
+
+  return uint32_t(uintptr_t(data_address));
+}
+
+int64_t X64CodeCache::HostImageOffset(const void* host_address) {
+  return int64_t(reinterpret_cast<uintptr_t>(host_address)) -
+         int64_t(HostImageAnchor());
+}
+
+bool X64CodeCache::OpenPersistentCache(const std::wstring& root_path,
+                                       uint64_t module_hash,
+                                       uint32_t feature_flags,
+                                       uintptr_t emitter_data) {
+  std::lock_guard<std::mutex> lock(persistent_mutex_);
+  if (!persistent_cache_path_.empty()) {
+    // Only the first executable module gets a cache.
+    return false;
+  }
+
+  persistent_module_hash_ = module_hash;
+  persistent_feature_flags_ = feature_flags;
+  persistent_emitter_data_ = emitter_data;
   {
     auto global_lock = global_critical_region_.Acquire();
+    persistent_host_code_size_ = generated_code_offset_;
+  }
+  persistent_cache_path_ = xe::join_paths(
+      root_path, xe::format_string(L"%.16llX_%.8X.xjc", module_hash,
+                                   feature_flags));
+  persistent_functions_.clear();
+  persistent_mappings_.clear();
+  persistent_cache_dirty_ = false;
+
+  if (!xe::filesystem::PathExists(persistent_cache_path_)) {
+    XELOGI("Persistent code cache %S not found, starting empty",
+           persistent_cache_path_.c_str());
+    return true;
+  }
+  if (!MapPersistentCache(persistent_cache_path_, &persistent_functions_)) {
+    XELOGW("Persistent code cache %S is stale or corrupt, discarding",
+           persistent_cache_path_.c_str());
+    persistent_functions_.clear();
+    // Rewrite it on exit, even if nothing new is recorded.
+    persistent_cache_dirty_ = true;
+  }
+
+  XELOGI("Loaded %d functions from persistent code cache %S",
+         int(persistent_functions_.size()), persistent_cache_path_.c_str());
+  return true;
+}
 
-    // Reserve code.
-    // Always move the code to land on 16b alignment.
-    data_address = generated_code_base_ + generated_code_offset_;
-    generated_code_offset_ += xe::round_up(length, 16);
+bool X64CodeCache::MapPersistentCache(const std::wstring& path,
+                                      PersistentFunctionMap* functions) {
+  auto mapping = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!mapping) {
+    return false;
+  }
+  PersistentFunctionMap loaded_functions;
+  if (!LoadPersistentCache(mapping->data(), mapping->size(),
+                           &loaded_functions)) {
+    return false;
+  }
+  // Functions already in the map are newer.
+  for (auto& it : loaded_functions) {
+    functions->emplace(it.first, std::move(it.second));
+  }
+  persistent_mappings_.push_back(std::move(mapping));
+  return true;
+}
 
-    high_mark = generated_code_offset_;
+bool X64CodeCache::LoadPersistentCache(const uint8_t* data, size_t size,
+                                       PersistentFunctionMap* functions) {
+  PersistentCacheHeader header;
+  if (size < sizeof(header)) {
+    return false;
+  }
+  std::memcpy(&header, data, sizeof(header));
+  if (header.magic != kPersistentCacheMagic ||
+      header.version != kPersistentCacheVersion ||
+      std::memcmp(header.build_commit_sha, XE_BUILD_COMMIT,
+                  sizeof(header.build_commit_sha)) ||
+      header.module_hash != persistent_module_hash_ ||
+      header.feature_flags != persistent_feature_flags_ ||
+      header.host_code_size != persistent_host_code_size_ ||
+      header.emitter_data != persistent_emitter_data_ ||
+      header.host_image_fingerprint != HostImageFingerprint()) {
+    return false;
   }
 
-  // If we are going above the high water mark of committed memory, commit some
-  // more. It's ok if multiple threads do this, as redundant commits aren't
-  // harmful.
-  size_t old_commit_mark, new_commit_mark;
-  do {
-    old_commit_mark = generated_code_commit_mark_;
-    if (high_mark <= old_commit_mark) break;
+  functions->reserve(header.function_count);
+  size_t offset = sizeof(header);
+  for (uint32_t i = 0; i < header.function_count; ++i) {
+    PersistentFunctionHeader function_header;
+    if (size - offset < sizeof(function_header)) {
+      return false;
+    }
+    std::memcpy(&function_header, data + offset, sizeof(function_header));
+    offset += sizeof(function_header);
+    PersistentFunction function;
+    function.guest_end_address = function_header.guest_end_address;
+    function.guest_code_hash = function_header.guest_code_hash;
+    function.stack_size = function_header.stack_size;
+    function.code_size = function_header.code_size;
+    function.source_map_count = function_header.source_map_count;
+    function.relocation_count = function_header.relocation_count;
+    function.data = data + offset;
+    if (size - offset < function.data_size()) {
+      return false;
+    }
+    for (uint32_t j = 0; j < function.relocation_count; ++j) {
+      HostRelocation relocation;
+      std::memcpy(&relocation,
+                  function.relocation_data() + j * sizeof(HostRelocation),
+                  sizeof(relocation));
+      if (relocation.code_offset + sizeof(uint64_t) > function.code_size) {
+        return false;
+      }
+    }
+    offset += function.data_size();
+    functions->emplace(function_header.guest_address, std::move(function));
+  }
+  return true;
+}
 
-    new_commit_mark = old_commit_mark + 16 * 1024 * 1024;
-    xe::memory::AllocFixed(generated_code_base_, new_commit_mark,
-                           xe::memory::AllocationType::kCommit,
-                           xe::memory::PageAccess::kExecuteReadWrite);
-  } while (generated_code_commit_mark_.compare_exchange_weak(old_commit_mark,
-                                                             new_commit_mark));
+void X64CodeCache::FlushPersistentCache() {
+  std::lock_guard<std::mutex> lock(persistent_mutex_);
+  if (persistent_cache_path_.empty() || !persistent_cache_dirty_) {
+    return;
+  }
 
-  // Copy code.
-  std::memcpy(data_address, data, length);
+  // Instances running the same title take turns, through the lock file, to
+  // merge what they recorded into the cache they all map.
+  xe::filesystem::CreateParentFolder(persistent_cache_path_);
+  auto lock_file =
+      xe::filesystem::OpenFile(persistent_cache_path_ + L".lock", "ab");
+  if (!lock_file || !xe::filesystem::TryLockFile(lock_file)) {
+    XELOGW("Persistent code cache %S is being written by another instance, "
+           "not adding to it",
+           persistent_cache_path_.c_str());
+    if (lock_file) {
+      fclose(lock_file);
+    }
+    return;
+  }
+  // Take in what was added since it was opened. Fails if it's gone or stale,
+  // in which case it's replaced by what this instance has.
+  if (xe::filesystem::PathExists(persistent_cache_path_)) {
+    MapPersistentCache(persistent_cache_path_, &persistent_functions_);
+  }
 
-  return uint32_t(uintptr_t(data_address));
+  // Written aside and moved over the old file, so nothing ever sees it
+  // partially written.
+  auto temp_path = persistent_cache_path_ + L".tmp";
+  auto file = xe::filesystem::OpenFile(temp_path, "wb");
+  bool written = file != nullptr;
+  if (file) {
+    PersistentCacheHeader header = {0};
+    header.magic = kPersistentCacheMagic;
+    header.version = kPersistentCacheVersion;
+    std::memcpy(header.build_commit_sha, XE_BUILD_COMMIT,
+                sizeof(header.build_commit_sha));
+    header.module_hash = persistent_module_hash_;
+    header.feature_flags = persistent_feature_flags_;
+    header.function_count = uint32_t(persistent_functions_.size());
+    header.host_code_size = persistent_host_code_size_;
+    header.emitter_data = persistent_emitter_data_;
+    header.host_image_fingerprint = HostImageFingerprint();
+    written = fwrite(&header, sizeof(header), 1, file) == 1;
+
+    for (const auto& it : persistent_functions_) {
+      const auto& function = it.second;
+      PersistentFunctionHeader function_header;
+      function_header.guest_address = it.first;
+      function_header.guest_end_address = function.guest_end_address;
+      function_header.guest_code_hash = function.guest_code_hash;
+      function_header.stack_size = function.stack_size;
+      function_header.code_size = function.code_size;
+      function_header.source_map_count = function.source_map_count;
+      function_header.relocation_count = function.relocation_count;
+      size_t data_size = function.data_size();
+      written =
+          written &&
+          fwrite(&function_header, sizeof(function_header), 1, file) == 1 &&
+          fwrite(function.data, 1, data_size, file) == data_size;
+    }
+    written = fclose(file) == 0 && written;
+  }
+  if (written) {
+    // Windows doesn't replace a file that's mapped, by this process too, so
+    // the functions are copied out of the mappings until the move is done.
+    for (auto& it : persistent_functions_) {
+      auto& function = it.second;
+      if (function.owned_data.empty()) {
+        function.owned_data.assign(function.data,
+                                   function.data + function.data_size());
+        function.data = function.owned_data.data();
+      }
+    }
+    persistent_mappings_.clear();
+    written = xe::filesystem::RenameFile(temp_path, persistent_cache_path_);
+  }
+  if (!written) {
+    XELOGE("Unable to write persistent code cache %S",
+           persistent_cache_path_.c_str());
+    xe::filesystem::DeleteFile(temp_path);
+    fclose(lock_file);
+    return;
+  }
+
+  persistent_cache_dirty_ = false;
+  XELOGI("Wrote %d functions to persistent code cache %S",
+         int(persistent_functions_.size()), persistent_cache_path_.c_str());
+
+  // Back to sharing the pages with the other instances.
+  PersistentFunctionMap mapped_functions;
+  if (MapPersistentCache(persistent_cache_path_, &mapped_functions)) {
+    persistent_functions_ = std::move(mapped_functions);
+  }
+  fclose(lock_file);
 }
 
-GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
-  uint32_t key = uint32_t(host_pc - kGeneratedCodeBase);
-  void* fn_entry = std::bsearch(
-      &key, generated_code_map_.data(), generated_code_map_.size() + 1,
-      sizeof(std::pair<uint32_t, Function*>),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key = *reinterpret_cast<const uint32_t*>(key_ptr);
-        auto element =
-            reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-                element_ptr);
-        if (key < (element->first >> 32)) {
-          return -1;
-        } else if (key > uint32_t(element->first)) {
-          return 1;
-        } else {
-          return 0;
-        }
-      });
-  if (fn_entry) {
-    return reinterpret_cast<const std::pair<uint64_t, GuestFunction*>*>(
-               fn_entry)
-        ->second;
-  } else {
+void X64CodeCache::RecordPersistentFunction(
+    GuestFunction* function, const uint8_t* guest_code,
+    const void* machine_code, size_t code_size, size_t stack_size,
+    const std::vector<HostRelocation>& relocations) {
+  if (!is_persisting()) {
+    return;
+  }
+
+  PersistentFunction persistent_function;
+  persistent_function.guest_end_address = function->end_address();
+  persistent_function.guest_code_hash = HashGuestCode(
+      guest_code, function->address(), function->end_address());
+  persistent_function.stack_size = uint32_t(stack_size);
+  auto source_map = function->source_map().ToVector();
+  persistent_function.code_size = uint32_t(code_size);
+  persistent_function.source_map_count = uint32_t(source_map.size());
+  persistent_function.relocation_count = uint32_t(relocations.size());
+  auto& data = persistent_function.owned_data;
+  data.resize(persistent_function.data_size());
+  std::memcpy(data.data(), machine_code, code_size);
+  std::memcpy(data.data() + code_size, source_map.data(),
+              source_map.size() * sizeof(SourceMapEntry));
+  std::memcpy(data.data() + code_size +
+                  source_map.size() * sizeof(SourceMapEntry),
+              relocations.data(), relocations.size() * sizeof(HostRelocation));
+
+  std::lock_guard<std::mutex> lock(persistent_mutex_);
+  auto& entry = persistent_functions_[function->address()];
+  entry = std::move(persistent_function);
+  entry.data = entry.owned_data.data();
+  persistent_cache_dirty_ = true;
+}
+
+bool X64CodeCache::RestorePersistentFunction(GuestFunction* function,
+                                             Memory* memory) {
+  if (!is_persisting()) {
+    return false;
+  }
+
+  std::vector<uint8_t> machine_code;
+  uint32_t stack_size;
+  uint32_t end_address;
+  {
+    std::lock_guard<std::mutex> lock(persistent_mutex_);
+    auto it = persistent_functions_.find(function->address());
+    if (it == persistent_functions_.end()) {
+      return false;
+    }
+    auto& persistent_function = it->second;
+
+    // The guest code may have been patched or overwritten since this was
+    // recorded.
+    uint64_t guest_code_hash =
+        HashGuestCode(memory->TranslateVirtual(function->address()),
+                      function->address(), persistent_function.guest_end_address);
+    if (guest_code_hash != persistent_function.guest_code_hash) {
+      persistent_functions_.erase(it);
+      persistent_cache_dirty_ = true;
+      return false;
+    }
+
+    machine_code.assign(
+        persistent_function.data,
+        persistent_function.data + persistent_function.code_size);
+    stack_size = persistent_function.stack_size;
+    end_address = persistent_function.guest_end_address;
+    std::vector<SourceMapEntry> source_map(
+        persistent_function.source_map_count);
+    std::memcpy(source_map.data(),
+                persistent_function.data + persistent_function.code_size,
+                source_map.size() * sizeof(SourceMapEntry));
+    function->set_source_map(source_map);
+
+    // Fix up host addresses for this session before anything can run it.
+    for (uint32_t i = 0; i < persistent_function.relocation_count; ++i) {
+      HostRelocation relocation;
+      std::memcpy(&relocation,
+                  persistent_function.relocation_data() +
+                      i * sizeof(HostRelocation),
+                  sizeof(relocation));
+      uint64_t host_address = HostImageAnchor() + relocation.image_offset;
+      std::memcpy(machine_code.data() + relocation.code_offset, &host_address,
+                  sizeof(host_address));
+    }
+  }
+
+  function->set_end_address(end_address);
+  auto code_address =
+      PlaceGuestCode(function->address(), machine_code.data(),
+                     machine_code.size(), stack_size, function);
+  static_cast<X64Function*>(function)->Setup(
+      reinterpret_cast<uint8_t*>(code_address), machine_code.size());
+  return true;
+}
+
+void X64CodeCache::AddCodeMapEntry(CodeSlab* slab, uint32_t code_offset_start,
+                                   uint32_t code_offset_end,
+                                   size_t unwind_table_slot,
+                                   GuestFunction* function,
+                                   size_t stack_size) {
+  CodeMapEntry* previous =
+      slab->entries.empty() ? nullptr : &slab->entries.back();
+  slab->entries.emplace_back();
+  auto& entry = slab->entries.back();
+  entry.code_offset_start = code_offset_start;
+  entry.code_offset_end = code_offset_end;
+  entry.slab = slab;
+  entry.unwind_table_slot = unwind_table_slot;
+  entry.function = function;
+  entry.stack_size = uint32_t(stack_size);
+  entry.next = nullptr;
+  if (previous) {
+    previous->next = &entry;
+  }
+
+  // Point every page the entry touches that doesn't have an entry yet at it.
+  // Pages belong to a single slab and placement in it is append-only, so the
+  // first entry to claim a page is the lowest one overlapping it. Leaves were
+  // allocated with the slab.
+  if (code_offset_end <= code_offset_start) {
+    return;
+  }
+  uint32_t first_page = code_offset_start >> kCodeMapPageShift;
+  uint32_t last_page = (code_offset_end - 1) >> kCodeMapPageShift;
+  for (uint32_t page = first_page; page <= last_page; ++page) {
+    auto& leaf = code_map_[page >> (kCodeMapLeafShift - kCodeMapPageShift)];
+    auto& slot = leaf[page & (kCodeMapLeafPageCount - 1)];
+    if (!slot) {
+      slot = &entry;
+    }
+  }
+}
+
+const X64CodeCache::CodeMapEntry* X64CodeCache::LookupCodeMapEntry(
+    uint64_t host_pc) const {
+  if (host_pc < kGeneratedCodeBase ||
+      host_pc >= kGeneratedCodeBase + kGeneratedCodeSize) {
     return nullptr;
   }
+  uint32_t offset = uint32_t(host_pc - kGeneratedCodeBase);
+  uint32_t page = offset >> kCodeMapPageShift;
+  auto& leaf = code_map_[page >> (kCodeMapLeafShift - kCodeMapPageShift)];
+  if (!leaf) {
+    return nullptr;
+  }
+  const CodeMapEntry* entry = leaf[page & (kCodeMapLeafPageCount - 1)];
+  while (entry && entry->code_offset_end <= offset) {
+    entry = entry->next;
+  }
+  if (!entry || entry->code_offset_start > offset) {
+    return nullptr;
+  }
+  return entry;
+}
+
+GuestFunction* X64CodeCache::LookupFunction(uint64_t host_pc) {
+  auto entry = LookupCodeMapEntry(host_pc);
+  return entry ? entry->function : nullptr;
+}
+
+bool X64CodeCache::UnwindGuestFrame(uint64_t* host_pc, uint64_t* host_sp) {
+  auto entry = LookupCodeMapEntry(*host_pc);
+  if (!entry || !entry->function) {
+    return false;
+  }
+  // Generated code only adjusts rsp in the prolog and epilog, so the return
+  // address is right above the frame, except before the prolog's sub, at the
+  // epilog's ret and between the add and jmp of a tail call. The last one
+  // can't be told from a jump within the function, so when the return
+  // address above the frame doesn't look like one, the frame is assumed to
+  // be gone already.
+  auto pc = reinterpret_cast<const uint8_t*>(*host_pc);
+  uint64_t stack_sizes[] = {entry->stack_size, 0};
+  size_t first = 0;
+  if (pc == generated_code_base_ + entry->code_offset_start || *pc == 0xC3) {
+    first = 1;
+  }
+  for (size_t i = first; i < xe::countof(stack_sizes); ++i) {
+    uint64_t return_address =
+        *reinterpret_cast<const uint64_t*>(*host_sp + stack_sizes[i]);
+    if (IsReturnAddress(return_address)) {
+      *host_pc = return_address;
+      *host_sp += stack_sizes[i] + 8;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool X64CodeCache::IsReturnAddress(uint64_t address) const {
+  // Guest code is only ever called from other generated code: guest code and
+  // the host to guest thunk. All of it calls with either a call rel32 or a
+  // call through a register.
+  if (!LookupCodeMapEntry(address)) {
+    return false;
+  }
+  auto code = reinterpret_cast<const uint8_t*>(address);
+  if (code[-5] == 0xE8) {
+    return true;
+  }
+  if (code[-2] == 0xFF && (code[-1] & 0xF8) == 0xD0) {
+    // call r64 for rax-rdi, with a REX.B prefix for r8-r15.
+    return true;
+  }
+  return false;
 }
 
 }  // namespace x64
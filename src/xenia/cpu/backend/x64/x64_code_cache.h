@@ -11,14 +11,20 @@
 #define XENIA_CPU_BACKEND_X64_X64_CODE_CACHE_H_
 
 #include <atomic>
+#include <deque>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/memory_usage.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/code_cache.h"
+#include "xenia/memory.h"
 
 namespace xe {
 namespace cpu {
@@ -27,6 +33,15 @@ namespace x64 {
 
 class X64CodeCache : public CodeCache {
  public:
+  // A 64-bit immediate in generated code that holds an address within the
+  // host executable image. These are stored relative to the image so that they
+  // can be fixed up when the code is restored from the persistent cache.
+  struct HostRelocation {
+    uint32_t code_offset;
+    uint32_t reserved;
+    int64_t image_offset;
+  };
+
   ~X64CodeCache() override;
 
   static std::unique_ptr<X64CodeCache> Create();
@@ -37,13 +52,40 @@ class X64CodeCache : public CodeCache {
   uint32_t base_address() const override { return kGeneratedCodeBase; }
   uint32_t total_size() const override { return kGeneratedCodeSize; }
 
-  // TODO(benvanik): ELF serialization/etc
   // TODO(benvanik): keep track of code blocks
   // TODO(benvanik): padding/guards/etc
 
   bool has_indirection_table() { return indirection_table_base_ != nullptr; }
   void set_indirection_default(uint32_t default_value);
+  // Sets the indirection table entry for the guest address, repatching any
+  // direct call sites that target it.
   void AddIndirection(uint32_t guest_address, uint32_t host_address);
+  // Resets the indirection table entry for the guest address back to the
+  // default and unpatches direct call sites that target it, so that the next
+  // call resolves the function again.
+  void RemoveIndirection(uint32_t guest_address);
+
+  // Call sites are rel32 call/jmp displacements in generated code that target
+  // the code for a guest address. They start out pointing at the given
+  // default host code and are patched to call the function directly once its
+  // code is placed.
+  void set_call_site_default(uint8_t* default_target) {
+    call_site_default_target_ = default_target;
+  }
+  // Registers patchable call site displacements (4b aligned) that target the
+  // given guest address and patches them to its current code, if any.
+  void AddCallSites(uint32_t guest_address, uint8_t* const* displacements,
+                    size_t count);
+
+  // Guest target value of an inline cache that has not seen a call yet.
+  // Never a valid target, as branch targets are 4b aligned.
+  static const uint32_t kInlineCacheEmpty = 0xFEEDF00D;
+  // Fills an empty inline cache for the given guest target: the call site
+  // displacement is patched (and kept patched like any other call site) and
+  // then the guest address it is guarded by is set. Only the first fill of a
+  // site takes effect.
+  void FillInlineCache(uint32_t* guest_field, uint8_t* displacement,
+                       uint32_t guest_address);
 
   void CommitExecutableRange(uint32_t guest_low, uint32_t guest_high);
 
@@ -55,6 +97,34 @@ class X64CodeCache : public CodeCache {
   uint32_t PlaceData(const void* data, size_t length);
 
   GuestFunction* LookupFunction(uint64_t host_pc) override;
+  bool UnwindGuestFrame(uint64_t* host_pc, uint64_t* host_sp) override;
+
+  // Returns the offset of the given host address from the host image anchor.
+  static int64_t HostImageOffset(const void* host_address);
+
+  // True if generated code is being recorded to the persistent cache.
+  // Code must avoid embedding references to other generated code while this
+  // is set, as placement will differ between runs.
+  bool is_persisting() const { return !persistent_cache_path_.empty(); }
+
+  // Opens (and loads, if present) the persistent cache file in the given
+  // directory for the given module. All parameters that influence the shape
+  // of the generated code must be part of the key.
+  bool OpenPersistentCache(const std::wstring& root_path, uint64_t module_hash,
+                           uint32_t feature_flags, uintptr_t emitter_data);
+  // Writes out the persistent cache, if opened and modified.
+  void FlushPersistentCache();
+
+  // Records placed guest code so that it can be persisted.
+  // The guest code is hashed to validate the translation on restore.
+  void RecordPersistentFunction(GuestFunction* function,
+                                const uint8_t* guest_code,
+                                const void* machine_code, size_t code_size,
+                                size_t stack_size,
+                                const std::vector<HostRelocation>& relocations);
+  // Places previously persisted code for the function if the guest code is
+  // unchanged. The function is fully setup on success.
+  bool RestorePersistentFunction(GuestFunction* function, Memory* memory);
 
  protected:
   // All executable code falls within 0x80000000 to 0x9FFFFFFF, so we can
@@ -67,10 +137,51 @@ class X64CodeCache : public CodeCache {
   static const uint64_t kGeneratedCodeBase = 0xA0000000;
   static const uint64_t kGeneratedCodeSize = 0x0FFFFFFF;
 
-  // This is picked to be high enough to cover whatever we can reasonably
-  // expect. If we hit issues with this it probably means some corner case
-  // in analysis triggering.
-  static const size_t kMaximumFunctionCount = 50000;
+  // Host PC lookups go through a two-level table of 4KB pages within the
+  // generated code region: a fixed directory of 1MB leaves, each allocated the
+  // first time code lands in it.
+  static const uint32_t kCodeMapPageShift = 12;
+  static const uint32_t kCodeMapLeafShift = 20;
+  static const uint32_t kCodeMapLeafPageCount =
+      1u << (kCodeMapLeafShift - kCodeMapPageShift);
+  static const uint32_t kCodeMapDirectorySize =
+      uint32_t((kGeneratedCodeSize + 1) >> kCodeMapLeafShift);
+
+  // Code is placed into slabs carved out of the generated code region, each
+  // owned by the one thread that fills it, so placement doesn't contend on
+  // the global lock. Slabs are aligned to code map leaves and never share one.
+  static const size_t kCodeSlabSize = size_t(1) << kCodeMapLeafShift;
+
+  struct CodeSlab;
+
+  // A placed block of code (and its unwind info), in placement order within
+  // its slab. Entries are never moved or freed while the cache is alive, so
+  // lookups can walk them without holding any lock.
+  struct CodeMapEntry {
+    uint32_t code_offset_start;
+    uint32_t code_offset_end;
+    CodeSlab* slab;
+    size_t unwind_table_slot;
+    GuestFunction* function;
+    // Allocated by the prolog, or 0 for code without a frame.
+    uint32_t stack_size;
+    std::atomic<CodeMapEntry*> next;
+  };
+
+  // Platform unwind registration for the code in one slab.
+  struct UnwindTable {
+    virtual ~UnwindTable() = default;
+  };
+
+  struct CodeSlab {
+    size_t offset_start;
+    size_t offset_end;
+    // Next free byte. Only touched by the owning thread.
+    size_t offset;
+    // Entries for the code in this slab, in host PC order.
+    std::deque<CodeMapEntry> entries;
+    std::unique_ptr<UnwindTable> unwind_table;
+  };
 
   struct UnwindReservation {
     size_t data_size = 0;
@@ -78,26 +189,100 @@ class X64CodeCache : public CodeCache {
     uint8_t* entry_address = 0;
   };
 
+  struct PersistentFunction {
+    uint32_t guest_end_address;
+    uint64_t guest_code_hash;
+    uint32_t stack_size;
+    uint32_t code_size;
+    uint32_t source_map_count;
+    uint32_t relocation_count;
+    // The machine code, source map and relocations, back to back and
+    // unaligned as in the file. Functions loaded from the file point into its
+    // read-only mapping, whose pages every instance running the title shares,
+    // and ones recorded in this session point into owned_data.
+    const uint8_t* data = nullptr;
+    std::vector<uint8_t> owned_data;
+
+    size_t data_size() const {
+      return code_size + source_map_count * sizeof(SourceMapEntry) +
+             relocation_count * sizeof(HostRelocation);
+    }
+    const uint8_t* relocation_data() const {
+      return data + code_size + source_map_count * sizeof(SourceMapEntry);
+    }
+  };
+  typedef std::unordered_map<uint32_t, PersistentFunction>
+      PersistentFunctionMap;
+
   X64CodeCache();
 
-  virtual UnwindReservation RequestUnwindReservation(uint8_t* entry_address) {
+  // Returns the placed code containing the given host PC, if any.
+  const CodeMapEntry* LookupCodeMapEntry(uint64_t host_pc) const;
+  // Returns the calling thread's slab with at least size bytes free, carving
+  // out a new one if needed.
+  CodeSlab* AcquireSlab(size_t size);
+  // Adds a block of code to the host PC map. Must be called in placement order
+  // by the thread owning the slab.
+  void AddCodeMapEntry(CodeSlab* slab, uint32_t code_offset_start,
+                       uint32_t code_offset_end, size_t unwind_table_slot,
+                       GuestFunction* function, size_t stack_size);
+
+  // Whether the address is right after a call in generated code.
+  bool IsReturnAddress(uint64_t address) const;
+
+  // Maps the cache file and adds the functions in it that aren't in the map
+  // yet, if the file is valid for this session. The mapping is kept for as
+  // long as the code cache.
+  bool MapPersistentCache(const std::wstring& path,
+                          PersistentFunctionMap* functions);
+  bool LoadPersistentCache(const uint8_t* data, size_t size,
+                           PersistentFunctionMap* functions);
+  static void PatchCallSite(uint8_t* displacement, uint8_t* target);
+  // Patches the call site to the current code of the guest address.
+  // call_site_mutex_ must be held.
+  void PatchCallSiteToCurrent(uint32_t guest_address, uint8_t* displacement);
+
+  // Bytes of unwind info stored after each function.
+  virtual size_t unwind_data_size() const { return 0; }
+  // Sets up unwind registration for a new slab. The global critical region is
+  // held.
+  virtual std::unique_ptr<UnwindTable> CreateUnwindTable(CodeSlab* slab) {
+    return nullptr;
+  }
+  // Called by the thread owning the slab.
+  virtual UnwindReservation RequestUnwindReservation(CodeSlab* slab,
+                                                     uint8_t* entry_address) {
     return UnwindReservation();
   }
-  virtual void PlaceCode(uint32_t guest_address, void* machine_code,
-                         size_t code_size, size_t stack_size,
-                         void* code_address,
+  virtual void PlaceCode(CodeSlab* slab, uint32_t guest_address,
+                         void* machine_code, size_t code_size,
+                         size_t stack_size, void* code_address,
                          UnwindReservation unwind_reservation) {}
 
+  // Maps the generated code region with large pages, returning false if the
+  // host can't provide them.
+  bool InitializeLargePages();
+
   std::wstring file_name_;
   xe::memory::FileMappingHandle mapping_ = nullptr;
+  // Whether the generated code region is backed by large pages, which are
+  // committed up front.
+  bool large_pages_ = false;
 
-  // NOTE: the global critical region must be held when manipulating the offsets
-  // or counts of anything, to keep the tables consistent and ordered.
+  // NOTE: the global critical region must be held when carving out slabs.
   xe::global_critical_region global_critical_region_;
+  // Distinguishes caches in the per-thread slab pointers.
+  uint64_t instance_id_ = 0;
 
   // Value that the indirection table will be initialized with upon commit.
   uint32_t indirection_default_value_ = 0xFEEDF00D;
 
+  // Host code that unpatched call sites target.
+  uint8_t* call_site_default_target_ = nullptr;
+  // Patchable call site displacements by target guest address.
+  std::mutex call_site_mutex_;
+  std::unordered_map<uint32_t, std::vector<uint8_t*>> call_sites_;
+
   // Fixed at kIndirectionTableBase in host space, holding 4 byte pointers into
   // the generated code table that correspond to the PPC functions in guest
   // space.
@@ -105,14 +290,32 @@ class X64CodeCache : public CodeCache {
   // Fixed at kGeneratedCodeBase and holding all generated code, growing as
   // needed.
   uint8_t* generated_code_base_ = nullptr;
-  // Current offset to empty space in generated code.
+  // Current offset to space not yet carved into slabs. Slabs are committed
+  // when carved.
   size_t generated_code_offset_ = 0;
-  // Current high water mark of COMMITTED code.
-  std::atomic<size_t> generated_code_commit_mark_ = {0};
-  // Sorted map by host PC base offsets to source function info.
-  // This can be used to bsearch on host PC to find the guest function.
-  // The key is [start address | end address].
-  std::vector<std::pair<uint64_t, GuestFunction*>> generated_code_map_;
+  MemoryUsageCounter generated_code_usage_{"cpu/code_cache"};
+  // All slabs ever carved out, in host PC order.
+  std::vector<std::unique_ptr<CodeSlab>> code_slabs_;
+  // Page-indexed map to the first entry that ends past the start of each page.
+  // From there a lookup only needs to step over the entries that share the
+  // page.
+  std::unique_ptr<std::atomic<CodeMapEntry*>[]>
+      code_map_[kCodeMapDirectorySize];
+
+  // Persistent cache file path and key. Empty if not persisting.
+  std::wstring persistent_cache_path_;
+  uint64_t persistent_module_hash_ = 0;
+  uint32_t persistent_feature_flags_ = 0;
+  uintptr_t persistent_emitter_data_ = 0;
+  size_t persistent_host_code_size_ = 0;
+  // Guards the persistent function map, which is accessed from any thread
+  // translating code.
+  std::mutex persistent_mutex_;
+  // Persisted functions by guest address, both loaded and newly recorded.
+  PersistentFunctionMap persistent_functions_;
+  // Mappings of the cache file the loaded functions point into.
+  std::vector<std::unique_ptr<MappedMemory>> persistent_mappings_;
+  bool persistent_cache_dirty_ = false;
 };
 
 }  // namespace x64
@@ -101,6 +101,9 @@ typedef struct _UNWIND_INFO {
 static const uint32_t kUnwindInfoSize =
     sizeof(UNWIND_INFO) + (sizeof(UNWIND_CODE) * (6 - 1));
 
+// Initial number of unwind table entries per slab. Tables double when full.
+static const uint32_t kInitialUnwindTableSize = 1024;
+
 class Win32X64CodeCache : public X64CodeCache {
  public:
   Win32X64CodeCache();
@@ -111,21 +114,46 @@ class Win32X64CodeCache : public X64CodeCache {
   void* LookupUnwindInfo(uint64_t host_pc) override;
 
  private:
-  UnwindReservation RequestUnwindReservation(uint8_t* entry_address) override;
-  void PlaceCode(uint32_t guest_address, void* machine_code, size_t code_size,
-                 size_t stack_size, void* code_address,
+  // Each slab has a table of its own. Code is appended to a slab in address
+  // order, so its table stays sorted without any coordination between
+  // threads, and the system only has to be told once per slab.
+  struct Win32UnwindTable : public UnwindTable {
+    // Growable function table system handle.
+    void* handle = nullptr;
+    // Entries are relative to this: the slab for growable tables, the whole
+    // code region for the callback.
+    uint8_t* range_base = nullptr;
+    uint8_t* range_end = nullptr;
+    // All storage allocated so far; the last one is current. Older ones are
+    // kept around as the system (or the callback) may still be reading them
+    // while we switch over.
+    std::vector<std::unique_ptr<RUNTIME_FUNCTION[]>> storage;
+    // Actual unwind table entries.
+    std::atomic<RUNTIME_FUNCTION*> entries = {nullptr};
+    uint32_t capacity = 0;
+    // Current number of entries in the table.
+    std::atomic<uint32_t> count = {0};
+  };
+
+  size_t unwind_data_size() const override {
+    return xe::round_up(kUnwindInfoSize, 16);
+  }
+  std::unique_ptr<UnwindTable> CreateUnwindTable(CodeSlab* slab) override;
+  UnwindReservation RequestUnwindReservation(CodeSlab* slab,
+                                             uint8_t* entry_address) override;
+  void PlaceCode(CodeSlab* slab, uint32_t guest_address, void* machine_code,
+                 size_t code_size, size_t stack_size, void* code_address,
                  UnwindReservation unwind_reservation) override;
 
-  void InitializeUnwindEntry(uint8_t* unwind_entry_address,
+  void InitializeUnwindEntry(Win32UnwindTable* table,
+                             uint8_t* unwind_entry_address,
                              size_t unwind_table_slot, void* code_address,
                              size_t code_size, size_t stack_size);
+  // Moves the unwind table into storage twice the size and re-registers it.
+  // Only called by the thread owning the slab.
+  bool GrowUnwindTable(Win32UnwindTable* table);
+  bool RegisterUnwindTable(Win32UnwindTable* table, void** out_handle);
 
-  // Growable function table system handle.
-  void* unwind_table_handle_ = nullptr;
-  // Actual unwind table entries.
-  std::vector<RUNTIME_FUNCTION> unwind_table_;
-  // Current number of entries in the table.
-  std::atomic<uint32_t> unwind_table_count_ = {0};
   // Does this version of Windows support growable funciton tables?
   bool supports_growable_table_ = false;
 
@@ -142,8 +170,11 @@ Win32X64CodeCache::Win32X64CodeCache() = default;
 
 Win32X64CodeCache::~Win32X64CodeCache() {
   if (supports_growable_table_) {
-    if (unwind_table_handle_) {
-      delete_growable_table_(unwind_table_handle_);
+    for (auto& slab : code_slabs_) {
+      auto table = static_cast<Win32UnwindTable*>(slab->unwind_table.get());
+      if (table && table->handle) {
+        delete_growable_table_(table->handle);
+      }
     }
   } else {
     if (generated_code_base_) {
@@ -158,10 +189,6 @@ bool Win32X64CodeCache::Initialize() {
     return false;
   }
 
-  // Compute total number of unwind entries we should allocate.
-  // We don't support reallocing right now, so this should be high.
-  unwind_table_.resize(kMaximumFunctionCount);
-
   // Check if this version of Windows supports growable function tables.
   add_growable_table_ = (FnRtlAddGrowableFunctionTable)GetProcAddress(
       GetModuleHandleW(L"ntdll.dll"), "RtlAddGrowableFunctionTable");
@@ -172,20 +199,10 @@ bool Win32X64CodeCache::Initialize() {
   supports_growable_table_ =
       add_growable_table_ && delete_growable_table_ && grow_table_;
 
-  // Create table and register with the system. It's empty now, but we'll grow
-  // it as functions are added.
-  if (supports_growable_table_) {
-    if (add_growable_table_(&unwind_table_handle_, unwind_table_.data(),
-                            unwind_table_count_, DWORD(unwind_table_.size()),
-                            reinterpret_cast<ULONG_PTR>(generated_code_base_),
-                            reinterpret_cast<ULONG_PTR>(generated_code_base_ +
-                                                        kGeneratedCodeSize))) {
-      XELOGE("Unable to create unwind function table");
-      return false;
-    }
-  } else {
-    // Install a callback that the debugger will use to lookup unwind info on
-    // demand.
+  // Growable tables are created and registered with each slab. Otherwise
+  // install a callback that the debugger will use to lookup unwind info on
+  // demand.
+  if (!supports_growable_table_) {
     if (!RtlInstallFunctionTableCallback(
             reinterpret_cast<DWORD64>(generated_code_base_) | 0x3,
             reinterpret_cast<DWORD64>(generated_code_base_), kGeneratedCodeSize,
@@ -203,37 +220,100 @@ bool Win32X64CodeCache::Initialize() {
   return true;
 }
 
+std::unique_ptr<X64CodeCache::UnwindTable>
+Win32X64CodeCache::CreateUnwindTable(CodeSlab* slab) {
+  auto table = std::make_unique<Win32UnwindTable>();
+  table->capacity = kInitialUnwindTableSize;
+  table->storage.emplace_back(new RUNTIME_FUNCTION[table->capacity]());
+  table->entries = table->storage.back().get();
+  if (supports_growable_table_) {
+    table->range_base = generated_code_base_ + slab->offset_start;
+    table->range_end = generated_code_base_ + slab->offset_end;
+    // It's empty now, but we'll grow it as functions are added.
+    if (!RegisterUnwindTable(table.get(), &table->handle)) {
+      XELOGE("Unable to create unwind function table");
+    }
+  } else {
+    table->range_base = generated_code_base_;
+    table->range_end = generated_code_base_ + kGeneratedCodeSize;
+  }
+  return std::move(table);
+}
+
+bool Win32X64CodeCache::RegisterUnwindTable(Win32UnwindTable* table,
+                                            void** out_handle) {
+  return !add_growable_table_(
+      out_handle, table->entries.load(), table->count, DWORD(table->capacity),
+      reinterpret_cast<ULONG_PTR>(table->range_base),
+      reinterpret_cast<ULONG_PTR>(table->range_end));
+}
+
+bool Win32X64CodeCache::GrowUnwindTable(Win32UnwindTable* table) {
+  uint32_t new_capacity = table->capacity * 2;
+  auto new_entries = std::unique_ptr<RUNTIME_FUNCTION[]>(
+      new RUNTIME_FUNCTION[new_capacity]());
+  std::memcpy(new_entries.get(), table->entries.load(),
+              sizeof(RUNTIME_FUNCTION) * table->count);
+  table->entries = new_entries.get();
+  table->capacity = new_capacity;
+  table->storage.push_back(std::move(new_entries));
+
+  if (supports_growable_table_) {
+    // Growable tables have a fixed maximum size, so register the new storage
+    // before dropping the old table. Both cover the same code while this
+    // happens, which is fine as they hold the same entries.
+    void* new_handle = nullptr;
+    if (!RegisterUnwindTable(table, &new_handle)) {
+      XELOGE("Unable to grow unwind function table");
+      return false;
+    }
+    if (table->handle) {
+      delete_growable_table_(table->handle);
+    }
+    table->handle = new_handle;
+  }
+  return true;
+}
+
 Win32X64CodeCache::UnwindReservation
-Win32X64CodeCache::RequestUnwindReservation(uint8_t* entry_address) {
+Win32X64CodeCache::RequestUnwindReservation(CodeSlab* slab,
+                                            uint8_t* entry_address) {
+  auto table = static_cast<Win32UnwindTable*>(slab->unwind_table.get());
+  if (table->count >= table->capacity) {
+    GrowUnwindTable(table);
+  }
+
   UnwindReservation unwind_reservation;
-  unwind_reservation.data_size = xe::round_up(kUnwindInfoSize, 16);
-  unwind_reservation.table_slot = ++unwind_table_count_;
+  unwind_reservation.data_size = unwind_data_size();
+  unwind_reservation.table_slot = table->count;
   unwind_reservation.entry_address = entry_address;
-  assert_false(unwind_table_count_ >= kMaximumFunctionCount);
 
   return unwind_reservation;
 }
 
-void Win32X64CodeCache::PlaceCode(uint32_t guest_address, void* machine_code,
-                                  size_t code_size, size_t stack_size,
-                                  void* code_address,
+void Win32X64CodeCache::PlaceCode(CodeSlab* slab, uint32_t guest_address,
+                                  void* machine_code, size_t code_size,
+                                  size_t stack_size, void* code_address,
                                   UnwindReservation unwind_reservation) {
   // Add unwind info.
-  InitializeUnwindEntry(unwind_reservation.entry_address,
+  auto table = static_cast<Win32UnwindTable*>(slab->unwind_table.get());
+  InitializeUnwindEntry(table, unwind_reservation.entry_address,
                         unwind_reservation.table_slot, code_address, code_size,
                         stack_size);
+  // The entry is complete, so lookups may see it now.
+  table->count = uint32_t(unwind_reservation.table_slot + 1);
 
-  if (supports_growable_table_) {
+  if (supports_growable_table_ && table->handle) {
     // Notify that the unwind table has grown.
-    // We do this outside of the lock, but with the latest total count.
-    grow_table_(unwind_table_handle_, unwind_table_count_);
+    grow_table_(table->handle, table->count);
   }
 
   // This isn't needed on x64 (probably), but is convention.
   FlushInstructionCache(GetCurrentProcess(), code_address, code_size);
 }
 
-void Win32X64CodeCache::InitializeUnwindEntry(uint8_t* unwind_entry_address,
+void Win32X64CodeCache::InitializeUnwindEntry(Win32UnwindTable* table,
+                                              uint8_t* unwind_entry_address,
                                               size_t unwind_table_slot,
                                               void* code_address,
                                               size_t code_size,
@@ -297,29 +377,23 @@ void Win32X64CodeCache::InitializeUnwindEntry(uint8_t* unwind_entry_address,
   }
 
   // Add entry.
-  auto& fn_entry = unwind_table_[unwind_table_slot];
+  auto& fn_entry = table->entries.load()[unwind_table_slot];
   fn_entry.BeginAddress =
-      (DWORD)(reinterpret_cast<uint8_t*>(code_address) - generated_code_base_);
+      (DWORD)(reinterpret_cast<uint8_t*>(code_address) - table->range_base);
   fn_entry.EndAddress = (DWORD)(fn_entry.BeginAddress + code_size);
-  fn_entry.UnwindData = (DWORD)(unwind_entry_address - generated_code_base_);
+  fn_entry.UnwindData = (DWORD)(unwind_entry_address - table->range_base);
 }
 
 void* Win32X64CodeCache::LookupUnwindInfo(uint64_t host_pc) {
-  return std::bsearch(
-      &host_pc, unwind_table_.data(), unwind_table_count_ + 1,
-      sizeof(RUNTIME_FUNCTION),
-      [](const void* key_ptr, const void* element_ptr) {
-        auto key =
-            *reinterpret_cast<const uintptr_t*>(key_ptr) - kGeneratedCodeBase;
-        auto element = reinterpret_cast<const RUNTIME_FUNCTION*>(element_ptr);
-        if (key < element->BeginAddress) {
-          return -1;
-        } else if (key > element->EndAddress) {
-          return 1;
-        } else {
-          return 0;
-        }
-      });
+  auto entry = LookupCodeMapEntry(host_pc);
+  if (!entry) {
+    return nullptr;
+  }
+  auto table = static_cast<Win32UnwindTable*>(entry->slab->unwind_table.get());
+  if (entry->unwind_table_slot >= table->count) {
+    return nullptr;
+  }
+  return &table->entries.load()[entry->unwind_table_slot];
 }
 
 }  // namespace x64
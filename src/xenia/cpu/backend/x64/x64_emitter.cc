@@ -31,6 +31,8 @@
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_debug_info.h"
+#include "xenia/cpu/function_trace_recorder.h"
+#include "xenia/cpu/probe.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -41,12 +43,19 @@ DEFINE_bool(ignore_undefined_externs, true,
             "Don't exit when an undefined extern is called.");
 DEFINE_bool(emit_source_annotations, false,
             "Add extra movs and nops to make disassembly easier to read.");
+DEFINE_bool(inline_critical_sections, true,
+            "Emit uncontended RtlEnterCriticalSection/RtlLeaveCriticalSection "
+            "inline, only calling the kernel when contended or recursive.");
+DEFINE_bool(elide_leaf_frames, true,
+            "Emit functions that make no calls and have no spills without a "
+            "stack frame.");
 
 namespace xe {
 namespace cpu {
 namespace backend {
 namespace x64 {
 
+using xe::cpu::hir::Block;
 using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 
@@ -55,6 +64,8 @@ static const size_t kMaxCodeSize = 1 * 1024 * 1024;
 static const size_t kStashOffset = 32;
 // static const size_t kStashOffsetHigh = 32 + 32;
 
+uint64_t TierUpFunction(void* raw_context, uint64_t function_ptr);
+
 const uint32_t X64Emitter::gpr_reg_map_[X64Emitter::GPR_COUNT] = {
     Xbyak::Operand::RBX, Xbyak::Operand::R10, Xbyak::Operand::R11,
     Xbyak::Operand::R12, Xbyak::Operand::R13, Xbyak::Operand::R14,
@@ -79,6 +90,15 @@ X64Emitter::X64Emitter(X64Backend* backend, XbyakAllocator* allocator)
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tF16C) ? kX64EmitF16C : 0;
     feature_flags_ |= cpu_.has(Xbyak::util::Cpu::tMOVBE) ? kX64EmitMovbe : 0;
   }
+  if (FLAGS_enable_avx512_instructions &&
+      cpu_.has(Xbyak::util::Cpu::tAVX512F) &&
+      cpu_.has(Xbyak::util::Cpu::tAVX512BW) &&
+      cpu_.has(Xbyak::util::Cpu::tAVX512VL)) {
+    feature_flags_ |= kX64EmitAVX512;
+    feature_flags_ |=
+        cpu_.has(Xbyak::util::Cpu::tAVX512_VBMI) ? kX64EmitAVX512VBMI : 0;
+  }
+  feature_flags_ &= uint32_t(FLAGS_x64_extension_mask);
 
   if (!cpu_.has(Xbyak::util::Cpu::tAVX)) {
     xe::FatalError(
@@ -100,13 +120,51 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   debug_info_ = debug_info;
   debug_info_flags_ = debug_info_flags;
   trace_data_ = &function->trace_data();
+  tier_up_function_ = function->tier() == GuestFunction::Tier::kBaseline
+                          ? function
+                          : nullptr;
+  // Baseline code profiles its blocks so that the optimized recompile can
+  // move the ones that never ran out of the way of the hot path.
+  function_address_ = function->address();
+  recording_block_profile_ = false;
+  block_profile_ = nullptr;
+  block_profile_count_ = 0;
+  if (FLAGS_profile_guided_layout && !debug_info_flags) {
+    if (tier_up_function_) {
+      recording_block_profile_ = true;
+      block_profile_ = function->ResetBlockProfile();
+    } else {
+      block_profile_ = function->block_profile();
+    }
+    block_profile_count_ = block_profile_ ? function->block_profile_count() : 0;
+  }
   source_map_arena_.Reset();
+  // Traced code embeds pointers to per-function trace data.
+  persistable_ = !(debug_info_flags & DebugInfoFlags::kDebugInfoAllTracing);
+  host_relocations_.clear();
+  patchable_call_sites_.clear();
 
   // Fill the generator with code.
+  // Leaf functions are first emitted without a frame. Some sequences call
+  // the host or use stack scratch space, which can't be told from the HIR,
+  // so if any of them came up the function is emitted again with one.
   size_t stack_size = 0;
+  frame_elided_ = CanElideFrame(builder);
+  frame_used_ = false;
   if (!Emit(builder, &stack_size)) {
     return false;
   }
+  if (frame_elided_ && frame_used_) {
+    reset();
+    source_map_arena_.Reset();
+    persistable_ = !(debug_info_flags & DebugInfoFlags::kDebugInfoAllTracing);
+    host_relocations_.clear();
+    patchable_call_sites_.clear();
+    frame_elided_ = false;
+    if (!Emit(builder, &stack_size)) {
+      return false;
+    }
+  }
 
   // Copy the final code to the cache and relocate it.
   *out_code_size = getSize();
@@ -115,6 +173,14 @@ bool X64Emitter::Emit(GuestFunction* function, HIRBuilder* builder,
   // Stash source map.
   source_map_arena_.CloneContents(out_source_map);
 
+  // Now that the code has its final address, make its direct calls
+  // patchable.
+  for (auto& call_site : patchable_call_sites_) {
+    uint8_t* displacement =
+        reinterpret_cast<uint8_t*>(*out_code_address) + call_site.code_offset;
+    code_cache_->AddCallSites(call_site.guest_address, &displacement, 1);
+  }
+
   return true;
 }
 
@@ -138,9 +204,41 @@ void* X64Emitter::Emplace(size_t stack_size, GuestFunction* function) {
   return new_address;
 }
 
+bool X64Emitter::CanElideFrame(HIRBuilder* builder) const {
+  // Tracing and the tier-up countdown call the host from the prolog, and
+  // locals are spills.
+  if (!FLAGS_elide_leaf_frames || debug_info_flags_ || tier_up_function_ ||
+      !builder->locals().empty()) {
+    return false;
+  }
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      switch (instr->opcode->num) {
+        case hir::OPCODE_DEBUG_BREAK:
+        case hir::OPCODE_DEBUG_BREAK_TRUE:
+        case hir::OPCODE_TRAP:
+        case hir::OPCODE_TRAP_TRUE:
+        case hir::OPCODE_CALL:
+        case hir::OPCODE_CALL_TRUE:
+        case hir::OPCODE_CALL_INDIRECT:
+        case hir::OPCODE_CALL_INDIRECT_TRUE:
+        case hir::OPCODE_CALL_EXTERN:
+        case hir::OPCODE_SET_RETURN_ADDRESS:
+        case hir::OPCODE_LOAD_LOCAL:
+        case hir::OPCODE_STORE_LOCAL:
+          return false;
+        default:
+          break;
+      }
+    }
+  }
+  return true;
+}
+
 bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   Xbyak::Label epilog_label;
   epilog_label_ = &epilog_label;
+  xmm_pool_.clear();
 
   // Calculate stack size. We need to align things to their natural sizes.
   // This could be much better (sort by type/etc).
@@ -167,15 +265,20 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
   // IMPORTANT: any changes to the prolog must be kept in sync with
   //     X64CodeCache, which dynamically generates exception information.
   //     Adding or changing anything here must be matched!
-  const size_t stack_size = StackLayout::GUEST_STACK_SIZE + stack_offset;
-  assert_true((stack_size + 8) % 16 == 0);
+  // Without a frame there is no prolog at all, and the unwind info X64CodeCache
+  // generates for a stack size of 0 says as much.
+  const size_t stack_size =
+      frame_elided_ ? 0 : StackLayout::GUEST_STACK_SIZE + stack_offset;
+  assert_true(frame_elided_ || (stack_size + 8) % 16 == 0);
   *out_stack_size = stack_size;
   stack_size_ = stack_size;
 
-  sub(rsp, (uint32_t)stack_size);
-  mov(qword[rsp + StackLayout::GUEST_CTX_HOME], GetContextReg());
-  mov(qword[rsp + StackLayout::GUEST_RET_ADDR], rcx);
-  mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], 0);
+  if (!frame_elided_) {
+    sub(rsp, (uint32_t)stack_size);
+    mov(qword[rsp + StackLayout::GUEST_CTX_HOME], GetContextReg());
+    mov(qword[rsp + StackLayout::GUEST_RET_ADDR], rcx);
+    mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], 0);
+  }
 
   // Safe now to do some tracing.
   if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctions) {
@@ -204,46 +307,90 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
     lock();
     bts(qword[low_address(&trace_header->function_thread_use)], rax);
   }
+  if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionRecords) {
+    EmitTraceFunctionRecord(FunctionTraceRecord::kEnter);
+  }
+
+  // Baseline code counts down to its recompilation at the optimized tier.
+  // The countdown only hits zero once, so the host is only called once.
+  if (tier_up_function_) {
+    Xbyak::Label tier_up_done;
+    MovSessionAddress(
+        rax, reinterpret_cast<uint64_t>(tier_up_function_->tier_up_countdown()));
+    lock();
+    dec(dword[rax]);
+    jnz(tier_up_done, CodeGenerator::T_NEAR);
+    MovSessionAddress(GetNativeParam(0),
+                      reinterpret_cast<uint64_t>(tier_up_function_));
+    CallNative(TierUpFunction);
+    L(tier_up_done);
+  }
 
   // Load membase.
   mov(GetMembaseReg(),
       qword[GetContextReg() + offsetof(ppc::PPCContext, virtual_membase)]);
 
   // Body.
-  auto block = builder->first_block();
-  while (block) {
-    // Mark block labels.
-    auto label = block->label_head;
-    while (label) {
-      L(label->name);
-      label = label->next;
+  // Hot blocks are emitted in order ahead of the epilog and cold ones (those
+  // the profile says never ran) after it. Without a layout profile every
+  // block is hot.
+  std::vector<const Block*> blocks;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    blocks.push_back(block);
+  }
+  std::vector<size_t> layout;
+  std::vector<size_t> cold_blocks;
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    int32_t profile_index = -1;
+    if (!recording_block_profile_ && i) {
+      // The entry block must follow the prolog.
+      profile_index = GetBlockProfileIndex(blocks[i]);
+    }
+    if (profile_index != -1 && block_profile_[profile_index] == 1) {
+      cold_blocks.push_back(i);
+    } else {
+      layout.push_back(i);
+    }
+  }
+  size_t hot_block_count = layout.size();
+  layout.insert(layout.end(), cold_blocks.begin(), cold_blocks.end());
+
+  std::unique_ptr<Xbyak::Label[]> block_labels(
+      new Xbyak::Label[blocks.size()]);
+  for (size_t i = 0; i < layout.size(); ++i) {
+    if (i == hot_block_count) {
+      EmitEpilog(epilog_label, stack_size);
     }
 
-    // Process instructions.
-    const Instr* instr = block->instr_head;
-    while (instr) {
-      const Instr* new_tail = instr;
-      if (!SelectSequence(this, instr, &new_tail)) {
-        // No sequence found!
-        // NOTE: If you encounter this after adding a new instruction, do a full
-        // rebuild!
-        assert_always();
-        XELOGE("Unable to process HIR opcode %s", instr->opcode->name);
-        break;
+    size_t index = layout[i];
+    L(block_labels[index]);
+    EmitBlock(blocks[index]);
+
+    // Blocks that fall through need a jump when their successor was moved.
+    // A return only falls through (into the epilog) from the last block.
+    bool next_is_epilog = index + 1 == blocks.size();
+    auto tail = blocks[index]->instr_tail;
+    if (tail && (tail->opcode->num == hir::OPCODE_BRANCH ||
+                 (tail->opcode->num == hir::OPCODE_RETURN &&
+                  !next_is_epilog))) {
+      continue;
+    }
+    if (i + 1 == hot_block_count) {
+      if (!next_is_epilog) {
+        jmp(block_labels[index + 1], T_NEAR);
+      }
+    } else if (i + 1 == layout.size() || layout[i + 1] != index + 1) {
+      if (next_is_epilog) {
+        jmp(epilog_label, T_NEAR);
+      } else {
+        jmp(block_labels[index + 1], T_NEAR);
       }
-      instr = new_tail;
     }
-
-    block = block->next;
   }
-
-  // Function epilog.
-  L(epilog_label);
+  if (hot_block_count == layout.size()) {
+    EmitEpilog(epilog_label, stack_size);
+  }
   epilog_label_ = nullptr;
-  EmitTraceUserCallReturn();
-  mov(GetContextReg(), qword[rsp + StackLayout::GUEST_CTX_HOME]);
-  add(rsp, (uint32_t)stack_size);
-  ret();
 
   if (FLAGS_emit_source_annotations) {
     nop();
@@ -253,14 +400,97 @@ bool X64Emitter::Emit(HIRBuilder* builder, size_t* out_stack_size) {
     nop();
   }
 
+  EmitXmmConstantPool();
+
   return true;
 }
 
+void X64Emitter::EmitEpilog(Xbyak::Label& epilog_label, size_t stack_size) {
+  L(epilog_label);
+  if (frame_elided_) {
+    // Nothing could have changed the context register.
+    ret();
+    return;
+  }
+  EmitTraceUserCallReturn();
+  mov(GetContextReg(), qword[rsp + StackLayout::GUEST_CTX_HOME]);
+  add(rsp, (uint32_t)stack_size);
+  ret();
+}
+
+void X64Emitter::EmitXmmConstantPool() {
+  if (xmm_pool_.empty()) {
+    return;
+  }
+  // Code is placed at 16b alignment, so this keeps the constants aligned.
+  while (getSize() & 15) {
+    int3();
+  }
+  for (auto& constant : xmm_pool_) {
+    L(*constant.label);
+    dq(constant.value.low);
+    dq(constant.value.high);
+  }
+}
+
+void X64Emitter::EmitBlock(const Block* block) {
+  // Mark block labels.
+  auto label = block->label_head;
+  while (label) {
+    L(label->name);
+    label = label->next;
+  }
+  known_rounding_mode_ = -1;
+
+  if (recording_block_profile_) {
+    int32_t profile_index = GetBlockProfileIndex(block);
+    if (profile_index != -1) {
+      // 1 marks the instruction as a block start that never ran.
+      block_profile_[profile_index] = 1;
+      MovSessionAddress(
+          rax, reinterpret_cast<uint64_t>(&block_profile_[profile_index]));
+      inc(dword[rax]);
+    }
+  }
+
+  // Process instructions.
+  const Instr* instr = block->instr_head;
+  while (instr) {
+    const Instr* new_tail = instr;
+    if (!SelectSequence(this, instr, &new_tail)) {
+      // No sequence found!
+      // NOTE: If you encounter this after adding a new instruction, do a full
+      // rebuild!
+      assert_always();
+      XELOGE("Unable to process HIR opcode %s", instr->opcode->name);
+      break;
+    }
+    instr = new_tail;
+  }
+}
+
+int32_t X64Emitter::GetBlockProfileIndex(const Block* block) const {
+  if (!block_profile_) {
+    return -1;
+  }
+  // Blocks are identified by the guest instruction they start at, which is
+  // stable across the baseline and optimized pipelines.
+  for (auto instr = block->instr_head; instr; instr = instr->next) {
+    if (instr->opcode->num == hir::OPCODE_SOURCE_OFFSET) {
+      uint32_t index =
+          (static_cast<uint32_t>(instr->src1.offset) - function_address_) / 4;
+      return index < block_profile_count_ ? int32_t(index) : -1;
+    }
+  }
+  return -1;
+}
+
 void X64Emitter::MarkSourceOffset(const Instr* i) {
   auto entry = source_map_arena_.Alloc<SourceMapEntry>();
   entry->guest_address = static_cast<uint32_t>(i->src1.offset);
   entry->hir_offset = uint32_t(i->block->ordinal << 16) | i->ordinal;
   entry->code_offset = static_cast<uint32_t>(getSize());
+  current_guest_address_ = entry->guest_address;
 
   if (FLAGS_emit_source_annotations) {
     nop();
@@ -284,9 +514,69 @@ void X64Emitter::EmitGetCurrentThreadId() {
   mov(ax, word[GetContextReg() + offsetof(ppc::PPCContext, thread_id)]);
 }
 
-void X64Emitter::EmitTraceUserCallReturn() {}
+void X64Emitter::EmitTraceUserCallReturn() {
+  if (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionRecords) {
+    EmitTraceFunctionRecord(FunctionTraceRecord::kReturn);
+  }
+}
+
+void X64Emitter::EmitTraceFunctionRecord(uint32_t type) {
+  // Tail calls have their target in rax, so everything used is kept.
+  Xbyak::Label dropped, done;
+  push(rax);
+  push(rcx);
+  push(rdx);
+  mov(rcx, qword[GetContextReg() +
+                 offsetof(ppc::PPCContext, function_trace_ring)]);
+  test(rcx, rcx);
+  jz(done, T_NEAR);
+
+  // Full unless the recorder has drained past write_index - kRecordCount.
+  mov(rax, qword[rcx + offsetof(FunctionTraceRing, write_index)]);
+  mov(rdx, rax);
+  sub(rdx, qword[rcx + offsetof(FunctionTraceRing, read_index)]);
+  cmp(rdx, FunctionTraceRing::kRecordCount);
+  jae(dropped, T_NEAR);
+
+  // rcx = record.
+  and_(eax, FunctionTraceRing::kRecordCount - 1);
+  shl(eax, 5);
+  lea(rcx, ptr[rcx + rax + offsetof(FunctionTraceRing, records)]);
+  mov(dword[rcx + offsetof(FunctionTraceRecord, guest_address)],
+      function_address_);
+  mov(dword[rcx + offsetof(FunctionTraceRecord, type)], type);
+  if (FLAGS_trace_function_records_gprs) {
+    for (uint32_t i = 0; i < 2; ++i) {
+      mov(rax, qword[GetContextReg() + offsetof(ppc::PPCContext, r) +
+                     (3 + i) * sizeof(uint64_t)]);
+      mov(qword[rcx + offsetof(FunctionTraceRecord, gprs) +
+                i * sizeof(uint64_t)],
+          rax);
+    }
+  }
+  rdtsc();
+  shl(rdx, 32);
+  or_(rax, rdx);
+  mov(qword[rcx + offsetof(FunctionTraceRecord, timestamp)], rax);
+
+  // Publish the record. Only this thread writes write_index, and x64 makes
+  // the stores above visible first.
+  mov(rcx, qword[GetContextReg() +
+                 offsetof(ppc::PPCContext, function_trace_ring)]);
+  inc(qword[rcx + offsetof(FunctionTraceRing, write_index)]);
+  jmp(done, T_NEAR);
+
+  L(dropped);
+  inc(qword[rcx + offsetof(FunctionTraceRing, dropped_count)]);
+
+  L(done);
+  pop(rdx);
+  pop(rcx);
+  pop(rax);
+}
 
 void X64Emitter::DebugBreak() {
+  frame_used_ = true;
   // TODO(benvanik): notify debugger.
   db(0xCC);
 }
@@ -316,6 +606,7 @@ uint64_t TrapDebugBreak(void* raw_context, uint64_t address) {
 }
 
 void X64Emitter::Trap(uint16_t trap_type) {
+  frame_used_ = true;
   switch (trap_type) {
     case 20:
     case 26:
@@ -331,6 +622,16 @@ void X64Emitter::Trap(uint16_t trap_type) {
     case 25:
       // ?
       break;
+    case Probe::kBreakTrapType:
+      // ud2 and nop dword [rax + marker]. The ud2 stays in the code, and the
+      // backend resumes past it.
+      db(0x0F);
+      db(0x0B);
+      db(0x0F);
+      db(0x1F);
+      db(0x80);
+      dd(X64Backend::kProbeBreakMarker);
+      break;
     default:
       XELOGW("Unknown trap type %d", trap_type);
       db(0xCC);
@@ -361,11 +662,62 @@ extern "C" uint64_t ResolveFunction(void* raw_context,
   return addr;
 }
 
+uint64_t TierUpFunction(void* raw_context, uint64_t function_ptr) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto function = reinterpret_cast<GuestFunction*>(function_ptr);
+  thread_state->processor()->TierUpFunction(function);
+  return 0;
+}
+
 void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
   assert_not_null(function);
+  frame_used_ = true;
+  known_rounding_mode_ = -1;
   auto fn = static_cast<X64Function*>(function);
+  if (code_cache_->has_indirection_table() && !code_cache_->is_persisting()) {
+    // Direct rel32 call that X64CodeCache repatches whenever the target code
+    // is placed or replaced. Until then it goes through a thunk that does the
+    // indirection table lookup, which needs the guest address in ebx.
+    mov(ebx, function->address());
+    const void* target = fn->machine_code();
+    if (!target) {
+      target = reinterpret_cast<const void*>(backend()->indirect_call_thunk());
+    }
+    bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+    if (is_tail) {
+      // Since we skip the prolog we need to mark the return here.
+      EmitTraceUserCallReturn();
+
+      // Pass the callers return address over.
+      mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+
+      add(rsp, static_cast<uint32_t>(stack_size()));
+    } else {
+      // Return address is from the previous SET_RETURN_ADDRESS.
+      mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+    }
+    // Align the displacement so it can be patched atomically. Code is placed
+    // at 16b alignment so offsets within the function are enough.
+    while ((getSize() + 1) & 0x3) {
+      nop();
+    }
+    if (is_tail) {
+      jmp(target, CodeGenerator::T_NEAR);
+    } else {
+      call(target);
+    }
+    patchable_call_sites_.push_back(
+        {uint32_t(getSize() - 4), function->address()});
+    return;
+  }
+
   // Resolve address to the function to call and store in rax.
-  if (fn->machine_code()) {
+  // Persisted code can't reference other generated code directly, as it will
+  // be placed elsewhere when restored.
+  // Baseline code is going to be replaced, so it is always called through the
+  // table to pick up the optimized version once it is ready.
+  if (fn->machine_code() && !code_cache_->is_persisting() &&
+      fn->tier() != GuestFunction::Tier::kBaseline) {
     // TODO(benvanik): is it worth it to do this? It removes the need for
     // a ResolveFunction call, but makes the table less useful.
     assert_zero(uint64_t(fn->machine_code()) & 0xFFFFFFFF00000000);
@@ -403,12 +755,21 @@ void X64Emitter::Call(const hir::Instr* instr, GuestFunction* function) {
 
 void X64Emitter::CallIndirect(const hir::Instr* instr,
                               const Xbyak::Reg64& reg) {
+  frame_used_ = true;
+  known_rounding_mode_ = -1;
   // Check if return.
   if (instr->flags & hir::CALL_POSSIBLE_RETURN) {
     cmp(reg.cvt32(), dword[rsp + StackLayout::GUEST_RET_ADDR]);
     je(epilog_label(), CodeGenerator::T_NEAR);
   }
 
+  // Monomorphic inline cache, guarding a direct call to whichever target the
+  // site first sees. Misses fall through to the indirection table.
+  Xbyak::Label inline_cache_done;
+  if (code_cache_->has_indirection_table()) {
+    EmitInlineCache(instr, reg, inline_cache_done);
+  }
+
   // Load the pointer to the indirection table maintained in X64CodeCache.
   // The target dword will either contain the address of the generated code
   // or a thunk to ResolveAddress.
@@ -442,6 +803,97 @@ void X64Emitter::CallIndirect(const hir::Instr* instr,
 
     call(rax);
   }
+  L(inline_cache_done);
+}
+
+uint64_t FillInlineCache(void* raw_context, uint64_t guest_field,
+                         uint64_t displacement, uint64_t guest_address) {
+  auto thread_state = *reinterpret_cast<ThreadState**>(raw_context);
+  auto backend =
+      reinterpret_cast<X64Backend*>(thread_state->processor()->backend());
+  backend->code_cache()->FillInlineCache(
+      reinterpret_cast<uint32_t*>(guest_field),
+      reinterpret_cast<uint8_t*>(displacement), uint32_t(guest_address));
+  return 0;
+}
+
+void X64Emitter::EmitInlineCache(const hir::Instr* instr,
+                                 const Xbyak::Reg64& reg,
+                                 Xbyak::Label& done_label) {
+  auto reg32 = reg.cvt32();
+  bool is_tail = (instr->flags & hir::CALL_TAIL) != 0;
+  bool count_hits =
+      (debug_info_flags_ & DebugInfoFlags::kDebugInfoTraceFunctionCoverage) ==
+      DebugInfoFlags::kDebugInfoTraceFunctionCoverage;
+  uint8_t* counts = nullptr;
+  if (count_hits) {
+    uint32_t instruction_index =
+        (current_guest_address_ - trace_data_->start_address()) / 4;
+    counts = trace_data_->inline_cache_counts() + instruction_index * 16;
+  }
+
+  Xbyak::Label guest_field;
+  Xbyak::Label displacement;
+  Xbyak::Label miss;
+  Xbyak::Label table;
+
+  // cmp reg32, imm32, encoded by hand to force the imm32 form and to land the
+  // immediate on a 4b boundary so that it can be filled atomically.
+  size_t prefix_length = reg32.getIdx() >= 8 ? 3 : 2;
+  while ((getSize() + prefix_length) & 0x3) {
+    nop();
+  }
+  if (reg32.getIdx() >= 8) {
+    db(0x41);
+  }
+  db(0x81);
+  db(0xF8 | (reg32.getIdx() & 0x7));
+  L(guest_field);
+  dd(X64CodeCache::kInlineCacheEmpty);
+  jne(miss, CodeGenerator::T_NEAR);
+
+  // Hit.
+  if (count_hits) {
+    lock();
+    inc(qword[low_address(counts)]);
+  }
+  // The target may be unpatched back to the indirect call thunk, which needs
+  // the guest address in ebx.
+  if (reg32 != ebx) {
+    mov(ebx, reg32);
+  }
+  if (is_tail) {
+    EmitTraceUserCallReturn();
+    mov(rcx, qword[rsp + StackLayout::GUEST_RET_ADDR]);
+    add(rsp, static_cast<uint32_t>(stack_size()));
+  } else {
+    mov(rcx, qword[rsp + StackLayout::GUEST_CALL_RET_ADDR]);
+  }
+  // call/jmp rel32. The displacement is only reachable once filled.
+  while ((getSize() + 1) & 0x3) {
+    nop();
+  }
+  db(is_tail ? 0xE9 : 0xE8);
+  L(displacement);
+  dd(0);
+  if (!is_tail) {
+    jmp(done_label, CodeGenerator::T_NEAR);
+  }
+
+  // Miss. Fill the cache if this is the first target seen, then take the
+  // table path below.
+  L(miss);
+  if (count_hits) {
+    lock();
+    inc(qword[low_address(counts + 8)]);
+  }
+  cmp(dword[rip + guest_field], X64CodeCache::kInlineCacheEmpty);
+  jne(table, CodeGenerator::T_NEAR);
+  lea(GetNativeParam(0), ptr[rip + guest_field]);
+  lea(GetNativeParam(1), ptr[rip + displacement]);
+  mov(GetNativeParam(2).cvt32(), reg32);
+  CallNativeSafe(reinterpret_cast<void*>(FillInlineCache));
+  L(table);
 }
 
 uint64_t UndefinedCallExtern(void* raw_context, uint64_t function_ptr) {
@@ -456,6 +908,8 @@ uint64_t UndefinedCallExtern(void* raw_context, uint64_t function_ptr) {
   return 0;
 }
 void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
+  frame_used_ = true;
+  known_rounding_mode_ = -1;
   bool undefined = true;
   if (function->behavior() == Function::Behavior::kBuiltin) {
     auto builtin_function = static_cast<const BuiltinFunction*>(function);
@@ -467,9 +921,12 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(builtin_function->handler()));
-      mov(rdx, reinterpret_cast<uint64_t>(builtin_function->arg0()));
-      mov(r8, reinterpret_cast<uint64_t>(builtin_function->arg1()));
+      MovHostImageAddress(
+          rcx, reinterpret_cast<const void*>(builtin_function->handler()));
+      MovSessionAddress(rdx,
+                        reinterpret_cast<uint64_t>(builtin_function->arg0()));
+      MovSessionAddress(r8,
+                        reinterpret_cast<uint64_t>(builtin_function->arg1()));
       call(rax);
       // rax = host return
     }
@@ -477,22 +934,105 @@ void X64Emitter::CallExtern(const hir::Instr* instr, const Function* function) {
     auto extern_function = static_cast<const GuestFunction*>(function);
     if (extern_function->extern_handler()) {
       undefined = false;
+      Xbyak::Label fast_path_done;
+      bool has_fast_path = EmitExternFastPath(extern_function, fast_path_done);
       // rcx = target function
       // rdx = arg0
       // r8  = arg1
       // r9  = arg2
       auto thunk = backend()->guest_to_host_thunk();
       mov(rax, reinterpret_cast<uint64_t>(thunk));
-      mov(rcx, reinterpret_cast<uint64_t>(extern_function->extern_handler()));
+      MovHostImageAddress(rcx, reinterpret_cast<const void*>(
+                                   extern_function->extern_handler()));
       mov(rdx,
           qword[GetContextReg() + offsetof(ppc::PPCContext, kernel_state)]);
       call(rax);
       // rax = host return
+      if (has_fast_path) {
+        L(fast_path_done);
+      }
     }
   }
   if (undefined) {
-    CallNative(UndefinedCallExtern, reinterpret_cast<uint64_t>(function));
+    MovSessionAddress(GetNativeParam(0), reinterpret_cast<uint64_t>(function));
+    CallNative(UndefinedCallExtern);
+  }
+}
+
+// Guest layout of X_RTL_CRITICAL_SECTION (see xboxkrnl_rtl.cc). lock_count
+// is only ever touched by the kernel and these fast paths, and is kept in
+// host byte order; the rest is big-endian.
+static const int32_t kCriticalSectionLockCountOffset = 0x10;
+static const int32_t kCriticalSectionRecursionCountOffset = 0x14;
+static const int32_t kCriticalSectionOwningThreadOffset = 0x18;
+// Offset of the current KTHREAD pointer in the KPCR that r13 points to.
+static const int32_t kPcrCurrentThreadOffset = 0x100;
+// 1 as stored big-endian.
+static const uint32_t kBigEndianOne = 0x01000000;
+
+bool X64Emitter::EmitExternFastPath(const GuestFunction* function,
+                                    Xbyak::Label& done_label) {
+  auto export_data = function->export_data();
+  if (!FLAGS_inline_critical_sections || !export_data) {
+    return false;
+  }
+  bool enter = !std::strcmp(export_data->name, "RtlEnterCriticalSection");
+  bool leave = !std::strcmp(export_data->name, "RtlLeaveCriticalSection");
+  if (!enter && !leave) {
+    return false;
+  }
+
+  // Only the scratch registers are used; nothing needs saving.
+  // rcx = host address of the critical section (r3)
+  // edx = current thread, big-endian as stored in guest memory, once loaded
+  Xbyak::Label slow_path;
+  auto load_current_thread = [this]() {
+    mov(edx, dword[GetContextReg() + offsetof(ppc::PPCContext, r[13])]);
+    mov(edx, dword[GetMembaseReg() + rdx + kPcrCurrentThreadOffset]);
+  };
+  mov(ecx, dword[GetContextReg() + offsetof(ppc::PPCContext, r[3])]);
+  add(rcx, GetMembaseReg());
+  if (enter) {
+    // Unowned: lock_count -1 -> 0. Anything else (owned by us or by someone
+    // else) goes to the kernel.
+    mov(eax, -1);
+    xor_(edx, edx);
+    lock();
+    cmpxchg(dword[rcx + kCriticalSectionLockCountOffset], edx);
+    jnz(slow_path, CodeGenerator::T_NEAR);
+    load_current_thread();
+    mov(dword[rcx + kCriticalSectionOwningThreadOffset], edx);
+    mov(dword[rcx + kCriticalSectionRecursionCountOffset], kBigEndianOne);
+    jmp(done_label, CodeGenerator::T_NEAR);
+  } else {
+    // Held once by us with no waiters: lock_count 0 -> -1. Ownership is
+    // dropped first so that it is never visible after the release. If there
+    // turn out to be waiters nobody else can have taken the lock, so it is
+    // put back before handing off to the kernel to wake one.
+    cmp(dword[rcx + kCriticalSectionRecursionCountOffset], kBigEndianOne);
+    jne(slow_path, CodeGenerator::T_NEAR);
+    load_current_thread();
+    cmp(dword[rcx + kCriticalSectionOwningThreadOffset], edx);
+    jne(slow_path, CodeGenerator::T_NEAR);
+    mov(dword[rcx + kCriticalSectionRecursionCountOffset], 0);
+    mov(dword[rcx + kCriticalSectionOwningThreadOffset], 0);
+    xor_(eax, eax);
+    mov(edx, -1);
+    lock();
+    cmpxchg(dword[rcx + kCriticalSectionLockCountOffset], edx);
+    je(done_label, CodeGenerator::T_NEAR);
+    load_current_thread();
+    mov(dword[rcx + kCriticalSectionOwningThreadOffset], edx);
+    mov(dword[rcx + kCriticalSectionRecursionCountOffset], kBigEndianOne);
   }
+
+  L(slow_path);
+  MovSessionAddress(rax,
+                    reinterpret_cast<uint64_t>(
+                        backend()->critical_section_slow_path_count_ptr()));
+  lock();
+  inc(qword[rax]);
+  return true;
 }
 
 void X64Emitter::CallNative(void* fn) { CallNativeSafe(fn); }
@@ -512,18 +1052,20 @@ void X64Emitter::CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0),
 }
 
 void X64Emitter::CallNativeSafe(void* fn) {
+  frame_used_ = true;
   // rcx = target function
   // rdx = arg0
   // r8  = arg1
   // r9  = arg2
   auto thunk = backend()->guest_to_host_thunk();
   mov(rax, reinterpret_cast<uint64_t>(thunk));
-  mov(rcx, reinterpret_cast<uint64_t>(fn));
+  MovHostImageAddress(rcx, fn);
   call(rax);
   // rax = host return
 }
 
 void X64Emitter::SetReturnAddress(uint64_t value) {
+  frame_used_ = true;
   mov(rax, value);
   mov(qword[rsp + StackLayout::GUEST_CALL_RET_ADDR], rax);
 }
@@ -540,11 +1082,39 @@ Xbyak::Reg64 X64Emitter::GetNativeParam(uint32_t param) {
   return r9;
 }
 
+void X64Emitter::MovHostImageAddress(const Xbyak::Reg64& dest,
+                                     const void* address) {
+  uint64_t value = reinterpret_cast<uint64_t>(address);
+  mov(dest, value);
+
+  // Only full 64-bit immediates can be patched in place. Xbyak picks a shorter
+  // encoding when the value fits in 32 bits, which can't be relocated.
+  uint64_t encoded_value;
+  std::memcpy(&encoded_value, getCurr() - sizeof(uint64_t),
+              sizeof(encoded_value));
+  if (encoded_value != value) {
+    persistable_ = false;
+    return;
+  }
+
+  X64CodeCache::HostRelocation relocation;
+  relocation.code_offset = uint32_t(getSize() - sizeof(uint64_t));
+  relocation.reserved = 0;
+  relocation.image_offset = X64CodeCache::HostImageOffset(address);
+  host_relocations_.push_back(relocation);
+}
+
+void X64Emitter::MovSessionAddress(const Xbyak::Reg64& dest, uint64_t address) {
+  mov(dest, address);
+  persistable_ = false;
+}
+
 // Important: If you change these, you must update the thunks in x64_backend.cc!
 Xbyak::Reg64 X64Emitter::GetContextReg() { return rsi; }
 Xbyak::Reg64 X64Emitter::GetMembaseReg() { return rdi; }
 
 void X64Emitter::ReloadContext() {
+  frame_used_ = true;
   mov(GetContextReg(), qword[rsp + StackLayout::GUEST_CTX_HOME]);
 }
 
@@ -742,6 +1312,24 @@ Xbyak::Address X64Emitter::GetXmmConstPtr(XmmConst id) {
                                      sizeof(vec128_t) * id)];
 }
 
+Xbyak::Address X64Emitter::GetXmmConstPtr(const vec128_t& v) {
+  for (size_t id = 0; id < xe::countof(xmm_consts); ++id) {
+    if (xmm_consts[id] == v) {
+      return GetXmmConstPtr(XmmConst(id));
+    }
+  }
+  // Anything else goes in the pool at the end of the function, shared by all
+  // the uses in it. Being RIP-relative it moves with the code, so it doesn't
+  // get in the way of persisting it.
+  for (auto& constant : xmm_pool_) {
+    if (constant.value == v) {
+      return ptr[rip + *constant.label];
+    }
+  }
+  xmm_pool_.push_back({v, std::unique_ptr<Xbyak::Label>(new Xbyak::Label())});
+  return ptr[rip + *xmm_pool_.back().label];
+}
+
 void X64Emitter::LoadConstantXmm(Xbyak::Xmm dest, const vec128_t& v) {
   // https://www.agner.org/optimize/optimizing_assembly.pdf
   // 13.4 Generating constants
@@ -752,11 +1340,7 @@ void X64Emitter::LoadConstantXmm(Xbyak::Xmm dest, const vec128_t& v) {
     // 1111...
     vpcmpeqb(dest, dest);
   } else {
-    // TODO(benvanik): see what other common values are.
-    // TODO(benvanik): build constant table - 99% are reused.
-    MovMem64(rsp + kStashOffset, v.low);
-    MovMem64(rsp + kStashOffset + 8, v.high);
-    vmovdqa(dest, ptr[rsp + kStashOffset]);
+    vmovdqa(dest, GetXmmConstPtr(v));
   }
 }
 
@@ -799,6 +1383,7 @@ void X64Emitter::LoadConstantXmm(Xbyak::Xmm dest, double v) {
 }
 
 Xbyak::Address X64Emitter::StashXmm(int index, const Xbyak::Xmm& r) {
+  frame_used_ = true;
   auto addr = ptr[rsp + kStashOffset + (index * 16)];
   vmovups(addr, r);
   return addr;
@@ -10,9 +10,11 @@
 #ifndef XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 #define XENIA_CPU_BACKEND_X64_X64_EMITTER_H_
 
+#include <memory>
 #include <vector>
 
 #include "xenia/base/arena.h"
+#include "xenia/cpu/backend/x64/x64_code_cache.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/hir/hir_builder.h"
@@ -37,7 +39,6 @@ namespace backend {
 namespace x64 {
 
 class X64Backend;
-class X64CodeCache;
 
 enum RegisterFlags {
   REG_DEST = (1 << 0),
@@ -120,6 +121,9 @@ enum X64EmitterFeatureFlags {
   kX64EmitBMI2 = 1 << 4,
   kX64EmitF16C = 1 << 5,
   kX64EmitMovbe = 1 << 6,
+  // AVX-512 F+BW+VL, which lets us use EVEX encodings on xmm registers.
+  kX64EmitAVX512 = 1 << 7,
+  kX64EmitAVX512VBMI = 1 << 8,
 };
 
 class X64Emitter : public Xbyak::CodeGenerator {
@@ -129,6 +133,8 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   Processor* processor() const { return processor_; }
   X64Backend* backend() const { return backend_; }
+  uint32_t feature_flags() const { return feature_flags_; }
+  uint32_t debug_info_flags() const { return debug_info_flags_; }
 
   static uintptr_t PlaceConstData();
   static void FreeConstData(uintptr_t data);
@@ -178,7 +184,15 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   void Call(const hir::Instr* instr, GuestFunction* function);
   void CallIndirect(const hir::Instr* instr, const Xbyak::Reg64& reg);
+  // Emits an inline cache in front of the indirection table lookup of
+  // CallIndirect. Jumps to done_label on a hit.
+  void EmitInlineCache(const hir::Instr* instr, const Xbyak::Reg64& reg,
+                       Xbyak::Label& done_label);
   void CallExtern(const hir::Instr* instr, const Function* function);
+  // Emits an inline version of the common case of some kernel exports. Jumps
+  // to done_label when it succeeds, otherwise falls through to the call.
+  bool EmitExternFastPath(const GuestFunction* function,
+                          Xbyak::Label& done_label);
   void CallNative(void* fn);
   void CallNative(uint64_t (*fn)(void* raw_context));
   void CallNative(uint64_t (*fn)(void* raw_context, uint64_t arg0));
@@ -189,6 +203,19 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   Xbyak::Reg64 GetNativeParam(uint32_t param);
 
+  // Loads the address of a function or data within the host executable.
+  // These are recorded as relocations so the code can be persisted.
+  void MovHostImageAddress(const Xbyak::Reg64& dest, const void* address);
+  // Loads a host address only valid for this session, such as a heap object.
+  // Code using this cannot be persisted.
+  void MovSessionAddress(const Xbyak::Reg64& dest, uint64_t address);
+
+  // True if the emitted code can be stored in the persistent code cache.
+  bool is_persistable() const { return persistable_; }
+  const std::vector<X64CodeCache::HostRelocation>& host_relocations() const {
+    return host_relocations_;
+  }
+
   Xbyak::Reg64 GetContextReg();
   Xbyak::Reg64 GetMembaseReg();
   void ReloadContext();
@@ -203,6 +230,9 @@ class X64Emitter : public Xbyak::CodeGenerator {
   void MovMem64(const Xbyak::RegExp& addr, uint64_t v);
 
   Xbyak::Address GetXmmConstPtr(XmmConst id);
+  // Any other constant, from the fixed table when it has it. Either way the
+  // address can be used directly as a memory operand.
+  Xbyak::Address GetXmmConstPtr(const vec128_t& v);
   void LoadConstantXmm(Xbyak::Xmm dest, float v);
   void LoadConstantXmm(Xbyak::Xmm dest, double v);
   void LoadConstantXmm(Xbyak::Xmm dest, const vec128_t& v);
@@ -216,11 +246,29 @@ class X64Emitter : public Xbyak::CodeGenerator {
 
   size_t stack_size() const { return stack_size_; }
 
+  // Rounding mode the host MXCSR is known to be in at this point in the
+  // generated code, or -1 if it could be anything. Only tracked within a
+  // block and reset by calls, which may run guest code that changes it.
+  int32_t known_rounding_mode() const { return known_rounding_mode_; }
+  void set_known_rounding_mode(int32_t mode) { known_rounding_mode_ = mode; }
+
  protected:
   void* Emplace(size_t stack_size, GuestFunction* function = nullptr);
+  // Whether the function looks like it can run without a stack frame: no
+  // calls, no spills and no prolog work.
+  bool CanElideFrame(hir::HIRBuilder* builder) const;
   bool Emit(hir::HIRBuilder* builder, size_t* out_stack_size);
+  void EmitEpilog(Xbyak::Label& epilog_label, size_t stack_size);
+  void EmitXmmConstantPool();
+  void EmitBlock(const hir::Block* block);
+  // Index of the block into the block profile, or -1 if it doesn't start at a
+  // guest instruction.
+  int32_t GetBlockProfileIndex(const hir::Block* block) const;
   void EmitGetCurrentThreadId();
   void EmitTraceUserCallReturn();
+  // Appends a FunctionTraceRecord of the given type for this function to the
+  // ring of the thread. Preserves all registers but the flags.
+  void EmitTraceFunctionRecord(uint32_t type);
 
  protected:
   Processor* processor_ = nullptr;
@@ -237,9 +285,42 @@ class X64Emitter : public Xbyak::CodeGenerator {
   FunctionDebugInfo* debug_info_ = nullptr;
   uint32_t debug_info_flags_ = 0;
   FunctionTraceData* trace_data_ = nullptr;
+  // Guest address of the last source offset marked.
+  uint32_t current_guest_address_ = 0;
+  // Set while emitting baseline tier code, which counts its calls.
+  GuestFunction* tier_up_function_ = nullptr;
+  // Block profile being recorded by baseline code (if recording) or guiding
+  // the layout of optimized code, indexed by guest instruction.
+  uint32_t* block_profile_ = nullptr;
+  uint32_t block_profile_count_ = 0;
+  bool recording_block_profile_ = false;
+  uint32_t function_address_ = 0;
   Arena source_map_arena_;
 
   size_t stack_size_ = 0;
+  int32_t known_rounding_mode_ = -1;
+  // Set while emitting without a stack frame, and by anything emitted that
+  // needs one after all.
+  bool frame_elided_ = false;
+  bool frame_used_ = false;
+
+  // Vector constants referenced by the current function, emitted after its
+  // code.
+  struct XmmPoolConstant {
+    vec128_t value;
+    std::unique_ptr<Xbyak::Label> label;
+  };
+  std::vector<XmmPoolConstant> xmm_pool_;
+
+  bool persistable_ = true;
+  std::vector<X64CodeCache::HostRelocation> host_relocations_;
+
+  // Direct call displacements emitted into the current function.
+  struct PatchableCallSite {
+    uint32_t code_offset;
+    uint32_t guest_address;
+  };
+  std::vector<PatchableCallSite> patchable_call_sites_;
 
   static const uint32_t gpr_reg_map_[GPR_COUNT];
   static const uint32_t xmm_reg_map_[XMM_COUNT];
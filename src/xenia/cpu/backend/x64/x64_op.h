@@ -565,6 +565,23 @@ struct Sequence {
     }
   }
 
+  // Like the above, but a constant src2 is used straight from memory, so the
+  // function's last operand can be either a register or an address.
+  template <typename FN>
+  static void EmitBinaryVecOp(X64Emitter& e, const EmitArgType& i,
+                              const FN& fn) {
+    if (i.src1.is_constant) {
+      assert_true(!i.src2.is_constant);
+      e.LoadConstantXmm(e.xmm0, i.src1.constant());
+      fn(e, i.dest, e.xmm0, i.src2);
+    } else if (i.src2.is_constant) {
+      assert_true(!i.src1.is_constant);
+      fn(e, i.dest, i.src1, e.GetXmmConstPtr(i.src2.constant()));
+    } else {
+      fn(e, i.dest, i.src1, i.src2);
+    }
+  }
+
   template <typename REG_REG_FN, typename REG_CONST_FN>
   static void EmitCommutativeCompareOp(X64Emitter& e, const EmitArgType& i,
                                        const REG_REG_FN& reg_reg_fn,
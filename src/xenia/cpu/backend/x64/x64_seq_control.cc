@@ -450,6 +450,9 @@ EMITTER_OPCODE_TABLE(OPCODE_BRANCH, BRANCH);
 struct BRANCH_TRUE_I8
     : Sequence<BRANCH_TRUE_I8, I<OPCODE_BRANCH_TRUE, VoidOp, I8Op, LabelOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitFusedBranchTrue(e, i.instr)) {
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jnz(i.src2.value->name, e.T_NEAR);
   }
@@ -499,6 +502,9 @@ EMITTER_OPCODE_TABLE(OPCODE_BRANCH_TRUE, BRANCH_TRUE_I8, BRANCH_TRUE_I16,
 struct BRANCH_FALSE_I8
     : Sequence<BRANCH_FALSE_I8, I<OPCODE_BRANCH_FALSE, VoidOp, I8Op, LabelOp>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (EmitFusedBranchFalse(e, i.instr)) {
+      return;
+    }
     e.test(i.src1, i.src1);
     e.jz(i.src2.value->name, e.T_NEAR);
   }
@@ -12,8 +12,13 @@
 #include <algorithm>
 #include <cstring>
 
+#include "xenia/base/byte_order.h"
+#include "xenia/base/memory.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/backend/x64/x64_op.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
+#include "xenia/cpu/mmio_handler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
 
 namespace xe {
 namespace cpu {
@@ -42,9 +47,11 @@ RegExp ComputeMemoryAddressOffset(X64Emitter& e, const T& guest,
       e.mov(e.eax, address);
       return e.GetMembaseReg() + e.rax;
     }
+  } else if (guest.value->IsZeroExtended32()) {
+    // Already a 32-bit address.
+    return e.GetMembaseReg() + guest.reg() + offset_const;
   } else {
     // Clear the top 32 bits, as they are likely garbage.
-    // TODO(benvanik): find a way to avoid doing this.
     e.mov(e.eax, guest.reg().cvt32());
     return e.GetMembaseReg() + e.rax + offset_const;
   }
@@ -64,14 +71,101 @@ RegExp ComputeMemoryAddress(X64Emitter& e, const T& guest) {
       e.mov(e.eax, address);
       return e.GetMembaseReg() + e.rax;
     }
+  } else if (guest.value->IsZeroExtended32()) {
+    // Already a 32-bit address.
+    return e.GetMembaseReg() + guest.reg();
   } else {
     // Clear the top 32 bits, as they are likely garbage.
-    // TODO(benvanik): find a way to avoid doing this.
     e.mov(e.eax, guest.reg().cvt32());
     return e.GetMembaseReg() + e.rax;
   }
 }
 
+// All MMIO ranges are registered within 0x7F000000-0x7FFFFFFF, which is
+// otherwise only the GPU writeback and is rarely accessed.
+static const uint32_t kMmioWindowBase = 0x7F000000;
+static const uint32_t kMmioWindowSize = 0x01000000;
+
+// Values are passed and returned as they are in memory (big-endian), so the
+// sequences apply their own byte swapping as for a normal access.
+uint64_t LoadMmioWindowI32(void* raw_context, uint64_t address) {
+  auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+  uint32_t guest_address = static_cast<uint32_t>(address);
+  auto range = MMIOHandler::global_handler()->LookupRange(guest_address);
+  if (!range) {
+    return xe::load<uint32_t>(context->virtual_membase + guest_address);
+  }
+  return xe::byte_swap(
+      range->read(context, range->callback_context, guest_address));
+}
+uint64_t StoreMmioWindowI32(void* raw_context, uint64_t address,
+                            uint64_t value) {
+  auto context = reinterpret_cast<ppc::PPCContext*>(raw_context);
+  uint32_t guest_address = static_cast<uint32_t>(address);
+  auto range = MMIOHandler::global_handler()->LookupRange(guest_address);
+  if (!range) {
+    xe::store<uint32_t>(context->virtual_membase + guest_address,
+                        static_cast<uint32_t>(value));
+  } else {
+    range->write(context, range->callback_context, guest_address,
+                 xe::byte_swap(static_cast<uint32_t>(value)));
+  }
+  return 0;
+}
+
+// Branches to mmio_label with the full guest address in eax if a non-constant
+// address is within the MMIO window. Constant addresses in MMIO ranges have
+// already been turned into LOAD_MMIO/STORE_MMIO by constant propagation.
+template <typename T>
+bool EmitMmioWindowCheck(X64Emitter& e, const T& guest, int32_t offset,
+                         Xbyak::Label& mmio_label) {
+  if (!FLAGS_emit_mmio_range_check || guest.is_constant || IsTracingData()) {
+    return false;
+  }
+  e.mov(e.eax, guest.reg().cvt32());
+  if (offset) {
+    e.add(e.eax, offset);
+  }
+  e.lea(e.ecx, e.ptr[e.rax - int32_t(kMmioWindowBase)]);
+  e.cmp(e.ecx, kMmioWindowSize);
+  e.jb(mmio_label, CodeGenerator::T_NEAR);
+  return true;
+}
+
+// MMIO paths following the normal access, with the address in eax.
+template <typename T>
+void EmitMmioWindowLoadI32(X64Emitter& e, const T& i,
+                           Xbyak::Label& mmio_label) {
+  Xbyak::Label done;
+  e.jmp(done, CodeGenerator::T_NEAR);
+  e.L(mmio_label);
+  e.mov(e.GetNativeParam(0).cvt32(), e.eax);
+  e.CallNativeSafe(reinterpret_cast<void*>(LoadMmioWindowI32));
+  if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+    e.bswap(e.eax);
+  }
+  e.mov(i.dest, e.eax);
+  e.L(done);
+}
+template <typename T>
+void EmitMmioWindowStoreI32(X64Emitter& e, const T& i, const I32Op& value,
+                            Xbyak::Label& mmio_label) {
+  Xbyak::Label done;
+  e.jmp(done, CodeGenerator::T_NEAR);
+  e.L(mmio_label);
+  e.mov(e.GetNativeParam(0).cvt32(), e.eax);
+  if (value.is_constant) {
+    e.mov(e.GetNativeParam(1).cvt32(), value.constant());
+  } else {
+    e.mov(e.GetNativeParam(1).cvt32(), value);
+    if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
+      e.bswap(e.GetNativeParam(1).cvt32());
+    }
+  }
+  e.CallNativeSafe(reinterpret_cast<void*>(StoreMmioWindowI32));
+  e.L(done);
+}
+
 // ============================================================================
 // OPCODE_ATOMIC_EXCHANGE
 // ============================================================================
@@ -141,10 +235,20 @@ struct ATOMIC_COMPARE_EXCHANGE_I32
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I32,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I32Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.eax, i.src2);
+    if (i.src2.is_constant) {
+      e.mov(e.eax, i.src2.constant());
+    } else {
+      e.mov(e.eax, i.src2);
+    }
     e.mov(e.ecx, i.src1.reg().cvt32());
+    Xbyak::Reg32 new_value = e.edx;
+    if (i.src3.is_constant) {
+      e.mov(new_value, i.src3.constant());
+    } else {
+      new_value = i.src3;
+    }
     e.lock();
-    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], i.src3);
+    e.cmpxchg(e.dword[e.GetMembaseReg() + e.rcx], new_value);
     e.sete(i.dest);
   }
 };
@@ -152,10 +256,20 @@ struct ATOMIC_COMPARE_EXCHANGE_I64
     : Sequence<ATOMIC_COMPARE_EXCHANGE_I64,
                I<OPCODE_ATOMIC_COMPARE_EXCHANGE, I8Op, I64Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.rax, i.src2);
+    if (i.src2.is_constant) {
+      e.mov(e.rax, i.src2.constant());
+    } else {
+      e.mov(e.rax, i.src2);
+    }
     e.mov(e.ecx, i.src1.reg().cvt32());
+    Xbyak::Reg64 new_value = e.rdx;
+    if (i.src3.is_constant) {
+      e.mov(new_value, i.src3.constant());
+    } else {
+      new_value = i.src3;
+    }
     e.lock();
-    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], i.src3);
+    e.cmpxchg(e.qword[e.GetMembaseReg() + e.rcx], new_value);
     e.sete(i.dest);
   }
 };
@@ -505,7 +619,8 @@ struct LOAD_MMIO_I32
     // uint64_t (context, addr)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto read_address = uint32_t(i.src2.value);
-    e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
+    e.MovSessionAddress(e.GetNativeParam(0),
+                        uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), read_address);
     e.CallNativeSafe(reinterpret_cast<void*>(mmio_range->read));
     e.bswap(e.eax);
@@ -530,7 +645,8 @@ struct STORE_MMIO_I32
     // void (context, addr, value)
     auto mmio_range = reinterpret_cast<MMIORange*>(i.src1.value);
     auto write_address = uint32_t(i.src2.value);
-    e.mov(e.GetNativeParam(0), uint64_t(mmio_range->callback_context));
+    e.MovSessionAddress(e.GetNativeParam(0),
+                        uint64_t(mmio_range->callback_context));
     e.mov(e.GetNativeParam(1).cvt32(), write_address);
     if (i.src3.is_constant) {
       e.mov(e.GetNativeParam(2).cvt32(), xe::byte_swap(i.src3.constant()));
@@ -583,7 +699,12 @@ struct LOAD_OFFSET_I16
 struct LOAD_OFFSET_I32
     : Sequence<LOAD_OFFSET_I32, I<OPCODE_LOAD_OFFSET, I32Op, I64Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    auto addr = ComputeMemoryAddressOffset(e, i.src1, i.src2);
+    Xbyak::Label mmio;
+    bool mmio_check = EmitMmioWindowCheck(
+        e, i.src1, static_cast<int32_t>(i.src2.constant()), mmio);
+    // The check leaves the full address in eax.
+    auto addr = mmio_check ? e.GetMembaseReg() + e.rax
+                           : ComputeMemoryAddressOffset(e, i.src1, i.src2);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
         e.movbe(i.dest, e.dword[addr]);
@@ -594,6 +715,9 @@ struct LOAD_OFFSET_I32
     } else {
       e.mov(i.dest, e.dword[addr]);
     }
+    if (mmio_check) {
+      EmitMmioWindowLoadI32(e, i, mmio);
+    }
   }
 };
 
@@ -658,7 +782,12 @@ struct STORE_OFFSET_I32
     : Sequence<STORE_OFFSET_I32,
                I<OPCODE_STORE_OFFSET, VoidOp, I64Op, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    auto addr = ComputeMemoryAddressOffset(e, i.src1, i.src2);
+    Xbyak::Label mmio;
+    bool mmio_check = EmitMmioWindowCheck(
+        e, i.src1, static_cast<int32_t>(i.src2.constant()), mmio);
+    // The check leaves the full address in eax.
+    auto addr = mmio_check ? e.GetMembaseReg() + e.rax
+                           : ComputeMemoryAddressOffset(e, i.src1, i.src2);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src3.is_constant);
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -673,6 +802,9 @@ struct STORE_OFFSET_I32
         e.mov(e.dword[addr], i.src3);
       }
     }
+    if (mmio_check) {
+      EmitMmioWindowStoreI32(e, i, i.src3, mmio);
+    }
   }
 };
 
@@ -736,6 +868,8 @@ struct LOAD_I16 : Sequence<LOAD_I16, I<OPCODE_LOAD, I16Op, I64Op>> {
 };
 struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label mmio;
+    bool mmio_check = EmitMmioWindowCheck(e, i.src1, 0, mmio);
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       if (e.IsFeatureEnabled(kX64EmitMovbe)) {
@@ -747,6 +881,9 @@ struct LOAD_I32 : Sequence<LOAD_I32, I<OPCODE_LOAD, I32Op, I64Op>> {
     } else {
       e.mov(i.dest, e.dword[addr]);
     }
+    if (mmio_check) {
+      EmitMmioWindowLoadI32(e, i, mmio);
+    }
     if (IsTracingData()) {
       e.mov(e.GetNativeParam(1).cvt32(), i.dest);
       e.lea(e.GetNativeParam(0), e.ptr[addr]);
@@ -868,6 +1005,8 @@ struct STORE_I16 : Sequence<STORE_I16, I<OPCODE_STORE, VoidOp, I64Op, I16Op>> {
 };
 struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    Xbyak::Label mmio;
+    bool mmio_check = EmitMmioWindowCheck(e, i.src1, 0, mmio);
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
@@ -883,6 +1022,9 @@ struct STORE_I32 : Sequence<STORE_I32, I<OPCODE_STORE, VoidOp, I64Op, I32Op>> {
         e.mov(e.dword[addr], i.src2);
       }
     }
+    if (mmio_check) {
+      EmitMmioWindowStoreI32(e, i, i.src2, mmio);
+    }
     if (IsTracingData()) {
       addr = ComputeMemoryAddress(e, i.src1);
       e.mov(e.GetNativeParam(1).cvt32(), e.dword[addr]);
@@ -961,17 +1103,19 @@ struct STORE_F64 : Sequence<STORE_F64, I<OPCODE_STORE, VoidOp, I64Op, F64Op>> {
 struct STORE_V128
     : Sequence<STORE_V128, I<OPCODE_STORE, VoidOp, I64Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    // Unaligned, as combined scalar copies may be. stvx addresses are
+    // aligned, and then it's as fast as vmovaps.
     auto addr = ComputeMemoryAddress(e, i.src1);
     if (i.instr->flags & LoadStoreFlags::LOAD_STORE_BYTE_SWAP) {
       assert_false(i.src2.is_constant);
       e.vpshufb(e.xmm0, i.src2, e.GetXmmConstPtr(XMMByteSwapMask));
-      e.vmovaps(e.ptr[addr], e.xmm0);
+      e.vmovups(e.ptr[addr], e.xmm0);
     } else {
       if (i.src2.is_constant) {
         e.LoadConstantXmm(e.xmm0, i.src2.constant());
-        e.vmovaps(e.ptr[addr], e.xmm0);
+        e.vmovups(e.ptr[addr], e.xmm0);
       } else {
-        e.vmovaps(e.ptr[addr], i.src2);
+        e.vmovups(e.ptr[addr], i.src2);
       }
     }
     if (IsTracingData()) {
@@ -193,8 +193,9 @@ EMITTER_OPCODE_TABLE(OPCODE_LOAD_VECTOR_SHR, LOAD_VECTOR_SHR_I8);
 struct VECTOR_MAX
     : Sequence<VECTOR_MAX, I<OPCODE_VECTOR_MAX, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
           uint32_t part_type = i.instr->flags >> 8;
           if (i.instr->flags & ARITHMETIC_UNSIGNED) {
             switch (part_type) {
@@ -238,8 +239,9 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_MAX, VECTOR_MAX);
 struct VECTOR_MIN
     : Sequence<VECTOR_MIN, I<OPCODE_VECTOR_MIN, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
           uint32_t part_type = i.instr->flags >> 8;
           if (i.instr->flags & ARITHMETIC_UNSIGNED) {
             switch (part_type) {
@@ -284,8 +286,9 @@ struct VECTOR_COMPARE_EQ_V128
     : Sequence<VECTOR_COMPARE_EQ_V128,
                I<OPCODE_VECTOR_COMPARE_EQ, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
           switch (i.instr->flags) {
             case INT8_TYPE:
               e.vpcmpeqb(dest, src1, src2);
@@ -312,8 +315,9 @@ struct VECTOR_COMPARE_SGT_V128
     : Sequence<VECTOR_COMPARE_SGT_V128,
                I<OPCODE_VECTOR_COMPARE_SGT, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitAssociativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
           switch (i.instr->flags) {
             case INT8_TYPE:
               e.vpcmpgtb(dest, src1, src2);
@@ -340,8 +344,9 @@ struct VECTOR_COMPARE_SGE_V128
     : Sequence<VECTOR_COMPARE_SGE_V128,
                I<OPCODE_VECTOR_COMPARE_SGE, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitAssociativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
           switch (i.instr->flags) {
             case INT8_TYPE:
               e.vpcmpeqb(e.xmm0, src1, src2);
@@ -490,8 +495,9 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_COMPARE_UGE, VECTOR_COMPARE_UGE_V128);
 struct VECTOR_ADD
     : Sequence<VECTOR_ADD, I<OPCODE_VECTOR_ADD, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, const Xmm& dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, const Xmm& dest, Xmm src1, const Operand& src2) {
           const TypeName part_type =
               static_cast<TypeName>(i.instr->flags & 0xFF);
           const uint32_t arithmetic_flags = i.instr->flags >> 8;
@@ -582,8 +588,9 @@ EMITTER_OPCODE_TABLE(OPCODE_VECTOR_ADD, VECTOR_ADD);
 struct VECTOR_SUB
     : Sequence<VECTOR_SUB, I<OPCODE_VECTOR_SUB, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(
-        e, i, [&i](X64Emitter& e, const Xmm& dest, Xmm src1, Xmm src2) {
+    EmitBinaryVecOp(
+        e, i,
+        [&i](X64Emitter& e, const Xmm& dest, Xmm src1, const Operand& src2) {
           const TypeName part_type =
               static_cast<TypeName>(i.instr->flags & 0xFF);
           const uint32_t arithmetic_flags = i.instr->flags >> 8;
@@ -1482,7 +1489,7 @@ struct EXTRACT_I32
       e.mov(e.al, i.src2);
       e.and_(e.al, 0x03);
       e.shl(e.al, 4);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(extract_table_32));
+      e.MovHostImageAddress(e.rdx, extract_table_32);
       e.vmovaps(e.xmm0, e.ptr[e.rdx + e.rax]);
       e.vpshufb(e.xmm0, src1, e.xmm0);
       e.vpextrd(i.dest, e.xmm0, 0);
@@ -1642,6 +1649,13 @@ struct PERMUTE_I32
 struct PERMUTE_V128
     : Sequence<PERMUTE_V128,
                I<OPCODE_PERMUTE, V128Op, V128Op, V128Op, V128Op>> {
+  // The byte control as the shuffles want it, for a known control: the
+  // swapped words of XMMSwapWordMask and the table index of
+  // XMMPermuteByteMask.
+  static vec128_t ShuffleControl(const vec128_t& control) {
+    return (control ^ vec128b(0x03)) & vec128b(0x1F);
+  }
+
   static void EmitByInt8(X64Emitter& e, const EmitArgType& i) {
     // TODO(benvanik): find out how to do this with only one temp register!
     // Permute bytes between src2 and src3.
@@ -1655,12 +1669,11 @@ struct PERMUTE_V128
       } else {
         // Control mask needs to be shuffled.
         if (i.src1.is_constant) {
-          e.LoadConstantXmm(e.xmm0, i.src1.constant());
-          e.vxorps(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMSwapWordMask));
+          e.LoadConstantXmm(e.xmm0, ShuffleControl(i.src1.constant()));
         } else {
           e.vxorps(e.xmm0, i.src1, e.GetXmmConstPtr(XMMSwapWordMask));
+          e.vpand(e.xmm0, e.GetXmmConstPtr(XMMPermuteByteMask));
         }
-        e.vpand(e.xmm0, e.GetXmmConstPtr(XMMPermuteByteMask));
         if (i.src2.is_constant) {
           e.LoadConstantXmm(i.dest, i.src2.constant());
           e.vpshufb(i.dest, i.dest, e.xmm0);
@@ -1672,17 +1685,33 @@ struct PERMUTE_V128
         e.vpcmpgtb(e.xmm0, e.xmm0, e.GetXmmConstPtr(XMMPermuteControl15));
         e.vpandn(i.dest, e.xmm0, i.dest);
       }
+    } else if (e.IsFeatureEnabled(kX64EmitAVX512VBMI)) {
+      // General permute as a single two-table byte shuffle. vpermi2b only
+      // looks at the low 5 bits of each index, so no masking is needed.
+      if (i.src1.is_constant) {
+        e.LoadConstantXmm(e.xmm2, ShuffleControl(i.src1.constant()));
+      } else {
+        e.vxorps(e.xmm2, i.src1, e.GetXmmConstPtr(XMMSwapWordMask));
+      }
+      Xmm src2 = i.src2.is_constant ? e.xmm0 : i.src2;
+      if (i.src2.is_constant) {
+        e.LoadConstantXmm(src2, i.src2.constant());
+      }
+      Xmm src3 = i.src3.is_constant ? e.xmm1 : i.src3;
+      if (i.src3.is_constant) {
+        e.LoadConstantXmm(src3, i.src3.constant());
+      }
+      e.vpermi2b(e.xmm2, src2, src3);
+      e.vmovdqa(i.dest, e.xmm2);
     } else {
       // General permute.
       // Control mask needs to be shuffled.
-      // TODO(benvanik): do constants here instead of in generated code.
       if (i.src1.is_constant) {
-        e.LoadConstantXmm(e.xmm2, i.src1.constant());
-        e.vxorps(e.xmm2, e.xmm2, e.GetXmmConstPtr(XMMSwapWordMask));
+        e.LoadConstantXmm(e.xmm2, ShuffleControl(i.src1.constant()));
       } else {
         e.vxorps(e.xmm2, i.src1, e.GetXmmConstPtr(XMMSwapWordMask));
+        e.vpand(e.xmm2, e.GetXmmConstPtr(XMMPermuteByteMask));
       }
-      e.vpand(e.xmm2, e.GetXmmConstPtr(XMMPermuteByteMask));
       Xmm src2_shuf = e.xmm0;
       if (i.src2.value->IsConstantZero()) {
         e.vpxor(src2_shuf, src2_shuf);
@@ -2033,6 +2062,25 @@ struct PACK : Sequence<PACK, I<OPCODE_PACK, V128Op, V128Op, V128Op>> {
       if (IsPackOutUnsigned(flags)) {
         if (IsPackOutSaturate(flags)) {
           // unsigned -> unsigned + saturate
+          if (e.IsFeatureEnabled(kX64EmitAVX512)) {
+            // VPMOVUSWB narrows each source with unsigned saturation into
+            // its low qword; glue the two halves back together.
+            if (i.src1.is_constant) {
+              e.LoadConstantXmm(e.xmm0, i.src1.constant());
+              e.vpmovuswb(e.xmm0, e.xmm0);
+            } else {
+              e.vpmovuswb(e.xmm0, i.src1);
+            }
+            if (i.src2.is_constant) {
+              e.LoadConstantXmm(e.xmm1, i.src2.constant());
+              e.vpmovuswb(e.xmm1, e.xmm1);
+            } else {
+              e.vpmovuswb(e.xmm1, i.src2);
+            }
+            e.vpunpcklqdq(i.dest, e.xmm0, e.xmm1);
+            e.vpshufb(i.dest, i.dest, e.GetXmmConstPtr(XMMByteOrderMask));
+            return;
+          }
           if (i.src2.is_constant) {
             e.LoadConstantXmm(e.xmm0, i.src2.constant());
             e.lea(e.GetNativeParam(1), e.StashXmm(1, e.xmm0));
@@ -2098,6 +2146,27 @@ struct PACK : Sequence<PACK, I<OPCODE_PACK, V128Op, V128Op, V128Op>> {
       if (IsPackOutUnsigned(flags)) {
         if (IsPackOutSaturate(flags)) {
           // unsigned -> unsigned + saturate
+          if (e.IsFeatureEnabled(kX64EmitAVX512)) {
+            // Same as the PACKUSDW path below, but with VPMOVUSDW doing the
+            // unsigned saturation of each source.
+            if (i.src1.is_constant) {
+              e.LoadConstantXmm(e.xmm0, i.src1.constant());
+              e.vpmovusdw(e.xmm0, e.xmm0);
+            } else {
+              e.vpmovusdw(e.xmm0, i.src1);
+            }
+            if (i.src2.is_constant) {
+              e.LoadConstantXmm(e.xmm1, i.src2.constant());
+              e.vpmovusdw(e.xmm1, e.xmm1);
+            } else {
+              e.vpmovusdw(e.xmm1, i.src2);
+            }
+            e.vpunpcklqdq(i.dest, e.xmm0, e.xmm1);
+            // Words need to be swapped within each dword.
+            e.vpshuflw(i.dest, i.dest, 0b10110001);
+            e.vpshufhw(i.dest, i.dest, 0b10110001);
+            return;
+          }
           // Construct a saturation max value
           e.mov(e.eax, 0xFFFFu);
           e.vmovd(e.xmm0, e.eax);
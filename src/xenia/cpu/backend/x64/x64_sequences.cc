@@ -32,6 +32,7 @@
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/threading.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/backend/x64/x64_emitter.h"
 #include "xenia/cpu/backend/x64/x64_op.h"
 #include "xenia/cpu/backend/x64/x64_tracers.h"
@@ -64,7 +65,7 @@ struct COMMENT : Sequence<COMMENT, I<OPCODE_COMMENT, VoidOp, OffsetOp>> {
       // TODO(benvanik): pass through.
       // TODO(benvanik): don't just leak this memory.
       auto str_copy = strdup(str);
-      e.mov(e.rdx, reinterpret_cast<uint64_t>(str_copy));
+      e.MovSessionAddress(e.rdx, reinterpret_cast<uint64_t>(str_copy));
       e.CallNative(reinterpret_cast<void*>(TraceString));
     }
   }
@@ -440,8 +441,29 @@ EMITTER_OPCODE_TABLE(OPCODE_ROUND, ROUND_F32, ROUND_F64, ROUND_V128);
 // ============================================================================
 struct LOAD_CLOCK : Sequence<LOAD_CLOCK, I<OPCODE_LOAD_CLOCK, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    // It'd be cool to call QueryPerformanceCounter directly, but w/e.
-    e.CallNative(LoadClock);
+    if (!Clock::is_guest_clock_tsc()) {
+      e.CallNative(LoadClock);
+      e.mov(i.dest, e.rax);
+      return;
+    }
+    // Inline Clock::QueryGuestTickCount: the TSC ticks since the base,
+    // multiplied by the 32.32 fixed point guest to host tick ratio.
+    Xbyak::Label after_base;
+    e.mov(e.rcx, reinterpret_cast<uint64_t>(Clock::guest_tick_base_address()));
+    e.mov(e.rcx, e.qword[e.rcx]);
+    e.rdtsc();
+    e.shl(e.rdx, 32);
+    e.or_(e.rax, e.rdx);
+    e.sub(e.rax, e.qword[e.rcx + offsetof(Clock::GuestTickBase,
+                                          host_tick_base)]);
+    // Read from another core with a TSC slightly behind the base.
+    e.jae(after_base);
+    e.xor_(e.eax, e.eax);
+    e.L(after_base);
+    e.mul(e.qword[e.rcx + offsetof(Clock::GuestTickBase, multiplier)]);
+    e.shrd(e.rax, e.rdx, 32);
+    e.add(e.rax, e.qword[e.rcx + offsetof(Clock::GuestTickBase,
+                                          guest_tick_base)]);
     e.mov(i.dest, e.rax);
   }
   static uint64_t LoadClock(void* raw_context) {
@@ -736,6 +758,14 @@ struct SELECT_V128_V128
     }
 
     // src1 ? src2 : src3;
+    if (e.IsFeatureEnabled(kX64EmitAVX512)) {
+      // Bitwise select in one op: (src1 & src3) | (~src1 & src2).
+      // vpternlogd overwrites its first operand, which holds the mask (0xF0).
+      e.vmovdqa(e.xmm3, src1);
+      e.vpternlogd(e.xmm3, src3, src2, 0xCA);
+      e.vmovdqa(i.dest, e.xmm3);
+      return;
+    }
     e.vpandn(e.xmm3, src1, src2);
     e.vpand(i.dest, src1, src3);
     e.vpor(i.dest, i.dest, e.xmm3);
@@ -745,31 +775,237 @@ EMITTER_OPCODE_TABLE(OPCODE_SELECT, SELECT_I8, SELECT_I16, SELECT_I32,
                      SELECT_I64, SELECT_F32, SELECT_F64, SELECT_V128_I8,
                      SELECT_V128_V128);
 
+// ============================================================================
+// Compare-and-branch fusion
+// ============================================================================
+// Integer compares leave their result in the flags until something clobbers
+// them. A conditional branch testing the compare result later in the same
+// block jumps on those flags directly instead of re-testing the byte, and if
+// the branch is the only use the compare skips materializing it entirely:
+//   cmp r10d, r11d
+//   je loc_a         (instead of sete al; ... test al, al; jnz loc_a)
+// Each condition sits next to its negation so that negating is ^1.
+enum FusedCondition {
+  kFusedE,
+  kFusedNE,
+  kFusedL,
+  kFusedGE,
+  kFusedLE,
+  kFusedG,
+  kFusedB,
+  kFusedAE,
+  kFusedBE,
+  kFusedA,
+};
+
+// Whether the sequence for the instruction is guaranteed not to touch flags.
+static bool PreservesFlags(X64Emitter& e, const Instr* i) {
+  switch (i->opcode->num) {
+    case OPCODE_COMMENT:
+    case OPCODE_NOP:
+    case OPCODE_CONTEXT_BARRIER:
+    case OPCODE_ASSIGN:
+    case OPCODE_LOAD_LOCAL:
+    case OPCODE_STORE_LOCAL:
+      return true;
+    case OPCODE_SOURCE_OFFSET:
+      return !(e.debug_info_flags() &
+               DebugInfoFlags::kDebugInfoTraceFunctionCoverage);
+    case OPCODE_LOAD_CONTEXT:
+    case OPCODE_STORE_CONTEXT:
+      return !IsTracingData();
+    default:
+      return false;
+  }
+}
+
+// Returns the compare whose flags the branch can use, if any.
+static const Instr* GetFusedBranchCompare(X64Emitter& e,
+                                          const Instr* branch) {
+  auto compare = branch->src1.value->def;
+  if (!compare || compare->block != branch->block) {
+    return nullptr;
+  }
+  switch (compare->opcode->num) {
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+    case OPCODE_IS_TRUE:
+    case OPCODE_IS_FALSE:
+      break;
+    default:
+      return nullptr;
+  }
+  if (compare->src1.value->type > INT64_TYPE) {
+    return nullptr;
+  }
+  for (auto i = compare->next; i != branch; i = i->next) {
+    if (!PreservesFlags(e, i)) {
+      return nullptr;
+    }
+  }
+  return compare;
+}
+
+static bool IsCompareFusedWithBranch(X64Emitter& e, const Instr* compare) {
+  auto use = compare->dest->use_head;
+  if (!use || use->next) {
+    return false;
+  }
+  auto branch = use->instr;
+  if (branch->opcode != &OPCODE_BRANCH_TRUE_info &&
+      branch->opcode != &OPCODE_BRANCH_FALSE_info) {
+    return false;
+  }
+  return GetFusedBranchCompare(e, branch) == compare;
+}
+template <typename T>
+static bool IsCompareFusedWithBranch(X64Emitter& e, const T& i) {
+  return IsCompareFusedWithBranch(e, i.instr);
+}
+
+// Emits a jcc on the flags left by the compare feeding the branch. Returns
+// false if the branch has to test its condition itself.
+static bool EmitFusedBranch(X64Emitter& e, const Instr* branch,
+                            bool branch_if_true) {
+  auto compare = GetFusedBranchCompare(e, branch);
+  if (!compare) {
+    return false;
+  }
+  FusedCondition cond;
+  switch (compare->opcode->num) {
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_IS_FALSE:
+      cond = kFusedE;
+      break;
+    case OPCODE_COMPARE_NE:
+    case OPCODE_IS_TRUE:
+      cond = kFusedNE;
+      break;
+    case OPCODE_COMPARE_SLT:
+      cond = kFusedL;
+      break;
+    case OPCODE_COMPARE_SLE:
+      cond = kFusedLE;
+      break;
+    case OPCODE_COMPARE_SGT:
+      cond = kFusedG;
+      break;
+    case OPCODE_COMPARE_SGE:
+      cond = kFusedGE;
+      break;
+    case OPCODE_COMPARE_ULT:
+      cond = kFusedB;
+      break;
+    case OPCODE_COMPARE_ULE:
+      cond = kFusedBE;
+      break;
+    case OPCODE_COMPARE_UGT:
+      cond = kFusedA;
+      break;
+    case OPCODE_COMPARE_UGE:
+      cond = kFusedAE;
+      break;
+    default:
+      assert_unhandled_case(compare->opcode->num);
+      return false;
+  }
+  // EmitAssociativeCompareOp swaps the operands of ordered compares when the
+  // constant is on the left.
+  if (cond >= kFusedL && compare->src1.value->IsConstant()) {
+    static const FusedCondition swapped[] = {
+        kFusedE, kFusedNE, kFusedG,  kFusedLE, kFusedGE,
+        kFusedL, kFusedA,  kFusedBE, kFusedAE, kFusedB,
+    };
+    cond = swapped[cond];
+  }
+  if (!branch_if_true) {
+    cond = static_cast<FusedCondition>(cond ^ 1);
+  }
+  auto label = branch->src2.label->name;
+  switch (cond) {
+    case kFusedE:
+      e.je(label, e.T_NEAR);
+      break;
+    case kFusedNE:
+      e.jne(label, e.T_NEAR);
+      break;
+    case kFusedL:
+      e.jl(label, e.T_NEAR);
+      break;
+    case kFusedGE:
+      e.jge(label, e.T_NEAR);
+      break;
+    case kFusedLE:
+      e.jle(label, e.T_NEAR);
+      break;
+    case kFusedG:
+      e.jg(label, e.T_NEAR);
+      break;
+    case kFusedB:
+      e.jb(label, e.T_NEAR);
+      break;
+    case kFusedAE:
+      e.jae(label, e.T_NEAR);
+      break;
+    case kFusedBE:
+      e.jbe(label, e.T_NEAR);
+      break;
+    case kFusedA:
+      e.ja(label, e.T_NEAR);
+      break;
+  }
+  return true;
+}
+
+bool EmitFusedBranchTrue(X64Emitter& e, const Instr* branch) {
+  return EmitFusedBranch(e, branch, true);
+}
+
+bool EmitFusedBranchFalse(X64Emitter& e, const Instr* branch) {
+  return EmitFusedBranch(e, branch, false);
+}
+
 // ============================================================================
 // OPCODE_IS_TRUE
 // ============================================================================
 struct IS_TRUE_I8 : Sequence<IS_TRUE_I8, I<OPCODE_IS_TRUE, I8Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setnz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setnz(i.dest);
+    }
   }
 };
 struct IS_TRUE_I16 : Sequence<IS_TRUE_I16, I<OPCODE_IS_TRUE, I8Op, I16Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setnz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setnz(i.dest);
+    }
   }
 };
 struct IS_TRUE_I32 : Sequence<IS_TRUE_I32, I<OPCODE_IS_TRUE, I8Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setnz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setnz(i.dest);
+    }
   }
 };
 struct IS_TRUE_I64 : Sequence<IS_TRUE_I64, I<OPCODE_IS_TRUE, I8Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setnz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setnz(i.dest);
+    }
   }
 };
 struct IS_TRUE_F32 : Sequence<IS_TRUE_F32, I<OPCODE_IS_TRUE, I8Op, F32Op>> {
@@ -799,25 +1035,33 @@ EMITTER_OPCODE_TABLE(OPCODE_IS_TRUE, IS_TRUE_I8, IS_TRUE_I16, IS_TRUE_I32,
 struct IS_FALSE_I8 : Sequence<IS_FALSE_I8, I<OPCODE_IS_FALSE, I8Op, I8Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setz(i.dest);
+    }
   }
 };
 struct IS_FALSE_I16 : Sequence<IS_FALSE_I16, I<OPCODE_IS_FALSE, I8Op, I16Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setz(i.dest);
+    }
   }
 };
 struct IS_FALSE_I32 : Sequence<IS_FALSE_I32, I<OPCODE_IS_FALSE, I8Op, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setz(i.dest);
+    }
   }
 };
 struct IS_FALSE_I64 : Sequence<IS_FALSE_I64, I<OPCODE_IS_FALSE, I8Op, I64Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
     e.test(i.src1, i.src1);
-    e.setz(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setz(i.dest);
+    }
   }
 };
 struct IS_FALSE_F32 : Sequence<IS_FALSE_F32, I<OPCODE_IS_FALSE, I8Op, F32Op>> {
@@ -871,7 +1115,9 @@ struct COMPARE_EQ_I8
                                 const Reg8& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg8& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I16
@@ -882,7 +1128,9 @@ struct COMPARE_EQ_I16
                                 const Reg16& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg16& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I32
@@ -893,7 +1141,9 @@ struct COMPARE_EQ_I32
                                 const Reg32& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg32& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_I64
@@ -904,7 +1154,9 @@ struct COMPARE_EQ_I64
                                 const Reg64& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg64& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.sete(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.sete(i.dest);
+    }
   }
 };
 struct COMPARE_EQ_F32
@@ -942,7 +1194,9 @@ struct COMPARE_NE_I8
                                 const Reg8& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg8& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I16
@@ -953,7 +1207,9 @@ struct COMPARE_NE_I16
                                 const Reg16& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg16& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I32
@@ -964,7 +1220,9 @@ struct COMPARE_NE_I32
                                 const Reg32& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg32& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_I64
@@ -975,7 +1233,9 @@ struct COMPARE_NE_I64
                                 const Reg64& src2) { e.cmp(src1, src2); },
                              [](X64Emitter& e, const Reg64& src1,
                                 int32_t constant) { e.cmp(src1, constant); });
-    e.setne(i.dest);
+    if (!IsCompareFusedWithBranch(e, i.instr)) {
+      e.setne(i.dest);
+    }
   }
 };
 struct COMPARE_NE_F32
@@ -1005,20 +1265,27 @@ EMITTER_OPCODE_TABLE(OPCODE_COMPARE_NE, COMPARE_NE_I8, COMPARE_NE_I16,
       : Sequence<COMPARE_##op##_##type,                                 \
                  I<OPCODE_COMPARE_##op, I8Op, type, type>> {            \
     static void Emit(X64Emitter& e, const EmitArgType& i) {             \
+      bool fused = IsCompareFusedWithBranch(e, i);                      \
       EmitAssociativeCompareOp(                                         \
           e, i,                                                         \
-          [](X64Emitter& e, const Reg8& dest, const reg_type& src1,     \
-             const reg_type& src2, bool inverse) {                      \
+          [fused](X64Emitter& e, const Reg8& dest, const reg_type& src1, \
+                  const reg_type& src2, bool inverse) {                 \
             e.cmp(src1, src2);                                          \
+            if (fused) {                                                \
+              return;                                                   \
+            }                                                           \
             if (!inverse) {                                             \
               e.instr(dest);                                            \
             } else {                                                    \
               e.inverse_instr(dest);                                    \
             }                                                           \
           },                                                            \
-          [](X64Emitter& e, const Reg8& dest, const reg_type& src1,     \
-             int32_t constant, bool inverse) {                          \
+          [fused](X64Emitter& e, const Reg8& dest, const reg_type& src1, \
+                  int32_t constant, bool inverse) {                     \
             e.cmp(src1, constant);                                      \
+            if (fused) {                                                \
+              return;                                                   \
+            }                                                           \
             if (!inverse) {                                             \
               e.instr(dest);                                            \
             } else {                                                    \
@@ -1216,6 +1483,65 @@ struct ADD_CARRY_I64
 EMITTER_OPCODE_TABLE(OPCODE_ADD_CARRY, ADD_CARRY_I8, ADD_CARRY_I16,
                      ADD_CARRY_I32, ADD_CARRY_I64);
 
+// ============================================================================
+// OPCODE_DID_CARRY
+// ============================================================================
+// Redoes the add with adc so the carry comes straight from CF instead of
+// being reconstructed with compares.
+template <typename ARGS>
+void EmitCarryIn(X64Emitter& e, const ARGS& i) {
+  if (i.src3.is_constant) {
+    if (i.src3.constant()) {
+      e.stc();
+    } else {
+      e.clc();
+    }
+  } else {
+    e.bt(i.src3.reg().cvt32(), 0);
+  }
+}
+struct DID_CARRY_I32
+    : Sequence<DID_CARRY_I32, I<OPCODE_DID_CARRY, I8Op, I32Op, I32Op, I8Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.src1.is_constant) {
+      e.mov(e.eax, i.src1.constant());
+    } else {
+      e.mov(e.eax, i.src1);
+    }
+    EmitCarryIn(e, i);
+    if (i.src2.is_constant) {
+      e.adc(e.eax, i.src2.constant());
+    } else {
+      e.adc(e.eax, i.src2);
+    }
+    e.setc(i.dest);
+  }
+};
+struct DID_CARRY_I64
+    : Sequence<DID_CARRY_I64, I<OPCODE_DID_CARRY, I8Op, I64Op, I64Op, I8Op>> {
+  static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (i.src1.is_constant) {
+      e.mov(e.rax, i.src1.constant());
+    } else {
+      e.mov(e.rax, i.src1);
+    }
+    if (i.src2.is_constant && !e.ConstantFitsIn32Reg(i.src2.constant())) {
+      e.mov(e.rcx, i.src2.constant());
+      EmitCarryIn(e, i);
+      e.adc(e.rax, e.rcx);
+    } else {
+      EmitCarryIn(e, i);
+      if (i.src2.is_constant) {
+        e.adc(e.rax, static_cast<int32_t>(i.src2.constant()));
+      } else {
+        e.adc(e.rax, i.src2);
+      }
+    }
+    e.setc(i.dest);
+  }
+};
+EMITTER_OPCODE_TABLE(OPCODE_DID_CARRY, DID_CARRY_I32, DID_CARRY_I64);
+
 // ============================================================================
 // OPCODE_SUB
 // ============================================================================
@@ -2520,10 +2846,11 @@ struct AND_I64 : Sequence<AND_I64, I<OPCODE_AND, I64Op, I64Op, I64Op>> {
 };
 struct AND_V128 : Sequence<AND_V128, I<OPCODE_AND, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(e, i,
-                               [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
-                                 e.vpand(dest, src1, src2);
-                               });
+    EmitBinaryVecOp(
+        e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
+          e.vpand(dest, src1, src2);
+        });
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_AND, AND_I8, AND_I16, AND_I32, AND_I64, AND_V128);
@@ -2565,10 +2892,11 @@ struct OR_I64 : Sequence<OR_I64, I<OPCODE_OR, I64Op, I64Op, I64Op>> {
 };
 struct OR_V128 : Sequence<OR_V128, I<OPCODE_OR, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(e, i,
-                               [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
-                                 e.vpor(dest, src1, src2);
-                               });
+    EmitBinaryVecOp(
+        e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
+          e.vpor(dest, src1, src2);
+        });
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_OR, OR_I8, OR_I16, OR_I32, OR_I64, OR_V128);
@@ -2610,10 +2938,11 @@ struct XOR_I64 : Sequence<XOR_I64, I<OPCODE_XOR, I64Op, I64Op, I64Op>> {
 };
 struct XOR_V128 : Sequence<XOR_V128, I<OPCODE_XOR, V128Op, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    EmitCommutativeBinaryXmmOp(e, i,
-                               [](X64Emitter& e, Xmm dest, Xmm src1, Xmm src2) {
-                                 e.vpxor(dest, src1, src2);
-                               });
+    EmitBinaryVecOp(
+        e, i,
+        [](X64Emitter& e, Xmm dest, Xmm src1, const Operand& src2) {
+          e.vpxor(dest, src1, src2);
+        });
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_XOR, XOR_I8, XOR_I16, XOR_I32, XOR_I64, XOR_V128);
@@ -2649,6 +2978,11 @@ struct NOT_I64 : Sequence<NOT_I64, I<OPCODE_NOT, I64Op, I64Op>> {
 };
 struct NOT_V128 : Sequence<NOT_V128, I<OPCODE_NOT, V128Op, V128Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
+    if (e.IsFeatureEnabled(kX64EmitAVX512)) {
+      // dest = ~src, without touching memory for the all-ones constant.
+      e.vpternlogd(i.dest, i.src1, i.src1, 0x55);
+      return;
+    }
     // dest = src ^ 0xFFFF...
     e.vpxor(i.dest, i.src1, e.GetXmmConstPtr(XMMFFFF /* FF... */));
   }
@@ -3042,6 +3376,9 @@ EMITTER_OPCODE_TABLE(OPCODE_CNTLZ, CNTLZ_I8, CNTLZ_I16, CNTLZ_I32, CNTLZ_I64);
 // OPCODE_SET_ROUNDING_MODE
 // ============================================================================
 // Input: FPSCR (PPC format)
+// ldmxcsr serializes, so the mode currently loaded is kept in the context and
+// the reload skipped when it wouldn't change anything. Constant modes that
+// are already known to be loaded don't emit any code at all.
 static const uint32_t mxcsr_table[] = {
     0x1F80, 0x7F80, 0x5F80, 0x3F80, 0x9F80, 0xFF80, 0xDF80, 0xBF80,
 };
@@ -3049,10 +3386,28 @@ struct SET_ROUNDING_MODE_I32
     : Sequence<SET_ROUNDING_MODE_I32,
                I<OPCODE_SET_ROUNDING_MODE, VoidOp, I32Op>> {
   static void Emit(X64Emitter& e, const EmitArgType& i) {
-    e.mov(e.rcx, i.src1);
-    e.and_(e.rcx, 0x7);
-    e.mov(e.rax, uintptr_t(mxcsr_table));
+    auto mode_ptr = e.byte[e.GetContextReg() +
+                           offsetof(ppc::PPCContext, host_rounding_mode)];
+    int32_t mode = -1;
+    if (i.src1.is_constant) {
+      mode = i.src1.constant() & 0x7;
+      if (mode == e.known_rounding_mode()) {
+        e.backend()->CountElidedRoundingModeSwitch();
+        return;
+      }
+      e.mov(e.ecx, mode);
+    } else {
+      e.mov(e.ecx, i.src1);
+      e.and_(e.ecx, 0x7);
+    }
+    Xbyak::Label skip;
+    e.cmp(e.cl, mode_ptr);
+    e.je(skip);
+    e.mov(mode_ptr, e.cl);
+    e.MovHostImageAddress(e.rax, mxcsr_table);
     e.vldmxcsr(e.ptr[e.rax + e.rcx * 4]);
+    e.L(skip);
+    e.set_known_rounding_mode(mode);
   }
 };
 EMITTER_OPCODE_TABLE(OPCODE_SET_ROUNDING_MODE, SET_ROUNDING_MODE_I32);
@@ -43,6 +43,12 @@ static bool Register() {
 bool SelectSequence(X64Emitter* e, const hir::Instr* i,
                     const hir::Instr** new_tail);
 
+// Emits the branch as a jcc on the flags of the compare feeding it, if that
+// compare was fused with it. Returns false if the branch must test its
+// condition value itself.
+bool EmitFusedBranchTrue(X64Emitter& e, const hir::Instr* branch);
+bool EmitFusedBranchFalse(X64Emitter& e, const hir::Instr* branch);
+
 }  // namespace x64
 }  // namespace backend
 }  // namespace cpu
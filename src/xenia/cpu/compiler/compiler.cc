@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/compiler/compiler.h"
 
+#include "xenia/base/clock.h"
 #include "xenia/base/profiling.h"
 #include "xenia/cpu/compiler/compiler_pass.h"
 
@@ -30,12 +31,20 @@ void Compiler::Reset() {}
 bool Compiler::Compile(xe::cpu::hir::HIRBuilder* builder) {
   // TODO(benvanik): sophisticated stuff. Run passes in parallel, run until they
   //                 stop changing things, etc.
+  if (record_pass_ticks_) {
+    pass_ticks_.assign(passes_.size(), 0);
+  }
   for (size_t i = 0; i < passes_.size(); ++i) {
     auto& pass = passes_[i];
     scratch_arena_.Reset();
+    uint64_t start_ticks =
+        record_pass_ticks_ ? Clock::QueryHostTickCount() : 0;
     if (!pass->Run(builder)) {
       return false;
     }
+    if (record_pass_ticks_) {
+      pass_ticks_[i] = Clock::QueryHostTickCount() - start_ticks;
+    }
   }
 
   return true;
@@ -42,10 +42,21 @@ class Compiler {
 
   bool Compile(hir::HIRBuilder* builder);
 
+  size_t pass_count() const { return passes_.size(); }
+  const CompilerPass* pass(size_t index) const { return passes_[index].get(); }
+
+  // When enabled each Compile records how many host ticks every pass took,
+  // indexed like pass().
+  void set_record_pass_ticks(bool value) { record_pass_ticks_ = value; }
+  const std::vector<uint64_t>& pass_ticks() const { return pass_ticks_; }
+
  private:
   Processor* processor_;
   Arena scratch_arena_;
 
+  bool record_pass_ticks_ = false;
+  std::vector<uint64_t> pass_ticks_;
+
   std::vector<std::unique_ptr<CompilerPass>> passes_;
 };
 
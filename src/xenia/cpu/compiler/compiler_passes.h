@@ -18,7 +18,11 @@
 #include "xenia/cpu/compiler/passes/control_flow_simplification_pass.h"
 #include "xenia/cpu/compiler/passes/data_flow_analysis_pass.h"
 #include "xenia/cpu/compiler/passes/dead_code_elimination_pass.h"
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
 #include "xenia/cpu/compiler/passes/finalization_pass.h"
+#include "xenia/cpu/compiler/passes/global_context_promotion_pass.h"
+#include "xenia/cpu/compiler/passes/linear_scan_register_allocation_pass.h"
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
 #include "xenia/cpu/compiler/passes/memory_sequence_combination_pass.h"
 #include "xenia/cpu/compiler/passes/register_allocation_pass.h"
 #include "xenia/cpu/compiler/passes/simplification_pass.h"
@@ -76,6 +76,10 @@ bool ConditionalGroupPass::Run(HIRBuilder* builder) {
 }
 
 void ConditionalGroupPass::AddPass(std::unique_ptr<CompilerPass> pass) {
+  if (!name_.empty()) {
+    name_ += "+";
+  }
+  name_ += pass->name();
   passes_.push_back(std::move(pass));
 }
 
@@ -11,6 +11,7 @@
 #define XENIA_CPU_COMPILER_PASSES_CONDITIONAL_GROUP_PASS_H_
 
 #include <cmath>
+#include <string>
 #include <vector>
 
 #include "xenia/base/platform.h"
@@ -30,11 +31,14 @@ class ConditionalGroupPass : public CompilerPass {
   bool Initialize(Compiler* compiler) override;
 
   bool Run(hir::HIRBuilder* builder) override;
+  // The names of the grouped passes, as they can't be timed individually.
+  const char* name() const override { return name_.c_str(); }
 
   void AddPass(std::unique_ptr<CompilerPass> pass);
 
  private:
   std::vector<std::unique_ptr<CompilerPass>> passes_;
+  std::string name_;
 };
 
 }  // namespace passes
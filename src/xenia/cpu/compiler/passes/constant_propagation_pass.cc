@@ -233,7 +233,11 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
                   !(protect & kMemoryProtectWrite) &&
                   (protect & kMemoryProtectRead)) {
                 // Memory is readonly - can just return the value.
+                // Should the guest ever make it writable the processor drops
+                // this code, so note where the value came from.
                 auto host_addr = memory->TranslateVirtual(address);
+                builder->AddConstantDataPage(address &
+                                             ~(heap->page_size() - 1));
                 switch (v->type) {
                   case INT8_TYPE:
                     v->set_constant(xe::load<uint8_t>(host_addr));
@@ -474,6 +478,25 @@ bool ConstantPropagationPass::Run(HIRBuilder* builder, bool& result) {
             result = true;
           }
           break;
+        case OPCODE_DID_CARRY:
+          if (i->src1.value->IsConstant() && i->src2.value->IsConstant() &&
+              i->src3.value->IsConstant()) {
+            uint64_t a = i->src1.value->constant.u64;
+            uint64_t b = i->src2.value->constant.u64;
+            uint64_t c = i->src3.value->constant.u64 & 1;
+            size_t bits = GetTypeSize(i->src1.value->type) * 8;
+            uint8_t carry;
+            if (bits == 64) {
+              carry = (a + b < a) || (a + b + c < c);
+            } else {
+              uint64_t mask = (1ull << bits) - 1;
+              carry = uint8_t((((a & mask) + (b & mask) + c) >> bits) & 1);
+            }
+            v->set_constant(carry);
+            i->Remove();
+            result = true;
+          }
+          break;
         case OPCODE_SUB:
           if (i->src1.value->IsConstant() && i->src2.value->IsConstant()) {
             v->set_from(i->src1.value);
@@ -23,6 +23,7 @@ class ConstantPropagationPass : public ConditionalGroupSubpass {
   ~ConstantPropagationPass() override;
 
   bool Run(hir::HIRBuilder* builder, bool& result) override;
+  const char* name() const override { return "constant_propagation"; }
 
  private:
 };
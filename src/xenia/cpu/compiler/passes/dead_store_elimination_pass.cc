@@ -0,0 +1,155 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/dead_store_elimination_pass.h"
+
+#include <gflags/gflags.h>
+
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+DECLARE_bool(debug);
+DECLARE_bool(store_all_context_values);
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+
+DeadStoreEliminationPass::DeadStoreEliminationPass() : CompilerPass() {}
+
+DeadStoreEliminationPass::~DeadStoreEliminationPass() {}
+
+bool DeadStoreEliminationPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+
+  context_size_ = sizeof(ppc::PPCContext);
+  live_.resize(static_cast<uint32_t>(context_size_));
+
+  return true;
+}
+
+bool DeadStoreEliminationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Context stores are what debuggers and stack walks read registers from.
+  if (FLAGS_debug || FLAGS_store_all_context_values) {
+    return true;
+  }
+
+  // Backwards may-read liveness of each context byte:
+  //   store_context +100, v0  <-- removed: +100 is stored again on all paths
+  //   branch_true v1, loc_a
+  //   store_context +100, v2
+  //   ...
+  // loc_a:
+  //   store_context +100, v3
+  // Everything is considered live at anything that may observe the context:
+  // calls (including externs), returns, traps, volatile instructions, context
+  // barriers and the end of the function. Only local branches are followed.
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+  }
+  block_live_in_.resize(block_count);
+  for (auto& live_in : block_live_in_) {
+    live_in.clear();
+    live_in.resize(static_cast<uint32_t>(context_size_));
+  }
+
+  // Iterate to a fixed point. Walking blocks in reverse order converges
+  // quickly as most edges go forward.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto block = builder->last_block(); block; block = block->prev) {
+      ComputeLiveOut(block, &live_);
+      ProcessBlock(block, &live_, false);
+      auto& live_in = block_live_in_[block->ordinal];
+      if (live_ != live_in) {
+        live_in = live_;
+        changed = true;
+      }
+    }
+  }
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    ComputeLiveOut(block, &live_);
+    ProcessBlock(block, &live_, true);
+  }
+
+  return true;
+}
+
+void DeadStoreEliminationPass::ComputeLiveOut(Block* block,
+                                              llvm::BitVector* live) {
+  // Anything branched to is handled at the branch, so only fallthrough
+  // remains.
+  auto tail = block->instr_tail;
+  if (tail && tail->opcode == &OPCODE_BRANCH_info) {
+    live->reset();
+  } else if (block->next) {
+    *live = block_live_in_[block->next->ordinal];
+  } else {
+    live->set();
+  }
+}
+
+void DeadStoreEliminationPass::ProcessBlock(Block* block,
+                                            llvm::BitVector* live,
+                                            bool remove_dead_stores) {
+  Instr* i = block->instr_tail;
+  while (i) {
+    Instr* prev = i->prev;
+    auto opcode = i->opcode;
+    if (opcode == &OPCODE_BRANCH_info) {
+      *live = block_live_in_[i->src1.label->block->ordinal];
+    } else if (opcode == &OPCODE_BRANCH_TRUE_info ||
+               opcode == &OPCODE_BRANCH_FALSE_info) {
+      *live |= block_live_in_[i->src2.label->block->ordinal];
+    } else if (opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH) ||
+               opcode == &OPCODE_CONTEXT_BARRIER_info) {
+      live->set();
+    } else if (opcode == &OPCODE_LOAD_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      live->set(offset, offset + uint32_t(GetTypeSize(i->dest->type)));
+    } else if (opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      uint32_t end = offset + uint32_t(GetTypeSize(i->src2.value->type));
+      bool is_live = false;
+      for (uint32_t n = offset; n < end; ++n) {
+        if (live->test(n)) {
+          is_live = true;
+          break;
+        }
+      }
+      if (is_live) {
+        live->reset(offset, end);
+      } else if (remove_dead_stores) {
+        i->Remove();
+      }
+    }
+    i = prev;
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
+
+#include <vector>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+#if XE_COMPILER_MSVC
+#pragma warning(push)
+#pragma warning(disable : 4244)
+#pragma warning(disable : 4267)
+#include <llvm/ADT/BitVector.h>
+#pragma warning(pop)
+#else
+#include <llvm/ADT/BitVector.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Removes context stores that are overwritten before anything can observe
+// them, following branches across blocks within the function.
+class DeadStoreEliminationPass : public CompilerPass {
+ public:
+  DeadStoreEliminationPass();
+  ~DeadStoreEliminationPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "dead_store_elimination"; }
+
+ private:
+  // Walks the block backwards starting with the context bytes live on exit,
+  // leaving the bytes live on entry in live.
+  void ProcessBlock(hir::Block* block, llvm::BitVector* live,
+                    bool remove_dead_stores);
+  void ComputeLiveOut(hir::Block* block, llvm::BitVector* live);
+
+ private:
+  size_t context_size_ = 0;
+  // Context bytes that may be read before being overwritten, on entry to
+  // each block (by ordinal).
+  std::vector<llvm::BitVector> block_live_in_;
+  llvm::BitVector live_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_DEAD_STORE_ELIMINATION_PASS_H_
@@ -0,0 +1,259 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/global_context_promotion_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+// Largest context access (vec128).
+constexpr uint32_t kMaxAccessSize = 16;
+
+GlobalContextPromotionPass::GlobalContextPromotionPass() : CompilerPass() {}
+
+GlobalContextPromotionPass::~GlobalContextPromotionPass() {}
+
+bool GlobalContextPromotionPass::Initialize(Compiler* compiler) {
+  if (!CompilerPass::Initialize(compiler)) {
+    return false;
+  }
+
+  context_size_ = sizeof(ppc::PPCContext);
+  offset_slots_.resize(context_size_, -1);
+
+  return true;
+}
+
+bool GlobalContextPromotionPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Forward dataflow of the value held by each context location:
+  //   v0 = load_context +100
+  //   branch_true v1, loc_a
+  //   ...
+  // loc_a:
+  //   v2 = load_context +100  <-- v2 = v0 if no path into loc_a stores +100
+  // This runs after ContextPromotionPass, which already forwarded values
+  // within blocks, so only the first load in each block is interesting.
+  // Values are unknown at function entry and after anything that may touch
+  // the context (calls, traps, volatile instructions, context barriers).
+  //
+  // HIR values are block-local in the backends, so values that cross a block
+  // boundary are carried in a local. Constants are substituted directly,
+  // which lets the following simplification passes fold across blocks.
+  // Stores stay in place; DeadStoreEliminationPass drops the ones that are
+  // overwritten before the function exits or calls out.
+  GatherSlots(builder);
+  if (slots_.empty()) {
+    return true;
+  }
+
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+  }
+  block_states_.resize(block_count);
+  for (auto& block_state : block_states_) {
+    block_state.assign(slots_.size(), nullptr);
+  }
+  block_reached_.assign(block_count, false);
+  block_reached_[0] = true;
+
+  // Iterate to a fixed point. A slot can only go from unreached to a value
+  // to unknown, so this terminates quickly.
+  std::vector<Value*> state;
+  do {
+    changed_ = false;
+    for (auto block = builder->first_block(); block; block = block->next) {
+      if (!block_reached_[block->ordinal]) {
+        continue;
+      }
+      state = block_states_[block->ordinal];
+      ProcessBlock(builder, block, &state, false);
+      auto tail = block->instr_tail;
+      if (block->next && !(tail && tail->opcode == &OPCODE_BRANCH_info)) {
+        MergeInto(block->next, state);
+      }
+    }
+  } while (changed_);
+
+  for (auto block = builder->first_block(); block; block = block->next) {
+    if (!block_reached_[block->ordinal]) {
+      continue;
+    }
+    state = block_states_[block->ordinal];
+    ProcessBlock(builder, block, &state, true);
+  }
+
+  ResetSlots();
+  return true;
+}
+
+void GlobalContextPromotionPass::GatherSlots(HIRBuilder* builder) {
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      TypeName type;
+      if (i->opcode == &OPCODE_LOAD_CONTEXT_info) {
+        type = i->dest->type;
+      } else if (i->opcode == &OPCODE_STORE_CONTEXT_info) {
+        type = i->src2.value->type;
+      } else {
+        continue;
+      }
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      int32_t index = offset_slots_[offset];
+      if (index == -1) {
+        offset_slots_[offset] = static_cast<int32_t>(slots_.size());
+        slots_.push_back(
+            {offset, static_cast<uint32_t>(GetTypeSize(type)), type, false});
+      } else if (slots_[index].type != type) {
+        auto& slot = slots_[index];
+        slot.mixed = true;
+        slot.size =
+            std::max(slot.size, static_cast<uint32_t>(GetTypeSize(type)));
+      }
+    }
+  }
+}
+
+void GlobalContextPromotionPass::ResetSlots() {
+  for (auto& slot : slots_) {
+    offset_slots_[slot.offset] = -1;
+  }
+  slots_.clear();
+}
+
+void GlobalContextPromotionPass::ProcessBlock(HIRBuilder* builder,
+                                              Block* block,
+                                              std::vector<Value*>* state,
+                                              bool rewrite) {
+  for (auto i = block->instr_head; i; i = i->next) {
+    auto opcode = i->opcode;
+    if (opcode == &OPCODE_BRANCH_info) {
+      if (!rewrite) {
+        MergeInto(i->src1.label->block, *state);
+      }
+    } else if (opcode == &OPCODE_BRANCH_TRUE_info ||
+               opcode == &OPCODE_BRANCH_FALSE_info) {
+      if (!rewrite) {
+        MergeInto(i->src2.label->block, *state);
+      }
+    } else if (opcode->flags & (OPCODE_FLAG_VOLATILE | OPCODE_FLAG_BRANCH) ||
+               opcode == &OPCODE_CONTEXT_BARRIER_info) {
+      std::fill(state->begin(), state->end(), nullptr);
+    } else if (opcode == &OPCODE_LOAD_CONTEXT_info) {
+      int32_t index = offset_slots_[i->src1.offset];
+      if (slots_[index].mixed) {
+        continue;
+      }
+      Value* value = (*state)[index];
+      if (!value) {
+        (*state)[index] = i->dest;
+      } else if (rewrite && value != i->dest) {
+        PromoteLoad(builder, i, value);
+      }
+    } else if (opcode == &OPCODE_STORE_CONTEXT_info) {
+      uint32_t offset = static_cast<uint32_t>(i->src1.offset);
+      Value* value = i->src2.value;
+      KillOverlapping(state, offset,
+                      static_cast<uint32_t>(GetTypeSize(value->type)));
+      int32_t index = offset_slots_[offset];
+      if (!slots_[index].mixed) {
+        (*state)[index] = value;
+      }
+    }
+  }
+}
+
+bool GlobalContextPromotionPass::MergeInto(Block* block,
+                                           const std::vector<Value*>& state) {
+  auto& block_state = block_states_[block->ordinal];
+  if (!block_reached_[block->ordinal]) {
+    block_reached_[block->ordinal] = true;
+    block_state = state;
+    changed_ = true;
+    return true;
+  }
+  bool changed = false;
+  for (size_t n = 0; n < block_state.size(); ++n) {
+    if (block_state[n] && block_state[n] != state[n]) {
+      block_state[n] = nullptr;
+      changed = true;
+    }
+  }
+  changed_ |= changed;
+  return changed;
+}
+
+void GlobalContextPromotionPass::KillOverlapping(std::vector<Value*>* state,
+                                                 uint32_t offset,
+                                                 uint32_t size) {
+  uint32_t start =
+      offset >= kMaxAccessSize - 1 ? offset - kMaxAccessSize + 1 : 0;
+  for (uint32_t n = start; n < offset + size; ++n) {
+    int32_t index = offset_slots_[n];
+    if (index != -1 && slots_[index].offset + slots_[index].size > offset) {
+      (*state)[index] = nullptr;
+    }
+  }
+}
+
+void GlobalContextPromotionPass::PromoteLoad(HIRBuilder* builder, Instr* i,
+                                             Value* value) {
+  if (value->IsConstant() || value->def->block == i->block) {
+    i->opcode = &OPCODE_ASSIGN_info;
+    i->set_src1(value);
+    return;
+  }
+
+  // Carry the value over in a local, stored once right after the definition.
+  // The definition dominates every block it reaches here so the local always
+  // holds its latest result.
+  if (!value->local_slot) {
+    value->local_slot = builder->AllocLocal(value->type);
+    builder->StoreLocal(value->local_slot, value);
+    auto store = builder->last_instr();
+    auto insert_before = value->def->next;
+    while (insert_before &&
+           insert_before->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+      insert_before = insert_before->next;
+    }
+    if (insert_before) {
+      store->MoveBefore(insert_before);
+    } else {
+      auto tail = value->def->block->instr_tail;
+      store->MoveBefore(tail);
+      tail->MoveBefore(store);
+    }
+  }
+  i->opcode = &OPCODE_LOAD_LOCAL_info;
+  i->set_src1(value->local_slot);
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,73 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_GLOBAL_CONTEXT_PROMOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_GLOBAL_CONTEXT_PROMOTION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Function-wide version of ContextPromotionPass: forwards context values
+// across block boundaries and loop back-edges when every path into a block
+// leaves the same value in a context location.
+class GlobalContextPromotionPass : public CompilerPass {
+ public:
+  GlobalContextPromotionPass();
+  ~GlobalContextPromotionPass() override;
+
+  bool Initialize(Compiler* compiler) override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "global_context_promotion"; }
+
+ private:
+  // A context location accessed by the function.
+  struct Slot {
+    uint32_t offset;
+    uint32_t size;
+    hir::TypeName type;
+    // Accessed with more than one type; never forwarded.
+    bool mixed;
+  };
+
+  void GatherSlots(hir::HIRBuilder* builder);
+  void ResetSlots();
+  // Applies the block to state. When rewriting, loads of known values are
+  // replaced; otherwise the state is merged into branch targets.
+  void ProcessBlock(hir::HIRBuilder* builder, hir::Block* block,
+                    std::vector<hir::Value*>* state, bool rewrite);
+  bool MergeInto(hir::Block* block, const std::vector<hir::Value*>& state);
+  void KillOverlapping(std::vector<hir::Value*>* state, uint32_t offset,
+                       uint32_t size);
+  void PromoteLoad(hir::HIRBuilder* builder, hir::Instr* i, hir::Value* value);
+
+ private:
+  size_t context_size_ = 0;
+  // Slot index by context offset, or -1.
+  std::vector<int32_t> offset_slots_;
+  std::vector<Slot> slots_;
+  // Value in each slot on entry to each block (by ordinal), nullptr if
+  // unknown.
+  std::vector<std::vector<hir::Value*>> block_states_;
+  std::vector<bool> block_reached_;
+  bool changed_ = false;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_GLOBAL_CONTEXT_PROMOTION_PASS_H_
@@ -0,0 +1,318 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/linear_scan_register_allocation_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/passes/register_allocation_stats.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::backend::MachineInfo;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::RegAssignment;
+using xe::cpu::hir::TypeName;
+using xe::cpu::hir::Value;
+
+static RegisterAllocationStats stats_("Linear scan");
+
+LinearScanRegisterAllocationPass::LinearScanRegisterAllocationPass(
+    const MachineInfo* machine_info)
+    : CompilerPass() {
+  auto mi_sets = machine_info->register_sets;
+  for (uint32_t n = 0; mi_sets[n].count; ++n) {
+    auto& mi_set = mi_sets[n];
+    auto set = std::make_unique<RegisterSet>();
+    set->set = &mi_set;
+    set->count = mi_set.count;
+    assert_true(set->count <= set->free.size());
+    if (mi_set.types & MachineInfo::RegisterSet::INT_TYPES) {
+      int_set_ = set.get();
+    }
+    if (mi_set.types & MachineInfo::RegisterSet::FLOAT_TYPES) {
+      float_set_ = set.get();
+    }
+    if (mi_set.types & MachineInfo::RegisterSet::VEC_TYPES) {
+      vec_set_ = set.get();
+    }
+    sets_.push_back(std::move(set));
+  }
+}
+
+LinearScanRegisterAllocationPass::~LinearScanRegisterAllocationPass() = default;
+
+bool LinearScanRegisterAllocationPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // HIR values never live across blocks (everything that does goes through
+  // the context), so each block is scanned on its own. Ordinals are global so
+  // that spill slots can be shared across the whole function.
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  spill_slots_.clear();
+  spill_count_ = 0;
+  reload_count_ = 0;
+
+  uint16_t block_ordinal = 0;
+  uint32_t instr_ordinal = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_ordinal++;
+    ResetBlockState();
+
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      instr->ordinal = instr_ordinal++;
+    }
+
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      uint32_t signature = instr->opcode->signature;
+
+      ExpireValues(instr);
+
+      if (GET_OPCODE_SIG_TYPE_DEST(signature) != OPCODE_SIG_TYPE_V) {
+        continue;
+      }
+      // Must not have been set already.
+      assert_null(instr->dest->reg.set);
+      SortUses(instr->dest);
+
+      // Reusing the register of a src1 that dies here lets x64 avoid a move
+      // for its two operand instructions.
+      const RegAssignment* preferred_reg = nullptr;
+      if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+          std::find(retired_values_.begin(), retired_values_.end(),
+                    instr->src1.value) != retired_values_.end()) {
+        preferred_reg = &instr->src1.value->reg;
+      }
+
+      if (!Allocate(instr->dest, preferred_reg)) {
+        if (!SpillAndSplit(builder, instr, instr->dest->type)) {
+          XELOGE("Unable to spill any registers");
+          assert_always();
+          return false;
+        }
+        if (!Allocate(instr->dest, nullptr)) {
+          XELOGE("Register allocation failed");
+          assert_always();
+          return false;
+        }
+      }
+    }
+  }
+
+  stats_.Record(Clock::QueryHostTickCount() - start_ticks, spill_count_,
+                reload_count_, uint32_t(spill_slots_.size()));
+  return true;
+}
+
+LinearScanRegisterAllocationPass::RegisterSet*
+LinearScanRegisterAllocationPass::SetForType(TypeName type) {
+  if (type <= INT64_TYPE) {
+    return int_set_;
+  } else if (type <= FLOAT64_TYPE) {
+    return float_set_;
+  } else {
+    return vec_set_;
+  }
+}
+
+void LinearScanRegisterAllocationPass::ResetBlockState() {
+  for (auto& set : sets_) {
+    set->free.reset();
+    for (uint32_t i = 0; i < set->count; ++i) {
+      set->free.set(i);
+    }
+    set->active.clear();
+  }
+}
+
+void LinearScanRegisterAllocationPass::ExpireValues(const Instr* instr) {
+  retired_values_.clear();
+  for (auto& set : sets_) {
+    auto& active = set->active;
+    for (size_t i = 0; i < active.size();) {
+      auto& entry = active[i];
+      // A value may be used several times by the same instruction.
+      while (entry.next_use && entry.next_use->instr == instr) {
+        entry.next_use = entry.next_use->next;
+      }
+      if (entry.next_use) {
+        assert_true(entry.next_use->instr->block == instr->block);
+        ++i;
+        continue;
+      }
+      // No more uses (or none at all, like the dest of some atomics).
+      retired_values_.push_back(entry.value);
+      set->free.set(entry.value->reg.index);
+      active.erase(active.begin() + i);
+    }
+  }
+}
+
+bool LinearScanRegisterAllocationPass::Allocate(
+    Value* value, const RegAssignment* preferred_reg) {
+  auto set = SetForType(value->type);
+  int32_t index = -1;
+  if (preferred_reg && preferred_reg->set == set->set &&
+      set->free.test(preferred_reg->index)) {
+    index = preferred_reg->index;
+  } else {
+    for (uint32_t i = 0; i < set->count; ++i) {
+      if (set->free.test(i)) {
+        index = int32_t(i);
+        break;
+      }
+    }
+  }
+  if (index == -1) {
+    return false;
+  }
+  set->free.reset(index);
+  set->active.push_back({value, value->use_head});
+  value->reg.set = set->set;
+  value->reg.index = index;
+  return true;
+}
+
+bool LinearScanRegisterAllocationPass::SpillAndSplit(HIRBuilder* builder,
+                                                     const Instr* instr,
+                                                     TypeName type) {
+  auto set = SetForType(type);
+  if (set->active.empty()) {
+    return false;
+  }
+
+  // Everything active is next used after this instruction. Pick the one
+  // needed last, preferring values that are already in a slot as they need no
+  // store.
+  auto victim = set->active.begin();
+  for (auto it = set->active.begin() + 1; it != set->active.end(); ++it) {
+    uint32_t next = it->next_use->instr->ordinal;
+    uint32_t victim_next = victim->next_use->instr->ordinal;
+    if (next > victim_next ||
+        (next == victim_next && it->value->local_slot &&
+         !victim->value->local_slot)) {
+      victim = it;
+    }
+  }
+  Value* value = victim->value;
+  Value::Use* next_use = victim->next_use;
+  set->free.set(value->reg.index);
+  set->active.erase(victim);
+
+  // Store right after the definition. Reloaded values already have their
+  // contents in the slot.
+  if (!value->local_slot) {
+    value->local_slot =
+        AcquireSpillSlot(builder, value->type, value->def->ordinal,
+                         value->last_use->ordinal);
+    builder->StoreLocal(value->local_slot, value);
+    auto spill_store = builder->last_instr();
+    spill_store->ordinal = value->def->ordinal;
+    auto insert_before = value->def->next;
+    while (insert_before->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+      insert_before = insert_before->next;
+    }
+    spill_store->MoveBefore(insert_before);
+    ++spill_count_;
+  }
+
+  // Reload right before the next use. The load is allocated like any other
+  // definition once the scan reaches it.
+  auto insert_before = next_use->instr;
+  while ((insert_before->opcode->flags & OPCODE_FLAG_PAIRED_PREV) &&
+         insert_before->prev->ordinal > instr->ordinal) {
+    insert_before = insert_before->prev;
+  }
+  auto new_value = builder->LoadLocal(value->local_slot);
+  auto spill_load = builder->last_instr();
+  spill_load->ordinal = insert_before->ordinal;
+  spill_load->MoveBefore(insert_before);
+  new_value->local_slot = value->local_slot;
+  ++reload_count_;
+
+  // Hand all remaining uses over to the reloaded value.
+  auto walk_use = next_use;
+  while (walk_use) {
+    auto next_walk_use = walk_use->next;
+    auto use_instr = walk_use->instr;
+    uint32_t signature = use_instr->opcode->signature;
+    if (GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+        use_instr->src1.value == value) {
+      use_instr->set_src1(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+        use_instr->src2.value == value) {
+      use_instr->set_src2(new_value);
+    }
+    if (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+        use_instr->src3.value == value) {
+      use_instr->set_src3(new_value);
+    }
+    walk_use = next_walk_use;
+  }
+  value->last_use = spill_load;
+
+  return true;
+}
+
+Value* LinearScanRegisterAllocationPass::AcquireSpillSlot(HIRBuilder* builder,
+                                                          TypeName type,
+                                                          uint32_t live_from,
+                                                          uint32_t live_until) {
+  for (auto& spill_slot : spill_slots_) {
+    if (spill_slot.slot->type == type && spill_slot.live_until < live_from) {
+      spill_slot.live_until = live_until;
+      return spill_slot.slot;
+    }
+  }
+  auto slot = builder->AllocLocal(type);
+  spill_slots_.push_back({slot, live_until});
+  return slot;
+}
+
+void LinearScanRegisterAllocationPass::SortUses(Value* value) {
+  if (!value->use_head) {
+    return;
+  }
+  sort_scratch_.clear();
+  for (auto use = value->use_head; use; use = use->next) {
+    sort_scratch_.push_back(use);
+  }
+  std::stable_sort(sort_scratch_.begin(), sort_scratch_.end(),
+                   [](const Value::Use* a, const Value::Use* b) {
+                     return a->instr->ordinal < b->instr->ordinal;
+                   });
+  Value::Use* prev = nullptr;
+  for (auto use : sort_scratch_) {
+    use->prev = prev;
+    use->next = nullptr;
+    if (prev) {
+      prev->next = use;
+    }
+    prev = use;
+  }
+  value->use_head = sort_scratch_.front();
+  value->last_use = sort_scratch_.back()->instr;
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
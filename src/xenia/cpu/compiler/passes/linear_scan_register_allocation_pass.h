@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
+
+#include <bitset>
+#include <memory>
+#include <vector>
+
+#include "xenia/cpu/backend/machine_info.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Linear scan over the live ranges of the SSA values in each block.
+// When out of registers the value with the furthest next use is split there:
+// it is stored to a stack slot right after its definition and a reloaded copy
+// takes over its remaining uses, which may then be allocated to any register.
+// Stack slots are shared between values whose live ranges do not overlap
+// anywhere in the function, keeping frames small in spill-heavy code.
+class LinearScanRegisterAllocationPass : public CompilerPass {
+ public:
+  explicit LinearScanRegisterAllocationPass(
+      const backend::MachineInfo* machine_info);
+  ~LinearScanRegisterAllocationPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override {
+    return "linear_scan_register_allocation";
+  }
+
+ private:
+  // A value holding a register and the next instruction that needs it.
+  struct ActiveValue {
+    hir::Value* value;
+    hir::Value::Use* next_use;
+  };
+  struct RegisterSet {
+    const backend::MachineInfo::RegisterSet* set = nullptr;
+    uint32_t count = 0;
+    std::bitset<32> free;
+    std::vector<ActiveValue> active;
+  };
+  // A stack slot and the last instruction ordinal its contents are used at.
+  struct SpillSlot {
+    hir::Value* slot;
+    uint32_t live_until;
+  };
+
+  RegisterSet* SetForType(hir::TypeName type);
+  void ResetBlockState();
+  // Frees the registers of all values last used by the instruction.
+  void ExpireValues(const hir::Instr* instr);
+  bool Allocate(hir::Value* value, const hir::RegAssignment* preferred_reg);
+  // Frees a register of the given type by splitting the live range of the
+  // value with the furthest next use.
+  bool SpillAndSplit(hir::HIRBuilder* builder, const hir::Instr* instr,
+                     hir::TypeName type);
+  hir::Value* AcquireSpillSlot(hir::HIRBuilder* builder, hir::TypeName type,
+                               uint32_t live_from, uint32_t live_until);
+  void SortUses(hir::Value* value);
+
+  std::vector<std::unique_ptr<RegisterSet>> sets_;
+  RegisterSet* int_set_ = nullptr;
+  RegisterSet* float_set_ = nullptr;
+  RegisterSet* vec_set_ = nullptr;
+
+  std::vector<SpillSlot> spill_slots_;
+  // Values whose last use was the instruction last passed to ExpireValues.
+  std::vector<hir::Value*> retired_values_;
+  std::vector<hir::Value::Use*> sort_scratch_;
+
+  uint32_t spill_count_ = 0;
+  uint32_t reload_count_ = 0;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LINEAR_SCAN_REGISTER_ALLOCATION_PASS_H_
@@ -0,0 +1,377 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/loop_invariant_code_motion_pass.h"
+
+#include <algorithm>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// TODO(benvanik): remove when enums redefined.
+using namespace xe::cpu::hir;
+
+using xe::cpu::hir::Block;
+using xe::cpu::hir::Edge;
+using xe::cpu::hir::HIRBuilder;
+using xe::cpu::hir::Instr;
+using xe::cpu::hir::Value;
+
+LoopInvariantCodeMotionPass::LoopInvariantCodeMotionPass() : CompilerPass() {}
+
+LoopInvariantCodeMotionPass::~LoopInvariantCodeMotionPass() {}
+
+bool LoopInvariantCodeMotionPass::Run(HIRBuilder* builder) {
+  SCOPE_profile_cpu_f("cpu");
+
+  // Loops are found from back edges in the CFG:
+  //   preheader:
+  //     ...
+  //   loop_head:
+  //     v0 = load_context +100
+  //     v1 = add v0, <membase>
+  //     v2 = load v1
+  //     ...
+  //     branch_true v3, loop_head
+  // Anything in the loop that only depends on constants and on context
+  // locations the loop never writes is computed in the preheader instead:
+  //   preheader:
+  //     v0 = load_context +100
+  //     v1 = add v0, <membase>
+  //     store_local l0, v1
+  //     ...
+  //   loop_head:
+  //     v1' = load_local l0
+  //     v2 = load v1'
+  // HIR values are block-local in the backends, so every hoisted value that
+  // is still used in the loop comes back through a local. That costs a load,
+  // so a block's invariant code is only moved when it saves instructions.
+  FindLoops(builder);
+  for (auto& loop : loops_) {
+    ProcessLoop(builder, loop);
+  }
+  loops_.clear();
+  return true;
+}
+
+void LoopInvariantCodeMotionPass::FindLoops(HIRBuilder* builder) {
+  uint16_t block_count = 0;
+  for (auto block = builder->first_block(); block; block = block->next) {
+    block->ordinal = block_count++;
+  }
+
+  // Blocks are in guest code order, so an edge to this or an earlier block
+  // closes a loop. Back edges to the same head are one loop.
+  for (auto block = builder->first_block(); block; block = block->next) {
+    for (auto edge = block->outgoing_edge_head; edge;
+         edge = edge->outgoing_next) {
+      auto head = edge->dest;
+      if (head->ordinal > block->ordinal) {
+        continue;
+      }
+      auto it = std::find_if(loops_.begin(), loops_.end(),
+                             [head](const Loop& loop) {
+                               return loop.head == head;
+                             });
+      if (it != loops_.end()) {
+        if (it->tail->ordinal < block->ordinal) {
+          it->tail = block;
+        }
+      } else {
+        loops_.push_back({head->prev, head, block});
+      }
+    }
+  }
+
+  // Inner loops first, so that what they hoist can be considered again by
+  // the loops around them.
+  std::sort(loops_.begin(), loops_.end(), [](const Loop& a, const Loop& b) {
+    return a.tail->ordinal - a.head->ordinal <
+           b.tail->ordinal - b.head->ordinal;
+  });
+}
+
+bool LoopInvariantCodeMotionPass::IsWellFormed(const Loop& loop) {
+  // The only way into the loop must be from the preheader into the head, or
+  // the preheader doesn't run before everything in the loop.
+  if (!loop.preheader || !loop.preheader->instr_tail ||
+      !(loop.preheader->instr_tail->opcode->flags & OPCODE_FLAG_BRANCH)) {
+    return false;
+  }
+  bool entered = false;
+  for (auto block = loop.head;; block = block->next) {
+    for (auto edge = block->incoming_edge_head; edge;
+         edge = edge->incoming_next) {
+      auto src = edge->src;
+      if (src->ordinal >= loop.head->ordinal &&
+          src->ordinal <= loop.tail->ordinal) {
+        continue;
+      }
+      if (block != loop.head || src != loop.preheader) {
+        return false;
+      }
+      entered = true;
+    }
+    if (block == loop.tail) {
+      break;
+    }
+  }
+  return entered;
+}
+
+void LoopInvariantCodeMotionPass::ProcessLoop(HIRBuilder* builder,
+                                              const Loop& loop) {
+  if (!IsWellFormed(loop)) {
+    return;
+  }
+
+  // Find what the loop may change in the context.
+  stored_context_.assign(sizeof(ppc::PPCContext), false);
+  context_clobbered_ = false;
+  for (auto block = loop.head;; block = block->next) {
+    for (auto i = block->instr_head; i; i = i->next) {
+      auto opcode = i->opcode;
+      if (opcode == &OPCODE_STORE_CONTEXT_info) {
+        size_t offset = static_cast<size_t>(i->src1.offset);
+        size_t size = GetTypeSize(i->src2.value->type);
+        std::fill(stored_context_.begin() + offset,
+                  stored_context_.begin() + offset + size, true);
+      } else if (opcode == &OPCODE_SET_ROUNDING_MODE_info) {
+        // Floating-point results would depend on where they are computed.
+        return;
+      } else if (opcode == &OPCODE_CONTEXT_BARRIER_info ||
+                 opcode == &OPCODE_TRAP_info ||
+                 opcode == &OPCODE_TRAP_TRUE_info ||
+                 opcode == &OPCODE_DEBUG_BREAK_info ||
+                 opcode == &OPCODE_DEBUG_BREAK_TRUE_info ||
+                 (opcode->flags & OPCODE_FLAG_BRANCH &&
+                  opcode != &OPCODE_BRANCH_info &&
+                  opcode != &OPCODE_BRANCH_TRUE_info &&
+                  opcode != &OPCODE_BRANCH_FALSE_info &&
+                  opcode != &OPCODE_RETURN_info &&
+                  opcode != &OPCODE_RETURN_TRUE_info)) {
+        // Calls and anything that may stop in the debugger can change any of
+        // the context.
+        context_clobbered_ = true;
+      }
+    }
+    if (block == loop.tail) {
+      break;
+    }
+  }
+
+  // Hoisted code goes before the branches that end the preheader.
+  auto insert_before = loop.preheader->instr_tail;
+  while (insert_before->prev &&
+         insert_before->prev->opcode->flags & OPCODE_FLAG_BRANCH) {
+    insert_before = insert_before->prev;
+  }
+  for (auto block = loop.head;; block = block->next) {
+    HoistBlock(builder, block, insert_before);
+    if (block == loop.tail) {
+      break;
+    }
+  }
+}
+
+bool LoopInvariantCodeMotionPass::IsInvariant(Instr* i) {
+  if (!i->dest) {
+    return false;
+  }
+  if (i->next && i->next->opcode->flags & OPCODE_FLAG_PAIRED_PREV) {
+    // Has to stay right before its pair.
+    return false;
+  }
+  switch (i->opcode->num) {
+    case OPCODE_LOAD_CONTEXT: {
+      if (context_clobbered_) {
+        return false;
+      }
+      size_t offset = static_cast<size_t>(i->src1.offset);
+      size_t size = GetTypeSize(i->dest->type);
+      return std::find(stored_context_.begin() + offset,
+                       stored_context_.begin() + offset + size,
+                       true) == stored_context_.begin() + offset + size;
+    }
+    // Pure and unable to fault. Memory accesses, division (which traps on
+    // the host) and anything calling out are left alone.
+    case OPCODE_ASSIGN:
+    case OPCODE_CAST:
+    case OPCODE_ZERO_EXTEND:
+    case OPCODE_SIGN_EXTEND:
+    case OPCODE_TRUNCATE:
+    case OPCODE_CONVERT:
+    case OPCODE_ROUND:
+    case OPCODE_VECTOR_CONVERT_I2F:
+    case OPCODE_VECTOR_CONVERT_F2I:
+    case OPCODE_LOAD_VECTOR_SHL:
+    case OPCODE_LOAD_VECTOR_SHR:
+    case OPCODE_MAX:
+    case OPCODE_VECTOR_MAX:
+    case OPCODE_MIN:
+    case OPCODE_VECTOR_MIN:
+    case OPCODE_SELECT:
+    case OPCODE_IS_TRUE:
+    case OPCODE_IS_FALSE:
+    case OPCODE_IS_NAN:
+    case OPCODE_COMPARE_EQ:
+    case OPCODE_COMPARE_NE:
+    case OPCODE_COMPARE_SLT:
+    case OPCODE_COMPARE_SLE:
+    case OPCODE_COMPARE_SGT:
+    case OPCODE_COMPARE_SGE:
+    case OPCODE_COMPARE_ULT:
+    case OPCODE_COMPARE_ULE:
+    case OPCODE_COMPARE_UGT:
+    case OPCODE_COMPARE_UGE:
+    case OPCODE_VECTOR_COMPARE_EQ:
+    case OPCODE_VECTOR_COMPARE_SGT:
+    case OPCODE_VECTOR_COMPARE_SGE:
+    case OPCODE_VECTOR_COMPARE_UGT:
+    case OPCODE_VECTOR_COMPARE_UGE:
+    case OPCODE_ADD:
+    case OPCODE_ADD_CARRY:
+    case OPCODE_DID_CARRY:
+    case OPCODE_VECTOR_ADD:
+    case OPCODE_SUB:
+    case OPCODE_VECTOR_SUB:
+    case OPCODE_MUL:
+    case OPCODE_MUL_HI:
+    case OPCODE_MUL_ADD:
+    case OPCODE_MUL_SUB:
+    case OPCODE_NEG:
+    case OPCODE_ABS:
+    case OPCODE_SQRT:
+    case OPCODE_RSQRT:
+    case OPCODE_RECIP:
+    case OPCODE_DOT_PRODUCT_3:
+    case OPCODE_DOT_PRODUCT_4:
+    case OPCODE_AND:
+    case OPCODE_OR:
+    case OPCODE_XOR:
+    case OPCODE_NOT:
+    case OPCODE_SHL:
+    case OPCODE_VECTOR_SHL:
+    case OPCODE_SHR:
+    case OPCODE_VECTOR_SHR:
+    case OPCODE_SHA:
+    case OPCODE_VECTOR_SHA:
+    case OPCODE_ROTATE_LEFT:
+    case OPCODE_VECTOR_ROTATE_LEFT:
+    case OPCODE_VECTOR_AVERAGE:
+    case OPCODE_BYTE_SWAP:
+    case OPCODE_CNTLZ:
+    case OPCODE_INSERT:
+    case OPCODE_EXTRACT:
+    case OPCODE_SPLAT:
+    case OPCODE_PERMUTE:
+    case OPCODE_SWIZZLE:
+    case OPCODE_PACK:
+    case OPCODE_UNPACK:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void LoopInvariantCodeMotionPass::HoistBlock(HIRBuilder* builder,
+                                             Block* block,
+                                             Instr* insert_before) {
+  uint32_t instr_count = 0;
+  for (auto i = block->instr_head; i; i = i->next) {
+    i->ordinal = instr_count++;
+  }
+  hoistable_.assign(instr_count, false);
+
+  // Everything feeding a hoistable instruction is defined earlier in the
+  // same block, so one forward walk finds them all.
+  auto is_hoistable_operand = [&](Value* value) {
+    if (value->IsConstant()) {
+      return true;
+    }
+    auto def = value->def;
+    return def && def->block == block && hoistable_[def->ordinal];
+  };
+  hoisted_.clear();
+  for (auto i = block->instr_head; i; i = i->next) {
+    if (!IsInvariant(i)) {
+      continue;
+    }
+    uint32_t signature = i->opcode->signature;
+    if ((GET_OPCODE_SIG_TYPE_SRC1(signature) == OPCODE_SIG_TYPE_V &&
+         !is_hoistable_operand(i->src1.value)) ||
+        (GET_OPCODE_SIG_TYPE_SRC2(signature) == OPCODE_SIG_TYPE_V &&
+         !is_hoistable_operand(i->src2.value)) ||
+        (GET_OPCODE_SIG_TYPE_SRC3(signature) == OPCODE_SIG_TYPE_V &&
+         !is_hoistable_operand(i->src3.value))) {
+      continue;
+    }
+    hoistable_[i->ordinal] = true;
+    hoisted_.push_back(i);
+  }
+
+  // Values still used in the loop have to be reloaded from a local.
+  auto is_root = [&](Instr* i) {
+    for (auto use = i->dest->use_head; use; use = use->next) {
+      if (use->instr->block != block || !hoistable_[use->instr->ordinal]) {
+        return true;
+      }
+    }
+    return false;
+  };
+  size_t root_count = 0;
+  for (auto i : hoisted_) {
+    root_count += is_root(i) ? 1 : 0;
+  }
+  if (hoisted_.size() <= root_count) {
+    return;
+  }
+
+  for (auto i : hoisted_) {
+    if (is_root(i)) {
+      auto value = i->dest;
+      auto slot = builder->AllocLocal(value->type);
+      auto reload = builder->LoadLocal(slot);
+      builder->last_instr()->MoveBefore(i);
+      // Swap uses that stay in the loop over to the reloaded value.
+      auto use = value->use_head;
+      while (use) {
+        auto next_use = use->next;
+        auto user = use->instr;
+        if (user->block != block || !hoistable_[user->ordinal]) {
+          if (user->src1_use == use) {
+            user->set_src1(reload);
+          } else if (user->src2_use == use) {
+            user->set_src2(reload);
+          } else if (user->src3_use == use) {
+            user->set_src3(reload);
+          }
+        }
+        use = next_use;
+      }
+      i->MoveBefore(insert_before);
+      builder->StoreLocal(slot, value);
+      builder->last_instr()->MoveBefore(insert_before);
+    } else {
+      i->MoveBefore(insert_before);
+    }
+  }
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
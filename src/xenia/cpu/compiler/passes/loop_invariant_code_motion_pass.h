@@ -0,0 +1,63 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+#define XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
+
+#include <vector>
+
+#include "xenia/cpu/compiler/compiler_pass.h"
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Moves computations that produce the same value on every iteration of a loop
+// into the block that enters it. Requires the edges from
+// ControlFlowAnalysisPass.
+class LoopInvariantCodeMotionPass : public CompilerPass {
+ public:
+  LoopInvariantCodeMotionPass();
+  ~LoopInvariantCodeMotionPass() override;
+
+  bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "loop_invariant_code_motion"; }
+
+ private:
+  // Blocks head..tail in layout order, entered from preheader.
+  struct Loop {
+    hir::Block* preheader;
+    hir::Block* head;
+    hir::Block* tail;
+  };
+
+  void FindLoops(hir::HIRBuilder* builder);
+  bool IsWellFormed(const Loop& loop);
+  void ProcessLoop(hir::HIRBuilder* builder, const Loop& loop);
+  bool IsInvariant(hir::Instr* i);
+  void HoistBlock(hir::HIRBuilder* builder, hir::Block* block,
+                  hir::Instr* insert_before);
+
+ private:
+  std::vector<Loop> loops_;
+  // Context bytes written somewhere in the loop being processed.
+  std::vector<bool> stored_context_;
+  bool context_clobbered_ = false;
+  // Hoistable instructions of the block being processed, by ordinal.
+  std::vector<bool> hoistable_;
+  std::vector<hir::Instr*> hoisted_;
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_LOOP_INVARIANT_CODE_MOTION_PASS_H_
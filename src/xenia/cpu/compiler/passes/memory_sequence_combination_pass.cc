@@ -9,8 +9,17 @@
 
 #include "xenia/cpu/compiler/passes/memory_sequence_combination_pass.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <vector>
+
 #include "xenia/base/profiling.h"
 
+DEFINE_bool(combine_memory_copies, true,
+            "Copy guest memory moved by runs of adjacent loads and stores "
+            "16 bytes at a time.");
+
 namespace xe {
 namespace cpu {
 namespace compiler {
@@ -19,6 +28,7 @@ namespace passes {
 // TODO(benvanik): remove when enums redefined.
 using namespace xe::cpu::hir;
 
+using xe::cpu::hir::Block;
 using xe::cpu::hir::HIRBuilder;
 using xe::cpu::hir::Instr;
 using xe::cpu::hir::Value;
@@ -44,6 +54,10 @@ bool MemorySequenceCombinationPass::Run(HIRBuilder* builder) {
       }
       i = i->next;
     }
+    if (FLAGS_combine_memory_copies) {
+      while (CombineCopySequence(builder, block)) {
+      }
+    }
     block = block->next;
   }
   return true;
@@ -150,6 +164,243 @@ void MemorySequenceCombinationPass::CombineStoreSequence(Instr* i) {
   // TODO(benvanik): extend/truncate.
 }
 
+static bool IsLoad(const Instr* i) {
+  return i->opcode == &OPCODE_LOAD_info ||
+         i->opcode == &OPCODE_LOAD_OFFSET_info;
+}
+
+static bool IsStore(const Instr* i) {
+  return i->opcode == &OPCODE_STORE_info ||
+         i->opcode == &OPCODE_STORE_OFFSET_info;
+}
+
+// Splits the address of a load or store into a base value (null if constant)
+// and a constant offset. lfd and stfd add their offset, lwz and stw use the
+// offset forms.
+static bool SplitAddress(const Instr* i, Value** out_base,
+                         int64_t* out_offset) {
+  Value* base = i->src1.value;
+  int64_t offset = 0;
+  if (i->opcode == &OPCODE_LOAD_OFFSET_info ||
+      i->opcode == &OPCODE_STORE_OFFSET_info) {
+    if (!i->src2.value->IsConstant()) {
+      return false;
+    }
+    offset = i->src2.value->constant.i64;
+  }
+  while (base && !base->IsConstant() && base->def) {
+    auto def = base->def;
+    if (def->opcode == &OPCODE_ASSIGN_info) {
+      base = def->src1.value;
+    } else if (def->opcode == &OPCODE_ADD_info && !def->flags &&
+               def->src2.value->IsConstant()) {
+      offset += def->src2.value->constant.i64;
+      base = def->src1.value;
+    } else {
+      break;
+    }
+  }
+  if (base->IsConstant()) {
+    offset += base->constant.i64;
+    base = nullptr;
+  }
+  *out_base = base;
+  *out_offset = offset;
+  return true;
+}
+
+// Finds the load a stored value was moved from without changing its bits,
+// if any: through assignments, casts and extensions truncated back.
+static Instr* FindStoredLoad(Value* value) {
+  while (value->def) {
+    auto def = value->def;
+    if (def->opcode == &OPCODE_ASSIGN_info ||
+        def->opcode == &OPCODE_CAST_info) {
+      value = def->src1.value;
+    } else if (def->opcode == &OPCODE_TRUNCATE_info) {
+      auto extended = def->src1.value;
+      while (extended->def && extended->def->opcode == &OPCODE_ASSIGN_info) {
+        extended = extended->def->src1.value;
+      }
+      if (!extended->def ||
+          (extended->def->opcode != &OPCODE_ZERO_EXTEND_info &&
+           extended->def->opcode != &OPCODE_SIGN_EXTEND_info) ||
+          extended->def->src1.value->type != value->type) {
+        return nullptr;
+      }
+      value = extended->def->src1.value;
+    } else {
+      return IsLoad(def) ? def : nullptr;
+    }
+  }
+  return nullptr;
+}
+
+bool MemorySequenceCombinationPass::CombineCopySequence(HIRBuilder* builder,
+                                                        Block* block) {
+  // Memory moved by adjacent loads to adjacent stores, as in unrolled struct
+  // copies:
+  //   v1.i32 = load_offset v0, 0, [swap]
+  //   v2.i32 = load_offset v0, 4, [swap]
+  //   ...
+  //   store_offset v10, 0, v1.i32, [swap]
+  //   store_offset v10, 4, v2.i32, [swap]
+  //   ...
+  // becomes, for every 16 bytes:
+  //   v20.v128 = load v0
+  //   store v10, v20.v128
+  // The swaps cancel out, as the data is only moved. The scalar loads are
+  // left for DCE if the registers they were loaded into are dead.
+  struct Move {
+    Instr* store;
+    Instr* load;
+    uint32_t store_ordinal;
+    uint32_t load_ordinal;
+    Value* store_base;
+    int64_t store_offset;
+    Value* load_base;
+    int64_t load_offset;
+    uint32_t size;
+  };
+  std::vector<Instr*> instrs;
+  std::vector<Move> moves;
+  for (auto i = block->instr_head; i; i = i->next) {
+    i->ordinal = uint32_t(instrs.size());
+    instrs.push_back(i);
+    if (!IsStore(i)) {
+      continue;
+    }
+    Value* value = i->opcode == &OPCODE_STORE_OFFSET_info ? i->src3.value
+                                                           : i->src2.value;
+    if (value->IsConstant() || value->type == VEC128_TYPE ||
+        value->type == FLOAT32_TYPE) {
+      continue;
+    }
+    Instr* load = FindStoredLoad(value);
+    if (!load || load->block != block || load->flags != i->flags ||
+        load->dest->type == FLOAT32_TYPE ||
+        GetTypeSize(load->dest->type) != GetTypeSize(value->type)) {
+      continue;
+    }
+    Move move;
+    move.store = i;
+    move.load = load;
+    move.store_ordinal = i->ordinal;
+    move.load_ordinal = load->ordinal;
+    move.size = uint32_t(GetTypeSize(value->type));
+    if (SplitAddress(i, &move.store_base, &move.store_offset) &&
+        SplitAddress(load, &move.load_base, &move.load_offset)) {
+      moves.push_back(move);
+    }
+  }
+  if (moves.size() < 2) {
+    return false;
+  }
+
+  // Moves between the same bases, by the same distance, that are each other's
+  // neighbors.
+  std::sort(moves.begin(), moves.end(), [](const Move& a, const Move& b) {
+    if (a.store_base != b.store_base) {
+      return a.store_base < b.store_base;
+    }
+    if (a.load_base != b.load_base) {
+      return a.load_base < b.load_base;
+    }
+    int64_t a_delta = a.store_offset - a.load_offset;
+    int64_t b_delta = b.store_offset - b.load_offset;
+    if (a_delta != b_delta) {
+      return a_delta < b_delta;
+    }
+    return a.store_offset < b.store_offset;
+  });
+  for (size_t first = 0; first < moves.size(); ++first) {
+    auto& head = moves[first];
+    uint32_t size = head.size;
+    size_t end = first + 1;
+    while (size < 16 && end < moves.size()) {
+      auto& move = moves[end];
+      if (move.store_base != head.store_base ||
+          move.load_base != head.load_base ||
+          move.store_offset != head.store_offset + size ||
+          move.load_offset != head.load_offset + size) {
+        break;
+      }
+      size += move.size;
+      ++end;
+    }
+    if (size != 16 || end - first < 2) {
+      continue;
+    }
+
+    // Only when all the loads come before all the stores, so it doesn't
+    // matter whether the source and the destination overlap, and nothing
+    // else in between may touch memory.
+    uint32_t first_ordinal = UINT32_MAX;
+    uint32_t last_load_ordinal = 0;
+    uint32_t first_store_ordinal = UINT32_MAX;
+    uint32_t last_ordinal = 0;
+    for (size_t n = first; n < end; ++n) {
+      first_ordinal = std::min(first_ordinal, moves[n].load_ordinal);
+      last_load_ordinal = std::max(last_load_ordinal, moves[n].load_ordinal);
+      first_store_ordinal =
+          std::min(first_store_ordinal, moves[n].store_ordinal);
+      last_ordinal = std::max(last_ordinal, moves[n].store_ordinal);
+    }
+    if (last_load_ordinal > first_store_ordinal) {
+      continue;
+    }
+    bool safe = true;
+    for (uint32_t n = first_ordinal; safe && n <= last_ordinal; ++n) {
+      auto i = instrs[n];
+      if (i->opcode->flags & (OPCODE_FLAG_BRANCH | OPCODE_FLAG_VOLATILE)) {
+        safe = false;
+      } else if (i->opcode->flags & OPCODE_FLAG_MEMORY) {
+        if (IsLoad(i)) {
+          // Other loads are fine until the stores start.
+          safe = n < first_store_ordinal ||
+                 std::any_of(moves.begin() + first, moves.begin() + end,
+                             [i](const Move& move) { return move.load == i; });
+        } else {
+          safe = std::any_of(
+              moves.begin() + first, moves.begin() + end,
+              [i](const Move& move) { return move.store == i; });
+        }
+      }
+    }
+    if (!safe) {
+      continue;
+    }
+
+    // Load right after the last scalar load and store in place of the last
+    // scalar store, where all of the addresses are available.
+    auto make_address = [&](Value* base, int64_t offset, Instr* before) {
+      Value* address = base ? base : builder->LoadZeroInt64();
+      if (offset) {
+        address = builder->Add(address, builder->LoadConstantInt64(offset));
+        if (address->def) {
+          address->def->MoveBefore(before);
+        }
+      }
+      return address;
+    };
+    auto load_before = instrs[last_load_ordinal]->next;
+    auto vector = builder->Load(
+        make_address(head.load_base, head.load_offset, load_before),
+        VEC128_TYPE);
+    vector->def->MoveBefore(load_before);
+    auto store_before = instrs[last_ordinal];
+    builder->Store(
+        make_address(head.store_base, head.store_offset, store_before),
+        vector);
+    builder->last_instr()->MoveBefore(store_before);
+    for (size_t n = first; n < end; ++n) {
+      moves[n].store->Remove();
+    }
+    return true;
+  }
+  return false;
+}
+
 }  // namespace passes
 }  // namespace compiler
 }  // namespace cpu
@@ -23,11 +23,15 @@ class MemorySequenceCombinationPass : public CompilerPass {
   ~MemorySequenceCombinationPass() override;
 
   bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "memory_sequence_combination"; }
 
  private:
   void CombineMemorySequences(hir::HIRBuilder* builder);
   void CombineLoadSequence(hir::Instr* i);
   void CombineStoreSequence(hir::Instr* i);
+  // Returns true if a copy was combined, after which the block has to be
+  // looked at again.
+  bool CombineCopySequence(hir::HIRBuilder* builder, hir::Block* block);
 };
 
 }  // namespace passes
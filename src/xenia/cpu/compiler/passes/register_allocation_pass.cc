@@ -13,9 +13,11 @@
 #include <cstring>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
+#include "xenia/cpu/compiler/passes/register_allocation_stats.h"
 
 namespace xe {
 namespace cpu {
@@ -35,6 +37,8 @@ using xe::cpu::hir::Value;
 
 #define ASSERT_NO_CYCLES 0
 
+static RegisterAllocationStats stats_("Default");
+
 RegisterAllocationPass::RegisterAllocationPass(const MachineInfo* machine_info)
     : CompilerPass() {
   // Initialize register sets.
@@ -77,6 +81,10 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
   // Really, it'd just be nice to have someone who knew what they
   // were doing lower SSA and do this right.
 
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  spill_count_ = 0;
+  reload_count_ = 0;
+
   uint16_t block_ordinal = 0;
   uint32_t instr_ordinal = 0;
   auto block = builder->first_block();
@@ -170,6 +178,10 @@ bool RegisterAllocationPass::Run(HIRBuilder* builder) {
     block = block->next;
   }
 
+  // Every spill gets its own slot.
+  stats_.Record(Clock::QueryHostTickCount() - start_ticks, spill_count_,
+                reload_count_, spill_count_);
+
   return true;
 }
 
@@ -374,6 +386,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   } else {
     // Allocate a local slot.
     spill_value->local_slot = builder->AllocLocal(spill_value->type);
+    ++spill_count_;
 
     // Add store.
     builder->StoreLocal(spill_value->local_slot, spill_value);
@@ -419,6 +432,7 @@ bool RegisterAllocationPass::SpillOneRegister(HIRBuilder* builder, Block* block,
   // automatically when we get to it.
   auto new_value = builder->LoadLocal(spill_value->local_slot);
   auto spill_load = builder->last_instr();
+  ++reload_count_;
   spill_load->MoveBefore(next_use->instr);
   // Note: implicit first use added.
 
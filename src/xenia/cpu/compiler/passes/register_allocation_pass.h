@@ -29,6 +29,7 @@ class RegisterAllocationPass : public CompilerPass {
   ~RegisterAllocationPass() override;
 
   bool Run(hir::HIRBuilder* builder) override;
+  const char* name() const override { return "register_allocation"; }
 
  private:
   // TODO(benvanik): rewrite all this set shit -- too much indirection, the
@@ -78,6 +79,9 @@ class RegisterAllocationPass : public CompilerPass {
     RegisterSetUsage* vec_set = nullptr;
     RegisterSetUsage* all_sets[3];
   } usage_sets_;
+
+  uint32_t spill_count_ = 0;
+  uint32_t reload_count_ = 0;
 };
 
 }  // namespace passes
@@ -0,0 +1,53 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/compiler/passes/register_allocation_stats.h"
+
+#include <gflags/gflags.h>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+
+DEFINE_bool(log_register_allocation_stats, false,
+            "Periodically log register allocator compile time and spill "
+            "counts.");
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Functions between each logged report.
+static const uint64_t kReportInterval = 1000;
+
+void RegisterAllocationStats::Record(uint64_t host_ticks, uint32_t spill_count,
+                                     uint32_t reload_count,
+                                     uint32_t slot_count) {
+  host_ticks_ += host_ticks;
+  spill_count_ += spill_count;
+  reload_count_ += reload_count;
+  slot_count_ += slot_count;
+  uint64_t function_count = ++function_count_;
+
+  if (!FLAGS_log_register_allocation_stats ||
+      function_count % kReportInterval) {
+    return;
+  }
+  uint64_t micros = host_ticks_ * 1000000 / Clock::host_tick_frequency();
+  XELOGI(
+      "%s register allocation: %lld functions in %lldus, %lld spills, %lld "
+      "reloads, %lld stack slots",
+      name_, function_count, micros, uint64_t(spill_count_),
+      uint64_t(reload_count_), uint64_t(slot_count_));
+}
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
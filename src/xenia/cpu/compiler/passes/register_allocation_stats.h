@@ -0,0 +1,47 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_COMPILER_PASSES_REGISTER_ALLOCATION_STATS_H_
+#define XENIA_CPU_COMPILER_PASSES_REGISTER_ALLOCATION_STATS_H_
+
+#include <atomic>
+#include <cstdint>
+
+namespace xe {
+namespace cpu {
+namespace compiler {
+namespace passes {
+
+// Running totals for a register allocator across all functions it has run on,
+// used to compare allocators. Periodically logged with
+// --log_register_allocation_stats.
+class RegisterAllocationStats {
+ public:
+  explicit RegisterAllocationStats(const char* name) : name_(name) {}
+
+  // Records one function. Spills are stores to a stack slot, reloads are the
+  // loads back out of one.
+  void Record(uint64_t host_ticks, uint32_t spill_count, uint32_t reload_count,
+              uint32_t slot_count);
+
+ private:
+  const char* name_;
+  std::atomic<uint64_t> function_count_ = {0};
+  std::atomic<uint64_t> host_ticks_ = {0};
+  std::atomic<uint64_t> spill_count_ = {0};
+  std::atomic<uint64_t> reload_count_ = {0};
+  std::atomic<uint64_t> slot_count_ = {0};
+};
+
+}  // namespace passes
+}  // namespace compiler
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_COMPILER_PASSES_REGISTER_ALLOCATION_STATS_H_
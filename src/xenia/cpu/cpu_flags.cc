@@ -16,8 +16,55 @@ DEFINE_string(
     "Loads a .map for symbol names and to diff with the generated symbol "
     "database.");
 
+DEFINE_string(persistent_code_cache_path, "",
+              "Directory to persist generated code in across runs of the same "
+              "title. Disabled if empty.");
+
+DEFINE_string(xex_image_cache_path, "",
+              "Directory to keep decrypted, decompressed and patched XEX "
+              "images in so later loads can skip that work. Disabled if "
+              "empty.");
+
+DEFINE_bool(code_cache_large_pages, false,
+            "Back the generated code region with large pages to reduce iTLB "
+            "misses. The whole region is committed up front. Falls back to "
+            "regular pages if the host can't provide them.");
+
+DEFINE_int32(translation_worker_count, 0,
+             "Number of background threads translating functions ahead of "
+             "their first call. 0 translates everything on demand.");
+DEFINE_int32(restore_translation_wait_ms, 30000,
+             "Longest to hold guest threads after restoring a save state "
+             "while the translation workers translate the functions it was "
+             "running again.");
+
+DEFINE_bool(tiered_compilation, false,
+            "Compile functions with a fast baseline pipeline first and only "
+            "fully optimize the ones that are called often.");
+DEFINE_int32(tier_up_call_count, 1000,
+             "Calls to a baseline function before it is recompiled with full "
+             "optimization.");
+
+DEFINE_bool(profile_guided_layout, false,
+            "Record block execution counts in baseline code and move blocks "
+            "that never ran out of line when recompiling hot functions. "
+            "Requires --tiered_compilation.");
+
+DEFINE_int32(max_guest_function_instructions, 4096,
+             "Guest functions longer than this many instructions are split "
+             "into separately compiled regions to bound compile time. 0 to "
+             "never split.");
+
+DEFINE_bool(invalidate_modified_code, false,
+            "Write-watch translated guest code and retranslate functions "
+            "whose code is modified at runtime.");
+
+DEFINE_bool(profile_kernel_calls, false,
+            "Record the call count and host time of every kernel export, "
+            "shown in the debugger and logged at exit.");
+
 DEFINE_bool(disassemble_functions, false,
-            "Disassemble functions during generation.");
+            "Log the disassembly of functions as they are generated.");
 
 DEFINE_bool(trace_functions, false,
             "Generate tracing for function statistics.");
@@ -27,6 +74,20 @@ DEFINE_bool(trace_function_references, false,
             "Generate tracing for function address references.");
 DEFINE_bool(trace_function_data, false,
             "Generate tracing for function result data.");
+DEFINE_string(trace_function_records_path, "",
+              "Record every guest function entry and return into per-thread "
+              "rings flushed to this file, for xenia-cpu-trace-dump.");
+DEFINE_bool(trace_function_records_gprs, false,
+            "Also record r3 and r4 with --trace_function_records_path.");
+
+DEFINE_uint64(capture_function, 0,
+              "Guest address of a function to snapshot a call of, with its "
+              "context and memory, for xenia-cpu-replay.");
+DEFINE_uint64(capture_function_hit, 100,
+              "Which call of --capture_function to snapshot, so that it is "
+              "as warmed up as a hot function would be.");
+DEFINE_string(capture_function_path, "capture.xfc",
+              "Path to write the --capture_function snapshot to.");
 
 DEFINE_bool(
     disable_global_lock, false,
@@ -35,6 +96,49 @@ DEFINE_bool(
 DEFINE_bool(validate_hir, false,
             "Perform validation checks on the HIR during compilation.");
 
+DEFINE_bool(global_context_promotion, false,
+            "Forward guest context values across blocks, not just within "
+            "them.");
+DEFINE_bool(loop_invariant_code_motion, false,
+            "Compute loop-invariant values once before the loop instead of "
+            "on every iteration.");
+DEFINE_bool(inline_leaf_functions, false,
+            "Inline calls to small, already translated leaf functions.");
+DEFINE_int32(inline_max_instructions, 8,
+             "Largest leaf function, in instructions, that will be inlined.");
+DEFINE_bool(trace_compilation, false,
+            "Compile hot direct callees, branches and all, into the optimized "
+            "code of their callers. Exits from the callee to anywhere else "
+            "become regular calls.");
+DEFINE_int32(trace_max_instructions, 64,
+             "Largest callee, in instructions, compiled into its callers with "
+             "--trace_compilation.");
+DEFINE_string(native_crt_signatures, "",
+              "File of guest CRT routine signatures (memcpy, memset, strlen) "
+              "to replace with native implementations.");
+DEFINE_string(native_crt_disabled_titles, "",
+              "Comma-separated hex title IDs that keep their guest CRT "
+              "routines.");
+
+DEFINE_bool(yield_on_spin_loops, true,
+            "Give up the host core in guest loops that only poll memory and "
+            "on guest low thread priority hints.");
+DEFINE_bool(inline_kernel_intrinsics, true,
+            "Emit uncontended kernel spinlocks and the interlocked SList "
+            "exports in generated code instead of calling the kernel.");
+DEFINE_bool(bind_import_calls, true,
+            "Call kernel exports straight from the call sites of their "
+            "import thunks instead of going through the thunk code.");
+
+DEFINE_string(guest_profile_path, "",
+              "Sample guest threads and write their stacks to this path as "
+              "folded stacks (for flame graphs) on exit.");
+DEFINE_int32(guest_profile_interval_us, 10000,
+             "Microseconds between guest profiler samples.");
+
+DEFINE_string(register_allocator, "default",
+              "Register allocator [default, linear_scan].");
+
 // Breakpoints:
 DEFINE_uint64(break_on_instruction, 0,
               "int3 before the given guest address is executed.");
@@ -16,17 +16,57 @@ DECLARE_string(cpu);
 
 DECLARE_string(load_module_map);
 
+DECLARE_string(persistent_code_cache_path);
+DECLARE_string(xex_image_cache_path);
+
+DECLARE_bool(code_cache_large_pages);
+
+DECLARE_int32(translation_worker_count);
+DECLARE_int32(restore_translation_wait_ms);
+
+DECLARE_bool(tiered_compilation);
+DECLARE_int32(tier_up_call_count);
+DECLARE_bool(profile_guided_layout);
+
+DECLARE_int32(max_guest_function_instructions);
+
+DECLARE_bool(invalidate_modified_code);
+
+DECLARE_bool(profile_kernel_calls);
 DECLARE_bool(disassemble_functions);
 
 DECLARE_bool(trace_functions);
 DECLARE_bool(trace_function_coverage);
 DECLARE_bool(trace_function_references);
 DECLARE_bool(trace_function_data);
+DECLARE_string(trace_function_records_path);
+DECLARE_bool(trace_function_records_gprs);
+
+DECLARE_uint64(capture_function);
+DECLARE_uint64(capture_function_hit);
+DECLARE_string(capture_function_path);
 
 DECLARE_bool(disable_global_lock);
 
 DECLARE_bool(validate_hir);
 
+DECLARE_bool(global_context_promotion);
+DECLARE_bool(loop_invariant_code_motion);
+DECLARE_bool(inline_leaf_functions);
+DECLARE_int32(inline_max_instructions);
+DECLARE_bool(trace_compilation);
+DECLARE_int32(trace_max_instructions);
+DECLARE_string(native_crt_signatures);
+DECLARE_string(native_crt_disabled_titles);
+DECLARE_bool(yield_on_spin_loops);
+DECLARE_bool(inline_kernel_intrinsics);
+DECLARE_bool(bind_import_calls);
+
+DECLARE_string(guest_profile_path);
+DECLARE_int32(guest_profile_interval_us);
+
+DECLARE_string(register_allocator);
+
 DECLARE_uint64(break_on_instruction);
 DECLARE_int32(break_condition_gpr);
 DECLARE_uint64(break_condition_value);
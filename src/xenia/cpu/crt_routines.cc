@@ -0,0 +1,136 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/crt_routines.h"
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include "xenia/base/logging.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+
+// All of these operate on bytes, and guest memory is stored in guest byte
+// order, so no swapping is required for them to behave as they would on the
+// console. Arguments arrive in r3-r5 and results go back in r3.
+
+// memcpy returns dest, which is already in r3. Overlapping copies are
+// undefined in the guest too, but memmove keeps us from ever reading bytes
+// we've just written.
+static void CrtMemcpy(ppc::PPCContext* ppc_context,
+                      kernel::KernelState* kernel_state) {
+  uint32_t dest = static_cast<uint32_t>(ppc_context->r[3]);
+  uint32_t src = static_cast<uint32_t>(ppc_context->r[4]);
+  uint32_t size = static_cast<uint32_t>(ppc_context->r[5]);
+  std::memmove(ppc_context->virtual_membase + dest,
+               ppc_context->virtual_membase + src, size);
+}
+
+static void CrtMemset(ppc::PPCContext* ppc_context,
+                      kernel::KernelState* kernel_state) {
+  uint32_t dest = static_cast<uint32_t>(ppc_context->r[3]);
+  uint8_t value = static_cast<uint8_t>(ppc_context->r[4]);
+  uint32_t size = static_cast<uint32_t>(ppc_context->r[5]);
+  std::memset(ppc_context->virtual_membase + dest, value, size);
+}
+
+static void CrtStrlen(ppc::PPCContext* ppc_context,
+                      kernel::KernelState* kernel_state) {
+  uint32_t str = static_cast<uint32_t>(ppc_context->r[3]);
+  ppc_context->r[3] = std::strlen(
+      reinterpret_cast<const char*>(ppc_context->virtual_membase + str));
+}
+
+static const CrtRoutine crt_routines[] = {
+    {"memcpy", CrtMemcpy},   {"memmove", CrtMemcpy},
+    {"XMemCpy", CrtMemcpy},  {"memset", CrtMemset},
+    {"XMemSet", CrtMemset},  {"strlen", CrtStrlen},
+};
+
+const CrtRoutine* LookupCrtRoutine(const std::string& name) {
+  for (auto& routine : crt_routines) {
+    if (name == routine.name) {
+      return &routine;
+    }
+  }
+  return nullptr;
+}
+
+bool LoadCrtSignatures(const std::string& path,
+                       std::vector<CrtSignature>* out_signatures) {
+  std::ifstream infile(path);
+  if (!infile) {
+    XELOGE("Unable to open CRT signature file %s", path.c_str());
+    return false;
+  }
+
+  std::string line;
+  std::stringstream sstream;
+  std::string name;
+  std::string word;
+  while (std::getline(infile, line)) {
+    if (line.empty() || line[0] == '#') {
+      continue;
+    }
+    sstream.clear();
+    sstream.str(line);
+    if (!(sstream >> name)) {
+      continue;
+    }
+    auto routine = LookupCrtRoutine(name);
+    if (!routine) {
+      XELOGW("CRT signature for unknown routine %s ignored", name.c_str());
+      continue;
+    }
+
+    CrtSignature signature;
+    signature.routine = routine;
+    bool valid = true;
+    while (valid && sstream >> word) {
+      if (word.size() != 8) {
+        valid = false;
+        break;
+      }
+      uint32_t value = 0;
+      uint32_t mask = 0;
+      for (char c : word) {
+        value <<= 4;
+        mask <<= 4;
+        if (c == '?') {
+          continue;
+        }
+        mask |= 0xF;
+        if (c >= '0' && c <= '9') {
+          value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+          value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+          value |= c - 'A' + 10;
+        } else {
+          valid = false;
+        }
+      }
+      signature.values.push_back(value);
+      signature.masks.push_back(mask);
+    }
+    if (!valid || signature.values.empty()) {
+      XELOGW("Malformed CRT signature for %s ignored", name.c_str());
+      continue;
+    }
+    out_signatures->push_back(std::move(signature));
+  }
+
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
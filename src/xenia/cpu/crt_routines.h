@@ -0,0 +1,49 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_CRT_ROUTINES_H_
+#define XENIA_CPU_CRT_ROUTINES_H_
+
+#include <string>
+#include <vector>
+
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+
+// A guest C runtime routine with a native host implementation.
+struct CrtRoutine {
+  const char* name;
+  GuestFunction::ExternHandler handler;
+};
+
+// Returns the native implementation of the named routine, if there is one.
+const CrtRoutine* LookupCrtRoutine(const std::string& name);
+
+// A code pattern identifying a statically linked CRT routine.
+// Each instruction word is compared under its mask, so operands that vary
+// between builds (branch displacements, etc) can be ignored.
+struct CrtSignature {
+  const CrtRoutine* routine;
+  std::vector<uint32_t> values;
+  std::vector<uint32_t> masks;
+};
+
+// Loads signatures from a text file, one per line:
+//   <routine name> <word> <word> ...
+// Words are 8 hex digits in guest (big-endian) order; any digit may be '?'
+// to match anything. Blank lines and lines starting with '#' are skipped.
+bool LoadCrtSignatures(const std::string& path,
+                       std::vector<CrtSignature>* out_signatures);
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_CRT_ROUTINES_H_
@@ -19,16 +19,11 @@ EntryTable::EntryTable() = default;
 
 EntryTable::~EntryTable() {
   auto global_lock = global_critical_region_.Acquire();
-  for (auto it : map_) {
-    Entry* entry = it.second;
-    delete entry;
-  }
+  map_.ForEach([](uint32_t address, Entry* entry) { delete entry; });
 }
 
 Entry* EntryTable::Get(uint32_t address) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  Entry* entry = map_.Find(address);
   if (entry) {
     // TODO(benvanik): wait if needed?
     if (entry->status != Entry::STATUS_READY) {
@@ -38,18 +33,27 @@ Entry* EntryTable::Get(uint32_t address) {
   return entry;
 }
 
-Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
-  // TODO(benvanik): replace with a map with wait-free for find.
-  // https://github.com/facebook/folly/blob/master/folly/AtomicHashMap.h
+Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry,
+                                      bool* out_waited) {
+  // Ready entries are by far the common case and don't need the lock.
+  Entry* entry = map_.Find(address);
+  if (entry && entry->status == Entry::STATUS_READY) {
+    *out_entry = entry;
+    if (out_waited) {
+      *out_waited = false;
+    }
+    return Entry::STATUS_READY;
+  }
 
   auto global_lock = global_critical_region_.Acquire();
-  const auto& it = map_.find(address);
-  Entry* entry = it != map_.end() ? it->second : nullptr;
+  entry = map_.Find(address);
   Entry::Status status;
+  bool waited = false;
   if (entry) {
     // If we aren't ready yet spin and wait.
     if (entry->status == Entry::STATUS_COMPILING) {
       // Still compiling, so spin.
+      waited = true;
       do {
         global_lock.unlock();
         // TODO(benvanik): sleep for less time?
@@ -58,6 +62,10 @@ Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
       } while (entry->status == Entry::STATUS_COMPILING);
     }
     status = entry->status;
+    if (status == Entry::STATUS_NEW) {
+      // Invalidated, so the caller gets to regenerate it.
+      entry->status = Entry::STATUS_COMPILING;
+    }
   } else {
     // Create and return for initialization.
     entry = new Entry();
@@ -65,25 +73,52 @@ Entry::Status EntryTable::GetOrCreate(uint32_t address, Entry** out_entry) {
     entry->end_address = 0;
     entry->status = Entry::STATUS_COMPILING;
     entry->function = 0;
-    map_[address] = entry;
+    map_.Insert(address, entry);
     status = Entry::STATUS_NEW;
   }
   global_lock.unlock();
   *out_entry = entry;
+  if (out_waited) {
+    *out_waited = waited;
+  }
   return status;
 }
 
 std::vector<Function*> EntryTable::FindWithAddress(uint32_t address) {
   auto global_lock = global_critical_region_.Acquire();
   std::vector<Function*> fns;
-  for (auto& it : map_) {
-    Entry* entry = it.second;
+  map_.ForEach([&](uint32_t entry_address, Entry* entry) {
     if (address >= entry->address && address <= entry->end_address) {
       if (entry->status == Entry::STATUS_READY) {
         fns.push_back(entry->function);
       }
     }
-  }
+  });
+  return fns;
+}
+
+std::vector<Function*> EntryTable::FindReady() {
+  auto global_lock = global_critical_region_.Acquire();
+  std::vector<Function*> fns;
+  map_.ForEach([&](uint32_t entry_address, Entry* entry) {
+    if (entry->status == Entry::STATUS_READY) {
+      fns.push_back(entry->function);
+    }
+  });
+  return fns;
+}
+
+std::vector<Function*> EntryTable::Invalidate(uint32_t low_address,
+                                              uint32_t high_address) {
+  auto global_lock = global_critical_region_.Acquire();
+  std::vector<Function*> fns;
+  map_.ForEach([&](uint32_t entry_address, Entry* entry) {
+    if (entry->status == Entry::STATUS_READY &&
+        entry->address < high_address && entry->end_address >= low_address) {
+      entry->status = Entry::STATUS_NEW;
+      fns.push_back(entry->function);
+    }
+  });
   return fns;
 }
 
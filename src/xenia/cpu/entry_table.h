@@ -10,9 +10,10 @@
 #ifndef XENIA_CPU_ENTRY_TABLE_H_
 #define XENIA_CPU_ENTRY_TABLE_H_
 
-#include <unordered_map>
+#include <atomic>
 #include <vector>
 
+#include "xenia/base/concurrent_hash_map.h"
 #include "xenia/base/mutex.h"
 
 namespace xe {
@@ -30,7 +31,9 @@ typedef struct Entry_t {
 
   uint32_t address;
   uint32_t end_address;
-  Status status;
+  // Set last once the entry is ready, so lock-free readers that see
+  // STATUS_READY also see the function.
+  std::atomic<Status> status;
   Function* function;
 } Entry;
 
@@ -40,14 +43,25 @@ class EntryTable {
   ~EntryTable();
 
   Entry* Get(uint32_t address);
-  Entry::Status GetOrCreate(uint32_t address, Entry** out_entry);
+  // If out_waited is provided it is set to true when the call had to wait on
+  // another thread finishing the entry.
+  Entry::Status GetOrCreate(uint32_t address, Entry** out_entry,
+                            bool* out_waited = nullptr);
 
   std::vector<Function*> FindWithAddress(uint32_t address);
+  // All functions with ready entries.
+  std::vector<Function*> FindReady();
+  // Resets all ready entries overlapping [low_address, high_address) so that
+  // the next GetOrCreate of them returns STATUS_NEW, and returns their
+  // functions.
+  std::vector<Function*> Invalidate(uint32_t low_address,
+                                    uint32_t high_address);
 
  private:
+  // Held to add entries and to change their status. Lookups of ready entries
+  // don't take it.
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Entry*> map_;
+  ConcurrentHashMap<Entry> map_;
 };
 
 }  // namespace cpu
@@ -9,8 +9,13 @@
 
 #include "xenia/cpu/export_resolver.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/cpu/cpu_flags.h"
 
 namespace xe {
 namespace cpu {
@@ -38,7 +43,30 @@ ExportResolver::Table::Table(const char* module_name,
       [](Export* a, Export* b) { return std::strcmp(a->name, b->name) <= 0; });
 }
 
-ExportResolver::ExportResolver() = default;
+void ExportProfile::Record(uint64_t ticks, uint32_t thread_id) {
+  call_count.fetch_add(1, std::memory_order_relaxed);
+  total_ticks.fetch_add(ticks, std::memory_order_relaxed);
+  uint64_t max = max_ticks.load(std::memory_order_relaxed);
+  while (ticks > max && !max_ticks.compare_exchange_weak(
+                            max, ticks, std::memory_order_relaxed)) {
+  }
+  last_thread_id.store(thread_id, std::memory_order_relaxed);
+}
+
+void ExportProfile::Reset() {
+  call_count = 0;
+  total_ticks = 0;
+  max_ticks = 0;
+  last_thread_id = 0;
+}
+
+std::atomic<bool> ExportResolver::profiling_enabled_ = {false};
+
+ExportResolver::ExportResolver() {
+  if (FLAGS_profile_kernel_calls) {
+    set_profiling_enabled(true);
+  }
+}
 
 ExportResolver::~ExportResolver() = default;
 
@@ -63,7 +91,7 @@ Export* ExportResolver::GetExportByOrdinal(const char* module_name,
   for (const auto& table : tables_) {
     if (std::strncmp(module_name, table.module_name(),
                      std::strlen(table.module_name())) == 0) {
-      if (ordinal > table.exports_by_ordinal().size()) {
+      if (ordinal >= table.exports_by_ordinal().size()) {
         return nullptr;
       }
       return table.exports_by_ordinal().at(ordinal);
@@ -72,6 +100,46 @@ Export* ExportResolver::GetExportByOrdinal(const char* module_name,
   return nullptr;
 }
 
+std::vector<Export*> ExportResolver::GetProfiledExports() const {
+  std::vector<Export*> exports;
+  for (auto export_entry : all_exports_by_name_) {
+    if (export_entry->type == Export::Type::kFunction &&
+        export_entry->profile.call_count) {
+      exports.push_back(export_entry);
+    }
+  }
+  std::sort(exports.begin(), exports.end(), [](Export* a, Export* b) {
+    return a->profile.total_ticks > b->profile.total_ticks;
+  });
+  return exports;
+}
+
+void ExportResolver::ResetProfile() {
+  for (auto export_entry : all_exports_by_name_) {
+    export_entry->profile.Reset();
+  }
+}
+
+void ExportResolver::DumpProfile() const {
+  auto exports = GetProfiledExports();
+  if (exports.empty()) {
+    return;
+  }
+  double us_per_tick = 1000000.0 / double(Clock::host_tick_frequency());
+  XELOGI("Kernel call profile (%zu exports):", exports.size());
+  XELOGI("%-48s %10s %12s %10s %10s %8s", "Export", "Calls", "Total us",
+         "Avg us", "Max us", "Thread");
+  for (auto export_entry : exports) {
+    const auto& profile = export_entry->profile;
+    auto call_count = static_cast<unsigned long long>(profile.call_count);
+    double total_us = double(profile.total_ticks) * us_per_tick;
+    XELOGI("%-48s %10llu %12.0f %10.2f %10.2f %8.8X", export_entry->name,
+           call_count, total_us, total_us / double(call_count),
+           double(profile.max_ticks) * us_per_tick,
+           uint32_t(profile.last_thread_id));
+  }
+}
+
 void ExportResolver::SetVariableMapping(const char* module_name,
                                         uint16_t ordinal, uint32_t value) {
   auto export_entry = GetExportByOrdinal(module_name, ordinal);
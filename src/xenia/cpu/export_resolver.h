@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_EXPORT_RESOLVER_H_
 #define XENIA_CPU_EXPORT_RESOLVER_H_
 
+#include <atomic>
 #include <string>
 #include <vector>
 
@@ -69,6 +70,19 @@ typedef void (*xe_kernel_export_shim_fn)(void*, void*);
 
 typedef void (*ExportTrampoline)(ppc::PPCContext* ppc_context);
 
+// Calls to an export recorded while kernel call profiling is enabled.
+struct ExportProfile {
+  std::atomic<uint64_t> call_count = {0};
+  // Host ticks (Clock::host_tick_frequency) spent in the export.
+  std::atomic<uint64_t> total_ticks = {0};
+  std::atomic<uint64_t> max_ticks = {0};
+  // Guest thread ID of the most recent caller.
+  std::atomic<uint32_t> last_thread_id = {0};
+
+  void Record(uint64_t ticks, uint32_t thread_id);
+  void Reset();
+};
+
 class Export {
  public:
   enum class Type {
@@ -110,6 +124,8 @@ class Export {
       uint64_t call_count;
     } function_data;
   };
+
+  ExportProfile profile;
 };
 
 class ExportResolver {
@@ -144,6 +160,20 @@ class ExportResolver {
 
   Export* GetExportByOrdinal(const char* module_name, uint16_t ordinal);
 
+  // Whether export trampolines record their calls into Export::profile.
+  // Checked on every kernel call, so it's a single global flag.
+  static bool is_profiling_enabled() {
+    return profiling_enabled_.load(std::memory_order_relaxed);
+  }
+  static void set_profiling_enabled(bool enabled) {
+    profiling_enabled_.store(enabled, std::memory_order_relaxed);
+  }
+  // Exports called while profiling, most total host time first.
+  std::vector<Export*> GetProfiledExports() const;
+  void ResetProfile();
+  // Logs the profile of every export called while profiling.
+  void DumpProfile() const;
+
   void SetVariableMapping(const char* module_name, uint16_t ordinal,
                           uint32_t value);
   void SetFunctionMapping(const char* module_name, uint16_t ordinal,
@@ -152,6 +182,8 @@ class ExportResolver {
                           ExportTrampoline trampoline);
 
  private:
+  static std::atomic<bool> profiling_enabled_;
+
   std::vector<Table> tables_;
   std::vector<Export*> all_exports_by_name_;
 };
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/function.h"
 
+#include <cstring>
+
 #include "xenia/base/logging.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
@@ -56,69 +58,70 @@ bool BuiltinFunction::Call(ThreadState* thread_state, uint32_t return_address) {
 GuestFunction::GuestFunction(Module* module, uint32_t address)
     : Function(module, address) {
   behavior_ = Behavior::kDefault;
+  ClearMachineCodeMapCache();
 }
 
 GuestFunction::~GuestFunction() = default;
 
-void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
-  behavior_ = Behavior::kExtern;
-  extern_handler_ = handler;
-  export_data_ = export_data;
-}
-
-const SourceMapEntry* GuestFunction::LookupGuestAddress(
-    uint32_t guest_address) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.guest_address == guest_address) {
-      return &entry;
-    }
-  }
-  return nullptr;
-}
-
-const SourceMapEntry* GuestFunction::LookupHIROffset(uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (size_t i = 0; i < source_map_.size(); ++i) {
-    const auto& entry = source_map_[i];
-    if (entry.hir_offset >= offset) {
-      return &entry;
+uint32_t* GuestFunction::ResetBlockProfile() {
+  uint32_t count = (end_address_ - address_) / 4 + 1;
+  if (!block_profile_ || block_profile_count_ < count) {
+    // Older code may still be running against the previous profile, so it is
+    // kept alive as long as the function is.
+    if (block_profile_) {
+      retired_block_profiles_.push_back(std::move(block_profile_));
     }
+    block_profile_.reset(new uint32_t[count]());
+    block_profile_count_ = count;
+  } else {
+    std::memset(block_profile_.get(), 0, sizeof(uint32_t) * count);
   }
-  return nullptr;
+  return block_profile_.get();
 }
 
-const SourceMapEntry* GuestFunction::LookupMachineCodeOffset(
-    uint32_t offset) const {
-  // TODO(benvanik): binary search? We know the list is sorted by code order.
-  for (int64_t i = source_map_.size() - 1; i >= 0; --i) {
-    const auto& entry = source_map_[i];
-    if (entry.code_offset <= offset) {
-      return &entry;
-    }
-  }
-  return source_map_.empty() ? nullptr : &source_map_[0];
+void GuestFunction::SetupExtern(ExternHandler handler, Export* export_data) {
+  behavior_ = Behavior::kExtern;
+  extern_handler_ = handler;
+  export_data_ = export_data;
 }
 
 uint32_t GuestFunction::MapGuestAddressToMachineCodeOffset(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
-  return entry ? entry->code_offset : 0;
+  SourceMapEntry entry;
+  return source_map_.LookupGuestAddress(guest_address, &entry)
+             ? entry.code_offset
+             : 0;
 }
 
 uintptr_t GuestFunction::MapGuestAddressToMachineCode(
     uint32_t guest_address) const {
-  auto entry = LookupGuestAddress(guest_address);
   return reinterpret_cast<uintptr_t>(machine_code()) +
-         (entry ? entry->code_offset : 0);
+         MapGuestAddressToMachineCodeOffset(guest_address);
 }
 
 uint32_t GuestFunction::MapMachineCodeToGuestAddress(
     uintptr_t host_address) const {
-  auto entry = LookupMachineCodeOffset(static_cast<uint32_t>(
-      host_address - reinterpret_cast<uintptr_t>(machine_code())));
-  return entry ? entry->guest_address : address();
+  uint32_t offset = static_cast<uint32_t>(
+      host_address - reinterpret_cast<uintptr_t>(machine_code()));
+  auto& cache_entry =
+      machine_code_map_cache_[offset % kMachineCodeMapCacheSize];
+  uint64_t cached = cache_entry.load(std::memory_order_relaxed);
+  if (cached >> 32 == uint64_t(offset) + 1) {
+    return uint32_t(cached);
+  }
+  SourceMapEntry entry;
+  uint32_t guest_address = source_map_.LookupMachineCodeOffset(offset, &entry)
+                               ? entry.guest_address
+                               : address();
+  cache_entry.store((uint64_t(offset) + 1) << 32 | guest_address,
+                    std::memory_order_relaxed);
+  return guest_address;
+}
+
+void GuestFunction::ClearMachineCodeMapCache() {
+  for (auto& cache_entry : machine_code_map_cache_) {
+    cache_entry.store(0, std::memory_order_relaxed);
+  }
 }
 
 bool GuestFunction::Call(ThreadState* thread_state, uint32_t return_address) {
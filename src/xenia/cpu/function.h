@@ -10,28 +10,27 @@
 #ifndef XENIA_CPU_FUNCTION_H_
 #define XENIA_CPU_FUNCTION_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
 #include "xenia/cpu/function_debug_info.h"
 #include "xenia/cpu/function_trace_data.h"
 #include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/source_map.h"
 #include "xenia/cpu/symbol.h"
 #include "xenia/cpu/thread_state.h"
 
 namespace xe {
 namespace cpu {
 class Export;
+namespace ppc {
+struct PPCDecodedCode;
+}  // namespace ppc
 }  // namespace cpu
 
 namespace cpu {
 
-struct SourceMapEntry {
-  uint32_t guest_address;  // PPC guest address (0x82....).
-  uint32_t hir_offset;     // Block ordinal (16b) | Instr ordinal (16b)
-  uint32_t code_offset;    // Offset from emitted code start.
-};
-
 class Function : public Symbol {
  public:
   enum class Behavior {
@@ -100,6 +99,15 @@ class GuestFunction : public Function {
   typedef void (*ExternHandler)(ppc::PPCContext* ppc_context,
                                 kernel::KernelState* kernel_state);
 
+  // Optimization level of the current machine code.
+  enum class Tier {
+    // Compiled with a minimal pass pipeline. Counts its calls so that it can
+    // be recompiled once hot.
+    kBaseline,
+    // Compiled with the full pass pipeline.
+    kOptimized,
+  };
+
   GuestFunction(Module* module, uint32_t address);
   ~GuestFunction() override;
 
@@ -108,26 +116,67 @@ class GuestFunction : public Function {
   uint32_t end_address() const { return end_address_; }
   void set_end_address(uint32_t value) { end_address_ = value; }
 
+  // Set by the scanner when it cut the function short (see
+  // --max_guest_function_instructions). The rest is compiled as its own
+  // region starting after end_address(), which this function tail calls when
+  // execution falls off its end.
+  bool is_split() const { return is_split_; }
+  void set_split(bool value) { is_split_ = value; }
+  // Set on regions that continue a split function. They don't start like
+  // functions do, so the scanner's entry heuristics don't apply.
+  bool is_split_region() const { return is_split_region_; }
+  void set_split_region(bool value) { is_split_region_ = value; }
+
   virtual uint8_t* machine_code() const = 0;
   virtual size_t machine_code_length() const = 0;
 
+  Tier tier() const { return tier_; }
+  void set_tier(Tier tier) { tier_ = tier; }
+  // Decremented by baseline code on every call. Recompilation is requested
+  // when it reaches zero.
+  int32_t* tier_up_countdown() { return &tier_up_countdown_; }
+  void set_tier_up_countdown(int32_t value) { tier_up_countdown_ = value; }
+  // Returns true only for the first caller, so that a function is only
+  // queued for recompilation once.
+  bool BeginTierUp() { return !tier_up_requested_.exchange(true); }
+
+  // Per guest instruction block execution counts, recorded by baseline code
+  // with --profile_guided_layout. Entries are 1 + the number of executions
+  // for instructions that start a block and 0 for all others.
+  uint32_t* block_profile() const { return block_profile_.get(); }
+  uint32_t block_profile_count() const { return block_profile_count_; }
+  // Allocates (or clears) the block profile for the current extents.
+  uint32_t* ResetBlockProfile();
+
   FunctionDebugInfo* debug_info() const { return debug_info_.get(); }
   void set_debug_info(std::unique_ptr<FunctionDebugInfo> debug_info) {
     debug_info_ = std::move(debug_info);
   }
   FunctionTraceData& trace_data() { return trace_data_; }
-  std::vector<SourceMapEntry>& source_map() { return source_map_; }
+  // Instructions decoded by the last scan, reused by retranslations until
+  // the guest code is invalidated. Shared, as translations of the function
+  // (tier-up, disassembly, ...) can overlap.
+  std::shared_ptr<const ppc::PPCDecodedCode> decoded_code() const {
+    return std::atomic_load(&decoded_code_);
+  }
+  void set_decoded_code(std::shared_ptr<const ppc::PPCDecodedCode> code) {
+    std::atomic_store(&decoded_code_, std::move(code));
+  }
+  const SourceMap& source_map() const { return source_map_; }
+  void set_source_map(const std::vector<SourceMapEntry>& entries) {
+    source_map_.Assign(entries);
+    ClearMachineCodeMapCache();
+  }
 
   ExternHandler extern_handler() const { return extern_handler_; }
   Export* export_data() const { return export_data_; }
   void SetupExtern(ExternHandler handler, Export* export_data = nullptr);
 
-  const SourceMapEntry* LookupGuestAddress(uint32_t guest_address) const;
-  const SourceMapEntry* LookupHIROffset(uint32_t offset) const;
-  const SourceMapEntry* LookupMachineCodeOffset(uint32_t offset) const;
 
   uint32_t MapGuestAddressToMachineCodeOffset(uint32_t guest_address) const;
   uintptr_t MapGuestAddressToMachineCode(uint32_t guest_address) const;
+  // Recently mapped addresses are cached, as stack walks for the profiler and
+  // exceptions keep landing on the same return addresses.
   uint32_t MapMachineCodeToGuestAddress(uintptr_t host_address) const;
 
   bool Call(ThreadState* thread_state, uint32_t return_address) override;
@@ -135,12 +184,28 @@ class GuestFunction : public Function {
  protected:
   virtual bool CallImpl(ThreadState* thread_state, uint32_t return_address) = 0;
 
+  void ClearMachineCodeMapCache();
+
  protected:
   std::unique_ptr<FunctionDebugInfo> debug_info_;
   FunctionTraceData trace_data_;
-  std::vector<SourceMapEntry> source_map_;
+  std::shared_ptr<const ppc::PPCDecodedCode> decoded_code_;
+  SourceMap source_map_;
   ExternHandler extern_handler_ = nullptr;
   Export* export_data_ = nullptr;
+  Tier tier_ = Tier::kBaseline;
+  bool is_split_ = false;
+  bool is_split_region_ = false;
+  int32_t tier_up_countdown_ = 0;
+  std::atomic<bool> tier_up_requested_ = {false};
+  std::unique_ptr<uint32_t[]> block_profile_;
+  std::vector<std::unique_ptr<uint32_t[]>> retired_block_profiles_;
+  uint32_t block_profile_count_ = 0;
+  // Indexed by machine code offset, each entry holding
+  // (offset + 1) << 32 | guest address.
+  static const size_t kMachineCodeMapCacheSize = 16;
+  mutable std::atomic<uint64_t>
+      machine_code_map_cache_[kMachineCodeMapCacheSize];
 };
 
 }  // namespace cpu
@@ -0,0 +1,157 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/function_capture.h"
+
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/thread_state.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace cpu {
+
+bool FunctionCapture::Parse(const uint8_t* data, size_t size) {
+  if (size < sizeof(FunctionCaptureHeader)) {
+    return false;
+  }
+  header = reinterpret_cast<const FunctionCaptureHeader*>(data);
+  if (header->magic != FunctionCaptureHeader::kMagic ||
+      header->version != FunctionCaptureHeader::kVersion) {
+    return false;
+  }
+  size_t offset = sizeof(FunctionCaptureHeader);
+  size_t regions_size =
+      size_t(header->region_count) * sizeof(FunctionCaptureRegion);
+  if (offset + regions_size > size) {
+    return false;
+  }
+  regions = reinterpret_cast<const FunctionCaptureRegion*>(data + offset);
+  offset += regions_size;
+  runs.clear();
+  runs.reserve(header->run_count);
+  for (uint32_t i = 0; i < header->run_count; ++i) {
+    if (offset + sizeof(FunctionCaptureRun) > size) {
+      return false;
+    }
+    auto run = reinterpret_cast<const FunctionCaptureRun*>(data + offset);
+    offset += sizeof(FunctionCaptureRun);
+    if (offset + run->size > size) {
+      return false;
+    }
+    runs.emplace_back(run, data + offset);
+    offset += run->size;
+  }
+  return true;
+}
+
+static bool IsZeroPage(const uint8_t* data) {
+  auto words = reinterpret_cast<const uint64_t*>(data);
+  for (size_t i = 0; i < FunctionCaptureRun::kPageSize / 8; ++i) {
+    if (words[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool WriteFunctionCapture(const std::wstring& path, Memory* memory,
+                          ThreadState* thread_state, uint32_t guest_address,
+                          uint64_t hit_count) {
+  // Each view of physical memory has its own heap, covering separate
+  // physical pages. 0x7F000000 is MMIO.
+  static const uint32_t kHeapBases[] = {
+      0x00000000, 0x40000000, 0x80000000, 0x90000000,
+      0xA0000000, 0xC0000000, 0xE0000000,
+  };
+  std::vector<FunctionCaptureRegion> regions;
+  std::vector<FunctionCaptureRun> runs;
+  for (uint32_t heap_base : kHeapBases) {
+    auto heap = memory->LookupHeap(heap_base);
+    if (!heap) {
+      continue;
+    }
+    uint32_t address = heap->heap_base();
+    while (address - heap->heap_base() < heap->heap_size()) {
+      HeapAllocationInfo info;
+      if (!heap->QueryRegionInfo(address, &info) || !info.region_size) {
+        break;
+      }
+      if (info.state & kMemoryAllocationCommit) {
+        regions.push_back(
+            {address, info.region_size, heap->page_size(), info.protect});
+        // Pages that can't be read are allocated again but left empty.
+        if (info.protect & kMemoryProtectRead) {
+          auto data = memory->TranslateVirtual(address);
+          for (uint32_t offset = 0; offset < info.region_size;
+               offset += FunctionCaptureRun::kPageSize) {
+            if (IsZeroPage(data + offset)) {
+              continue;
+            }
+            if (!runs.empty() &&
+                runs.back().address + runs.back().size == address + offset) {
+              runs.back().size += FunctionCaptureRun::kPageSize;
+            } else {
+              runs.push_back(
+                  {address + offset, FunctionCaptureRun::kPageSize});
+            }
+          }
+        }
+      }
+      address += info.region_size;
+    }
+  }
+
+  FILE* file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGE("Unable to open function capture file %S", path.c_str());
+    return false;
+  }
+  FunctionCaptureHeader header;
+  std::memset(&header, 0, sizeof(header));
+  header.magic = FunctionCaptureHeader::kMagic;
+  header.version = FunctionCaptureHeader::kVersion;
+  header.guest_address = guest_address;
+  header.thread_id = thread_state->thread_id();
+  header.hit_count = hit_count;
+  header.region_count = uint32_t(regions.size());
+  header.run_count = uint32_t(runs.size());
+  std::memcpy(header.context,
+              reinterpret_cast<const uint8_t*>(thread_state->context()) +
+                  FunctionCaptureHeader::kContextOffset,
+              FunctionCaptureHeader::kContextSize);
+  bool written = std::fwrite(&header, sizeof(header), 1, file) == 1;
+  if (!regions.empty()) {
+    written &= std::fwrite(regions.data(), sizeof(FunctionCaptureRegion),
+                           regions.size(), file) == regions.size();
+  }
+  uint64_t data_size = 0;
+  for (auto& run : runs) {
+    written &= std::fwrite(&run, sizeof(run), 1, file) == 1;
+    written &= std::fwrite(memory->TranslateVirtual(run.address), run.size, 1,
+                           file) == 1;
+    data_size += run.size;
+  }
+  std::fclose(file);
+  if (!written) {
+    XELOGE("Unable to write function capture file %S", path.c_str());
+    return false;
+  }
+  XELOGI("Captured call %" PRIu64 " of %.8X: %zu regions, %" PRIu64
+         " bytes of data",
+         hit_count, guest_address, regions.size(), data_size);
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
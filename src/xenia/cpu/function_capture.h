@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_FUNCTION_CAPTURE_H_
+#define XENIA_CPU_FUNCTION_CAPTURE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+class Memory;
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+
+class ThreadState;
+
+// A guest function call snapshotted on entry (--capture_function), replayed
+// in isolation by xenia-cpu-replay. The file starts with this header,
+// followed by region_count FunctionCaptureRegions and run_count
+// FunctionCaptureRuns, each followed by its data.
+struct FunctionCaptureHeader {
+  static const uint32_t kMagic = 0x50434658;  // 'XFCP'
+  static const uint32_t kVersion = 1;
+  // The guest registers, lr through irql.
+  static const size_t kContextOffset = offsetof(ppc::PPCContext, lr);
+  static const size_t kContextSize =
+      offsetof(ppc::PPCContext, thread_id) - kContextOffset;
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t guest_address;
+  uint32_t thread_id;
+  // The call that was captured, counting from 1.
+  uint64_t hit_count;
+  uint32_t region_count;
+  uint32_t run_count;
+  uint8_t context[kContextSize];
+};
+
+// Committed guest memory, allocated again by the replay. Only the runs have
+// data, everything else in the regions is zero.
+struct FunctionCaptureRegion {
+  uint32_t address;
+  uint32_t size;
+  uint32_t page_size;
+  // kMemoryProtect* flags.
+  uint32_t protect;
+};
+
+// Non-zero kPageSize pages of a region, size bytes of data follow.
+struct FunctionCaptureRun {
+  static const uint32_t kPageSize = 4096;
+
+  uint32_t address;
+  uint32_t size;
+};
+
+// A capture file mapped into memory.
+struct FunctionCapture {
+  const FunctionCaptureHeader* header = nullptr;
+  const FunctionCaptureRegion* regions = nullptr;
+  std::vector<std::pair<const FunctionCaptureRun*, const uint8_t*>> runs;
+
+  // Checks the data and points into it, returning false if it isn't a
+  // complete capture.
+  bool Parse(const uint8_t* data, size_t size);
+};
+
+// Writes the context of the thread about to run guest_address and all the
+// committed guest memory. Other threads keep running while the memory is
+// copied, so data they're writing at the same time may be torn.
+bool WriteFunctionCapture(const std::wstring& path, Memory* memory,
+                          ThreadState* thread_state, uint32_t guest_address,
+                          uint64_t hit_count);
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_FUNCTION_CAPTURE_H_
@@ -23,11 +23,17 @@ FunctionDebugInfo::FunctionDebugInfo()
       hir_disasm_(nullptr),
       machine_code_disasm_(nullptr) {}
 
-FunctionDebugInfo::~FunctionDebugInfo() {
+FunctionDebugInfo::~FunctionDebugInfo() { ClearDisasm(); }
+
+void FunctionDebugInfo::ClearDisasm() {
   free(source_disasm_);
+  source_disasm_ = nullptr;
   free(raw_hir_disasm_);
+  raw_hir_disasm_ = nullptr;
   free(hir_disasm_);
+  hir_disasm_ = nullptr;
   free(machine_code_disasm_);
+  machine_code_disasm_ = nullptr;
 }
 
 void FunctionDebugInfo::Dump() {
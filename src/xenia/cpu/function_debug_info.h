@@ -28,16 +28,22 @@ enum DebugInfoFlags : uint32_t {
   kDebugInfoTraceFunctionCoverage = (1 << 7) | kDebugInfoTraceFunctions,
   kDebugInfoTraceFunctionReferences = (1 << 8) | kDebugInfoTraceFunctions,
   kDebugInfoTraceFunctionData = (1 << 9) | kDebugInfoTraceFunctions,
+  // Entries and returns written to the FunctionTraceRing of the thread.
+  kDebugInfoTraceFunctionRecords = (1 << 10),
 
   kDebugInfoAllTracing =
       kDebugInfoTraceFunctions | kDebugInfoTraceFunctionCoverage |
-      kDebugInfoTraceFunctionReferences | kDebugInfoTraceFunctionData,
+      kDebugInfoTraceFunctionReferences | kDebugInfoTraceFunctionData |
+      kDebugInfoTraceFunctionRecords,
   kDebugInfoAll = 0xFFFFFFFF,
 };
 
 // DEPRECATED
 // This will be getting removed or refactored to contain only on-demand
 // disassembly data.
+// Disassembly is only kept by functions translated with the kDebugInfoDisasm
+// flags set on the processor. Otherwise Processor::DisassembleFunction
+// regenerates it into a new instance when a tool asks for it.
 class FunctionDebugInfo {
  public:
   FunctionDebugInfo();
@@ -64,6 +70,8 @@ class FunctionDebugInfo {
   void set_machine_code_disasm(char* value) { machine_code_disasm_ = value; }
 
   void Dump();
+  // Frees the disassembly strings, keeping the counts.
+  void ClearDisasm();
 
  private:
   uint32_t address_reference_count_;
@@ -0,0 +1,257 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/function_capture.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/raw_module.h"
+#include "xenia/cpu/thread_state.h"
+#include "xenia/memory.h"
+
+DEFINE_int32(replay_iterations, 1000,
+             "Number of times to run the captured call.");
+DEFINE_string(replay_output, "",
+              "Path to write the JSON report to. Written to stdout if empty.");
+
+namespace xe {
+namespace cpu {
+
+// Allocates the captured regions and fills them in.
+static bool RestoreMemory(const FunctionCapture& capture, Memory* memory) {
+  for (uint32_t i = 0; i < capture.header->region_count; ++i) {
+    auto& region = capture.regions[i];
+    auto heap = memory->LookupHeap(region.address);
+    // Memory::Initialize allocates some of the same ranges itself.
+    HeapAllocationInfo info;
+    bool restored = false;
+    if (heap && heap->QueryRegionInfo(region.address, &info)) {
+      restored =
+          info.state & kMemoryAllocationCommit
+              ? heap->Protect(region.address, region.size,
+                              kMemoryProtectRead | kMemoryProtectWrite)
+              : heap->AllocFixed(
+                    region.address, region.size, region.page_size,
+                    kMemoryAllocationReserve | kMemoryAllocationCommit,
+                    kMemoryProtectRead | kMemoryProtectWrite);
+    }
+    if (!restored) {
+      XELOGE("Unable to allocate %.8X-%.8X", region.address,
+             region.address + region.size - 1);
+      return false;
+    }
+  }
+  for (auto& run : capture.runs) {
+    std::memcpy(memory->TranslateVirtual(run.first->address), run.second,
+                run.first->size);
+  }
+  for (uint32_t i = 0; i < capture.header->region_count; ++i) {
+    auto& region = capture.regions[i];
+    if (region.protect != (kMemoryProtectRead | kMemoryProtectWrite)) {
+      memory->LookupHeap(region.address)
+          ->Protect(region.address, region.size, region.protect);
+    }
+  }
+  return true;
+}
+
+// A page the call wrote to, and what to put back before the next one.
+struct DirtyPage {
+  uint32_t address;
+  // Null for a page that was all zero.
+  const uint8_t* data;
+};
+
+// Compares the writable pages against the capture.
+static std::vector<DirtyPage> FindDirtyPages(const FunctionCapture& capture,
+                                             Memory* memory) {
+  static const uint32_t kPageSize = FunctionCaptureRun::kPageSize;
+  static const uint8_t kZeroPage[kPageSize] = {0};
+  std::vector<DirtyPage> pages;
+  auto run_it = capture.runs.begin();
+  for (uint32_t i = 0; i < capture.header->region_count; ++i) {
+    auto& region = capture.regions[i];
+    if (!(region.protect & kMemoryProtectWrite)) {
+      continue;
+    }
+    for (uint32_t address = region.address;
+         address - region.address < region.size; address += kPageSize) {
+      // Runs are in address order.
+      while (run_it != capture.runs.end() &&
+             run_it->first->address + run_it->first->size <= address) {
+        ++run_it;
+      }
+      const uint8_t* data = nullptr;
+      if (run_it != capture.runs.end() && run_it->first->address <= address) {
+        data = run_it->second + (address - run_it->first->address);
+      }
+      if (std::memcmp(memory->TranslateVirtual(address),
+                      data ? data : kZeroPage, kPageSize)) {
+        pages.push_back({address, data});
+      }
+    }
+  }
+  return pages;
+}
+
+int function_replay_main(const std::vector<std::wstring>& args) {
+  if (args.size() < 2) {
+    XELOGE("Usage: %S [capture_path]", args[0].c_str());
+    return 1;
+  }
+  std::wstring path = xe::to_absolute_path(args[1]);
+  auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  FunctionCapture capture;
+  if (!mmap || !capture.Parse(mmap->data(), mmap->size())) {
+    XELOGE("%S is not a function capture", path.c_str());
+    return 1;
+  }
+  uint32_t guest_address = capture.header->guest_address;
+
+  auto memory = std::make_unique<Memory>();
+  if (!memory->Initialize()) {
+    XELOGE("Unable to initialize memory");
+    return 1;
+  }
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  if (!processor->Setup(std::make_unique<backend::x64::X64Backend>())) {
+    XELOGE("Unable to set up the processor");
+    return 1;
+  }
+  if (!RestoreMemory(capture, memory.get())) {
+    return 1;
+  }
+
+  // The captured memory has the code of the title, but none of its module
+  // information: functions are found by scanning, and without a kernel,
+  // imports only log that they're unimplemented.
+  auto module = std::make_unique<RawModule>(processor.get());
+  module->set_name("capture");
+  module->set_executable(true);
+  module->SetAddressRange(0x80000000, 0x20000000);
+  processor->AddModule(std::move(module));
+  auto function = processor->ResolveFunction(guest_address);
+  if (!function || !function->is_guest()) {
+    XELOGE("Unable to resolve %.8X", guest_address);
+    return 1;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+
+  auto thread_state =
+      std::make_unique<ThreadState>(processor.get(), capture.header->thread_id);
+  auto context = thread_state->context();
+  std::vector<DirtyPage> dirty_pages;
+  std::vector<uint64_t> call_ticks;
+  int iterations = std::max(FLAGS_replay_iterations, 1);
+  call_ticks.reserve(iterations);
+  uint64_t result = 0;
+  bool deterministic = true;
+  for (int i = 0; i < iterations; ++i) {
+    for (auto& page : dirty_pages) {
+      auto dest = memory->TranslateVirtual(page.address);
+      if (page.data) {
+        std::memcpy(dest, page.data, FunctionCaptureRun::kPageSize);
+      } else {
+        std::memset(dest, 0, FunctionCaptureRun::kPageSize);
+      }
+    }
+    std::memcpy(reinterpret_cast<uint8_t*>(context) +
+                    FunctionCaptureHeader::kContextOffset,
+                capture.header->context, FunctionCaptureHeader::kContextSize);
+    context->host_rounding_mode = -1;
+
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    guest_function->Call(thread_state.get(), uint32_t(context->lr));
+    call_ticks.push_back(Clock::QueryHostTickCount() - start_ticks);
+
+    if (i == 0) {
+      // The first call includes translating everything it reaches.
+      dirty_pages = FindDirtyPages(capture, memory.get());
+      result = context->r[3];
+    } else if (context->r[3] != result) {
+      deterministic = false;
+    }
+  }
+  if (!deterministic) {
+    XELOGW("r3 differs between calls; the function depends on more than "
+           "its context and memory");
+  }
+
+  // Skip the first call, unless it's the only one.
+  uint64_t first_ticks = call_ticks.front();
+  if (call_ticks.size() > 1) {
+    call_ticks.erase(call_ticks.begin());
+  }
+  std::sort(call_ticks.begin(), call_ticks.end());
+  uint64_t total_ticks = 0;
+  for (uint64_t ticks : call_ticks) {
+    total_ticks += ticks;
+  }
+  auto to_us = [](double ticks) {
+    return ticks * 1000000.0 / double(Clock::host_tick_frequency());
+  };
+
+  FILE* file = stdout;
+  if (!FLAGS_replay_output.empty()) {
+    file = xe::filesystem::OpenFile(xe::to_wstring(FLAGS_replay_output), "w");
+    if (!file) {
+      XELOGE("Unable to open %s", FLAGS_replay_output.c_str());
+      return 1;
+    }
+  }
+  std::fprintf(file, "{\n");
+  std::fprintf(file, "  \"function\": \"%.8X\",\n", guest_address);
+  std::fprintf(file, "  \"captured_hit\": %" PRIu64 ",\n",
+               capture.header->hit_count);
+  std::fprintf(file, "  \"iterations\": %d,\n", iterations);
+  std::fprintf(file, "  \"first_call_us\": %.3f,\n",
+               to_us(double(first_ticks)));
+  std::fprintf(file, "  \"min_us\": %.3f,\n",
+               to_us(double(call_ticks.front())));
+  std::fprintf(file, "  \"median_us\": %.3f,\n",
+               to_us(double(call_ticks[call_ticks.size() / 2])));
+  std::fprintf(file, "  \"mean_us\": %.3f,\n",
+               to_us(double(total_ticks) / double(call_ticks.size())));
+  std::fprintf(file, "  \"max_us\": %.3f,\n", to_us(double(call_ticks.back())));
+  std::fprintf(file, "  \"tier\": \"%s\",\n",
+               guest_function->tier() == GuestFunction::Tier::kOptimized
+                   ? "optimized"
+                   : "baseline");
+  std::fprintf(file, "  \"code_size\": %zu,\n",
+               guest_function->machine_code_length());
+  std::fprintf(file, "  \"dirty_page_count\": %zu,\n", dirty_pages.size());
+  std::fprintf(file, "  \"result_r3\": \"%.16" PRIX64 "\",\n", result);
+  std::fprintf(file, "  \"deterministic\": %s\n",
+               deterministic ? "true" : "false");
+  std::fprintf(file, "}\n");
+  if (file != stdout) {
+    std::fclose(file);
+  }
+  return 0;
+}
+
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-replay", L"xenia-cpu-replay [capture_path]",
+                   xe::cpu::function_replay_main);
@@ -32,6 +32,7 @@ class FunctionTraceData {
     // +24   8b  function_call_count
     // +32   4b+ function_caller_history[4]
     // +48   8b+ instruction_execute_count[instruction count]
+    // +..  16b+ inline_cache_count[instruction count]  // {hits, misses}
     uint32_t data_size;
     uint32_t start_address;
     uint32_t end_address;
@@ -75,6 +76,12 @@ class FunctionTraceData {
     return reinterpret_cast<uint8_t*>(header_) + sizeof(Header);
   }
 
+  // Hit and miss counts of the inline cache at each indirect branch, indexed
+  // by instruction. Only present along with instruction execute counts.
+  uint8_t* inline_cache_counts() const {
+    return instruction_execute_counts() + instruction_count() * 8;
+  }
+
   static size_t SizeOfHeader() { return sizeof(Header); }
 
   static size_t SizeOfInstructionCounts(uint32_t start_address,
@@ -83,6 +90,12 @@ class FunctionTraceData {
     return instruction_count * 8;
   }
 
+  static size_t SizeOfInlineCacheCounts(uint32_t start_address,
+                                        uint32_t end_address) {
+    uint32_t instruction_count = (end_address - start_address) / 4 + 1;
+    return instruction_count * 16;
+  }
+
  private:
   Header* header_;
 };
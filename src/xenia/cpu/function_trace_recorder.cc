@@ -0,0 +1,163 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/function_trace_recorder.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/platform.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif  // XE_COMPILER_MSVC
+
+namespace xe {
+namespace cpu {
+
+// Often enough for the rings not to fill up on all but the hottest threads.
+static const std::chrono::milliseconds kFlushInterval(5);
+
+std::unique_ptr<FunctionTraceRecorder> FunctionTraceRecorder::Create(
+    const std::wstring& path, bool record_gprs) {
+  std::unique_ptr<FunctionTraceRecorder> recorder(new FunctionTraceRecorder());
+  recorder->file_ = xe::filesystem::OpenFile(path, "wb");
+  if (!recorder->file_) {
+    XELOGE("Unable to open function trace file %S", path.c_str());
+    return nullptr;
+  }
+  recorder->scratch_records_.resize(FunctionTraceRing::kRecordCount);
+
+  FunctionTraceFileHeader header = {};
+  header.magic = FunctionTraceFileHeader::kMagic;
+  header.version = FunctionTraceFileHeader::kVersion;
+  header.flags = record_gprs ? FunctionTraceFileHeader::kFlagGprs : 0;
+  header.start_timestamp = __rdtsc();
+  header.start_host_ticks = Clock::QueryHostTickCount();
+  header.host_tick_frequency = Clock::host_tick_frequency();
+  std::fwrite(&header, sizeof(header), 1, recorder->file_);
+
+  xe::threading::Thread::CreationParameters params;
+  params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+  auto recorder_ptr = recorder.get();
+  recorder->thread_ = xe::threading::Thread::Create(
+      params, [recorder_ptr]() { recorder_ptr->FlusherMain(); });
+  if (!recorder->thread_) {
+    XELOGE("Unable to create function trace flusher thread");
+    return nullptr;
+  }
+  recorder->thread_->set_name("Function Trace Flusher");
+  XELOGI("Recording function traces to %S", path.c_str());
+  return recorder;
+}
+
+FunctionTraceRecorder::~FunctionTraceRecorder() { Shutdown(); }
+
+FunctionTraceRing* FunctionTraceRecorder::CreateRing(uint32_t thread_id) {
+  // Value initialized, so all zeros.
+  auto ring = new FunctionTraceRing();
+  ring->thread_id = thread_id;
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  rings_.push_back(ring);
+  return ring;
+}
+
+void FunctionTraceRecorder::ReleaseRing(FunctionTraceRing* ring) {
+  {
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    Drain(ring);
+    auto it = std::find(rings_.begin(), rings_.end(), ring);
+    assert_true(it != rings_.end());
+    rings_.erase(it);
+  }
+  delete ring;
+}
+
+void FunctionTraceRecorder::Shutdown() {
+  if (thread_) {
+    shutting_down_ = true;
+    xe::threading::Wait(thread_.get(), false);
+    thread_.reset();
+  }
+  if (!file_) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(rings_mutex_);
+  for (auto ring : rings_) {
+    Drain(ring);
+  }
+  FunctionTraceChunkHeader chunk = {};
+  chunk.type = FunctionTraceChunkHeader::kEnd;
+  chunk.end_timestamp = __rdtsc();
+  chunk.end_host_ticks = Clock::QueryHostTickCount();
+  std::fwrite(&chunk, sizeof(chunk), 1, file_);
+  std::fclose(file_);
+  file_ = nullptr;
+  XELOGI("Recorded %lld function trace records, dropped %lld",
+         static_cast<long long>(record_count_),
+         static_cast<long long>(dropped_count_));
+}
+
+void FunctionTraceRecorder::FlusherMain() {
+  while (!shutting_down_) {
+    xe::threading::Sleep(kFlushInterval);
+    std::lock_guard<std::mutex> lock(rings_mutex_);
+    for (auto ring : rings_) {
+      Drain(ring);
+    }
+    std::fflush(file_);
+  }
+}
+
+void FunctionTraceRecorder::Drain(FunctionTraceRing* ring) {
+  if (!file_) {
+    // Shut down already.
+    return;
+  }
+  uint64_t write_index = ring->write_index.load(std::memory_order_acquire);
+  uint64_t read_index = ring->read_index.load(std::memory_order_relaxed);
+  uint64_t dropped_count = ring->dropped_count.load(std::memory_order_relaxed);
+  uint32_t count = uint32_t(write_index - read_index);
+  if (!count && dropped_count == ring->drained_dropped_count) {
+    return;
+  }
+  assert_true(count <= FunctionTraceRing::kRecordCount);
+
+  // Copy out first so the ring frees up before the file write.
+  uint32_t first = uint32_t(read_index % FunctionTraceRing::kRecordCount);
+  uint32_t first_count =
+      std::min(count, FunctionTraceRing::kRecordCount - first);
+  std::memcpy(scratch_records_.data(), ring->records + first,
+              first_count * sizeof(FunctionTraceRecord));
+  std::memcpy(scratch_records_.data() + first_count, ring->records,
+              (count - first_count) * sizeof(FunctionTraceRecord));
+  ring->read_index.store(write_index, std::memory_order_release);
+
+  FunctionTraceChunkHeader chunk = {};
+  chunk.type = FunctionTraceChunkHeader::kRecords;
+  chunk.thread_id = ring->thread_id;
+  chunk.record_count = count;
+  chunk.dropped_count = dropped_count - ring->drained_dropped_count;
+  ring->drained_dropped_count = dropped_count;
+  std::fwrite(&chunk, sizeof(chunk), 1, file_);
+  std::fwrite(scratch_records_.data(), sizeof(FunctionTraceRecord), count,
+              file_);
+  record_count_ += count;
+  dropped_count_ += chunk.dropped_count;
+}
+
+}  // namespace cpu
+}  // namespace xe
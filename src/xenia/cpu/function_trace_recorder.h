@@ -0,0 +1,142 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_FUNCTION_TRACE_RECORDER_H_
+#define XENIA_CPU_FUNCTION_TRACE_RECORDER_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+// A guest function entry or exit, written by the generated code without
+// leaving it.
+struct FunctionTraceRecord {
+  enum Type : uint32_t {
+    kEnter = 1,
+    kReturn = 2,
+  };
+  uint32_t guest_address;
+  uint32_t type;
+  // TSC.
+  uint64_t timestamp;
+  // r3 and r4 (the first arguments on entry, the result on return) if the
+  // trace has FunctionTraceFileHeader::kFlagGprs set, garbage otherwise.
+  uint64_t gprs[2];
+};
+static_assert(sizeof(FunctionTraceRecord) == 32,
+              "generated code indexes records with a shift");
+
+// Records of one thread, written by the thread alone and drained by the
+// recorder thread alone. Once full, records are dropped and counted rather
+// than stalling the guest. The generated code updates it with plain stores,
+// which x64 keeps in order, so a record is visible before the index is.
+struct FunctionTraceRing {
+  static const uint32_t kRecordCount = 16384;
+
+  // Records written so far. Only advanced past a record once it is complete.
+  std::atomic<uint64_t> write_index;
+  // Records drained so far.
+  std::atomic<uint64_t> read_index;
+  // Records the ring had no room for so far.
+  std::atomic<uint64_t> dropped_count;
+  // dropped_count as of the last drain. Only touched by the recorder.
+  uint64_t drained_dropped_count;
+  uint32_t thread_id;
+  FunctionTraceRecord records[kRecordCount];
+};
+
+// The file starts with this header, followed by the chunks.
+struct FunctionTraceFileHeader {
+  static const uint32_t kMagic = 0x52544658;  // 'XFTR'
+  static const uint32_t kVersion = 1;
+  static const uint32_t kFlagGprs = 1 << 0;
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t flags;
+  uint32_t reserved;
+  // A TSC value and the Clock::QueryHostTickCount at the same time, so
+  // that timestamps can be converted with the pair in the end chunk.
+  uint64_t start_timestamp;
+  uint64_t start_host_ticks;
+  uint64_t host_tick_frequency;
+};
+
+struct FunctionTraceChunkHeader {
+  enum Type : uint32_t {
+    // record_count FunctionTraceRecords of thread_id follow.
+    kRecords = 1,
+    // Last in the file. record_count is 0, end_timestamp and
+    // end_host_ticks are valid.
+    kEnd = 2,
+  };
+  uint32_t type;
+  uint32_t thread_id;
+  uint32_t record_count;
+  uint32_t reserved;
+  // Records the thread dropped right before these ones.
+  uint64_t dropped_count;
+  uint64_t end_timestamp;
+  uint64_t end_host_ticks;
+};
+
+// Binary function tracing (--trace_function_records_path). Every traced
+// thread gets a FunctionTraceRing, and a background thread periodically
+// appends their new records to the file. Decode the file with
+// xenia-cpu-trace-dump.
+class FunctionTraceRecorder {
+ public:
+  ~FunctionTraceRecorder();
+
+  static std::unique_ptr<FunctionTraceRecorder> Create(
+      const std::wstring& path, bool record_gprs);
+
+  uint64_t record_count() const { return record_count_; }
+  uint64_t dropped_count() const { return dropped_count_; }
+
+  // Called by the thread about to run guest code.
+  FunctionTraceRing* CreateRing(uint32_t thread_id);
+  // Drains what's left of the ring of the exiting thread and frees it.
+  void ReleaseRing(FunctionTraceRing* ring);
+
+  // Drains all rings and closes the file with the end chunk.
+  void Shutdown();
+
+ private:
+  FunctionTraceRecorder() = default;
+
+  void FlusherMain();
+  // rings_mutex_ must be held.
+  void Drain(FunctionTraceRing* ring);
+
+  FILE* file_ = nullptr;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::atomic<bool> shutting_down_ = {false};
+
+  std::mutex rings_mutex_;
+  std::vector<FunctionTraceRing*> rings_;
+  // Staging for one ring's records, in case they wrap.
+  std::vector<FunctionTraceRecord> scratch_records_;
+  uint64_t record_count_ = 0;
+  uint64_t dropped_count_ = 0;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_FUNCTION_TRACE_RECORDER_H_
@@ -0,0 +1,177 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/guest_profiler.h"
+
+#include <cstdio>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/cpu/backend/code_cache.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+size_t GuestProfiler::StackHash::operator()(const Stack& stack) const {
+  // FNV-1a over the function addresses.
+  uint64_t hash = 0xCBF29CE484222325ull;
+  for (uint32_t address : stack) {
+    hash ^= address;
+    hash *= 0x100000001B3ull;
+  }
+  return size_t(hash);
+}
+
+GuestProfiler::GuestProfiler(Processor* processor) : processor_(processor) {
+  scratch_stack_.reserve(kMaxFrameCount + 1);
+}
+
+GuestProfiler::~GuestProfiler() { Shutdown(); }
+
+void GuestProfiler::Start(std::chrono::microseconds interval) {
+  assert_false(is_running());
+  interval_ = interval;
+  shutting_down_ = false;
+  xe::threading::Thread::CreationParameters params;
+  // Samples must land on time to be representative, and the sampler spends
+  // nearly all of its time asleep.
+  params.initial_priority = xe::threading::ThreadPriority::kHighest;
+  thread_ = xe::threading::Thread::Create(params, [this]() { SamplerMain(); });
+  if (!thread_) {
+    XELOGE("Unable to create guest profiler thread");
+    return;
+  }
+  thread_->set_name("Guest Profiler");
+  XELOGI("Guest profiler sampling every %lldus",
+         static_cast<long long>(interval.count()));
+}
+
+void GuestProfiler::Shutdown() {
+  if (!thread_) {
+    return;
+  }
+  shutting_down_ = true;
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+}
+
+void GuestProfiler::Reset() {
+  std::lock_guard<std::mutex> lock(stacks_mutex_);
+  stacks_.clear();
+  sample_count_ = 0;
+}
+
+void GuestProfiler::SamplerMain() {
+  while (!shutting_down_) {
+    xe::threading::Sleep(interval_);
+    if (shutting_down_) {
+      break;
+    }
+    Sample();
+  }
+}
+
+void GuestProfiler::Sample() {
+  auto code_cache = processor_->backend()->code_cache();
+  uint64_t frame_host_pcs[kMaxFrameCount];
+  for (auto thread_info : processor_->QueryThreadDebugInfos()) {
+    size_t frame_count = 0;
+    if (!processor_->CaptureGuestThreadStack(thread_info->thread_id,
+                                             frame_host_pcs, kMaxFrameCount,
+                                             &frame_count)) {
+      continue;
+    }
+
+    // Frames are leaf first. Only resolve the ones in the code cache: host
+    // symbol lookups are far too slow to do per sample and aren't what we're
+    // after anyway.
+    scratch_stack_.clear();
+    bool in_host = false;
+    for (size_t i = frame_count; i-- > 0;) {
+      auto function = code_cache->LookupFunction(frame_host_pcs[i]);
+      if (!function) {
+        in_host = true;
+        continue;
+      }
+      in_host = false;
+      // Recursion and thunks can put the same function in adjacent frames.
+      uint32_t address = function->address();
+      if (scratch_stack_.empty() || scratch_stack_.back() != address) {
+        scratch_stack_.push_back(address);
+      }
+    }
+    if (scratch_stack_.empty()) {
+      // Not running guest code at all (yet).
+      continue;
+    }
+    if (in_host) {
+      scratch_stack_.push_back(0);
+    }
+
+    std::lock_guard<std::mutex> lock(stacks_mutex_);
+    auto it = stacks_.find(scratch_stack_);
+    if (it != stacks_.end()) {
+      ++it->second;
+    } else {
+      stacks_.emplace(scratch_stack_, 1);
+    }
+    ++sample_count_;
+  }
+}
+
+bool GuestProfiler::WriteFoldedStacks(const std::wstring& path) {
+  FILE* file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Unable to open guest profile output %S", path.c_str());
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(stacks_mutex_);
+  std::unordered_map<uint32_t, std::string> names;
+  for (auto& it : stacks_) {
+    auto& stack = it.first;
+    for (size_t i = 0; i < stack.size(); ++i) {
+      uint32_t address = stack[i];
+      if (i) {
+        std::fputc(';', file);
+      }
+      if (!address) {
+        std::fputs("[host]", file);
+        continue;
+      }
+      auto name_it = names.find(address);
+      if (name_it == names.end()) {
+        auto function = processor_->QueryFunction(address);
+        std::string name;
+        if (function && !function->name().empty()) {
+          name = function->name();
+        } else {
+          char buffer[16];
+          std::snprintf(buffer, sizeof(buffer), "sub_%.8X", address);
+          name = buffer;
+        }
+        name_it = names.emplace(address, std::move(name)).first;
+      }
+      std::fputs(name_it->second.c_str(), file);
+    }
+    std::fprintf(file, " %llu\n", static_cast<unsigned long long>(it.second));
+  }
+
+  std::fclose(file);
+  XELOGI("Wrote %llu guest profile samples (%d distinct stacks)",
+         static_cast<unsigned long long>(sample_count_.load()),
+         int(stacks_.size()));
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
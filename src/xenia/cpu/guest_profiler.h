@@ -0,0 +1,88 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_GUEST_PROFILER_H_
+#define XENIA_CPU_GUEST_PROFILER_H_
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class Processor;
+
+// Statistical profiler for guest code.
+// A background thread periodically suspends each guest thread, walks its host
+// stack and maps the frames inside the code cache back to the guest functions
+// they were generated from. Identical stacks are aggregated, so the cost per
+// sample is a suspend/resume, a stack walk and a hash lookup - nothing is
+// instrumented and generated code is unaffected.
+class GuestProfiler {
+ public:
+  // Deepest stack captured. Deeper stacks are truncated at the root end.
+  static const size_t kMaxFrameCount = 64;
+
+  explicit GuestProfiler(Processor* processor);
+  ~GuestProfiler();
+
+  bool is_running() const { return !!thread_; }
+
+  // Starts sampling every guest thread at the given interval.
+  void Start(std::chrono::microseconds interval);
+  // Stops sampling. Collected samples are kept.
+  void Shutdown();
+
+  // Total number of stacks sampled so far.
+  uint64_t sample_count() const { return sample_count_; }
+
+  // Discards all collected samples.
+  void Reset();
+
+  // Writes the collected samples as folded stacks, one line per distinct
+  // stack: "root;...;leaf count". This is what flamegraph.pl and most other
+  // flame graph tools consume.
+  bool WriteFoldedStacks(const std::wstring& path);
+
+ private:
+  // Guest function addresses of a stack, root first. A trailing 0 marks
+  // samples taken while the thread was running host code (kernel calls,
+  // waits, etc).
+  typedef std::vector<uint32_t> Stack;
+  struct StackHash {
+    size_t operator()(const Stack& stack) const;
+  };
+
+  void SamplerMain();
+  void Sample();
+
+  Processor* processor_ = nullptr;
+  std::chrono::microseconds interval_;
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::atomic<bool> shutting_down_ = {false};
+
+  std::mutex stacks_mutex_;
+  std::unordered_map<Stack, uint64_t, StackHash> stacks_;
+  std::atomic<uint64_t> sample_count_ = {0};
+
+  // Only touched by the sampler thread.
+  Stack scratch_stack_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_GUEST_PROFILER_H_
@@ -9,6 +9,7 @@
 
 #include "xenia/cpu/hir/hir_builder.h"
 
+#include <algorithm>
 #include <cinttypes>
 #include <cstdarg>
 #include <cstring>
@@ -62,6 +63,7 @@ void HIRBuilder::Reset() {
   next_label_id_ = 0;
   next_value_ordinal_ = 0;
   locals_.clear();
+  constant_data_pages_.clear();
   block_head_ = block_tail_ = NULL;
   current_block_ = NULL;
 #if SCRIBBLE_ARENA_ON_RESET
@@ -428,6 +430,13 @@ void HIRBuilder::InsertLabel(Label* label, Instr* prev_instr) {
   }
 }
 
+void HIRBuilder::AddConstantDataPage(uint32_t page) {
+  if (std::find(constant_data_pages_.begin(), constant_data_pages_.end(),
+                page) == constant_data_pages_.end()) {
+    constant_data_pages_.push_back(page);
+  }
+}
+
 void HIRBuilder::ResetLabelTags() {
   // TODO(benvanik): make this faster?
   auto block = block_head_;
@@ -960,6 +969,7 @@ Value* HIRBuilder::Assign(Value* value) {
   Instr* i = AppendInstr(OPCODE_ASSIGN_info, 0, AllocValue(value->type));
   i->set_src1(value);
   i->src2.value = i->src3.value = NULL;
+  i->dest->flags |= value->flags & VALUE_IS_ZERO_EXTENDED_32;
   return i->dest;
 }
 
@@ -990,6 +1000,9 @@ Value* HIRBuilder::ZeroExtend(Value* value, TypeName target_type) {
   Instr* i = AppendInstr(OPCODE_ZERO_EXTEND_info, 0, AllocValue(target_type));
   i->set_src1(value);
   i->src2.value = i->src3.value = NULL;
+  if (target_type == INT64_TYPE) {
+    i->dest->flags |= VALUE_IS_ZERO_EXTENDED_32;
+  }
   return i->dest;
 }
 
@@ -1537,6 +1550,17 @@ Value* HIRBuilder::AddWithCarry(Value* value1, Value* value2, Value* value3,
   return i->dest;
 }
 
+Value* HIRBuilder::DidCarry(Value* value1, Value* value2, Value* value3) {
+  ASSERT_TYPES_EQUAL(value1, value2);
+  assert_true(value3->type == INT8_TYPE);
+
+  Instr* i = AppendInstr(OPCODE_DID_CARRY_info, 0, AllocValue(INT8_TYPE));
+  i->set_src1(value1);
+  i->set_src2(value2);
+  i->set_src3(value3);
+  return i->dest;
+}
+
 Value* HIRBuilder::VectorAdd(Value* value1, Value* value2, TypeName part_type,
                              uint32_t arithmetic_flags) {
   ASSERT_VECTOR_TYPE(value1);
@@ -1761,6 +1785,9 @@ Value* HIRBuilder::And(Value* value1, Value* value2) {
   i->set_src1(value1);
   i->set_src2(value2);
   i->src3.value = NULL;
+  if (value1->IsZeroExtended32() || value2->IsZeroExtended32()) {
+    i->dest->flags |= VALUE_IS_ZERO_EXTENDED_32;
+  }
   return i->dest;
 }
 
@@ -1781,6 +1808,9 @@ Value* HIRBuilder::Or(Value* value1, Value* value2) {
   i->set_src1(value1);
   i->set_src2(value2);
   i->src3.value = NULL;
+  if (value1->IsZeroExtended32() && value2->IsZeroExtended32()) {
+    i->dest->flags |= VALUE_IS_ZERO_EXTENDED_32;
+  }
   return i->dest;
 }
 
@@ -47,6 +47,13 @@ class HIRBuilder {
 
   std::vector<Value*>& locals() { return locals_; }
 
+  // Guest pages that loads were folded from because they were read-only at
+  // compile time. The generated code must be dropped if they become writable.
+  const std::vector<uint32_t>& constant_data_pages() const {
+    return constant_data_pages_;
+  }
+  void AddConstantDataPage(uint32_t page);
+
   uint32_t max_value_ordinal() const { return next_value_ordinal_; }
 
   Block* first_block() const { return block_head_; }
@@ -191,6 +198,9 @@ class HIRBuilder {
   Value* Add(Value* value1, Value* value2, uint32_t arithmetic_flags = 0);
   Value* AddWithCarry(Value* value1, Value* value2, Value* value3,
                       uint32_t arithmetic_flags = 0);
+  // Carry out (as an INT8 0/1) of value1 + value2 + value3, where value3 is
+  // an INT8 carry in.
+  Value* DidCarry(Value* value1, Value* value2, Value* value3);
   Value* VectorAdd(Value* value1, Value* value2, TypeName part_type,
                    uint32_t arithmetic_flags = 0);
   Value* Sub(Value* value1, Value* value2, uint32_t arithmetic_flags = 0);
@@ -254,11 +264,11 @@ class HIRBuilder {
  protected:
   void DumpValue(StringBuffer* str, Value* value);
   void DumpOp(StringBuffer* str, OpcodeSignatureType sig_type, Instr::Op* op);
+  bool IsUnconditionalJump(Instr* instr);
 
  private:
   Block* AppendBlock();
   void EndBlock();
-  bool IsUnconditionalJump(Instr* instr);
   Instr* AppendInstr(const OpcodeInfo& opcode, uint16_t flags, Value* dest = 0);
   Value* CompareXX(const OpcodeInfo& opcode, Value* value1, Value* value2);
   Value* VectorCompareXX(const OpcodeInfo& opcode, Value* value1, Value* value2,
@@ -273,6 +283,7 @@ class HIRBuilder {
   uint32_t next_value_ordinal_;
 
   std::vector<Value*> locals_;
+  std::vector<uint32_t> constant_data_pages_;
 
   Block* block_head_;
   Block* block_tail_;
@@ -185,6 +185,7 @@ enum Opcode {
   OPCODE_VECTOR_COMPARE_UGE,
   OPCODE_ADD,
   OPCODE_ADD_CARRY,
+  OPCODE_DID_CARRY,
   OPCODE_VECTOR_ADD,
   OPCODE_SUB,
   OPCODE_VECTOR_SUB,
@@ -416,6 +416,12 @@ DEFINE_OPCODE(
     OPCODE_SIG_V_V_V_V,
     0)
 
+DEFINE_OPCODE(
+    OPCODE_DID_CARRY,
+    "did_carry",
+    OPCODE_SIG_V_V_V_V,
+    0)
+
 DEFINE_OPCODE(
     OPCODE_VECTOR_ADD,
     "vector_add",
@@ -61,6 +61,9 @@ inline size_t GetTypeSize(TypeName type_name) {
 enum ValueFlags {
   VALUE_IS_CONSTANT = (1 << 1),
   VALUE_IS_ALLOCATED = (1 << 2),  // Used by backends. Do not set.
+  // The upper 32 bits of the INT64 value are known to be zero, set by the
+  // builder for zero extensions from INT32 and masks with them clear.
+  VALUE_IS_ZERO_EXTENDED_32 = (1 << 3),
 };
 
 struct RegAssignment {
@@ -177,6 +180,17 @@ class Value {
   }
 
   inline bool IsConstant() const { return !!(flags & VALUE_IS_CONSTANT); }
+  // Whether the value is an INT64 that fits in 32 bits, such as a guest
+  // address that needs no truncation before use.
+  bool IsZeroExtended32() const {
+    if (type != INT64_TYPE) {
+      return false;
+    }
+    if (IsConstant()) {
+      return constant.u64 <= 0xFFFFFFFFull;
+    }
+    return !!(flags & VALUE_IS_ZERO_EXTENDED_32);
+  }
   bool IsConstantTrue() const {
     if (type == VEC128_TYPE) {
       assert_always();
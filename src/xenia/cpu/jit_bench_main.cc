@@ -0,0 +1,195 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/backend/x64/x64_backend.h"
+#include "xenia/cpu/compiler/compiler.h"
+#include "xenia/cpu/compiler/compiler_pass.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/ppc/ppc_translator.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/cpu/xex_module.h"
+#include "xenia/memory.h"
+
+DEFINE_string(jit_bench_output, "",
+              "Path to write the JSON report to. Written to stdout if empty.");
+
+namespace xe {
+namespace cpu {
+
+// Declares every function listed in the module's .pdata. Each entry is the
+// function start followed by a word packing the prolog length (8 bits) and
+// the function length in instructions (22 bits).
+static size_t DeclarePdataFunctions(Processor* processor, XexModule* module) {
+  auto pdata = module->GetPESection(".pdata");
+  if (!pdata) {
+    XELOGW("Module has no .pdata; only known functions will be compiled");
+    return 0;
+  }
+  size_t count = 0;
+  auto entries = processor->memory()->TranslateVirtual(pdata->address);
+  for (uint32_t offset = 0; offset + 8 <= pdata->size; offset += 8) {
+    uint32_t start = xe::load_and_swap<uint32_t>(entries + offset);
+    uint32_t data = xe::load_and_swap<uint32_t>(entries + offset + 4);
+    uint32_t length = ((data >> 8) & 0x3FFFFF) * 4;
+    if (!start || !length) {
+      continue;
+    }
+    if (processor->LookupFunction(start)) {
+      ++count;
+    }
+  }
+  return count;
+}
+
+int jit_bench_main(const std::vector<std::wstring>& args) {
+  if (args.size() < 2) {
+    XELOGE("Usage: %S [xex_path]", args[0].c_str());
+    return 1;
+  }
+  std::wstring path = xe::to_absolute_path(args[1]);
+
+  // Every function is compiled once at the optimized tier, which is what we
+  // want to track, and nothing is ever run.
+  FLAGS_tiered_compilation = false;
+  FLAGS_persistent_code_cache_path = "";
+
+  auto memory = std::make_unique<Memory>();
+  if (!memory->Initialize()) {
+    XELOGE("Unable to initialize memory");
+    return 1;
+  }
+  auto processor = std::make_unique<Processor>(memory.get(), nullptr);
+  if (!processor->Setup(std::make_unique<backend::x64::X64Backend>())) {
+    XELOGE("Unable to set up the processor");
+    return 1;
+  }
+
+  auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!mmap) {
+    XELOGE("Unable to open %S", path.c_str());
+    return 1;
+  }
+  std::string name = xe::to_string(xe::find_name_from_path(path));
+  // Imports aren't resolved without a kernel, which only matters to code
+  // that runs.
+  auto module = std::make_unique<XexModule>(processor.get(), nullptr);
+  auto xex_module = module.get();
+  if (!xex_module->Load(name, xe::to_string(path), mmap->data(),
+                        mmap->size()) ||
+      !processor->AddModule(std::move(module)) ||
+      !xex_module->LoadContinue()) {
+    XELOGE("Unable to load %S", path.c_str());
+    return 1;
+  }
+  mmap.reset();
+
+  DeclarePdataFunctions(processor.get(), xex_module);
+  std::vector<GuestFunction*> functions;
+  xex_module->ForEachFunction([&](Function* function) {
+    if (function->is_guest() &&
+        function->status() == Symbol::Status::kDeclared) {
+      functions.push_back(static_cast<GuestFunction*>(function));
+    }
+  });
+
+  ppc::PPCTranslator translator(processor->frontend());
+  ppc::PPCTranslator::Stats stats;
+  translator.set_stats(&stats);
+  translator.compiler()->set_record_pass_ticks(true);
+  auto compiler = translator.compiler();
+  std::vector<uint64_t> pass_ticks(compiler->pass_count(), 0);
+
+  size_t compiled_count = 0;
+  size_t failed_count = 0;
+  uint64_t code_size = 0;
+  uint64_t hir_instr_count_in = 0;
+  uint64_t hir_instr_count_out = 0;
+  uint64_t spill_count = 0;
+  uint64_t reload_count = 0;
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  for (auto function : functions) {
+    if (!translator.Translate(function, 0)) {
+      ++failed_count;
+      continue;
+    }
+    ++compiled_count;
+    code_size += function->machine_code_length();
+    hir_instr_count_in += stats.hir_instr_count_in;
+    hir_instr_count_out += stats.hir_instr_count_out;
+    spill_count += stats.spill_count;
+    reload_count += stats.reload_count;
+    auto& ticks = compiler->pass_ticks();
+    for (size_t i = 0; i < ticks.size(); ++i) {
+      pass_ticks[i] += ticks[i];
+    }
+  }
+  uint64_t total_ticks = Clock::QueryHostTickCount() - start_ticks;
+
+  FILE* file = stdout;
+  if (!FLAGS_jit_bench_output.empty()) {
+    file = xe::filesystem::OpenFile(xe::to_wstring(FLAGS_jit_bench_output),
+                                    "w");
+    if (!file) {
+      XELOGE("Unable to open %s", FLAGS_jit_bench_output.c_str());
+      return 1;
+    }
+  }
+  auto to_ms = [](uint64_t ticks) {
+    return double(ticks) * 1000.0 / double(Clock::host_tick_frequency());
+  };
+  std::fprintf(file, "{\n");
+  std::fprintf(file, "  \"module\": \"%s\",\n", name.c_str());
+  std::fprintf(file, "  \"function_count\": %zu,\n", compiled_count);
+  std::fprintf(file, "  \"failed_function_count\": %zu,\n", failed_count);
+  std::fprintf(file, "  \"total_ms\": %.3f,\n", to_ms(total_ticks));
+  std::fprintf(file, "  \"code_size\": %llu,\n",
+               static_cast<unsigned long long>(code_size));
+  std::fprintf(file, "  \"hir_instr_count_in\": %llu,\n",
+               static_cast<unsigned long long>(hir_instr_count_in));
+  std::fprintf(file, "  \"hir_instr_count_out\": %llu,\n",
+               static_cast<unsigned long long>(hir_instr_count_out));
+  std::fprintf(file, "  \"spill_count\": %llu,\n",
+               static_cast<unsigned long long>(spill_count));
+  std::fprintf(file, "  \"reload_count\": %llu,\n",
+               static_cast<unsigned long long>(reload_count));
+  std::fprintf(file, "  \"passes\": [\n");
+  for (size_t i = 0; i < pass_ticks.size(); ++i) {
+    std::fprintf(file, "    {\"name\": \"%s\", \"ms\": %.3f}%s\n",
+                 compiler->pass(i)->name(), to_ms(pass_ticks[i]),
+                 i + 1 < pass_ticks.size() ? "," : "");
+  }
+  std::fprintf(file, "  ]\n");
+  std::fprintf(file, "}\n");
+  if (file != stdout) {
+    std::fclose(file);
+  }
+
+  translator.set_stats(nullptr);
+  return failed_count ? 1 : 0;
+}
+
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-jit-bench", L"xenia-cpu-jit-bench [xex_path]",
+                   xe::cpu::jit_bench_main);
@@ -9,6 +9,8 @@
 
 #include "xenia/cpu/mmio_handler.h"
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/exception_handler.h"
@@ -33,8 +35,11 @@ std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
   auto handler = std::unique_ptr<MMIOHandler>(
       new MMIOHandler(virtual_membase, physical_membase, membase_end));
 
-  // Install the exception handler directed at the MMIOHandler.
-  ExceptionHandler::Install(ExceptionCallbackThunk, handler.get());
+  // Install the exception handler directed at the MMIOHandler, for faults
+  // within the guest mappings only.
+  ExceptionHandler::InstallForRange(ExceptionCallbackThunk, handler.get(),
+                                    uint64_t(virtual_membase),
+                                    uint64_t(membase_end) + 1);
 
   global_handler_ = handler.get();
   return handler;
@@ -42,6 +47,9 @@ std::unique_ptr<MMIOHandler> MMIOHandler::Install(uint8_t* virtual_membase,
 
 MMIOHandler::~MMIOHandler() {
   ExceptionHandler::Uninstall(ExceptionCallbackThunk, this);
+  XELOGI("MMIO faults: %llu register accesses, %llu access watch faults",
+         static_cast<unsigned long long>(mmio_fault_count_.load()),
+         static_cast<unsigned long long>(access_watch_fault_count_.load()));
 
   assert_true(global_handler_ == this);
   global_handler_ = nullptr;
@@ -110,37 +118,9 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   auto lock = global_critical_region_.Acquire();
 
   // Fire any access watches that overlap this region.
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    // Case 1: 2222222|222|11111111
-    // Case 2: 1111111|222|22222222
-    // Case 3: 1111111|222|11111111 (fragmentation)
-    // Case 4: 2222222|222|22222222 (complete overlap)
-    bool hit = false;
-    auto entry = *it;
-
-    if (base_address <= (*it)->address &&
-        base_address + length > (*it)->address) {
-      hit = true;
-    } else if ((*it)->address <= base_address &&
-               (*it)->address + (*it)->length > base_address) {
-      hit = true;
-    } else if ((*it)->address <= base_address &&
-               (*it)->address + (*it)->length > base_address + length) {
-      hit = true;
-    } else if ((*it)->address >= base_address &&
-               (*it)->address + (*it)->length < base_address + length) {
-      hit = true;
-    }
-
-    if (hit) {
-      FireAccessWatch(*it);
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-
-    ++it;
-  }
+  std::vector<AccessWatchEntry*> overlapping_entries;
+  FindAccessWatches(false, base_address, length, &overlapping_entries);
+  FireAccessWatches(overlapping_entries);
 
   // Add to table. The slot reservation may evict a previous watch, which
   // could include our target, so we do it first.
@@ -148,33 +128,54 @@ uintptr_t MMIOHandler::AddPhysicalAccessWatch(uint32_t guest_address,
   entry->address = base_address;
   entry->length = uint32_t(length);
   entry->type = type;
+  entry->is_virtual = false;
   entry->callback = callback;
   entry->callback_context = callback_context;
   entry->callback_data = callback_data;
-  access_watches_.push_back(entry);
+  AddToAccessWatchIndex(entry);
 
-  auto page_access = memory::PageAccess::kNoAccess;
-  switch (type) {
-    case kWatchWrite:
-      page_access = memory::PageAccess::kReadOnly;
-      break;
-    case kWatchReadWrite:
-      page_access = memory::PageAccess::kNoAccess;
-      break;
-    default:
-      assert_unhandled_case(type);
-      break;
-  }
+  ProtectAccessWatch(entry, type != kWatchReadWrite
+                                ? memory::PageAccess::kReadOnly
+                                : memory::PageAccess::kNoAccess);
 
-  // Protect the range under all address spaces
-  memory::Protect(physical_membase_ + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xC0000000 + entry->address, entry->length,
-                  page_access, nullptr);
-  memory::Protect(virtual_membase_ + 0xE0000000 + entry->address, entry->length,
-                  page_access, nullptr);
+  return reinterpret_cast<uintptr_t>(entry);
+}
+
+uintptr_t MMIOHandler::AddVirtualAccessWatch(uint32_t virtual_address,
+                                             size_t length, WatchType type,
+                                             AccessWatchCallback callback,
+                                             void* callback_context,
+                                             void* callback_data) {
+  // The physical views are handled by AddPhysicalAccessWatch.
+  assert_true(virtual_address < 0xA0000000);
+  assert_true(type != kWatchInvalid);
+
+  uint32_t base_address = virtual_address;
+  length = xe::round_up(length + (base_address % xe::memory::page_size()),
+                        xe::memory::page_size());
+  base_address = base_address - (base_address % xe::memory::page_size());
+
+  auto lock = global_critical_region_.Acquire();
+
+  // Fire any virtual watches sharing these pages, as clearing either one would
+  // unprotect the other.
+  std::vector<AccessWatchEntry*> overlapping_entries;
+  FindAccessWatches(true, base_address, length, &overlapping_entries);
+  FireAccessWatches(overlapping_entries);
+
+  auto entry = new AccessWatchEntry();
+  entry->address = base_address;
+  entry->length = uint32_t(length);
+  entry->type = type;
+  entry->is_virtual = true;
+  entry->callback = callback;
+  entry->callback_context = callback_context;
+  entry->callback_data = callback_data;
+  AddToAccessWatchIndex(entry);
+
+  ProtectAccessWatch(entry, type != kWatchReadWrite
+                                ? memory::PageAccess::kReadOnly
+                                : memory::PageAccess::kNoAccess);
 
   return reinterpret_cast<uintptr_t>(entry);
 }
@@ -185,15 +186,100 @@ void MMIOHandler::FireAccessWatch(AccessWatchEntry* entry) {
                   entry->address);
 }
 
-void MMIOHandler::ClearAccessWatch(AccessWatchEntry* entry) {
-  memory::Protect(physical_membase_ + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
+void MMIOHandler::ProtectAccessWatch(AccessWatchEntry* entry,
+                                     memory::PageAccess access) {
+  if (entry->is_virtual) {
+    memory::Protect(virtual_membase_ + entry->address, entry->length, access,
+                    nullptr);
+    return;
+  }
+
+  // Protect the range under all address spaces
+  memory::Protect(physical_membase_ + entry->address, entry->length, access,
+                  nullptr);
   memory::Protect(virtual_membase_ + 0xA0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
+                  access, nullptr);
   memory::Protect(virtual_membase_ + 0xC0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
+                  access, nullptr);
   memory::Protect(virtual_membase_ + 0xE0000000 + entry->address, entry->length,
-                  xe::memory::PageAccess::kReadWrite, nullptr);
+                  access, nullptr);
+}
+
+void MMIOHandler::ClearAccessWatch(AccessWatchEntry* entry) {
+  ProtectAccessWatch(entry, xe::memory::PageAccess::kReadWrite);
+}
+
+void MMIOHandler::AddToAccessWatchIndex(AccessWatchEntry* entry) {
+  auto& index = GetAccessWatchIndex(entry->is_virtual);
+  size_t page_size = xe::memory::page_size();
+  size_t first_page = entry->address / page_size;
+  size_t end_page =
+      std::min((size_t(entry->address) + entry->length) / page_size,
+               index.watched_pages.size());
+  if (first_page >= end_page) {
+    return;
+  }
+  for (size_t page = first_page; page < end_page; ++page) {
+    index.page_watches[uint32_t(page)].push_back(entry);
+  }
+  index.watched_pages.Set(first_page, end_page - first_page);
+}
+
+void MMIOHandler::RemoveFromAccessWatchIndex(AccessWatchEntry* entry) {
+  auto& index = GetAccessWatchIndex(entry->is_virtual);
+  size_t page_size = xe::memory::page_size();
+  size_t first_page = entry->address / page_size;
+  size_t end_page =
+      std::min((size_t(entry->address) + entry->length) / page_size,
+               index.watched_pages.size());
+  for (size_t page = first_page; page < end_page; ++page) {
+    auto it = index.page_watches.find(uint32_t(page));
+    if (it == index.page_watches.end()) {
+      continue;
+    }
+    auto& watches = it->second;
+    watches.erase(std::remove(watches.begin(), watches.end(), entry),
+                  watches.end());
+    if (watches.empty()) {
+      index.page_watches.erase(it);
+      index.watched_pages.Clear(page, 1);
+    }
+  }
+}
+
+void MMIOHandler::FindAccessWatches(
+    bool is_virtual, uint32_t address, size_t length,
+    std::vector<AccessWatchEntry*>* out_entries) {
+  auto& index = GetAccessWatchIndex(is_virtual);
+  size_t page_size = xe::memory::page_size();
+  size_t first_page = address / page_size;
+  size_t end_page =
+      (size_t(address) + std::max(length, size_t(1)) + page_size - 1) /
+      page_size;
+  for (size_t page = index.watched_pages.FindFirstSet(first_page, end_page);
+       page < end_page;
+       page = index.watched_pages.FindFirstSet(page + 1, end_page)) {
+    auto it = index.page_watches.find(uint32_t(page));
+    if (it == index.page_watches.end()) {
+      continue;
+    }
+    for (auto entry : it->second) {
+      // Watches span whole pages, so they're only gathered on the first page
+      // of theirs within the range.
+      if (page == std::max(entry->address / page_size, first_page)) {
+        out_entries->push_back(entry);
+      }
+    }
+  }
+}
+
+void MMIOHandler::FireAccessWatches(
+    const std::vector<AccessWatchEntry*>& entries) {
+  for (auto entry : entries) {
+    RemoveFromAccessWatchIndex(entry);
+    FireAccessWatch(entry);
+    delete entry;
+  }
 }
 
 void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
@@ -203,85 +289,95 @@ void MMIOHandler::CancelAccessWatch(uintptr_t watch_handle) {
   // Allow access to the range again.
   ClearAccessWatch(entry);
 
-  // Remove from table.
-  auto it = std::find(access_watches_.begin(), access_watches_.end(), entry);
-  assert_false(it == access_watches_.end());
-
-  if (it != access_watches_.end()) {
-    access_watches_.erase(it);
-  }
+  // Remove from table, or from the deferred hits if it's been hit already.
+  RemoveFromAccessWatchIndex(entry);
+  deferred_hit_watches_.erase(std::remove(deferred_hit_watches_.begin(),
+                                          deferred_hit_watches_.end(), entry),
+                              deferred_hit_watches_.end());
 
   delete entry;
 }
 
-void MMIOHandler::InvalidateRange(uint32_t physical_address, size_t length) {
+void MMIOHandler::ProcessDeferredAccessWatches() {
   auto lock = global_critical_region_.Acquire();
+  if (deferred_hit_watches_.empty()) {
+    return;
+  }
+  // Callbacks may add watches that are hit again before this returns.
+  std::vector<AccessWatchEntry*> entries;
+  entries.swap(deferred_hit_watches_);
+  for (auto entry : entries) {
+    entry->callback(entry->callback_context, entry->callback_data,
+                    entry->address);
+    delete entry;
+  }
+}
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address) ||
-        (entry->address >= physical_address &&
-         entry->address < physical_address + length)) {
-      // This watch lies within the range. End it.
-      FireAccessWatch(entry);
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
+void MMIOHandler::InvalidateRange(uint32_t physical_address, size_t length) {
+  auto lock = global_critical_region_.Acquire();
 
-    ++it;
-  }
+  // End the watches that lie within the range.
+  std::vector<AccessWatchEntry*> entries;
+  FindAccessWatches(false, physical_address, length, &entries);
+  FireAccessWatches(entries);
 }
 
 bool MMIOHandler::IsRangeWatched(uint32_t physical_address, size_t length) {
   auto lock = global_critical_region_.Acquire();
 
-  for (auto it = access_watches_.begin(); it != access_watches_.end(); ++it) {
-    auto entry = *it;
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address + length)) {
+  // Only the watches on the first page of the range may contain all of it.
+  // TODO(DrChat): Check if the range is covered by multiple watches.
+  uint32_t page = uint32_t(physical_address / xe::memory::page_size());
+  if (page >= physical_watches_.watched_pages.size() ||
+      !physical_watches_.watched_pages.Test(page)) {
+    return false;
+  }
+  auto it = physical_watches_.page_watches.find(page);
+  if (it == physical_watches_.page_watches.end()) {
+    return false;
+  }
+  for (auto entry : it->second) {
+    if (entry->address <= physical_address &&
+        entry->address + entry->length > physical_address + length) {
       // This range lies entirely within this watch.
       return true;
     }
-
-    // TODO(DrChat): Check if the range is partially covered, and subtract the
-    // covered portion if it is.
-    if ((entry->address <= physical_address &&
-         entry->address + entry->length > physical_address)) {
-      // The beginning of range lies partially within this watch.
-    } else if ((entry->address < physical_address + length &&
-                entry->address + entry->length > physical_address + length)) {
-      // The ending of this range lies partially within this watch.
-    }
   }
 
   return false;
 }
 
-bool MMIOHandler::CheckAccessWatch(uint32_t physical_address) {
+bool MMIOHandler::CheckAccessWatch(uint32_t physical_address,
+                                   bool is_virtual_fault,
+                                   uint32_t virtual_address) {
   auto lock = global_critical_region_.Acquire();
 
-  bool hit = false;
-  for (auto it = access_watches_.begin(); it != access_watches_.end();) {
-    auto entry = *it;
-    if (entry->address <= physical_address &&
-        entry->address + entry->length > physical_address) {
-      // Hit! Remove the watch.
-      hit = true;
-      FireAccessWatch(entry);
-      it = access_watches_.erase(it);
-      delete entry;
-      continue;
-    }
-    ++it;
+  // Watches cover whole pages, so all the watches on the faulting page are
+  // hit. Virtual watches can only be hit through virtual addresses.
+  std::vector<AccessWatchEntry*> entries;
+  FindAccessWatches(false, physical_address, 1, &entries);
+  if (is_virtual_fault) {
+    FindAccessWatches(true, virtual_address, 1, &entries);
   }
-
-  if (!hit) {
+  if (entries.empty()) {
     // Rethrow access violation - range was not being watched.
     return false;
   }
 
+  // Hit! Remove the watches. Deferred ones only need the pages writable
+  // again now.
+  auto deferred_end = std::stable_partition(
+      entries.begin(), entries.end(), [](AccessWatchEntry* entry) {
+        return entry->type == kWatchWriteDeferred;
+      });
+  for (auto it = entries.begin(); it != deferred_end; ++it) {
+    RemoveFromAccessWatchIndex(*it);
+    ClearAccessWatch(*it);
+    deferred_hit_watches_.push_back(*it);
+  }
+  entries.erase(entries.begin(), deferred_end);
+  FireAccessWatches(entries);
+
   // Range was watched, so lets eat this access violation.
   return true;
 }
@@ -476,15 +572,19 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
   if (!range) {
     auto fault_address = reinterpret_cast<uint8_t*>(ex->fault_address());
     uint32_t guest_address = 0;
+    bool is_virtual_fault = false;
     if (fault_address >= virtual_membase_ &&
         fault_address < physical_membase_) {
       // Faulting on a virtual address.
       guest_address = static_cast<uint32_t>(ex->fault_address()) & 0x1FFFFFFF;
+      is_virtual_fault = true;
     } else {
       // Faulting on a physical address.
       guest_address = static_cast<uint32_t>(ex->fault_address());
     }
 
+    access_watch_fault_count_.fetch_add(1, std::memory_order_relaxed);
+
     // HACK: Recheck if the pages are still protected (race condition - another
     // thread clears the writewatch we just hit)
     // Do this under the lock so we don't introduce another race condition.
@@ -500,9 +600,13 @@ bool MMIOHandler::ExceptionCallback(Exception* ex) {
 
     // Access is not found within any range, so fail and let the caller handle
     // it (likely by aborting).
-    return CheckAccessWatch(guest_address);
+    return CheckAccessWatch(
+        guest_address, is_virtual_fault,
+        static_cast<uint32_t>(fault_address - virtual_membase_));
   }
 
+  mmio_fault_count_.fetch_add(1, std::memory_order_relaxed);
+
   auto rip = ex->pc();
   auto p = reinterpret_cast<const uint8_t*>(rip);
   DecodedMov mov = {0};
@@ -10,11 +10,14 @@
 #ifndef XENIA_CPU_MMIO_HANDLER_H_
 #define XENIA_CPU_MMIO_HANDLER_H_
 
-#include <list>
+#include <atomic>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+#include "xenia/base/memory.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/range_bit_map.h"
 
 namespace xe {
 class Exception;
@@ -49,6 +52,10 @@ class MMIOHandler {
     kWatchInvalid = 0,
     kWatchWrite = 1,
     kWatchReadWrite = 2,
+    // Write watch that only records the write when its pages fault, leaving
+    // the callback to the next ProcessDeferredAccessWatches on the thread
+    // that calls it.
+    kWatchWriteDeferred = 3,
   };
 
   static std::unique_ptr<MMIOHandler> Install(uint8_t* virtual_membase,
@@ -72,7 +79,15 @@ class MMIOHandler {
   uintptr_t AddPhysicalAccessWatch(uint32_t guest_address, size_t length,
                                    WatchType type, AccessWatchCallback callback,
                                    void* callback_context, void* callback_data);
+  // Same as AddPhysicalAccessWatch, but for a range of a virtual heap that is
+  // not backed by physical memory (such as the 0x80000000 XEX image heap).
+  // Only accesses through that virtual address trigger the watch.
+  uintptr_t AddVirtualAccessWatch(uint32_t virtual_address, size_t length,
+                                  WatchType type, AccessWatchCallback callback,
+                                  void* callback_context, void* callback_data);
   void CancelAccessWatch(uintptr_t watch_handle);
+  // Fires the deferred write watches hit since the last call, in one batch.
+  void ProcessDeferredAccessWatches();
 
   // Fires and clears any access watches that overlap this range.
   void InvalidateRange(uint32_t physical_address, size_t length);
@@ -85,23 +100,52 @@ class MMIOHandler {
     uint32_t address;
     uint32_t length;
     WatchType type;
+    // Address is a full virtual address instead of a physical one.
+    bool is_virtual;
     AccessWatchCallback callback;
     void* callback_context;
     void* callback_data;
   };
 
+  // Watches indexed by the host pages they cover, in one address space.
+  struct AccessWatchIndex {
+    // Pages covered by any watch.
+    RangeBitMap watched_pages;
+    std::unordered_map<uint32_t, std::vector<AccessWatchEntry*>> page_watches;
+  };
+
   MMIOHandler(uint8_t* virtual_membase, uint8_t* physical_membase,
               uint8_t* membase_end)
       : virtual_membase_(virtual_membase),
         physical_membase_(physical_membase),
-        memory_end_(membase_end) {}
+        memory_end_(membase_end) {
+    physical_watches_.watched_pages.Resize(0x20000000 /
+                                           xe::memory::page_size());
+    virtual_watches_.watched_pages.Resize(0xA0000000 /
+                                          xe::memory::page_size());
+  }
 
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
   bool ExceptionCallback(Exception* ex);
 
   void FireAccessWatch(AccessWatchEntry* entry);
+  void ProtectAccessWatch(AccessWatchEntry* entry,
+                          xe::memory::PageAccess access);
   void ClearAccessWatch(AccessWatchEntry* entry);
-  bool CheckAccessWatch(uint32_t guest_address);
+  AccessWatchIndex& GetAccessWatchIndex(bool is_virtual) {
+    return is_virtual ? virtual_watches_ : physical_watches_;
+  }
+  void AddToAccessWatchIndex(AccessWatchEntry* entry);
+  void RemoveFromAccessWatchIndex(AccessWatchEntry* entry);
+  // Gathers the watches overlapping the range, each once, looking only at the
+  // pages that are watched.
+  void FindAccessWatches(bool is_virtual, uint32_t address, size_t length,
+                         std::vector<AccessWatchEntry*>* out_entries);
+  // Removes the watches from the index, then fires and deletes them.
+  void FireAccessWatches(const std::vector<AccessWatchEntry*>& entries);
+  // virtual_address is only valid if is_virtual_fault is set.
+  bool CheckAccessWatch(uint32_t guest_address, bool is_virtual_fault,
+                        uint32_t virtual_address);
 
   uint8_t* virtual_membase_;
   uint8_t* physical_membase_;
@@ -110,8 +154,15 @@ class MMIOHandler {
   std::vector<MMIORange> mapped_ranges_;
 
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): data structure magic.
-  std::list<AccessWatchEntry*> access_watches_;
+  AccessWatchIndex physical_watches_;
+  AccessWatchIndex virtual_watches_;
+  // Deferred write watches hit but not fired yet. Their pages are already
+  // unprotected and they're out of the index.
+  std::vector<AccessWatchEntry*> deferred_hit_watches_;
+
+  // Faults handled, by what they hit, logged on shutdown.
+  std::atomic<uint64_t> mmio_fault_count_ = {0};
+  std::atomic<uint64_t> access_watch_fault_count_ = {0};
 
   static MMIOHandler* global_handler_;
 };
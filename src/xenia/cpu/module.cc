@@ -29,18 +29,15 @@ Module::~Module() = default;
 bool Module::ContainsAddress(uint32_t address) { return true; }
 
 Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
-  auto global_lock = global_critical_region_.Acquire();
-  const auto it = map_.find(address);
-  Symbol* symbol = it != map_.end() ? it->second : nullptr;
+  // Lock-free: symbols are never removed and their status is atomic.
+  Symbol* symbol = map_.Find(address);
   if (symbol) {
     if (symbol->status() == Symbol::Status::kDeclaring) {
       // Some other thread is declaring the symbol - wait.
       if (wait) {
         do {
-          global_lock.unlock();
           // TODO(benvanik): sleep for less time?
           xe::threading::Sleep(std::chrono::microseconds(100));
-          global_lock.lock();
         } while (symbol->status() == Symbol::Status::kDeclaring);
       } else {
         // Immediate request, just return.
@@ -48,16 +45,25 @@ Symbol* Module::LookupSymbol(uint32_t address, bool wait) {
       }
     }
   }
-  global_lock.unlock();
   return symbol;
 }
 
 Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
                                      Symbol** out_symbol) {
   *out_symbol = nullptr;
+
+  // Existing symbols that are done being declared don't need the lock.
+  Symbol* symbol = map_.Find(address);
+  if (symbol && symbol->status() != Symbol::Status::kDeclaring) {
+    if (symbol->type() != type) {
+      return Symbol::Status::kFailed;
+    }
+    *out_symbol = symbol;
+    return symbol->status();
+  }
+
   auto global_lock = global_critical_region_.Acquire();
-  auto it = map_.find(address);
-  Symbol* symbol = it != map_.end() ? it->second : nullptr;
+  symbol = map_.Find(address);
   Symbol::Status status;
   if (symbol) {
     // If we exist but are the wrong type, die.
@@ -86,7 +92,7 @@ Symbol::Status Module::DeclareSymbol(Symbol::Type type, uint32_t address,
         symbol = new Symbol(Symbol::Type::kVariable, this, address);
         break;
     }
-    map_[address] = symbol;
+    map_.Insert(address, symbol);
     list_.emplace_back(symbol);
     status = Symbol::Status::kNew;
   }
@@ -117,6 +123,13 @@ Symbol::Status Module::DeclareVariable(uint32_t address, Symbol** out_symbol) {
 }
 
 Symbol::Status Module::DefineSymbol(Symbol* symbol) {
+  // Already defined (or failed) symbols can't change, so skip the lock.
+  Symbol::Status current_status = symbol->status();
+  if (current_status == Symbol::Status::kDefined ||
+      current_status == Symbol::Status::kFailed) {
+    return current_status;
+  }
+
   auto global_lock = global_critical_region_.Acquire();
   Symbol::Status status;
   if (symbol->status() == Symbol::Status::kDeclared) {
@@ -13,9 +13,9 @@
 #include <functional>
 #include <memory>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
+#include "xenia/base/concurrent_hash_map.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/symbol.h"
@@ -64,9 +64,10 @@ class Module {
                                Symbol** out_symbol);
   Symbol::Status DefineSymbol(Symbol* symbol);
 
+  // Held to add symbols and to wait on them. Lookups of symbols that are
+  // already declared/defined don't take it.
   xe::global_critical_region global_critical_region_;
-  // TODO(benvanik): replace with a better data structure.
-  std::unordered_map<uint32_t, Symbol*> map_;
+  ConcurrentHashMap<Symbol> map_;
   std::vector<std::unique_ptr<Symbol>> list_;
 };
 
@@ -20,6 +20,7 @@ namespace xe {
 namespace cpu {
 class Processor;
 class ThreadState;
+struct FunctionTraceRing;
 }  // namespace cpu
 namespace kernel {
 class KernelState;
@@ -397,6 +398,15 @@ typedef struct PPCContext_s {
 
   uint8_t vscr_sat;
 
+  // Rounding mode (FPSCR[RN] and NI) currently loaded into the host MXCSR of
+  // the thread running this context, or -1 if unknown. Lets generated code
+  // skip redundant (and serializing) MXCSR reloads.
+  int8_t host_rounding_mode;
+
+  // IRQL of the thread, here rather than in the kernel so that the spinlock
+  // exports inlined by the frontend can raise and lower it.
+  uint8_t irql;
+
   // uint32_t get_fprf() {
   //   return fpscr.value & 0x000F8000;
   // }
@@ -414,6 +424,10 @@ typedef struct PPCContext_s {
   // Used to shuttle data into externs. Contents volatile.
   uint64_t scratch;
 
+  // Where traced code records function entries and returns, if the
+  // processor is recording them.
+  FunctionTraceRing* function_trace_ring;
+
   // Processor-specific data pointer. Used on callbacks to get access to the
   // current runtime and its data.
   Processor* processor;
@@ -426,6 +440,9 @@ typedef struct PPCContext_s {
   // Value of last reserved load
   uint64_t reserved_val;
 
+  // Up to the 64b multiple asserted below.
+  uint8_t padding[56];
+
   static std::string GetRegisterName(PPCRegister reg);
   std::string GetStringFromValue(PPCRegister reg) const;
   void SetValueFromString(PPCRegister reg, std::string value);
@@ -0,0 +1,73 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_DECODED_CODE_H_
+#define XENIA_CPU_PPC_PPC_DECODED_CODE_H_
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "xenia/base/byte_order.h"
+#include "xenia/cpu/ppc/ppc_opcode_info.h"
+#include "xenia/memory.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// A guest instruction with its opcode looked up. The fields (and branch
+// targets) are plain bit extracts of the code with PPCDecodeData.
+struct PPCDecodedInstr {
+  uint32_t code;
+  PPCOpcode opcode;
+
+  static PPCDecodedInstr Decode(Memory* memory, uint32_t address) {
+    PPCDecodedInstr instr;
+    instr.code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    instr.opcode = LookupOpcode(instr.code);
+    return instr;
+  }
+};
+
+// The instructions of a guest function from its start to its end address,
+// decoded once by PPCScanner and kept on the function (see
+// GuestFunction::decoded_code) for PPCHIRBuilder and later retranslations.
+// Dropped when the guest code is invalidated.
+struct PPCDecodedCode {
+  uint32_t start_address = 0;
+  std::vector<PPCDecodedInstr> instrs;
+
+  uint32_t end_address() const {
+    return start_address + uint32_t(instrs.size()) * 4 - 4;
+  }
+  bool Covers(uint32_t start, uint32_t end) const {
+    return !instrs.empty() && start_address == start && end_address() == end;
+  }
+
+  // The instruction at the address, from the decoded code if there is any
+  // and it's in range, otherwise decoded from memory.
+  static PPCDecodedInstr Get(const PPCDecodedCode* decoded_code,
+                             Memory* memory, uint32_t address) {
+    if (decoded_code && address >= decoded_code->start_address) {
+      size_t index = (address - decoded_code->start_address) / 4;
+      if (index < decoded_code->instrs.size()) {
+        return decoded_code->instrs[index];
+      }
+    }
+    return PPCDecodedInstr::Decode(memory, address);
+  }
+};
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_DECODED_CODE_H_
@@ -10,7 +10,9 @@
 #include "xenia/cpu/ppc/ppc_emit-private.h"
 
 #include "xenia/base/assert.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
 
 namespace xe {
@@ -24,25 +26,24 @@ using xe::cpu::hir::Value;
 
 // Integer arithmetic (A-3)
 
+// Carries are computed from the low 32 bits. The carry is only ever produced
+// as a value, so stores of it that nothing reads are dropped by context
+// promotion/DSE along with the computation itself.
 Value* AddDidCarry(PPCHIRBuilder& f, Value* v1, Value* v2) {
-  return f.CompareUGT(f.Truncate(v2, INT32_TYPE),
-                      f.Not(f.Truncate(v1, INT32_TYPE)));
+  return f.DidCarry(f.Truncate(v1, INT32_TYPE), f.Truncate(v2, INT32_TYPE),
+                    f.LoadZeroInt8());
 }
 
+// v1 - v2 is v1 + ~v2 + 1.
 Value* SubDidCarry(PPCHIRBuilder& f, Value* v1, Value* v2) {
-  return f.Or(f.CompareUGT(f.Truncate(v1, INT32_TYPE),
-                           f.Not(f.Neg(f.Truncate(v2, INT32_TYPE)))),
-              f.IsFalse(f.Truncate(v2, INT32_TYPE)));
+  return f.DidCarry(f.Truncate(v1, INT32_TYPE),
+                    f.Not(f.Truncate(v2, INT32_TYPE)), f.LoadConstantInt8(1));
 }
 
-// https://github.com/sebastianbiallas/pearpc/blob/0b3c823f61456faa677f6209545a7b906e797421/src/cpu/cpu_generic/ppc_tools.h#L26
 Value* AddWithCarryDidCarry(PPCHIRBuilder& f, Value* v1, Value* v2, Value* v3) {
-  v1 = f.Truncate(v1, INT32_TYPE);
-  v2 = f.Truncate(v2, INT32_TYPE);
   assert_true(v3->type == INT8_TYPE);
-  v3 = f.ZeroExtend(v3, INT32_TYPE);
-  return f.Or(f.CompareULT(f.Add(f.Add(v1, v2), v3), v3),
-              f.CompareULT(f.Add(v1, v2), v1));
+  return f.DidCarry(f.Truncate(v1, INT32_TYPE), f.Truncate(v2, INT32_TYPE),
+                    v3);
 }
 
 int InstrEmit_addx(PPCHIRBuilder& f, const InstrData& i) {
@@ -784,8 +785,12 @@ int InstrEmit_norx(PPCHIRBuilder& f, const InstrData& i) {
 int InstrEmit_orx(PPCHIRBuilder& f, const InstrData& i) {
   // RA <- (RS) | (RB)
   if (i.X.RT == i.X.RB && i.X.RT == i.X.RA && !i.X.Rc) {
-    // Sometimes used as no-op.
-    f.Nop();
+    // Sometimes used as no-op, and as thread priority hints around busy waits.
+    if (FLAGS_yield_on_spin_loops && PPCHIRBuilder::IsYieldHint(i.code)) {
+      f.CallExtern(f.builtins()->spin_yield);
+    } else {
+      f.Nop();
+    }
     return 0;
   }
   Value* ra;
@@ -14,6 +14,7 @@
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
+#include "xenia/cpu/ppc/ppc_kernel_intrinsics.h"
 
 #include <stddef.h>
 
@@ -27,6 +28,39 @@ using namespace xe::cpu::hir;
 using xe::cpu::hir::Label;
 using xe::cpu::hir::Value;
 
+// A branch without link out of a callee inlined into a trace. It would have
+// left the callee's frame, so it's made as a call from the caller's instead,
+// unless it is the return to the caller.
+void EmitTraceExit(PPCHIRBuilder& f, Value* nia, Value* cond, bool expect_true,
+                   bool nia_is_lr) {
+  Label* skip = nullptr;
+  if (cond) {
+    skip = f.NewLabel();
+    if (expect_true) {
+      f.BranchFalse(cond, skip);
+    } else {
+      f.BranchTrue(cond, skip);
+    }
+  }
+  Value* return_address = f.LoadConstantUint64(f.trace_return_address());
+  if (nia->IsConstant()) {
+    f.SetReturnAddress(return_address);
+    f.Call(f.LookupFunction(uint32_t(nia->AsUint64())), 0);
+  } else {
+    if (nia_is_lr) {
+      f.BranchTrue(f.CompareEQ(f.Truncate(nia, INT32_TYPE),
+                               f.Truncate(return_address, INT32_TYPE)),
+                   f.trace_return_label());
+    }
+    f.SetReturnAddress(return_address);
+    f.CallIndirect(nia, 0);
+  }
+  f.Branch(f.trace_return_label());
+  if (skip) {
+    f.MarkLabel(skip);
+  }
+}
+
 int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
                      Value* nia, bool lk, Value* cond = NULL,
                      bool expect_true = true, bool nia_is_lr = false) {
@@ -60,8 +94,14 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
     if (nia_value == f.function()->address() && lk) {
       is_recursion = true;
     }
+    if (f.trace_function() && nia_value == f.trace_function()->address() &&
+        lk) {
+      is_recursion = true;
+    }
     Label* label = is_recursion ? NULL : f.LookupLabel(nia_value);
-    if (label) {
+    if (!label && !lk && f.trace_return_label()) {
+      EmitTraceExit(f, nia, cond, expect_true, nia_is_lr);
+    } else if (label) {
       // Branch to label.
       uint32_t branch_flags = 0;
       if (cond) {
@@ -81,7 +121,9 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
           cond = f.IsFalse(cond);
         }
         f.CallTrue(cond, function, call_flags);
-      } else {
+      } else if (!lk ||
+                 !(f.InlineImportCall(function) || f.InlineCall(function) ||
+                   f.InlineTrace(function, uint32_t(cia)))) {
         f.Call(function, call_flags);
       }
     }
@@ -127,6 +169,10 @@ int InstrEmit_branch(PPCHIRBuilder& f, const char* src, uint64_t cia,
     {
 #endif
     // Jump to pointer.
+    if (!lk && f.trace_return_label()) {
+      EmitTraceExit(f, nia, cond, expect_true, nia_is_lr);
+      return 0;
+    }
     bool likely_return = !lk && nia_is_lr;
     if (likely_return) {
       call_flags |= CALL_POSSIBLE_RETURN;
@@ -237,6 +283,12 @@ int InstrEmit_bcx(PPCHIRBuilder& f, const InstrData& i) {
   } else {
     nia = (uint32_t)(i.address + XEEXTS16(i.B.BD << 2));
   }
+  if (FLAGS_yield_on_spin_loops && !i.B.LK && ok &&
+      f.IsSpinLoop(nia, i.address)) {
+    // Busy wait on memory. Back off on the host instead of burning the core
+    // another thread needs to make progress.
+    f.CallExtern(f.builtins()->spin_yield);
+  }
   return InstrEmit_branch(f, "bcx", i.address, f.LoadConstantUint32(nia),
                           i.B.LK, ok, expect_true);
 }
@@ -423,7 +475,12 @@ int InstrEmit_mcrf(PPCHIRBuilder& f, const InstrData& i) {
 // System linkage (A-24)
 
 int InstrEmit_sc(PPCHIRBuilder& f, const InstrData& i) {
-  f.CallExtern(f.function());
+  auto intrinsic = GetKernelIntrinsic(f.function());
+  if (intrinsic == KernelIntrinsic::kNone) {
+    f.CallExtern(f.function());
+  } else {
+    EmitKernelIntrinsic(f, intrinsic, f.function());
+  }
   return 0;
 }
 
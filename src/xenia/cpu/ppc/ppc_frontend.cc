@@ -9,12 +9,19 @@
 
 #include "xenia/cpu/ppc/ppc_frontend.h"
 
+#include <xmmintrin.h>
+
 #include "xenia/base/atomic.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_emit.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/ppc/ppc_translator.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/cpu/thread_state.h"
 
 namespace xe {
 namespace cpu {
@@ -46,6 +53,8 @@ PPCFrontend::PPCFrontend(Processor* processor) : processor_(processor) {
 }
 
 PPCFrontend::~PPCFrontend() {
+  XELOGD("PPC translators: %zu created, %zu reused",
+         translator_pool_.allocated_count(), translator_pool_.reused_count());
   // Force cleanup now before we deinit.
   translator_pool_.Reset();
 }
@@ -78,6 +87,47 @@ void LeaveGlobalLock(PPCContext* ppc_context, void* arg0, void* arg1) {
   global_mutex->unlock();
 }
 
+// Called on every iteration of a guest loop that does nothing but wait for
+// memory to change, and on guest low priority hints. The longer the wait goes
+// on the less likely it is to end within the next few iterations, so we back
+// off from pause to yielding the timeslice to sleeping outright.
+void SpinYield(PPCContext* ppc_context, void* arg0, void* arg1) {
+  // Iterations further apart than this are treated as separate waits.
+  static const uint64_t kWaitGapUs = 50;
+  static const uint32_t kPauseIterations = 64;
+  static const uint32_t kYieldIterations = 1024;
+
+  auto& stats = ppc_context->thread_state->spin_stats();
+  uint64_t now = Clock::QueryHostTickCount();
+  uint64_t gap_ticks = kWaitGapUs * Clock::host_tick_frequency() / 1000000;
+  if (!stats.last_tick || now - stats.last_tick > gap_ticks) {
+    stats.streak = 0;
+    ++stats.wait_count;
+  } else {
+    stats.tick_count += now - stats.last_tick;
+  }
+  ++stats.iteration_count;
+
+  uint32_t streak = stats.streak++;
+  if (streak < kPauseIterations) {
+    _mm_pause();
+  } else if (streak < kYieldIterations) {
+    xe::threading::MaybeYield();
+  } else {
+    xe::threading::Sleep(std::chrono::microseconds(10));
+  }
+  stats.last_tick = Clock::QueryHostTickCount();
+  stats.tick_count += stats.last_tick - now;
+}
+
+// Called by compiled probes once their condition is met, with the id of the
+// probe in scratch. Leaves it there to break, otherwise 0.
+void ProbeHit(PPCContext* ppc_context, void* arg0, void* arg1) {
+  auto processor = reinterpret_cast<Processor*>(arg0);
+  ppc_context->scratch = processor->OnProbeHit(
+      ppc_context->thread_state, uint32_t(ppc_context->scratch));
+}
+
 bool PPCFrontend::Initialize() {
   void* arg0 = reinterpret_cast<void*>(&xe::global_critical_region::mutex());
   void* arg1 = reinterpret_cast<void*>(&builtins_.global_lock_count);
@@ -87,6 +137,10 @@ bool PPCFrontend::Initialize() {
       processor_->DefineBuiltin("EnterGlobalLock", EnterGlobalLock, arg0, arg1);
   builtins_.leave_global_lock =
       processor_->DefineBuiltin("LeaveGlobalLock", LeaveGlobalLock, arg0, arg1);
+  builtins_.spin_yield =
+      processor_->DefineBuiltin("SpinYield", SpinYield, nullptr, nullptr);
+  builtins_.probe_hit =
+      processor_->DefineBuiltin("ProbeHit", ProbeHit, processor_, nullptr);
   return true;
 }
 
@@ -107,6 +161,16 @@ bool PPCFrontend::DefineFunction(GuestFunction* function,
   return result;
 }
 
+bool PPCFrontend::DisassembleFunction(GuestFunction* function,
+                                      uint32_t debug_info_flags,
+                                      FunctionDebugInfo* debug_info) {
+  auto translator = translator_pool_.Allocate(this);
+  bool result =
+      translator->Disassemble(function, debug_info_flags, debug_info);
+  translator_pool_.Release(translator);
+  return result;
+}
+
 }  // namespace ppc
 }  // namespace cpu
 }  // namespace xe
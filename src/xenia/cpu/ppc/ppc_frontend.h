@@ -33,6 +33,8 @@ struct PPCBuiltins {
   Function* check_global_lock;
   Function* enter_global_lock;
   Function* leave_global_lock;
+  Function* spin_yield;
+  Function* probe_hit;
 };
 
 class PPCFrontend {
@@ -48,6 +50,8 @@ class PPCFrontend {
 
   bool DeclareFunction(GuestFunction* function);
   bool DefineFunction(GuestFunction* function, uint32_t debug_info_flags);
+  bool DisassembleFunction(GuestFunction* function, uint32_t debug_info_flags,
+                           FunctionDebugInfo* debug_info);
 
  private:
   Processor* processor_;
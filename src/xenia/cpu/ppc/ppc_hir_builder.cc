@@ -20,7 +20,9 @@
 #include "xenia/cpu/hir/label.h"
 #include "xenia/cpu/ppc/ppc_context.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
+#include "xenia/cpu/ppc/ppc_decoded_code.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/ppc/ppc_kernel_intrinsics.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/processor.h"
 
@@ -68,6 +70,10 @@ void PPCHIRBuilder::Reset() {
   instr_count_ = 0;
   instr_offset_list_ = NULL;
   label_list_ = NULL;
+  decoded_code_.reset();
+  trace_function_ = nullptr;
+  trace_return_label_ = nullptr;
+  trace_return_address_ = 0;
   with_debug_info_ = false;
   HIRBuilder::Reset();
 }
@@ -78,6 +84,7 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
   Memory* memory = frontend_->memory();
 
   function_ = function;
+  decoded_code_ = function_->decoded_code();
   start_address_ = function_->address();
   instr_count_ = (function_->end_address() - function_->address()) / 4 + 1;
 
@@ -88,6 +95,16 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
                   function_->name().c_str());
   }
 
+  // Routines bound to a native implementation (see crt_routines.h) keep their
+  // guest code in memory but never run it; hand straight off to the host.
+  // Import thunks are rewritten to sc/blr and take the normal path.
+  if (function_->behavior() == Function::Behavior::kExtern &&
+      function_->extern_handler() && !function_->export_data()) {
+    CallExtern(function_);
+    Return();
+    return Finalize();
+  }
+
   // Allocate offset list.
   // This is used to quickly map labels to instructions.
   // The list is built as the instructions are traversed, with the values
@@ -105,80 +122,99 @@ bool PPCHIRBuilder::Emit(GuestFunction* function, uint32_t flags) {
 
   uint32_t start_address = function_->address();
   uint32_t end_address = function_->end_address();
+  probes_ =
+      frontend_->processor()->QueryProbesInRange(start_address, end_address);
   for (uint32_t address = start_address, offset = 0; address <= end_address;
        address += 4, offset++) {
-    trace_info_.dest_count = 0;
-    uint32_t code =
-        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
-    auto opcode = LookupOpcode(code);
-    auto& opcode_info = GetOpcodeInfo(opcode);
+    EmitInstruction(address, offset);
+  }
+  probes_.clear();
 
-    // Mark label, if we were assigned one earlier on in the walk.
-    // We may still get a label, but it'll be inserted by LookupLabel
-    // as needed.
-    Label* label = label_list_[offset];
-    if (label) {
-      MarkLabel(label);
+  if (function_->is_split()) {
+    // Execution falling off the end continues in the next region.
+    auto tail = last_instr();
+    if (!tail || !IsUnconditionalJump(tail)) {
+      Call(LookupFunction(function_->end_address() + 4), CALL_TAIL);
     }
+  }
 
-    Instr* first_instr = 0;
-    if (with_debug_info_) {
-      if (label) {
-        AnnotateLabel(address, label);
-      }
-      comment_buffer_.Reset();
-      comment_buffer_.AppendFormat("%.8X %.8X ", address, code);
-      DisasmPPC(address, code, &comment_buffer_);
-      Comment(comment_buffer_);
-      first_instr = last_instr();
-    }
+  if (false) {
+    DumpAllOpcodeCounts();
+  }
 
-    // Mark source offset for debugging.
-    // We could omit this if we never wanted to debug.
-    SourceOffset(address);
-    if (!first_instr) {
-      first_instr = last_instr();
-    }
+  return Finalize();
+}
 
-    // Stash instruction offset. It's either the SOURCE_OFFSET or the COMMENT.
-    instr_offset_list_[offset] = first_instr;
+void PPCHIRBuilder::EmitInstruction(uint32_t address, uint32_t offset) {
+  Memory* memory = frontend_->memory();
+  trace_info_.dest_count = 0;
+  auto instr = PPCDecodedCode::Get(decoded_code_.get(), memory, address);
+  uint32_t code = instr.code;
+  auto opcode = instr.opcode;
+  auto& opcode_info = GetOpcodeInfo(opcode);
+
+  // Mark label, if we were assigned one earlier on in the walk.
+  // We may still get a label, but it'll be inserted by LookupLabel
+  // as needed.
+  Label* label = label_list_[offset];
+  if (label) {
+    MarkLabel(label);
+  }
 
-    if (opcode == PPCOpcode::kInvalid) {
-      XELOGE("Invalid instruction %.8llX %.8X", address, code);
-      Comment("INVALID!");
-      // TraceInvalidInstruction(i);
-      continue;
+  Instr* first_instr = 0;
+  if (with_debug_info_) {
+    if (label) {
+      AnnotateLabel(address, label);
     }
-    ++opcode_translation_counts[static_cast<int>(opcode)];
+    comment_buffer_.Reset();
+    comment_buffer_.AppendFormat("%.8X %.8X ", address, code);
+    DisasmPPC(address, code, &comment_buffer_);
+    Comment(comment_buffer_);
+    first_instr = last_instr();
+  }
 
-    // Synchronize the PPC context as required.
-    // This will ensure all registers are saved to the PPC context before this
-    // instruction executes.
-    if (opcode_info.type == PPCOpcodeType::kSync) {
-      ContextBarrier();
-    }
+  // Mark source offset for debugging.
+  // We could omit this if we never wanted to debug.
+  SourceOffset(address);
+  if (!first_instr) {
+    first_instr = last_instr();
+  }
 
-    MaybeBreakOnInstruction(address);
+  // Stash instruction offset. It's either the SOURCE_OFFSET or the COMMENT.
+  instr_offset_list_[offset] = first_instr;
 
-    InstrData i;
-    i.address = address;
-    i.code = code;
-    i.opcode = opcode;
-    i.opcode_info = &opcode_info;
-    if (!opcode_info.emit || opcode_info.emit(*this, i)) {
-      auto& disasm_info = GetOpcodeDisasmInfo(opcode);
-      XELOGE("Unimplemented instr %.8llX %.8X %s", address, code,
-             disasm_info.name);
-      Comment("UNIMPLEMENTED!");
-      DebugBreak();
-    }
+  if (opcode == PPCOpcode::kInvalid) {
+    XELOGE("Invalid instruction %.8llX %.8X", address, code);
+    Comment("INVALID!");
+    // TraceInvalidInstruction(i);
+    return;
   }
+  ++opcode_translation_counts[static_cast<int>(opcode)];
 
-  if (false) {
-    DumpAllOpcodeCounts();
+  // Synchronize the PPC context as required.
+  // This will ensure all registers are saved to the PPC context before this
+  // instruction executes.
+  if (opcode_info.type == PPCOpcodeType::kSync) {
+    ContextBarrier();
   }
 
-  return Finalize();
+  MaybeBreakOnInstruction(address);
+  if (!probes_.empty()) {
+    EmitProbes(address);
+  }
+
+  InstrData i;
+  i.address = address;
+  i.code = code;
+  i.opcode = opcode;
+  i.opcode_info = &opcode_info;
+  if (!opcode_info.emit || opcode_info.emit(*this, i)) {
+    auto& disasm_info = GetOpcodeDisasmInfo(opcode);
+    XELOGE("Unimplemented instr %.8llX %.8X %s", address, code,
+           disasm_info.name);
+    Comment("UNIMPLEMENTED!");
+    DebugBreak();
+  }
 }
 
 void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
@@ -200,31 +236,93 @@ void PPCHIRBuilder::MaybeBreakOnInstruction(uint32_t address) {
     right = Truncate(right, INT32_TYPE);
   }
 
-  auto op = FLAGS_break_condition_op.c_str();
-  // TODO(rick): table?
-  if (strcasecmp(op, "eq") == 0) {
-    TrapTrue(CompareEQ(left, right));
-  } else if (strcasecmp(op, "ne") == 0) {
-    TrapTrue(CompareNE(left, right));
-  } else if (strcasecmp(op, "slt") == 0) {
-    TrapTrue(CompareSLT(left, right));
-  } else if (strcasecmp(op, "sle") == 0) {
-    TrapTrue(CompareSLE(left, right));
-  } else if (strcasecmp(op, "sgt") == 0) {
-    TrapTrue(CompareSGT(left, right));
-  } else if (strcasecmp(op, "sge") == 0) {
-    TrapTrue(CompareSGE(left, right));
-  } else if (strcasecmp(op, "ult") == 0) {
-    TrapTrue(CompareULT(left, right));
-  } else if (strcasecmp(op, "ule") == 0) {
-    TrapTrue(CompareULE(left, right));
-  } else if (strcasecmp(op, "ugt") == 0) {
-    TrapTrue(CompareUGT(left, right));
-  } else if (strcasecmp(op, "uge") == 0) {
-    TrapTrue(CompareUGE(left, right));
-  } else {
+  Probe::CompareOp op;
+  if (!Probe::ParseCompareOp(FLAGS_break_condition_op.c_str(), &op)) {
     assert_always();
+    return;
   }
+  TrapTrue(CompareProbeOperands(op, left, right));
+}
+
+void PPCHIRBuilder::EmitProbes(uint32_t address) {
+  for (auto& probe : probes_) {
+    if (probe.guest_address() != address) {
+      continue;
+    }
+    switch (probe.action()) {
+      case Probe::Action::kBreak:
+        Comment("probe: break");
+        break;
+      case Probe::Action::kTrace:
+        Comment("probe: trace");
+        break;
+      case Probe::Action::kCapture:
+        Comment("probe: capture");
+        break;
+    }
+
+    auto& condition = probe.condition();
+    Label* skip_label = nullptr;
+    if (condition.operand_type != Probe::OperandType::kNone) {
+      Value* left;
+      Value* right;
+      if (condition.operand_type == Probe::OperandType::kGpr) {
+        left = LoadGPR(condition.operand);
+        right = LoadConstantUint64(condition.value);
+        if (condition.truncate) {
+          left = Truncate(left, INT32_TYPE);
+          right = LoadConstantUint32(uint32_t(condition.value));
+        }
+      } else {
+        left = ByteSwap(
+            Load(LoadConstantUint64(condition.operand), INT32_TYPE));
+        right = LoadConstantUint32(uint32_t(condition.value));
+      }
+      skip_label = NewLabel();
+      BranchFalse(CompareProbeOperands(condition.op, left, right), skip_label);
+    }
+
+    // Hit counts and the trace are kept by the processor.
+    StoreContext(offsetof(PPCContext, scratch),
+                 LoadConstantUint64(probe.id()));
+    CallExtern(frontend_->builtins()->probe_hit);
+    if (probe.action() == Probe::Action::kBreak) {
+      TrapTrue(LoadContext(offsetof(PPCContext, scratch), INT64_TYPE),
+               Probe::kBreakTrapType);
+    }
+
+    if (skip_label) {
+      MarkLabel(skip_label);
+    }
+  }
+}
+
+Value* PPCHIRBuilder::CompareProbeOperands(Probe::CompareOp op, Value* left,
+                                           Value* right) {
+  switch (op) {
+    case Probe::CompareOp::kEq:
+      return CompareEQ(left, right);
+    case Probe::CompareOp::kNe:
+      return CompareNE(left, right);
+    case Probe::CompareOp::kSlt:
+      return CompareSLT(left, right);
+    case Probe::CompareOp::kSle:
+      return CompareSLE(left, right);
+    case Probe::CompareOp::kSgt:
+      return CompareSGT(left, right);
+    case Probe::CompareOp::kSge:
+      return CompareSGE(left, right);
+    case Probe::CompareOp::kUlt:
+      return CompareULT(left, right);
+    case Probe::CompareOp::kUle:
+      return CompareULE(left, right);
+    case Probe::CompareOp::kUgt:
+      return CompareUGT(left, right);
+    case Probe::CompareOp::kUge:
+      return CompareUGE(left, right);
+  }
+  assert_always();
+  return CompareEQ(left, right);
 }
 
 void PPCHIRBuilder::AnnotateLabel(uint32_t address, Label* label) {
@@ -238,6 +336,323 @@ Function* PPCHIRBuilder::LookupFunction(uint32_t address) {
   return frontend_->processor()->LookupFunction(address);
 }
 
+bool PPCHIRBuilder::CanInline(GuestFunction* function) {
+  // Inlined copies are invisible to the debugger and tracing: breakpoints
+  // and coverage are keyed on the function containing an address.
+  if (!FLAGS_inline_leaf_functions || with_debug_info_ ||
+      frontend_->processor()->is_debugger_attached()) {
+    return false;
+  }
+  // Code watches only invalidate the function owning the modified page, so
+  // an inlined copy would go stale.
+  if (FLAGS_invalidate_modified_code) {
+    return false;
+  }
+  if (function == function_ ||
+      function->behavior() != Function::Behavior::kDefault ||
+      function->status() != Symbol::Status::kDefined) {
+    return false;
+  }
+  uint32_t start_address = function->address();
+  uint32_t end_address = function->end_address();
+  if (end_address < start_address ||
+      (end_address - start_address) / 4 + 1 >
+          uint32_t(FLAGS_inline_max_instructions)) {
+    return false;
+  }
+  if (FLAGS_break_on_instruction >= start_address &&
+      FLAGS_break_on_instruction <= end_address) {
+    return false;
+  }
+  if (frontend_->processor()->HasProbesInRange(start_address, end_address)) {
+    return false;
+  }
+
+  // Straight-line code ending in a plain blr. Anything that branches,
+  // changes LR/CTR or needs to know which function it is in is left alone.
+  Memory* memory = frontend_->memory();
+  auto decoded_code = function->decoded_code();
+  if (PPCDecodedCode::Get(decoded_code.get(), memory, end_address).code !=
+      0x4E800020) {
+    return false;
+  }
+  for (uint32_t address = start_address; address < end_address;
+       address += 4) {
+    auto opcode =
+        PPCDecodedCode::Get(decoded_code.get(), memory, address).opcode;
+    auto& opcode_info = GetOpcodeInfo(opcode);
+    if (opcode == PPCOpcode::kInvalid || !opcode_info.emit ||
+        opcode_info.group == PPCOpcodeGroup::kB || opcode == PPCOpcode::mtspr) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PPCHIRBuilder::InlineCall(Function* function) {
+  if (!function || !function->is_guest()) {
+    return false;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (!CanInline(guest_function)) {
+    return false;
+  }
+
+  // The caller has already set LR, so the body sees the same state it would
+  // after a real call. Source offsets use the callee addresses so that host
+  // code maps back to the guest instruction that produced it; the final blr
+  // simply falls through to the caller.
+  Memory* memory = frontend_->memory();
+  auto decoded_code = guest_function->decoded_code();
+  for (uint32_t address = guest_function->address();
+       address < guest_function->end_address(); address += 4) {
+    trace_info_.dest_count = 0;
+    auto instr = PPCDecodedCode::Get(decoded_code.get(), memory, address);
+    uint32_t code = instr.code;
+    auto opcode = instr.opcode;
+    auto& opcode_info = GetOpcodeInfo(opcode);
+
+    SourceOffset(address);
+    if (opcode_info.type == PPCOpcodeType::kSync) {
+      ContextBarrier();
+    }
+
+    InstrData i;
+    i.address = address;
+    i.code = code;
+    i.opcode = opcode;
+    i.opcode_info = &opcode_info;
+    if (opcode_info.emit(*this, i)) {
+      auto& disasm_info = GetOpcodeDisasmInfo(opcode);
+      XELOGE("Unimplemented instr %.8X %.8X %s", address, code,
+             disasm_info.name);
+      Comment("UNIMPLEMENTED!");
+      DebugBreak();
+    }
+  }
+  return true;
+}
+
+bool PPCHIRBuilder::CanTrace(GuestFunction* function, uint32_t call_address) {
+  // Only hot code is worth the larger caller, and the same restrictions as
+  // for leaf inlining apply.
+  if (!FLAGS_trace_compilation || trace_function_ || with_debug_info_ ||
+      function_->tier() != GuestFunction::Tier::kOptimized ||
+      frontend_->processor()->is_debugger_attached() ||
+      FLAGS_invalidate_modified_code) {
+    return false;
+  }
+  if (function == function_ ||
+      function->behavior() != Function::Behavior::kDefault ||
+      function->status() != Symbol::Status::kDefined ||
+      function->tier() != GuestFunction::Tier::kOptimized ||
+      function->is_split() || function->is_split_region()) {
+    return false;
+  }
+  uint32_t start_address = function->address();
+  uint32_t end_address = function->end_address();
+  if (end_address < start_address ||
+      (end_address - start_address) / 4 + 1 >
+          uint32_t(FLAGS_trace_max_instructions)) {
+    return false;
+  }
+  if (FLAGS_break_on_instruction >= start_address &&
+      FLAGS_break_on_instruction <= end_address) {
+    return false;
+  }
+  if (frontend_->processor()->HasProbesInRange(start_address, end_address)) {
+    return false;
+  }
+  if (IsColdInstruction(call_address)) {
+    return false;
+  }
+
+  // sc refers to the function being translated.
+  Memory* memory = frontend_->memory();
+  auto decoded_code = function->decoded_code();
+  for (uint32_t address = start_address; address <= end_address;
+       address += 4) {
+    auto opcode =
+        PPCDecodedCode::Get(decoded_code.get(), memory, address).opcode;
+    if (opcode == PPCOpcode::kInvalid || !GetOpcodeInfo(opcode).emit ||
+        opcode == PPCOpcode::sc) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool PPCHIRBuilder::IsColdInstruction(uint32_t address) {
+  // Entries are only set where blocks start, the nearest one before the
+  // instruction is its block.
+  uint32_t* block_profile = function_->block_profile();
+  if (!block_profile || address < function_->address()) {
+    return false;
+  }
+  uint32_t index = (address - function_->address()) / 4;
+  if (index >= function_->block_profile_count()) {
+    return false;
+  }
+  for (uint32_t i = index + 1; i-- > 0;) {
+    if (block_profile[i]) {
+      return block_profile[i] == 1;
+    }
+  }
+  return false;
+}
+
+bool PPCHIRBuilder::InlineTrace(Function* function, uint32_t call_address) {
+  if (!function || !function->is_guest()) {
+    return false;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (!CanTrace(guest_function, call_address)) {
+    return false;
+  }
+
+  // The callee gets its own labels, so its branches stay within it. The
+  // caller has already set LR, so returns are recognized by comparing
+  // against it and continue after the call.
+  uint64_t saved_start_address = start_address_;
+  uint64_t saved_instr_count = instr_count_;
+  Instr** saved_instr_offset_list = instr_offset_list_;
+  Label** saved_label_list = label_list_;
+  auto saved_decoded_code = std::move(decoded_code_);
+  decoded_code_ = guest_function->decoded_code();
+  start_address_ = guest_function->address();
+  instr_count_ =
+      (guest_function->end_address() - guest_function->address()) / 4 + 1;
+  size_t list_size = instr_count_ * sizeof(void*);
+  instr_offset_list_ = (Instr**)arena_->Alloc(list_size);
+  label_list_ = (Label**)arena_->Alloc(list_size);
+  std::memset(instr_offset_list_, 0, list_size);
+  std::memset(label_list_, 0, list_size);
+  Label* return_label = NewLabel();
+  trace_function_ = guest_function;
+  trace_return_label_ = return_label;
+  trace_return_address_ = call_address + 4;
+
+  for (uint32_t address = guest_function->address(), offset = 0;
+       address <= guest_function->end_address(); address += 4, offset++) {
+    EmitInstruction(address, offset);
+  }
+
+  start_address_ = saved_start_address;
+  instr_count_ = saved_instr_count;
+  instr_offset_list_ = saved_instr_offset_list;
+  label_list_ = saved_label_list;
+  decoded_code_ = std::move(saved_decoded_code);
+  trace_function_ = nullptr;
+  trace_return_label_ = nullptr;
+  trace_return_address_ = 0;
+  MarkLabel(return_label);
+  return true;
+}
+
+bool PPCHIRBuilder::InlineImportCall(Function* function) {
+  if (!FLAGS_bind_import_calls || !function || !function->is_guest() ||
+      with_debug_info_ || frontend_->processor()->is_debugger_attached()) {
+    return false;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (function->behavior() != Function::Behavior::kExtern ||
+      !guest_function->export_data()) {
+    return false;
+  }
+
+  // XexModule rewrites kernel import thunks to sc; blr. Anything else was
+  // patched by the title and has to run as written.
+  Memory* memory = frontend_->memory();
+  auto code = memory->TranslateVirtual<xe::be<uint32_t>*>(function->address());
+  if (code[0] != 0x44000002 || code[1] != 0x4E800020) {
+    return false;
+  }
+  auto intrinsic = GetKernelIntrinsic(guest_function);
+  if (intrinsic == KernelIntrinsic::kNone) {
+    CallExtern(function);
+  } else {
+    EmitKernelIntrinsic(*this, intrinsic, function);
+  }
+  return true;
+}
+
+bool PPCHIRBuilder::IsYieldHint(uint32_t code) {
+  // or rS,rA,rB with Rc=0.
+  if ((code & 0xFC0007FF) != 0x7C000378) {
+    return false;
+  }
+  uint32_t rs = (code >> 21) & 0x1F;
+  if (rs != ((code >> 16) & 0x1F) || rs != ((code >> 11) & 0x1F)) {
+    return false;
+  }
+  return rs == 1 || rs >= 28;
+}
+
+bool PPCHIRBuilder::IsSpinLoop(uint32_t loop_address,
+                               uint32_t branch_address) {
+  static const uint32_t kMaxSpinLoopInstructions = 8;
+  if (loop_address < start_address_ || loop_address >= branch_address ||
+      (branch_address - loop_address) / 4 > kMaxSpinLoopInstructions) {
+    return false;
+  }
+
+  // Only loads, compares and masking are allowed, and no load may use an
+  // address computed inside the loop. Anything else (stores, pointer
+  // increments, calls, ...) means the loop is doing real work.
+  Memory* memory = frontend_->memory();
+  uint32_t written_gprs = 0;
+  uint32_t address_gprs = 0;
+  for (uint32_t address = loop_address; address < branch_address;
+       address += 4) {
+    uint32_t code =
+        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    uint32_t rt = (code >> 21) & 0x1F;
+    uint32_t ra = (code >> 16) & 0x1F;
+    uint32_t rb = (code >> 11) & 0x1F;
+    switch (LookupOpcode(code)) {
+      case PPCOpcode::lbz:
+      case PPCOpcode::lhz:
+      case PPCOpcode::lha:
+      case PPCOpcode::lwz:
+      case PPCOpcode::lwa:
+      case PPCOpcode::ld:
+        written_gprs |= 1u << rt;
+        address_gprs |= 1u << ra;
+        break;
+      case PPCOpcode::lbzx:
+      case PPCOpcode::lhzx:
+      case PPCOpcode::lhax:
+      case PPCOpcode::lwzx:
+      case PPCOpcode::lwax:
+      case PPCOpcode::ldx:
+        written_gprs |= 1u << rt;
+        address_gprs |= (1u << ra) | (1u << rb);
+        break;
+      case PPCOpcode::rlwinmx:
+      case PPCOpcode::andix:
+        written_gprs |= 1u << ra;
+        break;
+      case PPCOpcode::cmp:
+      case PPCOpcode::cmpi:
+      case PPCOpcode::cmpl:
+      case PPCOpcode::cmpli:
+      case PPCOpcode::sync:
+      case PPCOpcode::isync:
+      case PPCOpcode::eieio:
+        break;
+      case PPCOpcode::ori:
+        if (code != 0x60000000) {
+          return false;
+        }
+        break;
+      default:
+        // Includes priority hints: those already yield on their own.
+        return false;
+    }
+  }
+  return !(written_gprs & address_gprs);
+}
+
 Label* PPCHIRBuilder::LookupLabel(uint32_t address) {
   if (address < start_address_) {
     return nullptr;
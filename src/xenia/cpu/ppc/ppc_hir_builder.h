@@ -10,15 +10,20 @@
 #ifndef XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 #define XENIA_CPU_PPC_PPC_HIR_BUILDER_H_
 
+#include <memory>
+#include <vector>
+
 #include "xenia/base/string_buffer.h"
 #include "xenia/cpu/function.h"
 #include "xenia/cpu/hir/hir_builder.h"
+#include "xenia/cpu/probe.h"
 
 namespace xe {
 namespace cpu {
 namespace ppc {
 
 struct PPCBuiltins;
+struct PPCDecodedCode;
 class PPCFrontend;
 
 class PPCHIRBuilder : public hir::HIRBuilder {
@@ -44,6 +49,32 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   Function* LookupFunction(uint32_t address);
   Label* LookupLabel(uint32_t address);
 
+  // Emits the body of a small leaf function in place of a call to it.
+  // Returns false if the function cannot be inlined and must be called.
+  bool InlineCall(Function* function);
+  // Emits the kernel call of an import thunk in place of a call to the thunk.
+  // Returns false if the function isn't a kernel import thunk.
+  bool InlineImportCall(Function* function);
+  // Emits the whole body of a hot callee in place of a call to it, so that
+  // it is optimized together with the caller. Returns false if the function
+  // cannot be traced and must be called.
+  bool InlineTrace(Function* function, uint32_t call_address);
+
+  // While a callee is inlined into a trace, the callee, the label its returns
+  // branch to and the return address its caller set. Branches leaving the
+  // callee go through EmitTraceExit instead.
+  GuestFunction* trace_function() const { return trace_function_; }
+  Label* trace_return_label() const { return trace_return_label_; }
+  uint32_t trace_return_address() const { return trace_return_address_; }
+
+  // Returns true if the code is an `or rN,rN,rN` thread priority hint the
+  // guest uses to mark busy waits (low priority and the db*cyc delays).
+  static bool IsYieldHint(uint32_t code);
+  // Returns true if the loop from loop_address back to the branch at
+  // branch_address does nothing but poll memory, so it can only exit once
+  // another thread (or the GPU) changes it.
+  bool IsSpinLoop(uint32_t loop_address, uint32_t branch_address);
+
   Value* LoadLR();
   void StoreLR(Value* value);
   Value* LoadCTR();
@@ -83,6 +114,15 @@ class PPCHIRBuilder : public hir::HIRBuilder {
 
  private:
   void MaybeBreakOnInstruction(uint32_t address);
+  // Checks the conditions of the probes at the address inline, calling out
+  // only when they are met.
+  void EmitProbes(uint32_t address);
+  Value* CompareProbeOperands(Probe::CompareOp op, Value* left, Value* right);
+  bool CanInline(GuestFunction* function);
+  bool CanTrace(GuestFunction* function, uint32_t call_address);
+  // Whether the baseline profile says the instruction never ran.
+  bool IsColdInstruction(uint32_t address);
+  void EmitInstruction(uint32_t address, uint32_t offset);
   void AnnotateLabel(uint32_t address, Label* label);
 
   PPCFrontend* frontend_;
@@ -97,6 +137,13 @@ class PPCHIRBuilder : public hir::HIRBuilder {
   uint64_t instr_count_;
   Instr** instr_offset_list_;
   Label** label_list_;
+  // Of the function (or trace) being emitted, if the scanner kept it.
+  std::shared_ptr<const PPCDecodedCode> decoded_code_;
+  GuestFunction* trace_function_;
+  Label* trace_return_label_;
+  uint32_t trace_return_address_;
+  // Within the function.
+  std::vector<Probe> probes_;
 
   // Reset each instruction.
   struct {
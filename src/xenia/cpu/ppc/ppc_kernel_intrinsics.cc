@@ -0,0 +1,176 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/ppc/ppc_kernel_intrinsics.h"
+
+#include <stddef.h>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/export_resolver.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/ppc/ppc_context.h"
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+using namespace xe::cpu::hir;
+
+namespace {
+
+struct KernelIntrinsicName {
+  const char* name;
+  KernelIntrinsic intrinsic;
+};
+const KernelIntrinsicName kKernelIntrinsicNames[] = {
+    {"KfAcquireSpinLock", KernelIntrinsic::kKfAcquireSpinLock},
+    {"KfReleaseSpinLock", KernelIntrinsic::kKfReleaseSpinLock},
+    {"KeAcquireSpinLockAtRaisedIrql",
+     KernelIntrinsic::kKeAcquireSpinLockAtRaisedIrql},
+    {"KeReleaseSpinLockFromRaisedIrql",
+     KernelIntrinsic::kKeReleaseSpinLockFromRaisedIrql},
+    {"InterlockedPushEntrySList", KernelIntrinsic::kInterlockedPushEntrySList},
+    {"InterlockedPopEntrySList", KernelIntrinsic::kInterlockedPopEntrySList},
+    {"InterlockedFlushSList", KernelIntrinsic::kInterlockedFlushSList},
+};
+
+Value* LoadGPR(HIRBuilder& f, uint32_t reg) {
+  return f.LoadContext(offsetof(PPCContext, r) + reg * 8, INT64_TYPE);
+}
+
+void StoreGPR(HIRBuilder& f, uint32_t reg, Value* value) {
+  f.StoreContext(offsetof(PPCContext, r) + reg * 8, value);
+}
+
+// The header as a big-endian number: next << 32 | depth << 16 | sequence.
+Value* LoadSListHeader(HIRBuilder& f, Value* list, Value** out_raw) {
+  *out_raw = f.Load(list, INT64_TYPE);
+  return f.ByteSwap(*out_raw);
+}
+
+}  // namespace
+
+KernelIntrinsic GetKernelIntrinsic(const GuestFunction* function) {
+  auto export_data = function->export_data();
+  if (!FLAGS_inline_kernel_intrinsics || FLAGS_profile_kernel_calls ||
+      !export_data || !function->extern_handler()) {
+    return KernelIntrinsic::kNone;
+  }
+  for (const auto& entry : kKernelIntrinsicNames) {
+    if (!std::strcmp(export_data->name, entry.name)) {
+      return entry.intrinsic;
+    }
+  }
+  return KernelIntrinsic::kNone;
+}
+
+Value* EmitSListPush(HIRBuilder& f, Value* list, Value* entry) {
+  auto retry = f.NewLabel();
+  f.MarkLabel(retry);
+  Value* old_raw;
+  Value* old_header = LoadSListHeader(f, list, &old_raw);
+  Value* old_next = f.Shr(old_header, int8_t(32));
+  f.Store(entry, f.ByteSwap(f.Truncate(old_next, INT32_TYPE)));
+  Value* depth = f.And(f.Add(old_header, f.LoadConstantUint64(0x10000)),
+                       f.LoadConstantUint64(0xFFFF0000));
+  Value* sequence = f.And(f.Add(old_header, f.LoadConstantUint64(1)),
+                          f.LoadConstantUint64(0xFFFF));
+  Value* new_header =
+      f.Or(f.Shl(f.And(entry, f.LoadConstantUint64(0xFFFFFFFF)), int8_t(32)),
+           f.Or(depth, sequence));
+  f.BranchFalse(f.AtomicCompareExchange(list, old_raw, f.ByteSwap(new_header)),
+                retry);
+  return old_next;
+}
+
+Value* EmitSListPop(HIRBuilder& f, Value* list) {
+  auto retry = f.NewLabel();
+  auto end = f.NewLabel();
+  f.MarkLabel(retry);
+  Value* old_raw;
+  Value* old_header = LoadSListHeader(f, list, &old_raw);
+  Value* old_next = f.Shr(old_header, int8_t(32));
+  f.BranchTrue(f.IsFalse(old_next), end);
+  Value* next_next =
+      f.ZeroExtend(f.ByteSwap(f.Load(old_next, INT32_TYPE)), INT64_TYPE);
+  Value* depth = f.And(f.Sub(old_header, f.LoadConstantUint64(0x10000)),
+                       f.LoadConstantUint64(0xFFFF0000));
+  Value* sequence = f.And(old_header, f.LoadConstantUint64(0xFFFF));
+  Value* new_header = f.Or(f.Shl(next_next, int8_t(32)), f.Or(depth, sequence));
+  f.BranchFalse(f.AtomicCompareExchange(list, old_raw, f.ByteSwap(new_header)),
+                retry);
+  f.MarkLabel(end);
+  return old_next;
+}
+
+Value* EmitSListFlush(HIRBuilder& f, Value* list) {
+  auto retry = f.NewLabel();
+  f.MarkLabel(retry);
+  Value* old_raw;
+  Value* old_header = LoadSListHeader(f, list, &old_raw);
+  f.BranchFalse(f.AtomicCompareExchange(list, old_raw, f.LoadZeroInt64()),
+                retry);
+  return f.Shr(old_header, int8_t(32));
+}
+
+void EmitKernelIntrinsic(HIRBuilder& f, KernelIntrinsic intrinsic,
+                         Function* export_function) {
+  switch (intrinsic) {
+    case KernelIntrinsic::kKfAcquireSpinLock:
+    case KernelIntrinsic::kKeAcquireSpinLockAtRaisedIrql: {
+      auto contended = f.NewLabel();
+      auto end = f.NewLabel();
+      f.BranchFalse(f.AtomicCompareExchange(LoadGPR(f, 3), f.LoadZeroInt32(),
+                                            f.LoadConstantUint32(1)),
+                    contended);
+      if (intrinsic == KernelIntrinsic::kKfAcquireSpinLock) {
+        // Returns the old IRQL, raised to DISPATCH.
+        StoreGPR(f, 3,
+                 f.ZeroExtend(
+                     f.LoadContext(offsetof(PPCContext, irql), INT8_TYPE),
+                     INT64_TYPE));
+        f.StoreContext(offsetof(PPCContext, irql), f.LoadConstantUint8(2));
+      }
+      f.Branch(end);
+      f.MarkLabel(contended);
+      f.CallExtern(export_function);
+      f.MarkLabel(end);
+      break;
+    }
+    case KernelIntrinsic::kKfReleaseSpinLock:
+    case KernelIntrinsic::kKeReleaseSpinLockFromRaisedIrql:
+      if (intrinsic == KernelIntrinsic::kKfReleaseSpinLock) {
+        f.StoreContext(offsetof(PPCContext, irql),
+                       f.Truncate(LoadGPR(f, 4), INT8_TYPE));
+      }
+      // Everything done under the lock must be visible before it's free.
+      f.MemoryBarrier();
+      f.Store(LoadGPR(f, 3), f.LoadZeroInt32());
+      break;
+    case KernelIntrinsic::kInterlockedPushEntrySList:
+      StoreGPR(f, 3, EmitSListPush(f, LoadGPR(f, 3), LoadGPR(f, 4)));
+      break;
+    case KernelIntrinsic::kInterlockedPopEntrySList:
+      StoreGPR(f, 3, EmitSListPop(f, LoadGPR(f, 3)));
+      break;
+    case KernelIntrinsic::kInterlockedFlushSList:
+      StoreGPR(f, 3, EmitSListFlush(f, LoadGPR(f, 3)));
+      break;
+    default:
+      assert_unhandled_case(intrinsic);
+      f.CallExtern(export_function);
+      break;
+  }
+}
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
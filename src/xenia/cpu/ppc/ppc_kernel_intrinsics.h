@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PPC_PPC_KERNEL_INTRINSICS_H_
+#define XENIA_CPU_PPC_PPC_KERNEL_INTRINSICS_H_
+
+#include "xenia/cpu/hir/hir_builder.h"
+
+namespace xe {
+namespace cpu {
+class Function;
+class GuestFunction;
+}  // namespace cpu
+}  // namespace xe
+
+namespace xe {
+namespace cpu {
+namespace ppc {
+
+// Kernel exports that are emitted in their import thunks (at the sc) instead
+// of calling into the kernel. They work on the same guest data the same way
+// the exports do, so titles can mix the two freely.
+enum class KernelIntrinsic {
+  kNone,
+  // Spinlocks take the lock word from 0 to 1 in host byte order and keep the
+  // IRQL in PPCContext. A lock already held goes to the export to spin.
+  kKfAcquireSpinLock,
+  kKfReleaseSpinLock,
+  kKeAcquireSpinLockAtRaisedIrql,
+  kKeReleaseSpinLockFromRaisedIrql,
+  // Lock-free X_SLIST_HEADER operations.
+  kInterlockedPushEntrySList,
+  kInterlockedPopEntrySList,
+  kInterlockedFlushSList,
+};
+
+// The intrinsic for an import thunk, if it has one and they are enabled
+// (--inline_kernel_intrinsics).
+KernelIntrinsic GetKernelIntrinsic(const GuestFunction* function);
+
+// Emits the intrinsic with its arguments and result in the guest registers.
+// export_function is called when the intrinsic can't complete by itself.
+void EmitKernelIntrinsic(hir::HIRBuilder& f, KernelIntrinsic intrinsic,
+                         Function* export_function);
+
+// Compare-exchange loops on the 8 bytes of a big-endian X_SLIST_HEADER at the
+// guest address (next, depth, sequence). Each returns the entry that was first
+// in the list, as an INT64 guest address. Pushing bumps the depth and the
+// sequence, popping drops the depth, and flushing clears the header.
+hir::Value* EmitSListPush(hir::HIRBuilder& f, hir::Value* list,
+                          hir::Value* entry);
+hir::Value* EmitSListPop(hir::HIRBuilder& f, hir::Value* list);
+hir::Value* EmitSListFlush(hir::HIRBuilder& f, hir::Value* list);
+
+}  // namespace ppc
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PPC_PPC_KERNEL_INTRINSICS_H_
@@ -15,7 +15,9 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
+#include "xenia/cpu/ppc/ppc_decoded_code.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/processor.h"
@@ -64,6 +66,12 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
   size_t blocks_found = 0;
   bool in_block = false;
   bool starts_with_mfspr_lr = false;
+  bool split = false;
+  auto decoded_code = std::make_shared<PPCDecodedCode>();
+  decoded_code->start_address = start_address;
+  if (end_address >= start_address) {
+    decoded_code->instrs.reserve((end_address - start_address) / 4 + 1);
+  }
   while (true) {
     uint32_t code =
         xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
@@ -78,6 +86,7 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
     }
 
     auto opcode = LookupOpcode(code);
+    decoded_code->instrs.push_back({code, opcode});
 
     PPCDecodeData d;
     d.address = address;
@@ -175,7 +184,8 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
         //   b         KeBugCheck
         // This check may hit on functions that jump over data code, so only
         // trigger this check in leaf functions (no mfspr lr/prolog).
-        if (!ends_fn && !starts_with_mfspr_lr && blocks_found == 1) {
+        if (!ends_fn && !starts_with_mfspr_lr && blocks_found == 1 &&
+            !function->is_split_region()) {
           LOGPPC("HEURISTIC: ending at simple leaf thunk %.8X", address);
           ends_fn = true;
         }
@@ -249,6 +259,20 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
 
     if (ends_block) {
       in_block = false;
+
+      // Cut oversized functions at the first block boundary past the limit
+      // that no forward branch crosses, so that the regions rarely enter each
+      // other anywhere but at their starts. Give up on that at twice the
+      // limit. Everything lives in the context between instructions, so any
+      // boundary is correct.
+      uint32_t max_count = uint32_t(FLAGS_max_guest_function_instructions);
+      uint32_t count = (address - start_address) / 4 + 1;
+      if (!ends_fn && max_count && count >= max_count &&
+          (furthest_target <= address || count >= max_count * 2)) {
+        LOGPPC("function split %.8X (%d instructions)", address, count);
+        ends_fn = true;
+        split = true;
+      }
     }
     if (ends_fn) {
       break;
@@ -272,8 +296,29 @@ bool PPCScanner::Scan(GuestFunction* function, FunctionDebugInfo* debug_info) {
   }
   function->set_end_address(address);
 
-  // If there's spare bits at the end, split the function.
-  // TODO(benvanik): splitting?
+  // The walk may have stopped past the end (on a zero word or overrunning
+  // the expected end), or short of it.
+  if (address >= start_address) {
+    size_t count = (address - start_address) / 4 + 1;
+    decoded_code->instrs.resize(std::min(decoded_code->instrs.size(), count));
+    while (decoded_code->instrs.size() < count) {
+      decoded_code->instrs.push_back(PPCDecodedInstr::Decode(
+          memory,
+          start_address + uint32_t(decoded_code->instrs.size()) * 4));
+    }
+    function->set_decoded_code(std::move(decoded_code));
+  } else {
+    function->set_decoded_code(nullptr);
+  }
+
+  function->set_split(split);
+  if (split) {
+    auto region = frontend_->processor()->LookupFunction(address + 4);
+    if (region && region->is_guest()) {
+      static_cast<GuestFunction*>(region)->set_split_region(true);
+    }
+    XELOGD("Split function %.8X at %.8X", start_address, address + 4);
+  }
 
   // TODO(benvanik): find and record stack information
   // - look for __savegprlr_* and __restgprlr_*
@@ -296,15 +341,16 @@ std::vector<BlockInfo> PPCScanner::FindBlocks(GuestFunction* function) {
 
   uint32_t start_address = function->address();
   uint32_t end_address = function->end_address();
+  auto decoded_code = function->decoded_code();
   bool in_block = false;
   uint32_t block_start = 0;
   for (uint32_t address = start_address; address <= end_address; address += 4) {
-    uint32_t code =
-        xe::load_and_swap<uint32_t>(memory->TranslateVirtual(address));
+    auto instr = PPCDecodedCode::Get(decoded_code.get(), memory, address);
+    uint32_t code = instr.code;
     if (!code) {
       continue;
     }
-    auto opcode = xe::cpu::ppc::LookupOpcode(code);
+    auto opcode = instr.opcode;
 
     if (!in_block) {
       in_block = true;
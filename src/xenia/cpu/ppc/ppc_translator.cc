@@ -18,6 +18,7 @@
 #include "xenia/base/reset_scope.h"
 #include "xenia/cpu/compiler/compiler_passes.h"
 #include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/ppc/ppc_decoded_code.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
 #include "xenia/cpu/ppc/ppc_hir_builder.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
@@ -32,6 +33,16 @@ using xe::cpu::backend::Backend;
 using xe::cpu::compiler::Compiler;
 namespace passes = xe::cpu::compiler::passes;
 
+// Creates the register allocator picked with --register_allocator.
+static std::unique_ptr<compiler::CompilerPass> CreateRegisterAllocationPass(
+    const backend::MachineInfo* machine_info) {
+  if (FLAGS_register_allocator == "linear_scan") {
+    return std::make_unique<passes::LinearScanRegisterAllocationPass>(
+        machine_info);
+  }
+  return std::make_unique<passes::RegisterAllocationPass>(machine_info);
+}
+
 PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   Backend* backend = frontend->processor()->backend();
 
@@ -53,6 +64,11 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::ContextPromotionPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  if (FLAGS_global_context_promotion) {
+    compiler_->AddPass(std::make_unique<passes::GlobalContextPromotionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
 
   // Grouped simplification + constant propagation.
   // Loops until no changes are made.
@@ -63,6 +79,15 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   if (validate) sap->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::move(sap));
 
+  if (FLAGS_loop_invariant_code_motion) {
+    // Simplification changed the blocks, so the CFG has to be rebuilt first.
+    compiler_->AddPass(std::make_unique<passes::ControlFlowAnalysisPass>());
+    compiler_->AddPass(
+        std::make_unique<passes::LoopInvariantCodeMotionPass>());
+    if (validate)
+      compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  }
+
   if (backend->machine_info()->supports_extended_load_store) {
     // Backend supports the advanced LOAD/STORE instructions.
     // These will save us a lot of HIR opcodes.
@@ -73,9 +98,8 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   }
   compiler_->AddPass(std::make_unique<passes::SimplificationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
-  // compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
-  // if (validate)
-  // compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+  compiler_->AddPass(std::make_unique<passes::DeadStoreEliminationPass>());
+  if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
   compiler_->AddPass(std::make_unique<passes::DeadCodeEliminationPass>());
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
@@ -87,12 +111,28 @@ PPCTranslator::PPCTranslator(PPCFrontend* frontend) : frontend_(frontend) {
   // Will modify the HIR to add loads/stores.
   // This should be the last pass before finalization, as after this all
   // registers are assigned and ready to be emitted.
-  compiler_->AddPass(std::make_unique<passes::RegisterAllocationPass>(
-      backend->machine_info()));
+  compiler_->AddPass(CreateRegisterAllocationPass(backend->machine_info()));
   if (validate) compiler_->AddPass(std::make_unique<passes::ValidationPass>());
 
   // Must come last. The HIR is not really HIR after this.
   compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+
+  // Baseline tier for tiered compilation: only what is required to produce
+  // working code, leaving the expensive optimizations for hot functions.
+  if (FLAGS_tiered_compilation) {
+    baseline_compiler_.reset(new Compiler(frontend->processor()));
+    baseline_compiler_->AddPass(
+        std::make_unique<passes::ControlFlowAnalysisPass>());
+    if (validate) {
+      baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    }
+    baseline_compiler_->AddPass(
+        CreateRegisterAllocationPass(backend->machine_info()));
+    if (validate) {
+      baseline_compiler_->AddPass(std::make_unique<passes::ValidationPass>());
+    }
+    baseline_compiler_->AddPass(std::make_unique<passes::FinalizationPass>());
+  }
 }
 
 PPCTranslator::~PPCTranslator() = default;
@@ -104,11 +144,16 @@ bool PPCTranslator::Translate(GuestFunction* function,
   // Reset() all caching when we leave.
   xe::make_reset_scope(builder_);
   xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
   xe::make_reset_scope(assembler_);
   xe::make_reset_scope(&string_buffer_);
 
   // NOTE: we only want to do this when required, as it's expensive to build.
-  if (FLAGS_disassemble_functions) {
+  // Disassembly only wanted for the log isn't kept past the translation.
+  bool log_disasm = FLAGS_disassemble_functions;
+  bool keep_disasm =
+      (debug_info_flags & DebugInfoFlags::kDebugInfoAllDisasm) != 0;
+  if (log_disasm) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoAllDisasm;
   }
   if (FLAGS_trace_functions) {
@@ -123,14 +168,51 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (FLAGS_trace_function_data) {
     debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionData;
   }
+  if (!FLAGS_trace_function_records_path.empty()) {
+    debug_info_flags |= DebugInfoFlags::kDebugInfoTraceFunctionRecords;
+  }
+
+  // Previously generated code can be reused as-is when no debug info,
+  // tracing or probes are needed.
+  // Once the guest has made read-only data writable, the constants folded
+  // into persisted code can't be trusted.
+  auto processor = frontend_->processor();
+  if (!debug_info_flags && !processor->constant_data_modified() &&
+      !processor->HasProbesInRange(function->address(),
+                                   function->end_address()) &&
+      processor->backend()->RestorePersistentFunction(function)) {
+    function->set_tier(GuestFunction::Tier::kOptimized);
+    // Which pages the code depends on wasn't persisted.
+    processor->AddConstantDataDependency(function, {});
+    return true;
+  }
+
+  // New functions start at the baseline tier and are retranslated at the
+  // optimized tier once hot. Debugging features always get full optimization
+  // so that what is inspected is what runs.
+  Compiler* compiler = compiler_.get();
+  if (baseline_compiler_ && !debug_info_flags &&
+      function->tier() == GuestFunction::Tier::kBaseline) {
+    compiler = baseline_compiler_.get();
+    function->set_tier_up_countdown(FLAGS_tier_up_call_count);
+  } else {
+    function->set_tier(GuestFunction::Tier::kOptimized);
+  }
+
   std::unique_ptr<FunctionDebugInfo> debug_info;
   if (debug_info_flags) {
     debug_info.reset(new FunctionDebugInfo());
   }
 
-  // Scan the function to find its extents and gather debug data.
-  if (!scanner_->Scan(function, debug_info.get())) {
-    return false;
+  // Scan the function to find its extents and gather debug data. Retiering
+  // reuses the instructions decoded by the first scan (and its extents and
+  // split), as long as the code hasn't been invalidated since.
+  auto decoded_code = function->decoded_code();
+  if (debug_info || !decoded_code ||
+      !decoded_code->Covers(function->address(), function->end_address())) {
+    if (!scanner_->Scan(function, debug_info.get())) {
+      return false;
+    }
   }
 
   // Setup trace data, if needed.
@@ -141,6 +223,8 @@ bool PPCTranslator::Translate(GuestFunction* function,
       // Additional space for instruction coverage counts.
       trace_data_size += FunctionTraceData::SizeOfInstructionCounts(
           function->address(), function->end_address());
+      trace_data_size += FunctionTraceData::SizeOfInlineCacheCounts(
+          function->address(), function->end_address());
     }
     uint8_t* trace_data =
         frontend_->processor()->AllocateFunctionTraceData(trace_data_size);
@@ -169,6 +253,11 @@ bool PPCTranslator::Translate(GuestFunction* function,
   if (!builder_->Emit(function, emit_flags)) {
     return false;
   }
+  if (stats_) {
+    *stats_ = Stats();
+    stats_->compiler = compiler;
+    GatherStats(false);
+  }
 
   // Stash raw HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
@@ -178,9 +267,12 @@ bool PPCTranslator::Translate(GuestFunction* function,
   }
 
   // Compile/optimize/etc.
-  if (!compiler_->Compile(builder_.get())) {
+  if (!compiler->Compile(builder_.get())) {
     return false;
   }
+  if (stats_) {
+    GatherStats(true);
+  }
 
   // Stash optimized HIR.
   if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
@@ -194,10 +286,98 @@ bool PPCTranslator::Translate(GuestFunction* function,
                             std::move(debug_info))) {
     return false;
   }
+  if (log_disasm) {
+    function->debug_info()->Dump();
+    if (!keep_disasm) {
+      function->debug_info()->ClearDisasm();
+    }
+  }
+  if (!builder_->constant_data_pages().empty()) {
+    processor->AddConstantDataDependency(function,
+                                         builder_->constant_data_pages());
+  }
 
   return true;
 }
 
+bool PPCTranslator::Disassemble(GuestFunction* function,
+                                uint32_t debug_info_flags,
+                                FunctionDebugInfo* debug_info) {
+  SCOPE_profile_cpu_f("cpu");
+
+  xe::make_reset_scope(builder_);
+  xe::make_reset_scope(compiler_);
+  xe::make_reset_scope(baseline_compiler_);
+  xe::make_reset_scope(&string_buffer_);
+
+  if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmSource) {
+    DumpSource(function, &string_buffer_);
+    debug_info->set_source_disasm(string_buffer_.ToString());
+    string_buffer_.Reset();
+  }
+
+  if (debug_info_flags & (DebugInfoFlags::kDebugInfoDisasmRawHir |
+                          DebugInfoFlags::kDebugInfoDisasmHir)) {
+    if (!builder_->Emit(function, PPCHIRBuilder::EMIT_DEBUG_COMMENTS)) {
+      return false;
+    }
+    if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmRawHir) {
+      builder_->Dump(&string_buffer_);
+      debug_info->set_raw_hir_disasm(string_buffer_.ToString());
+      string_buffer_.Reset();
+    }
+    if (debug_info_flags & DebugInfoFlags::kDebugInfoDisasmHir) {
+      Compiler* compiler = compiler_.get();
+      if (baseline_compiler_ &&
+          function->tier() == GuestFunction::Tier::kBaseline) {
+        compiler = baseline_compiler_.get();
+      }
+      if (!compiler->Compile(builder_.get())) {
+        return false;
+      }
+      builder_->Dump(&string_buffer_);
+      debug_info->set_hir_disasm(string_buffer_.ToString());
+      string_buffer_.Reset();
+    }
+  }
+
+  if ((debug_info_flags & DebugInfoFlags::kDebugInfoDisasmMachineCode) &&
+      function->machine_code()) {
+    assembler_->DumpMachineCode(function, &string_buffer_);
+    debug_info->set_machine_code_disasm(string_buffer_.ToString());
+    string_buffer_.Reset();
+  }
+
+  return true;
+}
+
+void PPCTranslator::GatherStats(bool after_compile) {
+  size_t instr_count = 0;
+  for (auto block = builder_->first_block(); block; block = block->next) {
+    for (auto instr = block->instr_head; instr; instr = instr->next) {
+      switch (instr->opcode->num) {
+        case hir::OPCODE_COMMENT:
+        case hir::OPCODE_SOURCE_OFFSET:
+          continue;
+        case hir::OPCODE_STORE_LOCAL:
+          stats_->spill_count += after_compile ? 1 : 0;
+          break;
+        case hir::OPCODE_LOAD_LOCAL:
+          stats_->reload_count += after_compile ? 1 : 0;
+          break;
+        default:
+          break;
+      }
+      ++instr_count;
+    }
+  }
+  if (after_compile) {
+    stats_->hir_instr_count_out = instr_count;
+  } else {
+    stats_->hir_instr_count_in = instr_count;
+  }
+}
+
 void PPCTranslator::DumpSource(GuestFunction* function,
                                StringBuffer* string_buffer) {
   Memory* memory = frontend_->memory();
@@ -31,17 +31,43 @@ class PPCTranslator {
   ~PPCTranslator();
 
   bool Translate(GuestFunction* function, uint32_t debug_info_flags);
+  // Regenerates the kDebugInfoDisasm parts of debug_info_flags for a defined
+  // function into debug_info, without touching its code. The HIR is compiled
+  // again at the tier of the current code.
+  bool Disassemble(GuestFunction* function, uint32_t debug_info_flags,
+                   FunctionDebugInfo* debug_info);
+
+  // Measurements of the last Translate, for offline tools.
+  struct Stats {
+    // Compiler that ran; pass_ticks() is only filled if the tool enabled it.
+    compiler::Compiler* compiler = nullptr;
+    // HIR instructions (excluding comments and source markers) as emitted
+    // and as handed to the assembler.
+    size_t hir_instr_count_in = 0;
+    size_t hir_instr_count_out = 0;
+    // Stores to and loads from stack slots added by register allocation.
+    size_t spill_count = 0;
+    size_t reload_count = 0;
+  };
+  // Stats are collected only when a destination is set.
+  void set_stats(Stats* stats) { stats_ = stats; }
+
+  compiler::Compiler* compiler() const { return compiler_.get(); }
 
  private:
   void DumpSource(GuestFunction* function, StringBuffer* string_buffer);
+  void GatherStats(bool after_compile);
 
   PPCFrontend* frontend_;
   std::unique_ptr<PPCScanner> scanner_;
   std::unique_ptr<PPCHIRBuilder> builder_;
   std::unique_ptr<compiler::Compiler> compiler_;
+  // Only created when tiered compilation is enabled.
+  std::unique_ptr<compiler::Compiler> baseline_compiler_;
   std::unique_ptr<backend::Assembler> assembler_;
 
   StringBuffer string_buffer_;
+  Stats* stats_ = nullptr;
 };
 
 }  // namespace ppc
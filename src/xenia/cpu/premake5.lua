@@ -9,6 +9,7 @@ project("xenia-cpu")
   links({
     "xenia-base",
     "mspack",
+    "xxhash",
   })
   includedirs({
     project_root.."/third_party/llvm/include",
@@ -20,6 +21,79 @@ project("xenia-cpu")
   local_platform_files("compiler/passes")
   local_platform_files("hir")
   local_platform_files("ppc")
+  removefiles({"function_replay_main.cc"})
+  removefiles({"jit_bench_main.cc"})
+  removefiles({"trace_dump_main.cc"})
+
+project("xenia-cpu-jit-bench")
+  uuid("6b4c5f0e-2d53-4b8e-9a5c-3f1e7d2a9c41")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "xenia-cpu-backend-x64",
+    "xenia-cpu",
+    "xenia-base",
+    "gflags",
+    "capstone", -- cpu-backend-x64
+    "mspack",
+    "xxhash",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "jit_bench_main.cc",
+    project_root.."/src/xenia/base/main_"..platform_suffix..".cc",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
+  filter({})
+
+project("xenia-cpu-replay")
+  uuid("8d2f6b3a-41c7-4e9d-b5a8-2e7c0f9d3b16")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "xenia-cpu-backend-x64",
+    "xenia-cpu",
+    "xenia-base",
+    "gflags",
+    "capstone", -- cpu-backend-x64
+    "mspack",
+    "xxhash",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "function_replay_main.cc",
+    project_root.."/src/xenia/base/main_"..platform_suffix..".cc",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
+  filter({})
+
+project("xenia-cpu-trace-dump")
+  uuid("c3e8a1d4-7f26-4b95-8e0a-5d2b9f4c6a17")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "xenia-base",
+    "gflags",
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "trace_dump_main.cc",
+    project_root.."/src/xenia/base/main_"..platform_suffix..".cc",
+  })
+  filter("platforms:Windows")
+    -- xenia-base needs this
+    links({"xenia-ui"})
+  filter({})
 
 include("testing")
 include("ppc/testing")
@@ -0,0 +1,65 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/probe.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/platform.h"
+
+namespace xe {
+namespace cpu {
+
+Probe::Probe(Action action, uint32_t guest_address, const Condition& condition,
+             HitCallback hit_callback)
+    : action_(action),
+      guest_address_(guest_address),
+      condition_(condition),
+      hit_callback_(std::move(hit_callback)) {}
+
+bool Probe::ParseCompareOp(const char* name, CompareOp* out_op) {
+  static const struct {
+    const char* name;
+    CompareOp op;
+  } kOps[] = {
+      {"eq", CompareOp::kEq},   {"ne", CompareOp::kNe},
+      {"slt", CompareOp::kSlt}, {"sle", CompareOp::kSle},
+      {"sgt", CompareOp::kSgt}, {"sge", CompareOp::kSge},
+      {"ult", CompareOp::kUlt}, {"ule", CompareOp::kUle},
+      {"ugt", CompareOp::kUgt}, {"uge", CompareOp::kUge},
+  };
+  for (auto& entry : kOps) {
+    if (strcasecmp(name, entry.name) == 0) {
+      *out_op = entry.op;
+      return true;
+    }
+  }
+  return false;
+}
+
+void Probe::set_logged_gprs(std::vector<uint32_t> gprs) {
+  assert_true(gprs.size() <= kMaxLoggedGprs);
+  gprs.resize(std::min(gprs.size(), kMaxLoggedGprs));
+  logged_gprs_ = std::move(gprs);
+}
+
+std::vector<ProbeTraceEntry> ProbeTraceBuffer::Read() const {
+  std::vector<ProbeTraceEntry> entries;
+  uint64_t count = std::min(append_count_, uint64_t(kEntryCount));
+  entries.reserve(size_t(count));
+  for (uint64_t i = append_count_ - count; i < append_count_; ++i) {
+    entries.push_back(entries_[i % kEntryCount]);
+  }
+  return entries;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,145 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_PROBE_H_
+#define XENIA_CPU_PROBE_H_
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace xe {
+namespace cpu {
+
+struct ThreadDebugInfo;
+
+// A conditional breakpoint or tracepoint compiled into the code of the guest
+// functions containing its address when they are next translated. The
+// condition is checked inline, so only hits meeting it leave the generated
+// code: breakpoints then pause execution as Breakpoint does, tracepoints
+// append to the trace of the thread without stopping it, and captures write
+// a FunctionCapture of the first hit.
+class Probe {
+ public:
+  enum class Action {
+    kBreak,
+    kTrace,
+    kCapture,
+  };
+  enum class OperandType {
+    // Always met.
+    kNone,
+    // A GPR, by index.
+    kGpr,
+    // The big-endian word at a guest virtual address.
+    kMemory,
+  };
+  enum class CompareOp {
+    kEq,
+    kNe,
+    kSlt,
+    kSle,
+    kSgt,
+    kSge,
+    kUlt,
+    kUle,
+    kUgt,
+    kUge,
+  };
+  struct Condition {
+    OperandType operand_type = OperandType::kNone;
+    // GPR index or guest address.
+    uint32_t operand = 0;
+    CompareOp op = CompareOp::kEq;
+    uint64_t value = 0;
+    // Compares only the low 32 bits of GPRs. Memory words always are.
+    bool truncate = true;
+  };
+  typedef std::function<void(Probe*, ThreadDebugInfo*)> HitCallback;
+
+  // GPRs recorded by each tracepoint hit.
+  static const size_t kMaxLoggedGprs = 4;
+  // Trap type of the compiled breaks, outside of the PPC trap conditions.
+  static const uint16_t kBreakTrapType = 0x100;
+
+  // Everything but the hit callback is compiled into the code, and can't
+  // change once the probe is added to the processor.
+  Probe(Action action, uint32_t guest_address, const Condition& condition,
+        HitCallback hit_callback = nullptr);
+
+  // Parses eq, ne, slt, sle, sgt, sge, ult, ule, ugt or uge.
+  static bool ParseCompareOp(const char* name, CompareOp* out_op);
+
+  // Assigned by Processor::AddProbe, 0 until then.
+  uint32_t id() const { return id_; }
+  Action action() const { return action_; }
+  uint32_t guest_address() const { return guest_address_; }
+  const Condition& condition() const { return condition_; }
+
+  // Hits meeting the condition before the target are only counted, so that
+  // only the Nth and later ones break or trace.
+  uint64_t hit_count_target() const { return hit_count_target_; }
+  void set_hit_count_target(uint64_t target) { hit_count_target_ = target; }
+  // Hits meeting the condition so far. Guarded by the processor.
+  uint64_t hit_count() const { return hit_count_; }
+
+  const std::vector<uint32_t>& logged_gprs() const { return logged_gprs_; }
+  // Up to kMaxLoggedGprs, recorded by tracepoints.
+  void set_logged_gprs(std::vector<uint32_t> gprs);
+
+ private:
+  friend class Processor;
+
+  uint32_t id_ = 0;
+  Action action_;
+  uint32_t guest_address_;
+  Condition condition_;
+  uint64_t hit_count_target_ = 0;
+  uint64_t hit_count_ = 0;
+  std::vector<uint32_t> logged_gprs_;
+  HitCallback hit_callback_;
+};
+
+// A tracepoint hit.
+struct ProbeTraceEntry {
+  uint32_t probe_id;
+  uint32_t guest_address;
+  uint64_t hit_count;
+  // Clock::QueryHostTickCount value.
+  uint64_t host_ticks;
+  uint32_t gpr_count;
+  uint64_t gprs[Probe::kMaxLoggedGprs];
+};
+
+// The latest tracepoint hits of a thread, overwriting the oldest ones once
+// full. Guarded by the processor.
+class ProbeTraceBuffer {
+ public:
+  static const size_t kEntryCount = 1024;
+
+  ProbeTraceBuffer() : entries_(kEntryCount) {}
+
+  void Append(const ProbeTraceEntry& entry) {
+    entries_[append_count_ % kEntryCount] = entry;
+    ++append_count_;
+  }
+  // Oldest first.
+  std::vector<ProbeTraceEntry> Read() const;
+  // Including the overwritten ones.
+  uint64_t append_count() const { return append_count_; }
+
+ private:
+  std::vector<ProbeTraceEntry> entries_;
+  uint64_t append_count_ = 0;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_PROBE_H_
@@ -11,10 +11,13 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/atomic.h"
 #include "xenia/base/byte_order.h"
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/debugging.h"
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
@@ -24,6 +27,7 @@
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/cpu_flags.h"
 #include "xenia/cpu/export_resolver.h"
+#include "xenia/cpu/function_capture.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
@@ -81,6 +85,22 @@ Processor::Processor(xe::Memory* memory, ExportResolver* export_resolver)
     : memory_(memory), export_resolver_(export_resolver) {}
 
 Processor::~Processor() {
+  Metrics::RemoveCollector(CollectMetricsThunk, this);
+
+  if (guest_profiler_) {
+    guest_profiler_->Shutdown();
+    guest_profiler_->WriteFoldedStacks(
+        xe::to_wstring(FLAGS_guest_profile_path));
+    guest_profiler_.reset();
+  }
+
+  // Workers may be in the middle of translating, so stop them before tearing
+  // down anything they touch.
+  if (translation_worker_pool_) {
+    translation_worker_pool_->Shutdown();
+    translation_worker_pool_.reset();
+  }
+
   {
     auto global_lock = global_critical_region_.Acquire();
     modules_.clear();
@@ -93,6 +113,10 @@ Processor::~Processor() {
     functions_trace_file_->Flush();
     functions_trace_file_.reset();
   }
+  if (function_trace_recorder_) {
+    function_trace_recorder_->Shutdown();
+    function_trace_recorder_.reset();
+  }
 }
 
 bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
@@ -126,6 +150,13 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
   backend_ = std::move(backend);
   frontend_ = std::move(frontend);
 
+  translation_worker_pool_ = std::make_unique<TranslationWorkerPool>(this);
+  if (FLAGS_translation_worker_count > 0) {
+    translation_worker_pool_->Start(
+        uint32_t(FLAGS_translation_worker_count));
+  }
+  Metrics::AddCollector(CollectMetricsThunk, this);
+
   // Stack walker is used when profiling, debugging, and dumping.
   // Note that creation may fail, in which case we'll have to disable those
   // features.
@@ -138,12 +169,35 @@ bool Processor::Setup(std::unique_ptr<backend::Backend> backend) {
     }
   }
 
+  if (!FLAGS_guest_profile_path.empty()) {
+    if (stack_walker_) {
+      guest_profiler_ = std::make_unique<GuestProfiler>(this);
+      guest_profiler_->Start(
+          std::chrono::microseconds(FLAGS_guest_profile_interval_us));
+    } else {
+      XELOGW("Disabling guest profiler due to lack of stack walker");
+    }
+  }
+
   // Open the trace data path, if requested.
   functions_trace_path_ = xe::to_wstring(FLAGS_trace_function_data_path);
   if (!functions_trace_path_.empty()) {
     functions_trace_file_ = ChunkedMappedMemoryWriter::Open(
         functions_trace_path_, 32 * 1024 * 1024, true);
   }
+  if (!FLAGS_trace_function_records_path.empty()) {
+    function_trace_recorder_ = FunctionTraceRecorder::Create(
+        xe::to_wstring(FLAGS_trace_function_records_path),
+        FLAGS_trace_function_records_gprs);
+  }
+
+  if (FLAGS_capture_function) {
+    capture_probe_ = std::make_unique<Probe>(
+        Probe::Action::kCapture, uint32_t(FLAGS_capture_function),
+        Probe::Condition());
+    capture_probe_->set_hit_count_target(FLAGS_capture_function_hit);
+    AddProbe(capture_probe_.get());
+  }
 
   return true;
 }
@@ -216,9 +270,30 @@ std::vector<Function*> Processor::FindFunctionsWithAddress(uint32_t address) {
 }
 
 Function* Processor::ResolveFunction(uint32_t address) {
+  if (!translation_worker_pool_ || !translation_worker_pool_->is_running()) {
+    return ResolveFunction(address, nullptr);
+  }
+  // Track how long guest threads are held up by translation, as that is what
+  // the background workers are trying to hide.
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  bool stalled = false;
+  auto function = ResolveFunction(address, &stalled);
+  if (stalled) {
+    uint64_t elapsed_ticks = Clock::QueryHostTickCount() - start_ticks;
+    translation_worker_pool_->RecordStall(elapsed_ticks * 1000000 /
+                                          Clock::host_tick_frequency());
+  }
+  return function;
+}
+
+Function* Processor::ResolveFunction(uint32_t address, bool* out_stalled) {
   Entry* entry;
-  Entry::Status status = entry_table_.GetOrCreate(address, &entry);
+  Entry::Status status =
+      entry_table_.GetOrCreate(address, &entry, out_stalled);
   if (status == Entry::STATUS_NEW) {
+    if (out_stalled) {
+      *out_stalled = true;
+    }
     // Needs to be generated. We have the 'lock' on it and must do so now.
 
     // Grab symbol declaration.
@@ -245,6 +320,77 @@ Function* Processor::ResolveFunction(uint32_t address) {
   }
 }
 
+void Processor::QueueFunctionTranslation(uint32_t address, int32_t priority) {
+  if (translation_worker_pool_) {
+    translation_worker_pool_->Enqueue(address, priority);
+  }
+}
+
+bool Processor::PrecompileFunction(uint32_t address,
+                                   std::vector<uint32_t>* out_call_targets) {
+  auto function = ResolveFunction(address, nullptr);
+  if (!function || !function->is_guest()) {
+    return false;
+  }
+  auto guest_function = static_cast<GuestFunction*>(function);
+  if (guest_function->extern_handler()) {
+    return true;
+  }
+
+  // Pick out direct calls (bl/bla) so their targets can be translated next.
+  for (uint32_t pc = function->address(); pc <= function->end_address();
+       pc += 4) {
+    uint32_t code = xe::load_and_swap<uint32_t>(memory_->TranslateVirtual(pc));
+    if ((code >> 26) != 18 || !(code & 1)) {
+      continue;
+    }
+    int32_t offset = int32_t(code & 0x03FFFFFC);
+    if (offset & 0x02000000) {
+      offset |= 0xFC000000;
+    }
+    uint32_t target = (code & 2) ? uint32_t(offset) : pc + offset;
+    out_call_targets->push_back(target);
+  }
+  return true;
+}
+
+void Processor::TierUpFunction(GuestFunction* function) {
+  if (!function->BeginTierUp()) {
+    return;
+  }
+  if (translation_worker_pool_ && translation_worker_pool_->is_running()) {
+    translation_worker_pool_->EnqueueTierUp(function);
+  } else {
+    RecompileFunction(function);
+  }
+}
+
+bool Processor::RecompileFunction(GuestFunction* function) {
+  // The baseline code stays valid (and in use by anything already running it)
+  // until the new code is swapped into the indirection table.
+  function->set_tier(GuestFunction::Tier::kOptimized);
+  if (!frontend_->DefineFunction(function, debug_info_flags_)) {
+    XELOGE("Failed to recompile function %.8X at the optimized tier",
+           function->address());
+    return false;
+  }
+  return true;
+}
+
+std::unique_ptr<FunctionDebugInfo> Processor::DisassembleFunction(
+    GuestFunction* function, uint32_t debug_info_flags) {
+  if (function->status() != Symbol::Status::kDefined) {
+    return nullptr;
+  }
+  auto debug_info = std::make_unique<FunctionDebugInfo>();
+  if (!frontend_->DisassembleFunction(function, debug_info_flags,
+                                      debug_info.get())) {
+    XELOGE("Failed to disassemble function %.8X", function->address());
+    return nullptr;
+  }
+  return debug_info;
+}
+
 Function* Processor::LookupFunction(uint32_t address) {
   // TODO(benvanik): fast reject invalid addresses/log errors.
 
@@ -303,6 +449,10 @@ bool Processor::DemandFunction(Function* function) {
     // Before we give the symbol back to the rest, let the debugger know.
     OnFunctionDefined(function);
 
+    if (FLAGS_invalidate_modified_code) {
+      WatchFunctionCode(static_cast<GuestFunction*>(function));
+    }
+
     function->set_status(Symbol::Status::kDefined);
     symbol_status = function->status();
   }
@@ -315,6 +465,135 @@ bool Processor::DemandFunction(Function* function) {
   return true;
 }
 
+void Processor::InvalidateCodeRange(uint32_t guest_low, uint32_t guest_high) {
+  auto global_lock = global_critical_region_.Acquire();
+
+  // The pages are going away (or being replaced), so stop watching them.
+  for (auto it = code_watches_.begin(); it != code_watches_.end();) {
+    if (it->first >= guest_low && it->first < guest_high) {
+      memory_->CancelAccessWatch(it->second);
+      it = code_watches_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+
+  InvalidateFunctions(entry_table_.Invalidate(guest_low, guest_high));
+}
+
+void Processor::AddConstantDataDependency(GuestFunction* function,
+                                          const std::vector<uint32_t>& pages) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (pages.empty()) {
+    unscoped_constant_data_dependents_.push_back(function);
+    return;
+  }
+  for (uint32_t page : pages) {
+    auto& dependents = constant_data_dependents_[page];
+    if (std::find(dependents.begin(), dependents.end(), function) ==
+        dependents.end()) {
+      dependents.push_back(function);
+    }
+  }
+}
+
+void Processor::OnGuestProtectionChanged(uint32_t address, uint32_t size,
+                                         uint32_t protect) {
+  if (!(protect & kMemoryProtectWrite)) {
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  std::vector<Function*> functions;
+  for (auto it = constant_data_dependents_.begin();
+       it != constant_data_dependents_.end();) {
+    // Pages are recorded at the guest heap page size so they may start before
+    // the range that changed.
+    auto heap = memory_->LookupHeap(it->first);
+    uint32_t page_size = heap ? heap->page_size() : 4096;
+    if (it->first + page_size > address && it->first < address + size) {
+      functions.insert(functions.end(), it->second.begin(), it->second.end());
+      it = constant_data_dependents_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  if (functions.empty()) {
+    return;
+  }
+
+  XELOGCPU("Read-only guest data %.8X-%.8X made writable, invalidating %d "
+           "functions",
+           address, address + size, int(functions.size()));
+  constant_data_modified_ = true;
+  functions.insert(functions.end(), unscoped_constant_data_dependents_.begin(),
+                   unscoped_constant_data_dependents_.end());
+  unscoped_constant_data_dependents_.clear();
+  for (auto function : functions) {
+    uint32_t guest_address = function->address();
+    InvalidateFunctions(
+        entry_table_.Invalidate(guest_address, guest_address + 1));
+  }
+}
+
+void Processor::InvalidateFunctions(const std::vector<Function*>& functions) {
+  for (auto function : functions) {
+    if (!function->is_guest()) {
+      continue;
+    }
+    auto guest_function = static_cast<GuestFunction*>(function);
+    if (guest_function->extern_handler()) {
+      // Not backed by guest code.
+      continue;
+    }
+    // Let the next DemandFunction define it again. This must happen before
+    // anything can resolve the function, which the global lock ensures.
+    guest_function->set_status(Symbol::Status::kDeclared);
+    guest_function->set_decoded_code(nullptr);
+    backend_->InvalidateFunction(guest_function);
+  }
+}
+
+void Processor::WatchFunctionCode(GuestFunction* function) {
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  uint32_t first_page = function->address() & ~(page_size - 1);
+  uint32_t last_page = function->end_address() & ~(page_size - 1);
+
+  auto global_lock = global_critical_region_.Acquire();
+  for (uint32_t page = first_page; page <= last_page; page += page_size) {
+    if (code_watches_.count(page)) {
+      continue;
+    }
+    auto data = reinterpret_cast<void*>(uintptr_t(page));
+    uintptr_t watch;
+    if (page < 0xA0000000) {
+      watch = memory_->AddVirtualAccessWatch(
+          page, page_size, cpu::MMIOHandler::kWatchWrite,
+          CodeWriteCallbackThunk, this, data);
+    } else {
+      watch = memory_->AddPhysicalAccessWatch(
+          page, page_size, cpu::MMIOHandler::kWatchWrite,
+          CodeWriteCallbackThunk, this, data);
+    }
+    code_watches_[page] = watch;
+  }
+}
+
+void Processor::CodeWriteCallbackThunk(void* context_ptr, void* data_ptr,
+                                       uint32_t address) {
+  // Called on the writing thread with the global lock held, before the write
+  // is retried. The watch is one-shot and removed by the handler; functions
+  // rewatch their pages when they are retranslated.
+  auto processor = reinterpret_cast<Processor*>(context_ptr);
+  uint32_t page = uint32_t(reinterpret_cast<uintptr_t>(data_ptr));
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  XELOGCPU("Guest code page %.8X modified, invalidating translations", page);
+
+  auto global_lock = processor->global_critical_region_.Acquire();
+  processor->code_watches_.erase(page);
+  processor->InvalidateFunctions(
+      processor->entry_table_.Invalidate(page, page + page_size));
+}
+
 bool Processor::Execute(ThreadState* thread_state, uint32_t address) {
   SCOPE_profile_cpu_f("cpu");
 
@@ -433,6 +712,17 @@ void Processor::LowerIrql(Irql old_value) {
 
 bool Processor::Save(ByteStream* stream) {
   stream->Write('PROC');
+
+  std::vector<uint32_t> addresses;
+  for (auto function : entry_table_.FindReady()) {
+    if (function->is_guest() &&
+        !static_cast<GuestFunction*>(function)->extern_handler()) {
+      addresses.push_back(function->address());
+    }
+  }
+  std::sort(addresses.begin(), addresses.end());
+  stream->Write(uint32_t(addresses.size()));
+  stream->WriteArray(addresses.data(), addresses.size());
   return true;
 }
 
@@ -442,7 +732,13 @@ bool Processor::Restore(ByteStream* stream) {
     return false;
   }
 
+  // Nothing can be translated until the modules are restored.
+  restored_function_addresses_.resize(stream->Read<uint32_t>());
+  stream->ReadArray(restored_function_addresses_.data(),
+                    restored_function_addresses_.size());
+
   // Clear cached thread data for zombie threads.
+  auto debugger_lock = debugger_lock_.Acquire();
   std::vector<uint32_t> to_delete;
   for (auto& it : thread_debug_infos_) {
     if (it.second->state == ThreadDebugInfo::State::kZombie) {
@@ -456,6 +752,31 @@ bool Processor::Restore(ByteStream* stream) {
   return true;
 }
 
+void Processor::TranslateRestoredFunctions() {
+  std::vector<uint32_t> addresses;
+  std::swap(addresses, restored_function_addresses_);
+  if (addresses.empty() || !translation_worker_pool_ ||
+      !translation_worker_pool_->is_running()) {
+    return;
+  }
+  // The list is the whole working set already, so their calls aren't chased.
+  for (uint32_t address : addresses) {
+    translation_worker_pool_->Enqueue(
+        address, TranslationWorkerPool::kPriorityRestore, false);
+  }
+  if (FLAGS_restore_translation_wait_ms <= 0) {
+    return;
+  }
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  bool idle = translation_worker_pool_->WaitForIdle(
+      std::chrono::milliseconds(FLAGS_restore_translation_wait_ms));
+  uint64_t elapsed_ms = (Clock::QueryHostTickCount() - start_ticks) * 1000 /
+                        Clock::host_tick_frequency();
+  XELOGI("Waited %dms for the %d functions of the restored state%s",
+         int(elapsed_ms), int(addresses.size()),
+         idle ? "" : ", resuming before they were all translated");
+}
+
 uint8_t* Processor::AllocateFunctionTraceData(size_t size) {
   if (!functions_trace_file_) {
     return nullptr;
@@ -464,7 +785,9 @@ uint8_t* Processor::AllocateFunctionTraceData(size_t size) {
 }
 
 void Processor::OnFunctionDefined(Function* function) {
+  symbol_index_.Add(function);
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   for (auto breakpoint : breakpoints_) {
     if (breakpoint->address_type() == Breakpoint::AddressType::kGuest) {
       if (function->ContainsAddress(breakpoint->guest_address())) {
@@ -478,7 +801,7 @@ void Processor::OnFunctionDefined(Function* function) {
 
 void Processor::OnThreadCreated(uint32_t thread_handle,
                                 ThreadState* thread_state, Thread* thread) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   auto thread_info = std::make_unique<ThreadDebugInfo>();
   thread_info->thread_handle = thread_handle;
   thread_info->thread_id = thread_state->thread_id();
@@ -489,7 +812,7 @@ void Processor::OnThreadCreated(uint32_t thread_handle,
 }
 
 void Processor::OnThreadExit(uint32_t thread_id) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   auto it = thread_debug_infos_.find(thread_id);
   assert_true(it != thread_debug_infos_.end());
   auto thread_info = it->second.get();
@@ -497,7 +820,7 @@ void Processor::OnThreadExit(uint32_t thread_id) {
 }
 
 void Processor::OnThreadDestroyed(uint32_t thread_id) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   auto it = thread_debug_infos_.find(thread_id);
   assert_true(it != thread_debug_infos_.end());
   auto thread_info = it->second.get();
@@ -505,26 +828,56 @@ void Processor::OnThreadDestroyed(uint32_t thread_id) {
   thread_info->thread = nullptr;
 }
 
-void Processor::OnThreadEnteringWait(uint32_t thread_id) {
-  auto global_lock = global_critical_region_.Acquire();
+void Processor::OnThreadEnteringWait(uint32_t thread_id,
+                                     uint32_t object_handle) {
+  auto debugger_lock = debugger_lock_.Acquire();
   auto it = thread_debug_infos_.find(thread_id);
   assert_true(it != thread_debug_infos_.end());
   auto thread_info = it->second.get();
   thread_info->state = ThreadDebugInfo::State::kWaiting;
+  thread_info->wait_object_handle = object_handle;
+  thread_info->wait_start_tick = Clock::QueryHostTickCount();
 }
 
 void Processor::OnThreadLeavingWait(uint32_t thread_id) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   auto it = thread_debug_infos_.find(thread_id);
   assert_true(it != thread_debug_infos_.end());
   auto thread_info = it->second.get();
   if (thread_info->state == ThreadDebugInfo::State::kWaiting) {
     thread_info->state = ThreadDebugInfo::State::kAlive;
   }
+  ++thread_info->wait_count;
+  thread_info->blocked_ticks +=
+      Clock::QueryHostTickCount() - thread_info->wait_start_tick;
+  thread_info->wait_object_handle = 0;
+}
+
+void Processor::CollectMetricsThunk(MetricsWriter* writer, void* data) {
+  auto processor = reinterpret_cast<Processor*>(data);
+  auto stats = processor->translation_worker_pool_->QueryStats();
+  writer->Gauge("xenia_jit_queue_depth",
+                "Guest functions waiting for a translation worker.",
+                stats.queue_depth);
+  writer->Counter("xenia_jit_queued_total",
+                  "Guest functions queued for background translation.",
+                  double(stats.queued_count));
+  writer->Counter("xenia_jit_translated_total",
+                  "Guest functions translated by the workers.",
+                  double(stats.translated_count));
+  writer->Counter("xenia_jit_tier_up_total",
+                  "Hot guest functions recompiled at the optimized tier.",
+                  double(stats.tier_up_count));
+  writer->Counter("xenia_jit_stalls_total",
+                  "Guest calls that had to wait for a translation.",
+                  double(stats.stall_count));
+  writer->Counter("xenia_jit_stall_seconds_total",
+                  "Time guest threads spent waiting for translations.",
+                  double(stats.stall_microseconds) / 1000000.0);
 }
 
 std::vector<ThreadDebugInfo*> Processor::QueryThreadDebugInfos() {
-  auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   std::vector<ThreadDebugInfo*> result;
   for (auto& it : thread_debug_infos_) {
     result.push_back(it.second.get());
@@ -532,8 +885,40 @@ std::vector<ThreadDebugInfo*> Processor::QueryThreadDebugInfos() {
   return result;
 }
 
-ThreadDebugInfo* Processor::QueryThreadDebugInfo(uint32_t thread_id) {
+bool Processor::CaptureGuestThreadStack(uint32_t thread_id,
+                                        uint64_t* frame_host_pcs,
+                                        size_t frame_count,
+                                        size_t* out_frame_count) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
+  auto it = thread_debug_infos_.find(thread_id);
+  if (it == thread_debug_infos_.end()) {
+    return false;
+  }
+  auto thread_info = it->second.get();
+  if (thread_info->suspended ||
+      thread_info->state != ThreadDebugInfo::State::kAlive ||
+      !thread_info->thread || !thread_info->thread->can_debugger_suspend() ||
+      (Thread::IsInThread() && thread_id == Thread::GetCurrentThreadId())) {
+    return false;
+  }
+
+  // Keep the window the thread is stopped in as short as possible; symbols
+  // are resolved by the caller after it is running again.
+  auto thread = thread_info->thread->thread();
+  if (!thread->Suspend(nullptr)) {
+    return false;
+  }
+  X64Context host_context;
+  *out_frame_count = stack_walker_->CaptureStackTrace(
+      thread->native_handle(), frame_host_pcs, 0, frame_count, nullptr,
+      &host_context);
+  thread->Resume();
+  return *out_frame_count != 0;
+}
+
+ThreadDebugInfo* Processor::QueryThreadDebugInfo(uint32_t thread_id) {
+  auto debugger_lock = debugger_lock_.Acquire();
   const auto& it = thread_debug_infos_.find(thread_id);
   if (it == thread_debug_infos_.end()) {
     return nullptr;
@@ -543,6 +928,7 @@ ThreadDebugInfo* Processor::QueryThreadDebugInfo(uint32_t thread_id) {
 
 void Processor::AddBreakpoint(Breakpoint* breakpoint) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
 
   // Add to breakpoints map.
   breakpoints_.push_back(breakpoint);
@@ -554,6 +940,7 @@ void Processor::AddBreakpoint(Breakpoint* breakpoint) {
 
 void Processor::RemoveBreakpoint(Breakpoint* breakpoint) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
 
   // Uninstall (if needed).
   if (execution_state_ == ExecutionState::kRunning) {
@@ -567,6 +954,7 @@ void Processor::RemoveBreakpoint(Breakpoint* breakpoint) {
 
 Breakpoint* Processor::FindBreakpoint(uint32_t address) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   for (auto breakpoint : breakpoints_) {
     if (breakpoint->address() == address) {
       return breakpoint;
@@ -575,6 +963,106 @@ Breakpoint* Processor::FindBreakpoint(uint32_t address) {
   return nullptr;
 }
 
+void Processor::AddProbe(Probe* probe) {
+  {
+    std::lock_guard<std::mutex> lock(probes_mutex_);
+    probe->id_ = next_probe_id_++;
+    probe->hit_count_ = 0;
+    probes_[probe->id_] = probe;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  InvalidateFunctions(entry_table_.Invalidate(probe->guest_address(),
+                                              probe->guest_address() + 4));
+}
+
+void Processor::RemoveProbe(Probe* probe) {
+  {
+    std::lock_guard<std::mutex> lock(probes_mutex_);
+    probes_.erase(probe->id_);
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  InvalidateFunctions(entry_table_.Invalidate(probe->guest_address(),
+                                              probe->guest_address() + 4));
+}
+
+bool Processor::HasProbesInRange(uint32_t guest_low, uint32_t guest_high) {
+  std::lock_guard<std::mutex> lock(probes_mutex_);
+  for (auto& it : probes_) {
+    uint32_t address = it.second->guest_address();
+    if (address >= guest_low && address <= guest_high) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::vector<Probe> Processor::QueryProbesInRange(uint32_t guest_low,
+                                                 uint32_t guest_high) {
+  std::vector<Probe> probes;
+  std::lock_guard<std::mutex> lock(probes_mutex_);
+  for (auto& it : probes_) {
+    uint32_t address = it.second->guest_address();
+    if (address >= guest_low && address <= guest_high) {
+      probes.push_back(*it.second);
+    }
+  }
+  return probes;
+}
+
+std::vector<ProbeTraceEntry> Processor::ReadProbeTrace(uint32_t thread_id) {
+  auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
+  auto it = thread_debug_infos_.find(thread_id);
+  if (it == thread_debug_infos_.end() || !it->second->thread) {
+    return {};
+  }
+  std::lock_guard<std::mutex> lock(probes_mutex_);
+  auto probe_trace = it->second->thread->thread_state()->probe_trace();
+  return probe_trace ? probe_trace->Read() : std::vector<ProbeTraceEntry>();
+}
+
+uint32_t Processor::OnProbeHit(ThreadState* thread_state, uint32_t probe_id) {
+  std::unique_lock<std::mutex> lock(probes_mutex_);
+  auto it = probes_.find(probe_id);
+  if (it == probes_.end()) {
+    // Removed, and the code not retranslated yet.
+    return 0;
+  }
+  Probe* probe = it->second;
+  if (++probe->hit_count_ < probe->hit_count_target_) {
+    return 0;
+  }
+  if (probe->action() == Probe::Action::kBreak) {
+    return probe_id;
+  }
+  if (probe->action() == Probe::Action::kCapture) {
+    if (function_captured_) {
+      return 0;
+    }
+    // The thread stays in the probe until the capture is written, and any
+    // other thread hitting it meanwhile goes on uncaptured.
+    function_captured_ = true;
+    uint32_t guest_address = probe->guest_address();
+    uint64_t hit_count = probe->hit_count_;
+    lock.unlock();
+    WriteFunctionCapture(xe::to_wstring(FLAGS_capture_function_path),
+                         memory_, thread_state, guest_address, hit_count);
+    return 0;
+  }
+
+  ProbeTraceEntry entry;
+  entry.probe_id = probe_id;
+  entry.guest_address = probe->guest_address();
+  entry.hit_count = probe->hit_count_;
+  entry.host_ticks = Clock::QueryHostTickCount();
+  entry.gpr_count = uint32_t(probe->logged_gprs().size());
+  for (uint32_t i = 0; i < entry.gpr_count; ++i) {
+    entry.gprs[i] = thread_state->context()->r[probe->logged_gprs()[i]];
+  }
+  thread_state->EnsureProbeTrace()->Append(entry);
+  return 0;
+}
+
 void Processor::set_debug_listener(DebugListener* debug_listener) {
   if (debug_listener == debug_listener_) {
     return;
@@ -608,8 +1096,9 @@ void Processor::DemandDebugListener() {
   set_debug_listener(debug_listener_handler_(this));
 }
 
-bool Processor::OnThreadBreakpointHit(Exception* ex) {
+bool Processor::OnThreadBreakpointHit(Exception* ex, uint32_t probe_id) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
 
   // Suspend all threads (but ourselves).
   SuspendAllThreads();
@@ -634,10 +1123,26 @@ bool Processor::OnThreadBreakpointHit(Exception* ex) {
   // exception handler).
   UpdateThreadExecutionStates(thread_info->thread_id, ex->thread_context());
 
+  if (probe_id) {
+    Probe* probe = nullptr;
+    Probe::HitCallback hit_callback;
+    {
+      std::lock_guard<std::mutex> lock(probes_mutex_);
+      auto probe_it = probes_.find(probe_id);
+      if (probe_it != probes_.end()) {
+        probe = probe_it->second;
+        hit_callback = probe->hit_callback_;
+      }
+    }
+    if (hit_callback) {
+      hit_callback(probe, thread_info);
+    }
+  }
+
   // Walk the captured thread stack and look for breakpoints at any address in
   // the stack. We just look for the first one.
   Breakpoint* breakpoint = nullptr;
-  for (size_t i = 0; i < thread_info->frames.size(); ++i) {
+  for (size_t i = 0; !probe_id && i < thread_info->frames.size(); ++i) {
     auto& frame = thread_info->frames[i];
     for (auto scan_breakpoint : breakpoints_) {
       if ((scan_breakpoint->address_type() == Breakpoint::AddressType::kGuest &&
@@ -662,6 +1167,7 @@ bool Processor::OnThreadBreakpointHit(Exception* ex) {
   thread_info->suspended = true;
 
   // Must unlock, or we will deadlock.
+  debugger_lock.unlock();
   global_lock.unlock();
 
   if (debug_listener_) {
@@ -680,6 +1186,7 @@ bool Processor::OnThreadBreakpointHit(Exception* ex) {
 
 void Processor::OnStepCompleted(ThreadDebugInfo* thread_info) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   execution_state_ = ExecutionState::kPaused;
   if (debug_listener_) {
     debug_listener_->OnExecutionPaused();
@@ -701,6 +1208,7 @@ bool Processor::OnUnhandledException(Exception* ex) {
   }
 
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
 
   // Suspend all guest threads (but this one).
   SuspendAllThreads();
@@ -717,7 +1225,9 @@ bool Processor::OnUnhandledException(Exception* ex) {
   // debug_listener_->OnException(info);
   debug_listener_->OnExecutionPaused();
 
-  // Suspend self.
+  // Suspend self. The locks must be released for the debugger to resume us.
+  debugger_lock.unlock();
+  global_lock.unlock();
   Thread::GetCurrentThread()->thread()->Suspend();
 
   return true;
@@ -733,6 +1243,7 @@ void Processor::ShowDebugger() {
 
 bool Processor::SuspendAllThreads() {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   for (auto& it : thread_debug_infos_) {
     auto thread_info = it.second.get();
     if (thread_info->suspended) {
@@ -761,6 +1272,7 @@ bool Processor::SuspendAllThreads() {
 
 bool Processor::ResumeThread(uint32_t thread_id) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   auto it = thread_debug_infos_.find(thread_id);
   if (it == thread_debug_infos_.end()) {
     return false;
@@ -776,6 +1288,7 @@ bool Processor::ResumeThread(uint32_t thread_id) {
 
 bool Processor::ResumeAllThreads() {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   for (auto& it : thread_debug_infos_) {
     auto thread_info = it.second.get();
     if (!thread_info->suspended) {
@@ -805,6 +1318,7 @@ bool Processor::ResumeAllThreads() {
 void Processor::UpdateThreadExecutionStates(uint32_t override_thread_id,
                                             X64Context* override_context) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   uint64_t frame_host_pcs[64];
   xe::cpu::StackFrame cpu_frames[64];
   for (auto& it : thread_debug_infos_) {
@@ -860,6 +1374,7 @@ void Processor::UpdateThreadExecutionStates(uint32_t override_thread_id,
 
 void Processor::SuspendAllBreakpoints() {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   for (auto breakpoint : breakpoints_) {
     breakpoint->Suspend();
   }
@@ -867,6 +1382,7 @@ void Processor::SuspendAllBreakpoints() {
 
 void Processor::ResumeAllBreakpoints() {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   for (auto breakpoint : breakpoints_) {
     breakpoint->Resume();
   }
@@ -875,6 +1391,7 @@ void Processor::ResumeAllBreakpoints() {
 void Processor::Pause() {
   {
     auto global_lock = global_critical_region_.Acquire();
+    auto debugger_lock = debugger_lock_.Acquire();
     assert_true(execution_state_ == ExecutionState::kRunning);
     SuspendAllThreads();
     SuspendAllBreakpoints();
@@ -889,6 +1406,7 @@ void Processor::Pause() {
 
 void Processor::Continue() {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   if (execution_state_ == ExecutionState::kRunning) {
     return;
   } else if (execution_state_ == ExecutionState::kStepping) {
@@ -904,6 +1422,7 @@ void Processor::Continue() {
 
 void Processor::StepHostInstruction(uint32_t thread_id) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   assert_true(execution_state_ == ExecutionState::kPaused);
   execution_state_ = ExecutionState::kStepping;
 
@@ -936,6 +1455,7 @@ void Processor::StepHostInstruction(uint32_t thread_id) {
 
 void Processor::StepGuestInstruction(uint32_t thread_id) {
   auto global_lock = global_critical_region_.Acquire();
+  auto debugger_lock = debugger_lock_.Acquire();
   assert_true(execution_state_ == ExecutionState::kPaused);
   execution_state_ = ExecutionState::kStepping;
 
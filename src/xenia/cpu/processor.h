@@ -14,20 +14,28 @@
 
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/mapped_memory.h"
+#include "xenia/base/metrics.h"
 #include "xenia/base/mutex.h"
 #include "xenia/cpu/backend/backend.h"
 #include "xenia/cpu/debug_listener.h"
 #include "xenia/cpu/entry_table.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/function.h"
+#include "xenia/cpu/function_trace_recorder.h"
+#include "xenia/cpu/guest_profiler.h"
 #include "xenia/cpu/module.h"
 #include "xenia/cpu/ppc/ppc_frontend.h"
+#include "xenia/cpu/probe.h"
+#include "xenia/cpu/symbol_index.h"
 #include "xenia/cpu/thread_debug_info.h"
 #include "xenia/cpu/thread_state.h"
+#include "xenia/cpu/translation_worker_pool.h"
 #include "xenia/memory.h"
 
 DECLARE_bool(debug);
@@ -116,6 +124,49 @@ class Processor {
   Function* LookupFunction(Module* module, uint32_t address);
   Function* ResolveFunction(uint32_t address);
 
+  // Background translation of functions ahead of their first call.
+  // Queued functions are ignored if no workers are running.
+  TranslationWorkerPool* translation_worker_pool() const {
+    return translation_worker_pool_.get();
+  }
+  void QueueFunctionTranslation(uint32_t address, int32_t priority);
+  // Resolves the function at the given address on behalf of a translation
+  // worker and returns the targets of any direct calls it makes.
+  bool PrecompileFunction(uint32_t address,
+                          std::vector<uint32_t>* out_call_targets);
+
+  // Called by baseline tier code once it is hot. Recompiles the function at
+  // the optimized tier, on a translation worker if any are running.
+  void TierUpFunction(GuestFunction* function);
+  bool RecompileFunction(GuestFunction* function);
+
+  // Generates the disassembly selected by the kDebugInfoDisasm flags for a
+  // defined guest function, on the calling thread, for tools that show it.
+  // Nothing of it stays resident with the function.
+  std::unique_ptr<FunctionDebugInfo> DisassembleFunction(
+      GuestFunction* function,
+      uint32_t debug_info_flags = DebugInfoFlags::kDebugInfoAllDisasm);
+
+  // Drops the translated code of all functions overlapping
+  // [guest_low, guest_high) so that they are retranslated the next time they
+  // are called. Code that is already running is unaffected, as machine code
+  // is never freed. Used for bulk invalidation when a module is unloaded.
+  void InvalidateCodeRange(uint32_t guest_low, uint32_t guest_high);
+
+  // Records that the function's code has values loaded from the given
+  // read-only guest pages baked into it. An empty list means the pages are
+  // unknown (code restored from the persistent cache) and any change to
+  // read-only data invalidates the function.
+  void AddConstantDataDependency(GuestFunction* function,
+                                 const std::vector<uint32_t>& pages);
+  // Called when the guest changes the protection of a range of its memory.
+  // Functions that folded loads from pages now made writable are
+  // invalidated.
+  void OnGuestProtectionChanged(uint32_t address, uint32_t size,
+                                uint32_t protect);
+  // Set once any read-only data constants were folded from became writable.
+  bool constant_data_modified() const { return constant_data_modified_; }
+
   bool Execute(ThreadState* thread_state, uint32_t address);
   bool ExecuteRaw(ThreadState* thread_state, uint32_t address);
   uint64_t Execute(ThreadState* thread_state, uint32_t address, uint64_t args[],
@@ -126,8 +177,14 @@ class Processor {
   Irql RaiseIrql(Irql new_value);
   void LowerIrql(Irql old_value);
 
+  // Save states list the functions translated at the time, so that a
+  // restored session can translate them up front instead of on demand.
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
+  // Queues the functions listed in the restored state on the translation
+  // workers and waits for them, up to --restore_translation_wait_ms. Called
+  // once the guest modules and memory are back, before guest threads resume.
+  void TranslateRestoredFunctions();
 
   // Returns a list of debugger info for all threads that have ever existed.
   // This is the preferred way to sample thread state vs. attempting to ask
@@ -137,6 +194,17 @@ class Processor {
   // Returns the debugger info for the given thread.
   ThreadDebugInfo* QueryThreadDebugInfo(uint32_t thread_id);
 
+  // Only present when guest profiling was requested with
+  // --guest_profile_path.
+  GuestProfiler* guest_profiler() const { return guest_profiler_.get(); }
+  // Every function defined so far, for the debugger.
+  const SymbolIndex* symbol_index() const { return &symbol_index_; }
+
+  // Briefly suspends the given guest thread to capture its host stack, leaf
+  // first. Fails if the thread isn't running or is suspended by the debugger.
+  bool CaptureGuestThreadStack(uint32_t thread_id, uint64_t* frame_host_pcs,
+                               size_t frame_count, size_t* out_frame_count);
+
   // Adds a breakpoint to the debugger and activates it (if enabled).
   // The given breakpoint will not be owned by the debugger and must remain
   // allocated so long as it is added.
@@ -151,6 +219,26 @@ class Processor {
   // Returns all currently registered breakpoints.
   std::vector<Breakpoint*> breakpoints() const;
 
+  // Adds a probe, compiled into the functions containing its address as they
+  // are retranslated on their next call. Code that is already running, and
+  // copies of the functions inlined before, keep going without it.
+  // The given probe will not be owned and must remain allocated so long as it
+  // is added.
+  void AddProbe(Probe* probe);
+  // Removes a probe. Code compiled with it is retranslated on its next call,
+  // and ignores it until then.
+  void RemoveProbe(Probe* probe);
+  // Whether any probe is at an address in [guest_low, guest_high].
+  bool HasProbesInRange(uint32_t guest_low, uint32_t guest_high);
+  // Copies of the probes in [guest_low, guest_high], for compiling them in.
+  std::vector<Probe> QueryProbesInRange(uint32_t guest_low,
+                                        uint32_t guest_high);
+  // The latest tracepoint hits of the thread, oldest first.
+  std::vector<ProbeTraceEntry> ReadProbeTrace(uint32_t thread_id);
+  // Called by compiled probes on the thread hitting them once their condition
+  // is met. Returns probe_id if it is to break, 0 otherwise.
+  uint32_t OnProbeHit(ThreadState* thread_state, uint32_t probe_id);
+
   // Shows the debug listener, focusing it if it already exists.
   void ShowDebugger();
 
@@ -192,13 +280,19 @@ class Processor {
                        Thread* thread);
   void OnThreadExit(uint32_t thread_id);
   void OnThreadDestroyed(uint32_t thread_id);
-  void OnThreadEnteringWait(uint32_t thread_id);
+  // The handle is of the first object waited on.
+  void OnThreadEnteringWait(uint32_t thread_id, uint32_t object_handle);
   void OnThreadLeavingWait(uint32_t thread_id);
 
   bool OnUnhandledException(Exception* ex);
-  bool OnThreadBreakpointHit(Exception* ex);
+  // probe_id is of the probe that broke, if not 0, rather than a breakpoint.
+  bool OnThreadBreakpointHit(Exception* ex, uint32_t probe_id = 0);
 
   uint8_t* AllocateFunctionTraceData(size_t size);
+  // Null unless --trace_function_records_path is set.
+  FunctionTraceRecorder* function_trace_recorder() const {
+    return function_trace_recorder_.get();
+  }
 
  private:
   // Synchronously demands a debug listener.
@@ -225,6 +319,7 @@ class Processor {
   void OnFunctionDefined(Function* function);
 
   static bool ExceptionCallbackThunk(Exception* ex, void* data);
+  static void CollectMetricsThunk(MetricsWriter* writer, void* data);
   bool ExceptionCallback(Exception* ex);
   void OnStepCompleted(ThreadDebugInfo* thread_info);
   void OnBreakpointHit(ThreadDebugInfo* thread_info, Breakpoint* breakpoint);
@@ -235,8 +330,20 @@ class Processor {
   uint32_t CalculateNextGuestInstruction(ThreadDebugInfo* thread_info,
                                          uint32_t current_pc);
 
+  // Sets out_stalled if the caller blocked on a translation.
+  Function* ResolveFunction(uint32_t address, bool* out_stalled);
   bool DemandFunction(Function* function);
 
+  // Write-watches the guest pages holding the code of the function, if
+  // --invalidate_modified_code is set. Any write invalidates every function
+  // overlapping the page.
+  void WatchFunctionCode(GuestFunction* function);
+  static void CodeWriteCallbackThunk(void* context_ptr, void* data_ptr,
+                                     uint32_t address);
+  // Invalidates the functions returned by EntryTable::Invalidate.
+  // global_critical_region_ must be held.
+  void InvalidateFunctions(const std::vector<Function*>& functions);
+
   Memory* memory_ = nullptr;
   std::unique_ptr<StackWalker> stack_walker_;
 
@@ -248,13 +355,30 @@ class Processor {
   // If specified, the file trace data gets written to when running.
   std::wstring functions_trace_path_;
   std::unique_ptr<ChunkedMappedMemoryWriter> functions_trace_file_;
+  std::unique_ptr<FunctionTraceRecorder> function_trace_recorder_;
 
   std::unique_ptr<ppc::PPCFrontend> frontend_;
   std::unique_ptr<backend::Backend> backend_;
+  std::unique_ptr<TranslationWorkerPool> translation_worker_pool_;
+  std::vector<uint32_t> restored_function_addresses_;
+  std::unique_ptr<GuestProfiler> guest_profiler_;
   ExportResolver* export_resolver_ = nullptr;
 
   EntryTable entry_table_;
+  SymbolIndex symbol_index_;
   xe::global_critical_region global_critical_region_;
+  // Guards the thread debug infos, breakpoints and execution state. Taken
+  // after global_critical_region_ by everything but the thread notifications,
+  // as installing breakpoints and suspending threads require both.
+  xe::subsystem_mutex debugger_lock_{"cpu/debugger"};
+  // Watch handles of guest code pages, by page address.
+  std::unordered_map<uint32_t, uintptr_t> code_watches_;
+  // Functions with constants folded from read-only guest pages, by page
+  // address, and those whose pages are unknown.
+  std::unordered_map<uint32_t, std::vector<GuestFunction*>>
+      constant_data_dependents_;
+  std::vector<GuestFunction*> unscoped_constant_data_dependents_;
+  bool constant_data_modified_ = false;
   ExecutionState execution_state_ = ExecutionState::kPaused;
   std::vector<std::unique_ptr<Module>> modules_;
   Module* builtin_module_ = nullptr;
@@ -267,6 +391,16 @@ class Processor {
   // TODO(benvanik): cleanup/change structures.
   std::vector<Breakpoint*> breakpoints_;
 
+  // Guards the probes, their hit counts and the probe traces of the threads,
+  // as they are hit. Not held while taking any other lock.
+  std::mutex probes_mutex_;
+  // By id.
+  std::map<uint32_t, Probe*> probes_;
+  uint32_t next_probe_id_ = 1;
+  // For --capture_function, done once written.
+  std::unique_ptr<Probe> capture_probe_;
+  bool function_captured_ = false;
+
   Irql irql_;
 };
 
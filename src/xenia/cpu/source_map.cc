@@ -0,0 +1,141 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/source_map.h"
+
+namespace xe {
+namespace cpu {
+
+namespace {
+
+void WriteDelta(uint32_t value, uint32_t previous, std::vector<uint8_t>* out) {
+  // Zigzag, so that small steps backwards stay small too.
+  int32_t delta = int32_t(value - previous);
+  uint32_t bits = (uint32_t(delta) << 1) ^ uint32_t(delta >> 31);
+  while (bits >= 0x80) {
+    out->push_back(uint8_t(bits | 0x80));
+    bits >>= 7;
+  }
+  out->push_back(uint8_t(bits));
+}
+
+uint32_t ReadDelta(const uint8_t*& ptr, uint32_t previous) {
+  uint32_t bits = 0;
+  uint32_t shift = 0;
+  uint8_t byte;
+  do {
+    byte = *ptr++;
+    bits |= uint32_t(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+  return previous + ((bits >> 1) ^ (0u - (bits & 1)));
+}
+
+}  // namespace
+
+SourceMap::Iterator::Iterator(const uint8_t* ptr, const uint8_t* end)
+    : ptr_(ptr), next_(ptr), end_(end) {
+  Decode();
+}
+
+void SourceMap::Iterator::Decode() {
+  if (next_ == end_) {
+    return;
+  }
+  entry_.guest_address = ReadDelta(next_, entry_.guest_address);
+  entry_.hir_offset = ReadDelta(next_, entry_.hir_offset);
+  entry_.code_offset = ReadDelta(next_, entry_.code_offset);
+}
+
+SourceMap::Iterator& SourceMap::Iterator::operator++() {
+  ptr_ = next_;
+  Decode();
+  return *this;
+}
+
+void SourceMap::Assign(const std::vector<SourceMapEntry>& entries) {
+  data_.clear();
+  SourceMapEntry previous = {0};
+  for (const auto& entry : entries) {
+    WriteDelta(entry.guest_address, previous.guest_address, &data_);
+    WriteDelta(entry.hir_offset, previous.hir_offset, &data_);
+    WriteDelta(entry.code_offset, previous.code_offset, &data_);
+    previous = entry;
+  }
+  data_.shrink_to_fit();
+  size_ = entries.size();
+}
+
+void SourceMap::Clear() {
+  data_.clear();
+  data_.shrink_to_fit();
+  size_ = 0;
+}
+
+SourceMap::Iterator SourceMap::begin() const {
+  return Iterator(data_.data(), data_.data() + data_.size());
+}
+
+SourceMap::Iterator SourceMap::end() const {
+  return Iterator(data_.data() + data_.size(), data_.data() + data_.size());
+}
+
+std::vector<SourceMapEntry> SourceMap::ToVector() const {
+  std::vector<SourceMapEntry> entries;
+  entries.reserve(size_);
+  for (const auto& entry : *this) {
+    entries.push_back(entry);
+  }
+  return entries;
+}
+
+bool SourceMap::LookupGuestAddress(uint32_t guest_address,
+                                   SourceMapEntry* out_entry) const {
+  for (const auto& entry : *this) {
+    if (entry.guest_address == guest_address) {
+      *out_entry = entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SourceMap::LookupHIROffset(uint32_t offset,
+                                SourceMapEntry* out_entry) const {
+  for (const auto& entry : *this) {
+    if (entry.hir_offset >= offset) {
+      *out_entry = entry;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SourceMap::LookupMachineCodeOffset(uint32_t offset,
+                                        SourceMapEntry* out_entry) const {
+  if (empty()) {
+    return false;
+  }
+  // Code offsets only grow, so the last one not past it is the match.
+  bool found = false;
+  for (const auto& entry : *this) {
+    if (entry.code_offset > offset) {
+      break;
+    }
+    *out_entry = entry;
+    found = true;
+  }
+  if (!found) {
+    *out_entry = *begin();
+  }
+  return true;
+}
+
+}  // namespace cpu
+}  // namespace xe
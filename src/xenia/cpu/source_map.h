@@ -0,0 +1,82 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SOURCE_MAP_H_
+#define XENIA_CPU_SOURCE_MAP_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xe {
+namespace cpu {
+
+struct SourceMapEntry {
+  uint32_t guest_address;  // PPC guest address (0x82....).
+  uint32_t hir_offset;     // Block ordinal (16b) | Instr ordinal (16b)
+  uint32_t code_offset;    // Offset from emitted code start.
+};
+
+// Source map of a function kept resident for as long as its code is, in
+// code order. Each entry is stored as the differences of its fields to the
+// previous entry, zigzag and variable-length encoded, which is 3-5 bytes
+// instead of 12 for typical code. Lookups decode from the start, so they are
+// meant for the debugger and exception paths, not anything hot.
+class SourceMap {
+ public:
+  class Iterator {
+   public:
+    const SourceMapEntry& operator*() const { return entry_; }
+    const SourceMapEntry* operator->() const { return &entry_; }
+    Iterator& operator++();
+    bool operator==(const Iterator& other) const { return ptr_ == other.ptr_; }
+    bool operator!=(const Iterator& other) const { return ptr_ != other.ptr_; }
+
+   private:
+    friend class SourceMap;
+    Iterator(const uint8_t* ptr, const uint8_t* end);
+    void Decode();
+
+    const uint8_t* ptr_;
+    const uint8_t* next_;
+    const uint8_t* end_;
+    SourceMapEntry entry_ = {0};
+  };
+
+  // Replaces the contents with the entries, which must be in code order.
+  void Assign(const std::vector<SourceMapEntry>& entries);
+  void Clear();
+
+  size_t size() const { return size_; }
+  bool empty() const { return !size_; }
+  size_t encoded_size() const { return data_.size(); }
+
+  Iterator begin() const;
+  Iterator end() const;
+  std::vector<SourceMapEntry> ToVector() const;
+
+  // The entry of the first instruction at the guest address.
+  bool LookupGuestAddress(uint32_t guest_address,
+                          SourceMapEntry* out_entry) const;
+  // The first entry at or after the HIR offset.
+  bool LookupHIROffset(uint32_t offset, SourceMapEntry* out_entry) const;
+  // The last entry starting at or before the machine code offset, else the
+  // first one.
+  bool LookupMachineCodeOffset(uint32_t offset,
+                               SourceMapEntry* out_entry) const;
+
+ private:
+  std::vector<uint8_t> data_;
+  size_t size_ = 0;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SOURCE_MAP_H_
@@ -192,28 +192,60 @@ class Win32StackWalker : public StackWalker {
                   sizeof(out_host_context->xmm_registers));
     }
 
-    // Setup the frame for walking.
-    STACKFRAME64 stack_frame = {0};
-    stack_frame.AddrPC.Mode = AddrModeFlat;
-    stack_frame.AddrPC.Offset = thread_context.Rip;
-    stack_frame.AddrFrame.Mode = AddrModeFlat;
-    stack_frame.AddrFrame.Offset = thread_context.Rbp;
-    stack_frame.AddrStack.Mode = AddrModeFlat;
-    stack_frame.AddrStack.Offset = thread_context.Rsp;
-
     // Walk the stack.
+    // Guest frames are stepped over by the code cache, which knows their
+    // layout, and everything else by StackWalk64. The context always holds
+    // the current frame; captured tells whether StackWalk64 already reported
+    // it.
     // Note that StackWalk64 is thread safe, though other dbghelp functions are
     // not.
+    STACKFRAME64 stack_frame;
+    bool stack_frame_valid = false;
+    bool captured = false;
     size_t frame_index = 0;
-    while (frame_index < frame_count &&
-           stack_walk_64_(IMAGE_FILE_MACHINE_AMD64, GetCurrentProcess(),
-                          thread_handle, &stack_frame, &thread_context, nullptr,
-                          XSymFunctionTableAccess64, XSymGetModuleBase64,
-                          nullptr) == TRUE) {
+    while (frame_index < frame_count) {
+      uint64_t caller_pc = thread_context.Rip;
+      uint64_t caller_sp = thread_context.Rsp;
+      if (code_cache_->UnwindGuestFrame(&caller_pc, &caller_sp)) {
+        if (!captured) {
+          if (frame_index >= frame_offset) {
+            frame_host_pcs[frame_index - frame_offset] = thread_context.Rip;
+          }
+          ++frame_index;
+        }
+        thread_context.Rip = caller_pc;
+        thread_context.Rsp = caller_sp;
+        stack_frame_valid = false;
+        captured = false;
+        continue;
+      }
+
+      if (!stack_frame_valid) {
+        // Setup the frame for walking from the current context. The first
+        // step reports the frame itself.
+        std::memset(&stack_frame, 0, sizeof(stack_frame));
+        stack_frame.AddrPC.Mode = AddrModeFlat;
+        stack_frame.AddrPC.Offset = thread_context.Rip;
+        stack_frame.AddrFrame.Mode = AddrModeFlat;
+        stack_frame.AddrFrame.Offset = thread_context.Rbp;
+        stack_frame.AddrStack.Mode = AddrModeFlat;
+        stack_frame.AddrStack.Offset = thread_context.Rsp;
+        stack_frame_valid = true;
+      }
+      if (stack_walk_64_(IMAGE_FILE_MACHINE_AMD64, GetCurrentProcess(),
+                         thread_handle, &stack_frame, &thread_context, nullptr,
+                         XSymFunctionTableAccess64, XSymGetModuleBase64,
+                         nullptr) != TRUE) {
+        break;
+      }
+      // Keep the context on the reported frame, in case it is guest code.
+      thread_context.Rip = stack_frame.AddrPC.Offset;
+      thread_context.Rsp = stack_frame.AddrStack.Offset;
       if (frame_index >= frame_offset) {
         frame_host_pcs[frame_index - frame_offset] = stack_frame.AddrPC.Offset;
       }
       ++frame_index;
+      captured = true;
     }
 
     return frame_index - frame_offset;
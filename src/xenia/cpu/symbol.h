@@ -10,6 +10,7 @@
 #ifndef XENIA_CPU_SYMBOL_H_
 #define XENIA_CPU_SYMBOL_H_
 
+#include <atomic>
 #include <cstdint>
 #include <string>
 
@@ -50,7 +51,8 @@ class Symbol {
  protected:
   Type type_ = Type::kVariable;
   Module* module_ = nullptr;
-  Status status_ = Status::kDefining;
+  // Read without the module lock once the symbol is in its map.
+  std::atomic<Status> status_ = {Status::kDefining};
   uint32_t address_ = 0;
 
   std::string name_;
@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/symbol_index.h"
+
+#include "xenia/cpu/function.h"
+
+namespace xe {
+namespace cpu {
+
+void SymbolIndex::Add(Function* function) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!functions_.insert(function).second) {
+    return;
+  }
+  Entry entry;
+  entry.address = function->address();
+  entry.end_address = function->end_address();
+  entry.module = function->module();
+  entry.function = function;
+  entries_.push_back(entry);
+}
+
+size_t SymbolIndex::entry_count() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+size_t SymbolIndex::CopyEntries(size_t first, std::vector<Entry>* out) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (first >= entries_.size()) {
+    return 0;
+  }
+  out->insert(out->end(), entries_.begin() + first, entries_.end());
+  return entries_.size() - first;
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,52 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_SYMBOL_INDEX_H_
+#define XENIA_CPU_SYMBOL_INDEX_H_
+
+#include <cstdint>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace xe {
+namespace cpu {
+
+class Function;
+class Module;
+
+// Every function defined so far, in the order they were defined. Kept up to
+// date by Processor::OnFunctionDefined so that tools listing functions only
+// have to pick up the new entries instead of walking every module.
+class SymbolIndex {
+ public:
+  struct Entry {
+    uint32_t address;
+    uint32_t end_address;
+    Module* module;
+    Function* function;
+  };
+
+  // Functions defined again (after invalidation) are only added once.
+  void Add(Function* function);
+
+  size_t entry_count() const;
+  // Appends the entries from first on to out, returning how many there were.
+  size_t CopyEntries(size_t first, std::vector<Entry>* out) const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<Entry> entries_;
+  std::unordered_set<Function*> functions_;
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_SYMBOL_INDEX_H_
@@ -0,0 +1,203 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+// Latency of individual HIR sequences, in TSC cycles per op, for every
+// combination of emitter features the host supports. Hidden from the default
+// run; use `xenia-cpu-tests [.benchmark]`.
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+
+#include "xenia/base/platform.h"
+#include "xenia/cpu/backend/x64/x64_emitter.h"
+#include "xenia/cpu/testing/util.h"
+
+#if XE_COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif  // XE_COMPILER_MSVC
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+// Each op is chained this many times inside one function so that the cost of
+// entering and leaving guest code can be subtracted out.
+const uint32_t kChainLength = 64;
+const uint32_t kCallCount = 2000;
+const uint32_t kBatchCount = 5;
+
+typedef std::function<Value*(HIRBuilder& b, Value* x, Value* y)> OpEmitter;
+
+uint32_t QueryHostFeatures() {
+  using Xbyak::util::Cpu;
+  Cpu cpu;
+  uint32_t features = 0;
+  features |= cpu.has(Cpu::tAVX2) ? backend::x64::kX64EmitAVX2 : 0;
+  features |= cpu.has(Cpu::tFMA) ? backend::x64::kX64EmitFMA : 0;
+  features |= cpu.has(Cpu::tLZCNT) ? backend::x64::kX64EmitLZCNT : 0;
+  features |= cpu.has(Cpu::tBMI2) ? backend::x64::kX64EmitBMI2 : 0;
+  features |= cpu.has(Cpu::tF16C) ? backend::x64::kX64EmitF16C : 0;
+  features |= cpu.has(Cpu::tMOVBE) ? backend::x64::kX64EmitMovbe : 0;
+  if (cpu.has(Cpu::tAVX512F) && cpu.has(Cpu::tAVX512BW) &&
+      cpu.has(Cpu::tAVX512VL)) {
+    features |= backend::x64::kX64EmitAVX512;
+    features |= cpu.has(Cpu::tAVX512_VBMI) ? backend::x64::kX64EmitAVX512VBMI
+                                            : 0;
+  }
+  return features;
+}
+
+// Fastest batch of kCallCount calls, in TSC cycles per call.
+double MeasureCall(TypeName type, uint32_t chain_length, OpEmitter emit) {
+  TestFunction test([&](HIRBuilder& b) {
+    bool is_vector = type == VEC128_TYPE;
+    auto x = is_vector ? LoadVR(b, 4) : b.Truncate(LoadGPR(b, 4), type);
+    auto y = is_vector ? LoadVR(b, 5) : b.Truncate(LoadGPR(b, 5), type);
+    for (uint32_t i = 0; i < chain_length; ++i) {
+      x = emit(b, x, y);
+    }
+    if (is_vector) {
+      StoreVR(b, 3, x);
+    } else {
+      StoreGPR(b, 3, type == INT64_TYPE ? x : b.ZeroExtend(x, INT64_TYPE));
+    }
+    b.Return();
+  });
+  double best = 0;
+  for (auto& processor : test.processors) {
+    auto fn = processor->ResolveFunction(0x80000000);
+    auto thread_state = std::make_unique<ThreadState>(processor.get(), 0x100);
+    auto ctx = thread_state->context();
+    for (uint32_t batch = 0; batch < kBatchCount; ++batch) {
+      ctx->v[4] = vec128i(0x01234567, 0x89ABCDEF, 0x02468ACE, 0x13579BDF);
+      ctx->v[5] = vec128i(0x03030303, 0x05050505, 0x07070707, 0x01010101);
+      ctx->r[4] = 0x0123456789ABCDEFull;
+      ctx->r[5] = 3;
+      uint64_t start = __rdtsc();
+      for (uint32_t i = 0; i < kCallCount; ++i) {
+        ctx->lr = 0xBCBCBCBC;
+        fn->Call(thread_state.get(), uint32_t(ctx->lr));
+      }
+      double cycles = double(__rdtsc() - start) / kCallCount;
+      best = batch ? std::min(best, cycles) : cycles;
+    }
+  }
+  return best;
+}
+
+void Benchmark(const char* name, TypeName type, OpEmitter emit) {
+  int32_t old_mask = FLAGS_x64_extension_mask;
+  uint32_t host_features = QueryHostFeatures();
+  // Walk every subset of the host features.
+  uint32_t features = host_features;
+  while (true) {
+    FLAGS_x64_extension_mask = int32_t(features);
+    double empty_cycles = MeasureCall(type, 0, emit);
+    double chain_cycles = MeasureCall(type, kChainLength, emit);
+    double op_cycles =
+        std::max(0.0, (chain_cycles - empty_cycles) / kChainLength);
+    std::printf("%-24s features=%.3X %8.2f cycles/op\n", name, features,
+                op_cycles);
+    if (!features) {
+      break;
+    }
+    features = (features - 1) & host_features;
+  }
+  FLAGS_x64_extension_mask = old_mask;
+}
+
+}  // namespace
+
+TEST_CASE("BENCHMARK_INTEGER", "[.benchmark]") {
+  Benchmark("ADD_I32", INT32_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) { return b.Add(x, y); });
+  Benchmark("MUL_I32", INT32_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) { return b.Mul(x, y); });
+  Benchmark("MUL_HI_I64", INT64_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) { return b.MulHi(x, y); });
+  Benchmark("SHL_I32", INT32_TYPE, [](HIRBuilder& b, Value* x, Value* y) {
+    return b.Shl(x, b.Truncate(y, INT8_TYPE));
+  });
+  Benchmark("SHR_I32", INT32_TYPE, [](HIRBuilder& b, Value* x, Value* y) {
+    return b.Shr(x, b.Truncate(y, INT8_TYPE));
+  });
+  Benchmark("SHA_I32", INT32_TYPE, [](HIRBuilder& b, Value* x, Value* y) {
+    return b.Sha(x, b.Truncate(y, INT8_TYPE));
+  });
+  Benchmark("ROTATE_LEFT_I32", INT32_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.RotateLeft(x, b.Truncate(y, INT8_TYPE));
+            });
+  Benchmark("BYTE_SWAP_I32", INT32_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) { return b.ByteSwap(x); });
+}
+
+TEST_CASE("BENCHMARK_VECTOR", "[.benchmark]") {
+  Benchmark("VECTOR_ADD_I32", VEC128_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.VectorAdd(x, y, INT32_TYPE);
+            });
+  Benchmark("VECTOR_MAX_I32", VEC128_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.VectorMax(x, y, INT32_TYPE);
+            });
+  Benchmark("VECTOR_MIN_I32", VEC128_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.VectorMin(x, y, INT32_TYPE);
+            });
+  for (auto type : {INT8_TYPE, INT16_TYPE, INT32_TYPE}) {
+    const char* suffix =
+        type == INT8_TYPE ? "I8" : type == INT16_TYPE ? "I16" : "I32";
+    std::string shl_name = std::string("VECTOR_SHL_") + suffix;
+    Benchmark(shl_name.c_str(), VEC128_TYPE,
+              [type](HIRBuilder& b, Value* x, Value* y) {
+                return b.VectorShl(x, y, type);
+              });
+    std::string shr_name = std::string("VECTOR_SHR_") + suffix;
+    Benchmark(shr_name.c_str(), VEC128_TYPE,
+              [type](HIRBuilder& b, Value* x, Value* y) {
+                return b.VectorShr(x, y, type);
+              });
+    std::string sha_name = std::string("VECTOR_SHA_") + suffix;
+    Benchmark(sha_name.c_str(), VEC128_TYPE,
+              [type](HIRBuilder& b, Value* x, Value* y) {
+                return b.VectorSha(x, y, type);
+              });
+    std::string rotate_name = std::string("VECTOR_ROTATE_LEFT_") + suffix;
+    Benchmark(rotate_name.c_str(), VEC128_TYPE,
+              [type](HIRBuilder& b, Value* x, Value* y) {
+                return b.VectorRotateLeft(x, y, type);
+              });
+  }
+  Benchmark("PERMUTE_I8", VEC128_TYPE, [](HIRBuilder& b, Value* x, Value* y) {
+    return b.Permute(y, x, x, INT8_TYPE);
+  });
+  Benchmark("SWIZZLE_I32", VEC128_TYPE, [](HIRBuilder& b, Value* x, Value* y) {
+    return b.Swizzle(x, INT32_TYPE, MakeSwizzleMask(3, 2, 1, 0));
+  });
+  Benchmark("PACK_FLOAT16_4", VEC128_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.Pack(x, PACK_TYPE_FLOAT16_4);
+            });
+  Benchmark("UNPACK_FLOAT16_4", VEC128_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.Unpack(x, PACK_TYPE_FLOAT16_4);
+            });
+  Benchmark("PACK_SHORT_2", VEC128_TYPE,
+            [](HIRBuilder& b, Value* x, Value* y) {
+              return b.Pack(x, PACK_TYPE_SHORT_2);
+            });
+}
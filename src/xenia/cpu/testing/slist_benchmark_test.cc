@@ -0,0 +1,181 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+// The inlined interlocked SList exports, checked against the header layout
+// the kernel uses and run from several host threads at once. The contention
+// benchmark is hidden from the default run; use
+// `xenia-cpu-tests [.benchmark]`.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/memory.h"
+#include "xenia/cpu/ppc/ppc_kernel_intrinsics.h"
+#include "xenia/cpu/testing/util.h"
+
+using namespace xe;
+using namespace xe::cpu;
+using namespace xe::cpu::hir;
+using namespace xe::cpu::testing;
+using xe::cpu::ppc::PPCContext;
+
+namespace {
+
+const uint32_t kEntrySize = 16;
+
+uint32_t ListNext(Memory* memory, uint32_t list) {
+  return xe::load_and_swap<uint32_t>(memory->TranslateVirtual(list));
+}
+uint16_t ListDepth(Memory* memory, uint32_t list) {
+  return xe::load_and_swap<uint16_t>(memory->TranslateVirtual(list + 4));
+}
+uint16_t ListSequence(Memory* memory, uint32_t list) {
+  return xe::load_and_swap<uint16_t>(memory->TranslateVirtual(list + 6));
+}
+
+uint32_t AllocZeroed(Memory* memory, uint32_t size) {
+  uint32_t address = memory->SystemHeapAlloc(size);
+  std::memset(memory->TranslateVirtual(address), 0, size);
+  return address;
+}
+
+// r3 = list, r4 = entry; pushes the entry and pops the first one into r3.
+void EmitPushPop(HIRBuilder& b) {
+  auto list = LoadGPR(b, 3);
+  ppc::EmitSListPush(b, list, LoadGPR(b, 4));
+  StoreGPR(b, 3, ppc::EmitSListPop(b, list));
+  b.Return();
+}
+
+}  // namespace
+
+TEST_CASE("SLIST_PUSH_POP_FLUSH", "[instr]") {
+  TestFunction push([](HIRBuilder& b) {
+    StoreGPR(b, 3, ppc::EmitSListPush(b, LoadGPR(b, 3), LoadGPR(b, 4)));
+    b.Return();
+  });
+  TestFunction pop([](HIRBuilder& b) {
+    StoreGPR(b, 3, ppc::EmitSListPop(b, LoadGPR(b, 3)));
+    b.Return();
+  });
+  TestFunction flush([](HIRBuilder& b) {
+    StoreGPR(b, 3, ppc::EmitSListFlush(b, LoadGPR(b, 3)));
+    b.Return();
+  });
+  // Each TestFunction has its own guest memory.
+  auto call = [](TestFunction& test, uint64_t r3, uint64_t r4) {
+    auto& processor = test.processors.front();
+    auto fn = processor->ResolveFunction(0x80000000);
+    ThreadState thread_state(processor.get(), 0x100);
+    auto ctx = thread_state.context();
+    ctx->r[3] = r3;
+    ctx->r[4] = r4;
+    ctx->lr = 0xBCBCBCBC;
+    fn->Call(&thread_state, uint32_t(ctx->lr));
+    return ctx->r[3];
+  };
+
+  Memory* memory = push.memory.get();
+  uint32_t list = AllocZeroed(memory, 8);
+  uint32_t entry_a = AllocZeroed(memory, kEntrySize);
+  uint32_t entry_b = AllocZeroed(memory, kEntrySize);
+  REQUIRE(call(push, list, entry_a) == 0);
+  REQUIRE(call(push, list, entry_b) == entry_a);
+  REQUIRE(ListNext(memory, list) == entry_b);
+  REQUIRE(ListDepth(memory, list) == 2);
+  REQUIRE(ListSequence(memory, list) == 2);
+  REQUIRE(xe::load_and_swap<uint32_t>(memory->TranslateVirtual(entry_b)) ==
+          entry_a);
+
+  memory = pop.memory.get();
+  list = AllocZeroed(memory, 8);
+  entry_a = AllocZeroed(memory, kEntrySize);
+  REQUIRE(call(pop, list, 0) == 0);
+  xe::store_and_swap<uint32_t>(memory->TranslateVirtual(list), entry_a);
+  xe::store_and_swap<uint16_t>(memory->TranslateVirtual(list + 4), 1);
+  xe::store_and_swap<uint16_t>(memory->TranslateVirtual(list + 6), 7);
+  REQUIRE(call(pop, list, 0) == entry_a);
+  REQUIRE(ListNext(memory, list) == 0);
+  REQUIRE(ListDepth(memory, list) == 0);
+  REQUIRE(ListSequence(memory, list) == 7);
+
+  memory = flush.memory.get();
+  list = AllocZeroed(memory, 8);
+  entry_a = AllocZeroed(memory, kEntrySize);
+  xe::store_and_swap<uint32_t>(memory->TranslateVirtual(list), entry_a);
+  xe::store_and_swap<uint16_t>(memory->TranslateVirtual(list + 4), 1);
+  REQUIRE(call(flush, list, 0) == entry_a);
+  REQUIRE(ListNext(memory, list) == 0);
+  REQUIRE(ListDepth(memory, list) == 0);
+}
+
+// Every host thread pushes the entry it holds and pops one back, so together
+// they keep the list hammered from both ends. Nothing is ever lost: when all
+// are done the list is empty again and each entry is held by one thread.
+TEST_CASE("BENCHMARK_SLIST_CONTENTION", "[.benchmark]") {
+  const uint32_t kCallCount = 200000;
+  TestFunction test(EmitPushPop);
+  auto& processor = test.processors.front();
+  Memory* memory = test.memory.get();
+  auto fn = processor->ResolveFunction(0x80000000);
+  uint32_t host_threads = std::max(std::thread::hardware_concurrency(), 2u);
+
+  for (uint32_t thread_count = 1; thread_count <= host_threads;
+       thread_count *= 2) {
+    uint32_t list = AllocZeroed(memory, 8);
+    std::vector<std::unique_ptr<ThreadState>> thread_states;
+    std::vector<uint32_t> held(thread_count);
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      thread_states.push_back(
+          std::make_unique<ThreadState>(processor.get(), 0x100 + i));
+      held[i] = AllocZeroed(memory, kEntrySize);
+    }
+    std::vector<uint32_t> entries = held;
+
+    std::atomic<uint32_t> ready(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      threads.emplace_back([&, i]() {
+        auto thread_state = thread_states[i].get();
+        auto ctx = thread_state->context();
+        ++ready;
+        while (ready < thread_count) {
+        }
+        for (uint32_t call = 0; call < kCallCount; ++call) {
+          ctx->r[3] = list;
+          ctx->r[4] = held[i];
+          ctx->lr = 0xBCBCBCBC;
+          fn->Call(thread_state, uint32_t(ctx->lr));
+          held[i] = uint32_t(ctx->r[3]);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    std::printf("SLIST_PUSH_POP threads=%-3u %10.1f ns/call %12.0f calls/s\n",
+                thread_count, seconds * 1e9 / kCallCount,
+                double(kCallCount) * thread_count / seconds);
+
+    REQUIRE(ListNext(memory, list) == 0);
+    REQUIRE(ListDepth(memory, list) == 0);
+    std::sort(held.begin(), held.end());
+    std::sort(entries.begin(), entries.end());
+    REQUIRE(held == entries);
+  }
+}
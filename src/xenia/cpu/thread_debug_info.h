@@ -55,6 +55,15 @@ struct ThreadDebugInfo {
   // Whether the debugger has forcefully suspended this thread.
   bool suspended = false;
 
+  // Wait statistics, only kept with --wait_graph.
+  // Handle of the first object waited on while in kWaiting.
+  uint32_t wait_object_handle = 0;
+  // Host tick count the current wait began at.
+  uint64_t wait_start_tick = 0;
+  uint64_t wait_count = 0;
+  // Host ticks spent in finished waits.
+  uint64_t blocked_ticks = 0;
+
   // A breakpoint managed by the stepping system, installed as required to
   // trigger a break at the next instruction.
   std::unique_ptr<Breakpoint> step_breakpoint;
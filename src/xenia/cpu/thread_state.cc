@@ -13,6 +13,7 @@
 #include <cstring>
 
 #include "xenia/base/assert.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
@@ -49,6 +50,11 @@ ThreadState::ThreadState(Processor* processor, uint32_t thread_id,
   context_->processor = processor_;
   context_->thread_state = this;
   context_->thread_id = thread_id_;
+  context_->host_rounding_mode = -1;
+  if (processor_->function_trace_recorder()) {
+    context_->function_trace_ring =
+        processor_->function_trace_recorder()->CreateRing(thread_id_);
+  }
 
   // Set initial registers.
   context_->r[1] = stack_base;
@@ -56,6 +62,17 @@ ThreadState::ThreadState(Processor* processor, uint32_t thread_id,
 }
 
 ThreadState::~ThreadState() {
+  if (spin_stats_.wait_count) {
+    XELOGD("Thread %.8X spun %lld times in %lld waits (%lldms)", thread_id_,
+           static_cast<long long>(spin_stats_.iteration_count),
+           static_cast<long long>(spin_stats_.wait_count),
+           static_cast<long long>(spin_stats_.tick_count * 1000 /
+                                  Clock::host_tick_frequency()));
+  }
+  if (context_->function_trace_ring) {
+    processor_->function_trace_recorder()->ReleaseRing(
+        context_->function_trace_ring);
+  }
   if (backend_data_) {
     processor_->backend()->FreeThreadData(backend_data_);
   }
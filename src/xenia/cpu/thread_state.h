@@ -10,9 +10,11 @@
 #ifndef XENIA_CPU_THREAD_STATE_H_
 #define XENIA_CPU_THREAD_STATE_H_
 
+#include <memory>
 #include <string>
 
 #include "xenia/cpu/ppc/ppc_context.h"
+#include "xenia/cpu/probe.h"
 #include "xenia/cpu/thread_state.h"
 #include "xenia/memory.h"
 
@@ -33,6 +35,33 @@ class ThreadState {
   ppc::PPCContext* context() const { return context_; }
   uint32_t thread_id() const { return thread_id_; }
 
+  // Time this thread has spent in guest loops that were only waiting on
+  // memory (see the yield_on_spin_loops flag).
+  struct SpinStats {
+    // Number of spin loop iterations/priority hints executed.
+    uint64_t iteration_count = 0;
+    // Number of distinct waits (runs of back-to-back iterations).
+    uint64_t wait_count = 0;
+    // Total host ticks spent spinning.
+    uint64_t tick_count = 0;
+    // Host tick of the end of the last iteration and the length of the run
+    // it belongs to. Used to scale back how eagerly we give up the core.
+    uint64_t last_tick = 0;
+    uint32_t streak = 0;
+  };
+  SpinStats& spin_stats() { return spin_stats_; }
+  const SpinStats& spin_stats() const { return spin_stats_; }
+
+  // Hits of tracepoints on this thread, created by the first one. Guarded by
+  // the processor.
+  ProbeTraceBuffer* probe_trace() const { return probe_trace_.get(); }
+  ProbeTraceBuffer* EnsureProbeTrace() {
+    if (!probe_trace_) {
+      probe_trace_ = std::make_unique<ProbeTraceBuffer>();
+    }
+    return probe_trace_.get();
+  }
+
   static void Bind(ThreadState* thread_state);
   static ThreadState* Get();
   static uint32_t GetThreadID();
@@ -45,6 +74,9 @@ class ThreadState {
   uint32_t pcr_address_ = 0;
   uint32_t thread_id_ = 0;
 
+  SpinStats spin_stats_;
+  std::unique_ptr<ProbeTraceBuffer> probe_trace_;
+
   // NOTE: must be 64b aligned for SSE ops.
   ppc::PPCContext* context_;
 };
@@ -0,0 +1,209 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include <gflags/gflags.h>
+
+#include <cinttypes>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/function_trace_recorder.h"
+
+DEFINE_string(trace_dump_format, "text",
+              "text: one line per record, indented by call depth. timeline: "
+              "Chrome trace event JSON, for chrome://tracing or Perfetto.");
+DEFINE_string(trace_dump_output, "",
+              "Path to write the decoded trace to. Written to stdout if "
+              "empty.");
+
+namespace xe {
+namespace cpu {
+
+struct DumpState {
+  const FunctionTraceFileHeader* header = nullptr;
+  // Microseconds per TSC tick, or 0 if the trace was cut short before the
+  // end chunk, in which case times are left in TSC ticks.
+  double tsc_us = 0;
+  FILE* file = nullptr;
+  bool timeline = false;
+  bool first_event = true;
+  std::unordered_map<uint32_t, int> depths;
+};
+
+// Calls fn for every chunk and its records, returning false if the file is
+// malformed.
+template <typename Fn>
+static bool ForEachChunk(const uint8_t* data, size_t size, Fn fn) {
+  size_t offset = sizeof(FunctionTraceFileHeader);
+  while (offset < size) {
+    if (offset + sizeof(FunctionTraceChunkHeader) > size) {
+      return false;
+    }
+    auto chunk =
+        reinterpret_cast<const FunctionTraceChunkHeader*>(data + offset);
+    offset += sizeof(FunctionTraceChunkHeader);
+    size_t records_size = chunk->record_count * sizeof(FunctionTraceRecord);
+    if (offset + records_size > size) {
+      return false;
+    }
+    fn(chunk, reinterpret_cast<const FunctionTraceRecord*>(data + offset));
+    offset += records_size;
+  }
+  return true;
+}
+
+static double ToTime(const DumpState& state, uint64_t timestamp) {
+  uint64_t ticks = timestamp - state.header->start_timestamp;
+  return state.tsc_us ? ticks * state.tsc_us : double(ticks);
+}
+
+static void DumpRecord(DumpState* state, uint32_t thread_id,
+                       const FunctionTraceRecord& record) {
+  bool is_enter = record.type == FunctionTraceRecord::kEnter;
+  bool has_gprs = !!(state->header->flags & FunctionTraceFileHeader::kFlagGprs);
+  double time = ToTime(*state, record.timestamp);
+  if (state->timeline) {
+    std::fprintf(state->file,
+                 "%s\n    {\"name\": \"%.8X\", \"ph\": \"%s\", \"ts\": %.3f, "
+                 "\"pid\": 0, \"tid\": %u",
+                 state->first_event ? "" : ",", record.guest_address,
+                 is_enter ? "B" : "E", time, thread_id);
+    if (has_gprs) {
+      std::fprintf(state->file,
+                   ", \"args\": {\"r3\": \"%.16" PRIX64 "\", "
+                   "\"r4\": \"%.16" PRIX64 "\"}",
+                   record.gprs[0], record.gprs[1]);
+    }
+    std::fprintf(state->file, "}");
+    state->first_event = false;
+    return;
+  }
+
+  // Returns from functions entered before the trace started go negative.
+  int& depth = state->depths[thread_id];
+  if (!is_enter) {
+    --depth;
+  }
+  std::fprintf(state->file, "%.8X %14.3f %*s%s %.8X", thread_id, time,
+               depth > 0 ? depth * 2 : 0, "", is_enter ? ">" : "<",
+               record.guest_address);
+  if (has_gprs) {
+    std::fprintf(state->file,
+                 " r3=%.16" PRIX64 " r4=%.16" PRIX64, record.gprs[0],
+                 record.gprs[1]);
+  }
+  std::fprintf(state->file, "\n");
+  if (is_enter) {
+    ++depth;
+  }
+}
+
+int trace_dump_main(const std::vector<std::wstring>& args) {
+  if (args.size() < 2) {
+    XELOGE("Usage: %S [trace_path]", args[0].c_str());
+    return 1;
+  }
+  std::wstring path = xe::to_absolute_path(args[1]);
+  auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!mmap || mmap->size() < sizeof(FunctionTraceFileHeader)) {
+    XELOGE("Unable to open %S", path.c_str());
+    return 1;
+  }
+  DumpState state;
+  state.header = reinterpret_cast<const FunctionTraceFileHeader*>(mmap->data());
+  if (state.header->magic != FunctionTraceFileHeader::kMagic ||
+      state.header->version != FunctionTraceFileHeader::kVersion) {
+    XELOGE("%S is not a function trace", path.c_str());
+    return 1;
+  }
+
+  // Converting TSC ticks to time needs the end chunk.
+  uint64_t record_count = 0;
+  uint64_t dropped_count = 0;
+  bool complete = ForEachChunk(
+      mmap->data(), mmap->size(),
+      [&](const FunctionTraceChunkHeader* chunk,
+          const FunctionTraceRecord* records) {
+        if (chunk->type == FunctionTraceChunkHeader::kEnd &&
+            chunk->end_timestamp > state.header->start_timestamp) {
+          state.tsc_us =
+              double(chunk->end_host_ticks - state.header->start_host_ticks) *
+              1000000.0 / double(state.header->host_tick_frequency) /
+              double(chunk->end_timestamp - state.header->start_timestamp);
+        }
+        record_count += chunk->record_count;
+        dropped_count += chunk->dropped_count;
+      });
+  if (!complete) {
+    XELOGW("Trace is truncated; decoding the complete chunks");
+  }
+  if (!state.tsc_us) {
+    XELOGW("Trace has no end chunk; times are in TSC ticks");
+  }
+
+  if (FLAGS_trace_dump_format == "timeline") {
+    state.timeline = true;
+  } else if (FLAGS_trace_dump_format != "text") {
+    XELOGE("Unknown --trace_dump_format %s",
+           FLAGS_trace_dump_format.c_str());
+    return 1;
+  }
+  state.file = stdout;
+  if (!FLAGS_trace_dump_output.empty()) {
+    state.file = xe::filesystem::OpenFile(
+        xe::to_wstring(FLAGS_trace_dump_output), "w");
+    if (!state.file) {
+      XELOGE("Unable to open %s", FLAGS_trace_dump_output.c_str());
+      return 1;
+    }
+  }
+
+  if (state.timeline) {
+    std::fprintf(state.file, "{\n  \"traceEvents\": [");
+  }
+  ForEachChunk(mmap->data(), mmap->size(),
+               [&](const FunctionTraceChunkHeader* chunk,
+                   const FunctionTraceRecord* records) {
+                 if (chunk->type != FunctionTraceChunkHeader::kRecords) {
+                   return;
+                 }
+                 if (chunk->dropped_count && !state.timeline) {
+                   std::fprintf(state.file,
+                                "%.8X dropped %" PRIu64 " records\n",
+                                chunk->thread_id, chunk->dropped_count);
+                 }
+                 for (uint32_t i = 0; i < chunk->record_count; ++i) {
+                   DumpRecord(&state, chunk->thread_id, records[i]);
+                 }
+               });
+  if (state.timeline) {
+    std::fprintf(state.file, "\n  ],\n  \"displayTimeUnit\": \"ns\"\n}\n");
+  }
+  if (state.file != stdout) {
+    std::fclose(state.file);
+  }
+
+  XELOGI("Decoded %" PRIu64 " records, %" PRIu64 " dropped", record_count,
+         dropped_count);
+  return 0;
+}
+
+}  // namespace cpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-cpu-trace-dump",
+                   L"xenia-cpu-trace-dump [trace_path]",
+                   xe::cpu::trace_dump_main);
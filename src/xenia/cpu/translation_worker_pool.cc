@@ -0,0 +1,178 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/cpu/translation_worker_pool.h"
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+#include "xenia/cpu/function.h"
+#include "xenia/cpu/processor.h"
+
+namespace xe {
+namespace cpu {
+
+// Upper bound on pending requests, to keep speculative call target chasing
+// from ballooning on huge titles.
+static const size_t kMaxQueueDepth = 64 * 1024;
+
+TranslationWorkerPool::TranslationWorkerPool(Processor* processor)
+    : processor_(processor) {}
+
+TranslationWorkerPool::~TranslationWorkerPool() { Shutdown(); }
+
+void TranslationWorkerPool::Start(uint32_t worker_count) {
+  assert_true(workers_.empty());
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    params.initial_priority = xe::threading::ThreadPriority::kBelowNormal;
+    auto thread =
+        xe::threading::Thread::Create(params, [this]() { WorkerMain(); });
+    if (!thread) {
+      XELOGE("Unable to create translation worker %d", i);
+      break;
+    }
+    thread->set_name(xe::format_string("Translation Worker %d", i));
+    workers_.push_back(std::move(thread));
+  }
+  if (!workers_.empty()) {
+    XELOGI("Started %d background translation workers", int(workers_.size()));
+  }
+}
+
+void TranslationWorkerPool::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    shutting_down_ = true;
+    queue_ = std::priority_queue<Request>();
+  }
+  queue_cond_.notify_all();
+  idle_cond_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker.get(), false);
+  }
+  workers_.clear();
+}
+
+void TranslationWorkerPool::Enqueue(uint32_t address, int32_t priority,
+                                    bool follow_calls) {
+  if (!is_running() || !address) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (shutting_down_ || queue_.size() >= kMaxQueueDepth) {
+      return;
+    }
+    if (!queued_addresses_.insert(address).second) {
+      return;
+    }
+    Request request;
+    request.priority = priority;
+    request.sequence = next_sequence_++;
+    request.address = address;
+    request.follow_calls = follow_calls;
+    request.tier_up_function = nullptr;
+    queue_.push(request);
+  }
+  ++queued_count_;
+  queue_cond_.notify_one();
+}
+
+void TranslationWorkerPool::EnqueueTierUp(GuestFunction* function) {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (shutting_down_) {
+      return;
+    }
+    // Not bounded by kMaxQueueDepth, as there is at most one per function.
+    Request request;
+    request.priority = kPriorityTierUp;
+    request.sequence = next_sequence_++;
+    request.address = function->address();
+    request.follow_calls = false;
+    request.tier_up_function = function;
+    queue_.push(request);
+  }
+  queue_cond_.notify_one();
+}
+
+void TranslationWorkerPool::RecordStall(uint64_t microseconds) {
+  ++stall_count_;
+  stall_microseconds_ += microseconds;
+}
+
+TranslationWorkerPool::Stats TranslationWorkerPool::QueryStats() {
+  Stats stats;
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    stats.queue_depth = uint32_t(queue_.size());
+  }
+  stats.queued_count = queued_count_;
+  stats.translated_count = translated_count_;
+  stats.tier_up_count = tier_up_count_;
+  stats.stall_count = stall_count_;
+  stats.stall_microseconds = stall_microseconds_;
+  return stats;
+}
+
+bool TranslationWorkerPool::WaitForIdle(std::chrono::milliseconds timeout) {
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  return idle_cond_.wait_for(lock, timeout, [this]() {
+    return shutting_down_ || (queue_.empty() && !active_count_);
+  });
+}
+
+void TranslationWorkerPool::WorkerMain() {
+  while (true) {
+    Request request;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cond_.wait(lock,
+                       [this]() { return shutting_down_ || !queue_.empty(); });
+      if (shutting_down_) {
+        return;
+      }
+      request = queue_.top();
+      queue_.pop();
+      ++active_count_;
+    }
+
+    if (request.tier_up_function) {
+      if (processor_->RecompileFunction(request.tier_up_function)) {
+        ++tier_up_count_;
+      }
+    } else {
+      // Goes down the same path as a guest demand. If a guest thread gets
+      // there first this just waits on (or returns) its result.
+      std::vector<uint32_t> call_targets;
+      if (processor_->PrecompileFunction(request.address, &call_targets)) {
+        ++translated_count_;
+        int32_t child_priority = request.priority - kPriorityCallDepthPenalty;
+        if (request.follow_calls && child_priority > 0) {
+          for (uint32_t target : call_targets) {
+            Enqueue(target, child_priority);
+          }
+        }
+      }
+    }
+
+    bool idle;
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      idle = !--active_count_ && queue_.empty();
+    }
+    if (idle) {
+      idle_cond_.notify_all();
+    }
+  }
+}
+
+}  // namespace cpu
+}  // namespace xe
@@ -0,0 +1,132 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_CPU_TRANSLATION_WORKER_POOL_H_
+#define XENIA_CPU_TRANSLATION_WORKER_POOL_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <unordered_set>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace cpu {
+
+class GuestFunction;
+class Processor;
+
+// Translates guest functions on background threads ahead of their first call,
+// so that guest threads mostly find finished code in the entry table.
+// Each worker runs the regular Processor::ResolveFunction path, and the
+// frontend hands every concurrent translation its own PPCTranslator (and with
+// it its own HIRBuilder/Compiler/X64Emitter) from its pool.
+class TranslationWorkerPool {
+ public:
+  // Rough priorities for queued functions. Higher is translated first.
+  static const int32_t kPriorityTierUp = 2000;
+  static const int32_t kPriorityRestore = 1500;
+  static const int32_t kPriorityEntryPoint = 1000;
+  static const int32_t kPriorityExport = 500;
+  static const int32_t kPriorityImport = 100;
+  // Call targets found while translating are queued at the priority of their
+  // caller minus this, so work spreads breadth-first from the roots.
+  static const int32_t kPriorityCallDepthPenalty = 1;
+
+  struct Stats {
+    // Functions waiting to be translated.
+    uint32_t queue_depth;
+    // Total functions queued and translated by workers.
+    uint64_t queued_count;
+    uint64_t translated_count;
+    uint64_t tier_up_count;
+    // Guest demands that had to translate or wait for a translation.
+    uint64_t stall_count;
+    uint64_t stall_microseconds;
+  };
+
+  explicit TranslationWorkerPool(Processor* processor);
+  ~TranslationWorkerPool();
+
+  bool is_running() const { return !workers_.empty(); }
+
+  // Starts the given number of workers. 0 leaves the pool idle, in which case
+  // all translation happens on demand.
+  void Start(uint32_t worker_count);
+  // Stops all workers, dropping anything still queued.
+  void Shutdown();
+
+  // Queues the function at the given guest address for translation.
+  // Redundant requests are ignored. Unless follow_calls is false, the targets
+  // of its direct calls are queued after it.
+  void Enqueue(uint32_t address, int32_t priority, bool follow_calls = true);
+  // Queues a hot baseline tier function for recompilation at the optimized
+  // tier. Callers must ensure each function is only queued once.
+  void EnqueueTierUp(GuestFunction* function);
+
+  // Records time a guest thread spent blocked translating a function on
+  // demand (or waiting for another thread to finish it).
+  void RecordStall(uint64_t microseconds);
+
+  Stats QueryStats();
+
+  // Waits until nothing is queued or being translated. Returns false on
+  // timeout.
+  bool WaitForIdle(std::chrono::milliseconds timeout);
+
+ private:
+  struct Request {
+    int32_t priority;
+    // Monotonic order for stable sorting within a priority level.
+    uint64_t sequence;
+    uint32_t address;
+    bool follow_calls;
+    // Set when recompiling an existing function instead of translating a new
+    // one.
+    GuestFunction* tier_up_function;
+    bool operator<(const Request& other) const {
+      if (priority != other.priority) {
+        return priority < other.priority;
+      }
+      return sequence > other.sequence;
+    }
+  };
+
+  void WorkerMain();
+
+  Processor* processor_ = nullptr;
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers_;
+
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cond_;
+  bool shutting_down_ = false;
+  std::priority_queue<Request> queue_;
+  // Requests taken off the queue that workers are still on.
+  uint32_t active_count_ = 0;
+  std::condition_variable idle_cond_;
+  // All addresses ever queued. Functions are only translated once.
+  std::unordered_set<uint32_t> queued_addresses_;
+  uint64_t next_sequence_ = 0;
+
+  std::atomic<uint64_t> queued_count_ = {0};
+  std::atomic<uint64_t> translated_count_ = {0};
+  std::atomic<uint64_t> tier_up_count_ = {0};
+  std::atomic<uint64_t> stall_count_ = {0};
+  std::atomic<uint64_t> stall_microseconds_ = {0};
+};
+
+}  // namespace cpu
+}  // namespace xe
+
+#endif  // XENIA_CPU_TRANSLATION_WORKER_POOL_H_
@@ -10,12 +10,27 @@
 #include "xenia/cpu/xex_module.h"
 
 #include <algorithm>
-
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "xenia/base/aes_cbc.h"
 #include "xenia/base/byte_order.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/cpu_flags.h"
+#include "xenia/cpu/crt_routines.h"
 #include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/lzx.h"
 #include "xenia/cpu/processor.h"
@@ -23,9 +38,8 @@
 #include "xenia/kernel/xmodule.h"
 
 #include "third_party/crypto/TinySHA1.hpp"
-#include "third_party/crypto/rijndael-alg-fst.c"
-#include "third_party/crypto/rijndael-alg-fst.h"
 #include "third_party/pe/pe_image.h"
+#include "third_party/xxhash/xxhash.h"
 
 static const uint8_t xe_xex2_retail_key[16] = {
     0x20, 0xB1, 0x85, 0xA5, 0x9D, 0x28, 0xFD, 0xC3,
@@ -37,26 +51,131 @@ static const uint8_t xe_xex2_devkit_key[16] = {
 void aes_decrypt_buffer(const uint8_t* session_key, const uint8_t* input_buffer,
                         const size_t input_size, uint8_t* output_buffer,
                         const size_t output_size) {
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key, 128);
-  const uint8_t* ct = input_buffer;
-  uint8_t* pt = output_buffer;
-  for (size_t n = 0; n < input_size; n += 16, ct += 16, pt += 16) {
-    // Decrypt 16 uint8_ts from input -> output.
-    rijndaelDecrypt(rk, Nr, ct, pt);
-    for (size_t i = 0; i < 16; i++) {
-      // XOR with previous.
-      pt[i] ^= ivec[i];
-      // Set previous.
-      ivec[i] = ct[i];
-    }
-  }
+  xe::AesCbcDecryptor(session_key)
+      .Decrypt(nullptr, input_buffer, input_size, output_buffer);
 }
 
 namespace xe {
 namespace cpu {
 
+// A fully loaded image as written to --xex_image_cache_path: this header, the
+// final xex headers and then the image. Host endian. The header is written
+// last so a partially written file is never accepted.
+struct ImageCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint64_t key;
+  uint32_t header_size;
+  uint32_t image_size;
+  uint8_t session_key[16];
+  uint32_t is_dev_kit;
+  uint32_t reserved;
+};
+static const uint32_t kImageCacheMagic = 'XIMG';
+static const uint32_t kImageCacheVersion = 1;
+
+static std::wstring GetImageCachePath(uint64_t key) {
+  return xe::join_paths(xe::to_wstring(FLAGS_xex_image_cache_path),
+                        xe::format_string(L"%.16llX.xic", key));
+}
+
+// Work below this size isn't worth waking up other threads for.
+static const size_t kParallelLoadGranularity = 1024 * 1024;
+
+static uint32_t GetLoadThreadCount(size_t work_size) {
+  size_t count = std::min(size_t(xe::threading::logical_processor_count()),
+                          work_size / kParallelLoadGranularity);
+  return uint32_t(std::max(count, size_t(1)));
+}
+
+// Calls fn(i) for every i in [0, count) from up to thread_count threads,
+// including the calling one. Indices are handed out in order.
+static void ParallelFor(size_t count, uint32_t thread_count,
+                        const std::function<void(size_t)>& fn) {
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next_index.fetch_add(1)) < count;) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Decrypts a CBC stream in chunks on background threads. Each chunk is
+// chained to the last ciphertext block of the one before it, so they are
+// independent; the caller can consume the decrypted prefix while the rest is
+// still being worked on (and paged in from the backing file).
+class ParallelDecryptJob {
+ public:
+  ParallelDecryptJob(const uint8_t* session_key, const uint8_t* input,
+                     size_t size, uint8_t* output)
+      : aes_(session_key),
+        input_(input),
+        size_(size),
+        output_(output),
+        chunk_count_((size + kParallelLoadGranularity - 1) /
+                     kParallelLoadGranularity),
+        chunk_done_(chunk_count_, false) {
+    uint32_t thread_count = GetLoadThreadCount(size);
+    for (uint32_t i = 0; i < thread_count; ++i) {
+      threads_.emplace_back([this]() { WorkerMain(); });
+    }
+  }
+
+  ~ParallelDecryptJob() {
+    // Lets workers finish early if the consumer gave up.
+    next_chunk_ = chunk_count_;
+    for (auto& thread : threads_) {
+      thread.join();
+    }
+  }
+
+  // Blocks until the first size bytes of the output are decrypted.
+  void WaitFor(size_t size) {
+    size = std::min(size, size_);
+    std::unique_lock<std::mutex> lock(mutex_);
+    ready_cv_.wait(lock, [&]() { return ready_size_ >= size; });
+  }
+
+ private:
+  void WorkerMain() {
+    for (size_t i; (i = next_chunk_.fetch_add(1)) < chunk_count_;) {
+      size_t offset = i * kParallelLoadGranularity;
+      size_t length = std::min(kParallelLoadGranularity, size_ - offset);
+      aes_.Decrypt(offset ? input_ + offset - 16 : nullptr, input_ + offset,
+                   length, output_ + offset);
+      std::lock_guard<std::mutex> lock(mutex_);
+      chunk_done_[i] = true;
+      while (ready_chunks_ < chunk_count_ && chunk_done_[ready_chunks_]) {
+        ++ready_chunks_;
+      }
+      ready_size_ = std::min(ready_chunks_ * kParallelLoadGranularity, size_);
+      ready_cv_.notify_all();
+    }
+  }
+
+  xe::AesCbcDecryptor aes_;
+  const uint8_t* input_;
+  size_t size_;
+  uint8_t* output_;
+  size_t chunk_count_;
+  std::atomic<size_t> next_chunk_ = {0};
+  std::vector<std::thread> threads_;
+
+  std::mutex mutex_;
+  std::condition_variable ready_cv_;
+  std::vector<bool> chunk_done_;
+  size_t ready_chunks_ = 0;
+  size_t ready_size_ = 0;
+};
+
 using xe::kernel::KernelState;
 
 XexModule::XexModule(Processor* processor, KernelState* kernel_state)
@@ -202,6 +321,21 @@ int XexModule::ApplyPatch(XexModule* module) {
     return 1;
   }
 
+  // The patched image is cached under the base image and everything that
+  // went into the patch.
+  uint64_t patched_cache_key = 0;
+  if (module->image_cache_key_) {
+    patched_cache_key = XXH64(xex_header_mem_.data(), xex_header_mem_.size(),
+                              module->image_cache_key_);
+    patched_cache_key =
+        XXH64(xexp_data_mem_.data(), xexp_data_mem_.size(), patched_cache_key);
+    if (module->LoadCachedImage(patched_cache_key, module->image_size())) {
+      XELOGI("Loaded patched XEX image from cache");
+      module->image_cache_key_ = patched_cache_key;
+      return 0;
+    }
+  }
+
   // Grab the delta descriptor and get to work.
   xex2_opt_delta_patch_descriptor* patch_header = nullptr;
   GetOptHeader(XEX_HEADER_DELTA_PATCH_DESCRIPTOR,
@@ -458,6 +592,11 @@ int XexModule::ApplyPatch(XexModule* module) {
         "version: %d.%d.%d.%d",
         source_ver.major, source_ver.minor, source_ver.build, source_ver.qfe,
         target_ver.major, target_ver.minor, target_ver.build, target_ver.qfe);
+
+    if (patched_cache_key) {
+      module->image_cache_key_ = patched_cache_key;
+      module->SaveCachedImage(patched_cache_key);
+    }
   } else {
     XELOGE("XEX patch application failed, error code %d", result_code);
   }
@@ -539,8 +678,8 @@ int XexModule::ReadImageUncompressed(const void* xex_addr, size_t xex_length) {
            uncompressed_size);
     return 2;
   }
+  // All of it is written below.
   uint8_t* buffer = memory()->TranslateVirtual(base_address_);
-  std::memset(buffer, 0, uncompressed_size);
 
   const uint8_t* p = (const uint8_t*)xex_addr + xex_header()->header_size;
 
@@ -551,10 +690,11 @@ int XexModule::ReadImageUncompressed(const void* xex_addr, size_t xex_length) {
       }
       memcpy(buffer, p, exe_length);
       return 0;
-    case XEX_ENCRYPTION_NORMAL:
-      aes_decrypt_buffer(session_key_, p, exe_length, buffer,
-                         uncompressed_size);
+    case XEX_ENCRYPTION_NORMAL: {
+      ParallelDecryptJob job(session_key_, p, exe_length, buffer);
+      job.WaitFor(exe_length);
       return 0;
+    }
     default:
       assert_always();
       return 1;
@@ -607,47 +747,68 @@ int XexModule::ReadImageBasicCompressed(const void* xex_addr,
     return 1;
   }
 
+  // Only the parts the blocks don't fill in are zeroed.
   uint8_t* buffer = memory()->TranslateVirtual(base_address_);
-  std::memset(buffer, 0, total_size);  // Quickly zero the contents.
-  uint8_t* d = buffer;
 
-  uint32_t rk[4 * (MAXNR + 1)];
-  uint8_t ivec[16] = {0};
-  int32_t Nr = rijndaelKeySetupDec(rk, session_key_, 128);
+  auto encryption_type = opt_file_format_info()->encryption_type;
+  if (encryption_type != XEX_ENCRYPTION_NONE &&
+      encryption_type != XEX_ENCRYPTION_NORMAL) {
+    assert_always();
+    return 1;
+  }
 
-  for (size_t n = 0; n < block_count; n++) {
+  // Blocks don't depend on each other (the CBC chain only needs the
+  // preceding ciphertext), so lay them all out first and then fill them in
+  // from as many threads as the data size warrants.
+  struct Block {
+    const uint8_t* iv;
+    const uint8_t* source;
+    uint8_t* dest;
+    uint32_t size;
+    uint32_t zero_size;
+  };
+  std::vector<Block> blocks(block_count);
+  const uint8_t* iv = nullptr;
+  uint32_t dest_offset = 0;
+  for (uint32_t n = 0; n < block_count; n++) {
     const uint32_t data_size = comp_info.blocks[n].data_size;
     const uint32_t zero_size = comp_info.blocks[n].zero_size;
-
-    switch (opt_file_format_info()->encryption_type) {
-      case XEX_ENCRYPTION_NONE:
-        if (data_size > uncompressed_size - (d - buffer)) {
-          // Overflow.
-          return 1;
-        }
-        memcpy(d, p, data_size);
-        break;
-      case XEX_ENCRYPTION_NORMAL: {
-        const uint8_t* ct = p;
-        uint8_t* pt = d;
-        for (size_t m = 0; m < data_size; m += 16, ct += 16, pt += 16) {
-          // Decrypt 16 uint8_ts from input -> output.
-          rijndaelDecrypt(rk, Nr, ct, pt);
-          for (size_t i = 0; i < 16; i++) {
-            // XOR with previous.
-            pt[i] ^= ivec[i];
-            // Set previous.
-            ivec[i] = ct[i];
-          }
-        }
-      } break;
-      default:
-        assert_always();
-        return 1;
+    if (data_size > exe_length - (p - source_buffer) ||
+        data_size > total_size - dest_offset) {
+      // Overflow.
+      return 1;
+    }
+    uint32_t dest_size =
+        std::min(data_size + zero_size, total_size - dest_offset);
+    blocks[n] = {iv, p, buffer + dest_offset, data_size,
+                 dest_size - data_size};
+    if (data_size) {
+      // The chain continues from the last cipher block touched, which for a
+      // partial block runs past the data.
+      iv = p + xe::round_up(data_size, 16u) - 16;
     }
-
     p += data_size;
-    d += data_size + zero_size;
+    dest_offset += dest_size;
+  }
+  std::memset(buffer + dest_offset, 0, total_size - dest_offset);
+
+  xe::AesCbcDecryptor aes(session_key_);
+  auto fill_block = [&](size_t n) {
+    auto& block = blocks[n];
+    if (encryption_type == XEX_ENCRYPTION_NONE) {
+      std::memcpy(block.dest, block.source, block.size);
+    } else {
+      aes.Decrypt(block.iv, block.source, block.size, block.dest);
+    }
+    std::memset(block.dest + block.size, 0, block.zero_size);
+  };
+  uint32_t thread_count = GetLoadThreadCount(exe_length);
+  if (thread_count > 1) {
+    ParallelFor(block_count, thread_count, fill_block);
+  } else {
+    for (size_t n = 0; n < block_count; n++) {
+      fill_block(n);
+    }
   }
 
   return 0;
@@ -672,32 +833,34 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   uint8_t* d = NULL;
   sha1::SHA1 s;
 
-  // Decrypt (if needed).
-  bool free_input = false;
+  compress_buffer = (uint8_t*)calloc(1, exe_length);
+
+  // Decrypt (if needed) straight into the buffer the blocks are joined in,
+  // which is done in place: the chunks only ever move back. This runs in the
+  // background and de-blocking below follows it as blocks become available.
+  // The source, often a mapping of the file, is only read.
   const uint8_t* input_buffer = exe_buffer;
-  size_t input_size = exe_length;
+  std::unique_ptr<ParallelDecryptJob> decrypt_job;
 
   switch (opt_file_format_info()->encryption_type) {
     case XEX_ENCRYPTION_NONE:
       // No-op.
       break;
     case XEX_ENCRYPTION_NORMAL:
-      // TODO: a way to do without a copy/alloc?
-      free_input = true;
-      input_buffer = (const uint8_t*)calloc(1, exe_length);
-      aes_decrypt_buffer(session_key_, exe_buffer, exe_length,
-                         (uint8_t*)input_buffer, exe_length);
+      input_buffer = compress_buffer;
+      decrypt_job = std::make_unique<ParallelDecryptJob>(
+          session_key_, exe_buffer, exe_length, compress_buffer);
       break;
     default:
       assert_always();
+      free(compress_buffer);
       return 1;
   }
 
+  // Copied, as the info of each block is at the start of the one before,
+  // which may be overwritten by its own chunks.
   const auto* compression_info = &opt_file_format_info()->compression_info;
-  const xex2_compressed_block_info* cur_block =
-      &compression_info->normal.first_block;
-
-  compress_buffer = (uint8_t*)calloc(1, exe_length);
+  xex2_compressed_block_info cur_block = compression_info->normal.first_block;
 
   p = input_buffer;
   d = compress_buffer;
@@ -706,15 +869,19 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   int result_code = 0;
 
   uint8_t block_calced_digest[0x14];
-  while (cur_block->block_size) {
-    const uint8_t* pnext = p + cur_block->block_size;
-    const auto* next_block = (const xex2_compressed_block_info*)p;
+  while (cur_block.block_size) {
+    const uint8_t* pnext = p + cur_block.block_size;
+    if (decrypt_job) {
+      decrypt_job->WaitFor(pnext - input_buffer);
+    }
+    xex2_compressed_block_info next_block;
+    std::memcpy(&next_block, p, sizeof(next_block));
 
     // Compare block hash, if no match we probably used wrong decrypt key
     s.reset();
-    s.processBytes(p, cur_block->block_size);
+    s.processBytes(p, cur_block.block_size);
     s.finalize(block_calced_digest);
-    if (memcmp(block_calced_digest, cur_block->block_hash, 0x14) != 0) {
+    if (memcmp(block_calced_digest, cur_block.block_hash, 0x14) != 0) {
       result_code = 2;
       break;
     }
@@ -730,7 +897,7 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
         break;
       }
 
-      memcpy(d, p, chunk_size);
+      std::memmove(d, p, chunk_size);
       p += chunk_size;
       d += chunk_size;
     }
@@ -738,6 +905,8 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
     p = pnext;
     cur_block = next_block;
   }
+  // Whatever is left is padding and hasn't been looked at.
+  decrypt_job.reset();
 
   if (!result_code) {
     uint32_t uncompressed_size = image_size();
@@ -769,9 +938,6 @@ int XexModule::ReadImageCompressed(const void* xex_addr, size_t xex_length) {
   if (compress_buffer) {
     free((void*)compress_buffer);
   }
-  if (free_input) {
-    free((void*)input_buffer);
-  }
   return result_code;
 }
 
@@ -894,7 +1060,17 @@ bool XexModule::Load(const std::string& name, const std::string& path,
   name_ = std::string(name);
   path_ = std::string(path);
 
-  uint8_t* data = memory()->TranslateVirtual(base_address_);
+  // Skip decryption and decompression entirely if this exact image has been
+  // loaded before. The headers hold the digests of the image, so they're
+  // enough to identify it.
+  if (!FLAGS_xex_image_cache_path.empty() && !is_patch()) {
+    image_cache_key_ = XXH64(xex_header_mem_.data(), xex_header_mem_.size(),
+                             kImageCacheVersion);
+    if (LoadCachedImage(image_cache_key_, 0)) {
+      XELOGI("Loaded XEX image from cache");
+      return true;
+    }
+  }
 
   // Load in the XEX basefile
   // We'll try using both XEX2 keys to see if any give a valid PE
@@ -911,11 +1087,102 @@ bool XexModule::Load(const std::string& name, const std::string& path,
     }
   }
 
+  if (image_cache_key_) {
+    SaveCachedImage(image_cache_key_);
+  }
+
   // Note: caller will have to call LoadContinue once it's determined whether a
   // patch file exists or not!
   return true;
 }
 
+bool XexModule::LoadCachedImage(uint64_t key, uint32_t allocated_size) {
+  auto path = GetImageCachePath(key);
+  if (!xe::filesystem::PathExists(path)) {
+    return false;
+  }
+  auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!mmap || mmap->size() < sizeof(ImageCacheHeader)) {
+    return false;
+  }
+  ImageCacheHeader cache_header;
+  std::memcpy(&cache_header, mmap->data(), sizeof(cache_header));
+  if (cache_header.magic != kImageCacheMagic ||
+      cache_header.version != kImageCacheVersion || cache_header.key != key ||
+      sizeof(cache_header) + uint64_t(cache_header.header_size) +
+              cache_header.image_size !=
+          mmap->size()) {
+    XELOGW("XEX image cache %S is stale or corrupt, ignoring", path.c_str());
+    return false;
+  }
+
+  // A patch may have changed the image size.
+  uint32_t image_size = cache_header.image_size;
+  if (image_size > allocated_size) {
+    uint32_t address = base_address_ + allocated_size;
+    bool alloc_result =
+        memory()
+            ->LookupHeap(address)
+            ->AllocFixed(
+                address, image_size - allocated_size, 4096,
+                xe::kMemoryAllocationReserve | xe::kMemoryAllocationCommit,
+                xe::kMemoryProtectRead | xe::kMemoryProtectWrite);
+    if (!alloc_result) {
+      XELOGE("Unable to allocate XEX memory at %.8X-%.8X.", address,
+             image_size - allocated_size);
+      return false;
+    }
+  } else if (image_size < allocated_size) {
+    uint32_t address = base_address_ + image_size;
+    memory()->LookupHeap(address)->Decommit(address,
+                                            allocated_size - image_size);
+  }
+
+  const uint8_t* data = mmap->data() + sizeof(cache_header);
+  xex_header_mem_.assign(data, data + cache_header.header_size);
+  std::memcpy(memory()->TranslateVirtual(base_address_),
+              data + cache_header.header_size, image_size);
+  std::memcpy(session_key_, cache_header.session_key, sizeof(session_key_));
+  is_dev_kit_ = cache_header.is_dev_kit != 0;
+  return true;
+}
+
+void XexModule::SaveCachedImage(uint64_t key) {
+  auto path = GetImageCachePath(key);
+  xe::filesystem::CreateParentFolder(path);
+  auto file = xe::filesystem::OpenFile(path, "wb");
+  if (!file) {
+    XELOGW("Unable to write XEX image cache %S", path.c_str());
+    return;
+  }
+
+  ImageCacheHeader cache_header = {0};
+  uint32_t image_size = this->image_size();
+  bool written =
+      fwrite(&cache_header, sizeof(cache_header), 1, file) == 1 &&
+      fwrite(xex_header_mem_.data(), 1, xex_header_mem_.size(), file) ==
+          xex_header_mem_.size() &&
+      fwrite(memory()->TranslateVirtual(base_address_), 1, image_size,
+             file) == image_size;
+  if (written) {
+    cache_header.magic = kImageCacheMagic;
+    cache_header.version = kImageCacheVersion;
+    cache_header.key = key;
+    cache_header.header_size = uint32_t(xex_header_mem_.size());
+    cache_header.image_size = image_size;
+    std::memcpy(cache_header.session_key, session_key_,
+                sizeof(cache_header.session_key));
+    cache_header.is_dev_kit = is_dev_kit_ ? 1 : 0;
+    written = fseek(file, 0, SEEK_SET) == 0 &&
+              fwrite(&cache_header, sizeof(cache_header), 1, file) == 1;
+  }
+  fclose(file);
+  if (!written) {
+    XELOGW("Unable to write XEX image cache %S", path.c_str());
+    xe::filesystem::DeleteFile(path);
+  }
+}
+
 bool XexModule::LoadContinue() {
   // Second part of image load
   // Split from Load() so that we can patch the XEX before loading this data
@@ -958,6 +1225,16 @@ bool XexModule::LoadContinue() {
   // Notify backend that we have an executable range.
   processor_->backend()->CommitExecutableRange(low_address_, high_address_);
 
+  // Generated code for the title can be reused from previous runs. The headers
+  // hold the digests of the image, so they're enough to identify it; the
+  // backend validates each function against guest memory anyway.
+  if (is_executable() && !FLAGS_persistent_code_cache_path.empty()) {
+    uint64_t module_hash =
+        XXH64(xex_header_mem_.data(), xex_header_mem_.size(), 0);
+    processor_->backend()->OpenPersistentCache(
+        xe::to_wstring(FLAGS_persistent_code_cache_path), module_hash);
+  }
+
   // Add all imports (variables/functions).
   xex2_opt_import_libraries* opt_import_libraries = nullptr;
   GetOptHeader(XEX_HEADER_IMPORT_LIBRARIES, &opt_import_libraries);
@@ -1007,6 +1284,13 @@ bool XexModule::LoadContinue() {
     return false;
   }
 
+  // Swap hot CRT routines (memcpy/memset/etc) for native versions.
+  if (FLAGS_native_crt_signatures.size()) {
+    if (!FindCrtRoutines()) {
+      return false;
+    }
+  }
+
   // Load a specified module map and diff.
   if (FLAGS_load_module_map.size()) {
     if (!ReadMap(FLAGS_load_module_map.c_str())) {
@@ -1035,9 +1319,62 @@ bool XexModule::LoadContinue() {
     page += desc.page_count;
   }
 
+  QueueInitialTranslations();
+
   return true;
 }
 
+void XexModule::QueueInitialTranslations() {
+  auto pool = processor_->translation_worker_pool();
+  if (!pool || !pool->is_running()) {
+    return;
+  }
+
+  // Entry point first, as that is what the title is about to run.
+  uint32_t entry_point = 0;
+  if (GetOptHeader(XEX_HEADER_ENTRY_POINT, &entry_point)) {
+    pool->Enqueue(entry_point, TranslationWorkerPool::kPriorityEntryPoint);
+  }
+
+  // Exports, which other modules may call into immediately.
+  if (xex_security_info()->export_table) {
+    auto export_table = memory()->TranslateVirtual<const xex2_export_table*>(
+        xex_security_info()->export_table);
+    for (uint32_t i = 0; i < export_table->count; i++) {
+      uint32_t ordinal_offset = export_table->ordOffset[i];
+      if (!ordinal_offset) {
+        continue;
+      }
+      ordinal_offset += export_table->imagebaseaddr << 16;
+      pool->Enqueue(ordinal_offset, TranslationWorkerPool::kPriorityExport);
+    }
+  } else {
+    xex2_opt_data_directory* pe_export_directory = 0;
+    if (GetOptHeader(XEX_HEADER_EXPORTS_BY_NAME, &pe_export_directory)) {
+      auto e = memory()->TranslateVirtual<const X_IMAGE_EXPORT_DIRECTORY*>(
+          base_address_ + pe_export_directory->offset);
+      uint32_t* function_table =
+          reinterpret_cast<uint32_t*>(uintptr_t(e) + e->AddressOfFunctions);
+      for (uint32_t i = 0; i < e->NumberOfFunctions; i++) {
+        if (function_table[i]) {
+          pool->Enqueue(base_address_ + function_table[i],
+                        TranslationWorkerPool::kPriorityExport);
+        }
+      }
+    }
+  }
+
+  // Import thunks. These are tiny but called from nearly everywhere.
+  for (auto& library : import_libs_) {
+    for (auto& import : library.imports) {
+      if (import.thunk_address) {
+        pool->Enqueue(import.thunk_address,
+                      TranslationWorkerPool::kPriorityImport);
+      }
+    }
+  }
+}
+
 bool XexModule::Unload() {
   if (!loaded_) {
     return true;
@@ -1048,6 +1385,10 @@ bool XexModule::Unload() {
   if (!is_patch()) {
     assert_not_zero(base_address_);
 
+    // Nothing may keep running translations of code that is going away, as
+    // another module could be loaded at the same address.
+    processor_->InvalidateCodeRange(low_address_, high_address_);
+
     memory()->LookupHeap(base_address_)->Release(base_address_);
   }
 
@@ -1058,6 +1399,12 @@ bool XexModule::Unload() {
 
 bool XexModule::SetupLibraryImports(const char* name,
                                     const xex2_import_library* library) {
+  if (!kernel_state_) {
+    // Loaded by an offline tool; there is nothing to resolve imports against
+    // and their thunks are never run.
+    return true;
+  }
+
   ExportResolver* kernel_resolver = nullptr;
   if (kernel_state_->IsKernelModule(name)) {
     kernel_resolver = processor_->export_resolver();
@@ -1114,6 +1461,7 @@ bool XexModule::SetupLibraryImports(const char* name,
       ImportLibraryFn import_info;
       import_info.ordinal = ordinal;
       import_info.value_address = record_addr;
+      import_info.thunk_address = 0;
       library_info.imports.push_back(import_info);
 
       import_name.AppendFormat("__imp__");
@@ -1567,5 +1915,81 @@ bool XexModule::FindSaveRest() {
   return true;
 }
 
+bool XexModule::FindCrtRoutines() {
+  auto exec_info = opt_execution_info();
+  if (exec_info) {
+    uint32_t title_id = exec_info->title_id;
+    std::stringstream titles(FLAGS_native_crt_disabled_titles);
+    std::string title;
+    while (std::getline(titles, title, ',')) {
+      if (title.size() &&
+          std::strtoul(title.c_str(), nullptr, 16) == title_id) {
+        XELOGI("Native CRT routines disabled for title %.8X", title_id);
+        return true;
+      }
+    }
+  }
+
+  std::vector<CrtSignature> signatures;
+  if (!LoadCrtSignatures(FLAGS_native_crt_signatures, &signatures)) {
+    return false;
+  }
+  if (signatures.empty()) {
+    return true;
+  }
+
+  auto page_size = base_address_ <= 0x90000000 ? 64 * 1024 : 4 * 1024;
+  auto sec_header = xex_security_info();
+  for (uint32_t i = 0, page = 0; i < sec_header->page_descriptor_count; i++) {
+    // Byteswap the bitfield manually.
+    xex2_page_descriptor desc;
+    desc.value = xe::byte_swap(sec_header->page_descriptors[i].value);
+
+    const auto start_address = base_address_ + (page * page_size);
+    const auto end_address = start_address + (desc.page_count * page_size);
+    page += desc.page_count;
+    if (desc.info != XEX_SECTION_CODE) {
+      continue;
+    }
+
+    auto p = memory()->TranslateVirtual<const uint32_t*>(start_address);
+    uint32_t word_count = (end_address - start_address) / 4;
+    for (uint32_t n = 0; n < word_count; n++) {
+      for (auto& signature : signatures) {
+        size_t length = signature.values.size();
+        if (n + length > word_count) {
+          continue;
+        }
+        size_t j = 0;
+        for (; j < length; j++) {
+          if ((xe::byte_swap(p[n + j]) & signature.masks[j]) !=
+              signature.values[j]) {
+            break;
+          }
+        }
+        if (j != length) {
+          continue;
+        }
+
+        uint32_t address = start_address + n * 4;
+        Function* function;
+        DeclareFunction(address, &function);
+        if (function->behavior() != Function::Behavior::kDefault) {
+          // Already claimed (save/restore helpers, another signature).
+          break;
+        }
+        XELOGI("Native %s bound at %.8X", signature.routine->name, address);
+        function->set_name(signature.routine->name);
+        static_cast<GuestFunction*>(function)->SetupExtern(
+            signature.routine->handler, nullptr);
+        function->set_status(Symbol::Status::kDeclared);
+        break;
+      }
+    }
+  }
+
+  return true;
+}
+
 }  // namespace cpu
 }  // namespace xe
@@ -162,9 +162,19 @@ class XexModule : public xe::cpu::Module {
 
   int ReadPEHeaders();
 
+  // Restores the final headers and image saved under key, growing or
+  // shrinking the allocated_size bytes already at base_address_ to fit.
+  bool LoadCachedImage(uint64_t key, uint32_t allocated_size);
+  void SaveCachedImage(uint64_t key);
+
   bool SetupLibraryImports(const char* name,
                            const xex2_import_library* library);
   bool FindSaveRest();
+  // Binds statically linked CRT routines matching --native_crt_signatures
+  // to their native implementations.
+  bool FindCrtRoutines();
+  // Queues the known roots of the call graph for background translation.
+  void QueueInitialTranslations();
 
   Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -179,6 +189,8 @@ class XexModule : public xe::cpu::Module {
 
   uint8_t session_key_[0x10];
   bool is_dev_kit_ = false;
+  // Identifies the loaded image in --xex_image_cache_path, or 0.
+  uint64_t image_cache_key_ = 0;
 
   bool loaded_ = false;         // Loaded into memory?
   bool finished_load_ = false;  // PE/imports/symbols/etc all loaded?
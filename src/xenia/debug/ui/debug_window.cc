@@ -27,9 +27,11 @@
 #include "xenia/base/string_util.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/breakpoint.h"
+#include "xenia/cpu/export_resolver.h"
 #include "xenia/cpu/ppc/ppc_opcode_info.h"
 #include "xenia/cpu/stack_walker.h"
 #include "xenia/gpu/graphics_system.h"
+#include "xenia/kernel/wait_graph.h"
 #include "xenia/kernel/xmodule.h"
 #include "xenia/kernel/xthread.h"
 #include "xenia/ui/graphics_provider.h"
@@ -197,6 +199,9 @@ void DebugWindow::DrawFrame() {
   ImGui::SameLine();
   ImGui::RadioButton("Memory", &state_.right_pane_tab,
                      ImState::kRightPaneMemory);
+  ImGui::SameLine();
+  ImGui::RadioButton("Kernel Calls", &state_.right_pane_tab,
+                     ImState::kRightPaneKernelCalls);
   ImGui::EndGroup();
   ImGui::Separator();
   switch (state_.right_pane_tab) {
@@ -210,6 +215,11 @@ void DebugWindow::DrawFrame() {
       DrawMemoryPane();
       ImGui::EndChild();
       break;
+    case ImState::kRightPaneKernelCalls:
+      ImGui::BeginChild("##kernel_calls_pane");
+      DrawKernelCallsPane();
+      ImGui::EndChild();
+      break;
   }
   ImGui::EndChild();
   ImGui::InvisibleButton("##hsplitter0", ImVec2(-1, kSplitterWidth));
@@ -304,11 +314,116 @@ void DebugWindow::DrawToolbar() {
 }
 
 void DebugWindow::DrawFunctionsPane() {
-  ImGui::Text("<functions>");
-  // bar: analyze (?), goto current
-  // combo with module (+ emulator itself?)
-  // list with all functions known
-  // filter box + search button -> search dialog
+  auto& state = state_.functions;
+  UpdateFunctionMatches();
+
+  ImGui::PushItemWidth(-1);
+  StringBuffer module_combo;
+  module_combo.Append("(all modules)");
+  module_combo.Append('\0');
+  for (auto module : state.modules) {
+    module_combo.Append(module->name());
+    module_combo.Append('\0');
+  }
+  int module_combo_index = state.module_index + 1;
+  if (ImGui::Combo("##module_combo", &module_combo_index,
+                   module_combo.GetString(), 10)) {
+    state.module_index = module_combo_index - 1;
+  }
+  ImGui::Dummy(ImVec2(0, 2));
+  ImGui::InputText("##function_filter", state.filter,
+                   xe::countof(state.filter),
+                   ImGuiInputTextFlags_AutoSelectAll);
+  ImGui::PopItemWidth();
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Fuzzy search by address or name.");
+  }
+  ImGui::Dummy(ImVec2(0, 2));
+  ImGui::Text("%zu of %zu functions", state.matches.size(),
+              state.entries.size());
+  ImGui::Separator();
+
+  // Only the visible rows are drawn, however many functions there are.
+  ImGui::BeginChild("##function_list", ImVec2(0, 0), false);
+  ImGuiListClipper clipper(static_cast<int>(state.matches.size()),
+                           ImGui::GetTextLineHeightWithSpacing());
+  for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; ++i) {
+    auto& entry = state.entries[state.matches[i].first];
+    auto function = entry.function;
+    char label[128];
+    std::snprintf(label, xe::countof(label), "%.8X %s", entry.address,
+                  function->name().c_str());
+    ImGui::PushID(function);
+    if (ImGui::Selectable(label, function == state_.function)) {
+      NavigateToFunction(function);
+    }
+    ImGui::PopID();
+  }
+  clipper.End();
+  ImGui::EndChild();
+}
+
+void DebugWindow::UpdateFunctionMatches() {
+  auto& state = state_.functions;
+  size_t first_new_entry = state.entries.size();
+  processor_->symbol_index()->CopyEntries(first_new_entry, &state.entries);
+  for (size_t i = first_new_entry; i < state.entries.size(); ++i) {
+    auto module = state.entries[i].module;
+    if (std::find(state.modules.begin(), state.modules.end(), module) ==
+        state.modules.end()) {
+      state.modules.push_back(module);
+    }
+  }
+
+  // Filtering starts over when it changes, and otherwise only takes in the
+  // functions defined since last time.
+  if (state.matched_filter != state.filter ||
+      state.matched_module_index != state.module_index) {
+    state.matches.clear();
+    state.matched_entry_count = 0;
+    state.matched_filter = state.filter;
+    state.matched_module_index = state.module_index;
+  }
+  if (state.matched_entry_count == state.entries.size()) {
+    return;
+  }
+  cpu::Module* module =
+      state.module_index >= 0 ? state.modules[state.module_index] : nullptr;
+  bool has_filter = !state.matched_filter.empty();
+  size_t old_match_count = state.matches.size();
+  for (size_t i = state.matched_entry_count; i < state.entries.size(); ++i) {
+    auto& entry = state.entries[i];
+    if (module && entry.module != module) {
+      continue;
+    }
+    int score = 0;
+    if (has_filter) {
+      char label[128];
+      std::snprintf(label, xe::countof(label), "%.8X %s", entry.address,
+                    entry.function->name().c_str());
+      score = xe::fuzzy_match(state.matched_filter, label);
+      if (!score) {
+        continue;
+      }
+    }
+    state.matches.emplace_back(static_cast<uint32_t>(i), score);
+  }
+  state.matched_entry_count = state.entries.size();
+
+  // Best matches first, then by address. The matches so far are in order
+  // already, so only the new ones have to be sorted.
+  auto& entries = state.entries;
+  auto order = [&entries](const std::pair<uint32_t, int>& a,
+                          const std::pair<uint32_t, int>& b) {
+    if (a.second != b.second) {
+      return a.second > b.second;
+    }
+    return entries[a.first].address < entries[b.first].address;
+  };
+  auto middle = state.matches.begin() + old_match_count;
+  std::sort(middle, state.matches.end(), order);
+  std::inplace_merge(state.matches.begin(), middle, state.matches.end(),
+                     order);
 }
 
 void DebugWindow::DrawSourcePane() {
@@ -451,7 +566,7 @@ void DebugWindow::DrawGuestFunctionSource() {
   //     if historical data for memory/etc present, show combo boxes
   auto memory = emulator_->memory();
   auto function = static_cast<cpu::GuestFunction*>(state_.function);
-  auto& source_map = function->source_map();
+  auto source_map = function->source_map().ToVector();
   uint32_t source_map_index = 0;
 
   bool draw_hir = false;
@@ -476,11 +591,23 @@ void DebugWindow::DrawGuestFunctionSource() {
           ? state_.thread_info->frames[state_.thread_stack_frame_index].guest_pc
           : 0;
 
-  if (draw_hir) {
-    // TODO(benvanik): get HIR and draw preamble.
-  }
-  if (draw_hir_opt) {
-    // TODO(benvanik): get HIR and draw preamble.
+  if (draw_hir || draw_hir_opt) {
+    if (state_.disasm_function != function) {
+      state_.disasm_function = function;
+      state_.function_disasm = processor_->DisassembleFunction(
+          function, cpu::DebugInfoFlags::kDebugInfoDisasmRawHir |
+                        cpu::DebugInfoFlags::kDebugInfoDisasmHir);
+    }
+    auto disasm = state_.function_disasm.get();
+    const char* hir =
+        !disasm ? nullptr
+                : draw_hir ? disasm->raw_hir_disasm() : disasm->hir_disasm();
+    if (hir) {
+      // TODO(benvanik): split by source offset and interleave.
+      ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 1.0f, 0.5f));
+      ImGui::TextUnformatted(hir);
+      ImGui::PopStyleColor();
+    }
   }
   if (draw_x64) {
     // x64 preamble.
@@ -996,6 +1123,15 @@ void DebugWindow::DrawThreadsPane() {
   ImGui::BeginGroup();
   //   checkbox to show host threads
   //   expand all toggle
+  auto wait_graph = emulator_->kernel_state()->wait_graph();
+  if (wait_graph && ImGui::Button("Export Waits")) {
+    if (wait_graph->WriteTimeline(L"wait_timeline.json")) {
+      XELOGI("Wrote the wait timeline to wait_timeline.json");
+    }
+  }
+  if (wait_graph && ImGui::IsItemHovered()) {
+    ImGui::SetTooltip("Write the recorded waits as a Chrome trace file.");
+  }
   ImGui::EndGroup();
   ImGui::BeginChild("##threads_listing");
   for (size_t i = 0; i < cache_.thread_debug_infos.size(); ++i) {
@@ -1043,6 +1179,20 @@ void DebugWindow::DrawThreadsPane() {
                                 is_current_thread)) {
       //   |     (log button) detail of kernel call categories
       // log button toggles only logging that thread
+      if (wait_graph) {
+        uint64_t blocked_ticks = thread_info->blocked_ticks;
+        if (thread_info->wait_object_handle) {
+          blocked_ticks +=
+              Clock::QueryHostTickCount() - thread_info->wait_start_tick;
+        }
+        ImGui::BulletText(
+            "Waits: %" PRIu64 ", blocked %.1f ms", thread_info->wait_count,
+            double(blocked_ticks) * 1000.0 / Clock::host_tick_frequency());
+        if (thread_info->wait_object_handle) {
+          ImGui::SameLine();
+          ImGui::Text("(waiting on %.8X)", thread_info->wait_object_handle);
+        }
+      }
       ImGui::BulletText("Call Stack");
       ImGui::Indent();
       for (size_t j = 0; j < thread_info->frames.size(); ++j) {
@@ -1099,6 +1249,56 @@ void DebugWindow::DrawMemoryPane() {
   // https://github.com/ocornut/imgui/wiki/memory_editor_example
 }
 
+void DebugWindow::DrawKernelCallsPane() {
+  auto export_resolver = emulator_->export_resolver();
+  bool is_profiling_enabled = cpu::ExportResolver::is_profiling_enabled();
+  if (ImGui::Checkbox("Profile", &is_profiling_enabled)) {
+    cpu::ExportResolver::set_profiling_enabled(is_profiling_enabled);
+  }
+  ImGui::SameLine();
+  if (ImGui::Button("Reset")) {
+    export_resolver->ResetProfile();
+  }
+  ImGui::Separator();
+
+  // Updated live, sorted by total host time.
+  double us_per_tick = 1000000.0 / double(Clock::host_tick_frequency());
+  ImGui::BeginChild("##kernel_calls_listing");
+  ImGui::Columns(6);
+  ImGui::Text("Export");
+  ImGui::NextColumn();
+  ImGui::Text("Calls");
+  ImGui::NextColumn();
+  ImGui::Text("Total us");
+  ImGui::NextColumn();
+  ImGui::Text("Avg us");
+  ImGui::NextColumn();
+  ImGui::Text("Max us");
+  ImGui::NextColumn();
+  ImGui::Text("Thread");
+  ImGui::NextColumn();
+  ImGui::Separator();
+  for (auto export_entry : export_resolver->GetProfiledExports()) {
+    const auto& profile = export_entry->profile;
+    auto call_count = static_cast<unsigned long long>(profile.call_count);
+    double total_us = double(profile.total_ticks) * us_per_tick;
+    ImGui::Text("%s", export_entry->name);
+    ImGui::NextColumn();
+    ImGui::Text("%llu", call_count);
+    ImGui::NextColumn();
+    ImGui::Text("%.0f", total_us);
+    ImGui::NextColumn();
+    ImGui::Text("%.2f", total_us / double(call_count));
+    ImGui::NextColumn();
+    ImGui::Text("%.2f", double(profile.max_ticks) * us_per_tick);
+    ImGui::NextColumn();
+    ImGui::Text("%.8X", uint32_t(profile.last_thread_id));
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  ImGui::EndChild();
+}
+
 void DebugWindow::DrawBreakpointsPane() {
   auto& state = state_.breakpoints;
 
@@ -1420,6 +1620,9 @@ void DebugWindow::SelectThreadStackFrame(cpu::ThreadDebugInfo* thread_info,
 void DebugWindow::NavigateToFunction(cpu::Function* function, uint32_t guest_pc,
                                      uint64_t host_pc) {
   state_.function = function;
+  // It may have been retranslated since.
+  state_.disasm_function = nullptr;
+  state_.function_disasm.reset();
   state_.last_host_pc = host_pc;
   state_.has_changed_pc = true;
 }
@@ -11,6 +11,8 @@
 #define XENIA_DEBUG_UI_DEBUG_WINDOW_H_
 
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include "xenia/base/x64_context.h"
@@ -54,6 +56,7 @@ class DebugWindow : public cpu::DebugListener {
   void DrawFrame();
   void DrawToolbar();
   void DrawFunctionsPane();
+  void UpdateFunctionMatches();
   void DrawSourcePane();
   void DrawGuestFunctionSource();
   void DrawMachineCodeSource(const uint8_t* ptr, size_t length);
@@ -68,6 +71,7 @@ class DebugWindow : public cpu::DebugListener {
   bool DrawRegisterTextBoxes(int id, float* value);
   void DrawThreadsPane();
   void DrawMemoryPane();
+  void DrawKernelCallsPane();
   void DrawBreakpointsPane();
   void DrawLogPane();
 
@@ -116,6 +120,7 @@ class DebugWindow : public cpu::DebugListener {
   struct ImState {
     static const int kRightPaneThreads = 0;
     static const int kRightPaneMemory = 1;
+    static const int kRightPaneKernelCalls = 2;
     int right_pane_tab = kRightPaneThreads;
 
     cpu::ThreadDebugInfo* thread_info = nullptr;
@@ -126,6 +131,24 @@ class DebugWindow : public cpu::DebugListener {
     uint64_t last_host_pc = 0;
     bool has_changed_pc = false;
     int source_display_mode = 3;
+    // HIR of state_.function, generated when a mode that shows it is picked.
+    xe::cpu::Function* disasm_function = nullptr;
+    std::unique_ptr<cpu::FunctionDebugInfo> function_disasm;
+
+    struct {
+      char filter[64] = {0};
+      // Index into modules of the module listed, or -1 for all of them.
+      int module_index = -1;
+      // Copied from the symbol index of the processor as it grows.
+      std::vector<cpu::SymbolIndex::Entry> entries;
+      std::vector<cpu::Module*> modules;
+      // {entry index, filter score} of the functions listed, in order.
+      std::vector<std::pair<uint32_t, int>> matches;
+      // How much of entries matches covers, and what it was filtered by.
+      size_t matched_entry_count = 0;
+      std::string matched_filter;
+      int matched_module_index = -1;
+    } functions;
 
     RegisterGroup register_group = RegisterGroup::kGuestGeneral;
     bool register_input_hex = true;
@@ -10,7 +10,9 @@
 #include "xenia/emulator.h"
 
 #include <gflags/gflags.h>
+#include <chrono>
 #include <cinttypes>
+#include <mutex>
 
 #include "xenia/apu/audio_system.h"
 #include "xenia/base/assert.h"
@@ -20,8 +22,11 @@
 #include "xenia/base/exception_handler.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
+#include "xenia/base/metrics.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/startup_phases.h"
 #include "xenia/base/string.h"
+#include "xenia/base/threading.h"
 #include "xenia/cpu/backend/code_cache.h"
 #include "xenia/cpu/backend/x64/x64_backend.h"
 #include "xenia/cpu/cpu_flags.h"
@@ -38,6 +43,7 @@
 #include "xenia/kernel/xboxkrnl/xboxkrnl_module.h"
 #include "xenia/memory.h"
 #include "xenia/ui/imgui_dialog.h"
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/host_path_device.h"
 #include "xenia/vfs/devices/stfs_container_device.h"
@@ -45,15 +51,77 @@
 
 DEFINE_double(time_scalar, 1.0,
               "Scalar used to speed or slow time (1x, 2x, 1/2x, etc).");
+DEFINE_string(vfs_preload_log, "",
+              "Access log recorded with --vfs_access_log during an earlier "
+              "boot, replayed in the background at launch so the files the "
+              "title reads are already cached.");
+DEFINE_int32(metrics_port, 0,
+             "Loopback port to serve the runtime metrics on, in the "
+             "Prometheus text format. 0 disables the exporter.");
 
 namespace xe {
 
+namespace {
+
+// Installed after everything else, so it only sees the exceptions nobody
+// handled, which take the process down.
+bool FlushLogExceptionCallback(Exception* ex, void* data) {
+  xe::FlushLog();
+  return false;
+}
+
+// When the stages of Setup ran, and on which thread, logged once it's done.
+class SetupTimeline {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  SetupTimeline() : start_(Now()) {}
+
+  static TimePoint Now() { return std::chrono::steady_clock::now(); }
+
+  void Record(const char* name, TimePoint begin) {
+    auto end = Now();
+    std::lock_guard<std::mutex> lock(mutex_);
+    stages_.push_back({name, xe::threading::current_thread_id(),
+                       Milliseconds(begin), Milliseconds(end)});
+  }
+
+  void Log() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    XELOGI("Emulator setup took %.1f ms:", Milliseconds(Now()));
+    for (auto& stage : stages_) {
+      XELOGI("  %-16s %8.1f - %8.1f ms (%6.1f ms) on thread %.8X",
+             stage.name, stage.begin_ms, stage.end_ms,
+             stage.end_ms - stage.begin_ms, stage.thread_id);
+    }
+  }
+
+ private:
+  struct Stage {
+    const char* name;
+    uint32_t thread_id;
+    double begin_ms;
+    double end_ms;
+  };
+
+  double Milliseconds(TimePoint time) const {
+    return std::chrono::duration<double, std::milli>(time - start_).count();
+  }
+
+  TimePoint start_;
+  std::mutex mutex_;
+  std::vector<Stage> stages_;
+};
+
+}  // namespace
+
 Emulator::Emulator(const std::wstring& command_line,
                    const std::wstring& content_root)
     : command_line_(command_line), content_root_(content_root) {}
 
 Emulator::~Emulator() {
   // Note that we delete things in the reverse order they were initialized.
+  Metrics::StopExporter();
 
   // Give the systems time to shutdown before we delete them.
   if (graphics_system_) {
@@ -72,9 +140,16 @@ Emulator::~Emulator() {
 
   processor_.reset();
 
+  if (export_resolver_) {
+    export_resolver_->DumpProfile();
+  }
   export_resolver_.reset();
 
+  ExceptionHandler::Uninstall(FlushLogExceptionCallback, nullptr);
   ExceptionHandler::Uninstall(Emulator::ExceptionCallbackThunk, this);
+
+  // In case no frame was ever swapped.
+  StartupPhases::Report();
 }
 
 X_STATUS Emulator::Setup(
@@ -85,7 +160,10 @@ X_STATUS Emulator::Setup(
         graphics_system_factory,
     std::function<std::vector<std::unique_ptr<hid::InputDriver>>(ui::Window*)>
         input_driver_factory) {
+  StartupPhases::Mark(StartupPhases::Phase::kSetupBegin);
   X_STATUS result = X_STATUS_UNSUCCESSFUL;
+  SetupTimeline timeline;
+  auto stage_begin = SetupTimeline::Now();
 
   display_window_ = display_window;
 
@@ -106,6 +184,8 @@ X_STATUS Emulator::Setup(
   if (!memory_->Initialize()) {
     return false;
   }
+  timeline.Record("memory", stage_begin);
+  stage_begin = SetupTimeline::Now();
 
   // Shared export resolver used to attach and query for HLE exports.
   export_resolver_ = std::make_unique<xe::cpu::ExportResolver>();
@@ -132,65 +212,92 @@ X_STATUS Emulator::Setup(
   if (!processor_->Setup(std::move(backend))) {
     return X_STATUS_UNSUCCESSFUL;
   }
+  timeline.Record("cpu", stage_begin);
 
-  // Initialize the APU.
+  // Create the APU and the GPU.
   if (audio_system_factory) {
     audio_system_ = audio_system_factory(processor_.get());
     if (!audio_system_) {
       return X_STATUS_NOT_IMPLEMENTED;
     }
   }
-
-  // Initialize the GPU.
   graphics_system_ = graphics_system_factory();
   if (!graphics_system_) {
     return X_STATUS_NOT_IMPLEMENTED;
   }
 
-  // Initialize the HID.
-  input_system_ = std::make_unique<xe::hid::InputSystem>(display_window_);
-  if (!input_system_) {
-    return X_STATUS_NOT_IMPLEMENTED;
-  }
-  if (input_driver_factory) {
-    auto input_drivers = input_driver_factory(display_window_);
-    for (size_t i = 0; i < input_drivers.size(); ++i) {
-      input_system_->AddDriver(std::move(input_drivers[i]));
-    }
-  }
-
-  result = input_system_->Setup();
-  if (result) {
-    return result;
-  }
-
   // Bring up the virtual filesystem used by the kernel.
   file_system_ = std::make_unique<xe::vfs::VirtualFileSystem>();
 
   // Shared kernel state.
+  stage_begin = SetupTimeline::Now();
   kernel_state_ = std::make_unique<xe::kernel::KernelState>(this);
+  timeline.Record("kernel state", stage_begin);
+
+  // The graphics device, its caches and the display context take the longest
+  // and only need the processor and the kernel state, so they are brought up
+  // on a thread of their own while the HID and the kernel modules are set up
+  // here. The APU maps MMIO ranges like the GPU does, and registering ranges
+  // isn't thread safe, so it waits for the GPU.
+  X_STATUS gpu_result = X_STATUS_UNSUCCESSFUL;
+  auto gpu_setup_thread = xe::threading::Thread::Create({}, [&]() {
+    auto gpu_begin = SetupTimeline::Now();
+    gpu_result = graphics_system_->Setup(processor_.get(), kernel_state_.get(),
+                                         display_window_);
+    timeline.Record("gpu", gpu_begin);
+  });
+  gpu_setup_thread->set_name("Emulator GPU Setup");
 
-  // Setup the core components.
-  result = graphics_system_->Setup(processor_.get(), kernel_state_.get(),
-                                   display_window_);
+  result = [&]() {
+    // Initialize the HID.
+    auto hid_begin = SetupTimeline::Now();
+    input_system_ = std::make_unique<xe::hid::InputSystem>(display_window_);
+    if (!input_system_) {
+      return X_STATUS_NOT_IMPLEMENTED;
+    }
+    if (input_driver_factory) {
+      auto input_drivers = input_driver_factory(display_window_);
+      for (size_t i = 0; i < input_drivers.size(); ++i) {
+        input_system_->AddDriver(std::move(input_drivers[i]));
+      }
+    }
+    X_STATUS hid_result = input_system_->Setup();
+    if (hid_result) {
+      return hid_result;
+    }
+    timeline.Record("hid", hid_begin);
+
+    // HLE kernel modules.
+    auto modules_begin = SetupTimeline::Now();
+    kernel_state_->LoadKernelModule<kernel::xboxkrnl::XboxkrnlModule>();
+    kernel_state_->LoadKernelModule<kernel::xam::XamModule>();
+    kernel_state_->LoadKernelModule<kernel::xbdm::XbdmModule>();
+    timeline.Record("kernel modules", modules_begin);
+    return X_STATUS(X_STATUS_SUCCESS);
+  }();
+
+  xe::threading::Wait(gpu_setup_thread.get(), false);
   if (result) {
     return result;
   }
+  if (gpu_result) {
+    return gpu_result;
+  }
 
   if (audio_system_) {
+    stage_begin = SetupTimeline::Now();
     result = audio_system_->Setup(kernel_state_.get());
     if (result) {
       return result;
     }
+    timeline.Record("apu", stage_begin);
   }
-
-  // HLE kernel modules.
-  kernel_state_->LoadKernelModule<kernel::xboxkrnl::XboxkrnlModule>();
-  kernel_state_->LoadKernelModule<kernel::xam::XamModule>();
-  kernel_state_->LoadKernelModule<kernel::xbdm::XbdmModule>();
+  timeline.Log();
+  StartupPhases::Mark(StartupPhases::Phase::kSetupEnd);
 
   // Initialize emulator fallback exception handling last.
   ExceptionHandler::Install(Emulator::ExceptionCallbackThunk, this);
+  ExceptionHandler::Install(FlushLogExceptionCallback, nullptr);
 
   if (display_window_) {
     // Finish initializing the display.
@@ -200,6 +307,10 @@ X_STATUS Emulator::Setup(
     });
   }
 
+  if (FLAGS_metrics_port > 0) {
+    Metrics::StartExporter(uint16_t(FLAGS_metrics_port));
+  }
+
   return result;
 }
 
@@ -215,6 +326,8 @@ X_STATUS Emulator::TerminateTitle() {
 }
 
 X_STATUS Emulator::LaunchPath(std::wstring path) {
+  StartupPhases::Mark(StartupPhases::Phase::kLaunchBegin);
+
   // Launch based on file type.
   // This is a silly guess based on file extension.
   auto last_slash = path.find_last_of(xe::kPathSeparator);
@@ -232,6 +345,8 @@ X_STATUS Emulator::LaunchPath(std::wstring path) {
   if (extension == L".xex" || extension == L".elf" || extension == L".exe") {
     // Treat as a naked xex file.
     return LaunchXexFile(path);
+  } else if (extension == L".xcdi") {
+    return LaunchDiscImage(path, true);
   } else {
     // Assume a disc image.
     return LaunchDiscImage(path);
@@ -273,11 +388,16 @@ X_STATUS Emulator::LaunchXexFile(std::wstring path) {
   return CompleteLaunch(path, fs_path);
 }
 
-X_STATUS Emulator::LaunchDiscImage(std::wstring path) {
+X_STATUS Emulator::LaunchDiscImage(std::wstring path, bool compressed) {
   auto mount_path = "\\Device\\Cdrom0";
 
   // Register the disc image in the virtual filesystem.
-  auto device = std::make_unique<vfs::DiscImageDevice>(mount_path, path);
+  std::unique_ptr<vfs::DiscImageDevice> device;
+  if (compressed) {
+    device = std::make_unique<vfs::CompressedDiscImageDevice>(mount_path, path);
+  } else {
+    device = std::make_unique<vfs::DiscImageDevice>(mount_path, path);
+  }
   if (!device->Initialize()) {
     xe::FatalError("Unable to mount disc image; file not found or corrupt.");
     return X_STATUS_NO_SUCH_FILE;
@@ -392,10 +512,7 @@ bool Emulator::SaveToFile(const std::wstring& path) {
 
   // It's important we don't hold the global lock here! XThreads need to step
   // forward (possibly through guarded regions) without worry!
-  processor_->Save(&stream);
-  graphics_system_->Save(&stream);
-  audio_system_->Save(&stream);
-  kernel_state_->Save(&stream);
+  SaveSystemState(&stream);
   memory_->Save(&stream);
   map->Close(stream.offset());
 
@@ -403,6 +520,50 @@ bool Emulator::SaveToFile(const std::wstring& path) {
   return true;
 }
 
+void Emulator::SaveSystemState(ByteStream* stream) {
+  processor_->Save(stream);
+  graphics_system_->Save(stream);
+  audio_system_->Save(stream);
+  kernel_state_->Save(stream);
+}
+
+bool Emulator::RestoreSystemState(ByteStream* stream) {
+  if (!processor_->Restore(stream)) {
+    XELOGE("Could not restore processor!");
+    return false;
+  }
+  if (!graphics_system_->Restore(stream)) {
+    XELOGE("Could not restore graphics system!");
+    return false;
+  }
+  if (!audio_system_->Restore(stream)) {
+    XELOGE("Could not restore audio system!");
+    return false;
+  }
+  if (!kernel_state_->Restore(stream)) {
+    XELOGE("Could not restore kernel state!");
+    return false;
+  }
+  return true;
+}
+
+void Emulator::FinishRestore() {
+  // Update the main thread.
+  auto threads =
+      kernel_state_->object_table()->GetObjectsByType<kernel::XThread>();
+  for (auto thread : threads) {
+    if (thread->main_thread()) {
+      main_thread_ = thread->thread();
+      break;
+    }
+  }
+
+  Resume();
+
+  restore_fence_.Signal();
+  restoring_ = false;
+}
+
 bool Emulator::RestoreFromFile(const std::wstring& path) {
   // Restore the emulator state from a file
   auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite);
@@ -429,42 +590,123 @@ bool Emulator::RestoreFromFile(const std::wstring& path) {
     return false;
   }
 
-  if (!processor_->Restore(&stream)) {
-    XELOGE("Could not restore processor!");
-    return false;
-  }
-  if (!graphics_system_->Restore(&stream)) {
-    XELOGE("Could not restore graphics system!");
+  if (!RestoreSystemState(&stream)) {
     return false;
   }
-  if (!audio_system_->Restore(&stream)) {
-    XELOGE("Could not restore audio system!");
+  if (!memory_->Restore(&stream)) {
+    XELOGE("Could not restore memory!");
     return false;
   }
-  if (!kernel_state_->Restore(&stream)) {
-    XELOGE("Could not restore kernel state!");
+
+  // The translation workers need the global lock, and guest threads are
+  // still paused.
+  lock.unlock();
+  processor_->TranslateRestoredFunctions();
+  lock.lock();
+
+  FinishRestore();
+  return true;
+}
+
+bool Emulator::SaveIncrementalToFile(const std::wstring& path, bool base) {
+  Pause();
+
+  filesystem::CreateFile(path);
+  auto map = MappedMemory::Open(path, MappedMemory::Mode::kReadWrite, 0,
+                                1024ull * 1024ull * 1024ull * 2ull);
+  if (!map) {
+    Resume();
     return false;
   }
-  if (!memory_->Restore(&stream)) {
-    XELOGE("Could not restore memory!");
+
+  ByteStream stream(map->data(), map->size());
+  stream.Write('XSVI');
+  stream.Write(title_id_);
+  stream.Write(uint32_t(base ? 1 : 0));
+
+  // Only the system state of the last snapshot in a chain is restored, so its
+  // size is recorded to find the memory of the others.
+  size_t state_size_offset = stream.offset();
+  stream.Write(uint64_t(0));
+  SaveSystemState(&stream);
+  size_t state_end = stream.offset();
+  stream.set_offset(state_size_offset);
+  stream.Write(uint64_t(state_end - state_size_offset - sizeof(uint64_t)));
+  stream.set_offset(state_end);
+
+  bool result = memory_->SaveIncremental(&stream, base);
+  map->Close(result ? stream.offset() : 0);
+
+  Resume();
+  return result;
+}
+
+bool Emulator::RestoreIncrementalFromFiles(
+    const std::vector<std::wstring>& paths) {
+  if (paths.empty()) {
     return false;
   }
 
-  // Update the main thread.
-  auto threads =
-      kernel_state_->object_table()->GetObjectsByType<kernel::XThread>();
-  for (auto thread : threads) {
-    if (thread->main_thread()) {
-      main_thread_ = thread->thread();
-      break;
+  std::vector<std::unique_ptr<MappedMemory>> maps;
+  std::vector<size_t> memory_offsets;
+  size_t last_state_offset = 0;
+  for (size_t i = 0; i < paths.size(); ++i) {
+    auto map = MappedMemory::Open(paths[i], MappedMemory::Mode::kRead);
+    if (!map) {
+      return false;
     }
+    ByteStream stream(map->data(), map->size());
+    if (stream.Read<uint32_t>() != 'XSVI') {
+      XELOGE("%s is not an incremental snapshot",
+             xe::to_string(paths[i]).c_str());
+      return false;
+    }
+    if (stream.Read<uint32_t>() != title_id_) {
+      // Swapping between titles is unsupported at the moment.
+      XELOGE("%s is a snapshot of another title",
+             xe::to_string(paths[i]).c_str());
+      return false;
+    }
+    bool base = stream.Read<uint32_t>() != 0;
+    if (base != (i == 0)) {
+      XELOGE("Snapshots must be a base followed by its deltas");
+      return false;
+    }
+    auto state_size = stream.Read<uint64_t>();
+    last_state_offset = stream.offset();
+    memory_offsets.push_back(stream.offset() + size_t(state_size));
+    maps.push_back(std::move(map));
   }
 
-  Resume();
+  restoring_ = true;
 
-  restore_fence_.Signal();
-  restoring_ = false;
+  // Terminate any loaded titles.
+  Pause();
+  kernel_state_->TerminateTitle();
+
+  auto lock = global_critical_region::AcquireDirect();
+  ByteStream stream(maps.back()->data(), maps.back()->size(),
+                    last_state_offset);
+  if (!RestoreSystemState(&stream)) {
+    return false;
+  }
+  for (size_t i = 0; i < maps.size(); ++i) {
+    ByteStream memory_stream(maps[i]->data(), maps[i]->size(),
+                             memory_offsets[i]);
+    if (!memory_->RestoreIncremental(&memory_stream)) {
+      XELOGE("Could not restore memory from %s!",
+             xe::to_string(paths[i]).c_str());
+      return false;
+    }
+  }
+
+  // The translation workers need the global lock, and guest threads are
+  // still paused.
+  lock.unlock();
+  processor_->TranslateRestoredFunctions();
+  lock.lock();
 
+  FinishRestore();
   return true;
 }
 
@@ -536,16 +778,26 @@ bool Emulator::ExceptionCallback(Exception* ex) {
     XELOGE(" v%-3d = [0x%.8X, 0x%.8X, 0x%.8X, 0x%.8X]", i, context->v[i].i32[0],
            context->v[i].i32[1], context->v[i].i32[2], context->v[i].i32[3]);
   }
+  // The thread is about to be suspended for good.
+  xe::FlushLog();
 
   // Display a dialog telling the user the guest has crashed.
-  display_window()->loop()->PostSynchronous([&]() {
-    xe::ui::ImGuiDialog::ShowMessageBox(
-        display_window(), "Uh-oh!",
-        "The guest has crashed.\n\n"
-        ""
-        "Xenia has now paused itself.\n"
-        "A crash dump has been written into the log.");
-  });
+  if (display_window_) {
+    display_window()->loop()->PostSynchronous([&]() {
+      xe::ui::ImGuiDialog::ShowMessageBox(
+          display_window(), "Uh-oh!",
+          "The guest has crashed.\n\n"
+          ""
+          "Xenia has now paused itself.\n"
+          "A crash dump has been written into the log.");
+    });
+  } else {
+    // Headless, nobody would notice the pause, so a batch run fails instead
+    // of hanging.
+    XELOGE("The guest has crashed, exiting");
+    xe::FlushLog();
+    exit(1);
+  }
 
   // Now suspend ourself (we should be a guest thread).
   current_thread->Suspend(nullptr);
@@ -582,7 +834,7 @@ std::string Emulator::FindLaunchModule() {
     if (XSUCCEEDED(result)) {
       std::vector<uint8_t> buffer(gameinfo_entry->size());
       size_t bytes_read = 0;
-      result = file->ReadSync(buffer.data(), buffer.size(), 0, &bytes_read);
+      result = file->Read(buffer.data(), buffer.size(), 0, &bytes_read);
       if (XSUCCEEDED(result)) {
         kernel::util::GameInfo info(buffer);
         if (info.is_valid()) {
@@ -605,6 +857,11 @@ std::string Emulator::FindLaunchModule() {
 
 X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
                                   const std::string& module_path) {
+  StartupPhases::Mark(StartupPhases::Phase::kTitleMounted);
+  if (!FLAGS_vfs_preload_log.empty()) {
+    file_system_->StartPreload(xe::to_wstring(FLAGS_vfs_preload_log));
+  }
+
   // Allow xam to request module loads.
   auto xam = kernel_state()->GetKernelModule<kernel::xam::XamModule>("xam.xex");
 
@@ -614,12 +871,16 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
     XELOGE("Failed to load user module %S", path.c_str());
     return X_STATUS_NOT_FOUND;
   }
+  StartupPhases::Mark(StartupPhases::Phase::kTitleLoaded);
 
   // Grab the current title ID.
   xex2_opt_execution_info* info = nullptr;
   module->GetOptHeader(XEX_HEADER_EXECUTION_INFO, &info);
   if (info) {
     title_id_ = info->title_id;
+    char title_id[9] = {0};
+    std::snprintf(title_id, xe::countof(title_id), "%08X", title_id_);
+    StartupPhases::set_title(title_id);
   }
 
   // Try and load the resource database (xex only).
@@ -635,7 +896,7 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
       if (db.is_valid()) {
         game_title_ = xe::to_wstring(db.title());
         auto icon_block = db.icon();
-        if (icon_block) {
+        if (icon_block && display_window_) {
           display_window_->SetIcon(icon_block.buffer, icon_block.size);
         }
       }
@@ -648,6 +909,7 @@ X_STATUS Emulator::CompleteLaunch(const std::wstring& path,
   }
 
   main_thread_ = main_xthread->thread();
+  StartupPhases::Mark(StartupPhases::Phase::kTitleLaunched);
   on_launch();
 
   return X_STATUS_SUCCESS;
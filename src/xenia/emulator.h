@@ -12,6 +12,7 @@
 
 #include <functional>
 #include <string>
+#include <vector>
 
 #include "xenia/base/delegate.h"
 #include "xenia/base/exception_handler.h"
@@ -125,8 +126,9 @@ class Emulator {
   // was an extracted STFS container.
   X_STATUS LaunchXexFile(std::wstring path);
 
-  // Launches a game from a disc image file (.iso, etc).
-  X_STATUS LaunchDiscImage(std::wstring path);
+  // Launches a game from a disc image file (.iso, etc), or a chunk-compressed
+  // one (.xcdi).
+  X_STATUS LaunchDiscImage(std::wstring path, bool compressed = false);
 
   // Launches a game from an STFS container file.
   X_STATUS LaunchStfsContainer(std::wstring path);
@@ -138,6 +140,14 @@ class Emulator {
   bool SaveToFile(const std::wstring& path);
   bool RestoreFromFile(const std::wstring& path);
 
+  // Incremental save states. A base contains everything; each later delta
+  // only holds the guest memory changed since the snapshot before it (plus
+  // the rest of the emulator state, which is small). Fails for a delta if
+  // there is no base since launch or the last restore.
+  bool SaveIncrementalToFile(const std::wstring& path, bool base);
+  // Restores a base followed by its deltas, in the order they were saved.
+  bool RestoreIncrementalFromFiles(const std::vector<std::wstring>& paths);
+
   // The game can request another title to be loaded.
   bool TitleRequested();
   void LaunchNextTitle();
@@ -154,6 +164,11 @@ class Emulator {
 
   std::string FindLaunchModule();
 
+  // Everything but guest memory, shared by the save state formats.
+  void SaveSystemState(ByteStream* stream);
+  bool RestoreSystemState(ByteStream* stream);
+  void FinishRestore();
+
   X_STATUS CompleteLaunch(const std::wstring& path,
                           const std::string& module_path);
 
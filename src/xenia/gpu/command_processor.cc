@@ -14,10 +14,13 @@
 #include <cmath>
 
 #include "xenia/base/byte_stream.h"
+#include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/ring_buffer.h"
+#include "xenia/base/startup_phases.h"
 #include "xenia/gpu/gpu_flags.h"
 #include "xenia/gpu/graphics_system.h"
 #include "xenia/gpu/registers.h"
@@ -41,7 +44,9 @@ CommandProcessor::CommandProcessor(GraphicsSystem* graphics_system,
       trace_writer_(graphics_system->memory()->physical_membase()),
       worker_running_(true),
       write_ptr_index_event_(xe::threading::Event::CreateAutoResetEvent(false)),
-      write_ptr_index_(0) {}
+      write_ptr_index_(0),
+      wait_event_(xe::threading::Event::CreateAutoResetEvent(false)),
+      wait_register_index_(RegisterFile::kRegisterCount) {}
 
 CommandProcessor::~CommandProcessor() = default;
 
@@ -67,6 +72,15 @@ bool CommandProcessor::Initialize(
   dirty_gamma_ramp_normal_ = true;
   dirty_gamma_ramp_pwl_ = true;
 
+  if (FLAGS_frame_skip == "alternate") {
+    frame_skip_mode_ = FrameSkipMode::kAlternate;
+  } else if (FLAGS_frame_skip == "budget") {
+    frame_skip_mode_ = FrameSkipMode::kBudget;
+  } else if (FLAGS_frame_skip != "none") {
+    XELOGW("Unknown --frame_skip mode %s, drawing every frame",
+           FLAGS_frame_skip.c_str());
+  }
+
   worker_running_ = true;
   worker_thread_ = kernel::object_ref<kernel::XHostThread>(
       new kernel::XHostThread(kernel_state_, 128 * 1024, 0, [this]() {
@@ -76,18 +90,35 @@ bool CommandProcessor::Initialize(
   worker_thread_->set_name("GraphicsSystem Command Processor");
   worker_thread_->Create();
 
+  Metrics::AddCollector(CollectMetricsThunk, this);
   return true;
 }
 
 void CommandProcessor::Shutdown() {
+  Metrics::RemoveCollector(CollectMetricsThunk, this);
   EndTracing();
 
   worker_running_ = false;
   write_ptr_index_event_->Set();
+  wait_event_->Set();
   worker_thread_->Wait(0, 0, 0, nullptr);
   worker_thread_.reset();
 }
 
+void CommandProcessor::CollectMetricsThunk(MetricsWriter* writer,
+                                           void* data) {
+  auto command_processor = reinterpret_cast<CommandProcessor*>(data);
+  // The frame rate is the rate of this.
+  writer->Counter("xenia_frames_total", "Frames swapped by the guest.",
+                  double(command_processor->frame_count_));
+  writer->Counter("xenia_frames_skipped_total",
+                  "Frames whose draws were skipped by --frame_skip.",
+                  double(command_processor->skipped_frame_count_));
+  command_processor->frame_time_.Write(
+      writer, "xenia_frame_time_seconds",
+      "Host time between the recent guest swaps.");
+}
+
 void CommandProcessor::RequestFrameTrace(const std::wstring& root_path) {
   if (trace_state_ == TraceState::kStreaming) {
     XELOGE("Streaming trace; cannot also trace frame.");
@@ -132,7 +163,58 @@ void CommandProcessor::CallInThread(std::function<void()> fn) {
   }
 }
 
-void CommandProcessor::ClearCaches() {}
+void CommandProcessor::ClearCaches() {
+  // The shaders of the checkpoints may be freed.
+  ReleaseCheckpoints();
+}
+
+uint32_t CommandProcessor::SaveCheckpoint() {
+  FlushPendingDraws();
+  uint32_t checkpoint = last_checkpoint_ + 1;
+  if (!SaveBackendCheckpoint(checkpoint)) {
+    return 0;
+  }
+  last_checkpoint_ = checkpoint;
+  Checkpoint& saved = checkpoints_[checkpoint];
+  saved.registers.resize(RegisterFile::kRegisterCount);
+  std::memcpy(saved.registers.data(), register_file_->values,
+              RegisterFile::kRegisterCount * sizeof(uint32_t));
+  saved.vertex_shader = active_vertex_shader_;
+  saved.pixel_shader = active_pixel_shader_;
+  return checkpoint;
+}
+
+bool CommandProcessor::RestoreCheckpoint(uint32_t checkpoint) {
+  auto it = checkpoints_.find(checkpoint);
+  if (it == checkpoints_.end()) {
+    return false;
+  }
+  FlushPendingDraws();
+  const Checkpoint& saved = it->second;
+  std::memcpy(register_file_->values, saved.registers.data(),
+              RegisterFile::kRegisterCount * sizeof(uint32_t));
+  register_file_->MarkAllDirty();
+  active_vertex_shader_ = saved.vertex_shader;
+  active_pixel_shader_ = saved.pixel_shader;
+  RestoreBackendCheckpoint(checkpoint);
+  return true;
+}
+
+void CommandProcessor::ReleaseCheckpoints() {
+  if (checkpoints_.empty()) {
+    return;
+  }
+  checkpoints_.clear();
+  ReleaseBackendCheckpoints();
+}
+
+bool CommandProcessor::SaveBackendCheckpoint(uint32_t checkpoint) {
+  return false;
+}
+
+void CommandProcessor::RestoreBackendCheckpoint(uint32_t checkpoint) {}
+
+void CommandProcessor::ReleaseBackendCheckpoints() {}
 
 void CommandProcessor::WorkerThreadMain() {
   context_->MakeCurrent();
@@ -155,6 +237,7 @@ void CommandProcessor::WorkerThreadMain() {
       // We spin here waiting for new ones, as the overhead of waiting on our
       // event is too high.
       PrepareForWait();
+      uint64_t wait_begin_tick = Clock::QueryHostTickCount();
       uint32_t loop_count = 0;
       do {
         // If we spin around too much, revert to a "low-power" state.
@@ -171,6 +254,7 @@ void CommandProcessor::WorkerThreadMain() {
                (write_ptr_index == 0xBAADF00D ||
                 read_ptr_index_ == write_ptr_index));
       ReturnFromWait();
+      frame_idle_ticks_ += Clock::QueryHostTickCount() - wait_begin_tick;
       if (!worker_running_ || !pending_fns_.empty()) {
         continue;
       }
@@ -282,6 +366,7 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 
   regs->values[index].u32 = value;
+  regs->MarkDirty(index);
   if (!regs->GetRegisterInfo(index)) {
     XELOGW("GPU: Write to unknown register (%.4X = %.8X)", index, value);
   }
@@ -305,6 +390,59 @@ void CommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 }
 
+void CommandProcessor::NotifyRegisterWritten(uint32_t index) {
+  if (wait_register_index_.load(std::memory_order_relaxed) == index) {
+    wait_event_->Set();
+  }
+}
+
+void CommandProcessor::WriteRegistersFromMem(uint32_t start_index,
+                                             const uint32_t* base,
+                                             uint32_t num_registers) {
+  if (start_index + num_registers > RegisterFile::kRegisterCount) {
+    XELOGW("CommandProcessor::WriteRegistersFromMem range out of bounds: %d+%d",
+           start_index, num_registers);
+    if (start_index >= RegisterFile::kRegisterCount) {
+      return;
+    }
+    num_registers = uint32_t(RegisterFile::kRegisterCount) - start_index;
+  }
+  uint32_t end_index = start_index + num_registers;
+
+  // Registers with side effects go through the one by one path.
+  if ((start_index <= XE_GPU_REG_SCRATCH_REG7 &&
+       end_index > XE_GPU_REG_SCRATCH_REG0) ||
+      (start_index <= XE_GPU_REG_COHER_STATUS_HOST &&
+       end_index > XE_GPU_REG_COHER_STATUS_HOST)) {
+    for (uint32_t i = 0; i < num_registers; ++i) {
+      WriteRegister(start_index + i, xe::load_and_swap<uint32_t>(base + i));
+    }
+    return;
+  }
+
+  RegisterFile* regs = register_file_;
+  xe::copy_and_swap_32_unaligned(&regs->values[start_index].u32, base,
+                                 num_registers);
+  regs->MarkRangeDirty(start_index, num_registers);
+}
+
+void CommandProcessor::WriteRegistersFromRing(RingBuffer* reader,
+                                              uint32_t start_index,
+                                              uint32_t num_registers) {
+  // The range may wrap around the end of the ring.
+  auto range = reader->BeginRead(num_registers * sizeof(uint32_t));
+  uint32_t first_count = uint32_t(range.first_length / sizeof(uint32_t));
+  WriteRegistersFromMem(start_index,
+                        reinterpret_cast<const uint32_t*>(range.first),
+                        first_count);
+  if (range.second_length) {
+    WriteRegistersFromMem(start_index + first_count,
+                          reinterpret_cast<const uint32_t*>(range.second),
+                          uint32_t(range.second_length / sizeof(uint32_t)));
+  }
+  reader->EndRead(range);
+}
+
 void CommandProcessor::UpdateGammaRampValue(GammaRampType type,
                                             uint32_t value) {
   RegisterFile* regs = register_file_;
@@ -338,6 +476,12 @@ void CommandProcessor::UpdateGammaRampValue(GammaRampType type,
   }
 }
 
+void CommandProcessor::FlushPendingDraws() {}
+
+void CommandProcessor::BeginOcclusionQuery(uint32_t sample_counts_address) {}
+
+void CommandProcessor::EndOcclusionQuery(uint32_t sample_counts_address) {}
+
 void CommandProcessor::MakeCoherent() {
   SCOPE_profile_cpu_f("gpu");
 
@@ -401,7 +545,9 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
       XELOGW("Skipped frame!");
     }
   } else {
-    // Spin until no more pending swap.
+    // Spin until no more pending swap. Not counted against the frame skip
+    // budget, as it's presentation that holds this up.
+    uint64_t wait_begin_tick = Clock::QueryHostTickCount();
     while (worker_running_) {
       {
         std::lock_guard<std::mutex> lock(swap_state_.mutex);
@@ -411,14 +557,38 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
       }
       xe::threading::MaybeYield();
     }
+    frame_idle_ticks_ += Clock::QueryHostTickCount() - wait_begin_tick;
   }
 
+  // A skipped frame is still swapped so that its commands are submitted, but
+  // with nothing drawn it isn't presented.
+  last_frame_skipped_ = skipping_frame_;
   PerformSwap(frontbuffer_ptr, frontbuffer_width, frontbuffer_height);
+  StartupPhases::Mark(StartupPhases::Phase::kFirstSwap);
+  uint64_t swap_tick = Clock::QueryHostTickCount();
+  uint64_t busy_ticks = 0;
+  if (last_swap_tick_) {
+    frame_time_.Record(double(swap_tick - last_swap_tick_) /
+                       Clock::host_tick_frequency());
+    busy_ticks = swap_tick - last_swap_tick_ -
+                 std::min(frame_idle_ticks_, swap_tick - last_swap_tick_);
+  }
+  last_swap_tick_ = swap_tick;
+  frame_idle_ticks_ = 0;
+  ++frame_count_;
+  UpdateFrameSkip(busy_ticks);
+  on_swap();
+
+  if (last_frame_skipped_) {
+    ++skipped_frame_count_;
+    return;
+  }
 
   {
     // Set pending so that the display will swap the next time it can.
     std::lock_guard<std::mutex> lock(swap_state_.mutex);
     swap_state_.pending = true;
+    swap_state_.swap_ticks = Clock::QueryHostTickCount();
   }
 
   // Notify the display a swap is pending so that our changes are picked up.
@@ -426,6 +596,28 @@ void CommandProcessor::IssueSwap(uint32_t frontbuffer_ptr,
   swap_request_handler_();
 }
 
+void CommandProcessor::UpdateFrameSkip(uint64_t busy_ticks) {
+  bool skip = false;
+  // Traces must have all the draws.
+  if (trace_state_ == TraceState::kDisabled) {
+    switch (frame_skip_mode_) {
+      case FrameSkipMode::kNone:
+        break;
+      case FrameSkipMode::kAlternate:
+        skip = !skipping_frame_;
+        break;
+      case FrameSkipMode::kBudget:
+        skip = busy_ticks * 1000000 >
+                   uint64_t(std::max(FLAGS_frame_skip_budget_us, 0)) *
+                       Clock::host_tick_frequency() &&
+               skipped_frame_run_ < uint32_t(std::max(FLAGS_frame_skip_max, 0));
+        break;
+    }
+  }
+  skipped_frame_run_ = skip ? skipped_frame_run_ + 1 : 0;
+  skipping_frame_ = skip;
+}
+
 uint32_t CommandProcessor::ExecutePrimaryBuffer(uint32_t read_index,
                                                 uint32_t write_index) {
   SCOPE_profile_cpu_f("gpu");
@@ -449,6 +641,8 @@ uint32_t CommandProcessor::ExecutePrimaryBuffer(uint32_t read_index,
 
   trace_writer_.WritePrimaryBufferStart(start_ptr, write_index - read_index);
 
+  PredecodePrimaryBuffer(read_index, write_index);
+
   // Execute commands!
   RingBuffer reader(memory_->TranslatePhysical(primary_buffer_ptr_),
                     primary_buffer_size_);
@@ -473,21 +667,137 @@ void CommandProcessor::ExecuteIndirectBuffer(uint32_t ptr, uint32_t count) {
 
   trace_writer_.WriteIndirectBufferStart(ptr, count * sizeof(uint32_t));
 
+  // Traces record the packets as they're read, no-ops included.
+  const PredecodedIndirectBuffer* predecoded = nullptr;
+  if (!trace_writer_.is_open()) {
+    // Buffers skipped by predicated packets may be passed over.
+    for (size_t i = next_predecoded_buffer_; i < predecoded_buffers_.size();
+         ++i) {
+      if (predecoded_buffers_[i].ptr == ptr &&
+          predecoded_buffers_[i].count == count) {
+        predecoded = &predecoded_buffers_[i];
+        next_predecoded_buffer_ = i + 1;
+        break;
+      }
+    }
+  }
+
   // Execute commands!
   RingBuffer reader(memory_->TranslatePhysical(ptr), count * sizeof(uint32_t));
   reader.set_write_offset(count * sizeof(uint32_t));
-  do {
-    if (!ExecutePacket(&reader)) {
-      // Return up a level if we encounter a bad packet.
-      XELOGE("**** INDIRECT RINGBUFFER: Failed to execute packet.");
-      assert_always();
-      break;
+  if (predecoded) {
+    auto packets = predecoded_packets_.data() + predecoded->first_packet;
+    for (uint32_t i = 0; i < predecoded->packet_count; ++i) {
+      reader.set_read_offset(packets[i].payload_offset);
+      if (!DispatchPacket(&reader, packets[i].header)) {
+        XELOGE("**** INDIRECT RINGBUFFER: Failed to execute packet.");
+        assert_always();
+        break;
+      }
     }
-  } while (reader.read_count());
+  } else {
+    do {
+      if (!ExecutePacket(&reader)) {
+        // Return up a level if we encounter a bad packet.
+        XELOGE("**** INDIRECT RINGBUFFER: Failed to execute packet.");
+        assert_always();
+        break;
+      }
+    } while (reader.read_count());
+  }
 
   trace_writer_.WriteIndirectBufferEnd();
 }
 
+// The number of dwords following the header of a packet.
+static uint32_t PacketPayloadCount(uint32_t packet) {
+  switch (packet >> 30) {
+    case 0x00:
+      return packet ? ((packet >> 16) & 0x3FFF) + 1 : 0;
+    case 0x01:
+      return 2;
+    case 0x02:
+      return 0;
+    default:
+      return ((packet >> 16) & 0x3FFF) + 1;
+  }
+}
+
+void CommandProcessor::PredecodePrimaryBuffer(uint32_t read_index,
+                                              uint32_t write_index) {
+  predecoded_buffers_.clear();
+  predecoded_packets_.clear();
+  next_predecoded_buffer_ = 0;
+  if (!FLAGS_predecode_indirect_buffers || trace_writer_.is_open()) {
+    return;
+  }
+
+  RingBuffer reader(memory_->TranslatePhysical(primary_buffer_ptr_),
+                    primary_buffer_size_);
+  reader.set_read_offset(read_index * sizeof(uint32_t));
+  reader.set_write_offset(write_index * sizeof(uint32_t));
+  while (reader.read_count()) {
+    uint32_t packet = reader.ReadAndSwap<uint32_t>();
+    uint32_t count = PacketPayloadCount(packet);
+    if (reader.read_count() < count * sizeof(uint32_t)) {
+      return;
+    }
+    if (packet >> 30 == 0x03) {
+      switch ((packet >> 8) & 0x7F) {
+        case PM4_INDIRECT_BUFFER:
+        case PM4_INDIRECT_BUFFER_PFD:
+          if (count >= 2) {
+            uint32_t list_ptr = CpuToGpu(reader.ReadAndSwap<uint32_t>());
+            uint32_t list_length = reader.ReadAndSwap<uint32_t>() & 0xFFFFF;
+            PredecodeIndirectBuffer(GpuToCpu(list_ptr), list_length);
+            count -= 2;
+          }
+          break;
+        case PM4_INTERRUPT:
+        case PM4_XE_SWAP:
+        case PM4_WAIT_REG_MEM:
+        case PM4_REG_TO_MEM:
+        case PM4_MEM_WRITE:
+        case PM4_COND_WRITE:
+        case PM4_EVENT_WRITE_SHD:
+        case PM4_EVENT_WRITE_EXT:
+        case PM4_EVENT_WRITE_ZPD:
+          // The guest may only write the buffers called after these once
+          // they've been executed.
+          return;
+      }
+    }
+    reader.AdvanceRead(count * sizeof(uint32_t));
+  }
+}
+
+void CommandProcessor::PredecodeIndirectBuffer(uint32_t ptr, uint32_t count) {
+  if (!count) {
+    return;
+  }
+  auto data =
+      reinterpret_cast<const uint32_t*>(memory_->TranslatePhysical(ptr));
+  uint32_t first_packet = uint32_t(predecoded_packets_.size());
+  uint32_t offset = 0;
+  while (offset < count) {
+    uint32_t packet = xe::load_and_swap<uint32_t>(data + offset);
+    ++offset;
+    uint32_t payload_count = PacketPayloadCount(packet);
+    if (payload_count > count - offset) {
+      // Left for ExecuteIndirectBuffer to report.
+      predecoded_packets_.resize(first_packet);
+      return;
+    }
+    if (payload_count) {
+      predecoded_packets_.push_back({packet, offset * 4});
+    }
+    offset += payload_count;
+  }
+  predecoded_buffers_.push_back(
+      {ptr, count, first_packet,
+       uint32_t(predecoded_packets_.size()) - first_packet});
+}
+
 void CommandProcessor::ExecutePacket(uint32_t ptr, uint32_t count) {
   // Execute commands!
   RingBuffer reader(memory_->TranslatePhysical(ptr), count * sizeof(uint32_t));
@@ -502,14 +812,18 @@ void CommandProcessor::ExecutePacket(uint32_t ptr, uint32_t count) {
 }
 
 bool CommandProcessor::ExecutePacket(RingBuffer* reader) {
+  StartupPhases::Mark(StartupPhases::Phase::kFirstPacket);
   const uint32_t packet = reader->ReadAndSwap<uint32_t>();
-  const uint32_t packet_type = packet >> 30;
   if (packet == 0) {
     trace_writer_.WritePacketStart(uint32_t(reader->read_ptr() - 4), 1);
     trace_writer_.WritePacketEnd();
     return true;
   }
+  return DispatchPacket(reader, packet);
+}
 
+bool CommandProcessor::DispatchPacket(RingBuffer* reader, uint32_t packet) {
+  const uint32_t packet_type = packet >> 30;
   switch (packet_type) {
     case 0x00:
       return ExecutePacketType0(reader, packet);
@@ -541,10 +855,17 @@ bool CommandProcessor::ExecutePacketType0(RingBuffer* reader, uint32_t packet) {
 
   uint32_t base_index = (packet & 0x7FFF);
   uint32_t write_one_reg = (packet >> 15) & 0x1;
-  for (uint32_t m = 0; m < count; m++) {
-    uint32_t reg_data = reader->ReadAndSwap<uint32_t>();
-    uint32_t target_index = write_one_reg ? base_index : base_index + m;
-    WriteRegister(target_index, reg_data);
+  if (write_one_reg) {
+    uint32_t reg_data[64];
+    for (uint32_t m = 0; m < count; m += uint32_t(xe::countof(reg_data))) {
+      uint32_t chunk = std::min(count - m, uint32_t(xe::countof(reg_data)));
+      reader->ReadAndSwapArray(reg_data, chunk);
+      for (uint32_t i = 0; i < chunk; i++) {
+        WriteRegister(base_index, reg_data[i]);
+      }
+    }
+  } else {
+    WriteRegistersFromRing(reader, base_index, count);
   }
 
   trace_writer_.WritePacketEnd();
@@ -604,6 +925,26 @@ bool CommandProcessor::ExecutePacketType3(RingBuffer* reader, uint32_t packet) {
     }
   }
 
+  switch (opcode) {
+    case PM4_NOP:
+    case PM4_INDIRECT_BUFFER:
+    case PM4_INDIRECT_BUFFER_PFD:
+    case PM4_DRAW_INDX:
+    case PM4_SET_CONSTANT:
+    case PM4_SET_CONSTANT2:
+    case PM4_LOAD_ALU_CONSTANT:
+    case PM4_SET_SHADER_CONSTANTS:
+    case PM4_SET_BIN_MASK_LO:
+    case PM4_SET_BIN_MASK_HI:
+    case PM4_SET_BIN_SELECT_LO:
+    case PM4_SET_BIN_SELECT_HI:
+      // Can be merged with, or flush on register writes themselves.
+      break;
+    default:
+      FlushPendingDraws();
+      break;
+  }
+
   bool result = false;
   switch (opcode) {
     case PM4_ME_INIT:
@@ -762,10 +1103,8 @@ bool CommandProcessor::ExecutePacketType3_ME_INIT(RingBuffer* reader,
                                                   uint32_t packet,
                                                   uint32_t count) {
   // initialize CP's micro-engine
-  me_bin_.clear();
-  for (uint32_t i = 0; i < count; i++) {
-    me_bin_.push_back(reader->ReadAndSwap<uint32_t>());
-  }
+  me_bin_.resize(count);
+  reader->ReadAndSwapArray(me_bin_.data(), count);
 
   return true;
 }
@@ -846,19 +1185,20 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingBuffer* reader,
   uint32_t ref = reader->ReadAndSwap<uint32_t>();
   uint32_t mask = reader->ReadAndSwap<uint32_t>();
   uint32_t wait = reader->ReadAndSwap<uint32_t>();
-  bool matched = false;
-  do {
+  bool is_memory = (wait_info & 0x10) != 0;
+  auto endianness = static_cast<Endian>(poll_reg_addr & 0x3);
+  if (is_memory) {
+    poll_reg_addr &= ~0x3;
+  } else {
+    assert_true(poll_reg_addr < RegisterFile::kRegisterCount);
+  }
+  auto test = [&]() {
     uint32_t value;
-    if (wait_info & 0x10) {
-      // Memory.
-      auto endianness = static_cast<Endian>(poll_reg_addr & 0x3);
-      poll_reg_addr &= ~0x3;
+    if (is_memory) {
       value = xe::load<uint32_t>(memory_->TranslatePhysical(poll_reg_addr));
       value = GpuSwap(value, endianness);
       trace_writer_.WriteMemoryRead(CpuToGpu(poll_reg_addr), 4);
     } else {
-      // Register.
-      assert_true(poll_reg_addr < RegisterFile::kRegisterCount);
       value = register_file_->values[poll_reg_addr].u32;
       if (poll_reg_addr == XE_GPU_REG_COHER_STATUS_HOST) {
         MakeCoherent();
@@ -867,56 +1207,105 @@ bool CommandProcessor::ExecutePacketType3_WAIT_REG_MEM(RingBuffer* reader,
     }
     switch (wait_info & 0x7) {
       case 0x0:  // Never.
-        matched = false;
-        break;
+        return false;
       case 0x1:  // Less than reference.
-        matched = (value & mask) < ref;
-        break;
+        return (value & mask) < ref;
       case 0x2:  // Less than or equal to reference.
-        matched = (value & mask) <= ref;
-        break;
+        return (value & mask) <= ref;
       case 0x3:  // Equal to reference.
-        matched = (value & mask) == ref;
-        break;
+        return (value & mask) == ref;
       case 0x4:  // Not equal to reference.
-        matched = (value & mask) != ref;
-        break;
+        return (value & mask) != ref;
       case 0x5:  // Greater than or equal to reference.
-        matched = (value & mask) >= ref;
-        break;
+        return (value & mask) >= ref;
       case 0x6:  // Greater than reference.
-        matched = (value & mask) > ref;
-        break;
-      case 0x7:  // Always
-        matched = true;
-        break;
+        return (value & mask) > ref;
+      default:  // Always.
+        return true;
     }
-    if (!matched) {
-      // Wait.
-      if (wait >= 0x100) {
-        PrepareForWait();
-        if (!FLAGS_vsync) {
-          // User wants it fast and dangerous.
-          xe::threading::MaybeYield();
-        } else {
-          xe::threading::Sleep(std::chrono::milliseconds(wait / 0x100));
-        }
-        xe::threading::SyncMemory();
-        ReturnFromWait();
+  };
+  if (test()) {
+    return true;
+  }
 
-        if (!worker_running_) {
-          // Short-circuited exit.
-          return false;
-        }
-      } else {
-        xe::threading::MaybeYield();
-      }
+  // Sleep until a write that may satisfy the condition, with the poll
+  // interval as a timeout for changes nothing notifies about. The wake-ups are
+  // armed before every test so a write between the two isn't missed.
+  uint64_t wait_start = Clock::QueryHostTickCount();
+  auto timeout = std::chrono::milliseconds(
+      FLAGS_vsync ? std::max(wait / 0x100, uint32_t(1)) : 1);
+  bool matched = false;
+  while (true) {
+    ArmWaitWake(is_memory, poll_reg_addr);
+    matched = test();
+    if (matched || !worker_running_) {
+      break;
+    }
+    if (wait >= 0x100) {
+      PrepareForWait();
+      xe::threading::Wait(wait_event_.get(), false, timeout);
+      xe::threading::SyncMemory();
+      ReturnFromWait();
+    } else {
+      xe::threading::Wait(wait_event_.get(), false, timeout);
+      xe::threading::SyncMemory();
     }
-  } while (!matched);
+  }
+  DisarmWaitWake();
+  if (!matched) {
+    // Short-circuited exit.
+    return false;
+  }
 
+  // Histogram of the durations of the waits.
+  uint64_t wait_us = (Clock::QueryHostTickCount() - wait_start) * 1000000 /
+                     Clock::host_tick_frequency();
+  if (wait_us < 10) {
+    COUNT_profile_add("gpu/wait_reg_mem/under_10us", 1);
+  } else if (wait_us < 100) {
+    COUNT_profile_add("gpu/wait_reg_mem/under_100us", 1);
+  } else if (wait_us < 1000) {
+    COUNT_profile_add("gpu/wait_reg_mem/under_1ms", 1);
+  } else if (wait_us < 10000) {
+    COUNT_profile_add("gpu/wait_reg_mem/under_10ms", 1);
+  } else {
+    COUNT_profile_add("gpu/wait_reg_mem/over_10ms", 1);
+  }
   return true;
 }
 
+void CommandProcessor::ArmWaitWake(bool is_memory, uint32_t address) {
+  if (!is_memory) {
+    wait_register_index_.store(address, std::memory_order_relaxed);
+    return;
+  }
+  auto global_lock = global_critical_region_.Acquire();
+  if (!wait_watch_handle_) {
+    wait_watch_handle_ = memory_->AddPhysicalAccessWatch(
+        address, 4, cpu::MMIOHandler::kWatchWrite, WaitMemoryWriteCallback,
+        this, nullptr);
+  }
+}
+
+void CommandProcessor::DisarmWaitWake() {
+  wait_register_index_.store(RegisterFile::kRegisterCount,
+                             std::memory_order_relaxed);
+  auto global_lock = global_critical_region_.Acquire();
+  if (wait_watch_handle_) {
+    memory_->CancelAccessWatch(wait_watch_handle_);
+    wait_watch_handle_ = 0;
+  }
+}
+
+void CommandProcessor::WaitMemoryWriteCallback(void* context_ptr,
+                                               void* data_ptr,
+                                               uint32_t address) {
+  // Called under the global critical region, and the watch is gone after this.
+  auto self = reinterpret_cast<CommandProcessor*>(context_ptr);
+  self->wait_watch_handle_ = 0;
+  self->wait_event_->Set();
+}
+
 bool CommandProcessor::ExecutePacketType3_REG_RMW(RingBuffer* reader,
                                                   uint32_t packet,
                                                   uint32_t count) {
@@ -971,15 +1360,19 @@ bool CommandProcessor::ExecutePacketType3_MEM_WRITE(RingBuffer* reader,
                                                     uint32_t packet,
                                                     uint32_t count) {
   uint32_t write_addr = reader->ReadAndSwap<uint32_t>();
-  for (uint32_t i = 0; i < count - 1; i++) {
-    uint32_t write_data = reader->ReadAndSwap<uint32_t>();
-
-    auto endianness = static_cast<Endian>(write_addr & 0x3);
-    auto addr = write_addr & ~0x3;
-    write_data = GpuSwap(write_data, endianness);
-    xe::store(memory_->TranslatePhysical(addr), write_data);
-    trace_writer_.WriteMemoryWrite(CpuToGpu(addr), 4);
-    write_addr += 4;
+  uint32_t write_data[64];
+  for (uint32_t i = 0; i < count - 1; i += uint32_t(xe::countof(write_data))) {
+    uint32_t chunk =
+        std::min(count - 1 - i, uint32_t(xe::countof(write_data)));
+    reader->ReadAndSwapArray(write_data, chunk);
+    for (uint32_t j = 0; j < chunk; j++) {
+      auto endianness = static_cast<Endian>(write_addr & 0x3);
+      auto addr = write_addr & ~0x3;
+      xe::store(memory_->TranslatePhysical(addr),
+                GpuSwap(write_data[j], endianness));
+      trace_writer_.WriteMemoryWrite(CpuToGpu(addr), 4);
+      write_addr += 4;
+    }
   }
 
   return true;
@@ -1132,9 +1525,23 @@ bool CommandProcessor::ExecutePacketType3_EVENT_WRITE_ZPD(RingBuffer* reader,
   // Writeback initiator.
   WriteRegister(XE_GPU_REG_VGT_EVENT_INITIATOR, initiator & 0x3F);
 
-  // TODO: Flag the backend CP to write out zpass counters to
-  // REG_RB_SAMPLE_COUNT_ADDR (probably # pixels passed depth test).
-  // This applies to the last draw, I believe.
+  // The same packet begins and ends queries, only ends have the marker.
+  uint32_t sample_counts_address =
+      register_file_->values[XE_GPU_REG_RB_SAMPLE_COUNT_ADDR].u32;
+  if (!sample_counts_address) {
+    return true;
+  }
+  auto sample_counts =
+      memory_->TranslatePhysical<const xe_gpu_depth_sample_counts*>(
+          sample_counts_address);
+  if ((sample_counts->ZPass_A == kSampleCountsEndMarker &&
+       sample_counts->ZPass_B == kSampleCountsEndMarker) ||
+      (sample_counts->ZFail_A == kSampleCountsEndMarker &&
+       sample_counts->ZFail_B == kSampleCountsEndMarker)) {
+    EndOcclusionQuery(sample_counts_address);
+  } else {
+    BeginOcclusionQuery(sample_counts_address);
+  }
 
   return true;
 }
@@ -1181,8 +1588,10 @@ bool CommandProcessor::ExecutePacketType3_DRAW_INDX(RingBuffer* reader,
     assert_always();
   }
 
-  bool success = IssueDraw(prim_type, index_count,
-                           is_indexed ? &index_buffer_info : nullptr);
+  bool success =
+      skipping_frame_ ||
+      IssueDraw(prim_type, index_count,
+                is_indexed ? &index_buffer_info : nullptr);
   if (!success) {
     XELOGE("PM4_DRAW_INDX(%d, %d, %d): Failed in backend", index_count,
            prim_type, src_sel);
@@ -1206,7 +1615,7 @@ bool CommandProcessor::ExecutePacketType3_DRAW_INDX_2(RingBuffer* reader,
   // uint32_t index_ptr = reader->ptr();
   reader->AdvanceRead((count - 1) * sizeof(uint32_t));
 
-  bool success = IssueDraw(prim_type, index_count, nullptr);
+  bool success = skipping_frame_ || IssueDraw(prim_type, index_count, nullptr);
   if (!success) {
     XELOGE("PM4_DRAW_INDX_IMM(%d, %d): Failed in backend", index_count,
            prim_type);
@@ -1245,10 +1654,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT(RingBuffer* reader,
       reader->AdvanceRead((count - 1) * sizeof(uint32_t));
       return true;
   }
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->ReadAndSwap<uint32_t>();
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1257,10 +1663,7 @@ bool CommandProcessor::ExecutePacketType3_SET_CONSTANT2(RingBuffer* reader,
                                                         uint32_t count) {
   uint32_t offset_type = reader->ReadAndSwap<uint32_t>();
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->ReadAndSwap<uint32_t>();
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1296,11 +1699,10 @@ bool CommandProcessor::ExecutePacketType3_LOAD_ALU_CONSTANT(RingBuffer* reader,
       return true;
   }
   trace_writer_.WriteMemoryRead(CpuToGpu(address), size_dwords * 4);
-  for (uint32_t n = 0; n < size_dwords; n++, index++) {
-    uint32_t data = xe::load_and_swap<uint32_t>(
-        memory_->TranslatePhysical(address + n * 4));
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromMem(
+      index,
+      reinterpret_cast<const uint32_t*>(memory_->TranslatePhysical(address)),
+      size_dwords);
   return true;
 }
 
@@ -1308,10 +1710,7 @@ bool CommandProcessor::ExecutePacketType3_SET_SHADER_CONSTANTS(
     RingBuffer* reader, uint32_t packet, uint32_t count) {
   uint32_t offset_type = reader->ReadAndSwap<uint32_t>();
   uint32_t index = offset_type & 0xFFFF;
-  for (uint32_t n = 0; n < count - 1; n++, index++) {
-    uint32_t data = reader->ReadAndSwap<uint32_t>();
-    WriteRegister(index, data);
-  }
+  WriteRegistersFromRing(reader, index, count - 1);
   return true;
 }
 
@@ -1361,9 +1760,20 @@ bool CommandProcessor::ExecutePacketType3_IM_LOAD_IMMEDIATE(RingBuffer* reader,
   assert_true(start == 0);
   assert_true(reader->read_count() >= size_dwords * 4);
   assert_true(count - 2 >= size_dwords);
-  auto shader =
-      LoadShader(shader_type, uint32_t(reader->read_ptr()),
-                 reinterpret_cast<uint32_t*>(reader->read_ptr()), size_dwords);
+  uint32_t guest_address = uint32_t(reader->read_ptr());
+  auto range = reader->BeginRead(size_dwords * sizeof(uint32_t));
+  const uint32_t* dwords = reinterpret_cast<const uint32_t*>(range.first);
+  std::vector<uint32_t> wrapped_dwords;
+  if (range.second_length) {
+    // Only gathered when the code wraps around the end of the ring.
+    wrapped_dwords.resize(size_dwords);
+    std::memcpy(wrapped_dwords.data(), range.first, range.first_length);
+    std::memcpy(reinterpret_cast<uint8_t*>(wrapped_dwords.data()) +
+                    range.first_length,
+                range.second, range.second_length);
+    dwords = wrapped_dwords.data();
+  }
+  auto shader = LoadShader(shader_type, guest_address, dwords, size_dwords);
   switch (shader_type) {
     case ShaderType::kVertex:
       active_vertex_shader_ = shader;
@@ -1375,7 +1785,7 @@ bool CommandProcessor::ExecutePacketType3_IM_LOAD_IMMEDIATE(RingBuffer* reader,
       assert_unhandled_case(shader_type);
       return false;
   }
-  reader->AdvanceRead(size_dwords * sizeof(uint32_t));
+  reader->EndRead(range);
   return true;
 }
 
@@ -13,12 +13,15 @@
 #include <atomic>
 #include <cstring>
 #include <functional>
+#include <map>
 #include <memory>
 #include <mutex>
 #include <queue>
 #include <string>
 #include <vector>
 
+#include "xenia/base/delegate.h"
+#include "xenia/base/metrics.h"
 #include "xenia/base/ring_buffer.h"
 #include "xenia/base/threading.h"
 #include "xenia/gpu/register_file.h"
@@ -51,6 +54,9 @@ struct SwapState {
   void* backend_data = nullptr;
   // Whether the back buffer is dirty and a swap is pending.
   bool pending = false;
+  // Host tick count of the last swap, to measure how long its frame takes to
+  // be presented.
+  uint64_t swap_ticks = 0;
 };
 
 enum class SwapMode {
@@ -58,6 +64,14 @@ enum class SwapMode {
   kIgnored,
 };
 
+enum class FrameSkipMode {
+  kNone,
+  // Every other frame.
+  kAlternate,
+  // Frames after one that kept the command processor busy for too long.
+  kBudget,
+};
+
 enum class GammaRampType {
   kUnknown = 0,
   kNormal,
@@ -129,6 +143,11 @@ class CommandProcessor {
   void set_swap_request_handler(std::function<void()> fn) {
     swap_request_handler_ = fn;
   }
+  // Called on the worker thread after each guest swap has been issued.
+  xe::Delegate<> on_swap;
+  // Whether the draws of the frame last swapped were skipped, in which case
+  // it isn't presented. Only valid on the worker thread, such as in on_swap.
+  bool last_frame_skipped() const { return last_frame_skipped_; }
 
   virtual void RequestFrameTrace(const std::wstring& root_path);
   virtual void BeginTracing(const std::wstring& root_path);
@@ -138,6 +157,8 @@ class CommandProcessor {
   void EnableReadPointerWriteBack(uint32_t ptr, uint32_t block_size);
 
   void UpdateWritePointer(uint32_t value);
+  // Wakes a WAIT_REG_MEM polling the register if the write can satisfy it.
+  void NotifyRegisterWritten(uint32_t index);
 
   void ExecutePacket(uint32_t ptr, uint32_t count);
 
@@ -148,6 +169,17 @@ class CommandProcessor {
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
+  // Checkpoints of the state trace playback builds up, so that it can resume
+  // after a command without replaying the ones before it: the registers, the
+  // active shaders and the contents of the render targets. Must be called on
+  // the worker thread. Returns 0 if the backend can't save the render
+  // targets.
+  uint32_t SaveCheckpoint();
+  // Returns false if the checkpoint has been released.
+  bool RestoreCheckpoint(uint32_t checkpoint);
+  // Releases all checkpoints, as does ClearCaches.
+  void ReleaseCheckpoints();
+
  protected:
   struct IndexBufferInfo {
     IndexFormat format = IndexFormat::kInt16;
@@ -157,14 +189,53 @@ class CommandProcessor {
     size_t length = 0;
   };
 
+  // A packet of an indirect buffer found by PredecodePrimaryBuffer. No-ops
+  // are left out.
+  struct PredecodedPacket {
+    uint32_t header;
+    // In bytes from the start of the indirect buffer.
+    uint32_t payload_offset;
+  };
+  struct PredecodedIndirectBuffer {
+    uint32_t ptr;
+    uint32_t count;
+    // Range of predecoded_packets_.
+    uint32_t first_packet;
+    uint32_t packet_count;
+  };
+
   void WorkerThreadMain();
+  // Decides whether to skip the draws of the next frame, given the host ticks
+  // the worker was busy for during the one just swapped.
+  void UpdateFrameSkip(uint64_t busy_ticks);
+  static void CollectMetricsThunk(MetricsWriter* writer, void* data);
   virtual bool SetupContext() = 0;
   virtual void ShutdownContext() = 0;
 
   virtual void WriteRegister(uint32_t index, uint32_t value);
+  // Writes num_registers consecutive registers from big-endian data, such as
+  // packet contents or guest memory, in one go. Backends that react to writes
+  // of specific registers must override this as well as WriteRegister.
+  virtual void WriteRegistersFromMem(uint32_t start_index, const uint32_t* base,
+                                     uint32_t num_registers);
+  void WriteRegistersFromRing(RingBuffer* reader, uint32_t start_index,
+                              uint32_t num_registers);
 
   void UpdateGammaRampValue(GammaRampType type, uint32_t value);
 
+  // Arms the wake-ups of a WAIT_REG_MEM: a write watch on the polled guest
+  // memory, or a notification on writes to the polled register.
+  void ArmWaitWake(bool is_memory, uint32_t address);
+  void DisarmWaitWake();
+  static void WaitMemoryWriteCallback(void* context_ptr, void* data_ptr,
+                                      uint32_t address);
+
+  // Called on EVENT_WRITE_ZPD to begin counting the samples passing the depth
+  // test, or to end and write the count to the xe_gpu_depth_sample_counts at
+  // sample_counts_address.
+  virtual void BeginOcclusionQuery(uint32_t sample_counts_address);
+  virtual void EndOcclusionQuery(uint32_t sample_counts_address);
+
   virtual void MakeCoherent();
   virtual void PrepareForWait();
   virtual void ReturnFromWait();
@@ -175,6 +246,14 @@ class CommandProcessor {
   uint32_t ExecutePrimaryBuffer(uint32_t start_index, uint32_t end_index);
   void ExecuteIndirectBuffer(uint32_t ptr, uint32_t length);
   bool ExecutePacket(RingBuffer* reader);
+  // Executes a packet whose header has already been read.
+  bool DispatchPacket(RingBuffer* reader, uint32_t packet);
+  // Splits the indirect buffers called by the primary buffer into packets
+  // before executing any of it (--predecode_indirect_buffers), which also
+  // brings them into the cache. Stops at the first packet the guest may be
+  // waiting on to finish writing the buffers after it.
+  void PredecodePrimaryBuffer(uint32_t read_index, uint32_t write_index);
+  void PredecodeIndirectBuffer(uint32_t ptr, uint32_t count);
   bool ExecutePacketType0(RingBuffer* reader, uint32_t packet);
   bool ExecutePacketType1(RingBuffer* reader, uint32_t packet);
   bool ExecutePacketType2(RingBuffer* reader, uint32_t packet);
@@ -236,6 +315,15 @@ class CommandProcessor {
   virtual bool IssueDraw(PrimitiveType prim_type, uint32_t index_count,
                          IndexBufferInfo* index_buffer_info) = 0;
   virtual bool IssueCopy() = 0;
+  // Issues draws the backend has deferred to merge them with the next ones.
+  // Called before every packet that may depend on them or change their state,
+  // other than register writes, which backends deferring draws must watch.
+  virtual void FlushPendingDraws();
+
+  // The backend state of checkpoints, outside any pending draws.
+  virtual bool SaveBackendCheckpoint(uint32_t checkpoint);
+  virtual void RestoreBackendCheckpoint(uint32_t checkpoint);
+  virtual void ReleaseBackendCheckpoints();
 
   Memory* memory_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -259,6 +347,20 @@ class CommandProcessor {
   SwapMode swap_mode_ = SwapMode::kNormal;
   SwapState swap_state_;
   std::function<void()> swap_request_handler_;
+  // Host seconds between the guest's swaps.
+  MetricsSummary frame_time_;
+  uint64_t last_swap_tick_ = 0;
+  std::atomic<uint64_t> frame_count_ = {0};
+
+  // With --frame_skip, draws are dropped for whole frames while packets,
+  // register writes, resolves and swaps are still processed.
+  FrameSkipMode frame_skip_mode_ = FrameSkipMode::kNone;
+  bool skipping_frame_ = false;
+  bool last_frame_skipped_ = false;
+  uint32_t skipped_frame_run_ = 0;
+  std::atomic<uint64_t> skipped_frame_count_ = {0};
+  // Host ticks the worker spent waiting for the guest since the last swap.
+  uint64_t frame_idle_ticks_ = 0;
   std::queue<std::function<void()>> pending_fns_;
 
   // MicroEngine binary from PM4_ME_INIT
@@ -270,18 +372,40 @@ class CommandProcessor {
   uint32_t primary_buffer_size_ = 0;
 
   uint32_t read_ptr_index_ = 0;
+
+  // Filled by PredecodePrimaryBuffer in the order the buffers are called.
+  std::vector<PredecodedIndirectBuffer> predecoded_buffers_;
+  std::vector<PredecodedPacket> predecoded_packets_;
+  size_t next_predecoded_buffer_ = 0;
   uint32_t read_ptr_update_freq_ = 0;
   uint32_t read_ptr_writeback_ptr_ = 0;
 
   std::unique_ptr<xe::threading::Event> write_ptr_index_event_;
   std::atomic<uint32_t> write_ptr_index_;
 
+  // Signaled when the condition of the current WAIT_REG_MEM may have changed.
+  std::unique_ptr<xe::threading::Event> wait_event_;
+  // Register polled by the current WAIT_REG_MEM, or kRegisterCount.
+  std::atomic<uint32_t> wait_register_index_;
+  // Write watch on the guest memory polled by the current WAIT_REG_MEM,
+  // guarded by the global critical region as it's cleared when it fires.
+  xe::global_critical_region global_critical_region_;
+  uintptr_t wait_watch_handle_ = 0;
+
   uint64_t bin_select_ = 0xFFFFFFFFull;
   uint64_t bin_mask_ = 0xFFFFFFFFull;
 
   Shader* active_vertex_shader_ = nullptr;
   Shader* active_pixel_shader_ = nullptr;
 
+  struct Checkpoint {
+    std::vector<uint32_t> registers;
+    Shader* vertex_shader;
+    Shader* pixel_shader;
+  };
+  std::map<uint32_t, Checkpoint> checkpoints_;
+  uint32_t last_checkpoint_ = 0;
+
   bool paused_ = false;
 
   GammaRamp gamma_ramp_ = {};
@@ -16,4 +16,28 @@ DEFINE_bool(trace_gpu_stream, false, "Trace all GPU packets.");
 DEFINE_string(dump_shaders, "",
               "Path to write GPU shaders to as they are compiled.");
 
+DEFINE_bool(deferred_write_watches, false,
+            "Only record guest writes to watched textures and buffers when "
+            "they fault, and invalidate the written ones in one batch before "
+            "each draw and swap, instead of in the faulting thread.");
+DEFINE_bool(predecode_indirect_buffers, true,
+            "Split the indirect buffers called by newly submitted commands "
+            "into packets before executing the commands.");
+
 DEFINE_bool(vsync, true, "Enable VSYNC.");
+DEFINE_int32(frame_limit, 0,
+             "Maximum frames presented per second, so that they're paced "
+             "evenly. With vsync the guest waits for its frames to be "
+             "presented, otherwise the latest frame is presented. 0 for no "
+             "limit.");
+
+DEFINE_string(frame_skip, "none",
+              "Skip the draws of some guest frames, keeping everything else, "
+              "so titles hold their speed on hosts too slow to draw every "
+              "frame. Use: [none, alternate, budget]");
+DEFINE_int32(frame_skip_budget_us, 16667,
+             "With --frame_skip=budget, the draws of a frame are skipped if "
+             "the command processor was busy for longer than this during the "
+             "frame before.");
+DEFINE_int32(frame_skip_max, 1,
+             "Most frames in a row whose draws --frame_skip=budget skips.");
@@ -17,6 +17,14 @@ DECLARE_bool(trace_gpu_stream);
 
 DECLARE_string(dump_shaders);
 
+DECLARE_bool(deferred_write_watches);
+DECLARE_bool(predecode_indirect_buffers);
+
 DECLARE_bool(vsync);
+DECLARE_int32(frame_limit);
+
+DECLARE_string(frame_skip);
+DECLARE_int32(frame_skip_budget_us);
+DECLARE_int32(frame_skip_max);
 
 #endif  // XENIA_GPU_GPU_FLAGS_H_
@@ -9,6 +9,8 @@
 
 #include "xenia/gpu/graphics_system.h"
 
+#include <algorithm>
+
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
@@ -89,12 +91,25 @@ X_STATUS GraphicsSystem::Setup(cpu::Processor* processor,
   }
 
   if (target_window) {
+    // Paints are requested from a thread of their own, so that pacing them
+    // doesn't hold up the command processor.
+    present_event_ = xe::threading::Event::CreateAutoResetEvent(false);
+    present_thread_running_ = true;
+    present_thread_ = std::thread(&GraphicsSystem::PresentThreadMain, this);
     command_processor_->set_swap_request_handler(
-        [this]() { target_window_->Invalidate(); });
+        [this]() { present_event_->Set(); });
 
     // Watch for paint requests to do our swap.
-    target_window->on_painting.AddListener(
-        [this](xe::ui::UIEvent* e) { Swap(e); });
+    target_window->on_painting.AddListener([this](xe::ui::UIEvent* e) {
+      {
+        auto& swap_state = command_processor_->swap_state();
+        std::lock_guard<std::mutex> lock(swap_state.mutex);
+        painting_swap_ticks_ = swap_state.swap_ticks;
+      }
+      Swap(e);
+    });
+    target_window->on_painted.AddListener(
+        [this](xe::ui::UIEvent* e) { ReportPresent(); });
 
     // Watch for context lost events.
     target_window->on_context_lost.AddListener(
@@ -140,6 +155,12 @@ X_STATUS GraphicsSystem::Setup(cpu::Processor* processor,
 }
 
 void GraphicsSystem::Shutdown() {
+  if (present_thread_.joinable()) {
+    present_thread_running_ = false;
+    present_event_->Set();
+    present_thread_.join();
+  }
+
   if (command_processor_) {
     EndTracing();
     command_processor_->Shutdown();
@@ -212,6 +233,8 @@ void GraphicsSystem::WriteRegister(uint32_t addr, uint32_t value) {
 
   assert_true(r < RegisterFile::kRegisterCount);
   register_file_.values[r].u32 = value;
+  register_file_.MarkDirty(r);
+  command_processor_->NotifyRegisterWritten(r);
 }
 
 void GraphicsSystem::InitializeRingBuffer(uint32_t ptr, uint32_t log2_size) {
@@ -264,6 +287,49 @@ void GraphicsSystem::MarkVblank() {
   DispatchInterruptCallback(0, 2);
 }
 
+void GraphicsSystem::PresentThreadMain() {
+  xe::threading::set_name("GraphicsSystem Present");
+  uint64_t next_present_ticks = 0;
+  while (true) {
+    // Swaps made while waiting for the limit are presented as one, the latest.
+    xe::threading::Wait(present_event_.get(), false);
+    if (!present_thread_running_) {
+      break;
+    }
+    if (FLAGS_frame_limit > 0) {
+      uint64_t frequency = Clock::host_tick_frequency();
+      uint64_t now_ticks = Clock::QueryHostTickCount();
+      // A frame later than its slot is presented right away, and the next
+      // one is paced from it rather than rushed to catch up.
+      uint64_t present_ticks = std::max(next_present_ticks, now_ticks);
+      if (present_ticks > now_ticks) {
+        xe::threading::Sleep(std::chrono::microseconds(
+            (present_ticks - now_ticks) * 1000000 / frequency));
+      }
+      next_present_ticks = present_ticks + frequency / FLAGS_frame_limit;
+    }
+    target_window_->Invalidate();
+  }
+}
+
+void GraphicsSystem::ReportPresent() {
+  // Paints not caused by a swap show the same frame again.
+  uint64_t swap_ticks = painting_swap_ticks_;
+  if (!swap_ticks || swap_ticks == presented_swap_ticks_) {
+    return;
+  }
+  uint64_t now_ticks = Clock::QueryHostTickCount();
+  double us_per_tick = 1000000.0 / double(Clock::host_tick_frequency());
+  COUNT_profile_set("gpu/present/swap_to_present_us",
+                    int64_t((now_ticks - swap_ticks) * us_per_tick));
+  if (last_present_ticks_) {
+    COUNT_profile_set("gpu/present/present_to_present_us",
+                      int64_t((now_ticks - last_present_ticks_) * us_per_tick));
+  }
+  presented_swap_ticks_ = swap_ticks;
+  last_present_ticks_ = now_ticks;
+}
+
 void GraphicsSystem::ClearCaches() {
   command_processor_->CallInThread(
       [&]() { command_processor_->ClearCaches(); });
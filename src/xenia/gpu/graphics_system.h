@@ -14,6 +14,7 @@
 #include <memory>
 #include <thread>
 
+#include "xenia/base/threading.h"
 #include "xenia/cpu/processor.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/kernel/xthread.h"
@@ -88,6 +89,12 @@ class GraphicsSystem {
   void MarkVblank();
   virtual void Swap(xe::ui::UIEvent* e) = 0;
 
+  // Requests a paint of the window for each new frame, no more often than
+  // --frame_limit, off the command processor thread.
+  void PresentThreadMain();
+  // Reports the latency of the frame the window just presented, if new.
+  void ReportPresent();
+
   Memory* memory_ = nullptr;
   cpu::Processor* processor_ = nullptr;
   kernel::KernelState* kernel_state_ = nullptr;
@@ -100,6 +107,14 @@ class GraphicsSystem {
   std::atomic<bool> vsync_worker_running_;
   kernel::object_ref<kernel::XHostThread> vsync_worker_thread_;
 
+  std::atomic<bool> present_thread_running_ = {false};
+  std::thread present_thread_;
+  std::unique_ptr<xe::threading::Event> present_event_;
+  // Swap of the frame being painted, and of the last one presented.
+  uint64_t painting_swap_ticks_ = 0;
+  uint64_t presented_swap_ticks_ = 0;
+  uint64_t last_present_ticks_ = 0;
+
   RegisterFile register_file_;
   std::unique_ptr<CommandProcessor> command_processor_;
 
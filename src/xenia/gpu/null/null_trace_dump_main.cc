@@ -0,0 +1,45 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/base/logging.h"
+#include "xenia/base/main.h"
+#include "xenia/gpu/gpu_flags.h"
+#include "xenia/gpu/null/null_graphics_system.h"
+#include "xenia/gpu/trace_dump.h"
+
+namespace xe {
+namespace gpu {
+namespace null {
+
+// Replays traces without rendering anything, so that the benchmark mode only
+// measures the packet parsing and register handling of the command processor.
+class NullTraceDump : public TraceDump {
+ public:
+  std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() override {
+    return std::unique_ptr<gpu::GraphicsSystem>(new NullGraphicsSystem());
+  }
+
+ protected:
+  // Writing a trace of the replay would be measured along with the packets.
+  void PrepareBenchmark() override { FLAGS_trace_gpu_stream = false; }
+};
+
+int trace_dump_main(const std::vector<std::wstring>& args) {
+  NullTraceDump trace_dump;
+  return trace_dump.Main(args);
+}
+
+}  // namespace null
+}  // namespace gpu
+}  // namespace xe
+
+DEFINE_ENTRY_POINT(L"xenia-gpu-null-trace-dump",
+                   L"xenia-gpu-null-trace-dump some.trace "
+                   L"--trace_dump_benchmark_iterations=100",
+                   xe::gpu::null::trace_dump_main);
@@ -19,3 +19,68 @@ project("xenia-gpu-null")
     project_root.."/third_party/gflags/src",
   })
   local_platform_files()
+
+group("src")
+project("xenia-gpu-null-trace-dump")
+  uuid("9f0791e6-169b-4cb9-8378-4f76c4bebaaa")
+  kind("ConsoleApp")
+  language("C++")
+  links({
+    "aes_128",
+    "capstone",
+    "gflags",
+    "glslang-spirv",
+    "imgui",
+    "libavcodec",
+    "libavutil",
+    "mspack",
+    "snappy",
+    "spirv-tools",
+    "volk",
+    "xenia-apu",
+    "xenia-apu-nop",
+    "xenia-base",
+    "xenia-core",
+    "xenia-cpu",
+    "xenia-cpu-backend-x64",
+    "xenia-gpu",
+    "xenia-gpu-null",
+    "xenia-hid",
+    "xenia-hid-nop",
+    "xenia-kernel",
+    "xenia-ui",
+    "xenia-ui-spirv",
+    "xenia-ui-vulkan",
+    "xenia-vfs",
+    "xxhash",
+  })
+  defines({
+  })
+  includedirs({
+    project_root.."/third_party/gflags/src",
+  })
+  files({
+    "null_trace_dump_main.cc",
+    "../../base/main_"..platform_suffix..".cc",
+  })
+
+  filter("platforms:Linux")
+    links({
+      "X11",
+      "xcb",
+      "X11-xcb",
+      "GL",
+      "vulkan",
+    })
+
+  filter("platforms:Windows")
+    -- Only create the .user file if it doesn't already exist.
+    local user_file = project_root.."/build/xenia-gpu-null-trace-dump.vcxproj.user"
+    if not os.isfile(user_file) then
+      debugdir(project_root)
+      debugargs({
+        "--flagfile=scratch/flags.txt",
+        "2>&1",
+        "1>scratch/stdout-trace-dump-null.txt",
+      })
+    end
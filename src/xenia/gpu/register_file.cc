@@ -16,7 +16,102 @@
 namespace xe {
 namespace gpu {
 
-RegisterFile::RegisterFile() { std::memset(values, 0, sizeof(values)); }
+uint8_t RegisterFile::dirty_group_masks_[RegisterFile::kRegisterCount];
+
+namespace {
+
+struct DirtyGroupRegisters {
+  uint32_t group;
+  Register registers[32];
+};
+
+// Every register the state of a group is derived from. Unused entries are 0,
+// which isn't a state register.
+const DirtyGroupRegisters kDirtyGroupRegisters[] = {
+    {RegisterFile::kDirtyRasterization,
+     {XE_GPU_REG_PA_CL_CLIP_CNTL, XE_GPU_REG_PA_SU_SC_MODE_CNTL,
+      XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL, XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR,
+      XE_GPU_REG_PA_SC_VIZ_QUERY, XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_FRONT_SCALE,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_FRONT_OFFSET,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_BACK_SCALE,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_BACK_OFFSET}},
+    {RegisterFile::kDirtyMultisample,
+     {XE_GPU_REG_PA_SC_AA_CONFIG, XE_GPU_REG_PA_SU_SC_MODE_CNTL,
+      XE_GPU_REG_RB_SURFACE_INFO}},
+    {RegisterFile::kDirtyDepthStencil,
+     {XE_GPU_REG_RB_DEPTHCONTROL, XE_GPU_REG_RB_STENCILREFMASK}},
+    {RegisterFile::kDirtyColorBlend,
+     {XE_GPU_REG_RB_COLORCONTROL, XE_GPU_REG_RB_COLOR_MASK,
+      XE_GPU_REG_RB_BLENDCONTROL_0, XE_GPU_REG_RB_BLENDCONTROL_1,
+      XE_GPU_REG_RB_BLENDCONTROL_2, XE_GPU_REG_RB_BLENDCONTROL_3,
+      XE_GPU_REG_RB_MODECONTROL}},
+    {RegisterFile::kDirtyDynamicState,
+     {XE_GPU_REG_PA_SC_WINDOW_OFFSET,
+      XE_GPU_REG_PA_SU_SC_MODE_CNTL,
+      XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL,
+      XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR,
+      XE_GPU_REG_RB_SURFACE_INFO,
+      XE_GPU_REG_PA_CL_VTE_CNTL,
+      XE_GPU_REG_PA_SU_VTX_CNTL,
+      XE_GPU_REG_PA_CL_VPORT_XOFFSET,
+      XE_GPU_REG_PA_CL_VPORT_YOFFSET,
+      XE_GPU_REG_PA_CL_VPORT_ZOFFSET,
+      XE_GPU_REG_PA_CL_VPORT_XSCALE,
+      XE_GPU_REG_PA_CL_VPORT_YSCALE,
+      XE_GPU_REG_PA_CL_VPORT_ZSCALE,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_FRONT_SCALE,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_FRONT_OFFSET,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_BACK_SCALE,
+      XE_GPU_REG_PA_SU_POLY_OFFSET_BACK_OFFSET,
+      XE_GPU_REG_RB_BLEND_RED,
+      XE_GPU_REG_RB_BLEND_GREEN,
+      XE_GPU_REG_RB_BLEND_BLUE,
+      XE_GPU_REG_RB_BLEND_ALPHA,
+      XE_GPU_REG_RB_STENCILREFMASK,
+      XE_GPU_REG_SQ_PROGRAM_CNTL,
+      XE_GPU_REG_SQ_CONTEXT_MISC,
+      XE_GPU_REG_RB_COLORCONTROL,
+      XE_GPU_REG_RB_COLOR_INFO,
+      XE_GPU_REG_RB_COLOR1_INFO,
+      XE_GPU_REG_RB_COLOR2_INFO,
+      XE_GPU_REG_RB_COLOR3_INFO,
+      XE_GPU_REG_RB_ALPHA_REF,
+      XE_GPU_REG_PA_SU_POINT_SIZE}},
+    {RegisterFile::kDirtyRenderTargets,
+     {XE_GPU_REG_RB_MODECONTROL, XE_GPU_REG_RB_SURFACE_INFO,
+      XE_GPU_REG_RB_COLOR_INFO, XE_GPU_REG_RB_COLOR1_INFO,
+      XE_GPU_REG_RB_COLOR2_INFO, XE_GPU_REG_RB_COLOR3_INFO,
+      XE_GPU_REG_RB_DEPTH_INFO, XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL,
+      XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR}},
+};
+
+}  // namespace
+
+RegisterFile::RegisterFile() {
+  std::memset(values, 0, sizeof(values));
+
+  static const bool dirty_group_masks_built = [] {
+    for (const auto& group : kDirtyGroupRegisters) {
+      for (Register reg : group.registers) {
+        if (reg) {
+          dirty_group_masks_[reg] |= uint8_t(group.group);
+        }
+      }
+    }
+    // Too many to list.
+    for (uint32_t i = XE_GPU_REG_SHADER_CONSTANT_000_X;
+         i <= XE_GPU_REG_SHADER_CONSTANT_511_W; ++i) {
+      dirty_group_masks_[i] |= uint8_t(kDirtyShaderConstants);
+    }
+    for (uint32_t i = XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031;
+         i <= XE_GPU_REG_SHADER_CONSTANT_LOOP_31; ++i) {
+      dirty_group_masks_[i] |= uint8_t(kDirtyShaderConstants);
+    }
+    return true;
+  }();
+  (void)dirty_group_masks_built;
+}
 
 const RegisterInfo* RegisterFile::GetRegisterInfo(uint32_t index) {
   switch (index) {
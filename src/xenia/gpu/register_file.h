@@ -46,6 +46,44 @@ class RegisterFile {
 
   RegisterValue& operator[](int reg) { return values[reg]; }
   RegisterValue& operator[](Register reg) { return values[reg]; }
+
+  // Blocks of state derived from registers. Writes mark the blocks the
+  // register is part of as dirty, so the state only has to be compared
+  // against the registers again once any of them may have changed.
+  enum DirtyGroup : uint32_t {
+    kDirtyRasterization = 1 << 0,
+    kDirtyMultisample = 1 << 1,
+    kDirtyDepthStencil = 1 << 2,
+    kDirtyColorBlend = 1 << 3,
+    kDirtyDynamicState = 1 << 4,
+    kDirtyRenderTargets = 1 << 5,
+    kDirtyShaderConstants = 1 << 6,
+    kDirtyAll = (1 << 7) - 1,
+  };
+
+  // Must be called on every write to values.
+  void MarkDirty(uint32_t index) {
+    dirty_groups_ |= dirty_group_masks_[index];
+  }
+  void MarkRangeDirty(uint32_t index, uint32_t count) {
+    uint8_t masks = 0;
+    for (uint32_t i = 0; i < count; ++i) {
+      masks |= dirty_group_masks_[index + i];
+    }
+    dirty_groups_ |= masks;
+  }
+  void MarkAllDirty() { dirty_groups_ = kDirtyAll; }
+  // Returns whether any of the groups have been written since the last call,
+  // and clears them.
+  bool TestAndClearDirty(uint32_t groups) {
+    bool dirty = (dirty_groups_ & groups) != 0;
+    dirty_groups_ &= ~groups;
+    return dirty;
+  }
+
+ private:
+  static uint8_t dirty_group_masks_[kRegisterCount];
+  uint32_t dirty_groups_ = kDirtyAll;
 };
 
 }  // namespace gpu
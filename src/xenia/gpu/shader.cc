@@ -11,7 +11,9 @@
 
 #include <cinttypes>
 #include <cstring>
+#include <type_traits>
 
+#include "xenia/base/assert.h"
 #include "xenia/base/filesystem.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -40,6 +42,149 @@ std::string Shader::GetTranslatedBinaryString() const {
   return result;
 }
 
+// Fetch instructions are saved as they are, which only works as long as they
+// stay plain data.
+static_assert(
+    std::is_trivially_copyable<Shader::VertexBinding::Attribute>::value,
+    "Vertex attributes must be plain data to be saved");
+static_assert(std::is_trivially_copyable<Shader::TextureBinding>::value,
+              "Texture bindings must be plain data to be saved");
+
+namespace {
+
+void WriteBytes(std::vector<uint8_t>* out, const void* data, size_t size) {
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  out->insert(out->end(), bytes, bytes + size);
+}
+
+template <typename T>
+void WriteValue(std::vector<uint8_t>* out, const T& value) {
+  WriteBytes(out, &value, sizeof(value));
+}
+
+class TranslationReader {
+ public:
+  TranslationReader(const uint8_t* data, size_t size)
+      : data_(data), remaining_(size) {}
+
+  bool ReadBytes(void* out, size_t size) {
+    if (size > remaining_) {
+      return false;
+    }
+    std::memcpy(out, data_, size);
+    data_ += size;
+    remaining_ -= size;
+    return true;
+  }
+
+  template <typename T>
+  bool ReadValue(T* out) {
+    return ReadBytes(out, sizeof(*out));
+  }
+
+  bool at_end() const { return remaining_ == 0; }
+
+ private:
+  const uint8_t* data_;
+  size_t remaining_;
+};
+
+}  // namespace
+
+void Shader::SaveTranslation(std::vector<uint8_t>* out) const {
+  assert_true(is_valid_);
+  WriteValue(out, constant_register_map_);
+  for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
+    WriteValue(out, uint8_t(writes_color_targets_[i]));
+  }
+  WriteValue(out, uint32_t(vertex_bindings_.size()));
+  for (const auto& binding : vertex_bindings_) {
+    WriteValue(out, int32_t(binding.binding_index));
+    WriteValue(out, binding.fetch_constant);
+    WriteValue(out, binding.stride_words);
+    WriteValue(out, uint32_t(binding.attributes.size()));
+    WriteBytes(out, binding.attributes.data(),
+               binding.attributes.size() * sizeof(VertexBinding::Attribute));
+  }
+  WriteValue(out, uint32_t(texture_bindings_.size()));
+  WriteBytes(out, texture_bindings_.data(),
+             texture_bindings_.size() * sizeof(TextureBinding));
+  WriteValue(out, uint32_t(translated_binary_.size()));
+  WriteBytes(out, translated_binary_.data(), translated_binary_.size());
+}
+
+bool Shader::LoadTranslation(const uint8_t* data, size_t size) {
+  TranslationReader reader(data, size);
+  ConstantRegisterMap constant_register_map;
+  if (!reader.ReadValue(&constant_register_map)) {
+    return false;
+  }
+  uint8_t writes_color_targets[4];
+  if (!reader.ReadBytes(writes_color_targets, sizeof(writes_color_targets))) {
+    return false;
+  }
+  uint32_t vertex_binding_count;
+  if (!reader.ReadValue(&vertex_binding_count) ||
+      vertex_binding_count > size) {
+    return false;
+  }
+  std::vector<VertexBinding> vertex_bindings(vertex_binding_count);
+  for (auto& binding : vertex_bindings) {
+    int32_t binding_index;
+    uint32_t attribute_count;
+    if (!reader.ReadValue(&binding_index) ||
+        !reader.ReadValue(&binding.fetch_constant) ||
+        !reader.ReadValue(&binding.stride_words) ||
+        !reader.ReadValue(&attribute_count) || attribute_count > size) {
+      return false;
+    }
+    binding.binding_index = binding_index;
+    binding.attributes.resize(attribute_count);
+    if (!reader.ReadBytes(binding.attributes.data(),
+                          attribute_count * sizeof(VertexBinding::Attribute))) {
+      return false;
+    }
+    for (auto& attribute : binding.attributes) {
+      // Points into the old process; only used for disassembly.
+      attribute.fetch_instr.opcode_name = nullptr;
+    }
+  }
+  uint32_t texture_binding_count;
+  if (!reader.ReadValue(&texture_binding_count) ||
+      texture_binding_count > size) {
+    return false;
+  }
+  std::vector<TextureBinding> texture_bindings(texture_binding_count);
+  if (!reader.ReadBytes(texture_bindings.data(),
+                        texture_binding_count * sizeof(TextureBinding))) {
+    return false;
+  }
+  for (auto& binding : texture_bindings) {
+    binding.fetch_instr.opcode_name = nullptr;
+  }
+  uint32_t binary_size;
+  if (!reader.ReadValue(&binary_size) || binary_size > size) {
+    return false;
+  }
+  std::vector<uint8_t> translated_binary(binary_size);
+  if (!reader.ReadBytes(translated_binary.data(), binary_size) ||
+      !reader.at_end()) {
+    return false;
+  }
+
+  constant_register_map_ = constant_register_map;
+  for (size_t i = 0; i < xe::countof(writes_color_targets_); ++i) {
+    writes_color_targets_[i] = writes_color_targets[i] != 0;
+  }
+  vertex_bindings_ = std::move(vertex_bindings);
+  texture_bindings_ = std::move(texture_bindings);
+  translated_binary_ = std::move(translated_binary);
+  errors_.clear();
+  is_valid_ = true;
+  is_translated_ = true;
+  return true;
+}
+
 std::pair<std::string, std::string> Shader::Dump(const std::string& base_path,
                                                  const char* path_prefix) {
   // Ensure target path exists.
@@ -591,6 +591,14 @@ class Shader {
   // May be empty if the host does not support saving binaries.
   const std::vector<uint8_t>& host_binary() const { return host_binary_; }
 
+  // Serializes the translation (binary and binding information) so that it
+  // can be restored in a later run without translating again. Only valid
+  // shaders can be saved.
+  void SaveTranslation(std::vector<uint8_t>* out) const;
+  // Restores a translation written by SaveTranslation. The shader is left
+  // untranslated if the data is malformed.
+  bool LoadTranslation(const uint8_t* data, size_t size);
+
   // Dumps the shader to a file in the given path based on ucode hash.
   // Both the ucode binary and disassembled and translated shader will be
   // written.
@@ -9,18 +9,29 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cinttypes>
 #include <cstring>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/main.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/string.h"
+#include "xenia/base/task_scheduler.h"
 #include "xenia/gpu/glsl_shader_translator.h"
+#include "xenia/gpu/shader_disk_cache.h"
 #include "xenia/gpu/shader_translator.h"
 #include "xenia/gpu/spirv_shader_translator.h"
 #include "xenia/ui/spirv/spirv_disassembler.h"
+#include "xenia/ui/spirv/spirv_validator.h"
 
 DEFINE_string(shader_input, "", "Input shader binary file path.");
 DEFINE_string(shader_input_type, "",
@@ -28,11 +39,233 @@ DEFINE_string(shader_input_type, "",
 DEFINE_string(shader_output, "", "Output shader file path.");
 DEFINE_string(shader_output_type, "ucode",
               "Translator to use: [ucode, glsl45, spirv, spirvtext].");
+DEFINE_string(shader_batch, "",
+              "Directory of shaders dumped with --dump_shaders, or its "
+              "manifest.txt, to translate to SPIR-V all at once. Records are "
+              "added to --shader_output, if given, as a shaders.bin of the "
+              "Vulkan pipeline cache.");
+DEFINE_int32(shader_batch_report_count, 20,
+             "Slowest shaders to list after a batch translation.");
 
 namespace xe {
 namespace gpu {
 
+namespace {
+
+struct BatchShader {
+  std::wstring path;
+  // False for dumps without a manifest, translated with the most registers.
+  bool has_cntl;
+  xenos::xe_gpu_program_cntl_t cntl;
+  std::unique_ptr<Shader> shader;
+  bool valid;
+  std::string error;
+  double translation_ms;
+};
+
+// Loads the ucode of a shader dumped with Shader::Dump, which is in host byte
+// order.
+std::unique_ptr<Shader> LoadDumpedShader(const std::wstring& path,
+                                         ShaderType shader_type) {
+  FILE* file = xe::filesystem::OpenFile(path, "rb");
+  if (!file) {
+    return nullptr;
+  }
+  fseek(file, 0, SEEK_END);
+  size_t file_size = ftell(file);
+  fseek(file, 0, SEEK_SET);
+  std::vector<uint32_t> host_dwords(file_size / 4);
+  size_t read_count = fread(host_dwords.data(), 4, host_dwords.size(), file);
+  fclose(file);
+  if (host_dwords.empty() || read_count != host_dwords.size()) {
+    return nullptr;
+  }
+  // Hashed and passed to the shader like the title would have it.
+  std::vector<uint32_t> ucode_dwords(host_dwords.size());
+  xe::copy_and_swap(ucode_dwords.data(), host_dwords.data(),
+                    host_dwords.size());
+  uint64_t ucode_data_hash =
+      XXH64(ucode_dwords.data(), ucode_dwords.size() * 4, 0);
+  return std::make_unique<Shader>(shader_type, ucode_data_hash,
+                                  ucode_dwords.data(), ucode_dwords.size());
+}
+
+bool EndsWith(const std::wstring& value, const std::wstring& suffix) {
+  return value.size() >= suffix.size() &&
+         value.compare(value.size() - suffix.size(), suffix.size(), suffix) ==
+             0;
+}
+
+// Lists the shaders of the manifest, or of the dump directory if it has none.
+bool ListBatchShaders(const std::wstring& batch_path,
+                      std::vector<BatchShader>* out_shaders) {
+  std::wstring manifest_path = batch_path;
+  if (xe::filesystem::IsFolder(batch_path)) {
+    manifest_path = xe::join_paths(batch_path, L"manifest.txt");
+    if (!xe::filesystem::PathExists(manifest_path)) {
+      XELOGW("No manifest in %S, translating without SQ_PROGRAM_CNTL",
+             batch_path.c_str());
+      for (auto& file_info : xe::filesystem::ListFiles(batch_path)) {
+        bool is_vertex = EndsWith(file_info.name, L".bin.vert");
+        if (file_info.type != xe::filesystem::FileInfo::Type::kFile ||
+            (!is_vertex && !EndsWith(file_info.name, L".bin.frag"))) {
+          continue;
+        }
+        BatchShader batch_shader = {};
+        batch_shader.path = xe::join_paths(batch_path, file_info.name);
+        batch_shader.shader = LoadDumpedShader(
+            batch_shader.path,
+            is_vertex ? ShaderType::kVertex : ShaderType::kPixel);
+        out_shaders->push_back(std::move(batch_shader));
+      }
+      return true;
+    }
+  }
+  std::vector<ShaderDumpManifestEntry> entries;
+  if (!ReadShaderDumpManifest(manifest_path, &entries)) {
+    XELOGE("Unable to open shader dump manifest %S", manifest_path.c_str());
+    return false;
+  }
+  for (auto& entry : entries) {
+    BatchShader batch_shader = {};
+    batch_shader.path = entry.binary_path;
+    batch_shader.has_cntl = true;
+    batch_shader.cntl = entry.cntl;
+    batch_shader.shader =
+        LoadDumpedShader(entry.binary_path, entry.shader_type);
+    out_shaders->push_back(std::move(batch_shader));
+  }
+  return true;
+}
+
+int shader_compiler_batch() {
+  std::vector<BatchShader> shaders;
+  if (!ListBatchShaders(xe::to_wstring(FLAGS_shader_batch), &shaders)) {
+    return 1;
+  }
+  // The same ucode may have been dumped more than once.
+  std::unordered_set<uint64_t> ucode_hashes;
+  size_t unreadable_count = 0;
+  auto end = std::remove_if(
+      shaders.begin(), shaders.end(), [&](const BatchShader& batch_shader) {
+        if (!batch_shader.shader) {
+          XELOGE("Unable to read %S", batch_shader.path.c_str());
+          ++unreadable_count;
+          return true;
+        }
+        return !ucode_hashes.insert(batch_shader.shader->ucode_data_hash())
+                    .second;
+      });
+  shaders.erase(end, shaders.end());
+
+  // Every task takes the next shader until there are none left, so the slow
+  // ones don't hold up a whole share of the batch.
+  auto start_time = std::chrono::steady_clock::now();
+  std::atomic<size_t> next_index = {0};
+  TaskGroup group;
+  for (uint32_t i = 0; i < group.scheduler()->worker_count(); ++i) {
+    group.Run([&shaders, &next_index]() {
+      SpirvShaderTranslator translator;
+      xe::ui::spirv::SpirvValidator validator;
+      size_t index;
+      while ((index = next_index++) < shaders.size()) {
+        auto& batch_shader = shaders[index];
+        auto shader = batch_shader.shader.get();
+        auto translation_start = std::chrono::steady_clock::now();
+        if (batch_shader.has_cntl) {
+          translator.Translate(shader, batch_shader.cntl);
+        } else {
+          translator.Translate(shader);
+        }
+        batch_shader.translation_ms =
+            std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - translation_start)
+                .count();
+        if (!shader->is_valid()) {
+          batch_shader.error = "translation failed";
+          continue;
+        }
+        const auto& binary = shader->translated_binary();
+        auto validation = validator.Validate(
+            reinterpret_cast<const uint32_t*>(binary.data()),
+            binary.size() / 4);
+        if (!validation) {
+          batch_shader.error = "validator unavailable";
+        } else if (validation->has_error()) {
+          batch_shader.error = validation->error_string();
+        } else {
+          batch_shader.valid = true;
+        }
+      }
+    });
+  }
+  group.Wait();
+  double batch_ms = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - start_time)
+                        .count();
+
+  size_t written_count = 0;
+  if (!FLAGS_shader_output.empty()) {
+    // Appended to what the cache has already, like the emulator would.
+    std::unordered_set<uint64_t> cached_hashes;
+    FILE* output_file = OpenDiskCacheFile(
+        xe::to_wstring(FLAGS_shader_output), kShaderDiskCacheMagic,
+        [&cached_hashes](const uint8_t* data, size_t size) {
+          DiskShaderRecord record;
+          if (size >= sizeof(record)) {
+            std::memcpy(&record, data, sizeof(record));
+            cached_hashes.insert(record.ucode_hash);
+          }
+        });
+    if (!output_file) {
+      return 1;
+    }
+    for (auto& batch_shader : shaders) {
+      auto shader = batch_shader.shader.get();
+      if (batch_shader.valid &&
+          cached_hashes.insert(shader->ucode_data_hash()).second &&
+          WriteDiskShaderRecord(output_file, shader, batch_shader.cntl)) {
+        ++written_count;
+      }
+    }
+    fclose(output_file);
+  }
+
+  // Slowest first, to find the ucode that the translator struggles with.
+  std::sort(shaders.begin(), shaders.end(),
+            [](const BatchShader& a, const BatchShader& b) {
+              return a.translation_ms > b.translation_ms;
+            });
+  double translation_ms = 0.0;
+  size_t failed_count = 0;
+  for (size_t i = 0; i < shaders.size(); ++i) {
+    auto& batch_shader = shaders[i];
+    translation_ms += batch_shader.translation_ms;
+    if (!batch_shader.valid) {
+      ++failed_count;
+      XELOGE("%S: %s", batch_shader.path.c_str(), batch_shader.error.c_str());
+    }
+    if (i < size_t(std::max(FLAGS_shader_batch_report_count, 0))) {
+      XELOGI("%9.3f ms  %.16" PRIX64 "  %S", batch_shader.translation_ms,
+             batch_shader.shader->ucode_data_hash(),
+             batch_shader.path.c_str());
+    }
+  }
+  XELOGI(
+      "Translated %zu shaders (%zu failed, %zu unreadable) in %.1f ms, "
+      "%.1f ms of translation; %zu added to the cache",
+      shaders.size(), failed_count, unreadable_count, batch_ms, translation_ms,
+      written_count);
+  return failed_count || unreadable_count ? 1 : 0;
+}
+
+}  // namespace
+
 int shader_compiler_main(const std::vector<std::wstring>& args) {
+  if (!FLAGS_shader_batch.empty()) {
+    return shader_compiler_batch();
+  }
+
   ShaderType shader_type;
   if (!FLAGS_shader_input_type.empty()) {
     if (FLAGS_shader_input_type == "vs") {
@@ -0,0 +1,192 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/shader_disk_cache.h"
+
+#include <cinttypes>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+#include "third_party/xxhash/xxhash.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/mapped_memory.h"
+#include "xenia/base/memory.h"
+#include "xenia/base/string.h"
+#include "xenia/gpu/shader.h"
+
+namespace xe {
+namespace gpu {
+
+size_t ReadDiskCacheFile(
+    const std::wstring& path, uint32_t magic,
+    const std::function<void(const uint8_t*, size_t)>& record_fn) {
+  if (!xe::filesystem::PathExists(path)) {
+    return 0;
+  }
+  auto mmap = MappedMemory::Open(path, MappedMemory::Mode::kRead);
+  if (!mmap || mmap->size() < sizeof(DiskCacheHeader)) {
+    return 0;
+  }
+  DiskCacheHeader header;
+  std::memcpy(&header, mmap->data(), sizeof(header));
+  if (header.magic != magic || header.version != kDiskCacheVersion) {
+    XELOGW("Disk cache %S is from another version, discarding", path.c_str());
+    return 0;
+  }
+  size_t offset = sizeof(header);
+  while (mmap->size() - offset >= sizeof(DiskCacheRecordHeader)) {
+    DiskCacheRecordHeader record_header;
+    std::memcpy(&record_header, mmap->data() + offset, sizeof(record_header));
+    const uint8_t* payload = mmap->data() + offset + sizeof(record_header);
+    if (record_header.size >
+            mmap->size() - offset - sizeof(record_header) ||
+        XXH64(payload, record_header.size, 0) != record_header.hash) {
+      XELOGW("Disk cache %S is corrupt after %zu bytes", path.c_str(), offset);
+      break;
+    }
+    record_fn(payload, record_header.size);
+    offset += sizeof(record_header) + record_header.size;
+  }
+  return offset;
+}
+
+FILE* OpenDiskCacheFile(
+    const std::wstring& path, uint32_t magic,
+    const std::function<void(const uint8_t*, size_t)>& record_fn) {
+  // Instances running the same title share the files. The first to open one
+  // is the only one appending to it until it exits, and the rest just read
+  // it. The file is created without truncating, as it may be in use already.
+  xe::filesystem::CreateParentFolder(path);
+  FILE* file = xe::filesystem::OpenFile(path, "ab");
+  if (file) {
+    fclose(file);
+    file = xe::filesystem::OpenFile(path, "r+b");
+  }
+  if (!file) {
+    XELOGW("Unable to write disk cache %S", path.c_str());
+    ReadDiskCacheFile(path, magic, record_fn);
+    return nullptr;
+  }
+  if (!xe::filesystem::TryLockFile(file)) {
+    XELOGI("Disk cache %S is written by another instance, only reading it",
+           path.c_str());
+    fclose(file);
+    ReadDiskCacheFile(path, magic, record_fn);
+    return nullptr;
+  }
+
+  // Read with the lock held, so no other instance appends in between.
+  size_t valid_size = ReadDiskCacheFile(path, magic, record_fn);
+  bool opened;
+  if (valid_size) {
+    opened = fseek(file, long(valid_size), SEEK_SET) == 0;
+  } else {
+    DiskCacheHeader header = {magic, kDiskCacheVersion};
+    opened = xe::filesystem::SetFileLength(file, 0) &&
+             fwrite(&header, sizeof(header), 1, file) == 1;
+  }
+  if (!opened) {
+    XELOGW("Unable to write disk cache %S", path.c_str());
+    fclose(file);
+    return nullptr;
+  }
+  return file;
+}
+
+bool WriteDiskCacheRecord(FILE* file, const void* data, size_t size) {
+  DiskCacheRecordHeader record_header;
+  record_header.size = uint32_t(size);
+  record_header.reserved = 0;
+  record_header.hash = XXH64(data, size, 0);
+  bool written =
+      fwrite(&record_header, sizeof(record_header), 1, file) == 1 &&
+      fwrite(data, 1, size, file) == size;
+  // Titles are likely to be killed rather than exited cleanly.
+  fflush(file);
+  return written;
+}
+
+bool WriteDiskShaderRecord(FILE* file, const Shader* shader,
+                           xenos::xe_gpu_program_cntl_t cntl) {
+  std::vector<uint8_t> translation;
+  shader->SaveTranslation(&translation);
+
+  DiskShaderRecord record;
+  record.ucode_hash = shader->ucode_data_hash();
+  record.shader_type = uint32_t(shader->type());
+  record.sq_program_cntl = cntl.dword_0;
+  record.ucode_dword_count = uint32_t(shader->ucode_dword_count());
+  record.translation_size = uint32_t(translation.size());
+  size_t ucode_size = shader->ucode_dword_count() * 4;
+  std::vector<uint8_t> data(sizeof(record) + ucode_size + translation.size());
+  std::memcpy(data.data(), &record, sizeof(record));
+  // Back to guest byte order, which is what the hash is of.
+  xe::copy_and_swap(reinterpret_cast<uint32_t*>(data.data() + sizeof(record)),
+                    shader->ucode_dwords(), shader->ucode_dword_count());
+  std::memcpy(data.data() + sizeof(record) + ucode_size, translation.data(),
+              translation.size());
+  return WriteDiskCacheRecord(file, data.data(), data.size());
+}
+
+void AppendShaderDumpManifest(const std::string& dump_path,
+                              const Shader* shader,
+                              const std::string& binary_path,
+                              xenos::xe_gpu_program_cntl_t cntl) {
+  static std::mutex manifest_mutex;
+  std::lock_guard<std::mutex> lock(manifest_mutex);
+  auto manifest_path = xe::join_paths(xe::to_wstring(dump_path),
+                                      L"manifest.txt");
+  FILE* file = xe::filesystem::OpenFile(manifest_path, "ab");
+  if (!file) {
+    XELOGW("Unable to write shader dump manifest %S", manifest_path.c_str());
+    return;
+  }
+  // Names are relative to the manifest, so the dump can be moved.
+  auto name_begin = binary_path.find_last_of("/\\");
+  fprintf(file, "%s %.8X %s\n",
+          shader->type() == ShaderType::kVertex ? "vs" : "ps", cntl.dword_0,
+          binary_path
+              .substr(name_begin != std::string::npos ? name_begin + 1 : 0)
+              .c_str());
+  fclose(file);
+}
+
+bool ReadShaderDumpManifest(const std::wstring& manifest_path,
+                            std::vector<ShaderDumpManifestEntry>* out_entries) {
+  FILE* file = xe::filesystem::OpenFile(manifest_path, "rb");
+  if (!file) {
+    return false;
+  }
+  auto base_path = xe::find_base_path(manifest_path);
+  char line[1024];
+  while (fgets(line, sizeof(line), file)) {
+    char type[3];
+    uint32_t cntl;
+    char name[sizeof(line)];
+    if (std::sscanf(line, "%2s %" SCNx32 " %1023[^\r\n]", type, &cntl,
+                    name) != 3 ||
+        (std::strcmp(type, "vs") && std::strcmp(type, "ps"))) {
+      continue;
+    }
+    ShaderDumpManifestEntry entry;
+    entry.shader_type =
+        type[0] == 'v' ? ShaderType::kVertex : ShaderType::kPixel;
+    entry.cntl.dword_0 = cntl;
+    entry.binary_path = xe::join_paths(base_path, xe::to_wstring(name));
+    out_entries->push_back(std::move(entry));
+  }
+  fclose(file);
+  return true;
+}
+
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,93 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SHADER_DISK_CACHE_H_
+#define XENIA_GPU_SHADER_DISK_CACHE_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "xenia/gpu/xenos.h"
+
+namespace xe {
+namespace gpu {
+
+class Shader;
+
+// Files in the on-disk cache start with this header and are followed by
+// records, each a DiskCacheRecordHeader and its payload. Records are only ever
+// appended, so everything up to a torn or corrupt one is still usable.
+struct DiskCacheHeader {
+  uint32_t magic;
+  uint32_t version;
+};
+struct DiskCacheRecordHeader {
+  uint32_t size;
+  uint32_t reserved;
+  // XXH64 of the payload.
+  uint64_t hash;
+};
+const uint32_t kShaderDiskCacheMagic = 'XSHD';
+// Must be bumped whenever translator output or a record layout changes.
+const uint32_t kDiskCacheVersion = 5;
+
+// Payload of a shaders.bin record, followed by the ucode (in guest byte order,
+// as it was hashed) and the translation from Shader::SaveTranslation.
+struct DiskShaderRecord {
+  uint64_t ucode_hash;
+  uint32_t shader_type;
+  uint32_t sq_program_cntl;
+  uint32_t ucode_dword_count;
+  uint32_t translation_size;
+};
+
+// Calls record_fn for every intact record of the file and returns the size of
+// the valid part of it, or 0 if it's missing or not a cache of this kind.
+size_t ReadDiskCacheFile(
+    const std::wstring& path, uint32_t magic,
+    const std::function<void(const uint8_t*, size_t)>& record_fn);
+
+// Reads the file like ReadDiskCacheFile and opens it to append records after
+// the last intact one, creating it if needed. Returns nullptr, after reading
+// it all the same, if another process is already appending to it.
+FILE* OpenDiskCacheFile(
+    const std::wstring& path, uint32_t magic,
+    const std::function<void(const uint8_t*, size_t)>& record_fn);
+
+bool WriteDiskCacheRecord(FILE* file, const void* data, size_t size);
+
+// Appends a shaders.bin record for the translated shader.
+bool WriteDiskShaderRecord(FILE* file, const Shader* shader,
+                           xenos::xe_gpu_program_cntl_t cntl);
+
+// Shaders dumped with --dump_shaders are listed in manifest.txt of the dump
+// path, a line per shader translated, with what the ucode alone doesn't say.
+struct ShaderDumpManifestEntry {
+  ShaderType shader_type;
+  xenos::xe_gpu_program_cntl_t cntl;
+  // The ucode file written by Shader::Dump.
+  std::wstring binary_path;
+};
+// Adds the shader to the manifest, given the ucode path from Shader::Dump.
+// Safe to call from multiple threads.
+void AppendShaderDumpManifest(const std::string& dump_path,
+                              const Shader* shader,
+                              const std::string& binary_path,
+                              xenos::xe_gpu_program_cntl_t cntl);
+// False if the manifest can't be opened. Malformed lines are skipped.
+bool ReadShaderDumpManifest(const std::wstring& manifest_path,
+                            std::vector<ShaderDumpManifestEntry>* out_entries);
+
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SHADER_DISK_CACHE_H_
@@ -9,6 +9,8 @@
 
 #include "xenia/gpu/spirv/compiler.h"
 
+#include "xenia/base/logging.h"
+
 namespace xe {
 namespace gpu {
 namespace spirv {
@@ -19,14 +21,37 @@ void Compiler::AddPass(std::unique_ptr<CompilerPass> pass) {
   compiler_passes_.push_back(std::move(pass));
 }
 
-bool Compiler::Compile(spv::Module* module) {
+bool Compiler::Compile(std::vector<uint32_t>* words) {
+  // Passes can only be checked against valid input.
+  auto validation = validator_.Validate(words->data(), words->size());
+  if (!validation || validation->has_error()) {
+    return false;
+  }
+
+  bool changed = false;
+  Module module;
+  std::vector<uint32_t> pass_words;
   for (auto& pass : compiler_passes_) {
-    if (!pass->Run(module)) {
-      return false;
+    if (!module.Parse(words->data(), words->size())) {
+      break;
+    }
+    if (!pass->Run(&module)) {
+      XELOGW("SPIR-V pass %s failed, skipping it", pass->name());
+      continue;
+    }
+    module.RemoveDeadAnnotations();
+    module.Emit(&pass_words);
+    validation = validator_.Validate(pass_words.data(), pass_words.size());
+    if (!validation || validation->has_error()) {
+      XELOGE("SPIR-V pass %s produced invalid code, skipping it: %s",
+             pass->name(), validation ? validation->error_string() : "");
+      continue;
     }
+    words->swap(pass_words);
+    changed = true;
   }
 
-  return true;
+  return changed;
 }
 
 void Compiler::Reset() { compiler_passes_.clear(); }
@@ -10,11 +10,12 @@
 #ifndef XENIA_GPU_SPIRV_COMPILER_H_
 #define XENIA_GPU_SPIRV_COMPILER_H_
 
+#include <memory>
+#include <vector>
+
 #include "xenia/base/arena.h"
 #include "xenia/gpu/spirv/compiler_pass.h"
-
-#include "third_party/glslang-spirv/SpvBuilder.h"
-#include "third_party/spirv/GLSL.std.450.hpp11"
+#include "xenia/ui/spirv/spirv_validator.h"
 
 namespace xe {
 namespace gpu {
@@ -28,10 +29,14 @@ class Compiler {
 
   void AddPass(std::unique_ptr<CompilerPass> pass);
   void Reset();
-  bool Compile(spv::Module* module);
+  // Runs the passes over the binary in place. The output of each pass is
+  // validated, and a pass producing invalid code is undone. Returns whether
+  // any pass was applied.
+  bool Compile(std::vector<uint32_t>* words);
 
  private:
   std::vector<std::unique_ptr<CompilerPass>> compiler_passes_;
+  xe::ui::spirv::SpirvValidator validator_;
 };
 
 }  // namespace spirv
@@ -11,9 +11,7 @@
 #define XENIA_GPU_SPIRV_COMPILER_PASS_H_
 
 #include "xenia/base/arena.h"
-
-#include "third_party/glslang-spirv/SpvBuilder.h"
-#include "third_party/spirv/GLSL.std.450.hpp11"
+#include "xenia/gpu/spirv/module.h"
 
 namespace xe {
 namespace gpu {
@@ -24,7 +22,10 @@ class CompilerPass {
   CompilerPass() = default;
   virtual ~CompilerPass() {}
 
-  virtual bool Run(spv::Module* module) = 0;
+  virtual const char* name() const = 0;
+  // Rewrites the module, returning false if it couldn't be processed. The
+  // module may be left partially rewritten in that case.
+  virtual bool Run(Module* module) = 0;
 
  private:
   xe::Arena ir_arena_;
@@ -0,0 +1,368 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/module.h"
+
+#include <cstring>
+#include <unordered_set>
+#include <utility>
+
+#include "third_party/glslang-spirv/doc.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+bool Module::Parse(const uint32_t* words, size_t word_count) {
+  spv::Parameterize();
+
+  globals_.clear();
+  functions_.clear();
+  global_indices_.clear();
+  if (word_count < 5 || words[0] != spv::MagicNumber) {
+    return false;
+  }
+  std::memcpy(header_, words, sizeof(header_));
+  id_bound_ = words[3];
+
+  Function* function = nullptr;
+  Block* block = nullptr;
+  size_t i = 5;
+  while (i < word_count) {
+    uint32_t length = words[i] >> spv::WordCountShift;
+    uint32_t opcode = words[i] & spv::OpCodeMask;
+    if (!length || length > word_count - i || opcode >= spv::OpcodeCeiling) {
+      return false;
+    }
+    const spv::InstructionParameters& desc = spv::InstructionDesc[opcode];
+    Instruction instruction;
+    instruction.opcode = spv::Op(opcode);
+    size_t end = i + length;
+    size_t word = i + 1;
+    if (desc.hasType()) {
+      if (word >= end) {
+        return false;
+      }
+      instruction.type_id = words[word++];
+    }
+    if (desc.hasResult()) {
+      if (word >= end) {
+        return false;
+      }
+      instruction.result_id = words[word++];
+    }
+    instruction.operands.assign(words + word, words + end);
+    i = end;
+
+    switch (instruction.opcode) {
+      case spv::Op::OpFunction:
+        if (function) {
+          return false;
+        }
+        functions_.emplace_back();
+        function = &functions_.back();
+        function->function = std::move(instruction);
+        block = nullptr;
+        break;
+      case spv::Op::OpFunctionParameter:
+        if (!function || block) {
+          return false;
+        }
+        function->parameters.push_back(std::move(instruction));
+        break;
+      case spv::Op::OpLabel:
+        if (!function) {
+          return false;
+        }
+        function->blocks.emplace_back();
+        block = &function->blocks.back();
+        block->id = instruction.result_id;
+        break;
+      case spv::Op::OpFunctionEnd:
+        if (!function) {
+          return false;
+        }
+        function = nullptr;
+        block = nullptr;
+        break;
+      default:
+        if (function) {
+          if (!block) {
+            return false;
+          }
+          block->instructions.push_back(std::move(instruction));
+        } else {
+          if (instruction.result_id) {
+            global_indices_[instruction.result_id] = globals_.size();
+          }
+          globals_.push_back(std::move(instruction));
+        }
+        break;
+    }
+  }
+  return !function;
+}
+
+void Module::Emit(std::vector<uint32_t>* words) const {
+  words->clear();
+  words->insert(words->end(), header_, header_ + 5);
+  (*words)[3] = id_bound_;
+
+  auto emit = [words](const Instruction& instruction) {
+    if (instruction.is_nop()) {
+      return;
+    }
+    uint32_t length = 1 + uint32_t(instruction.operands.size());
+    if (instruction.type_id) {
+      ++length;
+    }
+    if (instruction.result_id) {
+      ++length;
+    }
+    words->push_back((length << spv::WordCountShift) |
+                     uint32_t(instruction.opcode));
+    if (instruction.type_id) {
+      words->push_back(instruction.type_id);
+    }
+    if (instruction.result_id) {
+      words->push_back(instruction.result_id);
+    }
+    words->insert(words->end(), instruction.operands.begin(),
+                  instruction.operands.end());
+  };
+
+  for (auto& instruction : globals_) {
+    emit(instruction);
+  }
+  for (auto& function : functions_) {
+    emit(function.function);
+    for (auto& parameter : function.parameters) {
+      emit(parameter);
+    }
+    for (auto& block : function.blocks) {
+      words->push_back((2 << spv::WordCountShift) | spv::Op::OpLabel);
+      words->push_back(block.id);
+      for (auto& instruction : block.instructions) {
+        emit(instruction);
+      }
+    }
+    words->push_back((1 << spv::WordCountShift) | spv::Op::OpFunctionEnd);
+  }
+}
+
+Instruction* Module::FindGlobal(uint32_t id) {
+  auto it = global_indices_.find(id);
+  if (it == global_indices_.end()) {
+    return nullptr;
+  }
+  Instruction* instruction = &globals_[it->second];
+  return instruction->result_id == id ? instruction : nullptr;
+}
+
+uint32_t Module::GetScalarConstant(uint32_t type_id, uint32_t value) {
+  Instruction* type = FindGlobal(type_id);
+  bool is_bool = type && type->opcode == spv::Op::OpTypeBool;
+  spv::Op opcode = spv::Op::OpConstant;
+  if (is_bool) {
+    opcode = value ? spv::Op::OpConstantTrue : spv::Op::OpConstantFalse;
+  }
+  for (auto& instruction : globals_) {
+    if (instruction.opcode == opcode && instruction.type_id == type_id &&
+        (is_bool || (instruction.operands.size() == 1 &&
+                     instruction.operands[0] == value))) {
+      return instruction.result_id;
+    }
+  }
+  Instruction constant;
+  constant.opcode = opcode;
+  constant.type_id = type_id;
+  constant.result_id = AllocateId();
+  if (!is_bool) {
+    constant.operands.push_back(value);
+  }
+  global_indices_[constant.result_id] = globals_.size();
+  globals_.push_back(std::move(constant));
+  return globals_.back().result_id;
+}
+
+bool Module::GetScalarConstantValue(uint32_t id, uint32_t* value) {
+  Instruction* constant = FindGlobal(id);
+  if (!constant) {
+    return false;
+  }
+  switch (constant->opcode) {
+    case spv::Op::OpConstant:
+      if (constant->operands.size() != 1) {
+        return false;
+      }
+      *value = constant->operands[0];
+      return true;
+    case spv::Op::OpConstantTrue:
+      *value = 1;
+      return true;
+    case spv::Op::OpConstantFalse:
+      *value = 0;
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t Module::GetUndef(uint32_t type_id) {
+  for (auto& instruction : globals_) {
+    if (instruction.opcode == spv::Op::OpUndef &&
+        instruction.type_id == type_id) {
+      return instruction.result_id;
+    }
+  }
+  Instruction undef;
+  undef.opcode = spv::Op::OpUndef;
+  undef.type_id = type_id;
+  undef.result_id = AllocateId();
+  global_indices_[undef.result_id] = globals_.size();
+  globals_.push_back(std::move(undef));
+  return globals_.back().result_id;
+}
+
+uint32_t Module::GetPointeeType(uint32_t pointer_type_id) {
+  Instruction* type = FindGlobal(pointer_type_id);
+  if (!type || type->opcode != spv::Op::OpTypePointer ||
+      type->operands.size() < 2) {
+    return 0;
+  }
+  return type->operands[1];
+}
+
+void Module::ForEachIdOperand(Instruction* instruction,
+                              const std::function<void(uint32_t*)>& callback) {
+  auto& operands = instruction->operands;
+  size_t count = operands.size();
+  if (instruction->opcode == spv::Op::OpTypeImage) {
+    // Only the sampled type is an ID, the rest are literals.
+    if (count) {
+      callback(&operands[0]);
+    }
+    return;
+  }
+  const spv::OperandParameters& params =
+      spv::InstructionDesc[instruction->opcode].operands;
+  size_t i = 0;
+  for (int param = 0; param < params.getNum() && i < count; ++param) {
+    switch (params.getClass(param)) {
+      case spv::OperandId:
+      case spv::OperandScope:
+      case spv::OperandMemorySemantics:
+        callback(&operands[i++]);
+        break;
+      case spv::OperandImageOperands:
+        // The mask, followed by IDs.
+        ++i;
+      // Fall through.
+      case spv::OperandVariableIds:
+        for (; i < count; ++i) {
+          callback(&operands[i]);
+        }
+        return;
+      case spv::OperandOptionalLiteral:
+      case spv::OperandVariableLiterals:
+        return;
+      case spv::OperandVariableIdLiteral:
+        for (; i < count; i += 2) {
+          callback(&operands[i]);
+        }
+        return;
+      case spv::OperandVariableLiteralId:
+        for (i += 1; i < count; i += 2) {
+          callback(&operands[i]);
+        }
+        return;
+      case spv::OperandLiteralString:
+      case spv::OperandOptionalLiteralString:
+        // Ends with the word containing the terminating null.
+        while (i < count) {
+          uint32_t word = operands[i++];
+          if (!(word & 0xFF) || !(word & 0xFF00) || !(word & 0xFF0000) ||
+              !(word & 0xFF000000)) {
+            break;
+          }
+        }
+        break;
+      default:
+        // Literal numbers and enumerants.
+        ++i;
+        break;
+    }
+  }
+}
+
+void Module::ReplaceUses(
+    const std::unordered_map<uint32_t, uint32_t>& replacements) {
+  if (replacements.empty()) {
+    return;
+  }
+  auto replace = [&replacements](uint32_t* id) {
+    // Bounded in case of a cycle, which no pass should produce.
+    for (size_t i = 0; i <= replacements.size(); ++i) {
+      auto it = replacements.find(*id);
+      if (it == replacements.end()) {
+        break;
+      }
+      *id = it->second;
+    }
+  };
+  for (auto& function : functions_) {
+    for (auto& block : function.blocks) {
+      for (auto& instruction : block.instructions) {
+        ForEachIdOperand(&instruction, replace);
+      }
+    }
+  }
+}
+
+void Module::RemoveDeadAnnotations() {
+  std::unordered_set<uint32_t> defined;
+  for (auto& instruction : globals_) {
+    if (instruction.result_id) {
+      defined.insert(instruction.result_id);
+    }
+  }
+  for (auto& function : functions_) {
+    defined.insert(function.function.result_id);
+    for (auto& parameter : function.parameters) {
+      defined.insert(parameter.result_id);
+    }
+    for (auto& block : function.blocks) {
+      defined.insert(block.id);
+      for (auto& instruction : block.instructions) {
+        if (instruction.result_id) {
+          defined.insert(instruction.result_id);
+        }
+      }
+    }
+  }
+  for (auto& instruction : globals_) {
+    switch (instruction.opcode) {
+      case spv::Op::OpName:
+      case spv::Op::OpMemberName:
+      case spv::Op::OpDecorate:
+      case spv::Op::OpMemberDecorate:
+        if (instruction.operands.empty() ||
+            !defined.count(instruction.operands[0])) {
+          instruction.Kill();
+        }
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,103 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_MODULE_H_
+#define XENIA_GPU_SPIRV_MODULE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <vector>
+
+#include "third_party/glslang-spirv/spirv.hpp"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// A single instruction. Removed instructions become OpNop and aren't emitted.
+struct Instruction {
+  spv::Op opcode = spv::Op::OpNop;
+  uint32_t type_id = 0;
+  uint32_t result_id = 0;
+  std::vector<uint32_t> operands;
+
+  bool is_nop() const { return opcode == spv::Op::OpNop; }
+  void Kill() {
+    opcode = spv::Op::OpNop;
+    type_id = 0;
+    result_id = 0;
+    operands.clear();
+  }
+};
+
+struct Block {
+  uint32_t id = 0;
+  // Everything after the OpLabel, ending with the terminator.
+  std::vector<Instruction> instructions;
+};
+
+struct Function {
+  Instruction function;
+  std::vector<Instruction> parameters;
+  std::vector<Block> blocks;
+};
+
+// A SPIR-V binary split into the global sections and functions, in a form
+// simple enough for passes to rewrite. Unlike spv::Module, it owns the types,
+// constants and globals too.
+class Module {
+ public:
+  // Parses a binary, failing on malformed input and opcodes it doesn't know.
+  bool Parse(const uint32_t* words, size_t word_count);
+  void Emit(std::vector<uint32_t>* words) const;
+
+  // Everything before the first function, in order.
+  std::vector<Instruction>& globals() { return globals_; }
+  std::vector<Function>& functions() { return functions_; }
+
+  uint32_t AllocateId() { return id_bound_++; }
+
+  // Returns a global instruction by its result ID, or null. Adding globals
+  // invalidates the pointer.
+  Instruction* FindGlobal(uint32_t id);
+  // Finds or adds a scalar OpConstant, or OpConstantTrue/False for booleans.
+  uint32_t GetScalarConstant(uint32_t type_id, uint32_t value);
+  // Gets the value of a 32-bit scalar constant, 0 or 1 for booleans. Spec
+  // constants aren't known.
+  bool GetScalarConstantValue(uint32_t id, uint32_t* value);
+  // Finds or adds a global OpUndef.
+  uint32_t GetUndef(uint32_t type_id);
+  // Returns the type pointed to by an OpTypePointer, or 0.
+  uint32_t GetPointeeType(uint32_t pointer_type_id);
+
+  // Invokes the callback for each ID operand of the instruction, excluding the
+  // result type, allowing it to be replaced.
+  static void ForEachIdOperand(Instruction* instruction,
+                               const std::function<void(uint32_t*)>& callback);
+  // Replaces the uses of IDs within the functions, following chains of
+  // replacements.
+  void ReplaceUses(const std::unordered_map<uint32_t, uint32_t>& replacements);
+  // Removes the names and decorations of IDs no longer defined.
+  void RemoveDeadAnnotations();
+
+ private:
+  uint32_t header_[5] = {};
+  uint32_t id_bound_ = 0;
+  std::vector<Instruction> globals_;
+  std::vector<Function> functions_;
+  std::unordered_map<uint32_t, size_t> global_indices_;
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_MODULE_H_
@@ -0,0 +1,352 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/constant_folding_pass.h"
+
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+namespace {
+
+enum class ScalarKind {
+  kNone,
+  kBool,
+  kInt,
+  kFloat,
+};
+
+float AsFloat(uint32_t value) {
+  float result;
+  std::memcpy(&result, &value, sizeof(result));
+  return result;
+}
+
+uint32_t AsWord(float value) {
+  uint32_t result;
+  std::memcpy(&result, &value, sizeof(result));
+  return result;
+}
+
+class Folder {
+ public:
+  explicit Folder(Module* module) : module_(module) {
+    for (auto& function : module->functions()) {
+      for (auto& block : function.blocks) {
+        for (auto& instruction : block.instructions) {
+          if (instruction.result_id) {
+            definitions_[instruction.result_id] = &instruction;
+          }
+        }
+      }
+    }
+  }
+
+  // Returns the ID to replace the result of the instruction with, or 0.
+  uint32_t Fold(const Instruction& instruction);
+
+ private:
+  ScalarKind GetKind(uint32_t type_id);
+  uint32_t GetType(uint32_t id);
+  bool GetValue(uint32_t id, uint32_t* value) {
+    return module_->GetScalarConstantValue(id, value);
+  }
+  uint32_t Constant(uint32_t type_id, uint32_t value) {
+    return module_->GetScalarConstant(type_id, value);
+  }
+  uint32_t FoldBinary(const Instruction& instruction);
+  uint32_t FoldUnary(const Instruction& instruction);
+  uint32_t FoldCompositeExtract(const Instruction& instruction);
+
+  Module* module_;
+  // Instructions within the functions, which won't move during the pass.
+  std::unordered_map<uint32_t, Instruction*> definitions_;
+};
+
+ScalarKind Folder::GetKind(uint32_t type_id) {
+  Instruction* type = module_->FindGlobal(type_id);
+  if (!type) {
+    return ScalarKind::kNone;
+  }
+  switch (type->opcode) {
+    case spv::Op::OpTypeBool:
+      return ScalarKind::kBool;
+    case spv::Op::OpTypeInt:
+      return type->operands[0] == 32 ? ScalarKind::kInt : ScalarKind::kNone;
+    case spv::Op::OpTypeFloat:
+      return type->operands[0] == 32 ? ScalarKind::kFloat : ScalarKind::kNone;
+    default:
+      return ScalarKind::kNone;
+  }
+}
+
+uint32_t Folder::GetType(uint32_t id) {
+  auto it = definitions_.find(id);
+  if (it != definitions_.end()) {
+    return it->second->type_id;
+  }
+  Instruction* global = module_->FindGlobal(id);
+  return global ? global->type_id : 0;
+}
+
+uint32_t Folder::Fold(const Instruction& instruction) {
+  switch (instruction.opcode) {
+    case spv::Op::OpSelect: {
+      uint32_t condition;
+      if (!GetValue(instruction.operands[0], &condition)) {
+        return 0;
+      }
+      return instruction.operands[condition ? 1 : 2];
+    }
+    case spv::Op::OpCompositeExtract:
+      return FoldCompositeExtract(instruction);
+    default:
+      break;
+  }
+  if (GetKind(instruction.type_id) == ScalarKind::kNone) {
+    return 0;
+  }
+  switch (instruction.operands.size()) {
+    case 1:
+      return FoldUnary(instruction);
+    case 2:
+      return FoldBinary(instruction);
+    default:
+      return 0;
+  }
+}
+
+uint32_t Folder::FoldUnary(const Instruction& instruction) {
+  uint32_t a;
+  if (!GetValue(instruction.operands[0], &a)) {
+    return 0;
+  }
+  uint32_t type_id = instruction.type_id;
+  switch (instruction.opcode) {
+    case spv::Op::OpNot:
+      return Constant(type_id, ~a);
+    case spv::Op::OpSNegate:
+      return Constant(type_id, 0u - a);
+    case spv::Op::OpLogicalNot:
+      return Constant(type_id, !a);
+    case spv::Op::OpFNegate:
+      return Constant(type_id, a ^ 0x80000000u);
+    case spv::Op::OpConvertUToF:
+      return Constant(type_id, AsWord(float(a)));
+    case spv::Op::OpConvertSToF:
+      return Constant(type_id, AsWord(float(int32_t(a))));
+    case spv::Op::OpBitcast:
+      if (GetKind(GetType(instruction.operands[0])) == ScalarKind::kNone) {
+        return 0;
+      }
+      return Constant(type_id, a);
+    default:
+      return 0;
+  }
+}
+
+uint32_t Folder::FoldBinary(const Instruction& instruction) {
+  uint32_t type_id = instruction.type_id;
+  uint32_t id_a = instruction.operands[0], id_b = instruction.operands[1];
+  uint32_t a, b;
+  bool a_known = GetValue(id_a, &a), b_known = GetValue(id_b, &b);
+  if (!a_known && !b_known) {
+    return 0;
+  }
+
+  if (!a_known || !b_known) {
+    // Identities, where the other operand must be of the result type, as the
+    // signedness of integer operands may differ.
+    uint32_t known = a_known ? a : b;
+    uint32_t other = a_known ? id_b : id_a;
+    bool forward = false;
+    switch (instruction.opcode) {
+      case spv::Op::OpLogicalAnd:
+        if (!known) {
+          return Constant(type_id, 0);
+        }
+        forward = true;
+        break;
+      case spv::Op::OpLogicalOr:
+        if (known) {
+          return Constant(type_id, 1);
+        }
+        forward = true;
+        break;
+      case spv::Op::OpIAdd:
+      case spv::Op::OpBitwiseOr:
+      case spv::Op::OpBitwiseXor:
+        forward = !known;
+        break;
+      case spv::Op::OpISub:
+      case spv::Op::OpShiftLeftLogical:
+      case spv::Op::OpShiftRightLogical:
+      case spv::Op::OpShiftRightArithmetic:
+        forward = b_known && !b;
+        break;
+      case spv::Op::OpIMul:
+        forward = known == 1;
+        break;
+      case spv::Op::OpBitwiseAnd:
+        forward = known == UINT32_MAX;
+        break;
+      default:
+        break;
+    }
+    return forward && GetType(other) == type_id ? other : 0;
+  }
+
+  float fa = AsFloat(a), fb = AsFloat(b);
+  bool ordered = !std::isnan(fa) && !std::isnan(fb);
+  switch (instruction.opcode) {
+    case spv::Op::OpIAdd:
+      return Constant(type_id, a + b);
+    case spv::Op::OpISub:
+      return Constant(type_id, a - b);
+    case spv::Op::OpIMul:
+      return Constant(type_id, a * b);
+    case spv::Op::OpUDiv:
+      return b ? Constant(type_id, a / b) : 0;
+    case spv::Op::OpUMod:
+      return b ? Constant(type_id, a % b) : 0;
+    case spv::Op::OpBitwiseAnd:
+      return Constant(type_id, a & b);
+    case spv::Op::OpBitwiseOr:
+      return Constant(type_id, a | b);
+    case spv::Op::OpBitwiseXor:
+      return Constant(type_id, a ^ b);
+    case spv::Op::OpShiftLeftLogical:
+      return b < 32 ? Constant(type_id, a << b) : 0;
+    case spv::Op::OpShiftRightLogical:
+      return b < 32 ? Constant(type_id, a >> b) : 0;
+    case spv::Op::OpShiftRightArithmetic:
+      return b < 32 ? Constant(type_id, uint32_t(int32_t(a) >> b)) : 0;
+    case spv::Op::OpIEqual:
+    case spv::Op::OpLogicalEqual:
+      return Constant(type_id, a == b);
+    case spv::Op::OpINotEqual:
+    case spv::Op::OpLogicalNotEqual:
+      return Constant(type_id, a != b);
+    case spv::Op::OpLogicalAnd:
+      return Constant(type_id, a && b);
+    case spv::Op::OpLogicalOr:
+      return Constant(type_id, a || b);
+    case spv::Op::OpULessThan:
+      return Constant(type_id, a < b);
+    case spv::Op::OpULessThanEqual:
+      return Constant(type_id, a <= b);
+    case spv::Op::OpUGreaterThan:
+      return Constant(type_id, a > b);
+    case spv::Op::OpUGreaterThanEqual:
+      return Constant(type_id, a >= b);
+    case spv::Op::OpSLessThan:
+      return Constant(type_id, int32_t(a) < int32_t(b));
+    case spv::Op::OpSLessThanEqual:
+      return Constant(type_id, int32_t(a) <= int32_t(b));
+    case spv::Op::OpSGreaterThan:
+      return Constant(type_id, int32_t(a) > int32_t(b));
+    case spv::Op::OpSGreaterThanEqual:
+      return Constant(type_id, int32_t(a) >= int32_t(b));
+    case spv::Op::OpFAdd:
+      return Constant(type_id, AsWord(fa + fb));
+    case spv::Op::OpFSub:
+      return Constant(type_id, AsWord(fa - fb));
+    case spv::Op::OpFMul:
+      return Constant(type_id, AsWord(fa * fb));
+    case spv::Op::OpFOrdEqual:
+      return Constant(type_id, ordered && fa == fb);
+    case spv::Op::OpFOrdNotEqual:
+      return Constant(type_id, ordered && fa != fb);
+    case spv::Op::OpFOrdLessThan:
+      return Constant(type_id, ordered && fa < fb);
+    case spv::Op::OpFOrdLessThanEqual:
+      return Constant(type_id, ordered && fa <= fb);
+    case spv::Op::OpFOrdGreaterThan:
+      return Constant(type_id, ordered && fa > fb);
+    case spv::Op::OpFOrdGreaterThanEqual:
+      return Constant(type_id, ordered && fa >= fb);
+    default:
+      return 0;
+  }
+}
+
+uint32_t Folder::FoldCompositeExtract(const Instruction& instruction) {
+  uint32_t composite = instruction.operands[0];
+  for (size_t i = 1; i < instruction.operands.size(); ++i) {
+    uint32_t index = instruction.operands[i];
+    Instruction* definition = module_->FindGlobal(composite);
+    if (definition) {
+      if (definition->opcode != spv::Op::OpConstantComposite ||
+          index >= definition->operands.size()) {
+        return 0;
+      }
+      composite = definition->operands[index];
+      continue;
+    }
+    auto it = definitions_.find(composite);
+    if (it == definitions_.end() ||
+        it->second->opcode != spv::Op::OpCompositeConstruct ||
+        index >= it->second->operands.size()) {
+      return 0;
+    }
+    // Vectors may be constructed from smaller vectors, in which case the
+    // constituents aren't the components.
+    Instruction* type = module_->FindGlobal(it->second->type_id);
+    if (!type || (type->opcode == spv::Op::OpTypeVector &&
+                  type->operands[1] != it->second->operands.size())) {
+      return 0;
+    }
+    composite = it->second->operands[index];
+  }
+  return composite;
+}
+
+}  // namespace
+
+ConstantFoldingPass::ConstantFoldingPass() {}
+
+bool ConstantFoldingPass::Run(Module* module) {
+  Folder folder(module);
+  std::unordered_map<uint32_t, uint32_t> replacements;
+  auto resolve = [&replacements](uint32_t* id) {
+    for (size_t i = 0; i <= replacements.size(); ++i) {
+      auto it = replacements.find(*id);
+      if (it == replacements.end()) {
+        break;
+      }
+      *id = it->second;
+    }
+  };
+  for (auto& function : module->functions()) {
+    for (auto& block : function.blocks) {
+      for (auto& instruction : block.instructions) {
+        if (!instruction.result_id) {
+          continue;
+        }
+        // Folds earlier in the block order feed into later ones.
+        Module::ForEachIdOperand(&instruction, resolve);
+        uint32_t replacement = folder.Fold(instruction);
+        if (replacement && replacement != instruction.result_id) {
+          replacements[instruction.result_id] = replacement;
+          instruction.Kill();
+        }
+      }
+    }
+  }
+  module->ReplaceUses(replacements);
+  return true;
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,35 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_CONSTANT_FOLDING_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_CONSTANT_FOLDING_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Constant folding pass. Evaluates 32-bit scalar integer, float and boolean
+// operations on constants, selects and extracts from constant composites, and
+// removes the identity operations on booleans and integers, replacing their
+// uses with the results.
+class ConstantFoldingPass : public CompilerPass {
+ public:
+  ConstantFoldingPass();
+
+  const char* name() const override { return "ConstantFolding"; }
+  bool Run(Module* module) override;
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_CONSTANT_FOLDING_PASS_H_
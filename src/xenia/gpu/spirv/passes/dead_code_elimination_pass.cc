@@ -0,0 +1,205 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/dead_code_elimination_pass.h"
+
+#include <cstring>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+namespace {
+
+// Whether an instruction can be removed when its result is unused.
+bool IsPure(spv::Op opcode) {
+  switch (opcode) {
+    case spv::Op::OpUndef:
+    case spv::Op::OpLoad:
+    case spv::Op::OpAccessChain:
+    case spv::Op::OpInBoundsAccessChain:
+    case spv::Op::OpPhi:
+    case spv::Op::OpCopyObject:
+    case spv::Op::OpSelect:
+    case spv::Op::OpVectorExtractDynamic:
+    case spv::Op::OpVectorInsertDynamic:
+    case spv::Op::OpVectorShuffle:
+    case spv::Op::OpCompositeConstruct:
+    case spv::Op::OpCompositeExtract:
+    case spv::Op::OpCompositeInsert:
+    case spv::Op::OpSampledImage:
+    case spv::Op::OpImageSampleImplicitLod:
+    case spv::Op::OpImageSampleExplicitLod:
+    case spv::Op::OpImageSampleDrefImplicitLod:
+    case spv::Op::OpImageSampleDrefExplicitLod:
+    case spv::Op::OpImageFetch:
+    case spv::Op::OpImageGather:
+    case spv::Op::OpImage:
+    case spv::Op::OpImageQuerySizeLod:
+    case spv::Op::OpImageQuerySize:
+    case spv::Op::OpImageQueryLod:
+    case spv::Op::OpImageQueryLevels:
+    case spv::Op::OpConvertFToU:
+    case spv::Op::OpConvertFToS:
+    case spv::Op::OpConvertSToF:
+    case spv::Op::OpConvertUToF:
+    case spv::Op::OpUConvert:
+    case spv::Op::OpSConvert:
+    case spv::Op::OpFConvert:
+    case spv::Op::OpBitcast:
+    case spv::Op::OpSNegate:
+    case spv::Op::OpFNegate:
+    case spv::Op::OpIAdd:
+    case spv::Op::OpFAdd:
+    case spv::Op::OpISub:
+    case spv::Op::OpFSub:
+    case spv::Op::OpIMul:
+    case spv::Op::OpFMul:
+    case spv::Op::OpUDiv:
+    case spv::Op::OpSDiv:
+    case spv::Op::OpFDiv:
+    case spv::Op::OpUMod:
+    case spv::Op::OpSRem:
+    case spv::Op::OpSMod:
+    case spv::Op::OpFRem:
+    case spv::Op::OpFMod:
+    case spv::Op::OpVectorTimesScalar:
+    case spv::Op::OpMatrixTimesScalar:
+    case spv::Op::OpVectorTimesMatrix:
+    case spv::Op::OpMatrixTimesVector:
+    case spv::Op::OpMatrixTimesMatrix:
+    case spv::Op::OpDot:
+    case spv::Op::OpAny:
+    case spv::Op::OpAll:
+    case spv::Op::OpIsNan:
+    case spv::Op::OpIsInf:
+    case spv::Op::OpLogicalEqual:
+    case spv::Op::OpLogicalNotEqual:
+    case spv::Op::OpLogicalOr:
+    case spv::Op::OpLogicalAnd:
+    case spv::Op::OpLogicalNot:
+    case spv::Op::OpIEqual:
+    case spv::Op::OpINotEqual:
+    case spv::Op::OpUGreaterThan:
+    case spv::Op::OpSGreaterThan:
+    case spv::Op::OpUGreaterThanEqual:
+    case spv::Op::OpSGreaterThanEqual:
+    case spv::Op::OpULessThan:
+    case spv::Op::OpSLessThan:
+    case spv::Op::OpULessThanEqual:
+    case spv::Op::OpSLessThanEqual:
+    case spv::Op::OpFOrdEqual:
+    case spv::Op::OpFUnordEqual:
+    case spv::Op::OpFOrdNotEqual:
+    case spv::Op::OpFUnordNotEqual:
+    case spv::Op::OpFOrdLessThan:
+    case spv::Op::OpFUnordLessThan:
+    case spv::Op::OpFOrdGreaterThan:
+    case spv::Op::OpFUnordGreaterThan:
+    case spv::Op::OpFOrdLessThanEqual:
+    case spv::Op::OpFUnordLessThanEqual:
+    case spv::Op::OpFOrdGreaterThanEqual:
+    case spv::Op::OpFUnordGreaterThanEqual:
+    case spv::Op::OpShiftRightLogical:
+    case spv::Op::OpShiftRightArithmetic:
+    case spv::Op::OpShiftLeftLogical:
+    case spv::Op::OpBitwiseOr:
+    case spv::Op::OpBitwiseXor:
+    case spv::Op::OpBitwiseAnd:
+    case spv::Op::OpNot:
+    case spv::Op::OpBitFieldInsert:
+    case spv::Op::OpBitFieldSExtract:
+    case spv::Op::OpBitFieldUExtract:
+    case spv::Op::OpBitReverse:
+    case spv::Op::OpBitCount:
+    case spv::Op::OpDPdx:
+    case spv::Op::OpDPdy:
+    case spv::Op::OpFwidth:
+    case spv::Op::OpDPdxFine:
+    case spv::Op::OpDPdyFine:
+    case spv::Op::OpFwidthFine:
+    case spv::Op::OpDPdxCoarse:
+    case spv::Op::OpDPdyCoarse:
+    case spv::Op::OpFwidthCoarse:
+      return true;
+    default:
+      return false;
+  }
+}
+
+}  // namespace
+
+DeadCodeEliminationPass::DeadCodeEliminationPass() {}
+
+bool DeadCodeEliminationPass::Run(Module* module) {
+  // Only GLSL.std.450 extended instructions are known to be pure.
+  std::unordered_set<uint32_t> pure_sets;
+  for (auto& instruction : module->globals()) {
+    if (instruction.opcode == spv::Op::OpExtInstImport &&
+        !instruction.operands.empty() &&
+        !std::strncmp(
+            reinterpret_cast<const char*>(instruction.operands.data()),
+            "GLSL.std.450", instruction.operands.size() * sizeof(uint32_t))) {
+      pure_sets.insert(instruction.result_id);
+    }
+  }
+  auto is_pure = [&pure_sets](const Instruction& instruction) {
+    if (instruction.opcode == spv::Op::OpExtInst) {
+      return pure_sets.count(instruction.operands[0]) != 0;
+    }
+    return IsPure(instruction.opcode);
+  };
+
+  for (auto& function : module->functions()) {
+    std::unordered_map<uint32_t, Instruction*> definitions;
+    std::vector<Instruction*> worklist;
+    for (auto& block : function.blocks) {
+      for (auto& instruction : block.instructions) {
+        if (instruction.is_nop()) {
+          continue;
+        }
+        if (instruction.result_id) {
+          definitions[instruction.result_id] = &instruction;
+        }
+        if (!is_pure(instruction)) {
+          worklist.push_back(&instruction);
+        }
+      }
+    }
+
+    // Mark everything the impure instructions depend on.
+    std::unordered_set<Instruction*> live(worklist.begin(), worklist.end());
+    while (!worklist.empty()) {
+      Instruction* instruction = worklist.back();
+      worklist.pop_back();
+      Module::ForEachIdOperand(instruction, [&](uint32_t* id) {
+        auto it = definitions.find(*id);
+        if (it != definitions.end() && live.insert(it->second).second) {
+          worklist.push_back(it->second);
+        }
+      });
+    }
+
+    for (auto& block : function.blocks) {
+      for (auto& instruction : block.instructions) {
+        if (!instruction.is_nop() && !live.count(&instruction)) {
+          instruction.Kill();
+        }
+      }
+    }
+  }
+  return true;
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,34 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Dead code elimination pass. Removes the instructions without side effects
+// whose results aren't used by any live instruction, including cycles of
+// phis.
+class DeadCodeEliminationPass : public CompilerPass {
+ public:
+  DeadCodeEliminationPass();
+
+  const char* name() const override { return "DeadCodeElimination"; }
+  bool Run(Module* module) override;
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_DEAD_CODE_ELIMINATION_PASS_H_
@@ -0,0 +1,139 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/dead_variable_elimination_pass.h"
+
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+namespace {
+
+bool IsAccessChain(spv::Op opcode) {
+  return opcode == spv::Op::OpAccessChain ||
+         opcode == spv::Op::OpInBoundsAccessChain;
+}
+
+bool IsRemovableStorage(uint32_t storage_class) {
+  return storage_class == spv::StorageClass::StorageClassFunction ||
+         storage_class == spv::StorageClass::StorageClassPrivate;
+}
+
+}  // namespace
+
+DeadVariableEliminationPass::DeadVariableEliminationPass() {}
+
+bool DeadVariableEliminationPass::Run(Module* module) {
+  // Variable of each variable or access chain pointer.
+  std::unordered_map<uint32_t, uint32_t> pointer_variables;
+  for (auto& instruction : module->globals()) {
+    if (instruction.opcode == spv::Op::OpVariable &&
+        IsRemovableStorage(instruction.operands[0])) {
+      pointer_variables[instruction.result_id] = instruction.result_id;
+    }
+  }
+  auto for_each_instruction = [module](
+      const std::function<void(Instruction*)>& callback) {
+    for (auto& function : module->functions()) {
+      for (auto& block : function.blocks) {
+        for (auto& instruction : block.instructions) {
+          if (!instruction.is_nop()) {
+            callback(&instruction);
+          }
+        }
+      }
+    }
+  };
+  for_each_instruction([&](Instruction* instruction) {
+    if (instruction->opcode == spv::Op::OpVariable &&
+        IsRemovableStorage(instruction->operands[0])) {
+      pointer_variables[instruction->result_id] = instruction->result_id;
+    }
+  });
+  // Chains are defined after their bases within the blocks, but the blocks
+  // may be in any order.
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for_each_instruction([&](Instruction* instruction) {
+      if (!IsAccessChain(instruction->opcode) ||
+          pointer_variables.count(instruction->result_id)) {
+        return;
+      }
+      auto it = pointer_variables.find(instruction->operands[0]);
+      if (it != pointer_variables.end()) {
+        pointer_variables[instruction->result_id] = it->second;
+        changed = true;
+      }
+    });
+  }
+  if (pointer_variables.empty()) {
+    return true;
+  }
+
+  // A variable is read if a pointer to it is used for anything but a store or
+  // another access chain. Names and decorations are removed along with it.
+  std::unordered_set<uint32_t> read_variables;
+  auto check_uses = [&](Instruction* instruction) {
+    switch (instruction->opcode) {
+      case spv::Op::OpName:
+      case spv::Op::OpMemberName:
+      case spv::Op::OpDecorate:
+      case spv::Op::OpMemberDecorate:
+        return;
+      default:
+        break;
+    }
+    Module::ForEachIdOperand(instruction, [&](uint32_t* id) {
+      auto it = pointer_variables.find(*id);
+      if (it == pointer_variables.end()) {
+        return;
+      }
+      bool is_pointer_operand = id == &instruction->operands[0];
+      if (!is_pointer_operand || (instruction->opcode != spv::Op::OpStore &&
+                                  !IsAccessChain(instruction->opcode))) {
+        read_variables.insert(it->second);
+      }
+    });
+  };
+  for (auto& instruction : module->globals()) {
+    check_uses(&instruction);
+  }
+  for_each_instruction(check_uses);
+
+  auto is_dead = [&](uint32_t pointer) {
+    auto it = pointer_variables.find(pointer);
+    return it != pointer_variables.end() && !read_variables.count(it->second);
+  };
+  for (auto& instruction : module->globals()) {
+    if (instruction.opcode == spv::Op::OpVariable &&
+        is_dead(instruction.result_id)) {
+      instruction.Kill();
+    }
+  }
+  for_each_instruction([&](Instruction* instruction) {
+    if ((instruction->opcode == spv::Op::OpVariable ||
+         IsAccessChain(instruction->opcode)) &&
+        is_dead(instruction->result_id)) {
+      instruction->Kill();
+    } else if (instruction->opcode == spv::Op::OpStore &&
+               is_dead(instruction->operands[0])) {
+      instruction->Kill();
+    }
+  });
+  return true;
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,33 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_DEAD_VARIABLE_ELIMINATION_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_DEAD_VARIABLE_ELIMINATION_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Dead variable elimination pass. Removes function and private variables which
+// are only ever stored to, along with their stores and access chains.
+class DeadVariableEliminationPass : public CompilerPass {
+ public:
+  DeadVariableEliminationPass();
+
+  const char* name() const override { return "DeadVariableElimination"; }
+  bool Run(Module* module) override;
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_DEAD_VARIABLE_ELIMINATION_PASS_H_
@@ -0,0 +1,551 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/spirv/passes/variable_promotion_pass.h"
+
+#include <algorithm>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+namespace {
+
+struct Variable {
+  // Pointee type and initializer, or 0.
+  uint32_t type_id = 0;
+  uint32_t initializer = 0;
+  bool promotable = true;
+  // Indices of every access chain into it, which must all be the same length
+  // for the accesses not to overlap, or -1 until known.
+  int index_count = -1;
+};
+
+// A variable, or an element of one, promoted to SSA values.
+struct Location {
+  uint32_t type_id;
+  // Value before the first store, allocated as needed.
+  uint32_t initial_value;
+};
+
+struct Phi {
+  size_t location;
+  uint32_t id;
+  // Incoming values by predecessor block index.
+  std::unordered_map<size_t, uint32_t> incoming;
+};
+
+struct ControlFlowGraph {
+  std::vector<std::vector<size_t>> successors;
+  std::vector<std::vector<size_t>> predecessors;
+  std::vector<bool> reachable;
+  // Immediate dominators of the reachable blocks, and their children.
+  std::vector<size_t> idom;
+  std::vector<std::vector<size_t>> children;
+  std::vector<std::unordered_set<size_t>> frontiers;
+};
+
+bool BuildControlFlowGraph(Function* function, ControlFlowGraph* cfg) {
+  auto& blocks = function->blocks;
+  size_t block_count = blocks.size();
+  std::unordered_map<uint32_t, size_t> block_indices;
+  for (size_t i = 0; i < block_count; ++i) {
+    block_indices[blocks[i].id] = i;
+  }
+
+  cfg->successors.assign(block_count, {});
+  cfg->predecessors.assign(block_count, {});
+  for (size_t i = 0; i < block_count; ++i) {
+    if (blocks[i].instructions.empty()) {
+      return false;
+    }
+    const Instruction& terminator = blocks[i].instructions.back();
+    std::vector<uint32_t> targets;
+    switch (terminator.opcode) {
+      case spv::Op::OpBranch:
+        targets.push_back(terminator.operands[0]);
+        break;
+      case spv::Op::OpBranchConditional:
+        targets.push_back(terminator.operands[1]);
+        targets.push_back(terminator.operands[2]);
+        break;
+      case spv::Op::OpSwitch:
+        targets.push_back(terminator.operands[1]);
+        for (size_t j = 3; j < terminator.operands.size(); j += 2) {
+          targets.push_back(terminator.operands[j]);
+        }
+        break;
+      case spv::Op::OpKill:
+      case spv::Op::OpReturn:
+      case spv::Op::OpReturnValue:
+      case spv::Op::OpUnreachable:
+        break;
+      default:
+        return false;
+    }
+    for (uint32_t target : targets) {
+      auto it = block_indices.find(target);
+      if (it == block_indices.end()) {
+        return false;
+      }
+      auto& successors = cfg->successors[i];
+      if (std::find(successors.begin(), successors.end(), it->second) ==
+          successors.end()) {
+        successors.push_back(it->second);
+        cfg->predecessors[it->second].push_back(i);
+      }
+    }
+  }
+
+  // Reverse postorder of the reachable blocks.
+  cfg->reachable.assign(block_count, false);
+  std::vector<size_t> postorder;
+  std::vector<std::pair<size_t, size_t>> stack;
+  cfg->reachable[0] = true;
+  stack.emplace_back(0, 0);
+  while (!stack.empty()) {
+    auto& top = stack.back();
+    auto& successors = cfg->successors[top.first];
+    if (top.second < successors.size()) {
+      size_t next = successors[top.second++];
+      if (!cfg->reachable[next]) {
+        cfg->reachable[next] = true;
+        stack.emplace_back(next, 0);
+      }
+    } else {
+      postorder.push_back(top.first);
+      stack.pop_back();
+    }
+  }
+  std::vector<size_t> rpo_numbers(block_count, SIZE_MAX);
+  for (size_t i = 0; i < postorder.size(); ++i) {
+    rpo_numbers[postorder[i]] = postorder.size() - 1 - i;
+  }
+
+  // Dominators, as in "A Simple, Fast Dominance Algorithm" by Cooper et al.
+  cfg->idom.assign(block_count, SIZE_MAX);
+  cfg->idom[0] = 0;
+  auto intersect = [&](size_t a, size_t b) {
+    while (a != b) {
+      while (rpo_numbers[a] > rpo_numbers[b]) {
+        a = cfg->idom[a];
+      }
+      while (rpo_numbers[b] > rpo_numbers[a]) {
+        b = cfg->idom[b];
+      }
+    }
+    return a;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto it = postorder.rbegin(); it != postorder.rend(); ++it) {
+      size_t block = *it;
+      if (!block) {
+        continue;
+      }
+      size_t new_idom = SIZE_MAX;
+      for (size_t predecessor : cfg->predecessors[block]) {
+        if (cfg->idom[predecessor] == SIZE_MAX) {
+          continue;
+        }
+        new_idom = new_idom == SIZE_MAX ? predecessor
+                                        : intersect(predecessor, new_idom);
+      }
+      if (cfg->idom[block] != new_idom) {
+        cfg->idom[block] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  cfg->children.assign(block_count, {});
+  cfg->frontiers.assign(block_count, {});
+  for (size_t block : postorder) {
+    if (!block) {
+      continue;
+    }
+    cfg->children[cfg->idom[block]].push_back(block);
+    size_t reachable_predecessors = 0;
+    for (size_t predecessor : cfg->predecessors[block]) {
+      if (cfg->reachable[predecessor]) {
+        ++reachable_predecessors;
+      }
+    }
+    if (reachable_predecessors < 2) {
+      continue;
+    }
+    for (size_t predecessor : cfg->predecessors[block]) {
+      if (!cfg->reachable[predecessor]) {
+        continue;
+      }
+      for (size_t runner = predecessor; runner != cfg->idom[block];
+           runner = cfg->idom[runner]) {
+        cfg->frontiers[runner].insert(block);
+      }
+    }
+  }
+  return true;
+}
+
+bool IsAccessChain(spv::Op opcode) {
+  return opcode == spv::Op::OpAccessChain ||
+         opcode == spv::Op::OpInBoundsAccessChain;
+}
+
+}  // namespace
+
+VariablePromotionPass::VariablePromotionPass() {}
+
+bool VariablePromotionPass::Run(Module* module) {
+  for (auto& function : module->functions()) {
+    if (!RunOnFunction(module, &function)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool VariablePromotionPass::RunOnFunction(Module* module, Function* function) {
+  auto& blocks = function->blocks;
+  if (blocks.empty()) {
+    return true;
+  }
+
+  // Function variables are all at the beginning of the entry block.
+  std::unordered_map<uint32_t, Variable> variables;
+  // Variable of each variable or access chain pointer.
+  std::unordered_map<uint32_t, uint32_t> pointer_variables;
+  std::unordered_map<uint32_t, std::vector<uint32_t>> chain_indices;
+  std::unordered_map<uint32_t, uint32_t> chain_types;
+  for (auto& instruction : blocks[0].instructions) {
+    if (instruction.opcode != spv::Op::OpVariable ||
+        instruction.operands[0] != spv::StorageClass::StorageClassFunction) {
+      continue;
+    }
+    Variable& variable = variables[instruction.result_id];
+    variable.type_id = module->GetPointeeType(instruction.type_id);
+    if (instruction.operands.size() > 1) {
+      variable.initializer = instruction.operands[1];
+    }
+    variable.promotable = variable.type_id != 0;
+    pointer_variables[instruction.result_id] = instruction.result_id;
+  }
+  if (variables.empty()) {
+    return true;
+  }
+
+  // Access chains directly into the variables with constant indices.
+  for (auto& block : blocks) {
+    for (auto& instruction : block.instructions) {
+      if (!IsAccessChain(instruction.opcode) ||
+          !variables.count(instruction.operands[0])) {
+        continue;
+      }
+      std::vector<uint32_t> indices;
+      for (size_t i = 1; i < instruction.operands.size(); ++i) {
+        uint32_t index;
+        if (!module->GetScalarConstantValue(instruction.operands[i], &index)) {
+          break;
+        }
+        indices.push_back(index);
+      }
+      if (indices.size() + 1 == instruction.operands.size()) {
+        pointer_variables[instruction.result_id] = instruction.operands[0];
+        chain_indices[instruction.result_id] = std::move(indices);
+        chain_types[instruction.result_id] = instruction.type_id;
+      }
+    }
+  }
+
+  // Only variables exclusively accessed through loads and stores of the same
+  // granularity can be promoted.
+  for (auto& block : blocks) {
+    for (auto& instruction : block.instructions) {
+      Instruction* current = &instruction;
+      Module::ForEachIdOperand(current, [&](uint32_t* id) {
+        auto it = pointer_variables.find(*id);
+        if (it == pointer_variables.end()) {
+          return;
+        }
+        Variable& variable = variables[it->second];
+        if (id != &current->operands[0]) {
+          variable.promotable = false;
+          return;
+        }
+        if (IsAccessChain(current->opcode)) {
+          if (!chain_indices.count(current->result_id)) {
+            variable.promotable = false;
+          }
+          return;
+        }
+        if (current->opcode != spv::Op::OpLoad &&
+            current->opcode != spv::Op::OpStore) {
+          variable.promotable = false;
+          return;
+        }
+        auto chain = chain_indices.find(*id);
+        int index_count =
+            chain != chain_indices.end() ? int(chain->second.size()) : 0;
+        if (variable.index_count < 0) {
+          variable.index_count = index_count;
+        } else if (variable.index_count != index_count) {
+          variable.promotable = false;
+        }
+        if (index_count && variable.initializer) {
+          variable.promotable = false;
+        }
+      });
+    }
+  }
+
+  // Locations of the promotable pointers.
+  std::vector<Location> locations;
+  std::map<std::pair<uint32_t, std::vector<uint32_t>>, size_t> location_keys;
+  std::unordered_map<uint32_t, size_t> pointer_locations;
+  for (auto& block : blocks) {
+    for (auto& instruction : block.instructions) {
+      if (instruction.opcode != spv::Op::OpLoad &&
+          instruction.opcode != spv::Op::OpStore) {
+        continue;
+      }
+      uint32_t pointer = instruction.operands[0];
+      auto variable_it = pointer_variables.find(pointer);
+      if (variable_it == pointer_variables.end() ||
+          !variables[variable_it->second].promotable ||
+          pointer_locations.count(pointer)) {
+        continue;
+      }
+      const Variable& variable = variables[variable_it->second];
+      std::pair<uint32_t, std::vector<uint32_t>> key;
+      key.first = variable_it->second;
+      Location location;
+      location.initial_value = variable.initializer;
+      auto chain = chain_indices.find(pointer);
+      if (chain != chain_indices.end()) {
+        key.second = chain->second;
+        location.type_id = module->GetPointeeType(chain_types[pointer]);
+      } else {
+        location.type_id = variable.type_id;
+      }
+      if (!location.type_id) {
+        return false;
+      }
+      auto key_it = location_keys.find(key);
+      if (key_it == location_keys.end()) {
+        key_it = location_keys.emplace(key, locations.size()).first;
+        locations.push_back(location);
+      }
+      pointer_locations[pointer] = key_it->second;
+    }
+  }
+  if (locations.empty()) {
+    return true;
+  }
+
+  ControlFlowGraph cfg;
+  if (!BuildControlFlowGraph(function, &cfg)) {
+    return false;
+  }
+  size_t block_count = blocks.size();
+
+  // Minimal SSA: a phi for each location in the iterated dominance frontier of
+  // its stores. Those never read are left for dead code elimination.
+  std::vector<std::vector<Phi>> block_phis(block_count);
+  {
+    std::vector<std::vector<size_t>> store_blocks(locations.size());
+    for (size_t i = 0; i < block_count; ++i) {
+      if (!cfg.reachable[i]) {
+        continue;
+      }
+      for (auto& instruction : blocks[i].instructions) {
+        if (instruction.opcode != spv::Op::OpStore) {
+          continue;
+        }
+        auto it = pointer_locations.find(instruction.operands[0]);
+        if (it != pointer_locations.end() &&
+            (store_blocks[it->second].empty() ||
+             store_blocks[it->second].back() != i)) {
+          store_blocks[it->second].push_back(i);
+        }
+      }
+    }
+    std::vector<size_t> has_phi(block_count, SIZE_MAX);
+    std::vector<size_t> worklist;
+    for (size_t location = 0; location < locations.size(); ++location) {
+      worklist = store_blocks[location];
+      while (!worklist.empty()) {
+        size_t block = worklist.back();
+        worklist.pop_back();
+        for (size_t frontier : cfg.frontiers[block]) {
+          if (has_phi[frontier] == location) {
+            continue;
+          }
+          has_phi[frontier] = location;
+          Phi phi;
+          phi.location = location;
+          phi.id = module->AllocateId();
+          block_phis[frontier].push_back(std::move(phi));
+          worklist.push_back(frontier);
+        }
+      }
+    }
+  }
+
+  // Rename along the dominator tree, with the current value of each location
+  // on a stack.
+  std::unordered_map<uint32_t, uint32_t> replacements;
+  std::vector<std::vector<uint32_t>> values(locations.size());
+  auto current_value = [&](size_t location) {
+    if (!values[location].empty()) {
+      return values[location].back();
+    }
+    Location& info = locations[location];
+    if (!info.initial_value) {
+      info.initial_value = module->GetUndef(info.type_id);
+    }
+    return info.initial_value;
+  };
+  struct Frame {
+    size_t block;
+    size_t next_child;
+    std::vector<size_t> pushed;
+  };
+  std::vector<Frame> stack;
+  stack.push_back({0, 0, {}});
+  bool entering = true;
+  while (!stack.empty()) {
+    Frame& frame = stack.back();
+    if (entering) {
+      for (auto& phi : block_phis[frame.block]) {
+        values[phi.location].push_back(phi.id);
+        frame.pushed.push_back(phi.location);
+      }
+      for (auto& instruction : blocks[frame.block].instructions) {
+        if (instruction.opcode != spv::Op::OpLoad &&
+            instruction.opcode != spv::Op::OpStore) {
+          continue;
+        }
+        auto it = pointer_locations.find(instruction.operands[0]);
+        if (it == pointer_locations.end()) {
+          continue;
+        }
+        if (instruction.opcode == spv::Op::OpLoad) {
+          replacements[instruction.result_id] = current_value(it->second);
+        } else {
+          values[it->second].push_back(instruction.operands[1]);
+          frame.pushed.push_back(it->second);
+        }
+        instruction.Kill();
+      }
+      for (size_t successor : cfg.successors[frame.block]) {
+        for (auto& phi : block_phis[successor]) {
+          phi.incoming[frame.block] = current_value(phi.location);
+        }
+      }
+    }
+    auto& children = cfg.children[frame.block];
+    if (frame.next_child < children.size()) {
+      size_t child = children[frame.next_child++];
+      stack.push_back({child, 0, {}});
+      entering = true;
+      continue;
+    }
+    for (size_t location : frame.pushed) {
+      values[location].pop_back();
+    }
+    stack.pop_back();
+    entering = false;
+  }
+
+  // Emit the phis, with undefined values from unreachable predecessors.
+  for (size_t i = 0; i < block_count; ++i) {
+    if (block_phis[i].empty()) {
+      continue;
+    }
+    std::vector<Instruction> phi_instructions;
+    for (auto& phi : block_phis[i]) {
+      uint32_t type_id = locations[phi.location].type_id;
+      Instruction instruction;
+      instruction.opcode = spv::Op::OpPhi;
+      instruction.type_id = type_id;
+      instruction.result_id = phi.id;
+      for (size_t predecessor : cfg.predecessors[i]) {
+        auto it = phi.incoming.find(predecessor);
+        instruction.operands.push_back(it != phi.incoming.end()
+                                           ? it->second
+                                           : module->GetUndef(type_id));
+        instruction.operands.push_back(blocks[predecessor].id);
+      }
+      phi_instructions.push_back(std::move(instruction));
+    }
+    auto& instructions = blocks[i].instructions;
+    instructions.insert(instructions.begin(),
+                        std::make_move_iterator(phi_instructions.begin()),
+                        std::make_move_iterator(phi_instructions.end()));
+  }
+
+  // Remove the phis merging a single value, which is then known to dominate
+  // their uses.
+  auto resolve = [&replacements](uint32_t id) {
+    for (size_t i = 0; i <= replacements.size(); ++i) {
+      auto it = replacements.find(id);
+      if (it == replacements.end()) {
+        break;
+      }
+      id = it->second;
+    }
+    return id;
+  };
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (auto& block : blocks) {
+      for (auto& instruction : block.instructions) {
+        if (instruction.is_nop()) {
+          continue;
+        }
+        if (instruction.opcode != spv::Op::OpPhi) {
+          // Phis are only at the beginning of blocks.
+          break;
+        }
+        uint32_t value = 0;
+        bool unique = true;
+        for (size_t i = 0; i < instruction.operands.size(); i += 2) {
+          uint32_t incoming = resolve(instruction.operands[i]);
+          if (incoming == instruction.result_id || incoming == value) {
+            continue;
+          }
+          if (value) {
+            unique = false;
+            break;
+          }
+          value = incoming;
+        }
+        if (unique && value) {
+          replacements[instruction.result_id] = value;
+          instruction.Kill();
+          changed = true;
+        }
+      }
+    }
+  }
+
+  module->ReplaceUses(replacements);
+  return true;
+}
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
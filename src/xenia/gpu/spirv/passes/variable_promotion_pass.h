@@ -0,0 +1,39 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_SPIRV_PASSES_VARIABLE_PROMOTION_PASS_H_
+#define XENIA_GPU_SPIRV_PASSES_VARIABLE_PROMOTION_PASS_H_
+
+#include "xenia/gpu/spirv/compiler_pass.h"
+
+namespace xe {
+namespace gpu {
+namespace spirv {
+
+// Variable promotion (mem2reg) pass. Replaces the loads and stores of function
+// variables with SSA values, inserting OpPhi where control flow joins. The
+// elements of arrays only ever indexed with constants, such as the register
+// file of shaders without relative addressing, are promoted separately. The
+// stores left without loads are for dead variable elimination to remove.
+class VariablePromotionPass : public CompilerPass {
+ public:
+  VariablePromotionPass();
+
+  const char* name() const override { return "VariablePromotion"; }
+  bool Run(Module* module) override;
+
+ private:
+  bool RunOnFunction(Module* module, Function* function);
+};
+
+}  // namespace spirv
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_SPIRV_PASSES_VARIABLE_PROMOTION_PASS_H_
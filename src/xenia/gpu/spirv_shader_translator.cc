@@ -19,9 +19,15 @@
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/gpu/spirv/passes/constant_folding_pass.h"
+#include "xenia/gpu/spirv/passes/dead_code_elimination_pass.h"
+#include "xenia/gpu/spirv/passes/dead_variable_elimination_pass.h"
+#include "xenia/gpu/spirv/passes/variable_promotion_pass.h"
 
 DEFINE_bool(spv_validate, false, "Validate SPIR-V shaders after generation");
 DEFINE_bool(spv_disasm, false, "Disassemble SPIR-V shaders after generation");
+DEFINE_bool(spv_optimize, true,
+            "Optimize SPIR-V shaders after generation, validating each pass");
 
 namespace xe {
 namespace gpu {
@@ -34,7 +40,14 @@ using spv::GLSLstd450;
 using spv::Id;
 using spv::Op;
 
-SpirvShaderTranslator::SpirvShaderTranslator() {}
+SpirvShaderTranslator::SpirvShaderTranslator() {
+  // Dead variables are the stores left behind by promotion, and removing them
+  // leaves the computation of the stored values dead.
+  compiler_.AddPass(std::make_unique<spirv::VariablePromotionPass>());
+  compiler_.AddPass(std::make_unique<spirv::ConstantFoldingPass>());
+  compiler_.AddPass(std::make_unique<spirv::DeadVariableEliminationPass>());
+  compiler_.AddPass(std::make_unique<spirv::DeadCodeEliminationPass>());
+}
 SpirvShaderTranslator::~SpirvShaderTranslator() = default;
 
 void SpirvShaderTranslator::StartTranslation() {
@@ -275,10 +288,44 @@ void SpirvShaderTranslator::StartTranslation() {
       b.addDecoration(vtx_, spv::Decoration::DecorationBinding, 0);
       b.addDecoration(vtx_, spv::Decoration::DecorationNonWritable);
 
-      // Set up the map from binding -> ssbo index
+      // The endians are specialized, see SpirvSpecializationConstants.
+      Id vertex_endian[2];
+      for (uint32_t i = 0; i < 2; ++i) {
+        vertex_endian[i] = b.makeUintConstant(0, true);
+        b.addDecoration(
+            vertex_endian[i], spv::Decoration::DecorationSpecId,
+            int(offsetof(SpirvSpecializationConstants, vertex_endian) /
+                    sizeof(uint32_t) +
+                i));
+      }
+
+      // Set up the map from binding -> ssbo index, and the swaps of each
+      // binding, which the driver folds away when specializing.
+      b.setToSpecConstCodeGenMode();
       for (const auto& binding : vertex_bindings()) {
+        assert_true(binding.binding_index < 32);
         vtx_binding_map_[binding.fetch_constant] = binding.binding_index;
+        auto endian = b.createBinOp(
+            spv::Op::OpShiftRightLogical, uint_type_,
+            vertex_endian[binding.binding_index / 16],
+            b.makeUintConstant((binding.binding_index % 16) * 2));
+        endian = b.createBinOp(spv::Op::OpBitwiseAnd, uint_type_, endian,
+                               b.makeUintConstant(0x3));
+        // k8in16 and k8in32 swap the bytes of the halves, k8in32 and k16in32
+        // swap the halves.
+        VertexSwap swap;
+        swap.swap_8in16 = b.createBinOp(
+            spv::Op::OpLogicalOr, bool_type_,
+            b.createBinOp(spv::Op::OpIEqual, bool_type_, endian,
+                          b.makeUintConstant(uint32_t(Endian::k8in16))),
+            b.createBinOp(spv::Op::OpIEqual, bool_type_, endian,
+                          b.makeUintConstant(uint32_t(Endian::k8in32))));
+        swap.swap_16in32 =
+            b.createBinOp(spv::Op::OpUGreaterThanEqual, bool_type_, endian,
+                          b.makeUintConstant(uint32_t(Endian::k8in32)));
+        vtx_swap_map_[binding.fetch_constant] = swap;
       }
+      b.setToNormalCodeGenMode();
     }
 
     // Outputs
@@ -509,18 +556,25 @@ std::vector<uint8_t> SpirvShaderTranslator::CompleteTranslation() {
   b.createFunctionCall(translated_main_, std::vector<Id>({}));
   if (is_vertex_shader()) {
     // gl_Position transform
-    auto vtx_fmt_ptr = b.createAccessChain(
-        spv::StorageClass::StorageClassPushConstant, push_consts_,
-        std::vector<Id>({b.makeUintConstant(1)}));
     auto window_scale_ptr = b.createAccessChain(
         spv::StorageClass::StorageClassPushConstant, push_consts_,
         std::vector<Id>({b.makeUintConstant(0)}));
-    auto vtx_fmt = b.createLoad(vtx_fmt_ptr);
     auto window_scale = b.createLoad(window_scale_ptr);
 
+    // The vertex format is specialized, see SpirvSpecializationConstants.
+    Id vtx_fmt[3];
+    for (uint32_t i = 0; i < 3; ++i) {
+      vtx_fmt[i] = b.makeBoolConstant(false, true);
+      b.addDecoration(vtx_fmt[i], spv::Decoration::DecorationSpecId,
+                      int(offsetof(SpirvSpecializationConstants, vtx_xy_fmt) /
+                              sizeof(uint32_t) +
+                          i));
+    }
+    auto c = b.makeCompositeConstant(
+        vec4_bool_type_, {vtx_fmt[0], vtx_fmt[0], vtx_fmt[1], vtx_fmt[2]},
+        true);
+
     auto p = b.createLoad(pos_);
-    auto c = b.createBinOp(spv::Op::OpFOrdNotEqual, vec4_bool_type_, vtx_fmt,
-                           vec4_float_zero_);
 
     // pos.w = vtx_fmt.w == 0.0 ? 1.0 / pos.w : pos.w
     auto c_w = b.createCompositeExtract(c, bool_type_, 3);
@@ -579,15 +633,15 @@ std::vector<uint8_t> SpirvShaderTranslator::CompleteTranslation() {
           std::vector<Id>({b.makeUintConstant(3)}));
       auto alpha_test = b.createLoad(alpha_test_ptr);
 
-      auto alpha_test_enabled =
-          b.createCompositeExtract(alpha_test, float_type_, 0);
-      auto alpha_test_func =
-          b.createCompositeExtract(alpha_test, float_type_, 1);
       auto alpha_test_ref =
           b.createCompositeExtract(alpha_test, float_type_, 2);
 
-      alpha_test_func =
-          b.createUnaryOp(spv::Op::OpConvertFToU, uint_type_, alpha_test_func);
+      // The function is specialized, always passing if the test is disabled.
+      auto alpha_test_func = b.makeUintConstant(7, true);
+      b.addDecoration(
+          alpha_test_func, spv::Decoration::DecorationSpecId,
+          int(offsetof(SpirvSpecializationConstants, alpha_test_func) /
+              sizeof(uint32_t)));
 
       auto oC0_ptr = b.createAccessChain(
           spv::StorageClass::StorageClassOutput, frag_outputs_,
@@ -595,10 +649,6 @@ std::vector<uint8_t> SpirvShaderTranslator::CompleteTranslation() {
       auto oC0_alpha =
           b.createCompositeExtract(b.createLoad(oC0_ptr), float_type_, 3);
 
-      auto cond = b.createBinOp(spv::Op::OpFOrdEqual, bool_type_,
-                                alpha_test_enabled, b.makeFloatConstant(1.f));
-      spv::Builder::If alpha_if(cond, 0, b);
-
       std::vector<spv::Block*> switch_segments;
       b.makeSwitch(
           alpha_test_func, 0, 8, std::vector<int>({0, 1, 2, 3, 4, 5, 6, 7}),
@@ -633,19 +683,19 @@ std::vector<uint8_t> SpirvShaderTranslator::CompleteTranslation() {
       // if (alpha_func == 7) passes = true;
       b.nextSwitchSegment(switch_segments, 7);
       b.endSwitch(switch_segments);
-
-      alpha_if.makeEndIf();
     }
   }
 
   b.makeReturn(false);
 
-  // Compile the spv IR
-  // compiler_.Compile(b.getModule());
-
   std::vector<uint32_t> spirv_words;
   b.dump(spirv_words);
 
+  // Compile the spv IR
+  if (FLAGS_spv_optimize) {
+    compiler_.Compile(&spirv_words);
+  }
+
   // Cleanup builder.
   cf_blocks_.clear();
   writes_depth_ = false;
@@ -1225,6 +1275,37 @@ spv::Id SpirvShaderTranslator::ConvertNormVar(spv::Id var, spv::Id result_type,
   return var;
 }
 
+spv::Id SpirvShaderTranslator::LoadVertexData(spv::Id vertex_ptr,
+                                             uint32_t fetch_constant) {
+  auto& b = *builder_;
+  auto data = b.createLoad(vertex_ptr);
+  const auto& swap = vtx_swap_map_[fetch_constant];
+
+  // ((data >> 8) & 0x00FF00FF) | ((data & 0x00FF00FF) << 8)
+  auto swapped = b.createBinOp(
+      spv::Op::OpBitwiseOr, uint_type_,
+      b.createBinOp(spv::Op::OpBitwiseAnd, uint_type_,
+                    b.createBinOp(spv::Op::OpShiftRightLogical, uint_type_,
+                                  data, b.makeUintConstant(8)),
+                    b.makeUintConstant(0x00FF00FF)),
+      b.createBinOp(spv::Op::OpShiftLeftLogical, uint_type_,
+                    b.createBinOp(spv::Op::OpBitwiseAnd, uint_type_, data,
+                                  b.makeUintConstant(0x00FF00FF)),
+                    b.makeUintConstant(8)));
+  data = b.createTriOp(spv::Op::OpSelect, uint_type_, swap.swap_8in16,
+                       swapped, data);
+
+  // (data >> 16) | (data << 16)
+  swapped = b.createBinOp(
+      spv::Op::OpBitwiseOr, uint_type_,
+      b.createBinOp(spv::Op::OpShiftRightLogical, uint_type_, data,
+                    b.makeUintConstant(16)),
+      b.createBinOp(spv::Op::OpShiftLeftLogical, uint_type_, data,
+                    b.makeUintConstant(16)));
+  return b.createTriOp(spv::Op::OpSelect, uint_type_, swap.swap_16in32,
+                       swapped, data);
+}
+
 void SpirvShaderTranslator::ProcessVertexFetchInstruction(
     const ParsedVertexFetchInstruction& instr) {
   auto& b = *builder_;
@@ -1280,7 +1361,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
     case VertexFormat::k_8_8_8_8: {
       auto vertex_ptr = b.createAccessChain(
           spv::StorageClass::StorageClassUniform, data_ptr, {vertex_idx});
-      auto vertex_data = b.createLoad(vertex_ptr);
+      auto vertex_data =
+          LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
       if (instr.attributes.is_integer) {
         spv::Id components[4] = {};
@@ -1317,7 +1399,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         if (instr.attributes.is_integer) {
           spv::Id comp[2] = {};
@@ -1364,7 +1447,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         if (instr.attributes.is_integer) {
           spv::Id comp[2] = {};
@@ -1412,7 +1496,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         assert_true(instr.attributes.is_integer);
         assert_true(instr.attributes.is_signed);
@@ -1431,7 +1516,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         assert_true(instr.attributes.is_integer);
         assert_true(instr.attributes.is_signed);
@@ -1451,7 +1537,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         if (instr.attributes.is_integer) {
           if (instr.attributes.is_signed) {
@@ -1486,7 +1573,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         if (instr.attributes.is_integer) {
           if (instr.attributes.is_signed) {
@@ -1521,7 +1609,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         if (instr.attributes.is_integer) {
           if (instr.attributes.is_signed) {
@@ -1553,7 +1642,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
     case VertexFormat::k_32_FLOAT: {
       auto vertex_ptr = b.createAccessChain(
           spv::StorageClass::StorageClassUniform, data_ptr, {vertex_idx});
-      auto vertex_data = b.createLoad(vertex_ptr);
+      auto vertex_data =
+          LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
       vertex = b.createUnaryOp(spv::Op::OpBitcast, float_type_, vertex_data);
     } break;
@@ -1565,7 +1655,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         components[i] =
             b.createUnaryOp(spv::Op::OpBitcast, float_type_, vertex_data);
@@ -1582,7 +1673,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         components[i] =
             b.createUnaryOp(spv::Op::OpBitcast, float_type_, vertex_data);
@@ -1599,7 +1691,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
                                    b.makeUintConstant(i));
         auto vertex_ptr = b.createAccessChain(
             spv::StorageClass::StorageClassUniform, data_ptr, {index});
-        auto vertex_data = b.createLoad(vertex_ptr);
+        auto vertex_data =
+            LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
 
         components[i] =
             b.createUnaryOp(spv::Op::OpBitcast, float_type_, vertex_data);
@@ -1613,7 +1706,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
     case VertexFormat::k_2_10_10_10: {
       auto vertex_ptr = b.createAccessChain(
           spv::StorageClass::StorageClassUniform, data_ptr, {vertex_idx});
-      auto vertex_data = b.createLoad(vertex_ptr);
+      auto vertex_data =
+          LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
       assert(b.getTypeId(vertex_data) == uint_type_);
 
       // This needs to be converted.
@@ -1660,7 +1754,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
     case VertexFormat::k_10_11_11: {
       auto vertex_ptr = b.createAccessChain(
           spv::StorageClass::StorageClassUniform, data_ptr, {vertex_idx});
-      auto vertex_data = b.createLoad(vertex_ptr);
+      auto vertex_data =
+          LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
       assert(b.getTypeId(vertex_data) == uint_type_);
 
       // This needs to be converted.
@@ -1718,7 +1813,8 @@ void SpirvShaderTranslator::ProcessVertexFetchInstruction(
     case VertexFormat::k_11_11_10: {
       auto vertex_ptr = b.createAccessChain(
           spv::StorageClass::StorageClassUniform, data_ptr, {vertex_idx});
-      auto vertex_data = b.createLoad(vertex_ptr);
+      auto vertex_data =
+          LoadVertexData(vertex_ptr, instr.operands[1].storage_index);
       assert(b.getTypeId(vertex_data) == uint_type_);
 
       // This needs to be converted.
@@ -18,6 +18,7 @@
 #include "third_party/glslang-spirv/SpvBuilder.h"
 #include "third_party/spirv/GLSL.std.450.hpp11"
 #include "xenia/gpu/shader_translator.h"
+#include "xenia/gpu/spirv/compiler.h"
 #include "xenia/ui/spirv/spirv_disassembler.h"
 #include "xenia/ui/spirv/spirv_validator.h"
 
@@ -30,13 +31,15 @@ namespace gpu {
 struct SpirvPushConstants {
   // Accessible to vertex shader only:
   float window_scale[4];  // scale x/y, offset x/y (pixels)
+  // Unused, now SpirvSpecializationConstants. Kept as the geometry shaders
+  // share the layout.
   float vtx_fmt[4];
 
   // Accessible to geometry shader only:
   float point_size[4];  // psx, psy, unused, unused
 
   // Accessible to fragment shader only:
-  float alpha_test[4];  // alpha test enable, func, ref
+  float alpha_test[4];  // unused, unused, ref
   float color_exp_bias[4];
   uint32_t ps_param_gen;
 };
@@ -53,6 +56,24 @@ constexpr uint32_t kSpirvPushConstantFragmentRangeSize =
     (sizeof(float) * 4) + sizeof(uint32_t);
 constexpr uint32_t kSpirvPushConstantsSize = sizeof(SpirvPushConstants);
 
+// State the translated shaders are specialized for when pipelines are created,
+// so that one module serves every combination without dynamic branches. The
+// constant ID of each is its index, and booleans are VkBool32.
+struct SpirvSpecializationConstants {
+  // PA_CL_VTE_CNTL VTX_XY_FMT, VTX_Z_FMT and VTX_W0_FMT.
+  uint32_t vtx_xy_fmt;
+  uint32_t vtx_z_fmt;
+  uint32_t vtx_w0_fmt;
+  // RB_COLORCONTROL ALPHAFUNC, or 7 (always) if alpha testing is disabled.
+  uint32_t alpha_test_func;
+  // Endian of the fetch constant of each vertex binding, 2 bits for each
+  // binding index, 16 bindings per word. The data is byte swapped as it's
+  // fetched rather than when it's uploaded.
+  uint32_t vertex_endian[2];
+};
+constexpr uint32_t kSpirvSpecializationConstantCount =
+    sizeof(SpirvSpecializationConstants) / sizeof(uint32_t);
+
 class SpirvShaderTranslator : public ShaderTranslator {
  public:
   SpirvShaderTranslator();
@@ -95,6 +116,8 @@ class SpirvShaderTranslator : public ShaderTranslator {
                           uint32_t offset, uint32_t count);
   spv::Id ConvertNormVar(spv::Id var, spv::Id result_type, uint32_t bits,
                          bool is_signed);
+  // Loads a word of vertex data, swapped to the endian of the fetch constant.
+  spv::Id LoadVertexData(spv::Id vertex_ptr, uint32_t fetch_constant);
 
   // Creates a call to the given GLSL intrinsic.
   spv::Id CreateGlslStd450InstructionCall(spv::Decoration precision,
@@ -113,6 +136,7 @@ class SpirvShaderTranslator : public ShaderTranslator {
 
   xe::ui::spirv::SpirvDisassembler disassembler_;
   xe::ui::spirv::SpirvValidator validator_;
+  spirv::Compiler compiler_;
 
   // True if there's an open predicated block
   bool open_predicated_block_ = false;
@@ -163,6 +187,12 @@ class SpirvShaderTranslator : public ShaderTranslator {
   std::unordered_map<uint32_t, uint32_t> tex_binding_map_;
   spv::Id vtx_ = 0;  // Vertex buffer array (32 runtime arrays)
   std::unordered_map<uint32_t, uint32_t> vtx_binding_map_;
+  // Specialized conditions of the byte swaps of each vertex fetch constant.
+  struct VertexSwap {
+    spv::Id swap_8in16;
+    spv::Id swap_16in32;
+  };
+  std::unordered_map<uint32_t, VertexSwap> vtx_swap_map_;
 
   bool writes_depth_ = false;
 
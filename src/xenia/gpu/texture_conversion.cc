@@ -37,7 +37,7 @@ void CopySwapBlock(Endian endian, void* output, const void* input,
       xe::copy_and_swap_32_unaligned(output, input, length / 4);
       break;
     case Endian::k16in32:  // Swap high and low 16 bits within a 32 bit word
-      xe::copy_and_swap_16_in_32_unaligned(output, input, length);
+      xe::copy_and_swap_16_in_32_unaligned(output, input, length / 4);
       break;
     default:
     case Endian::kUnspecified:
@@ -124,27 +124,45 @@ void Untile(uint8_t* output_buffer, const uint8_t* input_buffer,
   auto log2_bpp = (input_bytes_per_block / 4) +
                   ((input_bytes_per_block / 2) >> (input_bytes_per_block / 4));
 
+  // Blocks that are contiguous in the input can be copied as one run if
+  // their size doesn't change, so the swap can work on whole vectors.
+  bool copy_runs = input_bytes_per_block == output_bytes_per_block;
+
   // Offset to the current row, in bytes.
   uint32_t output_row_offset = 0;
   for (uint32_t y = 0; y < untile_info->height; y++) {
-    auto input_row_offset = TiledOffset2DRow(
-        untile_info->offset_y + y, untile_info->input_pitch, log2_bpp);
+    uint32_t tiled_y = untile_info->offset_y + y;
+    auto input_row_offset =
+        TiledOffset2DRow(tiled_y, untile_info->input_pitch, log2_bpp);
+    // Input offset of a block of this row, in blocks.
+    auto block_offset = [&](uint32_t x) {
+      return TiledOffset2DColumn(untile_info->offset_x + x, tiled_y, log2_bpp,
+                                 input_row_offset) >>
+             log2_bpp;
+    };
 
-    // Go block-by-block on this row.
+    // Go run-by-run on this row.
     uint32_t output_offset = output_row_offset;
-
-    for (uint32_t x = 0; x < untile_info->width; x++) {
-      auto input_offset = TiledOffset2DColumn(untile_info->offset_x + x,
-                                              untile_info->offset_y + y,
-                                              log2_bpp, input_row_offset);
-      input_offset >>= log2_bpp;
+    uint32_t input_offset = block_offset(0);
+    for (uint32_t x = 0; x < untile_info->width;) {
+      uint32_t run = 1;
+      uint32_t next_offset = 0;
+      while (x + run < untile_info->width) {
+        next_offset = block_offset(x + run);
+        if (!copy_runs || next_offset != input_offset + run) {
+          break;
+        }
+        ++run;
+      }
 
       untile_info->copy_callback(
           &output_buffer[output_offset],
           &input_buffer[input_offset * input_bytes_per_block],
-          output_bytes_per_block);
+          run * output_bytes_per_block);
 
-      output_offset += output_bytes_per_block;
+      output_offset += run * output_bytes_per_block;
+      input_offset = next_offset;
+      x += run;
     }
 
     output_row_offset += output_pitch;
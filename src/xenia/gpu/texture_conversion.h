@@ -43,6 +43,8 @@ typedef struct UntileInfo {
   uint32_t output_pitch;
   const FormatInfo* input_format_info;
   const FormatInfo* output_format_info;
+  // Called with the output length of one block, or of a run of blocks that
+  // are contiguous in the input if both formats have the same block size.
   UntileCopyBlockCallback copy_callback;
 } UntileInfo;
 
@@ -11,7 +11,12 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
+#include <cstdio>
+
 #include "third_party/stb/stb_image_write.h"
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
 #include "xenia/base/string.h"
@@ -30,12 +35,41 @@
 
 DEFINE_string(target_trace_file, "", "Specifies the trace file to load.");
 DEFINE_string(trace_dump_path, "", "Output path for dumped files.");
+DEFINE_int32(trace_dump_benchmark_iterations, 0,
+             "Replay the first frame of the trace this many times, reporting "
+             "timings and cache hit rates as JSON instead of dumping a "
+             "capture.");
+DEFINE_int32(trace_dump_benchmark_warmup, 2,
+             "Replays of the frame before the benchmark iterations, which "
+             "aren't measured.");
+DEFINE_string(trace_dump_benchmark_json, "",
+              "Path of the benchmark report, or the output path with a .json "
+              "extension if empty.");
 
 namespace xe {
 namespace gpu {
 
 using namespace xe::gpu::xenos;
 
+namespace {
+
+std::string EscapeJson(const std::string& value) {
+  std::string result;
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (uint8_t(c) < 0x20) {
+      result += xe::format_string("\\u%.4X", uint32_t(c));
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+}  // namespace
+
 TraceDump::TraceDump() = default;
 
 TraceDump::~TraceDump() = default;
@@ -67,6 +101,10 @@ int TraceDump::Main(const std::vector<std::wstring>& args) {
   auto abs_path = xe::to_absolute_path(path);
   XELOGI("Loading trace file %ls...", abs_path.c_str());
 
+  bool benchmark = FLAGS_trace_dump_benchmark_iterations > 0;
+  if (benchmark) {
+    PrepareBenchmark();
+  }
   if (!Setup()) {
     XELOGE("Unable to setup trace dump tool");
     return 4;
@@ -98,7 +136,7 @@ int TraceDump::Main(const std::vector<std::wstring>& args) {
   // Ensure output path exists.
   xe::filesystem::CreateParentFolder(base_output_path_);
 
-  return Run();
+  return benchmark ? RunBenchmark() : Run();
 }
 
 bool TraceDump::Setup() {
@@ -150,5 +188,151 @@ int TraceDump::Run() {
   return result;
 }
 
+int TraceDump::RunBenchmark() {
+  if (!player_->frame_count()) {
+    XELOGE("Trace has no frames to benchmark");
+    return 1;
+  }
+  int iterations = FLAGS_trace_dump_benchmark_iterations;
+  int warmup = std::max(FLAGS_trace_dump_benchmark_warmup, 0);
+  XELOGI("Benchmarking %d replays after %d warmup replays...", iterations,
+         warmup);
+
+  // The warmup fills the caches and lets background pipeline creation finish,
+  // so the iterations measure the frame as a title redrawing it would.
+  for (int i = 0; i < warmup; ++i) {
+    player_->ReplayFrame(0);
+  }
+
+  ResetBenchmarkStats();
+  player_->ResetPacketTimings();
+  player_->set_packet_timing_enabled(true);
+  double ms_per_tick = 1000.0 / double(Clock::host_tick_frequency());
+  std::vector<double> frame_times;
+  // Draws may be skipped in some iterations, so each is averaged over the
+  // iterations it was timed in.
+  std::vector<double> draw_time_sums;
+  std::vector<uint32_t> draw_time_counts;
+  std::vector<double> draw_times;
+  bool draws_timed = false;
+  for (int i = 0; i < iterations; ++i) {
+    uint64_t start_ticks = Clock::QueryHostTickCount();
+    player_->ReplayFrame(0);
+    frame_times.push_back((Clock::QueryHostTickCount() - start_ticks) *
+                          ms_per_tick);
+    if (!GetDrawGpuTimes(&draw_times)) {
+      continue;
+    }
+    draws_timed = true;
+    if (draw_time_sums.size() < draw_times.size()) {
+      draw_time_sums.resize(draw_times.size());
+      draw_time_counts.resize(draw_times.size());
+    }
+    for (size_t j = 0; j < draw_times.size(); ++j) {
+      draw_time_sums[j] += draw_times[j];
+      ++draw_time_counts[j];
+    }
+  }
+  player_->set_packet_timing_enabled(false);
+  std::vector<CacheStats> cache_stats;
+  GetCacheStats(&cache_stats);
+
+  // Frame times are the wall time of each replay, which includes waiting for
+  // the GPU to present it.
+  double frame_time_sum = 0.0;
+  for (double frame_time : frame_times) {
+    frame_time_sum += frame_time;
+  }
+  std::string json = "{\n";
+  json += xe::format_string(
+      "  \"trace\": \"%s\",\n"
+      "  \"iterations\": %d,\n"
+      "  \"warmup\": %d,\n"
+      "  \"frame_ms\": {\"mean\": %.4f, \"min\": %.4f, \"max\": %.4f},\n",
+      EscapeJson(xe::to_string(trace_file_path_)).c_str(), iterations, warmup,
+      frame_time_sum / iterations,
+      *std::min_element(frame_times.begin(), frame_times.end()),
+      *std::max_element(frame_times.begin(), frame_times.end()));
+
+  // Host time of executing each type of packet, per frame, and the rate
+  // packets of the type can be executed at.
+  json += "  \"packets\": [";
+  double us_per_tick = ms_per_tick * 1000.0;
+  double tick_frequency = double(Clock::host_tick_frequency());
+  uint64_t packet_count = 0, packet_ticks = 0;
+  const char* separator = "\n";
+  for (const auto& it : player_->packet_timings()) {
+    json += xe::format_string(
+        "%s    {\"type\": \"%s\", \"count\": %.2f, \"cpu_us\": %.3f, "
+        "\"cpu_us_per_packet\": %.4f, \"packets_per_sec\": %.0f}",
+        separator, it.first.c_str(), double(it.second.count) / iterations,
+        it.second.ticks * us_per_tick / iterations,
+        it.second.ticks * us_per_tick / it.second.count,
+        it.second.count * tick_frequency /
+            std::max(it.second.ticks, uint64_t(1)));
+    separator = ",\n";
+    packet_count += it.second.count;
+    packet_ticks += it.second.ticks;
+  }
+  json += "\n  ],\n";
+  double packets_per_sec =
+      packet_count * tick_frequency / std::max(packet_ticks, uint64_t(1));
+  json += xe::format_string("  \"packets_per_sec\": %.0f,\n",
+                            packets_per_sec);
+  XELOGI("Packets: %.0f per second", packets_per_sec);
+
+  if (draws_timed) {
+    double draw_time_total = 0.0;
+    std::string draw_list;
+    for (size_t i = 0; i < draw_time_sums.size(); ++i) {
+      double draw_time = draw_time_sums[i] / draw_time_counts[i];
+      draw_time_total += draw_time;
+      draw_list += xe::format_string("%s%.3f", i ? ", " : "", draw_time);
+    }
+    json += xe::format_string(
+        "  \"draws\": {\"count\": %zu, \"gpu_us\": %.3f, "
+        "\"gpu_us_per_draw\": [%s]},\n",
+        draw_time_sums.size(), draw_time_total, draw_list.c_str());
+  } else {
+    json += "  \"draws\": null,\n";
+  }
+
+  json += "  \"caches\": [";
+  separator = "\n";
+  for (const auto& stats : cache_stats) {
+    uint64_t lookups = stats.hits + stats.misses;
+    double hit_rate = lookups ? double(stats.hits) / lookups : 0.0;
+    json += xe::format_string(
+        "%s    {\"name\": \"%s\", \"hits\": %llu, \"misses\": %llu, "
+        "\"hit_rate\": %.4f}",
+        separator, stats.name, static_cast<unsigned long long>(stats.hits),
+        static_cast<unsigned long long>(stats.misses), hit_rate);
+    separator = ",\n";
+    XELOGI("%s cache: %.2f%% of %llu lookups hit", stats.name,
+           hit_rate * 100.0, static_cast<unsigned long long>(lookups));
+  }
+  json += "\n  ]\n}\n";
+  XELOGI("Frame: %.4fms mean over %d replays", frame_time_sum / iterations,
+         iterations);
+
+  std::wstring json_path =
+      FLAGS_trace_dump_benchmark_json.empty()
+          ? base_output_path_ + L".json"
+          : xe::to_wstring(FLAGS_trace_dump_benchmark_json);
+  int result = 0;
+  FILE* file = xe::filesystem::OpenFile(json_path, "wb");
+  if (file) {
+    fwrite(json.data(), 1, json.size(), file);
+    fclose(file);
+  } else {
+    XELOGE("Unable to write the benchmark report to %ls", json_path.c_str());
+    result = 1;
+  }
+
+  player_.reset();
+  emulator_.reset();
+  return result;
+}
+
 }  //  namespace gpu
 }  //  namespace xe
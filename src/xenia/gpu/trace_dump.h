@@ -11,6 +11,7 @@
 #define XENIA_GPU_TRACE_DUMP_H_
 
 #include <string>
+#include <vector>
 
 #include "xenia/emulator.h"
 #include "xenia/gpu/shader.h"
@@ -43,6 +44,22 @@ class TraceDump {
 
   virtual std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() = 0;
 
+  // Hit counts of a backend cache over the benchmark iterations.
+  struct CacheStats {
+    const char* name;
+    uint64_t hits;
+    uint64_t misses;
+  };
+  // Called before the emulator is set up in benchmark mode, to enable the
+  // measurements of the backend.
+  virtual void PrepareBenchmark() {}
+  // Called between replays, while the command processor is idle.
+  virtual void ResetBenchmarkStats() {}
+  // Gets the GPU time in microseconds of each draw of the last replay.
+  // Returns false if the backend doesn't measure it.
+  virtual bool GetDrawGpuTimes(std::vector<double>* times) { return false; }
+  virtual void GetCacheStats(std::vector<CacheStats>* stats) {}
+
   std::unique_ptr<Emulator> emulator_;
   GraphicsSystem* graphics_system_ = nullptr;
   std::unique_ptr<TracePlayer> player_;
@@ -51,6 +68,9 @@ class TraceDump {
   bool Setup();
   bool Load(std::wstring trace_file_path);
   int Run();
+  // Replays the first frame --trace_dump_benchmark_iterations times and
+  // writes the timings as JSON instead of capturing the frame.
+  int RunBenchmark();
 
   std::wstring trace_file_path_;
   std::wstring base_output_path_;
@@ -9,10 +9,23 @@
 
 #include "xenia/gpu/trace_player.h"
 
+#include <gflags/gflags.h>
+
+#include <cstring>
+#include <iterator>
+
+#include "xenia/base/clock.h"
 #include "xenia/gpu/command_processor.h"
 #include "xenia/gpu/graphics_system.h"
+#include "xenia/gpu/packet_disassembler.h"
 #include "xenia/memory.h"
 
+DEFINE_int32(trace_checkpoint_interval, 500,
+             "Commands of a frame between the checkpoints of the command "
+             "processor state seeking back in a trace resumes from, or 0 to "
+             "always replay from the frame start. Each holds a copy of the "
+             "render targets in GPU memory.");
+
 namespace xe {
 namespace gpu {
 
@@ -51,7 +64,7 @@ void TracePlayer::SeekFrame(int target_frame) {
 
   assert_true(frame->start_ptr <= frame->end_ptr);
   PlayTrace(frame->start_ptr, frame->end_ptr - frame->start_ptr,
-            TracePlaybackMode::kBreakOnSwap, false);
+            TracePlaybackMode::kBreakOnSwap, false, current_frame_index_, 0);
 }
 
 void TracePlayer::SeekCommand(int target_command) {
@@ -71,11 +84,13 @@ void TracePlayer::SeekCommand(int target_command) {
     const auto& previous_command = frame->commands[previous_command_index];
     PlayTrace(previous_command.end_ptr,
               command.end_ptr - previous_command.end_ptr,
-              TracePlaybackMode::kBreakOnSwap, false);
+              TracePlaybackMode::kBreakOnSwap, false, current_frame_index_,
+              previous_command_index + 1);
   } else {
-    // Full playback from frame start.
+    // Playback from the last checkpoint before the command, or from frame
+    // start. The caches are kept along with the checkpoints.
     PlayTrace(frame->start_ptr, command.end_ptr - frame->start_ptr,
-              TracePlaybackMode::kBreakOnSwap, true);
+              TracePlaybackMode::kBreakOnSwap, false, current_frame_index_, 0);
   }
 }
 
@@ -83,24 +98,40 @@ void TracePlayer::WaitOnPlayback() {
   xe::threading::Wait(playback_event_.get(), true);
 }
 
+void TracePlayer::ReplayFrame(int target_frame) {
+  current_frame_index_ = target_frame;
+  auto frame = current_frame();
+  current_command_index_ = int(frame->commands.size()) - 1;
+
+  // The playback ends with a swap, which completes the frame.
+  assert_true(frame->start_ptr <= frame->end_ptr);
+  PlayTrace(frame->start_ptr, frame->end_ptr - frame->start_ptr,
+            TracePlaybackMode::kUntilEnd, false);
+  WaitOnPlayback();
+}
+
 void TracePlayer::PlayTrace(const uint8_t* trace_data, size_t trace_size,
                             TracePlaybackMode playback_mode,
-                            bool clear_caches) {
+                            bool clear_caches, int frame_index,
+                            int first_command) {
   playing_trace_ = true;
   graphics_system_->command_processor()->CallInThread([=]() {
-    PlayTraceOnThread(trace_data, trace_size, playback_mode, clear_caches);
+    PlayTraceOnThread(trace_data, trace_size, playback_mode, clear_caches,
+                      frame_index, first_command);
   });
 }
 
 void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
                                     size_t trace_size,
                                     TracePlaybackMode playback_mode,
-                                    bool clear_caches) {
+                                    bool clear_caches, int frame_index,
+                                    int first_command) {
   auto memory = graphics_system_->memory();
   auto command_processor = graphics_system_->command_processor();
 
   if (clear_caches) {
     command_processor->ClearCaches();
+    checkpoints_.clear();
   }
 
   command_processor->set_swap_mode(SwapMode::kIgnored);
@@ -109,6 +140,37 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
 
   playing_trace_ = true;
   auto trace_ptr = trace_data;
+
+  const Frame* checkpoint_frame = nullptr;
+  int next_command = 0;
+  bool saving_checkpoints = false;
+  if (first_command >= 0 && FLAGS_trace_checkpoint_interval > 0) {
+    if (checkpoint_frame_index_ != frame_index) {
+      command_processor->ReleaseCheckpoints();
+      checkpoints_.clear();
+      checkpoint_frame_index_ = frame_index;
+    }
+    checkpoint_frame = frame(frame_index);
+    next_command = first_command;
+    saving_checkpoints = true;
+    if (first_command == 0) {
+      // Resume from the last checkpoint within the playback.
+      for (auto it = checkpoints_.rbegin(); it != checkpoints_.rend();) {
+        const auto& command = checkpoint_frame->commands[it->first];
+        if (command.end_ptr > trace_end) {
+          ++it;
+          continue;
+        }
+        if (command_processor->RestoreCheckpoint(it->second)) {
+          trace_ptr = command.end_ptr;
+          next_command = it->first + 1;
+          break;
+        }
+        it = std::map<int, uint32_t>::reverse_iterator(
+            checkpoints_.erase(std::next(it).base()));
+      }
+    }
+  }
   bool pending_break = false;
   const PacketStartCommand* pending_packet = nullptr;
   while (trace_ptr < trace_data + trace_size) {
@@ -157,10 +219,53 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
         auto cmd = reinterpret_cast<const PacketEndCommand*>(trace_ptr);
         trace_ptr += sizeof(*cmd);
         if (pending_packet) {
-          command_processor->ExecutePacket(pending_packet->base_ptr,
-                                           pending_packet->count);
+          if (packet_timing_enabled_ || packet_profiling_enabled_) {
+            uint64_t start_ticks = Clock::QueryHostTickCount();
+            command_processor->ExecutePacket(pending_packet->base_ptr,
+                                             pending_packet->count);
+            uint64_t end_ticks = Clock::QueryHostTickCount();
+            if (packet_timing_enabled_) {
+              PacketInfo packet_info;
+              const char* type_name = "PM4_UNKNOWN";
+              if (PacketDisassembler::DisasmPacket(
+                      memory->TranslatePhysical(pending_packet->base_ptr),
+                      &packet_info)) {
+                type_name = packet_info.type_info->name;
+              }
+              auto& timing = packet_timings_[type_name];
+              ++timing.count;
+              timing.ticks += end_ticks - start_ticks;
+            }
+            if (packet_profiling_enabled_) {
+              packet_profiles_.push_back(
+                  {reinterpret_cast<const uint8_t*>(pending_packet),
+                   start_ticks, end_ticks});
+            }
+          } else {
+            command_processor->ExecutePacket(pending_packet->base_ptr,
+                                             pending_packet->count);
+          }
           pending_packet = nullptr;
         }
+        if (saving_checkpoints) {
+          // Commands end with packets.
+          const auto& commands = checkpoint_frame->commands;
+          while (next_command < int(commands.size()) &&
+                 trace_ptr >= commands[next_command].end_ptr) {
+            int command_index = next_command++;
+            if (trace_ptr != commands[command_index].end_ptr ||
+                (command_index + 1) % FLAGS_trace_checkpoint_interval ||
+                checkpoints_.count(command_index)) {
+              continue;
+            }
+            uint32_t checkpoint = command_processor->SaveCheckpoint();
+            if (!checkpoint) {
+              saving_checkpoints = false;
+              break;
+            }
+            checkpoints_[command_index] = checkpoint;
+          }
+        }
         if (pending_break) {
           playing_trace_ = false;
           return;
@@ -170,9 +275,15 @@ void TracePlayer::PlayTraceOnThread(const uint8_t* trace_data,
       case TraceCommandType::kMemoryRead: {
         auto cmd = reinterpret_cast<const MemoryCommand*>(trace_ptr);
         trace_ptr += sizeof(*cmd);
+        // Memory already holding the data isn't written again, so that
+        // replaying a frame doesn't fire the write watches of the caches.
+        auto dest = memory->TranslatePhysical(cmd->base_ptr);
+        memory_scratch_.resize(cmd->decoded_length);
         DecompressMemory(cmd->encoding_format, trace_ptr, cmd->encoded_length,
-                         memory->TranslatePhysical(cmd->base_ptr),
-                         cmd->decoded_length);
+                         memory_scratch_.data(), cmd->decoded_length);
+        if (std::memcmp(dest, memory_scratch_.data(), cmd->decoded_length)) {
+          std::memcpy(dest, memory_scratch_.data(), cmd->decoded_length);
+        }
         trace_ptr += cmd->encoded_length;
         break;
       }
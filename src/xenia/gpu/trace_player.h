@@ -11,7 +11,9 @@
 #define XENIA_GPU_TRACE_PLAYER_H_
 
 #include <atomic>
+#include <map>
 #include <string>
+#include <vector>
 
 #include "xenia/base/threading.h"
 #include "xenia/gpu/trace_protocol.h"
@@ -48,11 +50,52 @@ class TracePlayer : public TraceReader {
 
   void WaitOnPlayback();
 
+  // Plays the whole frame again from its start, keeping the caches, and
+  // waits for it to be presented. Used to benchmark a frame.
+  void ReplayFrame(int target_frame);
+
+  // Host time spent executing the packets of each type, by the name of the
+  // type, accumulated while timing is enabled.
+  struct PacketTiming {
+    uint64_t count;
+    // In Clock::host_tick_frequency units.
+    uint64_t ticks;
+  };
+  void set_packet_timing_enabled(bool enabled) {
+    packet_timing_enabled_ = enabled;
+  }
+  const std::map<std::string, PacketTiming>& packet_timings() const {
+    return packet_timings_;
+  }
+  void ResetPacketTimings() { packet_timings_.clear(); }
+
+  // Host time span of each packet executed while profiling is enabled, in
+  // playback order. trace_ptr is the packet start command in the trace, which
+  // is within the range of a command of the frame.
+  struct PacketProfile {
+    const uint8_t* trace_ptr;
+    // Clock::QueryHostTickCount values.
+    uint64_t start_ticks;
+    uint64_t end_ticks;
+  };
+  void set_packet_profiling_enabled(bool enabled) {
+    packet_profiling_enabled_ = enabled;
+  }
+  const std::vector<PacketProfile>& packet_profiles() const {
+    return packet_profiles_;
+  }
+  void ResetPacketProfiles() { packet_profiles_.clear(); }
+
  private:
+  // If first_command isn't -1, trace_data is the start of that command of
+  // the frame, and checkpoints are taken after its commands (or resumed from
+  // if it's 0) so that seeking back doesn't replay the whole frame.
   void PlayTrace(const uint8_t* trace_data, size_t trace_size,
-                 TracePlaybackMode playback_mode, bool clear_caches);
+                 TracePlaybackMode playback_mode, bool clear_caches,
+                 int frame_index = -1, int first_command = -1);
   void PlayTraceOnThread(const uint8_t* trace_data, size_t trace_size,
-                         TracePlaybackMode playback_mode, bool clear_caches);
+                         TracePlaybackMode playback_mode, bool clear_caches,
+                         int frame_index, int first_command);
 
   xe::ui::Loop* loop_;
   GraphicsSystem* graphics_system_;
@@ -61,6 +104,16 @@ class TracePlayer : public TraceReader {
   bool playing_trace_ = false;
   std::atomic<uint32_t> playback_percent_ = {0};
   std::unique_ptr<xe::threading::Event> playback_event_;
+  bool packet_timing_enabled_ = false;
+  std::map<std::string, PacketTiming> packet_timings_;
+  bool packet_profiling_enabled_ = false;
+  std::vector<PacketProfile> packet_profiles_;
+  // Decompressed memory, compared with what guest memory already holds.
+  std::vector<uint8_t> memory_scratch_;
+  // Command processor checkpoints after the commands of the frame, by the
+  // command index. Accessed only on the command processor thread.
+  int checkpoint_frame_index_ = -1;
+  std::map<int, uint32_t> checkpoints_;
 };
 
 }  // namespace gpu
@@ -23,7 +23,7 @@ static const wchar_t kTraceExtension[] = L"xtr";
 // Other changes besides the file format may require bumps, such as
 // anything that changes what is recorded into the files (new GPU
 // command processor commands, etc).
-constexpr uint32_t kTraceFormatVersion = 1;
+constexpr uint32_t kTraceFormatVersion = 2;
 
 // Trace file header identifying information about the trace.
 // This must be positioned at the start of the file and must only occur once.
@@ -92,6 +92,10 @@ enum class MemoryEncodingFormat {
   kNone,
   // Data is compressed with third_party/snappy.
   kSnappy,
+  // Data is identical to that of an earlier memory command, and is stored as
+  // the uint64_t offset of that command from the start of the file.
+  // The referenced command is never a reference itself.
+  kReference,
 };
 
 // Represents the GPU reading or writing data from or to memory.
@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <cinttypes>
 
 #include "third_party/half/include/half.hpp"
@@ -199,6 +200,7 @@ void TraceViewer::DrawUI() {
   DrawCommandListUI();
   DrawStateUI();
   DrawPacketDisassemblerUI();
+  DrawProfileUI();
 }
 
 void TraceViewer::DrawControllerUI() {
@@ -543,6 +545,184 @@ void TraceViewer::DrawCommandListUI() {
   ImGui::End();
 }
 
+void TraceViewer::ProfileFrame(int frame_index) {
+  player_->ResetPacketProfiles();
+  player_->set_packet_profiling_enabled(true);
+  player_->ReplayFrame(frame_index);
+  player_->set_packet_profiling_enabled(false);
+
+  auto frame = player_->current_frame();
+  profiled_frame_index_ = frame_index;
+  command_profiles_.clear();
+  command_profiles_.resize(frame->commands.size());
+  for (size_t i = 0; i < command_profiles_.size(); ++i) {
+    command_profiles_[i].command_index = int(i);
+  }
+  unattributed_cpu_time_ = 0.0;
+  unattributed_gpu_time_ = 0.0;
+
+  std::vector<DrawProfile> draws;
+  gpu_times_available_ = GetDrawProfiles(&draws);
+  double us_per_tick = 1000000.0 / double(Clock::host_tick_frequency());
+
+  // Packets, draws and commands are all in playback order. A draw belongs to
+  // the packet that was executing when it was issued, which for merged draws
+  // is the packet that flushed them.
+  const auto& packets = player_->packet_profiles();
+  size_t command_index = 0;
+  size_t draw_index = 0;
+  for (const auto& packet : packets) {
+    while (command_index < frame->commands.size() &&
+           packet.trace_ptr >= frame->commands[command_index].end_ptr) {
+      ++command_index;
+    }
+    for (; draw_index < draws.size() &&
+           draws[draw_index].issue_ticks < packet.start_ticks;
+         ++draw_index) {
+      unattributed_gpu_time_ += draws[draw_index].gpu_time;
+    }
+    double cpu_time = (packet.end_ticks - packet.start_ticks) * us_per_tick;
+    if (command_index >= frame->commands.size()) {
+      unattributed_cpu_time_ += cpu_time;
+      continue;
+    }
+    auto& profile = command_profiles_[command_index];
+    profile.cpu_time += cpu_time;
+    for (; draw_index < draws.size() &&
+           draws[draw_index].issue_ticks <= packet.end_ticks;
+         ++draw_index) {
+      const auto& draw = draws[draw_index];
+      profile.gpu_time += draw.gpu_time;
+      ++profile.draw_count;
+      profile.texture_upload |= draw.texture_upload;
+      profile.pipeline_creation |= draw.pipeline_creation;
+      profile.render_pass_break |= draw.render_pass_break;
+    }
+  }
+  for (; draw_index < draws.size(); ++draw_index) {
+    unattributed_gpu_time_ += draws[draw_index].gpu_time;
+  }
+}
+
+void TraceViewer::DrawProfileUI() {
+  ImGui::SetNextWindowCollapsed(true, ImGuiSetCond_FirstUseEver);
+  ImGui::SetNextWindowPos(ImVec2(float(window_->width()) - 500 - 5, 310),
+                          ImGuiSetCond_FirstUseEver);
+  if (!ImGui::Begin("Profile", nullptr, ImVec2(500, 400))) {
+    ImGui::End();
+    return;
+  }
+
+  if (ImGui::Button("profile frame") && !player_->is_playing_trace()) {
+    ProfileFrame(player_->current_frame_index());
+  }
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip(
+        "Replay the whole frame, timing each command on the CPU and its "
+        "draws on the GPU");
+  }
+  if (profiled_frame_index_ != player_->current_frame_index()) {
+    ImGui::Text("Frame #%d not profiled", player_->current_frame_index());
+    ImGui::End();
+    return;
+  }
+
+  static ProfileSortOrder sort_order = ProfileSortOrder::kCommand;
+  ImGui::SameLine();
+  ImGui::RadioButton("order", reinterpret_cast<int*>(&sort_order),
+                     static_cast<int>(ProfileSortOrder::kCommand));
+  ImGui::SameLine();
+  ImGui::RadioButton("CPU", reinterpret_cast<int*>(&sort_order),
+                     static_cast<int>(ProfileSortOrder::kCpuTime));
+  ImGui::SameLine();
+  ImGui::RadioButton("GPU", reinterpret_cast<int*>(&sort_order),
+                     static_cast<int>(ProfileSortOrder::kGpuTime));
+
+  double total_cpu_time = unattributed_cpu_time_;
+  double total_gpu_time = unattributed_gpu_time_;
+  for (const auto& profile : command_profiles_) {
+    total_cpu_time += profile.cpu_time;
+    total_gpu_time += profile.gpu_time;
+  }
+  ImGui::Text("Total: CPU %.1fus, GPU %.1fus", total_cpu_time, total_gpu_time);
+  ImGui::Text("Outside of commands: CPU %.1fus, GPU %.1fus",
+              unattributed_cpu_time_, unattributed_gpu_time_);
+  if (!gpu_times_available_) {
+    ImGui::Text("GPU times not available from this backend");
+  }
+  ImGui::Separator();
+
+  std::vector<const CommandProfile*> profiles;
+  profiles.reserve(command_profiles_.size());
+  for (const auto& profile : command_profiles_) {
+    profiles.push_back(&profile);
+  }
+  if (sort_order == ProfileSortOrder::kCpuTime) {
+    std::stable_sort(profiles.begin(), profiles.end(),
+                     [](const CommandProfile* a, const CommandProfile* b) {
+                       return a->cpu_time > b->cpu_time;
+                     });
+  } else if (sort_order == ProfileSortOrder::kGpuTime) {
+    std::stable_sort(profiles.begin(), profiles.end(),
+                     [](const CommandProfile* a, const CommandProfile* b) {
+                       return a->gpu_time > b->gpu_time;
+                     });
+  }
+
+  ImGui::Columns(5);
+  ImGui::Text("Command");
+  ImGui::NextColumn();
+  ImGui::Text("CPU us");
+  ImGui::NextColumn();
+  ImGui::Text("GPU us");
+  ImGui::NextColumn();
+  ImGui::Text("Draws");
+  ImGui::NextColumn();
+  ImGui::Text("Flags");
+  if (ImGui::IsItemHovered()) {
+    ImGui::SetTooltip(
+        "T: texture upload, P: pipeline creation, R: render pass break");
+  }
+  ImGui::NextColumn();
+  ImGui::Separator();
+  auto frame = player_->current_frame();
+  int selected_id = -1;
+  for (const auto* profile : profiles) {
+    int command_id = profile->command_index;
+    const char* label =
+        frame->commands[command_id].type ==
+                TraceReader::Frame::Command::Type::kSwap
+            ? "Swap"
+            : "Draw";
+    char name[32];
+    std::snprintf(name, xe::countof(name), "%s %d", label, command_id);
+    bool is_selected = command_id == player_->current_command_index();
+    ImGui::PushID(command_id);
+    if (ImGui::Selectable(name, &is_selected)) {
+      selected_id = command_id;
+    }
+    ImGui::PopID();
+    ImGui::NextColumn();
+    ImGui::Text("%.1f", profile->cpu_time);
+    ImGui::NextColumn();
+    ImGui::Text("%.1f", profile->gpu_time);
+    ImGui::NextColumn();
+    ImGui::Text("%u", profile->draw_count);
+    ImGui::NextColumn();
+    ImGui::Text("%s%s%s", profile->texture_upload ? "T" : "",
+                profile->pipeline_creation ? "P" : "",
+                profile->render_pass_break ? "R" : "");
+    ImGui::NextColumn();
+  }
+  ImGui::Columns(1);
+  if (selected_id != -1 && selected_id != player_->current_command_index() &&
+      !player_->is_playing_trace()) {
+    player_->SeekCommand(selected_id);
+  }
+
+  ImGui::End();
+}
+
 TraceViewer::ShaderDisplayType TraceViewer::DrawShaderTypeUI() {
   static ShaderDisplayType shader_display_type = ShaderDisplayType::kUcode;
   ImGui::RadioButton("ucode", reinterpret_cast<int*>(&shader_display_type),
@@ -11,6 +11,7 @@
 #define XENIA_GPU_TRACE_VIEWER_H_
 
 #include <string>
+#include <vector>
 
 #include "xenia/emulator.h"
 #include "xenia/gpu/shader.h"
@@ -58,6 +59,23 @@ class TraceViewer {
   virtual size_t QueryVSOutputElementSize() { return 0; }
   virtual bool QueryVSOutput(void* buffer, size_t size) { return false; }
 
+  // A draw of the frame last replayed, as timed by the backend.
+  struct DrawProfile {
+    // Clock::QueryHostTickCount value when the draw was issued.
+    uint64_t issue_ticks;
+    // In microseconds.
+    double gpu_time;
+    // What issuing the draw caused on the host.
+    bool texture_upload;
+    bool pipeline_creation;
+    bool render_pass_break;
+  };
+  // Gets the draws of the frame last replayed in issue order, or returns
+  // false if the backend doesn't time draws.
+  virtual bool GetDrawProfiles(std::vector<DrawProfile>* profiles) {
+    return false;
+  }
+
   virtual bool Setup();
 
   std::unique_ptr<xe::ui::Loop> loop_;
@@ -74,6 +92,23 @@ class TraceViewer {
     kHostDisasm,
   };
 
+  enum class ProfileSortOrder : int {
+    kCommand,
+    kCpuTime,
+    kGpuTime,
+  };
+
+  // Cost of a command of the profiled frame, in microseconds.
+  struct CommandProfile {
+    int command_index;
+    double cpu_time;
+    double gpu_time;
+    uint32_t draw_count;
+    bool texture_upload;
+    bool pipeline_creation;
+    bool render_pass_break;
+  };
+
   bool Load(std::wstring trace_file_path);
   void Run();
 
@@ -84,6 +119,11 @@ class TraceViewer {
                                    TraceReader::CommandBuffer* buffer);
   void DrawCommandListUI();
   void DrawStateUI();
+  void DrawProfileUI();
+
+  // Replays the frame, timing the packets of each command on the host, and
+  // attributes the draws the backend timed to the commands that issued them.
+  void ProfileFrame(int frame_index);
 
   ShaderDisplayType DrawShaderTypeUI();
   void DrawShaderUI(Shader* shader, ShaderDisplayType display_type);
@@ -98,6 +138,14 @@ class TraceViewer {
   void DrawVertexFetcher(Shader* shader,
                          const Shader::VertexBinding& vertex_binding,
                          const xenos::xe_gpu_vertex_fetch_t* fetch);
+
+  int profiled_frame_index_ = -1;
+  std::vector<CommandProfile> command_profiles_;
+  bool gpu_times_available_ = false;
+  // Time spent outside of the commands, such as by draws merged until the
+  // final swap of the replay.
+  double unattributed_cpu_time_ = 0.0;
+  double unattributed_gpu_time_ = 0.0;
 };
 
 }  // namespace gpu
@@ -11,8 +11,8 @@
 
 #include <cstring>
 
-#include "third_party/snappy/snappy-sinksource.h"
 #include "third_party/snappy/snappy.h"
+#include "third_party/xxhash/xxhash.h"
 
 #include "build/version.h"
 #include "xenia/base/assert.h"
@@ -25,7 +25,7 @@ namespace gpu {
 TraceWriter::TraceWriter(uint8_t* membase)
     : membase_(membase), file_(nullptr) {}
 
-TraceWriter::~TraceWriter() = default;
+TraceWriter::~TraceWriter() { Close(); }
 
 bool TraceWriter::Open(const std::wstring& path, uint32_t title_id) {
   Close();
@@ -46,20 +46,42 @@ bool TraceWriter::Open(const std::wstring& path, uint32_t title_id) {
               sizeof(header.build_commit_sha));
   header.title_id = title_id;
   fwrite(&header, sizeof(header), 1, file_);
+  file_offset_ = sizeof(header);
 
   cached_memory_reads_.clear();
+  pending_commands_.reserve(kCommandBlockSize);
+  flush_requested_ = false;
+  exiting_ = false;
+  writer_thread_ = std::thread(&TraceWriter::WriterMain, this);
   return true;
 }
 
 void TraceWriter::Flush() {
-  if (file_) {
-    fflush(file_);
+  if (!file_) {
+    return;
   }
+  // The file is flushed once the writer thread catches up, without waiting
+  // for it here.
+  SubmitCommands();
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  flush_requested_ = true;
+  queue_cv_.notify_one();
 }
 
 void TraceWriter::Close() {
   if (file_) {
+    SubmitCommands();
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      exiting_ = true;
+      queue_cv_.notify_one();
+    }
+    writer_thread_.join();
+
     cached_memory_reads_.clear();
+    stored_memory_.clear();
+    compression_buffer_.clear();
+    compression_buffer_.shrink_to_fit();
 
     fflush(file_);
     fclose(file_);
@@ -76,7 +98,7 @@ void TraceWriter::WritePrimaryBufferStart(uint32_t base_ptr, uint32_t count) {
       base_ptr,
       0,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  WriteCommand(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WritePrimaryBufferEnd() {
@@ -86,7 +108,7 @@ void TraceWriter::WritePrimaryBufferEnd() {
   PrimaryBufferEndCommand cmd = {
       TraceCommandType::kPrimaryBufferEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  WriteCommand(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
@@ -98,7 +120,7 @@ void TraceWriter::WriteIndirectBufferStart(uint32_t base_ptr, uint32_t count) {
       base_ptr,
       0,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  WriteCommand(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteIndirectBufferEnd() {
@@ -108,7 +130,7 @@ void TraceWriter::WriteIndirectBufferEnd() {
   IndirectBufferEndCommand cmd = {
       TraceCommandType::kIndirectBufferEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  WriteCommand(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
@@ -120,8 +142,8 @@ void TraceWriter::WritePacketStart(uint32_t base_ptr, uint32_t count) {
       base_ptr,
       count,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
-  fwrite(membase_ + base_ptr, 4, count, file_);
+  WriteCommand(&cmd, sizeof(cmd));
+  WriteCommand(membase_ + base_ptr, count * 4);
 }
 
 void TraceWriter::WritePacketEnd() {
@@ -131,7 +153,7 @@ void TraceWriter::WritePacketEnd() {
   PacketEndCommand cmd = {
       TraceCommandType::kPacketEnd,
   };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
+  WriteCommand(&cmd, sizeof(cmd));
 }
 
 void TraceWriter::WriteMemoryRead(uint32_t base_ptr, size_t length) {
@@ -147,6 +169,8 @@ void TraceWriter::WriteMemoryReadCached(uint32_t base_ptr, size_t length) {
   }
 
   // HACK: length is guaranteed to be within 32-bits (guest memory)
+  // Reads of the same range with different contents are caught here only
+  // once - identical contents at other ranges are deduplicated when written.
   uint64_t key = uint64_t(base_ptr) << 32 | uint64_t(length);
   if (cached_memory_reads_.find(key) == cached_memory_reads_.end()) {
     WriteMemoryCommand(TraceCommandType::kMemoryRead, base_ptr, length);
@@ -173,63 +197,141 @@ void TraceWriter::WriteMemoryWrite(uint32_t base_ptr, size_t length) {
   WriteMemoryCommand(TraceCommandType::kMemoryWrite, base_ptr, length);
 }
 
-class SnappySink : public snappy::Sink {
- public:
-  SnappySink(FILE* file) : file_(file) {}
-
-  void Append(const char* bytes, size_t n) override {
-    fwrite(bytes, 1, n, file_);
+void TraceWriter::WriteEvent(EventCommand::Type event_type) {
+  if (!file_) {
+    return;
   }
+  EventCommand cmd = {
+      TraceCommandType::kEvent,
+      event_type,
+  };
+  WriteCommand(&cmd, sizeof(cmd));
+}
 
- private:
-  FILE* file_ = nullptr;
-};
+void TraceWriter::WriteCommand(const void* data, size_t length) {
+  auto bytes = reinterpret_cast<const uint8_t*>(data);
+  pending_commands_.insert(pending_commands_.end(), bytes, bytes + length);
+  if (pending_commands_.size() >= kCommandBlockSize) {
+    SubmitCommands();
+  }
+}
 
 void TraceWriter::WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
                                      size_t length) {
-  MemoryCommand cmd;
-  cmd.type = type;
-  cmd.base_ptr = base_ptr;
-  cmd.encoding_format = MemoryEncodingFormat::kNone;
-  cmd.encoded_length = cmd.decoded_length = static_cast<uint32_t>(length);
-
-  bool compress = compress_output_ && length > compression_threshold_;
-  if (compress) {
-    // Write the header now so we reserve space in the buffer.
-    long header_position = std::ftell(file_);
+  // Keep the commands before the memory contents in order.
+  SubmitCommands();
+
+  // Guest memory may change as soon as this returns, so the contents are
+  // copied now and encoded on the writer thread.
+  Block block;
+  block.is_memory = true;
+  block.memory_command.type = type;
+  block.memory_command.base_ptr = base_ptr;
+  block.memory_command.encoding_format = MemoryEncodingFormat::kNone;
+  block.memory_command.encoded_length = block.memory_command.decoded_length =
+      static_cast<uint32_t>(length);
+  block.data.assign(membase_ + base_ptr, membase_ + base_ptr + length);
+  Enqueue(std::move(block));
+}
+
+void TraceWriter::SubmitCommands() {
+  if (pending_commands_.empty()) {
+    return;
+  }
+  Block block;
+  block.is_memory = false;
+  block.data.swap(pending_commands_);
+  Enqueue(std::move(block));
+  pending_commands_.reserve(kCommandBlockSize);
+}
+
+void TraceWriter::Enqueue(Block block) {
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  // A block larger than the limit is still accepted once the queue is empty.
+  queue_space_cv_.wait(lock, [this, &block] {
+    return !queued_bytes_ ||
+           queued_bytes_ + block.data.size() <= kMaxQueuedBytes;
+  });
+  queued_bytes_ += block.data.size();
+  queue_.push_back(std::move(block));
+  queue_cv_.notify_one();
+}
+
+void TraceWriter::WriterMain() {
+  while (true) {
+    Block block;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cv_.wait(lock, [this] {
+        return !queue_.empty() || flush_requested_ || exiting_;
+      });
+      if (queue_.empty()) {
+        if (exiting_) {
+          break;
+        }
+        flush_requested_ = false;
+        lock.unlock();
+        fflush(file_);
+        continue;
+      }
+      block = std::move(queue_.front());
+      queue_.pop_front();
+      queued_bytes_ -= block.data.size();
+    }
+    queue_space_cv_.notify_all();
+
+    if (block.is_memory) {
+      WriteMemoryBlock(&block);
+    } else {
+      WriteFile(block.data.data(), block.data.size());
+    }
+  }
+}
+
+void TraceWriter::WriteFile(const void* data, size_t length) {
+  fwrite(data, 1, length, file_);
+  file_offset_ += length;
+}
+
+void TraceWriter::WriteMemoryBlock(Block* block) {
+  MemoryCommand& cmd = block->memory_command;
+  const uint8_t* data = block->data.data();
+  size_t length = block->data.size();
+
+  // Contents no larger than a reference are always stored as they are.
+  uint64_t hash = 0;
+  bool dedupe = length > sizeof(uint64_t);
+  if (dedupe) {
+    hash = XXH64(data, length, 0);
+    auto it = stored_memory_.find(hash);
+    if (it != stored_memory_.end() && it->second.length == length) {
+      cmd.encoding_format = MemoryEncodingFormat::kReference;
+      cmd.encoded_length = sizeof(it->second.offset);
+      WriteFile(&cmd, sizeof(cmd));
+      WriteFile(&it->second.offset, sizeof(it->second.offset));
+      return;
+    }
+  }
+
+  uint64_t offset = file_offset_;
+  if (compress_output_ && length > compression_threshold_) {
+    compression_buffer_.resize(snappy::MaxCompressedLength(length));
+    size_t compressed_length;
+    snappy::RawCompress(reinterpret_cast<const char*>(data), length,
+                        compression_buffer_.data(), &compressed_length);
     cmd.encoding_format = MemoryEncodingFormat::kSnappy;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-
-    // Stream the content right to the buffer.
-    snappy::ByteArraySource snappy_source(
-        reinterpret_cast<const char*>(membase_ + cmd.base_ptr),
-        cmd.decoded_length);
-    SnappySink snappy_sink(file_);
-    cmd.encoded_length =
-        static_cast<uint32_t>(snappy::Compress(&snappy_source, &snappy_sink));
-
-    // Seek back and overwrite the header with our final size.
-    std::fseek(file_, header_position, SEEK_SET);
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    std::fseek(file_, header_position + sizeof(cmd) + cmd.encoded_length,
-               SEEK_SET);
+    cmd.encoded_length = static_cast<uint32_t>(compressed_length);
+    WriteFile(&cmd, sizeof(cmd));
+    WriteFile(compression_buffer_.data(), compressed_length);
   } else {
     // Uncompressed - write buffer directly to the file.
     cmd.encoding_format = MemoryEncodingFormat::kNone;
-    fwrite(&cmd, 1, sizeof(cmd), file_);
-    fwrite(membase_ + cmd.base_ptr, 1, cmd.decoded_length, file_);
+    WriteFile(&cmd, sizeof(cmd));
+    WriteFile(data, length);
   }
-}
-
-void TraceWriter::WriteEvent(EventCommand::Type event_type) {
-  if (!file_) {
-    return;
+  if (dedupe) {
+    stored_memory_[hash] = {offset, length};
   }
-  EventCommand cmd = {
-      TraceCommandType::kEvent,
-      event_type,
-  };
-  fwrite(&cmd, 1, sizeof(cmd), file_);
 }
 
 }  //  namespace gpu
@@ -10,8 +10,14 @@
 #ifndef XENIA_GPU_TRACE_WRITER_H_
 #define XENIA_GPU_TRACE_WRITER_H_
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <set>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "xenia/base/filesystem.h"
 #include "xenia/gpu/trace_protocol.h"
@@ -19,6 +25,9 @@
 namespace xe {
 namespace gpu {
 
+// Writes traces from the command processor thread. Commands are copied into
+// a bounded queue and the file is written from a background thread, which also
+// compresses memory contents and stores repeated contents as references.
 class TraceWriter {
  public:
   explicit TraceWriter(uint8_t* membase);
@@ -43,13 +52,59 @@ class TraceWriter {
   void WriteEvent(EventCommand::Type event_type);
 
  private:
+  // Commands are batched into blocks up to this size before being queued.
+  static constexpr size_t kCommandBlockSize = 64 * 1024;
+  // Producers wait while this many bytes are queued, so a slow disk throttles
+  // the title instead of the queue growing without bound.
+  static constexpr size_t kMaxQueuedBytes = 64 * 1024 * 1024;
+
+  struct Block {
+    // Whether data is the contents of a memory command rather than commands
+    // to be written as they are.
+    bool is_memory;
+    MemoryCommand memory_command;
+    std::vector<uint8_t> data;
+  };
+
+  // Location of memory contents already in the file, by their hash.
+  struct StoredMemory {
+    uint64_t offset;
+    size_t length;
+  };
+
+  void WriteCommand(const void* data, size_t length);
   void WriteMemoryCommand(TraceCommandType type, uint32_t base_ptr,
                           size_t length);
+  void SubmitCommands();
+  void Enqueue(Block block);
+
+  // Writer thread.
+  void WriterMain();
+  void WriteFile(const void* data, size_t length);
+  void WriteMemoryBlock(Block* block);
 
   std::set<uint64_t> cached_memory_reads_;
   uint8_t* membase_;
   FILE* file_;
 
+  std::vector<uint8_t> pending_commands_;
+
+  std::mutex queue_mutex_;
+  // Signaled when there's work for the writer thread.
+  std::condition_variable queue_cv_;
+  // Signaled when the writer thread frees queue space.
+  std::condition_variable queue_space_cv_;
+  std::deque<Block> queue_;
+  size_t queued_bytes_ = 0;
+  bool flush_requested_ = false;
+  bool exiting_ = false;
+  std::thread writer_thread_;
+
+  // Owned by the writer thread while the file is open.
+  uint64_t file_offset_ = 0;
+  std::unordered_map<uint64_t, StoredMemory> stored_memory_;
+  std::vector<char> compression_buffer_;
+
   bool compress_output_ = true;
   size_t compression_threshold_ = 1024;  // Min. number of bytes to compress.
 };
@@ -9,6 +9,8 @@
 
 #include "xenia/gpu/vulkan/buffer_cache.h"
 
+#include <algorithm>
+
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -23,87 +25,26 @@ namespace xe {
 namespace gpu {
 namespace vulkan {
 
-#if XE_ARCH_AMD64
-void copy_cmp_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
-                                uint16_t cmp_value, size_t count) {
-  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint16_t*>(src_ptr);
-  __m128i shufmask =
-      _mm_set_epi8(0x0E, 0x0F, 0x0C, 0x0D, 0x0A, 0x0B, 0x08, 0x09, 0x06, 0x07,
-                   0x04, 0x05, 0x02, 0x03, 0x00, 0x01);
-  __m128i cmpval = _mm_set1_epi16(cmp_value);
-
-  size_t i;
-  for (i = 0; i + 8 <= count; i += 8) {
-    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    __m128i output = _mm_shuffle_epi8(input, shufmask);
-
-    __m128i mask = _mm_cmpeq_epi16(output, cmpval);
-    output = _mm_or_si128(output, mask);
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
-  }
-  for (; i < count; ++i) {  // handle residual elements
-    dest[i] = byte_swap(src[i]);
-  }
-}
-
-void copy_cmp_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
-                                uint32_t cmp_value, size_t count) {
-  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
-  __m128i shufmask =
-      _mm_set_epi8(0x0C, 0x0D, 0x0E, 0x0F, 0x08, 0x09, 0x0A, 0x0B, 0x04, 0x05,
-                   0x06, 0x07, 0x00, 0x01, 0x02, 0x03);
-  __m128i cmpval = _mm_set1_epi32(cmp_value);
-
-  size_t i;
-  for (i = 0; i + 4 <= count; i += 4) {
-    __m128i input = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[i]));
-    __m128i output = _mm_shuffle_epi8(input, shufmask);
-
-    __m128i mask = _mm_cmpeq_epi32(output, cmpval);
-    output = _mm_or_si128(output, mask);
-    _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), output);
-  }
-  for (; i < count; ++i) {  // handle residual elements
-    dest[i] = byte_swap(src[i]);
-  }
-}
-#else
-void copy_and_swap_16_unaligned(void* dest_ptr, const void* src_ptr,
-                                uint16_t cmp_value, size_t count) {
-  auto dest = reinterpret_cast<uint16_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint16_t*>(src_ptr);
-  for (size_t i = 0; i < count; ++i) {
-    uint16_t value = byte_swap(src[i]);
-    dest[i] = value == cmp_value ? 0xFFFF : value;
-  }
-}
-
-void copy_and_swap_32_unaligned(void* dest_ptr, const void* src_ptr,
-                                uint32_t cmp_value, size_t count) {
-  auto dest = reinterpret_cast<uint32_t*>(dest_ptr);
-  auto src = reinterpret_cast<const uint32_t*>(src_ptr);
-  for (size_t i = 0; i < count; ++i) {
-    uint32_t value = byte_swap(src[i]);
-    dest[i] = value == cmp_value ? 0xFFFFFFFF : value;
-  }
-}
-#endif
-
 using xe::ui::vulkan::CheckResult;
 
 constexpr VkDeviceSize kConstantRegisterUniformRange =
     512 * 4 * 4 + 8 * 4 + 32 * 4;
 
 BufferCache::BufferCache(RegisterFile* register_file, Memory* memory,
-                         ui::vulkan::VulkanDevice* device, size_t capacity)
-    : register_file_(register_file), memory_(memory), device_(device) {
+                         ui::vulkan::VulkanDevice* device,
+                         ui::vulkan::CommandBufferPool* batch_pool,
+                         size_t capacity)
+    : register_file_(register_file),
+      memory_(memory),
+      device_(device),
+      batch_pool_(batch_pool) {
   transient_buffer_ = std::make_unique<ui::vulkan::CircularBuffer>(
       device_,
       VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
-          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
       capacity, 256);
+  transient_cache_.resize(kTransientSetCount * kTransientWays);
 }
 
 BufferCache::~BufferCache() { Shutdown(); }
@@ -112,6 +53,9 @@ VkResult BufferCache::Initialize() {
   VkMemoryRequirements pool_reqs;
   transient_buffer_->GetBufferMemoryRequirements(&pool_reqs);
   gpu_memory_pool_ = device_->AllocateMemory(pool_reqs);
+  if (gpu_memory_pool_) {
+    memory_usage_.Add(pool_reqs.size);
+  }
 
   VkResult status = transient_buffer_->Initialize(gpu_memory_pool_, 0);
   if (status != VK_SUCCESS) {
@@ -144,6 +88,19 @@ VkResult BufferCache::Initialize() {
   return VK_SUCCESS;
 }
 
+void BufferCache::InitializeIndexConverter(VkBuffer guest_buffer) {
+  if (!FLAGS_vulkan_gpu_index_conversion) {
+    return;
+  }
+  index_converter_ = std::make_unique<IndexConverter>(device_);
+  VkResult status = index_converter_->Initialize(
+      transient_buffer_->gpu_buffer(), guest_buffer);
+  if (status != VK_SUCCESS) {
+    XELOGW("Failed to set up GPU index conversion, using the CPU instead");
+    index_converter_.reset();
+  }
+}
+
 VkResult xe::gpu::vulkan::BufferCache::CreateVertexDescriptorPool() {
   VkResult status;
 
@@ -305,7 +262,17 @@ void BufferCache::FreeConstantDescriptorSet() {
 }
 
 void BufferCache::Shutdown() {
+  index_converter_.reset();
+
   if (mem_allocator_) {
+    ClearCachedBuffers();
+    for (auto cached : pending_delete_buffers_) {
+      vmaDestroyBuffer(mem_allocator_, cached->buffer, cached->alloc);
+      memory_usage_.Subtract(cached->size);
+      delete cached;
+    }
+    pending_delete_buffers_.clear();
+
     vmaDestroyAllocator(mem_allocator_);
     mem_allocator_ = nullptr;
   }
@@ -315,6 +282,7 @@ void BufferCache::Shutdown() {
 
   transient_buffer_->Shutdown();
   VK_SAFE_DESTROY(vkFreeMemory, *device_, gpu_memory_pool_, nullptr);
+  memory_usage_.Set(0);
 }
 
 std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
@@ -328,6 +296,15 @@ std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
   //   uint bool[8];
   //   uint loop[32];
   // };
+  bool constants_dirty =
+      register_file_->TestAndClearDirty(RegisterFile::kDirtyShaderConstants);
+  if (!constants_dirty && last_constant_offset_ != VK_WHOLE_SIZE &&
+      last_constant_fence_ == fence) {
+    // Still visible to the shaders since the last draw.
+    return {last_constant_offset_, last_constant_offset_};
+  }
+  last_constant_offset_ = VK_WHOLE_SIZE;
+
   auto offset = AllocateTransientData(kConstantRegisterUniformRange, fence);
   if (offset == VK_WHOLE_SIZE) {
     // OOM.
@@ -365,6 +342,8 @@ std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
                        VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, nullptr, 1,
                        &barrier, 0, nullptr);
 
+  last_constant_offset_ = offset;
+  last_constant_fence_ = fence;
   return {offset, offset};
 
 // Packed upload code.
@@ -421,6 +400,40 @@ std::pair<VkDeviceSize, VkDeviceSize> BufferCache::UploadConstantRegisters(
 std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadIndexBuffer(
     VkCommandBuffer command_buffer, uint32_t source_addr,
     uint32_t source_length, IndexFormat format, VkFence fence) {
+  BufferSource source = {};
+  source.guest_address = source_addr;
+  source.length = source_length;
+  source.format = uint32_t(format);
+  source.is_index = 1;
+  source.prim_reset_enabled =
+      !!(register_file_->values[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32 & (1 << 21));
+  if (source.prim_reset_enabled) {
+    source.prim_reset_index =
+        register_file_->values[XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX].u32;
+  }
+
+  VkBuffer cached_buffer = FindCachedBuffer(command_buffer, source, fence);
+  if (cached_buffer) {
+    ++stats_.hits;
+    return {cached_buffer, 0};
+  }
+  ++stats_.misses;
+
+  if (index_converter_) {
+    // Converted a word at a time, so up to 2 bytes past the end are written.
+    auto offset =
+        AllocateTransientData(xe::round_up(source_length, 4u), fence);
+    if (offset == VK_WHOLE_SIZE ||
+        !ConvertIndicesOnGpu(command_buffer, source,
+                             IndexConverter::Mode::kConvert, 0, offset,
+                             fence)) {
+      // OOM.
+      return {nullptr, VK_WHOLE_SIZE};
+    }
+    NoteBufferUse(source);
+    return {transient_buffer_->gpu_buffer(), offset};
+  }
+
   // Allocate space in the buffer for our data.
   auto offset = AllocateTransientData(source_length, fence);
   if (offset == VK_WHOLE_SIZE) {
@@ -428,40 +441,7 @@ std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadIndexBuffer(
     return {nullptr, VK_WHOLE_SIZE};
   }
 
-  const void* source_ptr = memory_->TranslatePhysical(source_addr);
-
-  uint32_t prim_reset_index =
-      register_file_->values[XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX].u32;
-  bool prim_reset_enabled =
-      !!(register_file_->values[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32 & (1 << 21));
-
-  // Copy data into the buffer. If primitive reset is enabled, translate any
-  // primitive reset indices to something Vulkan understands.
-  // TODO(benvanik): memcpy then use compute shaders to swap?
-  if (prim_reset_enabled) {
-    if (format == IndexFormat::kInt16) {
-      // Endian::k8in16, swap half-words.
-      copy_cmp_swap_16_unaligned(
-          transient_buffer_->host_base() + offset, source_ptr,
-          static_cast<uint16_t>(prim_reset_index), source_length / 2);
-    } else if (format == IndexFormat::kInt32) {
-      // Endian::k8in32, swap words.
-      copy_cmp_swap_32_unaligned(transient_buffer_->host_base() + offset,
-                                 source_ptr, prim_reset_index,
-                                 source_length / 4);
-    }
-  } else {
-    if (format == IndexFormat::kInt16) {
-      // Endian::k8in16, swap half-words.
-      xe::copy_and_swap_16_unaligned(transient_buffer_->host_base() + offset,
-                                     source_ptr, source_length / 2);
-    } else if (format == IndexFormat::kInt32) {
-      // Endian::k8in32, swap words.
-      xe::copy_and_swap_32_unaligned(transient_buffer_->host_base() + offset,
-                                     source_ptr, source_length / 4);
-    }
-  }
-
+  CopyBufferData(source, transient_buffer_->host_base() + offset);
   transient_buffer_->Flush(offset, source_length);
 
   // Append a barrier to the command buffer.
@@ -480,17 +460,30 @@ std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadIndexBuffer(
                        VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1,
                        &barrier, 0, nullptr);
 
+  NoteBufferUse(source);
   return {transient_buffer_->gpu_buffer(), offset};
 }
 
 std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
     VkCommandBuffer command_buffer, uint32_t source_addr,
-    uint32_t source_length, Endian endian, VkFence fence) {
+    uint32_t source_length, VkFence fence) {
   auto offset = FindCachedTransientData(source_addr, source_length);
   if (offset != VK_WHOLE_SIZE) {
+    ++stats_.hits;
     return {transient_buffer_->gpu_buffer(), offset};
   }
 
+  BufferSource source = {};
+  source.guest_address = source_addr;
+  source.length = source_length;
+  source.format = uint32_t(Endian::kUnspecified);
+  VkBuffer cached_buffer = FindCachedBuffer(command_buffer, source, fence);
+  if (cached_buffer) {
+    ++stats_.hits;
+    return {cached_buffer, 0};
+  }
+  ++stats_.misses;
+
   // Slow path :)
   // Expand the region up to the allocation boundary
   auto physical_heap = memory_->GetPhysicalHeap();
@@ -514,20 +507,9 @@ std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
     return {nullptr, VK_WHOLE_SIZE};
   }
 
-  const void* upload_ptr = memory_->TranslatePhysical(upload_base);
-
   // Copy data into the buffer.
-  // TODO(benvanik): memcpy then use compute shaders to swap?
-  if (endian == Endian::k8in32) {
-    // Endian::k8in32, swap words.
-    xe::copy_and_swap_32_unaligned(transient_buffer_->host_base() + offset,
-                                   upload_ptr, source_length / 4);
-  } else if (endian == Endian::k16in32) {
-    xe::copy_and_swap_16_in_32_unaligned(
-        transient_buffer_->host_base() + offset, upload_ptr, source_length / 4);
-  } else {
-    assert_always();
-  }
+  source.guest_address = upload_base;
+  CopyBufferData(source, transient_buffer_->host_base() + offset);
 
   transient_buffer_->Flush(offset, upload_size);
 
@@ -548,52 +530,616 @@ std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadVertexBuffer(
                        &barrier, 0, nullptr);
 
   CacheTransientData(upload_base, upload_size, offset);
+  if (upload_base == source_addr && upload_size == source_length) {
+    NoteBufferUse(source);
+  }
   return {transient_buffer_->gpu_buffer(), offset + source_offset};
 }
 
-void BufferCache::HashVertexBindings(
-    XXH64_state_t* hash_state,
-    const std::vector<Shader::VertexBinding>& vertex_bindings) {
+// Writes the indices of quad_count quads, each made of 4 of the given
+// indices. The triangles keep the winding and the provoking vertex of the
+// triangle strip the geometry shader emits, and the lines outline the quads.
+template <typename T>
+static void ExpandQuadList(T* dest, const T* indices, uint32_t quad_count,
+                           bool as_lines) {
+  static const uint32_t kTriangleOrder[6] = {0, 1, 3, 1, 2, 3};
+  static const uint32_t kLineOrder[8] = {0, 1, 1, 2, 2, 3, 3, 0};
+  const uint32_t* order = as_lines ? kLineOrder : kTriangleOrder;
+  uint32_t order_count = as_lines ? 8 : 6;
+  for (uint32_t i = 0; i < quad_count; i++) {
+    const T* quad = indices ? indices + i * 4 : nullptr;
+    for (uint32_t j = 0; j < order_count; j++) {
+      *(dest++) = quad ? quad[order[j]] : T(i * 4 + order[j]);
+    }
+  }
+}
+
+std::pair<VkBuffer, VkDeviceSize> BufferCache::UploadQuadListIndexBuffer(
+    VkCommandBuffer command_buffer, uint32_t source_addr, uint32_t quad_count,
+    IndexFormat format, bool as_lines, VkFence fence) {
+  uint32_t index_count = quad_count * GetQuadListIndexCount(as_lines);
+
+  if (!source_addr) {
+    // The same for every draw, so the indices for the largest draw so far are
+    // kept.
+    CachedBuffer*& cached = quad_list_indices_[as_lines ? 1 : 0];
+    uint32_t& capacity = quad_list_capacity_[as_lines ? 1 : 0];
+    if (quad_count > capacity) {
+      uint32_t new_capacity = std::max(xe::next_pow2(quad_count), 1024u);
+      VkDeviceSize length =
+          VkDeviceSize(new_capacity) * GetQuadListIndexCount(as_lines) * 4;
+      auto offset = AllocateTransientData(length, fence);
+      if (offset == VK_WHOLE_SIZE) {
+        return {nullptr, VK_WHOLE_SIZE};
+      }
+      auto new_cached = CreateCachedBuffer(length);
+      if (!new_cached) {
+        return {nullptr, VK_WHOLE_SIZE};
+      }
+      ExpandQuadList(reinterpret_cast<uint32_t*>(
+                         transient_buffer_->host_base() + offset),
+                     static_cast<const uint32_t*>(nullptr), new_capacity,
+                     as_lines);
+      transient_buffer_->Flush(offset, length);
+      CopyTransientData(command_buffer, offset, length, new_cached->buffer);
+      if (cached) {
+        FreeCachedBuffer(cached);
+      }
+      cached = new_cached;
+      capacity = new_capacity;
+    }
+    cached->in_flight_fence = fence;
+    return {cached->buffer, 0};
+  }
+
+  // The guest indices are converted first, without primitive reset, which
+  // isn't meaningful in a list.
+  BufferSource source = {};
+  source.guest_address = source_addr;
+  source.format = uint32_t(format);
+  source.is_index = 1;
+  uint32_t index_size = format == IndexFormat::kInt32 ? 4 : 2;
+  source.length = quad_count * 4 * index_size;
+
+  VkDeviceSize length = VkDeviceSize(index_count) * index_size;
+  auto offset = AllocateTransientData(length, fence);
+  if (offset == VK_WHOLE_SIZE) {
+    // OOM.
+    return {nullptr, VK_WHOLE_SIZE};
+  }
+
+  if (index_converter_) {
+    if (!ConvertIndicesOnGpu(
+            command_buffer, source,
+            as_lines ? IndexConverter::Mode::kQuadListToLineList
+                     : IndexConverter::Mode::kQuadListToTriangleList,
+            quad_count, offset, fence)) {
+      return {nullptr, VK_WHOLE_SIZE};
+    }
+    return {transient_buffer_->gpu_buffer(), offset};
+  }
+
+  quad_list_scratch_.resize(source.length);
+  CopyBufferData(source, quad_list_scratch_.data());
+  uint8_t* dest = transient_buffer_->host_base() + offset;
+  if (format == IndexFormat::kInt32) {
+    ExpandQuadList(reinterpret_cast<uint32_t*>(dest),
+                   reinterpret_cast<const uint32_t*>(quad_list_scratch_.data()),
+                   quad_count, as_lines);
+  } else {
+    ExpandQuadList(reinterpret_cast<uint16_t*>(dest),
+                   reinterpret_cast<const uint16_t*>(quad_list_scratch_.data()),
+                   quad_count, as_lines);
+  }
+  transient_buffer_->Flush(offset, length);
+
+  // Append a barrier to the command buffer.
+  VkBufferMemoryBarrier barrier = {
+      VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      nullptr,
+      VK_ACCESS_HOST_WRITE_BIT,
+      VK_ACCESS_INDEX_READ_BIT,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_QUEUE_FAMILY_IGNORED,
+      transient_buffer_->gpu_buffer(),
+      offset,
+      length,
+  };
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, 0, 0, nullptr, 1,
+                       &barrier, 0, nullptr);
+
+  return {transient_buffer_->gpu_buffer(), offset};
+}
+
+uint64_t BufferCache::HashBufferSource(const BufferSource& source) {
+  return XXH64(&source, sizeof(source), 0);
+}
+
+void BufferCache::CopyBufferData(const BufferSource& source, void* dest) {
+  const void* source_ptr = memory_->TranslatePhysical(source.guest_address);
+  uint32_t source_length = source.length;
+
+  // TODO(benvanik): memcpy then use compute shaders to swap?
+  if (source.is_index) {
+    // If primitive reset is enabled, translate any primitive reset indices to
+    // something Vulkan understands.
+    IndexFormat format = IndexFormat(source.format);
+    if (source.prim_reset_enabled) {
+      if (format == IndexFormat::kInt16) {
+        // Endian::k8in16, swap half-words.
+        xe::copy_cmp_swap_16_unaligned(
+            dest, source_ptr, static_cast<uint16_t>(source.prim_reset_index),
+            source_length / 2);
+      } else if (format == IndexFormat::kInt32) {
+        // Endian::k8in32, swap words.
+        xe::copy_cmp_swap_32_unaligned(dest, source_ptr,
+                                       source.prim_reset_index,
+                                       source_length / 4);
+      }
+    } else {
+      if (format == IndexFormat::kInt16) {
+        // Endian::k8in16, swap half-words.
+        xe::copy_and_swap_16_unaligned(dest, source_ptr, source_length / 2);
+      } else if (format == IndexFormat::kInt32) {
+        // Endian::k8in32, swap words.
+        xe::copy_and_swap_32_unaligned(dest, source_ptr, source_length / 4);
+      }
+    }
+    return;
+  }
+
+  Endian endian = Endian(source.format);
+  if (endian == Endian::kUnspecified) {
+    std::memcpy(dest, source_ptr, source_length);
+  } else if (endian == Endian::k8in32) {
+    // Endian::k8in32, swap words.
+    xe::copy_and_swap_32_unaligned(dest, source_ptr, source_length / 4);
+  } else if (endian == Endian::k16in32) {
+    xe::copy_and_swap_16_in_32_unaligned(dest, source_ptr, source_length / 4);
+  } else {
+    assert_always();
+  }
+}
+
+VkBuffer BufferCache::FindCachedBuffer(VkCommandBuffer command_buffer,
+                                       const BufferSource& source,
+                                       VkFence fence) {
+  if (cached_buffers_.empty()) {
+    return nullptr;
+  }
+  auto it = cached_buffers_.find(HashBufferSource(source));
+  if (it == cached_buffers_.end() ||
+      std::memcmp(&it->second->source, &source, sizeof(source))) {
+    return nullptr;
+  }
+
+  CachedBuffer* cached = it->second;
+  if (cached->write_count != cached->region->write_count) {
+    if (cached->in_flight_fence == fence) {
+      // Earlier draws of this batch use the old contents, and the copy would
+      // execute before them. Upload it again in the next batch.
+      return nullptr;
+    }
+    if (frame_index_ - cached->upload_frame <= 1) {
+      // Written to every frame, not worth watching.
+      cached_buffers_.erase(it);
+      FreeCachedBuffer(cached);
+      return nullptr;
+    }
+    if (!UploadCachedBuffer(command_buffer, cached, fence)) {
+      return nullptr;
+    }
+  }
+
+  cached->in_flight_fence = fence;
+  return cached->buffer;
+}
+
+void BufferCache::NoteBufferUse(const BufferSource& source) {
+  if (FLAGS_vulkan_buffer_cache_frames <= 0) {
+    return;
+  }
+
+  uint64_t key = HashBufferSource(source);
+  if (cached_buffers_.count(key)) {
+    // Cached, but used from the transient buffer until it's uploaded again.
+    return;
+  }
+  BufferCandidate& candidate = buffer_candidates_[key];
+  if (candidate.last_frame == frame_index_) {
+    // Already seen this frame.
+    return;
+  }
+  uint64_t data_hash = XXH64(memory_->TranslatePhysical(source.guest_address),
+                             source.length, 0);
+  if (candidate.last_frame + 1 == frame_index_ &&
+      candidate.data_hash == data_hash) {
+    candidate.stable_frames++;
+  } else {
+    candidate.stable_frames = 0;
+  }
+  candidate.data_hash = data_hash;
+  candidate.last_frame = frame_index_;
+  uint32_t promote_frames = uint32_t(FLAGS_vulkan_buffer_cache_frames);
+  if (candidate.stable_frames + 1 < promote_frames) {
+    return;
+  }
+  buffer_candidates_.erase(key);
+
+  // Uploaded on its next use, by FindCachedBuffer.
+  auto cached = CreateCachedBuffer(source.length);
+  if (!cached) {
+    return;
+  }
+  cached->source = source;
+  cached->region = AcquireWatchRegion(source);
+  cached->region->buffers.push_back(cached);
+  cached->write_count = cached->region->write_count - 1;
+  cached_buffers_[key] = cached;
+  COUNT_profile_set("gpu/buffer_cache/cached_buffers", cached_buffers_.size());
+}
+
+bool BufferCache::UploadCachedBuffer(VkCommandBuffer command_buffer,
+                                     CachedBuffer* cached, VkFence fence) {
+  // Take the write count and rearm the watch before reading, so that any
+  // later write is caught.
+  WatchRegion* region = cached->region;
+  uint32_t write_count = region->write_count;
+  if (!region->access_watch_handle) {
+    region->access_watch_handle = memory_->AddPhysicalAccessWatch(
+        region->address, region->length,
+        FLAGS_deferred_write_watches ? cpu::MMIOHandler::kWatchWriteDeferred
+                                     : cpu::MMIOHandler::kWatchWrite,
+        &WatchCallback, this, region);
+  }
+
+  uint32_t length = cached->source.length;
+  if (index_converter_ && cached->source.is_index) {
+    auto offset = AllocateTransientData(xe::round_up(length, 4u), fence);
+    if (offset == VK_WHOLE_SIZE ||
+        !ConvertIndicesOnGpu(command_buffer, cached->source,
+                             IndexConverter::Mode::kConvert, 0, offset,
+                             fence)) {
+      return false;
+    }
+    CopyTransientData(command_buffer, offset, length, cached->buffer);
+  } else {
+    auto offset = AllocateTransientData(length, fence);
+    if (offset == VK_WHOLE_SIZE) {
+      return false;
+    }
+    CopyBufferData(cached->source, transient_buffer_->host_base() + offset);
+    transient_buffer_->Flush(offset, length);
+    CopyTransientData(command_buffer, offset, length, cached->buffer);
+  }
+
+  cached->write_count = write_count;
+  cached->upload_frame = frame_index_;
+  cached_upload_bytes_ += length;
+  return true;
+}
+
+bool BufferCache::ConvertIndicesOnGpu(VkCommandBuffer command_buffer,
+                                      const BufferSource& source,
+                                      IndexConverter::Mode mode,
+                                      uint32_t quad_count,
+                                      VkDeviceSize dst_offset, VkFence fence) {
+  uint32_t src_length = xe::round_up(source.length, 4u);
+  IndexConverter::Constants constants;
+  constants.dst_offset = uint32_t(dst_offset >> 2);
+  constants.count =
+      mode == IndexConverter::Mode::kConvert ? src_length >> 2 : quad_count;
+  constants.index_32bit = IndexFormat(source.format) == IndexFormat::kInt32;
+  constants.prim_reset_enabled = source.prim_reset_enabled;
+  constants.prim_reset_index = source.prim_reset_index;
+
+  // Word aligned indices are read where they are in guest memory if it's
+  // imported, the others are copied as they are first.
+  bool from_guest_buffer = index_converter_->has_guest_buffer() &&
+                           !(source.guest_address & 3) &&
+                           source.guest_address + src_length <= 0x20000000;
+  if (from_guest_buffer) {
+    constants.src_offset = source.guest_address >> 2;
+  } else {
+    auto src_offset = AllocateTransientData(src_length, fence);
+    if (src_offset == VK_WHOLE_SIZE) {
+      return false;
+    }
+    std::memcpy(transient_buffer_->host_base() + src_offset,
+                memory_->TranslatePhysical(source.guest_address),
+                source.length);
+    transient_buffer_->Flush(src_offset, source.length);
+    constants.src_offset = uint32_t(src_offset >> 2);
+
+    VkBufferMemoryBarrier barrier = {
+        VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+        nullptr,
+        VK_ACCESS_HOST_WRITE_BIT,
+        VK_ACCESS_SHADER_READ_BIT,
+        VK_QUEUE_FAMILY_IGNORED,
+        VK_QUEUE_FAMILY_IGNORED,
+        transient_buffer_->gpu_buffer(),
+        src_offset,
+        src_length,
+    };
+    vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_HOST_BIT,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr,
+                         1, &barrier, 0, nullptr);
+  }
+
+  index_converter_->Dispatch(command_buffer, mode, constants,
+                             from_guest_buffer);
+
+  VkDeviceSize dst_length =
+      mode == IndexConverter::Mode::kConvert
+          ? src_length
+          : VkDeviceSize(quad_count) *
+                GetQuadListIndexCount(
+                    mode == IndexConverter::Mode::kQuadListToLineList) *
+                (constants.index_32bit ? 4 : 2);
+  VkBufferMemoryBarrier barrier = {
+      VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      nullptr,
+      VK_ACCESS_SHADER_WRITE_BIT,
+      VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_QUEUE_FAMILY_IGNORED,
+      transient_buffer_->gpu_buffer(),
+      dst_offset,
+      dst_length,
+  };
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 0, nullptr, 1, &barrier, 0, nullptr);
+  return true;
+}
+
+BufferCache::CachedBuffer* BufferCache::CreateCachedBuffer(
+    VkDeviceSize length) {
+  VkBufferCreateInfo buffer_info = {
+      VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      nullptr,
+      0,
+      length,
+      VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+          VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      VK_SHARING_MODE_EXCLUSIVE,
+      0,
+      nullptr,
+  };
+  VmaAllocationCreateInfo alloc_create_info = {
+      0, VMA_MEMORY_USAGE_GPU_ONLY, 0, 0, 0, nullptr, nullptr,
+  };
+  VkBuffer buffer;
+  VmaAllocation alloc;
+  VkResult status = vmaCreateBuffer(mem_allocator_, &buffer_info,
+                                    &alloc_create_info, &buffer, &alloc,
+                                    nullptr);
+  if (status != VK_SUCCESS) {
+    return nullptr;
+  }
+
+  memory_usage_.Add(length);
+
+  auto cached = new CachedBuffer();
+  std::memset(&cached->source, 0, sizeof(cached->source));
+  cached->buffer = buffer;
+  cached->alloc = alloc;
+  cached->size = length;
+  cached->region = nullptr;
+  cached->write_count = 0;
+  cached->upload_frame = 0;
+  cached->in_flight_fence = nullptr;
+  return cached;
+}
+
+void BufferCache::CopyTransientData(VkCommandBuffer command_buffer,
+                                    VkDeviceSize offset, VkDeviceSize length,
+                                    VkBuffer buffer) {
+  // Wait for the staging data and for earlier batches reading the buffer.
+  VkBufferMemoryBarrier barriers[2] = {
+      {
+          VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          nullptr,
+          VK_ACCESS_HOST_WRITE_BIT,
+          VK_ACCESS_TRANSFER_READ_BIT,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          transient_buffer_->gpu_buffer(),
+          offset,
+          length,
+      },
+      {
+          VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+          nullptr,
+          0,
+          VK_ACCESS_TRANSFER_WRITE_BIT,
+          VK_QUEUE_FAMILY_IGNORED,
+          VK_QUEUE_FAMILY_IGNORED,
+          buffer,
+          0,
+          VK_WHOLE_SIZE,
+      },
+  };
+  vkCmdPipelineBarrier(command_buffer,
+                       VK_PIPELINE_STAGE_HOST_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 2,
+                       barriers, 0, nullptr);
+
+  VkBufferCopy copy = {offset, 0, length};
+  vkCmdCopyBuffer(command_buffer, transient_buffer_->gpu_buffer(), buffer, 1,
+                  &copy);
+
+  VkBufferMemoryBarrier barrier = {
+      VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      nullptr,
+      VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT,
+      VK_QUEUE_FAMILY_IGNORED,
+      VK_QUEUE_FAMILY_IGNORED,
+      buffer,
+      0,
+      VK_WHOLE_SIZE,
+  };
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+                           VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                       0, 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+void BufferCache::FreeCachedBuffer(CachedBuffer* cached) {
+  if (cached->region) {
+    ReleaseWatchRegion(cached->region, cached);
+    cached->region = nullptr;
+  }
+  pending_delete_buffers_.push_back(cached);
+  COUNT_profile_set("gpu/buffer_cache/cached_buffers", cached_buffers_.size());
+}
+
+void BufferCache::ClearCachedBuffers() {
+  for (auto it : cached_buffers_) {
+    FreeCachedBuffer(it.second);
+  }
+  cached_buffers_.clear();
+  buffer_candidates_.clear();
+  for (size_t i = 0; i < xe::countof(quad_list_indices_); i++) {
+    if (quad_list_indices_[i]) {
+      FreeCachedBuffer(quad_list_indices_[i]);
+      quad_list_indices_[i] = nullptr;
+      quad_list_capacity_[i] = 0;
+    }
+  }
+  COUNT_profile_set("gpu/buffer_cache/cached_buffers", 0);
+}
+
+BufferCache::WatchRegion* BufferCache::AcquireWatchRegion(
+    const BufferSource& source) {
+  uint32_t page_size = uint32_t(xe::memory::page_size());
+  uint32_t address = source.guest_address & ~(page_size - 1);
+  uint32_t end =
+      xe::round_up(source.guest_address + source.length, page_size);
+
+  // Find the regions overlapping the pages.
+  auto it = watch_regions_.upper_bound(address);
+  if (it != watch_regions_.begin()) {
+    auto prev = std::prev(it);
+    if (prev->second->address + prev->second->length > address) {
+      it = prev;
+    }
+  }
+  auto first = it;
+  while (it != watch_regions_.end() && it->first < end) {
+    ++it;
+  }
+  if (first != it && std::next(first) == it &&
+      first->second->address <= address &&
+      first->second->address + first->second->length >= end) {
+    return first->second;
+  }
+
+  // Merge them into one. The buffers moved over will be uploaded again, as
+  // writes to the old regions while unwatched can't be told apart.
+  auto region = new WatchRegion();
+  region->address = address;
+  region->length = end - address;
+  region->access_watch_handle = 0;
+  region->write_count = 0;
+  for (auto merged = first; merged != it; ++merged) {
+    WatchRegion* old_region = merged->second;
+    uint32_t old_end = old_region->address + old_region->length;
+    region->address = std::min(region->address, old_region->address);
+    end = std::max(end, old_end);
+    region->length = end - region->address;
+    if (old_region->access_watch_handle) {
+      memory_->CancelAccessWatch(old_region->access_watch_handle);
+      old_region->access_watch_handle = 0;
+    }
+    for (auto cached : old_region->buffers) {
+      cached->region = region;
+      cached->write_count = region->write_count - 1;
+      region->buffers.push_back(cached);
+    }
+    delete old_region;
+  }
+  watch_regions_.erase(first, it);
+  watch_regions_[region->address] = region;
+  return region;
+}
+
+void BufferCache::ReleaseWatchRegion(WatchRegion* region,
+                                     CachedBuffer* cached) {
+  auto it = std::find(region->buffers.begin(), region->buffers.end(), cached);
+  if (it != region->buffers.end()) {
+    region->buffers.erase(it);
+  }
+  if (!region->buffers.empty()) {
+    return;
+  }
+  if (region->access_watch_handle) {
+    memory_->CancelAccessWatch(region->access_watch_handle);
+    region->access_watch_handle = 0;
+  }
+  watch_regions_.erase(region->address);
+  delete region;
+}
+
+void BufferCache::WatchCallback(void* context_ptr, void* data_ptr,
+                                uint32_t address) {
+  auto region = reinterpret_cast<WatchRegion*>(data_ptr);
+  if (!region || !region->access_watch_handle) {
+    return;
+  }
+
+  // Clear watch handle first so we don't redundantly remove. The buffers in
+  // the region notice the new count when they are next used.
+  region->access_watch_handle = 0;
+  region->write_count++;
+}
+
+bool BufferCache::GetVertexSetKey(
+    const std::vector<Shader::VertexBinding>& vertex_bindings,
+    VertexSetKey* out_key, uint64_t* out_hash) const {
+  if (vertex_bindings.size() > kMaxVertexSetBindings) {
+    return false;
+  }
+  // Vertex fetch constants are two dwords each, three to a fetch group.
+  static_assert(sizeof(xe_gpu_vertex_fetch_t) == sizeof(uint64_t),
+                "Vertex fetch constants are read as 64 bits");
   auto& regs = *register_file_;
-  for (const auto& vertex_binding : vertex_bindings) {
-#if 0
-    XXH64_update(hash_state, &vertex_binding.binding_index, sizeof(vertex_binding.binding_index));
-    XXH64_update(hash_state, &vertex_binding.fetch_constant, sizeof(vertex_binding.fetch_constant));
-    XXH64_update(hash_state, &vertex_binding.stride_words, sizeof(vertex_binding.stride_words));
-#endif
+  uint64_t hash = vertex_bindings.size();
+  out_key->count = uint32_t(vertex_bindings.size());
+  for (size_t i = 0; i < vertex_bindings.size(); ++i) {
     int r = XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 +
-            (vertex_binding.fetch_constant / 3) * 6;
-    const auto group = reinterpret_cast<xe_gpu_fetch_group_t*>(&regs.values[r]);
-    switch (vertex_binding.fetch_constant % 3) {
-      case 0: {
-        auto& fetch = group->vertex_fetch_0;
-        XXH64_update(hash_state, &fetch, sizeof(fetch));
-      } break;
-      case 1: {
-        auto& fetch = group->vertex_fetch_1;
-        XXH64_update(hash_state, &fetch, sizeof(fetch));
-      } break;
-      case 2: {
-        auto& fetch = group->vertex_fetch_2;
-        XXH64_update(hash_state, &fetch, sizeof(fetch));
-      } break;
-    }
+            vertex_bindings[i].fetch_constant * 2;
+    uint64_t fetch;
+    std::memcpy(&fetch, &regs.values[r], sizeof(fetch));
+    out_key->fetches[i] = fetch;
+    hash = (hash ^ fetch) * 0x9E3779B97F4A7C15ull;
+    hash ^= hash >> 29;
   }
+  *out_hash = hash;
+  return true;
 }
 
 VkDescriptorSet BufferCache::PrepareVertexSet(
     VkCommandBuffer command_buffer, VkFence fence,
     const std::vector<Shader::VertexBinding>& vertex_bindings) {
-  // (quickly) Generate a hash.
-  XXH64_state_t hash_state;
-  XXH64_reset(&hash_state, 0);
-
-  // (quickly) Generate a hash.
-  HashVertexBindings(&hash_state, vertex_bindings);
-  uint64_t hash = XXH64_digest(&hash_state);
-  for (auto it = vertex_sets_.find(hash); it != vertex_sets_.end(); ++it) {
-    // TODO(DrChat): We need to compare the bindings and ensure they're equal.
-    return it->second;
+  VertexSetKey key;
+  uint64_t hash;
+  if (!GetVertexSetKey(vertex_bindings, &key, &hash)) {
+    return nullptr;
+  }
+  if (last_vertex_set_.set && last_vertex_set_.key == key) {
+    return last_vertex_set_.set;
+  }
+  auto it = vertex_sets_.find(hash);
+  if (it != vertex_sets_.end() && it->second.key == key) {
+    last_vertex_set_ = it->second;
+    return it->second.set;
   }
 
   if (!vertex_descriptor_pool_->has_open_batch()) {
@@ -606,8 +1152,7 @@ VkDescriptorSet BufferCache::PrepareVertexSet(
     return nullptr;
   }
 
-  // TODO(DrChat): Define magic number 32 as a constant somewhere.
-  VkDescriptorBufferInfo buffer_infos[32] = {};
+  VkDescriptorBufferInfo buffer_infos[kMaxVertexSetBindings] = {};
   VkWriteDescriptorSet descriptor_write = {
       VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
       nullptr,
@@ -654,9 +1199,8 @@ VkDescriptorSet BufferCache::PrepareVertexSet(
     // trace_writer_.WriteMemoryRead(physical_address, source_length);
 
     // Upload (or get a cached copy of) the buffer.
-    auto buffer_ref =
-        UploadVertexBuffer(command_buffer, physical_address, source_length,
-                           static_cast<Endian>(fetch->endian), fence);
+    auto buffer_ref = UploadVertexBuffer(command_buffer, physical_address,
+                                         source_length, fence);
     if (buffer_ref.second == VK_WHOLE_SIZE) {
       // Failed to upload buffer.
       XELOGW("Failed to upload vertex buffer!");
@@ -672,7 +1216,11 @@ VkDescriptorSet BufferCache::PrepareVertexSet(
   }
 
   vkUpdateDescriptorSets(*device_, 1, &descriptor_write, 0, nullptr);
-  vertex_sets_[hash] = set;
+  // A set of other bindings with the same hash is replaced, not reused.
+  auto& vertex_set = vertex_sets_[hash];
+  vertex_set.key = key;
+  vertex_set.set = set;
+  last_vertex_set_ = vertex_set;
   return set;
 }
 
@@ -706,40 +1254,56 @@ VkDeviceSize BufferCache::TryAllocateTransientData(VkDeviceSize length,
 
 VkDeviceSize BufferCache::FindCachedTransientData(uint32_t guest_address,
                                                   uint32_t guest_length) {
-  if (transient_cache_.empty()) {
-    // Short-circuit exit.
-    return VK_WHOLE_SIZE;
-  }
-
-  // Find the first element > guest_address
-  auto it = transient_cache_.upper_bound(guest_address);
-  if (it != transient_cache_.begin()) {
-    // it = first element <= guest_address
-    --it;
-
-    if ((it->first + it->second.first) >= (guest_address + guest_length)) {
+  // Ranges are in the sets of every page they cover, so the page of the
+  // start has any range containing this one.
+  uint32_t page = guest_address >> kTransientPageShift;
+  TransientEntry* set =
+      &transient_cache_[(page % kTransientSetCount) * kTransientWays];
+  uint64_t guest_end = uint64_t(guest_address) + guest_length;
+  for (uint32_t i = 0; i < kTransientWays; ++i) {
+    const TransientEntry& entry = set[i];
+    if (entry.generation == transient_generation_ &&
+        entry.guest_address <= guest_address &&
+        uint64_t(entry.guest_address) + entry.guest_length >= guest_end) {
       // This data is contained within some existing transient data.
-      auto source_offset = static_cast<VkDeviceSize>(guest_address - it->first);
-      return it->second.second + source_offset;
+      return entry.offset + (guest_address - entry.guest_address);
     }
   }
-
   return VK_WHOLE_SIZE;
 }
 
 void BufferCache::CacheTransientData(uint32_t guest_address,
                                      uint32_t guest_length,
                                      VkDeviceSize offset) {
-  transient_cache_[guest_address] = {guest_length, offset};
-
-  // Erase any entries contained within
-  auto it = transient_cache_.upper_bound(guest_address);
-  while (it != transient_cache_.end()) {
-    if ((guest_address + guest_length) >= (it->first + it->second.first)) {
-      it = transient_cache_.erase(it);
-    } else {
-      break;
+  uint32_t first_page = guest_address >> kTransientPageShift;
+  uint32_t last_page =
+      (guest_address + std::max(guest_length, 1u) - 1) >> kTransientPageShift;
+  // Lookups in the pages past the limit just miss.
+  last_page = std::min(last_page, first_page + kTransientMaxPages - 1);
+  for (uint32_t page = first_page; page <= last_page; ++page) {
+    TransientEntry* set =
+        &transient_cache_[(page % kTransientSetCount) * kTransientWays];
+    // Take a free way, else the least recently added one.
+    uint32_t way = kTransientWays - 1;
+    for (uint32_t i = 0; i < kTransientWays; ++i) {
+      if (set[i].generation != transient_generation_) {
+        way = i;
+        break;
+      }
     }
+    for (; way > 0; --way) {
+      set[way] = set[way - 1];
+    }
+    set[0] = {transient_generation_, guest_address, guest_length, offset};
+  }
+}
+
+void BufferCache::ForgetTransientData() {
+  if (++transient_generation_ == 0) {
+    // Wrapped around, the generations in the table are ambiguous now.
+    std::memset(transient_cache_.data(), 0,
+                transient_cache_.size() * sizeof(TransientEntry));
+    transient_generation_ = 1;
   }
 }
 
@@ -767,25 +1331,64 @@ void BufferCache::Flush(VkCommandBuffer command_buffer) {
 void BufferCache::InvalidateCache() {
   // Called by VulkanCommandProcessor::MakeCoherent()
   // Discard everything?
-  transient_cache_.clear();
+  ForgetTransientData();
 }
 
-void BufferCache::ClearCache() { transient_cache_.clear(); }
+void BufferCache::ClearCache() {
+  ForgetTransientData();
+  last_constant_offset_ = VK_WHOLE_SIZE;
+  ClearCachedBuffers();
+}
 
 void BufferCache::Scavenge() {
   SCOPE_profile_cpu_f("gpu");
 
-  transient_cache_.clear();
+  ForgetTransientData();
   transient_buffer_->Scavenge();
+  // Descriptors are bound to the transient buffer, so it can't grow, but how
+  // close it has come to filling up is worth knowing when sizing it.
+  COUNT_profile_set("gpu/buffer_cache/transient_high_water_bytes",
+                    transient_buffer_->high_water_mark());
+  // The fence may be reused by a later batch.
+  last_constant_offset_ = VK_WHOLE_SIZE;
 
   // TODO(DrChat): These could persist across frames, we just need a smart way
   // to delete unused ones.
   vertex_sets_.clear();
+  last_vertex_set_ = {};
   if (vertex_descriptor_pool_->has_open_batch()) {
     vertex_descriptor_pool_->EndBatch();
   }
 
   vertex_descriptor_pool_->Scavenge();
+
+  // Forget the data that wasn't used in the last frame, and destroy the
+  // buffers the GPU is done with.
+  ++frame_index_;
+  for (auto it = buffer_candidates_.begin(); it != buffer_candidates_.end();) {
+    if (it->second.last_frame + 1 < frame_index_) {
+      it = buffer_candidates_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  for (auto it = pending_delete_buffers_.begin();
+       it != pending_delete_buffers_.end();) {
+    CachedBuffer* cached = *it;
+    if (cached->in_flight_fence &&
+        !batch_pool_->IsFenceSignaled(cached->in_flight_fence)) {
+      ++it;
+      continue;
+    }
+    vmaDestroyBuffer(mem_allocator_, cached->buffer, cached->alloc);
+    memory_usage_.Subtract(cached->size);
+    delete cached;
+    it = pending_delete_buffers_.erase(it);
+  }
+
+  COUNT_profile_set("gpu/buffer_cache/cached_upload_bytes",
+                    cached_upload_bytes_);
+  cached_upload_bytes_ = 0;
 }
 
 }  // namespace vulkan
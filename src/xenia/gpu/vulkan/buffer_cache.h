@@ -10,8 +10,10 @@
 #ifndef XENIA_GPU_VULKAN_BUFFER_CACHE_H_
 #define XENIA_GPU_VULKAN_BUFFER_CACHE_H_
 
+#include "xenia/base/memory_usage.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/shader.h"
+#include "xenia/gpu/vulkan/index_converter.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/memory.h"
 #include "xenia/ui/vulkan/circular_buffer.h"
@@ -22,8 +24,13 @@
 #include "third_party/vulkan/vk_mem_alloc.h"
 #include "third_party/xxhash/xxhash.h"
 
+#include <atomic>
+#include <cstring>
+#include <list>
 #include <map>
+#include <memory>
 #include <unordered_map>
+#include <vector>
 
 namespace xe {
 namespace gpu {
@@ -35,12 +42,19 @@ namespace vulkan {
 class BufferCache {
  public:
   BufferCache(RegisterFile* register_file, Memory* memory,
-              ui::vulkan::VulkanDevice* device, size_t capacity);
+              ui::vulkan::VulkanDevice* device,
+              ui::vulkan::CommandBufferPool* batch_pool, size_t capacity);
   ~BufferCache();
 
   VkResult Initialize();
   void Shutdown();
 
+  // Sets up the conversion of indices with compute shaders if
+  // --vulkan_gpu_index_conversion is set, reading them straight from
+  // guest_buffer, all of guest physical memory imported as a storage buffer,
+  // when not null. The CPU converts them if this isn't called or fails.
+  void InitializeIndexConverter(VkBuffer guest_buffer);
+
   // Descriptor set containing the dynamic uniform buffer used for constant
   // uploads. Used in conjunction with a dynamic offset returned by
   // UploadConstantRegisters.
@@ -65,7 +79,8 @@ class BufferCache {
   // The registers are tightly packed in order as [floats, ints, bools].
   // Returns an offset that can be used with the transient_descriptor_set or
   // VK_WHOLE_SIZE if the constants could not be uploaded (OOM).
-  // The returned offsets may alias.
+  // The returned offsets may alias. If no constant register has been written
+  // since the last upload for the same fence, that upload is reused.
   std::pair<VkDeviceSize, VkDeviceSize> UploadConstantRegisters(
       VkCommandBuffer command_buffer,
       const Shader::ConstantRegisterMap& vertex_constant_register_map,
@@ -81,12 +96,28 @@ class BufferCache {
       uint32_t source_length, IndexFormat format, VkFence fence);
 
   // Uploads vertex buffer data from guest memory, possibly eliding with
-  // recently uploaded data or cached copies.
+  // recently uploaded data or cached copies. The data is copied as is, the
+  // vertex shaders swap it as they fetch it.
   // Returns a buffer and offset that can be used with vkCmdBindVertexBuffers.
   // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
   std::pair<VkBuffer, VkDeviceSize> UploadVertexBuffer(
       VkCommandBuffer command_buffer, uint32_t source_addr,
-      uint32_t source_length, Endian endian, VkFence fence);
+      uint32_t source_length, VkFence fence);
+
+  // Generates the indices drawing a quad list as a triangle list, or as a
+  // line list if as_lines is set, from the guest indices at source_addr, or
+  // if source_addr is 0 from consecutive vertices. Generated indices for
+  // consecutive vertices are 32-bit and reused across draws, the others are
+  // in the guest format.
+  // Returns a buffer and offset that can be used with vkCmdBindIndexBuffer.
+  // Size will be VK_WHOLE_SIZE if the data could not be uploaded (OOM).
+  std::pair<VkBuffer, VkDeviceSize> UploadQuadListIndexBuffer(
+      VkCommandBuffer command_buffer, uint32_t source_addr,
+      uint32_t quad_count, IndexFormat format, bool as_lines, VkFence fence);
+  // Indices per quad in UploadQuadListIndexBuffer.
+  static uint32_t GetQuadListIndexCount(bool as_lines) {
+    return as_lines ? 8 : 6;
+  }
 
   // Prepares and returns a vertex descriptor set.
   VkDescriptorSet PrepareVertexSet(
@@ -110,6 +141,16 @@ class BufferCache {
   // Wipes all data no longer needed.
   void Scavenge();
 
+  // Index and vertex buffer uploads since the stats were last reset, for
+  // benchmarks. Hits reuse data uploaded before, this frame or into a cached
+  // buffer.
+  struct Stats {
+    uint64_t hits;
+    uint64_t misses;
+  };
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = {}; }
+
  private:
   // This represents an uploaded vertex buffer.
   struct VertexBuffer {
@@ -120,15 +161,82 @@ class BufferCache {
     VmaAllocationInfo alloc_info;
   };
 
+  // Where cached data comes from and how it is converted. Zero initialized so
+  // that it can be hashed and compared as a whole.
+  struct BufferSource {
+    uint32_t guest_address;
+    uint32_t length;
+    // IndexFormat for index data, Endian for vertex data.
+    uint32_t format;
+    uint32_t is_index : 1;
+    uint32_t prim_reset_enabled : 1;
+    uint32_t : 30;
+    uint32_t prim_reset_index;
+  };
+
+  struct WatchRegion;
+
+  // Guest data kept in a device local buffer across frames. It is only
+  // uploaded again when the guest writes to the memory it came from.
+  struct CachedBuffer {
+    BufferSource source;
+    VkBuffer buffer;
+    VmaAllocation alloc;
+    VkDeviceSize size;
+    WatchRegion* region;
+    // Region write count the contents were read at.
+    uint32_t write_count;
+    uint32_t upload_frame;
+    VkFence in_flight_fence;
+  };
+
+  // Pages under a single write watch, shared by all the cached buffers on
+  // them: rearming the watch of one buffer would otherwise fire the watch of
+  // any other buffer on the same page.
+  struct WatchRegion {
+    uint32_t address;
+    uint32_t length;
+    uintptr_t access_watch_handle;
+    // Incremented whenever the guest writes to the region.
+    std::atomic<uint32_t> write_count;
+    std::vector<CachedBuffer*> buffers;
+  };
+
+  // Guest data not cached yet, with the hash of it the last frame it was
+  // used in.
+  struct BufferCandidate {
+    uint64_t data_hash;
+    uint32_t last_frame;
+    uint32_t stable_frames;
+  };
+
   VkResult CreateVertexDescriptorPool();
   void FreeVertexDescriptorPool();
 
   VkResult CreateConstantDescriptorSet();
   void FreeConstantDescriptorSet();
 
-  void HashVertexBindings(
-      XXH64_state_t* hash_state,
-      const std::vector<Shader::VertexBinding>& vertex_bindings);
+  // Most vertex buffers bound to a descriptor set.
+  static const uint32_t kMaxVertexSetBindings = 32;
+  // The vertex fetch constants of the bindings, in order, which are all that
+  // determines the contents of a set.
+  struct VertexSetKey {
+    uint32_t count;
+    uint64_t fetches[kMaxVertexSetBindings];
+
+    bool operator==(const VertexSetKey& other) const {
+      return count == other.count &&
+             !std::memcmp(fetches, other.fetches, count * sizeof(uint64_t));
+    }
+  };
+  struct VertexSet {
+    VertexSetKey key;
+    VkDescriptorSet set;
+  };
+  // False if there are more bindings than a set holds.
+  bool GetVertexSetKey(
+      const std::vector<Shader::VertexBinding>& vertex_bindings,
+      VertexSetKey* out_key, uint64_t* out_hash) const;
 
   // Allocates a block of memory in the transient buffer.
   // When memory is not available fences are checked and space is reclaimed.
@@ -144,25 +252,112 @@ class BufferCache {
   // Adds a block of data to the frame cache.
   void CacheTransientData(uint32_t guest_address, uint32_t guest_length,
                           VkDeviceSize offset);
+  // Empties the frame cache.
+  void ForgetTransientData();
+
+  static uint64_t HashBufferSource(const BufferSource& source);
+  // Copies guest data into dest, converting it as described by source.
+  void CopyBufferData(const BufferSource& source, void* dest);
+  // Returns the cached buffer holding the data, uploading it again if it has
+  // been written to, or nullptr if the data must be uploaded as transient.
+  VkBuffer FindCachedBuffer(VkCommandBuffer command_buffer,
+                            const BufferSource& source, VkFence fence);
+  // Counts the frames the data is used unchanged in, and caches it once
+  // that reaches --vulkan_buffer_cache_frames.
+  void NoteBufferUse(const BufferSource& source);
+  bool UploadCachedBuffer(VkCommandBuffer command_buffer,
+                          CachedBuffer* cached, VkFence fence);
+  // Records the conversion of the guest indices of source into the transient
+  // buffer at dst_offset with index_converter_, for quad_count quads unless
+  // mode is kConvert, and the barrier making them readable as indices or by
+  // a copy. False if the guest indices couldn't be staged (OOM).
+  bool ConvertIndicesOnGpu(VkCommandBuffer command_buffer,
+                           const BufferSource& source,
+                           IndexConverter::Mode mode, uint32_t quad_count,
+                           VkDeviceSize dst_offset, VkFence fence);
+  // Records the copy of transient data into a device local buffer, after any
+  // earlier batch reading it.
+  void CopyTransientData(VkCommandBuffer command_buffer, VkDeviceSize offset,
+                         VkDeviceSize length, VkBuffer buffer);
+  // Creates a device local buffer, with its source zeroed.
+  CachedBuffer* CreateCachedBuffer(VkDeviceSize length);
+  void FreeCachedBuffer(CachedBuffer* cached);
+  void ClearCachedBuffers();
+  // Returns a region covering the pages of the data, merging any regions it
+  // overlaps.
+  WatchRegion* AcquireWatchRegion(const BufferSource& source);
+  void ReleaseWatchRegion(WatchRegion* region, CachedBuffer* cached);
+  static void WatchCallback(void* context_ptr, void* data_ptr,
+                            uint32_t address);
 
   RegisterFile* register_file_ = nullptr;
   Memory* memory_ = nullptr;
   ui::vulkan::VulkanDevice* device_ = nullptr;
+  // Command processor batches, whose serials retire the buffers in flight.
+  ui::vulkan::CommandBufferPool* batch_pool_ = nullptr;
 
   VkDeviceMemory gpu_memory_pool_ = nullptr;
   VmaAllocator mem_allocator_ = nullptr;
+  // The transient pool and the cached buffers.
+  MemoryUsageCounter memory_usage_{"gpu/buffer_cache"};
 
   // Staging ringbuffer we cycle through fast. Used for data we don't
   // plan on keeping past the current frame.
   std::unique_ptr<ui::vulkan::CircularBuffer> transient_buffer_ = nullptr;
-  std::map<uint32_t, std::pair<uint32_t, VkDeviceSize>> transient_cache_;
+  // Transient data of the current frame by guest range, in a set associative
+  // table indexed by each of the (up to kTransientMaxPages) guest pages the
+  // range covers. Entries of older generations are free, so advancing
+  // transient_generation_ forgets everything without touching the table.
+  static const uint32_t kTransientPageShift = 16;
+  static const uint32_t kTransientMaxPages = 16;
+  static const uint32_t kTransientSetCount = 1024;
+  static const uint32_t kTransientWays = 4;
+  struct TransientEntry {
+    uint32_t generation;
+    uint32_t guest_address;
+    uint32_t guest_length;
+    VkDeviceSize offset;
+  };
+  std::vector<TransientEntry> transient_cache_;
+  uint32_t transient_generation_ = 1;
+
+  // Persistent tier, keyed by HashBufferSource.
+  std::unordered_map<uint64_t, CachedBuffer*> cached_buffers_;
+  std::unordered_map<uint64_t, BufferCandidate> buffer_candidates_;
+  // Regions by guest address. They never overlap.
+  std::map<uint32_t, WatchRegion*> watch_regions_;
+  // Buffers waiting for their fence before being destroyed.
+  std::list<CachedBuffer*> pending_delete_buffers_;
+  // Incremented on every Scavenge, starting at 1 so that a new candidate is
+  // never seen in the current frame.
+  uint32_t frame_index_ = 1;
+
+  // The last constant upload, valid while no constants are written and the
+  // batch is the same.
+  VkDeviceSize last_constant_offset_ = VK_WHOLE_SIZE;
+  VkFence last_constant_fence_ = nullptr;
+  uint64_t cached_upload_bytes_ = 0;
+
+  // Indices for quad lists of consecutive vertices as triangles and as lines,
+  // for up to quad_list_capacity_ quads.
+  CachedBuffer* quad_list_indices_[2] = {};
+  uint32_t quad_list_capacity_[2] = {};
+  // Guest indices of quad lists converted to host order.
+  std::vector<uint8_t> quad_list_scratch_;
+
+  // Null when the CPU converts the indices.
+  std::unique_ptr<IndexConverter> index_converter_;
 
   // Vertex buffer descriptors
   std::unique_ptr<ui::vulkan::DescriptorPool> vertex_descriptor_pool_ = nullptr;
   VkDescriptorSetLayout vertex_descriptor_set_layout_ = nullptr;
 
-  // Current frame vertex sets.
-  std::unordered_map<uint64_t, VkDescriptorSet> vertex_sets_;
+  // Current frame vertex sets, and the last one prepared, which consecutive
+  // draws often use again.
+  std::unordered_map<uint64_t, VertexSet> vertex_sets_;
+  VertexSet last_vertex_set_ = {};
+
+  Stats stats_ = {};
 
   // Descriptor set used to hold vertex/pixel shader float constants
   VkDescriptorPool constant_descriptor_pool_ = nullptr;
@@ -0,0 +1,111 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/draw_timer.h"
+
+#include "xenia/base/clock.h"
+#include "xenia/base/logging.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using xe::ui::vulkan::CheckResult;
+
+constexpr uint32_t DrawTimer::kMaxDraws;
+
+DrawTimer::DrawTimer(ui::vulkan::VulkanDevice* device) : device_(device) {}
+
+DrawTimer::~DrawTimer() { Shutdown(); }
+
+VkResult DrawTimer::Initialize() {
+  const auto& device_info = device_->device_info();
+  uint32_t valid_bits =
+      device_info.queue_family_properties[device_->queue_family_index()]
+          .timestampValidBits;
+  if (!valid_bits) {
+    XELOGW("Vulkan queue doesn't support timestamps, draws won't be timed");
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+  timestamp_mask_ = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+  timestamp_period_ = device_info.properties.limits.timestampPeriod / 1000.0;
+
+  VkQueryPoolCreateInfo pool_info;
+  pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = 0;
+  pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  pool_info.queryCount = kMaxDraws * 2;
+  pool_info.pipelineStatistics = 0;
+  VkResult status =
+      vkCreateQueryPool(*device_, &pool_info, nullptr, &query_pool_);
+  CheckResult(status, "vkCreateQueryPool");
+  if (status != VK_SUCCESS) {
+    query_pool_ = nullptr;
+  }
+  return status;
+}
+
+void DrawTimer::Shutdown() {
+  VK_SAFE_DESTROY(vkDestroyQueryPool, *device_, query_pool_, nullptr);
+}
+
+void DrawTimer::BeginFrame(VkCommandBuffer setup_buffer) {
+  vkCmdResetQueryPool(setup_buffer, query_pool_, 0, kMaxDraws * 2);
+  draw_count_ = 0;
+  draw_issue_ticks_.clear();
+  draw_flags_.clear();
+}
+
+void DrawTimer::BeginDraw(VkCommandBuffer command_buffer, uint32_t flags) {
+  if (draw_count_ >= kMaxDraws) {
+    return;
+  }
+  draw_issue_ticks_.push_back(Clock::QueryHostTickCount());
+  draw_flags_.push_back(flags);
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                      query_pool_, draw_count_ * 2);
+}
+
+void DrawTimer::EndDraw(VkCommandBuffer command_buffer) {
+  if (draw_count_ >= kMaxDraws) {
+    return;
+  }
+  vkCmdWriteTimestamp(command_buffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      query_pool_, draw_count_ * 2 + 1);
+  ++draw_count_;
+}
+
+void DrawTimer::EndFrame() {
+  draw_times_.clear();
+  if (!draw_count_) {
+    return;
+  }
+  std::vector<uint64_t> timestamps(draw_count_ * 2);
+  VkResult status = vkGetQueryPoolResults(
+      *device_, query_pool_, 0, draw_count_ * 2,
+      timestamps.size() * sizeof(uint64_t), timestamps.data(),
+      sizeof(uint64_t), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+  CheckResult(status, "vkGetQueryPoolResults");
+  if (status != VK_SUCCESS) {
+    return;
+  }
+  draw_times_.reserve(draw_count_);
+  for (uint32_t i = 0; i < draw_count_; ++i) {
+    uint64_t ticks =
+        (timestamps[i * 2 + 1] - timestamps[i * 2]) & timestamp_mask_;
+    draw_times_.push_back(ticks * timestamp_period_);
+  }
+  draw_count_ = 0;
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
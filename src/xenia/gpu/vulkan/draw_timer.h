@@ -0,0 +1,81 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_DRAW_TIMER_H_
+#define XENIA_GPU_VULKAN_DRAW_TIMER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Measures the GPU time of each draw of a frame with timestamp queries, for
+// benchmarking. Reading the times back waits for the frame to complete, so
+// frames don't overlap while it's used. The host time each draw was issued
+// at and what it caused to be created are kept along with it, for the trace
+// viewer to attribute the draws to the commands of the trace.
+class DrawTimer {
+ public:
+  // Work done on the host to issue a draw.
+  enum DrawFlags : uint32_t {
+    kDrawTextureUpload = 1 << 0,
+    kDrawPipelineCreation = 1 << 1,
+    kDrawRenderPassBreak = 1 << 2,
+  };
+
+  explicit DrawTimer(ui::vulkan::VulkanDevice* device);
+  ~DrawTimer();
+
+  VkResult Initialize();
+  void Shutdown();
+
+  // Resets the queries in the setup buffer of a new frame.
+  void BeginFrame(VkCommandBuffer setup_buffer);
+  // Called around each draw. Only the first kMaxDraws draws are timed.
+  void BeginDraw(VkCommandBuffer command_buffer, uint32_t flags);
+  void EndDraw(VkCommandBuffer command_buffer);
+  // Waits for the frame, which must have been submitted, and reads the times
+  // of its draws.
+  void EndFrame();
+
+  // GPU time in microseconds of each draw of the last frame ended.
+  const std::vector<double>& draw_times() const { return draw_times_; }
+  // Host tick count (Clock::QueryHostTickCount) each draw of the frame was
+  // issued at, and its DrawFlags. Valid until the next frame begins.
+  const std::vector<uint64_t>& draw_issue_ticks() const {
+    return draw_issue_ticks_;
+  }
+  const std::vector<uint32_t>& draw_flags() const { return draw_flags_; }
+
+ private:
+  static constexpr uint32_t kMaxDraws = 4096;
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+
+  VkQueryPool query_pool_ = nullptr;
+  // Mask of the valid bits of the timestamps, and microseconds per tick.
+  uint64_t timestamp_mask_ = 0;
+  double timestamp_period_ = 0.0;
+
+  uint32_t draw_count_ = 0;
+  std::vector<double> draw_times_;
+  std::vector<uint64_t> draw_issue_ticks_;
+  std::vector<uint32_t> draw_flags_;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_DRAW_TIMER_H_
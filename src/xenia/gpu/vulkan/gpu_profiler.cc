@@ -0,0 +1,172 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/gpu_profiler.h"
+
+#include <algorithm>
+
+#include "xenia/base/logging.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using xe::ui::vulkan::CheckResult;
+
+constexpr uint32_t GpuProfiler::kFrameCount;
+constexpr uint32_t GpuProfiler::kQueriesPerFrame;
+
+GpuProfiler::GpuProfiler(ui::vulkan::VulkanDevice* device) : device_(device) {}
+
+GpuProfiler::~GpuProfiler() { Shutdown(); }
+
+VkResult GpuProfiler::Initialize() {
+  const auto& device_info = device_->device_info();
+  uint32_t valid_bits =
+      device_info.queue_family_properties[device_->queue_family_index()]
+          .timestampValidBits;
+  if (!valid_bits) {
+    XELOGW("Vulkan queue doesn't support timestamps, GPU scopes won't be "
+           "timed");
+    return VK_ERROR_FEATURE_NOT_PRESENT;
+  }
+  timestamp_mask_ = valid_bits >= 64 ? UINT64_MAX : (1ull << valid_bits) - 1;
+  ticks_per_second_ = uint64_t(
+      1000000000.0 / double(device_info.properties.limits.timestampPeriod));
+
+  VkQueryPoolCreateInfo pool_info;
+  pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = 0;
+  pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+  pool_info.queryCount = kFrameCount * kQueriesPerFrame;
+  pool_info.pipelineStatistics = 0;
+  VkResult status =
+      vkCreateQueryPool(*device_, &pool_info, nullptr, &query_pool_);
+  CheckResult(status, "vkCreateQueryPool");
+  if (status != VK_SUCCESS) {
+    query_pool_ = nullptr;
+    return status;
+  }
+
+  results_.assign(kFrameCount * kQueriesPerFrame, UINT64_MAX);
+  Profiler::SetGpuTimestampProvider(this);
+  return VK_SUCCESS;
+}
+
+void GpuProfiler::Shutdown() {
+  if (query_pool_) {
+    Profiler::SetGpuTimestampProvider(nullptr);
+  }
+  VK_SAFE_DESTROY(vkDestroyQueryPool, *device_, query_pool_, nullptr);
+}
+
+void GpuProfiler::BeginFrame(VkCommandBuffer setup_buffer,
+                             VkCommandBuffer command_buffer) {
+  setup_buffer_ = setup_buffer;
+  command_buffer_ = command_buffer;
+  Profiler::SetGpuContext(command_buffer);
+  if (range_pending_) {
+    BeginRange();
+  }
+}
+
+void GpuProfiler::EndFrame() {
+  Profiler::SetGpuContext(nullptr);
+  setup_buffer_ = nullptr;
+  command_buffer_ = nullptr;
+}
+
+uint32_t GpuProfiler::InsertTimestamp(void* context) {
+  if (!context || range_pending_) {
+    return UINT32_MAX;
+  }
+  uint32_t frame_index = uint32_t(frame_ % kFrameCount);
+  uint32_t& count = query_counts_[frame_index];
+  if (count >= kQueriesPerFrame) {
+    return UINT32_MAX;
+  }
+  uint32_t index = frame_index * kQueriesPerFrame + count++;
+  vkCmdWriteTimestamp(reinterpret_cast<VkCommandBuffer>(context),
+                      VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool_,
+                      index);
+  return index;
+}
+
+uint32_t GpuProfiler::Flip() {
+  ++frame_;
+  if (frame_ > Profiler::kGpuFrameDelay) {
+    ReadResults(uint32_t((frame_ - Profiler::kGpuFrameDelay - 1) %
+                         kFrameCount));
+  }
+
+  // The range of the new frame was last read at the previous flip. Its start
+  // is the first query, written when the range is reset.
+  uint32_t frame_index = uint32_t(frame_ % kFrameCount);
+  range_reset_[frame_index] = false;
+  range_pending_ = true;
+  if (setup_buffer_) {
+    BeginRange();
+  }
+  return frame_index * kQueriesPerFrame;
+}
+
+uint64_t GpuProfiler::GetTimestamp(uint32_t index) {
+  return index < results_.size() ? results_[index] : UINT64_MAX;
+}
+
+void GpuProfiler::BeginRange() {
+  uint32_t frame_index = uint32_t(frame_ % kFrameCount);
+  uint32_t first_query = frame_index * kQueriesPerFrame;
+  // Commands already recorded into the command buffer belong to the previous
+  // frame, and the setup buffer is executed before it.
+  vkCmdResetQueryPool(setup_buffer_, query_pool_, first_query,
+                      kQueriesPerFrame);
+  vkCmdWriteTimestamp(command_buffer_, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                      query_pool_, first_query);
+  query_counts_[frame_index] = 1;
+  range_reset_[frame_index] = true;
+  range_pending_ = false;
+}
+
+void GpuProfiler::ReadResults(uint32_t frame_index) {
+  uint64_t* results = &results_[frame_index * kQueriesPerFrame];
+  std::fill(results, results + kQueriesPerFrame, UINT64_MAX);
+  uint32_t count = query_counts_[frame_index];
+  if (!range_reset_[frame_index] || !count) {
+    return;
+  }
+
+  // Queries still in flight are reported as unavailable rather than waited
+  // for.
+  struct Result {
+    uint64_t timestamp;
+    uint64_t available;
+  };
+  std::vector<Result> query_results(count);
+  VkResult status = vkGetQueryPoolResults(
+      *device_, query_pool_, frame_index * kQueriesPerFrame, count,
+      query_results.size() * sizeof(Result), query_results.data(),
+      sizeof(Result),
+      VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WITH_AVAILABILITY_BIT);
+  if (status != VK_SUCCESS && status != VK_NOT_READY) {
+    CheckResult(status, "vkGetQueryPoolResults");
+    return;
+  }
+  for (uint32_t i = 0; i < count; ++i) {
+    if (query_results[i].available) {
+      results[i] = query_results[i].timestamp & timestamp_mask_;
+    }
+  }
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,78 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_GPU_PROFILER_H_
+#define XENIA_GPU_VULKAN_GPU_PROFILER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/base/profiling.h"
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Times the GPU profiling scopes with timestamp queries written into the
+// command buffers of the command processor. The queries of each profiler frame
+// use their own range of the pool, and are read back without waiting when the
+// profiler needs them, several frames later.
+class GpuProfiler : public GpuTimestampProvider {
+ public:
+  explicit GpuProfiler(ui::vulkan::VulkanDevice* device);
+  ~GpuProfiler() override;
+
+  VkResult Initialize();
+  void Shutdown();
+
+  // Called when the command processor begins recording a batch, whose setup
+  // buffer is executed before its command buffer. GPU scopes are timed in the
+  // command buffer by default until EndFrame.
+  void BeginFrame(VkCommandBuffer setup_buffer, VkCommandBuffer command_buffer);
+  void EndFrame();
+
+  uint32_t InsertTimestamp(void* context) override;
+  uint32_t Flip() override;
+  uint64_t GetTimestamp(uint32_t index) override;
+  uint64_t ticks_per_second() override { return ticks_per_second_; }
+
+ private:
+  // The profiler reads the timestamps of a frame kGpuFrameDelay flips after
+  // it ends, so one more range than that is in use at the time.
+  static constexpr uint32_t kFrameCount = Profiler::kGpuFrameDelay + 2;
+  static constexpr uint32_t kQueriesPerFrame = 2048;
+
+  // Resets the range of the current frame and writes its start timestamp.
+  void BeginRange();
+  void ReadResults(uint32_t frame_index);
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+
+  VkQueryPool query_pool_ = nullptr;
+  uint64_t timestamp_mask_ = 0;
+  uint64_t ticks_per_second_ = 0;
+
+  VkCommandBuffer setup_buffer_ = nullptr;
+  VkCommandBuffer command_buffer_ = nullptr;
+
+  uint64_t frame_ = 0;
+  // Until the range of the current frame is reset, no timestamps are written.
+  bool range_pending_ = true;
+  uint32_t query_counts_[kFrameCount] = {};
+  bool range_reset_[kFrameCount] = {};
+  std::vector<uint64_t> results_;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_GPU_PROFILER_H_
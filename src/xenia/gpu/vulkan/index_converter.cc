@@ -0,0 +1,420 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/index_converter.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+#include "third_party/glslang-spirv/SpvBuilder.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/math.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using spv::Id;
+using xe::ui::vulkan::CheckResult;
+
+// Invocations per workgroup, and workgroups per row of the dispatch, which
+// is 2D so that the largest draws stay within the group count limits.
+constexpr uint32_t kGroupSize = 64;
+constexpr uint32_t kRowGroups = 1024;
+
+IndexConverter::IndexConverter(ui::vulkan::VulkanDevice* device)
+    : device_(device) {}
+
+IndexConverter::~IndexConverter() { Shutdown(); }
+
+VkResult IndexConverter::Initialize(VkBuffer buffer, VkBuffer guest_buffer) {
+  VkResult status = VK_SUCCESS;
+
+  // Binding 0 is the output, binding 1 the guest indices.
+  VkDescriptorSetLayoutBinding bindings[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[i].pImmutableSamplers = nullptr;
+  }
+  VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info;
+  descriptor_set_layout_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  descriptor_set_layout_info.pNext = nullptr;
+  descriptor_set_layout_info.flags = 0;
+  descriptor_set_layout_info.bindingCount = 2;
+  descriptor_set_layout_info.pBindings = bindings;
+  status = vkCreateDescriptorSetLayout(*device_, &descriptor_set_layout_info,
+                                       nullptr, &descriptor_set_layout_);
+  CheckResult(status, "vkCreateDescriptorSetLayout");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkPushConstantRange push_constant_range;
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(Constants);
+  VkPipelineLayoutCreateInfo pipeline_layout_info;
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.pNext = nullptr;
+  pipeline_layout_info.flags = 0;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &descriptor_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  status = vkCreatePipelineLayout(*device_, &pipeline_layout_info, nullptr,
+                                  &pipeline_layout_);
+  CheckResult(status, "vkCreatePipelineLayout");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  // The buffers never change, so there is a set for each source, bound for
+  // every dispatch.
+  uint32_t set_count = guest_buffer ? 2 : 1;
+  VkDescriptorPoolSize pool_size;
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = 2 * set_count;
+  VkDescriptorPoolCreateInfo descriptor_pool_info;
+  descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptor_pool_info.pNext = nullptr;
+  descriptor_pool_info.flags = 0;
+  descriptor_pool_info.maxSets = set_count;
+  descriptor_pool_info.poolSizeCount = 1;
+  descriptor_pool_info.pPoolSizes = &pool_size;
+  status = vkCreateDescriptorPool(*device_, &descriptor_pool_info, nullptr,
+                                  &descriptor_pool_);
+  CheckResult(status, "vkCreateDescriptorPool");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkDescriptorSetLayout set_layouts[2] = {descriptor_set_layout_,
+                                          descriptor_set_layout_};
+  VkDescriptorSetAllocateInfo set_alloc_info;
+  set_alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  set_alloc_info.pNext = nullptr;
+  set_alloc_info.descriptorPool = descriptor_pool_;
+  set_alloc_info.descriptorSetCount = set_count;
+  set_alloc_info.pSetLayouts = set_layouts;
+  status =
+      vkAllocateDescriptorSets(*device_, &set_alloc_info, descriptor_sets_);
+  CheckResult(status, "vkAllocateDescriptorSets");
+  if (status != VK_SUCCESS) {
+    descriptor_sets_[0] = nullptr;
+    descriptor_sets_[1] = nullptr;
+    return status;
+  }
+
+  VkDescriptorBufferInfo buffer_infos[4];
+  VkWriteDescriptorSet descriptor_writes[4];
+  std::memset(descriptor_writes, 0, sizeof(descriptor_writes));
+  for (uint32_t i = 0; i < set_count * 2; ++i) {
+    uint32_t binding = i & 1;
+    buffer_infos[i].buffer = binding && i >= 2 ? guest_buffer : buffer;
+    buffer_infos[i].offset = 0;
+    buffer_infos[i].range = VK_WHOLE_SIZE;
+    descriptor_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptor_writes[i].dstSet = descriptor_sets_[i >> 1];
+    descriptor_writes[i].dstBinding = binding;
+    descriptor_writes[i].descriptorCount = 1;
+    descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+  }
+  vkUpdateDescriptorSets(*device_, set_count * 2, descriptor_writes, 0,
+                         nullptr);
+
+  for (size_t i = 0; i < size_t(Mode::kCount); ++i) {
+    auto code = BuildShader(Mode(i));
+    VkShaderModuleCreateInfo shader_info;
+    shader_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_info.pNext = nullptr;
+    shader_info.flags = 0;
+    shader_info.codeSize = code.size() * sizeof(uint32_t);
+    shader_info.pCode = code.data();
+    status = vkCreateShaderModule(*device_, &shader_info, nullptr,
+                                  &shader_modules_[i]);
+    CheckResult(status, "vkCreateShaderModule");
+    if (status != VK_SUCCESS) {
+      return status;
+    }
+
+    VkComputePipelineCreateInfo pipeline_info;
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = nullptr;
+    pipeline_info.flags = 0;
+    pipeline_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.pNext = nullptr;
+    pipeline_info.stage.flags = 0;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = shader_modules_[i];
+    pipeline_info.stage.pName = "main";
+    pipeline_info.stage.pSpecializationInfo = nullptr;
+    pipeline_info.layout = pipeline_layout_;
+    pipeline_info.basePipelineHandle = nullptr;
+    pipeline_info.basePipelineIndex = -1;
+    status = vkCreateComputePipelines(*device_, nullptr, 1, &pipeline_info,
+                                      nullptr, &pipelines_[i]);
+    CheckResult(status, "vkCreateComputePipelines");
+    if (status != VK_SUCCESS) {
+      return status;
+    }
+  }
+
+  return VK_SUCCESS;
+}
+
+void IndexConverter::Shutdown() {
+  for (size_t i = 0; i < size_t(Mode::kCount); ++i) {
+    if (pipelines_[i]) {
+      vkDestroyPipeline(*device_, pipelines_[i], nullptr);
+      pipelines_[i] = nullptr;
+    }
+    if (shader_modules_[i]) {
+      vkDestroyShaderModule(*device_, shader_modules_[i], nullptr);
+      shader_modules_[i] = nullptr;
+    }
+  }
+  if (descriptor_pool_) {
+    // Frees descriptor_sets_ along with it.
+    vkDestroyDescriptorPool(*device_, descriptor_pool_, nullptr);
+    descriptor_pool_ = nullptr;
+    descriptor_sets_[0] = nullptr;
+    descriptor_sets_[1] = nullptr;
+  }
+  if (pipeline_layout_) {
+    vkDestroyPipelineLayout(*device_, pipeline_layout_, nullptr);
+    pipeline_layout_ = nullptr;
+  }
+  if (descriptor_set_layout_) {
+    vkDestroyDescriptorSetLayout(*device_, descriptor_set_layout_, nullptr);
+    descriptor_set_layout_ = nullptr;
+  }
+}
+
+void IndexConverter::Dispatch(VkCommandBuffer command_buffer, Mode mode,
+                              const Constants& constants,
+                              bool from_guest_buffer) {
+  assert_true(!from_guest_buffer || has_guest_buffer());
+  uint32_t group_count = xe::round_up(constants.count, kGroupSize) /
+                         kGroupSize;
+  if (!group_count) {
+    return;
+  }
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipelines_[size_t(mode)]);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline_layout_, 0, 1,
+                          &descriptor_sets_[from_guest_buffer ? 1 : 0], 0,
+                          nullptr);
+  vkCmdPushConstants(command_buffer, pipeline_layout_,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Constants),
+                     &constants);
+  vkCmdDispatch(command_buffer, std::min(group_count, kRowGroups),
+                xe::round_up(group_count, kRowGroups) / kRowGroups, 1);
+}
+
+std::vector<uint32_t> IndexConverter::BuildShader(Mode mode) {
+  spv::Builder b(0x10000, 0xFFFFFFFF, nullptr);
+  b.setSource(spv::SourceLanguage::SourceLanguageUnknown, 0);
+  b.setMemoryModel(spv::AddressingModel::AddressingModelLogical,
+                   spv::MemoryModel::MemoryModelGLSL450);
+  b.addCapability(spv::Capability::CapabilityShader);
+
+  Id bool_type = b.makeBoolType();
+  Id uint_type = b.makeUintType(32);
+  Id uvec3_type = b.makeVectorType(uint_type, 3);
+
+  // Push constants, one uint per field of Constants.
+  const uint32_t constant_count = sizeof(Constants) / sizeof(uint32_t);
+  Id constants_type = b.makeStructType(
+      std::vector<Id>(constant_count, uint_type), "constants_type");
+  b.addDecoration(constants_type, spv::Decoration::DecorationBlock);
+  for (uint32_t i = 0; i < constant_count; ++i) {
+    b.addMemberDecoration(constants_type, i, spv::Decoration::DecorationOffset,
+                          i * sizeof(uint32_t));
+  }
+  Id constants = b.createVariable(spv::StorageClass::StorageClassPushConstant,
+                                  constants_type, "constants");
+
+  // The whole output and source buffers as arrays of words. They may be the
+  // same buffer.
+  Id data_array_type = b.makeRuntimeArray(uint_type);
+  b.addDecoration(data_array_type, spv::Decoration::DecorationArrayStride,
+                  sizeof(uint32_t));
+  Id data_type = b.makeStructType({data_array_type}, "data_type");
+  b.addDecoration(data_type, spv::Decoration::DecorationBufferBlock);
+  b.addMemberName(data_type, 0, "words");
+  b.addMemberDecoration(data_type, 0, spv::Decoration::DecorationOffset, 0);
+  Id data = b.createVariable(spv::StorageClass::StorageClassUniform,
+                             data_type, "data");
+  b.addDecoration(data, spv::Decoration::DecorationDescriptorSet, 0);
+  b.addDecoration(data, spv::Decoration::DecorationBinding, 0);
+  Id source = b.createVariable(spv::StorageClass::StorageClassUniform,
+                               data_type, "source");
+  b.addDecoration(source, spv::Decoration::DecorationDescriptorSet, 0);
+  b.addDecoration(source, spv::Decoration::DecorationBinding, 1);
+  b.addDecoration(source, spv::Decoration::DecorationNonWritable);
+
+  Id invocation_id = b.createVariable(spv::StorageClass::StorageClassInput,
+                                      uvec3_type, "gl_GlobalInvocationID");
+  b.addDecoration(invocation_id, spv::Decoration::DecorationBuiltIn,
+                  spv::BuiltIn::BuiltInGlobalInvocationId);
+
+  spv::Block* entry_block;
+  auto main_fn = b.makeFunctionEntry(spv::NoPrecision, b.makeVoidType(),
+                                     "main", {}, {}, &entry_block);
+  auto entry = b.addEntryPoint(spv::ExecutionModel::ExecutionModelGLCompute,
+                               main_fn, "main");
+  entry->addIdOperand(invocation_id);
+  b.addExecutionMode(main_fn, spv::ExecutionMode::ExecutionModeLocalSize,
+                     kGroupSize, 1, 1);
+
+  auto u = [&](uint32_t value) { return b.makeUintConstant(value); };
+  auto op = [&](spv::Op opcode, Id a, Id c) {
+    return b.createBinOp(opcode, uint_type, a, c);
+  };
+  auto add = [&](Id a, Id c) { return op(spv::Op::OpIAdd, a, c); };
+  auto mul = [&](Id a, Id c) { return op(spv::Op::OpIMul, a, c); };
+  auto and_ = [&](Id a, uint32_t mask) {
+    return op(spv::Op::OpBitwiseAnd, a, u(mask));
+  };
+  auto or_ = [&](Id a, Id c) { return op(spv::Op::OpBitwiseOr, a, c); };
+  auto shl = [&](Id a, uint32_t shift) {
+    return op(spv::Op::OpShiftLeftLogical, a, u(shift));
+  };
+  auto shr = [&](Id a, uint32_t shift) {
+    return op(spv::Op::OpShiftRightLogical, a, u(shift));
+  };
+  auto select = [&](Id condition, Id a, Id c) {
+    return b.createTriOp(spv::Op::OpSelect, uint_type, condition, a, c);
+  };
+  auto equal = [&](Id a, Id c) {
+    return b.createBinOp(spv::Op::OpIEqual, bool_type, a, c);
+  };
+  auto constant = [&](size_t offset) {
+    Id ptr = b.createAccessChain(spv::StorageClass::StorageClassPushConstant,
+                                 constants,
+                                 {u(uint32_t(offset / sizeof(uint32_t)))});
+    return b.createLoad(ptr);
+  };
+#define CONSTANT(name) constant(offsetof(Constants, name))
+
+  // Guest indices are 8in16 if 16-bit and 8in32 if 32-bit.
+  auto swap_16 = [&](Id word) {
+    return or_(and_(shl(word, 8), 0xFF00FF00), and_(shr(word, 8), 0x00FF00FF));
+  };
+  auto swap_32 = [&](Id word) {
+    Id swapped = swap_16(word);
+    return or_(shl(swapped, 16), shr(swapped, 16));
+  };
+  Id src_offset = CONSTANT(src_offset);
+  Id dst_offset = CONSTANT(dst_offset);
+  auto load_word = [&](Id index) {
+    return b.createLoad(b.createAccessChain(
+        spv::StorageClass::StorageClassUniform, source,
+        {u(0), add(src_offset, index)}));
+  };
+  auto store_word = [&](Id index, Id value) {
+    b.createStore(value,
+                  b.createAccessChain(spv::StorageClass::StorageClassUniform,
+                                      data, {u(0), add(dst_offset, index)}));
+  };
+
+  Id id = b.createLoad(invocation_id);
+  Id index = add(b.createCompositeExtract(id, uint_type, 0),
+                 mul(b.createCompositeExtract(id, uint_type, 1),
+                     u(kGroupSize * kRowGroups)));
+  spv::Builder::If bounds_if(
+      b.createBinOp(spv::Op::OpULessThan, bool_type, index, CONSTANT(count)),
+      0, b);
+  Id index_32bit = b.createBinOp(spv::Op::OpINotEqual, bool_type,
+                                 CONSTANT(index_32bit), u(0));
+
+  switch (mode) {
+    case Mode::kConvert: {
+      Id word = load_word(index);
+      Id reset_enabled = b.createBinOp(spv::Op::OpINotEqual, bool_type,
+                                       CONSTANT(prim_reset_enabled), u(0));
+      Id reset_index = CONSTANT(prim_reset_index);
+      auto replace_reset = [&](Id value, Id reset_value, uint32_t all_ones) {
+        Id is_reset = b.createBinOp(spv::Op::OpLogicalAnd, bool_type,
+                                    reset_enabled, equal(value, reset_value));
+        return select(is_reset, u(all_ones), value);
+      };
+      Id value_32 = replace_reset(swap_32(word), reset_index, 0xFFFFFFFF);
+      Id swapped_16 = swap_16(word);
+      Id reset_index_16 = and_(reset_index, 0xFFFF);
+      Id value_16 =
+          or_(replace_reset(and_(swapped_16, 0xFFFF), reset_index_16, 0xFFFF),
+              shl(replace_reset(shr(swapped_16, 16), reset_index_16, 0xFFFF),
+                  16));
+      store_word(index, select(index_32bit, value_32, value_16));
+    } break;
+    case Mode::kQuadListToTriangleList:
+    case Mode::kQuadListToLineList: {
+      // Same orders as ExpandQuadList in the buffer cache.
+      static const uint32_t kTriangleOrder[6] = {0, 1, 3, 1, 2, 3};
+      static const uint32_t kLineOrder[8] = {0, 1, 1, 2, 2, 3, 3, 0};
+      bool as_lines = mode == Mode::kQuadListToLineList;
+      const uint32_t* order = as_lines ? kLineOrder : kTriangleOrder;
+      uint32_t order_count = as_lines ? 8 : 6;
+      // Separate paths, as they read different amounts of words.
+      spv::Builder::If width_if(index_32bit, 0, b);
+      {
+        Id src_base = shl(index, 2);
+        Id indices[4];
+        for (uint32_t i = 0; i < 4; ++i) {
+          indices[i] = swap_32(load_word(add(src_base, u(i))));
+        }
+        Id dst_base = mul(index, u(order_count));
+        for (uint32_t i = 0; i < order_count; ++i) {
+          store_word(add(dst_base, u(i)), indices[order[i]]);
+        }
+      }
+      width_if.makeBeginElse();
+      {
+        Id src_base = shl(index, 1);
+        Id w0 = swap_16(load_word(src_base));
+        Id w1 = swap_16(load_word(add(src_base, u(1))));
+        Id indices[4] = {and_(w0, 0xFFFF), shr(w0, 16), and_(w1, 0xFFFF),
+                         shr(w1, 16)};
+        // Quads are a whole number of words in both orders.
+        Id dst_base = mul(index, u(order_count / 2));
+        for (uint32_t i = 0; i < order_count / 2; ++i) {
+          store_word(add(dst_base, u(i)),
+                     or_(indices[order[i * 2]],
+                         shl(indices[order[i * 2 + 1]], 16)));
+        }
+      }
+      width_if.makeEndIf();
+    } break;
+    default:
+      assert_unhandled_case(mode);
+      break;
+  }
+#undef CONSTANT
+
+  bounds_if.makeEndIf();
+  b.makeReturn(false);
+
+  std::vector<uint32_t> spirv_words;
+  b.dump(spirv_words);
+  return spirv_words;
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
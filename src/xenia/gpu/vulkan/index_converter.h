@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_INDEX_CONVERTER_H_
+#define XENIA_GPU_VULKAN_INDEX_CONVERTER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Endian swaps guest indices, replacing the primitive reset index with the
+// one Vulkan restarts on, or expands quad lists, with compute shaders. The
+// output lives in a storage buffer (the buffer cache transient buffer), and
+// the raw guest indices are read either from the same buffer or from guest
+// memory imported as a buffer.
+class IndexConverter {
+ public:
+  enum class Mode {
+    // One word of indices per invocation.
+    kConvert,
+    // One quad per invocation, as in BufferCache::UploadQuadListIndexBuffer.
+    kQuadListToTriangleList,
+    kQuadListToLineList,
+    kCount,
+  };
+
+  // Push constants, all in the same order as in the shader.
+  struct Constants {
+    // Word offsets of the guest indices in the source buffer and of the
+    // output in the buffer.
+    uint32_t src_offset;
+    uint32_t dst_offset;
+    // Words for kConvert, quads otherwise.
+    uint32_t count;
+    uint32_t index_32bit;
+    // kConvert only, indices equal to prim_reset_index (after swapping)
+    // become all ones if enabled.
+    uint32_t prim_reset_enabled;
+    uint32_t prim_reset_index;
+  };
+
+  explicit IndexConverter(ui::vulkan::VulkanDevice* device);
+  ~IndexConverter();
+
+  // buffer holds the output of every conversion and the guest indices copied
+  // into it, and guest_buffer, if not null, all of guest physical memory.
+  VkResult Initialize(VkBuffer buffer, VkBuffer guest_buffer = nullptr);
+  void Shutdown();
+
+  bool has_guest_buffer() const { return descriptor_sets_[1] != nullptr; }
+
+  // Records one conversion, reading from guest_buffer if from_guest_buffer
+  // is set. The caller is responsible for the barriers around it.
+  void Dispatch(VkCommandBuffer command_buffer, Mode mode,
+                const Constants& constants, bool from_guest_buffer);
+
+ private:
+  static std::vector<uint32_t> BuildShader(Mode mode);
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+
+  VkDescriptorSetLayout descriptor_set_layout_ = nullptr;
+  VkDescriptorPool descriptor_pool_ = nullptr;
+  // Reading from buffer and from guest_buffer.
+  VkDescriptorSet descriptor_sets_[2] = {};
+  VkPipelineLayout pipeline_layout_ = nullptr;
+  VkShaderModule shader_modules_[size_t(Mode::kCount)] = {};
+  VkPipeline pipelines_[size_t(Mode::kCount)] = {};
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_INDEX_CONVERTER_H_
@@ -10,14 +10,21 @@
 #include "xenia/gpu/vulkan/pipeline_cache.h"
 
 #include "third_party/xxhash/xxhash.h"
+#include "xenia/base/byte_order.h"
+#include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/string.h"
+#include "xenia/base/threading.h"
 #include "xenia/gpu/gpu_flags.h"
+#include "xenia/gpu/shader_disk_cache.h"
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 
+#include <algorithm>
 #include <cinttypes>
+#include <memory>
 #include <string>
 
 namespace xe {
@@ -33,6 +40,24 @@ using xe::ui::vulkan::CheckResult;
 #include "xenia/gpu/vulkan/shaders/bin/quad_list_geom.h"
 #include "xenia/gpu/vulkan/shaders/bin/rect_list_geom.h"
 
+static const uint32_t kPipelineDiskCacheMagic = 'XPIP';
+static const uint32_t kDriverDiskCacheMagic = 'XDRV';
+
+bool PipelineCache::IsQuadListExpanded(PrimitiveType primitive_type) {
+  return primitive_type == PrimitiveType::kQuadList &&
+         FLAGS_vulkan_expand_quad_lists;
+}
+
+bool PipelineCache::IsPolygonLineMode(uint32_t pa_su_sc_mode_cntl) {
+  if (((pa_su_sc_mode_cntl >> 3) & 0x3) != 0) {
+    uint32_t front_poly_mode = (pa_su_sc_mode_cntl >> 5) & 0x7;
+    if (front_poly_mode == 1) {
+      return true;
+    }
+  }
+  return false;
+}
+
 PipelineCache::PipelineCache(RegisterFile* register_file,
                              ui::vulkan::VulkanDevice* device)
     : register_file_(register_file), device_(device) {
@@ -166,10 +191,19 @@ VkResult PipelineCache::Initialize(
                             VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT,
                             "S(p): Dummy");
 
+  // Previously used pipelines are created on the workers even when draws
+  // wait for their pipelines.
+  async_ = FLAGS_vulkan_async_pipelines;
+  if (async_ || !FLAGS_vulkan_pipeline_cache_path.empty()) {
+    StartWorkers();
+  }
+
   return VK_SUCCESS;
 }
 
 void PipelineCache::Shutdown() {
+  StopWorkers();
+  CloseDiskCache();
   ClearCache();
 
   // Destroy geometry shaders.
@@ -208,21 +242,36 @@ VulkanShader* PipelineCache::LoadShader(ShaderType shader_type,
                                         uint32_t guest_address,
                                         const uint32_t* host_address,
                                         uint32_t dword_count) {
+  size_t ucode_size = dword_count * sizeof(uint32_t);
+  LastLoadedShader& last_loaded =
+      last_loaded_shaders_[shader_type == ShaderType::kPixel ? 1 : 0];
+  if (last_loaded.shader && last_loaded.shader->type() == shader_type &&
+      last_loaded.ucode.size() == dword_count &&
+      !std::memcmp(last_loaded.ucode.data(), host_address, ucode_size)) {
+    ++stats_.shader_hits;
+    return last_loaded.shader;
+  }
+
   // Hash the input memory and lookup the shader.
-  uint64_t data_hash = XXH64(host_address, dword_count * sizeof(uint32_t), 0);
+  uint64_t data_hash = XXH64(host_address, ucode_size, 0);
+  VulkanShader* shader;
   auto it = shader_map_.find(data_hash);
   if (it != shader_map_.end()) {
     // Shader has been previously loaded.
-    return it->second;
+    shader = it->second;
+    ++stats_.shader_hits;
+  } else {
+    // Always create the shader and stash it away.
+    // We need to track it even if it fails translation so we know not to try
+    // again.
+    shader = new VulkanShader(device_, shader_type, data_hash, host_address,
+                              dword_count);
+    shader_map_.insert({data_hash, shader});
+    ++stats_.shader_misses;
   }
 
-  // Always create the shader and stash it away.
-  // We need to track it even if it fails translation so we know not to try
-  // again.
-  VulkanShader* shader = new VulkanShader(device_, shader_type, data_hash,
-                                          host_address, dword_count);
-  shader_map_.insert({data_hash, shader});
-
+  last_loaded.shader = shader;
+  last_loaded.ucode.assign(host_address, host_address + dword_count);
   return shader;
 }
 
@@ -236,6 +285,10 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
 
   assert_not_null(pipeline_out);
 
+  if (!workers_.empty()) {
+    CollectCompletedWork();
+  }
+
   // Perform a pass over all registers and state updating our cached structures.
   // This will tell us if anything has changed that requires us to either build
   // a new pipeline or use an existing one.
@@ -257,16 +310,37 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
       // We are in an indeterminate state, so reset things for the next attempt.
       current_pipeline_ = nullptr;
       return update_status;
+    case UpdateStatus::kPending:
+      // Shaders are still being translated, so there's no way to tell what
+      // the pipeline would be.
+      current_pipeline_ = nullptr;
+      ++skipped_draw_count_;
+      return update_status;
   }
   if (!pipeline) {
     // Should have a hash key produced by the UpdateState pass.
     uint64_t hash_key = XXH64_digest(&hash_state_);
-    pipeline = GetPipeline(render_state, hash_key);
+    bool pending = false;
+    pipeline = GetPipeline(render_state, hash_key, &pending);
     current_pipeline_ = pipeline;
-    if (!pipeline) {
+    if (pending) {
+      // Draw with a pipeline that only differs in fixed-function state while
+      // the real one is created. current_pipeline_ stays empty so that the
+      // next draw looks again.
+      auto it = fallback_pipelines_.find(GetFallbackKey(
+          update_shader_stages_regs_, render_state->render_pass_handle));
+      if (it == fallback_pipelines_.end()) {
+        ++skipped_draw_count_;
+        return UpdateStatus::kPending;
+      }
+      ++fallback_draw_count_;
+      pipeline = it->second;
+    } else if (!pipeline) {
       // Unable to create pipeline.
       return UpdateStatus::kError;
     }
+    // This is not the pipeline that is bound.
+    update_status = UpdateStatus::kMismatch;
   }
 
   *pipeline_out = pipeline;
@@ -274,6 +348,14 @@ PipelineCache::UpdateStatus PipelineCache::ConfigurePipeline(
 }
 
 void PipelineCache::ClearCache() {
+  // Let the workers finish with anything they may be using.
+  if (!workers_.empty()) {
+    WaitForWorkers();
+    CollectCompletedWork();
+  }
+  fallback_pipelines_.clear();
+  current_pipeline_ = nullptr;
+
   // Destroy all pipelines.
   for (auto it : cached_pipelines_) {
     vkDestroyPipeline(*device_, it.second, nullptr);
@@ -282,21 +364,138 @@ void PipelineCache::ClearCache() {
   COUNT_profile_set("gpu/pipeline_cache/pipelines", 0);
 
   // Destroy all shaders.
+  for (auto& last_loaded : last_loaded_shaders_) {
+    last_loaded.shader = nullptr;
+    last_loaded.ucode.clear();
+  }
   for (auto it : shader_map_) {
     delete it.second;
   }
   shader_map_.clear();
 }
 
+void PipelineCache::EndFrame() {
+  COUNT_profile_set("gpu/pipeline_cache/skipped_draws", skipped_draw_count_);
+  COUNT_profile_set("gpu/pipeline_cache/fallback_draws", fallback_draw_count_);
+  if (skipped_draw_count_ || fallback_draw_count_) {
+    XELOGGPU("Pipeline cache: %u draws skipped, %u drawn with a fallback",
+             skipped_draw_count_, fallback_draw_count_);
+  }
+  skipped_draw_count_ = 0;
+  fallback_draw_count_ = 0;
+}
+
+uint64_t PipelineCache::GetFallbackKey(
+    const UpdateShaderStagesRegisters& regs, VkRenderPass render_pass) {
+  // The shader stages and the vertex input (which follows from the vertex
+  // shader) have to match, as does render pass compatibility.
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, &regs, sizeof(regs));
+  XXH64_update(&hash_state, &render_pass, sizeof(render_pass));
+  return XXH64_digest(&hash_state);
+}
+
 VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
-                                      uint64_t hash_key) {
+                                      uint64_t hash_key, bool* pending) {
   // Lookup the pipeline in the cache.
   auto it = cached_pipelines_.find(hash_key);
   if (it != cached_pipelines_.end()) {
     // Found existing pipeline.
+    ++stats_.pipeline_hits;
     return it->second;
   }
+  ++stats_.pipeline_misses;
+
+  if (async_) {
+    *pending = true;
+    if (pending_pipelines_.insert(hash_key).second) {
+      auto job = std::make_shared<PipelineCreateJob>();
+      SnapshotPipelineState(render_state, hash_key, job.get());
+      SavePipelineToDisk(render_state, *job);
+      QueuePipelineCreation(job);
+    }
+    return nullptr;
+  }
+
+  if (pending_pipelines_.count(hash_key)) {
+    // Being created from the disk cache already.
+    WaitForWorkers();
+    CollectCompletedWork();
+    it = cached_pipelines_.find(hash_key);
+    return it != cached_pipelines_.end() ? it->second : nullptr;
+  }
+
+  PipelineCreateJob job;
+  SnapshotPipelineState(render_state, hash_key, &job);
+  SavePipelineToDisk(render_state, job);
+  VkPipeline pipeline = CreatePipeline(job);
+  if (!pipeline) {
+    return nullptr;
+  }
+
+  // Add to cache with the hash key for reuse.
+  cached_pipelines_.insert({hash_key, pipeline});
+  COUNT_profile_set("gpu/pipeline_cache/pipelines", cached_pipelines_.size());
+
+  return pipeline;
+}
+
+// Every member of SpirvSpecializationConstants, with its index as the ID.
+static const VkSpecializationMapEntry* GetSpecializationMapEntries() {
+  static VkSpecializationMapEntry entries[kSpirvSpecializationConstantCount];
+  static bool initialized = false;
+  if (!initialized) {
+    for (uint32_t i = 0; i < kSpirvSpecializationConstantCount; ++i) {
+      entries[i].constantID = i;
+      entries[i].offset = i * sizeof(uint32_t);
+      entries[i].size = sizeof(uint32_t);
+    }
+    initialized = true;
+  }
+  return entries;
+}
+
+void PipelineCache::LinkJobSpecialization(PipelineCreateJob* job) {
+  job->specialization_info.mapEntryCount = kSpirvSpecializationConstantCount;
+  job->specialization_info.pMapEntries = GetSpecializationMapEntries();
+  job->specialization_info.dataSize = sizeof(job->specialization_constants);
+  job->specialization_info.pData = &job->specialization_constants;
+  for (uint32_t i = 0; i < job->shader_stage_count; ++i) {
+    auto& stage = job->shader_stages[i];
+    stage.pSpecializationInfo = stage.stage != VK_SHADER_STAGE_GEOMETRY_BIT
+                                    ? &job->specialization_info
+                                    : nullptr;
+  }
+}
 
+void PipelineCache::SnapshotPipelineState(const RenderState* render_state,
+                                          uint64_t hash_key,
+                                          PipelineCreateJob* job) {
+  job->hash_key = hash_key;
+  job->fallback_key = GetFallbackKey(update_shader_stages_regs_,
+                                     render_state->render_pass_handle);
+  std::memcpy(job->shader_stages, update_shader_stages_info_,
+              sizeof(job->shader_stages));
+  job->shader_stage_count = update_shader_stages_stage_count_;
+  job->specialization_constants =
+      update_shader_stages_specialization_constants_;
+  LinkJobSpecialization(job);
+  job->vertex_input_state = update_vertex_input_state_info_;
+  job->input_assembly_state = update_input_assembly_state_info_;
+  job->viewport_state = update_viewport_state_info_;
+  job->rasterization_state = update_rasterization_state_info_;
+  job->multisample_state = update_multisample_state_info_;
+  job->depth_stencil_state = update_depth_stencil_state_info_;
+  job->color_blend_state = update_color_blend_state_info_;
+  std::memcpy(job->color_blend_attachments,
+              update_color_blend_attachment_states_,
+              sizeof(job->color_blend_attachments));
+  job->color_blend_state.pAttachments = job->color_blend_attachments;
+  job->render_pass = render_state->render_pass_handle;
+}
+
+VkPipeline PipelineCache::CreatePipeline(const PipelineCreateJob& job) {
   VkPipelineDynamicStateCreateInfo dynamic_state_info;
   dynamic_state_info.sType =
       VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
@@ -321,19 +520,19 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
   pipeline_info.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
   pipeline_info.pNext = nullptr;
   pipeline_info.flags = VK_PIPELINE_CREATE_DISABLE_OPTIMIZATION_BIT;
-  pipeline_info.stageCount = update_shader_stages_stage_count_;
-  pipeline_info.pStages = update_shader_stages_info_;
-  pipeline_info.pVertexInputState = &update_vertex_input_state_info_;
-  pipeline_info.pInputAssemblyState = &update_input_assembly_state_info_;
+  pipeline_info.stageCount = job.shader_stage_count;
+  pipeline_info.pStages = job.shader_stages;
+  pipeline_info.pVertexInputState = &job.vertex_input_state;
+  pipeline_info.pInputAssemblyState = &job.input_assembly_state;
   pipeline_info.pTessellationState = nullptr;
-  pipeline_info.pViewportState = &update_viewport_state_info_;
-  pipeline_info.pRasterizationState = &update_rasterization_state_info_;
-  pipeline_info.pMultisampleState = &update_multisample_state_info_;
-  pipeline_info.pDepthStencilState = &update_depth_stencil_state_info_;
-  pipeline_info.pColorBlendState = &update_color_blend_state_info_;
+  pipeline_info.pViewportState = &job.viewport_state;
+  pipeline_info.pRasterizationState = &job.rasterization_state;
+  pipeline_info.pMultisampleState = &job.multisample_state;
+  pipeline_info.pDepthStencilState = &job.depth_stencil_state;
+  pipeline_info.pColorBlendState = &job.color_blend_state;
   pipeline_info.pDynamicState = &dynamic_state_info;
   pipeline_info.layout = pipeline_layout_;
-  pipeline_info.renderPass = render_state->render_pass_handle;
+  pipeline_info.renderPass = job.render_pass;
   pipeline_info.subpass = 0;
   pipeline_info.basePipelineHandle = nullptr;
   pipeline_info.basePipelineIndex = -1;
@@ -356,18 +555,25 @@ VkPipeline PipelineCache::GetPipeline(const RenderState* render_state,
     }
   }
 
-  // Add to cache with the hash key for reuse.
-  cached_pipelines_.insert({hash_key, pipeline});
-  COUNT_profile_set("gpu/pipeline_cache/pipelines", cached_pipelines_.size());
-
   return pipeline;
 }
 
-bool PipelineCache::TranslateShader(VulkanShader* shader,
+void PipelineCache::QueuePipelineCreation(
+    std::shared_ptr<PipelineCreateJob> job) {
+  QueueWork([this, job](ShaderTranslator* shader_translator) {
+    VkPipeline pipeline = CreatePipeline(*job);
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    completed_pipelines_.push_back(
+        {job->hash_key, job->fallback_key, pipeline});
+  });
+}
+
+bool PipelineCache::TranslateShader(ShaderTranslator* shader_translator,
+                                    VulkanShader* shader,
                                     xenos::xe_gpu_program_cntl_t cntl) {
   // Perform translation.
   // If this fails the shader will be marked as invalid and ignored later.
-  if (!shader_translator_->Translate(shader, cntl)) {
+  if (!shader_translator->Translate(shader, cntl)) {
     XELOGE("Shader translation failed; marking shader as ignored");
     return false;
   }
@@ -388,12 +594,468 @@ bool PipelineCache::TranslateShader(VulkanShader* shader,
 
   // Dump shader files if desired.
   if (!FLAGS_dump_shaders.empty()) {
-    shader->Dump(FLAGS_dump_shaders, "vk");
+    auto dump_paths = shader->Dump(FLAGS_dump_shaders, "vk");
+    AppendShaderDumpManifest(FLAGS_dump_shaders, shader, dump_paths.second,
+                             cntl);
+  }
+
+  if (shader->is_valid()) {
+    SaveShaderToDisk(shader, cntl);
   }
 
   return shader->is_valid();
 }
 
+bool PipelineCache::QueueShaderTranslation(VulkanShader* shader,
+                                           xenos::xe_gpu_program_cntl_t cntl) {
+  if (pending_shaders_.count(shader)) {
+    return true;
+  }
+  if (shader->is_translated()) {
+    return false;
+  }
+  pending_shaders_.insert(shader);
+  QueueWork([this, shader, cntl](ShaderTranslator* shader_translator) {
+    TranslateShader(shader_translator, shader, cntl);
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    completed_shaders_.push_back(shader);
+  });
+  return true;
+}
+
+void PipelineCache::StartWorkers() {
+  // Leave most of the host to the guest and the command processor.
+  uint32_t worker_count =
+      std::max(1u, std::min(4u, xe::threading::logical_processor_count() / 4));
+  workers_exiting_ = false;
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    workers_.emplace_back([this]() { WorkerMain(); });
+  }
+}
+
+void PipelineCache::StopWorkers() {
+  if (workers_.empty()) {
+    return;
+  }
+  {
+    // Whatever hasn't started yet (such as pipelines from the disk cache) is
+    // of no use anymore.
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    work_in_flight_ -= work_queue_.size();
+    work_queue_.clear();
+    workers_exiting_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto& worker : workers_) {
+    worker.join();
+  }
+  workers_.clear();
+  CollectCompletedWork();
+}
+
+void PipelineCache::WorkerMain() {
+  xe::threading::set_name("Vulkan Pipeline Compiler");
+  // Translators keep state while working, so each worker has its own.
+  SpirvShaderTranslator shader_translator;
+  while (true) {
+    std::function<void(ShaderTranslator*)> work;
+    {
+      std::unique_lock<std::mutex> lock(work_mutex_);
+      work_cv_.wait(lock, [this]() {
+        return workers_exiting_ || !work_queue_.empty();
+      });
+      if (work_queue_.empty()) {
+        // Exiting, and everything queued is done.
+        return;
+      }
+      work = std::move(work_queue_.front());
+      work_queue_.pop_front();
+    }
+    work(&shader_translator);
+    {
+      std::lock_guard<std::mutex> lock(work_mutex_);
+      --work_in_flight_;
+    }
+    work_done_cv_.notify_all();
+  }
+}
+
+void PipelineCache::QueueWork(std::function<void(ShaderTranslator*)> work) {
+  {
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    work_queue_.push_back(std::move(work));
+    ++work_in_flight_;
+  }
+  work_cv_.notify_one();
+}
+
+void PipelineCache::WaitForWorkers() {
+  std::unique_lock<std::mutex> lock(work_mutex_);
+  work_done_cv_.wait(lock, [this]() { return work_in_flight_ == 0; });
+}
+
+void PipelineCache::CollectCompletedWork() {
+  std::vector<CompletedPipeline> pipelines;
+  std::vector<VulkanShader*> shaders;
+  {
+    std::lock_guard<std::mutex> lock(work_mutex_);
+    pipelines.swap(completed_pipelines_);
+    shaders.swap(completed_shaders_);
+  }
+  for (auto shader : shaders) {
+    pending_shaders_.erase(shader);
+  }
+  if (pipelines.empty()) {
+    return;
+  }
+  for (auto& completed : pipelines) {
+    pending_pipelines_.erase(completed.hash_key);
+    // Failures are kept (as null) so they aren't retried on every draw.
+    if (!cached_pipelines_.insert({completed.hash_key, completed.pipeline})
+             .second) {
+      if (completed.pipeline) {
+        vkDestroyPipeline(*device_, completed.pipeline, nullptr);
+      }
+      continue;
+    }
+    if (completed.pipeline) {
+      fallback_pipelines_[completed.fallback_key] = completed.pipeline;
+    }
+  }
+  COUNT_profile_set("gpu/pipeline_cache/pipelines", cached_pipelines_.size());
+}
+
+void PipelineCache::OpenDiskCache(uint32_t title_id,
+                                  RenderCache* render_cache) {
+  if (FLAGS_vulkan_pipeline_cache_path.empty() || !disk_cache_path_.empty()) {
+    return;
+  }
+  disk_cache_path_ =
+      xe::join_paths(xe::to_wstring(FLAGS_vulkan_pipeline_cache_path),
+                     xe::format_string(L"%.8X", title_id));
+
+  // Merge in the driver cache first so that the pipelines below hit it.
+  std::vector<uint8_t> driver_data;
+  ReadDiskCacheFile(xe::join_paths(disk_cache_path_, L"driver.bin"),
+                    kDriverDiskCacheMagic,
+                    [&](const uint8_t* data, size_t size) {
+                      driver_data.assign(data, data + size);
+                    });
+  if (!driver_data.empty()) {
+    // The driver ignores the data if it was made by another device or driver
+    // version.
+    VkPipelineCacheCreateInfo pipeline_cache_info;
+    pipeline_cache_info.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipeline_cache_info.pNext = nullptr;
+    pipeline_cache_info.flags = 0;
+    pipeline_cache_info.initialDataSize = driver_data.size();
+    pipeline_cache_info.pInitialData = driver_data.data();
+    VkPipelineCache loaded_cache = nullptr;
+    VkResult status = vkCreatePipelineCache(*device_, &pipeline_cache_info,
+                                            nullptr, &loaded_cache);
+    CheckResult(status, "vkCreatePipelineCache");
+    if (status == VK_SUCCESS) {
+      // The destination must not be in use by the workers.
+      if (!workers_.empty()) {
+        WaitForWorkers();
+      }
+      status = vkMergePipelineCaches(*device_, pipeline_cache_, 1,
+                                     &loaded_cache);
+      CheckResult(status, "vkMergePipelineCaches");
+      vkDestroyPipelineCache(*device_, loaded_cache, nullptr);
+    }
+  }
+
+  LoadShadersFromDisk();
+  LoadPipelinesFromDisk(render_cache);
+}
+
+void PipelineCache::LoadShadersFromDisk() {
+  std::lock_guard<std::mutex> lock(disk_cache_mutex_);
+  uint32_t loaded_count = 0;
+  std::vector<uint32_t> ucode;
+  shader_disk_file_ = OpenDiskCacheFile(
+      xe::join_paths(disk_cache_path_, L"shaders.bin"), kShaderDiskCacheMagic,
+      [&](const uint8_t* data, size_t size) {
+        DiskShaderRecord record;
+        if (size < sizeof(record)) {
+          return;
+        }
+        std::memcpy(&record, data, sizeof(record));
+        size_t ucode_size = size_t(record.ucode_dword_count) * 4;
+        if (sizeof(record) + ucode_size + record.translation_size != size ||
+            (record.shader_type != uint32_t(ShaderType::kVertex) &&
+             record.shader_type != uint32_t(ShaderType::kPixel))) {
+          return;
+        }
+        // Records aren't aligned.
+        ucode.resize(record.ucode_dword_count);
+        std::memcpy(ucode.data(), data + sizeof(record), ucode_size);
+        if (XXH64(ucode.data(), ucode_size, 0) != record.ucode_hash) {
+          return;
+        }
+        disk_shaders_.insert(record.ucode_hash);
+
+        // The title may have loaded the shader already.
+        VulkanShader* shader;
+        auto it = shader_map_.find(record.ucode_hash);
+        if (it != shader_map_.end()) {
+          shader = it->second;
+          if (shader->is_translated() || pending_shaders_.count(shader)) {
+            return;
+          }
+        } else {
+          shader = new VulkanShader(
+              device_, ShaderType(record.shader_type), record.ucode_hash,
+              ucode.data(), record.ucode_dword_count);
+          shader_map_.insert({record.ucode_hash, shader});
+        }
+        if (shader->LoadTranslation(data + sizeof(record) + ucode_size,
+                                    record.translation_size) &&
+            shader->Prepare()) {
+          ++loaded_count;
+        }
+      });
+  XELOGGPU("Pipeline disk cache: restored %u shaders", loaded_count);
+}
+
+void PipelineCache::LoadPipelinesFromDisk(RenderCache* render_cache) {
+  std::vector<DiskPipelineRecord> records;
+  {
+    std::lock_guard<std::mutex> lock(disk_cache_mutex_);
+    pipeline_disk_file_ = OpenDiskCacheFile(
+        xe::join_paths(disk_cache_path_, L"pipelines.bin"),
+        kPipelineDiskCacheMagic, [&](const uint8_t* data, size_t size) {
+          if (size == sizeof(DiskPipelineRecord)) {
+            records.emplace_back();
+            std::memcpy(&records.back(), data, size);
+          }
+        });
+  }
+
+  auto find_shader = [this](uint64_t hash) -> VulkanShader* {
+    auto it = shader_map_.find(hash);
+    if (it == shader_map_.end() || pending_shaders_.count(it->second) ||
+        !it->second->is_valid()) {
+      return nullptr;
+    }
+    return it->second;
+  };
+
+  uint32_t queued_count = 0;
+  for (auto& record : records) {
+    VulkanShader* vertex_shader = find_shader(record.vertex_shader_hash);
+    VulkanShader* pixel_shader = nullptr;
+    if (record.pixel_shader_hash) {
+      pixel_shader = find_shader(record.pixel_shader_hash);
+      if (!pixel_shader) {
+        continue;
+      }
+    }
+    auto& job = record.job;
+    if (!vertex_shader || job.shader_stage_count > 3 ||
+        job.vertex_input_state.vertexBindingDescriptionCount ||
+        job.vertex_input_state.vertexAttributeDescriptionCount ||
+        job.color_blend_state.attachmentCount >
+            xe::countof(job.color_blend_attachments)) {
+      continue;
+    }
+    if (record.input_assembly_state_regs.expand_quad_lists !=
+        uint32_t(FLAGS_vulkan_expand_quad_lists)) {
+      // Made for the other way of drawing quad lists.
+      continue;
+    }
+
+    // Put the shaders back to get the hash UpdateState will produce.
+    record.shader_stages_regs.vertex_shader = vertex_shader;
+    record.shader_stages_regs.pixel_shader = pixel_shader;
+    record.vertex_input_state_regs.vertex_shader = vertex_shader;
+    uint64_t hash_key = HashDiskPipelineRecord(record);
+    {
+      std::lock_guard<std::mutex> lock(disk_cache_mutex_);
+      disk_pipelines_.insert(hash_key);
+    }
+    if (cached_pipelines_.count(hash_key) ||
+        pending_pipelines_.count(hash_key)) {
+      continue;
+    }
+
+    VkRenderPass render_pass =
+        render_cache->GetRenderPass(record.render_config);
+    if (!render_pass) {
+      continue;
+    }
+    bool stages_valid = true;
+    for (uint32_t i = 0; i < job.shader_stage_count; ++i) {
+      auto& stage = job.shader_stages[i];
+      stage.pNext = nullptr;
+      stage.pName = "main";
+      stage.pSpecializationInfo = nullptr;
+      switch (stage.stage) {
+        case VK_SHADER_STAGE_VERTEX_BIT:
+          stage.module = vertex_shader->shader_module();
+          break;
+        case VK_SHADER_STAGE_GEOMETRY_BIT:
+          stage.module = GetGeometryShader(
+              record.shader_stages_regs.primitive_type,
+              IsPolygonLineMode(record.shader_stages_regs.pa_su_sc_mode_cntl));
+          break;
+        case VK_SHADER_STAGE_FRAGMENT_BIT:
+          stage.module = pixel_shader ? pixel_shader->shader_module()
+                                      : dummy_pixel_shader_;
+          break;
+        default:
+          stage.module = nullptr;
+          break;
+      }
+      stages_valid &= stage.module != nullptr;
+    }
+    if (!stages_valid) {
+      continue;
+    }
+    job.hash_key = hash_key;
+    job.fallback_key = GetFallbackKey(record.shader_stages_regs, render_pass);
+    job.render_pass = render_pass;
+    job.vertex_input_state.pNext = nullptr;
+    job.vertex_input_state.pVertexBindingDescriptions = nullptr;
+    job.vertex_input_state.pVertexAttributeDescriptions = nullptr;
+    job.input_assembly_state.pNext = nullptr;
+    job.viewport_state.pNext = nullptr;
+    job.viewport_state.pViewports = nullptr;
+    job.viewport_state.pScissors = nullptr;
+    job.rasterization_state.pNext = nullptr;
+    job.multisample_state.pNext = nullptr;
+    job.multisample_state.pSampleMask = nullptr;
+    job.depth_stencil_state.pNext = nullptr;
+    job.color_blend_state.pNext = nullptr;
+
+    auto queued_job = std::make_shared<PipelineCreateJob>(job);
+    queued_job->color_blend_state.pAttachments =
+        queued_job->color_blend_attachments;
+    LinkJobSpecialization(queued_job.get());
+    pending_pipelines_.insert(hash_key);
+    QueuePipelineCreation(queued_job);
+    ++queued_count;
+  }
+  XELOGGPU("Pipeline disk cache: creating %u of %zu pipelines", queued_count,
+           records.size());
+}
+
+void PipelineCache::SaveShaderToDisk(VulkanShader* shader,
+                                     xenos::xe_gpu_program_cntl_t cntl) {
+  std::lock_guard<std::mutex> lock(disk_cache_mutex_);
+  if (!shader_disk_file_ ||
+      !disk_shaders_.insert(shader->ucode_data_hash()).second) {
+    return;
+  }
+  WriteDiskShaderRecord(shader_disk_file_, shader, cntl);
+}
+
+void PipelineCache::SavePipelineToDisk(const RenderState* render_state,
+                                       const PipelineCreateJob& job) {
+  std::lock_guard<std::mutex> lock(disk_cache_mutex_);
+  if (!pipeline_disk_file_ || !disk_pipelines_.insert(job.hash_key).second) {
+    return;
+  }
+  auto pixel_shader = update_shader_stages_regs_.pixel_shader;
+  DiskPipelineRecord record;
+  record.vertex_shader_hash =
+      update_shader_stages_regs_.vertex_shader->ucode_data_hash();
+  record.pixel_shader_hash = pixel_shader ? pixel_shader->ucode_data_hash() : 0;
+  record.render_config = render_state->config;
+  record.render_targets_regs = update_render_targets_regs_;
+  record.shader_stages_regs = update_shader_stages_regs_;
+  record.shader_stages_regs.vertex_shader = nullptr;
+  record.shader_stages_regs.pixel_shader = nullptr;
+  record.vertex_input_state_regs.vertex_shader = nullptr;
+  record.input_assembly_state_regs = update_input_assembly_state_regs_;
+  record.rasterization_state_regs = update_rasterization_state_regs_;
+  record.multisample_state_regs = update_multisample_state_regs_;
+  record.depth_stencil_state_regs = update_depth_stencil_state_regs_;
+  record.color_blend_state_regs = update_color_blend_state_regs_;
+  record.job = job;
+  WriteDiskCacheRecord(pipeline_disk_file_, &record, sizeof(record));
+}
+
+void PipelineCache::CloseDiskCache() {
+  if (disk_cache_path_.empty()) {
+    return;
+  }
+  // Only the instance appending to the cache rewrites the driver data.
+  bool disk_cache_writer;
+  {
+    std::lock_guard<std::mutex> lock(disk_cache_mutex_);
+    disk_cache_writer = pipeline_disk_file_ != nullptr;
+    if (shader_disk_file_) {
+      fclose(shader_disk_file_);
+      shader_disk_file_ = nullptr;
+    }
+    if (pipeline_disk_file_) {
+      fclose(pipeline_disk_file_);
+      pipeline_disk_file_ = nullptr;
+    }
+    disk_shaders_.clear();
+    disk_pipelines_.clear();
+  }
+
+  if (!disk_cache_writer) {
+    disk_cache_path_.clear();
+    return;
+  }
+
+  size_t data_size = 0;
+  VkResult status =
+      vkGetPipelineCacheData(*device_, pipeline_cache_, &data_size, nullptr);
+  std::vector<uint8_t> driver_data(data_size);
+  if (status == VK_SUCCESS && data_size) {
+    status = vkGetPipelineCacheData(*device_, pipeline_cache_, &data_size,
+                                    driver_data.data());
+  }
+  if (status == VK_SUCCESS && data_size) {
+    // Written aside and moved over the old one, which instances starting up
+    // may be reading.
+    auto path = xe::join_paths(disk_cache_path_, L"driver.bin");
+    auto temp_path = path + L".tmp";
+    auto file = xe::filesystem::OpenFile(temp_path, "wb");
+    DiskCacheHeader header = {kDriverDiskCacheMagic, kDiskCacheVersion};
+    bool written = file && fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   WriteDiskCacheRecord(file, driver_data.data(), data_size);
+    if (file) {
+      fclose(file);
+    }
+    written = written && xe::filesystem::RenameFile(temp_path, path);
+    if (!written) {
+      xe::filesystem::DeleteFile(temp_path);
+      XELOGW("Unable to write pipeline disk cache %S", path.c_str());
+    }
+  }
+  disk_cache_path_.clear();
+}
+
+uint64_t PipelineCache::HashDiskPipelineRecord(
+    const DiskPipelineRecord& record) {
+  // Must match the order of UpdateState. The viewport state isn't hashed.
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, &record.render_targets_regs,
+               sizeof(record.render_targets_regs));
+  XXH64_update(&hash_state, &record.shader_stages_regs,
+               sizeof(record.shader_stages_regs));
+  XXH64_update(&hash_state, &record.vertex_input_state_regs,
+               sizeof(record.vertex_input_state_regs));
+  XXH64_update(&hash_state, &record.input_assembly_state_regs,
+               sizeof(record.input_assembly_state_regs));
+  XXH64_update(&hash_state, &record.rasterization_state_regs,
+               sizeof(record.rasterization_state_regs));
+  XXH64_update(&hash_state, &record.multisample_state_regs,
+               sizeof(record.multisample_state_regs));
+  XXH64_update(&hash_state, &record.depth_stencil_state_regs,
+               sizeof(record.depth_stencil_state_regs));
+  XXH64_update(&hash_state, &record.color_blend_state_regs,
+               sizeof(record.color_blend_state_regs));
+  return XXH64_digest(&hash_state);
+}
+
 static void DumpShaderStatisticsAMD(const VkShaderStatisticsInfoAMD& stats) {
   XELOGI(" - resource usage:");
   XELOGI("   numUsedVgprs: %d", stats.resourceUsage.numUsedVgprs);
@@ -549,6 +1211,10 @@ VkShaderModule PipelineCache::GetGeometryShader(PrimitiveType primitive_type,
     case PrimitiveType::kRectangleList:
       return geometry_shaders_.rect_list;
     case PrimitiveType::kQuadList:
+      if (IsQuadListExpanded(primitive_type)) {
+        // Drawn with indices from BufferCache::UploadQuadListIndexBuffer.
+        return nullptr;
+      }
       return is_line_mode ? geometry_shaders_.line_quad_list
                           : geometry_shaders_.quad_list;
     case PrimitiveType::kQuadStrip:
@@ -575,6 +1241,12 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
 
   auto& regs = set_dynamic_state_registers_;
 
+  // Everything below only depends on the registers and full_update.
+  if (!register_file_->TestAndClearDirty(RegisterFile::kDirtyDynamicState) &&
+      !full_update) {
+    return true;
+  }
+
   bool window_offset_dirty = SetShadowRegister(&regs.pa_sc_window_offset,
                                                XE_GPU_REG_PA_SC_WINDOW_OFFSET);
   window_offset_dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
@@ -645,10 +1317,11 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
   auto surface_msaa =
       static_cast<MsaaSamples>((regs.rb_surface_info >> 16) & 0x3);
 
-  // Apply a multiplier to emulate MSAA.
+  // Apply a multiplier to emulate MSAA. Native MSAA targets are at the
+  // guest resolution.
   float window_width_scalar = 1;
   float window_height_scalar = 1;
-  switch (surface_msaa) {
+  switch (FLAGS_vulkan_native_msaa ? MsaaSamples::k1X : surface_msaa) {
     case MsaaSamples::k1X:
       break;
     case MsaaSamples::k2X:
@@ -865,20 +1538,7 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
       push_constants.window_scale[3] = (-1280.f / window_height_scalar) + 0.5f;
     }
 
-    // https://www.x.org/docs/AMD/old/evergreen_3D_registers_v2.pdf
-    // VTX_XY_FMT = true: the incoming XY have already been multiplied by 1/W0.
-    //            = false: multiply the X, Y coordinates by 1/W0.
-    // VTX_Z_FMT = true: the incoming Z has already been multiplied by 1/W0.
-    //           = false: multiply the Z coordinate by 1/W0.
-    // VTX_W0_FMT = true: the incoming W0 is not 1/W0. Perform the reciprocal to
-    //                    get 1/W0.
-    float vtx_xy_fmt = (regs.pa_cl_vte_cntl >> 8) & 0x1 ? 1.0f : 0.0f;
-    float vtx_z_fmt = (regs.pa_cl_vte_cntl >> 9) & 0x1 ? 1.0f : 0.0f;
-    float vtx_w0_fmt = (regs.pa_cl_vte_cntl >> 10) & 0x1 ? 1.0f : 0.0f;
-    push_constants.vtx_fmt[0] = vtx_xy_fmt;
-    push_constants.vtx_fmt[1] = vtx_xy_fmt;
-    push_constants.vtx_fmt[2] = vtx_z_fmt;
-    push_constants.vtx_fmt[3] = vtx_w0_fmt;
+    // The vertex format is a specialization constant.
 
     // Point size
     push_constants.point_size[0] =
@@ -897,16 +1557,8 @@ bool PipelineCache::SetDynamicState(VkCommandBuffer command_buffer,
           static_cast<float>(1 << color_info[i].color_exp_bias);
     }
 
-    // Alpha testing -- ALPHAREF, ALPHAFUNC, ALPHATESTENABLE
-    // Emulated in shader.
-    // if(ALPHATESTENABLE && frag_out.a [<=/ALPHAFUNC] ALPHAREF) discard;
-    // ALPHATESTENABLE
-    push_constants.alpha_test[0] =
-        (regs.rb_colorcontrol & 0x8) != 0 ? 1.0f : 0.0f;
-    // ALPHAFUNC
-    push_constants.alpha_test[1] =
-        static_cast<float>(regs.rb_colorcontrol & 0x7);
-    // ALPHAREF
+    // Alpha testing -- ALPHAREF. Emulated in shader, the function is a
+    // specialization constant.
     push_constants.alpha_test[2] = regs.rb_alpha_ref;
 
     // Whether to populate a register in the pixel shader with frag coord.
@@ -949,6 +1601,34 @@ bool PipelineCache::SetShadowRegister(float* dest, uint32_t register_name) {
   return true;
 }
 
+void PipelineCache::GetVertexEndians(VulkanShader* vertex_shader,
+                                     uint32_t* vertex_endian) {
+  vertex_endian[0] = vertex_endian[1] = 0;
+  if (!vertex_shader->is_translated()) {
+    return;
+  }
+  for (const auto& binding : vertex_shader->vertex_bindings()) {
+    int r = XE_GPU_REG_SHADER_CONSTANT_FETCH_00_0 +
+            (binding.fetch_constant / 3) * 6;
+    const auto group = reinterpret_cast<const xenos::xe_gpu_fetch_group_t*>(
+        &register_file_->values[r]);
+    uint32_t endian = 0;
+    switch (binding.fetch_constant % 3) {
+      case 0:
+        endian = group->vertex_fetch_0.endian;
+        break;
+      case 1:
+        endian = group->vertex_fetch_1.endian;
+        break;
+      case 2:
+        endian = group->vertex_fetch_2.endian;
+        break;
+    }
+    vertex_endian[binding.binding_index / 16] |=
+        endian << ((binding.binding_index % 16) * 2);
+  }
+}
+
 bool PipelineCache::SetShadowRegisterArray(uint32_t* dest, uint32_t num,
                                            uint32_t register_name) {
   bool dirty = false;
@@ -978,6 +1658,8 @@ PipelineCache::UpdateStatus PipelineCache::UpdateState(
     if (status == UpdateStatus::kError) {                    \
       XELOGE(error_message);                                 \
       return status;                                         \
+    } else if (status == UpdateStatus::kPending) {           \
+      return status;                                         \
     } else if (status == UpdateStatus::kMismatch) {          \
       mismatch = true;                                       \
     }                                                        \
@@ -1064,32 +1746,90 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
   dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
                              XE_GPU_REG_PA_SU_SC_MODE_CNTL);
   dirty |= SetShadowRegister(&regs.sq_program_cntl, XE_GPU_REG_SQ_PROGRAM_CNTL);
+  // VTX_XY_FMT, VTX_Z_FMT, VTX_W0_FMT.
+  uint32_t pa_cl_vte_cntl =
+      register_file_->values[XE_GPU_REG_PA_CL_VTE_CNTL].u32 & 0x700;
+  // ALPHAFUNC, ALPHATESTENABLE.
+  uint32_t rb_colorcontrol =
+      register_file_->values[XE_GPU_REG_RB_COLORCONTROL].u32 & 0xF;
+  dirty |= regs.pa_cl_vte_cntl != pa_cl_vte_cntl;
+  dirty |= regs.rb_colorcontrol != rb_colorcontrol;
+  regs.pa_cl_vte_cntl = pa_cl_vte_cntl;
+  regs.rb_colorcontrol = rb_colorcontrol;
+  // The vertex bindings are known once the shader is translated, which a new
+  // shader isn't yet, but then the stages are dirty anyway.
+  uint32_t vertex_endian[2];
+  GetVertexEndians(vertex_shader, vertex_endian);
+  dirty |= std::memcmp(regs.vertex_endian, vertex_endian,
+                       sizeof(vertex_endian)) != 0;
+  std::memcpy(regs.vertex_endian, vertex_endian, sizeof(vertex_endian));
   dirty |= regs.vertex_shader != vertex_shader;
   dirty |= regs.pixel_shader != pixel_shader;
   dirty |= regs.primitive_type != primitive_type;
   regs.vertex_shader = vertex_shader;
   regs.pixel_shader = pixel_shader;
   regs.primitive_type = primitive_type;
-  XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
+    XXH64_update(&hash_state_, &regs, sizeof(regs));
     return UpdateStatus::kCompatible;
   }
 
   xenos::xe_gpu_program_cntl_t sq_program_cntl;
   sq_program_cntl.dword_0 = regs.sq_program_cntl;
 
+  if (async_) {
+    bool vertex_pending =
+        QueueShaderTranslation(vertex_shader, sq_program_cntl);
+    bool pixel_pending =
+        pixel_shader && QueueShaderTranslation(pixel_shader, sq_program_cntl);
+    if (vertex_pending || pixel_pending) {
+      // Build the stages on a later draw, once the shaders are ready.
+      regs.Reset();
+      return UpdateStatus::kPending;
+    }
+  }
+
   if (!vertex_shader->is_translated() &&
-      !TranslateShader(vertex_shader, sq_program_cntl)) {
+      !TranslateShader(shader_translator_.get(), vertex_shader,
+                       sq_program_cntl)) {
     XELOGE("Failed to translate the vertex shader!");
     return UpdateStatus::kError;
   }
 
   if (pixel_shader && !pixel_shader->is_translated() &&
-      !TranslateShader(pixel_shader, sq_program_cntl)) {
+      !TranslateShader(shader_translator_.get(), pixel_shader,
+                       sq_program_cntl)) {
     XELOGE("Failed to translate the pixel shader!");
     return UpdateStatus::kError;
   }
 
+  GetVertexEndians(vertex_shader, regs.vertex_endian);
+  XXH64_update(&hash_state_, &regs, sizeof(regs));
+
+  // https://www.x.org/docs/AMD/old/evergreen_3D_registers_v2.pdf
+  // VTX_XY_FMT = true: the incoming XY have already been multiplied by 1/W0.
+  //            = false: multiply the X, Y coordinates by 1/W0.
+  // VTX_Z_FMT = true: the incoming Z has already been multiplied by 1/W0.
+  //           = false: multiply the Z coordinate by 1/W0.
+  // VTX_W0_FMT = true: the incoming W0 is not 1/W0. Perform the reciprocal to
+  //                    get 1/W0.
+  auto& specialization_constants =
+      update_shader_stages_specialization_constants_;
+  specialization_constants.vtx_xy_fmt = (pa_cl_vte_cntl >> 8) & 0x1;
+  specialization_constants.vtx_z_fmt = (pa_cl_vte_cntl >> 9) & 0x1;
+  specialization_constants.vtx_w0_fmt = (pa_cl_vte_cntl >> 10) & 0x1;
+  // Alpha testing -- ALPHAFUNC, ALPHATESTENABLE (always passing if disabled).
+  // if(ALPHATESTENABLE && frag_out.a [<=/ALPHAFUNC] ALPHAREF) discard;
+  specialization_constants.alpha_test_func =
+      (rb_colorcontrol & 0x8) ? (rb_colorcontrol & 0x7) : 7;
+  std::memcpy(specialization_constants.vertex_endian, regs.vertex_endian,
+              sizeof(specialization_constants.vertex_endian));
+  auto& specialization_info = update_shader_stages_specialization_info_;
+  specialization_info.mapEntryCount = kSpirvSpecializationConstantCount;
+  specialization_info.pMapEntries = GetSpecializationMapEntries();
+  specialization_info.dataSize = sizeof(specialization_constants);
+  specialization_info.pData = &specialization_constants;
+
   update_shader_stages_stage_count_ = 0;
 
   auto& vertex_pipeline_stage =
@@ -1101,16 +1841,10 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
   vertex_pipeline_stage.stage = VK_SHADER_STAGE_VERTEX_BIT;
   vertex_pipeline_stage.module = vertex_shader->shader_module();
   vertex_pipeline_stage.pName = "main";
-  vertex_pipeline_stage.pSpecializationInfo = nullptr;
+  vertex_pipeline_stage.pSpecializationInfo = &specialization_info;
 
-  bool is_line_mode = false;
-  if (((regs.pa_su_sc_mode_cntl >> 3) & 0x3) != 0) {
-    uint32_t front_poly_mode = (regs.pa_su_sc_mode_cntl >> 5) & 0x7;
-    if (front_poly_mode == 1) {
-      is_line_mode = true;
-    }
-  }
-  auto geometry_shader = GetGeometryShader(primitive_type, is_line_mode);
+  auto geometry_shader = GetGeometryShader(
+      primitive_type, IsPolygonLineMode(regs.pa_su_sc_mode_cntl));
   if (geometry_shader) {
     auto& geometry_pipeline_stage =
         update_shader_stages_info_[update_shader_stages_stage_count_++];
@@ -1134,7 +1868,7 @@ PipelineCache::UpdateStatus PipelineCache::UpdateShaderStages(
   pixel_pipeline_stage.module =
       pixel_shader ? pixel_shader->shader_module() : dummy_pixel_shader_;
   pixel_pipeline_stage.pName = "main";
-  pixel_pipeline_stage.pSpecializationInfo = nullptr;
+  pixel_pipeline_stage.pSpecializationInfo = &specialization_info;
 
   return UpdateStatus::kMismatch;
 }
@@ -1176,6 +1910,7 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
   dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
                              XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
   regs.primitive_type = primitive_type;
+  regs.expand_quad_lists = uint32_t(FLAGS_vulkan_expand_quad_lists);
   XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
@@ -1212,7 +1947,13 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
       state_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
       break;
     case PrimitiveType::kQuadList:
-      state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
+      if (!regs.expand_quad_lists) {
+        state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST_WITH_ADJACENCY;
+      } else if (IsPolygonLineMode(regs.pa_su_sc_mode_cntl)) {
+        state_info.topology = VK_PRIMITIVE_TOPOLOGY_LINE_LIST;
+      } else {
+        state_info.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+      }
       break;
     default:
     case PrimitiveType::kTriangleWithWFlags:
@@ -1230,8 +1971,10 @@ PipelineCache::UpdateStatus PipelineCache::UpdateInputAssemblyState(
   //   glProvokingVertex(GL_FIRST_VERTEX_CONVENTION);
   // }
 
-  // Primitive restart index is handled in the buffer cache.
-  if (regs.pa_su_sc_mode_cntl & (1 << 21)) {
+  // Primitive restart index is handled in the buffer cache. Expanded quad
+  // lists never contain it.
+  if ((regs.pa_su_sc_mode_cntl & (1 << 21)) &&
+      !IsQuadListExpanded(primitive_type)) {
     state_info.primitiveRestartEnable = VK_TRUE;
   } else {
     state_info.primitiveRestartEnable = VK_FALSE;
@@ -1264,17 +2007,21 @@ PipelineCache::UpdateStatus PipelineCache::UpdateRasterizationState(
 
   bool dirty = false;
   dirty |= regs.primitive_type != primitive_type;
-  dirty |= SetShadowRegister(&regs.pa_cl_clip_cntl, XE_GPU_REG_PA_CL_CLIP_CNTL);
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_tl,
-                             XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL);
-  dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_br,
-                             XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR);
-  dirty |= SetShadowRegister(&regs.pa_sc_viz_query, XE_GPU_REG_PA_SC_VIZ_QUERY);
-  dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
-                             XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
   regs.primitive_type = primitive_type;
+  if (register_file_->TestAndClearDirty(RegisterFile::kDirtyRasterization)) {
+    dirty |=
+        SetShadowRegister(&regs.pa_cl_clip_cntl, XE_GPU_REG_PA_CL_CLIP_CNTL);
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_tl,
+                               XE_GPU_REG_PA_SC_SCREEN_SCISSOR_TL);
+    dirty |= SetShadowRegister(&regs.pa_sc_screen_scissor_br,
+                               XE_GPU_REG_PA_SC_SCREEN_SCISSOR_BR);
+    dirty |=
+        SetShadowRegister(&regs.pa_sc_viz_query, XE_GPU_REG_PA_SC_VIZ_QUERY);
+    dirty |= SetShadowRegister(&regs.multi_prim_ib_reset_index,
+                               XE_GPU_REG_VGT_MULTI_PRIM_IB_RESET_INDX);
+  }
 
   // Vulkan doesn't support separate depth biases for different sides.
   // SetRenderState also accepts only one argument, so they should be rare.
@@ -1380,10 +2127,14 @@ PipelineCache::UpdateStatus PipelineCache::UpdateMultisampleState() {
   auto& state_info = update_multisample_state_info_;
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.pa_sc_aa_config, XE_GPU_REG_PA_SC_AA_CONFIG);
-  dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
-                             XE_GPU_REG_PA_SU_SC_MODE_CNTL);
-  dirty |= SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
+  if (register_file_->TestAndClearDirty(RegisterFile::kDirtyMultisample)) {
+    dirty |=
+        SetShadowRegister(&regs.pa_sc_aa_config, XE_GPU_REG_PA_SC_AA_CONFIG);
+    dirty |= SetShadowRegister(&regs.pa_su_sc_mode_cntl,
+                               XE_GPU_REG_PA_SU_SC_MODE_CNTL);
+    dirty |=
+        SetShadowRegister(&regs.rb_surface_info, XE_GPU_REG_RB_SURFACE_INFO);
+  }
   XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
@@ -1433,9 +2184,12 @@ PipelineCache::UpdateStatus PipelineCache::UpdateDepthStencilState() {
   auto& state_info = update_depth_stencil_state_info_;
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.rb_depthcontrol, XE_GPU_REG_RB_DEPTHCONTROL);
-  dirty |=
-      SetShadowRegister(&regs.rb_stencilrefmask, XE_GPU_REG_RB_STENCILREFMASK);
+  if (register_file_->TestAndClearDirty(RegisterFile::kDirtyDepthStencil)) {
+    dirty |=
+        SetShadowRegister(&regs.rb_depthcontrol, XE_GPU_REG_RB_DEPTHCONTROL);
+    dirty |= SetShadowRegister(&regs.rb_stencilrefmask,
+                               XE_GPU_REG_RB_STENCILREFMASK);
+  }
   XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
@@ -1515,17 +2269,21 @@ PipelineCache::UpdateStatus PipelineCache::UpdateColorBlendState() {
   auto& state_info = update_color_blend_state_info_;
 
   bool dirty = false;
-  dirty |= SetShadowRegister(&regs.rb_colorcontrol, XE_GPU_REG_RB_COLORCONTROL);
-  dirty |= SetShadowRegister(&regs.rb_color_mask, XE_GPU_REG_RB_COLOR_MASK);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[0], XE_GPU_REG_RB_BLENDCONTROL_0);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[1], XE_GPU_REG_RB_BLENDCONTROL_1);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[2], XE_GPU_REG_RB_BLENDCONTROL_2);
-  dirty |=
-      SetShadowRegister(&regs.rb_blendcontrol[3], XE_GPU_REG_RB_BLENDCONTROL_3);
-  dirty |= SetShadowRegister(&regs.rb_modecontrol, XE_GPU_REG_RB_MODECONTROL);
+  if (register_file_->TestAndClearDirty(RegisterFile::kDirtyColorBlend)) {
+    dirty |=
+        SetShadowRegister(&regs.rb_colorcontrol, XE_GPU_REG_RB_COLORCONTROL);
+    dirty |= SetShadowRegister(&regs.rb_color_mask, XE_GPU_REG_RB_COLOR_MASK);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[0],
+                               XE_GPU_REG_RB_BLENDCONTROL_0);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[1],
+                               XE_GPU_REG_RB_BLENDCONTROL_1);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[2],
+                               XE_GPU_REG_RB_BLENDCONTROL_2);
+    dirty |= SetShadowRegister(&regs.rb_blendcontrol[3],
+                               XE_GPU_REG_RB_BLENDCONTROL_3);
+    dirty |=
+        SetShadowRegister(&regs.rb_modecontrol, XE_GPU_REG_RB_MODECONTROL);
+  }
   XXH64_update(&hash_state_, &regs, sizeof(regs));
   if (!dirty) {
     return UpdateStatus::kCompatible;
@@ -10,7 +10,17 @@
 #ifndef XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 #define XENIA_GPU_VULKAN_PIPELINE_CACHE_H_
 
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "third_party/xxhash/xxhash.h"
 
@@ -37,6 +47,9 @@ class PipelineCache {
     kCompatible,
     kMismatch,
     kError,
+    // The pipeline (or a shader it needs) is still being created in the
+    // background and there is nothing compatible to draw with yet.
+    kPending,
   };
 
   PipelineCache(RegisterFile* register_file, ui::vulkan::VulkanDevice* device);
@@ -74,12 +87,96 @@ class PipelineCache {
   // Clears all cached content.
   void ClearCache();
 
+  // Publishes the per-frame counters and resets them.
+  void EndFrame();
+
+  // Lookups since the stats were last reset, for benchmarks. A pipeline is
+  // looked up for each draw that changes the state.
+  struct Stats {
+    uint64_t shader_hits;
+    uint64_t shader_misses;
+    uint64_t pipeline_hits;
+    uint64_t pipeline_misses;
+  };
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = {}; }
+
+  // Opens the on-disk cache for the title (--vulkan_pipeline_cache_path).
+  // Previously translated shaders are restored, and every pipeline the title
+  // created before is queued for creation on the background threads.
+  // Anything new is added to the cache as it is created.
+  void OpenDiskCache(uint32_t title_id, RenderCache* render_cache);
+
+  // Whether a primitive type is drawn as triangles (or lines in polygon line
+  // mode) with indices from BufferCache::UploadQuadListIndexBuffer instead of
+  // going through a geometry shader.
+  static bool IsQuadListExpanded(PrimitiveType primitive_type);
+  // Whether polygons are drawn as lines, which needs a geometry shader unless
+  // the quads are expanded.
+  static bool IsPolygonLineMode(uint32_t pa_su_sc_mode_cntl);
+
  private:
-  // Creates or retrieves an existing pipeline for the currently configured
-  // state.
-  VkPipeline GetPipeline(const RenderState* render_state, uint64_t hash_key);
+  // Everything vkCreateGraphicsPipelines reads, copied out of the update state
+  // so that the pipeline can be created later or on another thread.
+  struct PipelineCreateJob {
+    uint64_t hash_key;
+    // Identifies pipelines that differ only in fixed-function state.
+    uint64_t fallback_key;
+    VkPipelineShaderStageCreateInfo shader_stages[3];
+    uint32_t shader_stage_count;
+    VkPipelineVertexInputStateCreateInfo vertex_input_state;
+    VkPipelineInputAssemblyStateCreateInfo input_assembly_state;
+    VkPipelineViewportStateCreateInfo viewport_state;
+    VkPipelineRasterizationStateCreateInfo rasterization_state;
+    VkPipelineMultisampleStateCreateInfo multisample_state;
+    VkPipelineDepthStencilStateCreateInfo depth_stencil_state;
+    VkPipelineColorBlendStateCreateInfo color_blend_state;
+    VkPipelineColorBlendAttachmentState color_blend_attachments[4];
+    VkRenderPass render_pass;
+    // Of the vertex and fragment stages.
+    SpirvSpecializationConstants specialization_constants;
+    VkSpecializationInfo specialization_info;
+  };
+  // Points the stages of the job at its own specialization constants, after
+  // it has been copied.
+  static void LinkJobSpecialization(PipelineCreateJob* job);
 
-  bool TranslateShader(VulkanShader* shader, xenos::xe_gpu_program_cntl_t cntl);
+  // Creates or retrieves an existing pipeline for the currently configured
+  // state. In async mode this returns nullptr with *pending set while the
+  // pipeline is being created.
+  VkPipeline GetPipeline(const RenderState* render_state, uint64_t hash_key,
+                         bool* pending);
+  void SnapshotPipelineState(const RenderState* render_state,
+                             uint64_t hash_key, PipelineCreateJob* job);
+  VkPipeline CreatePipeline(const PipelineCreateJob& job);
+  // Creates the pipeline on a worker. The result is picked up by
+  // CollectCompletedWork.
+  void QueuePipelineCreation(std::shared_ptr<PipelineCreateJob> job);
+
+  bool TranslateShader(ShaderTranslator* shader_translator,
+                       VulkanShader* shader, xenos::xe_gpu_program_cntl_t cntl);
+  // Starts translating the shader in the background if it isn't already.
+  // Returns true if it is still being translated.
+  bool QueueShaderTranslation(VulkanShader* shader,
+                              xenos::xe_gpu_program_cntl_t cntl);
+
+  void StartWorkers();
+  void StopWorkers();
+  void WorkerMain();
+  void QueueWork(std::function<void(ShaderTranslator*)> work);
+  // Blocks until all queued work is done.
+  void WaitForWorkers();
+  // Picks up pipelines and shaders finished by the workers.
+  void CollectCompletedWork();
+
+  void SaveShaderToDisk(VulkanShader* shader,
+                        xenos::xe_gpu_program_cntl_t cntl);
+  void SavePipelineToDisk(const RenderState* render_state,
+                          const PipelineCreateJob& job);
+  void LoadShadersFromDisk();
+  void LoadPipelinesFromDisk(RenderCache* render_cache);
+  // Writes the driver pipeline cache and closes the files.
+  void CloseDiskCache();
 
   void DumpShaderDisasmAMD(VkPipeline pipeline);
   void DumpShaderDisasmNV(const VkGraphicsPipelineCreateInfo& info);
@@ -98,6 +195,14 @@ class PipelineCache {
   xe::ui::spirv::SpirvDisassembler disassembler_;
   // All loaded shaders mapped by their guest hash key.
   std::unordered_map<uint64_t, VulkanShader*> shader_map_;
+  // The last shader of each type loaded, with its ucode in guest byte order.
+  // Titles usually load the same shaders again for each draw, which is found
+  // by comparing the ucode instead of hashing it and looking it up.
+  struct LastLoadedShader {
+    VulkanShader* shader = nullptr;
+    std::vector<uint32_t> ucode;
+  };
+  LastLoadedShader last_loaded_shaders_[2];
 
   // Vulkan pipeline cache, which in theory helps us out.
   // This can be serialized to disk and reused, if we want.
@@ -129,6 +234,35 @@ class PipelineCache {
   // changed.
   VkPipeline current_pipeline_ = nullptr;
 
+  // Async creation (--vulkan_async_pipelines). Only the workers and the
+  // queues are shared with them; everything else stays on the command
+  // processor thread.
+  bool async_ = false;
+  std::vector<std::thread> workers_;
+  std::mutex work_mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable work_done_cv_;
+  std::deque<std::function<void(ShaderTranslator*)>> work_queue_;
+  size_t work_in_flight_ = 0;
+  bool workers_exiting_ = false;
+  struct CompletedPipeline {
+    uint64_t hash_key;
+    uint64_t fallback_key;
+    VkPipeline pipeline;
+  };
+  std::vector<CompletedPipeline> completed_pipelines_;
+  std::vector<VulkanShader*> completed_shaders_;
+  // Shaders being translated by the workers. Nothing else may touch them.
+  std::unordered_set<VulkanShader*> pending_shaders_;
+  // Pipelines being created, by hash key.
+  std::unordered_set<uint64_t> pending_pipelines_;
+  // The latest ready pipeline for each fallback key.
+  std::unordered_map<uint64_t, VkPipeline> fallback_pipelines_;
+  // Draws this frame that were skipped or substituted while waiting.
+  uint32_t skipped_draw_count_ = 0;
+  Stats stats_ = {};
+  uint32_t fallback_draw_count_ = 0;
+
  private:
   UpdateStatus UpdateState(VulkanShader* vertex_shader,
                            VulkanShader* pixel_shader,
@@ -150,6 +284,10 @@ class PipelineCache {
   bool SetShadowRegister(float* dest, uint32_t register_name);
   bool SetShadowRegisterArray(uint32_t* dest, uint32_t num,
                               uint32_t register_name);
+  // Packs the endians of the vertex fetch constants the translated vertex
+  // shader uses as SpirvSpecializationConstants::vertex_endian, or zeros if
+  // the shader isn't translated yet.
+  void GetVertexEndians(VulkanShader* vertex_shader, uint32_t* vertex_endian);
 
   struct UpdateRenderTargetsRegisters {
     uint32_t rb_modecontrol;
@@ -171,6 +309,10 @@ class PipelineCache {
     PrimitiveType primitive_type;
     uint32_t pa_su_sc_mode_cntl;
     uint32_t sq_program_cntl;
+    // Only the bits the shaders are specialized for.
+    uint32_t pa_cl_vte_cntl;
+    uint32_t rb_colorcontrol;
+    uint32_t vertex_endian[2];
     VulkanShader* vertex_shader;
     VulkanShader* pixel_shader;
 
@@ -178,6 +320,8 @@ class PipelineCache {
     void Reset() { std::memset(this, 0, sizeof(*this)); }
   } update_shader_stages_regs_;
   VkPipelineShaderStageCreateInfo update_shader_stages_info_[3];
+  SpirvSpecializationConstants update_shader_stages_specialization_constants_;
+  VkSpecializationInfo update_shader_stages_specialization_info_;
   uint32_t update_shader_stages_stage_count_ = 0;
 
   struct UpdateVertexInputStateRegisters {
@@ -195,6 +339,8 @@ class PipelineCache {
     PrimitiveType primitive_type;
     uint32_t pa_su_sc_mode_cntl;
     uint32_t multi_prim_ib_reset_index;
+    // --vulkan_expand_quad_lists, which changes the quad list topology.
+    uint32_t expand_quad_lists;
 
     UpdateInputAssemblyStateRegisters() { Reset(); }
     void Reset() { std::memset(this, 0, sizeof(*this)); }
@@ -267,6 +413,43 @@ class PipelineCache {
   VkPipelineColorBlendStateCreateInfo update_color_blend_state_info_;
   VkPipelineColorBlendAttachmentState update_color_blend_attachment_states_[4];
 
+  // A pipeline as stored on disk: the state it was hashed from, with the
+  // shaders replaced by their ucode hashes (and the pointers zeroed), and
+  // everything needed to create it again.
+  struct DiskPipelineRecord {
+    uint64_t vertex_shader_hash;
+    // 0 if there is no pixel shader.
+    uint64_t pixel_shader_hash;
+    RenderConfiguration render_config;
+    UpdateRenderTargetsRegisters render_targets_regs;
+    UpdateShaderStagesRegisters shader_stages_regs;
+    UpdateVertexInputStateRegisters vertex_input_state_regs;
+    UpdateInputAssemblyStateRegisters input_assembly_state_regs;
+    UpdateRasterizationStateRegisters rasterization_state_regs;
+    UpdateMultisampleStateeRegisters multisample_state_regs;
+    UpdateDepthStencilStateRegisters depth_stencil_state_regs;
+    UpdateColorBlendStateRegisters color_blend_state_regs;
+    // Pointers and handles in here are meaningless and set up again on load.
+    PipelineCreateJob job;
+  };
+  // Produces the same hash as UpdateState for the state in the record.
+  static uint64_t HashDiskPipelineRecord(const DiskPipelineRecord& record);
+  // Identifies pipelines that can stand in for each other while one is being
+  // created: same shaders, primitive type and render pass.
+  static uint64_t GetFallbackKey(const UpdateShaderStagesRegisters& regs,
+                                 VkRenderPass render_pass);
+
+  // On-disk cache. Shaders are saved from the workers, so the files are
+  // guarded by the mutex.
+  std::mutex disk_cache_mutex_;
+  std::wstring disk_cache_path_;
+  FILE* shader_disk_file_ = nullptr;
+  FILE* pipeline_disk_file_ = nullptr;
+  // Ucode hashes of the shaders already on disk.
+  std::unordered_set<uint64_t> disk_shaders_;
+  // Hash keys of the pipelines already on disk.
+  std::unordered_set<uint64_t> disk_pipelines_;
+
   struct SetDynamicStateRegisters {
     uint32_t pa_sc_window_offset;
 
@@ -0,0 +1,182 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/query_cache.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "xenia/base/profiling.h"
+#include "xenia/gpu/xenos.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using namespace xe::gpu::xenos;
+using xe::ui::vulkan::CheckResult;
+
+constexpr uint32_t QueryCache::kQueryCount;
+constexpr uint32_t QueryCache::kResetChunk;
+
+QueryCache::QueryCache(Memory* memory, ui::vulkan::VulkanDevice* device,
+                       ui::vulkan::CommandBufferPool* batch_pool)
+    : memory_(memory), device_(device), batch_pool_(batch_pool) {}
+
+QueryCache::~QueryCache() { Shutdown(); }
+
+VkResult QueryCache::Initialize() {
+  VkQueryPoolCreateInfo pool_info;
+  pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+  pool_info.pNext = nullptr;
+  pool_info.flags = 0;
+  pool_info.queryType = VK_QUERY_TYPE_OCCLUSION;
+  pool_info.queryCount = kQueryCount;
+  pool_info.pipelineStatistics = 0;
+  VkResult status =
+      vkCreateQueryPool(*device_, &pool_info, nullptr, &query_pool_);
+  CheckResult(status, "vkCreateQueryPool");
+  if (status != VK_SUCCESS) {
+    query_pool_ = nullptr;
+    return status;
+  }
+
+  // Without precise queries any non-zero count means some samples passed,
+  // which is still enough for visibility tests.
+  if (device_->device_info().features.occlusionQueryPrecise) {
+    control_flags_ = VK_QUERY_CONTROL_PRECISE_BIT;
+  }
+  return VK_SUCCESS;
+}
+
+void QueryCache::Shutdown() {
+  pending_queries_.clear();
+  query_active_ = false;
+  VK_SAFE_DESTROY(vkDestroyQueryPool, *device_, query_pool_, nullptr);
+}
+
+void QueryCache::BeginQuery(uint32_t guest_address) {
+  if (query_active_) {
+    // Its slots are still released in order, but nothing is written.
+    active_query_.guest_address = 0;
+    pending_queries_.push_back(active_query_);
+  }
+  WriteResults(guest_address, 0);
+
+  query_active_ = true;
+  active_query_.guest_address = guest_address;
+  active_query_.first_slot = next_slot_;
+  active_query_.slot_count = 0;
+  active_query_.fence = nullptr;
+}
+
+void QueryCache::EndQuery(uint32_t guest_address) {
+  if (!query_active_) {
+    // Nothing was counted.
+    WriteResults(guest_address, 0);
+    return;
+  }
+  query_active_ = false;
+  active_query_.guest_address = guest_address;
+  pending_queries_.push_back(active_query_);
+  Scavenge();
+}
+
+void QueryCache::BeginDraw(VkCommandBuffer command_buffer,
+                           VkCommandBuffer setup_buffer, VkFence batch_fence) {
+  if (!query_active_) {
+    return;
+  }
+  if (next_slot_ == reset_end_) {
+    if (reset_end_ + kResetChunk - oldest_slot_ > kQueryCount) {
+      // Too many results in flight, the draw stays uncounted.
+      COUNT_profile_add("gpu/query_cache/uncounted_draws", 1);
+      return;
+    }
+    vkCmdResetQueryPool(setup_buffer, query_pool_,
+                        uint32_t(reset_end_ % kQueryCount), kResetChunk);
+    reset_end_ += kResetChunk;
+  }
+  vkCmdBeginQuery(command_buffer, query_pool_,
+                  uint32_t(next_slot_ % kQueryCount), control_flags_);
+  ++next_slot_;
+  ++active_query_.slot_count;
+  active_query_.fence = batch_fence;
+  draw_query_open_ = true;
+}
+
+void QueryCache::EndDraw(VkCommandBuffer command_buffer) {
+  if (!draw_query_open_) {
+    return;
+  }
+  vkCmdEndQuery(command_buffer, query_pool_,
+                uint32_t((next_slot_ - 1) % kQueryCount));
+  draw_query_open_ = false;
+}
+
+void QueryCache::Scavenge() {
+  while (!pending_queries_.empty()) {
+    const Query& query = pending_queries_.front();
+    uint64_t samples = 0;
+    if (query.fence && (!batch_pool_->IsFenceSignaled(query.fence) ||
+                        !ReadResults(query, &samples))) {
+      // Batches complete in order, so the rest aren't ready either.
+      break;
+    }
+    if (query.guest_address) {
+      WriteResults(query.guest_address, samples);
+    }
+    oldest_slot_ = query.first_slot + query.slot_count;
+    pending_queries_.pop_front();
+  }
+  COUNT_profile_set("gpu/query_cache/pending_queries",
+                    pending_queries_.size());
+}
+
+bool QueryCache::ReadResults(const Query& query, uint64_t* samples) {
+  // Read in chunks, which never wrap around the end of the pool.
+  uint64_t results[kResetChunk];
+  uint64_t sum = 0;
+  uint64_t slot = query.first_slot;
+  uint64_t slot_end = query.first_slot + query.slot_count;
+  while (slot < slot_end) {
+    uint32_t first = uint32_t(slot % kQueryCount);
+    uint32_t count = uint32_t(std::min(
+        slot_end - slot, uint64_t(kResetChunk - first % kResetChunk)));
+    VkResult status = vkGetQueryPoolResults(
+        *device_, query_pool_, first, count, count * sizeof(uint64_t),
+        results, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if (status != VK_SUCCESS) {
+      return false;
+    }
+    for (uint32_t i = 0; i < count; ++i) {
+      sum += results[i];
+    }
+    slot += count;
+  }
+  *samples = sum;
+  return true;
+}
+
+void QueryCache::WriteResults(uint32_t guest_address, uint64_t samples) {
+  auto sample_counts =
+      memory_->TranslatePhysical<xe_gpu_depth_sample_counts*>(guest_address);
+  // Only the samples passing are known, so all are reported as passing.
+  uint32_t count = uint32_t(std::min(samples, uint64_t(UINT32_MAX)));
+  xe_gpu_depth_sample_counts results;
+  std::memset(&results, 0, sizeof(results));
+  results.Total_A = count;
+  results.ZPass_A = count;
+  std::memcpy(sample_counts, &results, sizeof(results));
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
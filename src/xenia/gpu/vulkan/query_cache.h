@@ -0,0 +1,96 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_QUERY_CACHE_H_
+#define XENIA_GPU_VULKAN_QUERY_CACHE_H_
+
+#include <cstdint>
+#include <deque>
+
+#include "xenia/memory.h"
+#include "xenia/ui/vulkan/fenced_pools.h"
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Counts the samples of guest occlusion queries with host occlusion queries,
+// one per draw made while a guest query is active, as a host query can't span
+// render passes. The results are written to guest memory once the batches
+// they were counted in complete, without ever waiting for them.
+class QueryCache {
+ public:
+  QueryCache(Memory* memory, ui::vulkan::VulkanDevice* device,
+             ui::vulkan::CommandBufferPool* batch_pool);
+  ~QueryCache();
+
+  VkResult Initialize();
+  void Shutdown();
+
+  // Begins a guest query, zeroing the sample counts at guest_address. A query
+  // still active is abandoned.
+  void BeginQuery(uint32_t guest_address);
+  // Ends the active guest query, to write its counts to guest_address.
+  void EndQuery(uint32_t guest_address);
+
+  // Called around each draw, inside its render pass. Slots are reset in the
+  // setup buffer, which executes before the command buffer.
+  void BeginDraw(VkCommandBuffer command_buffer, VkCommandBuffer setup_buffer,
+                 VkFence batch_fence);
+  void EndDraw(VkCommandBuffer command_buffer);
+
+  // Writes the results of the queries whose batches have completed.
+  void Scavenge();
+
+ private:
+  // Slots of the query pool, used as a ring in allocation order.
+  static constexpr uint32_t kQueryCount = 4096;
+  // Slots reset at once. kQueryCount must be a multiple of it.
+  static constexpr uint32_t kResetChunk = 64;
+
+  struct Query {
+    // Where to write the counts, or 0 if abandoned.
+    uint32_t guest_address;
+    // Slot serial of the first draw, followed by slot_count more.
+    uint64_t first_slot;
+    uint32_t slot_count;
+    // Batch of the last draw, or null without draws.
+    VkFence fence;
+  };
+
+  bool ReadResults(const Query& query, uint64_t* samples);
+  void WriteResults(uint32_t guest_address, uint64_t samples);
+
+  Memory* memory_ = nullptr;
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+  ui::vulkan::CommandBufferPool* batch_pool_ = nullptr;
+
+  VkQueryPool query_pool_ = nullptr;
+  VkQueryControlFlags control_flags_ = 0;
+
+  // Serials of the next slot to allocate, of the oldest slot not read back
+  // yet, and of the end of the slots reset so far.
+  uint64_t next_slot_ = 0;
+  uint64_t oldest_slot_ = 0;
+  uint64_t reset_end_ = 0;
+
+  bool query_active_ = false;
+  Query active_query_;
+  bool draw_query_open_ = false;
+  // Ended queries waiting for their results, in order.
+  std::deque<Query> pending_queries_;
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_QUERY_CACHE_H_
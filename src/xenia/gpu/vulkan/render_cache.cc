@@ -19,6 +19,10 @@
 #include "xenia/gpu/registers.h"
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 
+DEFINE_int32(vulkan_tile_view_max_idle_frames, 300,
+             "Frames an EDRAM tile view may go unused before it's freed. "
+             "Never less than --vulkan_max_frames_in_flight.");
+
 namespace xe {
 namespace gpu {
 namespace vulkan {
@@ -28,6 +32,8 @@ using xe::ui::vulkan::CheckResult;
 
 constexpr uint32_t kEdramBufferCapacity = 10 * 1024 * 1024;
 
+DEFINE_profile_gpu(gpu_render_pass, "host_gpu", "RenderPass");
+
 ColorRenderTargetFormat GetBaseRTFormat(ColorRenderTargetFormat format) {
   switch (format) {
     case ColorRenderTargetFormat::k_8_8_8_8_GAMMA:
@@ -82,6 +88,28 @@ VkFormat DepthRenderTargetFormatToVkFormat(DepthRenderTargetFormat format) {
   }
 }
 
+// The samples of the tile views of a surface. Without native MSAA, the
+// samples are pixels of a single sampled view at a larger size.
+uint16_t GetTileViewSamples(MsaaSamples samples) {
+  return FLAGS_vulkan_native_msaa ? static_cast<uint16_t>(samples) : 0;
+}
+
+// Size of the framebuffer of a surface, stretched by MSAA unless natively
+// multisampled.
+VkExtent2D GetSurfaceExtent(const RenderConfiguration& config) {
+  uint32_t width = config.surface_pitch_px;
+  uint32_t height = config.surface_height_px;
+  if (!FLAGS_vulkan_native_msaa) {
+    if (config.surface_msaa == MsaaSamples::k4X) {
+      width *= 2;
+    }
+    if (config.surface_msaa != MsaaSamples::k1X) {
+      height *= 2;
+    }
+  }
+  return {std::min(width, 2560u), std::min(height, 2560u)};
+}
+
 // Cached framebuffer referencing tile attachments.
 // Each framebuffer is specific to a render pass. Ugh.
 class CachedFramebuffer {
@@ -212,6 +240,7 @@ VkResult CachedTileView::Initialize(VkCommandBuffer command_buffer) {
   } else {
     image_info.samples = VK_SAMPLE_COUNT_1_BIT;
   }
+  format = image_info.format;
   sample_count = image_info.samples;
   image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
   image_info.usage = VK_IMAGE_USAGE_TRANSFER_SRC_BIT |
@@ -369,15 +398,8 @@ bool CachedFramebuffer::IsCompatible(
     const RenderConfiguration& desired_config) const {
   // We already know all render pass things line up, so let's verify dimensions,
   // edram offsets, etc. We need an exact match.
-  uint32_t surface_pitch_px = desired_config.surface_msaa != MsaaSamples::k4X
-                                  ? desired_config.surface_pitch_px
-                                  : desired_config.surface_pitch_px * 2;
-  uint32_t surface_height_px = desired_config.surface_msaa == MsaaSamples::k1X
-                                   ? desired_config.surface_height_px
-                                   : desired_config.surface_height_px * 2;
-  surface_pitch_px = std::min(surface_pitch_px, 2560u);
-  surface_height_px = std::min(surface_height_px, 2560u);
-  if (surface_pitch_px != width || surface_height_px != height) {
+  VkExtent2D extent = GetSurfaceExtent(desired_config);
+  if (extent.width != width || extent.height != height) {
     return false;
   }
   // TODO(benvanik): separate image views from images in tiles and store in fb?
@@ -619,14 +641,14 @@ void RenderCache::Shutdown() {
   // TODO(benvanik): wait for idle.
 
   // Dispose all render passes (and their framebuffers).
-  for (auto render_pass : cached_render_passes_) {
-    delete render_pass;
+  for (auto& it : cached_render_passes_) {
+    delete it.second;
   }
   cached_render_passes_.clear();
 
   // Dispose all of our cached tile views.
-  for (auto tile_view : cached_tile_views_) {
-    delete tile_view;
+  for (auto& it : cached_tile_views_) {
+    delete it.second;
   }
   cached_tile_views_.clear();
 
@@ -641,7 +663,11 @@ void RenderCache::Shutdown() {
   }
 }
 
-bool RenderCache::dirty() const {
+bool RenderCache::dirty() {
+  if (!register_file_->TestAndClearDirty(RegisterFile::kDirtyRenderTargets)) {
+    return false;
+  }
+
   auto& regs = *register_file_;
   auto& cur_regs = shadow_registers_;
 
@@ -658,18 +684,49 @@ bool RenderCache::dirty() const {
            regs[XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL].u32;
   dirty |= cur_regs.pa_sc_window_scissor_br !=
            regs[XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR].u32;
-  return dirty;
+  if (!dirty || !current_state_.render_pass) {
+    return dirty;
+  }
+
+  // Ending the pass would only store and reload the same attachments if the
+  // configuration comes out the same.
+  ShadowRegisters new_regs;
+  new_regs.rb_modecontrol.value = regs[XE_GPU_REG_RB_MODECONTROL].u32;
+  new_regs.rb_surface_info.value = regs[XE_GPU_REG_RB_SURFACE_INFO].u32;
+  new_regs.rb_color_info.value = regs[XE_GPU_REG_RB_COLOR_INFO].u32;
+  new_regs.rb_color1_info.value = regs[XE_GPU_REG_RB_COLOR1_INFO].u32;
+  new_regs.rb_color2_info.value = regs[XE_GPU_REG_RB_COLOR2_INFO].u32;
+  new_regs.rb_color3_info.value = regs[XE_GPU_REG_RB_COLOR3_INFO].u32;
+  new_regs.rb_depth_info.value = regs[XE_GPU_REG_RB_DEPTH_INFO].u32;
+  new_regs.pa_sc_window_scissor_tl =
+      regs[XE_GPU_REG_PA_SC_WINDOW_SCISSOR_TL].u32;
+  new_regs.pa_sc_window_scissor_br =
+      regs[XE_GPU_REG_PA_SC_WINDOW_SCISSOR_BR].u32;
+  RenderConfiguration config = current_state_.config;
+  if (!ParseConfiguration(new_regs, &config) ||
+      !IsConfigurationEqual(config, current_state_.config)) {
+    return true;
+  }
+  shadow_registers_ = new_regs;
+  return false;
 }
 
 const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
+                                                VkCommandBuffer setup_buffer,
                                                 VulkanShader* vertex_shader,
                                                 VulkanShader* pixel_shader) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
 
-  assert_null(current_command_buffer_);
+  assert_true(!current_command_buffer_ ||
+              current_command_buffer_ == command_buffer);
+  if (current_command_buffer_ && !current_started_) {
+    // Replacing a pass that was configured but never drawn to.
+    ++empty_render_pass_count_;
+  }
   current_command_buffer_ = command_buffer;
+  current_started_ = false;
 
   // Lookup or construct a render pass compatible with our current state.
   auto config = &current_state_.config;
@@ -702,12 +759,14 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
     framebuffer = current_state_.framebuffer;
   } else {
     // Re-parse configuration.
-    if (!ParseConfiguration(config)) {
+    if (!ParseConfiguration(regs, config)) {
       return nullptr;
     }
 
     // Lookup or generate a new render pass and framebuffer for the new state.
-    if (!ConfigureRenderPass(command_buffer, config, &render_pass,
+    // New attachments are initialized in the setup buffer since a pass may
+    // still be open in the command buffer.
+    if (!ConfigureRenderPass(setup_buffer, config, &render_pass,
                              &framebuffer)) {
       return nullptr;
     }
@@ -739,6 +798,30 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
   if (!render_pass) {
     return nullptr;
   }
+  TouchFramebuffer(framebuffer);
+
+  if (pass_open_ && open_state_.render_pass == render_pass &&
+      open_state_.framebuffer == framebuffer &&
+      IsConfigurationEqual(open_state_.config, *config)) {
+    // Back to the pass that is still open - keep drawing into it.
+    current_started_ = true;
+    ++merged_render_pass_count_;
+  }
+
+  return &current_state_;
+}
+
+void RenderCache::StartRenderPass() {
+  assert_not_null(current_command_buffer_);
+  if (current_started_) {
+    return;
+  }
+  if (pass_open_) {
+    vkCmdEndRenderPass(current_command_buffer_);
+    LEAVE_profile_gpu(gpu_render_pass, pass_profile_tick_);
+  }
+
+  auto config = &current_state_.config;
 
   // Setup render pass in command buffer.
   // This is meant to preserve previous contents as we may be called
@@ -746,25 +829,15 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
   VkRenderPassBeginInfo render_pass_begin_info;
   render_pass_begin_info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
   render_pass_begin_info.pNext = nullptr;
-  render_pass_begin_info.renderPass = render_pass->handle;
-  render_pass_begin_info.framebuffer = framebuffer->handle;
+  render_pass_begin_info.renderPass = current_state_.render_pass_handle;
+  render_pass_begin_info.framebuffer = current_state_.framebuffer_handle;
 
   // Render into the entire buffer (or at least tell the API we are doing
   // this). In theory it'd be better to clip this to the scissor region, but
   // the docs warn anything but the full framebuffer may be slow.
   render_pass_begin_info.renderArea.offset.x = 0;
   render_pass_begin_info.renderArea.offset.y = 0;
-  render_pass_begin_info.renderArea.extent.width = config->surface_pitch_px;
-  render_pass_begin_info.renderArea.extent.height = config->surface_height_px;
-
-  if (config->surface_msaa == MsaaSamples::k2X) {
-    render_pass_begin_info.renderArea.extent.height =
-        std::min(config->surface_height_px * 2, 2560u);
-  } else if (config->surface_msaa == MsaaSamples::k4X) {
-    render_pass_begin_info.renderArea.extent.width *= 2;
-    render_pass_begin_info.renderArea.extent.height =
-        std::min(config->surface_height_px * 2, 2560u);
-  }
+  render_pass_begin_info.renderArea.extent = GetSurfaceExtent(*config);
 
   // Configure clear color, if clearing.
   // TODO(benvanik): enable clearing here during resolve?
@@ -772,15 +845,17 @@ const RenderState* RenderCache::BeginRenderPass(VkCommandBuffer command_buffer,
   render_pass_begin_info.pClearValues = nullptr;
 
   // Begin the render pass.
-  vkCmdBeginRenderPass(command_buffer, &render_pass_begin_info,
+  pass_profile_tick_ = ENTER_profile_gpu(gpu_render_pass);
+  vkCmdBeginRenderPass(current_command_buffer_, &render_pass_begin_info,
                        VK_SUBPASS_CONTENTS_INLINE);
-
-  return &current_state_;
+  open_state_ = current_state_;
+  pass_open_ = true;
+  current_started_ = true;
+  ++render_pass_begin_count_;
 }
 
-bool RenderCache::ParseConfiguration(RenderConfiguration* config) {
-  auto& regs = shadow_registers_;
-
+bool RenderCache::ParseConfiguration(const ShadowRegisters& regs,
+                                     RenderConfiguration* config) {
   // RB_MODECONTROL
   // Rough mode control (color, color+depth, etc).
   config->mode_control = regs.rb_modecontrol.edram_mode;
@@ -839,6 +914,67 @@ bool RenderCache::ParseConfiguration(RenderConfiguration* config) {
   return true;
 }
 
+bool RenderCache::IsConfigurationEqual(const RenderConfiguration& a,
+                                       const RenderConfiguration& b) {
+  if (a.mode_control != b.mode_control ||
+      a.surface_pitch_px != b.surface_pitch_px ||
+      a.surface_height_px != b.surface_height_px ||
+      a.surface_msaa != b.surface_msaa) {
+    return false;
+  }
+  for (int i = 0; i < 4; ++i) {
+    if (a.color[i].used != b.color[i].used ||
+        a.color[i].edram_base != b.color[i].edram_base ||
+        a.color[i].format != b.color[i].format) {
+      return false;
+    }
+  }
+  return a.depth_stencil.used == b.depth_stencil.used &&
+         a.depth_stencil.edram_base == b.depth_stencil.edram_base &&
+         a.depth_stencil.format == b.depth_stencil.format;
+}
+
+VkRenderPass RenderCache::GetRenderPass(const RenderConfiguration& config) {
+  CachedRenderPass* render_pass = FindOrCreateRenderPass(config);
+  return render_pass ? render_pass->handle : nullptr;
+}
+
+uint64_t RenderCache::GetRenderPassKey(const RenderConfiguration& config) {
+  uint64_t key = 0;
+  for (int i = 0; i < 4; ++i) {
+    key |= uint64_t(config.color[i].format) << (i * 8);
+  }
+  key |= uint64_t(config.depth_stencil.format) << 32;
+  if (FLAGS_vulkan_native_msaa) {
+    key |= uint64_t(config.surface_msaa) << 40;
+  }
+  return key;
+}
+
+CachedRenderPass* RenderCache::FindOrCreateRenderPass(
+    const RenderConfiguration& config) {
+  // Attempt to find the render pass in our cache.
+  uint64_t key = GetRenderPassKey(config);
+  auto it = cached_render_passes_.find(key);
+  if (it != cached_render_passes_.end()) {
+    assert_true(it->second->IsCompatible(config));
+    return it->second;
+  }
+
+  // If no render pass was found in the cache create a new one.
+  auto render_pass = new CachedRenderPass(*device_, config);
+  VkResult status = render_pass->Initialize();
+  if (status != VK_SUCCESS) {
+    XELOGE("%s: Failed to create render pass, status %s", __func__,
+           ui::vulkan::to_string(status));
+    delete render_pass;
+    return nullptr;
+  }
+
+  cached_render_passes_.emplace(key, render_pass);
+  return render_pass;
+}
+
 bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
                                       RenderConfiguration* config,
                                       CachedRenderPass** out_render_pass,
@@ -846,29 +982,9 @@ bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
   *out_render_pass = nullptr;
   *out_framebuffer = nullptr;
 
-  // TODO(benvanik): better lookup.
-  // Attempt to find the render pass in our cache.
-  CachedRenderPass* render_pass = nullptr;
-  for (auto cached_render_pass : cached_render_passes_) {
-    if (cached_render_pass->IsCompatible(*config)) {
-      // Found a match.
-      render_pass = cached_render_pass;
-      break;
-    }
-  }
-
-  // If no render pass was found in the cache create a new one.
+  CachedRenderPass* render_pass = FindOrCreateRenderPass(*config);
   if (!render_pass) {
-    render_pass = new CachedRenderPass(*device_, *config);
-    VkResult status = render_pass->Initialize();
-    if (status != VK_SUCCESS) {
-      XELOGE("%s: Failed to create render pass, status %s", __func__,
-             ui::vulkan::to_string(status));
-      delete render_pass;
-      return false;
-    }
-
-    cached_render_passes_.push_back(render_pass);
+    return false;
   }
 
   // TODO(benvanik): better lookup.
@@ -898,8 +1014,7 @@ bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
       //     xe::round_up(config->surface_height_px, tile_height) / tile_height;
       color_key.tile_height = 160;
       color_key.color_or_depth = 1;
-      color_key.msaa_samples =
-          0;  // static_cast<uint16_t>(config->surface_msaa);
+      color_key.msaa_samples = GetTileViewSamples(config->surface_msaa);
       color_key.edram_format = static_cast<uint16_t>(config->color[i].format);
       target_color_attachments[i] =
           FindOrCreateTileView(command_buffer, color_key);
@@ -917,8 +1032,7 @@ bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
     //     xe::round_up(config->surface_height_px, tile_height) / tile_height;
     depth_stencil_key.tile_height = 160;
     depth_stencil_key.color_or_depth = 0;
-    depth_stencil_key.msaa_samples =
-        0;  // static_cast<uint16_t>(config->surface_msaa);
+    depth_stencil_key.msaa_samples = GetTileViewSamples(config->surface_msaa);
     depth_stencil_key.edram_format =
         static_cast<uint16_t>(config->depth_stencil.format);
     auto target_depth_stencil_attachment =
@@ -928,16 +1042,9 @@ bool RenderCache::ConfigureRenderPass(VkCommandBuffer command_buffer,
       return false;
     }
 
-    uint32_t surface_pitch_px = config->surface_msaa != MsaaSamples::k4X
-                                    ? config->surface_pitch_px
-                                    : config->surface_pitch_px * 2;
-    uint32_t surface_height_px = config->surface_msaa == MsaaSamples::k1X
-                                     ? config->surface_height_px
-                                     : config->surface_height_px * 2;
-    surface_pitch_px = std::min(surface_pitch_px, 2560u);
-    surface_height_px = std::min(surface_height_px, 2560u);
+    VkExtent2D extent = GetSurfaceExtent(*config);
     framebuffer = new CachedFramebuffer(
-        *device_, render_pass->handle, surface_pitch_px, surface_height_px,
+        *device_, render_pass->handle, extent.width, extent.height,
         target_color_attachments, target_depth_stencil_attachment);
     VkResult status = framebuffer->Initialize();
     if (status != VK_SUCCESS) {
@@ -973,10 +1080,11 @@ CachedTileView* RenderCache::FindTileView(uint32_t base, uint32_t pitch,
   key.tile_width = xe::round_up(pitch, tile_width) / tile_width;
   key.tile_height = 160;
   key.color_or_depth = color_or_depth ? 1 : 0;
-  key.msaa_samples = 0;
+  key.msaa_samples = GetTileViewSamples(samples);
   key.edram_format = static_cast<uint16_t>(format);
   auto view = FindTileView(key);
   if (view) {
+    view->last_use_frame = frame_number_;
     return view;
   }
 
@@ -1001,7 +1109,7 @@ CachedTileView* RenderCache::FindOrCreateTileView(
     return nullptr;
   }
 
-  cached_tile_views_.push_back(tile_view);
+  cached_tile_views_.emplace(view_key.packed(), tile_view);
   return tile_view;
 }
 
@@ -1060,21 +1168,34 @@ void RenderCache::UpdateTileView(VkCommandBuffer command_buffer,
 
 CachedTileView* RenderCache::FindTileView(const TileViewKey& view_key) const {
   // Check the cache.
-  // TODO(benvanik): better lookup.
-  for (auto tile_view : cached_tile_views_) {
-    if (tile_view->IsEqual(view_key)) {
-      return tile_view;
+  auto it = cached_tile_views_.find(view_key.packed());
+  return it != cached_tile_views_.end() ? it->second : nullptr;
+}
+
+void RenderCache::TouchFramebuffer(CachedFramebuffer* framebuffer) {
+  for (int i = 0; i < 4; ++i) {
+    if (framebuffer->color_attachments[i]) {
+      framebuffer->color_attachments[i]->last_use_frame = frame_number_;
     }
   }
-
-  return nullptr;
+  if (framebuffer->depth_stencil_attachment) {
+    framebuffer->depth_stencil_attachment->last_use_frame = frame_number_;
+  }
 }
 
 void RenderCache::EndRenderPass() {
   assert_not_null(current_command_buffer_);
 
-  // End the render pass.
-  vkCmdEndRenderPass(current_command_buffer_);
+  // End the render pass, if any draws have been recorded into it.
+  if (!current_started_) {
+    ++empty_render_pass_count_;
+  }
+  if (pass_open_) {
+    vkCmdEndRenderPass(current_command_buffer_);
+    LEAVE_profile_gpu(gpu_render_pass, pass_profile_tick_);
+  }
+  pass_open_ = false;
+  current_started_ = false;
 
   // Copy all render targets back into our EDRAM buffer.
   // Don't bother waiting on this command to complete, as next render pass may
@@ -1118,10 +1239,166 @@ void RenderCache::EndRenderPass() {
   current_command_buffer_ = nullptr;
 }
 
+void RenderCache::EndFrame() {
+  COUNT_profile_set("gpu/render_cache/render_pass_begins",
+                    render_pass_begin_count_);
+  COUNT_profile_set("gpu/render_cache/empty_render_passes",
+                    empty_render_pass_count_);
+  COUNT_profile_set("gpu/render_cache/merged_render_passes",
+                    merged_render_pass_count_);
+  render_pass_begin_count_ = 0;
+  empty_render_pass_count_ = 0;
+  merged_render_pass_count_ = 0;
+  ++frame_number_;
+}
+
+void RenderCache::Scavenge() {
+  // The state may be reused without being configured again.
+  if (current_state_.framebuffer) {
+    TouchFramebuffer(current_state_.framebuffer);
+  }
+  if (open_state_.framebuffer) {
+    TouchFramebuffer(open_state_.framebuffer);
+  }
+
+  // Anything older than the frames in flight is done on the GPU.
+  uint64_t max_idle_frames =
+      uint64_t(std::max(std::max(FLAGS_vulkan_tile_view_max_idle_frames,
+                                 FLAGS_vulkan_max_frames_in_flight),
+                        1));
+  if (frame_number_ <= max_idle_frames) {
+    return;
+  }
+  uint64_t oldest_frame = frame_number_ - max_idle_frames;
+  auto is_stale = [oldest_frame](const CachedTileView* view) {
+    return view && view->last_use_frame < oldest_frame;
+  };
+
+  // Framebuffers attaching stale views go first.
+  for (auto& it : cached_render_passes_) {
+    auto& framebuffers = it.second->cached_framebuffers;
+    auto end = std::remove_if(
+        framebuffers.begin(), framebuffers.end(),
+        [&is_stale](CachedFramebuffer* framebuffer) {
+          bool stale = is_stale(framebuffer->depth_stencil_attachment);
+          for (int i = 0; i < 4 && !stale; ++i) {
+            stale = is_stale(framebuffer->color_attachments[i]);
+          }
+          if (stale) {
+            delete framebuffer;
+          }
+          return stale;
+        });
+    framebuffers.erase(end, framebuffers.end());
+  }
+
+  size_t evicted_count = 0;
+  for (auto it = cached_tile_views_.begin(); it != cached_tile_views_.end();) {
+    if (is_stale(it->second)) {
+      delete it->second;
+      it = cached_tile_views_.erase(it);
+      ++evicted_count;
+    } else {
+      ++it;
+    }
+  }
+  if (evicted_count) {
+    XELOGGPU("RenderCache: freed %zu idle tile views, %zu left", evicted_count,
+             cached_tile_views_.size());
+  }
+}
+
 void RenderCache::ClearCache() {
   // TODO(benvanik): caching.
 }
 
+TileViewSnapshot::~TileViewSnapshot() {
+  for (auto& it : copies_) {
+    delete it.second;
+  }
+}
+
+bool RenderCache::SnapshotTileViews(VkCommandBuffer command_buffer,
+                                    TileViewSnapshot* snapshot) {
+  // Created first, so that one barrier covers their initial transitions too.
+  for (auto& it : cached_tile_views_) {
+    auto copy = new CachedTileView(device_, edram_memory_, it.second->key);
+    if (copy->Initialize(command_buffer) != VK_SUCCESS) {
+      XELOGE("RenderCache: failed to create a tile view snapshot");
+      delete copy;
+      return false;
+    }
+    snapshot->copies_[it.first] = copy;
+  }
+
+  SnapshotBarrier(command_buffer, true);
+  for (auto& it : snapshot->copies_) {
+    CopyTileView(command_buffer, cached_tile_views_[it.first], it.second);
+  }
+  SnapshotBarrier(command_buffer, false);
+  return true;
+}
+
+void RenderCache::RestoreTileViews(VkCommandBuffer command_buffer,
+                                   const TileViewSnapshot& snapshot) {
+  SnapshotBarrier(command_buffer, true);
+  for (auto& it : snapshot.copies_) {
+    auto view_it = cached_tile_views_.find(it.first);
+    if (view_it != cached_tile_views_.end()) {
+      CopyTileView(command_buffer, it.second, view_it->second);
+    }
+  }
+  SnapshotBarrier(command_buffer, false);
+}
+
+void RenderCache::CopyTileView(VkCommandBuffer command_buffer,
+                               const CachedTileView* src,
+                               CachedTileView* dst) {
+  // Tile views always stay in the general layout.
+  VkImageCopy region;
+  region.srcSubresource.aspectMask =
+      src->key.color_or_depth
+          ? VK_IMAGE_ASPECT_COLOR_BIT
+          : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+  region.srcSubresource.mipLevel = 0;
+  region.srcSubresource.baseArrayLayer = 0;
+  region.srcSubresource.layerCount = 1;
+  region.srcOffset = {0, 0, 0};
+  region.dstSubresource = region.srcSubresource;
+  region.dstOffset = {0, 0, 0};
+  VkExtent2D size = src->GetSize();
+  region.extent = {size.width, size.height, 1};
+  vkCmdCopyImage(command_buffer, src->image, VK_IMAGE_LAYOUT_GENERAL,
+                 dst->image, VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+}
+
+void RenderCache::SnapshotBarrier(VkCommandBuffer command_buffer,
+                                  bool before) {
+  VkAccessFlags attachment_access =
+      VK_ACCESS_COLOR_ATTACHMENT_READ_BIT |
+      VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT |
+      VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT |
+      VK_ACCESS_TRANSFER_WRITE_BIT;
+  VkMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = before
+                              ? attachment_access
+                              : VK_ACCESS_TRANSFER_READ_BIT |
+                                    VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = before ? VK_ACCESS_TRANSFER_READ_BIT |
+                                       VK_ACCESS_TRANSFER_WRITE_BIT
+                                 : attachment_access;
+  vkCmdPipelineBarrier(command_buffer,
+                       before ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT
+                              : VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       before ? VK_PIPELINE_STAGE_TRANSFER_BIT
+                              : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                       0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
 void RenderCache::RawCopyToImage(VkCommandBuffer command_buffer,
                                  uint32_t edram_base, VkImage image,
                                  VkImageLayout image_layout,
@@ -1211,7 +1488,7 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
   // Grab a tile view that represents the source image.
   TileViewKey key;
   key.color_or_depth = color_or_depth ? 1 : 0;
-  key.msaa_samples = 0;  // static_cast<uint16_t>(num_samples);
+  key.msaa_samples = GetTileViewSamples(num_samples);
   key.edram_format = format;
   key.tile_offset = edram_base;
   key.tile_width = xe::round_up(pitch, tile_width) / tile_width;
@@ -1296,6 +1573,115 @@ void RenderCache::BlitToImage(VkCommandBuffer command_buffer,
                        nullptr, 1, &image_barrier);
 }
 
+CachedTileView* RenderCache::ResolveTileView(VkCommandBuffer command_buffer,
+                                             CachedTileView* view,
+                                             VkRect2D rect) {
+  if (view->sample_count == VK_SAMPLE_COUNT_1_BIT) {
+    return view;
+  }
+  if (!view->key.color_or_depth) {
+    // Would need VK_KHR_depth_stencil_resolve.
+    return nullptr;
+  }
+
+  TileViewKey key = view->key;
+  key.msaa_samples = 0;
+  auto resolved_view = FindOrCreateTileView(command_buffer, key);
+  if (!resolved_view) {
+    return nullptr;
+  }
+  resolved_view->last_use_frame = frame_number_;
+
+  VkImageMemoryBarrier image_barriers[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    auto& image_barrier = image_barriers[i];
+    image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    image_barrier.pNext = nullptr;
+    image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    image_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    image_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    image_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  }
+  image_barriers[0].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  image_barriers[0].image = view->image;
+  // Earlier reads of the resolved view, as well as writes to it.
+  image_barriers[1].srcAccessMask |=
+      VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+  image_barriers[1].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  image_barriers[1].image = resolved_view->image;
+  vkCmdPipelineBarrier(command_buffer,
+                       VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 2, image_barriers);
+
+  VkImageResolve image_resolve;
+  image_resolve.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  image_resolve.srcOffset = {rect.offset.x, rect.offset.y, 0};
+  image_resolve.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  image_resolve.dstOffset = image_resolve.srcOffset;
+  VkExtent2D size = view->GetSize();
+  image_resolve.extent = {
+      std::min(rect.extent.width, size.width - uint32_t(rect.offset.x)),
+      std::min(rect.extent.height, size.height - uint32_t(rect.offset.y)),
+      1};
+  vkCmdResolveImage(command_buffer, view->image, VK_IMAGE_LAYOUT_GENERAL,
+                    resolved_view->image, VK_IMAGE_LAYOUT_GENERAL, 1,
+                    &image_resolve);
+
+  image_barriers[0].srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  image_barriers[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  image_barriers[1].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  image_barriers[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT |
+                                    VK_ACCESS_TRANSFER_READ_BIT |
+                                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT |
+                           VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       0, 0, nullptr, 0, nullptr, 2, image_barriers);
+  return resolved_view;
+}
+
+void RenderCache::ResolveToImage(VkCommandBuffer command_buffer,
+                                 CachedTileView* view, VkImage image,
+                                 VkImageLayout image_layout,
+                                 VkRect2D src_rect, VkOffset2D dst_offset) {
+  assert_true(view->key.color_or_depth &&
+              view->sample_count != VK_SAMPLE_COUNT_1_BIT);
+  view->last_use_frame = frame_number_;
+
+  VkImageMemoryBarrier image_barrier;
+  image_barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  image_barrier.pNext = nullptr;
+  image_barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+  image_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  image_barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  image_barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  image_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  image_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  image_barrier.image = view->image;
+  image_barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &image_barrier);
+
+  VkImageResolve image_resolve;
+  image_resolve.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  image_resolve.srcOffset = {src_rect.offset.x, src_rect.offset.y, 0};
+  image_resolve.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  image_resolve.dstOffset = {dst_offset.x, dst_offset.y, 0};
+  image_resolve.extent = {src_rect.extent.width, src_rect.extent.height, 1};
+  vkCmdResolveImage(command_buffer, view->image, VK_IMAGE_LAYOUT_GENERAL,
+                    image, image_layout, 1, &image_resolve);
+
+  std::swap(image_barrier.srcAccessMask, image_barrier.dstAccessMask);
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &image_barrier);
+}
+
 void RenderCache::ClearEDRAMColor(VkCommandBuffer command_buffer,
                                   uint32_t edram_base,
                                   ColorRenderTargetFormat format,
@@ -1313,7 +1699,7 @@ void RenderCache::ClearEDRAMColor(VkCommandBuffer command_buffer,
   // Grab a tile view (as we need to clear an image first)
   TileViewKey key;
   key.color_or_depth = 1;
-  key.msaa_samples = 0;  // static_cast<uint16_t>(num_samples);
+  key.msaa_samples = GetTileViewSamples(num_samples);
   key.edram_format = static_cast<uint16_t>(format);
   key.tile_offset = edram_base;
   key.tile_width = xe::round_up(pitch, tile_width) / tile_width;
@@ -1349,7 +1735,7 @@ void RenderCache::ClearEDRAMDepthStencil(VkCommandBuffer command_buffer,
   // Grab a tile view (as we need to clear an image first)
   TileViewKey key;
   key.color_or_depth = 0;
-  key.msaa_samples = 0;  // static_cast<uint16_t>(num_samples);
+  key.msaa_samples = GetTileViewSamples(num_samples);
   key.edram_format = static_cast<uint16_t>(format);
   key.tile_offset = edram_base;
   key.tile_width = xe::round_up(pitch, tile_width) / tile_width;
@@ -10,6 +10,10 @@
 #ifndef XENIA_GPU_VULKAN_RENDER_CACHE_H_
 #define XENIA_GPU_VULKAN_RENDER_CACHE_H_
 
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/registers.h"
 #include "xenia/gpu/shader.h"
@@ -42,6 +46,13 @@ struct TileViewKey {
   uint16_t msaa_samples : 2;
   // Either ColorRenderTargetFormat or DepthRenderTargetFormat.
   uint16_t edram_format : 13;
+
+  // All the fields as one value, for hashing and comparing.
+  uint64_t packed() const {
+    uint64_t value;
+    std::memcpy(&value, this, sizeof(value));
+    return value;
+  }
 };
 static_assert(sizeof(TileViewKey) == 8, "Key must be tightly packed");
 
@@ -60,8 +71,11 @@ class CachedTileView {
   VkImageLayout image_layout = VK_IMAGE_LAYOUT_UNDEFINED;
   // Memory buffer
   VkDeviceMemory memory = nullptr;
-  // Image sample count
+  // Image format and sample count
+  VkFormat format = VK_FORMAT_UNDEFINED;
   VkSampleCountFlagBits sample_count = VK_SAMPLE_COUNT_1_BIT;
+  // Frame the view was last attached or resolved from in.
+  uint64_t last_use_frame = 0;
 
   // (if a depth view) Image view of depth aspect
   VkImageView image_view_depth = nullptr;
@@ -75,9 +89,7 @@ class CachedTileView {
   VkResult Initialize(VkCommandBuffer command_buffer);
 
   bool IsEqual(const TileViewKey& other_key) const {
-    auto a = reinterpret_cast<const uint64_t*>(&key);
-    auto b = reinterpret_cast<const uint64_t*>(&other_key);
-    return *a == *b;
+    return key.packed() == other_key.packed();
   }
 
   bool operator<(const CachedTileView& other) const {
@@ -131,6 +143,19 @@ struct RenderState {
   bool depth_attachment_written = false;
 };
 
+// Copies of the tile views that existed when it was taken, which they can be
+// restored to, such as to resume trace playback from a checkpoint. Takes as
+// much memory as the views themselves.
+class TileViewSnapshot {
+ public:
+  ~TileViewSnapshot();
+
+ private:
+  friend class RenderCache;
+  // By TileViewKey::packed.
+  std::unordered_map<uint64_t, CachedTileView*> copies_;
+};
+
 // Manages the virtualized EDRAM and the render target cache.
 //
 // On the 360 the render target is an opaque block of memory in EDRAM that's
@@ -281,26 +306,63 @@ class RenderCache {
   void Shutdown();
 
   // Call this to determine if you should start a new render pass or continue
-  // with an already open pass.
-  bool dirty() const;
+  // with an already open pass. Register changes that leave the parsed
+  // configuration as it is (such as a new window scissor) don't need a new
+  // pass.
+  bool dirty();
 
   CachedTileView* FindTileView(uint32_t base, uint32_t pitch,
                                MsaaSamples samples, bool color_or_depth,
                                uint32_t format);
 
   // Begins a render pass targeting the state-specified framebuffer formats.
-  // The command buffer will be transitioned into the render pass phase.
+  // Nothing is recorded into the command buffer until StartRenderPass, so a
+  // pass without draws costs nothing, and the previously started pass stays
+  // open until then in case the configuration comes back to it. Attachments
+  // created for the pass are initialized in the setup buffer.
   const RenderState* BeginRenderPass(VkCommandBuffer command_buffer,
+                                     VkCommandBuffer setup_buffer,
                                      VulkanShader* vertex_shader,
                                      VulkanShader* pixel_shader);
 
+  // Transitions the command buffer into the current render pass, ending the
+  // previously started one if it's different. Must be called before each
+  // command that needs to be recorded inside the pass.
+  void StartRenderPass();
+
   // Ends the current render pass.
   // The command buffer will be transitioned out of the render pass phase.
   void EndRenderPass();
 
+  // Publishes the per-frame render pass counters and resets them.
+  void EndFrame();
+  // Passes begun in the command buffer so far this frame.
+  uint32_t render_pass_begin_count() const { return render_pass_begin_count_; }
+
+  // Gets or creates a render pass compatible with the given configuration,
+  // outside of any command buffer. Returns nullptr on failure.
+  VkRenderPass GetRenderPass(const RenderConfiguration& config);
+
   // Clears all cached content.
   void ClearCache();
 
+  // Queues commands to copy the contents of all tile views into snapshot,
+  // which the command buffer must be completed before destroying.
+  // The command buffer must not be inside of a render pass when calling this.
+  bool SnapshotTileViews(VkCommandBuffer command_buffer,
+                         TileViewSnapshot* snapshot);
+  // Queues commands to copy the snapshot back into the tile views that still
+  // exist. Views created since keep their contents.
+  // The command buffer must not be inside of a render pass when calling this.
+  void RestoreTileViews(VkCommandBuffer command_buffer,
+                        const TileViewSnapshot& snapshot);
+
+  // Frees the tile views that haven't been used in
+  // --vulkan_tile_view_max_idle_frames, and the framebuffers attaching them.
+  // Must be called after EndFrame, once the frames using them may no longer
+  // be in flight.
+  void Scavenge();
+
   // Queues commands to copy EDRAM contents into an image.
   // The command buffer must not be inside of a render pass when calling this.
   void RawCopyToImage(VkCommandBuffer command_buffer, uint32_t edram_base,
@@ -308,7 +370,9 @@ class RenderCache {
                       bool color_or_depth, VkOffset3D offset,
                       VkExtent3D extents);
 
-  // Queues commands to blit EDRAM contents into an image.
+  // Queues commands to blit EDRAM contents into an image. Natively
+  // multisampled contents are resolved instead, so the image must then have
+  // the format of the tile view.
   // The command buffer must not be inside of a render pass when calling this.
   void BlitToImage(VkCommandBuffer command_buffer, uint32_t edram_base,
                    uint32_t pitch, uint32_t height, MsaaSamples num_samples,
@@ -316,6 +380,21 @@ class RenderCache {
                    bool color_or_depth, uint32_t format, VkFilter filter,
                    VkOffset3D offset, VkExtent3D extents);
 
+  // Returns a single sampled tile view with the contents of view within
+  // rect, resolving a natively multisampled color view into the view of the
+  // same EDRAM range without MSAA. Null for multisampled depth, which can't
+  // be resolved.
+  // The command buffer must not be inside of a render pass when calling this.
+  CachedTileView* ResolveTileView(VkCommandBuffer command_buffer,
+                                  CachedTileView* view, VkRect2D rect);
+  // Resolves src_rect of a natively multisampled color view into an image of
+  // the same format at dst_offset, in a layout it can be written in by
+  // transfers.
+  // The command buffer must not be inside of a render pass when calling this.
+  void ResolveToImage(VkCommandBuffer command_buffer, CachedTileView* view,
+                      VkImage image, VkImageLayout image_layout,
+                      VkRect2D src_rect, VkOffset2D dst_offset);
+
   // Queues commands to clear EDRAM contents with a solid color.
   // The command buffer must not be inside of a render pass when calling this.
   void ClearEDRAMColor(VkCommandBuffer command_buffer, uint32_t edram_base,
@@ -333,8 +412,6 @@ class RenderCache {
   void FillEDRAM(VkCommandBuffer command_buffer, uint32_t value);
 
  private:
-  // Parses the current state into a configuration object.
-  bool ParseConfiguration(RenderConfiguration* config);
 
   // Finds a tile view. Returns nullptr if none found matching the key.
   CachedTileView* FindTileView(const TileViewKey& view_key) const;
@@ -346,9 +423,24 @@ class RenderCache {
   void UpdateTileView(VkCommandBuffer command_buffer, CachedTileView* view,
                       bool load, bool insert_barrier = true);
 
+  // Copies between views of the same key. Synchronization is up to the
+  // caller.
+  static void CopyTileView(VkCommandBuffer command_buffer,
+                           const CachedTileView* src, CachedTileView* dst);
+  // Makes the tile view contents written so far visible to transfers, or the
+  // transfers visible to everything else.
+  static void SnapshotBarrier(VkCommandBuffer command_buffer, bool before);
+
+  // Marks the attachments of the framebuffer as used in this frame.
+  void TouchFramebuffer(CachedFramebuffer* framebuffer);
+
+  // Packs everything CachedRenderPass::IsCompatible compares.
+  static uint64_t GetRenderPassKey(const RenderConfiguration& config);
+
   // Gets or creates a render pass and frame buffer for the given configuration.
   // This attempts to reuse as much as possible across render passes and
   // framebuffers.
+  CachedRenderPass* FindOrCreateRenderPass(const RenderConfiguration& config);
   bool ConfigureRenderPass(VkCommandBuffer command_buffer,
                            RenderConfiguration* config,
                            CachedRenderPass** out_render_pass,
@@ -362,12 +454,15 @@ class RenderCache {
   // Buffer overlayed 1:1 with edram_memory_ to allow raw access.
   VkBuffer edram_buffer_ = nullptr;
 
-  // Cache of VkImage and VkImageView's for all of our EDRAM tilings.
-  // TODO(benvanik): non-linear lookup? Should only be a small number of these.
-  std::vector<CachedTileView*> cached_tile_views_;
+  // Cache of VkImage and VkImageView's for all of our EDRAM tilings, by
+  // TileViewKey::packed.
+  std::unordered_map<uint64_t, CachedTileView*> cached_tile_views_;
 
-  // Cache of render passes based on formats.
-  std::vector<CachedRenderPass*> cached_render_passes_;
+  // Cache of render passes based on formats, by GetRenderPassKey.
+  std::unordered_map<uint64_t, CachedRenderPass*> cached_render_passes_;
+
+  // Frames ended so far, for aging the tile views.
+  uint64_t frame_number_ = 0;
 
   // Shadows of the registers that impact the render pass we choose.
   // If the registers don't change between passes we can quickly reuse the
@@ -388,12 +483,33 @@ class RenderCache {
   } shadow_registers_;
   bool SetShadowRegister(uint32_t* dest, uint32_t register_name);
 
+  // Parses the register state into a configuration object.
+  static bool ParseConfiguration(const ShadowRegisters& regs,
+                                 RenderConfiguration* config);
+  static bool IsConfigurationEqual(const RenderConfiguration& a,
+                                   const RenderConfiguration& b);
+
   // Configuration used for the current/previous Begin/End, representing the
   // current shadow register state.
   RenderState current_state_;
 
   // Only valid during a BeginRenderPass/EndRenderPass block.
   VkCommandBuffer current_command_buffer_ = nullptr;
+
+  // The pass actually begun in current_command_buffer_, which may differ from
+  // current_state_ until the next StartRenderPass.
+  RenderState open_state_;
+  bool pass_open_ = false;
+  // GPU profiling scope of the open pass.
+  uint64_t pass_profile_tick_ = 0;
+  // Whether current_state_ is the open pass.
+  bool current_started_ = false;
+
+  // Per-frame counts of passes recorded, passes that were configured but
+  // never drawn to, and passes resumed rather than begun again.
+  uint32_t render_pass_begin_count_ = 0;
+  uint32_t empty_render_pass_count_ = 0;
+  uint32_t merged_render_pass_count_ = 0;
 };
 
 }  // namespace vulkan
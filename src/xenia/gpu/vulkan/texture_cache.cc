@@ -10,6 +10,8 @@
 #include "xenia/gpu/vulkan/texture_cache.h"
 #include "xenia/gpu/vulkan/texture_config.h"
 
+#include <algorithm>
+
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/memory.h"
@@ -35,6 +37,8 @@ using xe::ui::vulkan::CheckResult;
 constexpr uint32_t kMaxTextureSamplers = 32;
 constexpr VkDeviceSize kStagingBufferSize = 64 * 1024 * 1024;
 
+DEFINE_profile_gpu(gpu_texture_upload, "host_gpu", "TextureUpload");
+
 const char* get_dimension_name(Dimension dimension) {
   static const char* names[] = {
       "1D",
@@ -51,12 +55,16 @@ const char* get_dimension_name(Dimension dimension) {
 
 TextureCache::TextureCache(Memory* memory, RegisterFile* register_file,
                            TraceWriter* trace_writer,
-                           ui::vulkan::VulkanDevice* device)
+                           ui::vulkan::VulkanDevice* device,
+                           ui::vulkan::CommandBufferPool* batch_pool)
     : memory_(memory),
       register_file_(register_file),
       trace_writer_(trace_writer),
       device_(device),
-      staging_buffer_(device, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+      batch_pool_(batch_pool),
+      staging_buffer_(device,
+                      VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                          VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
                       kStagingBufferSize),
       wb_staging_buffer_(device, VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                          kStagingBufferSize) {}
@@ -74,9 +82,6 @@ VkResult TextureCache::Initialize() {
       *device_, 32768,
       std::vector<VkDescriptorPoolSize>(pool_sizes, std::end(pool_sizes)));
 
-  wb_command_pool_ = std::make_unique<ui::vulkan::CommandBufferPool>(
-      *device_, device_->queue_family_index());
-
   // Check some device limits
   // On low sampler counts: Rarely would we experience over 16 unique samplers.
   // This code could be refactored to scale up/down to the # of samplers.
@@ -92,6 +97,14 @@ VkResult TextureCache::Initialize() {
     // assert_always();
   }
 
+  if (FLAGS_vulkan_push_descriptors &&
+      device_->HasEnabledExtension(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME)) {
+    pfn_vkCmdPushDescriptorSetKHR_ =
+        (PFN_vkCmdPushDescriptorSetKHR)vkGetDeviceProcAddr(
+            *device_, "vkCmdPushDescriptorSetKHR");
+    push_descriptors_ = pfn_vkCmdPushDescriptorSetKHR_ != nullptr;
+  }
+
   // Create the descriptor set layout used for rendering.
   // We always have the same number of samplers but only some are used.
   // The shaders will alias the bindings to the 4 dimensional types.
@@ -108,6 +121,10 @@ VkResult TextureCache::Initialize() {
       VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
   descriptor_set_layout_info.pNext = nullptr;
   descriptor_set_layout_info.flags = 0;
+  if (push_descriptors_) {
+    descriptor_set_layout_info.flags |=
+        VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR;
+  }
   descriptor_set_layout_info.bindingCount =
       static_cast<uint32_t>(xe::countof(bindings));
   descriptor_set_layout_info.pBindings = bindings;
@@ -122,6 +139,25 @@ VkResult TextureCache::Initialize() {
   if (status != VK_SUCCESS) {
     return status;
   }
+  staging_buffer_.EnableGrowth(
+      uint32_t(std::max(FLAGS_vulkan_staging_growth_blocks, 0)));
+
+  // The buffer cache converts indices from the same import.
+  if (FLAGS_vulkan_import_guest_memory &&
+      (FLAGS_vulkan_gpu_texture_conversion ||
+       FLAGS_vulkan_gpu_index_conversion)) {
+    ImportGuestMemory();
+  }
+  if (FLAGS_vulkan_gpu_texture_conversion) {
+    texture_converter_ = std::make_unique<TextureConverter>(device_);
+    status = texture_converter_->Initialize(staging_buffer_.gpu_buffer(),
+                                            guest_buffer_);
+    if (status != VK_SUCCESS) {
+      XELOGW("Failed to set up GPU texture conversion, using the CPU instead");
+      texture_converter_.reset();
+      status = VK_SUCCESS;
+    }
+  }
 
   status = wb_staging_buffer_.Initialize();
   if (status != VK_SUCCESS) {
@@ -136,6 +172,23 @@ VkResult TextureCache::Initialize() {
       0, *device_, *device_, 0, 0, nullptr, nullptr, 0, nullptr, &vulkan_funcs,
   };
   status = vmaCreateAllocator(&alloc_info, &mem_allocator_);
+  if (status == VK_SUCCESS) {
+    // The bundled allocator can't query VK_EXT_memory_budget, so the budget
+    // is a share of the heap the textures go to at most.
+    memory_budget_ = 0;
+    if (FLAGS_vulkan_texture_budget_mb > 0) {
+      memory_budget_ = VkDeviceSize(FLAGS_vulkan_texture_budget_mb) << 20;
+    } else if (FLAGS_vulkan_texture_budget_mb == 0) {
+      const VkPhysicalDeviceMemoryProperties* memory_props = nullptr;
+      vmaGetMemoryProperties(mem_allocator_, &memory_props);
+      for (uint32_t i = 0; i < memory_props->memoryHeapCount; i++) {
+        const auto& heap = memory_props->memoryHeaps[i];
+        if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+          memory_budget_ = std::max(memory_budget_, heap.size / 4 * 3);
+        }
+      }
+    }
+  }
   if (status != VK_SUCCESS) {
     vkDestroyDescriptorSetLayout(*device_, texture_descriptor_set_layout_,
                                  nullptr);
@@ -147,18 +200,222 @@ VkResult TextureCache::Initialize() {
   invalidated_textures_ = &invalidated_textures_sets_[0];
 
   device_queue_ = device_->AcquireQueue(device_->queue_family_index());
+  if (FLAGS_vulkan_transfer_queue_uploads) {
+    InitializeTransferQueue();
+  }
   return VK_SUCCESS;
 }
 
+void TextureCache::ImportGuestMemory() {
+  if (!device_->HasEnabledExtension(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME) ||
+      !device_->HasEnabledExtension(
+          VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)) {
+    return;
+  }
+  auto get_host_pointer_properties =
+      (PFN_vkGetMemoryHostPointerPropertiesEXT)vkGetDeviceProcAddr(
+          *device_, "vkGetMemoryHostPointerPropertiesEXT");
+  if (!get_host_pointer_properties) {
+    return;
+  }
+
+  // The whole 512 MB physical address space. The physical membase is
+  // allocation granularity aligned, far more than any driver needs for
+  // imports.
+  const VkDeviceSize size = 0x20000000;
+  void* host_pointer = memory_->physical_membase();
+  if (device_->device_info().properties.limits.maxStorageBufferRange < size ||
+      (reinterpret_cast<uintptr_t>(host_pointer) & 0xFFFF)) {
+    return;
+  }
+  const auto handle_type =
+      VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+  VkMemoryHostPointerPropertiesEXT pointer_properties;
+  pointer_properties.sType =
+      VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT;
+  pointer_properties.pNext = nullptr;
+  VkResult status = get_host_pointer_properties(
+      *device_, handle_type, host_pointer, &pointer_properties);
+  if (status != VK_SUCCESS) {
+    return;
+  }
+
+  VkExternalMemoryBufferCreateInfoKHR external_info;
+  external_info.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+  external_info.pNext = nullptr;
+  external_info.handleTypes = handle_type;
+  VkBufferCreateInfo buffer_info;
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.pNext = &external_info;
+  buffer_info.flags = 0;
+  buffer_info.size = size;
+  buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buffer_info.queueFamilyIndexCount = 0;
+  buffer_info.pQueueFamilyIndices = nullptr;
+  status = vkCreateBuffer(*device_, &buffer_info, nullptr, &guest_buffer_);
+  if (status != VK_SUCCESS) {
+    guest_buffer_ = nullptr;
+    return;
+  }
+
+  VkMemoryRequirements requirements;
+  vkGetBufferMemoryRequirements(*device_, guest_buffer_, &requirements);
+  uint32_t memory_types =
+      requirements.memoryTypeBits & pointer_properties.memoryTypeBits;
+  uint32_t memory_type = 0;
+  if (!xe::bit_scan_forward(memory_types, &memory_type)) {
+    XELOGW("No memory type to import guest memory into");
+    vkDestroyBuffer(*device_, guest_buffer_, nullptr);
+    guest_buffer_ = nullptr;
+    return;
+  }
+
+  VkImportMemoryHostPointerInfoEXT import_info;
+  import_info.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT;
+  import_info.pNext = nullptr;
+  import_info.handleType = handle_type;
+  import_info.pHostPointer = host_pointer;
+  VkMemoryAllocateInfo alloc_info;
+  alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+  alloc_info.pNext = &import_info;
+  alloc_info.allocationSize = size;
+  alloc_info.memoryTypeIndex = memory_type;
+  status = vkAllocateMemory(*device_, &alloc_info, nullptr, &guest_memory_);
+  if (status == VK_SUCCESS) {
+    status = vkBindBufferMemory(*device_, guest_buffer_, guest_memory_, 0);
+  }
+  if (status != VK_SUCCESS) {
+    XELOGW("Failed to import guest memory");
+    VK_SAFE_DESTROY(vkFreeMemory, *device_, guest_memory_, nullptr);
+    VK_SAFE_DESTROY(vkDestroyBuffer, *device_, guest_buffer_, nullptr);
+    return;
+  }
+  XELOGI("Guest memory imported, data is converted straight from it");
+}
+
+void TextureCache::InitializeTransferQueue() {
+  // Transfer-only families are usually backed by DMA engines that run
+  // alongside rendering. Coarse image transfer granularities aren't supported
+  // since mips can be as small as a single block.
+  const auto& families = device_->device_info().queue_family_properties;
+  for (uint32_t i = 0; i < uint32_t(families.size()); i++) {
+    const auto& family = families[i];
+    if (!(family.queueFlags & VK_QUEUE_TRANSFER_BIT) ||
+        (family.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT))) {
+      continue;
+    }
+    const auto& granularity = family.minImageTransferGranularity;
+    if (granularity.width != 1 || granularity.height != 1 ||
+        granularity.depth != 1) {
+      continue;
+    }
+    transfer_queue_ = device_->AcquireQueue(i);
+    if (transfer_queue_) {
+      transfer_queue_family_index_ = i;
+      break;
+    }
+  }
+  if (!transfer_queue_) {
+    XELOGI("No dedicated transfer queue, uploading textures on graphics");
+    return;
+  }
+
+  transfer_command_pool_ = std::make_unique<ui::vulkan::CommandBufferPool>(
+      *device_, transfer_queue_family_index_);
+  transfer_staging_buffer_ = std::make_unique<ui::vulkan::CircularBuffer>(
+      device_, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, kStagingBufferSize);
+  VkResult status = transfer_staging_buffer_->Initialize();
+  transfer_staging_buffer_->EnableGrowth(
+      uint32_t(std::max(FLAGS_vulkan_staging_growth_blocks, 0)));
+  if (status == VK_SUCCESS) {
+    VkSemaphoreCreateInfo semaphore_info;
+    semaphore_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_info.pNext = nullptr;
+    semaphore_info.flags = 0;
+    status = vkCreateSemaphore(*device_, &semaphore_info, nullptr,
+                               &transfer_semaphore_);
+  }
+  if (status != VK_SUCCESS) {
+    XELOGW("Failed to set up the transfer queue, uploading on graphics");
+    ShutdownTransferQueue();
+  }
+}
+
+void TextureCache::ShutdownTransferQueue() {
+  if (!transfer_queue_) {
+    return;
+  }
+  if (transfer_command_buffer_) {
+    vkEndCommandBuffer(transfer_command_buffer_);
+    transfer_command_pool_->CancelBatch();
+    transfer_command_buffer_ = nullptr;
+  }
+  vkQueueWaitIdle(transfer_queue_);
+  if (transfer_command_pool_) {
+    transfer_command_pool_->Scavenge();
+    transfer_command_pool_.reset();
+  }
+  transfer_staging_buffer_.reset();
+  VK_SAFE_DESTROY(vkDestroySemaphore, *device_, transfer_semaphore_, nullptr);
+  device_->ReleaseQueue(transfer_queue_, transfer_queue_family_index_);
+  transfer_queue_ = nullptr;
+}
+
+VkCommandBuffer TextureCache::BeginTransferUploads() {
+  if (transfer_command_buffer_) {
+    return transfer_command_buffer_;
+  }
+  transfer_fence_ = transfer_command_pool_->BeginBatch();
+  transfer_command_buffer_ = transfer_command_pool_->AcquireEntry();
+
+  VkCommandBufferBeginInfo begin_info;
+  begin_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+  begin_info.pNext = nullptr;
+  begin_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+  begin_info.pInheritanceInfo = nullptr;
+  auto status = vkBeginCommandBuffer(transfer_command_buffer_, &begin_info);
+  CheckResult(status, "vkBeginCommandBuffer");
+  return transfer_command_buffer_;
+}
+
+VkSemaphore TextureCache::SubmitTransferUploads() {
+  if (!transfer_command_buffer_) {
+    return nullptr;
+  }
+  auto status = vkEndCommandBuffer(transfer_command_buffer_);
+  CheckResult(status, "vkEndCommandBuffer");
+  transfer_command_pool_->EndBatch();
+
+  VkSubmitInfo submit_info;
+  std::memset(&submit_info, 0, sizeof(submit_info));
+  submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+  submit_info.commandBufferCount = 1;
+  submit_info.pCommandBuffers = &transfer_command_buffer_;
+  submit_info.signalSemaphoreCount = 1;
+  submit_info.pSignalSemaphores = &transfer_semaphore_;
+  status = vkQueueSubmit(transfer_queue_, 1, &submit_info, transfer_fence_);
+  CheckResult(status, "vkQueueSubmit");
+
+  transfer_command_buffer_ = nullptr;
+  transfer_fence_ = nullptr;
+  return transfer_semaphore_;
+}
+
 void TextureCache::Shutdown() {
   if (device_queue_) {
     device_->ReleaseQueue(device_queue_, device_->queue_family_index());
   }
+  ShutdownTransferQueue();
 
   // Free all textures allocated.
   ClearCache();
   Scavenge();
 
+  texture_converter_.reset();
+  VK_SAFE_DESTROY(vkDestroyBuffer, *device_, guest_buffer_, nullptr);
+  VK_SAFE_DESTROY(vkFreeMemory, *device_, guest_memory_, nullptr);
+
   if (mem_allocator_ != nullptr) {
     vmaDestroyAllocator(mem_allocator_);
     mem_allocator_ = nullptr;
@@ -281,6 +538,7 @@ TextureCache::Texture* TextureCache::AllocateTexture(
     // Allocation failed.
     return nullptr;
   }
+  memory_usage_.Add(vma_info.size);
 
   auto texture = new Texture();
   texture->format = image_info.format;
@@ -290,18 +548,22 @@ TextureCache::Texture* TextureCache::AllocateTexture(
   texture->alloc_info = vma_info;
   texture->framebuffer = nullptr;
   texture->usage_flags = image_info.usage;
-  texture->access_watch_handle = 0;
+  texture->pending_invalidation = false;
+  texture->dirty_frame = 0;
+  texture->content_hash = 0;
   texture->texture_info = texture_info;
+  texture->last_used_frame = frame_index_;
+  texture->readback_data = nullptr;
+  texture->readback_fence = nullptr;
+  texture->readback_submitted = false;
   return texture;
 }
 
 bool TextureCache::FreeTexture(Texture* texture) {
-  if (texture->in_flight_fence) {
-    VkResult status = vkGetFenceStatus(*device_, texture->in_flight_fence);
-    if (status != VK_SUCCESS && status != VK_ERROR_DEVICE_LOST) {
-      // Texture still in flight.
-      return false;
-    }
+  if (texture->in_flight_fence &&
+      !batch_pool_->IsFenceSignaled(texture->in_flight_fence)) {
+    // Texture still in flight.
+    return false;
   }
 
   if (texture->framebuffer) {
@@ -313,12 +575,27 @@ bool TextureCache::FreeTexture(Texture* texture) {
     it = texture->views.erase(it);
   }
 
-  if (texture->access_watch_handle) {
-    memory_->CancelAccessWatch(texture->access_watch_handle);
-    texture->access_watch_handle = 0;
-  }
-
-  vmaDestroyImage(mem_allocator_, texture->image, texture->alloc);
+  UnwatchTexture(texture);
+  DropReadback(texture);
+  // Uploads recorded for a texture are committed before anything can free it,
+  // as it's in flight by then.
+  assert_true(std::none_of(
+      pending_uploads_.begin(), pending_uploads_.end(),
+      [texture](const PendingUpload& upload) {
+        return upload.image == texture->image;
+      }));
+  ForgetTextureContents(texture);
+
+  // Shared images are destroyed along with the last texture using them.
+  auto refs = shared_image_refs_.find(texture->image);
+  if (refs == shared_image_refs_.end()) {
+    vmaDestroyImage(mem_allocator_, texture->image, texture->alloc);
+    memory_usage_.Subtract(texture->alloc_info.size);
+  } else if (--refs->second == 1) {
+    shared_image_refs_.erase(refs);
+  }
+  COUNT_profile_set("gpu/texture_cache/shared_images",
+                    shared_image_refs_.size());
   delete texture;
   return true;
 }
@@ -326,31 +603,276 @@ bool TextureCache::FreeTexture(Texture* texture) {
 void TextureCache::WatchCallback(void* context_ptr, void* data_ptr,
                                  uint32_t address) {
   auto self = reinterpret_cast<TextureCache*>(context_ptr);
-  auto touched_texture = reinterpret_cast<Texture*>(data_ptr);
-  if (!touched_texture || !touched_texture->access_watch_handle ||
-      touched_texture->pending_invalidation) {
+  auto watch = reinterpret_cast<TextureWatch*>(data_ptr);
+  if (!watch || !watch->handle) {
     return;
   }
 
-  assert_not_zero(touched_texture->access_watch_handle);
   // Clear watch handle first so we don't redundantly
   // remove.
-  touched_texture->access_watch_handle = 0;
-  touched_texture->pending_invalidation = true;
+  watch->handle = 0;
+
+  auto touched_texture = watch->texture;
+  if (touched_texture->readback_data) {
+    // The CPU wants the resolved contents. The texture itself is still up to
+    // date, so it's only watched for writes again at the next Scavenge.
+    self->UnwatchTexture(touched_texture);
+    self->WriteReadback(touched_texture);
+    self->readback_rearm_textures_.insert(touched_texture);
+    return;
+  }
 
-  // Add to pending list so Scavenge will clean it up.
+  // Only the chunk under this watch has to be uploaded again. If the texture
+  // isn't demanded again soon Scavenge will clean it up.
   self->invalidated_textures_mutex_.lock();
-  self->invalidated_textures_->insert(touched_texture);
+  touched_texture->dirty_ranges.push_back(
+      {watch->address, watch->address + watch->length});
+  if (!touched_texture->pending_invalidation) {
+    touched_texture->pending_invalidation = true;
+    touched_texture->dirty_frame = self->frame_index_;
+    self->dirty_textures_.insert(touched_texture);
+  }
   self->invalidated_textures_mutex_.unlock();
 }
 
+void TextureCache::WatchTexture(Texture* texture) {
+  if (texture->watches.empty()) {
+    // Watches fire for a whole host page, and adding one fires any other
+    // watch on the same pages, so the chunks never share a page.
+    uint32_t page_size = uint32_t(xe::memory::page_size());
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+    const auto& memory_info = texture->texture_info.memory;
+    if (memory_info.base_address && memory_info.base_size) {
+      ranges.push_back(
+          {memory_info.base_address & ~(page_size - 1),
+           xe::round_up(memory_info.base_address + memory_info.base_size,
+                        page_size)});
+    }
+    if (memory_info.mip_address && memory_info.mip_size) {
+      std::pair<uint32_t, uint32_t> range = {
+          memory_info.mip_address & ~(page_size - 1),
+          xe::round_up(memory_info.mip_address + memory_info.mip_size,
+                       page_size)};
+      if (!ranges.empty() && range.first < ranges[0].second &&
+          ranges[0].first < range.second) {
+        ranges[0].first = std::min(ranges[0].first, range.first);
+        ranges[0].second = std::max(ranges[0].second, range.second);
+      } else {
+        ranges.push_back(range);
+      }
+    }
+
+    uint32_t max_chunks = kMaxWatchesPerTexture / uint32_t(ranges.size());
+    for (auto& range : ranges) {
+      uint32_t chunk_size = xe::round_up(
+          std::max((range.second - range.first) / max_chunks, page_size),
+          page_size);
+      for (uint32_t address = range.first; address < range.second;
+           address += chunk_size) {
+        auto watch = std::make_unique<TextureWatch>();
+        watch->texture = texture;
+        watch->address = address;
+        watch->length = std::min(chunk_size, range.second - address);
+        watch->handle = 0;
+        texture->watches.push_back(std::move(watch));
+      }
+    }
+  }
+
+  // Reads have to be caught as well while there are resolved contents to
+  // write out.
+  auto watch_type = cpu::MMIOHandler::kWatchWrite;
+  if (texture->readback_data) {
+    watch_type = cpu::MMIOHandler::kWatchReadWrite;
+  } else if (FLAGS_deferred_write_watches) {
+    watch_type = cpu::MMIOHandler::kWatchWriteDeferred;
+  }
+  for (auto& watch : texture->watches) {
+    if (!watch->handle) {
+      watch->handle = memory_->AddPhysicalAccessWatch(
+          watch->address, watch->length, watch_type, &WatchCallback, this,
+          watch.get());
+    }
+  }
+}
+
+void TextureCache::UnwatchTexture(Texture* texture) {
+  for (auto& watch : texture->watches) {
+    if (watch->handle) {
+      memory_->CancelAccessWatch(watch->handle);
+      watch->handle = 0;
+    }
+  }
+}
+
+void TextureCache::InvalidateTexture(Texture* texture) {
+  invalidated_textures_mutex_.lock();
+  invalidated_textures_->insert(texture);
+  invalidated_textures_mutex_.unlock();
+}
+
+uint64_t TextureCache::HashTextureContents(const TextureInfo& texture_info) {
+  TextureInfo layout = texture_info;
+  layout.memory.base_address = 0;
+  layout.memory.mip_address = 0;
+
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  XXH64_update(&hash_state, &layout, sizeof(layout));
+  if (texture_info.memory.base_address && texture_info.memory.base_size) {
+    XXH64_update(&hash_state,
+                 memory_->TranslatePhysical(texture_info.memory.base_address),
+                 texture_info.memory.base_size);
+  }
+  if (texture_info.memory.mip_address && texture_info.memory.mip_size) {
+    XXH64_update(&hash_state,
+                 memory_->TranslatePhysical(texture_info.memory.mip_address),
+                 texture_info.memory.mip_size);
+  }
+  // 0 means a texture without a known hash.
+  uint64_t hash = XXH64_digest(&hash_state);
+  return hash ? hash : 1;
+}
+
+TextureCache::Texture* TextureCache::AliasTexture(
+    Texture* texture, const TextureInfo& texture_info) {
+  auto alias = new Texture();
+  alias->format = texture->format;
+  alias->image = texture->image;
+  alias->image_layout = texture->image_layout;
+  alias->alloc = texture->alloc;
+  alias->alloc_info = texture->alloc_info;
+  alias->framebuffer = nullptr;
+  alias->usage_flags = texture->usage_flags;
+  alias->pending_invalidation = false;
+  alias->dirty_frame = 0;
+  alias->content_hash = 0;
+  alias->texture_info = texture_info;
+  // The image must be alive until the alias is done with it.
+  alias->in_flight_fence = texture->in_flight_fence;
+  alias->last_used_frame = frame_index_;
+  alias->readback_data = nullptr;
+  alias->readback_fence = nullptr;
+  alias->readback_submitted = false;
+
+  auto refs = shared_image_refs_.find(texture->image);
+  if (refs == shared_image_refs_.end()) {
+    shared_image_refs_[texture->image] = 2;
+  } else {
+    ++refs->second;
+  }
+  COUNT_profile_set("gpu/texture_cache/shared_images",
+                    shared_image_refs_.size());
+  return alias;
+}
+
+void TextureCache::ForgetTextureContents(Texture* texture) {
+  if (!texture->content_hash) {
+    return;
+  }
+  auto it = content_textures_.find(texture->content_hash);
+  if (it != content_textures_.end() && it->second == texture) {
+    content_textures_.erase(it);
+  }
+  texture->content_hash = 0;
+}
+
+bool TextureCache::UpdateTexture(VkCommandBuffer command_buffer,
+                                 VkFence completion_fence, Texture* texture) {
+  if (texture->in_flight_fence == completion_fence) {
+    // Already sampled by this batch, so the image can't be written to before
+    // the draws using the old contents.
+    return false;
+  }
+  if (IsTextureShared(texture)) {
+    // Other textures still need the old contents of the image.
+    return false;
+  }
+  ForgetTextureContents(texture);
+
+  const TextureInfo& src = texture->texture_info;
+  if (src.format == TextureFormat::k_24_8 ||
+      src.format == TextureFormat::k_24_8_FLOAT) {
+    return false;
+  }
+
+  std::vector<std::pair<uint32_t, uint32_t>> dirty_ranges;
+  invalidated_textures_mutex_.lock();
+  std::swap(dirty_ranges, texture->dirty_ranges);
+  texture->pending_invalidation = false;
+  invalidated_textures_mutex_.unlock();
+
+  // Rearm the watches before reading, so that writes made from now on are
+  // caught.
+  WatchTexture(texture);
+
+  std::vector<MipRows> parts;
+  for (uint32_t mip = src.mip_min_level; mip <= src.mip_max_level; mip++) {
+    uint32_t offset_x = 0;
+    uint32_t offset_y = 0;
+    uint32_t address = src.GetMipLocation(mip, &offset_x, &offset_y, true);
+    if (!address) {
+      return false;
+    }
+
+    auto src_extent = src.GetMipExtent(mip, true);
+    uint32_t src_pitch =
+        src_extent.block_pitch_h * src.format_info()->bytes_per_block();
+    uint32_t mip_length = src_pitch * src_extent.block_pitch_v *
+                          src_extent.depth;
+
+    // Find the written bytes of the mip.
+    uint32_t lo = UINT32_MAX;
+    uint32_t hi = 0;
+    for (auto& range : dirty_ranges) {
+      uint32_t range_lo = std::max(range.first, address);
+      uint32_t range_hi = std::min(range.second, address + mip_length);
+      if (range_lo < range_hi) {
+        lo = std::min(lo, range_lo - address);
+        hi = std::max(hi, range_hi - address);
+      }
+    }
+    if (lo >= hi) {
+      continue;
+    }
+
+    // Rows can only be picked out of single-face mips starting at the
+    // beginning of their surface, and that keep their block size. Tiled
+    // rows are stored in bands of 32.
+    bool split_rows = !offset_x && !offset_y && src_extent.depth == 1 &&
+                      src.dimension != Dimension::kCube &&
+                      GetFormatInfo(src.format) == src.format_info();
+    if (!split_rows) {
+      parts.push_back({mip, 0, kAllRows});
+      continue;
+    }
+    uint32_t rows_per_band = src.is_tiled ? 32 : 1;
+    uint32_t band_length = src_pitch * rows_per_band;
+    uint32_t first_row = lo / band_length * rows_per_band;
+    uint32_t end_row = xe::round_up(hi, band_length) / band_length *
+                       rows_per_band;
+    if (first_row >= src_extent.block_height) {
+      continue;
+    }
+    parts.push_back({mip, first_row, end_row - first_row});
+  }
+
+  if (parts.empty()) {
+    return true;
+  }
+  return UploadTexture(command_buffer, completion_fence, texture, src,
+                       &parts);
+}
+
 TextureCache::Texture* TextureCache::DemandResolveTexture(
     const TextureInfo& texture_info) {
   auto texture_hash = texture_info.hash();
   for (auto it = textures_.find(texture_hash); it != textures_.end(); ++it) {
     if (it->second->texture_info == texture_info) {
-      if (it->second->pending_invalidation) {
-        // This texture has been invalidated!
+      if (it->second->pending_invalidation || IsTextureShared(it->second)) {
+        // This texture has been invalidated! Resolving into an image shared
+        // with other textures would overwrite them as well.
+        InvalidateTexture(it->second);
         RemoveInvalidatedTextures();
         break;
       }
@@ -396,18 +918,9 @@ TextureCache::Texture* TextureCache::DemandResolveTexture(
           get_dimension_name(texture_info.dimension)));
 
   // Setup an access watch. If this texture is touched, it is destroyed.
-  if (texture_info.memory.base_address && texture_info.memory.base_size) {
-    texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-        texture_info.memory.base_address, texture_info.memory.base_size,
-        cpu::MMIOHandler::kWatchWrite, &WatchCallback, this, texture);
-  } else if (texture_info.memory.mip_address && texture_info.memory.mip_size) {
-    texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-        texture_info.memory.mip_address, texture_info.memory.mip_size,
-        cpu::MMIOHandler::kWatchWrite, &WatchCallback, this, texture);
-  }
+  WatchTexture(texture);
 
-  textures_[texture_hash] = texture;
-  COUNT_profile_set("gpu/texture_cache/textures", textures_.size());
+  AddTexture(texture_hash, texture);
   return texture;
 }
 
@@ -419,9 +932,14 @@ TextureCache::Texture* TextureCache::Demand(const TextureInfo& texture_info,
   for (auto it = textures_.find(texture_hash); it != textures_.end(); ++it) {
     if (it->second->texture_info == texture_info) {
       if (it->second->pending_invalidation) {
-        // This texture has been invalidated!
-        RemoveInvalidatedTextures();
-        break;
+        // Parts of this texture have been written to. Upload them again if
+        // possible, otherwise replace the texture.
+        if (!command_buffer ||
+            !UpdateTexture(command_buffer, completion_fence, it->second)) {
+          InvalidateTexture(it->second);
+          RemoveInvalidatedTextures();
+          break;
+        }
       }
 
       if (texture_info.memory.base_address) {
@@ -432,17 +950,53 @@ TextureCache::Texture* TextureCache::Demand(const TextureInfo& texture_info,
         trace_writer_->WriteMemoryReadCached(texture_info.memory.mip_address,
                                              texture_info.memory.mip_size);
       }
+      ++stats_.hits;
       return it->second;
     }
   }
 
+  // What the guest resolved into it can be sampled as is.
+  auto resolve_target = FindResolveTarget(texture_info);
+  if (resolve_target) {
+    if (texture_info.memory.base_address) {
+      trace_writer_->WriteMemoryReadCached(texture_info.memory.base_address,
+                                           texture_info.memory.base_size);
+    }
+    ++stats_.resolve_hits;
+    return resolve_target;
+  }
+
   if (!command_buffer) {
     // Texture not found and no command buffer was passed, preventing us from
     // uploading a new one.
     return nullptr;
   }
 
+  // The same data may have already been uploaded for another address.
+  uint64_t content_hash = 0;
+  if (FLAGS_vulkan_texture_dedup) {
+    content_hash = HashTextureContents(texture_info);
+    auto content_it = content_textures_.find(content_hash);
+    if (content_it != content_textures_.end() &&
+        !content_it->second->pending_invalidation) {
+      auto texture = AliasTexture(content_it->second, texture_info);
+      if (texture_info.memory.base_address) {
+        trace_writer_->WriteMemoryReadCached(texture_info.memory.base_address,
+                                             texture_info.memory.base_size);
+      }
+      if (texture_info.memory.mip_address) {
+        trace_writer_->WriteMemoryReadCached(texture_info.memory.mip_address,
+                                             texture_info.memory.mip_size);
+      }
+      AddTexture(texture_hash, texture);
+      WatchTexture(texture);
+      ++stats_.content_hits;
+      return texture;
+    }
+  }
+
   // Create a new texture and cache it.
+  ++stats_.misses;
   auto texture = AllocateTexture(texture_info);
   if (!texture) {
     // Failed to allocate texture (out of memory)
@@ -486,21 +1040,16 @@ TextureCache::Texture* TextureCache::Demand(const TextureInfo& texture_info,
           texture_info.format_info()->name,
           get_dimension_name(texture_info.dimension)));
 
-  textures_[texture_hash] = texture;
-  COUNT_profile_set("gpu/texture_cache/textures", textures_.size());
-
-  // Okay. Put a writewatch on it to tell us if it's been modified from the
-  // guest.
-  if (texture_info.memory.base_address && texture_info.memory.base_size) {
-    texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-        texture_info.memory.base_address, texture_info.memory.base_size,
-        cpu::MMIOHandler::kWatchWrite, &WatchCallback, this, texture);
-  } else if (texture_info.memory.mip_address && texture_info.memory.mip_size) {
-    texture->access_watch_handle = memory_->AddPhysicalAccessWatch(
-        texture_info.memory.mip_address, texture_info.memory.mip_size,
-        cpu::MMIOHandler::kWatchWrite, &WatchCallback, this, texture);
+  AddTexture(texture_hash, texture);
+  if (content_hash) {
+    texture->content_hash = content_hash;
+    content_textures_[content_hash] = texture;
   }
 
+  // Okay. Put writewatches on it to tell us which parts of it have been
+  // modified from the guest.
+  WatchTexture(texture);
+
   return texture;
 }
 
@@ -794,12 +1343,80 @@ TextureCache::Texture* TextureCache::Lookup(const TextureInfo& texture_info) {
   return nullptr;
 }
 
+void TextureCache::AddTexture(uint64_t texture_hash, Texture* texture) {
+  auto it = textures_.find(texture_hash);
+  if (it != textures_.end()) {
+    RemoveTexture(it->second);
+  }
+  textures_[texture_hash] = texture;
+  textures_by_address_.emplace(texture->texture_info.memory.base_address,
+                               texture);
+  max_indexed_texture_size_ = std::max(max_indexed_texture_size_,
+                                       texture->texture_info.memory.base_size);
+  COUNT_profile_set("gpu/texture_cache/textures", textures_.size());
+}
+
+void TextureCache::RemoveTexture(Texture* texture) {
+  auto it = textures_.find(texture->texture_info.hash());
+  if (it == textures_.end() || it->second != texture) {
+    // Replaced by another texture with the same hash already.
+    return;
+  }
+  textures_.erase(it);
+  auto range = textures_by_address_.equal_range(
+      texture->texture_info.memory.base_address);
+  for (auto address_it = range.first; address_it != range.second;
+       ++address_it) {
+    if (address_it->second == texture) {
+      textures_by_address_.erase(address_it);
+      break;
+    }
+  }
+}
+
+TextureCache::Texture* TextureCache::FindResolveTarget(
+    const TextureInfo& texture_info) {
+  if (texture_info.dimension != Dimension::k2D ||
+      texture_info.mip_levels() != 1 || !texture_info.memory.base_address) {
+    return nullptr;
+  }
+  VkFormat host_format =
+      texture_configs[int(texture_info.format_info()->format)].host_format;
+  auto range =
+      textures_by_address_.equal_range(texture_info.memory.base_address);
+  for (auto it = range.first; it != range.second; ++it) {
+    Texture* texture = it->second;
+    const auto& other_info = texture->texture_info;
+    if (!(texture->usage_flags &
+          (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+           VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) ||
+        texture->pending_invalidation || texture->format != host_format ||
+        other_info.dimension != Dimension::k2D ||
+        other_info.width != texture_info.width ||
+        other_info.height != texture_info.height ||
+        other_info.pitch != texture_info.pitch ||
+        other_info.is_tiled != texture_info.is_tiled ||
+        other_info.endianness != texture_info.endianness ||
+        !TextureFormatIsSimilar(other_info.format, texture_info.format)) {
+      continue;
+    }
+    return texture;
+  }
+  return nullptr;
+}
+
 TextureCache::Texture* TextureCache::LookupAddress(uint32_t guest_address,
                                                    uint32_t width,
                                                    uint32_t height,
                                                    TextureFormat format,
                                                    VkOffset2D* out_offset) {
-  for (auto it = textures_.begin(); it != textures_.end(); ++it) {
+  // Only textures starting less than the largest size below the address can
+  // contain it.
+  uint32_t first_address = guest_address > max_indexed_texture_size_
+                               ? guest_address - max_indexed_texture_size_
+                               : 0;
+  for (auto it = textures_by_address_.lower_bound(first_address);
+       it != textures_by_address_.end() && it->first <= guest_address; ++it) {
     const auto& texture_info = it->second->texture_info;
     if (guest_address >= texture_info.memory.base_address &&
         guest_address <
@@ -836,6 +1453,7 @@ TextureCache::Texture* TextureCache::LookupAddress(uint32_t guest_address,
 
 void TextureCache::FlushPendingCommands(VkCommandBuffer command_buffer,
                                         VkFence completion_fence) {
+  CommitUploads(command_buffer);
   auto status = vkEndCommandBuffer(command_buffer);
   CheckResult(status, "vkEndCommandBuffer");
 
@@ -845,6 +1463,17 @@ void TextureCache::FlushPendingCommands(VkCommandBuffer command_buffer,
   submit_info.commandBufferCount = 1;
   submit_info.pCommandBuffers = &command_buffer;
 
+  // The command buffer may acquire images from the transfer queue.
+  VkSemaphore transfer_semaphore = SubmitTransferUploads();
+  VkPipelineStageFlags transfer_wait_stage =
+      VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  if (transfer_semaphore) {
+    submit_info.waitSemaphoreCount = 1;
+    submit_info.pWaitSemaphores = &transfer_semaphore;
+    submit_info.pWaitDstStageMask = &transfer_wait_stage;
+  }
+
   if (device_queue_) {
     auto status =
         vkQueueSubmit(device_queue_, 1, &submit_info, completion_fence);
@@ -871,7 +1500,8 @@ void TextureCache::FlushPendingCommands(VkCommandBuffer command_buffer,
 }
 
 bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
-                                  uint32_t mip, const TextureInfo& src) {
+                                  uint32_t mip, const TextureInfo& src,
+                                  uint32_t first_row, uint32_t row_count) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
@@ -884,7 +1514,6 @@ bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
 
   void* host_address = memory_->TranslatePhysical(address);
 
-  auto is_cube = src.dimension == Dimension::kCube;
   auto src_extent = src.GetMipExtent(mip, true);
   auto dst_extent = GetMipExtent(src, mip);
 
@@ -895,13 +1524,21 @@ bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
 
   auto copy_block = GetFormatCopyBlock(src.format);
 
+  // Partial uploads are only made of whole mips or of rows of single-face
+  // mips that aren't converted to another block size.
+  uint32_t src_row_end =
+      std::min(src_extent.block_height, first_row + row_count);
+  uint32_t dst_row_end =
+      std::min(dst_extent.block_height, first_row + row_count);
+  assert_true(first_row == 0 || dst_extent.depth == 1);
+
   const uint8_t* src_mem = reinterpret_cast<const uint8_t*>(host_address);
   if (!src.is_tiled) {
     for (uint32_t face = 0; face < dst_extent.depth; face++) {
       src_mem += offset_y * src_pitch;
       src_mem += offset_x * src.format_info()->bytes_per_block();
-      for (uint32_t y = 0; y < dst_extent.block_height; y++) {
-        copy_block(src.endianness, dest + y * dst_pitch,
+      for (uint32_t y = first_row; y < dst_row_end; y++) {
+        copy_block(src.endianness, dest + (y - first_row) * dst_pitch,
                    src_mem + y * src_pitch, dst_pitch);
       }
       src_mem += src_pitch * src_extent.block_pitch_v;
@@ -914,9 +1551,9 @@ bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
       texture_conversion::UntileInfo untile_info;
       std::memset(&untile_info, 0, sizeof(untile_info));
       untile_info.offset_x = offset_x;
-      untile_info.offset_y = offset_y;
+      untile_info.offset_y = offset_y + first_row;
       untile_info.width = src_extent.block_width;
-      untile_info.height = src_extent.block_height;
+      untile_info.height = src_row_end - first_row;
       untile_info.input_pitch = src_extent.block_pitch_h;
       untile_info.output_pitch = dst_extent.block_pitch_h;
       untile_info.input_format_info = src.format_info();
@@ -930,26 +1567,200 @@ bool TextureCache::ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
     }
   }
 
+  FillCopyRegion(copy_region, mip, src, first_row, row_count);
+  return true;
+}
+
+void TextureCache::FillCopyRegion(VkBufferImageCopy* copy_region,
+                                  uint32_t mip, const TextureInfo& src,
+                                  uint32_t first_row, uint32_t row_count) {
+  auto is_cube = src.dimension == Dimension::kCube;
+  auto dst_extent = GetMipExtent(src, mip);
+  uint32_t block_height = GetFormatInfo(src.format)->block_height;
+  uint32_t height = std::max(1u, (src.height + 1) >> mip);
+  uint32_t first_y = std::min(height, first_row * block_height);
+  uint32_t row_height = row_count >= dst_extent.block_height
+                            ? height
+                            : row_count * block_height;
   copy_region->bufferRowLength = dst_extent.pitch;
   copy_region->bufferImageHeight = dst_extent.height;
   copy_region->imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
   copy_region->imageSubresource.mipLevel = mip;
   copy_region->imageSubresource.baseArrayLayer = 0;
   copy_region->imageSubresource.layerCount = !is_cube ? 1 : dst_extent.depth;
+  copy_region->imageOffset = {0, int32_t(first_y), 0};
   copy_region->imageExtent.width = std::max(1u, (src.width + 1) >> mip);
-  copy_region->imageExtent.height = std::max(1u, (src.height + 1) >> mip);
+  copy_region->imageExtent.height = std::min(height - first_y, row_height);
   copy_region->imageExtent.depth = !is_cube ? dst_extent.depth : 1;
+}
+
+uint32_t TextureCache::ComputeUploadStorage(const TextureInfo& src,
+                                            const MipRows& part) {
+  if (part.first_row == 0 && part.row_count == kAllRows) {
+    return ComputeMipStorage(src, part.mip);
+  }
+  auto dst_extent = GetMipExtent(src, part.mip);
+  uint32_t rows = std::min(part.row_count,
+                           dst_extent.block_height - part.first_row);
+  return xe::round_up(dst_extent.block_pitch_h *
+                          GetFormatInfo(src.format)->bytes_per_block() * rows,
+                      4u);
+}
+
+bool TextureCache::GetGpuConversion(const TextureInfo& src, uint32_t mip,
+                                    TextureConverter::Mode* mode,
+                                    TextureConverter::Constants* constants) {
+  uint32_t offset_x = 0;
+  uint32_t offset_y = 0;
+  uint32_t address = src.GetMipLocation(mip, &offset_x, &offset_y, true);
+  if (!address) {
+    return false;
+  }
+
+  // Find which part of the guest data the mip is in.
+  uint32_t data_base = 0;
+  uint32_t data_offset = 0;
+  uint32_t data_size = 0;
+  if (src.memory.base_address && address >= src.memory.base_address &&
+      address - src.memory.base_address < src.memory.base_size) {
+    data_offset = address - src.memory.base_address;
+    data_size = src.memory.base_size;
+  } else if (src.memory.mip_address && address >= src.memory.mip_address &&
+             address - src.memory.mip_address < src.memory.mip_size) {
+    data_base = xe::round_up(src.memory.base_size, 4u);
+    data_offset = address - src.memory.mip_address;
+    data_size = src.memory.mip_size;
+  } else {
+    return false;
+  }
+
+  auto src_format_info = src.format_info();
+  auto dst_format_info = GetFormatInfo(src.format);
+  uint32_t bytes_per_block = src_format_info->bytes_per_block();
+  uint32_t log2_bpp =
+      (bytes_per_block / 4) + ((bytes_per_block / 2) >> (bytes_per_block / 4));
+  if (bytes_per_block != 1u << log2_bpp) {
+    return false;
+  }
+
+  // Blocks smaller than a word are handled a word at a time.
+  uint32_t texel_shift = log2_bpp < 2 ? 2 - log2_bpp : 0;
+  // Destination blocks per source block in each direction.
+  uint32_t scale = 1;
+  switch (src.format) {
+    case TextureFormat::k_CTX1:
+      *mode = TextureConverter::Mode::kCTX1ToR8G8;
+      scale = 4;
+      break;
+    case TextureFormat::k_DXT3A:
+      *mode = TextureConverter::Mode::kDXT3AToDXT3;
+      break;
+    default:
+      if (dst_format_info->bytes_per_block() != bytes_per_block) {
+        return false;
+      }
+      *mode = TextureConverter::Mode::kCopy;
+      break;
+  }
+
+  // Words are swapped as a whole, so they must not span several blocks.
+  switch (src.endianness) {
+    case Endian::k8in16:
+      if (bytes_per_block < 2) {
+        return false;
+      }
+      break;
+    case Endian::k8in32:
+    case Endian::k16in32:
+      if (bytes_per_block < 4) {
+        return false;
+      }
+      break;
+    default:
+      break;
+  }
+
+  auto src_extent = src.GetMipExtent(mip, true);
+  auto dst_extent = GetMipExtent(src, mip);
+  uint32_t src_pitch = src_extent.block_pitch_h * bytes_per_block;
+  uint32_t dst_pitch =
+      dst_extent.block_pitch_h * dst_format_info->bytes_per_block();
+  uint32_t src_face_size = src_pitch * src_extent.block_pitch_v;
+  uint32_t dst_face_size = dst_pitch * dst_extent.block_pitch_v;
+  uint32_t texels_per_invocation = 1u << texel_shift;
+  if (((data_offset | src_pitch | dst_pitch | src_face_size | dst_face_size) &
+       3) ||
+      (offset_x & (texels_per_invocation - 1))) {
+    return false;
+  }
+  // The last invocation of a row may write past the width of the mip, but
+  // never past the destination pitch.
+  if (xe::round_up(src_extent.block_width, texels_per_invocation) * scale >
+          dst_extent.block_pitch_h ||
+      src_extent.block_height * scale > dst_extent.block_pitch_v) {
+    return false;
+  }
+  if (uint64_t(data_offset) + uint64_t(src_face_size) * dst_extent.depth >
+      data_size) {
+    return false;
+  }
+
+  std::memset(constants, 0, sizeof(*constants));
+  constants->src_offset = (data_base + data_offset) / 4;
+  constants->src_face_stride = src_face_size / 4;
+  constants->dst_face_stride = dst_face_size / 4;
+  constants->width = src_extent.block_width;
+  constants->height = src_extent.block_height;
+  constants->offset_x = offset_x;
+  constants->offset_y = offset_y;
+  constants->src_pitch = src.is_tiled ? src_extent.block_pitch_h : src_pitch;
+  constants->dst_pitch = dst_pitch / 4;
+  constants->log2_bpp = log2_bpp;
+  constants->texel_shift = texel_shift;
+  constants->block_words = std::max(1u, bytes_per_block / 4);
+  constants->endian = uint32_t(src.endianness);
+  constants->is_tiled = src.is_tiled ? 1 : 0;
+  return true;
+}
+
+bool TextureCache::CanConvertOnGpu(const TextureInfo& src) {
+  // Dumps are taken from the CPU side.
+  if (!texture_converter_ || FLAGS_texture_dump) {
+    return false;
+  }
+  TextureConverter::Mode mode;
+  TextureConverter::Constants constants;
+  for (uint32_t mip = src.mip_min_level; mip <= src.mip_max_level; mip++) {
+    if (!GetGpuConversion(src, mip, &mode, &constants)) {
+      return false;
+    }
+  }
   return true;
 }
 
 bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
                                  VkFence completion_fence, Texture* dest,
-                                 const TextureInfo& src) {
+                                 const TextureInfo& src,
+                                 const std::vector<MipRows>* parts) {
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
 
-  size_t unpack_length = ComputeTextureStorage(src);
+  // Without parts, this is the first upload of the whole texture.
+  bool is_update = parts != nullptr;
+  std::vector<MipRows> all_mips;
+  size_t unpack_length = 0;
+  if (is_update) {
+    for (auto& part : *parts) {
+      unpack_length += ComputeUploadStorage(src, part);
+    }
+  } else {
+    for (uint32_t mip = src.mip_min_level; mip <= src.mip_max_level; mip++) {
+      all_mips.push_back({mip, 0, kAllRows});
+    }
+    parts = &all_mips;
+    unpack_length = ComputeTextureStorage(src);
+  }
 
   XELOGGPU(
       "Uploading texture @ 0x%.8X/0x%.8X (%ux%ux%u, format: %s, dim: %s, "
@@ -971,25 +1782,60 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
     return false;
   }
 
-  if (!staging_buffer_.CanAcquire(unpack_length)) {
+  // Converting on the GPU needs the guest data in the staging buffer as well,
+  // after the converted mips, unless it's read from imported guest memory.
+  bool convert_on_gpu = !is_update && CanConvertOnGpu(src);
+  bool copy_guest_data = convert_on_gpu && !guest_buffer_;
+  VkDeviceSize staging_length = unpack_length;
+  VkDeviceSize guest_data_offset = 0;
+  if (copy_guest_data) {
+    for (uint32_t mip = src.mip_min_level; mip <= src.mip_max_level; mip++) {
+      guest_data_offset += ComputeMipStorage(src, mip);
+    }
+    staging_length = guest_data_offset +
+                     xe::round_up(src.memory.base_size, 4u) +
+                     src.memory.mip_size;
+  }
+
+  bool is_depth_stencil = dest->format == VK_FORMAT_D16_UNORM_S8_UINT ||
+                          dest->format == VK_FORMAT_D24_UNORM_S8_UINT ||
+                          dest->format == VK_FORMAT_D32_SFLOAT_S8_UINT;
+
+  // New textures converted on the CPU are only copied, which the transfer
+  // queue can do without making the frame wait for it. If its staging buffer
+  // is full, they're uploaded on graphics as usual.
+  // Only the copy reads the staging memory of those, so it may come from a
+  // growth block, whereas GPU conversion is bound to the staging buffer.
+  bool on_transfer_queue =
+      transfer_queue_ && !is_update && !convert_on_gpu && !is_depth_stencil &&
+      transfer_staging_buffer_->CanAcquire(staging_length, true);
+  ui::vulkan::CircularBuffer* staging_buffer = &staging_buffer_;
+  VkCommandBuffer copy_command_buffer = command_buffer;
+  VkFence staging_fence = completion_fence;
+  if (on_transfer_queue) {
+    staging_buffer = transfer_staging_buffer_.get();
+    copy_command_buffer = BeginTransferUploads();
+    staging_fence = transfer_fence_;
+  } else if (!staging_buffer_.CanAcquire(staging_length, !convert_on_gpu)) {
     // Need to have unique memory for every upload for at least one frame. If we
     // run out of memory, we need to flush all queued upload commands to the
     // GPU.
     FlushPendingCommands(command_buffer, completion_fence);
 
     // Uploads have been flushed. Continue.
-    if (!staging_buffer_.CanAcquire(unpack_length)) {
+    if (!staging_buffer_.CanAcquire(staging_length)) {
       // The staging buffer isn't big enough to hold this texture.
       XELOGE(
           "TextureCache staging buffer is too small! (uploading 0x%.8X bytes)",
-          unpack_length);
+          staging_length);
       assert_always();
       return false;
     }
   }
 
   // Grab some temporary memory for staging.
-  auto alloc = staging_buffer_.Acquire(unpack_length, completion_fence);
+  auto alloc =
+      staging_buffer->Acquire(staging_length, staging_fence, !convert_on_gpu);
   assert_not_null(alloc);
   if (!alloc) {
     XELOGE("%s: Failed to acquire staging memory!", __func__);
@@ -997,12 +1843,11 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
   }
 
   // DEBUG: Check the source address. If it's completely zero'd out, print it.
-  bool valid = false;
+  bool valid = is_update;
   auto src_data = memory_->TranslatePhysical(src.memory.base_address);
-  for (uint32_t i = 0; i < src.memory.base_size; i++) {
+  for (uint32_t i = 0; !valid && i < src.memory.base_size; i++) {
     if (src_data[i] != 0) {
       valid = true;
-      break;
     }
   }
 
@@ -1010,25 +1855,59 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
     XELOGW("Warning: Texture @ 0x%.8X is blank!", src.memory.base_address);
   }
 
-  // Upload texture into GPU memory.
-  // TODO: If the GPU supports it, we can submit a compute batch to convert the
-  // texture and copy it to its destination. Otherwise, fallback to conversion
-  // on the CPU.
-  uint32_t copy_region_count = src.mip_levels();
+  // Upload texture into GPU memory. If the GPU can convert it, the guest data
+  // is copied as-is and converted by a compute dispatch, otherwise it is
+  // converted on the CPU.
+  uint32_t copy_region_count = uint32_t(parts->size());
   std::vector<VkBufferImageCopy> copy_regions(copy_region_count);
 
-  // Upload all mips.
   auto unpack_buffer = reinterpret_cast<uint8_t*>(alloc->host_ptr);
+  if (copy_guest_data) {
+    if (src.memory.base_address) {
+      std::memcpy(&unpack_buffer[guest_data_offset],
+                  memory_->TranslatePhysical(src.memory.base_address),
+                  src.memory.base_size);
+    }
+    if (src.memory.mip_address) {
+      std::memcpy(&unpack_buffer[guest_data_offset +
+                                 xe::round_up(src.memory.base_size, 4u)],
+                  memory_->TranslatePhysical(src.memory.mip_address),
+                  src.memory.mip_size);
+    }
+  }
+
+  // Upload all mips, or the rows of them that changed.
   VkDeviceSize unpack_offset = 0;
-  for (uint32_t mip = src.mip_min_level, region = 0; mip <= src.mip_max_level;
-       mip++, region++) {
-    if (!ConvertTexture(&unpack_buffer[unpack_offset], &copy_regions[region],
-                        mip, src)) {
+  for (uint32_t region = 0; region < copy_region_count; region++) {
+    const MipRows& part = (*parts)[region];
+    uint32_t mip = part.mip;
+    if (convert_on_gpu) {
+      TextureConverter::Mode mode;
+      TextureConverter::Constants constants;
+      GetGpuConversion(src, mip, &mode, &constants);
+      if (copy_guest_data) {
+        constants.src_offset +=
+            uint32_t((alloc->offset + guest_data_offset) / 4);
+      } else {
+        // Relative to the mip data if past the base level data.
+        uint32_t base_words = xe::round_up(src.memory.base_size, 4u) / 4;
+        constants.src_offset +=
+            constants.src_offset < base_words
+                ? (src.memory.base_address & 0x1FFFFFFF) / 4
+                : (src.memory.mip_address & 0x1FFFFFFF) / 4 - base_words;
+      }
+      constants.dst_offset = uint32_t((alloc->offset + unpack_offset) / 4);
+      texture_converter_->Dispatch(command_buffer, mode, constants,
+                                   GetMipExtent(src, mip).depth);
+      FillCopyRegion(&copy_regions[region], mip, src, part.first_row,
+                     part.row_count);
+    } else if (!ConvertTexture(&unpack_buffer[unpack_offset],
+                               &copy_regions[region], mip, src,
+                               part.first_row, part.row_count)) {
       XELOGW("Failed to convert texture mip %u!", mip);
       return false;
     }
     copy_regions[region].bufferOffset = alloc->offset + unpack_offset;
-    copy_regions[region].imageOffset = {0, 0, 0};
 
     /*
     XELOGGPU("Mip %u %ux%ux%u @ 0x%X", mip,
@@ -1037,12 +1916,61 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
              copy_regions[region].imageExtent.depth, unpack_offset);
     */
 
-    unpack_offset += ComputeMipStorage(src, mip);
+    unpack_offset += ComputeUploadStorage(src, part);
   }
 
-  if (FLAGS_texture_dump) {
+  if (FLAGS_texture_dump && !is_update) {
     TextureDump(src, unpack_buffer, unpack_length);
   }
+  if (is_update) {
+    reuploaded_bytes_ += unpack_offset;
+  }
+  if (on_transfer_queue) {
+    transfer_upload_bytes_ += unpack_offset;
+  }
+
+  VkImageSubresourceRange subresource_range;
+  if (is_depth_stencil) {
+    subresource_range.aspectMask =
+        VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+    // Do just a depth upload (for now).
+    // This assumes depth buffers don't have mips (hopefully they don't)
+    assert_true(src.mip_levels() == 1);
+    copy_regions[0].imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+  } else {
+    subresource_range.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  }
+  subresource_range.baseMipLevel = src.mip_min_level;
+  subresource_range.levelCount = src.mip_levels();
+  subresource_range.baseArrayLayer =
+      copy_regions[0].imageSubresource.baseArrayLayer;
+  subresource_range.layerCount = copy_regions[0].imageSubresource.layerCount;
+
+  if (!on_transfer_queue) {
+    // Copies into the same image can't share a batch, their transitions
+    // would conflict.
+    for (auto& upload : pending_uploads_) {
+      if (upload.image == dest->image) {
+        CommitUploads(command_buffer);
+        break;
+      }
+    }
+    PendingUpload upload;
+    upload.image = dest->image;
+    upload.buffer = alloc->buffer;
+    upload.old_layout = dest->image_layout;
+    upload.subresource_range = subresource_range;
+    upload.is_update = is_update;
+    upload.copy_regions = std::move(copy_regions);
+    pending_uploads_.push_back(std::move(upload));
+    pending_gpu_conversions_ |= convert_on_gpu;
+    dest->image_layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    ++stats_.uploads;
+    return true;
+  }
+
+  // Uploads on the transfer queue can't be timed with the graphics queue.
+  SCOPE_profile_gpu_context(gpu_texture_upload, nullptr);
 
   // Transition the texture into a transfer destination layout.
   VkImageMemoryBarrier barrier;
@@ -1052,56 +1980,121 @@ bool TextureCache::UploadTexture(VkCommandBuffer command_buffer,
   barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
   barrier.oldLayout = dest->image_layout;
   barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-  barrier.srcQueueFamilyIndex = VK_FALSE;
-  barrier.dstQueueFamilyIndex = VK_FALSE;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
   barrier.image = dest->image;
-  if (dest->format == VK_FORMAT_D16_UNORM_S8_UINT ||
-      dest->format == VK_FORMAT_D24_UNORM_S8_UINT ||
-      dest->format == VK_FORMAT_D32_SFLOAT_S8_UINT) {
-    barrier.subresourceRange.aspectMask =
-        VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-  } else {
-    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-  }
-  barrier.subresourceRange.baseMipLevel = src.mip_min_level;
-  barrier.subresourceRange.levelCount = src.mip_levels();
-  barrier.subresourceRange.baseArrayLayer =
-      copy_regions[0].imageSubresource.baseArrayLayer;
-  barrier.subresourceRange.layerCount =
-      copy_regions[0].imageSubresource.layerCount;
-
-  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+  barrier.subresourceRange = subresource_range;
+  vkCmdPipelineBarrier(copy_command_buffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
                        VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
                        nullptr, 1, &barrier);
 
-  // Now move the converted texture into the destination.
-  if (dest->format == VK_FORMAT_D16_UNORM_S8_UINT ||
-      dest->format == VK_FORMAT_D24_UNORM_S8_UINT ||
-      dest->format == VK_FORMAT_D32_SFLOAT_S8_UINT) {
-    // Do just a depth upload (for now).
-    // This assumes depth buffers don't have mips (hopefully they don't)
-    assert_true(src.mip_levels() == 1);
-    copy_regions[0].imageSubresource.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
-  }
-
-  vkCmdCopyBufferToImage(command_buffer, staging_buffer_.gpu_buffer(),
-                         dest->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+  vkCmdCopyBufferToImage(copy_command_buffer, alloc->buffer, dest->image,
+                         VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
                          copy_region_count, copy_regions.data());
 
-  // Now transition the texture into a shader readonly source.
-  barrier.srcAccessMask = barrier.dstAccessMask;
-  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-  barrier.oldLayout = barrier.newLayout;
+  // Release the image to the graphics queue family, which acquires it with
+  // the same barrier once the transfer semaphore has been waited on.
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = 0;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
   barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
-                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
-                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
-                       0, 0, nullptr, 0, nullptr, 1, &barrier);
+  barrier.srcQueueFamilyIndex = transfer_queue_family_index_;
+  barrier.dstQueueFamilyIndex = device_->queue_family_index();
+  vkCmdPipelineBarrier(copy_command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  pending_acquire_barriers_.push_back(barrier);
 
   dest->image_layout = barrier.newLayout;
+  ++stats_.uploads;
   return true;
 }
 
+void TextureCache::CommitUploads(VkCommandBuffer command_buffer) {
+  if (pending_uploads_.empty() && pending_acquire_barriers_.empty()) {
+    return;
+  }
+  SCOPE_profile_gpu_context(gpu_texture_upload, command_buffer);
+
+  // Transition the images into a transfer destination layout. An update
+  // overwrites parts of an image earlier batches may still sample.
+  commit_barriers_.clear();
+  VkPipelineStageFlags src_stage_mask = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+  for (auto& upload : pending_uploads_) {
+    VkImageMemoryBarrier barrier;
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.pNext = nullptr;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.oldLayout = upload.old_layout;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = upload.image;
+    barrier.subresourceRange = upload.subresource_range;
+    commit_barriers_.push_back(barrier);
+    if (upload.is_update) {
+      src_stage_mask |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    }
+  }
+  if (!pending_uploads_.empty()) {
+    // Also makes the mips converted by compute visible to the copies.
+    VkMemoryBarrier memory_barrier;
+    memory_barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memory_barrier.pNext = nullptr;
+    memory_barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memory_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    if (pending_gpu_conversions_) {
+      src_stage_mask |= VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+    vkCmdPipelineBarrier(command_buffer, src_stage_mask,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         pending_gpu_conversions_ ? 1 : 0, &memory_barrier, 0,
+                         nullptr, uint32_t(commit_barriers_.size()),
+                         commit_barriers_.data());
+
+    for (auto& upload : pending_uploads_) {
+      vkCmdCopyBufferToImage(command_buffer, upload.buffer, upload.image,
+                             VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                             uint32_t(upload.copy_regions.size()),
+                             upload.copy_regions.data());
+    }
+  }
+
+  // Now transition them into a shader readonly source, along with acquiring
+  // the images uploaded on the transfer queue.
+  for (auto& barrier : commit_barriers_) {
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+  }
+  commit_barriers_.insert(commit_barriers_.end(),
+                          pending_acquire_barriers_.begin(),
+                          pending_acquire_barriers_.end());
+  src_stage_mask = 0;
+  if (!pending_uploads_.empty()) {
+    src_stage_mask |= VK_PIPELINE_STAGE_TRANSFER_BIT;
+  }
+  if (!pending_acquire_barriers_.empty()) {
+    src_stage_mask |= VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                      VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+  }
+  vkCmdPipelineBarrier(command_buffer, src_stage_mask,
+                       VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                           VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       0, 0, nullptr, 0, nullptr,
+                       uint32_t(commit_barriers_.size()),
+                       commit_barriers_.data());
+
+  pending_uploads_.clear();
+  pending_acquire_barriers_.clear();
+  pending_gpu_conversions_ = false;
+}
+
 const FormatInfo* TextureCache::GetFormatInfo(TextureFormat format) {
   switch (format) {
     case TextureFormat::k_CTX1:
@@ -1185,28 +2178,22 @@ uint32_t TextureCache::ComputeTextureStorage(const TextureInfo& src) {
   return length;
 }
 
-void TextureCache::WritebackTexture(Texture* texture) {
-  VkResult status = VK_SUCCESS;
-  VkFence fence = wb_command_pool_->BeginBatch();
-  auto alloc = wb_staging_buffer_.Acquire(texture->alloc_info.size, fence);
+void TextureCache::RequestReadback(VkCommandBuffer command_buffer,
+                                   VkFence completion_fence,
+                                   Texture* texture) {
+  auto global_lock = global_critical_region_.Acquire();
+  VkDeviceSize length = texture->alloc_info.size;
+  if (!wb_staging_buffer_.CanAcquire(length)) {
+    FlushReadbacks();
+  }
+  auto alloc = wb_staging_buffer_.Acquire(length, completion_fence);
   if (!alloc) {
-    wb_command_pool_->EndBatch();
+    XELOGGPU("Readback ring full, resolve to 0x%.8X stays on the GPU",
+             texture->texture_info.memory.base_address);
     return;
   }
 
-  auto command_buffer = wb_command_pool_->AcquireEntry();
-
-  VkCommandBufferBeginInfo begin_info = {
-      VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      nullptr,
-      VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
-      nullptr,
-  };
-  vkBeginCommandBuffer(command_buffer, &begin_info);
-
-  // TODO: Transition the texture to a transfer source.
   // TODO: copy depth/layers?
-
   VkBufferImageCopy region;
   region.bufferOffset = alloc->offset;
   region.bufferRowLength = 0;
@@ -1221,48 +2208,102 @@ void TextureCache::WritebackTexture(Texture* texture) {
   region.imageExtent.width = texture->texture_info.width + 1;
   region.imageExtent.height = texture->texture_info.height + 1;
   region.imageExtent.depth = 1;
-
-  vkCmdCopyImageToBuffer(command_buffer, texture->image,
-                         VK_IMAGE_LAYOUT_GENERAL,
+  vkCmdCopyImageToBuffer(command_buffer, texture->image, texture->image_layout,
                          wb_staging_buffer_.gpu_buffer(), 1, &region);
 
-  // TODO: Transition the texture back to a shader resource.
-
-  vkEndCommandBuffer(command_buffer);
-
-  // Submit the command buffer.
-  // Submit commands and wait.
-  {
-    std::lock_guard<std::mutex>(device_->primary_queue_mutex());
-    VkSubmitInfo submit_info = {
-        VK_STRUCTURE_TYPE_SUBMIT_INFO,
-        nullptr,
-        0,
-        nullptr,
-        nullptr,
-        1,
-        &command_buffer,
-        0,
-        nullptr,
-    };
-    status = vkQueueSubmit(device_->primary_queue(), 1, &submit_info, fence);
-    CheckResult(status, "vkQueueSubmit");
+  VkBufferMemoryBarrier barrier;
+  barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  barrier.pNext = nullptr;
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.buffer = wb_staging_buffer_.gpu_buffer();
+  barrier.offset = alloc->offset;
+  barrier.size = alloc->aligned_length;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier,
+                       0, nullptr);
+
+  // A newer resolve replaces the contents still pending.
+  if (!texture->readback_data) {
+    readback_textures_.push_back(texture);
+  }
+  texture->readback_data = reinterpret_cast<const uint8_t*>(alloc->host_ptr);
+  texture->readback_fence = completion_fence;
+  texture->readback_submitted = false;
+  readback_rearm_textures_.erase(texture);
+  UnwatchTexture(texture);
+  WatchTexture(texture);
+}
 
-    if (status == VK_SUCCESS) {
-      status = vkQueueWaitIdle(device_->primary_queue());
-      CheckResult(status, "vkQueueWaitIdle");
+void TextureCache::MarkReadbacksSubmitted(VkFence fence) {
+  auto global_lock = global_critical_region_.Acquire();
+  for (Texture* texture : readback_textures_) {
+    if (texture->readback_fence == fence) {
+      texture->readback_submitted = true;
     }
   }
+}
 
-  wb_command_pool_->EndBatch();
+void TextureCache::WriteReadback(Texture* texture) {
+  const uint8_t* data = texture->readback_data;
+  VkFence fence = texture->readback_fence;
+  bool submitted = texture->readback_submitted;
+  DropReadback(texture);
+  if (!data) {
+    return;
+  }
+  if (fence && !submitted) {
+    // The command processor may be waiting for the CPU.
+    XELOGW("Resolve to 0x%.8X read before being submitted, not written back",
+           texture->texture_info.memory.base_address);
+    return;
+  }
+  if (fence) {
+    vkWaitForFences(*device_, 1, &fence, VK_TRUE, UINT64_MAX);
+  }
 
-  if (status == VK_SUCCESS) {
-    auto dest =
-        memory_->TranslatePhysical(texture->texture_info.memory.base_address);
-    std::memcpy(dest, alloc->host_ptr, texture->texture_info.memory.base_size);
+  VkMappedMemoryRange range;
+  range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+  range.pNext = nullptr;
+  range.memory = wb_staging_buffer_.gpu_memory();
+  range.offset = 0;
+  range.size = VK_WHOLE_SIZE;
+  vkInvalidateMappedMemoryRanges(*device_, 1, &range);
+
+  const auto& memory_info = texture->texture_info.memory;
+  std::memcpy(memory_->TranslatePhysical(memory_info.base_address), data,
+              std::min(VkDeviceSize(memory_info.base_size),
+                       texture->alloc_info.size));
+}
+
+void TextureCache::FlushReadbacks() {
+  auto global_lock = global_critical_region_.Acquire();
+  for (auto it = readback_textures_.begin(); it != readback_textures_.end();) {
+    Texture* texture = *it++;
+    if (texture->readback_fence && !texture->readback_submitted) {
+      continue;
+    }
+    UnwatchTexture(texture);
+    WriteReadback(texture);
+    WatchTexture(texture);
+  }
+  if (readback_textures_.empty()) {
+    wb_staging_buffer_.Clear();
   }
+}
 
-  wb_staging_buffer_.Scavenge();
+void TextureCache::DropReadback(Texture* texture) {
+  auto global_lock = global_critical_region_.Acquire();
+  readback_rearm_textures_.erase(texture);
+  if (!texture->readback_data) {
+    return;
+  }
+  readback_textures_.remove(texture);
+  texture->readback_data = nullptr;
+  texture->readback_fence = nullptr;
+  texture->readback_submitted = false;
 }
 
 void TextureCache::HashTextureBindings(
@@ -1350,6 +2391,50 @@ VkDescriptorSet TextureCache::PrepareTextureSet(
   return descriptor_set;
 }
 
+bool TextureCache::PushTextureSet(
+    VkCommandBuffer command_buffer, VkCommandBuffer setup_command_buffer,
+    VkFence completion_fence, VkPipelineLayout pipeline_layout, uint32_t set,
+    const std::vector<Shader::TextureBinding>& vertex_bindings,
+    const std::vector<Shader::TextureBinding>& pixel_bindings) {
+  assert_true(push_descriptors_);
+
+  XXH64_state_t hash_state;
+  XXH64_reset(&hash_state, 0);
+  uint32_t fetch_mask = 0;
+  HashTextureBindings(&hash_state, fetch_mask, vertex_bindings);
+  HashTextureBindings(&hash_state, fetch_mask, pixel_bindings);
+  uint64_t hash = XXH64_digest(&hash_state);
+  if (command_buffer == last_push_command_buffer_ && hash == last_push_hash_) {
+    // Still bound.
+    return true;
+  }
+
+  auto update_set_info = &update_set_info_;
+  std::memset(update_set_info, 0, sizeof(update_set_info_));
+
+  bool any_failed = false;
+  any_failed = !SetupTextureBindings(setup_command_buffer, completion_fence,
+                                     update_set_info, vertex_bindings) ||
+               any_failed;
+  any_failed = !SetupTextureBindings(setup_command_buffer, completion_fence,
+                                     update_set_info, pixel_bindings) ||
+               any_failed;
+  if (any_failed) {
+    XELOGW("Failed to setup one or more texture bindings!");
+    // TODO(benvanik): actually bail out here?
+  }
+
+  if (update_set_info->image_write_count > 0) {
+    pfn_vkCmdPushDescriptorSetKHR_(
+        command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout, set,
+        update_set_info->image_write_count, update_set_info->image_writes);
+  }
+
+  last_push_command_buffer_ = command_buffer;
+  last_push_hash_ = hash;
+  return true;
+}
+
 bool TextureCache::SetupTextureBindings(
     VkCommandBuffer command_buffer, VkFence completion_fence,
     UpdateSetInfo* update_set_info,
@@ -1437,6 +2522,7 @@ bool TextureCache::SetupTextureBinding(VkCommandBuffer command_buffer,
   image_info->imageLayout = texture->image_layout;
   image_info->sampler = sampler->sampler;
   texture->in_flight_fence = completion_fence;
+  texture->last_used_frame = frame_index_;
 
   return true;
 }
@@ -1455,10 +2541,20 @@ void TextureCache::RemoveInvalidatedTextures() {
   // Append all invalidated textures to a deletion queue. They will be deleted
   // when all command buffers using them have finished executing.
   if (!invalidated_textures.empty()) {
+    invalidated_textures_mutex_.lock();
     for (auto it = invalidated_textures.begin();
          it != invalidated_textures.end(); ++it) {
+      dirty_textures_.erase(*it);
+    }
+    invalidated_textures_mutex_.unlock();
+
+    for (auto it = invalidated_textures.begin();
+         it != invalidated_textures.end(); ++it) {
+      UnwatchTexture(*it);
+      DropReadback(*it);
+      ForgetTextureContents(*it);
       pending_delete_textures_.push_back(*it);
-      textures_.erase((*it)->texture_info.hash());
+      RemoveTexture(*it);
     }
 
     COUNT_profile_set("gpu/texture_cache/textures", textures_.size());
@@ -1468,7 +2564,55 @@ void TextureCache::RemoveInvalidatedTextures() {
   }
 }
 
+void TextureCache::EvictColdTextures() {
+  VmaStats stats;
+  vmaCalculateStats(mem_allocator_, &stats);
+  COUNT_profile_set("gpu/texture_cache/used_bytes", stats.total.usedBytes);
+  if (!memory_budget_ || stats.total.usedBytes <= memory_budget_) {
+    return;
+  }
+
+  // Textures used within the last frame may still be sampled by the GPU, and
+  // render targets hold data that only exists on the GPU, so neither is
+  // evicted. Textures sharing an image free nothing until the last one goes.
+  std::vector<Texture*> candidates;
+  for (auto& it : textures_) {
+    Texture* texture = it.second;
+    if (frame_index_ - texture->last_used_frame < 2 ||
+        texture->usage_flags & (VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                                VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+      continue;
+    }
+    candidates.push_back(texture);
+  }
+  std::sort(candidates.begin(), candidates.end(),
+            [](const Texture* a, const Texture* b) {
+              return a->last_used_frame < b->last_used_frame;
+            });
+
+  // The memory is only released once the fences of the evicted textures
+  // signal, in the usual pending deletion pass.
+  VkDeviceSize excess = stats.total.usedBytes - memory_budget_;
+  VkDeviceSize evicted = 0;
+  uint32_t evicted_count = 0;
+  invalidated_textures_mutex_.lock();
+  for (Texture* texture : candidates) {
+    if (evicted >= excess) {
+      break;
+    }
+    invalidated_textures_->insert(texture);
+    if (!IsTextureShared(texture)) {
+      evicted += texture->alloc_info.size;
+    }
+    evicted_count++;
+  }
+  invalidated_textures_mutex_.unlock();
+  COUNT_profile_set("gpu/texture_cache/evicted_textures", evicted_count);
+}
+
 void TextureCache::ClearCache() {
+  // The guest still gets the contents of the submitted resolves.
+  FlushReadbacks();
   RemoveInvalidatedTextures();
   for (auto it = textures_.begin(); it != textures_.end(); ++it) {
     while (!FreeTexture(it->second)) {
@@ -1477,7 +2621,13 @@ void TextureCache::ClearCache() {
     }
   }
   textures_.clear();
+  textures_by_address_.clear();
+  max_indexed_texture_size_ = 0;
+  wb_staging_buffer_.Clear();
   COUNT_profile_set("gpu/texture_cache/textures", 0);
+  invalidated_textures_mutex_.lock();
+  dirty_textures_.clear();
+  invalidated_textures_mutex_.unlock();
 
   for (auto it = samplers_.begin(); it != samplers_.end(); ++it) {
     vkDestroySampler(*device_, it->second->sampler, nullptr);
@@ -1499,8 +2649,61 @@ void TextureCache::Scavenge() {
   // way to detect if they're unused and free them.
   texture_sets_.clear();
   descriptor_pool_->Scavenge();
+  // Command buffers are reused.
+  last_push_command_buffer_ = nullptr;
   staging_buffer_.Scavenge();
 
+  // Textures that were written to but haven't been demanded since the last
+  // frame are probably gone, so stop keeping them up to date.
+  invalidated_textures_mutex_.lock();
+  ++frame_index_;
+  for (auto it = dirty_textures_.begin(); it != dirty_textures_.end();) {
+    Texture* texture = *it;
+    if (!texture->pending_invalidation) {
+      it = dirty_textures_.erase(it);
+    } else if (frame_index_ - texture->dirty_frame > 1) {
+      invalidated_textures_->insert(texture);
+      it = dirty_textures_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  invalidated_textures_mutex_.unlock();
+
+  COUNT_profile_set("gpu/texture_cache/reuploaded_bytes", reuploaded_bytes_);
+  reuploaded_bytes_ = 0;
+  COUNT_profile_set("gpu/texture_cache/staging_high_water_bytes",
+                    staging_buffer_.high_water_mark());
+  COUNT_profile_set("gpu/texture_cache/staging_growth_blocks",
+                    staging_buffer_.growth_block_count());
+
+  {
+    // Completed batches have their fences reused, so the readbacks must not
+    // wait on them anymore.
+    auto global_lock = global_critical_region_.Acquire();
+    for (Texture* texture : readback_textures_) {
+      if (texture->readback_fence && texture->readback_submitted &&
+          batch_pool_->IsFenceSignaled(texture->readback_fence)) {
+        texture->readback_fence = nullptr;
+      }
+    }
+    for (Texture* texture : readback_rearm_textures_) {
+      WatchTexture(texture);
+    }
+    readback_rearm_textures_.clear();
+    COUNT_profile_set("gpu/texture_cache/pending_readbacks",
+                      readback_textures_.size());
+  }
+  if (transfer_queue_) {
+    COUNT_profile_set("gpu/texture_cache/transfer_upload_bytes",
+                      transfer_upload_bytes_);
+    transfer_upload_bytes_ = 0;
+    transfer_command_pool_->Scavenge();
+    transfer_staging_buffer_->Scavenge();
+  }
+
+  EvictColdTextures();
+
   // Kill all pending delete textures.
   RemoveInvalidatedTextures();
   if (!pending_delete_textures_.empty()) {
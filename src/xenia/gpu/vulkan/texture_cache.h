@@ -10,15 +10,20 @@
 #ifndef XENIA_GPU_VULKAN_TEXTURE_CACHE_H_
 #define XENIA_GPU_VULKAN_TEXTURE_CACHE_H_
 
+#include <list>
+#include <map>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "xenia/base/memory_usage.h"
+#include "xenia/base/mutex.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/sampler_info.h"
 #include "xenia/gpu/shader.h"
 #include "xenia/gpu/texture_conversion.h"
 #include "xenia/gpu/texture_info.h"
 #include "xenia/gpu/trace_writer.h"
+#include "xenia/gpu/vulkan/texture_converter.h"
 #include "xenia/gpu/vulkan/vulkan_command_processor.h"
 #include "xenia/gpu/xenos.h"
 #include "xenia/ui/vulkan/circular_buffer.h"
@@ -36,6 +41,7 @@ namespace vulkan {
 class TextureCache {
  public:
   struct TextureView;
+  struct TextureWatch;
 
   // This represents an uploaded Vulkan texture.
   struct Texture {
@@ -50,11 +56,40 @@ class TextureCache {
     VkFramebuffer framebuffer;  // Blit target frame buffer.
     VkImageUsageFlags usage_flags;
 
-    uintptr_t access_watch_handle;
+    // Write watches over the guest memory of the texture, each covering a
+    // chunk of it so that only the written parts have to be uploaded again.
+    std::vector<std::unique_ptr<TextureWatch>> watches;
+    // Guest address ranges [first, second) written to since the last upload.
+    // Guarded by invalidated_textures_mutex_, as is pending_invalidation.
+    std::vector<std::pair<uint32_t, uint32_t>> dirty_ranges;
     bool pending_invalidation;
+    // Scavenge count at which the texture was first written to.
+    uint32_t dirty_frame;
+    // Hash of the guest data when uploaded, or 0 if not known. See
+    // content_textures_.
+    uint64_t content_hash;
 
     // Pointer to the latest usage fence.
     VkFence in_flight_fence;
+    // Scavenge count at which in_flight_fence was last set.
+    uint32_t last_used_frame;
+
+    // Last resolved contents in the readback ring, written to guest memory
+    // when the CPU accesses the texture, or null. Guarded by the global
+    // critical region, which the watch callbacks run in.
+    const uint8_t* readback_data;
+    // Fence of the copy, or null once it's known to have completed.
+    VkFence readback_fence;
+    // Whether readback_fence has been submitted and can be waited on.
+    bool readback_submitted;
+  };
+
+  struct TextureWatch {
+    Texture* texture;
+    uint32_t address;
+    uint32_t length;
+    // Zero while the watch is not armed.
+    uintptr_t handle;
   };
 
   struct TextureView {
@@ -76,7 +111,8 @@ class TextureCache {
   };
 
   TextureCache(Memory* memory, RegisterFile* register_file,
-               TraceWriter* trace_writer, ui::vulkan::VulkanDevice* device);
+               TraceWriter* trace_writer, ui::vulkan::VulkanDevice* device,
+               ui::vulkan::CommandBufferPool* batch_pool);
   ~TextureCache();
 
   VkResult Initialize();
@@ -88,6 +124,10 @@ class TextureCache {
     return texture_descriptor_set_layout_;
   }
 
+  // Guest physical memory imported as a storage buffer, or null. Valid until
+  // Shutdown.
+  VkBuffer guest_buffer() const { return guest_buffer_; }
+
   // Prepares a descriptor set containing the samplers and images for all
   // bindings. The textures will be uploaded/converted/etc as needed.
   // Requires a fence to be provided that will be signaled when finished
@@ -97,6 +137,20 @@ class TextureCache {
       const std::vector<Shader::TextureBinding>& vertex_bindings,
       const std::vector<Shader::TextureBinding>& pixel_bindings);
 
+  // Whether the texture bindings are pushed with PushTextureSet rather than
+  // bound from PrepareTextureSet. Decided once in Initialize, as it changes
+  // the descriptor set layout.
+  bool uses_push_descriptors() const { return push_descriptors_; }
+
+  // Demands the textures for the bindings and pushes their descriptors into
+  // command_buffer as the given set of pipeline_layout. Does nothing if the
+  // same bindings were the last pushed into command_buffer.
+  bool PushTextureSet(
+      VkCommandBuffer command_buffer, VkCommandBuffer setup_command_buffer,
+      VkFence completion_fence, VkPipelineLayout pipeline_layout, uint32_t set,
+      const std::vector<Shader::TextureBinding>& vertex_bindings,
+      const std::vector<Shader::TextureBinding>& pixel_bindings);
+
   // TODO(benvanik): ReadTexture.
 
   Texture* Lookup(const TextureInfo& texture_info);
@@ -122,9 +176,64 @@ class TextureCache {
   // Frees any unused resources
   void Scavenge();
 
+  // Texture lookups since the stats were last reset, for benchmarks. Content
+  // hits alias a texture with the same data at another address
+  // (--vulkan_texture_dedup), and resolve hits sample a resolve target
+  // directly. Uploads include the partial updates of textures invalidated by
+  // guest writes.
+  struct Stats {
+    uint64_t hits;
+    uint64_t content_hits;
+    uint64_t resolve_hits;
+    uint64_t misses;
+    uint64_t uploads;
+  };
+  const Stats& stats() const { return stats_; }
+  void ResetStats() { stats_ = {}; }
+
+  // Copies a resolved texture into the readback ring. Its guest memory is only
+  // written once the CPU accesses it, with --vulkan_resolve_readback.
+  void RequestReadback(VkCommandBuffer command_buffer,
+                       VkFence completion_fence, Texture* texture);
+  // Lets the readbacks recorded in the batch of fence be waited on.
+  void MarkReadbacksSubmitted(VkFence fence);
+
+  // Records the layout transitions and copies of the uploads made since the
+  // last call, grouped into one barrier before the copies and one after.
+  // Called at the end of the setup buffer, ahead of the render passes of the
+  // frame.
+  void CommitUploads(VkCommandBuffer command_buffer);
+
+  // Submits the uploads recorded for the transfer queue. Returns the semaphore
+  // the graphics submission of the current batch must wait on, or nullptr if
+  // nothing was recorded.
+  VkSemaphore SubmitTransferUploads();
+
  private:
   struct UpdateSetInfo;
 
+  // A copy into a texture image made by UploadTexture on the graphics queue,
+  // recorded by CommitUploads.
+  struct PendingUpload {
+    VkImage image;
+    VkBuffer buffer;
+    VkImageLayout old_layout;
+    VkImageSubresourceRange subresource_range;
+    // Overwrites contents earlier batches may still sample.
+    bool is_update;
+    std::vector<VkBufferImageCopy> copy_regions;
+  };
+
+  // Rows of blocks of a mip to upload.
+  struct MipRows {
+    uint32_t mip;
+    uint32_t first_row;
+    uint32_t row_count;
+  };
+  static constexpr uint32_t kAllRows = UINT32_MAX;
+  // Upper bound on the watches placed over a single texture.
+  static constexpr uint32_t kMaxWatchesPerTexture = 16;
+
   // Cached Vulkan sampler.
   struct Sampler {
     SamplerInfo sampler_info;
@@ -139,6 +248,32 @@ class TextureCache {
 
   static void WatchCallback(void* context_ptr, void* data_ptr,
                             uint32_t address);
+  // Arms all the watches of a texture that aren't armed already, creating
+  // them on the first call.
+  void WatchTexture(Texture* texture);
+  void UnwatchTexture(Texture* texture);
+  // Queues a texture for removal at the next RemoveInvalidatedTextures.
+  void InvalidateTexture(Texture* texture);
+  // Hashes the guest data of a texture along with its layout, but not its
+  // addresses.
+  uint64_t HashTextureContents(const TextureInfo& texture_info);
+  // Caches a texture in textures_ and the address index, replacing any with
+  // the same hash.
+  void AddTexture(uint64_t texture_hash, Texture* texture);
+  void RemoveTexture(Texture* texture);
+  // A resolve target that can be sampled as texture_info as it is: same
+  // address, size, tiling, endianness and host format, a single mip level.
+  Texture* FindResolveTarget(const TextureInfo& texture_info);
+  // Creates a texture at another address sharing the image of texture.
+  Texture* AliasTexture(Texture* texture, const TextureInfo& texture_info);
+  void ForgetTextureContents(Texture* texture);
+  bool IsTextureShared(Texture* texture) const {
+    return shared_image_refs_.count(texture->image) != 0;
+  }
+  // Uploads the parts of a texture written to since the last upload. Returns
+  // false if that can't be done and the texture has to be replaced instead.
+  bool UpdateTexture(VkCommandBuffer command_buffer, VkFence completion_fence,
+                     Texture* texture);
 
   // Demands a texture. If command_buffer is null and the texture hasn't been
   // uploaded to graphics memory already, we will return null and bail.
@@ -150,8 +285,32 @@ class TextureCache {
   void FlushPendingCommands(VkCommandBuffer command_buffer,
                             VkFence completion_fence);
 
+  // Imports guest physical memory as guest_buffer_, if supported.
+  void ImportGuestMemory();
+
+  // Looks for a transfer-only queue family to stream new textures on.
+  void InitializeTransferQueue();
+  void ShutdownTransferQueue();
+  // Returns the transfer command buffer, beginning a batch if none is open.
+  VkCommandBuffer BeginTransferUploads();
+
+  // Converts row_count rows of blocks of a mip starting at first_row. Only
+  // 2D mips can be converted partially.
   bool ConvertTexture(uint8_t* dest, VkBufferImageCopy* copy_region,
-                      uint32_t mip, const TextureInfo& src);
+                      uint32_t mip, const TextureInfo& src,
+                      uint32_t first_row = 0, uint32_t row_count = kAllRows);
+  void FillCopyRegion(VkBufferImageCopy* copy_region, uint32_t mip,
+                      const TextureInfo& src, uint32_t first_row = 0,
+                      uint32_t row_count = kAllRows);
+
+  // Sets up the compute conversion of a mip. The source offset in constants is
+  // relative to the guest data, with the base level data first and the mip
+  // data 4 byte aligned after it, and the destination offset is left at zero.
+  // Returns false if the mip can only be converted on the CPU.
+  bool GetGpuConversion(const TextureInfo& src, uint32_t mip,
+                        TextureConverter::Mode* mode,
+                        TextureConverter::Constants* constants);
+  bool CanConvertOnGpu(const TextureInfo& src);
 
   static const FormatInfo* GetFormatInfo(TextureFormat format);
   static texture_conversion::CopyBlockCallback GetFormatCopyBlock(
@@ -162,16 +321,26 @@ class TextureCache {
                                     uint32_t depth, uint32_t mip);
   static uint32_t ComputeMipStorage(const TextureInfo& src, uint32_t mip);
   static uint32_t ComputeTextureStorage(const TextureInfo& src);
-
-  // Writes a texture back into guest memory. This call is (mostly) asynchronous
-  // but the texture must not be flagged for destruction.
-  void WritebackTexture(Texture* texture);
+  static uint32_t ComputeUploadStorage(const TextureInfo& src,
+                                       const MipRows& part);
+
+  // Writes the pending readback of a texture to guest memory, waiting for its
+  // copy if needed. The texture must not be watched. Readbacks that haven't
+  // been submitted yet can't be waited on and are dropped. Must be called in
+  // the global critical region.
+  void WriteReadback(Texture* texture);
+  // Writes all submitted readbacks, to free the readback ring.
+  void FlushReadbacks();
+  // Forgets the pending readback of a texture.
+  void DropReadback(Texture* texture);
 
   // Queues commands to upload a texture from system memory, applying any
   // conversions necessary. This may flush the command buffer to the GPU if we
   // run out of staging memory.
+  // If parts is provided only those are uploaded into the existing contents.
   bool UploadTexture(VkCommandBuffer command_buffer, VkFence completion_fence,
-                     Texture* dest, const TextureInfo& src);
+                     Texture* dest, const TextureInfo& src,
+                     const std::vector<MipRows>* parts = nullptr);
 
   void HashTextureBindings(XXH64_state_t* hash_state, uint32_t& fetch_mask,
                            const std::vector<Shader::TextureBinding>& bindings);
@@ -186,30 +355,95 @@ class TextureCache {
 
   // Removes invalidated textures from the cache, queues them for delete.
   void RemoveInvalidatedTextures();
+  // Invalidates the least recently used textures until the allocator is back
+  // under the texture memory budget.
+  void EvictColdTextures();
 
   Memory* memory_ = nullptr;
 
   RegisterFile* register_file_ = nullptr;
   TraceWriter* trace_writer_ = nullptr;
   ui::vulkan::VulkanDevice* device_ = nullptr;
+  // Command processor batches, whose serials retire the textures in flight.
+  ui::vulkan::CommandBufferPool* batch_pool_ = nullptr;
   VkQueue device_queue_ = nullptr;
 
-  std::unique_ptr<xe::ui::vulkan::CommandBufferPool> wb_command_pool_ = nullptr;
   std::unique_ptr<xe::ui::vulkan::DescriptorPool> descriptor_pool_ = nullptr;
   std::unordered_map<uint64_t, VkDescriptorSet> texture_sets_;
   VkDescriptorSetLayout texture_descriptor_set_layout_ = nullptr;
 
+  bool push_descriptors_ = false;
+  PFN_vkCmdPushDescriptorSetKHR pfn_vkCmdPushDescriptorSetKHR_ = nullptr;
+  // Bindings last pushed, which stay bound until the next push.
+  VkCommandBuffer last_push_command_buffer_ = nullptr;
+  uint64_t last_push_hash_ = 0;
+
   VmaAllocator mem_allocator_ = nullptr;
+  MemoryUsageCounter memory_usage_{"gpu/texture_cache"};
 
   ui::vulkan::CircularBuffer staging_buffer_;
+  // Readback ring, only cleared once it has no pending readbacks left.
   ui::vulkan::CircularBuffer wb_staging_buffer_;
+  std::unique_ptr<TextureConverter> texture_converter_;
+  // Guest physical memory imported with VK_EXT_external_memory_host, which
+  // the GPU conversions read from directly, or null.
+  VkBuffer guest_buffer_ = nullptr;
+  VkDeviceMemory guest_memory_ = nullptr;
+
+  // Dedicated transfer queue new textures are uploaded on, with
+  // --vulkan_transfer_queue_uploads. Images are handed over to the graphics
+  // queue family with an ownership transfer.
+  VkQueue transfer_queue_ = nullptr;
+  uint32_t transfer_queue_family_index_ = 0;
+  std::unique_ptr<ui::vulkan::CommandBufferPool> transfer_command_pool_;
+  std::unique_ptr<ui::vulkan::CircularBuffer> transfer_staging_buffer_;
+  VkCommandBuffer transfer_command_buffer_ = nullptr;
+  VkFence transfer_fence_ = nullptr;
+  VkSemaphore transfer_semaphore_ = nullptr;
+  // Bytes uploaded on the transfer queue since the last Scavenge.
+  uint64_t transfer_upload_bytes_ = 0;
   std::unordered_map<uint64_t, Texture*> textures_;
+  // The textures of textures_ by guest base address, for containment queries.
+  std::multimap<uint32_t, Texture*> textures_by_address_;
+  // Largest base_size indexed since the last ClearCache, bounding how far
+  // below an address the textures containing it can start.
+  uint32_t max_indexed_texture_size_ = 0;
   std::unordered_map<uint64_t, Sampler*> samplers_;
+  Stats stats_ = {};
   std::list<Texture*> pending_delete_textures_;
 
   std::mutex invalidated_textures_mutex_;
   std::unordered_set<Texture*>* invalidated_textures_;
   std::unordered_set<Texture*> invalidated_textures_sets_[2];
+  // Textures with pending writes, evicted if not demanded again soon.
+  std::unordered_set<Texture*> dirty_textures_;
+  uint32_t frame_index_ = 0;
+  // Device memory textures may use, 0 if unlimited.
+  VkDeviceSize memory_budget_ = 0;
+
+  // Textures by content hash, with --vulkan_texture_dedup.
+  std::unordered_map<uint64_t, Texture*> content_textures_;
+  // Number of textures using each image shared between several of them.
+  // Images used by a single texture aren't in here.
+  std::unordered_map<VkImage, uint32_t> shared_image_refs_;
+
+  xe::global_critical_region global_critical_region_;
+  // Textures with a pending readback.
+  std::list<Texture*> readback_textures_;
+  // Textures whose readback watch fired, to watch for writes again. The
+  // watches can't be added from the watch callback.
+  std::unordered_set<Texture*> readback_rearm_textures_;
+
+  // Bytes uploaded again to update written textures since the last Scavenge.
+  uint64_t reuploaded_bytes_ = 0;
+
+  // Uploads waiting for CommitUploads, and the acquires of images uploaded
+  // on the transfer queue.
+  std::vector<PendingUpload> pending_uploads_;
+  std::vector<VkImageMemoryBarrier> pending_acquire_barriers_;
+  // Some of pending_uploads_ copy mips converted by compute dispatches.
+  bool pending_gpu_conversions_ = false;
+  std::vector<VkImageMemoryBarrier> commit_barriers_;
 
   struct UpdateSetInfo {
     // Bitmap of all 32 fetch constants and whether they have been setup yet.
@@ -0,0 +1,457 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/gpu/vulkan/texture_converter.h"
+
+#include <cstddef>
+#include <cstring>
+
+#include "third_party/glslang-spirv/SpvBuilder.h"
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/ui/vulkan/vulkan_util.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+using spv::Id;
+using xe::ui::vulkan::CheckResult;
+
+// Invocations per workgroup along x and y.
+constexpr uint32_t kGroupSize = 8;
+
+TextureConverter::TextureConverter(ui::vulkan::VulkanDevice* device)
+    : device_(device) {}
+
+TextureConverter::~TextureConverter() { Shutdown(); }
+
+VkResult TextureConverter::Initialize(VkBuffer buffer,
+                                      VkBuffer source_buffer) {
+  VkResult status = VK_SUCCESS;
+
+  // Binding 0 is the output, binding 1 the guest data.
+  VkDescriptorSetLayoutBinding bindings[2];
+  for (uint32_t i = 0; i < 2; ++i) {
+    bindings[i].binding = i;
+    bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[i].descriptorCount = 1;
+    bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    bindings[i].pImmutableSamplers = nullptr;
+  }
+  VkDescriptorSetLayoutCreateInfo descriptor_set_layout_info;
+  descriptor_set_layout_info.sType =
+      VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+  descriptor_set_layout_info.pNext = nullptr;
+  descriptor_set_layout_info.flags = 0;
+  descriptor_set_layout_info.bindingCount = 2;
+  descriptor_set_layout_info.pBindings = bindings;
+  status = vkCreateDescriptorSetLayout(*device_, &descriptor_set_layout_info,
+                                       nullptr, &descriptor_set_layout_);
+  CheckResult(status, "vkCreateDescriptorSetLayout");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkPushConstantRange push_constant_range;
+  push_constant_range.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+  push_constant_range.offset = 0;
+  push_constant_range.size = sizeof(Constants);
+  VkPipelineLayoutCreateInfo pipeline_layout_info;
+  pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+  pipeline_layout_info.pNext = nullptr;
+  pipeline_layout_info.flags = 0;
+  pipeline_layout_info.setLayoutCount = 1;
+  pipeline_layout_info.pSetLayouts = &descriptor_set_layout_;
+  pipeline_layout_info.pushConstantRangeCount = 1;
+  pipeline_layout_info.pPushConstantRanges = &push_constant_range;
+  status = vkCreatePipelineLayout(*device_, &pipeline_layout_info, nullptr,
+                                  &pipeline_layout_);
+  CheckResult(status, "vkCreatePipelineLayout");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  // The buffers never change, so a single set is bound for every dispatch.
+  VkDescriptorPoolSize pool_size;
+  pool_size.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+  pool_size.descriptorCount = 2;
+  VkDescriptorPoolCreateInfo descriptor_pool_info;
+  descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+  descriptor_pool_info.pNext = nullptr;
+  descriptor_pool_info.flags = 0;
+  descriptor_pool_info.maxSets = 1;
+  descriptor_pool_info.poolSizeCount = 1;
+  descriptor_pool_info.pPoolSizes = &pool_size;
+  status = vkCreateDescriptorPool(*device_, &descriptor_pool_info, nullptr,
+                                  &descriptor_pool_);
+  CheckResult(status, "vkCreateDescriptorPool");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkDescriptorSetAllocateInfo set_alloc_info;
+  set_alloc_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+  set_alloc_info.pNext = nullptr;
+  set_alloc_info.descriptorPool = descriptor_pool_;
+  set_alloc_info.descriptorSetCount = 1;
+  set_alloc_info.pSetLayouts = &descriptor_set_layout_;
+  status =
+      vkAllocateDescriptorSets(*device_, &set_alloc_info, &descriptor_set_);
+  CheckResult(status, "vkAllocateDescriptorSets");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkDescriptorBufferInfo buffer_infos[2];
+  buffer_infos[0].buffer = buffer;
+  buffer_infos[1].buffer = source_buffer ? source_buffer : buffer;
+  VkWriteDescriptorSet descriptor_writes[2];
+  std::memset(descriptor_writes, 0, sizeof(descriptor_writes));
+  for (uint32_t i = 0; i < 2; ++i) {
+    buffer_infos[i].offset = 0;
+    buffer_infos[i].range = VK_WHOLE_SIZE;
+    descriptor_writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptor_writes[i].dstSet = descriptor_set_;
+    descriptor_writes[i].dstBinding = i;
+    descriptor_writes[i].descriptorCount = 1;
+    descriptor_writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptor_writes[i].pBufferInfo = &buffer_infos[i];
+  }
+  vkUpdateDescriptorSets(*device_, 2, descriptor_writes, 0, nullptr);
+
+  for (size_t i = 0; i < size_t(Mode::kCount); ++i) {
+    auto code = BuildShader(Mode(i));
+    VkShaderModuleCreateInfo shader_info;
+    shader_info.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shader_info.pNext = nullptr;
+    shader_info.flags = 0;
+    shader_info.codeSize = code.size() * sizeof(uint32_t);
+    shader_info.pCode = code.data();
+    status = vkCreateShaderModule(*device_, &shader_info, nullptr,
+                                  &shader_modules_[i]);
+    CheckResult(status, "vkCreateShaderModule");
+    if (status != VK_SUCCESS) {
+      return status;
+    }
+
+    VkComputePipelineCreateInfo pipeline_info;
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.pNext = nullptr;
+    pipeline_info.flags = 0;
+    pipeline_info.stage.sType =
+        VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipeline_info.stage.pNext = nullptr;
+    pipeline_info.stage.flags = 0;
+    pipeline_info.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipeline_info.stage.module = shader_modules_[i];
+    pipeline_info.stage.pName = "main";
+    pipeline_info.stage.pSpecializationInfo = nullptr;
+    pipeline_info.layout = pipeline_layout_;
+    pipeline_info.basePipelineHandle = nullptr;
+    pipeline_info.basePipelineIndex = -1;
+    status = vkCreateComputePipelines(*device_, nullptr, 1, &pipeline_info,
+                                      nullptr, &pipelines_[i]);
+    CheckResult(status, "vkCreateComputePipelines");
+    if (status != VK_SUCCESS) {
+      return status;
+    }
+  }
+
+  return VK_SUCCESS;
+}
+
+void TextureConverter::Shutdown() {
+  for (size_t i = 0; i < size_t(Mode::kCount); ++i) {
+    if (pipelines_[i]) {
+      vkDestroyPipeline(*device_, pipelines_[i], nullptr);
+      pipelines_[i] = nullptr;
+    }
+    if (shader_modules_[i]) {
+      vkDestroyShaderModule(*device_, shader_modules_[i], nullptr);
+      shader_modules_[i] = nullptr;
+    }
+  }
+  if (descriptor_pool_) {
+    // Frees descriptor_set_ along with it.
+    vkDestroyDescriptorPool(*device_, descriptor_pool_, nullptr);
+    descriptor_pool_ = nullptr;
+    descriptor_set_ = nullptr;
+  }
+  if (pipeline_layout_) {
+    vkDestroyPipelineLayout(*device_, pipeline_layout_, nullptr);
+    pipeline_layout_ = nullptr;
+  }
+  if (descriptor_set_layout_) {
+    vkDestroyDescriptorSetLayout(*device_, descriptor_set_layout_, nullptr);
+    descriptor_set_layout_ = nullptr;
+  }
+}
+
+void TextureConverter::Dispatch(VkCommandBuffer command_buffer, Mode mode,
+                                const Constants& constants, uint32_t depth) {
+  uint32_t invocations_x =
+      (constants.width + (1u << constants.texel_shift) - 1) >>
+      constants.texel_shift;
+  vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                    pipelines_[size_t(mode)]);
+  vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_COMPUTE,
+                          pipeline_layout_, 0, 1, &descriptor_set_, 0,
+                          nullptr);
+  vkCmdPushConstants(command_buffer, pipeline_layout_,
+                     VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(Constants),
+                     &constants);
+  vkCmdDispatch(command_buffer, xe::round_up(invocations_x, kGroupSize) /
+                                    kGroupSize,
+                xe::round_up(constants.height, kGroupSize) / kGroupSize,
+                depth);
+}
+
+std::vector<uint32_t> TextureConverter::BuildShader(Mode mode) {
+  spv::Builder b(0x10000, 0xFFFFFFFF, nullptr);
+  b.setSource(spv::SourceLanguage::SourceLanguageUnknown, 0);
+  b.setMemoryModel(spv::AddressingModel::AddressingModelLogical,
+                   spv::MemoryModel::MemoryModelGLSL450);
+  b.addCapability(spv::Capability::CapabilityShader);
+
+  Id bool_type = b.makeBoolType();
+  Id uint_type = b.makeUintType(32);
+  Id float_type = b.makeFloatType(32);
+  Id uvec3_type = b.makeVectorType(uint_type, 3);
+
+  // Push constants, one uint per field of Constants.
+  const uint32_t constant_count = sizeof(Constants) / sizeof(uint32_t);
+  Id constants_type = b.makeStructType(
+      std::vector<Id>(constant_count, uint_type), "constants_type");
+  b.addDecoration(constants_type, spv::Decoration::DecorationBlock);
+  for (uint32_t i = 0; i < constant_count; ++i) {
+    b.addMemberDecoration(constants_type, i, spv::Decoration::DecorationOffset,
+                          i * sizeof(uint32_t));
+  }
+  Id constants = b.createVariable(spv::StorageClass::StorageClassPushConstant,
+                                  constants_type, "constants");
+
+  // The whole output and source buffers as arrays of words. They may be the
+  // same buffer.
+  Id data_array_type = b.makeRuntimeArray(uint_type);
+  b.addDecoration(data_array_type, spv::Decoration::DecorationArrayStride,
+                  sizeof(uint32_t));
+  Id data_type = b.makeStructType({data_array_type}, "data_type");
+  b.addDecoration(data_type, spv::Decoration::DecorationBufferBlock);
+  b.addMemberName(data_type, 0, "words");
+  b.addMemberDecoration(data_type, 0, spv::Decoration::DecorationOffset, 0);
+  Id data = b.createVariable(spv::StorageClass::StorageClassUniform,
+                             data_type, "data");
+  b.addDecoration(data, spv::Decoration::DecorationDescriptorSet, 0);
+  b.addDecoration(data, spv::Decoration::DecorationBinding, 0);
+  Id source = b.createVariable(spv::StorageClass::StorageClassUniform,
+                               data_type, "source");
+  b.addDecoration(source, spv::Decoration::DecorationDescriptorSet, 0);
+  b.addDecoration(source, spv::Decoration::DecorationBinding, 1);
+  b.addDecoration(source, spv::Decoration::DecorationNonWritable);
+
+  Id invocation_id = b.createVariable(spv::StorageClass::StorageClassInput,
+                                      uvec3_type, "gl_GlobalInvocationID");
+  b.addDecoration(invocation_id, spv::Decoration::DecorationBuiltIn,
+                  spv::BuiltIn::BuiltInGlobalInvocationId);
+
+  spv::Block* entry_block;
+  auto main_fn = b.makeFunctionEntry(spv::NoPrecision, b.makeVoidType(),
+                                     "main", {}, {}, &entry_block);
+  auto entry = b.addEntryPoint(spv::ExecutionModel::ExecutionModelGLCompute,
+                               main_fn, "main");
+  entry->addIdOperand(invocation_id);
+  b.addExecutionMode(main_fn, spv::ExecutionMode::ExecutionModeLocalSize,
+                     kGroupSize, kGroupSize, 1);
+
+  auto u = [&](uint32_t value) { return b.makeUintConstant(value); };
+  auto op = [&](spv::Op opcode, Id a, Id c) {
+    return b.createBinOp(opcode, uint_type, a, c);
+  };
+  auto add = [&](Id a, Id c) { return op(spv::Op::OpIAdd, a, c); };
+  auto mul = [&](Id a, Id c) { return op(spv::Op::OpIMul, a, c); };
+  auto and_ = [&](Id a, uint32_t mask) {
+    return op(spv::Op::OpBitwiseAnd, a, u(mask));
+  };
+  auto or_ = [&](Id a, Id c) { return op(spv::Op::OpBitwiseOr, a, c); };
+  auto shl = [&](Id a, Id shift) {
+    return op(spv::Op::OpShiftLeftLogical, a, shift);
+  };
+  auto shr = [&](Id a, Id shift) {
+    return op(spv::Op::OpShiftRightLogical, a, shift);
+  };
+  auto select = [&](Id condition, Id a, Id c) {
+    return b.createTriOp(spv::Op::OpSelect, uint_type, condition, a, c);
+  };
+  auto equal = [&](Id a, uint32_t value) {
+    return b.createBinOp(spv::Op::OpIEqual, bool_type, a, u(value));
+  };
+  auto constant = [&](size_t offset) {
+    Id ptr = b.createAccessChain(spv::StorageClass::StorageClassPushConstant,
+                                 constants,
+                                 {u(uint32_t(offset / sizeof(uint32_t)))});
+    return b.createLoad(ptr);
+  };
+  auto word_ptr = [&](Id index) {
+    return b.createAccessChain(spv::StorageClass::StorageClassUniform, data,
+                               {u(0), index});
+  };
+  auto source_word_ptr = [&](Id index) {
+    return b.createAccessChain(spv::StorageClass::StorageClassUniform, source,
+                               {u(0), index});
+  };
+#define CONSTANT(name) constant(offsetof(Constants, name))
+
+  Id id = b.createLoad(invocation_id);
+  Id texel_shift = CONSTANT(texel_shift);
+  Id x0 = shl(b.createCompositeExtract(id, uint_type, 0), texel_shift);
+  Id y = b.createCompositeExtract(id, uint_type, 1);
+  Id face = b.createCompositeExtract(id, uint_type, 2);
+  Id in_bounds = b.createBinOp(
+      spv::Op::OpLogicalAnd, bool_type,
+      b.createBinOp(spv::Op::OpULessThan, bool_type, x0, CONSTANT(width)),
+      b.createBinOp(spv::Op::OpULessThan, bool_type, y, CONSTANT(height)));
+  spv::Builder::If bounds_if(in_bounds, 0, b);
+
+  Id log2_bpp = CONSTANT(log2_bpp);
+  Id src_pitch = CONSTANT(src_pitch);
+  Id tx = add(CONSTANT(offset_x), x0);
+  Id ty = add(CONSTANT(offset_y), y);
+
+  // Same as TiledOffset2DRow and TiledOffset2DColumn in texture_conversion.
+  Id macro_row = shl(mul(shr(ty, u(5)), shr(src_pitch, u(5))),
+                     add(log2_bpp, u(7)));
+  Id micro_row = shl(shl(and_(ty, 6), u(2)), log2_bpp);
+  Id row = add(add(add(macro_row, shl(and_(micro_row, ~0xFu), u(1))),
+                   and_(micro_row, 0xF)),
+               add(shl(and_(ty, 8), add(log2_bpp, u(3))),
+                   shl(and_(ty, 1), u(4))));
+  Id macro_column = shl(shr(tx, u(5)), add(log2_bpp, u(7)));
+  Id micro_column = shl(and_(tx, 7), log2_bpp);
+  Id column = add(row, add(add(macro_column,
+                               shl(and_(micro_column, ~0xFu), u(1))),
+                           and_(micro_column, 0xF)));
+  Id tiled_offset = add(
+      add(add(shl(and_(column, ~0x1FFu), u(3)),
+              shl(and_(column, 0x1C0), u(2))),
+          and_(column, 0x3F)),
+      add(shl(and_(ty, 16), u(7)),
+          shl(and_(add(shr(and_(ty, 8), u(2)), shr(tx, u(3))), 3), u(6))));
+  tiled_offset = shl(shr(tiled_offset, log2_bpp), log2_bpp);
+  Id linear_offset = add(mul(ty, src_pitch), shl(tx, log2_bpp));
+  Id is_tiled = b.createBinOp(spv::Op::OpINotEqual, bool_type,
+                              CONSTANT(is_tiled), u(0));
+  Id src_offset = select(is_tiled, tiled_offset, linear_offset);
+  Id src_word = add(add(CONSTANT(src_offset),
+                        mul(face, CONSTANT(src_face_stride))),
+                    shr(src_offset, u(2)));
+  Id dst_base = add(CONSTANT(dst_offset), mul(face, CONSTANT(dst_face_stride)));
+  Id dst_pitch = CONSTANT(dst_pitch);
+
+  Id endian = CONSTANT(endian);
+  Id swap_bytes = b.createBinOp(spv::Op::OpLogicalOr, bool_type,
+                                equal(endian, 1), equal(endian, 2));
+  Id swap_halves = b.createBinOp(spv::Op::OpLogicalOr, bool_type,
+                                 equal(endian, 2), equal(endian, 3));
+  auto load_word = [&](uint32_t index) {
+    Id word = b.createLoad(source_word_ptr(add(src_word, u(index))));
+    word = select(swap_bytes,
+                  or_(and_(shl(word, u(8)), 0xFF00FF00),
+                      and_(shr(word, u(8)), 0x00FF00FF)),
+                  word);
+    return select(swap_halves, or_(shl(word, u(16)), shr(word, u(16))), word);
+  };
+  auto store_word = [&](Id index, Id value) {
+    b.createStore(value, word_ptr(index));
+  };
+
+  switch (mode) {
+    case Mode::kCopy: {
+      Id dst_word = add(add(dst_base, mul(y, dst_pitch)),
+                        shr(shl(x0, log2_bpp), u(2)));
+      Id block_words = CONSTANT(block_words);
+      store_word(dst_word, load_word(0));
+      for (uint32_t i = 1; i < 4; ++i) {
+        spv::Builder::If word_if(
+            b.createBinOp(spv::Op::OpULessThan, bool_type, u(i), block_words),
+            0, b);
+        store_word(add(dst_word, u(i)), load_word(i));
+        word_if.makeEndIf();
+      }
+    } break;
+    case Mode::kCTX1ToR8G8: {
+      // w0 is r0, g0, r1, g1 from the low byte up, w1 the 2 bit indices.
+      Id w0 = load_word(0);
+      Id w1 = load_word(1);
+      auto lerp = [&](Id c0, Id c1) {
+        const float third = 1.f / 3.f;
+        Id f0 = b.createUnaryOp(spv::Op::OpConvertUToF, float_type, c0);
+        Id f1 = b.createUnaryOp(spv::Op::OpConvertUToF, float_type, c1);
+        Id f = b.createBinOp(
+            spv::Op::OpFAdd, float_type,
+            b.createBinOp(spv::Op::OpFMul, float_type, f0,
+                          b.makeFloatConstant(2.f * third)),
+            b.createBinOp(spv::Op::OpFMul, float_type, f1,
+                          b.makeFloatConstant(third)));
+        return b.createUnaryOp(spv::Op::OpConvertFToU, uint_type, f);
+      };
+      Id r0 = and_(w0, 0xFF);
+      Id g0 = and_(shr(w0, u(8)), 0xFF);
+      Id r1 = and_(shr(w0, u(16)), 0xFF);
+      Id g1 = shr(w0, u(24));
+      Id palette[4] = {
+          and_(w0, 0xFFFF), shr(w0, u(16)),
+          or_(lerp(r0, r1), shl(lerp(g0, g1), u(8))),
+          or_(lerp(r1, r0), shl(lerp(g1, g0), u(8))),
+      };
+      Id dst_column = shl(x0, u(1));
+      for (uint32_t oy = 0; oy < 4; ++oy) {
+        Id dst_word =
+            add(add(dst_base, mul(add(shl(y, u(2)), u(oy)), dst_pitch)),
+                dst_column);
+        for (uint32_t ow = 0; ow < 2; ++ow) {
+          Id texels[2];
+          for (uint32_t i = 0; i < 2; ++i) {
+            uint32_t ox = ow * 2 + i;
+            Id index = and_(shr(w1, u((ox + oy * 4) * 2)), 3);
+            texels[i] = select(
+                equal(index, 0), palette[0],
+                select(equal(index, 1), palette[1],
+                       select(equal(index, 2), palette[2], palette[3])));
+          }
+          store_word(add(dst_word, u(ow)),
+                     or_(texels[0], shl(texels[1], u(16))));
+        }
+      }
+    } break;
+    case Mode::kDXT3AToDXT3: {
+      Id dst_word = add(add(dst_base, mul(y, dst_pitch)), shl(x0, u(2)));
+      store_word(dst_word, load_word(0));
+      store_word(add(dst_word, u(1)), load_word(1));
+      store_word(add(dst_word, u(2)), u(0));
+      store_word(add(dst_word, u(3)), u(0));
+    } break;
+    default:
+      assert_unhandled_case(mode);
+      break;
+  }
+#undef CONSTANT
+
+  bounds_if.makeEndIf();
+  b.makeReturn(false);
+
+  std::vector<uint32_t> spirv_words;
+  b.dump(spirv_words);
+  return spirv_words;
+}
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
@@ -0,0 +1,100 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_GPU_VULKAN_TEXTURE_CONVERTER_H_
+#define XENIA_GPU_VULKAN_TEXTURE_CONVERTER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "xenia/ui/vulkan/vulkan.h"
+#include "xenia/ui/vulkan/vulkan_device.h"
+
+namespace xe {
+namespace gpu {
+namespace vulkan {
+
+// Untiles, endian swaps and converts guest texture data with compute shaders.
+// The output lives in a storage buffer (the texture staging buffer), from
+// which it is copied into the image as usual. The guest data is read either
+// from the same buffer or from guest memory imported as a buffer.
+class TextureConverter {
+ public:
+  enum class Mode {
+    // Blocks are copied as they are.
+    kCopy,
+    // Each CTX1 block is expanded into its 4x4 R8G8 texels.
+    kCTX1ToR8G8,
+    // DXT3A alpha blocks become DXT3 blocks with black color.
+    kDXT3AToDXT3,
+    kCount,
+  };
+
+  // Push constants, all in the same order as in the shader.
+  struct Constants {
+    // Word offsets of the guest data in the source buffer and of the output
+    // in the buffer.
+    uint32_t src_offset;
+    uint32_t dst_offset;
+    // Words between consecutive faces or slices.
+    uint32_t src_face_stride;
+    uint32_t dst_face_stride;
+    // Size of the mip, in source blocks.
+    uint32_t width;
+    uint32_t height;
+    // Position of the mip within the source surface, in blocks.
+    uint32_t offset_x;
+    uint32_t offset_y;
+    // Source pitch, in blocks if tiled and in bytes otherwise.
+    uint32_t src_pitch;
+    // Output row pitch, in words.
+    uint32_t dst_pitch;
+    // log2 of the source bytes per block.
+    uint32_t log2_bpp;
+    // log2 of the blocks each invocation handles, so that blocks smaller than
+    // a word are handled a whole word at a time.
+    uint32_t texel_shift;
+    // Words per block, kCopy only.
+    uint32_t block_words;
+    // xenos::Endian of the source.
+    uint32_t endian;
+    uint32_t is_tiled;
+  };
+
+  explicit TextureConverter(ui::vulkan::VulkanDevice* device);
+  ~TextureConverter();
+
+  // buffer holds the output of every conversion, and source_buffer the guest
+  // data, or buffer as well if null.
+  VkResult Initialize(VkBuffer buffer, VkBuffer source_buffer = nullptr);
+  void Shutdown();
+
+  // Records the conversion of one mip with depth faces or slices. The caller
+  // is responsible for the barriers around it.
+  void Dispatch(VkCommandBuffer command_buffer, Mode mode,
+                const Constants& constants, uint32_t depth);
+
+ private:
+  static std::vector<uint32_t> BuildShader(Mode mode);
+
+  ui::vulkan::VulkanDevice* device_ = nullptr;
+
+  VkDescriptorSetLayout descriptor_set_layout_ = nullptr;
+  VkDescriptorPool descriptor_pool_ = nullptr;
+  VkDescriptorSet descriptor_set_ = nullptr;
+  VkPipelineLayout pipeline_layout_ = nullptr;
+  VkShaderModule shader_modules_[size_t(Mode::kCount)] = {};
+  VkPipeline pipelines_[size_t(Mode::kCount)] = {};
+};
+
+}  // namespace vulkan
+}  // namespace gpu
+}  // namespace xe
+
+#endif  // XENIA_GPU_VULKAN_TEXTURE_CONVERTER_H_
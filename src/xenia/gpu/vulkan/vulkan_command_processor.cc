@@ -21,6 +21,8 @@
 #include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 #include "xenia/gpu/vulkan/vulkan_graphics_system.h"
 #include "xenia/gpu/xenos.h"
+#include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/user_module.h"
 #include "xenia/ui/vulkan/vulkan_util.h"
 
 namespace xe {
@@ -32,6 +34,10 @@ using xe::ui::vulkan::CheckResult;
 
 constexpr size_t kDefaultBufferCacheCapacity = 256 * 1024 * 1024;
 
+DEFINE_profile_gpu(gpu_draw, "host_gpu", "Draw");
+DEFINE_profile_gpu(gpu_resolve, "host_gpu", "Resolve");
+DEFINE_profile_gpu(gpu_swap_blit, "host_gpu", "SwapBlit");
+
 VulkanCommandProcessor::VulkanCommandProcessor(
     VulkanGraphicsSystem* graphics_system, kernel::KernelState* kernel_state)
     : CommandProcessor(graphics_system, kernel_state) {}
@@ -80,13 +86,20 @@ bool VulkanCommandProcessor::SetupContext() {
     return false;
   }
 
+  status = CreateGammaRampImage();
+  if (status != VK_SUCCESS) {
+    XELOGE("Unable to create the gamma ramp image");
+    return false;
+  }
+
   // Setup fenced pools used for all our per-frame/per-draw resources.
   command_buffer_pool_ = std::make_unique<ui::vulkan::CommandBufferPool>(
       *device_, device_->queue_family_index());
 
   // Initialize the state machine caches.
   buffer_cache_ = std::make_unique<BufferCache>(
-      register_file_, memory_, device_, kDefaultBufferCacheCapacity);
+      register_file_, memory_, device_, command_buffer_pool_.get(),
+      kDefaultBufferCacheCapacity);
   status = buffer_cache_->Initialize();
   if (status != VK_SUCCESS) {
     XELOGE("Unable to initialize buffer cache");
@@ -94,14 +107,16 @@ bool VulkanCommandProcessor::SetupContext() {
     return false;
   }
 
-  texture_cache_ = std::make_unique<TextureCache>(memory_, register_file_,
-                                                  &trace_writer_, device_);
+  texture_cache_ = std::make_unique<TextureCache>(
+      memory_, register_file_, &trace_writer_, device_,
+      command_buffer_pool_.get());
   status = texture_cache_->Initialize();
   if (status != VK_SUCCESS) {
     XELOGE("Unable to initialize texture cache");
     texture_cache_->Shutdown();
     return false;
   }
+  buffer_cache_->InitializeIndexConverter(texture_cache_->guest_buffer());
 
   pipeline_cache_ = std::make_unique<PipelineCache>(register_file_, device_);
   status = pipeline_cache_->Initialize(
@@ -122,19 +137,54 @@ bool VulkanCommandProcessor::SetupContext() {
     return false;
   }
 
+  if (FLAGS_vulkan_occlusion_queries) {
+    query_cache_ = std::make_unique<QueryCache>(memory_, device_,
+                                                command_buffer_pool_.get());
+    status = query_cache_->Initialize();
+    if (status != VK_SUCCESS) {
+      XELOGW("Unable to initialize query cache, occlusion queries disabled");
+      query_cache_.reset();
+    }
+  }
+
+  if (FLAGS_vulkan_draw_timing) {
+    draw_timer_ = std::make_unique<DrawTimer>(device_);
+    status = draw_timer_->Initialize();
+    if (status != VK_SUCCESS) {
+      XELOGW("Unable to initialize draw timer, draws won't be timed");
+      draw_timer_.reset();
+    }
+  }
+
+  if (Profiler::is_enabled()) {
+    gpu_profiler_ = std::make_unique<GpuProfiler>(device_);
+    status = gpu_profiler_->Initialize();
+    if (status != VK_SUCCESS) {
+      XELOGW("Unable to initialize GPU profiler, GPU scopes won't be timed");
+      gpu_profiler_.reset();
+    }
+  }
+
   return true;
 }
 
 void VulkanCommandProcessor::ShutdownContext() {
   // TODO(benvanik): wait until idle.
+  WaitForSwapFences(0);
 
   if (swap_state_.front_buffer_texture) {
     // Free swap chain image.
     DestroySwapImage();
   }
+  DestroyGammaRampImage();
 
   buffer_cache_.reset();
+  draw_timer_.reset();
+  gpu_profiler_.reset();
   pipeline_cache_.reset();
+  query_cache_.reset();
+  checkpoint_snapshots_.clear();
+  retired_checkpoint_snapshots_.clear();
   render_cache_.reset();
   texture_cache_.reset();
 
@@ -170,11 +220,30 @@ void VulkanCommandProcessor::MakeCoherent() {
   }
 }
 
+void VulkanCommandProcessor::BeginOcclusionQuery(
+    uint32_t sample_counts_address) {
+  if (query_cache_) {
+    query_cache_->BeginQuery(sample_counts_address);
+  }
+}
+
+void VulkanCommandProcessor::EndOcclusionQuery(
+    uint32_t sample_counts_address) {
+  if (query_cache_) {
+    query_cache_->EndQuery(sample_counts_address);
+  }
+}
+
 void VulkanCommandProcessor::PrepareForWait() {
   SCOPE_profile_cpu_f("gpu");
 
   CommandProcessor::PrepareForWait();
 
+  // The guest may be waiting for query results.
+  if (query_cache_) {
+    query_cache_->Scavenge();
+  }
+
   // TODO(benvanik): fences and fancy stuff. We should figure out a way to
   // make interrupt callbacks from the GPU so that we don't have to do a full
   // synchronize here.
@@ -191,6 +260,10 @@ void VulkanCommandProcessor::ReturnFromWait() {
 }
 
 void VulkanCommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
+  if (pending_draw_.index_count &&
+      register_file_->values[index].u32 != value) {
+    FlushPendingDraws();
+  }
   CommandProcessor::WriteRegister(index, value);
 
   if (index >= XE_GPU_REG_SHADER_CONSTANT_000_X &&
@@ -229,6 +302,58 @@ void VulkanCommandProcessor::WriteRegister(uint32_t index, uint32_t value) {
   }
 }
 
+void VulkanCommandProcessor::WriteRegistersFromMem(uint32_t start_index,
+                                                   const uint32_t* base,
+                                                   uint32_t num_registers) {
+  if (pending_draw_.index_count) {
+    for (uint32_t i = 0; i < num_registers; ++i) {
+      if (register_file_->values[start_index + i].u32 !=
+          xe::load_and_swap<uint32_t>(base + i)) {
+        FlushPendingDraws();
+        break;
+      }
+    }
+  }
+
+  uint32_t end_index = start_index + num_registers;
+  if (start_index <= XE_GPU_REG_DC_LUTA_CONTROL &&
+      end_index > XE_GPU_REG_DC_LUT_RW_MODE) {
+    // The gamma ramp is written through one register at a time.
+    for (uint32_t i = 0; i < num_registers; ++i) {
+      WriteRegister(start_index + i, xe::load_and_swap<uint32_t>(base + i));
+    }
+    return;
+  }
+
+  CommandProcessor::WriteRegistersFromMem(start_index, base, num_registers);
+
+  // Same as in WriteRegister, for the whole range at once.
+  uint32_t first, last;
+  first = std::max(start_index, uint32_t(XE_GPU_REG_SHADER_CONSTANT_000_X));
+  last = std::min(end_index, uint32_t(XE_GPU_REG_SHADER_CONSTANT_511_W + 1));
+  if (first < last) {
+    first = (first - XE_GPU_REG_SHADER_CONSTANT_000_X) / (4 * 4);
+    last = (last - 1 - XE_GPU_REG_SHADER_CONSTANT_000_X) / (4 * 4);
+    for (uint32_t i = first; i <= last; ++i) {
+      dirty_float_constants_ |= (1ull << (i ^ 0x3F));
+    }
+  }
+  first = std::max(start_index,
+                   uint32_t(XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031));
+  last = std::min(end_index,
+                  uint32_t(XE_GPU_REG_SHADER_CONSTANT_BOOL_224_255 + 1));
+  for (uint32_t i = first; i < last; ++i) {
+    dirty_bool_constants_ |=
+        (1 << ((i - XE_GPU_REG_SHADER_CONSTANT_BOOL_000_031) ^ 0x7));
+  }
+  first = std::max(start_index, uint32_t(XE_GPU_REG_SHADER_CONSTANT_LOOP_00));
+  last = std::min(end_index, uint32_t(XE_GPU_REG_SHADER_CONSTANT_LOOP_31 + 1));
+  for (uint32_t i = first; i < last; ++i) {
+    dirty_loop_constants_ |=
+        (1 << ((i - XE_GPU_REG_SHADER_CONSTANT_LOOP_00) ^ 0x1F));
+  }
+}
+
 void VulkanCommandProcessor::CreateSwapImage(VkCommandBuffer setup_buffer,
                                              VkExtent2D extents) {
   VkImageCreateInfo image_info;
@@ -328,6 +453,193 @@ void VulkanCommandProcessor::DestroySwapImage() {
   fb_image_view_ = nullptr;
 }
 
+VkResult VulkanCommandProcessor::CreateGammaRampImage() {
+  // 10 bits per component, as much as either ramp has.
+  VkImageCreateInfo image_info;
+  std::memset(&image_info, 0, sizeof(VkImageCreateInfo));
+  image_info.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+  image_info.imageType = VK_IMAGE_TYPE_2D;
+  image_info.format = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+  image_info.extent = {256, 1, 1};
+  image_info.mipLevels = 1;
+  image_info.arrayLayers = 1;
+  image_info.samples = VK_SAMPLE_COUNT_1_BIT;
+  image_info.tiling = VK_IMAGE_TILING_OPTIMAL;
+  image_info.usage =
+      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+  image_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  image_info.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+  auto status =
+      vkCreateImage(*device_, &image_info, nullptr, &gamma_ramp_image_);
+  CheckResult(status, "vkCreateImage");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkMemoryRequirements mem_requirements;
+  vkGetImageMemoryRequirements(*device_, gamma_ramp_image_, &mem_requirements);
+  gamma_ramp_image_memory_ = device_->AllocateMemory(mem_requirements, 0);
+  if (!gamma_ramp_image_memory_) {
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  status = vkBindImageMemory(*device_, gamma_ramp_image_,
+                             gamma_ramp_image_memory_, 0);
+  CheckResult(status, "vkBindImageMemory");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkImageViewCreateInfo view_create_info = {
+      VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      nullptr,
+      0,
+      gamma_ramp_image_,
+      VK_IMAGE_VIEW_TYPE_2D,
+      VK_FORMAT_A2B10G10R10_UNORM_PACK32,
+      {VK_COMPONENT_SWIZZLE_R, VK_COMPONENT_SWIZZLE_G, VK_COMPONENT_SWIZZLE_B,
+       VK_COMPONENT_SWIZZLE_A},
+      {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1},
+  };
+  status = vkCreateImageView(*device_, &view_create_info, nullptr,
+                             &gamma_ramp_image_view_);
+  CheckResult(status, "vkCreateImageView");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  VkBufferCreateInfo buffer_info;
+  std::memset(&buffer_info, 0, sizeof(VkBufferCreateInfo));
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.size = 256 * sizeof(uint32_t);
+  buffer_info.usage =
+      VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  status = vkCreateBuffer(*device_, &buffer_info, nullptr, &gamma_ramp_buffer_);
+  CheckResult(status, "vkCreateBuffer");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  vkGetBufferMemoryRequirements(*device_, gamma_ramp_buffer_,
+                                &mem_requirements);
+  gamma_ramp_buffer_memory_ = device_->AllocateMemory(mem_requirements, 0);
+  if (!gamma_ramp_buffer_memory_) {
+    return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  status = vkBindBufferMemory(*device_, gamma_ramp_buffer_,
+                              gamma_ramp_buffer_memory_, 0);
+  CheckResult(status, "vkBindBufferMemory");
+  gamma_ramp_uploaded_ = false;
+  return status;
+}
+
+void VulkanCommandProcessor::DestroyGammaRampImage() {
+  VK_SAFE_DESTROY(vkDestroyImageView, *device_, gamma_ramp_image_view_,
+                  nullptr);
+  VK_SAFE_DESTROY(vkDestroyImage, *device_, gamma_ramp_image_, nullptr);
+  VK_SAFE_DESTROY(vkFreeMemory, *device_, gamma_ramp_image_memory_, nullptr);
+  VK_SAFE_DESTROY(vkDestroyBuffer, *device_, gamma_ramp_buffer_, nullptr);
+  VK_SAFE_DESTROY(vkFreeMemory, *device_, gamma_ramp_buffer_memory_, nullptr);
+}
+
+void VulkanCommandProcessor::UpdateGammaRampImage(
+    VkCommandBuffer command_buffer) {
+  // The ramp last written to is the one in use.
+  bool use_pwl = register_file_->values[XE_GPU_REG_DC_LUT_RW_MODE].u32 != 0;
+  if (gamma_ramp_uploaded_ && use_pwl == gamma_ramp_pwl_uploaded_ &&
+      !(use_pwl ? dirty_gamma_ramp_pwl_ : dirty_gamma_ramp_normal_)) {
+    return;
+  }
+
+  // A2B10G10R10, for each 8-bit input.
+  uint32_t ramp[256];
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t r, g, b;
+    if (use_pwl) {
+      // 128 segments over the 10-bit input, each with a 16-bit base and the
+      // delta over its 8 values.
+      uint32_t input = (i * 1023 + 127) / 255;
+      const auto& entry = gamma_ramp_.pwl[input >> 3];
+      uint32_t fraction = input & 7;
+      uint32_t output[3];
+      for (uint32_t j = 0; j < 3; ++j) {
+        const auto& value = entry.values[j];
+        output[j] =
+            std::min(value.base + value.delta * fraction / 8, 0xFFFFu) >> 6;
+      }
+      r = output[0];
+      g = output[1];
+      b = output[2];
+    } else {
+      const auto& entry = gamma_ramp_.normal[i];
+      r = entry.r;
+      g = entry.g;
+      b = entry.b;
+    }
+    ramp[i] = r | (g << 10) | (b << 20) | (3u << 30);
+  }
+  if (use_pwl) {
+    dirty_gamma_ramp_pwl_ = false;
+  } else {
+    dirty_gamma_ramp_normal_ = false;
+  }
+  gamma_ramp_pwl_uploaded_ = use_pwl;
+
+  // The data goes into the command buffer, so nothing in flight is changed.
+  VkBufferMemoryBarrier buffer_barrier;
+  std::memset(&buffer_barrier, 0, sizeof(VkBufferMemoryBarrier));
+  buffer_barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+  buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  buffer_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  buffer_barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  buffer_barrier.buffer = gamma_ramp_buffer_;
+  buffer_barrier.offset = 0;
+  buffer_barrier.size = VK_WHOLE_SIZE;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &buffer_barrier, 0, nullptr);
+  vkCmdUpdateBuffer(command_buffer, gamma_ramp_buffer_, 0, sizeof(ramp),
+                    ramp);
+  buffer_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  buffer_barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 1,
+                       &buffer_barrier, 0, nullptr);
+
+  // Wait for the blits of earlier swaps to be done reading the image.
+  VkImageMemoryBarrier barrier;
+  std::memset(&barrier, 0, sizeof(VkImageMemoryBarrier));
+  barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+  barrier.srcAccessMask = 0;
+  barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.oldLayout = gamma_ramp_uploaded_ ? VK_IMAGE_LAYOUT_GENERAL
+                                           : VK_IMAGE_LAYOUT_UNDEFINED;
+  barrier.newLayout = VK_IMAGE_LAYOUT_GENERAL;
+  barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+  barrier.image = gamma_ramp_image_;
+  barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                       VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+
+  VkBufferImageCopy region;
+  std::memset(&region, 0, sizeof(VkBufferImageCopy));
+  region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+  region.imageExtent = {256, 1, 1};
+  vkCmdCopyBufferToImage(command_buffer, gamma_ramp_buffer_, gamma_ramp_image_,
+                         VK_IMAGE_LAYOUT_GENERAL, 1, &region);
+
+  barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+  barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+  barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+  vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                       VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0,
+                       nullptr, 1, &barrier);
+  gamma_ramp_uploaded_ = true;
+}
+
 void VulkanCommandProcessor::BeginFrame() {
   assert_false(frame_open_);
 
@@ -352,6 +664,13 @@ void VulkanCommandProcessor::BeginFrame() {
       vkBeginCommandBuffer(current_setup_buffer_, &command_buffer_begin_info);
   CheckResult(status, "vkBeginCommandBuffer");
 
+  if (draw_timer_) {
+    draw_timer_->BeginFrame(current_setup_buffer_);
+  }
+  if (gpu_profiler_) {
+    gpu_profiler_->BeginFrame(current_setup_buffer_, current_command_buffer_);
+  }
+
   // Flag renderdoc down to start a capture if requested.
   // The capture will end when these commands are submitted to the queue.
   static uint32_t frame = 0;
@@ -379,6 +698,9 @@ void VulkanCommandProcessor::EndFrame() {
     current_render_state_ = nullptr;
   }
 
+  // The uploads demanded during the frame run before its render passes.
+  texture_cache_->CommitUploads(current_setup_buffer_);
+
   VkResult status = VK_SUCCESS;
   status = vkEndCommandBuffer(current_setup_buffer_);
   CheckResult(status, "vkEndCommandBuffer");
@@ -388,15 +710,29 @@ void VulkanCommandProcessor::EndFrame() {
   current_command_buffer_ = nullptr;
   current_setup_buffer_ = nullptr;
   command_buffer_pool_->EndBatch();
+  if (gpu_profiler_) {
+    gpu_profiler_->EndFrame();
+  }
 
   frame_open_ = false;
 }
 
+void VulkanCommandProcessor::WaitForSwapFences(uint32_t max_count) {
+  while (swap_fences_.size() > max_count) {
+    VkFence fence = swap_fences_.front();
+    swap_fences_.pop_front();
+    vkWaitForFences(*device_, 1, &fence, VK_TRUE, -1);
+  }
+}
+
 void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
                                          uint32_t frontbuffer_width,
                                          uint32_t frontbuffer_height) {
   SCOPE_profile_cpu_f("gpu");
 
+  FlushPendingDraws();
+  memory_->ProcessDeferredAccessWatches();
+
   // Build a final command buffer that copies the game's frontbuffer texture
   // into our backbuffer texture.
   VkCommandBuffer copy_commands = nullptr;
@@ -441,8 +777,11 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
   // Issue the commands to copy the game's frontbuffer to our backbuffer.
   auto texture = texture_cache_->Lookup(texture_info);
   if (texture) {
+    SCOPE_profile_gpu_context(gpu_swap_blit, copy_commands);
     texture->in_flight_fence = current_batch_fence_;
 
+    UpdateGammaRampImage(copy_commands);
+
     // Insert a barrier so the GPU finishes writing to the image.
     VkImageMemoryBarrier barrier;
     std::memset(&barrier, 0, sizeof(VkImageMemoryBarrier));
@@ -472,7 +811,8 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
                          VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0,
                          nullptr, 0, nullptr, 1, &barrier);
 
-    // Part of the source image that we want to blit from.
+    // Part of the source image that we want to blit from. The blit scales it
+    // to the frontbuffer size and applies the gamma ramp in the same pass.
     VkRect2D src_rect = {
         {0, 0},
         {texture->texture_info.width + 1, texture->texture_info.height + 1},
@@ -491,7 +831,7 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
         {texture->texture_info.width + 1, texture->texture_info.height + 1},
         VK_FORMAT_R8G8B8A8_UNORM, dst_rect,
         {frontbuffer_width, frontbuffer_height}, fb_framebuffer_, viewport,
-        scissor, VK_FILTER_LINEAR, true, true);
+        scissor, VK_FILTER_LINEAR, true, true, gamma_ramp_image_view_);
 
     std::swap(barrier.oldLayout, barrier.newLayout);
     barrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
@@ -524,6 +864,13 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
 
   submit_buffers.push_back(copy_commands);
   if (!submit_buffers.empty()) {
+    // Textures streamed on the transfer queue are acquired in the setup
+    // buffer.
+    VkSemaphore transfer_semaphore = texture_cache_->SubmitTransferUploads();
+    VkPipelineStageFlags transfer_wait_stage =
+        VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+        VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+
     // TODO(benvanik): move to CP or to host (trace dump, etc).
     // This only needs to surround a vkQueueSubmit.
     if (queue_mutex_) {
@@ -536,14 +883,15 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
     submit_info.commandBufferCount = uint32_t(submit_buffers.size());
     submit_info.pCommandBuffers = submit_buffers.data();
 
-    submit_info.waitSemaphoreCount = 0;
-    submit_info.pWaitSemaphores = nullptr;
-    submit_info.pWaitDstStageMask = nullptr;
+    submit_info.waitSemaphoreCount = transfer_semaphore ? 1 : 0;
+    submit_info.pWaitSemaphores = &transfer_semaphore;
+    submit_info.pWaitDstStageMask = &transfer_wait_stage;
 
     submit_info.signalSemaphoreCount = 0;
     submit_info.pSignalSemaphores = nullptr;
 
     status = vkQueueSubmit(queue_, 1, &submit_info, current_batch_fence_);
+    texture_cache_->MarkReadbacksSubmitted(current_batch_fence_);
     if (device_->is_renderdoc_attached() && capturing_) {
       device_->EndRenderDocFrameCapture();
       capturing_ = false;
@@ -553,15 +901,34 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
     }
   }
 
-  vkWaitForFences(*device_, 1, &current_batch_fence_, VK_TRUE, -1);
+  if (draw_timer_) {
+    draw_timer_->EndFrame();
+  }
+
+  // Only wait for the frames beyond the limit, so the GPU works on the others
+  // while the next is recorded. Everything reused by the caches is tracked
+  // with fences anyway.
+  swap_fences_.push_back(current_batch_fence_);
+  WaitForSwapFences(uint32_t(std::max(FLAGS_vulkan_max_frames_in_flight, 1)) -
+                    1);
+  pipeline_cache_->EndFrame();
+  render_cache_->EndFrame();
+
   if (cache_clear_requested_) {
     cache_clear_requested_ = false;
+    // The caches are about to free what the frames may still be using.
+    WaitForSwapFences(0);
 
     buffer_cache_->ClearCache();
     pipeline_cache_->ClearCache();
     render_cache_->ClearCache();
     texture_cache_->ClearCache();
   }
+  if (!retired_checkpoint_snapshots_.empty()) {
+    // Only released while seeking in traces, so the stall doesn't matter.
+    WaitForSwapFences(0);
+    retired_checkpoint_snapshots_.clear();
+  }
 
   // Scavenging.
   {
@@ -576,8 +943,12 @@ void VulkanCommandProcessor::PerformSwap(uint32_t frontbuffer_ptr,
     command_buffer_pool_->Scavenge();
 
     blitter_->Scavenge();
+    render_cache_->Scavenge();
     texture_cache_->Scavenge();
     buffer_cache_->Scavenge();
+    if (query_cache_) {
+      query_cache_->Scavenge();
+    }
   }
 
   current_batch_fence_ = nullptr;
@@ -587,6 +958,15 @@ Shader* VulkanCommandProcessor::LoadShader(ShaderType shader_type,
                                            uint32_t guest_address,
                                            const uint32_t* host_address,
                                            uint32_t dword_count) {
+  // The title is only known once it starts submitting work.
+  if (!disk_cache_opened_) {
+    disk_cache_opened_ = true;
+    auto module = kernel_state_->GetExecutableModule();
+    if (module) {
+      pipeline_cache_->OpenDiskCache(module->title_id(), render_cache_.get());
+    }
+  }
+
   return pipeline_cache_->LoadShader(shader_type, guest_address, host_address,
                                      dword_count);
 }
@@ -594,12 +974,121 @@ Shader* VulkanCommandProcessor::LoadShader(ShaderType shader_type,
 bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
                                        uint32_t index_count,
                                        IndexBufferInfo* index_buffer_info) {
+  // Only indexed lists are merged, as strips and fans can't be joined without
+  // a primitive reset, and auto-indexed draws all begin at the same index.
+  // Copies are never deferred.
+  auto enable_mode = static_cast<ModeControl>(
+      register_file_->values[XE_GPU_REG_RB_MODECONTROL].u32 & 0x7);
+  bool mergeable = FLAGS_vulkan_merge_draws && index_buffer_info &&
+                   (enable_mode == ModeControl::kColorDepth ||
+                    enable_mode == ModeControl::kDepth) &&
+                   (primitive_type == PrimitiveType::kPointList ||
+                    primitive_type == PrimitiveType::kLineList ||
+                    primitive_type == PrimitiveType::kTriangleList ||
+                    primitive_type == PrimitiveType::kRectangleList);
+  if (mergeable) {
+    uint32_t index_size =
+        index_buffer_info->format == IndexFormat::kInt32 ? 4 : 2;
+    mergeable = index_buffer_info->length == index_count * index_size;
+    // Register writes changing anything have flushed the pending draw.
+    const IndexBufferInfo& pending_info = pending_draw_.index_buffer_info;
+    if (mergeable && pending_draw_.index_count &&
+        pending_draw_.primitive_type == primitive_type &&
+        pending_info.format == index_buffer_info->format &&
+        pending_info.endianness == index_buffer_info->endianness &&
+        pending_info.guest_base + pending_info.length ==
+            index_buffer_info->guest_base) {
+      pending_draw_.index_count += index_count;
+      pending_draw_.index_buffer_info.count += index_count;
+      pending_draw_.index_buffer_info.length += index_buffer_info->length;
+      COUNT_profile_add("gpu/merged_draws", 1);
+      return true;
+    }
+  }
+
+  FlushPendingDraws();
+  if (mergeable) {
+    pending_draw_.primitive_type = primitive_type;
+    pending_draw_.index_count = index_count;
+    pending_draw_.index_buffer_info = *index_buffer_info;
+    return true;
+  }
+  return ExecuteDraw(primitive_type, index_count, index_buffer_info);
+}
+
+void VulkanCommandProcessor::FlushPendingDraws() {
+  if (!pending_draw_.index_count) {
+    return;
+  }
+  // Cleared first, as the draw itself may flush.
+  PendingDraw draw = pending_draw_;
+  pending_draw_.index_count = 0;
+  if (!ExecuteDraw(draw.primitive_type, draw.index_count,
+                   &draw.index_buffer_info)) {
+    XELOGE("Merged draw of %u indices failed in backend", draw.index_count);
+  }
+}
+
+bool VulkanCommandProcessor::SaveBackendCheckpoint(uint32_t checkpoint) {
+  EndRenderPassForTransfer();
+  auto snapshot = std::make_unique<TileViewSnapshot>();
+  if (!render_cache_->SnapshotTileViews(current_command_buffer_,
+                                        snapshot.get())) {
+    // May already be referenced by the commands.
+    retired_checkpoint_snapshots_.push_back(std::move(snapshot));
+    return false;
+  }
+  checkpoint_snapshots_[checkpoint] = std::move(snapshot);
+  return true;
+}
+
+void VulkanCommandProcessor::RestoreBackendCheckpoint(uint32_t checkpoint) {
+  auto it = checkpoint_snapshots_.find(checkpoint);
+  if (it == checkpoint_snapshots_.end()) {
+    return;
+  }
+  EndRenderPassForTransfer();
+  render_cache_->RestoreTileViews(current_command_buffer_, *it->second);
+  // The registers were all replaced behind the constant tracking.
+  dirty_float_constants_ = ~uint64_t(0);
+  dirty_bool_constants_ = ~uint8_t(0);
+  dirty_loop_constants_ = ~uint32_t(0);
+}
+
+void VulkanCommandProcessor::ReleaseBackendCheckpoints() {
+  for (auto& it : checkpoint_snapshots_) {
+    retired_checkpoint_snapshots_.push_back(std::move(it.second));
+  }
+  checkpoint_snapshots_.clear();
+  if (!frame_open_) {
+    // Otherwise freed with the next swap.
+    WaitForSwapFences(0);
+    retired_checkpoint_snapshots_.clear();
+  }
+}
+
+void VulkanCommandProcessor::EndRenderPassForTransfer() {
+  if (!frame_open_) {
+    BeginFrame();
+  } else if (current_render_state_) {
+    // Copy commands cannot be issued within a render pass.
+    render_cache_->EndRenderPass();
+    current_render_state_ = nullptr;
+  }
+}
+
+bool VulkanCommandProcessor::ExecuteDraw(PrimitiveType primitive_type,
+                                         uint32_t index_count,
+                                         IndexBufferInfo* index_buffer_info) {
   auto& regs = *register_file_;
 
 #if FINE_GRAINED_DRAW_SCOPES
   SCOPE_profile_cpu_f("gpu");
 #endif  // FINE_GRAINED_DRAW_SCOPES
 
+  // Catch up on the guest writes to textures and buffers before using them.
+  memory_->ProcessDeferredAccessWatches();
+
   auto enable_mode =
       static_cast<ModeControl>(regs[XE_GPU_REG_RB_MODECONTROL].u32 & 0x7);
   if (enable_mode == ModeControl::kIgnore) {
@@ -640,19 +1129,26 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   auto command_buffer = current_command_buffer_;
   auto setup_buffer = current_setup_buffer_;
 
+  // Take note of what the draw makes the caches do, for the draw timer.
+  uint64_t texture_uploads = 0, pipeline_misses = 0;
+  uint32_t render_pass_begins = 0;
+  if (draw_timer_) {
+    texture_uploads = texture_cache_->stats().uploads;
+    pipeline_misses = pipeline_cache_->stats().pipeline_misses;
+    render_pass_begins = render_cache_->render_pass_begin_count();
+  }
+
   // Begin the render pass.
-  // This will setup our framebuffer and begin the pass in the command buffer.
-  // This reuses a previous render pass if one is already open.
+  // This will setup our framebuffer, though the pass is only begun in the
+  // command buffer right before the draw. The previous pass stays open until
+  // then, and is resumed if the configuration comes back to it.
   if (render_cache_->dirty() || !current_render_state_) {
-    if (current_render_state_) {
-      render_cache_->EndRenderPass();
-      current_render_state_ = nullptr;
-    }
-
     full_update = true;
     current_render_state_ = render_cache_->BeginRenderPass(
-        command_buffer, vertex_shader, pixel_shader);
+        command_buffer, setup_buffer, vertex_shader, pixel_shader);
     if (!current_render_state_) {
+      // Don't leave the previous pass open in the command buffer.
+      render_cache_->EndRenderPass();
       return false;
     }
   }
@@ -666,6 +1162,9 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
       primitive_type, &pipeline);
   if (pipeline_status == PipelineCache::UpdateStatus::kError) {
     return false;
+  } else if (pipeline_status == PipelineCache::UpdateStatus::kPending) {
+    // Not ready yet; skip the draw rather than wait.
+    return true;
   } else if (pipeline_status == PipelineCache::UpdateStatus::kMismatch ||
              full_update) {
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
@@ -679,7 +1178,8 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   }
 
   // Upload and bind index buffer data (if we have any).
-  if (!PopulateIndexBuffer(command_buffer, index_buffer_info)) {
+  if (!PopulateIndexBuffer(command_buffer, primitive_type, &index_count,
+                           index_buffer_info)) {
     return false;
   }
 
@@ -697,8 +1197,28 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
   }
 
   // Actually issue the draw.
-  if (!index_buffer_info) {
+  render_cache_->StartRenderPass();
+  if (query_cache_) {
+    query_cache_->BeginDraw(command_buffer, setup_buffer,
+                            current_batch_fence_);
+  }
+  if (draw_timer_) {
+    uint32_t draw_flags = 0;
+    if (texture_cache_->stats().uploads != texture_uploads) {
+      draw_flags |= DrawTimer::kDrawTextureUpload;
+    }
+    if (pipeline_cache_->stats().pipeline_misses != pipeline_misses) {
+      draw_flags |= DrawTimer::kDrawPipelineCreation;
+    }
+    if (render_cache_->render_pass_begin_count() != render_pass_begins) {
+      draw_flags |= DrawTimer::kDrawRenderPassBreak;
+    }
+    draw_timer_->BeginDraw(command_buffer, draw_flags);
+  }
+  if (!index_buffer_info &&
+      !PipelineCache::IsQuadListExpanded(primitive_type)) {
     // Auto-indexed draw.
+    SCOPE_profile_gpu_context(gpu_draw, command_buffer);
     uint32_t instance_count = 1;
     uint32_t first_vertex =
         register_file_->values[XE_GPU_REG_VGT_INDX_OFFSET].u32;
@@ -707,6 +1227,7 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
               first_instance);
   } else {
     // Index buffer draw.
+    SCOPE_profile_gpu_context(gpu_draw, command_buffer);
     uint32_t instance_count = 1;
     uint32_t first_index = 0;
     uint32_t vertex_offset =
@@ -715,6 +1236,12 @@ bool VulkanCommandProcessor::IssueDraw(PrimitiveType primitive_type,
     vkCmdDrawIndexed(command_buffer, index_count, instance_count, first_index,
                      vertex_offset, first_instance);
   }
+  if (query_cache_) {
+    query_cache_->EndDraw(command_buffer);
+  }
+  if (draw_timer_) {
+    draw_timer_->EndDraw(command_buffer);
+  }
 
   return true;
 }
@@ -757,8 +1284,35 @@ bool VulkanCommandProcessor::PopulateConstants(VkCommandBuffer command_buffer,
 }
 
 bool VulkanCommandProcessor::PopulateIndexBuffer(
-    VkCommandBuffer command_buffer, IndexBufferInfo* index_buffer_info) {
+    VkCommandBuffer command_buffer, PrimitiveType primitive_type,
+    uint32_t* index_count, IndexBufferInfo* index_buffer_info) {
   auto& regs = *register_file_;
+  if (PipelineCache::IsQuadListExpanded(primitive_type)) {
+    // Drawn as a list of triangles or lines instead.
+    bool as_lines = PipelineCache::IsPolygonLineMode(
+        regs[XE_GPU_REG_PA_SU_SC_MODE_CNTL].u32);
+    uint32_t quad_count = *index_count / 4;
+    uint32_t source_addr = 0;
+    IndexFormat format = IndexFormat::kInt32;
+    if (index_buffer_info && index_buffer_info->guest_base) {
+      source_addr = index_buffer_info->guest_base;
+      format = index_buffer_info->format;
+      trace_writer_.WriteMemoryRead(index_buffer_info->guest_base,
+                                    index_buffer_info->length);
+    }
+    auto buffer_ref = buffer_cache_->UploadQuadListIndexBuffer(
+        current_setup_buffer_, source_addr, quad_count, format, as_lines,
+        current_batch_fence_);
+    if (buffer_ref.second == VK_WHOLE_SIZE) {
+      return false;
+    }
+    vkCmdBindIndexBuffer(command_buffer, buffer_ref.first, buffer_ref.second,
+                         format == IndexFormat::kInt32 ? VK_INDEX_TYPE_UINT32
+                                                       : VK_INDEX_TYPE_UINT16);
+    *index_count = quad_count * BufferCache::GetQuadListIndexCount(as_lines);
+    return true;
+  }
+
   if (!index_buffer_info || !index_buffer_info->guest_base) {
     // No index buffer or auto draw.
     return true;
@@ -842,6 +1396,14 @@ bool VulkanCommandProcessor::PopulateSamplers(VkCommandBuffer command_buffer,
 #endif  // FINE_GRAINED_DRAW_SCOPES
 
   std::vector<xe::gpu::Shader::TextureBinding> dummy_bindings;
+  if (texture_cache_->uses_push_descriptors()) {
+    return texture_cache_->PushTextureSet(
+        command_buffer, setup_buffer, current_batch_fence_,
+        pipeline_cache_->pipeline_layout(), 1,
+        vertex_shader->texture_bindings(),
+        pixel_shader ? pixel_shader->texture_bindings() : dummy_bindings);
+  }
+
   auto descriptor_set = texture_cache_->PrepareTextureSet(
       setup_buffer, current_batch_fence_, vertex_shader->texture_bindings(),
       pixel_shader ? pixel_shader->texture_bindings() : dummy_bindings);
@@ -1050,14 +1612,9 @@ bool VulkanCommandProcessor::IssueCopy() {
   // For debugging purposes only (trace viewer)
   last_copy_base_ = texture->texture_info.memory.base_address;
 
-  if (!frame_open_) {
-    BeginFrame();
-  } else if (current_render_state_) {
-    // Copy commands cannot be issued within a render pass.
-    render_cache_->EndRenderPass();
-    current_render_state_ = nullptr;
-  }
+  EndRenderPassForTransfer();
   auto command_buffer = current_command_buffer_;
+  SCOPE_profile_gpu_context(gpu_resolve, command_buffer);
 
   if (texture->image_layout == VK_IMAGE_LAYOUT_UNDEFINED) {
     // Transition the image to a general layout.
@@ -1247,13 +1804,64 @@ bool VulkanCommandProcessor::IssueCopy() {
           {scissor_br_x - scissor_tl_x, scissor_br_y - scissor_tl_y},
       };
 
-      blitter_->BlitTexture2D(
-          command_buffer, current_batch_fence_,
-          is_color_source ? view->image_view : view->image_view_depth, src_rect,
-          view->GetSize(), texture->format, dst_rect,
-          {copy_dest_pitch, copy_dest_height}, texture->framebuffer, viewport,
-          scissor, filter, is_color_source,
-          copy_regs->copy_dest_info.copy_dest_swap != 0);
+      // Natively multisampled color is resolved by the hardware, straight
+      // into the texture if nothing needs converting or clipping, and the
+      // blitter only handles what it can't.
+      auto blit_view = view;
+      if (view->sample_count != VK_SAMPLE_COUNT_1_BIT) {
+        bool direct_resolve =
+            is_color_source && view->format == texture->format &&
+            !copy_regs->copy_dest_info.copy_dest_swap &&
+            dst_rect.offset.x >= scissor.offset.x &&
+            dst_rect.offset.y >= scissor.offset.y &&
+            dst_rect.offset.x + dst_rect.extent.width <=
+                scissor.offset.x + scissor.extent.width &&
+            dst_rect.offset.y + dst_rect.extent.height <=
+                scissor.offset.y + scissor.extent.height &&
+            dst_rect.offset.x + dst_rect.extent.width <=
+                texture->texture_info.width + 1 &&
+            dst_rect.offset.y + dst_rect.extent.height <=
+                texture->texture_info.height + 1;
+        if (direct_resolve) {
+          VkImageMemoryBarrier resolve_barrier = image_barrier;
+          resolve_barrier.oldLayout = image_barrier.newLayout;
+          resolve_barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+          resolve_barrier.srcAccessMask = 0;
+          resolve_barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+          vkCmdPipelineBarrier(command_buffer,
+                               VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT,
+                               VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                               0, nullptr, 1, &resolve_barrier);
+          render_cache_->ResolveToImage(command_buffer, view, texture->image,
+                                        resolve_barrier.newLayout, src_rect,
+                                        dst_rect.offset);
+          // Back to where the blitter would have left it.
+          std::swap(resolve_barrier.oldLayout, resolve_barrier.newLayout);
+          resolve_barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+          resolve_barrier.dstAccessMask = image_barrier.dstAccessMask;
+          vkCmdPipelineBarrier(command_buffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                               VK_PIPELINE_STAGE_ALL_GRAPHICS_BIT, 0, 0,
+                               nullptr, 0, nullptr, 1, &resolve_barrier);
+          blit_view = nullptr;
+        } else {
+          blit_view =
+              render_cache_->ResolveTileView(command_buffer, view, src_rect);
+          if (!blit_view) {
+            XELOGGPU("Can't resolve multisampled depth");
+          }
+        }
+      }
+
+      if (blit_view) {
+        blitter_->BlitTexture2D(
+            command_buffer, current_batch_fence_,
+            is_color_source ? blit_view->image_view
+                            : blit_view->image_view_depth,
+            src_rect, blit_view->GetSize(), texture->format, dst_rect,
+            {copy_dest_pitch, copy_dest_height}, texture->framebuffer,
+            viewport, scissor, filter, is_color_source,
+            copy_regs->copy_dest_info.copy_dest_swap != 0);
+      }
 
       // Pull the tile view back to a color/depth attachment.
       std::swap(tile_image_barrier.srcAccessMask,
@@ -1286,6 +1894,12 @@ bool VulkanCommandProcessor::IssueCopy() {
                            VK_PIPELINE_STAGE_TRANSFER_BIT,
                        0, 0, nullptr, 0, nullptr, 1, &image_barrier);
 
+  // Guest memory only gets the result if the CPU turns out to need it.
+  if (FLAGS_vulkan_resolve_readback && is_color_source) {
+    texture_cache_->RequestReadback(command_buffer, current_batch_fence_,
+                                    texture);
+  }
+
   // Perform any requested clears.
   uint32_t copy_depth_clear = regs[XE_GPU_REG_RB_DEPTH_CLEAR].u32;
   uint32_t copy_color_clear = regs[XE_GPU_REG_RB_COLOR_CLEAR].u32;
@@ -12,6 +12,7 @@
 
 #include <atomic>
 #include <cstring>
+#include <deque>
 #include <functional>
 #include <memory>
 #include <mutex>
@@ -24,7 +25,10 @@
 #include "xenia/gpu/command_processor.h"
 #include "xenia/gpu/register_file.h"
 #include "xenia/gpu/vulkan/buffer_cache.h"
+#include "xenia/gpu/vulkan/draw_timer.h"
+#include "xenia/gpu/vulkan/gpu_profiler.h"
 #include "xenia/gpu/vulkan/pipeline_cache.h"
+#include "xenia/gpu/vulkan/query_cache.h"
 #include "xenia/gpu/vulkan/render_cache.h"
 #include "xenia/gpu/vulkan/texture_cache.h"
 #include "xenia/gpu/vulkan/vulkan_shader.h"
@@ -53,17 +57,27 @@ class VulkanCommandProcessor : public CommandProcessor {
   virtual void RequestFrameTrace(const std::wstring& root_path) override;
   void ClearCaches() override;
 
+  BufferCache* buffer_cache() { return buffer_cache_.get(); }
+  PipelineCache* pipeline_cache() { return pipeline_cache_.get(); }
   RenderCache* render_cache() { return render_cache_.get(); }
+  TextureCache* texture_cache() { return texture_cache_.get(); }
+  // Null unless --vulkan_draw_timing is set.
+  DrawTimer* draw_timer() { return draw_timer_.get(); }
 
  private:
   bool SetupContext() override;
   void ShutdownContext() override;
 
+  void BeginOcclusionQuery(uint32_t sample_counts_address) override;
+  void EndOcclusionQuery(uint32_t sample_counts_address) override;
+
   void MakeCoherent() override;
   void PrepareForWait() override;
   void ReturnFromWait() override;
 
   void WriteRegister(uint32_t index, uint32_t value) override;
+  void WriteRegistersFromMem(uint32_t start_index, const uint32_t* base,
+                             uint32_t num_registers) override;
 
   void BeginFrame();
   void EndFrame();
@@ -71,6 +85,13 @@ class VulkanCommandProcessor : public CommandProcessor {
   void CreateSwapImage(VkCommandBuffer setup_buffer, VkExtent2D extents);
   void DestroySwapImage();
 
+  VkResult CreateGammaRampImage();
+  void DestroyGammaRampImage();
+  // Records an upload of the gamma ramp in use, if it has changed.
+  void UpdateGammaRampImage(VkCommandBuffer command_buffer);
+
+  // Waits for the oldest swaps until at most max_count are in flight.
+  void WaitForSwapFences(uint32_t max_count);
   void PerformSwap(uint32_t frontbuffer_ptr, uint32_t frontbuffer_width,
                    uint32_t frontbuffer_height) override;
 
@@ -80,10 +101,24 @@ class VulkanCommandProcessor : public CommandProcessor {
 
   bool IssueDraw(PrimitiveType primitive_type, uint32_t index_count,
                  IndexBufferInfo* index_buffer_info) override;
+  void FlushPendingDraws() override;
+
+  bool SaveBackendCheckpoint(uint32_t checkpoint) override;
+  void RestoreBackendCheckpoint(uint32_t checkpoint) override;
+  void ReleaseBackendCheckpoints() override;
+  // Ends the render pass, if any, opening the frame if needed, for commands
+  // that can't be recorded in one.
+  void EndRenderPassForTransfer();
+
+  // Records a draw with all of its setup.
+  bool ExecuteDraw(PrimitiveType primitive_type, uint32_t index_count,
+                   IndexBufferInfo* index_buffer_info);
   bool PopulateConstants(VkCommandBuffer command_buffer,
                          VulkanShader* vertex_shader,
                          VulkanShader* pixel_shader);
+  // Also generates the indices of expanded quad lists, updating index_count.
   bool PopulateIndexBuffer(VkCommandBuffer command_buffer,
+                           PrimitiveType primitive_type, uint32_t* index_count,
                            IndexBufferInfo* index_buffer_info);
   bool PopulateVertexBuffers(VkCommandBuffer command_buffer,
                              VkCommandBuffer setup_buffer,
@@ -101,6 +136,16 @@ class VulkanCommandProcessor : public CommandProcessor {
   VkImageView fb_image_view_ = nullptr;
   VkFramebuffer fb_framebuffer_ = nullptr;
 
+  // The gamma ramp in use as a 256x1 image the swap blit samples, uploaded
+  // from gamma_ramp_buffer_ with vkCmdUpdateBuffer as it changes.
+  VkImage gamma_ramp_image_ = nullptr;
+  VkImageView gamma_ramp_image_view_ = nullptr;
+  VkDeviceMemory gamma_ramp_image_memory_ = nullptr;
+  VkBuffer gamma_ramp_buffer_ = nullptr;
+  VkDeviceMemory gamma_ramp_buffer_memory_ = nullptr;
+  bool gamma_ramp_uploaded_ = false;
+  bool gamma_ramp_pwl_uploaded_ = false;
+
   uint64_t dirty_float_constants_ = 0;  // Dirty float constants in blocks of 4
   uint8_t dirty_bool_constants_ = 0;
   uint32_t dirty_loop_constants_ = 0;
@@ -123,20 +168,45 @@ class VulkanCommandProcessor : public CommandProcessor {
   bool capturing_ = false;
   bool trace_requested_ = false;
   bool cache_clear_requested_ = false;
+  bool disk_cache_opened_ = false;
 
   std::unique_ptr<BufferCache> buffer_cache_;
+  std::unique_ptr<DrawTimer> draw_timer_;
+  // Null unless profiling is enabled and timestamps are supported.
+  std::unique_ptr<GpuProfiler> gpu_profiler_;
   std::unique_ptr<PipelineCache> pipeline_cache_;
+  // Null if occlusion queries are disabled.
+  std::unique_ptr<QueryCache> query_cache_;
   std::unique_ptr<RenderCache> render_cache_;
   std::unique_ptr<TextureCache> texture_cache_;
 
   std::unique_ptr<ui::vulkan::Blitter> blitter_;
   std::unique_ptr<ui::vulkan::CommandBufferPool> command_buffer_pool_;
 
+  // Render targets of the checkpoints, by checkpoint, and of the released
+  // ones until the frames that copy them complete.
+  std::unordered_map<uint32_t, std::unique_ptr<TileViewSnapshot>>
+      checkpoint_snapshots_;
+  std::vector<std::unique_ptr<TileViewSnapshot>> retired_checkpoint_snapshots_;
+
+  // Indexed list draw deferred to be merged with the following draws using
+  // the indices right after its own with the same state, if index_count is
+  // not 0.
+  struct PendingDraw {
+    PrimitiveType primitive_type;
+    uint32_t index_count = 0;
+    IndexBufferInfo index_buffer_info;
+  };
+  PendingDraw pending_draw_;
+
   bool frame_open_ = false;
   const RenderState* current_render_state_ = nullptr;
   VkCommandBuffer current_command_buffer_ = nullptr;
   VkCommandBuffer current_setup_buffer_ = nullptr;
   VkFence current_batch_fence_;
+  // Batches of the swaps that may still be executing, oldest first
+  // (--vulkan_max_frames_in_flight).
+  std::deque<VkFence> swap_fences_;
 };
 
 }  // namespace vulkan
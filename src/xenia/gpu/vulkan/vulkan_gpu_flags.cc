@@ -11,6 +11,70 @@
 
 DEFINE_bool(vulkan_renderdoc_capture_all, false,
             "Capture everything with RenderDoc.");
-DEFINE_bool(vulkan_native_msaa, false, "Use native MSAA");
+DEFINE_bool(vulkan_native_msaa, false,
+            "Use native MSAA: render MSAA surfaces into multisampled images "
+            "and resolve them with the hardware, instead of stretching them "
+            "to a pixel per sample.");
 DEFINE_bool(vulkan_dump_disasm, false,
             "Dump shader disassembly. NVIDIA only supported.");
+DEFINE_bool(vulkan_async_pipelines, false,
+            "Translate shaders and create pipelines on background threads. "
+            "Draws are skipped (or drawn with a similar pipeline) until "
+            "theirs is ready.");
+DEFINE_string(vulkan_pipeline_cache_path, "",
+              "Directory to keep translated shaders and pipelines in, per "
+              "title, so that they are ready before they are needed in later "
+              "runs. Empty to disable.");
+DEFINE_bool(vulkan_gpu_texture_conversion, false,
+            "Untile and convert textures with compute shaders when possible, "
+            "instead of on the CPU.");
+DEFINE_bool(vulkan_gpu_index_conversion, false,
+            "Endian swap indices, replace the primitive reset index and "
+            "expand quad lists with compute shaders, instead of on the CPU.");
+DEFINE_bool(vulkan_texture_dedup, false,
+            "Share one image between textures with identical guest data at "
+            "different addresses.");
+DEFINE_int32(vulkan_texture_budget_mb, 0,
+             "Device memory for textures, in MB, beyond which textures that "
+             "haven't been used recently are evicted. 0 for 3/4 of the "
+             "largest device local heap, -1 for no limit.");
+DEFINE_int32(vulkan_buffer_cache_frames, 0,
+             "Frames vertex or index data has to be used unchanged in to be "
+             "kept in device local memory under a write watch, instead of "
+             "being uploaded on every use. 0 to disable.");
+DEFINE_bool(vulkan_expand_quad_lists, false,
+            "Draw quad lists as triangle lists with generated indices instead "
+            "of with a geometry shader.");
+DEFINE_int32(vulkan_max_frames_in_flight, 1,
+             "Frames submitted to the GPU that may be executing while the next "
+             "one is recorded, plus one. 1 waits for each frame to complete "
+             "after submitting it.");
+DEFINE_bool(vulkan_push_descriptors, true,
+            "Push texture descriptors into the command buffer if "
+            "VK_KHR_push_descriptor is available, instead of allocating "
+            "descriptor sets.");
+DEFINE_int32(vulkan_staging_growth_blocks, 4,
+             "Additional 64 MiB blocks the texture staging buffers may chain "
+             "when full, instead of waiting for earlier uploads to complete. "
+             "They're freed again after a while without being needed.");
+DEFINE_bool(vulkan_transfer_queue_uploads, false,
+            "Upload new textures on a dedicated transfer queue if the device "
+            "has one, so that streaming them doesn't stall the frame.");
+DEFINE_bool(vulkan_resolve_readback, false,
+            "Copy resolved render targets to host memory on the GPU, and write "
+            "them to guest memory when the CPU accesses them.");
+DEFINE_bool(vulkan_import_guest_memory, true,
+            "Import guest physical memory as a buffer if "
+            "VK_EXT_external_memory_host is available, so that textures "
+            "converted on the GPU are read from it directly instead of being "
+            "copied to the staging buffer first, and likewise for indices.");
+DEFINE_bool(vulkan_occlusion_queries, true,
+            "Count the samples of EVENT_WRITE_ZPD occlusion queries with host "
+            "queries, writing the results to guest memory when they're "
+            "ready.");
+DEFINE_bool(vulkan_merge_draws, true,
+            "Merge consecutive indexed list draws with the same state whose "
+            "indices follow each other in memory into one draw.");
+DEFINE_bool(vulkan_draw_timing, false,
+            "Measure the GPU time of each draw with timestamp queries, waiting "
+            "for every frame to complete. Used by trace dump benchmarks.");
@@ -17,5 +17,22 @@
 DECLARE_bool(vulkan_renderdoc_capture_all);
 DECLARE_bool(vulkan_native_msaa);
 DECLARE_bool(vulkan_dump_disasm);
+DECLARE_bool(vulkan_async_pipelines);
+DECLARE_string(vulkan_pipeline_cache_path);
+DECLARE_bool(vulkan_gpu_texture_conversion);
+DECLARE_bool(vulkan_gpu_index_conversion);
+DECLARE_bool(vulkan_texture_dedup);
+DECLARE_int32(vulkan_texture_budget_mb);
+DECLARE_int32(vulkan_buffer_cache_frames);
+DECLARE_bool(vulkan_expand_quad_lists);
+DECLARE_int32(vulkan_max_frames_in_flight);
+DECLARE_bool(vulkan_push_descriptors);
+DECLARE_int32(vulkan_staging_growth_blocks);
+DECLARE_bool(vulkan_transfer_queue_uploads);
+DECLARE_bool(vulkan_resolve_readback);
+DECLARE_bool(vulkan_import_guest_memory);
+DECLARE_bool(vulkan_occlusion_queries);
+DECLARE_bool(vulkan_merge_draws);
+DECLARE_bool(vulkan_draw_timing);
 
 #endif  // XENIA_GPU_VULKAN_VULKAN_GPU_FLAGS_H_
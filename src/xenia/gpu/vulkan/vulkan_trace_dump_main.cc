@@ -11,6 +11,7 @@
 #include "xenia/base/main.h"
 #include "xenia/gpu/trace_dump.h"
 #include "xenia/gpu/vulkan/vulkan_command_processor.h"
+#include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 #include "xenia/gpu/vulkan/vulkan_graphics_system.h"
 
 namespace xe {
@@ -24,6 +25,47 @@ class VulkanTraceDump : public TraceDump {
   std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() override {
     return std::unique_ptr<gpu::GraphicsSystem>(new VulkanGraphicsSystem());
   }
+
+ protected:
+  void PrepareBenchmark() override { FLAGS_vulkan_draw_timing = true; }
+
+  void ResetBenchmarkStats() override {
+    auto command_processor = GetCommandProcessor();
+    command_processor->buffer_cache()->ResetStats();
+    command_processor->pipeline_cache()->ResetStats();
+    command_processor->texture_cache()->ResetStats();
+  }
+
+  bool GetDrawGpuTimes(std::vector<double>* times) override {
+    auto draw_timer = GetCommandProcessor()->draw_timer();
+    if (!draw_timer) {
+      return false;
+    }
+    *times = draw_timer->draw_times();
+    return true;
+  }
+
+  void GetCacheStats(std::vector<CacheStats>* stats) override {
+    auto command_processor = GetCommandProcessor();
+    const auto& buffer_stats = command_processor->buffer_cache()->stats();
+    stats->push_back({"buffer", buffer_stats.hits, buffer_stats.misses});
+    const auto& pipeline_stats = command_processor->pipeline_cache()->stats();
+    stats->push_back({"pipeline", pipeline_stats.pipeline_hits,
+                      pipeline_stats.pipeline_misses});
+    stats->push_back({"shader", pipeline_stats.shader_hits,
+                      pipeline_stats.shader_misses});
+    const auto& texture_stats = command_processor->texture_cache()->stats();
+    stats->push_back({"texture",
+                      texture_stats.hits + texture_stats.content_hits +
+                          texture_stats.resolve_hits,
+                      texture_stats.misses});
+  }
+
+ private:
+  VulkanCommandProcessor* GetCommandProcessor() {
+    return static_cast<VulkanCommandProcessor*>(
+        graphics_system_->command_processor());
+  }
 };
 
 int trace_dump_main(const std::vector<std::wstring>& args) {
@@ -11,6 +11,7 @@
 #include "xenia/base/main.h"
 #include "xenia/gpu/trace_viewer.h"
 #include "xenia/gpu/vulkan/vulkan_command_processor.h"
+#include "xenia/gpu/vulkan/vulkan_gpu_flags.h"
 #include "xenia/gpu/vulkan/vulkan_graphics_system.h"
 
 namespace xe {
@@ -22,6 +23,8 @@ using namespace xe::gpu::xenos;
 class VulkanTraceViewer : public TraceViewer {
  public:
   std::unique_ptr<gpu::GraphicsSystem> CreateGraphicsSystem() override {
+    // Draws are timed for the profile view.
+    FLAGS_vulkan_draw_timing = true;
     return std::unique_ptr<gpu::GraphicsSystem>(new VulkanGraphicsSystem());
   }
 
@@ -60,6 +63,40 @@ class VulkanTraceViewer : public TraceViewer {
     // return static_cast<uintptr_t>(texture->handle);
     return 0;
   }
+
+ protected:
+  bool GetDrawProfiles(std::vector<DrawProfile>* profiles) override {
+    auto draw_timer = GetCommandProcessor()->draw_timer();
+    if (!draw_timer) {
+      return false;
+    }
+    const auto& times = draw_timer->draw_times();
+    const auto& issue_ticks = draw_timer->draw_issue_ticks();
+    const auto& flags = draw_timer->draw_flags();
+    // The times are missing if reading them back failed.
+    if (times.size() != issue_ticks.size()) {
+      return false;
+    }
+    profiles->reserve(times.size());
+    for (size_t i = 0; i < times.size(); ++i) {
+      DrawProfile profile;
+      profile.issue_ticks = issue_ticks[i];
+      profile.gpu_time = times[i];
+      profile.texture_upload = (flags[i] & DrawTimer::kDrawTextureUpload) != 0;
+      profile.pipeline_creation =
+          (flags[i] & DrawTimer::kDrawPipelineCreation) != 0;
+      profile.render_pass_break =
+          (flags[i] & DrawTimer::kDrawRenderPassBreak) != 0;
+      profiles->push_back(profile);
+    }
+    return true;
+  }
+
+ private:
+  VulkanCommandProcessor* GetCommandProcessor() {
+    return static_cast<VulkanCommandProcessor*>(
+        graphics_system_->command_processor());
+  }
 };
 
 int trace_viewer_main(const std::vector<std::wstring>& args) {
@@ -621,6 +621,23 @@ XEPACKEDUNION(xe_gpu_memexport_stream_t, {
   });
 });
 
+// Sample counts written by the occlusion queries of EVENT_WRITE_ZPD to
+// RB_SAMPLE_COUNT_ADDR. Unlike most guest data these are little-endian, and
+// D3D sums the A and B counts. D3D writes kSampleCountsEndMarker (big-endian
+// 0xFFFFFEED) over the pass, or in older versions the fail, counts when it
+// ends a query, and polls them until they're replaced by the results.
+constexpr uint32_t kSampleCountsEndMarker = 0xEDFEFFFF;
+struct xe_gpu_depth_sample_counts {
+  uint32_t Total_A;
+  uint32_t Total_B;
+  uint32_t ZFail_A;
+  uint32_t ZFail_B;
+  uint32_t ZPass_A;
+  uint32_t ZPass_B;
+  uint32_t StencilFail_A;
+  uint32_t StencilFail_B;
+};
+
 // Enum of event values used for VGT_EVENT_INITIATOR
 enum Event {
   VS_DEALLOC = 0,
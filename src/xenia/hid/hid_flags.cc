@@ -8,3 +8,8 @@
  */
 
 #include "xenia/hid/hid_flags.h"
+
+DEFINE_int32(hid_poll_rate, 0,
+             "Poll controller state on a thread of its own at this rate, in "
+             "Hz, so that the guest reads the latest without waiting on "
+             "the drivers. 0 to query them on each read.");
@@ -12,4 +12,6 @@
 
 #include <gflags/gflags.h>
 
+DECLARE_int32(hid_poll_rate);
+
 #endif  // XENIA_HID_HID_FLAGS_H_
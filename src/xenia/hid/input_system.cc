@@ -9,6 +9,11 @@
 
 #include "xenia/hid/input_system.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#include "xenia/base/logging.h"
 #include "xenia/base/profiling.h"
 #include "xenia/hid/hid_flags.h"
 #include "xenia/hid/input_driver.h"
@@ -16,11 +21,60 @@
 namespace xe {
 namespace hid {
 
+namespace {
+
+// Drivers can be slow to report that nothing is connected, so users without
+// a controller are only checked again this often.
+const uint64_t kDisconnectedPollIntervalUs = 500000;
+
+uint64_t NowUs() {
+  return uint64_t(std::chrono::duration_cast<std::chrono::microseconds>(
+                      std::chrono::steady_clock::now().time_since_epoch())
+                      .count());
+}
+
+}  // namespace
+
 InputSystem::InputSystem(xe::ui::Window* window) : window_(window) {}
 
-InputSystem::~InputSystem() = default;
+InputSystem::~InputSystem() {
+  if (!poller_thread_) {
+    return;
+  }
+  poller_running_ = false;
+  xe::threading::Wait(poller_thread_.get(), false);
+  poller_thread_.reset();
 
-X_STATUS InputSystem::Setup() { return X_STATUS_SUCCESS; }
+  uint64_t reads = changed_state_reads_;
+  XELOGI(
+      "Input polling: %llu polls, avg %.1f us; %llu changes read, avg age "
+      "%.1f us, max %llu us",
+      static_cast<unsigned long long>(polls_),
+      polls_ ? double(poll_time_us_) / polls_ : 0.0,
+      static_cast<unsigned long long>(reads),
+      reads ? double(changed_state_age_us_) / reads : 0.0,
+      static_cast<unsigned long long>(max_changed_state_age_us_));
+}
+
+X_STATUS InputSystem::Setup() {
+  if (FLAGS_hid_poll_rate <= 0 || drivers_.empty()) {
+    return X_STATUS_SUCCESS;
+  }
+
+  // Poll once before the guest can read, so it never sees the initial state.
+  uint64_t now_us = NowUs();
+  for (uint32_t i = 0; i < kUserCount; ++i) {
+    X_INPUT_STATE state = {};
+    PublishState(i, GetDriverState(i, &state), state, now_us);
+  }
+
+  poller_running_ = true;
+  poller_thread_ =
+      xe::threading::Thread::Create({}, [this]() { PollerThreadMain(); });
+  poller_thread_->set_name("Input Poller");
+  poller_thread_->set_priority(xe::threading::ThreadPriority::kAboveNormal);
+  return X_STATUS_SUCCESS;
+}
 
 void InputSystem::AddDriver(std::unique_ptr<InputDriver> driver) {
   drivers_.push_back(std::move(driver));
@@ -46,6 +100,36 @@ X_RESULT InputSystem::GetCapabilities(uint32_t user_index, uint32_t flags,
 X_RESULT InputSystem::GetState(uint32_t user_index, X_INPUT_STATE* out_state) {
   SCOPE_profile_cpu_f("hid");
 
+  if (!poller_thread_ || user_index >= kUserCount) {
+    return GetDriverState(user_index, out_state);
+  }
+
+  uint64_t changed_time_us;
+  X_RESULT result = ReadPolledState(user_index, out_state, &changed_time_us);
+  if (result != X_ERROR_SUCCESS ||
+      read_changed_time_us_[user_index].exchange(changed_time_us) ==
+          changed_time_us) {
+    return result;
+  }
+
+  // First read of a new state.
+  uint64_t age_us = NowUs() - changed_time_us;
+  changed_state_reads_.fetch_add(1, std::memory_order_relaxed);
+  changed_state_age_us_.fetch_add(age_us, std::memory_order_relaxed);
+  uint64_t max_age_us = max_changed_state_age_us_;
+  while (age_us > max_age_us &&
+         !max_changed_state_age_us_.compare_exchange_weak(max_age_us, age_us)) {
+  }
+#if XE_OPTION_PROFILING
+  static const MicroProfileToken age_token =
+      MicroProfileGetCounterToken("hid/input_age_us");
+  MicroProfileCounterSet(age_token, int64_t(age_us));
+#endif  // XE_OPTION_PROFILING
+  return result;
+}
+
+X_RESULT InputSystem::GetDriverState(uint32_t user_index,
+                                     X_INPUT_STATE* out_state) {
   bool any_connected = false;
   for (auto& driver : drivers_) {
     X_RESULT result = driver->GetState(user_index, out_state);
@@ -59,6 +143,97 @@ X_RESULT InputSystem::GetState(uint32_t user_index, X_INPUT_STATE* out_state) {
   return any_connected ? X_ERROR_EMPTY : X_ERROR_DEVICE_NOT_CONNECTED;
 }
 
+void InputSystem::PollerThreadMain() {
+  auto period = std::chrono::microseconds(
+      std::max(1000000 / std::max(FLAGS_hid_poll_rate, 1), 1));
+  auto next_poll = std::chrono::steady_clock::now();
+  uint64_t next_disconnected_poll_us[kUserCount] = {};
+  while (poller_running_) {
+    uint64_t start_us = NowUs();
+    for (uint32_t i = 0; i < kUserCount; ++i) {
+      auto& polled = polled_states_[i];
+      if (polled.result.load(std::memory_order_relaxed) ==
+              X_ERROR_DEVICE_NOT_CONNECTED &&
+          start_us < next_disconnected_poll_us[i]) {
+        continue;
+      }
+      X_INPUT_STATE state = {};
+      X_RESULT result = GetDriverState(i, &state);
+      if (result == X_ERROR_DEVICE_NOT_CONNECTED) {
+        next_disconnected_poll_us[i] = start_us + kDisconnectedPollIntervalUs;
+      }
+      PublishState(i, result, state, start_us);
+    }
+    ++polls_;
+    poll_time_us_ += NowUs() - start_us;
+
+    // Late polls move the following ones rather than being caught up on.
+    next_poll += period;
+    auto now = std::chrono::steady_clock::now();
+    if (next_poll <= now) {
+      next_poll = now;
+      continue;
+    }
+    xe::threading::Sleep(
+        std::chrono::duration_cast<std::chrono::microseconds>(next_poll - now));
+  }
+}
+
+void InputSystem::PublishState(uint32_t user_index, X_RESULT result,
+                               const X_INPUT_STATE& state, uint64_t time_us) {
+  auto& polled = polled_states_[user_index];
+  uint32_t words[kStateWordCount];
+  std::memcpy(words, &state, sizeof(words));
+
+  // Only this thread writes, so its own reads need no ordering. The packet
+  // number is left out, as some drivers change it on every query.
+  bool changed = polled.result.load(std::memory_order_relaxed) != result;
+  for (size_t i = 1; i < kStateWordCount; ++i) {
+    changed |= polled.state[i].load(std::memory_order_relaxed) != words[i];
+  }
+
+  uint32_t sequence = polled.sequence.load(std::memory_order_relaxed);
+  polled.sequence.store(sequence + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  polled.result.store(result, std::memory_order_relaxed);
+  for (size_t i = 0; i < kStateWordCount; ++i) {
+    polled.state[i].store(words[i], std::memory_order_relaxed);
+  }
+  if (changed) {
+    polled.changed_time_us.store(time_us, std::memory_order_relaxed);
+  }
+  polled.sequence.store(sequence + 2, std::memory_order_release);
+}
+
+X_RESULT InputSystem::ReadPolledState(uint32_t user_index,
+                                      X_INPUT_STATE* out_state,
+                                      uint64_t* out_changed_time_us) {
+  auto& polled = polled_states_[user_index];
+  uint32_t words[kStateWordCount];
+  X_RESULT result;
+  while (true) {
+    uint32_t sequence = polled.sequence.load(std::memory_order_acquire);
+    if (sequence & 1) {
+      xe::threading::MaybeYield();
+      continue;
+    }
+    result = polled.result.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < kStateWordCount; ++i) {
+      words[i] = polled.state[i].load(std::memory_order_relaxed);
+    }
+    *out_changed_time_us =
+        polled.changed_time_us.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (polled.sequence.load(std::memory_order_relaxed) == sequence) {
+      break;
+    }
+  }
+  if (result == X_ERROR_SUCCESS) {
+    std::memcpy(out_state, words, sizeof(words));
+  }
+  return result;
+}
+
 X_RESULT InputSystem::SetState(uint32_t user_index,
                                X_INPUT_VIBRATION* vibration) {
   SCOPE_profile_cpu_f("hid");
@@ -10,9 +10,11 @@
 #ifndef XENIA_HID_INPUT_SYSTEM_H_
 #define XENIA_HID_INPUT_SYSTEM_H_
 
+#include <atomic>
 #include <memory>
 #include <vector>
 
+#include "xenia/base/threading.h"
 #include "xenia/hid/input.h"
 #include "xenia/hid/input_driver.h"
 #include "xenia/xbox.h"
@@ -45,9 +47,44 @@ class InputSystem {
                         X_INPUT_KEYSTROKE* out_keystroke);
 
  private:
+  static const uint32_t kUserCount = 4;
+  static const size_t kStateWordCount = sizeof(X_INPUT_STATE) / 4;
+
+  // The state last polled for a user, with --hid_poll_rate. Written by the
+  // poller only, and read without locking: sequence is odd while the rest is
+  // being written, and readers retry when it was or it changed meanwhile.
+  struct PolledState {
+    std::atomic<uint32_t> sequence = {0};
+    std::atomic<uint32_t> result = {X_ERROR_DEVICE_NOT_CONNECTED};
+    std::atomic<uint32_t> state[kStateWordCount] = {};
+    // When the poller first saw the current state.
+    std::atomic<uint64_t> changed_time_us = {0};
+  };
+
+  X_RESULT GetDriverState(uint32_t user_index, X_INPUT_STATE* out_state);
+  void PollerThreadMain();
+  void PublishState(uint32_t user_index, X_RESULT result,
+                    const X_INPUT_STATE& state, uint64_t time_us);
+  X_RESULT ReadPolledState(uint32_t user_index, X_INPUT_STATE* out_state,
+                           uint64_t* out_changed_time_us);
+
   xe::ui::Window* window_ = nullptr;
 
   std::vector<std::unique_ptr<InputDriver>> drivers_;
+
+  PolledState polled_states_[kUserCount];
+  std::atomic<bool> poller_running_ = {false};
+  std::unique_ptr<xe::threading::Thread> poller_thread_;
+
+  // How old changed states were when the guest first read them, and how long
+  // polls took, logged at shutdown.
+  std::atomic<uint64_t> changed_state_reads_ = {0};
+  std::atomic<uint64_t> changed_state_age_us_ = {0};
+  std::atomic<uint64_t> max_changed_state_age_us_ = {0};
+  uint64_t polls_ = 0;
+  uint64_t poll_time_us_ = 0;
+  // The change time of the state the guest last read, per user.
+  std::atomic<uint64_t> read_changed_time_us_[kUserCount] = {};
 };
 
 }  // namespace hid
@@ -0,0 +1,98 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/async_io_engine.h"
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/string.h"
+
+namespace xe {
+namespace kernel {
+
+AsyncIOEngine::AsyncIOEngine() = default;
+
+AsyncIOEngine::~AsyncIOEngine() { Shutdown(); }
+
+void AsyncIOEngine::Start(uint32_t worker_count) {
+  assert_true(workers_.empty());
+  shutting_down_ = false;
+  for (uint32_t i = 0; i < worker_count; ++i) {
+    xe::threading::Thread::CreationParameters params;
+    params.stack_size = 256 * 1024;
+    auto thread =
+        xe::threading::Thread::Create(params, [this]() { WorkerMain(); });
+    if (!thread) {
+      XELOGE("Unable to create async I/O worker %d", i);
+      break;
+    }
+    thread->set_name(xe::format_string("Async I/O Worker %d", i));
+    workers_.push_back(std::move(thread));
+  }
+  if (!workers_.empty()) {
+    XELOGI("Started %d async I/O workers", int(workers_.size()));
+  }
+}
+
+void AsyncIOEngine::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    shutting_down_ = true;
+  }
+  queue_cond_.notify_all();
+  for (auto& worker : workers_) {
+    xe::threading::Wait(worker.get(), false);
+  }
+  workers_.clear();
+}
+
+bool AsyncIOEngine::Enqueue(std::function<void()> request) {
+  if (!is_running()) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    if (shutting_down_) {
+      return false;
+    }
+    queue_.push_back(std::move(request));
+  }
+  queue_cond_.notify_one();
+  return true;
+}
+
+AsyncIOEngine::Stats AsyncIOEngine::QueryStats() {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  Stats stats;
+  stats.queue_depth = uint32_t(queue_.size());
+  stats.completed_count = completed_count_;
+  return stats;
+}
+
+void AsyncIOEngine::WorkerMain() {
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  while (true) {
+    // Requests still queued at shutdown are completed, as their guest
+    // threads may be waiting on them.
+    queue_cond_.wait(lock,
+                     [this]() { return shutting_down_ || !queue_.empty(); });
+    if (queue_.empty()) {
+      break;
+    }
+    auto request = std::move(queue_.front());
+    queue_.pop_front();
+    lock.unlock();
+    request();
+    lock.lock();
+    ++completed_count_;
+  }
+}
+
+}  // namespace kernel
+}  // namespace xe
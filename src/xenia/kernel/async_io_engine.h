@@ -0,0 +1,69 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_ASYNC_IO_ENGINE_H_
+#define XENIA_KERNEL_ASYNC_IO_ENGINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace kernel {
+
+// Runs the file I/O of asynchronous (not FILE_SYNCHRONOUS_IO) files on host
+// worker threads, so NtReadFile and NtWriteFile can return STATUS_PENDING and
+// leave the guest thread running while the VFS does the transfer. Each request
+// completes itself from the worker as the kernel would: status block, event or
+// file object, APC and I/O completion ports.
+class AsyncIOEngine {
+ public:
+  struct Stats {
+    // Requests queued but not yet picked up by a worker.
+    uint32_t queue_depth;
+    uint64_t completed_count;
+  };
+
+  AsyncIOEngine();
+  ~AsyncIOEngine();
+
+  bool is_running() const { return !workers_.empty(); }
+
+  // Starts the given number of workers. 0 leaves the engine stopped, in which
+  // case all I/O is done synchronously by the caller.
+  void Start(uint32_t worker_count);
+  // Completes everything still queued, then stops all workers.
+  void Shutdown();
+
+  // Queues a request, which does the transfer and completes it on a worker.
+  // Returns false if the engine isn't running.
+  bool Enqueue(std::function<void()> request);
+
+  Stats QueryStats();
+
+ private:
+  void WorkerMain();
+
+  std::vector<std::unique_ptr<xe::threading::Thread>> workers_;
+  std::mutex queue_mutex_;
+  std::condition_variable queue_cond_;
+  std::deque<std::function<void()>> queue_;
+  bool shutting_down_ = false;
+  uint64_t completed_count_ = 0;
+};
+
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_ASYNC_IO_ENGINE_H_
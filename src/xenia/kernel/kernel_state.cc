@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <string>
 
 #include "xenia/base/assert.h"
@@ -22,6 +23,7 @@
 #include "xenia/kernel/notify_listener.h"
 #include "xenia/kernel/user_module.h"
 #include "xenia/kernel/util/shim_utils.h"
+#include "xenia/kernel/wait_graph.h"
 #include "xenia/kernel/xam/xam_module.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_module.h"
 #include "xenia/kernel/xevent.h"
@@ -30,7 +32,24 @@
 #include "xenia/kernel/xthread.h"
 
 DEFINE_bool(headless, false,
-            "Don't display any UI, using defaults for prompts as needed.");
+            "Don't create a window or display any UI, using defaults for "
+            "prompts as needed. The guest still renders, offscreen.");
+DEFINE_int32(async_io_worker_count, 2,
+             "Host threads doing the I/O of asynchronous guest files. 0 does "
+             "all file I/O on the calling guest thread.");
+DEFINE_bool(socket_engine, true,
+            "Keep host sockets non-blocking and wait on them from one "
+            "networking thread, instead of blocking guest threads in host "
+            "socket calls.");
+DEFINE_int32(timer_wheel_tick_us, 500,
+             "Resolution of guest timers in microseconds. Expirations closer "
+             "than this fire together.");
+DEFINE_bool(wait_graph, false,
+            "Record which guest threads wait on which objects, for how long "
+            "and who signals them, shown in the debugger.");
+DEFINE_string(wait_graph_timeline, "",
+              "Chrome trace file the --wait_graph waits are written to on "
+              "exit.");
 
 namespace xe {
 namespace kernel {
@@ -59,6 +78,22 @@ KernelState::KernelState(Emulator* emulator)
   content_root = xe::to_absolute_path(content_root);
   content_manager_ = std::make_unique<xam::ContentManager>(this, content_root);
 
+  async_io_engine_ = std::make_unique<AsyncIOEngine>();
+  async_io_engine_->Start(uint32_t(std::max(FLAGS_async_io_worker_count, 0)));
+
+  socket_engine_ = std::make_unique<SocketEngine>();
+  if (FLAGS_socket_engine) {
+    socket_engine_->Start();
+  }
+
+  timer_wheel_ = std::make_unique<TimerWheel>(
+      std::chrono::microseconds(std::max(FLAGS_timer_wheel_tick_us, 1)));
+  timer_wheel_->Start();
+
+  if (FLAGS_wait_graph) {
+    wait_graph_ = std::make_unique<WaitGraph>(this);
+  }
+
   assert_null(shared_kernel_state_);
   shared_kernel_state_ = this;
 
@@ -66,9 +101,23 @@ KernelState::KernelState(Emulator* emulator)
   tls_bitmap_.Resize(2048);
 
   xam::AppManager::RegisterApps(this, app_manager_.get());
+  Metrics::AddCollector(CollectMetricsThunk, this);
 }
 
 KernelState::~KernelState() {
+  Metrics::RemoveCollector(CollectMetricsThunk, this);
+
+  // Pending requests reference files and guest memory.
+  async_io_engine_->Shutdown();
+  // Overlapped socket requests write guest memory too.
+  socket_engine_->Shutdown();
+  // Timers stay scheduled until their objects are deleted, but don't fire.
+  timer_wheel_->Shutdown();
+
+  if (wait_graph_ && !FLAGS_wait_graph_timeline.empty()) {
+    wait_graph_->WriteTimeline(xe::to_wstring(FLAGS_wait_graph_timeline));
+  }
+
   SetExecutableModule(nullptr);
 
   if (dispatch_thread_running_) {
@@ -93,6 +142,24 @@ KernelState::~KernelState() {
 
 KernelState* KernelState::shared() { return shared_kernel_state_; }
 
+void KernelState::CollectMetricsThunk(MetricsWriter* writer, void* data) {
+  auto kernel_state = reinterpret_cast<KernelState*>(data);
+  auto io_stats = kernel_state->async_io_engine_->QueryStats();
+  writer->Gauge("xenia_async_io_queue_depth",
+                "Asynchronous guest file requests waiting for a worker.",
+                io_stats.queue_depth);
+  writer->Counter("xenia_async_io_completed_total",
+                  "Asynchronous guest file requests completed.",
+                  double(io_stats.completed_count));
+  size_t thread_count;
+  {
+    auto threads_lock = kernel_state->threads_lock_.Acquire();
+    thread_count = kernel_state->threads_by_id_.size();
+  }
+  writer->Gauge("xenia_threads", "Live guest and host XThreads.",
+                double(thread_count));
+}
+
 uint32_t KernelState::title_id() const {
   assert_not_null(executable_module_);
 
@@ -146,7 +213,7 @@ void KernelState::RegisterModule(XModule* module) {}
 void KernelState::UnregisterModule(XModule* module) {}
 
 bool KernelState::RegisterUserModule(object_ref<UserModule> module) {
-  auto lock = global_critical_region_.Acquire();
+  auto modules_lock = modules_lock_.Acquire();
 
   for (auto user_module : user_modules_) {
     if (user_module->path() == module->path()) {
@@ -160,10 +227,13 @@ bool KernelState::RegisterUserModule(object_ref<UserModule> module) {
 }
 
 void KernelState::UnregisterUserModule(UserModule* module) {
-  auto lock = global_critical_region_.Acquire();
+  // Released after the lock, as it may be the last reference.
+  object_ref<UserModule> removed_module;
+  auto modules_lock = modules_lock_.Acquire();
 
   for (auto it = user_modules_.begin(); it != user_modules_.end(); it++) {
     if ((*it)->path() == module->path()) {
+      removed_module = std::move(*it);
       user_modules_.erase(it);
       return;
     }
@@ -206,7 +276,15 @@ object_ref<XModule> KernelState::GetModule(const char* name, bool user_only) {
     return nullptr;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
+  std::string path(name);
+
+  // Resolve the path to an absolute path.
+  auto entry = file_system_->ResolvePath(name);
+  if (entry) {
+    path = entry->absolute_path();
+  }
+
+  auto modules_lock = modules_lock_.Acquire();
 
   if (!user_only) {
     for (auto kernel_module : kernel_modules_) {
@@ -216,14 +294,6 @@ object_ref<XModule> KernelState::GetModule(const char* name, bool user_only) {
     }
   }
 
-  std::string path(name);
-
-  // Resolve the path to an absolute path.
-  auto entry = file_system_->ResolvePath(name);
-  if (entry) {
-    path = entry->absolute_path();
-  }
-
   for (auto user_module : user_modules_) {
     if (user_module->Matches(path)) {
       return retain_object(user_module.get());
@@ -351,7 +421,7 @@ void KernelState::SetExecutableModule(object_ref<UserModule> module) {
 }
 
 void KernelState::LoadKernelModule(object_ref<KernelModule> kernel_module) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto modules_lock = modules_lock_.Acquire();
   kernel_modules_.push_back(std::move(kernel_module));
 }
 
@@ -367,7 +437,7 @@ object_ref<UserModule> KernelState::LoadUserModule(const char* raw_name,
 
   object_ref<UserModule> module;
   {
-    auto global_lock = global_critical_region_.Acquire();
+    auto modules_lock = modules_lock_.Acquire();
 
     // See if we've already loaded it
     for (auto& existing_module : user_modules_) {
@@ -377,7 +447,7 @@ object_ref<UserModule> KernelState::LoadUserModule(const char* raw_name,
       }
     }
 
-    global_lock.unlock();
+    modules_lock.unlock();
 
     // Module wasn't loaded, so load it.
     module = object_ref<UserModule>(new UserModule(this));
@@ -387,7 +457,7 @@ object_ref<UserModule> KernelState::LoadUserModule(const char* raw_name,
       return nullptr;
     }
 
-    global_lock.lock();
+    modules_lock.lock();
 
     // Retain when putting into the listing.
     module->Retain();
@@ -430,40 +500,50 @@ void KernelState::TerminateTitle() {
   terminate_notifications_.clear();
   */
 
-  // Kill all guest threads.
-  for (auto it = threads_by_id_.begin(); it != threads_by_id_.end();) {
-    if (!XThread::IsInThread(it->second) && it->second->is_guest_thread()) {
-      auto thread = it->second;
-
-      if (thread->is_running()) {
-        // Need to step the thread to a safe point (returns it to guest code
-        // so it's guaranteed to not be holding any locks / in host kernel
-        // code / etc). Can't do that properly if we have the lock.
-        if (!emulator_->is_paused()) {
-          thread->thread()->Suspend();
-        }
-
-        global_lock.unlock();
-        processor_->StepToGuestSafePoint(thread->thread_id());
-        thread->Terminate(0);
-        global_lock.lock();
+  // Kill all guest threads. The thread list lock can't be held while
+  // suspending them, as they may be waiting for it.
+  std::vector<object_ref<XThread>> guest_threads;
+  {
+    auto threads_lock = threads_lock_.Acquire();
+    for (auto& it : threads_by_id_) {
+      if (!XThread::IsInThread(it.second) && it.second->is_guest_thread()) {
+        guest_threads.push_back(retain_object(it.second));
+      }
+    }
+  }
+  for (auto& thread : guest_threads) {
+    if (thread->is_running()) {
+      // Need to step the thread to a safe point (returns it to guest code
+      // so it's guaranteed to not be holding any locks / in host kernel
+      // code / etc). Can't do that properly if we have the lock.
+      if (!emulator_->is_paused()) {
+        thread->thread()->Suspend();
       }
 
-      // Erase it from the thread list.
-      it = threads_by_id_.erase(it);
-    } else {
-      ++it;
+      global_lock.unlock();
+      processor_->StepToGuestSafePoint(thread->thread_id());
+      thread->Terminate(0);
+      global_lock.lock();
     }
+
+    // Erase it from the thread list.
+    UnregisterThread(thread.get());
   }
+  guest_threads.clear();
 
   // Third: Unload all user modules (including the executable).
-  for (size_t i = 0; i < user_modules_.size(); i++) {
-    X_STATUS status = user_modules_[i]->Unload();
+  std::vector<object_ref<UserModule>> user_modules;
+  {
+    auto modules_lock = modules_lock_.Acquire();
+    user_modules.swap(user_modules_);
+  }
+  for (auto& user_module : user_modules) {
+    X_STATUS status = user_module->Unload();
     assert_true(XSUCCEEDED(status));
 
-    object_table_.RemoveHandle(user_modules_[i]->handle());
+    object_table_.RemoveHandle(user_module->handle());
   }
-  user_modules_.clear();
+  user_modules.clear();
 
   // Release all objects in the object table.
   object_table_.PurgeAllObjects();
@@ -483,7 +563,7 @@ void KernelState::TerminateTitle() {
   }
 
   if (XThread::IsInThread()) {
-    threads_by_id_.erase(XThread::GetCurrentThread()->thread_id());
+    UnregisterThread(XThread::GetCurrentThread());
 
     // Now commit suicide (using Terminate, because we can't call into guest
     // code anymore).
@@ -493,7 +573,7 @@ void KernelState::TerminateTitle() {
 }
 
 void KernelState::RegisterThread(XThread* thread) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto threads_lock = threads_lock_.Acquire();
   threads_by_id_[thread->thread_id()] = thread;
 
   /*
@@ -504,7 +584,7 @@ void KernelState::RegisterThread(XThread* thread) {
 }
 
 void KernelState::UnregisterThread(XThread* thread) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto threads_lock = threads_lock_.Acquire();
   auto it = threads_by_id_.find(thread->thread_id());
   if (it != threads_by_id_.end()) {
     threads_by_id_.erase(it);
@@ -518,15 +598,20 @@ void KernelState::UnregisterThread(XThread* thread) {
 }
 
 void KernelState::OnThreadExecute(XThread* thread) {
-  auto global_lock = global_critical_region_.Acquire();
-
   // Must be called on executing thread.
   assert_true(XThread::GetCurrentThread() == thread);
 
+  // The modules are called without the lock held.
+  std::vector<object_ref<UserModule>> user_modules;
+  {
+    auto modules_lock = modules_lock_.Acquire();
+    user_modules = user_modules_;
+  }
+
   // Call DllMain(DLL_THREAD_ATTACH) for each user module:
   // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682583%28v=vs.85%29.aspx
   auto thread_state = thread->thread_state();
-  for (auto user_module : user_modules_) {
+  for (auto& user_module : user_modules) {
     if (user_module->is_dll_module() && user_module->entry_point()) {
       uint64_t args[] = {
           user_module->handle(),
@@ -540,15 +625,20 @@ void KernelState::OnThreadExecute(XThread* thread) {
 }
 
 void KernelState::OnThreadExit(XThread* thread) {
-  auto global_lock = global_critical_region_.Acquire();
-
   // Must be called on executing thread.
   assert_true(XThread::GetCurrentThread() == thread);
 
+  // The modules are called without the lock held.
+  std::vector<object_ref<UserModule>> user_modules;
+  {
+    auto modules_lock = modules_lock_.Acquire();
+    user_modules = user_modules_;
+  }
+
   // Call DllMain(DLL_THREAD_DETACH) for each user module:
   // https://msdn.microsoft.com/en-us/library/windows/desktop/ms682583%28v=vs.85%29.aspx
   auto thread_state = thread->thread_state();
-  for (auto user_module : user_modules_) {
+  for (auto& user_module : user_modules) {
     if (user_module->is_dll_module() && user_module->entry_point()) {
       uint64_t args[] = {
           user_module->handle(),
@@ -564,7 +654,7 @@ void KernelState::OnThreadExit(XThread* thread) {
 }
 
 object_ref<XThread> KernelState::GetThreadByID(uint32_t thread_id) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto threads_lock = threads_lock_.Acquire();
   XThread* thread = nullptr;
   auto it = threads_by_id_.find(thread_id);
   if (it != threads_by_id_.end()) {
@@ -676,15 +766,22 @@ void KernelState::CompleteOverlappedDeferredEx(
   auto ptr = memory()->TranslateVirtual(overlapped_ptr);
   XOverlappedSetResult(ptr, X_ERROR_IO_PENDING);
   XOverlappedSetContext(ptr, XThread::GetCurrentThreadHandle());
-  auto global_lock = global_critical_region_.Acquire();
-  dispatch_queue_.push_back([this, completion_callback, overlapped_ptr, result,
-                             extended_error, length]() {
-    xe::threading::Sleep(
-        std::chrono::milliseconds(kDeferredOverlappedDelayMillis));
-    completion_callback();
-    CompleteOverlappedEx(overlapped_ptr, result, extended_error, length);
-  });
-  dispatch_cond_.notify_all();
+  // Delayed on the timer wheel rather than the dispatch thread, so the
+  // completions queued meanwhile aren't held up behind it.
+  timer_wheel_->Schedule(
+      TimerWheel::clock::now() +
+          std::chrono::milliseconds(kDeferredOverlappedDelayMillis),
+      std::chrono::microseconds(0),
+      [this, completion_callback, overlapped_ptr, result, extended_error,
+       length]() {
+        auto global_lock = global_critical_region_.Acquire();
+        dispatch_queue_.push_back([this, completion_callback, overlapped_ptr,
+                                   result, extended_error, length]() {
+          completion_callback();
+          CompleteOverlappedEx(overlapped_ptr, result, extended_error, length);
+        });
+        dispatch_cond_.notify_all();
+      });
 }
 
 bool KernelState::Save(ByteStream* stream) {
@@ -697,9 +794,7 @@ bool KernelState::Save(ByteStream* stream) {
   // Write the TLS allocation bitmap
   auto tls_bitmap = tls_bitmap_.data();
   stream->Write(uint32_t(tls_bitmap.size()));
-  for (size_t i = 0; i < tls_bitmap.size(); i++) {
-    stream->Write<uint64_t>(tls_bitmap[i]);
-  }
+  stream->WriteArray(tls_bitmap.data(), tls_bitmap.size());
 
   // We save XThreads absolutely first, as they will execute code upon save
   // (which could modify the kernel state)
@@ -770,9 +865,7 @@ bool KernelState::Restore(ByteStream* stream) {
   auto num_bitmap_entries = stream->Read<uint32_t>();
   auto& tls_bitmap = tls_bitmap_.data();
   tls_bitmap.resize(num_bitmap_entries);
-  for (uint32_t i = 0; i < num_bitmap_entries; i++) {
-    tls_bitmap[i] = stream->Read<uint64_t>();
-  }
+  stream->ReadArray(tls_bitmap.data(), num_bitmap_entries);
 
   uint32_t num_threads = stream->Read<uint32_t>();
   XELOGD("Loading %d threads...", num_threads);
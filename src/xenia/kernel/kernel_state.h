@@ -21,7 +21,10 @@
 
 #include "xenia/base/bit_map.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/timer_wheel.h"
 #include "xenia/cpu/export_resolver.h"
+#include "xenia/kernel/async_io_engine.h"
+#include "xenia/kernel/socket_engine.h"
 #include "xenia/kernel/util/native_list.h"
 #include "xenia/kernel/util/object_table.h"
 #include "xenia/kernel/xam/app_manager.h"
@@ -51,6 +54,7 @@ class XModule;
 class NotifyListener;
 class XThread;
 class UserModule;
+class WaitGraph;
 
 // (?), used by KeGetCurrentProcessType
 constexpr uint32_t X_PROCTYPE_IDLE = 0;
@@ -106,6 +110,12 @@ class KernelState {
     return content_manager_.get();
   }
   xam::UserProfile* user_profile() const { return user_profile_.get(); }
+  AsyncIOEngine* async_io_engine() const { return async_io_engine_.get(); }
+  SocketEngine* socket_engine() const { return socket_engine_.get(); }
+  // Drives the guest timers and deferred completions.
+  TimerWheel* timer_wheel() const { return timer_wheel_.get(); }
+  // Only created with --wait_graph.
+  WaitGraph* wait_graph() const { return wait_graph_.get(); }
 
   // Access must be guarded by the global critical region.
   util::ObjectTable* object_table() { return &object_table_; }
@@ -181,6 +191,7 @@ class KernelState {
 
  private:
   void LoadKernelModule(object_ref<KernelModule> kernel_module);
+  static void CollectMetricsThunk(MetricsWriter* writer, void* data);
 
   Emulator* emulator_;
   Memory* memory_;
@@ -190,17 +201,24 @@ class KernelState {
   std::unique_ptr<xam::AppManager> app_manager_;
   std::unique_ptr<xam::ContentManager> content_manager_;
   std::unique_ptr<xam::UserProfile> user_profile_;
+  std::unique_ptr<AsyncIOEngine> async_io_engine_;
+  std::unique_ptr<SocketEngine> socket_engine_;
+  std::unique_ptr<TimerWheel> timer_wheel_;
+  std::unique_ptr<WaitGraph> wait_graph_;
 
   xe::global_critical_region global_critical_region_;
 
-  // Must be guarded by the global critical region.
+  // Guarded by its own lock.
   util::ObjectTable object_table_;
+  xe::subsystem_mutex threads_lock_{"kernel/threads"};
   std::unordered_map<uint32_t, XThread*> threads_by_id_;
+  // Must be guarded by the global critical region.
   std::vector<object_ref<NotifyListener>> notify_listeners_;
   bool has_notified_startup_ = false;
 
   uint32_t process_type_ = X_PROCTYPE_USER;
   object_ref<UserModule> executable_module_;
+  xe::subsystem_mutex modules_lock_{"kernel/modules"};
   std::vector<object_ref<KernelModule>> kernel_modules_;
   std::vector<object_ref<UserModule>> user_modules_;
   std::vector<TerminateNotification> terminate_notifications_;
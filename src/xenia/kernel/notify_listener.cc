@@ -35,7 +35,7 @@ void NotifyListener::EnqueueNotification(XNotificationID id, uint32_t data) {
     return;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto lock = lock_.Acquire();
   if (notifications_.count(id)) {
     // Already exists. Overwrite.
     notifications_[id] = data;
@@ -49,7 +49,10 @@ void NotifyListener::EnqueueNotification(XNotificationID id, uint32_t data) {
 
 bool NotifyListener::DequeueNotification(XNotificationID* out_id,
                                          uint32_t* out_data) {
-  auto global_lock = global_critical_region_.Acquire();
+  if (!notification_count_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  auto lock = lock_.Acquire();
   bool dequeued = false;
   if (notification_count_) {
     dequeued = true;
@@ -67,7 +70,10 @@ bool NotifyListener::DequeueNotification(XNotificationID* out_id,
 
 bool NotifyListener::DequeueNotification(XNotificationID id,
                                          uint32_t* out_data) {
-  auto global_lock = global_critical_region_.Acquire();
+  if (!notification_count_.load(std::memory_order_acquire)) {
+    return false;
+  }
+  auto lock = lock_.Acquire();
   bool dequeued = false;
   if (notification_count_) {
     auto it = notifications_.find(id);
@@ -87,8 +93,9 @@ bool NotifyListener::DequeueNotification(XNotificationID id,
 bool NotifyListener::Save(ByteStream* stream) {
   SaveObject(stream);
 
+  auto lock = lock_.Acquire();
   stream->Write(mask_);
-  stream->Write(notification_count_);
+  stream->Write(notification_count_.load());
   if (notification_count_) {
     for (auto pair : notifications_) {
       stream->Write<uint32_t>(pair.first);
@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_NOTIFY_LISTENER_H_
 #define XENIA_KERNEL_NOTIFY_LISTENER_H_
 
+#include <atomic>
 #include <memory>
 #include <unordered_map>
 
@@ -47,9 +48,12 @@ class NotifyListener : public XObject {
 
  private:
   std::unique_ptr<xe::threading::Event> wait_handle_;
-  xe::global_critical_region global_critical_region_;
+  xe::subsystem_mutex lock_{"kernel/notify_listener"};
+  // Guarded by lock_.
   std::unordered_map<XNotificationID, uint32_t> notifications_;
-  size_t notification_count_ = 0;
+  // Written under lock_, read without it so that polling with nothing queued
+  // (what titles do every frame) is a single load.
+  std::atomic<size_t> notification_count_ = {0};
   uint64_t mask_ = 0;
 };
 
@@ -0,0 +1,450 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/socket_engine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+
+#include "xenia/base/assert.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/platform.h"
+
+#ifdef XE_PLATFORM_WIN32
+// clang-format off
+#include "xenia/base/platform_win.h"
+#include <WS2tcpip.h>
+#include <WinSock2.h>
+// clang-format on
+#else
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace xe {
+namespace kernel {
+
+namespace {
+
+#ifdef XE_PLATFORM_WIN32
+// WSAPoll rejects POLLPRI.
+const short kPollException = POLLRDBAND;
+#else
+const short kPollException = POLLPRI;
+#endif
+
+short ToPollEvents(uint32_t events) {
+  short poll_events = 0;
+  if (events & SocketEngine::kReadable) {
+    poll_events |= POLLIN;
+  }
+  if (events & SocketEngine::kWritable) {
+    poll_events |= POLLOUT;
+  }
+  if (events & SocketEngine::kException) {
+    poll_events |= kPollException;
+  }
+  return poll_events;
+}
+
+// Errors and hangups count as ready like they do for select, so the caller's
+// next call fails instead of waiting forever.
+uint32_t FromPollEvents(short poll_events, uint32_t events) {
+  uint32_t ready_events = 0;
+  if (poll_events & (POLLIN | POLLHUP | POLLERR)) {
+    ready_events |= SocketEngine::kReadable;
+  }
+  if (poll_events & (POLLOUT | POLLHUP | POLLERR)) {
+    ready_events |= SocketEngine::kWritable;
+  }
+  if (poll_events & (kPollException | POLLERR)) {
+    ready_events |= SocketEngine::kException;
+  }
+  return ready_events & events;
+}
+
+}  // namespace
+
+SocketEngine::SocketEngine() = default;
+
+SocketEngine::~SocketEngine() { Shutdown(); }
+
+bool SocketEngine::Start() {
+  assert_null(thread_);
+  shutting_down_ = false;
+#ifdef XE_PLATFORM_WIN32
+  WSADATA wsa_data;
+  if (WSAStartup(MAKEWORD(2, 2), &wsa_data)) {
+    XELOGE("Unable to start Winsock for the socket engine");
+    return false;
+  }
+  // A datagram socket connected to itself: sending to it ends the poll.
+  SOCKET wake_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int address_len = sizeof(address);
+  u_long non_blocking = 1;
+  if (wake_socket == INVALID_SOCKET ||
+      bind(wake_socket, reinterpret_cast<sockaddr*>(&address),
+           sizeof(address)) ||
+      getsockname(wake_socket, reinterpret_cast<sockaddr*>(&address),
+                  &address_len) ||
+      connect(wake_socket, reinterpret_cast<sockaddr*>(&address),
+              sizeof(address)) ||
+      ioctlsocket(wake_socket, FIONBIO, &non_blocking)) {
+    XELOGE("Unable to create the socket engine wake socket");
+    if (wake_socket != INVALID_SOCKET) {
+      closesocket(wake_socket);
+    }
+    WSACleanup();
+    return false;
+  }
+  wake_handle_ = uint64_t(wake_socket);
+#else
+  int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  int wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.u64 = uint64_t(wake_fd);
+  if (epoll_fd == -1 || wake_fd == -1 ||
+      epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event)) {
+    XELOGE("Unable to create the socket engine epoll");
+    if (epoll_fd != -1) {
+      close(epoll_fd);
+    }
+    if (wake_fd != -1) {
+      close(wake_fd);
+    }
+    return false;
+  }
+  poll_handle_ = uint64_t(epoll_fd);
+  wake_handle_ = uint64_t(wake_fd);
+#endif
+
+  xe::threading::Thread::CreationParameters params;
+  params.stack_size = 256 * 1024;
+  thread_ = xe::threading::Thread::Create(params, [this]() { ThreadMain(); });
+  if (!thread_) {
+    XELOGE("Unable to create the socket engine thread");
+    Shutdown();
+    return false;
+  }
+  thread_->set_name("Socket Engine");
+  return true;
+}
+
+void SocketEngine::Shutdown() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+  }
+  cond_.notify_all();
+  if (thread_) {
+    Wake();
+    xe::threading::Wait(thread_.get(), false);
+    thread_.reset();
+  }
+
+  std::unordered_map<uint64_t, Socket> sockets;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    sockets.swap(sockets_);
+  }
+  for (auto& it : sockets) {
+    for (auto& request : it.second.requests) {
+      request.second(true);
+    }
+  }
+
+#ifdef XE_PLATFORM_WIN32
+  if (wake_handle_ != uint64_t(-1)) {
+    closesocket(SOCKET(wake_handle_));
+    WSACleanup();
+  }
+#else
+  if (poll_handle_ != uint64_t(-1)) {
+    close(int(poll_handle_));
+  }
+  if (wake_handle_ != uint64_t(-1)) {
+    close(int(wake_handle_));
+  }
+#endif
+  poll_handle_ = uint64_t(-1);
+  wake_handle_ = uint64_t(-1);
+}
+
+void SocketEngine::Register(uint64_t native_handle) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!is_running() || shutting_down_) {
+    return;
+  }
+  sockets_[native_handle] = Socket();
+#ifndef XE_PLATFORM_WIN32
+  // Added disarmed; one-shot, so a report disarms it again until the next
+  // waiter, and sockets nobody waits on never wake the thread.
+  epoll_event event = {};
+  event.events = EPOLLONESHOT;
+  event.data.u64 = native_handle;
+  epoll_ctl(int(poll_handle_), EPOLL_CTL_ADD, int(native_handle), &event);
+#endif
+}
+
+void SocketEngine::Unregister(uint64_t native_handle) {
+  std::vector<std::pair<uint32_t, Request>> requests;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sockets_.find(native_handle);
+    if (it == sockets_.end()) {
+      return;
+    }
+    requests.swap(it->second.requests);
+    sockets_.erase(it);
+#ifndef XE_PLATFORM_WIN32
+    epoll_ctl(int(poll_handle_), EPOLL_CTL_DEL, int(native_handle), nullptr);
+#endif
+    // Waiters retry and find the socket gone.
+    ++generation_;
+  }
+  cond_.notify_all();
+  for (auto& request : requests) {
+    request.second(true);
+  }
+}
+
+uint64_t SocketEngine::generation() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return generation_;
+}
+
+void SocketEngine::Arm(uint64_t native_handle, uint32_t events) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = sockets_.find(native_handle);
+  if (it == sockets_.end()) {
+    return;
+  }
+  it->second.armed_events |= events;
+  UpdateArmedLocked(native_handle, it->second);
+}
+
+bool SocketEngine::WaitForEvents(uint64_t generation, uint32_t timeout_ms) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  auto changed = [this, generation]() {
+    return generation_ != generation || shutting_down_;
+  };
+  if (timeout_ms == kInfinite) {
+    cond_.wait(lock, changed);
+  } else {
+    cond_.wait_for(lock, std::chrono::milliseconds(timeout_ms), changed);
+  }
+  return generation_ != generation && !shutting_down_;
+}
+
+bool SocketEngine::QueueRequest(uint64_t native_handle, uint32_t events,
+                                Request request) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!is_running() || shutting_down_) {
+    return false;
+  }
+  auto it = sockets_.find(native_handle);
+  if (it == sockets_.end()) {
+    return false;
+  }
+  it->second.requests.emplace_back(events, std::move(request));
+  UpdateArmedLocked(native_handle, it->second);
+  return true;
+}
+
+int SocketEngine::Poll(PollEntry* entries, size_t count, uint32_t timeout_ms) {
+  int timeout = timeout_ms == kInfinite
+                    ? -1
+                    : int(std::min(timeout_ms, uint32_t(INT_MAX)));
+  if (!count) {
+    // Like select with empty sets, which titles use to sleep.
+    if (timeout > 0) {
+      xe::threading::Sleep(std::chrono::milliseconds(timeout));
+    }
+    return 0;
+  }
+  std::vector<pollfd> poll_fds(count);
+  for (size_t i = 0; i < count; ++i) {
+    poll_fds[i].fd = decltype(poll_fds[i].fd)(entries[i].native_handle);
+    poll_fds[i].events = ToPollEvents(entries[i].events);
+    poll_fds[i].revents = 0;
+  }
+#ifdef XE_PLATFORM_WIN32
+  int ret = WSAPoll(poll_fds.data(), ULONG(count), timeout);
+#else
+  int ret = poll(poll_fds.data(), nfds_t(count), timeout);
+#endif
+  if (ret < 0) {
+    return -1;
+  }
+  int ready_count = 0;
+  for (size_t i = 0; i < count; ++i) {
+    entries[i].ready_events =
+        FromPollEvents(poll_fds[i].revents, entries[i].events);
+    if (entries[i].ready_events) {
+      ++ready_count;
+    }
+  }
+  return ready_count;
+}
+
+void SocketEngine::ThreadMain() {
+#ifdef XE_PLATFORM_WIN32
+  std::vector<pollfd> poll_fds;
+  std::vector<uint64_t> handles;
+  while (true) {
+    poll_fds.clear();
+    handles.clear();
+    poll_fds.push_back({SOCKET(wake_handle_), POLLIN, 0});
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (shutting_down_) {
+        break;
+      }
+      for (auto& it : sockets_) {
+        if (it.second.armed_events) {
+          poll_fds.push_back(
+              {SOCKET(it.first), ToPollEvents(it.second.armed_events), 0});
+          handles.push_back(it.first);
+        }
+      }
+    }
+    if (WSAPoll(poll_fds.data(), ULONG(poll_fds.size()), -1) < 0) {
+      XELOGE("Socket engine poll failed: %d", WSAGetLastError());
+      break;
+    }
+    if (poll_fds[0].revents) {
+      char buffer[16];
+      while (recv(SOCKET(wake_handle_), buffer, sizeof(buffer), 0) > 0) {
+      }
+    }
+    for (size_t i = 1; i < poll_fds.size(); ++i) {
+      if (poll_fds[i].revents) {
+        OnReady(handles[i - 1]);
+      }
+    }
+  }
+#else
+  epoll_event events[64];
+  while (true) {
+    int count = epoll_wait(int(poll_handle_), events, int(xe::countof(events)),
+                           -1);
+    if (count < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      XELOGE("Socket engine epoll failed: %d", errno);
+      break;
+    }
+    for (int i = 0; i < count; ++i) {
+      if (events[i].data.u64 == wake_handle_) {
+        uint64_t value;
+        read(int(wake_handle_), &value, sizeof(value));
+      } else {
+        OnReady(events[i].data.u64);
+      }
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (shutting_down_) {
+      break;
+    }
+  }
+#endif
+}
+
+void SocketEngine::OnReady(uint64_t native_handle) {
+  std::vector<std::pair<uint32_t, Request>> requests;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sockets_.find(native_handle);
+    if (it == sockets_.end()) {
+      return;
+    }
+    it->second.armed_events = 0;
+    requests.swap(it->second.requests);
+    ++generation_;
+  }
+  cond_.notify_all();
+  if (requests.empty()) {
+    return;
+  }
+
+  std::vector<std::pair<uint32_t, Request>> pending;
+  for (auto& request : requests) {
+    if (!request.second(false)) {
+      pending.push_back(std::move(request));
+    }
+  }
+  if (pending.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = sockets_.find(native_handle);
+    if (it != sockets_.end() && !shutting_down_) {
+      // Ahead of anything queued meanwhile, to keep the guest's order.
+      auto& socket_requests = it->second.requests;
+      socket_requests.insert(socket_requests.begin(),
+                             std::make_move_iterator(pending.begin()),
+                             std::make_move_iterator(pending.end()));
+      UpdateArmedLocked(native_handle, it->second);
+      pending.clear();
+    }
+  }
+  // Closed while the requests ran.
+  for (auto& request : pending) {
+    request.second(true);
+  }
+}
+
+void SocketEngine::UpdateArmedLocked(uint64_t native_handle, Socket& socket) {
+  uint32_t events = socket.armed_events;
+  for (auto& request : socket.requests) {
+    events |= request.first;
+  }
+#ifdef XE_PLATFORM_WIN32
+  socket.armed_events = events;
+  Wake();
+#else
+  epoll_event event = {};
+  event.events = EPOLLONESHOT;
+  if (events & kReadable) {
+    event.events |= EPOLLIN | EPOLLRDHUP;
+  }
+  if (events & kWritable) {
+    event.events |= EPOLLOUT;
+  }
+  if (events & kException) {
+    event.events |= EPOLLPRI;
+  }
+  event.data.u64 = native_handle;
+  epoll_ctl(int(poll_handle_), EPOLL_CTL_MOD, int(native_handle), &event);
+  socket.armed_events = events;
+#endif
+}
+
+void SocketEngine::Wake() {
+#ifdef XE_PLATFORM_WIN32
+  char value = 0;
+  send(SOCKET(wake_handle_), &value, 1, 0);
+#else
+  uint64_t value = 1;
+  write(int(wake_handle_), &value, sizeof(value));
+#endif
+}
+
+}  // namespace kernel
+}  // namespace xe
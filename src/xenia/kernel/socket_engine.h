@@ -0,0 +1,112 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_SOCKET_ENGINE_H_
+#define XENIA_KERNEL_SOCKET_ENGINE_H_
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace kernel {
+
+// Watches the host sockets of guest XSockets from one networking thread. The
+// host sockets are kept non-blocking: guest calls that would block arm a
+// one-shot wait here and sleep until the host reports the socket ready, and
+// overlapped requests are retried here until they complete, so no guest or
+// host thread ever sits in the host kernel on a socket.
+class SocketEngine {
+ public:
+  enum Events : uint32_t {
+    kReadable = 1 << 0,
+    kWritable = 1 << 1,
+    kException = 1 << 2,
+  };
+  static const uint32_t kInfinite = ~0u;
+
+  // Tries an overlapped transfer without blocking and completes it, returning
+  // false if the socket wasn't ready. Called with cancelled set instead when
+  // the socket is closed or the engine stops first, to fail the request.
+  typedef std::function<bool(bool cancelled)> Request;
+
+  struct PollEntry {
+    uint64_t native_handle;
+    uint32_t events;
+    // Filled in by Poll with the events that are ready.
+    uint32_t ready_events;
+  };
+
+  SocketEngine();
+  ~SocketEngine();
+
+  bool is_running() const { return thread_ != nullptr; }
+
+  bool Start();
+  // Stops the networking thread, cancels every request and releases all
+  // waiters.
+  void Shutdown();
+
+  void Register(uint64_t native_handle);
+  // Cancels the requests still queued on the socket. Must be done before the
+  // host socket is closed.
+  void Unregister(uint64_t native_handle);
+
+  // Bumped each time the host reports an armed socket ready.
+  uint64_t generation();
+  // Asks to be woken the next time the socket is ready for any of the events.
+  void Arm(uint64_t native_handle, uint32_t events);
+  // Waits until generation() moves past the given value. Returns false on
+  // timeout or if the engine is stopping.
+  bool WaitForEvents(uint64_t generation, uint32_t timeout_ms = kInfinite);
+
+  // Queues a request, tried each time the socket is ready for the events.
+  // Returns false if the engine isn't running.
+  bool QueueRequest(uint64_t native_handle, uint32_t events, Request request);
+
+  // Checks how ready the sockets are, waiting up to the timeout for at least
+  // one. Returns the number of ready entries or -1 on host errors.
+  static int Poll(PollEntry* entries, size_t count, uint32_t timeout_ms);
+
+ private:
+  struct Socket {
+    uint32_t armed_events = 0;
+    std::vector<std::pair<uint32_t, Request>> requests;
+  };
+
+  void ThreadMain();
+  // Called with the socket just reported ready and disarmed.
+  void OnReady(uint64_t native_handle);
+  // Updates what the host watches the socket for. Called with mutex_ held.
+  void UpdateArmedLocked(uint64_t native_handle, Socket& socket);
+  void Wake();
+
+  std::unique_ptr<xe::threading::Thread> thread_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::unordered_map<uint64_t, Socket> sockets_;
+  uint64_t generation_ = 0;
+  bool shutting_down_ = false;
+
+  // epoll and an eventfd to wake it on Linux. On Windows the armed sockets
+  // are polled, with a loopback datagram socket to wake the poll.
+  uint64_t poll_handle_ = uint64_t(-1);
+  uint64_t wake_handle_ = uint64_t(-1);
+};
+
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_SOCKET_ENGINE_H_
@@ -9,6 +9,7 @@
 
 #include "xenia/kernel/user_module.h"
 
+#include <memory>
 #include <vector>
 
 #include "xenia/base/byte_stream.h"
@@ -73,7 +74,8 @@ X_STATUS UserModule::LoadFromFile(std::string path) {
     // Load the module.
     result = LoadFromMemory(mmap->data(), mmap->size());
   } else {
-    std::vector<uint8_t> buffer(fs_entry->size());
+    // Not zeroed first, all of it is read over.
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[fs_entry->size()]);
 
     // Open file for reading.
     vfs::File* file = nullptr;
@@ -85,13 +87,13 @@ X_STATUS UserModule::LoadFromFile(std::string path) {
     // Read entire file into memory.
     // Ugh.
     size_t bytes_read = 0;
-    result = file->ReadSync(buffer.data(), buffer.size(), 0, &bytes_read);
+    result = file->Read(buffer.get(), fs_entry->size(), 0, &bytes_read);
     if (XFAILED(result)) {
       return result;
     }
 
     // Load the module.
-    result = LoadFromMemory(buffer.data(), bytes_read);
+    result = LoadFromMemory(buffer.get(), bytes_read);
 
     // Close the file.
     file->Destroy();
@@ -10,10 +10,10 @@
 #include "xenia/kernel/util/object_table.h"
 
 #include <algorithm>
-#include <cstring>
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/threading.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/kernel/xthread.h"
 
@@ -26,34 +26,43 @@ ObjectTable::ObjectTable() {}
 ObjectTable::~ObjectTable() { Reset(); }
 
 void ObjectTable::Reset() {
-  auto global_lock = global_critical_region_.Acquire();
+  std::vector<XObject*> objects;
+  {
+    auto table_lock = table_lock_.Acquire();
+    uint32_t table_capacity = table_capacity_;
+    for (uint32_t n = 0; n < table_capacity; n++) {
+      XObject* object = GetEntry(n)->object;
+      if (object) {
+        objects.push_back(object);
+      }
+    }
 
-  // Release all objects.
-  for (uint32_t n = 0; n < table_capacity_; n++) {
-    ObjectTableEntry& entry = table_[n];
-    if (entry.object) {
-      entry.object->Release();
+    // Lookups racing with this are invalid use, as the entries are freed.
+    table_capacity_ = 0;
+    last_free_entry_ = 0;
+    for (auto& chunk : chunks_) {
+      delete[] chunk.exchange(nullptr);
     }
   }
 
-  table_capacity_ = 0;
-  last_free_entry_ = 0;
-  free(table_);
-  table_ = nullptr;
+  // Release all objects.
+  for (auto object : objects) {
+    object->Release();
+  }
 }
 
 X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
   // Find a free slot.
   uint32_t slot = last_free_entry_;
   uint32_t scan_count = 0;
-  while (scan_count < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (!entry.object) {
+  uint32_t table_capacity = table_capacity_;
+  while (scan_count < table_capacity) {
+    if (!GetEntry(slot)->object) {
       *out_slot = slot;
       return X_STATUS_SUCCESS;
     }
     scan_count++;
-    slot = (slot + 1) % table_capacity_;
+    slot = (slot + 1) % table_capacity;
     if (slot == 0) {
       // Never allow 0 handles.
       scan_count++;
@@ -62,7 +71,7 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
   }
 
   // Table out of slots, expand.
-  uint32_t new_table_capacity = std::max(16 * 1024u, table_capacity_ * 2);
+  uint32_t new_table_capacity = std::max(16 * 1024u, table_capacity * 2);
   if (!Resize(new_table_capacity)) {
     return X_STATUS_NO_MEMORY;
   }
@@ -75,23 +84,28 @@ X_STATUS ObjectTable::FindFreeSlot(uint32_t* out_slot) {
 }
 
 bool ObjectTable::Resize(uint32_t new_capacity) {
-  uint32_t new_size = new_capacity * sizeof(ObjectTableEntry);
-  uint32_t old_size = table_capacity_ * sizeof(ObjectTableEntry);
-  auto new_table =
-      reinterpret_cast<ObjectTableEntry*>(realloc(table_, new_size));
-  if (!new_table) {
+  if (new_capacity > kMaxChunks * kChunkSize) {
     return false;
   }
+  uint32_t old_capacity = table_capacity_;
+  uint32_t chunk_count = (new_capacity + kChunkSize - 1) >> kChunkShift;
+  for (uint32_t i = 0; i < chunk_count; ++i) {
+    if (!chunks_[i].load(std::memory_order_relaxed)) {
+      chunks_[i].store(new ObjectTableEntry[kChunkSize],
+                       std::memory_order_release);
+    }
+  }
 
-  // Zero out new entries.
-  if (new_size > old_size) {
-    std::memset(reinterpret_cast<uint8_t*>(new_table) + old_size, 0,
-                new_size - old_size);
+  // Clear out new entries. Chunks are kept when shrinking, so ones past the
+  // old capacity may have been used before.
+  for (uint32_t slot = old_capacity; slot < new_capacity; ++slot) {
+    auto entry = GetEntry(slot);
+    entry->handle_ref_count = 0;
+    entry->object = nullptr;
   }
 
-  last_free_entry_ = table_capacity_;
-  table_capacity_ = new_capacity;
-  table_ = new_table;
+  last_free_entry_ = old_capacity;
+  table_capacity_.store(new_capacity, std::memory_order_release);
 
   return true;
 }
@@ -101,7 +115,7 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
 
   uint32_t handle = 0;
   {
-    auto global_lock = global_critical_region_.Acquire();
+    auto table_lock = table_lock_.Acquire();
 
     // Find a free slot.
     uint32_t slot = 0;
@@ -109,15 +123,16 @@ X_STATUS ObjectTable::AddHandle(XObject* object, X_HANDLE* out_handle) {
 
     // Stash.
     if (XSUCCEEDED(result)) {
-      ObjectTableEntry& entry = table_[slot];
-      entry.object = object;
-      entry.handle_ref_count = 1;
+      ObjectTableEntry* entry = GetEntry(slot);
+      entry->handle_ref_count = 1;
 
       handle = slot << 2;
       object->handles().push_back(handle);
 
-      // Retain so long as the object is in the table.
+      // Retain so long as the object is in the table, before lookups can see
+      // it.
       object->Retain();
+      entry->object = object;
 
       XELOGI("Added handle:%08X for %s", handle, typeid(*object).name());
     }
@@ -136,7 +151,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
   X_STATUS result = X_STATUS_SUCCESS;
   handle = TranslateHandle(handle);
 
-  XObject* object = LookupObject(handle, false);
+  XObject* object = LookupObject(handle);
   if (object) {
     result = AddHandle(object, out_handle);
     object->Release();  // Release the ref that LookupObject took
@@ -148,7 +163,7 @@ X_STATUS ObjectTable::DuplicateHandle(X_HANDLE handle, X_HANDLE* out_handle) {
 }
 
 X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_lock_.Acquire();
 
   ObjectTableEntry* entry = LookupTable(handle);
   if (!entry) {
@@ -160,16 +175,24 @@ X_STATUS ObjectTable::RetainHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
-  auto global_lock = global_critical_region_.Acquire();
+  XObject* object = nullptr;
+  {
+    auto table_lock = table_lock_.Acquire();
 
-  ObjectTableEntry* entry = LookupTable(handle);
-  if (!entry) {
-    return X_STATUS_INVALID_HANDLE;
+    ObjectTableEntry* entry = LookupTable(handle);
+    if (!entry) {
+      return X_STATUS_INVALID_HANDLE;
+    }
+
+    if (--entry->handle_ref_count == 0) {
+      // No more references. Remove it from the table.
+      object = DetachHandle(TranslateHandle(handle));
+    }
   }
 
-  if (--entry->handle_ref_count == 0) {
-    // No more references. Remove it from the table.
-    return RemoveHandle(handle);
+  // Release now that the object has been removed from the table.
+  if (object) {
+    object->Release();
   }
 
   // FIXME: Return a status code telling the caller it wasn't released
@@ -178,50 +201,68 @@ X_STATUS ObjectTable::ReleaseHandle(X_HANDLE handle) {
 }
 
 X_STATUS ObjectTable::RemoveHandle(X_HANDLE handle) {
-  X_STATUS result = X_STATUS_SUCCESS;
-
   handle = TranslateHandle(handle);
   if (!handle) {
     return X_STATUS_INVALID_HANDLE;
   }
 
-  ObjectTableEntry* entry = LookupTable(handle);
-  if (!entry) {
-    return X_STATUS_INVALID_HANDLE;
+  XObject* object;
+  {
+    auto table_lock = table_lock_.Acquire();
+    if (!LookupTable(handle)) {
+      return X_STATUS_INVALID_HANDLE;
+    }
+    object = DetachHandle(handle);
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-  if (entry->object) {
-    auto object = entry->object;
-    entry->object = nullptr;
-    entry->handle_ref_count = 0;
+  // Release now that the object has been removed from the table.
+  if (object) {
+    object->Release();
+  }
 
-    // Walk the object's handles and remove this one.
-    auto handle_entry =
-        std::find(object->handles().begin(), object->handles().end(), handle);
-    if (handle_entry != object->handles().end()) {
-      object->handles().erase(handle_entry);
-    }
+  return X_STATUS_SUCCESS;
+}
 
-    XELOGI("Removed handle:%08X for %s", handle, typeid(*object).name());
+XObject* ObjectTable::DetachHandle(X_HANDLE handle) {
+  ObjectTableEntry* entry = LookupTable(handle);
+  if (!entry || !entry->object) {
+    return nullptr;
+  }
+  auto object = ClearEntry(entry);
 
-    // Release now that the object has been removed from the table.
-    object->Release();
+  // Walk the object's handles and remove this one.
+  auto handle_entry =
+      std::find(object->handles().begin(), object->handles().end(), handle);
+  if (handle_entry != object->handles().end()) {
+    object->handles().erase(handle_entry);
   }
 
-  return X_STATUS_SUCCESS;
+  XELOGI("Removed handle:%08X for %s", handle, typeid(*object).name());
+  return object;
+}
+
+XObject* ObjectTable::ClearEntry(ObjectTableEntry* entry) {
+  entry->handle_ref_count = 0;
+  XObject* object = entry->object.exchange(nullptr);
+  // Pairs with LookupObject: either it sees the entry cleared, or this sees
+  // it retaining the object, which takes only a few instructions.
+  while (entry->lookup_count.load()) {
+    xe::threading::MaybeYield();
+  }
+  return object;
 }
 
 std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
-  auto lock = global_critical_region_.Acquire();
+  auto table_lock = table_lock_.Acquire();
   std::vector<object_ref<XObject>> results;
 
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && std::find(results.begin(), results.end(),
-                                  entry.object) == results.end()) {
-      entry.object->Retain();
-      results.push_back(object_ref<XObject>(entry.object));
+  uint32_t table_capacity = table_capacity_;
+  for (uint32_t slot = 0; slot < table_capacity; slot++) {
+    XObject* object = GetEntry(slot)->object;
+    if (object && std::find(results.begin(), results.end(), object) ==
+                      results.end()) {
+      object->Retain();
+      results.push_back(object_ref<XObject>(object));
     }
   }
 
@@ -229,16 +270,21 @@ std::vector<object_ref<XObject>> ObjectTable::GetAllObjects() {
 }
 
 void ObjectTable::PurgeAllObjects() {
-  auto lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; slot++) {
-    auto& entry = table_[slot];
-    if (entry.object && !entry.object->is_host_object()) {
-      entry.handle_ref_count = 0;
-      entry.object->Release();
-
-      entry.object = nullptr;
+  std::vector<XObject*> objects;
+  {
+    auto table_lock = table_lock_.Acquire();
+    uint32_t table_capacity = table_capacity_;
+    for (uint32_t slot = 0; slot < table_capacity; slot++) {
+      auto entry = GetEntry(slot);
+      XObject* object = entry->object;
+      if (object && !object->is_host_object()) {
+        objects.push_back(ClearEntry(entry));
+      }
     }
   }
+  for (auto object : objects) {
+    object->Release();
+  }
 }
 
 ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
@@ -247,12 +293,10 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
     return nullptr;
   }
 
-  auto global_lock = global_critical_region_.Acquire();
-
   // Lower 2 bits are ignored.
   uint32_t slot = handle >> 2;
-  if (slot <= table_capacity_) {
-    return &table_[slot];
+  if (slot < table_capacity_) {
+    return GetEntry(slot);
   }
 
   return nullptr;
@@ -261,54 +305,53 @@ ObjectTable::ObjectTableEntry* ObjectTable::LookupTable(X_HANDLE handle) {
 // Generic lookup
 template <>
 object_ref<XObject> ObjectTable::LookupObject<XObject>(X_HANDLE handle) {
-  auto object = ObjectTable::LookupObject(handle, false);
+  auto object = ObjectTable::LookupObject(handle);
   auto result = object_ref<XObject>(reinterpret_cast<XObject*>(object));
   return result;
 }
 
-XObject* ObjectTable::LookupObject(X_HANDLE handle, bool already_locked) {
+XObject* ObjectTable::LookupObject(X_HANDLE handle) {
   handle = TranslateHandle(handle);
   if (!handle) {
     return nullptr;
   }
 
-  XObject* object = nullptr;
-  if (!already_locked) {
-    global_critical_region_.mutex().lock();
-  }
-
   // Lower 2 bits are ignored.
   uint32_t slot = handle >> 2;
 
   // Verify slot.
-  if (slot < table_capacity_) {
-    ObjectTableEntry& entry = table_[slot];
-    if (entry.object) {
-      object = entry.object;
-    }
+  if (slot >= table_capacity_.load(std::memory_order_acquire)) {
+    return nullptr;
   }
+  ObjectTableEntry* entry = GetEntry(slot);
 
-  // Retain the object pointer.
+  // Retain the object pointer. The entry is marked as being looked up
+  // meanwhile, so ClearEntry keeps the table's reference until it's retained.
+  // As ClearEntry waits with the table lock held, the thread mustn't be
+  // suspended in between.
+  auto lock_state = xe::thread_lock_state::current();
+  lock_state->Enter();
+  entry->lookup_count.fetch_add(1);
+  XObject* object = entry->object.load();
   if (object) {
     object->Retain();
   }
-
-  if (!already_locked) {
-    global_critical_region_.mutex().unlock();
-  }
+  entry->lookup_count.fetch_sub(1);
+  lock_state->Leave();
 
   return object;
 }
 
 void ObjectTable::GetObjectsByType(XObject::Type type,
                                    std::vector<object_ref<XObject>>* results) {
-  auto global_lock = global_critical_region_.Acquire();
-  for (uint32_t slot = 0; slot < table_capacity_; ++slot) {
-    auto& entry = table_[slot];
-    if (entry.object) {
-      if (entry.object->type() == type) {
-        entry.object->Retain();
-        results->push_back(object_ref<XObject>(entry.object));
+  auto table_lock = table_lock_.Acquire();
+  uint32_t table_capacity = table_capacity_;
+  for (uint32_t slot = 0; slot < table_capacity; ++slot) {
+    XObject* object = GetEntry(slot)->object;
+    if (object) {
+      if (object->type() == type) {
+        object->Retain();
+        results->push_back(object_ref<XObject>(object));
       }
     }
   }
@@ -333,7 +376,7 @@ X_STATUS ObjectTable::AddNameMapping(const std::string& name, X_HANDLE handle) {
   std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
                  tolower);
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_lock_.Acquire();
   if (name_table_.count(lower_name)) {
     return X_STATUS_OBJECT_NAME_COLLISION;
   }
@@ -347,7 +390,7 @@ void ObjectTable::RemoveNameMapping(const std::string& name) {
   std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
                  tolower);
 
-  auto global_lock = global_critical_region_.Acquire();
+  auto table_lock = table_lock_.Acquire();
   auto it = name_table_.find(lower_name);
   if (it != name_table_.end()) {
     name_table_.erase(it);
@@ -361,18 +404,23 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
   std::transform(lower_name.begin(), lower_name.end(), lower_name.begin(),
                  tolower);
 
-  auto global_lock = global_critical_region_.Acquire();
-  auto it = name_table_.find(lower_name);
-  if (it == name_table_.end()) {
-    *out_handle = X_INVALID_HANDLE_VALUE;
-    return X_STATUS_OBJECT_NAME_NOT_FOUND;
-  }
-  *out_handle = it->second;
+  XObject* obj;
+  {
+    auto table_lock = table_lock_.Acquire();
+    auto it = name_table_.find(lower_name);
+    if (it == name_table_.end()) {
+      *out_handle = X_INVALID_HANDLE_VALUE;
+      return X_STATUS_OBJECT_NAME_NOT_FOUND;
+    }
+    *out_handle = it->second;
 
-  // We need to ref the handle. I think.
-  auto obj = LookupObject(it->second, true);
+    // We need to ref the handle. I think.
+    obj = LookupObject(it->second);
+    if (obj) {
+      obj->RetainHandle();
+    }
+  }
   if (obj) {
-    obj->RetainHandle();
     obj->Release();
   }
 
@@ -380,21 +428,25 @@ X_STATUS ObjectTable::GetObjectByName(const std::string& name,
 }
 
 bool ObjectTable::Save(ByteStream* stream) {
-  stream->Write<uint32_t>(table_capacity_);
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
-    stream->Write<int32_t>(entry.handle_ref_count);
+  auto table_lock = table_lock_.Acquire();
+  uint32_t table_capacity = table_capacity_;
+  stream->Write<uint32_t>(table_capacity);
+  for (uint32_t i = 0; i < table_capacity; i++) {
+    stream->Write<int32_t>(GetEntry(i)->handle_ref_count);
   }
 
   return true;
 }
 
 bool ObjectTable::Restore(ByteStream* stream) {
-  Resize(stream->Read<uint32_t>());
-  for (uint32_t i = 0; i < table_capacity_; i++) {
-    auto& entry = table_[i];
+  auto table_lock = table_lock_.Acquire();
+  if (!Resize(stream->Read<uint32_t>())) {
+    return false;
+  }
+  uint32_t table_capacity = table_capacity_;
+  for (uint32_t i = 0; i < table_capacity; i++) {
     // entry.object = nullptr;
-    entry.handle_ref_count = stream->Read<int32_t>();
+    GetEntry(i)->handle_ref_count = stream->Read<int32_t>();
   }
 
   return true;
@@ -402,12 +454,12 @@ bool ObjectTable::Restore(ByteStream* stream) {
 
 X_STATUS ObjectTable::RestoreHandle(X_HANDLE handle, XObject* object) {
   uint32_t slot = handle >> 2;
-  assert_true(table_capacity_ >= slot);
+  auto table_lock = table_lock_.Acquire();
+  assert_true(table_capacity_ > slot);
 
-  if (table_capacity_ >= slot) {
-    auto& entry = table_[slot];
-    entry.object = object;
+  if (table_capacity_ > slot) {
     object->Retain();
+    GetEntry(slot)->object = object;
   }
 
   return X_STATUS_SUCCESS;
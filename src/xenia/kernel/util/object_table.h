@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 #define XENIA_KERNEL_UTIL_OBJECT_TABLE_H_
 
+#include <atomic>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -46,9 +47,11 @@ class ObjectTable {
   // not use.
   X_STATUS RestoreHandle(X_HANDLE handle, XObject* object);
 
+  // Retains and returns the object of the handle. This takes no lock, as
+  // nearly every kernel call looks up handles.
   template <typename T>
   object_ref<T> LookupObject(X_HANDLE handle) {
-    auto object = LookupObject(handle, false);
+    auto object = LookupObject(handle);
     if (object) {
       assert_true(object->type() == T::kType);
     }
@@ -81,13 +84,38 @@ class ObjectTable {
   void PurgeAllObjects();  // Purges the object table of all guest objects
 
  private:
-  typedef struct {
+  struct ObjectTableEntry {
+    // Guarded by table_lock_.
     int handle_ref_count = 0;
-    XObject* object = nullptr;
-  } ObjectTableEntry;
+    // Written under table_lock_, read by lookups without it.
+    std::atomic<XObject*> object = {nullptr};
+    // Lookups currently retaining the object. The table keeps its reference
+    // until they're done, so they never retain a deleted object.
+    std::atomic<uint32_t> lookup_count = {0};
+  };
+
+  // Entries are allocated in chunks that stay in place until Reset, so
+  // lookups can index them while the table grows.
+  static const uint32_t kChunkShift = 12;
+  static const uint32_t kChunkSize = 1 << kChunkShift;
+  static const uint32_t kMaxChunks = 4096;
+
+  ObjectTableEntry* GetEntry(uint32_t slot) {
+    return &chunks_[slot >> kChunkShift].load(
+        std::memory_order_acquire)[slot & (kChunkSize - 1)];
+  }
 
+  // table_lock_ must be held.
   ObjectTableEntry* LookupTable(X_HANDLE handle);
-  XObject* LookupObject(X_HANDLE handle, bool already_locked);
+  // Returns the retained object of the handle. Takes no lock.
+  XObject* LookupObject(X_HANDLE handle);
+  // Clears the entry of the handle, returning the object it referenced for
+  // the caller to release once table_lock_ is released. table_lock_ must be
+  // held.
+  XObject* DetachHandle(X_HANDLE handle);
+  // Clears the object of an entry, waiting for lookups still retaining it.
+  // Returns the object to release. table_lock_ must be held.
+  XObject* ClearEntry(ObjectTableEntry* entry);
   void GetObjectsByType(XObject::Type type,
                         std::vector<object_ref<XObject>>* results);
 
@@ -95,9 +123,10 @@ class ObjectTable {
   X_STATUS FindFreeSlot(uint32_t* out_slot);
   bool Resize(uint32_t new_capacity);
 
-  xe::global_critical_region global_critical_region_;
-  uint32_t table_capacity_ = 0;
-  ObjectTableEntry* table_ = nullptr;
+  xe::subsystem_mutex table_lock_{"kernel/object_table"};
+  // Entries below the capacity are allocated; it's published after them.
+  std::atomic<uint32_t> table_capacity_ = {0};
+  std::atomic<ObjectTableEntry*> chunks_[kMaxChunks] = {};
   uint32_t last_free_entry_ = 0;
   std::unordered_map<std::string, X_HANDLE> name_table_;
 };
@@ -9,6 +9,9 @@
 
 #include "xenia/kernel/util/shim_utils.h"
 
+#include "xenia/base/clock.h"
+#include "xenia/kernel/xthread.h"
+
 DEFINE_bool(log_high_frequency_kernel_calls, false,
             "Log kernel calls with the kHighFrequency tag.");
 
@@ -20,6 +23,14 @@ thread_local StringBuffer string_buffer_;
 
 StringBuffer* thread_local_string_buffer() { return &string_buffer_; }
 
+void ProfileKernelCall(cpu::Export* export_entry, PPCContext* ppc_context,
+                       xe::cpu::ExportTrampoline call) {
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  call(ppc_context);
+  export_entry->profile.Record(Clock::QueryHostTickCount() - start_ticks,
+                               XThread::GetCurrentThreadId());
+}
+
 }  // namespace shim
 }  // namespace kernel
 }  // namespace xe
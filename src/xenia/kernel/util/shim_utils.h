@@ -14,6 +14,9 @@
 
 #include <cstring>
 #include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
 
 #include "xenia/base/byte_order.h"
 #include "xenia/base/logging.h"
@@ -25,6 +28,12 @@
 
 DECLARE_bool(log_high_frequency_kernel_calls);
 
+// Kernel call logging can be compiled out entirely, leaving the trampolines
+// with nothing but the argument loads and the call.
+#ifndef XE_OPTION_LOG_KERNEL_CALLS
+#define XE_OPTION_LOG_KERNEL_CALLS XE_OPTION_ENABLE_LOGGING
+#endif  // XE_OPTION_LOG_KERNEL_CALLS
+
 namespace xe {
 namespace kernel {
 
@@ -240,10 +249,24 @@ class StringPointerParam : public ParamBase<uint32_t> {
     return reinterpret_cast<uintptr_t>(host_ptr_);
   }
   STR value() const { return xe::load_and_swap<STR>(host_ptr_); }
+  // In characters, read in place rather than through a copy like value().
+  size_t length() const {
+    assert_not_null(host_ptr_);
+    auto chars = reinterpret_cast<const GuestChar*>(host_ptr_);
+    size_t length = 0;
+    while (chars[length]) {
+      ++length;
+    }
+    return length;
+  }
   operator CHAR*() const { return host_ptr_; }
   operator bool() const { return host_ptr_ != nullptr; }
 
  protected:
+  // Guest wide strings are UTF-16, whatever the size of wchar_t is here.
+  using GuestChar =
+      typename std::conditional<sizeof(CHAR) == 1, char, uint16_t>::type;
+
   CHAR* host_ptr_;
 };
 
@@ -376,7 +399,7 @@ inline void AppendParam(StringBuffer* string_buffer, lpdouble_t param) {
 inline void AppendParam(StringBuffer* string_buffer, lpstring_t param) {
   string_buffer->AppendFormat("%.8X", param.guest_address());
   if (param) {
-    string_buffer->AppendFormat("(%s)", param.value().c_str());
+    string_buffer->AppendFormat("(%s)", static_cast<const char*>(param));
   }
 }
 inline void AppendParam(StringBuffer* string_buffer, lpwstring_t param) {
@@ -442,6 +465,23 @@ template <size_t I = 0, typename... Ps>
 
 StringBuffer* thread_local_string_buffer();
 
+inline bool ShouldLogKernelCall(cpu::Export* export_entry) {
+#if XE_OPTION_LOG_KERNEL_CALLS
+  if (!(export_entry->tags & xe::cpu::ExportTag::kLog) ||
+      ((export_entry->tags & xe::cpu::ExportTag::kHighFrequency) &&
+       !FLAGS_log_high_frequency_kernel_calls)) {
+    return false;
+  }
+  // Don't build the line at all if it'd be dropped.
+  return xe::IsLogLevelEnabled(
+      (export_entry->tags & xe::cpu::ExportTag::kImportant)
+          ? xe::LogLevel::Info
+          : xe::LogLevel::Debug);
+#else
+  return false;
+#endif  // XE_OPTION_LOG_KERNEL_CALLS
+}
+
 template <typename Tuple>
 void PrintKernelCall(cpu::Export* export_entry, const Tuple& params) {
   auto& string_buffer = *thread_local_string_buffer();
@@ -459,11 +499,52 @@ void PrintKernelCall(cpu::Export* export_entry, const Tuple& params) {
   }
 }
 
+// Calls the trampoline body, recording its host time into the export profile.
+void ProfileKernelCall(cpu::Export* export_entry, PPCContext* ppc_context,
+                       xe::cpu::ExportTrampoline call);
+
 template <typename F, typename Tuple, std::size_t... I>
 auto KernelTrampoline(F&& f, Tuple&& t, std::index_sequence<I...>) {
   return std::forward<F>(f)(std::get<I>(std::forward<Tuple>(t))...);
 }
 
+template <typename P>
+struct IsFloatParam : std::false_type {};
+template <>
+struct IsFloatParam<const ParamBase<float>> : std::true_type {};
+template <>
+struct IsFloatParam<const ParamBase<double>> : std::true_type {};
+
+// Number of floating point parameters before parameter I.
+template <size_t I, typename... Ps>
+struct FloatParamOrdinal;
+template <typename P, typename... Ps>
+struct FloatParamOrdinal<0, P, Ps...> {
+  static const int value = 0;
+};
+template <size_t I, typename P, typename... Ps>
+struct FloatParamOrdinal<I, P, Ps...> {
+  static const int value =
+      int(IsFloatParam<P>::value) + FloatParamOrdinal<I - 1, Ps...>::value;
+};
+
+// Each parameter knows its register/stack slot at compile time, so loading
+// it is a single access into the context (or guest stack) with no counting,
+// and the result doesn't depend on the order arguments are evaluated in.
+template <typename P, size_t I, int F>
+P LoadKernelCallParam(PPCContext* ppc_context) {
+  Param::Init init = {ppc_context, int(I) + 1, F};
+  return P(init);
+}
+
+template <typename... Ps, std::size_t... I>
+std::tuple<Ps...> LoadKernelCallParams(PPCContext* ppc_context,
+                                       std::index_sequence<I...>) {
+  return std::tuple<Ps...>{
+      LoadKernelCallParam<Ps, I, FloatParamOrdinal<I, Ps...>::value>(
+          ppc_context)...};
+}
+
 template <KernelModuleId MODULE, uint16_t ORDINAL, typename R, typename... Ps>
 xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
                                 xe::cpu::ExportTag::type tags) {
@@ -473,16 +554,17 @@ xe::cpu::Export* RegisterExport(R (*fn)(Ps&...), const char* name,
   static R (*FN)(Ps & ...) = fn;
   struct X {
     static void Trampoline(PPCContext* ppc_context) {
+      if (xe::cpu::ExportResolver::is_profiling_enabled()) {
+        ProfileKernelCall(export_entry, ppc_context, &Call);
+      } else {
+        Call(ppc_context);
+      }
+    }
+    static void Call(PPCContext* ppc_context) {
       ++export_entry->function_data.call_count;
-      Param::Init init = {
-          ppc_context,
-          sizeof...(Ps),
-          0,
-      };
-      auto params = std::make_tuple<Ps...>(Ps(init)...);
-      if (export_entry->tags & xe::cpu::ExportTag::kLog &&
-          (!(export_entry->tags & xe::cpu::ExportTag::kHighFrequency) ||
-           FLAGS_log_high_frequency_kernel_calls)) {
+      auto params = LoadKernelCallParams<Ps...>(
+          ppc_context, std::make_index_sequence<sizeof...(Ps)>());
+      if (ShouldLogKernelCall(export_entry)) {
         PrintKernelCall(export_entry, params);
       }
       auto result =
@@ -508,15 +590,17 @@ xe::cpu::Export* RegisterExport(void (*fn)(Ps&...), const char* name,
   static void (*FN)(Ps & ...) = fn;
   struct X {
     static void Trampoline(PPCContext* ppc_context) {
+      if (xe::cpu::ExportResolver::is_profiling_enabled()) {
+        ProfileKernelCall(export_entry, ppc_context, &Call);
+      } else {
+        Call(ppc_context);
+      }
+    }
+    static void Call(PPCContext* ppc_context) {
       ++export_entry->function_data.call_count;
-      Param::Init init = {
-          ppc_context,
-          sizeof...(Ps),
-      };
-      auto params = std::make_tuple<Ps...>(Ps(init)...);
-      if (export_entry->tags & xe::cpu::ExportTag::kLog &&
-          (!(export_entry->tags & xe::cpu::ExportTag::kHighFrequency) ||
-           FLAGS_log_high_frequency_kernel_calls)) {
+      auto params = LoadKernelCallParams<Ps...>(
+          ppc_context, std::make_index_sequence<sizeof...(Ps)>());
+      if (ShouldLogKernelCall(export_entry)) {
         PrintKernelCall(export_entry, params);
       }
       KernelTrampoline(FN, std::forward<std::tuple<Ps...>>(params),
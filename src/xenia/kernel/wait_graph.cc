@@ -0,0 +1,202 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/kernel/wait_graph.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/cpu/processor.h"
+#include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/xthread.h"
+
+DEFINE_int32(wait_graph_max_edges, 1 << 20,
+             "Number of the most recent wait edges kept by --wait_graph.");
+
+namespace xe {
+namespace kernel {
+
+namespace {
+
+const char* GetObjectTypeName(XObject::Type type) {
+  switch (type) {
+    case XObject::kTypeEvent:
+      return "event";
+    case XObject::kTypeMutant:
+      return "mutant";
+    case XObject::kTypeSemaphore:
+      return "semaphore";
+    case XObject::kTypeThread:
+      return "thread";
+    case XObject::kTypeTimer:
+      return "timer";
+    case XObject::kTypeIOCompletion:
+      return "io_completion";
+    case XObject::kTypeFile:
+      return "file";
+    case XObject::kTypeNotifyListener:
+      return "notify_listener";
+    default:
+      return "object";
+  }
+}
+
+// Names are whatever the guest passed in, so they can't go into the JSON as
+// they are.
+void WriteJsonString(FILE* file, const std::string& value) {
+  std::fputc('"', file);
+  for (char c : value) {
+    if (c == '"' || c == '\\') {
+      std::fputc('\\', file);
+      std::fputc(c, file);
+    } else if (uint8_t(c) < 0x20) {
+      std::fprintf(file, "\\u%04X", uint8_t(c));
+    } else {
+      std::fputc(c, file);
+    }
+  }
+  std::fputc('"', file);
+}
+
+}  // namespace
+
+WaitGraph::ScopedWait::ScopedWait(XObject* const* objects, uint32_t count,
+                                  bool wait_all)
+    : graph_(KernelState::shared()->wait_graph()),
+      thread_(nullptr),
+      objects_(objects),
+      count_(count),
+      wait_all_(wait_all) {
+  if (!graph_ || !count) {
+    return;
+  }
+  thread_ = XThread::GetCurrentThread();
+  if (!thread_) {
+    return;
+  }
+  start_tick_ = Clock::QueryHostTickCount();
+  graph_->kernel_state_->processor()->OnThreadEnteringWait(
+      thread_->thread_id(), objects[0]->handle());
+}
+
+X_STATUS WaitGraph::ScopedWait::End(X_STATUS status) {
+  if (!thread_) {
+    return status;
+  }
+  uint64_t end_tick = Clock::QueryHostTickCount();
+  graph_->kernel_state_->processor()->OnThreadLeavingWait(
+      thread_->thread_id());
+  graph_->Record(thread_, objects_, count_, wait_all_, start_tick_, end_tick,
+                 status);
+  thread_ = nullptr;
+  return status;
+}
+
+WaitGraph::WaitGraph(KernelState* kernel_state)
+    : kernel_state_(kernel_state),
+      base_tick_(Clock::QueryHostTickCount()),
+      tick_frequency_(Clock::host_tick_frequency()) {}
+
+uint64_t WaitGraph::TicksToMicroseconds(uint64_t ticks) const {
+  return uint64_t(double(ticks) * 1000000.0 / double(tick_frequency_));
+}
+
+void WaitGraph::Record(XThread* thread, XObject* const* objects,
+                       uint32_t count, bool wait_all, uint64_t start_tick,
+                       uint64_t end_tick, X_STATUS status) {
+  // Wait-any returns the index of the object that satisfied it.
+  bool satisfied_all = wait_all && status == X_STATUS_SUCCESS;
+  uint32_t satisfied_index = !wait_all && status < count ? status : count;
+
+  auto lock = lock_.Acquire();
+  if (thread_names_.find(thread->thread_id()) == thread_names_.end()) {
+    thread_names_[thread->thread_id()] = thread->name();
+  }
+  size_t max_edges = size_t(std::max(FLAGS_wait_graph_max_edges, 1));
+  for (uint32_t i = 0; i < count; ++i) {
+    XObject* object = objects[i];
+    Edge edge;
+    edge.waiter_thread_id = thread->thread_id();
+    edge.object_handle = object->handle();
+    edge.object_type = object->type();
+    edge.object_name = object->name();
+    edge.start_us = TicksToMicroseconds(start_tick - base_tick_);
+    edge.duration_us = TicksToMicroseconds(end_tick - start_tick);
+    edge.signaler_thread_id = 0;
+    if (satisfied_all || i == satisfied_index) {
+      // Threads are signaled by exiting.
+      edge.signaler_thread_id =
+          object->type() == XObject::kTypeThread
+              ? static_cast<XThread*>(object)->thread_id()
+              : object->signaler_thread_id();
+    }
+    edge.status = status;
+    while (edges_.size() >= max_edges) {
+      edges_.pop_front();
+    }
+    edges_.push_back(std::move(edge));
+  }
+}
+
+std::vector<WaitGraph::Edge> WaitGraph::QueryEdges() {
+  auto lock = lock_.Acquire();
+  return std::vector<Edge>(edges_.begin(), edges_.end());
+}
+
+bool WaitGraph::WriteTimeline(const std::wstring& path) {
+  auto lock = lock_.Acquire();
+  FILE* file = xe::filesystem::OpenFile(path, "w");
+  if (!file) {
+    XELOGE("Failed to open the wait timeline file");
+    return false;
+  }
+  std::fprintf(file, "{\"traceEvents\":[\n");
+  bool first = true;
+  for (auto& it : thread_names_) {
+    std::fprintf(file,
+                 "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,"
+                 "\"tid\":%u,\"args\":{\"name\":",
+                 first ? "" : ",\n", it.first);
+    WriteJsonString(file, it.second);
+    std::fprintf(file, "}}");
+    first = false;
+  }
+  for (auto& edge : edges_) {
+    std::fprintf(file, "%s{\"ph\":\"X\",\"cat\":\"%s\",\"name\":",
+                 first ? "" : ",\n", GetObjectTypeName(edge.object_type));
+    if (edge.object_name.empty()) {
+      char name[32];
+      std::snprintf(name, xe::countof(name), "%s %.8X",
+                    GetObjectTypeName(edge.object_type), edge.object_handle);
+      WriteJsonString(file, name);
+    } else {
+      WriteJsonString(file, edge.object_name);
+    }
+    std::fprintf(file,
+                 ",\"pid\":0,\"tid\":%u,\"ts\":%" PRIu64 ",\"dur\":%" PRIu64
+                 ",\"args\":{\"handle\":\"%.8X\",\"signaler\":%u,"
+                 "\"status\":\"%.8X\"}}",
+                 edge.waiter_thread_id, edge.start_us, edge.duration_us,
+                 edge.object_handle, edge.signaler_thread_id, edge.status);
+    first = false;
+  }
+  std::fprintf(file, "\n]}\n");
+  std::fclose(file);
+  return true;
+}
+
+}  // namespace kernel
+}  // namespace xe
@@ -0,0 +1,92 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_KERNEL_WAIT_GRAPH_H_
+#define XENIA_KERNEL_WAIT_GRAPH_H_
+
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "xenia/base/mutex.h"
+#include "xenia/kernel/xobject.h"
+#include "xenia/xbox.h"
+
+namespace xe {
+namespace kernel {
+
+class KernelState;
+class XThread;
+
+// Records which guest thread waited on which objects, for how long and which
+// thread signaled them, to find stalls and lock convoys in guest code. Only
+// created with --wait_graph, as every wait takes its lock.
+class WaitGraph {
+ public:
+  // One object of a finished wait.
+  struct Edge {
+    uint32_t waiter_thread_id;
+    X_HANDLE object_handle;
+    XObject::Type object_type;
+    std::string object_name;
+    // Host microseconds since the graph was created.
+    uint64_t start_us;
+    uint64_t duration_us;
+    // Last guest thread to signal the object before it satisfied the wait, or
+    // 0 if it didn't or was signaled from the host.
+    uint32_t signaler_thread_id;
+    X_STATUS status;
+  };
+
+  // Times a wait of the current thread, doing nothing without a graph or
+  // outside of guest threads.
+  class ScopedWait {
+   public:
+    ScopedWait(XObject* const* objects, uint32_t count, bool wait_all);
+    // Records the wait as finished with the status, and returns it.
+    X_STATUS End(X_STATUS status);
+
+   private:
+    WaitGraph* graph_;
+    XThread* thread_;
+    XObject* const* objects_;
+    uint32_t count_;
+    bool wait_all_;
+    uint64_t start_tick_ = 0;
+  };
+
+  explicit WaitGraph(KernelState* kernel_state);
+
+  // Oldest first. Only the most recent --wait_graph_max_edges are kept.
+  std::vector<Edge> QueryEdges();
+
+  // Writes the edges as a Chrome trace event file, loadable in about:tracing,
+  // with one track per waiting thread.
+  bool WriteTimeline(const std::wstring& path);
+
+ private:
+  uint64_t TicksToMicroseconds(uint64_t ticks) const;
+  void Record(XThread* thread, XObject* const* objects, uint32_t count,
+              bool wait_all, uint64_t start_tick, uint64_t end_tick,
+              X_STATUS status);
+
+  KernelState* kernel_state_;
+  uint64_t base_tick_;
+  uint64_t tick_frequency_;
+
+  xe::subsystem_mutex lock_{"kernel/wait_graph"};
+  std::deque<Edge> edges_;
+  std::unordered_map<uint32_t, std::string> thread_names_;
+};
+
+}  // namespace kernel
+}  // namespace xe
+
+#endif  // XENIA_KERNEL_WAIT_GRAPH_H_
@@ -9,6 +9,9 @@
 
 #include "xenia/kernel/xam/content_manager.h"
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
 #include <string>
 
 #include "xenia/base/filesystem.h"
@@ -17,6 +20,11 @@
 #include "xenia/kernel/xobject.h"
 #include "xenia/vfs/devices/host_path_device.h"
 
+DEFINE_bool(content_catalog, true,
+            "Serve content enumerations from memory instead of rescanning "
+            "the content directories each time. Content copied in while "
+            "running is only seen after a restart.");
+
 namespace xe {
 namespace kernel {
 namespace xam {
@@ -98,12 +106,17 @@ std::wstring ContentManager::ResolvePackagePath(const XCONTENT_DATA& data) {
   return package_path;
 }
 
-std::vector<XCONTENT_DATA> ContentManager::ListContent(uint32_t device_id,
-                                                       uint32_t content_type) {
-  std::vector<XCONTENT_DATA> result;
+std::vector<std::string>* ContentManager::LookupCatalog(
+    uint32_t content_type) {
+  uint64_t key = uint64_t(kernel_state_->title_id()) << 32 | content_type;
+  auto it = catalogs_.find(key);
+  if (it != catalogs_.end()) {
+    return &it->second;
+  }
 
   // Search path:
   // content_root/title_id/type_name/*
+  std::vector<std::string> file_names;
   auto package_root = ResolvePackageRoot(content_type);
   auto file_infos = xe::filesystem::ListFiles(package_root);
   for (const auto& file_info : file_infos) {
@@ -111,11 +124,51 @@ std::vector<XCONTENT_DATA> ContentManager::ListContent(uint32_t device_id,
       // Directories only.
       continue;
     }
+    file_names.push_back(xe::to_string(file_info.name));
+  }
+  return &catalogs_.emplace(key, std::move(file_names)).first->second;
+}
+
+void ContentManager::AddToCatalog(const XCONTENT_DATA& data) {
+  uint64_t key = uint64_t(kernel_state_->title_id()) << 32 | data.content_type;
+  auto it = catalogs_.find(key);
+  if (it == catalogs_.end()) {
+    // Not scanned yet, the scan will find it.
+    return;
+  }
+  auto& file_names = it->second;
+  if (std::find(file_names.begin(), file_names.end(), data.file_name) ==
+      file_names.end()) {
+    file_names.push_back(data.file_name);
+  }
+}
+
+void ContentManager::RemoveFromCatalog(const XCONTENT_DATA& data) {
+  uint64_t key = uint64_t(kernel_state_->title_id()) << 32 | data.content_type;
+  auto it = catalogs_.find(key);
+  if (it == catalogs_.end()) {
+    return;
+  }
+  auto& file_names = it->second;
+  file_names.erase(
+      std::remove(file_names.begin(), file_names.end(), data.file_name),
+      file_names.end());
+}
+
+std::vector<XCONTENT_DATA> ContentManager::ListContent(uint32_t device_id,
+                                                       uint32_t content_type) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (!FLAGS_content_catalog) {
+    catalogs_.clear();
+  }
+
+  std::vector<XCONTENT_DATA> result;
+  for (const auto& file_name : *LookupCatalog(content_type)) {
     XCONTENT_DATA content_data;
     content_data.device_id = device_id;
     content_data.content_type = content_type;
-    content_data.display_name = file_info.name;
-    content_data.file_name = xe::to_string(file_info.name);
+    content_data.display_name = xe::to_wstring(file_name);
+    content_data.file_name = file_name;
     result.emplace_back(std::move(content_data));
   }
 
@@ -159,6 +212,7 @@ X_RESULT ContentManager::CreateContent(std::string root_name,
   if (!xe::filesystem::CreateFolder(package_path)) {
     return X_ERROR_ACCESS_DENIED;
   }
+  AddToCatalog(data);
 
   auto package = ResolvePackage(root_name, data);
   assert_not_null(package);
@@ -232,6 +286,7 @@ X_RESULT ContentManager::SetContentThumbnail(const XCONTENT_DATA& data,
   auto package_path = ResolvePackagePath(data);
   xe::filesystem::CreateFolder(package_path);
   if (xe::filesystem::PathExists(package_path)) {
+    AddToCatalog(data);
     auto thumb_path = xe::join_paths(package_path, kThumbnailFileName);
     auto file = xe::filesystem::OpenFile(thumb_path, "wb");
     fwrite(buffer.data(), 1, buffer.size(), file);
@@ -248,6 +303,7 @@ X_RESULT ContentManager::DeleteContent(const XCONTENT_DATA& data) {
   auto package_path = ResolvePackagePath(data);
   if (xe::filesystem::PathExists(package_path)) {
     xe::filesystem::DeleteFolder(package_path);
+    RemoveFromCatalog(data);
     return X_ERROR_SUCCESS;
   } else {
     return X_ERROR_FILE_NOT_FOUND;
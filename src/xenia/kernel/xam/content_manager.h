@@ -90,12 +90,21 @@ class ContentManager {
   std::wstring ResolvePackageRoot(uint32_t content_type);
   std::wstring ResolvePackagePath(const XCONTENT_DATA& data);
 
+  // Names of the packages of one content type of the running title, scanned
+  // from the host on the first enumeration and kept up to date as content is
+  // created and deleted. Called with the global lock held.
+  std::vector<std::string>* LookupCatalog(uint32_t content_type);
+  void AddToCatalog(const XCONTENT_DATA& data);
+  void RemoveFromCatalog(const XCONTENT_DATA& data);
+
   KernelState* kernel_state_;
   std::wstring root_path_;
 
   // TODO(benvanik): remove use of global lock, it's bad here!
   xe::global_critical_region global_critical_region_;
   std::unordered_map<std::string, ContentPackage*> open_packages_;
+  // Keyed by title ID << 32 | content type.
+  std::unordered_map<uint64_t, std::vector<std::string>> catalogs_;
 };
 
 }  // namespace xam
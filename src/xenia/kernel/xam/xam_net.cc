@@ -7,11 +7,17 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cstring>
+#include <memory>
+#include <vector>
 
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/socket_engine.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xam/xam_module.h"
 #include "xenia/kernel/xam/xam_private.h"
@@ -96,6 +102,72 @@ struct XWSAOVERLAPPED {
   xe::be<uint32_t> event_handle;
 };
 
+// Winsock keeps the status of overlapped requests in Internal: STATUS_PENDING
+// until they finish, then 0 or the Winsock error. InternalHigh has the number
+// of bytes transferred.
+void CompleteOverlapped(XWSAOVERLAPPED* overlapped, uint32_t error,
+                        uint32_t byte_count) {
+  overlapped->internal_high = byte_count;
+  std::atomic_thread_fence(std::memory_order_release);
+  overlapped->internal = error;
+  if (overlapped->event_handle) {
+    auto ev = kernel_state()->object_table()->LookupObject<XEvent>(
+        overlapped->event_handle);
+    if (ev) {
+      ev->Set(0, false);
+    }
+  }
+}
+
+// Receives into the guest buffers, through a bounce buffer if there are
+// several. Waits like recvfrom unless told otherwise.
+int RecvFromBuffers(XSocket* socket, const std::vector<XWSABUF>& buffers,
+                    uint32_t flags, XSOCKADDR_IN* from_ptr,
+                    xe::be<uint32_t>* fromlen_ptr, bool wait) {
+  uint32_t total_len = 0;
+  for (const auto& buffer : buffers) {
+    total_len += buffer.len;
+  }
+  std::vector<uint8_t> bounce_buffer;
+  uint8_t* data;
+  if (buffers.size() == 1) {
+    data = kernel_memory()->TranslateVirtual(buffers[0].buf_ptr);
+  } else {
+    bounce_buffer.resize(total_len);
+    data = bounce_buffer.data();
+  }
+
+  N_XSOCKADDR_IN native_from;
+  uint32_t native_fromlen = fromlen_ptr ? uint32_t(*fromlen_ptr) : 0;
+  int ret = wait ? socket->RecvFrom(data, total_len, flags, &native_from,
+                                    fromlen_ptr ? &native_fromlen : nullptr)
+                 : socket->TryRecvFrom(data, total_len, flags, &native_from,
+                                       fromlen_ptr ? &native_fromlen : nullptr);
+  if (ret < 0) {
+    return ret;
+  }
+
+  if (buffers.size() != 1) {
+    uint32_t offset = 0;
+    for (const auto& buffer : buffers) {
+      uint32_t len = std::min(uint32_t(buffer.len), uint32_t(ret) - offset);
+      std::memcpy(kernel_memory()->TranslateVirtual(buffer.buf_ptr),
+                  data + offset, len);
+      offset += len;
+    }
+  }
+  if (from_ptr) {
+    from_ptr->sin_family = native_from.sin_family;
+    from_ptr->sin_port = native_from.sin_port;
+    from_ptr->sin_addr = native_from.sin_addr;
+    std::memset(from_ptr->sin_zero, 0, 8);
+  }
+  if (fromlen_ptr) {
+    *fromlen_ptr = native_fromlen;
+  }
+  return ret;
+}
+
 void LoadSockaddr(const uint8_t* ptr, sockaddr* out_addr) {
   out_addr->sa_family = xe::load_and_swap<uint16_t>(ptr + 0);
   switch (out_addr->sa_family) {
@@ -271,25 +343,88 @@ DECLARE_XAM_EXPORT1(NetDll_WSACleanup, kNetworking, kImplemented);
 dword_result_t NetDll_WSAGetLastError() { return XThread::GetLastError(); }
 DECLARE_XAM_EXPORT1(NetDll_WSAGetLastError, kNetworking, kImplemented);
 
-dword_result_t NetDll_WSARecvFrom(dword_t caller, dword_t socket,
+dword_result_t NetDll_WSARecvFrom(dword_t caller, dword_t socket_handle,
                                   pointer_t<XWSABUF> buffers_ptr,
                                   dword_t buffer_count,
                                   lpdword_t num_bytes_recv, lpdword_t flags_ptr,
-                                  pointer_t<XSOCKADDR_IN> from_addr,
+                                  pointer_t<XSOCKADDR_IN> from_ptr,
+                                  lpdword_t fromlen_ptr,
                                   pointer_t<XWSAOVERLAPPED> overlapped_ptr,
                                   lpvoid_t completion_routine_ptr) {
-  if (overlapped_ptr) {
-    // auto evt = kernel_state()->object_table()->LookupObject<XEvent>(
-    //    overlapped_ptr->event_handle);
+  assert(!completion_routine_ptr);
 
-    // if (evt) {
-    //  //evt->Set(0, false);
-    //}
+  auto socket =
+      kernel_state()->object_table()->LookupObject<XSocket>(socket_handle);
+  if (!socket) {
+    // WSAENOTSOCK
+    XThread::SetLastError(0x2736);
+    return -1;
   }
 
-  return 0;
+  // The buffers must stay around for an overlapped request, the array needn't.
+  std::vector<XWSABUF> buffers(buffer_count);
+  for (uint32_t i = 0; i < buffer_count; i++) {
+    buffers[i] = buffers_ptr[i];
+  }
+  uint32_t flags = flags_ptr ? flags_ptr.value() : 0;
+  XSOCKADDR_IN* from = from_ptr;
+  xe::be<uint32_t>* fromlen = fromlen_ptr;
+  xe::be<uint32_t>* flags_out = flags_ptr;
+  XWSAOVERLAPPED* overlapped = overlapped_ptr;
+
+  int ret = RecvFromBuffers(socket.get(), buffers, flags, from, fromlen,
+                            !overlapped);
+  if (ret >= 0) {
+    if (num_bytes_recv) {
+      *num_bytes_recv = uint32_t(ret);
+    }
+    if (flags_ptr) {
+      *flags_ptr = 0;
+    }
+    if (overlapped) {
+      CompleteOverlapped(overlapped, 0, uint32_t(ret));
+    }
+    return 0;
+  }
+
+  uint32_t error = XSocket::GetLastError();
+  if (overlapped && error == 10035) {  // WSAEWOULDBLOCK
+    // Finished on the networking thread once data arrives.
+    overlapped->internal = X_STATUS_PENDING;
+    auto request = [socket, buffers, flags, from, fromlen, flags_out,
+                    overlapped](bool cancelled) {
+      if (cancelled) {
+        CompleteOverlapped(overlapped, 995, 0);  // WSA_OPERATION_ABORTED
+        return true;
+      }
+      int received =
+          RecvFromBuffers(socket.get(), buffers, flags, from, fromlen, false);
+      if (received < 0) {
+        uint32_t recv_error = XSocket::GetLastError();
+        if (recv_error == 10035) {
+          return false;
+        }
+        CompleteOverlapped(overlapped, recv_error, 0);
+        return true;
+      }
+      if (flags_out) {
+        *flags_out = 0;
+      }
+      CompleteOverlapped(overlapped, 0, uint32_t(received));
+      return true;
+    };
+    auto engine = kernel_state()->socket_engine();
+    if (engine->QueueRequest(socket->native_handle(), SocketEngine::kReadable,
+                             request)) {
+      error = 997;  // WSA_IO_PENDING
+    } else {
+      overlapped->internal = error;
+    }
+  }
+  XThread::SetLastError(error);
+  return -1;
 }
-DECLARE_XAM_EXPORT1(NetDll_WSARecvFrom, kNetworking, kStub);
+DECLARE_XAM_EXPORT2(NetDll_WSARecvFrom, kNetworking, kImplemented, kBlocking);
 
 // If the socket is a VDP socket, buffer 0 is the game data length, and buffer 1
 // is the unencrypted game data.
@@ -299,7 +434,6 @@ dword_result_t NetDll_WSASendTo(dword_t caller, dword_t socket_handle,
                                 pointer_t<XSOCKADDR_IN> to_ptr, dword_t to_len,
                                 pointer_t<XWSAOVERLAPPED> overlapped,
                                 lpvoid_t completion_routine) {
-  assert(!overlapped);
   assert(!completion_routine);
 
   auto socket =
@@ -327,14 +461,62 @@ dword_result_t NetDll_WSASendTo(dword_t caller, dword_t socket_handle,
   }
 
   N_XSOCKADDR_IN native_to(to_ptr);
-  socket->SendTo(combined_buffer_mem.data(), combined_buffer_size, flags,
-                 &native_to, to_len);
-
-  // TODO: Instantly complete overlapped
+  int ret = socket->SendTo(combined_buffer_mem.data(), combined_buffer_size,
+                           flags, &native_to, to_len);
+  if (ret < 0) {
+    uint32_t error = XSocket::GetLastError();
+    if (overlapped) {
+      CompleteOverlapped(overlapped, error, 0);
+    }
+    XThread::SetLastError(error);
+    return -1;
+  }
 
+  // Datagrams go out at once, so overlapped sends complete right away.
+  if (num_bytes_sent) {
+    *num_bytes_sent = uint32_t(ret);
+  }
+  if (overlapped) {
+    CompleteOverlapped(overlapped, 0, uint32_t(ret));
+  }
   return 0;
 }
-DECLARE_XAM_EXPORT1(NetDll_WSASendTo, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_WSASendTo, kNetworking, kImplemented, kBlocking);
+
+dword_result_t NetDll_WSAGetOverlappedResult(
+    dword_t caller, dword_t socket_handle,
+    pointer_t<XWSAOVERLAPPED> overlapped_ptr, lpdword_t bytes_transferred_ptr,
+    dword_t wait, lpdword_t flags_ptr) {
+  if (overlapped_ptr->internal == X_STATUS_PENDING) {
+    if (!wait) {
+      XThread::SetLastError(996);  // WSA_IO_INCOMPLETE
+      return 0;
+    }
+    auto ev = kernel_state()->object_table()->LookupObject<XEvent>(
+        overlapped_ptr->event_handle);
+    if (!ev) {
+      XThread::SetLastError(6);  // ERROR_INVALID_HANDLE
+      return 0;
+    }
+    while (overlapped_ptr->internal == X_STATUS_PENDING) {
+      ev->Wait(0, 0, false, nullptr);
+    }
+  }
+
+  if (bytes_transferred_ptr) {
+    *bytes_transferred_ptr = overlapped_ptr->internal_high;
+  }
+  if (flags_ptr) {
+    *flags_ptr = 0;
+  }
+  if (overlapped_ptr->internal) {
+    XThread::SetLastError(overlapped_ptr->internal);
+    return 0;
+  }
+  return 1;
+}
+DECLARE_XAM_EXPORT2(NetDll_WSAGetOverlappedResult, kNetworking, kImplemented,
+                    kBlocking);
 
 dword_result_t NetDll_WSAWaitForMultipleEvents(dword_t num_events,
                                                lpdword_t events,
@@ -686,13 +868,13 @@ dword_result_t NetDll_connect(dword_t caller, dword_t socket_handle,
   N_XSOCKADDR native_name(name);
   X_STATUS status = socket->Connect(&native_name, namelen);
   if (XFAILED(status)) {
-    XThread::SetLastError(xboxkrnl::xeRtlNtStatusToDosError(status));
+    XThread::SetLastError(XSocket::GetLastError());
     return -1;
   }
 
   return 0;
 }
-DECLARE_XAM_EXPORT1(NetDll_connect, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_connect, kNetworking, kImplemented, kBlocking);
 
 dword_result_t NetDll_listen(dword_t caller, dword_t socket_handle,
                              int_t backlog) {
@@ -741,10 +923,11 @@ dword_result_t NetDll_accept(dword_t caller, dword_t socket_handle,
 
     return new_socket->handle();
   } else {
+    XThread::SetLastError(XSocket::GetLastError());
     return -1;
   }
 }
-DECLARE_XAM_EXPORT1(NetDll_accept, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_accept, kNetworking, kImplemented, kBlocking);
 
 struct x_fd_set {
   xe::be<uint32_t> fd_count;
@@ -780,19 +963,12 @@ struct host_set {
     }
   }
 
-  void Store(fd_set* native_set) {
-    FD_ZERO(native_set);
-    for (uint32_t i = 0; i < this->count; ++i) {
-      FD_SET(this->sockets[i]->native_handle(), native_set);
-    }
-  }
-
-  void UpdateFrom(fd_set* native_set) {
+  // Keeps the sockets whose poll entries, in load order, came back ready.
+  void UpdateFrom(const SocketEngine::PollEntry* entries) {
     uint32_t new_count = 0;
     for (uint32_t i = 0; i < this->count; ++i) {
-      auto socket = this->sockets[i];
-      if (FD_ISSET(socket->native_handle(), native_set)) {
-        this->sockets[new_count++] = socket;
+      if (entries[i].ready_events) {
+        this->sockets[new_count++] = this->sockets[i];
       }
     }
     this->count = new_count;
@@ -804,54 +980,83 @@ int_result_t NetDll_select(int_t caller, int_t nfds,
                            pointer_t<x_fd_set> writefds,
                            pointer_t<x_fd_set> exceptfds,
                            lpvoid_t timeout_ptr) {
-  host_set host_readfds = {0};
-  fd_set native_readfds = {0};
-  if (readfds) {
-    host_readfds.Load(readfds);
-    host_readfds.Store(&native_readfds);
-  }
-  host_set host_writefds = {0};
-  fd_set native_writefds = {0};
-  if (writefds) {
-    host_writefds.Load(writefds);
-    host_writefds.Store(&native_writefds);
-  }
-  host_set host_exceptfds = {0};
-  fd_set native_exceptfds = {0};
-  if (exceptfds) {
-    host_exceptfds.Load(exceptfds);
-    host_exceptfds.Store(&native_exceptfds);
-  }
-  timeval* timeout_in = nullptr;
-  timeval timeout;
+  host_set host_sets[3] = {};
+  x_fd_set* guest_sets[3] = {readfds, writefds, exceptfds};
+  const uint32_t set_events[3] = {SocketEngine::kReadable,
+                                  SocketEngine::kWritable,
+                                  SocketEngine::kException};
+  std::vector<SocketEngine::PollEntry> entries;
+  for (int i = 0; i < 3; ++i) {
+    if (!guest_sets[i]) {
+      continue;
+    }
+    host_sets[i].Load(guest_sets[i]);
+    for (uint32_t j = 0; j < host_sets[i].count; ++j) {
+      entries.push_back(
+          {host_sets[i].sockets[j]->native_handle(), set_events[i], 0});
+    }
+  }
+
+  uint32_t timeout_ms = SocketEngine::kInfinite;
   if (timeout_ptr) {
-    timeout = {static_cast<int32_t>(timeout_ptr.as_array<int32_t>()[0]),
-               static_cast<int32_t>(timeout_ptr.as_array<int32_t>()[1])};
+    timeval timeout = {
+        static_cast<int32_t>(timeout_ptr.as_array<int32_t>()[0]),
+        static_cast<int32_t>(timeout_ptr.as_array<int32_t>()[1])};
     Clock::ScaleGuestDurationTimeval(
         reinterpret_cast<int32_t*>(&timeout.tv_sec),
         reinterpret_cast<int32_t*>(&timeout.tv_usec));
-    timeout_in = &timeout;
+    timeout_ms = uint32_t(std::max<int64_t>(
+        int64_t(timeout.tv_sec) * 1000 + (timeout.tv_usec + 999) / 1000, 0));
   }
-  int ret = select(nfds, readfds ? &native_readfds : nullptr,
-                   writefds ? &native_writefds : nullptr,
-                   exceptfds ? &native_exceptfds : nullptr, timeout_in);
-  if (readfds) {
-    host_readfds.UpdateFrom(&native_readfds);
-    host_readfds.Store(readfds);
+
+  // Rather than sleeping in the host select, check readiness and wait on the
+  // socket engine between checks.
+  int ret;
+  auto engine = kernel_state()->socket_engine();
+  if (engine->is_running() && timeout_ms && !entries.empty()) {
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(timeout_ms);
+    while (true) {
+      uint64_t generation = engine->generation();
+      ret = SocketEngine::Poll(entries.data(), entries.size(), 0);
+      if (ret) {
+        break;
+      }
+      uint32_t remaining_ms = SocketEngine::kInfinite;
+      if (timeout_ms != SocketEngine::kInfinite) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+        if (remaining.count() <= 0) {
+          break;
+        }
+        remaining_ms = uint32_t(remaining.count());
+      }
+      for (const auto& entry : entries) {
+        engine->Arm(entry.native_handle, entry.events);
+      }
+      engine->WaitForEvents(generation, remaining_ms);
+    }
+  } else {
+    ret = SocketEngine::Poll(entries.data(), entries.size(), timeout_ms);
   }
-  if (writefds) {
-    host_writefds.UpdateFrom(&native_writefds);
-    host_writefds.Store(writefds);
+
+  if (ret < 0) {
+    XThread::SetLastError(XSocket::GetLastError());
+    return -1;
   }
-  if (exceptfds) {
-    host_exceptfds.UpdateFrom(&native_exceptfds);
-    host_exceptfds.Store(exceptfds);
+  size_t offset = 0;
+  for (int i = 0; i < 3; ++i) {
+    if (!guest_sets[i]) {
+      continue;
+    }
+    uint32_t loaded_count = host_sets[i].count;
+    host_sets[i].UpdateFrom(entries.data() + offset);
+    host_sets[i].Store(guest_sets[i]);
+    offset += loaded_count;
   }
-
-  // TODO(gibbed): modify ret to be what's actually copied to the guest fd_sets?
   return ret;
 }
-DECLARE_XAM_EXPORT1(NetDll_select, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_select, kNetworking, kImplemented, kBlocking);
 
 dword_result_t NetDll_recv(dword_t caller, dword_t socket_handle,
                            lpvoid_t buf_ptr, dword_t buf_len, dword_t flags) {
@@ -863,9 +1068,13 @@ dword_result_t NetDll_recv(dword_t caller, dword_t socket_handle,
     return -1;
   }
 
-  return socket->Recv(buf_ptr, buf_len, flags);
+  int ret = socket->Recv(buf_ptr, buf_len, flags);
+  if (ret == -1) {
+    XThread::SetLastError(XSocket::GetLastError());
+  }
+  return ret;
 }
-DECLARE_XAM_EXPORT1(NetDll_recv, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_recv, kNetworking, kImplemented, kBlocking);
 
 dword_result_t NetDll_recvfrom(dword_t caller, dword_t socket_handle,
                                lpvoid_t buf_ptr, dword_t buf_len, dword_t flags,
@@ -898,18 +1107,12 @@ dword_result_t NetDll_recvfrom(dword_t caller, dword_t socket_handle,
   }
 
   if (ret == -1) {
-// TODO: Better way of getting the error code
-#ifdef XE_PLATFORM_WIN32
-    uint32_t error_code = WSAGetLastError();
-    XThread::SetLastError(error_code);
-#else
-    XThread::SetLastError(0x0);
-#endif
+    XThread::SetLastError(XSocket::GetLastError());
   }
 
   return ret;
 }
-DECLARE_XAM_EXPORT1(NetDll_recvfrom, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_recvfrom, kNetworking, kImplemented, kBlocking);
 
 dword_result_t NetDll_send(dword_t caller, dword_t socket_handle,
                            lpvoid_t buf_ptr, dword_t buf_len, dword_t flags) {
@@ -921,9 +1124,13 @@ dword_result_t NetDll_send(dword_t caller, dword_t socket_handle,
     return -1;
   }
 
-  return socket->Send(buf_ptr, buf_len, flags);
+  int ret = socket->Send(buf_ptr, buf_len, flags);
+  if (ret == -1) {
+    XThread::SetLastError(XSocket::GetLastError());
+  }
+  return ret;
 }
-DECLARE_XAM_EXPORT1(NetDll_send, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_send, kNetworking, kImplemented, kBlocking);
 
 dword_result_t NetDll_sendto(dword_t caller, dword_t socket_handle,
                              lpvoid_t buf_ptr, dword_t buf_len, dword_t flags,
@@ -937,9 +1144,13 @@ dword_result_t NetDll_sendto(dword_t caller, dword_t socket_handle,
   }
 
   N_XSOCKADDR_IN native_to(to_ptr);
-  return socket->SendTo(buf_ptr, buf_len, flags, &native_to, to_len);
+  int ret = socket->SendTo(buf_ptr, buf_len, flags, &native_to, to_len);
+  if (ret == -1) {
+    XThread::SetLastError(XSocket::GetLastError());
+  }
+  return ret;
 }
-DECLARE_XAM_EXPORT1(NetDll_sendto, kNetworking, kImplemented);
+DECLARE_XAM_EXPORT2(NetDll_sendto, kNetworking, kImplemented, kBlocking);
 
 void RegisterNetExports(xe::cpu::ExportResolver* export_resolver,
                         KernelState* kernel_state) {
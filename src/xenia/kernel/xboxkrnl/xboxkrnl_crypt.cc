@@ -7,23 +7,18 @@
 ******************************************************************************
 */
 
+#include "xenia/base/aes_cbc.h"
 #include "xenia/base/logging.h"
+#include "xenia/base/sha.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
 #include "xenia/xbox.h"
 
-#include "third_party/crypto/TinySHA1.hpp"
 #include "third_party/crypto/des/des.cpp"
 #include "third_party/crypto/des/des.h"
 #include "third_party/crypto/des/des3.h"
 #include "third_party/crypto/des/descbc.h"
-#include "third_party/crypto/sha256.cpp"
-#include "third_party/crypto/sha256.h"
-
-extern "C" {
-#include "third_party/aes_128/aes.h"
-}
 
 namespace xe {
 namespace kernel {
@@ -56,19 +51,21 @@ DECLARE_XBOXKRNL_EXPORT1(XeCryptRc4Key, kNone, kImplemented);
 
 void XeCryptRc4Ecb(pointer_t<XECRYPT_RC4_STATE> rc4_ctx, lpvoid_t data,
                    dword_t size) {
-  // Crypt data
+  // Crypt data, with the indices kept in locals rather than the guest state.
+  uint8_t* S = rc4_ctx->S;
+  uint8_t i = rc4_ctx->i;
+  uint8_t j = rc4_ctx->j;
+  uint8_t* bytes = data.as<uint8_t*>();
   for (uint32_t idx = 0; idx < size; idx++) {
-    rc4_ctx->i = (rc4_ctx->i + 1) % 0x100;
-    rc4_ctx->j = (rc4_ctx->j + rc4_ctx->S[rc4_ctx->i]) % 0x100;
-    uint8_t temp = rc4_ctx->S[rc4_ctx->i];
-    rc4_ctx->S[rc4_ctx->i] = rc4_ctx->S[rc4_ctx->j];
-    rc4_ctx->S[rc4_ctx->j] = temp;
-
-    uint8_t a = data[idx];
-    uint8_t b =
-        rc4_ctx->S[(rc4_ctx->S[rc4_ctx->i] + rc4_ctx->S[rc4_ctx->j]) % 0x100];
-    data[idx] = (uint8_t)(a ^ b);
+    i = uint8_t(i + 1);
+    j = uint8_t(j + S[i]);
+    uint8_t temp = S[i];
+    S[i] = S[j];
+    S[j] = temp;
+    bytes[idx] ^= S[uint8_t(S[i] + S[j])];
   }
+  rc4_ctx->i = i;
+  rc4_ctx->j = j;
 }
 DECLARE_XBOXKRNL_EXPORT1(XeCryptRc4Ecb, kNone, kImplemented);
 
@@ -86,22 +83,25 @@ typedef struct {
 } XECRYPT_SHA_STATE;
 static_assert_size(XECRYPT_SHA_STATE, 0x58);
 
-void InitSha1(sha1::SHA1* sha, const XECRYPT_SHA_STATE* state) {
-  uint32_t digest[5];
-  for (int i = 0; i < 5; i++) {
-    digest[i] = state->state[i];
+// The guest states hold what xe::ShaHasher needs to continue a hash, so the
+// input is hashed straight from guest memory.
+template <typename T, typename S>
+T LoadShaState(const S* state) {
+  uint32_t words[sizeof(S::state) / sizeof(uint32_t)];
+  for (size_t i = 0; i < xe::countof(words); i++) {
+    words[i] = state->state[i];
   }
-
-  sha->init(digest, state->buffer, state->count);
+  return T(words, state->count, state->buffer);
 }
 
-void StoreSha1(sha1::SHA1* sha, XECRYPT_SHA_STATE* state) {
-  for (int i = 0; i < 5; i++) {
-    state->state[i] = sha->getDigest()[i];
+template <typename S>
+void StoreShaState(const xe::ShaHasher& sha, S* state) {
+  for (size_t i = 0; i < xe::countof(state->state); i++) {
+    state->state[i] = sha.state()[i];
   }
-
-  state->count = static_cast<uint32_t>(sha->getByteCount());
-  std::memcpy(state->buffer, sha->getBlock(), sha->getBlockByteIndex());
+  state->count = static_cast<uint32_t>(sha.byte_count());
+  std::memcpy(state->buffer, sha.partial_block(),
+              size_t(sha.byte_count() % xe::ShaHasher::kBlockSize));
 }
 
 void XeCryptShaInit(pointer_t<XECRYPT_SHA_STATE> sha_state) {
@@ -117,22 +117,20 @@ DECLARE_XBOXKRNL_EXPORT1(XeCryptShaInit, kNone, kImplemented);
 
 void XeCryptShaUpdate(pointer_t<XECRYPT_SHA_STATE> sha_state, lpvoid_t input,
                       dword_t input_size) {
-  sha1::SHA1 sha;
-  InitSha1(&sha, sha_state);
+  auto sha = LoadShaState<xe::Sha1, XECRYPT_SHA_STATE>(sha_state);
 
-  sha.processBytes(input, input_size);
+  sha.Update(input, input_size);
 
-  StoreSha1(&sha, sha_state);
+  StoreShaState<XECRYPT_SHA_STATE>(sha, sha_state);
 }
 DECLARE_XBOXKRNL_EXPORT1(XeCryptShaUpdate, kNone, kImplemented);
 
 void XeCryptShaFinal(pointer_t<XECRYPT_SHA_STATE> sha_state,
                      pointer_t<xe::be<uint32_t>> out, dword_t out_size) {
-  sha1::SHA1 sha;
-  InitSha1(&sha, sha_state);
+  auto sha = LoadShaState<xe::Sha1, XECRYPT_SHA_STATE>(sha_state);
 
   uint8_t digest[0x14];
-  sha.finalize(digest);
+  sha.Final(digest);
 
   std::memcpy(out, digest, std::min((uint32_t)out_size, 0x14u));
   std::memcpy(sha_state->state, digest, 0x14);
@@ -142,20 +140,20 @@ DECLARE_XBOXKRNL_EXPORT1(XeCryptShaFinal, kNone, kImplemented);
 void XeCryptSha(lpvoid_t input_1, dword_t input_1_size, lpvoid_t input_2,
                 dword_t input_2_size, lpvoid_t input_3, dword_t input_3_size,
                 lpvoid_t output, dword_t output_size) {
-  sha1::SHA1 sha;
+  xe::Sha1 sha;
 
   if (input_1 && input_1_size) {
-    sha.processBytes(input_1, input_1_size);
+    sha.Update(input_1, input_1_size);
   }
   if (input_2 && input_2_size) {
-    sha.processBytes(input_2, input_2_size);
+    sha.Update(input_2, input_2_size);
   }
   if (input_3 && input_3_size) {
-    sha.processBytes(input_3, input_3_size);
+    sha.Update(input_3, input_3_size);
   }
 
   uint8_t digest[0x14];
-  sha.finalize(digest);
+  sha.Final(digest);
   std::memcpy(output, digest, std::min((uint32_t)output_size, 0x14u));
 }
 DECLARE_XBOXKRNL_EXPORT1(XeCryptSha, kNone, kImplemented);
@@ -183,28 +181,20 @@ DECLARE_XBOXKRNL_EXPORT1(XeCryptSha256Init, kNone, kImplemented);
 
 void XeCryptSha256Update(pointer_t<XECRYPT_SHA256_STATE> sha_state,
                          lpvoid_t input, dword_t input_size) {
-  sha256::SHA256 sha;
-  std::memcpy(sha.getHashValues(), sha_state->state, 8 * 4);
-  std::memcpy(sha.getBuffer(), sha_state->buffer, 64);
-  sha.setTotalSize(sha_state->count);
+  auto sha = LoadShaState<xe::Sha256, XECRYPT_SHA256_STATE>(sha_state);
 
-  sha.add(input, input_size);
+  sha.Update(input, input_size);
 
-  std::memcpy(sha_state->state, sha.getHashValues(), 8 * 4);
-  std::memcpy(sha_state->buffer, sha.getBuffer(), 64);
-  sha_state->count = uint32_t(sha.getTotalSize());
+  StoreShaState<XECRYPT_SHA256_STATE>(sha, sha_state);
 }
 DECLARE_XBOXKRNL_EXPORT1(XeCryptSha256Update, kNone, kImplemented);
 
 void XeCryptSha256Final(pointer_t<XECRYPT_SHA256_STATE> sha_state,
                         pointer_t<xe::be<uint32_t>> out, dword_t out_size) {
-  sha256::SHA256 sha;
-  std::memcpy(sha.getHashValues(), sha_state->state, 8 * 4);
-  std::memcpy(sha.getBuffer(), sha_state->buffer, 64);
-  sha.setTotalSize(sha_state->count);
+  auto sha = LoadShaState<xe::Sha256, XECRYPT_SHA256_STATE>(sha_state);
 
   uint32_t hash[8];
-  sha.getHash(reinterpret_cast<uint8_t*>(hash));
+  sha.Final(reinterpret_cast<uint8_t*>(hash));
 
   std::memcpy(out, hash, std::min(uint32_t(out_size), 32u));
   std::memcpy(sha_state->buffer, hash, 32);
@@ -303,8 +293,8 @@ void XeCryptDes3Cbc(pointer_t<XECRYPT_DES3_STATE> state_ptr, lpqword_t inp,
 DECLARE_XBOXKRNL_EXPORT1(XeCryptDes3Cbc, kNone, kImplemented);
 
 struct XECRYPT_AES_STATE {
-  uint8_t keytabenc[11][4][4];  // 0x0
-  uint8_t keytabdec[11][4][4];  // 0xB0
+  uint8_t keytabenc[11][16];  // 0x0
+  uint8_t keytabdec[11][16];  // 0xB0
 };
 static_assert_size(XECRYPT_AES_STATE, 0x160);
 
@@ -313,9 +303,9 @@ static inline uint8_t xeXeCryptAesMul2(uint8_t a) {
 }
 
 void XeCryptAesKey(pointer_t<XECRYPT_AES_STATE> state_ptr, lpvoid_t key) {
-  aes_key_schedule_128(key, reinterpret_cast<uint8_t*>(state_ptr->keytabenc));
-  // Decryption key schedule not needed by openluopworld/aes_128, but generated
-  // to fill the context structure properly.
+  xe::Aes128ExpandKey(key, state_ptr->keytabenc);
+  // Decryption key schedule not needed by xe::Aes128Decrypt, but generated to
+  // fill the context structure properly.
   std::memcpy(state_ptr->keytabdec[0], state_ptr->keytabenc[10], 16);
   // Inverse MixColumns.
   for (uint32_t i = 1; i < 10; ++i) {
@@ -379,12 +369,10 @@ DECLARE_XBOXKRNL_EXPORT1(XeCryptAesKey, kNone, kImplemented);
 
 void XeCryptAesEcb(pointer_t<XECRYPT_AES_STATE> state_ptr, lpvoid_t inp_ptr,
                    lpvoid_t out_ptr, dword_t encrypt) {
-  const uint8_t* keytab =
-      reinterpret_cast<const uint8_t*>(state_ptr->keytabenc);
   if (encrypt) {
-    aes_encrypt_128(keytab, inp_ptr, out_ptr);
+    xe::Aes128Encrypt(state_ptr->keytabenc, nullptr, inp_ptr, 1, out_ptr);
   } else {
-    aes_decrypt_128(keytab, inp_ptr, out_ptr);
+    xe::Aes128Decrypt(state_ptr->keytabenc, nullptr, inp_ptr, 1, out_ptr);
   }
 }
 DECLARE_XBOXKRNL_EXPORT1(XeCryptAesEcb, kNone, kImplemented);
@@ -392,34 +380,13 @@ DECLARE_XBOXKRNL_EXPORT1(XeCryptAesEcb, kNone, kImplemented);
 void XeCryptAesCbc(pointer_t<XECRYPT_AES_STATE> state_ptr, lpvoid_t inp_ptr,
                    dword_t inp_size, lpvoid_t out_ptr, lpvoid_t feed_ptr,
                    dword_t encrypt) {
-  const uint8_t* keytab =
-      reinterpret_cast<const uint8_t*>(state_ptr->keytabenc);
-  const uint8_t* inp = inp_ptr.as<const uint8_t*>();
-  uint8_t* out = out_ptr.as<uint8_t*>();
-  uint8_t* feed = feed_ptr.as<uint8_t*>();
+  // The feed is updated in place, so chained calls continue the stream.
   if (encrypt) {
-    for (uint32_t i = 0; i < inp_size; i += 16) {
-      for (uint32_t j = 0; j < 16; ++j) {
-        feed[j] ^= inp[j];
-      }
-      aes_encrypt_128(keytab, feed, feed);
-      std::memcpy(out, feed, 16);
-      inp += 16;
-      out += 16;
-    }
+    xe::Aes128Encrypt(state_ptr->keytabenc, feed_ptr, inp_ptr, inp_size / 16,
+                      out_ptr);
   } else {
-    for (uint32_t i = 0; i < inp_size; i += 16) {
-      // In case inp == out.
-      uint8_t tmp[16];
-      std::memcpy(tmp, inp, 16);
-      aes_decrypt_128(keytab, inp, out);
-      for (uint32_t j = 0; j < 16; ++j) {
-        out[j] ^= feed[j];
-      }
-      std::memcpy(feed, tmp, 16);
-      inp += 16;
-      out += 16;
-    }
+    xe::Aes128Decrypt(state_ptr->keytabenc, feed_ptr, inp_ptr, inp_size / 16,
+                      out_ptr);
   }
 }
 DECLARE_XBOXKRNL_EXPORT1(XeCryptAesCbc, kNone, kImplemented);
@@ -429,7 +396,6 @@ void XeCryptHmacSha(lpvoid_t key, dword_t key_size_in, lpvoid_t inp_1,
                     lpvoid_t inp_3, dword_t inp_3_size, lpvoid_t out,
                     dword_t out_size) {
   uint32_t key_size = key_size_in;
-  sha1::SHA1 sha;
   uint8_t kpad_i[0x40];
   uint8_t kpad_o[0x40];
   uint8_t tmp_key[0x40];
@@ -439,9 +405,9 @@ void XeCryptHmacSha(lpvoid_t key, dword_t key_size_in, lpvoid_t inp_1,
   // Setup HMAC key
   // If > block size, use its hash
   if (key_size > 0x40) {
-    sha1::SHA1 sha_key;
-    sha_key.processBytes(key, key_size);
-    sha_key.finalize((uint8_t*)tmp_key);
+    xe::Sha1 sha_key;
+    sha_key.Update(key, key_size);
+    sha_key.Final(tmp_key);
 
     key_size = 0x14u;
   } else {
@@ -454,28 +420,29 @@ void XeCryptHmacSha(lpvoid_t key, dword_t key_size_in, lpvoid_t inp_1,
   }
 
   // Inner
-  sha.processBytes(kpad_i, 0x40);
+  xe::Sha1 sha;
+  sha.Update(kpad_i, 0x40);
 
   if (inp_1_size) {
-    sha.processBytes(inp_1, inp_1_size);
+    sha.Update(inp_1, inp_1_size);
   }
 
   if (inp_2_size) {
-    sha.processBytes(inp_2, inp_2_size);
+    sha.Update(inp_2, inp_2_size);
   }
 
   if (inp_3_size) {
-    sha.processBytes(inp_3, inp_3_size);
+    sha.Update(inp_3, inp_3_size);
   }
 
   uint8_t digest[0x14];
-  sha.finalize(digest);
-  sha.reset();
+  sha.Final(digest);
 
   // Outer
-  sha.processBytes(kpad_o, 0x40);
-  sha.processBytes(digest, 0x14);
-  sha.finalize(digest);
+  xe::Sha1 sha_outer;
+  sha_outer.Update(kpad_o, 0x40);
+  sha_outer.Update(digest, 0x14);
+  sha_outer.Final(digest);
 
   std::memcpy(out, digest, std::min((uint32_t)out_size, 0x14u));
 }
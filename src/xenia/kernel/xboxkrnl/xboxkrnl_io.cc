@@ -146,6 +146,74 @@ dword_result_t NtOpenFile(lpdword_t handle_out, dword_t desired_access,
 }
 DECLARE_XBOXKRNL_EXPORT1(NtOpenFile, kFileSystem, kImplemented);
 
+// Completes a transfer as the kernel does: the status block is written, then
+// the APC is queued to the thread that issued it and the event signaled.
+void CompleteFileIO(X_STATUS result, size_t bytes_transferred,
+                    uint32_t io_status_block_ptr, XEvent* ev, XThread* thread,
+                    uint32_t apc_routine, uint32_t apc_context) {
+  if (io_status_block_ptr) {
+    auto io_status_block =
+        kernel_memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+            io_status_block_ptr);
+    io_status_block->status = result;
+    io_status_block->information = static_cast<uint32_t>(bytes_transferred);
+  }
+
+  // Queue the APC callback. It must be delivered via the APC mechanism even
+  // though were are completing immediately.
+  if (apc_routine && apc_context) {
+    thread->EnqueueApc(apc_routine, apc_context, io_status_block_ptr, 0);
+  }
+
+  if (ev) {
+    ev->Set(0, false);
+  }
+}
+
+// Hands a transfer on an asynchronous file to the async I/O engine, leaving
+// its status block pending. The transfer and its completion (including the
+// file object and I/O completion ports, through XFile) happen on a worker.
+// Returns false if the engine can't take it, and the caller must do the
+// transfer itself.
+bool QueueFileIO(object_ref<XFile> file, object_ref<XEvent> ev, bool is_write,
+                 void* buffer, uint32_t buffer_length, uint64_t byte_offset,
+                 uint32_t io_status_block_ptr, uint32_t apc_routine,
+                 uint32_t apc_context) {
+  auto async_io_engine = kernel_state()->async_io_engine();
+  // Transfers at the current position stay synchronous, as the position
+  // depends on their order.
+  if (file->is_synchronous() || !async_io_engine->is_running() ||
+      byte_offset == uint64_t(-1)) {
+    return false;
+  }
+
+  if (ev) {
+    ev->Reset();
+  }
+  if (io_status_block_ptr) {
+    auto io_status_block =
+        kernel_memory()->TranslateVirtual<X_IO_STATUS_BLOCK*>(
+            io_status_block_ptr);
+    io_status_block->status = X_STATUS_PENDING;
+    io_status_block->information = 0;
+  }
+
+  auto thread = retain_object(XThread::GetCurrentThread());
+  return async_io_engine->Enqueue([file, ev, thread, is_write, buffer,
+                                   buffer_length, byte_offset,
+                                   io_status_block_ptr, apc_routine,
+                                   apc_context]() {
+    size_t bytes_transferred = 0;
+    X_STATUS result =
+        is_write ? file->Write(buffer, buffer_length, byte_offset,
+                               &bytes_transferred, apc_context)
+                 : file->Read(buffer, buffer_length, byte_offset,
+                              &bytes_transferred, apc_context);
+    CompleteFileIO(result, bytes_transferred, io_status_block_ptr, ev.get(),
+                   thread.get(), apc_routine, apc_context);
+  });
+}
+
 dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
                           lpvoid_t apc_routine_ptr, lpvoid_t apc_context,
                           pointer_t<X_IO_STATUS_BLOCK> io_status_block,
@@ -153,7 +221,6 @@ dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
                           lpqword_t byte_offset_ptr) {
   X_STATUS result = X_STATUS_SUCCESS;
 
-  bool signal_event = false;
   auto ev = kernel_state()->object_table()->LookupObject<XEvent>(event_handle);
   if (event_handle && !ev) {
     result = X_STATUS_INVALID_HANDLE;
@@ -165,62 +232,34 @@ dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
   }
 
   if (XSUCCEEDED(result)) {
-    if (true || file->is_synchronous()) {
-      // some games NtReadFile() directly into texture memory
-      // TODO(rick): better checking of physical address
-      if (buffer.guest_address() >= 0xA0000000) {
-        auto heap = kernel_memory()->LookupHeap(buffer.guest_address());
-        cpu::MMIOHandler::global_handler()->InvalidateRange(
-            heap->GetPhysicalAddress(buffer.guest_address()), buffer_length);
-      }
+    // some games NtReadFile() directly into texture memory
+    // TODO(rick): better checking of physical address
+    if (buffer.guest_address() >= 0xA0000000) {
+      auto heap = kernel_memory()->LookupHeap(buffer.guest_address());
+      cpu::MMIOHandler::global_handler()->InvalidateRange(
+          heap->GetPhysicalAddress(buffer.guest_address()), buffer_length);
+    }
 
+    uint64_t byte_offset =
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1;
+    // Low bit probably means do not queue to IO ports.
+    uint32_t apc_routine = static_cast<uint32_t>(apc_routine_ptr) & ~1u;
+    if (QueueFileIO(file, ev, false, buffer, buffer_length, byte_offset,
+                    io_status_block.guest_address(), apc_routine,
+                    apc_context)) {
+      result = X_STATUS_PENDING;
+    } else {
       // Synchronous.
       size_t bytes_read = 0;
-      result = file->Read(
-          buffer, buffer_length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_read, apc_context);
-      if (io_status_block) {
-        io_status_block->status = result;
-        io_status_block->information = static_cast<uint32_t>(bytes_read);
-      }
-
-      // Queue the APC callback. It must be delivered via the APC mechanism even
-      // though were are completing immediately.
-      // Low bit probably means do not queue to IO ports.
-      if ((uint32_t)apc_routine_ptr & ~1) {
-        if (apc_context) {
-          auto thread = XThread::GetCurrentThread();
-          thread->EnqueueApc(static_cast<uint32_t>(apc_routine_ptr) & ~1u,
-                             apc_context, io_status_block, 0);
-        }
-      }
+      result = file->Read(buffer, buffer_length, byte_offset, &bytes_read,
+                          apc_context);
+      CompleteFileIO(result, bytes_read, io_status_block.guest_address(),
+                     ev.get(), XThread::GetCurrentThread(), apc_routine,
+                     apc_context);
 
       if (!file->is_synchronous()) {
         result = X_STATUS_PENDING;
       }
-
-      // Mark that we should signal the event now. We do this after
-      // we have written the info out.
-      signal_event = true;
-    } else {
-      // TODO(benvanik): async.
-
-      // X_STATUS_PENDING if not returning immediately.
-      // XFile is waitable and signalled after each async req completes.
-      // reset the input event (->Reset())
-      /*xeNtReadFileState* call_state = new xeNtReadFileState();
-      XAsyncRequest* request = new XAsyncRequest(
-      state, file,
-      (XAsyncRequest::CompletionCallback)xeNtReadFileCompleted,
-      call_state);*/
-      // result = file->Read(buffer, buffer_length, byte_offset, request);
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_PENDING;
-        io_status_block->information = 0;
-      }
-
-      result = X_STATUS_PENDING;
     }
   }
 
@@ -229,10 +268,6 @@ dword_result_t NtReadFile(dword_t file_handle, dword_t event_handle,
     io_status_block->information = 0;
   }
 
-  if (ev && signal_event) {
-    ev->Set(0, false);
-  }
-
   return result;
 }
 DECLARE_XBOXKRNL_EXPORT2(NtReadFile, kFileSystem, kImplemented, kHighFrequency);
@@ -242,14 +277,9 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
                            pointer_t<X_IO_STATUS_BLOCK> io_status_block,
                            lpvoid_t buffer, dword_t buffer_length,
                            lpqword_t byte_offset_ptr) {
-  // Async not supported yet.
-  assert_zero(apc_routine);
-
   X_STATUS result = X_STATUS_SUCCESS;
-  uint32_t info = 0;
 
   // Grab event to signal.
-  bool signal_event = false;
   auto ev = kernel_state()->object_table()->LookupObject<XEvent>(event_handle);
   if (event_handle && !ev) {
     result = X_STATUS_INVALID_HANDLE;
@@ -263,39 +293,25 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
 
   // Execute write.
   if (XSUCCEEDED(result)) {
-    // TODO(benvanik): async path.
-    if (true || file->is_synchronous()) {
+    uint64_t byte_offset =
+        byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1;
+    uint32_t apc_routine_ptr = static_cast<uint32_t>(apc_routine) & ~1u;
+    if (QueueFileIO(file, ev, true, buffer, buffer_length, byte_offset,
+                    io_status_block.guest_address(), apc_routine_ptr,
+                    apc_context)) {
+      result = X_STATUS_PENDING;
+    } else {
       // Synchronous request.
       size_t bytes_written = 0;
-      result = file->Write(
-          buffer, buffer_length,
-          byte_offset_ptr ? static_cast<uint64_t>(*byte_offset_ptr) : -1,
-          &bytes_written, apc_context);
-      if (XSUCCEEDED(result)) {
-        info = (int32_t)bytes_written;
-      }
+      result = file->Write(buffer, buffer_length, byte_offset, &bytes_written,
+                           apc_context);
+      CompleteFileIO(result, bytes_written, io_status_block.guest_address(),
+                     ev.get(), XThread::GetCurrentThread(), apc_routine_ptr,
+                     apc_context);
 
       if (!file->is_synchronous()) {
         result = X_STATUS_PENDING;
       }
-
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_SUCCESS;
-        io_status_block->information = info;
-      }
-
-      // Mark that we should signal the event now. We do this after
-      // we have written the info out.
-      signal_event = true;
-    } else {
-      // X_STATUS_PENDING if not returning immediately.
-      result = X_STATUS_PENDING;
-      info = 0;
-
-      if (io_status_block) {
-        io_status_block->status = X_STATUS_SUCCESS;
-        io_status_block->information = info;
-      }
     }
   }
 
@@ -304,10 +320,6 @@ dword_result_t NtWriteFile(dword_t file_handle, dword_t event_handle,
     io_status_block->information = 0;
   }
 
-  if (ev && signal_event) {
-    ev->Set(0, false);
-  }
-
   return result;
 }
 DECLARE_XBOXKRNL_EXPORT1(NtWriteFile, kFileSystem, kImplemented);
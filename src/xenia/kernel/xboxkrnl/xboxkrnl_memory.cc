@@ -11,6 +11,7 @@
 
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/cpu/processor.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/util/shim_utils.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
@@ -198,6 +199,8 @@ dword_result_t NtProtectVirtualMemory(lpdword_t base_addr_ptr,
   if (!heap->Protect(adjusted_base, adjusted_size, protect, &tmp_old_protect)) {
     return X_STATUS_ACCESS_DENIED;
   }
+  kernel_state()->processor()->OnGuestProtectionChanged(adjusted_base,
+                                                        adjusted_size, protect);
 
   // Write back output variables.
   *base_addr_ptr = adjusted_base;
@@ -378,7 +381,10 @@ void MmSetAddressProtect(lpvoid_t base_address, dword_t region_size,
                          dword_t protect_bits) {
   uint32_t protect = FromXdkProtectFlags(protect_bits);
   auto heap = kernel_memory()->LookupHeap(base_address);
-  heap->Protect(base_address.guest_address(), region_size, protect);
+  if (heap->Protect(base_address.guest_address(), region_size, protect)) {
+    kernel_state()->processor()->OnGuestProtectionChanged(
+        base_address.guest_address(), region_size, protect);
+  }
 }
 DECLARE_XBOXKRNL_EXPORT1(MmSetAddressProtect, kMemory, kImplemented);
 
@@ -528,16 +534,11 @@ DECLARE_XBOXKRNL_EXPORT1(MmMapIoSpace, kMemory, kImplemented);
 
 dword_result_t ExAllocatePoolTypeWithTag(dword_t size, dword_t tag,
                                          dword_t zero) {
-  uint32_t alignment = 8;
-  uint32_t adjusted_size = size;
-  if (adjusted_size < 4 * 1024) {
-    adjusted_size = xe::round_up(adjusted_size, 4 * 1024);
-  } else {
-    alignment = 4 * 1024;
-  }
-
-  uint32_t addr =
-      kernel_state()->memory()->SystemHeapAlloc(adjusted_size, alignment);
+  // Small allocations go to the system pool slabs, larger ones (or all of
+  // them with the slabs off) take whole pages from the system heap.
+  uint32_t alignment = size < 4 * 1024 ? 8 : 4 * 1024;
+  uint32_t addr = kernel_state()->memory()->SystemHeapAlloc(
+      size, alignment, kSystemHeapDefault, tag);
 
   return addr;
 }
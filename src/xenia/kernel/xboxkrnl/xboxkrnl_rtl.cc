@@ -167,8 +167,9 @@ DECLARE_XBOXKRNL_EXPORT1(RtlFreeAnsiString, kNone, kImplemented);
 void RtlInitUnicodeString(pointer_t<X_UNICODE_STRING> destination,
                           lpwstring_t source) {
   if (source) {
-    destination->length = (uint16_t)source.value().size() * 2;
-    destination->maximum_length = (uint16_t)(source.value().size() + 1) * 2;
+    size_t length = source.length();
+    destination->length = (uint16_t)length * 2;
+    destination->maximum_length = (uint16_t)(length + 1) * 2;
     destination->pointer = source.guest_address();
   } else {
     destination->reset();
@@ -7,11 +7,12 @@
  ******************************************************************************
  */
 
+#include <algorithm>
+#include <cstdio>
 #include <cstring>
-#include <iomanip>
-#include <sstream>
 
 #include "xenia/base/logging.h"
+#include "xenia/base/string_buffer.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/user_module.h"
 #include "xenia/kernel/util/shim_utils.h"
@@ -79,37 +80,35 @@ class ArgList {
 // "Format Specification Syntax: printf and wprintf Functions"
 // https://msdn.microsoft.com/en-us/library/56e442dc.aspx
 
-std::string format_double(double value, int32_t precision, uint16_t c,
-                          uint32_t flags) {
+// Formats into buffer as a stream would with the corresponding manipulators,
+// which are defined in terms of these conversions, and returns the length.
+int32_t format_double(char* buffer, size_t buffer_length, double value,
+                      int32_t precision, uint16_t c, uint32_t flags) {
   if (precision < 0) {
     precision = 6;
   } else if (precision == 0 && c == 'g') {
     precision = 1;
   }
 
-  std::ostringstream temp;
-  temp << std::setprecision(precision);
-
-  if (c == 'f') {
-    temp << std::fixed;
-  } else if (c == 'e' || c == 'E') {
-    temp << std::scientific;
-  } else if (c == 'a' || c == 'A') {
-    temp << std::hexfloat;
-  } else if (c == 'g' || c == 'G') {
-    temp << std::defaultfloat;
-  }
-
-  if (c == 'E' || c == 'G' || c == 'A') {
-    temp << std::uppercase;
-  }
-
+  char format[8];
+  char* p = format;
+  *p++ = '%';
   if (flags & FF_AddPrefix) {
-    temp << std::showpoint;
+    *p++ = '#';
   }
-
-  temp << value;
-  return temp.str();
+  if (c != 'a' && c != 'A') {
+    // Hexfloat ignores the precision.
+    *p++ = '.';
+    *p++ = '*';
+  }
+  *p++ = char(c);
+  *p = '\0';
+
+  int length = (c == 'a' || c == 'A')
+                   ? std::snprintf(buffer, buffer_length, format, value)
+                   : std::snprintf(buffer, buffer_length, format, precision,
+                                   value);
+  return std::min(length, int(buffer_length) - 1);
 }
 
 int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
@@ -473,16 +472,12 @@ int32_t format_core(PPCContext* ppc_context, FormatData& data, ArgList& args,
               flags |= FF_AddNegative;
             }
 
-            auto s = format_double(value, precision, c, flags);
-            auto length = (int32_t)s.size();
-            assert_true(length < xe::countof(work));
-
             auto start = &work[0];
+            int32_t length = format_double(start, xe::countof(work), value,
+                                           precision, c, flags);
+            assert_true(length >= 0);
             auto end = &start[length];
 
-            std::memcpy(start, s.c_str(), length);
-            end[0] = '\0';
-
             text.buffer = start;
             text.length = (int32_t)(end - start);
             text.is_wide = false;
@@ -738,15 +733,15 @@ class StringFormatData : public FormatData {
     if (c >= 0x100) {
       return false;
     }
-    output_ << (char)c;
+    output_.Append(char(c));
     return true;
   }
 
-  std::string str() const { return output_.str(); }
+  const char* output() const { return output_.data(); }
 
  private:
   const uint8_t* input_;
-  std::ostringstream output_;
+  StackStringBuffer<char, 512> output_;
 };
 
 class WideStringFormatData : public FormatData {
@@ -772,15 +767,15 @@ class WideStringFormatData : public FormatData {
   }
 
   bool put(uint16_t c) {
-    output_ << (wchar_t)c;
+    output_.Append(c);
     return true;
   }
 
-  std::wstring wstr() const { return output_.str(); }
+  const uint16_t* output() const { return output_.data(); }
 
  private:
   const uint16_t* input_;
-  std::wostringstream output_;
+  StackStringBuffer<uint16_t, 512> output_;
 };
 
 class WideCountFormatData : public FormatData {
@@ -834,7 +829,7 @@ SHIM_CALL DbgPrint_shim(PPCContext* ppc_context, KernelState* kernel_state) {
     return;
   }
 
-  XELOGD("(DbgPrint) %s", data.str().c_str());
+  XELOGD("(DbgPrint) %s", data.output());
 
   SHIM_SET_RETURN_32(X_STATUS_SUCCESS);
 }
@@ -865,12 +860,12 @@ SHIM_CALL _snprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
       buffer[0] = '\0';  // write a null, just to be safe
     }
   } else if (count <= buffer_count) {
-    std::memcpy(buffer, data.str().c_str(), count);
+    std::memcpy(buffer, data.output(), count);
     if (count < buffer_count) {
       buffer[count] = '\0';
     }
   } else {
-    std::memcpy(buffer, data.str().c_str(), buffer_count);
+    std::memcpy(buffer, data.output(), buffer_count);
     count = -1;  // for return value
   }
   SHIM_SET_RETURN_32(count);
@@ -898,7 +893,7 @@ SHIM_CALL sprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    std::memcpy(buffer, data.str().c_str(), count);
+    std::memcpy(buffer, data.output(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -930,12 +925,12 @@ SHIM_CALL _snwprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
       buffer[0] = '\0';  // write a null, just to be safe
     }
   } else if (count <= buffer_count) {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
+    xe::copy_and_swap(buffer, data.output(), count);
     if (count < buffer_count) {
       buffer[count] = '\0';
     }
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), buffer_count);
+    xe::copy_and_swap(buffer, data.output(), buffer_count);
     count = -1;  // for return value
   }
   SHIM_SET_RETURN_32(count);
@@ -963,7 +958,7 @@ SHIM_CALL swprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
+    xe::copy_and_swap(buffer, data.output(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -998,13 +993,13 @@ SHIM_CALL _vsnprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
     }
   } else if (count <= buffer_count) {
     // Fit within the buffer.
-    std::memcpy(buffer, data.str().c_str(), count);
+    std::memcpy(buffer, data.output(), count);
     if (count < buffer_count) {
       buffer[count] = '\0';
     }
   } else {
     // Overflowed buffer. We still return the count we would have written.
-    std::memcpy(buffer, data.str().c_str(), buffer_count);
+    std::memcpy(buffer, data.output(), buffer_count);
   }
   SHIM_SET_RETURN_32(count);
 }
@@ -1038,13 +1033,13 @@ SHIM_CALL _vsnwprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
     }
   } else if (count <= buffer_count) {
     // Fit within the buffer.
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
+    xe::copy_and_swap(buffer, data.output(), count);
     if (count < buffer_count) {
       buffer[count] = '\0';
     }
   } else {
     // Overflowed buffer. We still return the count we would have written.
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), buffer_count);
+    xe::copy_and_swap(buffer, data.output(), buffer_count);
   }
   SHIM_SET_RETURN_32(count);
 }
@@ -1072,7 +1067,7 @@ SHIM_CALL vsprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    std::memcpy(buffer, data.str().c_str(), count);
+    std::memcpy(buffer, data.output(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -1123,7 +1118,7 @@ SHIM_CALL vswprintf_shim(PPCContext* ppc_context, KernelState* kernel_state) {
   if (count <= 0) {
     buffer[0] = '\0';
   } else {
-    xe::copy_and_swap(buffer, (uint16_t*)data.wstr().c_str(), count);
+    xe::copy_and_swap(buffer, data.output(), count);
     buffer[count] = '\0';
   }
   SHIM_SET_RETURN_32(count);
@@ -97,7 +97,7 @@ X_STATUS XFile::Read(void* buffer, size_t buffer_length, size_t byte_offset,
 
   size_t bytes_read = 0;
   X_STATUS result =
-      file_->ReadSync(buffer, buffer_length, byte_offset, &bytes_read);
+      file_->Read(buffer, buffer_length, byte_offset, &bytes_read);
   if (XSUCCEEDED(result)) {
     position_ += bytes_read;
   }
@@ -127,7 +127,7 @@ X_STATUS XFile::Write(const void* buffer, size_t buffer_length,
 
   size_t bytes_written = 0;
   X_STATUS result =
-      file_->WriteSync(buffer, buffer_length, byte_offset, &bytes_written);
+      file_->Write(buffer, buffer_length, byte_offset, &bytes_written);
   if (XSUCCEEDED(result)) {
     position_ += bytes_written;
   }
@@ -10,6 +10,7 @@
 #ifndef XENIA_KERNEL_XFILE_H_
 #define XENIA_KERNEL_XFILE_H_
 
+#include <atomic>
 #include <string>
 
 #include "xenia/base/filesystem.h"
@@ -133,7 +134,8 @@ class XFile : public XObject {
 
   // TODO(benvanik): create flags, open state, etc.
 
-  size_t position_ = 0;
+  // Also advanced by async I/O workers.
+  std::atomic<size_t> position_ = {0};
 
   xe::filesystem::WildcardEngine find_engine_;
   size_t find_index_ = 0;
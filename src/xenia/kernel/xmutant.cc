@@ -46,6 +46,7 @@ X_STATUS XMutant::ReleaseMutant(uint32_t priority_increment, bool abandon,
 
   // TODO(benvanik): abandoning.
   assert_false(abandon);
+  RecordSignal();
   if (mutant_->Release()) {
     return X_STATUS_SUCCESS;
   } else {
@@ -15,6 +15,7 @@
 #include "xenia/base/clock.h"
 #include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/notify_listener.h"
+#include "xenia/kernel/wait_graph.h"
 #include "xenia/kernel/xboxkrnl/xboxkrnl_private.h"
 #include "xenia/kernel/xenumerator.h"
 #include "xenia/kernel/xevent.h"
@@ -158,6 +159,14 @@ object_ref<XObject> XObject::Restore(KernelState* kernel_state, Type type,
   return nullptr;
 }
 
+void XObject::RecordSignal() {
+  if (!KernelState::shared()->wait_graph()) {
+    return;
+  }
+  auto thread = XThread::GetCurrentThread();
+  signaler_thread_id_ = thread ? thread->thread_id() : 0;
+}
+
 void XObject::SetAttributes(uint32_t obj_attributes_ptr) {
   if (!obj_attributes_ptr) {
     return;
@@ -198,22 +207,24 @@ X_STATUS XObject::Wait(uint32_t wait_reason, uint32_t processor_mode,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  XObject* object = this;
+  WaitGraph::ScopedWait scoped_wait(&object, 1, true);
   auto result =
       xe::threading::Wait(wait_handle, alertable ? true : false, timeout_ms);
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       WaitCallback();
-      return X_STATUS_SUCCESS;
+      return scoped_wait.End(X_STATUS_SUCCESS);
     case xe::threading::WaitResult::kUserCallback:
       // Or X_STATUS_ALERTED?
-      return X_STATUS_USER_APC;
+      return scoped_wait.End(X_STATUS_USER_APC);
     case xe::threading::WaitResult::kTimeout:
       xe::threading::MaybeYield();
-      return X_STATUS_TIMEOUT;
+      return scoped_wait.End(X_STATUS_TIMEOUT);
     default:
     case xe::threading::WaitResult::kAbandoned:
     case xe::threading::WaitResult::kFailed:
-      return X_STATUS_ABANDONED_WAIT_0;
+      return scoped_wait.End(X_STATUS_ABANDONED_WAIT_0);
   }
 }
 
@@ -225,23 +236,24 @@ X_STATUS XObject::SignalAndWait(XObject* signal_object, XObject* wait_object,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  WaitGraph::ScopedWait scoped_wait(&wait_object, 1, true);
   auto result = xe::threading::SignalAndWait(
       signal_object->GetWaitHandle(), wait_object->GetWaitHandle(),
       alertable ? true : false, timeout_ms);
   switch (result) {
     case xe::threading::WaitResult::kSuccess:
       wait_object->WaitCallback();
-      return X_STATUS_SUCCESS;
+      return scoped_wait.End(X_STATUS_SUCCESS);
     case xe::threading::WaitResult::kUserCallback:
       // Or X_STATUS_ALERTED?
-      return X_STATUS_USER_APC;
+      return scoped_wait.End(X_STATUS_USER_APC);
     case xe::threading::WaitResult::kTimeout:
       xe::threading::MaybeYield();
-      return X_STATUS_TIMEOUT;
+      return scoped_wait.End(X_STATUS_TIMEOUT);
     default:
     case xe::threading::WaitResult::kAbandoned:
     case xe::threading::WaitResult::kFailed:
-      return X_STATUS_ABANDONED_WAIT_0;
+      return scoped_wait.End(X_STATUS_ABANDONED_WAIT_0);
   }
 }
 
@@ -260,6 +272,7 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
                         TimeoutTicksToMs(*opt_timeout)))
                   : std::chrono::milliseconds::max();
 
+  WaitGraph::ScopedWait scoped_wait(objects, count, !wait_type);
   if (wait_type) {
     auto result = xe::threading::WaitAny(std::move(wait_handles),
                                          alertable ? true : false, timeout_ms);
@@ -267,18 +280,19 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
       case xe::threading::WaitResult::kSuccess:
         objects[result.second]->WaitCallback();
 
-        return X_STATUS(result.second);
+        return scoped_wait.End(X_STATUS(result.second));
       case xe::threading::WaitResult::kUserCallback:
         // Or X_STATUS_ALERTED?
-        return X_STATUS_USER_APC;
+        return scoped_wait.End(X_STATUS_USER_APC);
       case xe::threading::WaitResult::kTimeout:
         xe::threading::MaybeYield();
-        return X_STATUS_TIMEOUT;
+        return scoped_wait.End(X_STATUS_TIMEOUT);
       default:
       case xe::threading::WaitResult::kAbandoned:
-        return X_STATUS(X_STATUS_ABANDONED_WAIT_0 + result.second);
+        return scoped_wait.End(
+            X_STATUS(X_STATUS_ABANDONED_WAIT_0 + result.second));
       case xe::threading::WaitResult::kFailed:
-        return X_STATUS_UNSUCCESSFUL;
+        return scoped_wait.End(X_STATUS_UNSUCCESSFUL);
     }
   } else {
     auto result = xe::threading::WaitAll(std::move(wait_handles),
@@ -289,17 +303,17 @@ X_STATUS XObject::WaitMultiple(uint32_t count, XObject** objects,
           objects[i]->WaitCallback();
         }
 
-        return X_STATUS_SUCCESS;
+        return scoped_wait.End(X_STATUS_SUCCESS);
       case xe::threading::WaitResult::kUserCallback:
         // Or X_STATUS_ALERTED?
-        return X_STATUS_USER_APC;
+        return scoped_wait.End(X_STATUS_USER_APC);
       case xe::threading::WaitResult::kTimeout:
         xe::threading::MaybeYield();
-        return X_STATUS_TIMEOUT;
+        return scoped_wait.End(X_STATUS_TIMEOUT);
       default:
       case xe::threading::WaitResult::kAbandoned:
       case xe::threading::WaitResult::kFailed:
-        return X_STATUS_ABANDONED_WAIT_0;
+        return scoped_wait.End(X_STATUS_ABANDONED_WAIT_0);
     }
   }
 }
@@ -143,6 +143,8 @@ class XObject {
   std::vector<X_HANDLE>& handles() { return handles_; }
 
   const std::string& name() const { return name_; }
+  // Last guest thread to signal the object, only kept with --wait_graph.
+  uint32_t signaler_thread_id() const { return signaler_thread_id_; }
   uint32_t guest_object() const { return guest_object_ptr_; }
 
   // Has this object been created for use by the host?
@@ -194,6 +196,9 @@ class XObject {
   // Called on successful wait.
   virtual void WaitCallback() {}
   virtual xe::threading::WaitHandle* GetWaitHandle() { return nullptr; }
+  // Called by the objects that guest code signals directly, for the wait
+  // graph.
+  void RecordSignal();
 
   // Creates the kernel object for guest code to use. Typically not needed.
   uint8_t* CreateNative(uint32_t size);
@@ -223,6 +228,7 @@ class XObject {
   Type type_;
   std::vector<X_HANDLE> handles_;
   std::string name_;  // May be zero length.
+  std::atomic<uint32_t> signaler_thread_id_ = {0};
 
   // Guest pointer for kernel object. Remember: X_OBJECT_HEADER precedes this
   // if we allocated it!
@@ -9,8 +9,11 @@
 
 #include "src/xenia/kernel/xsocket.h"
 
+#include "xenia/base/logging.h"
+#include "xenia/base/memory.h"
 #include "xenia/base/platform.h"
 #include "xenia/kernel/kernel_state.h"
+#include "xenia/kernel/socket_engine.h"
 #include "xenia/kernel/xam/xam_module.h"
 // #include "xenia/kernel/xnet.h"
 
@@ -22,15 +25,55 @@
 // clang-format on
 #else
 #include <arpa/inet.h>
+#include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/ip.h>
+#include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <unistd.h>
+#include <cerrno>
 #endif
 
 namespace xe {
 namespace kernel {
 
+namespace {
+
+// Guest ioctlsocket commands.
+const uint32_t kFIONBIO = 0x8004667E;
+const uint32_t kFIONREAD = 0x4004667F;
+
+#ifndef XE_PLATFORM_WIN32
+struct WinsockError {
+  int host_error;
+  uint32_t winsock_error;
+};
+// Winsock numbers its errors after BSD, not Linux. A non-blocking connect
+// reports WSAEWOULDBLOCK rather than WSAEINPROGRESS.
+const WinsockError kWinsockErrors[] = {
+    {EINTR, 10004}, {EBADF, 10009}, {EACCES, 10013}, {EFAULT, 10014},
+    {EINVAL, 10022}, {EMFILE, 10024}, {EWOULDBLOCK, 10035},
+    {EINPROGRESS, 10035}, {EALREADY, 10037}, {ENOTSOCK, 10038},
+    {EDESTADDRREQ, 10039}, {EMSGSIZE, 10040}, {EPROTOTYPE, 10041},
+    {ENOPROTOOPT, 10042}, {EPROTONOSUPPORT, 10043}, {EOPNOTSUPP, 10045},
+    {EAFNOSUPPORT, 10047}, {EADDRINUSE, 10048}, {EADDRNOTAVAIL, 10049},
+    {ENETDOWN, 10050}, {ENETUNREACH, 10051}, {ECONNABORTED, 10053},
+    {ECONNRESET, 10054}, {ENOBUFS, 10055}, {EISCONN, 10056}, {ENOTCONN, 10057},
+    {EPIPE, 10058}, {ESHUTDOWN, 10058}, {ETIMEDOUT, 10060},
+    {ECONNREFUSED, 10061}, {EHOSTUNREACH, 10065},
+};
+#endif
+
+bool IsWouldBlockError() {
+#ifdef XE_PLATFORM_WIN32
+  return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  return errno == EWOULDBLOCK || errno == EAGAIN;
+#endif
+}
+
+}  // namespace
+
 XSocket::XSocket(KernelState* kernel_state)
     : XObject(kernel_state, XObject::kTypeSocket) {}
 
@@ -40,6 +83,64 @@ XSocket::XSocket(KernelState* kernel_state, uint64_t native_handle)
 
 XSocket::~XSocket() { Close(); }
 
+uint32_t XSocket::GetLastError() {
+#ifdef XE_PLATFORM_WIN32
+  return WSAGetLastError();
+#else
+  int error = errno;
+  for (const auto& entry : kWinsockErrors) {
+    if (entry.host_error == error) {
+      return entry.winsock_error;
+    }
+  }
+  return 10022;  // WSAEINVAL
+#endif
+}
+
+SocketEngine* XSocket::socket_engine() const {
+  auto engine = kernel_state_->socket_engine();
+  return engine && engine->is_running() ? engine : nullptr;
+}
+
+void XSocket::RegisterWithEngine() {
+  auto engine = socket_engine();
+  if (!engine) {
+    return;
+  }
+  if (XFAILED(SetHostNonBlocking(true))) {
+    XELOGW("Unable to make socket %lld non-blocking", native_handle_);
+    return;
+  }
+  engine->Register(native_handle_);
+}
+
+X_STATUS XSocket::SetHostNonBlocking(bool non_blocking) {
+#ifdef XE_PLATFORM_WIN32
+  u_long value = non_blocking ? 1 : 0;
+  int ret = ioctlsocket(native_handle_, FIONBIO, &value);
+#else
+  int flags = fcntl(int(native_handle_), F_GETFL, 0);
+  int new_flags = non_blocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+  int ret =
+      flags == -1 ? -1 : fcntl(int(native_handle_), F_SETFL, new_flags);
+#endif
+  return ret < 0 ? X_STATUS_UNSUCCESSFUL : X_STATUS_SUCCESS;
+}
+
+bool XSocket::WaitForReady(uint32_t events, uint64_t generation) {
+  auto engine = socket_engine();
+  if (!engine || non_blocking_ || !IsWouldBlockError()) {
+    return false;
+  }
+  engine->Arm(native_handle_, events);
+  return engine->WaitForEvents(generation);
+}
+
+uint64_t XSocket::engine_generation() const {
+  auto engine = socket_engine();
+  return engine ? engine->generation() : 0;
+}
+
 X_STATUS XSocket::Initialize(AddressFamily af, Type type, Protocol proto) {
   af_ = af;
   type_ = type;
@@ -54,16 +155,25 @@ X_STATUS XSocket::Initialize(AddressFamily af, Type type, Protocol proto) {
   if (native_handle_ == -1) {
     return X_STATUS_UNSUCCESSFUL;
   }
+  RegisterWithEngine();
 
   return X_STATUS_SUCCESS;
 }
 
 X_STATUS XSocket::Close() {
+  // closesocket closes it before the object goes away.
+  if (native_handle_ == -1) {
+    return X_STATUS_SUCCESS;
+  }
+  if (auto engine = kernel_state_->socket_engine()) {
+    engine->Unregister(native_handle_);
+  }
 #if XE_PLATFORM_WIN32
   int ret = closesocket(native_handle_);
 #elif XE_PLATFORM_LINUX
   int ret = close(native_handle_);
 #endif
+  native_handle_ = -1;
 
   if (ret != 0) {
     return X_STATUS_UNSUCCESSFUL;
@@ -96,6 +206,36 @@ X_STATUS XSocket::SetOption(uint32_t level, uint32_t optname, void* optval_ptr,
 }
 
 X_STATUS XSocket::IOControl(uint32_t cmd, uint8_t* arg_ptr) {
+  // The argument is a big-endian u_long in guest memory.
+  switch (cmd) {
+    case kFIONBIO: {
+      bool non_blocking = xe::load_and_swap<uint32_t>(arg_ptr) != 0;
+      // With the engine the guest mode only decides whether calls wait.
+      if (!socket_engine()) {
+        X_STATUS status = SetHostNonBlocking(non_blocking);
+        if (XFAILED(status)) {
+          return status;
+        }
+      }
+      non_blocking_ = non_blocking;
+      return X_STATUS_SUCCESS;
+    }
+    case kFIONREAD: {
+#ifdef XE_PLATFORM_WIN32
+      u_long value = 0;
+      int ret = ioctlsocket(native_handle_, FIONREAD, &value);
+#else
+      int value = 0;
+      int ret = ioctl(int(native_handle_), FIONREAD, &value);
+#endif
+      if (ret < 0) {
+        return X_STATUS_UNSUCCESSFUL;
+      }
+      xe::store_and_swap<uint32_t>(arg_ptr, uint32_t(value));
+      return X_STATUS_SUCCESS;
+    }
+  }
+
 #ifdef XE_PLATFORM_WIN32
   int ret = ioctlsocket(native_handle_, cmd, (u_long*)arg_ptr);
   if (ret < 0) {
@@ -111,6 +251,43 @@ X_STATUS XSocket::IOControl(uint32_t cmd, uint8_t* arg_ptr) {
 
 X_STATUS XSocket::Connect(N_XSOCKADDR* name, int name_len) {
   int ret = connect(native_handle_, (sockaddr*)name, name_len);
+  auto engine = socket_engine();
+#ifdef XE_PLATFORM_WIN32
+  bool in_progress = ret < 0 && WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+  bool in_progress = ret < 0 && errno == EINPROGRESS;
+#endif
+  if (in_progress && engine && !non_blocking_) {
+    // Wait for the handshake like a blocking connect, then take its result.
+    bool connected = false;
+    while (true) {
+      uint64_t generation = engine->generation();
+      SocketEngine::PollEntry entry = {native_handle_, SocketEngine::kWritable,
+                                       0};
+      if (SocketEngine::Poll(&entry, 1, 0) > 0) {
+        connected = true;
+        break;
+      }
+      engine->Arm(native_handle_, SocketEngine::kWritable);
+      if (!engine->WaitForEvents(generation)) {
+        break;
+      }
+    }
+    int error = 0;
+    socklen_t error_len = sizeof(error);
+    if (!connected) {
+      error = EWOULDBLOCK;
+    } else if (getsockopt(native_handle_, SOL_SOCKET, SO_ERROR,
+                          reinterpret_cast<char*>(&error), &error_len) < 0) {
+      error = EINVAL;
+    }
+#ifdef XE_PLATFORM_WIN32
+    WSASetLastError(error == EWOULDBLOCK ? WSAEWOULDBLOCK : error);
+#else
+    errno = error;
+#endif
+    ret = error ? -1 : 0;
+  }
   if (ret < 0) {
     return X_STATUS_UNSUCCESSFUL;
   }
@@ -141,9 +318,18 @@ X_STATUS XSocket::Listen(int backlog) {
 
 object_ref<XSocket> XSocket::Accept(N_XSOCKADDR* name, int* name_len) {
   sockaddr n_sockaddr;
-  socklen_t n_name_len = sizeof(sockaddr);
-  uintptr_t ret = accept(native_handle_, &n_sockaddr, &n_name_len);
-  if (ret == -1) {
+  socklen_t n_name_len;
+  uintptr_t ret;
+  while (true) {
+    uint64_t generation = engine_generation();
+    n_name_len = sizeof(sockaddr);
+    ret = accept(native_handle_, &n_sockaddr, &n_name_len);
+    if (ret != uintptr_t(-1) ||
+        !WaitForReady(SocketEngine::kReadable, generation)) {
+      break;
+    }
+  }
+  if (ret == uintptr_t(-1)) {
     std::memset(name, 0, *name_len);
     *name_len = 0;
     return nullptr;
@@ -158,6 +344,8 @@ object_ref<XSocket> XSocket::Accept(N_XSOCKADDR* name, int* name_len) {
   socket->af_ = af_;
   socket->type_ = type_;
   socket->proto_ = proto_;
+  socket->non_blocking_ = non_blocking_;
+  socket->RegisterWithEngine();
 
   return socket;
 }
@@ -165,11 +353,29 @@ object_ref<XSocket> XSocket::Accept(N_XSOCKADDR* name, int* name_len) {
 int XSocket::Shutdown(int how) { return shutdown(native_handle_, how); }
 
 int XSocket::Recv(uint8_t* buf, uint32_t buf_len, uint32_t flags) {
-  return recv(native_handle_, reinterpret_cast<char*>(buf), buf_len, flags);
+  while (true) {
+    uint64_t generation = engine_generation();
+    int ret =
+        recv(native_handle_, reinterpret_cast<char*>(buf), buf_len, flags);
+    if (ret != -1 || !WaitForReady(SocketEngine::kReadable, generation)) {
+      return ret;
+    }
+  }
 }
 
 int XSocket::RecvFrom(uint8_t* buf, uint32_t buf_len, uint32_t flags,
                       N_XSOCKADDR_IN* from, uint32_t* from_len) {
+  while (true) {
+    uint64_t generation = engine_generation();
+    int ret = TryRecvFrom(buf, buf_len, flags, from, from_len);
+    if (ret != -1 || !WaitForReady(SocketEngine::kReadable, generation)) {
+      return ret;
+    }
+  }
+}
+
+int XSocket::TryRecvFrom(uint8_t* buf, uint32_t buf_len, uint32_t flags,
+                         N_XSOCKADDR_IN* from, uint32_t* from_len) {
   // Pop from secure packets first
   // TODO(DrChat): Enable when I commit XNet
   /*
@@ -197,6 +403,9 @@ int XSocket::RecvFrom(uint8_t* buf, uint32_t buf_len, uint32_t flags,
   socklen_t nfromlen = sizeof(sockaddr_in);
   int ret = recvfrom(native_handle_, reinterpret_cast<char*>(buf), buf_len,
                      flags, (sockaddr*)&nfrom, &nfromlen);
+  if (ret == -1) {
+    return ret;
+  }
   if (from) {
     from->sin_family = nfrom.sin_family;
     from->sin_addr = ntohl(nfrom.sin_addr.s_addr);  // BE <- BE
@@ -212,8 +421,21 @@ int XSocket::RecvFrom(uint8_t* buf, uint32_t buf_len, uint32_t flags,
 }
 
 int XSocket::Send(const uint8_t* buf, uint32_t buf_len, uint32_t flags) {
-  return send(native_handle_, reinterpret_cast<const char*>(buf), buf_len,
-              flags);
+  uint32_t sent = 0;
+  while (true) {
+    uint64_t generation = engine_generation();
+    int ret = send(native_handle_, reinterpret_cast<const char*>(buf) + sent,
+                   buf_len - sent, flags);
+    if (ret >= 0) {
+      sent += ret;
+      // A blocking send only returns once all of it is queued.
+      if (sent == buf_len || non_blocking_ || !socket_engine()) {
+        return int(sent);
+      }
+    } else if (!WaitForReady(SocketEngine::kWritable, generation)) {
+      return sent ? int(sent) : -1;
+    }
+  }
 }
 
 int XSocket::SendTo(uint8_t* buf, uint32_t buf_len, uint32_t flags,
@@ -236,8 +458,14 @@ int XSocket::SendTo(uint8_t* buf, uint32_t buf_len, uint32_t flags,
     nto.sin_port = to->sin_port;
   }
 
-  return sendto(native_handle_, reinterpret_cast<char*>(buf), buf_len, flags,
-                to ? (sockaddr*)&nto : nullptr, to_len);
+  while (true) {
+    uint64_t generation = engine_generation();
+    int ret = sendto(native_handle_, reinterpret_cast<char*>(buf), buf_len,
+                     flags, to ? (sockaddr*)&nto : nullptr, to_len);
+    if (ret != -1 || !WaitForReady(SocketEngine::kWritable, generation)) {
+      return ret;
+    }
+  }
 }
 
 bool XSocket::QueuePacket(uint32_t src_ip, uint16_t src_port,
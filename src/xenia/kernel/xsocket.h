@@ -18,6 +18,9 @@
 
 namespace xe {
 namespace kernel {
+
+class SocketEngine;
+
 struct XSOCKADDR {
   xe::be<uint16_t> address_family;
   char sa_data[14];
@@ -92,6 +95,12 @@ class XSocket : public XObject {
 
   uint64_t native_handle() const { return native_handle_; }
   uint16_t bound_port() const { return bound_port_; }
+  // Set by the guest through FIONBIO. The host socket itself is always
+  // non-blocking while the socket engine runs.
+  bool non_blocking() const { return non_blocking_; }
+
+  // The Winsock error of the last failed call on this thread, for the guest.
+  static uint32_t GetLastError();
 
   X_STATUS Initialize(AddressFamily af, Type type, Protocol proto);
   X_STATUS Close();
@@ -111,6 +120,9 @@ class XSocket : public XObject {
 
   int RecvFrom(uint8_t* buf, uint32_t buf_len, uint32_t flags,
                N_XSOCKADDR_IN* from, uint32_t* from_len);
+  // RecvFrom that never waits, for overlapped requests.
+  int TryRecvFrom(uint8_t* buf, uint32_t buf_len, uint32_t flags,
+                  N_XSOCKADDR_IN* from, uint32_t* from_len);
   int SendTo(uint8_t* buf, uint32_t buf_len, uint32_t flags, N_XSOCKADDR_IN* to,
              uint32_t to_len);
 
@@ -129,6 +141,17 @@ class XSocket : public XObject {
 
  private:
   XSocket(KernelState* kernel_state, uint64_t native_handle);
+
+  SocketEngine* socket_engine() const;
+  // Makes the host socket non-blocking and hands it to the socket engine.
+  void RegisterWithEngine();
+  X_STATUS SetHostNonBlocking(bool non_blocking);
+  // After a host call failed, waits for the socket to get ready for the
+  // events if it would have blocked and the guest socket is blocking. Returns
+  // true if the call should be retried.
+  bool WaitForReady(uint32_t events, uint64_t generation);
+  uint64_t engine_generation() const;
+
   uint64_t native_handle_ = -1;
 
   AddressFamily af_;    // Address family
@@ -140,6 +163,7 @@ class XSocket : public XObject {
   uint16_t bound_port_ = 0;
 
   bool broadcast_socket_ = false;
+  bool non_blocking_ = false;
 
   std::unique_ptr<xe::threading::Event> event_;
   std::mutex incoming_packet_mutex_;
@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <cstring>
 
 #ifdef XE_PLATFORM_WIN32
@@ -22,6 +23,7 @@
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/base/profiling.h"
+#include "xenia/base/startup_phases.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/breakpoint.h"
 #include "xenia/cpu/ppc/ppc_decode_data.h"
@@ -36,6 +38,15 @@ DEFINE_bool(ignore_thread_priorities, true,
             "Ignores game-specified thread priorities.");
 DEFINE_bool(ignore_thread_affinities, true,
             "Ignores game-specified thread affinities.");
+DEFINE_bool(host_thread_placement, false,
+            "Runs guest threads on host processors dedicated to the guest "
+            "hardware threads they are pinned to, with host priorities mapped "
+            "from the guest ones, and emulator worker threads on the "
+            "remaining processors. Overrides ignore_thread_priorities and "
+            "ignore_thread_affinities.");
+DEFINE_bool(reuse_host_threads, true,
+            "Runs new guest threads on host threads left by exited ones where "
+            "the platform supports it, instead of creating one each time.");
 
 namespace xe {
 namespace kernel {
@@ -171,6 +182,63 @@ uint8_t GetFakeCpuNumber(uint8_t proc_mask) {
   return cpu_number;
 }
 
+namespace {
+
+const uint32_t kGuestHardwareThreadCount = 6;
+
+// Host processors used by host_thread_placement. Each guest hardware thread
+// gets a logical processor of its own where there are enough, so pairs of
+// them (the guest cores) usually end up on SMT siblings as on the console.
+// Emulator worker threads get the rest, or a single processor on small hosts.
+struct HostProcessorLayout {
+  uint64_t guest_masks[kGuestHardwareThreadCount];
+  uint64_t worker_mask;
+};
+
+uint64_t GetProcessorRangeMask(uint32_t first, uint32_t end) {
+  uint64_t end_mask = end >= 64 ? ~uint64_t(0) : (uint64_t(1) << end) - 1;
+  return end_mask & ~((uint64_t(1) << first) - 1);
+}
+
+const HostProcessorLayout& GetHostProcessorLayout() {
+  static const HostProcessorLayout layout = []() {
+    HostProcessorLayout layout;
+    uint32_t count = std::max(
+        std::min(xe::threading::logical_processor_count(), 64u), 1u);
+    uint32_t worker_count = count > kGuestHardwareThreadCount
+                                ? count - kGuestHardwareThreadCount
+                                : (count > 2 ? 1 : 0);
+    uint32_t guest_count = count - worker_count;
+    for (uint32_t i = 0; i < kGuestHardwareThreadCount; ++i) {
+      layout.guest_masks[i] = uint64_t(1) << (i % guest_count);
+    }
+    layout.worker_mask = worker_count
+                             ? GetProcessorRangeMask(guest_count, count)
+                             : GetProcessorRangeMask(0, count);
+    XELOGI(
+        "Host thread placement: %u processors, guest hardware threads on "
+        "%.16llX, workers on %.16llX",
+        count, GetProcessorRangeMask(0, guest_count), layout.worker_mask);
+    return layout;
+  }();
+  return layout;
+}
+
+int32_t GetHostPriority(int32_t increment) {
+  if (increment > 0x22) {
+    return xe::threading::ThreadPriority::kHighest;
+  } else if (increment > 0x11) {
+    return xe::threading::ThreadPriority::kAboveNormal;
+  } else if (increment < -0x22) {
+    return xe::threading::ThreadPriority::kLowest;
+  } else if (increment < -0x11) {
+    return xe::threading::ThreadPriority::kBelowNormal;
+  }
+  return xe::threading::ThreadPriority::kNormal;
+}
+
+}  // namespace
+
 void XThread::InitializeGuestObject() {
   auto guest_thread = guest_object<X_KTHREAD>();
 
@@ -371,6 +439,7 @@ X_STATUS XThread::Create() {
   xe::threading::Thread::CreationParameters params;
   params.stack_size = 16 * 1024 * 1024;  // Allocate a big host stack.
   params.create_suspended = true;
+  params.reuse_host_thread = FLAGS_reuse_host_threads;
   thread_ = xe::threading::Thread::Create(params, [this]() {
     // Set thread ID override. This is used by logging.
     xe::threading::set_current_thread_id(handle());
@@ -416,7 +485,7 @@ X_STATUS XThread::Create() {
     return X_STATUS_NO_MEMORY;
   }
 
-  if (!FLAGS_ignore_thread_affinities) {
+  if (!FLAGS_ignore_thread_affinities && !FLAGS_host_thread_placement) {
     thread_->set_affinity_mask(proc_mask);
   }
 
@@ -429,9 +498,16 @@ X_STATUS XThread::Create() {
   }
 
   if (creation_params_.creation_flags & 0x60) {
-    thread_->set_priority(creation_params_.creation_flags & 0x20 ? 1 : 0);
+    host_priority_ = creation_params_.creation_flags & 0x20
+                         ? xe::threading::ThreadPriority::kAboveNormal
+                         : xe::threading::ThreadPriority::kNormal;
+    if (!FLAGS_host_thread_placement) {
+      thread_->set_priority(host_priority_);
+    }
   }
 
+  UpdateHostPlacement(proc_mask);
+
   // Notify processor of our creation.
   emulator()->processor()->OnThreadCreated(handle(), thread_state_, this);
 
@@ -513,6 +589,8 @@ void XThread::Execute() {
   // Dispatch any APCs that were queued before the thread was created first.
   DeliverAPCs();
 
+  StartupPhases::Mark(StartupPhases::Phase::kFirstGuestCode);
+
   // If a XapiThreadStartup value is present, we use that as a trampoline.
   // Otherwise, we are a raw thread.
   if (creation_params_.xapi_thread_startup) {
@@ -544,18 +622,24 @@ void XThread::LeaveCriticalRegion() {
 }
 
 uint32_t XThread::RaiseIrql(uint32_t new_irql) {
-  return irql_.exchange(new_irql);
+  auto context = thread_state_->context();
+  uint32_t old_irql = context->irql;
+  context->irql = uint8_t(new_irql);
+  return old_irql;
 }
 
-void XThread::LowerIrql(uint32_t new_irql) { irql_ = new_irql; }
+void XThread::LowerIrql(uint32_t new_irql) {
+  thread_state_->context()->irql = uint8_t(new_irql);
+}
 
 void XThread::CheckApcs() { DeliverAPCs(); }
 
-void XThread::LockApc() { EnterCriticalRegion(); }
+void XThread::LockApc() { apc_lock_.lock(); }
 
 void XThread::UnlockApc(bool queue_delivery) {
   bool needs_apc = apc_list_.HasPending();
-  LeaveCriticalRegion();
+  apc_pending_.store(needs_apc, std::memory_order_release);
+  apc_lock_.unlock();
   if (needs_apc && queue_delivery) {
     thread_->QueueUserCallback([this]() { DeliverAPCs(); });
   }
@@ -563,8 +647,6 @@ void XThread::UnlockApc(bool queue_delivery) {
 
 void XThread::EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
                          uint32_t arg1, uint32_t arg2) {
-  LockApc();
-
   // Allocate APC.
   // We'll tag it as special and free it when dispatched.
   uint32_t apc_ptr = memory()->SystemHeapAlloc(XAPC::kSize);
@@ -580,14 +662,17 @@ void XThread::EnqueueApc(uint32_t normal_routine, uint32_t normal_context,
   apc->enqueued = 1;
 
   uint32_t list_entry_ptr = apc_ptr + 8;
+  LockApc();
   apc_list_.Insert(list_entry_ptr);
-
   UnlockApc(true);
 }
 
 void XThread::DeliverAPCs() {
   // https://www.drdobbs.com/inside-nts-asynchronous-procedure-call/184416590?pgno=1
   // https://www.drdobbs.com/inside-nts-asynchronous-procedure-call/184416590?pgno=7
+  if (!apc_pending_.load(std::memory_order_acquire)) {
+    return;
+  }
   auto processor = kernel_state()->processor();
   LockApc();
   while (apc_list_.HasPending()) {
@@ -611,7 +696,12 @@ void XThread::DeliverAPCs() {
     xe::store_and_swap<uint32_t>(scratch_ptr + 4, apc->normal_context);
     xe::store_and_swap<uint32_t>(scratch_ptr + 8, apc->arg1);
     xe::store_and_swap<uint32_t>(scratch_ptr + 12, apc->arg2);
-    if (apc->kernel_routine != XAPC::kDummyKernelRoutine) {
+    uint32_t kernel_routine = apc->kernel_routine;
+
+    // The APC is off the queue, so the lock isn't needed while running guest
+    // code for it.
+    UnlockApc(false);
+    if (kernel_routine != XAPC::kDummyKernelRoutine) {
       // kernel_routine(apc_address, &normal_routine, &normal_context,
       // &system_arg1, &system_arg2)
       uint64_t kernel_args[] = {
@@ -621,7 +711,7 @@ void XThread::DeliverAPCs() {
           scratch_address_ + 8,
           scratch_address_ + 12,
       };
-      processor->Execute(thread_state_, apc->kernel_routine, kernel_args,
+      processor->Execute(thread_state_, kernel_routine, kernel_args,
                          xe::countof(kernel_args));
     }
     uint32_t normal_routine = xe::load_and_swap<uint32_t>(scratch_ptr + 0);
@@ -632,12 +722,10 @@ void XThread::DeliverAPCs() {
     // Call the normal routine. Note that it may have been killed by the kernel
     // routine.
     if (normal_routine) {
-      UnlockApc(false);
       // normal_routine(normal_context, system_arg1, system_arg2)
       uint64_t normal_args[] = {normal_context, arg1, arg2};
       processor->Execute(thread_state_, normal_routine, normal_args,
                          xe::countof(normal_args));
-      LockApc();
     }
 
     XELOGD("Completed delivery of APC to %.8X (%.8X, %.8X, %.8X)",
@@ -647,6 +735,7 @@ void XThread::DeliverAPCs() {
     if (needs_freeing) {
       memory()->SystemHeapFree(apc_ptr);
     }
+    LockApc();
   }
   UnlockApc(true);
 }
@@ -663,14 +752,16 @@ void XThread::RundownAPCs() {
 
     // Mark as uninserted so that it can be reinserted again by the routine.
     apc->enqueued = 0;
+    uint32_t rundown_routine = apc->rundown_routine;
+    UnlockApc(false);
 
     // Call the rundown routine.
-    if (apc->rundown_routine == XAPC::kDummyRundownRoutine) {
+    if (rundown_routine == XAPC::kDummyRundownRoutine) {
       // No-op.
-    } else if (apc->rundown_routine) {
+    } else if (rundown_routine) {
       // rundown_routine(apc)
       uint64_t args[] = {apc_ptr};
-      kernel_state()->processor()->Execute(thread_state(), apc->rundown_routine,
+      kernel_state()->processor()->Execute(thread_state(), rundown_routine,
                                            args, xe::countof(args));
     }
 
@@ -678,6 +769,7 @@ void XThread::RundownAPCs() {
     if (needs_freeing) {
       memory()->SystemHeapFree(apc_ptr);
     }
+    LockApc();
   }
   UnlockApc(true);
 }
@@ -686,20 +778,11 @@ int32_t XThread::QueryPriority() { return thread_->priority(); }
 
 void XThread::SetPriority(int32_t increment) {
   priority_ = increment;
-  int32_t target_priority = 0;
-  if (increment > 0x22) {
-    target_priority = xe::threading::ThreadPriority::kHighest;
-  } else if (increment > 0x11) {
-    target_priority = xe::threading::ThreadPriority::kAboveNormal;
-  } else if (increment < -0x22) {
-    target_priority = xe::threading::ThreadPriority::kLowest;
-  } else if (increment < -0x11) {
-    target_priority = xe::threading::ThreadPriority::kBelowNormal;
-  } else {
-    target_priority = xe::threading::ThreadPriority::kNormal;
-  }
-  if (!FLAGS_ignore_thread_priorities) {
-    thread_->set_priority(target_priority);
+  host_priority_ = GetHostPriority(increment);
+  if (FLAGS_host_thread_placement) {
+    UpdateHostPlacement(affinity_);
+  } else if (!FLAGS_ignore_thread_priorities) {
+    thread_->set_priority(host_priority_);
   }
 }
 
@@ -719,11 +802,43 @@ void XThread::SetAffinity(uint32_t affinity) {
   }
   SetActiveCpu(GetFakeCpuNumber(affinity));
   affinity_ = affinity;
-  if (!FLAGS_ignore_thread_affinities) {
+  if (FLAGS_host_thread_placement) {
+    UpdateHostPlacement(affinity);
+  } else if (!FLAGS_ignore_thread_affinities) {
     thread_->set_affinity_mask(affinity);
   }
 }
 
+void XThread::UpdateHostPlacement(uint32_t guest_affinity) {
+  if (!FLAGS_host_thread_placement) {
+    return;
+  }
+  const auto& layout = GetHostProcessorLayout();
+  uint64_t host_mask = 0;
+  if (!guest_thread_) {
+    // Emulator workers (GPU, audio, XMA...) stay off the guest processors.
+    host_mask = layout.worker_mask;
+  } else {
+    uint32_t guest_mask =
+        guest_affinity & ((1 << kGuestHardwareThreadCount) - 1);
+    if (!guest_mask) {
+      guest_mask = (1 << kGuestHardwareThreadCount) - 1;
+    }
+    for (uint32_t i = 0; i < kGuestHardwareThreadCount; ++i) {
+      if (guest_mask & (1 << i)) {
+        host_mask |= layout.guest_masks[i];
+      }
+    }
+    thread_->set_priority(host_priority_);
+  }
+  thread_->set_affinity_mask(host_mask);
+  XELOGI(
+      "Thread placement: %s (%.8X) guest affinity %.2X priority %d -> host "
+      "processors %.16llX priority %d",
+      thread_name_.c_str(), handle(), guest_affinity, priority_, host_mask,
+      guest_thread_ ? host_priority_ : thread_->priority());
+}
+
 uint32_t XThread::active_cpu() const {
   uint8_t* pcr = memory()->TranslateVirtual(pcr_address_);
   return xe::load_and_swap<uint8_t>(pcr + 0x10C);
@@ -952,6 +1067,7 @@ object_ref<XThread> XThread::Restore(KernelState* kernel_state,
   thread->main_thread_ = state.is_main_thread;
   thread->running_ = state.is_running;
   thread->apc_list_.set_head(state.apc_head);
+  thread->apc_pending_ = thread->apc_list_.HasPending();
   thread->tls_static_address_ = state.tls_static_address;
   thread->tls_dynamic_address_ = state.tls_dynamic_address;
   thread->tls_total_size_ = state.tls_total_size;
@@ -1038,6 +1154,10 @@ object_ref<XThread> XThread::Restore(KernelState* kernel_state,
       thread->Release();
     });
 
+    // The affinity isn't saved, so restored threads may use any guest
+    // hardware thread.
+    thread->UpdateHostPlacement(0);
+
     // Notify processor we were recreated.
     thread->emulator()->processor()->OnThreadCreated(
         thread->handle(), thread->thread_state(), thread);
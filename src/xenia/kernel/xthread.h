@@ -198,6 +198,10 @@ class XThread : public XObject, public cpu::Thread {
   void DeliverAPCs();
   void RundownAPCs();
 
+  // Places the host thread as host_thread_placement asks, given the guest
+  // affinity mask (0 for any hardware thread).
+  void UpdateHostPlacement(uint32_t guest_affinity);
+
   xe::threading::WaitHandle* GetWaitHandle() override { return thread_.get(); }
 
   CreationParams creation_params_ = {0};
@@ -221,10 +225,15 @@ class XThread : public XObject, public cpu::Thread {
 
   int32_t priority_ = 0;
   uint32_t affinity_ = 0;
+  int32_t host_priority_ = xe::threading::ThreadPriority::kNormal;
 
   xe::global_critical_region global_critical_region_;
-  std::atomic<uint32_t> irql_ = {0};
+  xe::subsystem_mutex apc_lock_{"kernel/apc_queues"};
   util::NativeList apc_list_;
+  // Whether apc_list_ has entries, updated whenever apc_lock_ is released so
+  // that checking for APCs doesn't need the lock. A delivery that misses one
+  // being inserted is followed by the one the inserter queues.
+  std::atomic<bool> apc_pending_ = {false};
 };
 
 class XHostThread : public XThread {
@@ -9,9 +9,12 @@
 
 #include "xenia/kernel/xtimer.h"
 
+#include <algorithm>
+
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/cpu/processor.h"
+#include "xenia/kernel/kernel_state.h"
 #include "xenia/kernel/xthread.h"
 
 namespace xe {
@@ -19,16 +22,16 @@ namespace kernel {
 
 XTimer::XTimer(KernelState* kernel_state) : XObject(kernel_state, kTypeTimer) {}
 
-XTimer::~XTimer() = default;
+XTimer::~XTimer() { Cancel(); }
 
 void XTimer::Initialize(uint32_t timer_type) {
-  assert_false(timer_);
+  assert_false(event_);
   switch (timer_type) {
     case 0:  // NotificationTimer
-      timer_ = xe::threading::Timer::CreateManualResetTimer();
+      event_ = xe::threading::Event::CreateManualResetEvent(false);
       break;
     case 1:  // SynchronizationTimer
-      timer_ = xe::threading::Timer::CreateSynchronizationTimer();
+      event_ = xe::threading::Event::CreateAutoResetEvent(false);
       break;
     default:
       assert_always();
@@ -46,15 +49,34 @@ X_STATUS XTimer::SetTimer(int64_t due_time, uint32_t period_ms,
   due_time = Clock::ScaleGuestDurationFileTime(due_time);
   period_ms = Clock::ScaleGuestDurationMillis(period_ms);
 
+  // Negative due times are relative, positive ones absolute, both in 100ns.
+  int64_t relative_time = due_time;
+  if (due_time > 0) {
+    relative_time =
+        static_cast<int64_t>(Clock::QueryGuestSystemTime()) - due_time;
+  }
+  auto wheel_due_time =
+      TimerWheel::clock::now() +
+      std::chrono::nanoseconds(std::max(-relative_time, int64_t(0)) * 100);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto timer_wheel = kernel_state_->timer_wheel();
+  if (wheel_timer_) {
+    // Once this returns the old callback can't be running anymore.
+    timer_wheel->Cancel(wheel_timer_);
+    wheel_timer_ = 0;
+  }
+  event_->Reset();
+
   // Stash routine for callback.
   callback_thread_ = XThread::GetCurrentThread();
   callback_routine_ = routine;
   callback_routine_arg_ = routine_arg;
 
-  // This callback will only be issued when the timer is fired.
-  std::function<void()> callback = nullptr;
-  if (callback_routine_) {
-    callback = [this]() {
+  // Called from the timer wheel thread every time the timer fires.
+  auto callback = [this]() {
+    event_->Set();
+    if (callback_routine_) {
       // Queue APC to call back routine with (arg, low, high).
       // It'll be executed on the thread that requested the timer.
       uint64_t time = xe::Clock::QueryGuestSystemTime();
@@ -64,24 +86,21 @@ X_STATUS XTimer::SetTimer(int64_t due_time, uint32_t period_ms,
              callback_routine_, callback_routine_arg_, time_low, time_high);
       callback_thread_->EnqueueApc(callback_routine_, callback_routine_arg_,
                                    time_low, time_high);
-    };
-  }
-
-  bool result;
-  if (!period_ms) {
-    result = timer_->SetOnce(std::chrono::nanoseconds(due_time * 100),
-                             std::move(callback));
-  } else {
-    result = timer_->SetRepeating(std::chrono::nanoseconds(due_time * 100),
-                                  std::chrono::milliseconds(period_ms),
-                                  std::move(callback));
-  }
+    }
+  };
+  wheel_timer_ = timer_wheel->Schedule(
+      wheel_due_time, std::chrono::milliseconds(period_ms), callback);
 
-  return result ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
+  return X_STATUS_SUCCESS;
 }
 
 X_STATUS XTimer::Cancel() {
-  return timer_->Cancel() ? X_STATUS_SUCCESS : X_STATUS_UNSUCCESSFUL;
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (wheel_timer_) {
+    kernel_state_->timer_wheel()->Cancel(wheel_timer_);
+    wheel_timer_ = 0;
+  }
+  return X_STATUS_SUCCESS;
 }
 
 }  // namespace kernel
@@ -10,7 +10,10 @@
 #ifndef XENIA_KERNEL_XTIMER_H_
 #define XENIA_KERNEL_XTIMER_H_
 
+#include <mutex>
+
 #include "xenia/base/threading.h"
+#include "xenia/base/timer_wheel.h"
 #include "xenia/kernel/xobject.h"
 #include "xenia/xbox.h"
 
@@ -33,10 +36,14 @@ class XTimer : public XObject {
   X_STATUS Cancel();
 
  protected:
-  xe::threading::WaitHandle* GetWaitHandle() override { return timer_.get(); }
+  xe::threading::WaitHandle* GetWaitHandle() override { return event_.get(); }
 
  private:
-  std::unique_ptr<xe::threading::Timer> timer_;
+  // Signaled by the kernel timer wheel when the timer expires.
+  std::unique_ptr<xe::threading::Event> event_;
+
+  std::mutex mutex_;
+  TimerWheel::TimerId wheel_timer_ = 0;
 
   XThread* callback_thread_ = nullptr;
   uint32_t callback_routine_ = 0;
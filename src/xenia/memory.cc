@@ -12,24 +12,43 @@
 #include <gflags/gflags.h>
 
 #include <algorithm>
+#include <atomic>
+#include <cinttypes>
 #include <cstring>
+#include <functional>
+#include <thread>
 
 #include "xenia/base/byte_stream.h"
 #include "xenia/base/clock.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
+#include "xenia/base/memory_usage.h"
 #include "xenia/base/threading.h"
 #include "xenia/cpu/mmio_handler.h"
 
+#include "third_party/snappy/snappy.h"
+#include "third_party/xxhash/xxhash.h"
+
 // TODO(benvanik): move xbox.h out
 #include "xenia/xbox.h"
 
 DEFINE_bool(protect_zero, true, "Protect the zero page from reads and writes.");
 DEFINE_bool(protect_on_release, false,
             "Protect released memory to prevent accesses.");
+DEFINE_bool(discard_freed_memory, true,
+            "Return the host pages of decommitted and released guest memory "
+            "to the system. Titles reading memory after freeing it get zeros "
+            "instead of the old contents.");
 
 DEFINE_bool(scribble_heap, false,
             "Scribble 0xCD into all allocated heap memory.");
+DEFINE_bool(memory_large_pages, false,
+            "Ask the host to back guest memory with large pages to reduce "
+            "TLB misses, where it can do so without losing the protection of "
+            "individual guest pages (transparent huge pages on Linux).");
+DEFINE_bool(system_heap_slabs, true,
+            "Serve small system heap and kernel pool allocations from "
+            "size-classed slabs instead of whole pages.");
 
 namespace xe {
 
@@ -92,6 +111,8 @@ Memory::~Memory() {
   assert_true(active_memory_ == this);
   active_memory_ = nullptr;
 
+  Metrics::RemoveCollector(CollectMetricsThunk, this);
+
   // Uninstall the MMIO handler, as we won't be able to service more
   // requests.
   mmio_handler_.reset();
@@ -151,6 +172,10 @@ bool Memory::Initialize() {
   virtual_membase_ = mapping_base_;
   physical_membase_ = mapping_base_ + 0x100000000ull;
 
+  if (FLAGS_memory_large_pages) {
+    AdviseLargePages();
+  }
+
   // Prepare virtual heaps.
   heaps_.v00000000.Initialize(virtual_membase_, 0x00000000, 0x40000000, 4096);
   heaps_.v40000000.Initialize(virtual_membase_, 0x40000000,
@@ -171,6 +196,19 @@ bool Memory::Initialize() {
   heaps_.vE0000000.Initialize(virtual_membase_, 0xE0000000, 0x1FD00000, 4096,
                               &heaps_.physical);
 
+  system_pool_ = std::make_unique<SlabAllocator>(
+      [this]() {
+        uint32_t address;
+        if (!heaps_.v00000000.Alloc(
+                SlabAllocator::kChunkSize, SlabAllocator::kChunkSize,
+                kMemoryAllocationReserve | kMemoryAllocationCommit,
+                kMemoryProtectRead | kMemoryProtectWrite, false, &address)) {
+          return 0u;
+        }
+        return address;
+      },
+      [this](uint32_t address) { heaps_.v00000000.Release(address); });
+
   // Protect the first and last 64kb of memory.
   heaps_.v00000000.AllocFixed(
       0x00000000, 0x10000, 0x10000,
@@ -201,6 +239,7 @@ bool Memory::Initialize() {
   heaps_.vA0000000.Alloc(0x340000, 64 * 1024, kMemoryAllocationReserve,
                          kMemoryProtectNoAccess, true, &unk_phys_alloc);
 
+  Metrics::AddCollector(CollectMetricsThunk, this);
   return true;
 }
 
@@ -290,7 +329,30 @@ void Memory::UnmapViews() {
   }
 }
 
+void Memory::AdviseLargePages() {
+  // Access watches and guest protection work on individual 4KB pages, so
+  // large page mappings, which can only be protected as a whole, are out.
+  size_t total_length = 0;
+  size_t large_length = 0;
+  for (size_t n = 0; n < xe::countof(map_info); n++) {
+    size_t length = map_info[n].virtual_address_end -
+                    map_info[n].virtual_address_start + 1;
+    total_length += length;
+    if (xe::memory::AdviseLargePages(views_.all_views[n], length)) {
+      large_length += length;
+    }
+  }
+  if (!large_length) {
+    XELOGW("Large pages for guest memory are unavailable on this host");
+    return;
+  }
+  XELOGI("Advised %uMB of %uMB of guest memory views for %uKB large pages",
+         uint32_t(large_length >> 20), uint32_t(total_length >> 20),
+         uint32_t(xe::memory::large_page_size() >> 10));
+}
+
 void Memory::Reset() {
+  system_pool_->Clear();
   heaps_.v00000000.Reset();
   heaps_.v40000000.Reset();
   heaps_.v80000000.Reset();
@@ -408,16 +470,38 @@ uintptr_t Memory::AddPhysicalAccessWatch(uint32_t physical_address,
                                                callback_data);
 }
 
+uintptr_t Memory::AddVirtualAccessWatch(uint32_t virtual_address,
+                                        uint32_t length,
+                                        cpu::MMIOHandler::WatchType type,
+                                        cpu::AccessWatchCallback callback,
+                                        void* callback_context,
+                                        void* callback_data) {
+  return mmio_handler_->AddVirtualAccessWatch(virtual_address, length, type,
+                                              callback, callback_context,
+                                              callback_data);
+}
+
 void Memory::CancelAccessWatch(uintptr_t watch_handle) {
   mmio_handler_->CancelAccessWatch(watch_handle);
 }
 
+void Memory::ProcessDeferredAccessWatches() {
+  mmio_handler_->ProcessDeferredAccessWatches();
+}
+
 uint32_t Memory::SystemHeapAlloc(uint32_t size, uint32_t alignment,
-                                 uint32_t system_heap_flags) {
-  // TODO(benvanik): lightweight pool.
+                                 uint32_t system_heap_flags,
+                                 uint32_t pool_tag) {
   bool is_physical = !!(system_heap_flags & kSystemHeapPhysical);
-  auto heap = LookupHeapByType(is_physical, 4096);
   uint32_t address;
+  if (!is_physical && FLAGS_system_heap_slabs) {
+    address = system_pool_->Alloc(size, alignment, pool_tag);
+    if (address) {
+      Zero(address, size);
+      return address;
+    }
+  }
+  auto heap = LookupHeapByType(is_physical, 4096);
   if (!heap->Alloc(size, alignment,
                    kMemoryAllocationReserve | kMemoryAllocationCommit,
                    kMemoryProtectRead | kMemoryProtectWrite, false, &address)) {
@@ -431,7 +515,10 @@ void Memory::SystemHeapFree(uint32_t address) {
   if (!address) {
     return;
   }
-  // TODO(benvanik): lightweight pool.
+  // Slabs are looked up even with them turned off, it's cheap.
+  if (system_pool_->Free(address)) {
+    return;
+  }
   auto heap = LookupHeap(address);
   heap->Release(address);
 }
@@ -464,6 +551,106 @@ void Memory::DumpMap() {
   XELOGE("");
 }
 
+void Memory::GetHeapStatistics(std::vector<HeapStatistics>* out_stats,
+                               bool query_resident) {
+  BaseHeap* heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,  &heaps_.vA0000000,
+      &heaps_.vC0000000, &heaps_.vE0000000,
+  };
+  out_stats->resize(xe::countof(heaps));
+  for (size_t i = 0; i < xe::countof(heaps); ++i) {
+    heaps[i]->GetStatistics(&(*out_stats)[i]);
+    if (query_resident) {
+      (*out_stats)[i].resident_bytes = heaps[i]->QueryResidentSize();
+    }
+  }
+}
+
+void Memory::CollectMetricsThunk(MetricsWriter* writer, void* data) {
+  auto memory = reinterpret_cast<Memory*>(data);
+  std::vector<HeapStatistics> heap_stats;
+  memory->GetHeapStatistics(&heap_stats, true);
+  char labels[32];
+  for (auto& stats : heap_stats) {
+    std::snprintf(labels, xe::countof(labels), "heap=\"%.8X\"",
+                  stats.heap_base);
+    writer->Gauge("xenia_guest_committed_bytes",
+                  "Guest memory committed in each heap.",
+                  double(uint64_t(stats.committed_pages) * stats.page_size),
+                  labels);
+  }
+  for (auto& stats : heap_stats) {
+    std::snprintf(labels, xe::countof(labels), "heap=\"%.8X\"",
+                  stats.heap_base);
+    writer->Gauge("xenia_guest_reserved_bytes",
+                  "Guest memory reserved in each heap.",
+                  double(uint64_t(stats.reserved_pages) * stats.page_size),
+                  labels);
+  }
+  for (auto& stats : heap_stats) {
+    std::snprintf(labels, xe::countof(labels), "heap=\"%.8X\"",
+                  stats.heap_base);
+    writer->Gauge("xenia_guest_resident_bytes",
+                  "Guest memory of each heap in host RAM.",
+                  double(stats.resident_bytes), labels);
+  }
+}
+
+void Memory::GetSystemPoolStatistics(SlabAllocator::Statistics* out_stats) {
+  system_pool_->GetStatistics(out_stats);
+}
+
+void Memory::DumpStatistics() {
+  std::vector<HeapStatistics> heap_stats;
+  GetHeapStatistics(&heap_stats, true);
+  XELOGI("Guest heaps (committed / reserved / total KB, peak committed KB, "
+         "resident KB):");
+  for (const auto& stats : heap_stats) {
+    uint32_t page_kb = stats.page_size / 1024;
+    XELOGI("  %.8X: %u / %u / %u, %u, %" PRIu64, stats.heap_base,
+           stats.committed_pages * page_kb, stats.reserved_pages * page_kb,
+           stats.total_pages * page_kb, stats.peak_committed_pages * page_kb,
+           stats.resident_bytes / 1024);
+  }
+  SlabAllocator::Statistics pool_stats;
+  GetSystemPoolStatistics(&pool_stats);
+  uint64_t uptime_ms = Clock::QueryHostUptimeMillis();
+  double elapsed_s = (uptime_ms - last_dump_uptime_ms_) / 1000.0;
+  XELOGI("System pool, %u chunks (live allocs, live KB, waste KB, allocs, "
+         "allocs/s since last dump):",
+         pool_stats.chunk_count);
+  for (const auto& stats : pool_stats.tags) {
+    uint64_t last_alloc_count = 0;
+    for (const auto& last_stats : last_dump_pool_stats_) {
+      if (last_stats.tag == stats.tag) {
+        last_alloc_count = last_stats.alloc_count;
+        break;
+      }
+    }
+    // Pool tags are four characters, stored as a little-endian constant.
+    char tag[5];
+    for (int i = 0; i < 4; ++i) {
+      char c = char(stats.tag >> (i * 8));
+      tag[i] = c >= 0x20 && c < 0x7F ? c : '.';
+    }
+    tag[4] = 0;
+    XELOGI("  %s (%.8X): %u, %u, %u, %llu, %.1f", tag, stats.tag,
+           stats.live_count, uint32_t(stats.live_bytes / 1024),
+           uint32_t((stats.live_slot_bytes - stats.live_bytes) / 1024),
+           static_cast<unsigned long long>(stats.alloc_count),  // NOLINT
+           elapsed_s > 0 ? (stats.alloc_count - last_alloc_count) / elapsed_s
+                         : 0.0);
+  }
+  last_dump_uptime_ms_ = uptime_ms;
+  last_dump_pool_stats_ = std::move(pool_stats.tags);
+  XELOGI("Host memory (KB, peak KB):");
+  for (const auto& sample : MemoryUsageCounter::SampleAll()) {
+    XELOGI("  %s: %u, %u", sample.name, uint32_t(sample.bytes / 1024),
+           uint32_t(sample.peak_bytes / 1024));
+  }
+}
+
 bool Memory::Save(ByteStream* stream) {
   XELOGD("Serializing memory...");
   heaps_.v00000000.Save(stream);
@@ -471,6 +658,7 @@ bool Memory::Save(ByteStream* stream) {
   heaps_.v80000000.Save(stream);
   heaps_.v90000000.Save(stream);
   heaps_.physical.Save(stream);
+  system_pool_->Save(stream);
 
   return true;
 }
@@ -482,6 +670,52 @@ bool Memory::Restore(ByteStream* stream) {
   heaps_.v80000000.Restore(stream);
   heaps_.v90000000.Restore(stream);
   heaps_.physical.Restore(stream);
+  if (!system_pool_->Restore(stream)) {
+    XELOGE("Failed to restore the system pool");
+    return false;
+  }
+
+  return true;
+}
+
+bool Memory::SaveIncremental(ByteStream* stream, bool base) {
+  BaseHeap* heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,
+  };
+  if (!base) {
+    for (auto heap : heaps) {
+      if (!heap->has_incremental_snapshot()) {
+        XELOGE("No base snapshot to save a delta against");
+        return false;
+      }
+    }
+  }
+  XELOGD("Serializing memory (%s)...", base ? "base" : "delta");
+  for (auto heap : heaps) {
+    heap->SaveIncremental(stream, base);
+  }
+  // The slab bookkeeping is small, all of it goes in each snapshot.
+  system_pool_->Save(stream);
+
+  return true;
+}
+
+bool Memory::RestoreIncremental(ByteStream* stream) {
+  XELOGD("Restoring memory incrementally...");
+  BaseHeap* heaps[] = {
+      &heaps_.v00000000, &heaps_.v40000000, &heaps_.v80000000,
+      &heaps_.v90000000, &heaps_.physical,
+  };
+  for (auto heap : heaps) {
+    if (!heap->RestoreIncremental(stream)) {
+      return false;
+    }
+  }
+  if (!system_pool_->Restore(stream)) {
+    XELOGE("Failed to restore the system pool");
+    return false;
+  }
 
   return true;
 }
@@ -514,6 +748,30 @@ uint32_t FromPageAccess(xe::memory::PageAccess protect) {
   return kMemoryProtectNoAccess;
 }
 
+// Incremental snapshot pages are hashed and compressed in batches of this
+// many, from as many threads as there are host processors.
+static const uint32_t kSnapshotBatchPageCount = 64;
+
+static void SnapshotParallelFor(size_t count,
+                                const std::function<void(size_t)>& fn) {
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next_index.fetch_add(1)) < count;) {
+      fn(i);
+    }
+  };
+  uint32_t thread_count = uint32_t(std::min(
+      size_t(std::max(xe::threading::logical_processor_count(), 1u)), count));
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
 BaseHeap::BaseHeap()
     : membase_(nullptr), heap_base_(0), heap_size_(0), page_size_(0) {}
 
@@ -526,6 +784,8 @@ void BaseHeap::Initialize(uint8_t* membase, uint32_t heap_base,
   heap_size_ = heap_size - 1;
   page_size_ = page_size;
   page_table_.resize(heap_size / page_size);
+  reserved_pages_.Resize(page_table_.size());
+  RecountPages();
 }
 
 void BaseHeap::Dispose() {
@@ -593,29 +853,91 @@ uint32_t BaseHeap::GetTotalPageCount() { return uint32_t(page_table_.size()); }
 
 uint32_t BaseHeap::GetUnreservedPageCount() {
   auto global_lock = global_critical_region_.Acquire();
-  uint32_t count = 0;
-  bool is_empty_span = false;
-  uint32_t empty_span_start = 0;
-  uint32_t size = uint32_t(page_table_.size());
-  for (uint32_t i = 0; i < size; ++i) {
-    auto& page = page_table_[i];
-    if (!page.state) {
-      if (!is_empty_span) {
-        is_empty_span = true;
-        empty_span_start = i;
-      }
+  return uint32_t(page_table_.size()) - reserved_page_count_;
+}
+
+void BaseHeap::GetStatistics(HeapStatistics* out_stats) {
+  auto global_lock = global_critical_region_.Acquire();
+  out_stats->heap_base = heap_base_;
+  out_stats->page_size = page_size_;
+  out_stats->total_pages = uint32_t(page_table_.size());
+  out_stats->reserved_pages = reserved_page_count_;
+  out_stats->committed_pages = committed_page_count_;
+  out_stats->peak_reserved_pages = peak_reserved_page_count_;
+  out_stats->peak_committed_pages = peak_committed_page_count_;
+  out_stats->resident_bytes = 0;
+}
+
+uint64_t BaseHeap::QueryResidentSize() {
+  auto global_lock = global_critical_region_.Acquire();
+  uint64_t resident_size = 0;
+  uint32_t page_count = uint32_t(page_table_.size());
+  uint32_t page_number = 0;
+  while (page_number < page_count) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
       continue;
     }
-    if (is_empty_span) {
-      is_empty_span = false;
-      count += i - empty_span_start;
+    uint32_t end = page_number + 1;
+    while (end < page_count &&
+           (page_table_[end].state & kMemoryAllocationCommit)) {
+      ++end;
     }
-    i += page.region_page_count - 1;
+    resident_size += xe::memory::QueryResidentSize(
+        membase_ + heap_base_ + page_number * page_size_,
+        size_t(end - page_number) * page_size_);
+    page_number = end;
   }
-  if (is_empty_span) {
-    count += size - empty_span_start;
+  return resident_size;
+}
+
+void BaseHeap::RecountPages() {
+  reserved_page_count_ = 0;
+  committed_page_count_ = 0;
+  for (const auto& page : page_table_) {
+    if (page.state) {
+      ++reserved_page_count_;
+    }
+    if (page.state & kMemoryAllocationCommit) {
+      ++committed_page_count_;
+    }
+  }
+  peak_reserved_page_count_ = reserved_page_count_;
+  peak_committed_page_count_ = committed_page_count_;
+}
+
+void BaseHeap::DiscardCommittedPages(uint32_t start_page_number,
+                                     uint32_t end_page_number) {
+  if (!FLAGS_discard_freed_memory) {
+    return;
+  }
+  size_t host_page_size = xe::memory::page_size();
+  uint32_t page_number = start_page_number;
+  while (page_number <= end_page_number) {
+    if (!(page_table_[page_number].state & kMemoryAllocationCommit)) {
+      ++page_number;
+      continue;
+    }
+    uint32_t end = page_number + 1;
+    while (end <= end_page_number &&
+           (page_table_[end].state & kMemoryAllocationCommit)) {
+      ++end;
+    }
+    // Only whole host pages can be discarded, guest ones may be smaller.
+    auto start_ptr = reinterpret_cast<uintptr_t>(membase_ + heap_base_ +
+                                                 page_number * page_size_);
+    auto end_ptr = start_ptr + size_t(end - page_number) * page_size_;
+    start_ptr = xe::round_up(start_ptr, host_page_size);
+    end_ptr &= ~uintptr_t(host_page_size - 1);
+    if (start_ptr < end_ptr &&
+        !xe::memory::DiscardMemory(reinterpret_cast<void*>(start_ptr),
+                                   end_ptr - start_ptr)) {
+      XELOGW("BaseHeap failed to discard %.8X-%.8X on the host",
+             heap_base_ + page_number * page_size_,
+             heap_base_ + end * page_size_ - 1);
+    }
+    page_number = end;
   }
-  return count;
 }
 
 bool BaseHeap::Save(ByteStream* stream) {
@@ -649,6 +971,8 @@ bool BaseHeap::Save(ByteStream* stream) {
 bool BaseHeap::Restore(ByteStream* stream) {
   XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
 
+  reserved_pages_.Reset();
+  snapshot_page_hashes_.clear();
   for (size_t i = 0; i < page_table_.size(); i++) {
     auto& page = page_table_[i];
     page.qword = stream->Read<uint64_t>();
@@ -656,6 +980,7 @@ bool BaseHeap::Restore(ByteStream* stream) {
       // Unallocated.
       continue;
     }
+    reserved_pages_.Set(i, 1);
 
     memory::PageAccess page_access = memory::PageAccess::kNoAccess;
     if ((page.current_protect & kMemoryProtectRead) &&
@@ -686,13 +1011,191 @@ bool BaseHeap::Restore(ByteStream* stream) {
       xe::memory::Protect(addr, page_size_, page_access, nullptr);
     }
   }
+  RecountPages();
 
   return true;
 }
 
+bool BaseHeap::SaveIncremental(ByteStream* stream, bool base) {
+  XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
+
+  uint32_t page_count = uint32_t(page_table_.size());
+  if (base || snapshot_page_hashes_.size() != page_count) {
+    snapshot_page_hashes_.assign(page_count, 0);
+  }
+  stream->Write(page_count);
+  stream->Write(page_table_.data(), page_count * sizeof(PageEntry));
+
+  // Pages are hashed against the previous snapshot rather than tracked with
+  // write protection, which is already used by access watches and the guest.
+  struct Batch {
+    std::vector<uint32_t> pages;
+    std::string data;
+  };
+  uint32_t batch_count =
+      (page_count + kSnapshotBatchPageCount - 1) / kSnapshotBatchPageCount;
+  std::vector<Batch> batches(batch_count);
+  SnapshotParallelFor(batch_count, [&](size_t batch_index) {
+    Batch& batch = batches[batch_index];
+    uint32_t first = uint32_t(batch_index) * kSnapshotBatchPageCount;
+    uint32_t end = std::min(first + kSnapshotBatchPageCount, page_count);
+    std::string pages_data;
+    for (uint32_t i = first; i < end; ++i) {
+      uint64_t& hash = snapshot_page_hashes_[i];
+      if (!(page_table_[i].state & kMemoryAllocationCommit)) {
+        hash = 0;
+        continue;
+      }
+      void* addr = membase_ + heap_base_ + i * page_size_;
+      memory::PageAccess old_access;
+      memory::Protect(addr, page_size_, memory::PageAccess::kReadWrite,
+                      &old_access);
+      // Never 0, so newly committed pages are always written.
+      uint64_t new_hash = XXH64(addr, page_size_, 0) | 1;
+      if (new_hash != hash) {
+        hash = new_hash;
+        batch.pages.push_back(i);
+        pages_data.append(reinterpret_cast<const char*>(addr), page_size_);
+      }
+      memory::Protect(addr, page_size_, old_access, nullptr);
+    }
+    if (!batch.pages.empty()) {
+      snappy::Compress(pages_data.data(), pages_data.size(), &batch.data);
+    }
+  });
+
+  uint32_t written_batch_count = 0;
+  uint32_t written_page_count = 0;
+  for (const auto& batch : batches) {
+    if (!batch.pages.empty()) {
+      ++written_batch_count;
+      written_page_count += uint32_t(batch.pages.size());
+    }
+  }
+  stream->Write(written_batch_count);
+  for (const auto& batch : batches) {
+    if (batch.pages.empty()) {
+      continue;
+    }
+    stream->Write(uint32_t(batch.pages.size()));
+    stream->Write(batch.pages.data(), batch.pages.size() * sizeof(uint32_t));
+    stream->Write(uint32_t(batch.data.size()));
+    stream->Write(batch.data.data(), batch.data.size());
+  }
+  XELOGD("%u of %u pages written", written_page_count, page_count);
+
+  return true;
+}
+
+bool BaseHeap::RestoreIncremental(ByteStream* stream) {
+  XELOGD("Heap %.8X-%.8X", heap_base_, heap_base_ + heap_size_);
+
+  uint32_t page_count = stream->Read<uint32_t>();
+  if (page_count != page_table_.size()) {
+    XELOGE("Snapshot page count mismatch (%u, expected %u)", page_count,
+           uint32_t(page_table_.size()));
+    return false;
+  }
+  stream->Read(page_table_.data(), page_count * sizeof(PageEntry));
+  reserved_pages_.Reset();
+  snapshot_page_hashes_.clear();
+  RecountPages();
+
+  // Commit everything writable first, in runs, then fill in the pages that
+  // are in this snapshot, then apply the final protection.
+  auto for_each_committed_run = [&](const std::function<void(
+                                        uint32_t, uint32_t, uint32_t)>& fn) {
+    uint32_t i = 0;
+    while (i < page_count) {
+      if (!(page_table_[i].state & kMemoryAllocationCommit)) {
+        ++i;
+        continue;
+      }
+      uint32_t protect = page_table_[i].current_protect;
+      uint32_t end = i + 1;
+      while (end < page_count &&
+             (page_table_[end].state & kMemoryAllocationCommit) &&
+             page_table_[end].current_protect == protect) {
+        ++end;
+      }
+      fn(i, end - i, protect);
+      i = end;
+    }
+  };
+  for (uint32_t i = 0; i < page_count; ++i) {
+    if (page_table_[i].state) {
+      reserved_pages_.Set(i, 1);
+    }
+  }
+  for_each_committed_run([this](uint32_t first, uint32_t count, uint32_t) {
+    void* addr = membase_ + heap_base_ + first * page_size_;
+    xe::memory::AllocFixed(addr, count * page_size_,
+                           memory::AllocationType::kCommit,
+                           memory::PageAccess::kReadWrite);
+    xe::memory::Protect(addr, count * page_size_,
+                        memory::PageAccess::kReadWrite, nullptr);
+  });
+
+  struct Batch {
+    const uint32_t* pages;
+    uint32_t page_count;
+    const char* data;
+    uint32_t data_size;
+  };
+  uint32_t batch_count = stream->Read<uint32_t>();
+  std::vector<Batch> batches(batch_count);
+  for (auto& batch : batches) {
+    batch.page_count = stream->Read<uint32_t>();
+    batch.pages =
+        reinterpret_cast<const uint32_t*>(stream->data() + stream->offset());
+    stream->Advance(batch.page_count * sizeof(uint32_t));
+    batch.data_size = stream->Read<uint32_t>();
+    batch.data =
+        reinterpret_cast<const char*>(stream->data() + stream->offset());
+    stream->Advance(batch.data_size);
+    for (uint32_t i = 0; i < batch.page_count; ++i) {
+      if (batch.pages[i] >= page_count ||
+          !(page_table_[batch.pages[i]].state & kMemoryAllocationCommit)) {
+        XELOGE("Snapshot contains invalid page %u", batch.pages[i]);
+        return false;
+      }
+    }
+  }
+  std::atomic<bool> corrupt(false);
+  SnapshotParallelFor(batch_count, [&](size_t batch_index) {
+    const Batch& batch = batches[batch_index];
+    std::string pages_data;
+    if (!snappy::Uncompress(batch.data, batch.data_size, &pages_data) ||
+        pages_data.size() != size_t(batch.page_count) * page_size_) {
+      corrupt = true;
+      return;
+    }
+    for (uint32_t i = 0; i < batch.page_count; ++i) {
+      std::memcpy(membase_ + heap_base_ + batch.pages[i] * page_size_,
+                  pages_data.data() + size_t(i) * page_size_, page_size_);
+    }
+  });
+
+  for_each_committed_run(
+      [this](uint32_t first, uint32_t count, uint32_t protect) {
+        xe::memory::Protect(membase_ + heap_base_ + first * page_size_,
+                            count * page_size_, ToPageAccess(protect),
+                            nullptr);
+      });
+
+  if (corrupt) {
+    XELOGE("Snapshot page data is corrupt");
+    return false;
+  }
+  return true;
+}
+
 void BaseHeap::Reset() {
   // TODO(DrChat): protect pages.
   std::memset(page_table_.data(), 0, sizeof(PageEntry) * page_table_.size());
+  reserved_pages_.Reset();
+  snapshot_page_hashes_.clear();
+  RecountPages();
 }
 
 bool BaseHeap::Alloc(uint32_t size, uint32_t alignment,
@@ -728,24 +1231,22 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
   //   reserved.
   // - If we are committing it's ok for pages within the range to already be
   //   committed.
-  for (uint32_t page_number = start_page_number; page_number <= end_page_number;
-       ++page_number) {
-    uint32_t state = page_table_[page_number].state;
-    if ((allocation_type == kMemoryAllocationReserve) && state) {
-      // Already reserved.
-      XELOGE(
-          "BaseHeap::AllocFixed attempting to reserve an already reserved "
-          "range");
-      return false;
-    }
-    if ((allocation_type == kMemoryAllocationCommit) &&
-        !(state & kMemoryAllocationReserve)) {
-      // Attempting a commit-only op on an unreserved page.
-      // This may be OK.
-      XELOGW("BaseHeap::AllocFixed attempting commit on unreserved page");
-      allocation_type |= kMemoryAllocationReserve;
-      break;
-    }
+  if ((allocation_type == kMemoryAllocationReserve) &&
+      reserved_pages_.FindFirstSet(start_page_number, end_page_number + 1) <=
+          end_page_number) {
+    // Already reserved.
+    XELOGE(
+        "BaseHeap::AllocFixed attempting to reserve an already reserved "
+        "range");
+    return false;
+  }
+  if ((allocation_type == kMemoryAllocationCommit) &&
+      reserved_pages_.FindFirstClear(start_page_number, end_page_number + 1) <=
+          end_page_number) {
+    // Attempting a commit-only op on an unreserved page.
+    // This may be OK.
+    XELOGW("BaseHeap::AllocFixed attempting commit on unreserved page");
+    allocation_type |= kMemoryAllocationReserve;
   }
 
   // Allocate from host.
@@ -779,8 +1280,11 @@ bool BaseHeap::AllocFixed(uint32_t base_address, uint32_t size,
     }
     page_entry.allocation_protect = protect;
     page_entry.current_protect = protect;
+    UpdatePageCounts(page_entry.state,
+                     kMemoryAllocationReserve | allocation_type);
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  reserved_pages_.Set(start_page_number, page_count);
 
   return true;
 }
@@ -810,83 +1314,62 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
   auto global_lock = global_critical_region_.Acquire();
 
   // Find a free page range.
-  // The base page must match the requested alignment, so we first scan for
-  // a free aligned page and only then check for continuous free pages.
-  // TODO(benvanik): optimized searching (free list buckets, bitmap, etc).
+  // The base page must match the requested alignment, so candidates are
+  // aligned after skipping past reserved pages, then the whole range is
+  // checked at once.
   uint32_t start_page_number = UINT_MAX;
   uint32_t end_page_number = UINT_MAX;
   uint32_t page_scan_stride = alignment / page_size_;
   high_page_number = high_page_number - (high_page_number % page_scan_stride);
   if (top_down) {
-    for (int64_t base_page_number =
-             high_page_number - xe::round_up(page_count, page_scan_stride);
-         base_page_number >= low_page_number;
-         base_page_number -= page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
-      }
-      // Check requested range to ensure free.
-      start_page_number = uint32_t(base_page_number);
-      end_page_number = uint32_t(base_page_number) + page_count - 1;
-      assert_true(end_page_number < page_table_.size());
-      bool any_taken = false;
-      for (uint32_t page_number = uint32_t(base_page_number);
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least before this page.
-          any_taken = true;
-          if (page_count > page_number) {
-            // Not enough space left to fit entire page range. Breaks outer
-            // loop.
-            base_page_number = -1;
-          } else {
-            base_page_number = page_number - page_count;
-            base_page_number -= base_page_number % page_scan_stride;
-            base_page_number += page_scan_stride;  // cancel out loop logic
-          }
-          break;
-        }
-      }
-      if (!any_taken) {
+    int64_t base_page_number =
+        high_page_number - xe::round_up(page_count, page_scan_stride);
+    while (base_page_number >= low_page_number) {
+      size_t range_end = size_t(base_page_number) + page_count;
+      size_t taken_page_number =
+          reserved_pages_.FindLastSet(size_t(base_page_number), range_end);
+      if (taken_page_number == range_end) {
         // Found our place.
+        start_page_number = uint32_t(base_page_number);
+        end_page_number = uint32_t(range_end - 1);
+        break;
+      }
+      // The range must end before the run of reserved pages the taken page
+      // is in.
+      size_t free_page_number =
+          reserved_pages_.FindLastClear(low_page_number, taken_page_number);
+      if (free_page_number == taken_page_number ||
+          free_page_number + 1 < page_count) {
         break;
       }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
+      base_page_number = int64_t(free_page_number + 1 - page_count);
+      base_page_number -= base_page_number % page_scan_stride;
     }
   } else {
-    for (uint32_t base_page_number = low_page_number;
-         base_page_number <= high_page_number - page_count;
-         base_page_number += page_scan_stride) {
-      if (page_table_[base_page_number].state != 0) {
-        // Base page not free, skip to next usable page.
-        continue;
+    uint32_t base_page_number = low_page_number;
+    while (base_page_number + page_count <= high_page_number) {
+      size_t free_page_number =
+          reserved_pages_.FindFirstClear(base_page_number, high_page_number);
+      if (free_page_number == high_page_number) {
+        break;
       }
-      // Check requested range to ensure free.
-      start_page_number = base_page_number;
-      end_page_number = base_page_number + page_count - 1;
-      bool any_taken = false;
-      for (uint32_t page_number = base_page_number;
-           !any_taken && page_number <= end_page_number; ++page_number) {
-        bool is_free = page_table_[page_number].state == 0;
-        if (!is_free) {
-          // At least one page in the range is used, skip to next.
-          // We know we'll be starting at least after this page.
-          any_taken = true;
-          base_page_number = xe::round_up(page_number + 1, page_scan_stride);
-          base_page_number -= page_scan_stride;  // cancel out loop logic
-          break;
-        }
+      base_page_number =
+          xe::round_up(uint32_t(free_page_number), page_scan_stride);
+      if (base_page_number + page_count > high_page_number) {
+        break;
       }
-      if (!any_taken) {
+      size_t range_end = size_t(base_page_number) + page_count;
+      size_t taken_page_number =
+          reserved_pages_.FindFirstSet(base_page_number, range_end);
+      if (taken_page_number == range_end) {
         // Found our place.
+        start_page_number = base_page_number;
+        end_page_number = uint32_t(range_end - 1);
         break;
       }
-      // Retry.
-      start_page_number = end_page_number = UINT_MAX;
+      // We know we'll be starting at least after this page.
+      base_page_number =
+          xe::round_up(uint32_t(taken_page_number) + 1, page_scan_stride);
     }
   }
   if (start_page_number == UINT_MAX || end_page_number == UINT_MAX) {
@@ -924,8 +1407,11 @@ bool BaseHeap::AllocRange(uint32_t low_address, uint32_t high_address,
     page_entry.region_page_count = page_count;
     page_entry.allocation_protect = protect;
     page_entry.current_protect = protect;
+    UpdatePageCounts(page_entry.state,
+                     kMemoryAllocationReserve | allocation_type);
     page_entry.state = kMemoryAllocationReserve | allocation_type;
   }
+  reserved_pages_.Set(start_page_number, page_count);
 
   *out_address = heap_base_ + (start_page_number * page_size_);
   return true;
@@ -941,21 +1427,15 @@ bool BaseHeap::Decommit(uint32_t address, uint32_t size) {
 
   auto global_lock = global_critical_region_.Acquire();
 
-  // Release from host.
-  // TODO(benvanik): find a way to actually decommit memory;
-  //     mapped memory cannot be decommitted.
-  /*BOOL result =
-      VirtualFree(membase_ + heap_base_ + start_page_number * page_size_,
-                  page_count * page_size_, MEM_DECOMMIT);
-  if (!result) {
-    PLOGW("BaseHeap::Decommit failed due to host VirtualFree failure");
-    return false;
-  }*/
+  // Mapped memory can't be decommitted, but its pages can be given back.
+  DiscardCommittedPages(start_page_number, end_page_number);
 
   // Perform table change.
   for (uint32_t page_number = start_page_number; page_number <= end_page_number;
        ++page_number) {
     auto& page_entry = page_table_[page_number];
+    UpdatePageCounts(page_entry.state,
+                     page_entry.state & ~kMemoryAllocationCommit);
     page_entry.state &= ~kMemoryAllocationCommit;
   }
 
@@ -982,15 +1462,12 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
     *out_region_size = (base_page_entry.region_page_count * page_size_);
   }
 
-  // Release from host not needed as mapping reserves the range for us.
-  // TODO(benvanik): protect with NOACCESS?
-  /*BOOL result = VirtualFree(
-      membase_ + heap_base_ + base_page_number * page_size_, 0, MEM_RELEASE);
-  if (!result) {
-    PLOGE("BaseHeap::Release failed due to host VirtualFree failure");
-    return false;
-  }*/
-  // Instead, we just protect it, if we can.
+  // Release from host not needed as mapping reserves the range for us, but
+  // give its pages back.
+  uint32_t end_page_number =
+      base_page_number + base_page_entry.region_page_count - 1;
+  DiscardCommittedPages(base_page_number, end_page_number);
+  // And protect it, if we can.
   if (page_size_ == xe::memory::page_size() ||
       ((base_page_entry.region_page_count * page_size_) %
                xe::memory::page_size() ==
@@ -1010,13 +1487,13 @@ bool BaseHeap::Release(uint32_t base_address, uint32_t* out_region_size) {
   }
 
   // Perform table change.
-  uint32_t end_page_number =
-      base_page_number + base_page_entry.region_page_count - 1;
   for (uint32_t page_number = base_page_number; page_number <= end_page_number;
        ++page_number) {
     auto& page_entry = page_table_[page_number];
+    UpdatePageCounts(page_entry.state, 0);
     page_entry.qword = 0;
   }
+  reserved_pages_.Clear(base_page_number, base_page_entry.region_page_count);
 
   return true;
 }
@@ -1122,16 +1599,11 @@ bool BaseHeap::QueryRegionInfo(uint32_t base_address,
       out_info->region_size += page_size_;
     }
   } else {
-    // Free region.
-    for (uint32_t page_number = start_page_number;
-         page_number < page_table_.size(); ++page_number) {
-      auto page_entry = page_table_[page_number];
-      if (page_entry.state) {
-        // First non-free page; done with region.
-        break;
-      }
-      out_info->region_size += page_size_;
-    }
+    // Free region, up to the first non-free page.
+    size_t end_page_number =
+        reserved_pages_.FindFirstSet(start_page_number, page_table_.size());
+    out_info->region_size =
+        uint32_t(end_page_number - start_page_number) * page_size_;
   }
   return true;
 }
@@ -1333,6 +1805,8 @@ bool PhysicalHeap::AllocRange(uint32_t low_address, uint32_t high_address,
 bool PhysicalHeap::Decommit(uint32_t address, uint32_t size) {
   auto global_lock = global_critical_region_.Acquire();
   uint32_t parent_address = GetPhysicalAddress(address);
+  // The contents may be discarded.
+  cpu::MMIOHandler::global_handler()->InvalidateRange(parent_address, size);
   if (!parent_heap_->Decommit(parent_address, size)) {
     XELOGE("PhysicalHeap::Decommit failed due to parent heap failure");
     return false;
@@ -10,13 +10,17 @@
 #ifndef XENIA_MEMORY_H_
 #define XENIA_MEMORY_H_
 
+#include <algorithm>
 #include <cstdint>
 #include <memory>
 #include <string>
 #include <vector>
 
 #include "xenia/base/memory.h"
+#include "xenia/base/metrics.h"
 #include "xenia/base/mutex.h"
+#include "xenia/base/range_bit_map.h"
+#include "xenia/base/slab_allocator.h"
 #include "xenia/cpu/mmio_handler.h"
 
 namespace xe {
@@ -67,6 +71,24 @@ struct HeapAllocationInfo {
   uint32_t protect;
 };
 
+// Page counts of a heap, kept up to date as pages change state so they are
+// cheap to read at any time.
+struct HeapStatistics {
+  uint32_t heap_base;
+  uint32_t page_size;
+  uint32_t total_pages;
+  // Pages that are reserved, including the committed ones.
+  uint32_t reserved_pages;
+  uint32_t committed_pages;
+  // Highest values since the heap was initialized or last restored.
+  uint32_t peak_reserved_pages;
+  uint32_t peak_committed_pages;
+  // Bytes of the heap in host RAM. Only filled in by
+  // Memory::GetHeapStatistics when asked to, as it isn't cheap to find.
+  // Views of physical memory each count the same host pages.
+  uint64_t resident_bytes;
+};
+
 // Describes a single page in the page table.
 union PageEntry {
   struct {
@@ -94,6 +116,9 @@ class BaseHeap {
 
   // Size of each page within the heap range in bytes.
   uint32_t page_size() const { return page_size_; }
+  // Guest address range of the heap.
+  uint32_t heap_base() const { return heap_base_; }
+  uint32_t heap_size() const { return heap_size_; }
 
   // Disposes and decommits all memory and clears the page table.
   virtual void Dispose();
@@ -104,6 +129,10 @@ class BaseHeap {
   uint32_t GetTotalPageCount();
   uint32_t GetUnreservedPageCount();
 
+  void GetStatistics(HeapStatistics* out_stats);
+  // Gets how many bytes of the committed pages are in host RAM.
+  uint64_t QueryResidentSize();
+
   // Allocates pages with the given properties and allocation strategy.
   // This can reserve and commit the pages as well as set protection modes.
   // This will fail if not enough contiguous pages can be found.
@@ -158,6 +187,16 @@ class BaseHeap {
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
+  // Writes the page table and every committed page whose contents changed
+  // since the previous incremental snapshot, or all of them for a base.
+  bool SaveIncremental(ByteStream* stream, bool base);
+  // Applies a snapshot written by SaveIncremental on top of the current
+  // contents, so a base followed by its deltas rebuilds the image.
+  bool RestoreIncremental(ByteStream* stream);
+  bool has_incremental_snapshot() const {
+    return !snapshot_page_hashes_.empty();
+  }
+
   void Reset();
 
  protected:
@@ -166,12 +205,42 @@ class BaseHeap {
   void Initialize(uint8_t* membase, uint32_t heap_base, uint32_t heap_size,
                   uint32_t page_size);
 
+  // Keeps the statistics in sync with a page changing state.
+  void UpdatePageCounts(uint32_t old_state, uint32_t new_state) {
+    if (!old_state != !new_state) {
+      reserved_page_count_ += new_state ? 1 : -1;
+      peak_reserved_page_count_ =
+          std::max(peak_reserved_page_count_, reserved_page_count_);
+    }
+    if ((old_state ^ new_state) & kMemoryAllocationCommit) {
+      committed_page_count_ += (new_state & kMemoryAllocationCommit) ? 1 : -1;
+      peak_committed_page_count_ =
+          std::max(peak_committed_page_count_, committed_page_count_);
+    }
+  }
+  // Recounts the statistics after the whole page table has been replaced.
+  void RecountPages();
+  // Returns the host pages of the committed pages in the range to the system
+  // (--discard_freed_memory), before they are decommitted or released.
+  void DiscardCommittedPages(uint32_t start_page_number,
+                             uint32_t end_page_number);
+
   uint8_t* membase_;
   uint32_t heap_base_;
   uint32_t heap_size_;
   uint32_t page_size_;
   xe::global_critical_region global_critical_region_;
   std::vector<PageEntry> page_table_;
+  // Pages with any state (reserved or committed) in page_table_, indexed for
+  // searching free ranges.
+  RangeBitMap reserved_pages_;
+  uint32_t reserved_page_count_ = 0;
+  uint32_t committed_page_count_ = 0;
+  uint32_t peak_reserved_page_count_ = 0;
+  uint32_t peak_committed_page_count_ = 0;
+  // Hashes of the pages as of the last incremental snapshot, 0 for pages that
+  // weren't committed. Empty when there is no snapshot to build on.
+  std::vector<uint64_t> snapshot_page_hashes_;
 };
 
 // Normal heap allowing allocations from guest virtual address ranges.
@@ -316,15 +385,29 @@ class Memory {
                                    cpu::AccessWatchCallback callback,
                                    void* callback_context, void* callback_data);
 
+  // Adds an access watch for a range of a virtual heap that isn't backed by
+  // physical memory, such as the one XEX images are loaded into. See
+  // AddPhysicalAccessWatch.
+  uintptr_t AddVirtualAccessWatch(uint32_t virtual_address, uint32_t length,
+                                  cpu::MMIOHandler::WatchType type,
+                                  cpu::AccessWatchCallback callback,
+                                  void* callback_context, void* callback_data);
+
   // Cancels a write watch requested with AddPhysicalAccessWatch.
   void CancelAccessWatch(uintptr_t watch_handle);
 
+  // Fires the kWatchWriteDeferred watches written to since the last call.
+  void ProcessDeferredAccessWatches();
+
   // Allocates virtual memory from the 'system' heap.
   // System memory is kept separate from game memory but is still accessible
   // using normal guest virtual addresses. Kernel structures and other internal
   // 'system' allocations should come from this heap when possible.
+  // Small virtual allocations share pages through size-classed slabs, with
+  // statistics kept per pool tag.
   uint32_t SystemHeapAlloc(uint32_t size, uint32_t alignment = 0x20,
-                           uint32_t system_heap_flags = kSystemHeapDefault);
+                           uint32_t system_heap_flags = kSystemHeapDefault,
+                           uint32_t pool_tag = 0);
 
   // Frees memory allocated with SystemHeapAlloc.
   void SystemHeapFree(uint32_t address);
@@ -341,12 +424,32 @@ class Memory {
   // Dumps a map of all allocated memory to the log.
   void DumpMap();
 
+  // Gets the page counts of every heap, and how much of them is in host RAM
+  // if query_resident is set.
+  void GetHeapStatistics(std::vector<HeapStatistics>* out_stats,
+                         bool query_resident = false);
+  // Gets the usage of the small system heap allocations by pool tag.
+  void GetSystemPoolStatistics(SlabAllocator::Statistics* out_stats);
+  // Logs the page counts of every heap, the system pool usage and the host
+  // memory registered through MemoryUsageCounter.
+  void DumpStatistics();
+
   bool Save(ByteStream* stream);
   bool Restore(ByteStream* stream);
 
+  // Incremental snapshots of guest memory. A base contains every committed
+  // page, each later delta only the pages changed since the snapshot before
+  // it. Returns false without writing anything if a delta was requested with
+  // no base to build on (first save, or after restoring).
+  bool SaveIncremental(ByteStream* stream, bool base);
+  // Restores a base, then each of its deltas in order.
+  bool RestoreIncremental(ByteStream* stream);
+
  private:
   int MapViews(uint8_t* mapping_base);
   void UnmapViews();
+  void AdviseLargePages();
+  static void CollectMetricsThunk(MetricsWriter* writer, void* data);
 
  private:
   std::wstring file_name_;
@@ -385,6 +488,11 @@ class Memory {
     PhysicalHeap vE0000000;
   } heaps_;
 
+  std::unique_ptr<SlabAllocator> system_pool_;
+  // To report allocation rates since the last DumpStatistics.
+  uint64_t last_dump_uptime_ms_ = 0;
+  std::vector<SlabAllocator::TagStatistics> last_dump_pool_stats_;
+
   friend class BaseHeap;
 };
 
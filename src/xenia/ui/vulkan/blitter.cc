@@ -18,6 +18,7 @@ namespace vulkan {
 // Generated with `xenia-build genspirv`.
 #include "xenia/ui/vulkan/shaders/bin/blit_color_frag.h"
 #include "xenia/ui/vulkan/shaders/bin/blit_depth_frag.h"
+#include "xenia/ui/vulkan/shaders/bin/blit_gamma_frag.h"
 #include "xenia/ui/vulkan/shaders/bin/blit_vert.h"
 
 Blitter::Blitter() {}
@@ -56,6 +57,18 @@ VkResult Blitter::Initialize(VulkanDevice* device) {
                             VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT,
                             "S(B): Color");
 
+  shader_create_info.codeSize = sizeof(blit_gamma_frag);
+  shader_create_info.pCode = reinterpret_cast<const uint32_t*>(blit_gamma_frag);
+  status = vkCreateShaderModule(*device_, &shader_create_info, nullptr,
+                                &blit_gamma_);
+  CheckResult(status, "vkCreateShaderModule");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+  device_->DbgSetObjectName(uint64_t(blit_gamma_),
+                            VK_DEBUG_REPORT_OBJECT_TYPE_SHADER_MODULE_EXT,
+                            "S(B): Color with gamma ramp");
+
   shader_create_info.codeSize = sizeof(blit_depth_frag);
   shader_create_info.pCode = reinterpret_cast<const uint32_t*>(blit_depth_frag);
   status = vkCreateShaderModule(*device_, &shader_create_info, nullptr,
@@ -103,7 +116,9 @@ VkResult Blitter::Initialize(VulkanDevice* device) {
   pipeline_layout_info.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
   pipeline_layout_info.pNext = nullptr;
   pipeline_layout_info.flags = 0;
-  VkDescriptorSetLayout set_layouts[] = {descriptor_set_layout_};
+  // Set 1 is the gamma ramp, only used by blit_gamma_.
+  VkDescriptorSetLayout set_layouts[] = {descriptor_set_layout_,
+                                         descriptor_set_layout_};
   pipeline_layout_info.setLayoutCount =
       static_cast<uint32_t>(xe::countof(set_layouts));
   pipeline_layout_info.pSetLayouts = set_layouts;
@@ -188,6 +203,10 @@ void Blitter::Shutdown() {
     vkDestroyShaderModule(*device_, blit_depth_, nullptr);
     blit_depth_ = nullptr;
   }
+  if (blit_gamma_) {
+    vkDestroyShaderModule(*device_, blit_gamma_, nullptr);
+    blit_gamma_ = nullptr;
+  }
   if (pipeline_color_) {
     vkDestroyPipeline(*device_, pipeline_color_, nullptr);
     pipeline_color_ = nullptr;
@@ -229,7 +248,8 @@ void Blitter::BlitTexture2D(VkCommandBuffer command_buffer, VkFence fence,
                             VkRect2D dst_rect, VkExtent2D dst_extents,
                             VkFramebuffer dst_framebuffer, VkViewport viewport,
                             VkRect2D scissor, VkFilter filter,
-                            bool color_or_depth, bool swap_channels) {
+                            bool color_or_depth, bool swap_channels,
+                            VkImageView gamma_ramp_view) {
   // Do we need a full draw, or can we cheap out with a blit command?
   bool full_draw = swap_channels || true;
   if (full_draw) {
@@ -256,41 +276,56 @@ void Blitter::BlitTexture2D(VkCommandBuffer command_buffer, VkFence fence,
     vkCmdSetScissor(command_buffer, 0, 1, &scissor);
 
     // Acquire a pipeline.
-    auto pipeline =
-        GetPipeline(render_pass, color_or_depth ? blit_color_ : blit_depth_,
-                    color_or_depth);
+    bool apply_gamma_ramp = color_or_depth && gamma_ramp_view;
+    VkShaderModule frag_shader = blit_depth_;
+    if (color_or_depth) {
+      frag_shader = apply_gamma_ramp ? blit_gamma_ : blit_color_;
+    }
+    auto pipeline = GetPipeline(render_pass, frag_shader, color_or_depth);
     vkCmdBindPipeline(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                       pipeline);
 
-    // Acquire and update a descriptor set for this image.
-    auto set = descriptor_pool_->AcquireEntry(descriptor_set_layout_);
-    if (!set) {
-      assert_always();
-      descriptor_pool_->CancelBatch();
-      return;
+    // Acquire and update a descriptor set for this image, and one for the
+    // gamma ramp.
+    uint32_t set_count = apply_gamma_ramp ? 2 : 1;
+    VkDescriptorSet sets[2];
+    for (uint32_t i = 0; i < set_count; ++i) {
+      sets[i] = descriptor_pool_->AcquireEntry(descriptor_set_layout_);
+      if (!sets[i]) {
+        assert_always();
+        descriptor_pool_->CancelBatch();
+        return;
+      }
+    }
+
+    VkWriteDescriptorSet writes[2];
+    VkDescriptorImageInfo images[2];
+    for (uint32_t i = 0; i < set_count; ++i) {
+      auto& write = writes[i];
+      write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+      write.pNext = nullptr;
+      write.dstSet = sets[i];
+      write.dstBinding = 0;
+      write.dstArrayElement = 0;
+      write.descriptorCount = 1;
+      write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+      write.pImageInfo = &images[i];
+      write.pBufferInfo = nullptr;
+      write.pTexelBufferView = nullptr;
     }
 
-    VkWriteDescriptorSet write;
-    write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    write.pNext = nullptr;
-    write.dstSet = set;
-    write.dstBinding = 0;
-    write.dstArrayElement = 0;
-    write.descriptorCount = 1;
-    write.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-
-    VkDescriptorImageInfo image;
-    image.sampler = filter == VK_FILTER_NEAREST ? samp_nearest_ : samp_linear_;
-    image.imageView = src_image_view;
-    image.imageLayout = VK_IMAGE_LAYOUT_GENERAL;
-
-    write.pImageInfo = &image;
-    write.pBufferInfo = nullptr;
-    write.pTexelBufferView = nullptr;
-    vkUpdateDescriptorSets(*device_, 1, &write, 0, nullptr);
+    images[0].sampler =
+        filter == VK_FILTER_NEAREST ? samp_nearest_ : samp_linear_;
+    images[0].imageView = src_image_view;
+    images[0].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    // Interpolated between the entries around the input.
+    images[1].sampler = samp_linear_;
+    images[1].imageView = gamma_ramp_view;
+    images[1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+    vkUpdateDescriptorSets(*device_, set_count, writes, 0, nullptr);
 
     vkCmdBindDescriptorSets(command_buffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                            pipeline_layout_, 0, 1, &set, 0, nullptr);
+                            pipeline_layout_, 0, set_count, sets, 0, nullptr);
 
     VtxPushConstants vtx_constants = {
         {
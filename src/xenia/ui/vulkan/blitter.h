@@ -40,13 +40,17 @@ class Blitter {
   // dst_framebuffer must only have one attachment, the target texture.
   // viewport is the viewport rect (set to {0, 0, dst_w, dst_h} if unsure)
   // scissor is the scissor rect for the dest (set to dst size if unsure)
+  // gamma_ramp_view, for color, is a 256x1 image the color components are
+  // looked up in as they are written, with the output for the input i / 255
+  // in texel i, or null to copy them as they are.
   void BlitTexture2D(VkCommandBuffer command_buffer, VkFence fence,
                      VkImageView src_image_view, VkRect2D src_rect,
                      VkExtent2D src_extents, VkFormat dst_image_format,
                      VkRect2D dst_rect, VkExtent2D dst_extents,
                      VkFramebuffer dst_framebuffer, VkViewport viewport,
                      VkRect2D scissor, VkFilter filter, bool color_or_depth,
-                     bool swap_channels);
+                     bool swap_channels,
+                     VkImageView gamma_ramp_view = nullptr);
 
   void CopyColorTexture2D(VkCommandBuffer command_buffer, VkFence fence,
                           VkImage src_image, VkImageView src_image_view,
@@ -85,6 +89,7 @@ class Blitter {
   VkPipelineLayout pipeline_layout_ = nullptr;
   VkShaderModule blit_vertex_ = nullptr;
   VkShaderModule blit_color_ = nullptr;
+  VkShaderModule blit_gamma_ = nullptr;
   VkShaderModule blit_depth_ = nullptr;
   VkSampler samp_linear_ = nullptr;
   VkSampler samp_nearest_ = nullptr;
@@ -21,7 +21,7 @@ namespace vulkan {
 
 CircularBuffer::CircularBuffer(VulkanDevice* device, VkBufferUsageFlags usage,
                                VkDeviceSize capacity, VkDeviceSize alignment)
-    : device_(device), capacity_(capacity) {
+    : device_(device), usage_(usage), capacity_(capacity) {
   VkResult status = VK_SUCCESS;
 
   // Create our internal buffer.
@@ -118,6 +118,10 @@ VkResult CircularBuffer::Initialize() {
 
 void CircularBuffer::Shutdown() {
   Clear();
+  for (auto& block : growth_blocks_) {
+    DestroyGrowthBlock(block.get());
+  }
+  growth_blocks_.clear();
   if (host_base_) {
     vkUnmapMemory(*device_, gpu_memory_);
     host_base_ = nullptr;
@@ -136,10 +140,28 @@ void CircularBuffer::GetBufferMemoryRequirements(VkMemoryRequirements* reqs) {
   vkGetBufferMemoryRequirements(*device_, gpu_buffer_, reqs);
 }
 
-bool CircularBuffer::CanAcquire(VkDeviceSize length) {
+bool CircularBuffer::CanAcquire(VkDeviceSize length, bool allow_growth) {
   // Make sure the length is aligned.
   length = xe::round_up(length, alignment_);
-  if (allocations_.empty()) {
+  if (CanAcquireFromRing(length)) {
+    return true;
+  }
+  if (!allow_growth || length > capacity_) {
+    return false;
+  }
+  if (growth_blocks_.size() < max_growth_blocks_) {
+    return true;
+  }
+  for (auto& block : growth_blocks_) {
+    if (capacity_ - block->used >= length) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool CircularBuffer::CanAcquireFromRing(VkDeviceSize length) {
+  if (!ring_allocation_count_) {
     // Read head has caught up to write head (entire buffer available for write)
     assert_true(read_head_ == write_head_);
     return capacity_ >= length;
@@ -166,11 +188,35 @@ bool CircularBuffer::CanAcquire(VkDeviceSize length) {
 }
 
 CircularBuffer::Allocation* CircularBuffer::Acquire(VkDeviceSize length,
-                                                    VkFence fence) {
+                                                    VkFence fence,
+                                                    bool allow_growth) {
   VkDeviceSize aligned_length = xe::round_up(length, alignment_);
-  if (!CanAcquire(aligned_length)) {
-    return nullptr;
+  if (!CanAcquireFromRing(aligned_length)) {
+    GrowthBlock* block =
+        allow_growth ? GetGrowthBlock(aligned_length) : nullptr;
+    if (!block) {
+      return nullptr;
+    }
+    Allocation alloc;
+    alloc.host_ptr = block->host_base + block->used;
+    alloc.buffer = block->buffer;
+    alloc.gpu_memory = block->memory;
+    alloc.offset = block->used;
+    alloc.length = length;
+    alloc.aligned_length = aligned_length;
+    alloc.fence = fence;
+    block->used += aligned_length;
+    ++block->allocation_count;
+    block->idle_scavenges = 0;
+    used_bytes_ += aligned_length;
+    high_water_mark_ = std::max(high_water_mark_, used_bytes_);
+    allocations_.push(alloc);
+
+    return &allocations_.back();
   }
+  ++ring_allocation_count_;
+  used_bytes_ += aligned_length;
+  high_water_mark_ = std::max(high_water_mark_, used_bytes_);
 
   assert_true(write_head_ % alignment_ == 0);
   if (write_head_ < read_head_) {
@@ -179,6 +225,7 @@ CircularBuffer::Allocation* CircularBuffer::Acquire(VkDeviceSize length,
 
     Allocation alloc;
     alloc.host_ptr = host_base_ + write_head_;
+    alloc.buffer = gpu_buffer_;
     alloc.gpu_memory = gpu_memory_;
     alloc.offset = gpu_base_ + write_head_;
     alloc.length = length;
@@ -194,6 +241,7 @@ CircularBuffer::Allocation* CircularBuffer::Acquire(VkDeviceSize length,
       // Free space from write -> capacity
       Allocation alloc;
       alloc.host_ptr = host_base_ + write_head_;
+      alloc.buffer = gpu_buffer_;
       alloc.gpu_memory = gpu_memory_;
       alloc.offset = gpu_base_ + write_head_;
       alloc.length = length;
@@ -208,6 +256,7 @@ CircularBuffer::Allocation* CircularBuffer::Acquire(VkDeviceSize length,
       // from begin -> read
       Allocation alloc;
       alloc.host_ptr = host_base_ + 0;
+      alloc.buffer = gpu_buffer_;
       alloc.gpu_memory = gpu_memory_;
       alloc.offset = gpu_base_ + 0;
       alloc.length = length;
@@ -220,15 +269,97 @@ CircularBuffer::Allocation* CircularBuffer::Acquire(VkDeviceSize length,
     }
   }
 
+  --ring_allocation_count_;
+  used_bytes_ -= aligned_length;
+  return nullptr;
+}
+
+CircularBuffer::GrowthBlock* CircularBuffer::GetGrowthBlock(
+    VkDeviceSize aligned_length) {
+  if (aligned_length > capacity_) {
+    return nullptr;
+  }
+  for (auto& block : growth_blocks_) {
+    if (capacity_ - block->used >= aligned_length) {
+      return block.get();
+    }
+  }
+  if (growth_blocks_.size() >= max_growth_blocks_) {
+    return nullptr;
+  }
+
+  auto block = std::make_unique<GrowthBlock>();
+  VkBufferCreateInfo buffer_info;
+  buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+  buffer_info.pNext = nullptr;
+  buffer_info.flags = 0;
+  buffer_info.size = capacity_;
+  buffer_info.usage = usage_;
+  buffer_info.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  buffer_info.queueFamilyIndexCount = 0;
+  buffer_info.pQueueFamilyIndices = nullptr;
+  VkResult status =
+      vkCreateBuffer(*device_, &buffer_info, nullptr, &block->buffer);
+  CheckResult(status, "vkCreateBuffer");
+  if (status == VK_SUCCESS) {
+    VkMemoryRequirements reqs;
+    vkGetBufferMemoryRequirements(*device_, block->buffer, &reqs);
+    block->memory = device_->AllocateMemory(reqs);
+    status = block->memory ? VK_SUCCESS : VK_ERROR_OUT_OF_DEVICE_MEMORY;
+  }
+  if (status == VK_SUCCESS) {
+    status = vkBindBufferMemory(*device_, block->buffer, block->memory, 0);
+    CheckResult(status, "vkBindBufferMemory");
+  }
+  if (status == VK_SUCCESS) {
+    status = vkMapMemory(*device_, block->memory, 0, capacity_, 0,
+                         reinterpret_cast<void**>(&block->host_base));
+    CheckResult(status, "vkMapMemory");
+  }
+  if (status != VK_SUCCESS) {
+    XELOGW("CircularBuffer: failed to create a growth block");
+    DestroyGrowthBlock(block.get());
+    // Don't keep retrying every acquisition.
+    max_growth_blocks_ = uint32_t(growth_blocks_.size());
+    return nullptr;
+  }
+
+  growth_blocks_.push_back(std::move(block));
+  return growth_blocks_.back().get();
+}
+
+CircularBuffer::GrowthBlock* CircularBuffer::FindGrowthBlock(VkBuffer buffer) {
+  for (auto& block : growth_blocks_) {
+    if (block->buffer == buffer) {
+      return block.get();
+    }
+  }
   return nullptr;
 }
 
+void CircularBuffer::DestroyGrowthBlock(GrowthBlock* block) {
+  if (block->host_base) {
+    vkUnmapMemory(*device_, block->memory);
+    block->host_base = nullptr;
+  }
+  if (block->buffer) {
+    vkDestroyBuffer(*device_, block->buffer, nullptr);
+    block->buffer = nullptr;
+  }
+  if (block->memory) {
+    vkFreeMemory(*device_, block->memory, nullptr);
+    block->memory = nullptr;
+  }
+}
+
 void CircularBuffer::Flush(Allocation* allocation) {
   VkMappedMemoryRange range;
   range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
   range.pNext = nullptr;
-  range.memory = gpu_memory_;
-  range.offset = gpu_base_ + allocation->offset;
+  range.memory = allocation->gpu_memory;
+  range.offset = allocation->buffer == gpu_buffer_
+                     ? gpu_base_ + allocation->offset
+                     : allocation->offset;
   range.size = allocation->length;
   vkFlushMappedMemoryRanges(*device_, 1, &range);
 }
@@ -246,6 +377,12 @@ void CircularBuffer::Flush(VkDeviceSize offset, VkDeviceSize length) {
 void CircularBuffer::Clear() {
   allocations_ = std::queue<Allocation>{};
   write_head_ = read_head_ = 0;
+  ring_allocation_count_ = 0;
+  for (auto& block : growth_blocks_) {
+    block->used = 0;
+    block->allocation_count = 0;
+  }
+  used_bytes_ = 0;
 }
 
 void CircularBuffer::Scavenge() {
@@ -260,20 +397,42 @@ void CircularBuffer::Scavenge() {
     }
 
     fence = alloc.fence;
-    if (capacity_ - read_head_ < alloc.aligned_length) {
-      // This allocation is stored at the beginning of the buffer.
-      read_head_ = alloc.aligned_length;
+    used_bytes_ -= alloc.aligned_length;
+    if (alloc.buffer != gpu_buffer_) {
+      GrowthBlock* block = FindGrowthBlock(alloc.buffer);
+      assert_not_null(block);
+      if (!--block->allocation_count) {
+        block->used = 0;
+      }
     } else {
-      read_head_ += alloc.aligned_length;
+      --ring_allocation_count_;
+      if (capacity_ - read_head_ < alloc.aligned_length) {
+        // This allocation is stored at the beginning of the buffer.
+        read_head_ = alloc.aligned_length;
+      } else {
+        read_head_ += alloc.aligned_length;
+      }
     }
 
     allocations_.pop();
   }
 
-  if (allocations_.empty()) {
+  if (!ring_allocation_count_) {
     // Reset R/W heads to work around fragmentation issues.
     read_head_ = write_head_ = 0;
   }
+
+  // Shrink back once the pressure is gone.
+  for (auto it = growth_blocks_.begin(); it != growth_blocks_.end();) {
+    GrowthBlock* block = it->get();
+    if (block->allocation_count ||
+        ++block->idle_scavenges <= kGrowthBlockIdleScavenges) {
+      ++it;
+      continue;
+    }
+    DestroyGrowthBlock(block);
+    it = growth_blocks_.erase(it);
+  }
 }
 
 }  // namespace vulkan
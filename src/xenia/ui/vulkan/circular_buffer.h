@@ -10,7 +10,9 @@
 #ifndef XENIA_UI_VULKAN_CIRCULAR_BUFFER_H_
 #define XENIA_UI_VULKAN_CIRCULAR_BUFFER_H_
 
+#include <memory>
 #include <queue>
+#include <vector>
 
 #include "xenia/ui/vulkan/vulkan.h"
 #include "xenia/ui/vulkan/vulkan_device.h"
@@ -25,6 +27,11 @@ namespace vulkan {
 //
 // Allocations loop around the buffer in circles (but are not fragmented at the
 // ends of the buffer), where trailing older allocations are freed after use.
+//
+// If growth is enabled, callers that can take an allocation from any buffer
+// may get one from additional blocks of the same capacity when the ring is
+// full, instead of having to wait for it to drain. Blocks are freed again
+// after staying unused for a while.
 class CircularBuffer {
  public:
   CircularBuffer(VulkanDevice* device, VkBufferUsageFlags usage,
@@ -33,6 +40,8 @@ class CircularBuffer {
 
   struct Allocation {
     void* host_ptr;
+    // gpu_buffer(), unless in a growth block.
+    VkBuffer buffer;
     VkDeviceMemory gpu_memory;
     VkDeviceSize offset;
     VkDeviceSize length;
@@ -55,11 +64,22 @@ class CircularBuffer {
   VkDeviceMemory gpu_memory() const { return gpu_memory_; }
   uint8_t* host_base() const { return host_base_; }
 
-  bool CanAcquire(VkDeviceSize length);
+  // Lets up to max_blocks growth blocks be chained.
+  void EnableGrowth(uint32_t max_blocks) { max_growth_blocks_ = max_blocks; }
+
+  // Bytes of the ring and growth blocks held by allocations, and the most
+  // ever held at once.
+  VkDeviceSize used_bytes() const { return used_bytes_; }
+  VkDeviceSize high_water_mark() const { return high_water_mark_; }
+  size_t growth_block_count() const { return growth_blocks_.size(); }
+
+  // allow_growth permits a growth block if the ring itself is full.
+  bool CanAcquire(VkDeviceSize length, bool allow_growth = false);
 
   // Acquires space to hold memory. This allocation is only freed when the fence
   // reaches the signaled state.
-  Allocation* Acquire(VkDeviceSize length, VkFence fence);
+  Allocation* Acquire(VkDeviceSize length, VkFence fence,
+                      bool allow_growth = false);
   void Flush(Allocation* allocation);
   void Flush(VkDeviceSize offset, VkDeviceSize length);
 
@@ -70,6 +90,25 @@ class CircularBuffer {
   void Scavenge();
 
  private:
+  // Allocated from linearly, and rewound once all of its allocations are
+  // freed.
+  struct GrowthBlock {
+    VkBuffer buffer = nullptr;
+    VkDeviceMemory memory = nullptr;
+    uint8_t* host_base = nullptr;
+    VkDeviceSize used = 0;
+    uint32_t allocation_count = 0;
+    // Scavenges it has gone without allocations for.
+    uint32_t idle_scavenges = 0;
+  };
+  // Scavenges a growth block may stay unused before being freed.
+  static constexpr uint32_t kGrowthBlockIdleScavenges = 120;
+
+  bool CanAcquireFromRing(VkDeviceSize aligned_length);
+  GrowthBlock* GetGrowthBlock(VkDeviceSize aligned_length);
+  GrowthBlock* FindGrowthBlock(VkBuffer buffer);
+  void DestroyGrowthBlock(GrowthBlock* block);
+
   // All of these variables are relative to gpu_base
   VkDeviceSize capacity_ = 0;
   VkDeviceSize alignment_ = 0;
@@ -77,6 +116,7 @@ class CircularBuffer {
   VkDeviceSize read_head_ = 0;
 
   VulkanDevice* device_;
+  VkBufferUsageFlags usage_;
   bool owns_gpu_memory_ = false;
   VkBuffer gpu_buffer_ = nullptr;
   VkDeviceMemory gpu_memory_ = nullptr;
@@ -84,6 +124,13 @@ class CircularBuffer {
   uint8_t* host_base_ = nullptr;
 
   std::queue<Allocation> allocations_;
+  // Allocations in the ring itself.
+  size_t ring_allocation_count_ = 0;
+
+  uint32_t max_growth_blocks_ = 0;
+  std::vector<std::unique_ptr<GrowthBlock>> growth_blocks_;
+  VkDeviceSize used_bytes_ = 0;
+  VkDeviceSize high_water_mark_ = 0;
 };
 
 }  // namespace vulkan
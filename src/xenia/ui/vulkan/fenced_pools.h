@@ -10,6 +10,7 @@
 #ifndef XENIA_UI_VULKAN_FENCED_POOLS_H_
 #define XENIA_UI_VULKAN_FENCED_POOLS_H_
 
+#include <cstdint>
 #include <memory>
 
 #include "xenia/base/assert.h"
@@ -44,31 +45,76 @@ class BaseFencedPool {
   // True if a batch is open.
   bool has_open_batch() const { return open_batch_ != nullptr; }
 
+  // Every batch is given a serial when it begins, increasing by one each
+  // time. All pending batches with a serial up to this one have completed.
+  uint64_t completed_serial() const { return completed_serial_; }
+
+  // Polls the pending batches that are not known to have completed yet, in
+  // order, and advances completed_serial() up to the first one still in
+  // flight. Nothing is reclaimed.
+  uint64_t UpdateCompletedSerial() {
+    for (auto batch = pending_batch_list_head_; batch; batch = batch->next) {
+      if (batch->serial <= completed_serial_) {
+        continue;
+      }
+      VkResult status = vkGetFenceStatus(device_, batch->fence);
+      if (status != VK_SUCCESS && status != VK_ERROR_DEVICE_LOST) {
+        // Since batches are executed in order we know no others after it
+        // could have completed.
+        break;
+      }
+      completed_serial_ = batch->serial;
+    }
+    return completed_serial_;
+  }
+
+  // Whether the work signaling a fence has completed. Fences of this pool
+  // are answered from the batch serials, so a fence is only polled once
+  // however many objects reference it, and not at all once its batch is known
+  // to be done. Other fences are polled directly.
+  bool IsFenceSignaled(VkFence fence) {
+    if (open_batch_ && open_batch_->fence == fence) {
+      return false;
+    }
+    for (auto batch = pending_batch_list_head_; batch; batch = batch->next) {
+      if (batch->fence == fence) {
+        return batch->serial <= completed_serial_ ||
+               batch->serial <= UpdateCompletedSerial();
+      }
+    }
+    for (auto batch = free_batch_list_head_; batch; batch = batch->next) {
+      if (batch->fence == fence && (batch->flags & kBatchOwnsFence)) {
+        // Reclaimed already, and not reused since.
+        return true;
+      }
+    }
+    VkResult status = vkGetFenceStatus(device_, fence);
+    return status == VK_SUCCESS || status == VK_ERROR_DEVICE_LOST;
+  }
+
   // Checks all pending batches for completion and scavenges their entries.
   // This should be called as frequently as reasonable.
   void Scavenge() {
+    UpdateCompletedSerial();
     while (pending_batch_list_head_) {
       auto batch = pending_batch_list_head_;
       assert_not_null(batch->fence);
-
-      VkResult status = vkGetFenceStatus(device_, batch->fence);
-      if (status == VK_SUCCESS || status == VK_ERROR_DEVICE_LOST) {
-        // Batch has completed. Reclaim.
-        pending_batch_list_head_ = batch->next;
-        if (batch == pending_batch_list_tail_) {
-          pending_batch_list_tail_ = nullptr;
-        }
-        batch->next = free_batch_list_head_;
-        free_batch_list_head_ = batch;
-        batch->entry_list_tail->next = free_entry_list_head_;
-        free_entry_list_head_ = batch->entry_list_head;
-        batch->entry_list_head = nullptr;
-        batch->entry_list_tail = nullptr;
-      } else {
-        // Batch is still in-flight. Since batches are executed in order we know
-        // no others after it could have completed, so early-exit.
+      if (batch->serial > completed_serial_) {
+        // Batch is still in-flight.
         return;
       }
+
+      // Batch has completed. Reclaim.
+      pending_batch_list_head_ = batch->next;
+      if (batch == pending_batch_list_tail_) {
+        pending_batch_list_tail_ = nullptr;
+      }
+      batch->next = free_batch_list_head_;
+      free_batch_list_head_ = batch;
+      batch->entry_list_tail->next = free_entry_list_head_;
+      free_entry_list_head_ = batch->entry_list_head;
+      batch->entry_list_head = nullptr;
+      batch->entry_list_tail = nullptr;
     }
   }
 
@@ -133,6 +179,7 @@ class BaseFencedPool {
     }
     batch->entry_list_head = nullptr;
     batch->entry_list_tail = nullptr;
+    batch->serial = next_serial_++;
     open_batch_ = batch;
 
     return batch->fence;
@@ -272,6 +319,7 @@ class BaseFencedPool {
     Entry* entry_list_tail;
     uint32_t flags;
     VkFence fence;
+    uint64_t serial;
   };
 
   static const uint32_t kBatchOwnsFence = 1;
@@ -281,6 +329,8 @@ class BaseFencedPool {
   Batch* pending_batch_list_head_ = nullptr;
   Batch* pending_batch_list_tail_ = nullptr;
   Batch* open_batch_ = nullptr;
+  uint64_t next_serial_ = 1;
+  uint64_t completed_serial_ = 0;
 };
 
 class CommandBufferPool
@@ -0,0 +1,28 @@
+// NOTE: This file is compiled and embedded into the exe.
+//       Use `xenia-build genspirv` and check in any changes under bin/.
+
+#version 450 core
+precision highp float;
+
+layout(push_constant) uniform PushConstants {
+  layout(offset = 0x20) vec3 _pad;
+  layout(offset = 0x2C) int swap;
+} push_constants;
+
+layout(set = 0, binding = 0) uniform sampler2D src_texture;
+// 256x1, with the output for the input i / 255 in texel i.
+layout(set = 1, binding = 0) uniform sampler2D gamma_ramp;
+
+layout(location = 0) in vec2 vtx_uv;
+layout(location = 0) out vec4 oC;
+
+void main() {
+  oC = texture(src_texture, vtx_uv);
+  if (push_constants.swap != 0) oC = oC.bgra;
+
+  // Texel i is centered at (i + 0.5) / 256.
+  vec3 ramp_u = oC.rgb * (255.0 / 256.0) + (0.5 / 256.0);
+  oC = vec4(textureLod(gamma_ramp, vec2(ramp_u.r, 0.5), 0.0).r,
+            textureLod(gamma_ramp, vec2(ramp_u.g, 0.5), 0.0).g,
+            textureLod(gamma_ramp, vec2(ramp_u.b, 0.5), 0.0).b, oC.a);
+}
@@ -148,10 +148,12 @@ void VulkanContext::BeginSwap() {
 
   // If we have a window see if it's been resized since we last swapped.
   // If it has been, we'll need to reinitialize the swap chain before we
-  // start touching it.
+  // start touching it. This only waits for the previous swap, so the command
+  // processor keeps rendering into its own targets meanwhile.
   if (target_window_) {
     if (target_window_->scaled_width() != swap_chain_->surface_width() ||
-        target_window_->scaled_height() != swap_chain_->surface_height()) {
+        target_window_->scaled_height() != swap_chain_->surface_height() ||
+        swap_chain_->is_out_of_date()) {
       // Resized!
       swap_chain_->Reinitialize();
     }
@@ -160,21 +162,30 @@ void VulkanContext::BeginSwap() {
   if (!context_lost_) {
     // Acquire the next image and set it up for use.
     status = swap_chain_->Begin();
+    if (status == VK_ERROR_OUT_OF_DATE_KHR &&
+        swap_chain_->Reinitialize() == VK_SUCCESS) {
+      // Changed since the size was checked, such as by toggling fullscreen.
+      status = swap_chain_->Begin();
+    }
     if (status == VK_ERROR_DEVICE_LOST) {
       context_lost_ = true;
     }
   }
 
+  // Work on the primary queue, such as what the command processor renders
+  // into the images copied to the target image, is only ordered before the
+  // swap if it's on the same queue. Begin has already waited for the previous
+  // swap, so otherwise nothing needs to wait, and frames still executing on
+  // the GPU don't hold up presentation.
   // TODO(benvanik): use a fence instead? May not be possible with target image.
-  std::lock_guard<std::mutex> queue_lock(device->primary_queue_mutex());
-  status = vkQueueWaitIdle(device->primary_queue());
+  if (!swap_chain_->uses_primary_queue()) {
+    std::lock_guard<std::mutex> queue_lock(device->primary_queue_mutex());
+    status = vkQueueWaitIdle(device->primary_queue());
+  }
 }
 
 void VulkanContext::EndSwap() {
   SCOPE_profile_cpu_f("gpu");
-  auto provider = static_cast<VulkanProvider*>(provider_);
-  auto device = provider->device();
-
   VkResult status;
 
   if (!context_lost_) {
@@ -186,10 +197,8 @@ void VulkanContext::EndSwap() {
     }
   }
 
-  // Wait until the queue is idle.
-  // TODO(benvanik): is this required?
-  std::lock_guard<std::mutex> queue_lock(device->primary_queue_mutex());
-  status = vkQueueWaitIdle(device->primary_queue());
+  // The next Begin waits for this swap to complete, so the queue doesn't need
+  // to go idle, which would include the command processor's frames.
 }
 
 std::unique_ptr<RawImage> VulkanContext::Capture() {
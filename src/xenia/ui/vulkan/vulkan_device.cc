@@ -63,6 +63,14 @@ VulkanDevice::VulkanDevice(VulkanInstance* instance) : instance_(instance) {
   // Debug markers (optional)
   DeclareRequiredExtension(VK_EXT_DEBUG_MARKER_EXTENSION_NAME,
                            Version::Make(0, 0, 0), true);
+  // Push descriptors (optional)
+  DeclareRequiredExtension(VK_KHR_PUSH_DESCRIPTOR_EXTENSION_NAME,
+                           Version::Make(0, 0, 0), true);
+  // Importing guest memory (optional)
+  DeclareRequiredExtension(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME,
+                           Version::Make(0, 0, 0), true);
+  DeclareRequiredExtension(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME,
+                           Version::Make(0, 0, 0), true);
 
   DeclareRequiredExtension(VK_KHR_SAMPLER_MIRROR_CLAMP_TO_EDGE_EXTENSION_NAME,
                            Version::Make(0, 0, 0), false);
@@ -116,6 +124,9 @@ bool VulkanDevice::Initialize(DeviceInfo device_info) {
   ENABLE_AND_EXPECT(independentBlend);
   ENABLE_AND_EXPECT(textureCompressionBC);
   // TODO(benvanik): add other features.
+  // Exact occlusion query sample counts (optional).
+  enabled_features.occlusionQueryPrecise =
+      supported_features.occlusionQueryPrecise;
   if (any_features_missing) {
     XELOGE(
         "One or more required device features are missing; aborting "
@@ -9,6 +9,9 @@
 
 #include "xenia/ui/vulkan/vulkan_immediate_drawer.h"
 
+#include <algorithm>
+#include <cstring>
+
 #include "xenia/base/assert.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
@@ -25,12 +28,20 @@ namespace vulkan {
 #include "xenia/ui/vulkan/shaders/bin/immediate_frag.h"
 #include "xenia/ui/vulkan/shaders/bin/immediate_vert.h"
 
-constexpr uint32_t kCircularBufferCapacity = 2 * 1024 * 1024;
+// Initial size of the upload buffer, grown to fit what a frame needs.
+constexpr size_t kUploadBufferInitialCapacity = 2 * 1024 * 1024;
+// TODO(benvanik): query nonCoherentAtomSize.
+constexpr VkDeviceSize kUploadBufferFlushAlignment = 256;
 
-class LightweightCircularBuffer {
+// Vertices and indices of the current frame, written in order from the start
+// of the buffer. The swap chain waits for the previous frame to finish before
+// beginning a new one, so the buffer is reused from the start each frame and
+// nothing drawn in the frame is ever overwritten.
+class ImmediateUploadBuffer {
  public:
-  LightweightCircularBuffer(VulkanDevice* device) : device_(*device) {
-    buffer_capacity_ = xe::round_up(kCircularBufferCapacity, 4096);
+  ImmediateUploadBuffer(VulkanDevice* device, size_t capacity)
+      : device_(*device) {
+    buffer_capacity_ = xe::round_up(capacity, 4096);
 
     // Index buffer.
     VkBufferCreateInfo index_buffer_info;
@@ -75,10 +86,9 @@ class LightweightCircularBuffer {
     CheckResult(status, "vkMapMemory");
   }
 
-  ~LightweightCircularBuffer() {
+  ~ImmediateUploadBuffer() {
     if (buffer_memory_) {
       vkUnmapMemory(device_, buffer_memory_);
-      buffer_memory_ = nullptr;
     }
 
     VK_SAFE_DESTROY(vkDestroyBuffer, device_, index_buffer_, nullptr);
@@ -88,44 +98,49 @@ class LightweightCircularBuffer {
 
   VkBuffer vertex_buffer() const { return vertex_buffer_; }
   VkBuffer index_buffer() const { return index_buffer_; }
+  size_t capacity() const { return buffer_capacity_; }
 
-  // Allocates space for data and copies it into the buffer.
-  // Returns the offset in the buffer of the data or VK_WHOLE_SIZE if the buffer
-  // is full.
-  VkDeviceSize Emplace(const void* source_data, size_t source_length) {
-    // TODO(benvanik): query actual alignment.
-    source_length = xe::round_up(source_length, 256);
-
-    // Run down old fences to free up space.
-
-    // Check to see if we have space.
-    // return VK_WHOLE_SIZE;
+  // Starts a new frame, once the previous one has finished on the GPU.
+  void Reset() {
+    current_offset_ = 0;
+    flushed_offset_ = 0;
+  }
 
-    // Compute new range and mark as in use.
-    if (current_offset_ + source_length > buffer_capacity_) {
-      // Wraps around.
-      current_offset_ = 0;
+  // Copies data into the buffer at a multiple of alignment.
+  // Returns the offset in the buffer of the data or VK_WHOLE_SIZE if the frame
+  // doesn't fit in it.
+  VkDeviceSize Emplace(const void* source_data, size_t source_length,
+                       size_t alignment) {
+    size_t offset = (current_offset_ + alignment - 1) / alignment * alignment;
+    if (offset + source_length > buffer_capacity_) {
+      return VK_WHOLE_SIZE;
     }
-    VkDeviceSize offset = current_offset_;
-    current_offset_ += source_length;
+    current_offset_ = offset + source_length;
 
-    // Copy data.
     auto dest_ptr = reinterpret_cast<uint8_t*>(buffer_data_) + offset;
     std::memcpy(dest_ptr, source_data, source_length);
+    return offset;
+  }
 
-    // Insert fence.
-    // TODO(benvanik): coarse-grained fences, these may be too fine.
-
-    // Flush memory.
-    // TODO(benvanik): do only in large batches? can barrier it.
+  // Flushes everything written since the last flush, so that it is flushed
+  // once per Begin/End rather than once per batch.
+  void Flush() {
+    if (current_offset_ == flushed_offset_) {
+      return;
+    }
+    const VkDeviceSize alignment = kUploadBufferFlushAlignment;
+    VkDeviceSize begin = flushed_offset_ / alignment * alignment;
+    VkDeviceSize end =
+        std::min((current_offset_ + alignment - 1) / alignment * alignment,
+                 VkDeviceSize(buffer_capacity_));
     VkMappedMemoryRange dirty_range;
     dirty_range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
     dirty_range.pNext = nullptr;
     dirty_range.memory = buffer_memory_;
-    dirty_range.offset = offset;
-    dirty_range.size = source_length;
+    dirty_range.offset = begin;
+    dirty_range.size = end - begin;
     vkFlushMappedMemoryRanges(device_, 1, &dirty_range);
-    return offset;
+    flushed_offset_ = current_offset_;
   }
 
  private:
@@ -137,6 +152,7 @@ class LightweightCircularBuffer {
   void* buffer_data_ = nullptr;
   size_t buffer_capacity_ = 0;
   size_t current_offset_ = 0;
+  size_t flushed_offset_ = 0;
 };
 
 class VulkanImmediateTexture : public ImmediateTexture {
@@ -689,7 +705,8 @@ VkResult VulkanImmediateDrawer::Initialize() {
   VK_SAFE_DESTROY(vkDestroyShaderModule, *device, fragment_shader, nullptr);
 
   // Allocate the buffer we'll use for our vertex and index data.
-  circular_buffer_ = std::make_unique<LightweightCircularBuffer>(device);
+  upload_buffer_ = std::make_unique<ImmediateUploadBuffer>(
+      device, kUploadBufferInitialCapacity);
 
   return status;
 }
@@ -697,7 +714,7 @@ VkResult VulkanImmediateDrawer::Initialize() {
 void VulkanImmediateDrawer::Shutdown() {
   auto device = context_->device();
 
-  circular_buffer_.reset();
+  upload_buffer_.reset();
 
   VK_SAFE_DESTROY(vkDestroyPipeline, *device, line_pipeline_, nullptr);
   VK_SAFE_DESTROY(vkDestroyPipeline, *device, triangle_pipeline_, nullptr);
@@ -765,6 +782,31 @@ void VulkanImmediateDrawer::Begin(int render_target_width,
   current_render_target_width_ = render_target_width;
   current_render_target_height_ = render_target_height;
 
+  // Other users of the command buffer may have changed anything since the
+  // last Begin.
+  buffers_bound_ = false;
+  bound_pipeline_ = nullptr;
+  bound_texture_set_ = nullptr;
+  bound_restrict_texture_samples_ = -1;
+  scissor_valid_ = false;
+  has_pending_draw_ = false;
+
+  // The frame before this one has finished now, so its vertices and indices
+  // can be overwritten. Grow the buffer if that frame didn't fit in it.
+  uint64_t frame_number = swap_chain->frame_number();
+  if (frame_number != upload_frame_number_) {
+    upload_frame_number_ = frame_number;
+    if (upload_frame_length_ > upload_buffer_->capacity()) {
+      size_t capacity = upload_frame_length_ + upload_frame_length_ / 2;
+      XELOGI("Growing the immediate drawer upload buffer to %zu KB",
+             capacity / 1024);
+      upload_buffer_ =
+          std::make_unique<ImmediateUploadBuffer>(device, capacity);
+    }
+    upload_buffer_->Reset();
+    upload_frame_length_ = 0;
+  }
+
   // Viewport changes only once per batch.
   VkViewport viewport;
   viewport.x = 0.0f;
@@ -788,47 +830,102 @@ void VulkanImmediateDrawer::Begin(int render_target_width,
 }
 
 void VulkanImmediateDrawer::BeginDrawBatch(const ImmediateDrawBatch& batch) {
-  auto device = context_->device();
-
-  // Upload vertices.
-  VkDeviceSize vertices_offset = circular_buffer_->Emplace(
-      batch.vertices, batch.vertex_count * sizeof(ImmediateVertex));
+  // Upload vertices and indices at whole elements from the start of the
+  // buffer, so that both are bound once and the draws are offset into them.
+  size_t vertices_length = batch.vertex_count * sizeof(ImmediateVertex);
+  size_t indices_length = batch.indices ? batch.index_count * sizeof(uint16_t)
+                                        : 0;
+  upload_frame_length_ += vertices_length + sizeof(ImmediateVertex) +
+                          indices_length + sizeof(uint16_t);
+  batch_valid_ = false;
+  VkDeviceSize vertices_offset = upload_buffer_->Emplace(
+      batch.vertices, vertices_length, sizeof(ImmediateVertex));
   if (vertices_offset == VK_WHOLE_SIZE) {
-    // TODO(benvanik): die?
+    // Dropped for this frame, the buffer will fit it in the next one.
     return;
   }
-  auto vertex_buffer = circular_buffer_->vertex_buffer();
-  vkCmdBindVertexBuffers(current_cmd_buffer_, 0, 1, &vertex_buffer,
-                         &vertices_offset);
+  batch_base_vertex_ = int32_t(vertices_offset / sizeof(ImmediateVertex));
 
-  // Upload indices.
   if (batch.indices) {
-    VkDeviceSize indices_offset = circular_buffer_->Emplace(
-        batch.indices, batch.index_count * sizeof(uint16_t));
+    VkDeviceSize indices_offset = upload_buffer_->Emplace(
+        batch.indices, indices_length, sizeof(uint16_t));
     if (indices_offset == VK_WHOLE_SIZE) {
-      // TODO(benvanik): die?
       return;
     }
-    vkCmdBindIndexBuffer(current_cmd_buffer_, circular_buffer_->index_buffer(),
-                         indices_offset, VK_INDEX_TYPE_UINT16);
+    batch_first_index_ = uint32_t(indices_offset / sizeof(uint16_t));
+  }
+
+  if (!buffers_bound_) {
+    auto vertex_buffer = upload_buffer_->vertex_buffer();
+    VkDeviceSize zero_offset = 0;
+    vkCmdBindVertexBuffers(current_cmd_buffer_, 0, 1, &vertex_buffer,
+                           &zero_offset);
+    vkCmdBindIndexBuffer(current_cmd_buffer_, upload_buffer_->index_buffer(),
+                         0, VK_INDEX_TYPE_UINT16);
+    buffers_bound_ = true;
   }
 
   batch_has_index_buffer_ = !!batch.indices;
+  batch_valid_ = true;
 }
 
 void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
+  if (!batch_valid_ || !draw.count) {
+    return;
+  }
+
+  // Consecutive draws with the same state, continuing each other in the
+  // buffers, as the draw lists of imgui mostly are, are issued as one.
+  if (has_pending_draw_) {
+    auto& pending = pending_draw_;
+    bool same_state =
+        draw.primitive_type == pending.primitive_type &&
+        draw.texture_handle == pending.texture_handle &&
+        draw.restrict_texture_samples == pending.restrict_texture_samples &&
+        draw.alpha_blend == pending.alpha_blend &&
+        draw.scissor == pending.scissor &&
+        (!draw.scissor ||
+         std::memcmp(draw.scissor_rect, pending.scissor_rect,
+                     sizeof(draw.scissor_rect)) == 0);
+    bool continues =
+        batch_has_index_buffer_
+            ? draw.base_vertex == pending.base_vertex &&
+                  draw.index_offset == pending.index_offset + pending.count
+            : draw.base_vertex == pending.base_vertex + pending.count;
+    if (same_state && continues) {
+      pending.count += draw.count;
+      return;
+    }
+    FlushPendingDraw();
+  }
+  pending_draw_ = draw;
+  has_pending_draw_ = true;
+}
+
+void VulkanImmediateDrawer::FlushPendingDraw() {
+  if (!has_pending_draw_) {
+    return;
+  }
+  has_pending_draw_ = false;
+  const ImmediateDraw& draw = pending_draw_;
+
+  VkPipeline pipeline = nullptr;
   switch (draw.primitive_type) {
     case ImmediatePrimitiveType::kLines:
-      vkCmdBindPipeline(current_cmd_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        line_pipeline_);
+      pipeline = line_pipeline_;
       break;
     case ImmediatePrimitiveType::kTriangles:
-      vkCmdBindPipeline(current_cmd_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
-                        triangle_pipeline_);
+      pipeline = triangle_pipeline_;
       break;
   }
+  if (pipeline != bound_pipeline_) {
+    vkCmdBindPipeline(current_cmd_buffer_, VK_PIPELINE_BIND_POINT_GRAPHICS,
+                      pipeline);
+    bound_pipeline_ = pipeline;
+  }
 
-  // Setup texture binding.
+  // Setup texture binding. Each texture has its own descriptor set, created
+  // with it.
   auto texture = reinterpret_cast<VulkanImmediateTexture*>(draw.texture_handle);
   if (texture) {
     if (texture->layout() != VK_IMAGE_LAYOUT_GENERAL) {
@@ -840,17 +937,23 @@ void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
       XELOGW("Failed to acquire texture descriptor set for immediate drawer!");
     }
 
-    vkCmdBindDescriptorSets(current_cmd_buffer_,
-                            VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline_layout_,
-                            0, 1, &texture_set, 0, nullptr);
+    if (texture_set != bound_texture_set_) {
+      vkCmdBindDescriptorSets(current_cmd_buffer_,
+                              VK_PIPELINE_BIND_POINT_GRAPHICS,
+                              pipeline_layout_, 0, 1, &texture_set, 0, nullptr);
+      bound_texture_set_ = texture_set;
+    }
   }
 
   // Use push constants for our per-draw changes.
   // Here, the restrict_texture_samples uniform.
   int restrict_texture_samples = draw.restrict_texture_samples ? 1 : 0;
-  vkCmdPushConstants(current_cmd_buffer_, pipeline_layout_,
-                     VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float) * 16,
-                     sizeof(int), &restrict_texture_samples);
+  if (restrict_texture_samples != bound_restrict_texture_samples_) {
+    vkCmdPushConstants(current_cmd_buffer_, pipeline_layout_,
+                       VK_SHADER_STAGE_FRAGMENT_BIT, sizeof(float) * 16,
+                       sizeof(int), &restrict_texture_samples);
+    bound_restrict_texture_samples_ = restrict_texture_samples;
+  }
 
   // Scissor, if enabled.
   // Scissor can be disabled by making it the full screen.
@@ -867,20 +970,36 @@ void VulkanImmediateDrawer::Draw(const ImmediateDraw& draw) {
     scissor.extent.width = current_render_target_width_;
     scissor.extent.height = current_render_target_height_;
   }
-  vkCmdSetScissor(current_cmd_buffer_, 0, 1, &scissor);
+  if (!scissor_valid_ || scissor.offset.x != scissor_.offset.x ||
+      scissor.offset.y != scissor_.offset.y ||
+      scissor.extent.width != scissor_.extent.width ||
+      scissor.extent.height != scissor_.extent.height) {
+    vkCmdSetScissor(current_cmd_buffer_, 0, 1, &scissor);
+    scissor_ = scissor;
+    scissor_valid_ = true;
+  }
 
   // Issue draw.
   if (batch_has_index_buffer_) {
-    vkCmdDrawIndexed(current_cmd_buffer_, draw.count, 1, draw.index_offset,
-                     draw.base_vertex, 0);
+    vkCmdDrawIndexed(current_cmd_buffer_, draw.count, 1,
+                     batch_first_index_ + draw.index_offset,
+                     batch_base_vertex_ + draw.base_vertex, 0);
   } else {
-    vkCmdDraw(current_cmd_buffer_, draw.count, 1, draw.base_vertex, 0);
+    vkCmdDraw(current_cmd_buffer_, draw.count, 1,
+              batch_base_vertex_ + draw.base_vertex, 0);
   }
 }
 
-void VulkanImmediateDrawer::EndDrawBatch() {}
+void VulkanImmediateDrawer::EndDrawBatch() {
+  FlushPendingDraw();
+  batch_valid_ = false;
+}
 
-void VulkanImmediateDrawer::End() { current_cmd_buffer_ = nullptr; }
+void VulkanImmediateDrawer::End() {
+  FlushPendingDraw();
+  upload_buffer_->Flush();
+  current_cmd_buffer_ = nullptr;
+}
 
 VkSampler VulkanImmediateDrawer::GetSampler(ImmediateTextureFilter filter,
                                             bool repeat) {
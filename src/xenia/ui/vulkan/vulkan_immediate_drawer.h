@@ -10,6 +10,7 @@
 #ifndef XENIA_UI_VULKAN_VULKAN_IMMEDIATE_DRAWER_H_
 #define XENIA_UI_VULKAN_VULKAN_IMMEDIATE_DRAWER_H_
 
+#include <cstdint>
 #include <memory>
 
 #include "xenia/ui/immediate_drawer.h"
@@ -19,7 +20,7 @@ namespace xe {
 namespace ui {
 namespace vulkan {
 
-class LightweightCircularBuffer;
+class ImmediateUploadBuffer;
 class VulkanContext;
 
 class VulkanImmediateDrawer : public ImmediateDrawer {
@@ -50,6 +51,9 @@ class VulkanImmediateDrawer : public ImmediateDrawer {
   VkSampler GetSampler(ImmediateTextureFilter filter, bool repeat);
 
  private:
+  // Issues the draws merged in pending_draw_, binding only what changed.
+  void FlushPendingDraw();
+
   VulkanContext* context_ = nullptr;
 
   struct {
@@ -65,9 +69,31 @@ class VulkanImmediateDrawer : public ImmediateDrawer {
   VkPipeline triangle_pipeline_ = nullptr;
   VkPipeline line_pipeline_ = nullptr;
 
-  std::unique_ptr<LightweightCircularBuffer> circular_buffer_;
-
+  std::unique_ptr<ImmediateUploadBuffer> upload_buffer_;
+  // The swap chain frame upload_buffer_ holds the data of, and how much that
+  // frame wanted to upload, even if it didn't fit.
+  uint64_t upload_frame_number_ = UINT64_MAX;
+  size_t upload_frame_length_ = 0;
+
+  // Where the data of the current batch is in upload_buffer_, false if it
+  // didn't fit.
+  bool batch_valid_ = false;
+  int32_t batch_base_vertex_ = 0;
+  uint32_t batch_first_index_ = 0;
   bool batch_has_index_buffer_ = false;
+
+  // Draws of the batch merged so far.
+  bool has_pending_draw_ = false;
+  ImmediateDraw pending_draw_;
+
+  // State bound in current_cmd_buffer_ since Begin.
+  bool buffers_bound_ = false;
+  VkPipeline bound_pipeline_ = nullptr;
+  VkDescriptorSet bound_texture_set_ = nullptr;
+  int bound_restrict_texture_samples_ = -1;
+  bool scissor_valid_ = false;
+  VkRect2D scissor_;
+
   VkCommandBuffer current_cmd_buffer_ = nullptr;
   int current_render_target_width_ = 0;
   int current_render_target_height_ = 0;
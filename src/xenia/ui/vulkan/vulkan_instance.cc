@@ -66,6 +66,13 @@ VulkanInstance::VulkanInstance() {
 
   DeclareRequiredExtension(VK_EXT_DEBUG_MARKER_EXTENSION_NAME,
                            Version::Make(0, 0, 0), true);
+  // Required by some optional device extensions (optional)
+  DeclareRequiredExtension(
+      VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME,
+      Version::Make(0, 0, 0), true);
+  DeclareRequiredExtension(
+      VK_KHR_EXTERNAL_MEMORY_CAPABILITIES_EXTENSION_NAME,
+      Version::Make(0, 0, 0), true);
 }
 
 VulkanInstance::~VulkanInstance() { DestroyInstance(); }
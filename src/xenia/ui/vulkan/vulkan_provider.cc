@@ -52,12 +52,15 @@ VulkanProvider::~VulkanProvider() {
 bool VulkanProvider::Initialize() {
   instance_ = std::make_unique<VulkanInstance>();
 
-  // Always enable the swapchain.
+  // Enable the swapchain, unless there's nothing to present to, in which case
+  // devices without one (such as on a GPU server) can be used too.
 #if XE_PLATFORM_WIN32
-  instance_->DeclareRequiredExtension("VK_KHR_surface", Version::Make(0, 0, 0),
-                                      false);
-  instance_->DeclareRequiredExtension("VK_KHR_win32_surface",
-                                      Version::Make(0, 0, 0), false);
+  if (main_window_) {
+    instance_->DeclareRequiredExtension("VK_KHR_surface",
+                                        Version::Make(0, 0, 0), false);
+    instance_->DeclareRequiredExtension("VK_KHR_win32_surface",
+                                        Version::Make(0, 0, 0), false);
+  }
 #endif
 
   // Attempt initialization and device query.
@@ -78,8 +81,10 @@ bool VulkanProvider::Initialize() {
 
   // Create the device.
   device_ = std::make_unique<VulkanDevice>(instance_.get());
-  device_->DeclareRequiredExtension("VK_KHR_swapchain", Version::Make(0, 0, 0),
-                                    false);
+  if (main_window_) {
+    device_->DeclareRequiredExtension("VK_KHR_swapchain",
+                                      Version::Make(0, 0, 0), false);
+  }
   if (!device_->Initialize(device_info)) {
     XELOGE("Unable to initialize device");
     return false;
@@ -11,6 +11,7 @@
 
 #include <gflags/gflags.h>
 
+#include <algorithm>
 #include <mutex>
 #include <string>
 
@@ -24,6 +25,11 @@
 
 DEFINE_bool(vulkan_random_clear_color, false,
             "Randomizes framebuffer clear color.");
+DEFINE_string(vulkan_present_mode, "",
+              "Presentation mode: fifo (waits for vertical blank), mailbox "
+              "(replaces the queued image, no tearing) or immediate (may "
+              "tear). Empty for mailbox, then immediate, then fifo, whichever "
+              "is supported first.");
 
 namespace xe {
 namespace ui {
@@ -106,117 +112,6 @@ VkResult VulkanSwapChain::Initialize(VkSurfaceKHR surface) {
     surface_format_ = surface_formats[0].format;
   }
 
-  // Query surface min/max/caps.
-  VkSurfaceCapabilitiesKHR surface_caps;
-  status = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(*device_, surface_,
-                                                     &surface_caps);
-  CheckResult(status, "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
-  if (status != VK_SUCCESS) {
-    return status;
-  }
-
-  // Query surface properties so we can configure ourselves within bounds.
-  std::vector<VkPresentModeKHR> present_modes;
-  status = vkGetPhysicalDeviceSurfacePresentModesKHR(*device_, surface_, &count,
-                                                     nullptr);
-  CheckResult(status, "vkGetPhysicalDeviceSurfacePresentModesKHR");
-  if (status != VK_SUCCESS) {
-    return status;
-  }
-
-  present_modes.resize(count);
-  status = vkGetPhysicalDeviceSurfacePresentModesKHR(*device_, surface_, &count,
-                                                     present_modes.data());
-  CheckResult(status, "vkGetPhysicalDeviceSurfacePresentModesKHR");
-  if (status != VK_SUCCESS) {
-    return status;
-  }
-
-  // Calculate swapchain target dimensions.
-  VkExtent2D extent = surface_caps.currentExtent;
-  if (surface_caps.currentExtent.width == -1) {
-    assert_true(surface_caps.currentExtent.height == -1);
-    // Undefined extents, so we need to pick something.
-    XELOGI("Swap chain target surface extents undefined; guessing value");
-    extent.width = 1280;
-    extent.height = 720;
-  }
-  surface_width_ = extent.width;
-  surface_height_ = extent.height;
-
-  // Always prefer mailbox mode (non-tearing, low-latency).
-  // If it's not available we'll use immediate (tearing, low-latency).
-  // If not even that we fall back to FIFO, which sucks.
-  VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
-  for (size_t i = 0; i < present_modes.size(); ++i) {
-    if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
-      // This is the best, so early-out.
-      present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
-      break;
-    } else if (present_modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
-      present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
-    }
-  }
-
-  // Determine the number of images (1 + number queued).
-  uint32_t image_count = surface_caps.minImageCount + 1;
-  if (surface_caps.maxImageCount > 0 &&
-      image_count > surface_caps.maxImageCount) {
-    // Too many requested - use whatever we can.
-    XELOGI("Requested number of swapchain images (%d) exceeds maximum (%d)",
-           image_count, surface_caps.maxImageCount);
-    image_count = surface_caps.maxImageCount;
-  }
-
-  // Always pass through whatever transform the surface started with (so long
-  // as it's supported).
-  VkSurfaceTransformFlagBitsKHR pre_transform = surface_caps.currentTransform;
-
-  VkSwapchainCreateInfoKHR create_info;
-  create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-  create_info.pNext = nullptr;
-  create_info.flags = 0;
-  create_info.surface = surface_;
-  create_info.minImageCount = image_count;
-  create_info.imageFormat = surface_format_;
-  create_info.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
-  create_info.imageExtent.width = extent.width;
-  create_info.imageExtent.height = extent.height;
-  create_info.imageArrayLayers = 1;
-  create_info.imageUsage =
-      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
-  create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-  create_info.queueFamilyIndexCount = 0;
-  create_info.pQueueFamilyIndices = nullptr;
-  create_info.preTransform = pre_transform;
-  create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-  create_info.presentMode = present_mode;
-  create_info.clipped = VK_TRUE;
-  create_info.oldSwapchain = nullptr;
-
-  XELOGVK("Creating swap chain:");
-  XELOGVK("  minImageCount    = %u", create_info.minImageCount);
-  XELOGVK("  imageFormat      = %s", to_string(create_info.imageFormat));
-  XELOGVK("  imageExtent      = %d x %d", create_info.imageExtent.width,
-          create_info.imageExtent.height);
-  auto pre_transform_str = to_flags_string(create_info.preTransform);
-  XELOGVK("  preTransform     = %s", pre_transform_str.c_str());
-  XELOGVK("  imageArrayLayers = %u", create_info.imageArrayLayers);
-  XELOGVK("  presentMode      = %s", to_string(create_info.presentMode));
-  XELOGVK("  clipped          = %s", create_info.clipped ? "true" : "false");
-  XELOGVK("  imageColorSpace  = %s", to_string(create_info.imageColorSpace));
-  auto image_usage_flags_str = to_flags_string(
-      static_cast<VkImageUsageFlagBits>(create_info.imageUsage));
-  XELOGVK("  imageUsageFlags  = %s", image_usage_flags_str.c_str());
-  XELOGVK("  imageSharingMode = %s", to_string(create_info.imageSharingMode));
-  XELOGVK("  queueFamilyCount = %u", create_info.queueFamilyIndexCount);
-
-  status = vkCreateSwapchainKHR(*device_, &create_info, nullptr, &handle);
-  if (status != VK_SUCCESS) {
-    XELOGE("Failed to create swapchain: %s", to_string(status));
-    return status;
-  }
-
   // Create the pool used for transient buffers, so we can reset them all at
   // once.
   VkCommandPoolCreateInfo cmd_pool_info;
@@ -324,6 +219,184 @@ VkResult VulkanSwapChain::Initialize(VkSurfaceKHR surface) {
     return status;
   }
 
+  // Create a fence we'll use to wait for commands to finish.
+  VkFenceCreateInfo fence_create_info = {
+      VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      nullptr,
+      VK_FENCE_CREATE_SIGNALED_BIT,
+  };
+  status = vkCreateFence(*device_, &fence_create_info, nullptr,
+                         &synchronization_fence_);
+  CheckResult(status, "vkGetSwapchainImagesKHR");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  status = CreateSwapchain();
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  XELOGVK("Swap chain initialized successfully!");
+  return VK_SUCCESS;
+}
+
+VkResult VulkanSwapChain::CreateSwapchain() {
+  VkResult status;
+  uint32_t count = 0;
+
+  // Query surface min/max/caps.
+  VkSurfaceCapabilitiesKHR surface_caps;
+  status = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(*device_, surface_,
+                                                     &surface_caps);
+  CheckResult(status, "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  // Query surface properties so we can configure ourselves within bounds.
+  std::vector<VkPresentModeKHR> present_modes;
+  status = vkGetPhysicalDeviceSurfacePresentModesKHR(*device_, surface_, &count,
+                                                     nullptr);
+  CheckResult(status, "vkGetPhysicalDeviceSurfacePresentModesKHR");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  present_modes.resize(count);
+  status = vkGetPhysicalDeviceSurfacePresentModesKHR(*device_, surface_, &count,
+                                                     present_modes.data());
+  CheckResult(status, "vkGetPhysicalDeviceSurfacePresentModesKHR");
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+
+  // Calculate swapchain target dimensions.
+  VkExtent2D extent = surface_caps.currentExtent;
+  if (surface_caps.currentExtent.width == -1) {
+    assert_true(surface_caps.currentExtent.height == -1);
+    // Undefined extents, so we need to pick something.
+    XELOGI("Swap chain target surface extents undefined; guessing value");
+    extent.width = 1280;
+    extent.height = 720;
+  }
+  if (!extent.width || !extent.height) {
+    // Minimized - keep presenting to the current images until it's restored.
+    return VK_NOT_READY;
+  }
+
+  // Unless a mode is requested, prefer mailbox mode (non-tearing,
+  // low-latency).
+  // If it's not available we'll use immediate (tearing, low-latency).
+  // If not even that we fall back to FIFO, which sucks.
+  // FIFO is the only mode that is always supported.
+  VkPresentModeKHR present_mode = VK_PRESENT_MODE_FIFO_KHR;
+  if (FLAGS_vulkan_present_mode.empty()) {
+    for (size_t i = 0; i < present_modes.size(); ++i) {
+      if (present_modes[i] == VK_PRESENT_MODE_MAILBOX_KHR) {
+        // This is the best, so early-out.
+        present_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+        break;
+      } else if (present_modes[i] == VK_PRESENT_MODE_IMMEDIATE_KHR) {
+        present_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+      }
+    }
+  } else {
+    VkPresentModeKHR requested_mode = VK_PRESENT_MODE_FIFO_KHR;
+    if (FLAGS_vulkan_present_mode == "mailbox") {
+      requested_mode = VK_PRESENT_MODE_MAILBOX_KHR;
+    } else if (FLAGS_vulkan_present_mode == "immediate") {
+      requested_mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+    } else if (FLAGS_vulkan_present_mode != "fifo") {
+      XELOGW("Unknown presentation mode %s, using fifo",
+             FLAGS_vulkan_present_mode.c_str());
+    }
+    if (std::find(present_modes.begin(), present_modes.end(),
+                  requested_mode) != present_modes.end()) {
+      present_mode = requested_mode;
+    } else {
+      XELOGW("Presentation mode %s not supported, using fifo",
+             FLAGS_vulkan_present_mode.c_str());
+    }
+  }
+
+  // Determine the number of images (1 + number queued).
+  uint32_t image_count = surface_caps.minImageCount + 1;
+  if (surface_caps.maxImageCount > 0 &&
+      image_count > surface_caps.maxImageCount) {
+    // Too many requested - use whatever we can.
+    XELOGI("Requested number of swapchain images (%d) exceeds maximum (%d)",
+           image_count, surface_caps.maxImageCount);
+    image_count = surface_caps.maxImageCount;
+  }
+
+  // Always pass through whatever transform the surface started with (so long
+  // as it's supported).
+  VkSurfaceTransformFlagBitsKHR pre_transform = surface_caps.currentTransform;
+
+  VkSwapchainCreateInfoKHR create_info;
+  create_info.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+  create_info.pNext = nullptr;
+  create_info.flags = 0;
+  create_info.surface = surface_;
+  create_info.minImageCount = image_count;
+  create_info.imageFormat = surface_format_;
+  create_info.imageColorSpace = VK_COLORSPACE_SRGB_NONLINEAR_KHR;
+  create_info.imageExtent.width = extent.width;
+  create_info.imageExtent.height = extent.height;
+  create_info.imageArrayLayers = 1;
+  create_info.imageUsage =
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+  create_info.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  create_info.queueFamilyIndexCount = 0;
+  create_info.pQueueFamilyIndices = nullptr;
+  create_info.preTransform = pre_transform;
+  create_info.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+  create_info.presentMode = present_mode;
+  create_info.clipped = VK_TRUE;
+  // Images still queued for presentation from the current swap chain, if
+  // any, stay valid, so the window doesn't go blank while resizing.
+  create_info.oldSwapchain = handle;
+
+  XELOGVK("Creating swap chain:");
+  XELOGVK("  minImageCount    = %u", create_info.minImageCount);
+  XELOGVK("  imageFormat      = %s", to_string(create_info.imageFormat));
+  XELOGVK("  imageExtent      = %d x %d", create_info.imageExtent.width,
+          create_info.imageExtent.height);
+  auto pre_transform_str = to_flags_string(create_info.preTransform);
+  XELOGVK("  preTransform     = %s", pre_transform_str.c_str());
+  XELOGVK("  imageArrayLayers = %u", create_info.imageArrayLayers);
+  XELOGVK("  presentMode      = %s", to_string(create_info.presentMode));
+  XELOGVK("  clipped          = %s", create_info.clipped ? "true" : "false");
+  XELOGVK("  imageColorSpace  = %s", to_string(create_info.imageColorSpace));
+  auto image_usage_flags_str = to_flags_string(
+      static_cast<VkImageUsageFlagBits>(create_info.imageUsage));
+  XELOGVK("  imageUsageFlags  = %s", image_usage_flags_str.c_str());
+  XELOGVK("  imageSharingMode = %s", to_string(create_info.imageSharingMode));
+  XELOGVK("  queueFamilyCount = %u", create_info.queueFamilyIndexCount);
+
+  VkSwapchainKHR new_handle = nullptr;
+  status = vkCreateSwapchainKHR(*device_, &create_info, nullptr, &new_handle);
+  if (status != VK_SUCCESS) {
+    XELOGE("Failed to create swapchain: %s", to_string(status));
+    return status;
+  }
+  surface_width_ = extent.width;
+  surface_height_ = extent.height;
+
+  // The old swap chain is retired now. The last swap is done with its
+  // framebuffers, but its final present may still be in flight, so it's only
+  // destroyed once the first swap to the new one has completed.
+  for (auto& buffer : buffers_) {
+    DestroyBuffer(&buffer);
+  }
+  buffers_.clear();
+  VK_SAFE_DESTROY(vkDestroySwapchainKHR, *device_, retired_handle_, nullptr);
+  retired_handle_ = handle;
+  retired_frame_number_ = frame_number_;
+  handle = new_handle;
+  out_of_date_ = false;
+
   // Get images we will be presenting to.
   // Note that this may differ from our requested amount.
   uint32_t actual_image_count = 0;
@@ -355,20 +428,6 @@ VkResult VulkanSwapChain::Initialize(VkSurfaceKHR surface) {
     buffers_[i].image_layout = VK_IMAGE_LAYOUT_UNDEFINED;
   }
 
-  // Create a fence we'll use to wait for commands to finish.
-  VkFenceCreateInfo fence_create_info = {
-      VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
-      nullptr,
-      VK_FENCE_CREATE_SIGNALED_BIT,
-  };
-  status = vkCreateFence(*device_, &fence_create_info, nullptr,
-                         &synchronization_fence_);
-  CheckResult(status, "vkGetSwapchainImagesKHR");
-  if (status != VK_SUCCESS) {
-    return status;
-  }
-
-  XELOGVK("Swap chain initialized successfully!");
   return VK_SUCCESS;
 }
 
@@ -441,11 +500,15 @@ void VulkanSwapChain::DestroyBuffer(Buffer* buffer) {
 }
 
 VkResult VulkanSwapChain::Reinitialize() {
-  // Hacky, but stash the surface so we can reuse it.
-  auto surface = surface_;
-  surface_ = nullptr;
-  Shutdown();
-  return Initialize(surface);
+  // Only the last swap needs to be waited for before its framebuffers are
+  // destroyed - the queue, command buffers and render pass are kept, and
+  // whatever else is executing on the device isn't waited for.
+  VkResult status =
+      vkWaitForFences(*device_, 1, &synchronization_fence_, VK_TRUE, -1);
+  if (status != VK_SUCCESS) {
+    return status;
+  }
+  return CreateSwapchain();
 }
 
 void VulkanSwapChain::WaitOnSemaphore(VkSemaphore sem) {
@@ -453,7 +516,11 @@ void VulkanSwapChain::WaitOnSemaphore(VkSemaphore sem) {
 }
 
 void VulkanSwapChain::Shutdown() {
-  // TODO(benvanik): properly wait for a clean state.
+  // The last swap may still be executing, as swaps don't wait for the queue to
+  // go idle.
+  if (synchronization_fence_) {
+    vkWaitForFences(*device_, 1, &synchronization_fence_, VK_TRUE, -1);
+  }
   for (auto& buffer : buffers_) {
     DestroyBuffer(&buffer);
   }
@@ -486,6 +553,7 @@ void VulkanSwapChain::Shutdown() {
   VK_SAFE_DESTROY(vkDestroyFence, *device_, synchronization_fence_, nullptr);
 
   // images_ doesn't need to be cleaned up as the swapchain does it implicitly.
+  VK_SAFE_DESTROY(vkDestroySwapchainKHR, *device_, retired_handle_, nullptr);
   VK_SAFE_DESTROY(vkDestroySwapchainKHR, *device_, handle, nullptr);
   VK_SAFE_DESTROY(vkDestroySurfaceKHR, *instance_, surface_, nullptr);
 }
@@ -500,19 +568,33 @@ VkResult VulkanSwapChain::Begin() {
   if (status != VK_SUCCESS) {
     return status;
   }
-
-  status = vkResetFences(*device_, 1, &synchronization_fence_);
-  if (status != VK_SUCCESS) {
-    return status;
+  if (retired_handle_ && frame_number_ > retired_frame_number_) {
+    // A swap to the current swap chain has completed.
+    vkDestroySwapchainKHR(*device_, retired_handle_, nullptr);
+    retired_handle_ = nullptr;
   }
 
   // Get the index of the next available swapchain image.
+  // The fence is only reset once an image has been acquired, so if the swap
+  // chain needs to be recreated first, Reinitialize doesn't wait on it.
   status =
       vkAcquireNextImageKHR(*device_, handle, 0, image_available_semaphore_,
                             nullptr, &current_buffer_index_);
+  if (status == VK_SUBOPTIMAL_KHR) {
+    // Usable, but recreate it before the next swap.
+    out_of_date_ = true;
+  } else if (status != VK_SUCCESS) {
+    if (status == VK_ERROR_OUT_OF_DATE_KHR) {
+      out_of_date_ = true;
+    }
+    return status;
+  }
+
+  status = vkResetFences(*device_, 1, &synchronization_fence_);
   if (status != VK_SUCCESS) {
     return status;
   }
+  ++frame_number_;
 
   // Wait for the acquire semaphore to be signaled so that the following
   // operations know they can start modifying the image.
@@ -792,9 +874,10 @@ VkResult VulkanSwapChain::End() {
       status = VK_SUCCESS;
       break;
     case VK_ERROR_OUT_OF_DATE_KHR:
-      // Lost presentation ability; need to recreate the swapchain.
-      // TODO(benvanik): recreate swapchain.
-      assert_always("Swapchain recreation not implemented");
+      // Lost presentation ability; the swapchain is recreated before the
+      // next swap.
+      out_of_date_ = true;
+      status = VK_SUCCESS;
       break;
     case VK_ERROR_DEVICE_LOST:
       // Fatal. Device lost.
@@ -40,19 +40,33 @@ class VulkanSwapChain {
     return buffers_[current_buffer_index_].image;
   }
 
+  // Incremented by Begin, once the previous frame has finished on the GPU.
+  uint64_t frame_number() const { return frame_number_; }
+
   // Render pass used for compositing.
   VkRenderPass render_pass() const { return render_pass_; }
   // Render command buffer, active inside the render pass from Begin to End.
   VkCommandBuffer render_cmd_buffer() const { return render_cmd_buffer_; }
   // Copy commands, ran before the render command buffer.
   VkCommandBuffer copy_cmd_buffer() const { return copy_cmd_buffer_; }
+  // Whether presentation happens on the primary queue of the device, after
+  // everything submitted to it before.
+  bool uses_primary_queue() const {
+    return presentation_queue_mutex_ != nullptr;
+  }
 
   // Initializes the swap chain with the given WSI surface.
   VkResult Initialize(VkSurfaceKHR surface);
   // Reinitializes the swap chain with the initial surface.
-  // The surface will be retained but all other swap chain resources will be
-  // torn down and recreated with the new surface properties (size/etc).
+  // The surface, queue, command buffers and render pass are retained, and the
+  // images are recreated with the new surface properties (size/etc), handing
+  // the current swap chain over as the old one. Only waits for the last swap.
+  // Returns VK_NOT_READY, keeping the current images, if the surface has no
+  // area (the window is minimized).
   VkResult Reinitialize();
+  // Whether presentation reported the swap chain as no longer matching the
+  // surface, so it must be reinitialized before the next Begin.
+  bool is_out_of_date() const { return out_of_date_; }
 
   // Waits on and signals a semaphore in this operation.
   void WaitOnSemaphore(VkSemaphore sem);
@@ -70,6 +84,9 @@ class VulkanSwapChain {
     VkFramebuffer framebuffer = nullptr;
   };
 
+  // Creates the swap chain images for the current surface properties,
+  // retiring the current ones.
+  VkResult CreateSwapchain();
   VkResult InitializeBuffer(Buffer* buffer, VkImage target_image);
   void DestroyBuffer(Buffer* buffer);
 
@@ -95,6 +112,12 @@ class VulkanSwapChain {
   VkSemaphore image_available_semaphore_ = nullptr;
   VkSemaphore image_usage_semaphore_ = nullptr;
   uint32_t current_buffer_index_ = 0;
+  uint64_t frame_number_ = 0;
+  // Swap chain replaced by Reinitialize, destroyed once a frame past
+  // retired_frame_number_ has completed.
+  VkSwapchainKHR retired_handle_ = nullptr;
+  uint64_t retired_frame_number_ = 0;
+  bool out_of_date_ = false;
   std::vector<Buffer> buffers_;
   std::vector<VkSemaphore> wait_semaphores_;
 };
@@ -14,6 +14,8 @@
 namespace xe {
 namespace vfs {
 
+std::atomic<uint64_t> Device::detached_entries_generation_ = {0};
+
 Device::Device(const std::string& mount_path) : mount_path_(mount_path) {}
 Device::~Device() = default;
 
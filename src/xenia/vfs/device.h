@@ -10,6 +10,7 @@
 #ifndef XENIA_VFS_DEVICE_H_
 #define XENIA_VFS_DEVICE_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 
@@ -38,9 +39,24 @@ class Device {
   virtual uint32_t sectors_per_allocation_unit() const = 0;
   virtual uint32_t bytes_per_sector() const = 0;
 
+  // Bumped whenever any device drops entries on its own, rather than through
+  // Entry::Delete, as they went missing from its backing store. Whatever
+  // holds on to resolved entries must drop them when it changes. The dropped
+  // entries stay allocated as files may still be open on them.
+  static uint64_t detached_entries_generation() {
+    return detached_entries_generation_.load(std::memory_order_acquire);
+  }
+
  protected:
+  static void DetachedEntries() {
+    detached_entries_generation_.fetch_add(1, std::memory_order_acq_rel);
+  }
+
   xe::global_critical_region global_critical_region_;
   std::string mount_path_;
+
+ private:
+  static std::atomic<uint64_t> detached_entries_generation_;
 };
 
 }  // namespace vfs
@@ -0,0 +1,337 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "third_party/snappy/snappy.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/threading.h"
+
+DEFINE_int32(compressed_disc_image_cache_mb, 64,
+             "Size of the cache of decompressed chunks of compressed disc "
+             "images, in MB.");
+
+namespace xe {
+namespace vfs {
+
+const char CompressedDiscImageDevice::kMagic[4] = {'X', 'C', 'D', 'I'};
+
+// Chunks are decompressed on more threads when a read covers at least this
+// many, and compressed on all of them.
+static const size_t kParallelChunkCount = 16;
+
+// Calls fn(i) for every i in [0, count) from up to thread_count threads,
+// including the calling one.
+static void ParallelFor(size_t count, uint32_t thread_count,
+                        const std::function<void(size_t)>& fn) {
+  std::atomic<size_t> next_index(0);
+  auto worker = [&]() {
+    for (size_t i; (i = next_index.fetch_add(1)) < count;) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < thread_count; ++i) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+static uint32_t GetThreadCount(size_t chunk_count) {
+  size_t count = std::min(size_t(xe::threading::logical_processor_count()),
+                          chunk_count / (kParallelChunkCount / 4));
+  return uint32_t(std::max(count, size_t(1)));
+}
+
+CompressedDiscImageDevice::CompressedDiscImageDevice(
+    const std::string& mount_path, const std::wstring& local_path)
+    : DiscImageDevice(mount_path, local_path) {}
+
+CompressedDiscImageDevice::~CompressedDiscImageDevice() = default;
+
+bool CompressedDiscImageDevice::OpenImage() {
+  container_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
+  if (!container_) {
+    XELOGE("Compressed disc image could not be mapped");
+    return false;
+  }
+
+  Header header;
+  if (container_->size() < sizeof(header)) {
+    XELOGE("Compressed disc image is truncated");
+    return false;
+  }
+  std::memcpy(&header, container_->data(), sizeof(header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+      header.version != kVersion) {
+    XELOGE("Not a compressed disc image, or of an unsupported version");
+    return false;
+  }
+  if (!header.chunk_size || header.chunk_size % bytes_per_sector() ||
+      header.chunk_size > 16 * 1024 * 1024 ||
+      header.chunk_count !=
+          (header.image_size + header.chunk_size - 1) / header.chunk_size) {
+    XELOGE("Compressed disc image has a damaged header");
+    return false;
+  }
+  chunk_size_ = header.chunk_size;
+  chunk_count_ = header.chunk_count;
+  image_size_ = size_t(header.image_size);
+
+  // The index, and the chunks it points to, must all be in the file.
+  size_t index_size = (size_t(chunk_count_) + 1) * sizeof(uint64_t);
+  if (container_->size() < sizeof(header) + index_size) {
+    XELOGE("Compressed disc image is truncated");
+    return false;
+  }
+  size_t index_offset = container_->size() - index_size;
+  chunk_offsets_.resize(chunk_count_ + 1);
+  std::memcpy(chunk_offsets_.data(), container_->data() + index_offset,
+              index_size);
+  if (chunk_offsets_[0] < sizeof(header) ||
+      chunk_offsets_[chunk_count_] > index_offset) {
+    XELOGE("Compressed disc image has a damaged index");
+    return false;
+  }
+  for (uint32_t i = 0; i < chunk_count_; ++i) {
+    uint64_t compressed_length = chunk_offsets_[i + 1] - chunk_offsets_[i];
+    if (chunk_offsets_[i + 1] < chunk_offsets_[i] ||
+        compressed_length > chunk_length(i)) {
+      XELOGE("Compressed disc image has a damaged index");
+      return false;
+    }
+  }
+
+  cache_capacity_ = std::max(
+      size_t(std::max(FLAGS_compressed_disc_image_cache_mb, 0)) * 1024 *
+          1024 / chunk_size_,
+      size_t(1));
+  return true;
+}
+
+size_t CompressedDiscImageDevice::chunk_length(uint32_t index) const {
+  return std::min(size_t(chunk_size_),
+                  image_size_ - size_t(index) * chunk_size_);
+}
+
+bool CompressedDiscImageDevice::DecompressChunk(uint32_t index,
+                                                uint8_t* buffer) const {
+  auto compressed =
+      reinterpret_cast<const char*>(container_->data() + chunk_offsets_[index]);
+  size_t compressed_length =
+      size_t(chunk_offsets_[index + 1] - chunk_offsets_[index]);
+  size_t length = chunk_length(index);
+  if (compressed_length == length) {
+    // Stored.
+    std::memcpy(buffer, compressed, length);
+    return true;
+  }
+  size_t uncompressed_length;
+  if (!snappy::GetUncompressedLength(compressed, compressed_length,
+                                     &uncompressed_length) ||
+      uncompressed_length != length ||
+      !snappy::RawUncompress(compressed, compressed_length,
+                             reinterpret_cast<char*>(buffer))) {
+    XELOGE("Compressed disc image chunk %u is damaged", index);
+    return false;
+  }
+  return true;
+}
+
+CompressedDiscImageDevice::ChunkData CompressedDiscImageDevice::GetChunk(
+    uint32_t index) {
+  {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto it = cache_index_.find(index);
+    if (it != cache_index_.end()) {
+      cache_.splice(cache_.begin(), cache_, it->second);
+      return it->second->second;
+    }
+  }
+
+  // Decompressed outside the lock. Threads racing for the same chunk both
+  // decompress it, and the second one's insert finds the first's.
+  auto data = std::make_shared<std::vector<uint8_t>>(chunk_length(index));
+  if (!DecompressChunk(index, data->data())) {
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> lock(cache_mutex_);
+  auto it = cache_index_.find(index);
+  if (it != cache_index_.end()) {
+    return it->second->second;
+  }
+  cache_.emplace_front(index, data);
+  cache_index_.emplace(index, cache_.begin());
+  while (cache_.size() > cache_capacity_) {
+    cache_index_.erase(cache_.back().first);
+    cache_.pop_back();
+  }
+  return data;
+}
+
+bool CompressedDiscImageDevice::ReadImage(size_t offset, void* buffer,
+                                          size_t length) {
+  if (offset > image_size_ || length > image_size_ - offset) {
+    return false;
+  }
+  if (!length) {
+    return true;
+  }
+  auto out = reinterpret_cast<uint8_t*>(buffer);
+  uint32_t first_chunk = uint32_t(offset / chunk_size_);
+  uint32_t last_chunk = uint32_t((offset + length - 1) / chunk_size_);
+
+  // Chunks the read covers entirely are decompressed straight into the
+  // buffer, bypassing the cache so large reads don't flush it. The partial
+  // ones at either end go through the cache, as neighbouring reads are
+  // likely to want the rest.
+  std::vector<uint32_t> whole_chunks;
+  for (uint32_t i = first_chunk; i <= last_chunk; ++i) {
+    size_t chunk_offset = size_t(i) * chunk_size_;
+    size_t begin = std::max(chunk_offset, offset);
+    size_t end = std::min(chunk_offset + chunk_length(i), offset + length);
+    if (begin == chunk_offset && end == chunk_offset + chunk_length(i)) {
+      whole_chunks.push_back(i);
+      continue;
+    }
+    auto chunk = GetChunk(i);
+    if (!chunk) {
+      return false;
+    }
+    std::memcpy(out + (begin - offset), chunk->data() + (begin - chunk_offset),
+                end - begin);
+  }
+
+  std::atomic<bool> succeeded(true);
+  auto decompress = [&](size_t i) {
+    uint32_t index = whole_chunks[i];
+    if (!DecompressChunk(index,
+                         out + (size_t(index) * chunk_size_ - offset))) {
+      succeeded = false;
+    }
+  };
+  ParallelFor(whole_chunks.size(),
+              whole_chunks.size() >= kParallelChunkCount
+                  ? GetThreadCount(whole_chunks.size())
+                  : 1,
+              decompress);
+  return succeeded;
+}
+
+void CompressedDiscImageDevice::PrefetchImage(size_t offset, size_t length) {
+  if (offset >= image_size_ || !length) {
+    return;
+  }
+  length = std::min(length, image_size_ - offset);
+  uint32_t first_chunk = uint32_t(offset / chunk_size_);
+  uint32_t last_chunk = uint32_t((offset + length - 1) / chunk_size_);
+  container_->Prefetch(
+      size_t(chunk_offsets_[first_chunk]),
+      size_t(chunk_offsets_[last_chunk + 1] - chunk_offsets_[first_chunk]));
+}
+
+bool CompressedDiscImageDevice::Compress(const std::wstring& source_path,
+                                         const std::wstring& target_path,
+                                         uint32_t chunk_size) {
+  if (!chunk_size || chunk_size % (2 * 1024)) {
+    XELOGE("Chunk size must be a multiple of 2KB");
+    return false;
+  }
+  // Only GDFX images, so that what's written can be mounted.
+  DiscImageDevice source("", source_path);
+  if (!source.Initialize()) {
+    return false;
+  }
+  auto file = xe::filesystem::OpenFile(target_path, "wb");
+  if (!file) {
+    XELOGE("Unable to create the compressed disc image");
+    return false;
+  }
+
+  size_t image_size = source.image_size();
+  Header header;
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = kVersion;
+  header.chunk_size = chunk_size;
+  header.chunk_count =
+      uint32_t((image_size + chunk_size - 1) / chunk_size);
+  header.image_size = image_size;
+  bool succeeded = fwrite(&header, sizeof(header), 1, file) == 1;
+
+  // In batches of chunks compressed in parallel and written in order.
+  std::vector<uint64_t> chunk_offsets;
+  chunk_offsets.reserve(header.chunk_count + 1);
+  uint64_t file_offset = sizeof(header);
+  uint32_t thread_count = GetThreadCount(kParallelChunkCount * 4);
+  size_t batch_size = thread_count * kParallelChunkCount;
+  std::vector<std::vector<uint8_t>> raw(batch_size);
+  std::vector<std::string> compressed(batch_size);
+  size_t uncompressed_total = 0;
+  for (uint32_t batch_first = 0;
+       succeeded && batch_first < header.chunk_count;
+       batch_first += uint32_t(batch_size)) {
+    size_t count =
+        std::min(batch_size, size_t(header.chunk_count - batch_first));
+    std::atomic<bool> read_succeeded(true);
+    ParallelFor(count, thread_count, [&](size_t i) {
+      size_t chunk_offset = size_t(batch_first + i) * chunk_size;
+      size_t length = std::min(size_t(chunk_size), image_size - chunk_offset);
+      raw[i].resize(length);
+      if (!source.ReadImage(chunk_offset, raw[i].data(), length)) {
+        read_succeeded = false;
+        return;
+      }
+      snappy::Compress(reinterpret_cast<const char*>(raw[i].data()), length,
+                       &compressed[i]);
+    });
+    succeeded = read_succeeded;
+    for (size_t i = 0; succeeded && i < count; ++i) {
+      chunk_offsets.push_back(file_offset);
+      // Stored as is unless compression makes it smaller, which is what
+      // tells the two apart when reading.
+      bool store = compressed[i].size() >= raw[i].size();
+      const void* data = store ? raw[i].data()
+                               : static_cast<const void*>(compressed[i].data());
+      size_t length = store ? raw[i].size() : compressed[i].size();
+      succeeded = fwrite(data, 1, length, file) == length;
+      file_offset += length;
+      uncompressed_total += raw[i].size();
+    }
+  }
+  chunk_offsets.push_back(file_offset);
+  if (succeeded) {
+    size_t index_size = chunk_offsets.size() * sizeof(uint64_t);
+    succeeded = fwrite(chunk_offsets.data(), 1, index_size, file) == index_size;
+  }
+  succeeded = fclose(file) == 0 && succeeded;
+  if (!succeeded) {
+    XELOGE("Failed to write the compressed disc image");
+    return false;
+  }
+  XELOGI("Compressed %llu bytes into %llu (%u chunks)",
+         static_cast<unsigned long long>(uncompressed_total),
+         static_cast<unsigned long long>(file_offset), header.chunk_count);
+  return true;
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -0,0 +1,97 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
+#define XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/mapped_memory.h"
+#include "xenia/vfs/devices/disc_image_device.h"
+
+namespace xe {
+namespace vfs {
+
+// A GDFX disc image stored as independently compressed fixed-size chunks
+// (.xcdi), so that any range can be read by decompressing only the chunks it
+// touches. The image bytes, GDFX header included, are unchanged by the
+// compression, and everything above ReadImage is DiscImageDevice.
+//
+// Layout, little-endian:
+//   Header
+//   chunk data, chunk_count times: snappy-compressed, or stored as is when
+//     that wouldn't be smaller (a chunk exactly its uncompressed length)
+//   uint64_t chunk_offsets[chunk_count + 1]: where each chunk starts in the
+//     file, the last one being where the chunk data ends
+// The index is last so that the container can be written in one pass.
+class CompressedDiscImageDevice : public DiscImageDevice {
+ public:
+  struct Header {
+    char magic[4];  // kMagic
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t chunk_count;
+    uint64_t image_size;
+  };
+  static_assert(sizeof(Header) == 24, "Header must have no padding");
+  static const char kMagic[4];
+  static const uint32_t kVersion = 1;
+  static const uint32_t kDefaultChunkSize = 64 * 1024;
+
+  CompressedDiscImageDevice(const std::string& mount_path,
+                            const std::wstring& local_path);
+  ~CompressedDiscImageDevice() override;
+
+  // Writes the disc image at source_path as a container at target_path.
+  // chunk_size must be a multiple of the 2KB sector size.
+  static bool Compress(const std::wstring& source_path,
+                       const std::wstring& target_path,
+                       uint32_t chunk_size = kDefaultChunkSize);
+
+  size_t image_size() const override { return image_size_; }
+  bool ReadImage(size_t offset, void* buffer, size_t length) override;
+  void PrefetchImage(size_t offset, size_t length) override;
+
+ protected:
+  bool OpenImage() override;
+
+ private:
+  typedef std::shared_ptr<std::vector<uint8_t>> ChunkData;
+
+  size_t chunk_length(uint32_t index) const;
+  bool DecompressChunk(uint32_t index, uint8_t* buffer) const;
+  // Returns the chunk out of the cache of recently used ones, decompressing
+  // it into the cache if it isn't there. nullptr if it's damaged.
+  ChunkData GetChunk(uint32_t index);
+
+  std::unique_ptr<MappedMemory> container_;
+  uint32_t chunk_size_ = 0;
+  uint32_t chunk_count_ = 0;
+  size_t image_size_ = 0;
+  std::vector<uint64_t> chunk_offsets_;
+
+  // Most recently used first.
+  std::mutex cache_mutex_;
+  std::list<std::pair<uint32_t, ChunkData>> cache_;
+  std::unordered_map<uint32_t,
+                     std::list<std::pair<uint32_t, ChunkData>>::iterator>
+      cache_index_;
+  size_t cache_capacity_ = 0;
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_DEVICES_COMPRESSED_DISC_IMAGE_DEVICE_H_
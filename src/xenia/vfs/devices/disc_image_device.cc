@@ -9,6 +9,10 @@
 
 #include "xenia/vfs/devices/disc_image_device.h"
 
+#include <algorithm>
+#include <cctype>
+#include <vector>
+
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
@@ -25,30 +29,54 @@ DiscImageDevice::DiscImageDevice(const std::string& mount_path,
 DiscImageDevice::~DiscImageDevice() = default;
 
 bool DiscImageDevice::Initialize() {
-  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
-  if (!mmap_) {
-    XELOGE("Disc image could not be mapped");
+  if (!OpenImage()) {
     return false;
   }
 
   ParseState state = {0};
-  state.ptr = mmap_->data();
-  state.size = mmap_->size();
+  state.size = image_size();
   auto result = Verify(&state);
   if (result != Error::kSuccess) {
     XELOGE("Failed to verify disc image header: %d", result);
     return false;
   }
 
-  result = ReadAllEntries(&state, state.ptr + state.root_offset);
-  if (result != Error::kSuccess) {
-    XELOGE("Failed to read all GDFX entries: %d", result);
+  if (state.root_offset + state.root_size > state.size) {
+    XELOGE("GDFX root directory is out of bounds");
     return false;
   }
+  game_offset_ = state.game_offset;
+  auto root_entry = new DiscImageEntry(this, nullptr, "", mmap_.get());
+  root_entry->attributes_ = kFileAttributeDirectory;
+  root_entry->dirents_offset_ = state.root_offset;
+  root_entry->dirents_size_ = state.root_size;
+  root_entry->children_loaded_ = false;
+  root_entry_ = std::unique_ptr<Entry>(root_entry);
 
   return true;
 }
 
+bool DiscImageDevice::OpenImage() {
+  mmap_ = MappedMemory::Open(local_path_, MappedMemory::Mode::kRead);
+  if (!mmap_) {
+    XELOGE("Disc image could not be mapped");
+    return false;
+  }
+  return true;
+}
+
+bool DiscImageDevice::ReadImage(size_t offset, void* buffer, size_t length) {
+  if (offset > mmap_->size() || length > mmap_->size() - offset) {
+    return false;
+  }
+  std::memcpy(buffer, mmap_->data() + offset, length);
+  return true;
+}
+
+void DiscImageDevice::PrefetchImage(size_t offset, size_t length) {
+  mmap_->Prefetch(offset, length);
+}
+
 void DiscImageDevice::Dump(StringBuffer* string_buffer) {
   auto global_lock = global_critical_region_.Acquire();
   root_entry_->Dump(string_buffer, 0);
@@ -97,9 +125,13 @@ DiscImageDevice::Error DiscImageDevice::Verify(ParseState* state) {
   if (state->size < state->game_offset + (32 * kXESectorSize)) {
     return Error::kErrorReadError;
   }
-  uint8_t* fs_ptr = state->ptr + state->game_offset + (32 * kXESectorSize);
-  state->root_sector = xe::load<uint32_t>(fs_ptr + 20);
-  state->root_size = xe::load<uint32_t>(fs_ptr + 24);
+  uint8_t fs_header[28];
+  if (!ReadImage(state->game_offset + (32 * kXESectorSize), fs_header,
+                 sizeof(fs_header))) {
+    return Error::kErrorReadError;
+  }
+  state->root_sector = xe::load<uint32_t>(fs_header + 20);
+  state->root_size = xe::load<uint32_t>(fs_header + 24);
   state->root_offset =
       state->game_offset + (state->root_sector * kXESectorSize);
   if (state->root_size < 13 || state->root_size > 32 * 1024 * 1024) {
@@ -110,43 +142,143 @@ DiscImageDevice::Error DiscImageDevice::Verify(ParseState* state) {
 }
 
 bool DiscImageDevice::VerifyMagic(ParseState* state, size_t offset) {
-  if (offset >= state->size) {
-    return false;
-  }
-
   // Simple check to see if the given offset contains the magic value.
-  return std::memcmp(state->ptr + offset, "MICROSOFT*XBOX*MEDIA", 20) == 0;
+  char magic[20];
+  return ReadImage(offset, magic, sizeof(magic)) &&
+         std::memcmp(magic, "MICROSOFT*XBOX*MEDIA", 20) == 0;
 }
 
-DiscImageDevice::Error DiscImageDevice::ReadAllEntries(
-    ParseState* state, const uint8_t* root_buffer) {
-  auto root_entry = new DiscImageEntry(this, nullptr, "", mmap_.get());
-  root_entry->attributes_ = kFileAttributeDirectory;
-  root_entry_ = std::unique_ptr<Entry>(root_entry);
-
-  if (!ReadEntry(state, root_buffer, 0, root_entry)) {
-    return Error::kErrorOutOfMemory;
+Entry* DiscImageDevice::LoadChild(DiscImageEntry* parent,
+                                  const std::string& name) {
+  // Ordered the way the tree is, by uppercased name and then by length.
+  auto compare = [&name](const uint8_t* dirent) {
+    uint8_t name_length = xe::load<uint8_t>(dirent + 13);
+    auto dirent_name = reinterpret_cast<const char*>(dirent + 14);
+    size_t length = std::min(size_t(name_length), name.size());
+    for (size_t i = 0; i < length; ++i) {
+      int a = std::toupper(uint8_t(name[i]));
+      int b = std::toupper(uint8_t(dirent_name[i]));
+      if (a != b) {
+        return a - b;
+      }
+    }
+    return int(name.size()) - int(name_length);
+  };
+  if (!LoadDirents(parent)) {
+    return nullptr;
   }
 
-  return Error::kSuccess;
+  // Bounded in case a damaged image has a cycle in its tree.
+  size_t max_steps = parent->dirents_size_ / 14 + 1;
+  uint16_t ordinal = 0;
+  const uint8_t* dirent;
+  while ((dirent = GetDirent(parent, ordinal)) && max_steps--) {
+    int order = compare(dirent);
+    if (!order) {
+      auto it = parent->loaded_ordinals_.find(ordinal);
+      if (it != parent->loaded_ordinals_.end()) {
+        return it->second;
+      }
+      auto entry = parent->AddChild(ReadEntry(parent, dirent));
+      parent->loaded_ordinals_.emplace(ordinal, entry);
+      return entry;
+    }
+    ordinal = xe::load<uint16_t>(dirent + (order < 0 ? 0 : 2));
+    if (!ordinal) {
+      break;
+    }
+  }
+  return nullptr;
 }
 
-bool DiscImageDevice::ReadEntry(ParseState* state, const uint8_t* buffer,
-                                uint16_t entry_ordinal,
-                                DiscImageEntry* parent) {
-  const uint8_t* p = buffer + (entry_ordinal * 4);
+void DiscImageDevice::LoadChildren(DiscImageEntry* parent) {
+  if (!LoadDirents(parent)) {
+    parent->loaded_ordinals_.clear();
+    parent->children_loaded_ = true;
+    return;
+  }
+
+  // Children already loaded keep their place in the order of the tree.
+  std::unordered_map<Entry*, std::unique_ptr<Entry>> loaded;
+  for (auto& child : parent->children_) {
+    auto entry = child.get();
+    loaded.emplace(entry, std::move(child));
+  }
+  parent->children_.clear();
+  parent->child_index_.clear();
+
+  // In-order walk, so that children are listed sorted as before. Bounded in
+  // case a damaged image has a cycle in its tree.
+  size_t max_steps = parent->dirents_size_ / 14 + 1;
+  std::vector<uint16_t> stack;
+  uint16_t ordinal = 0;
+  const uint8_t* dirent = GetDirent(parent, ordinal);
+  while ((dirent && max_steps) || !stack.empty()) {
+    if (dirent && max_steps) {
+      --max_steps;
+      stack.push_back(ordinal);
+      ordinal = xe::load<uint16_t>(dirent + 0);
+      dirent = ordinal ? GetDirent(parent, ordinal) : nullptr;
+      continue;
+    }
+    ordinal = stack.back();
+    stack.pop_back();
+    dirent = GetDirent(parent, ordinal);
+    auto it = parent->loaded_ordinals_.find(ordinal);
+    if (it != parent->loaded_ordinals_.end()) {
+      parent->AddChild(std::move(loaded[it->second]));
+    } else {
+      parent->AddChild(ReadEntry(parent, dirent));
+    }
+    ordinal = xe::load<uint16_t>(dirent + 2);
+    dirent = ordinal ? GetDirent(parent, ordinal) : nullptr;
+  }
 
-  uint16_t node_l = xe::load<uint16_t>(p + 0);
-  uint16_t node_r = xe::load<uint16_t>(p + 2);
-  size_t sector = xe::load<uint32_t>(p + 4);
-  size_t length = xe::load<uint32_t>(p + 8);
-  uint8_t attributes = xe::load<uint8_t>(p + 12);
-  uint8_t name_length = xe::load<uint8_t>(p + 13);
-  auto name = reinterpret_cast<const char*>(p + 14);
+  parent->loaded_ordinals_.clear();
+  parent->children_loaded_ = true;
+  std::vector<uint8_t>().swap(parent->dirents_);
+}
 
-  if (node_l && !ReadEntry(state, buffer, node_l, parent)) {
+bool DiscImageDevice::LoadDirents(DiscImageEntry* parent) {
+  if (!parent->dirents_.empty()) {
+    return true;
+  }
+  parent->dirents_.resize(parent->dirents_size_);
+  if (!ReadImage(parent->dirents_offset_, parent->dirents_.data(),
+                 parent->dirents_size_)) {
+    XELOGE("Failed to read GDFX directory %s", parent->path().c_str());
+    parent->dirents_.clear();
+    parent->dirents_size_ = 0;
     return false;
   }
+  return true;
+}
+
+const uint8_t* DiscImageDevice::GetDirent(DiscImageEntry* parent,
+                                          uint16_t ordinal) {
+  size_t offset = size_t(ordinal) * 4;
+  if (offset + 14 > parent->dirents_size_) {
+    return nullptr;
+  }
+  const uint8_t* dirent = parent->dirents_.data() + offset;
+  if (xe::load<uint32_t>(dirent) == 0xFFFFFFFF) {
+    // Padding, as in the table of an empty directory.
+    return nullptr;
+  }
+  uint8_t name_length = xe::load<uint8_t>(dirent + 13);
+  if (offset + 14 + name_length > parent->dirents_size_) {
+    return nullptr;
+  }
+  return dirent;
+}
+
+std::unique_ptr<DiscImageEntry> DiscImageDevice::ReadEntry(
+    DiscImageEntry* parent, const uint8_t* dirent) {
+  size_t sector = xe::load<uint32_t>(dirent + 4);
+  size_t length = xe::load<uint32_t>(dirent + 8);
+  uint8_t attributes = xe::load<uint8_t>(dirent + 12);
+  uint8_t name_length = xe::load<uint8_t>(dirent + 13);
+  auto name = reinterpret_cast<const char*>(dirent + 14);
 
   auto entry = DiscImageEntry::Create(
       this, parent, std::string(name, name_length), mmap_.get());
@@ -159,38 +291,25 @@ bool DiscImageDevice::ReadEntry(ParseState* state, const uint8_t* buffer,
   entry->access_timestamp_ = 10000 * 11644473600000LL;
   entry->write_timestamp_ = 10000 * 11644473600000LL;
 
+  size_t offset = game_offset_ + (sector * kXESectorSize);
   if (attributes & kFileAttributeDirectory) {
-    // Folder.
+    // Folder. Its tree is read when it's first looked into.
     entry->data_offset_ = 0;
     entry->data_size_ = 0;
-    if (length) {
-      // Not a leaf - read in children.
-      if (state->size < state->game_offset + (sector * kXESectorSize)) {
-        // Out of bounds read.
-        return false;
-      }
-      // Read child list.
-      uint8_t* folder_ptr =
-          state->ptr + state->game_offset + (sector * kXESectorSize);
-      if (!ReadEntry(state, folder_ptr, 0, entry.get())) {
-        return false;
-      }
+    if (length && offset + length <= image_size()) {
+      entry->dirents_offset_ = offset;
+      entry->dirents_size_ = length;
+      entry->children_loaded_ = false;
+    } else if (length) {
+      XELOGE("GDFX directory %s is out of bounds", entry->path().c_str());
     }
   } else {
     // File.
-    entry->data_offset_ = state->game_offset + (sector * kXESectorSize);
+    entry->data_offset_ = offset;
     entry->data_size_ = length;
   }
 
-  // Add to parent.
-  parent->children_.emplace_back(std::move(entry));
-
-  // Read next file in the list.
-  if (node_r && !ReadEntry(state, buffer, node_r, parent)) {
-    return false;
-  }
-
-  return true;
+  return entry;
 }
 
 }  // namespace vfs
@@ -32,14 +32,31 @@ class DiscImageDevice : public Device {
   Entry* ResolvePath(std::string path) override;
 
   uint32_t total_allocation_units() const override {
-    return uint32_t(mmap_->size() / sectors_per_allocation_unit() /
+    return uint32_t(image_size() / sectors_per_allocation_unit() /
                     bytes_per_sector());
   }
   uint32_t available_allocation_units() const override { return 0; }
   uint32_t sectors_per_allocation_unit() const override { return 1; }
   uint32_t bytes_per_sector() const override { return 2 * 1024; }
 
+  // Size of the (uncompressed) image in bytes.
+  virtual size_t image_size() const { return mmap_->size(); }
+  // Copies image bytes out, failing if the range isn't all in the image.
+  virtual bool ReadImage(size_t offset, void* buffer, size_t length);
+  // Hints that the range of the image will be read soon.
+  virtual void PrefetchImage(size_t offset, size_t length);
+
+ protected:
+  // Opens the image, mapping it by default. Entries map their data out of
+  // mmap_ if it's set, and are read through ReadImage otherwise.
+  virtual bool OpenImage();
+
+  std::wstring local_path_;
+  std::unique_ptr<MappedMemory> mmap_;
+
  private:
+  friend class DiscImageEntry;
+
   enum class Error {
     kSuccess = 0,
     kErrorOutOfMemory = -1,
@@ -48,12 +65,10 @@ class DiscImageDevice : public Device {
     kErrorDamagedFile = -31,
   };
 
-  std::wstring local_path_;
   std::unique_ptr<Entry> root_entry_;
-  std::unique_ptr<MappedMemory> mmap_;
+  size_t game_offset_ = 0;
 
   typedef struct {
-    uint8_t* ptr;
     size_t size;         // Size (bytes) of total image.
     size_t game_offset;  // Offset (bytes) of game partition.
     size_t root_sector;  // Offset (sector) of root.
@@ -63,9 +78,18 @@ class DiscImageDevice : public Device {
 
   Error Verify(ParseState* state);
   bool VerifyMagic(ParseState* state, size_t offset);
-  Error ReadAllEntries(ParseState* state, const uint8_t* root_buffer);
-  bool ReadEntry(ParseState* state, const uint8_t* buffer,
-                 uint16_t entry_ordinal, DiscImageEntry* parent);
+
+  // Directories are read the first time they're looked into. Their entries
+  // are a binary tree sorted by uppercased name, so LoadChild only reads
+  // along the path to the one requested.
+  Entry* LoadChild(DiscImageEntry* parent, const std::string& name);
+  void LoadChildren(DiscImageEntry* parent);
+  // Reads the tree of the directory in, returning false if it has none.
+  bool LoadDirents(DiscImageEntry* parent);
+  // Returns the entry at the tree ordinal or nullptr if it's out of bounds.
+  const uint8_t* GetDirent(DiscImageEntry* parent, uint16_t ordinal);
+  std::unique_ptr<DiscImageEntry> ReadEntry(DiscImageEntry* parent,
+                                            const uint8_t* dirent);
 };
 
 }  // namespace vfs
@@ -12,6 +12,7 @@
 #include <algorithm>
 
 #include "xenia/base/math.h"
+#include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_file.h"
 
 namespace xe {
@@ -22,7 +23,10 @@ DiscImageEntry::DiscImageEntry(Device* device, Entry* parent, std::string path,
     : Entry(device, parent, path),
       mmap_(mmap),
       data_offset_(0),
-      data_size_(0) {}
+      data_size_(0),
+      dirents_offset_(0),
+      dirents_size_(0),
+      children_loaded_(true) {}
 
 DiscImageEntry::~DiscImageEntry() = default;
 
@@ -36,6 +40,22 @@ std::unique_ptr<DiscImageEntry> DiscImageEntry::Create(Device* device,
   return std::move(entry);
 }
 
+Entry* DiscImageEntry::LoadChild(const std::string& name) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (children_loaded_) {
+    return nullptr;
+  }
+  return static_cast<DiscImageDevice*>(device_)->LoadChild(this, name);
+}
+
+void DiscImageEntry::LoadChildren() {
+  auto global_lock = global_critical_region_.Acquire();
+  if (children_loaded_) {
+    return;
+  }
+  static_cast<DiscImageDevice*>(device_)->LoadChildren(this);
+}
+
 X_STATUS DiscImageEntry::Open(uint32_t desired_access, File** out_file) {
   *out_file = new DiscImageFile(desired_access, this);
   return X_STATUS_SUCCESS;
@@ -43,8 +63,8 @@ X_STATUS DiscImageEntry::Open(uint32_t desired_access, File** out_file) {
 
 std::unique_ptr<MappedMemory> DiscImageEntry::OpenMapped(
     MappedMemory::Mode mode, size_t offset, size_t length) {
-  if (mode != MappedMemory::Mode::kRead) {
-    // Only allow reads.
+  if (mode != MappedMemory::Mode::kRead || !mmap_) {
+    // Only allow reads, of mapped images.
     return nullptr;
   }
 
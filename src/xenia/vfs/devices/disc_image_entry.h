@@ -11,6 +11,7 @@
 #define XENIA_VFS_DEVICES_DISC_IMAGE_ENTRY_H_
 
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/filesystem.h"
@@ -38,17 +39,31 @@ class DiscImageEntry : public Entry {
 
   X_STATUS Open(uint32_t desired_access, File** out_file) override;
 
-  bool can_map() const override { return true; }
+  bool can_map() const override { return mmap_ != nullptr; }
   std::unique_ptr<MappedMemory> OpenMapped(MappedMemory::Mode mode,
                                            size_t offset,
                                            size_t length) override;
 
+ protected:
+  Entry* LoadChild(const std::string& name) override;
+  void LoadChildren() override;
+
  private:
   friend class DiscImageDevice;
 
   MappedMemory* mmap_;
   size_t data_offset_;
   size_t data_size_;
+
+  // Directories: the on-disc tree of their entries, read on demand and
+  // dropped once all children are loaded.
+  size_t dirents_offset_;
+  size_t dirents_size_;
+  std::vector<uint8_t> dirents_;
+  bool children_loaded_;
+  // Children loaded one at a time by LoadChild, by tree ordinal, until
+  // LoadChildren loads the rest.
+  std::unordered_map<uint16_t, Entry*> loaded_ordinals_;
 };
 
 }  // namespace vfs
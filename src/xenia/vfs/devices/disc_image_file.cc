@@ -11,6 +11,7 @@
 
 #include <algorithm>
 
+#include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/disc_image_entry.h"
 
 namespace xe {
@@ -28,10 +29,19 @@ X_STATUS DiscImageFile::ReadSync(void* buffer, size_t buffer_length,
   if (byte_offset >= entry_->size()) {
     return X_STATUS_END_OF_FILE;
   }
+  auto device = static_cast<DiscImageDevice*>(entry_->device());
   size_t real_offset = entry_->data_offset() + byte_offset;
   size_t real_length =
       std::min(buffer_length, entry_->data_size() - byte_offset);
-  std::memcpy(buffer, entry_->mmap()->data() + real_offset, real_length);
+  size_t prefetch_offset, prefetch_length;
+  if (readahead_.OnRead(byte_offset, real_length, entry_->data_size(),
+                        &prefetch_offset, &prefetch_length)) {
+    device->PrefetchImage(entry_->data_offset() + prefetch_offset,
+                          prefetch_length);
+  }
+  if (!device->ReadImage(real_offset, buffer, real_length)) {
+    return X_STATUS_UNSUCCESSFUL;
+  }
   *out_bytes_read = real_length;
   return X_STATUS_SUCCESS;
 }
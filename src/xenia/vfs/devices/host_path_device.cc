@@ -9,12 +9,17 @@
 
 #include "xenia/vfs/devices/host_path_device.h"
 
+#include <gflags/gflags.h>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/math.h"
 #include "xenia/kernel/xfile.h"
 #include "xenia/vfs/devices/host_path_entry.h"
 
+DEFINE_bool(vfs_watch_host_paths, true,
+            "Pick up changes made to mounted host directories while running.");
+
 namespace xe {
 namespace vfs {
 
@@ -22,7 +27,10 @@ HostPathDevice::HostPathDevice(const std::string& mount_path,
                                const std::wstring& local_path, bool read_only)
     : Device(mount_path), local_path_(local_path), read_only_(read_only) {}
 
-HostPathDevice::~HostPathDevice() = default;
+HostPathDevice::~HostPathDevice() {
+  // Stop the callbacks before what they touch goes away.
+  watcher_.reset();
+}
 
 bool HostPathDevice::Initialize() {
   if (!xe::filesystem::PathExists(local_path_)) {
@@ -38,7 +46,15 @@ bool HostPathDevice::Initialize() {
   auto root_entry = new HostPathEntry(this, nullptr, "", local_path_);
   root_entry->attributes_ = kFileAttributeDirectory;
   root_entry_ = std::unique_ptr<Entry>(root_entry);
-  PopulateEntry(root_entry);
+
+  if (FLAGS_vfs_watch_host_paths) {
+    watcher_ = xe::filesystem::DirectoryWatcher::Create(
+        local_path_,
+        [this](const std::wstring& path) { OnDirectoryChanged(path); });
+    if (!watcher_) {
+      XELOGW("Host path changes can't be watched, they won't be picked up");
+    }
+  }
 
   return true;
 }
@@ -69,19 +85,37 @@ Entry* HostPathDevice::ResolvePath(std::string path) {
   return entry;
 }
 
-void HostPathDevice::PopulateEntry(HostPathEntry* parent_entry) {
-  auto child_infos = xe::filesystem::ListFiles(parent_entry->local_path());
-  for (auto& child_info : child_infos) {
-    auto child = HostPathEntry::Create(
-        this, parent_entry,
-        xe::join_paths(parent_entry->local_path(), child_info.name),
-        child_info);
-    parent_entry->children_.push_back(std::unique_ptr<Entry>(child));
-
-    if (child_info.type == xe::filesystem::FileInfo::Type::kDirectory) {
-      PopulateEntry(child);
+void HostPathDevice::WatchDirectory(HostPathEntry* entry) {
+  if (watcher_ && !watcher_->Watch(entry->local_path())) {
+    XELOGW("Unable to watch %S for changes", entry->local_path().c_str());
+  }
+}
+
+bool HostPathDevice::TakeChanged(HostPathEntry* entry) {
+  bool changed = false;
+  uint64_t generation = rescan_generation_.load(std::memory_order_acquire);
+  if (entry->listed_generation_ != generation) {
+    entry->listed_generation_ = generation;
+    changed = true;
+  }
+  if (any_changed_.load(std::memory_order_acquire)) {
+    auto changed_lock = changed_lock_.Acquire();
+    if (changed_paths_.erase(entry->local_path())) {
+      changed = true;
     }
+    any_changed_.store(!changed_paths_.empty(), std::memory_order_release);
+  }
+  return changed;
+}
+
+void HostPathDevice::OnDirectoryChanged(const std::wstring& path) {
+  if (path.empty()) {
+    rescan_generation_.fetch_add(1, std::memory_order_acq_rel);
+    return;
   }
+  auto changed_lock = changed_lock_.Acquire();
+  changed_paths_.insert(path);
+  any_changed_.store(true, std::memory_order_release);
 }
 
 }  // namespace vfs
@@ -10,8 +10,13 @@
 #ifndef XENIA_VFS_DEVICES_HOST_PATH_DEVICE_H_
 #define XENIA_VFS_DEVICES_HOST_PATH_DEVICE_H_
 
+#include <atomic>
+#include <memory>
 #include <string>
+#include <unordered_set>
 
+#include "xenia/base/filesystem.h"
+#include "xenia/base/mutex.h"
 #include "xenia/vfs/device.h"
 
 namespace xe {
@@ -19,6 +24,11 @@ namespace vfs {
 
 class HostPathEntry;
 
+// Mirrors a host directory. Directories are listed the first time they are
+// looked into, and listed again when a lookup misses in or an enumeration
+// walks one the host reports changed since (see
+// xe::filesystem::DirectoryWatcher), so that lookups and enumerations are
+// served from the index rather than the host filesystem.
 class HostPathDevice : public Device {
  public:
   HostPathDevice(const std::string& mount_path, const std::wstring& local_path,
@@ -37,11 +47,30 @@ class HostPathDevice : public Device {
   uint32_t bytes_per_sector() const override { return 2 * 1024; }
 
  private:
-  void PopulateEntry(HostPathEntry* parent_entry);
+  friend class HostPathEntry;
+
+  // Called by directories before they are first listed.
+  void WatchDirectory(HostPathEntry* entry);
+  // Whether the host changed the listed directory since it was last listed.
+  // Clears the flag, the caller lists it again.
+  bool TakeChanged(HostPathEntry* entry);
+  // Called from the watcher thread.
+  void OnDirectoryChanged(const std::wstring& path);
+  void OnEntriesDetached() { DetachedEntries(); }
 
   std::wstring local_path_;
   std::unique_ptr<Entry> root_entry_;
   bool read_only_;
+
+  std::unique_ptr<xe::filesystem::DirectoryWatcher> watcher_;
+  // Host paths of the directories changed since they were last listed. A
+  // leaf lock, as the watcher thread takes it.
+  xe::subsystem_mutex changed_lock_{"vfs/host_path_changed"};
+  std::unordered_set<std::wstring> changed_paths_;
+  // Whether changed_paths_ is non-empty, checked without the lock.
+  std::atomic<bool> any_changed_ = {false};
+  // Bumped when events were lost, making every listed directory stale.
+  std::atomic<uint64_t> rescan_generation_ = {0};
 };
 
 }  // namespace vfs
@@ -9,12 +9,15 @@
 
 #include "xenia/vfs/devices/host_path_entry.h"
 
+#include <unordered_map>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/mapped_memory.h"
 #include "xenia/base/math.h"
 #include "xenia/base/string.h"
 #include "xenia/vfs/device.h"
+#include "xenia/vfs/devices/host_path_device.h"
 #include "xenia/vfs/devices/host_path_file.h"
 
 namespace xe {
@@ -32,9 +35,6 @@ HostPathEntry* HostPathEntry::Create(Device* device, Entry* parent,
   auto path = xe::join_paths(parent->path(), xe::to_string(file_info.name));
   auto entry = new HostPathEntry(device, parent, path, full_path);
 
-  entry->create_timestamp_ = file_info.create_timestamp;
-  entry->access_timestamp_ = file_info.access_timestamp;
-  entry->write_timestamp_ = file_info.write_timestamp;
   if (file_info.type == xe::filesystem::FileInfo::Type::kDirectory) {
     entry->attributes_ = kFileAttributeDirectory;
   } else {
@@ -42,13 +42,22 @@ HostPathEntry* HostPathEntry::Create(Device* device, Entry* parent,
     if (device->is_read_only()) {
       entry->attributes_ |= kFileAttributeReadOnly;
     }
-    entry->size_ = file_info.total_size;
-    entry->allocation_size_ =
-        xe::round_up(file_info.total_size, device->bytes_per_sector());
   }
+  entry->ApplyFileInfo(file_info);
   return entry;
 }
 
+void HostPathEntry::ApplyFileInfo(const xe::filesystem::FileInfo& file_info) {
+  create_timestamp_ = file_info.create_timestamp;
+  access_timestamp_ = file_info.access_timestamp;
+  write_timestamp_ = file_info.write_timestamp;
+  if (!(attributes_ & kFileAttributeDirectory)) {
+    size_ = file_info.total_size;
+    allocation_size_ =
+        xe::round_up(file_info.total_size, device_->bytes_per_sector());
+  }
+}
+
 X_STATUS HostPathEntry::Open(uint32_t desired_access, File** out_file) {
   if (is_read_only() && (desired_access & (FileAccess::kFileWriteData |
                                            FileAccess::kFileAppendData))) {
@@ -93,6 +102,68 @@ std::unique_ptr<Entry> HostPathEntry::CreateEntryInternal(std::string name,
       HostPathEntry::Create(device_, this, full_path, file_info));
 }
 
+Entry* HostPathEntry::LoadChild(const std::string& name) {
+  auto global_lock = global_critical_region_.Acquire();
+  if (!ListChildren()) {
+    return nullptr;
+  }
+  auto it = child_index_.find(xe::to_lower_ascii(name));
+  return it != child_index_.end() ? it->second : nullptr;
+}
+
+void HostPathEntry::LoadChildren() { ListChildren(); }
+
+bool HostPathEntry::ListChildren() {
+  if (!(attributes_ & kFileAttributeDirectory)) {
+    return false;
+  }
+  auto device = static_cast<HostPathDevice*>(device_);
+  auto global_lock = global_critical_region_.Acquire();
+  if (!children_listed_) {
+    // Watch first, so that changes made while listing aren't missed.
+    device->WatchDirectory(this);
+    device->TakeChanged(this);
+    children_listed_ = true;
+  } else if (!device->TakeChanged(this)) {
+    return false;
+  }
+
+  // What's left in here once the listing is applied is gone from the host.
+  std::unordered_map<std::string, HostPathEntry*> previous_children;
+  for (auto& child : children_) {
+    previous_children.emplace(child->name(),
+                              static_cast<HostPathEntry*>(child.get()));
+  }
+  bool detached = false;
+  for (auto& child_info : xe::filesystem::ListFiles(local_path_)) {
+    auto it = previous_children.find(xe::to_string(child_info.name));
+    if (it != previous_children.end()) {
+      auto child = it->second;
+      previous_children.erase(it);
+      bool is_directory =
+          child_info.type == xe::filesystem::FileInfo::Type::kDirectory;
+      if (is_directory == !!(child->attributes_ & kFileAttributeDirectory)) {
+        child->ApplyFileInfo(child_info);
+        continue;
+      }
+      // Replaced by one of the other type.
+      detached_children_.push_back(RemoveChild(child));
+      detached = true;
+    }
+    AddChild(std::unique_ptr<Entry>(HostPathEntry::Create(
+        device_, this, xe::join_paths(local_path_, child_info.name),
+        child_info)));
+  }
+  for (auto& it : previous_children) {
+    detached_children_.push_back(RemoveChild(it.second));
+    detached = true;
+  }
+  if (detached) {
+    device->OnEntriesDetached();
+  }
+  return true;
+}
+
 bool HostPathEntry::DeleteEntryInternal(Entry* entry) {
   auto full_path = xe::join_paths(local_path_, xe::to_wstring(entry->name()));
   if (entry->attributes() & kFileAttributeDirectory) {
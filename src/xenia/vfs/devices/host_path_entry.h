@@ -10,7 +10,9 @@
 #ifndef XENIA_VFS_DEVICES_HOST_PATH_ENTRY_H_
 #define XENIA_VFS_DEVICES_HOST_PATH_ENTRY_H_
 
+#include <memory>
 #include <string>
+#include <vector>
 
 #include "xenia/base/filesystem.h"
 #include "xenia/vfs/entry.h"
@@ -45,8 +47,22 @@ class HostPathEntry : public Entry {
   std::unique_ptr<Entry> CreateEntryInternal(std::string name,
                                              uint32_t attributes) override;
   bool DeleteEntryInternal(Entry* entry) override;
+  Entry* LoadChild(const std::string& name) override;
+  void LoadChildren() override;
+
+  void ApplyFileInfo(const xe::filesystem::FileInfo& file_info);
+  // Lists the directory if it hasn't been yet or the host changed it since,
+  // adding new children, updating the others and dropping the gone ones.
+  // Returns whether it was listed.
+  bool ListChildren();
 
   std::wstring local_path_;
+  bool children_listed_ = false;
+  // HostPathDevice::rescan_generation_ when last listed.
+  uint64_t listed_generation_ = 0;
+  // Children gone from the host directory, kept alive while files may still
+  // be open on them.
+  std::vector<std::unique_ptr<Entry>> detached_children_;
 };
 
 }  // namespace vfs
@@ -29,6 +29,11 @@ X_STATUS HostPathFile::ReadSync(void* buffer, size_t buffer_length,
     return X_STATUS_ACCESS_DENIED;
   }
 
+  size_t prefetch_offset, prefetch_length;
+  if (readahead_.OnRead(byte_offset, buffer_length, entry_->size(),
+                        &prefetch_offset, &prefetch_length)) {
+    file_handle_->Prefetch(prefetch_offset, prefetch_length);
+  }
   if (file_handle_->Read(byte_offset, buffer, buffer_length, out_bytes_read)) {
     return X_STATUS_SUCCESS;
   } else {
@@ -14,6 +14,7 @@
 
 #include "xenia/base/filesystem.h"
 #include "xenia/vfs/file.h"
+#include "xenia/vfs/readahead.h"
 
 namespace xe {
 namespace vfs {
@@ -36,6 +37,7 @@ class HostPathFile : public File {
 
  private:
   std::unique_ptr<xe::filesystem::FileHandle> file_handle_;
+  Readahead readahead_;
 };
 
 }  // namespace vfs
@@ -10,6 +10,7 @@
 #include "xenia/vfs/devices/stfs_container_device.h"
 
 #include <algorithm>
+#include <cstring>
 #include <queue>
 #include <vector>
 
@@ -17,6 +18,8 @@
 #include "xenia/base/math.h"
 #include "xenia/vfs/devices/stfs_container_entry.h"
 
+#include "third_party/crypto/TinySHA1.hpp"
+
 #if XE_PLATFORM_WIN32
 #include "xenia/base/platform_win.h"
 #define timegm _mkgmtime
@@ -362,8 +365,6 @@ StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
       uint32_t block_index = data_block;
       size_t remaining_size = xe::round_up(length, 0x800);
 
-      size_t last_record = -1;
-      size_t last_offset = -1;
       while (remaining_size) {
         const size_t BLOCK_SIZE = 0x800;
 
@@ -373,21 +374,13 @@ StfsContainerDevice::Error StfsContainerDevice::ReadEntrySVOD(
         block_index++;
         remaining_size -= BLOCK_SIZE;
 
-        if (offset - last_offset == 0x800) {
-          // Consecutive, so append to last entry.
-          entry->block_list_[last_record].length += BLOCK_SIZE;
-          last_offset = offset;
-          continue;
-        }
-
-        entry->block_list_.push_back({file_index, offset, BLOCK_SIZE});
-        last_record = entry->block_list_.size() - 1;
-        last_offset = offset;
+        // Consecutive blocks are merged into one record.
+        entry->AddBlock(file_index, offset, BLOCK_SIZE);
       }
     }
   }
 
-  parent->children_.emplace_back(std::move(entry));
+  parent->AddChild(std::move(entry));
 
   // Read the right node.
   if (node_r) {
@@ -464,6 +457,13 @@ void StfsContainerDevice::BlockToOffsetSVOD(size_t block, size_t* out_address,
 StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
   auto data = mmap_.at(0)->data();
 
+  // Constant for the package, so worked out once for BlockToOffsetSTFS.
+  stfs_block_shift_ = 0;
+  if (((header_.header_size + 0x0FFF) & 0xB000) == 0xB000 ||
+      (header_.stfs_volume_descriptor.flags & 0x1) == 0x0) {
+    stfs_block_shift_ = package_type_ == StfsPackageType::kCon ? 1 : 0;
+  }
+
   auto root_entry = new StfsContainerEntry(this, nullptr, "", &mmap_);
   root_entry->attributes_ = kFileAttributeDirectory;
   root_entry_ = std::unique_ptr<Entry>(root_entry);
@@ -514,6 +514,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
         entry->attributes_ = kFileAttributeNormal | kFileAttributeReadOnly;
         entry->data_offset_ = BlockToOffsetSTFS(start_block_index);
         entry->data_size_ = file_size;
+        entry->block_ = start_block_index;
       }
       entry->size_ = file_size;
       entry->allocation_size_ = xe::round_up(file_size, bytes_per_sector());
@@ -536,7 +537,9 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
           size_t block_size =
               std::min(static_cast<size_t>(0x1000), remaining_size);
           size_t offset = BlockToOffsetSTFS(block_index);
-          entry->block_list_.push_back({0, offset, block_size});
+          // Runs of blocks not interrupted by hash tables are merged, so
+          // reads copy them at once.
+          entry->AddBlock(0, offset, block_size);
           remaining_size -= block_size;
           auto block_hash = GetBlockHash(data, block_index, 0);
           if (table_size_shift_ && block_hash.info < 0x80) {
@@ -547,7 +550,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
         }
       }
 
-      parent_entry->children_.emplace_back(std::move(entry));
+      parent_entry->AddChild(std::move(entry));
     }
 
     auto block_hash = GetBlockHash(data, table_block_index, 0);
@@ -565,11 +568,7 @@ StfsContainerDevice::Error StfsContainerDevice::ReadSTFS() {
 
 size_t StfsContainerDevice::BlockToOffsetSTFS(uint64_t block_index) {
   uint64_t block;
-  uint32_t block_shift = 0;
-  if (((header_.header_size + 0x0FFF) & 0xB000) == 0xB000 ||
-      (header_.stfs_volume_descriptor.flags & 0x1) == 0x0) {
-    block_shift = package_type_ == StfsPackageType::kCon ? 1 : 0;
-  }
+  uint32_t block_shift = stfs_block_shift_;
 
   // For every level there is a hash table
   // Level 0: hash table of next 170 blocks
@@ -590,6 +589,41 @@ size_t StfsContainerDevice::BlockToOffsetSTFS(uint64_t block_index) {
   return xe::round_up(header_.header_size, 0x1000) + (block << 12);
 }
 
+bool StfsContainerDevice::VerifyEntry(StfsContainerEntry* entry) {
+  if (!has_block_hashes() || (entry->attributes() & kFileAttributeDirectory)) {
+    return true;
+  }
+  auto& map = mmap_.at(0);
+  uint32_t block_index = uint32_t(entry->block());
+  size_t remaining_size = entry->size();
+  uint32_t info = 0x80;
+  // Same walk as the one filling the block records in ReadSTFS.
+  while (remaining_size && block_index && info >= 0x80) {
+    size_t offset = BlockToOffsetSTFS(block_index);
+    if (offset + 0x1000 > map->size()) {
+      return false;
+    }
+    auto block_hash = GetBlockHash(map->data(), block_index, 0);
+    if (table_size_shift_ && block_hash.info < 0x80) {
+      block_hash = GetBlockHash(map->data(), block_index, 1);
+    }
+    // Hashes cover whole blocks, the padding after the end of the data too.
+    uint8_t digest[0x14];
+    sha1::SHA1 s;
+    s.processBytes(map->data() + offset, 0x1000);
+    s.finalize(digest);
+    if (std::memcmp(digest, block_hash.hash, sizeof(digest))) {
+      XELOGE("STFS block %u of %s doesn't match its hash", block_index,
+             entry->path().c_str());
+      return false;
+    }
+    remaining_size -= std::min(size_t(0x1000), remaining_size);
+    block_index = block_hash.next_block_index;
+    info = block_hash.info;
+  }
+  return !remaining_size;
+}
+
 StfsContainerDevice::BlockHash StfsContainerDevice::GetBlockHash(
     const uint8_t* map_ptr, uint32_t block_index, uint32_t table_offset) {
   uint32_t record = block_index % 0xAA;
@@ -605,7 +639,7 @@ StfsContainerDevice::BlockHash StfsContainerDevice::GetBlockHash(
   const uint8_t* record_data = hash_data + record * 0x18;
   uint32_t info = xe::load_and_swap<uint8_t>(record_data + 0x14);
   uint32_t next_block_index = load_uint24_be(record_data + 0x15);
-  return {next_block_index, info};
+  return {next_block_index, info, record_data};
 }
 
 bool StfsVolumeDescriptor::Read(const uint8_t* p) {
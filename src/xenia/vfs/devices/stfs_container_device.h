@@ -181,6 +181,15 @@ class StfsContainerDevice : public Device {
   uint32_t sectors_per_allocation_unit() const override { return 1; }
   uint32_t bytes_per_sector() const override { return 4 * 1024; }
 
+  // Whether VerifyEntry can check entries. Only STFS packages keep a hash of
+  // every block, SVOD ones are left unchecked.
+  bool has_block_hashes() const {
+    return header_.descriptor_type == StfsDescriptorType::kStfs;
+  }
+  // Checks every block of the entry's data against its SHA-1 in the hash
+  // tables. False if one doesn't match or the block chain is cut short.
+  bool VerifyEntry(StfsContainerEntry* entry);
+
  private:
   enum class Error {
     kSuccess = 0,
@@ -193,6 +202,8 @@ class StfsContainerDevice : public Device {
   struct BlockHash {
     uint32_t next_block_index;
     uint32_t info;
+    // SHA-1 of the block.
+    const uint8_t* hash;
   };
 
   const uint32_t kSTFSHashSpacing = 170;
@@ -224,6 +235,7 @@ class StfsContainerDevice : public Device {
   StfsPackageType package_type_;
   StfsHeader header_;
   uint32_t table_size_shift_;
+  uint32_t stfs_block_shift_ = 0;
 };
 
 }  // namespace vfs
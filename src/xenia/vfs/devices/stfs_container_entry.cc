@@ -11,6 +11,7 @@
 #include "xenia/base/math.h"
 #include "xenia/vfs/devices/stfs_container_file.h"
 
+#include <algorithm>
 #include <map>
 
 namespace xe {
@@ -34,6 +35,35 @@ std::unique_ptr<StfsContainerEntry> StfsContainerEntry::Create(
   return std::move(entry);
 }
 
+size_t StfsContainerEntry::FindBlockRecord(size_t entry_offset) const {
+  auto it = std::upper_bound(block_list_.begin(), block_list_.end(),
+                             entry_offset,
+                             [](size_t offset, const BlockRecord& record) {
+                               return offset < record.entry_offset;
+                             });
+  if (it == block_list_.begin()) {
+    return block_list_.size();
+  }
+  --it;
+  if (entry_offset >= it->entry_offset + it->length) {
+    return block_list_.size();
+  }
+  return size_t(it - block_list_.begin());
+}
+
+void StfsContainerEntry::AddBlock(size_t file, size_t offset, size_t length) {
+  size_t entry_offset = 0;
+  if (!block_list_.empty()) {
+    auto& last = block_list_.back();
+    if (last.file == file && last.offset + last.length == offset) {
+      last.length += length;
+      return;
+    }
+    entry_offset = last.entry_offset + last.length;
+  }
+  block_list_.push_back({file, offset, length, entry_offset});
+}
+
 X_STATUS StfsContainerEntry::Open(uint32_t desired_access, File** out_file) {
   *out_file = new StfsContainerFile(desired_access, this);
   return X_STATUS_SUCCESS;
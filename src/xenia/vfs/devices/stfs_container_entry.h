@@ -43,16 +43,26 @@ class StfsContainerEntry : public Entry {
 
   X_STATUS Open(uint32_t desired_access, File** out_file) override;
 
+  // A contiguous run of the entry's data in one of the container files.
   struct BlockRecord {
     size_t file;
     size_t offset;
     size_t length;
+    // Where the run starts in the entry's data.
+    size_t entry_offset;
   };
   const std::vector<BlockRecord>& block_list() const { return block_list_; }
+  // Returns the index of the record holding the byte at entry_offset, or
+  // block_list().size() if it's past the end.
+  size_t FindBlockRecord(size_t entry_offset) const;
 
  private:
   friend class StfsContainerDevice;
 
+  // Appends the data at offset of the container file, merging it into the
+  // last record if it directly follows it.
+  void AddBlock(size_t file, size_t offset, size_t length);
+
   MultifileMemoryMap* mmap_;
   size_t data_offset_;
   size_t data_size_;
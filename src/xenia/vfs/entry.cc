@@ -39,6 +39,7 @@ void Entry::Dump(xe::StringBuffer* string_buffer, int indent) {
   }
   string_buffer->Append(name());
   string_buffer->Append('\n');
+  LoadChildren();
   for (auto& child : children_) {
     child->Dump(string_buffer, indent + 2);
   }
@@ -48,18 +49,25 @@ bool Entry::is_read_only() const { return device_->is_read_only(); }
 
 Entry* Entry::GetChild(std::string name) {
   auto global_lock = global_critical_region_.Acquire();
-  // TODO(benvanik): a faster search
-  for (auto& child : children_) {
-    if (strcasecmp(child->name().c_str(), name.c_str()) == 0) {
-      return child.get();
-    }
+  auto it = child_index_.find(xe::to_lower_ascii(name));
+  if (it != child_index_.end()) {
+    return it->second;
   }
-  return nullptr;
+  return LoadChild(name);
+}
+
+Entry* Entry::AddChild(std::unique_ptr<Entry> child) {
+  auto global_lock = global_critical_region_.Acquire();
+  auto entry = child.get();
+  child_index_.emplace(xe::to_lower_ascii(entry->name()), entry);
+  children_.push_back(std::move(child));
+  return entry;
 }
 
 Entry* Entry::IterateChildren(const xe::filesystem::WildcardEngine& engine,
                               size_t* current_index) {
   auto global_lock = global_critical_region_.Acquire();
+  LoadChildren();
   while (*current_index < children_.size()) {
     auto& child = children_[*current_index];
     *current_index = *current_index + 1;
@@ -83,10 +91,10 @@ Entry* Entry::CreateEntry(std::string name, uint32_t attributes) {
   if (!entry) {
     return nullptr;
   }
-  children_.push_back(std::move(entry));
+  auto child = AddChild(std::move(entry));
   // TODO(benvanik): resort? would break iteration?
   Touch();
-  return children_.back().get();
+  return child;
 }
 
 bool Entry::Delete(Entry* entry) {
@@ -100,14 +108,38 @@ bool Entry::Delete(Entry* entry) {
   if (!DeleteEntryInternal(entry)) {
     return false;
   }
+  RemoveChild(entry);
+  Touch();
+  return true;
+}
+
+std::unique_ptr<Entry> Entry::RemoveChild(Entry* entry) {
+  auto global_lock = global_critical_region_.Acquire();
+  auto key = xe::to_lower_ascii(entry->name());
+  auto index_it = child_index_.find(key);
+  bool was_indexed = index_it != child_index_.end() &&
+                     index_it->second == entry;
+  if (was_indexed) {
+    child_index_.erase(index_it);
+  }
+  std::unique_ptr<Entry> removed;
   for (auto it = children_.begin(); it != children_.end(); ++it) {
     if (it->get() == entry) {
+      removed = std::move(*it);
       children_.erase(it);
       break;
     }
   }
-  Touch();
-  return true;
+  if (was_indexed) {
+    // Expose the next child with the same name, if the device had any.
+    for (auto& child : children_) {
+      if (xe::to_lower_ascii(child->name()) == key) {
+        child_index_.emplace(key, child.get());
+        break;
+      }
+    }
+  }
+  return removed;
 }
 
 bool Entry::Delete() {
@@ -12,6 +12,7 @@
 
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 #include "xenia/base/filesystem.h"
@@ -98,10 +99,14 @@ class Entry {
 
   Entry* GetChild(std::string name);
 
-  const std::vector<std::unique_ptr<Entry>>& children() const {
+  const std::vector<std::unique_ptr<Entry>>& children() {
+    LoadChildren();
     return children_;
   }
-  size_t child_count() const { return children_.size(); }
+  size_t child_count() {
+    LoadChildren();
+    return children_.size();
+  }
   Entry* IterateChildren(const xe::filesystem::WildcardEngine& engine,
                          size_t* current_index);
 
@@ -130,6 +135,19 @@ class Entry {
   }
   virtual bool DeleteEntryInternal(Entry* entry) { return false; }
 
+  // Entries reading their children on demand override these. LoadChild adds
+  // the named child if it exists but isn't loaded yet, LoadChildren adds any
+  // that aren't. They take global_critical_region_ themselves.
+  virtual Entry* LoadChild(const std::string& name) { return nullptr; }
+  virtual void LoadChildren() {}
+
+  // Appends a child and indexes it by name. Devices populating their trees
+  // must go through this instead of pushing into children_.
+  Entry* AddChild(std::unique_ptr<Entry> child);
+  // Unlinks a child and hands it back, for devices dropping entries that are
+  // gone from their backing store.
+  std::unique_ptr<Entry> RemoveChild(Entry* child);
+
   xe::global_critical_region global_critical_region_;
   Device* device_;
   Entry* parent_;
@@ -143,6 +161,8 @@ class Entry {
   uint64_t access_timestamp_;
   uint64_t write_timestamp_;
   std::vector<std::unique_ptr<Entry>> children_;
+  // children_ by lowercased name, the first one of any duplicates.
+  std::unordered_map<std::string, Entry*> child_index_;
 };
 
 }  // namespace vfs
@@ -0,0 +1,57 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/file.h"
+
+#include "xenia/base/clock.h"
+#include "xenia/vfs/io_stats.h"
+
+namespace xe {
+namespace vfs {
+
+namespace {
+
+uint64_t TicksToMicroseconds(uint64_t ticks) {
+  return ticks * 1000000 / Clock::host_tick_frequency();
+}
+
+}  // namespace
+
+X_STATUS File::Read(void* buffer, size_t buffer_length, size_t byte_offset,
+                    size_t* out_bytes_read) {
+  if (!IoStats::is_enabled()) {
+    return ReadSync(buffer, buffer_length, byte_offset, out_bytes_read);
+  }
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  X_STATUS result = ReadSync(buffer, buffer_length, byte_offset,
+                             out_bytes_read);
+  IoStats::Record(this, false, byte_offset,
+                  XSUCCEEDED(result) ? *out_bytes_read : 0,
+                  TicksToMicroseconds(Clock::QueryHostTickCount() -
+                                      start_ticks));
+  return result;
+}
+
+X_STATUS File::Write(const void* buffer, size_t buffer_length,
+                     size_t byte_offset, size_t* out_bytes_written) {
+  if (!IoStats::is_enabled()) {
+    return WriteSync(buffer, buffer_length, byte_offset, out_bytes_written);
+  }
+  uint64_t start_ticks = Clock::QueryHostTickCount();
+  X_STATUS result = WriteSync(buffer, buffer_length, byte_offset,
+                              out_bytes_written);
+  IoStats::Record(this, true, byte_offset,
+                  XSUCCEEDED(result) ? *out_bytes_written : 0,
+                  TicksToMicroseconds(Clock::QueryHostTickCount() -
+                                      start_ticks));
+  return result;
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -27,6 +27,13 @@ class File {
 
   virtual void Destroy() = 0;
 
+  // ReadSync and WriteSync, counted in IoStats. What everything but the
+  // devices themselves should call.
+  X_STATUS Read(void* buffer, size_t buffer_length, size_t byte_offset,
+                size_t* out_bytes_read);
+  X_STATUS Write(const void* buffer, size_t buffer_length, size_t byte_offset,
+                 size_t* out_bytes_written);
+
   virtual X_STATUS ReadSync(void* buffer, size_t buffer_length,
                             size_t byte_offset, size_t* out_bytes_read) = 0;
   virtual X_STATUS WriteSync(const void* buffer, size_t buffer_length,
@@ -0,0 +1,232 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/io_stats.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <map>
+#include <mutex>
+
+#include "xenia/base/clock.h"
+#include "xenia/base/filesystem.h"
+#include "xenia/base/logging.h"
+#include "xenia/base/math.h"
+#include "xenia/base/profiling.h"
+#include "xenia/vfs/device.h"
+#include "xenia/vfs/entry.h"
+#include "xenia/vfs/file.h"
+
+DEFINE_bool(vfs_io_stats, false,
+            "Collect guest file I/O statistics per device and per file, "
+            "logged at exit.");
+DEFINE_string(vfs_access_log, "",
+              "Write every guest file read and write to this file, in order.");
+
+namespace xe {
+namespace vfs {
+
+namespace {
+
+struct State {
+  std::mutex mutex;
+  std::map<std::string, IoStats::Totals> device_totals;
+  std::map<std::string, IoStats::Totals> file_totals;
+  FILE* access_log = nullptr;
+  bool access_log_opened = false;
+  uint64_t access_log_start = 0;
+
+  ~State() {
+    if (access_log) {
+      fclose(access_log);
+    }
+  }
+};
+
+State& state() {
+  static State state;
+  return state;
+}
+
+void AppendCounters(StringBuffer* string_buffer, const char* op,
+                    const IoStats::Counters& counters) {
+  if (!counters.count) {
+    return;
+  }
+  string_buffer->AppendFormat(
+      " %s %llu (%llu KB, %.1f ms, avg %llu us, p50 %llu us, p99 %llu us)",
+      op, static_cast<unsigned long long>(counters.count),
+      static_cast<unsigned long long>(counters.bytes / 1024),
+      counters.total_latency_us / 1000.0,
+      static_cast<unsigned long long>(counters.total_latency_us /
+                                      counters.count),
+      static_cast<unsigned long long>(counters.latency_percentile_us(0.5)),
+      static_cast<unsigned long long>(counters.latency_percentile_us(0.99)));
+}
+
+void AppendTotals(StringBuffer* string_buffer, const std::string& name,
+                  const IoStats::Totals& totals) {
+  string_buffer->AppendFormat("  %s:", name.c_str());
+  AppendCounters(string_buffer, "reads", totals.reads);
+  AppendCounters(string_buffer, "writes", totals.writes);
+  string_buffer->Append('\n');
+}
+
+template <typename T>
+std::vector<std::pair<std::string, IoStats::Totals>> Snapshot(const T& map) {
+  return std::vector<std::pair<std::string, IoStats::Totals>>(map.begin(),
+                                                              map.end());
+}
+
+}  // namespace
+
+void IoStats::Counters::Add(size_t length, uint64_t latency_us) {
+  ++count;
+  bytes += length;
+  total_latency_us += latency_us;
+  size_t bucket = 64 - xe::lzcnt(latency_us);
+  ++latency_buckets[std::min(bucket, kLatencyBucketCount - 1)];
+}
+
+uint64_t IoStats::Counters::latency_percentile_us(double fraction) const {
+  uint64_t target = uint64_t(count * fraction);
+  uint64_t seen = 0;
+  for (size_t i = 0; i < kLatencyBucketCount; ++i) {
+    seen += latency_buckets[i];
+    if (seen > target || seen == count) {
+      return uint64_t(1) << i;
+    }
+  }
+  return uint64_t(1) << (kLatencyBucketCount - 1);
+}
+
+bool IoStats::is_enabled() {
+  return FLAGS_vfs_io_stats || !FLAGS_vfs_access_log.empty();
+}
+
+void IoStats::Record(const File* file, bool is_write, size_t offset,
+                     size_t length, uint64_t latency_us) {
+#if XE_OPTION_PROFILING
+  static const MicroProfileToken read_token =
+      MicroProfileGetCounterToken("vfs/read_bytes");
+  static const MicroProfileToken write_token =
+      MicroProfileGetCounterToken("vfs/write_bytes");
+  MicroProfileCounterAdd(is_write ? write_token : read_token, int64_t(length));
+#endif  // XE_OPTION_PROFILING
+  auto entry = file->entry();
+  auto& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  if (FLAGS_vfs_io_stats) {
+    auto& device_totals = s.device_totals[entry->device()->mount_path()];
+    auto& file_totals = s.file_totals[entry->absolute_path()];
+    (is_write ? device_totals.writes : device_totals.reads)
+        .Add(length, latency_us);
+    (is_write ? file_totals.writes : file_totals.reads).Add(length, latency_us);
+  }
+  if (!FLAGS_vfs_access_log.empty()) {
+    if (!s.access_log_opened) {
+      s.access_log_opened = true;
+      s.access_log = xe::filesystem::OpenFile(
+          xe::to_wstring(FLAGS_vfs_access_log), "w");
+      if (!s.access_log) {
+        XELOGE("Unable to open the VFS access log %s",
+               FLAGS_vfs_access_log.c_str());
+      }
+      s.access_log_start = Clock::QueryHostTickCount();
+    }
+    if (s.access_log) {
+      uint64_t time_us = (Clock::QueryHostTickCount() - s.access_log_start) *
+                         1000000 / Clock::host_tick_frequency();
+      fprintf(s.access_log, "%llu %c %llu %llu %llu %s\n",
+              static_cast<unsigned long long>(time_us), is_write ? 'w' : 'r',
+              static_cast<unsigned long long>(offset),
+              static_cast<unsigned long long>(length),
+              static_cast<unsigned long long>(latency_us),
+              entry->absolute_path().c_str());
+    }
+  }
+}
+
+std::vector<std::pair<std::string, IoStats::Totals>>
+IoStats::GetDeviceTotals() {
+  auto& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  return Snapshot(s.device_totals);
+}
+
+std::vector<std::pair<std::string, IoStats::Totals>> IoStats::GetFileTotals() {
+  auto& s = state();
+  std::lock_guard<std::mutex> lock(s.mutex);
+  return Snapshot(s.file_totals);
+}
+
+void IoStats::Dump(StringBuffer* string_buffer, size_t max_file_count) {
+  auto device_totals = GetDeviceTotals();
+  auto file_totals = GetFileTotals();
+  if (device_totals.empty()) {
+    return;
+  }
+  string_buffer->Append("VFS I/O by device:\n");
+  for (auto& it : device_totals) {
+    AppendTotals(string_buffer, it.first, it.second);
+  }
+
+  auto time_taken = [](const Totals& totals) {
+    return totals.reads.total_latency_us + totals.writes.total_latency_us;
+  };
+  size_t file_count = std::min(max_file_count, file_totals.size());
+  std::partial_sort(file_totals.begin(), file_totals.begin() + file_count,
+                    file_totals.end(),
+                    [&](const std::pair<std::string, Totals>& a,
+                        const std::pair<std::string, Totals>& b) {
+                      return time_taken(a.second) > time_taken(b.second);
+                    });
+  string_buffer->AppendFormat("VFS I/O, %zu of %zu files by time taken:\n",
+                              file_count, file_totals.size());
+  for (size_t i = 0; i < file_count; ++i) {
+    AppendTotals(string_buffer, file_totals[i].first, file_totals[i].second);
+  }
+}
+
+bool IoStats::ReadAccessLog(const std::wstring& path,
+                            std::vector<AccessRecord>* out_records) {
+  auto file = xe::filesystem::OpenFile(path, "r");
+  if (!file) {
+    return false;
+  }
+  char line[4096];
+  while (fgets(line, sizeof(line), file)) {
+    AccessRecord record;
+    char op;
+    int path_start = 0;
+    if (sscanf(line, "%" SCNu64 " %c %" SCNu64 " %" SCNu64 " %" SCNu64 " %n",
+               &record.time_us, &op, &record.offset, &record.length,
+               &record.latency_us, &path_start) != 5 ||
+        !path_start || (op != 'r' && op != 'w')) {
+      continue;
+    }
+    record.is_write = op == 'w';
+    record.path = line + path_start;
+    while (!record.path.empty() &&
+           (record.path.back() == '\n' || record.path.back() == '\r')) {
+      record.path.pop_back();
+    }
+    if (!record.path.empty()) {
+      out_records->push_back(std::move(record));
+    }
+  }
+  fclose(file);
+  return true;
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -0,0 +1,87 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_IO_STATS_H_
+#define XENIA_VFS_IO_STATS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "xenia/base/string_buffer.h"
+
+namespace xe {
+namespace vfs {
+
+class File;
+
+// Counts the reads and writes made through File::Read and File::Write, per
+// device and per file, with a histogram of their latencies, when
+// --vfs_io_stats is set. The totals are logged when the VirtualFileSystem
+// shuts down, and can be taken at any time.
+//
+// --vfs_access_log also writes every operation, in order, to a text file, one
+// per line:
+//   <us since the first one> <r|w> <offset> <length> <latency us> <path>
+// with the absolute path of the entry last, as it may have spaces in it.
+class IoStats {
+ public:
+  static const size_t kLatencyBucketCount = 20;
+
+  struct Counters {
+    uint64_t count = 0;
+    uint64_t bytes = 0;
+    uint64_t total_latency_us = 0;
+    // Bucket 0 counts operations under 1us, bucket i those taking
+    // [2^(i-1), 2^i) us, and the last one also everything slower.
+    uint64_t latency_buckets[kLatencyBucketCount] = {};
+
+    void Add(size_t length, uint64_t latency_us);
+    // The latency that the given fraction of operations took at most, rounded
+    // up to the end of its bucket.
+    uint64_t latency_percentile_us(double fraction) const;
+  };
+  struct Totals {
+    Counters reads;
+    Counters writes;
+  };
+  // A line of the access log.
+  struct AccessRecord {
+    uint64_t time_us;
+    bool is_write;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t latency_us;
+    std::string path;
+  };
+
+  static bool is_enabled();
+
+  static void Record(const File* file, bool is_write, size_t offset,
+                     size_t length, uint64_t latency_us);
+
+  // By mount path and by absolute path, sorted by it.
+  static std::vector<std::pair<std::string, Totals>> GetDeviceTotals();
+  static std::vector<std::pair<std::string, Totals>> GetFileTotals();
+
+  // The devices and the max_file_count files that took the longest.
+  static void Dump(StringBuffer* string_buffer, size_t max_file_count = 32);
+
+  // Parses an access log, skipping malformed lines. False if it can't be
+  // opened.
+  static bool ReadAccessLog(const std::wstring& path,
+                            std::vector<AccessRecord>* out_records);
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_IO_STATS_H_
@@ -0,0 +1,164 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/preloader.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <unordered_map>
+
+#include "xenia/base/logging.h"
+#include "xenia/vfs/io_stats.h"
+#include "xenia/vfs/virtual_file_system.h"
+
+DEFINE_int32(vfs_preload_max_mb, 1024,
+             "Most data preloaded from an access log at launch, in MB.");
+
+namespace xe {
+namespace vfs {
+
+namespace {
+
+// Reads of a file this close after the previous one are merged into it.
+const uint64_t kMergeGap = 64 * 1024;
+const size_t kReadSize = 1024 * 1024;
+
+}  // namespace
+
+Preloader::Preloader(VirtualFileSystem* file_system)
+    : file_system_(file_system) {}
+
+Preloader::~Preloader() { Stop(); }
+
+bool Preloader::Start(const std::wstring& access_log_path) {
+  Stop();
+  std::vector<IoStats::AccessRecord> records;
+  if (!IoStats::ReadAccessLog(access_log_path, &records)) {
+    XELOGE("Unable to read the VFS access log %S", access_log_path.c_str());
+    return false;
+  }
+
+  // What ranges_ reads per path, by offset to end.
+  std::unordered_map<std::string, std::map<uint64_t, uint64_t>> covered;
+  uint64_t budget = uint64_t(std::max(FLAGS_vfs_preload_max_mb, 0)) << 20;
+  uint64_t total_length = 0;
+  ranges_.clear();
+  for (auto& record : records) {
+    if (record.is_write || !record.length) {
+      continue;
+    }
+    uint64_t begin = record.offset;
+    uint64_t end = record.offset + record.length;
+    auto& path_covered = covered[record.path];
+    auto it = path_covered.upper_bound(begin);
+    if (it != path_covered.begin() && std::prev(it)->second >= end) {
+      // Already read by an earlier range.
+      continue;
+    }
+    if (!ranges_.empty() && ranges_.back().path == record.path) {
+      auto& last = ranges_.back();
+      uint64_t last_end = last.offset + last.length;
+      if (begin >= last.offset && begin <= last_end + kMergeGap) {
+        if (end > last_end) {
+          total_length += end - last_end;
+          path_covered[last.offset] = end;
+          last.length = end - last.offset;
+        }
+        if (total_length >= budget) {
+          break;
+        }
+        continue;
+      }
+    }
+    ranges_.push_back({record.path, begin, end - begin});
+    path_covered[begin] = std::max(path_covered[begin], end);
+    total_length += end - begin;
+    if (total_length >= budget) {
+      break;
+    }
+  }
+  if (ranges_.empty()) {
+    return true;
+  }
+
+  XELOGI("VFS preload: replaying %zu ranges, %llu KB", ranges_.size(),
+         static_cast<unsigned long long>(total_length / 1024));
+  stopping_ = false;
+  thread_ = xe::threading::Thread::Create({}, [this]() { ThreadMain(); });
+  thread_->set_name("VFS Preload");
+  // Only ever to get ahead of the title, never in its way.
+  thread_->set_priority(xe::threading::ThreadPriority::kLowest);
+  return true;
+}
+
+void Preloader::Stop() {
+  if (!thread_) {
+    return;
+  }
+  stopping_ = true;
+  xe::threading::Wait(thread_.get(), false);
+  thread_.reset();
+}
+
+void Preloader::ThreadMain() {
+  auto start_time = std::chrono::steady_clock::now();
+  std::vector<uint8_t> buffer(kReadSize);
+  std::string file_path;
+  File* file = nullptr;
+  uint64_t bytes_read_total = 0;
+  for (auto& range : ranges_) {
+    if (stopping_) {
+      break;
+    }
+    if (range.path != file_path) {
+      if (file) {
+        file->Destroy();
+        file = nullptr;
+      }
+      file_path = range.path;
+      auto entry = file_system_->ResolvePath(file_path);
+      if (!entry || entry->Open(FileAccess::kFileReadData, &file) !=
+                        X_STATUS_SUCCESS) {
+        file = nullptr;
+      }
+    }
+    if (!file) {
+      continue;
+    }
+    // Reading it is what pulls it into the caches, the data is dropped.
+    uint64_t offset = range.offset;
+    uint64_t end = range.offset + range.length;
+    while (offset < end && !stopping_) {
+      size_t bytes_read = 0;
+      size_t length = size_t(std::min(uint64_t(kReadSize), end - offset));
+      if (file->ReadSync(buffer.data(), length, size_t(offset), &bytes_read) !=
+              X_STATUS_SUCCESS ||
+          !bytes_read) {
+        break;
+      }
+      offset += bytes_read;
+      bytes_read_total += bytes_read;
+    }
+  }
+  if (file) {
+    file->Destroy();
+  }
+  XELOGI("VFS preload: %s after %llu KB in %.1f ms",
+         stopping_ ? "stopped" : "done",
+         static_cast<unsigned long long>(bytes_read_total / 1024),
+         std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start_time)
+             .count());
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -0,0 +1,60 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_PRELOADER_H_
+#define XENIA_VFS_PRELOADER_H_
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "xenia/base/threading.h"
+
+namespace xe {
+namespace vfs {
+
+class VirtualFileSystem;
+
+// Replays the reads of an access log written by --vfs_access_log (see
+// IoStats) on a background thread, so that what a title read during an
+// earlier boot is already paged in, or decompressed for compressed images,
+// by the time it reads it again. Reads close together in the same file are
+// merged, those already replayed are skipped, and it stops after
+// --vfs_preload_max_mb. The reads go to File::ReadSync, so they don't show
+// up in the statistics or the access log of this run.
+class Preloader {
+ public:
+  explicit Preloader(VirtualFileSystem* file_system);
+  ~Preloader();
+
+  // False if the log can't be read.
+  bool Start(const std::wstring& access_log_path);
+  // Waits for the thread to stop, after the read in progress.
+  void Stop();
+
+ private:
+  struct Range {
+    std::string path;
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  void ThreadMain();
+
+  VirtualFileSystem* file_system_;
+  std::vector<Range> ranges_;
+  std::atomic<bool> stopping_ = {false};
+  std::unique_ptr<xe::threading::Thread> thread_;
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_PRELOADER_H_
@@ -7,6 +7,7 @@ project("xenia-vfs")
   kind("StaticLib")
   language("C++")
   links({
+    "snappy",
     "xenia-base",
   })
   defines({
@@ -23,6 +24,7 @@ project("xenia-vfs-dump")
   language("C++")
   links({
     "gflags",
+    "snappy",
     "xenia-base",
     "xenia-vfs",
   })
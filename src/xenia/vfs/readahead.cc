@@ -0,0 +1,133 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#include "xenia/vfs/readahead.h"
+
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+
+#include "xenia/base/profiling.h"
+
+DEFINE_bool(vfs_readahead, true,
+            "Prefetch ahead of sequential reads of guest files.");
+DEFINE_int32(vfs_readahead_max_kb, 4096,
+             "Largest window prefetched ahead of sequential reads, in KB.");
+
+namespace xe {
+namespace vfs {
+
+namespace {
+
+// The window of the first prefetch, after this many sequential reads.
+const size_t kInitialWindow = 128 * 1024;
+const uint32_t kSequentialReadsBeforePrefetch = 2;
+
+std::atomic<uint64_t> read_count_ = {0};
+std::atomic<uint64_t> hit_count_ = {0};
+std::atomic<uint64_t> prefetch_count_ = {0};
+std::atomic<uint64_t> prefetch_bytes_ = {0};
+
+#if XE_OPTION_PROFILING
+enum ProfileCounter {
+  kReads,
+  kHits,
+  kPrefetches,
+  kPrefetchBytes,
+};
+
+void AddProfileCounter(ProfileCounter counter, uint64_t value) {
+  static const MicroProfileToken tokens[] = {
+      MicroProfileGetCounterToken("vfs/readahead_reads"),
+      MicroProfileGetCounterToken("vfs/readahead_hits"),
+      MicroProfileGetCounterToken("vfs/readahead_prefetches"),
+      MicroProfileGetCounterToken("vfs/readahead_bytes"),
+  };
+  MicroProfileCounterAdd(tokens[counter], int64_t(value));
+}
+#endif  // XE_OPTION_PROFILING
+
+}  // namespace
+
+Readahead::Stats Readahead::GetStats() {
+  Stats stats;
+  stats.read_count = read_count_.load(std::memory_order_relaxed);
+  stats.hit_count = hit_count_.load(std::memory_order_relaxed);
+  stats.prefetch_count = prefetch_count_.load(std::memory_order_relaxed);
+  stats.prefetch_bytes = prefetch_bytes_.load(std::memory_order_relaxed);
+  return stats;
+}
+
+bool Readahead::OnRead(size_t offset, size_t length, size_t file_size,
+                       size_t* out_prefetch_offset,
+                       size_t* out_prefetch_length) {
+  if (!FLAGS_vfs_readahead || !length) {
+    return false;
+  }
+  size_t end = std::min(offset + length, file_size);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  read_count_.fetch_add(1, std::memory_order_relaxed);
+#if XE_OPTION_PROFILING
+  AddProfileCounter(kReads, 1);
+#endif  // XE_OPTION_PROFILING
+  if (offset >= prefetch_begin_ && end <= prefetch_end_) {
+    hit_count_.fetch_add(1, std::memory_order_relaxed);
+#if XE_OPTION_PROFILING
+    AddProfileCounter(kHits, 1);
+#endif  // XE_OPTION_PROFILING
+  }
+
+  if (offset == next_offset_) {
+    ++sequential_count_;
+  } else {
+    // Seeked, start over.
+    sequential_count_ = 1;
+    window_ = 0;
+    prefetch_begin_ = prefetch_end_ = 0;
+  }
+  next_offset_ = end;
+  if (sequential_count_ < kSequentialReadsBeforePrefetch || end >= file_size) {
+    return false;
+  }
+
+  // Stay a window ahead: prefetch again once the reads are into the second
+  // half of what was prefetched last.
+  size_t max_window =
+      std::max(size_t(FLAGS_vfs_readahead_max_kb), size_t(1)) * 1024;
+  if (window_ && end + window_ / 2 < prefetch_end_) {
+    return false;
+  }
+  window_ = window_ ? std::min(window_ * 2, max_window)
+                    : std::min(kInitialWindow, max_window);
+  size_t prefetch_offset = std::max(end, prefetch_end_);
+  size_t prefetch_length =
+      std::min(window_, file_size - std::min(prefetch_offset, file_size));
+  if (!prefetch_length) {
+    return false;
+  }
+  if (prefetch_end_ < end) {
+    prefetch_begin_ = end;
+  }
+  prefetch_end_ = prefetch_offset + prefetch_length;
+
+  prefetch_count_.fetch_add(1, std::memory_order_relaxed);
+  prefetch_bytes_.fetch_add(prefetch_length, std::memory_order_relaxed);
+#if XE_OPTION_PROFILING
+  AddProfileCounter(kPrefetches, 1);
+  AddProfileCounter(kPrefetchBytes, prefetch_length);
+#endif  // XE_OPTION_PROFILING
+  *out_prefetch_offset = prefetch_offset;
+  *out_prefetch_length = prefetch_length;
+  return true;
+}
+
+}  // namespace vfs
+}  // namespace xe
@@ -0,0 +1,59 @@
+/**
+ ******************************************************************************
+ * Xenia : Xbox 360 Emulator Research Project                                 *
+ ******************************************************************************
+ * Copyright 2018 Ben Vanik. All rights reserved.                             *
+ * Released under the BSD license - see LICENSE in the root for more details. *
+ ******************************************************************************
+ */
+
+#ifndef XENIA_VFS_READAHEAD_H_
+#define XENIA_VFS_READAHEAD_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace xe {
+namespace vfs {
+
+// Detects sequential reads of a single open file and picks what to prefetch
+// ahead of them. The window starts small and doubles, up to
+// --vfs_readahead_max_kb, while the file keeps being read sequentially; any
+// seek starts over. Files call OnRead for every read and pass the range it
+// returns to the OS as a readahead hint (madvise/posix_fadvise), which reads
+// it in the background.
+class Readahead {
+ public:
+  struct Stats {
+    // Reads observed.
+    uint64_t read_count;
+    // Reads entirely within a range prefetched by an earlier read.
+    uint64_t hit_count;
+    // Prefetches issued and the bytes they covered.
+    uint64_t prefetch_count;
+    uint64_t prefetch_bytes;
+  };
+
+  // Totals over all files.
+  static Stats GetStats();
+
+  // Returns true and the range to prefetch if the read warrants one.
+  bool OnRead(size_t offset, size_t length, size_t file_size,
+              size_t* out_prefetch_offset, size_t* out_prefetch_length);
+
+ private:
+  std::mutex mutex_;
+  // Where the next sequential read would start.
+  size_t next_offset_ = 0;
+  uint32_t sequential_count_ = 0;
+  size_t window_ = 0;
+  // What has been prefetched ahead of the reads.
+  size_t prefetch_begin_ = 0;
+  size_t prefetch_end_ = 0;
+};
+
+}  // namespace vfs
+}  // namespace xe
+
+#endif  // XENIA_VFS_READAHEAD_H_
@@ -7,45 +7,181 @@
  ******************************************************************************
  */
 
+#include <gflags/gflags.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cwctype>
+#include <mutex>
 #include <queue>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "xenia/base/logging.h"
 #include "xenia/base/main.h"
 #include "xenia/base/math.h"
+#include "xenia/base/threading.h"
 
+#include "xenia/vfs/devices/compressed_disc_image_device.h"
+#include "xenia/vfs/devices/disc_image_device.h"
 #include "xenia/vfs/devices/stfs_container_device.h"
+#include "xenia/vfs/devices/stfs_container_entry.h"
 #include "xenia/vfs/file.h"
 
+DEFINE_bool(compress, false,
+            "Convert the source disc image into a compressed disc image "
+            "(.xcdi) at dump_path instead of dumping its files.");
+DEFINE_int32(compress_chunk_kb, 64,
+             "Size of the chunks compressed disc images are split in, in KB.");
+DEFINE_int32(dump_threads, 0,
+             "Threads extracting files, 0 for one per logical processor.");
+DEFINE_int32(dump_buffer_kb, 4096,
+             "Size of the buffer each thread copies files through, in KB.");
+DEFINE_bool(dump_verify, false,
+            "Check the files of STFS packages against the block hashes of the "
+            "package as they are extracted.");
+
 namespace xe {
 namespace vfs {
 
+namespace {
+
+// Copy buffers are page aligned, which hosts can read into directly.
+const size_t kBufferAlignment = 4096;
+
+struct DumpTotals {
+  std::atomic<size_t> file_count = {0};
+  std::atomic<size_t> failed_count = {0};
+  std::atomic<uint64_t> byte_count = {0};
+};
+
+bool WriteAll(FILE* file, const uint8_t* data, size_t length,
+              size_t chunk_size, DumpTotals* totals) {
+  while (length) {
+    size_t chunk_length = std::min(chunk_size, length);
+    if (fwrite(data, chunk_length, 1, file) != 1) {
+      return false;
+    }
+    data += chunk_length;
+    length -= chunk_length;
+    totals->byte_count.fetch_add(chunk_length, std::memory_order_relaxed);
+  }
+  return true;
+}
+
+// Copies a file entry to dest_name through the buffer, streaming it so that
+// memory use doesn't depend on the file size.
+bool DumpFile(Entry* entry, const std::wstring& dest_name,
+              StfsContainerDevice* verify_device, uint8_t* buffer,
+              size_t buffer_size, DumpTotals* totals) {
+  if (verify_device &&
+      !verify_device->VerifyEntry(static_cast<StfsContainerEntry*>(entry))) {
+    XELOGE("%s is damaged", entry->path().c_str());
+    return false;
+  }
+
+  vfs::File* in_file = nullptr;
+  if (entry->Open(FileAccess::kFileReadData, &in_file) != X_STATUS_SUCCESS) {
+    XELOGE("Unable to open %s", entry->path().c_str());
+    return false;
+  }
+  auto file = xe::filesystem::OpenFile(dest_name, "wb");
+  if (!file) {
+    XELOGE("Unable to create %S", dest_name.c_str());
+    in_file->Destroy();
+    return false;
+  }
+
+  bool succeeded = true;
+  auto map = entry->can_map()
+                 ? entry->OpenMapped(xe::MappedMemory::Mode::kRead)
+                 : nullptr;
+  if (map) {
+    succeeded =
+        WriteAll(file, map->data(), map->size(), buffer_size, totals);
+    map->Close();
+  } else {
+    // Can't map the file into memory, read it a buffer at a time.
+    size_t offset = 0;
+    while (succeeded && offset < entry->size()) {
+      size_t bytes_read = 0;
+      if (in_file->ReadSync(buffer,
+                            std::min(buffer_size, entry->size() - offset),
+                            offset, &bytes_read) != X_STATUS_SUCCESS ||
+          !bytes_read) {
+        succeeded = false;
+        break;
+      }
+      succeeded = WriteAll(file, buffer, bytes_read, buffer_size, totals);
+      offset += bytes_read;
+    }
+  }
+  if (!succeeded) {
+    XELOGE("Failed to extract %s", entry->path().c_str());
+  }
+
+  fclose(file);
+  in_file->Destroy();
+  return succeeded;
+}
+
+}  // namespace
+
 int vfs_dump_main(const std::vector<std::wstring>& args) {
   if (args.size() <= 2) {
     XELOGE("Usage: %s [source] [dump_path]", args[0].c_str());
     return 1;
   }
 
+  if (FLAGS_compress) {
+    uint32_t chunk_size = uint32_t(std::max(FLAGS_compress_chunk_kb, 2)) * 1024;
+    return CompressedDiscImageDevice::Compress(args[1], args[2], chunk_size)
+               ? 0
+               : 1;
+  }
+
   std::wstring base_path = args[2];
   std::unique_ptr<vfs::Device> device;
+  StfsContainerDevice* stfs_device = nullptr;
 
-  // TODO: Flags specifying the type of device.
-  device = std::make_unique<vfs::StfsContainerDevice>("", args[1]);
+  // Guessed from the extension, as Emulator::LaunchPath does.
+  auto extension = args[1].substr(std::min(args[1].find_last_of(L'.'),
+                                           args[1].size()));
+  std::transform(extension.begin(), extension.end(), extension.begin(),
+                 towlower);
+  if (extension == L".iso") {
+    device = std::make_unique<vfs::DiscImageDevice>("", args[1]);
+  } else if (extension == L".xcdi") {
+    device = std::make_unique<vfs::CompressedDiscImageDevice>("", args[1]);
+  } else {
+    auto stfs = std::make_unique<vfs::StfsContainerDevice>("", args[1]);
+    stfs_device = stfs.get();
+    device = std::move(stfs);
+  }
   if (!device->Initialize()) {
     XELOGE("Failed to initialize device");
     return 1;
   }
 
-  // Run through all the files, breadth-first style.
+  StfsContainerDevice* verify_device = nullptr;
+  if (FLAGS_dump_verify) {
+    if (stfs_device && stfs_device->has_block_hashes()) {
+      verify_device = stfs_device;
+    } else {
+      XELOGW("Only STFS packages have block hashes, not verifying");
+    }
+  }
+
+  // Run through all the files, breadth-first style, creating the directories
+  // up front and listing the files for the workers.
+  std::vector<vfs::Entry*> files;
+  uint64_t total_size = 0;
   std::queue<vfs::Entry*> queue;
   auto root = device->ResolvePath("/");
   queue.push(root);
-
-  // Allocate a buffer when needed.
-  size_t buffer_size = 0;
-  uint8_t* buffer = nullptr;
-
   while (!queue.empty()) {
     auto entry = queue.front();
     queue.pop();
@@ -54,53 +190,92 @@ int vfs_dump_main(const std::vector<std::wstring>& args) {
     }
 
     XELOGI("%s", entry->path().c_str());
-    auto dest_name = xe::join_paths(base_path, xe::to_wstring(entry->path()));
     if (entry->attributes() & kFileAttributeDirectory) {
-      xe::filesystem::CreateFolder(dest_name + L"\\");
-      continue;
-    }
-
-    vfs::File* in_file = nullptr;
-    if (entry->Open(FileAccess::kFileReadData, &in_file) != X_STATUS_SUCCESS) {
+      auto dest_name =
+          xe::join_paths(base_path, xe::to_wstring(entry->path()));
+      xe::filesystem::CreateFolder(dest_name + xe::kWPathSeparator);
       continue;
     }
+    files.push_back(entry);
+    total_size += entry->size();
+  }
+  // Largest first, so that no thread is left alone with a big one at the end.
+  std::stable_sort(files.begin(), files.end(),
+                   [](vfs::Entry* a, vfs::Entry* b) {
+                     return a->size() > b->size();
+                   });
 
-    auto file = xe::filesystem::OpenFile(dest_name, "wb");
-    if (!file) {
-      in_file->Destroy();
-      continue;
-    }
+  uint32_t thread_count = FLAGS_dump_threads > 0
+                              ? uint32_t(FLAGS_dump_threads)
+                              : xe::threading::logical_processor_count();
+  thread_count =
+      uint32_t(std::max(std::min(size_t(thread_count), files.size()),
+                        size_t(1)));
+  size_t buffer_size =
+      xe::round_up(size_t(std::max(FLAGS_dump_buffer_kb, 4)) * 1024,
+                   kBufferAlignment);
+  XELOGI("Extracting %zu files, %.1f MB, on %u threads", files.size(),
+         total_size / (1024.0 * 1024.0), thread_count);
 
-    if (entry->can_map()) {
-      auto map = entry->OpenMapped(xe::MappedMemory::Mode::kRead);
-      fwrite(map->data(), map->size(), 1, file);
-      map->Close();
-    } else {
-      // Can't map the file into memory. Read it into a temporary buffer.
-      if (!buffer || entry->size() > buffer_size) {
-        // Resize the buffer.
-        if (buffer) {
-          delete[] buffer;
-        }
-
-        // Allocate a buffer rounded up to the nearest 512MB.
-        buffer_size = xe::round_up(entry->size(), 512 * 1024 * 1024);
-        buffer = new uint8_t[buffer_size];
+  DumpTotals totals;
+  std::atomic<size_t> next_index(0);
+  std::mutex done_mutex;
+  std::condition_variable done_cond;
+  uint32_t running_count = thread_count;
+  auto worker = [&]() {
+    std::vector<uint8_t> storage(buffer_size + kBufferAlignment);
+    auto buffer = reinterpret_cast<uint8_t*>(
+        xe::round_up(reinterpret_cast<uintptr_t>(storage.data()),
+                     kBufferAlignment));
+    for (size_t i; (i = next_index.fetch_add(1)) < files.size();) {
+      auto entry = files[i];
+      auto dest_name =
+          xe::join_paths(base_path, xe::to_wstring(entry->path()));
+      if (!DumpFile(entry, dest_name, verify_device, buffer, buffer_size,
+                    &totals)) {
+        totals.failed_count.fetch_add(1, std::memory_order_relaxed);
       }
-
-      size_t bytes_read = 0;
-      in_file->ReadSync(buffer, entry->size(), 0, &bytes_read);
-      fwrite(buffer, bytes_read, 1, file);
+      totals.file_count.fetch_add(1, std::memory_order_relaxed);
     }
-
-    fclose(file);
-    in_file->Destroy();
+    std::lock_guard<std::mutex> lock(done_mutex);
+    if (!--running_count) {
+      done_cond.notify_all();
+    }
+  };
+  auto start_time = std::chrono::steady_clock::now();
+  std::vector<std::thread> threads;
+  for (uint32_t i = 0; i < thread_count; ++i) {
+    threads.emplace_back(worker);
   }
 
-  if (buffer) {
-    delete[] buffer;
+  // Report progress every second until the workers are done.
+  auto report = [&](const char* what) {
+    double seconds = std::chrono::duration<double>(
+                         std::chrono::steady_clock::now() - start_time)
+                         .count();
+    double megabytes = totals.byte_count.load() / (1024.0 * 1024.0);
+    XELOGI("%s %zu/%zu files, %.1f/%.1f MB, %.1f MB/s", what,
+           totals.file_count.load(), files.size(), megabytes,
+           total_size / (1024.0 * 1024.0),
+           seconds > 0 ? megabytes / seconds : 0.0);
+  };
+  {
+    std::unique_lock<std::mutex> lock(done_mutex);
+    while (!done_cond.wait_for(lock, std::chrono::seconds(1),
+                               [&]() { return !running_count; })) {
+      report("Extracted");
+    }
   }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  report("Done:");
 
+  size_t failed_count = totals.failed_count.load();
+  if (failed_count) {
+    XELOGE("%zu files failed to extract", failed_count);
+    return 1;
+  }
   return 0;
 }
 
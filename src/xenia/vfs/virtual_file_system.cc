@@ -9,45 +9,106 @@
 
 #include "xenia/vfs/virtual_file_system.h"
 
+#include <algorithm>
+
 #include "xenia/base/filesystem.h"
 #include "xenia/base/logging.h"
 #include "xenia/base/string.h"
+#include "xenia/base/string_buffer.h"
 #include "xenia/kernel/xfile.h"
+#include "xenia/vfs/io_stats.h"
+#include "xenia/vfs/preloader.h"
+#include "xenia/vfs/readahead.h"
 
 namespace xe {
 namespace vfs {
 
+// Resolved paths are dropped all at once beyond this, bounding what aliases
+// of the same entries can accumulate.
+const size_t kMaxResolvedPaths = 64 * 1024;
+
 VirtualFileSystem::VirtualFileSystem() {}
 
 VirtualFileSystem::~VirtualFileSystem() {
   // Delete all devices.
   // This will explode if anyone is still using data from them.
+  StopPreload();
+  InvalidateResolvedPaths();
+  auto stats = Readahead::GetStats();
+  if (stats.read_count) {
+    XELOGI("VFS readahead: %llu reads, %.1f%% hits, %llu prefetches (%llu KB)",
+           static_cast<unsigned long long>(stats.read_count),
+           100.0 * stats.hit_count / stats.read_count,
+           static_cast<unsigned long long>(stats.prefetch_count),
+           static_cast<unsigned long long>(stats.prefetch_bytes / 1024));
+  }
+  if (IoStats::is_enabled()) {
+    StringBuffer io_stats;
+    IoStats::Dump(&io_stats);
+    // A line at a time, as there may be more than fits in one log line.
+    auto text = io_stats.to_string();
+    for (size_t start = 0, end; start < text.size(); start = end + 1) {
+      end = std::min(text.find('\n', start), text.size());
+      XELOGI("%s", text.substr(start, end - start).c_str());
+    }
+  }
+  devices_by_path_.clear();
   devices_.clear();
   symlinks_.clear();
 }
 
 bool VirtualFileSystem::RegisterDevice(std::unique_ptr<Device> device) {
   auto global_lock = global_critical_region_.Acquire();
+  devices_by_path_.emplace(xe::to_lower_ascii(device->mount_path()),
+                           device.get());
   devices_.emplace_back(std::move(device));
+  InvalidateResolvedPaths();
   return true;
 }
 
 bool VirtualFileSystem::UnregisterDevice(const std::string& path) {
+  // It may be reading from the device.
+  StopPreload();
   auto global_lock = global_critical_region_.Acquire();
   for (auto it = devices_.begin(); it != devices_.end(); ++it) {
     if ((*it)->mount_path() == path) {
       XELOGD("Unregistered device: %s", (*it)->mount_path().c_str());
+      InvalidateResolvedPaths();
+      auto key = xe::to_lower_ascii((*it)->mount_path());
+      auto by_path_it = devices_by_path_.find(key);
+      if (by_path_it != devices_by_path_.end() &&
+          by_path_it->second == it->get()) {
+        devices_by_path_.erase(by_path_it);
+      }
       devices_.erase(it);
+      for (auto& device : devices_) {
+        if (xe::to_lower_ascii(device->mount_path()) == key) {
+          devices_by_path_.emplace(key, device.get());
+          break;
+        }
+      }
       return true;
     }
   }
   return false;
 }
 
+bool VirtualFileSystem::StartPreload(const std::wstring& access_log_path) {
+  StopPreload();
+  preloader_ = std::make_unique<Preloader>(this);
+  return preloader_->Start(access_log_path);
+}
+
+void VirtualFileSystem::StopPreload() {
+  // Not under the global critical region, the preload thread takes it.
+  preloader_.reset();
+}
+
 bool VirtualFileSystem::RegisterSymbolicLink(const std::string& path,
                                              const std::string& target) {
   auto global_lock = global_critical_region_.Acquire();
   symlinks_.insert({path, target});
+  InvalidateResolvedPaths();
   XELOGD("Registered symbolic link: %s => %s", path.c_str(), target.c_str());
 
   return true;
@@ -63,6 +124,7 @@ bool VirtualFileSystem::UnregisterSymbolicLink(const std::string& path) {
          it->second.c_str());
 
   symlinks_.erase(it);
+  InvalidateResolvedPaths();
   return true;
 }
 
@@ -76,11 +138,44 @@ bool VirtualFileSystem::IsSymbolicLink(const std::string& path) {
 }
 
 Entry* VirtualFileSystem::ResolvePath(const std::string& path) {
-  auto global_lock = global_critical_region_.Acquire();
-
   // Resolve relative paths
   std::string normalized_path(xe::filesystem::CanonicalizePath(path));
 
+  auto key = xe::to_lower_ascii(normalized_path);
+  uint64_t generation;
+  uint64_t detached_generation = Device::detached_entries_generation();
+  {
+    auto cache_lock = resolve_cache_lock_.Acquire();
+    auto it = resolved_paths_.find(key);
+    if (it != resolved_paths_.end()) {
+      if (it->second.detached_generation == detached_generation) {
+        return it->second.entry;
+      }
+      // A device dropped entries since, maybe this one.
+      resolved_paths_.erase(it);
+    }
+    generation = resolved_paths_generation_;
+  }
+
+  auto entry = ResolvePathUncached(normalized_path, path);
+  if (entry) {
+    auto cache_lock = resolve_cache_lock_.Acquire();
+    if (generation == resolved_paths_generation_) {
+      if (resolved_paths_.size() >= kMaxResolvedPaths) {
+        resolved_paths_.clear();
+      }
+      resolved_paths_.emplace(std::move(key),
+                              ResolvedPath{entry, detached_generation});
+    }
+  }
+  return entry;
+}
+
+Entry* VirtualFileSystem::ResolvePathUncached(
+    const std::string& canonical_path, const std::string& path) {
+  auto global_lock = global_critical_region_.Acquire();
+  std::string normalized_path(canonical_path);
+
   // Resolve symlinks.
   std::string device_path;
   std::string relative_path;
@@ -120,11 +215,9 @@ Entry* VirtualFileSystem::ResolvePath(const std::string& path) {
     return nullptr;
   }
 
-  // Scan all devices.
-  for (auto& device : devices_) {
-    if (strcasecmp(device_path.c_str(), device->mount_path().c_str()) == 0) {
-      return device->ResolvePath(relative_path);
-    }
+  auto device_it = devices_by_path_.find(xe::to_lower_ascii(device_path));
+  if (device_it != devices_by_path_.end()) {
+    return device_it->second->ResolvePath(relative_path);
   }
 
   XELOGE("ResolvePath(%s) failed - device not found (%s)", path.c_str(),
@@ -132,6 +225,12 @@ Entry* VirtualFileSystem::ResolvePath(const std::string& path) {
   return nullptr;
 }
 
+void VirtualFileSystem::InvalidateResolvedPaths() {
+  auto cache_lock = resolve_cache_lock_.Acquire();
+  resolved_paths_.clear();
+  ++resolved_paths_generation_;
+}
+
 Entry* VirtualFileSystem::ResolveBasePath(const std::string& path) {
   auto base_path = xe::find_base_path(path);
   return ResolvePath(base_path);
@@ -171,12 +270,22 @@ bool VirtualFileSystem::DeletePath(const std::string& path) {
   if (!entry) {
     return false;
   }
-  auto parent = entry->parent();
-  if (!parent) {
+  if (!entry->parent()) {
     // Can't delete root.
     return false;
   }
-  return parent->Delete(entry);
+  return DeleteEntry(entry);
+}
+
+bool VirtualFileSystem::DeleteEntry(Entry* entry) {
+  // Held across both so that no lookup can resolve the entry in between and
+  // cache it again.
+  auto global_lock = global_critical_region_.Acquire();
+  if (!entry->Delete()) {
+    return false;
+  }
+  InvalidateResolvedPaths();
+  return true;
 }
 
 X_STATUS VirtualFileSystem::OpenFile(const std::string& path,
@@ -261,7 +370,7 @@ X_STATUS VirtualFileSystem::OpenFile(const std::string& path,
         return X_STATUS_ACCESS_DENIED;
       case FileDisposition::kSuperscede:
         // Replace (by delete + recreate).
-        if (!entry->Delete()) {
+        if (!DeleteEntry(entry)) {
           return X_STATUS_ACCESS_DENIED;
         }
         entry = nullptr;
@@ -275,7 +384,7 @@ X_STATUS VirtualFileSystem::OpenFile(const std::string& path,
       case FileDisposition::kOverwrite:
       case FileDisposition::kOverwriteIf:
         // Overwrite (we do by delete + recreate).
-        if (!entry->Delete()) {
+        if (!DeleteEntry(entry)) {
           return X_STATUS_ACCESS_DENIED;
         }
         entry = nullptr;
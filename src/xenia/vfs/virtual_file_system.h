@@ -23,6 +23,8 @@
 namespace xe {
 namespace vfs {
 
+class Preloader;
+
 class VirtualFileSystem {
  public:
   VirtualFileSystem();
@@ -46,10 +48,39 @@ class VirtualFileSystem {
                     uint32_t desired_access, File** out_file,
                     FileAction* out_action);
 
+  // Replays the reads of an access log in the background, see Preloader.
+  // Stops any preload still running first.
+  bool StartPreload(const std::wstring& access_log_path);
+  void StopPreload();
+
  private:
+  Entry* ResolvePathUncached(const std::string& canonical_path,
+                             const std::string& path);
+  // Deletes the entry from its parent and any cached path to it.
+  bool DeleteEntry(Entry* entry);
+  // Drops every resolved path, after entries were created or deleted or the
+  // mappings to devices changed.
+  void InvalidateResolvedPaths();
+
   xe::global_critical_region global_critical_region_;
   std::vector<std::unique_ptr<Device>> devices_;
+  // devices_ by lowercased mount path.
+  std::unordered_map<std::string, Device*> devices_by_path_;
   std::unordered_map<std::string, std::string> symlinks_;
+  std::unique_ptr<Preloader> preloader_;
+
+  // Entries previously resolved, by lowercased canonical path. Only hits are
+  // cached. A leaf lock, so lookups don't take the global critical region.
+  xe::subsystem_mutex resolve_cache_lock_{"vfs/resolve_cache"};
+  struct ResolvedPath {
+    Entry* entry;
+    // Device::detached_entries_generation() before it was resolved.
+    uint64_t detached_generation;
+  };
+  std::unordered_map<std::string, ResolvedPath> resolved_paths_;
+  // Bumped by every invalidation, so that lookups racing with one don't
+  // cache what they resolved before it.
+  uint64_t resolved_paths_generation_ = 0;
 };
 
 }  // namespace vfs